@@ -0,0 +1,173 @@
+/**
+ * \file csum_bench.c
+ * \brief Check the implementations of csum_add (see csum.h) against
+ *    csum_add_scalar, and time them.
+ *
+ * Each implementation supported by the CPU is selected in turn (see
+ * csum_set_implementation), and csum_add is compared with csum_add_scalar:
+ * - for every length in [0, CSUM_BENCH_NUM_SHORT] and in
+ *   [CSUM_BENCH_MAX_SIZE - CSUM_BENCH_NUM_LONG, CSUM_BENCH_MAX_SIZE],
+ *   starting at every offset in [0, CSUM_BENCH_MAX_OFFSET];
+ * - for NUM_CHECKS random lengths in [0, CSUM_BENCH_MAX_SIZE], starting
+ *   at a random offset in [0, CSUM_BENCH_MAX_OFFSET].
+ * Each check is made on random bytes and on 0xff bytes (whose sum
+ * overflows the most when the carries are folded), starting from a sum
+ * of 0, 0xffff and a random sum.
+ *
+ * Note that csum_add hands the inputs shorter than CSUM_SIMD_MIN_SIZE
+ * (see csum.c) to csum_add_scalar, whatever the selected implementation.
+ *
+ * The best of CSUM_BENCH_NUM_ROUNDS rounds of csum_add over
+ * CSUM_BENCH_TIMED_SIZE bytes is then reported in nanoseconds per call.
+ *
+ * Usage: csum_bench [NUM_CHECKS]
+ *
+ * The driver fails if any implementation disagrees with csum_add_scalar.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>         // malloc, free, atoi
+#include <stdio.h>          // printf, fprintf
+#include <stdint.h>         // uint*_t, UINT64_MAX
+#include <string.h>         // memset
+
+#include "common.h"         // get_time_ns
+#include "csum.h"           // csum_*
+
+#define CSUM_BENCH_NUM_CHECKS  10000
+#define CSUM_BENCH_MAX_SIZE    65535
+#define CSUM_BENCH_MAX_OFFSET  16
+#define CSUM_BENCH_NUM_SHORT   256
+#define CSUM_BENCH_NUM_LONG    64
+#define CSUM_BENCH_TIMED_SIZE  1500
+#define CSUM_BENCH_NUM_CALLS   100000
+#define CSUM_BENCH_NUM_ROUNDS  5
+
+// The implementations of csum_add (see csum_set_implementation).
+static const char * implementations[] = {"scalar", "sse2", "avx2", "neon"};
+
+/**
+ * \brief Pseudo-random number generator (xorshift64), so that the
+ *    checks are reproducible.
+ * \param state The state of the generator.
+ * \return The next pseudo-random number.
+ */
+
+static uint64_t bench_random(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * \brief Compare csum_add with csum_add_scalar over a sequence of bytes,
+ *    starting from several sums.
+ * \param bytes The bytes.
+ * \param size Number of bytes.
+ * \param sum A sum, in addition to 0 and 0xffff.
+ * \return The number of mismatches.
+ */
+
+static size_t bench_check(const uint8_t * bytes, size_t size, uint16_t sum) {
+    const uint16_t sums[] = {0, 0xffff, sum};
+    uint16_t       expected, result;
+    size_t         i, num_mismatches = 0;
+
+    for (i = 0; i < sizeof(sums) / sizeof(sums[0]); i++) {
+        expected = csum_add_scalar(sums[i], bytes, size);
+        if ((result = csum_add(sums[i], bytes, size)) != expected) {
+            fprintf(stderr, "%s: size %zu, start %p, sum 0x%04x: 0x%04x instead of 0x%04x\n",
+                csum_get_implementation(), size, (const void *) bytes, sums[i], result, expected
+            );
+            num_mismatches++;
+        }
+    }
+    return num_mismatches;
+}
+
+/**
+ * \brief Time csum_add over CSUM_BENCH_TIMED_SIZE bytes.
+ * \param bytes The bytes.
+ * \return The best time of a call, in nanoseconds.
+ */
+
+static double bench_time(const uint8_t * bytes) {
+    volatile uint16_t sum = 0;
+    uint64_t          start, elapsed, best = UINT64_MAX;
+    size_t            i, j;
+
+    for (i = 0; i < CSUM_BENCH_NUM_ROUNDS; i++) {
+        start = get_time_ns();
+        for (j = 0; j < CSUM_BENCH_NUM_CALLS; j++) {
+            sum = csum_add(sum, bytes, CSUM_BENCH_TIMED_SIZE);
+        }
+        if ((elapsed = get_time_ns() - start) < best) best = elapsed;
+    }
+    return (double) best / CSUM_BENCH_NUM_CALLS;
+}
+
+int main(int argc, char ** argv)
+{
+    int             exit_code = EXIT_FAILURE;
+    uint8_t       * buffers[2];
+    const uint8_t * bytes;
+    uint64_t        state = 0x9e3779b97f4a7c15ULL;
+    size_t          num_checks = CSUM_BENCH_NUM_CHECKS,
+                    buffer_size = CSUM_BENCH_MAX_OFFSET + CSUM_BENCH_MAX_SIZE,
+                    num_mismatches = 0,
+                    i, j, k, size;
+
+    if (argc > 2 || (argc == 2 && (num_checks = atoi(argv[1])) <= 0)) {
+        fprintf(stderr, "usage: %s [NUM_CHECKS]\n", argv[0]);
+        goto ERR_USAGE;
+    }
+
+    // Random bytes, and 0xff bytes
+    if (!(buffers[0] = malloc(buffer_size))) goto ERR_MALLOC_RANDOM;
+    if (!(buffers[1] = malloc(buffer_size))) goto ERR_MALLOC_ONES;
+    for (i = 0; i < buffer_size; i++) {
+        buffers[0][i] = (uint8_t) bench_random(&state);
+    }
+    memset(buffers[1], 0xff, buffer_size);
+
+    for (i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        if (!csum_set_implementation(implementations[i])) {
+            printf("%-6s not supported\n", implementations[i]);
+            continue;
+        }
+
+        for (j = 0; j < 2; j++) {
+            for (k = 0; k <= CSUM_BENCH_MAX_OFFSET; k++) {
+                for (size = 0; size <= CSUM_BENCH_NUM_SHORT; size++) {
+                    num_mismatches += bench_check(buffers[j] + k, size, bench_random(&state));
+                }
+                for (size = 0; size <= CSUM_BENCH_NUM_LONG; size++) {
+                    num_mismatches += bench_check(buffers[j] + k, CSUM_BENCH_MAX_SIZE - size, bench_random(&state));
+                }
+            }
+        }
+
+        for (j = 0; j < num_checks; j++) {
+            bytes = buffers[bench_random(&state) & 1] + bench_random(&state) % (CSUM_BENCH_MAX_OFFSET + 1);
+            size  = bench_random(&state) % (CSUM_BENCH_MAX_SIZE + 1);
+            num_mismatches += bench_check(bytes, size, bench_random(&state));
+        }
+
+        printf("%-6s %8.1f ns per %d bytes\n", implementations[i], bench_time(buffers[0]), CSUM_BENCH_TIMED_SIZE);
+    }
+
+    if (num_mismatches) {
+        fprintf(stderr, "FAIL: %zu mismatches\n", num_mismatches);
+    } else {
+        exit_code = EXIT_SUCCESS;
+    }
+
+    free(buffers[1]);
+ERR_MALLOC_ONES:
+    free(buffers[0]);
+ERR_MALLOC_RANDOM:
+ERR_USAGE:
+    exit(exit_code);
+}
@@ -0,0 +1,401 @@
+/**
+ * \file probe_bench.c
+ * \brief Microbenchmarks of the probe crafting and of the reply parsing.
+ *
+ * Each benchmark is run over IPv4/IPv6 x UDP/TCP/ICMP. It prepares
+ * num_ops probes (or packets), then times num_ops calls of the measured
+ * operation, BENCH_NUM_ROUNDS times. The best round is reported in
+ * nanoseconds per operation, along with the number of allocations
+ * (malloc, calloc, realloc) per operation.
+ *
+ * Usage: probe_bench [NUM_OPS]
+ *
+ * The "tag" benchmark requires a network_t instance, hence root
+ * privileges (raw sockets). It is skipped otherwise.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>         // malloc, free, atoi
+#include <stdio.h>          // printf, fprintf
+#include <stdbool.h>        // bool
+#include <string.h>         // strcmp
+#include <sys/socket.h>     // AF_INET, AF_INET6
+
+#include "address.h"        // address_t
+#include "common.h"         // get_time_ns, MIN
+#include "field.h"          // I8, I16, ADDRESS
+#include "network.h"        // network_t, network_tag_probe
+#include "packet.h"         // packet_t
+#include "probe.h"          // probe_t
+#include "tag_allocator.h"  // tag_allocator_*
+
+#define BENCH_NUM_OPS    10000
+#define BENCH_NUM_ROUNDS 5
+
+// The tags in use cannot exceed 2^NETWORK_DEFAULT_TAG_BITS
+#define BENCH_MAX_TAGS   (1 << (NETWORK_DEFAULT_TAG_BITS - 1))
+
+//---------------------------------------------------------------------------
+// Allocation counter
+//---------------------------------------------------------------------------
+
+// The allocators of the libc are overridden by the following ones, which
+// count the allocations made by the library.
+
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t num, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static size_t num_allocs = 0;
+
+void * malloc(size_t size) {
+    num_allocs++;
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t num, size_t size) {
+    num_allocs++;
+    return __libc_calloc(num, size);
+}
+
+void * realloc(void * ptr, size_t size) {
+    num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+//---------------------------------------------------------------------------
+// Benchmarks
+//---------------------------------------------------------------------------
+
+/**
+ * \struct bench_case_t
+ * \brief A kind of probe.
+ */
+
+typedef struct {
+    int          family;         /**< AF_INET or AF_INET6 */
+    const char * ip_name;        /**< "ipv4" or "ipv6" */
+    const char * protocol_name;  /**< The transport protocol of the probe */
+    const char * icmp_name;      /**< The protocol of the replies */
+    uint8_t      icmp_type;      /**< The type of the replies (time exceeded) */
+    const char * src_ip;         /**< Source of the probes */
+    const char * dst_ip;         /**< Destination of the probes */
+    const char * hop_ip;         /**< Source of the replies */
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+    {AF_INET,  "ipv4", "udp",    "icmpv4", 11, "198.51.100.1", "192.0.2.1",   "203.0.113.1"},
+    {AF_INET,  "ipv4", "tcp",    "icmpv4", 11, "198.51.100.1", "192.0.2.1",   "203.0.113.1"},
+    {AF_INET,  "ipv4", "icmpv4", "icmpv4", 11, "198.51.100.1", "192.0.2.1",   "203.0.113.1"},
+    {AF_INET6, "ipv6", "udp",    "icmpv6", 3,  "2001:db8::1",  "2001:db8::2", "2001:db8::3"},
+    {AF_INET6, "ipv6", "tcp",    "icmpv6", 3,  "2001:db8::1",  "2001:db8::2", "2001:db8::3"},
+    {AF_INET6, "ipv6", "icmpv6", "icmpv6", 3,  "2001:db8::1",  "2001:db8::2", "2001:db8::3"},
+};
+
+/**
+ * \struct bench_state_t
+ * \brief The data shared by the callbacks of a benchmark.
+ */
+
+typedef struct {
+    const bench_case_t * bench_case;   /**< The kind of probe */
+    probe_t            * skel;         /**< The probe skeleton */
+    packet_t           * reply;        /**< A reply to skel */
+    network_t          * network;      /**< See network_tag_probe, NULL if unavailable */
+    probe_t           ** probes;       /**< The probes handled by the benchmark */
+    packet_t          ** packets;      /**< The packets handled by the benchmark */
+    size_t               num_ops;      /**< Number of operations per round */
+} bench_state_t;
+
+/**
+ * \struct bench_t
+ * \brief A benchmark. setup and teardown are not timed.
+ */
+
+typedef struct {
+    const char * name;
+    bool      (* setup)(bench_state_t * state, size_t i);    /**< Prepare the i-th operation (may be NULL) */
+    bool      (* op)(bench_state_t * state, size_t i);       /**< The i-th measured operation */
+    void      (* teardown)(bench_state_t * state, size_t i); /**< Release the i-th operation (may be NULL) */
+} bench_t;
+
+// The flow identifier is carried by the source port, hence is only set
+// in the probes having ports
+static bool set_fields(bench_state_t * state, size_t i) {
+    const bench_case_t * bench_case = state->bench_case;
+
+    return strcmp(bench_case->protocol_name, bench_case->icmp_name) != 0 ?
+        probe_set_fields(state->probes[i], I8("ttl", 1 + i % 32), I16("flow_id", i), NULL) :
+        probe_set_fields(state->probes[i], I8("ttl", 1 + i % 32), NULL);
+}
+
+static bool setup_dup(bench_state_t * state, size_t i) {
+    return (state->probes[i] = probe_dup(state->skel)) != NULL;
+}
+
+static bool setup_dup_set_fields(bench_state_t * state, size_t i) {
+    return setup_dup(state, i)
+        && set_fields(state, i);
+}
+
+static bool setup_dup_update_fields(bench_state_t * state, size_t i) {
+    return setup_dup(state, i)
+        && probe_update_fields(state->probes[i]);
+}
+
+static bool setup_packet(bench_state_t * state, size_t i) {
+    return (state->packets[i] = packet_dup(state->reply)) != NULL;
+}
+
+static bool setup_wrap(bench_state_t * state, size_t i) {
+    return setup_packet(state, i)
+        && (state->probes[i] = probe_wrap_packet(state->packets[i])) != NULL;
+}
+
+static void teardown_probe(bench_state_t * state, size_t i) {
+    probe_free(state->probes[i]);
+}
+
+static bool op_create(bench_state_t * state, size_t i) {
+    return (state->probes[i] = probe_create())
+        && probe_set_protocols(state->probes[i], state->bench_case->ip_name, state->bench_case->protocol_name, NULL);
+}
+
+static bool op_set_fields(bench_state_t * state, size_t i) {
+    return set_fields(state, i);
+}
+
+static bool op_update_checksum(bench_state_t * state, size_t i) {
+    return probe_update_checksum(state->probes[i]);
+}
+
+static bool op_tag(bench_state_t * state, size_t i) {
+    return network_tag_probe(state->network, state->probes[i]);
+}
+
+static bool op_wrap(bench_state_t * state, size_t i) {
+    return (state->probes[i] = probe_wrap_packet(state->packets[i])) != NULL;
+}
+
+static bool op_extract(bench_state_t * state, size_t i) {
+    address_t src_ip;
+    uint16_t  checksum;
+
+    // What the network layer extracts to match a reply (see reply_extract_tag)
+    return probe_extract(state->probes[i], "src_ip", &src_ip)
+        && probe_extract_ext(state->probes[i], "checksum", 3, &checksum);
+}
+
+static const bench_t benches[] = {
+    {"create",          NULL,                    op_create,          teardown_probe},
+    {"set_fields",      setup_dup,               op_set_fields,      teardown_probe},
+    {"update_checksum", setup_dup_set_fields,    op_update_checksum, teardown_probe},
+    {"tag",             setup_dup_update_fields, op_tag,             teardown_probe},
+    {"wrap_packet",     setup_packet,            op_wrap,            teardown_probe},
+    {"extract",         setup_wrap,              op_extract,         teardown_probe},
+};
+
+/**
+ * \brief Run a benchmark.
+ * \param bench The benchmark.
+ * \param state The state of the benchmark.
+ * \param pns_per_op Where the best number of nanoseconds per operation is written.
+ * \param pallocs_per_op Where the number of allocations per operation is written.
+ * \return true iif successful.
+ */
+
+static bool bench_run(const bench_t * bench, bench_state_t * state, double * pns_per_op, double * pallocs_per_op)
+{
+    size_t   round, i, num_ops = state->num_ops, num_allocs_start;
+    uint64_t start, elapsed, best = UINT64_MAX;
+    bool     ret = true;
+
+    // The tags in use are released once the round is over
+    if (bench->op == op_tag) num_ops = MIN(num_ops, BENCH_MAX_TAGS);
+
+    for (round = 0; round < BENCH_NUM_ROUNDS && ret; round++) {
+        memset(state->probes,  0, num_ops * sizeof(probe_t *));
+        memset(state->packets, 0, num_ops * sizeof(packet_t *));
+        for (i = 0; i < num_ops && ret; i++) {
+            if (bench->setup) ret = bench->setup(state, i);
+        }
+
+        num_allocs_start = num_allocs;
+        start = get_time_ns();
+        for (i = 0; i < num_ops && ret; i++) {
+            ret = bench->op(state, i);
+        }
+        elapsed = get_time_ns() - start;
+        *pallocs_per_op = (double) (num_allocs - num_allocs_start) / num_ops;
+        if (elapsed < best) best = elapsed;
+
+        for (i = 0; i < num_ops; i++) {
+            if (state->probes[i]) {
+                if (bench->teardown) bench->teardown(state, i);
+            } else if (state->packets[i]) {
+                packet_free(state->packets[i]);
+            }
+        }
+        if (bench->op == op_tag) {
+            tag_allocator_free(state->network->tags);
+            if (!(state->network->tags = tag_allocator_create(NETWORK_DEFAULT_TAG_BITS))) ret = false;
+        }
+    }
+
+    *pns_per_op = (double) best / num_ops;
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// Probes
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Create the probe skeleton of a bench_case_t.
+ * \param bench_case The kind of probe.
+ * \return The probe skeleton, NULL in case of failure.
+ */
+
+static probe_t * make_skel(const bench_case_t * bench_case)
+{
+    probe_t   * skel;
+    address_t   src_ip, dst_ip;
+
+    if (address_from_string(bench_case->family, bench_case->src_ip, &src_ip) != 0
+    ||  address_from_string(bench_case->family, bench_case->dst_ip, &dst_ip) != 0
+    || !(skel = probe_create())) {
+        goto ERR_PROBE_CREATE;
+    }
+
+    if (!probe_set_protocols(skel, bench_case->ip_name, bench_case->protocol_name, NULL)
+    ||  !probe_set_fields(skel, ADDRESS("src_ip", &src_ip), ADDRESS("dst_ip", &dst_ip), NULL)
+    ||  (strcmp(bench_case->protocol_name, bench_case->icmp_name) != 0
+        && !(probe_set_fields(skel, I16("src_port", 3083), I16("dst_port", 33457), NULL)
+          // The tag is written in the payload (see paris-traceroute.c)
+          && probe_payload_resize(skel, 2)))
+    ||  !probe_update_fields(skel)) {
+        goto ERR_SET_FIELDS;
+    }
+    return skel;
+
+ERR_SET_FIELDS:
+    probe_free(skel);
+ERR_PROBE_CREATE:
+    return NULL;
+}
+
+/**
+ * \brief Create the ICMP time exceeded reply to a probe.
+ * \param bench_case The kind of probe.
+ * \param probe The probe.
+ * \return The packet of the reply, NULL in case of failure.
+ */
+
+static packet_t * make_reply(const bench_case_t * bench_case, probe_t * probe)
+{
+    probe_t   * reply;
+    packet_t  * packet = NULL;
+    address_t   src_ip, dst_ip;
+
+    if (address_from_string(bench_case->family, bench_case->hop_ip, &src_ip) != 0
+    ||  address_from_string(bench_case->family, bench_case->src_ip, &dst_ip) != 0
+    || !(reply = probe_create())) {
+        goto ERR_PROBE_CREATE;
+    }
+
+    if (probe_set_protocols(reply, bench_case->ip_name, bench_case->icmp_name, NULL)
+    &&  probe_set_fields(reply,
+            ADDRESS("src_ip", &src_ip), ADDRESS("dst_ip", &dst_ip),
+            I8("type", bench_case->icmp_type), I8("code", 0), NULL)
+    &&  probe_write_payload(reply, packet_get_bytes(probe->packet), packet_get_size(probe->packet))
+    &&  probe_update_fields(reply)) {
+        packet = packet_dup(reply->packet);
+    }
+
+    probe_free(reply);
+ERR_PROBE_CREATE:
+    return packet;
+}
+
+/**
+ * \brief Run every benchmark over a kind of probe and print the results.
+ * \param state The state of the benchmarks, whose bench_case is set.
+ * \return true iif successful.
+ */
+
+static bool bench_case_run(bench_state_t * state)
+{
+    const bench_case_t * bench_case = state->bench_case;
+    char                 case_name[32];
+    double               ns_per_op, allocs_per_op;
+    size_t               i;
+    bool                 ret = false;
+
+    snprintf(case_name, sizeof(case_name), "%s/%s", bench_case->ip_name, bench_case->protocol_name);
+
+    if (!(state->skel = make_skel(bench_case))) {
+        fprintf(stderr, "%s: cannot create the probe skeleton\n", case_name);
+        goto ERR_MAKE_SKEL;
+    }
+    if (!(state->reply = make_reply(bench_case, state->skel))) {
+        fprintf(stderr, "%s: cannot create the reply\n", case_name);
+        goto ERR_MAKE_REPLY;
+    }
+
+    for (i = 0; i < sizeof(benches) / sizeof(bench_t); i++) {
+        if (benches[i].op == op_tag && !state->network) continue;
+        if (!bench_run(&benches[i], state, &ns_per_op, &allocs_per_op)) {
+            fprintf(stderr, "%s %s: failed\n", benches[i].name, case_name);
+            goto ERR_BENCH_RUN;
+        }
+        printf("%-16s %-12s %12.1f %12.2f\n", benches[i].name, case_name, ns_per_op, allocs_per_op);
+    }
+    ret = true;
+
+ERR_BENCH_RUN:
+    packet_free(state->reply);
+ERR_MAKE_REPLY:
+    probe_free(state->skel);
+ERR_MAKE_SKEL:
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// Main program
+//---------------------------------------------------------------------------
+
+int main(int argc, char ** argv)
+{
+    int           exit_code = EXIT_FAILURE;
+    bench_state_t state;
+    size_t        i;
+
+    state.num_ops = argc > 1 ? (size_t) atoi(argv[1]) : BENCH_NUM_OPS;
+    if (!state.num_ops) {
+        fprintf(stderr, "usage: %s [NUM_OPS]\n", argv[0]);
+        goto ERR_USAGE;
+    }
+
+    if (!(state.probes  = malloc(state.num_ops * sizeof(probe_t *))))  goto ERR_PROBES;
+    if (!(state.packets = malloc(state.num_ops * sizeof(packet_t *)))) goto ERR_PACKETS;
+    if (!(state.network = network_create())) {
+        fprintf(stderr, "Cannot create the network layer, the tag benchmark is skipped (root privileges required)\n");
+    }
+
+    printf("%-16s %-12s %12s %12s\n", "benchmark", "probe", "ns/op", "allocs/op");
+    for (i = 0; i < sizeof(bench_cases) / sizeof(bench_case_t); i++) {
+        state.bench_case = &bench_cases[i];
+        if (!bench_case_run(&state)) goto ERR_BENCH_CASE_RUN;
+    }
+    exit_code = EXIT_SUCCESS;
+
+ERR_BENCH_CASE_RUN:
+    if (state.network) network_free(state.network);
+    free(state.packets);
+ERR_PACKETS:
+    free(state.probes);
+ERR_PROBES:
+ERR_USAGE:
+    exit(exit_code);
+}
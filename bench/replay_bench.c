@@ -0,0 +1,583 @@
+/**
+ * \file replay_bench.c
+ * \brief Replay a capture (see capture.h) through the reply path of the
+ *    network layer, to measure how many replies a loop can match and
+ *    dispatch per second regardless of the network and of the sniffer.
+ *
+ * The probes of the capture are registered in the flying probes of the
+ * network layer (see network_inject_probe), and its replies are queued
+ * in the recvq as if they had been sniffed (see network_inject_replies).
+ * The capture is replayed as fast as possible (its timestamps are ignored)
+ * by a "replay" instance which counts the matched replies.
+ *
+ * The capture may be a pcapng file (in the byte order of the host, as
+ * written by --pcap) or a pcap file. Its link type must be raw IP or
+ * Ethernet. The direction of a packet is given by its epb_flags if any;
+ * otherwise the ICMP packets other than echo requests are replies, and
+ * the other packets are probes.
+ *
+ * Usage: replay_bench [--simulate TOPOLOGY] [--tag-bits BITS] [...] FILE
+ *
+ * The network options (see network_get_options) must match the ones of
+ * the recorded measurement, in particular --tag-bits. The network layer
+ * requires root privileges (raw sockets), unless --simulate is passed.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>         // malloc, free
+#include <stdio.h>          // printf, fprintf, fopen
+#include <stdbool.h>        // bool
+#include <stdint.h>         // uint*_t
+#include <string.h>         // memcpy
+#include <libgen.h>         // basename
+#include <sys/resource.h>   // getrusage
+
+#include "algorithm.h"      // algorithm_t, ALGORITHM_REGISTER, pt_add_instance
+#include "common.h"         // get_time_ns
+#include "network.h"        // network_inject_probe, network_inject_replies
+#include "options.h"        // options_t
+#include "packet.h"         // packet_t
+#include "probe.h"          // probe_t
+#include "pt_loop.h"        // pt_loop_t
+
+// pcap and pcapng (see https://www.tcpdump.org/linktypes.html)
+#define PCAP_MAGIC_US            0xa1b2c3d4
+#define PCAP_MAGIC_NS            0xa1b23c4d
+#define PCAPNG_BLOCK_SHB         0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB         0x00000001
+#define PCAPNG_BLOCK_EPB         0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC  0x1a2b3c4d
+#define PCAPNG_OPT_ENDOFOPT      0
+#define PCAPNG_OPT_EPB_FLAGS     2
+#define LINKTYPE_ETHERNET        1
+#define LINKTYPE_RAW             101
+#define LINKTYPE_IPV4            228
+#define LINKTYPE_IPV6            229
+
+#define ETHERNET_HEADER_SIZE     14
+#define ETHERTYPE_IPV4           0x0800
+#define ETHERTYPE_IPV6           0x86dd
+
+// Maximum number of interfaces of a pcapng file
+#define REPLAY_MAX_INTERFACES    16
+
+typedef enum {
+    REPLAY_UNKNOWN,  /**< The direction must be guessed */
+    REPLAY_INBOUND,  /**< A reply */
+    REPLAY_OUTBOUND  /**< A probe */
+} replay_direction_t;
+
+//---------------------------------------------------------------------------
+// Capture reader
+//---------------------------------------------------------------------------
+
+/**
+ * \struct replay_file_t
+ * \brief A capture loaded in memory.
+ */
+
+typedef struct {
+    uint8_t  * bytes;                               /**< The content of the file */
+    size_t     size;                                /**< The size of the file */
+    size_t     offset;                              /**< The offset of the next record */
+    bool       is_pcapng;                           /**< True for pcapng, false for pcap */
+    uint32_t   linktypes[REPLAY_MAX_INTERFACES];    /**< The link type of each interface (only one for pcap) */
+    size_t     num_interfaces;                      /**< The number of interfaces */
+} replay_file_t;
+
+/**
+ * \struct replay_record_t
+ * \brief A packet of a capture.
+ */
+
+typedef struct {
+    const uint8_t      * bytes;     /**< The IP packet */
+    size_t               size;      /**< Its size (in bytes) */
+    replay_direction_t   direction; /**< Whether it is a probe or a reply */
+} replay_record_t;
+
+static inline uint16_t read_u16(const uint8_t * bytes) {
+    uint16_t value;
+
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read_u32(const uint8_t * bytes) {
+    uint32_t value;
+
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/**
+ * \brief Load a capture in memory and check its header.
+ * \param filename The path of the capture.
+ * \param file The replay_file_t instance to fill.
+ * \return true iif successful.
+ */
+
+static bool replay_file_open(const char * filename, replay_file_t * file)
+{
+    FILE     * fp;
+    long       size;
+    uint32_t   magic;
+
+    memset(file, 0, sizeof(replay_file_t));
+    if (!(fp = fopen(filename, "rb"))) {
+        perror(filename);
+        goto ERR_FOPEN;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) goto ERR_SIZE;
+    if (!(file->bytes = malloc(size ? size : 1)))                                             goto ERR_MALLOC;
+    if (fread(file->bytes, 1, size, fp) != (size_t) size)                                     goto ERR_FREAD;
+    file->size = size;
+    fclose(fp);
+
+    if (file->size < 24) goto ERR_FORMAT;
+    magic = read_u32(file->bytes);
+    if (magic == PCAPNG_BLOCK_SHB) {
+        // The section header block is read along with the other blocks
+        if (read_u32(file->bytes + 8) != PCAPNG_BYTE_ORDER_MAGIC) {
+            fprintf(stderr, "%s: only the pcapng files in the byte order of the host are supported\n", filename);
+            goto ERR_FORMAT;
+        }
+        file->is_pcapng = true;
+    } else if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+        file->linktypes[0]   = read_u32(file->bytes + 20) & 0xffff;
+        file->num_interfaces = 1;
+        file->offset         = 24;
+    } else {
+        fprintf(stderr, "%s: not a pcap or pcapng file in the byte order of the host\n", filename);
+        goto ERR_FORMAT;
+    }
+    return true;
+
+ERR_FREAD:
+ERR_MALLOC:
+ERR_SIZE:
+    fclose(fp);
+ERR_FORMAT:
+    free(file->bytes);
+    file->bytes = NULL;
+ERR_FOPEN:
+    return false;
+}
+
+static void replay_file_close(replay_file_t * file) {
+    free(file->bytes);
+}
+
+/**
+ * \brief Retrieve the IP packet carried by a frame.
+ * \param linktype The link type of the frame.
+ * \param bytes The frame.
+ * \param size The size of the frame.
+ * \param record The record in which the IP packet is written.
+ * \return true iif the frame carries an IP packet.
+ */
+
+static bool replay_record_set_frame(uint32_t linktype, const uint8_t * bytes, size_t size, replay_record_t * record)
+{
+    uint16_t ethertype;
+
+    switch (linktype) {
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+            break;
+        case LINKTYPE_ETHERNET:
+            if (size < ETHERNET_HEADER_SIZE) return false;
+            ethertype = (bytes[12] << 8) | bytes[13];
+            if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) return false;
+            bytes += ETHERNET_HEADER_SIZE;
+            size  -= ETHERNET_HEADER_SIZE;
+            break;
+        default:
+            return false;
+    }
+
+    record->bytes = bytes;
+    record->size  = size;
+    return size > 0;
+}
+
+/**
+ * \brief Guess whether an IP packet is a probe or a reply.
+ * \param record A record whose direction is REPLAY_UNKNOWN.
+ * \return The direction of the packet.
+ */
+
+static replay_direction_t replay_record_guess_direction(const replay_record_t * record)
+{
+    const uint8_t * bytes = record->bytes;
+    size_t          header_size;
+
+    switch (bytes[0] >> 4) {
+        case 4:
+            header_size = (bytes[0] & 0x0f) * 4;
+            if (record->size <= header_size || bytes[9] != 1) break;
+            return bytes[header_size] != 8 ? REPLAY_INBOUND : REPLAY_OUTBOUND;
+        case 6:
+            if (record->size <= 40 || bytes[6] != 58) break;
+            return bytes[40] != 128 ? REPLAY_INBOUND : REPLAY_OUTBOUND;
+        default:
+            break;
+    }
+    return REPLAY_OUTBOUND;
+}
+
+/**
+ * \brief Read the direction of an enhanced packet block in its options.
+ * \param bytes The options of the block.
+ * \param size The size of the options.
+ * \return The direction of the packet.
+ */
+
+static replay_direction_t pcapng_get_direction(const uint8_t * bytes, size_t size)
+{
+    uint16_t code, length;
+
+    while (size >= 4) {
+        code   = read_u16(bytes);
+        length = read_u16(bytes + 2);
+        if (code == PCAPNG_OPT_ENDOFOPT || size < 4 + length) break;
+        if (code == PCAPNG_OPT_EPB_FLAGS && length == 4) {
+            switch (read_u32(bytes + 4) & 0x3) {
+                case 1:  return REPLAY_INBOUND;
+                case 2:  return REPLAY_OUTBOUND;
+                default: return REPLAY_UNKNOWN;
+            }
+        }
+        bytes += 4 + ((length + 3) & ~3);
+        size  -= MIN(size, 4 + ((length + 3) & ~3));
+    }
+    return REPLAY_UNKNOWN;
+}
+
+/**
+ * \brief Read the next IP packet of a pcapng file.
+ * \param file A replay_file_t instance.
+ * \param record The record to fill.
+ * \return 1 if a packet has been read, 0 at the end of the file, -1 if
+ *    the file is malformed.
+ */
+
+static int pcapng_read_next(replay_file_t * file, replay_record_t * record)
+{
+    const uint8_t * block;
+    uint32_t        type, length, interface_id, caplen;
+
+    while (file->offset + 12 <= file->size) {
+        block  = file->bytes + file->offset;
+        type   = read_u32(block);
+        length = read_u32(block + 4);
+        if (length < 12 || length % 4 || file->offset + length > file->size) return -1;
+        file->offset += length;
+
+        switch (type) {
+            case PCAPNG_BLOCK_SHB:
+                // A new section redefines the interfaces
+                file->num_interfaces = 0;
+                break;
+            case PCAPNG_BLOCK_IDB:
+                if (length < 20) return -1;
+                if (file->num_interfaces < REPLAY_MAX_INTERFACES) {
+                    file->linktypes[file->num_interfaces++] = read_u16(block + 8);
+                }
+                break;
+            case PCAPNG_BLOCK_EPB:
+                if (length < 32) return -1;
+                interface_id = read_u32(block + 8);
+                caplen       = read_u32(block + 20);
+                if (caplen > length - 32 || interface_id >= file->num_interfaces) return -1;
+                if (!replay_record_set_frame(file->linktypes[interface_id], block + 28, caplen, record)) break;
+                record->direction = pcapng_get_direction(
+                    block + 28 + ((caplen + 3) & ~3),
+                    length - 32 - ((caplen + 3) & ~3)
+                );
+                return 1;
+            default:
+                break;
+        }
+    }
+    return file->offset == file->size ? 0 : -1;
+}
+
+/**
+ * \brief Read the next IP packet of a pcap file.
+ * \param file A replay_file_t instance.
+ * \param record The record to fill.
+ * \return 1 if a packet has been read, 0 at the end of the file, -1 if
+ *    the file is malformed.
+ */
+
+static int pcap_read_next(replay_file_t * file, replay_record_t * record)
+{
+    const uint8_t * header;
+    uint32_t        caplen;
+
+    while (file->offset + 16 <= file->size) {
+        header = file->bytes + file->offset;
+        caplen = read_u32(header + 8);
+        if (file->offset + 16 + caplen > file->size) return -1;
+        file->offset += 16 + caplen;
+
+        if (replay_record_set_frame(file->linktypes[0], header + 16, caplen, record)) {
+            record->direction = REPLAY_UNKNOWN;
+            return 1;
+        }
+    }
+    return file->offset == file->size ? 0 : -1;
+}
+
+/**
+ * \brief Read the next IP packet of a capture.
+ * \param file A replay_file_t instance.
+ * \param record The record to fill. Its direction is never REPLAY_UNKNOWN.
+ * \return 1 if a packet has been read, 0 at the end of the file, -1 if
+ *    the file is malformed.
+ */
+
+static int replay_file_read_next(replay_file_t * file, replay_record_t * record)
+{
+    int ret = file->is_pcapng ?
+        pcapng_read_next(file, record) :
+        pcap_read_next(file, record);
+
+    if (ret == 1 && record->direction == REPLAY_UNKNOWN) {
+        record->direction = replay_record_guess_direction(record);
+    }
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// Replay algorithm
+//---------------------------------------------------------------------------
+
+/**
+ * \struct replay_counters_t
+ * \brief The events received by the replay instance.
+ */
+
+typedef struct {
+    size_t num_replies;  /**< Number of PROBE_REPLY events */
+    size_t num_timeouts; /**< Number of PROBE_TIMEOUT events */
+} replay_counters_t;
+
+/**
+ * \brief Handler of the replay algorithm, which counts the replies to the
+ *    injected probes (see algorithm_t).
+ * \param poptions Points to a replay_counters_t instance.
+ */
+
+static int replay_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * poptions)
+{
+    replay_counters_t * counters = poptions;
+
+    // The probes and the replies are released along with the events
+    switch (event->type) {
+        case PROBE_REPLY:
+            counters->num_replies++;
+            break;
+        case PROBE_TIMEOUT:
+            counters->num_timeouts++;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static algorithm_t replay = {
+    .name    = "replay",
+    .handler = replay_handler,
+    .options = NULL
+};
+
+ALGORITHM_REGISTER(replay);
+
+//---------------------------------------------------------------------------
+// Replay
+//---------------------------------------------------------------------------
+
+/**
+ * \struct replay_state_t
+ * \brief The state of a replay.
+ */
+
+typedef struct {
+    pt_loop_t            * loop;                              /**< The loop dispatching the replies */
+    algorithm_instance_t * instance;                          /**< The caller of the injected probes */
+    packet_t             * packets[NETWORK_RECV_BATCH_SIZE];  /**< The replies not yet injected */
+    size_t                 num_packets;                       /**< The number of replies not yet injected */
+    size_t                 num_probes;                        /**< The number of injected probes */
+    size_t                 num_replies;                       /**< The number of injected replies */
+} replay_state_t;
+
+/**
+ * \brief Dispatch the pending events of the loop until the injected
+ *    replies are processed by the replay instance.
+ * \param loop The loop.
+ * \return true iif successful.
+ */
+
+static bool replay_drain(pt_loop_t * loop)
+{
+    do {
+        if (pt_loop_step(loop, 0, 0) <= 0) return false;
+    } while (queue_get_size(loop->network->recvq) || loop->first_ready_instance);
+    return true;
+}
+
+/**
+ * \brief Inject the pending replies and dispatch them.
+ * \param state The state of the replay.
+ * \return true iif successful.
+ */
+
+static bool replay_flush(replay_state_t * state)
+{
+    size_t i;
+
+    if (state->num_packets == 0) return true;
+    if (!network_inject_replies(state->loop->network, state->packets, state->num_packets)) {
+        for (i = 0; i < state->num_packets; i++) packet_free(state->packets[i]);
+        state->num_packets = 0;
+        return false;
+    }
+    state->num_replies += state->num_packets;
+    state->num_packets = 0;
+    return replay_drain(state->loop);
+}
+
+/**
+ * \brief Inject a packet of the capture.
+ * \param state The state of the replay.
+ * \param record The packet.
+ * \return true iif successful.
+ */
+
+static bool replay_record(replay_state_t * state, const replay_record_t * record)
+{
+    packet_t * packet;
+    probe_t  * probe;
+
+    if (!(packet = packet_create_from_bytes((uint8_t *) record->bytes, record->size))) goto ERR_PACKET_CREATE;
+
+    if (record->direction == REPLAY_INBOUND) {
+        state->packets[state->num_packets++] = packet;
+        return state->num_packets < NETWORK_RECV_BATCH_SIZE || replay_flush(state);
+    }
+
+    // The replies recorded before this probe are matched first
+    if (!replay_flush(state))                      goto ERR_REPLAY_FLUSH;
+    if (!(probe = probe_wrap_packet(packet)))      goto ERR_PROBE_WRAP_PACKET;
+    probe_set_caller(probe, state->instance);
+    probe_set_memstats(probe, state->instance->memstats);
+    if (!network_inject_probe(state->loop->network, probe)) {
+        // This packet is not a tagged probe (e.g. an unexpected packet)
+        probe_free(probe);
+        return true;
+    }
+    state->num_probes++;
+    return true;
+
+ERR_PROBE_WRAP_PACKET:
+ERR_REPLAY_FLUSH:
+    packet_free(packet);
+ERR_PACKET_CREATE:
+    return false;
+}
+
+static double get_cpu_time(const struct timeval * tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void loop_handler(pt_loop_t * loop, event_t * event, void * user_data) {
+}
+
+//---------------------------------------------------------------------------
+// Main program
+//---------------------------------------------------------------------------
+
+int main(int argc, char ** argv)
+{
+    int               exit_code = EXIT_FAILURE;
+    const char      * usage = "usage: %s [options] FILE\n";
+    options_t       * options;
+    replay_file_t     file;
+    replay_record_t   record;
+    replay_state_t    state;
+    replay_counters_t counters = {0};
+    network_t       * network;
+    struct rusage     usage_start, usage_end;
+    uint64_t          start, elapsed;
+    double            cpu_user, cpu_sys;
+    int               ret;
+
+    if (!(options = options_create(NULL))) goto ERR_OPTIONS_CREATE;
+    options_add_optspecs(options, network_get_options());
+    options_add_common  (options, "version 1.0");
+    if (options_parse(options, usage, argv) != 1) {
+        fprintf(stderr, usage, basename(argv[0]));
+        goto ERR_OPT_PARSE;
+    }
+
+    if (!replay_file_open(argv[argc - 1], &file)) goto ERR_FILE_OPEN;
+
+    memset(&state, 0, sizeof(replay_state_t));
+    if (!(state.loop = pt_loop_create(loop_handler, NULL))) {
+        fprintf(stderr, "Cannot create the loop (root privileges are required unless --simulate is passed)\n");
+        goto ERR_LOOP_CREATE;
+    }
+    network = state.loop->network;
+    options_network_init(network, false);
+    pt_loop_set_profiler(state.loop);
+    if (!(state.instance = pt_add_instance(state.loop, "replay", &counters, NULL))) goto ERR_ADD_INSTANCE;
+    if (!replay_drain(state.loop)) goto ERR_REPLAY;
+
+    getrusage(RUSAGE_SELF, &usage_start);
+    start = get_time_ns();
+    while ((ret = replay_file_read_next(&file, &record)) == 1) {
+        if (!replay_record(&state, &record)) goto ERR_REPLAY;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "%s: malformed capture\n", argv[argc - 1]);
+        goto ERR_REPLAY;
+    }
+    if (!replay_flush(&state)) goto ERR_REPLAY;
+    elapsed = get_time_ns() - start;
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    cpu_user = get_cpu_time(&usage_end.ru_utime) - get_cpu_time(&usage_start.ru_utime);
+    cpu_sys  = get_cpu_time(&usage_end.ru_stime) - get_cpu_time(&usage_start.ru_stime);
+
+    printf("probes %zu replies %zu matched %zu unmatched %llu\n",
+        state.num_probes, state.num_replies, counters.num_replies,
+        (unsigned long long) network->stats->counters.num_unmatched
+    );
+    printf("elapsed %.3f s: %.0f replies/s\n",
+        elapsed / 1e9,
+        elapsed ? state.num_replies / (elapsed / 1e9) : 0
+    );
+    printf("cpu user %.3f s sys %.3f s: %.3f us/reply\n",
+        cpu_user, cpu_sys,
+        state.num_replies ? (cpu_user + cpu_sys) * 1e6 / state.num_replies : 0
+    );
+    network_dump_stats(network, stdout);
+    fflush(stdout);
+    exit_code = EXIT_SUCCESS;
+
+ERR_REPLAY:
+ERR_ADD_INSTANCE:
+    // The time spent in each handler is printed once the loop is released
+    pt_loop_free(state.loop);
+ERR_LOOP_CREATE:
+    replay_file_close(&file);
+ERR_FILE_OPEN:
+ERR_OPT_PARSE:
+ERR_OPTIONS_CREATE:
+    exit(exit_code);
+}
@@ -0,0 +1,227 @@
+/**
+ * \file shards_bench.c
+ * \brief Run a skewed workload through a pt_shards_t (see pt_shards.h),
+ *    to check that the idle shards steal the instances of the busy ones.
+ *
+ * Every destination belongs to shard 0 (see network_get_destination_shard),
+ * and each shard only runs SHARDS_BENCH_MAX_RUNNING traceroute instances
+ * at once. Hence the other shards have nothing to run but the instances
+ * they steal from shard 0, and then receive the replies related to the
+ * stolen destinations (see network_accept_destination).
+ *
+ * The driver fails unless every instance has terminated exactly once, and
+ * unless at least one of them has been stolen. It prints how many instances
+ * each shard has run.
+ *
+ * Usage: shards_bench [--simulate TOPOLOGY] [...] [NUM_DESTINATIONS]
+ *
+ * The destinations are taken in 198.18.0.0/15 (see RFC 2544). The network
+ * layer requires root privileges (raw sockets), unless --simulate is passed.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>         // calloc, free, atoi
+#include <stdio.h>          // printf, fprintf
+#include <stdbool.h>        // bool
+#include <string.h>         // memset
+#include <libgen.h>         // basename
+#include <pthread.h>        // pthread_mutex_*
+#include <sys/socket.h>     // AF_INET
+#include <arpa/inet.h>      // htonl
+
+#include "address.h"        // address_t
+#include "algorithm.h"      // pt_stop_instance
+#include "algorithms/traceroute.h" // traceroute_options_t
+#include "field.h"          // ADDRESS, field_free
+#include "network.h"        // network_get_destination_shard
+#include "options.h"        // options_t
+#include "probe.h"          // probe_t
+#include "pt_loop.h"        // pt_loop_t
+#include "pt_shards.h"      // pt_shards_t
+
+#define SHARDS_BENCH_NUM_SHARDS       4
+#define SHARDS_BENCH_NUM_DESTINATIONS 64
+#define SHARDS_BENCH_MAX_RUNNING      2
+
+/**
+ * \struct bench_destination_t
+ * \brief A destination traced by the benchmark.
+ */
+
+typedef struct {
+    traceroute_options_t   options;        /**< Options of the instance. Must be the first member (see loop_handler) */
+    address_t              dst_addr;       /**< The destination */
+    probe_t              * probe;          /**< The probe skeleton of the instance */
+    size_t                 num_terminated; /**< Number of ALGORITHM_HAS_TERMINATED raised by the instance */
+    pt_loop_t            * loop;           /**< The loop which has run the instance */
+} bench_destination_t;
+
+/**
+ * \struct bench_state_t
+ * \brief State shared by the shards.
+ */
+
+typedef struct {
+    pthread_mutex_t mutex;          /**< Protects the destinations */
+    size_t          num_terminated; /**< Number of instances terminated so far */
+} bench_state_t;
+
+/**
+ * \brief Handle events raised by the shards. It is called by the thread
+ *    of each shard.
+ * \param loop The loop of the shard.
+ * \param event The event raised by libparistraceroute.
+ * \param user_data Points to the bench_state_t instance.
+ */
+
+static void loop_handler(pt_loop_t * loop, event_t * event, void * user_data) {
+    bench_state_t       * state = user_data;
+    bench_destination_t * destination;
+
+    if (event->type == ALGORITHM_HAS_TERMINATED) {
+        destination = (bench_destination_t *) event->issuer->options;
+        pthread_mutex_lock(&state->mutex);
+        destination->num_terminated++;
+        destination->loop = loop;
+        state->num_terminated++;
+        pthread_mutex_unlock(&state->mutex);
+        pt_stop_instance(loop, event->issuer);
+    }
+    event_free(event);
+}
+
+/**
+ * \brief Prepare the traceroute instance of a destination. The last byte
+ *    of every destination is 0, so that they all belong to shard 0.
+ * \param destination The bench_destination_t instance.
+ * \param i The index of the destination.
+ * \return true iif successful.
+ */
+
+static bool bench_destination_init(bench_destination_t * destination, size_t i) {
+    field_t * field;
+    bool      ret;
+
+    memset(destination, 0, sizeof(bench_destination_t));
+    destination->dst_addr.family = AF_INET;
+    destination->dst_addr.ip.ipv4.s_addr = htonl(0xc6120000 | ((i & 0x1ffff) << 8)); // 198.18.0.0/15
+
+    if (!(destination->probe = probe_create())) return false;
+    if (!(field = ADDRESS("dst_ip", &destination->dst_addr))) return false;
+    ret = probe_set_protocols(destination->probe, "ipv4", "udp", NULL)
+       && probe_set_field(destination->probe, field)
+       && probe_payload_resize(destination->probe, 2);
+    field_free(field);
+    if (!ret) return false;
+
+    // The hops are not printed: do not wait for their hostnames
+    destination->options = traceroute_get_default_options();
+    options_traceroute_init(&destination->options, &destination->dst_addr);
+    destination->options.do_resolv  = false;
+    destination->options.resolv_asn = false;
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    int                   exit_code = EXIT_FAILURE;
+    const char          * usage = "usage: %s [options] [NUM_DESTINATIONS]\n";
+    options_t           * options;
+    bench_state_t         state;
+    bench_destination_t * destinations;
+    pt_shards_t         * shards;
+    size_t                i, j,
+                          num_destinations = SHARDS_BENCH_NUM_DESTINATIONS,
+                          num_stolen = 0,
+                          num_run[SHARDS_BENCH_NUM_SHARDS] = {0};
+    int                   num_args;
+    bool                  is_complete = true;
+
+    if (!(options = options_create(NULL))) goto ERR_OPTIONS_CREATE;
+    options_add_optspecs(options, traceroute_get_options());
+    options_add_optspecs(options, network_get_options());
+    options_add_common  (options, "version 1.0");
+    if ((num_args = options_parse(options, usage, argv)) < 0 || num_args > 1
+    ||  (num_args == 1 && !(num_destinations = atoi(argv[argc - 1])))
+    ) {
+        fprintf(stderr, usage, basename(argv[0]));
+        goto ERR_OPT_PARSE;
+    }
+
+    if (!(destinations = calloc(num_destinations, sizeof(bench_destination_t)))) goto ERR_CALLOC;
+    pthread_mutex_init(&state.mutex, NULL);
+    state.num_terminated = 0;
+
+    if (!(shards = pt_shards_create(SHARDS_BENCH_NUM_SHARDS, loop_handler, &state))) {
+        fprintf(stderr, "Cannot create the shards (root privileges are required unless --simulate is passed)\n");
+        goto ERR_PT_SHARDS_CREATE;
+    }
+    pt_shards_set_max_running(shards, SHARDS_BENCH_MAX_RUNNING);
+    for (i = 0; i < SHARDS_BENCH_NUM_SHARDS; i++) {
+        options_network_init(pt_shards_get_shard_loop(shards, i)->network, false);
+    }
+
+    for (i = 0; i < num_destinations; i++) {
+        if (!bench_destination_init(&destinations[i], i)
+        ||  !pt_shards_add_instance(shards, "traceroute", &destinations[i].options, destinations[i].probe, &destinations[i].dst_addr)
+        ) {
+            fprintf(stderr, "Cannot add the instance of destination %zu\n", i);
+            goto ERR_ADD_INSTANCE;
+        }
+    }
+
+    if (pt_shards_run(shards) < 0) {
+        fprintf(stderr, "Cannot run the shards\n");
+        goto ERR_PT_SHARDS_RUN;
+    }
+
+    // Check that every instance has terminated exactly once, and count
+    // the instances run by another shard than the one of their destination.
+    for (i = 0; i < num_destinations; i++) {
+        if (destinations[i].num_terminated != 1) {
+            fprintf(stderr, "destination %zu: terminated %zu times\n", i, destinations[i].num_terminated);
+            is_complete = false;
+            continue;
+        }
+        for (j = 0; j < SHARDS_BENCH_NUM_SHARDS; j++) {
+            if (destinations[i].loop == pt_shards_get_shard_loop(shards, j)) break;
+        }
+        if (j == SHARDS_BENCH_NUM_SHARDS) {
+            fprintf(stderr, "destination %zu: run by an unknown loop\n", i);
+            is_complete = false;
+            continue;
+        }
+        num_run[j]++;
+        if (j != network_get_destination_shard(&destinations[i].dst_addr, SHARDS_BENCH_NUM_SHARDS)) {
+            num_stolen++;
+        }
+    }
+
+    for (j = 0; j < SHARDS_BENCH_NUM_SHARDS; j++) {
+        printf("shard %zu: %zu instances\n", j, num_run[j]);
+    }
+    printf("instances %zu terminated %zu stolen %zu\n", num_destinations, state.num_terminated, num_stolen);
+
+    if (!is_complete || state.num_terminated != num_destinations) {
+        fprintf(stderr, "FAIL: some instances have not terminated exactly once\n");
+    } else if (!num_stolen) {
+        fprintf(stderr, "FAIL: no instance has been stolen\n");
+    } else {
+        exit_code = EXIT_SUCCESS;
+    }
+
+ERR_PT_SHARDS_RUN:
+ERR_ADD_INSTANCE:
+    pt_shards_free(shards);
+ERR_PT_SHARDS_CREATE:
+    for (i = 0; i < num_destinations; i++) {
+        probe_free(destinations[i].probe);
+    }
+    pthread_mutex_destroy(&state.mutex);
+    free(destinations);
+ERR_CALLOC:
+ERR_OPT_PARSE:
+ERR_OPTIONS_CREATE:
+    exit(exit_code);
+}
@@ -1,7 +1,7 @@
 #include "use.h"
 #include "config.h"
 
-#include <stdio.h>      // perror
+#include <stdio.h>      // perror, fprintf
 #include <stdlib.h>     // malloc
 #include <errno.h>      // errno, ENOMEM, EINVAL
 #include <string.h>     // memcpy
@@ -9,41 +9,74 @@
 #include <sys/socket.h> // getnameinfo, getaddrinfo, sockaddr_*
 #include <netinet/in.h> // INET_ADDRSTRLEN, INET6_ADDRSTRLEN
 #include <arpa/inet.h>  // inet_pton
+#include <pthread.h>    // pthread_mutex_*
 
 #include "address.h"
+#include "cachefile.h"  // cachefile_append_hostname
 
-#ifdef USE_CACHE
-#    include "containers/map.h"
+#include "containers/hashmap.h" // hashmap_*
+#include "memstats.h"            // memstats_track_alloc
 
-static map_t * cache_ip_hostname = NULL;
+#ifdef USE_CACHE
+// Maps each address_t to a char * (allocated by the cache)
+static hashmap_t * cache_ip_hostname = NULL;
 
 static void __cache_ip_hostname_create() __attribute__((constructor));
 static void __cache_ip_hostname_free()   __attribute__((destructor));
 
-static void str_dump(const char * s) {
-    printf("%s (%p)", s, s);
+static void str_dump(char * const * ps) {
+    printf("%s (%p)", *ps, *ps);
+}
+
+static void str_free(char ** ps) {
+    free(*ps);
 }
 
 static void __cache_ip_hostname_create() {
-    cache_ip_hostname = map_create(
-        address_dup, address_free, address_dump, address_compare,
-        strdup,      free,         str_dump
+    cache_ip_hostname = hashmap_create(
+        sizeof(address_t), address_hash, address_compare, address_dump,
+        sizeof(char *),    str_free,     str_dump
     );
 }
 
 static void __cache_ip_hostname_free() {
-    if (cache_ip_hostname) map_free(cache_ip_hostname);
+    if (cache_ip_hostname) hashmap_free(cache_ip_hostname);
+}
+
+/**
+ * \brief Store a hostname in the cache. The caller must hold
+ *    address_resolv_mutex.
+ * \param address The address.
+ * \param hostname The hostname, "" for a negative entry.
+ */
+
+static void cache_ip_hostname_update(const address_t * address, const char * hostname) {
+    char * hostname_dup;
+    size_t num_entries;
+
+    if (cache_ip_hostname && (hostname_dup = strdup(hostname))) {
+        num_entries = hashmap_get_size(cache_ip_hostname);
+        if (!hashmap_update(cache_ip_hostname, address, &hostname_dup)) {
+            free(hostname_dup);
+        } else if (hashmap_get_size(cache_ip_hostname) > num_entries) {
+            // The cached entries are released on exit
+            memstats_track_alloc(MEMSTATS_CACHE, sizeof(address_t) + strlen(hostname) + 1);
+        }
+    }
 }
 
 #endif
 
+// gethostbyaddr and the cache are shared by the threads running a pt_loop_t.
+static pthread_mutex_t address_resolv_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 #define AI_IDN        0x0040
 
-static void ip_dump(int family, const void * ip, char * buffer, size_t buffer_len) {
+static void ip_dump(FILE * out, int family, const void * ip, char * buffer, size_t buffer_len) {
     if (inet_ntop(family, ip, buffer, buffer_len)) {
-        printf("%s", buffer);
+        fprintf(out, "%s", buffer);
     } else {
-        printf("???");
+        fprintf(out, "???");
     }
 }
 
@@ -104,20 +137,24 @@ ERROR_GETADDRINFO:
 #ifdef USE_IPV4
 void ipv4_dump(const ipv4_t * ipv4) {
     char buffer[INET_ADDRSTRLEN];
-    ip_dump(AF_INET, ipv4, buffer, INET_ADDRSTRLEN);
+    ip_dump(stdout, AF_INET, ipv4, buffer, INET_ADDRSTRLEN);
 }
 #endif
 
 #ifdef USE_IPV6
 void ipv6_dump(const ipv6_t * ipv6) {
     char buffer[INET6_ADDRSTRLEN];
-    ip_dump(AF_INET6, ipv6, buffer, INET6_ADDRSTRLEN);
+    ip_dump(stdout, AF_INET6, ipv6, buffer, INET6_ADDRSTRLEN);
 }
 #endif
 
 void address_dump(const address_t * address) {
+    address_fdump(stdout, address);
+}
+
+void address_fdump(FILE * out, const address_t * address) {
     char buffer[INET6_ADDRSTRLEN];
-    ip_dump(address->family, &address->ip, buffer, INET6_ADDRSTRLEN);
+    ip_dump(out, address->family, &address->ip, buffer, INET6_ADDRSTRLEN);
 }
 
 bool address_guess_family(const char * str_ip, int * pfamily) {
@@ -179,32 +216,40 @@ address_t * address_dup(const address_t * address) {
 }
 
 int address_compare(const address_t * x, const address_t * y) {
-    size_t          i, address_size;
-    const uint8_t * px = NULL,
-                  * py = NULL;
-
     if (x->family < y->family) return -1;
     if (x->family > y->family) return 1;
 
-    address_size = address_get_size(x);
+    // The bytes are in network order, so memcmp orders the addresses
+    // numerically.
+    return memcmp(&x->ip, &y->ip, address_get_size(x));
+}
+
+size_t address_hash(const address_t * address) {
+    uint64_t hash = (uint64_t) address->family;
+#ifdef USE_IPV6
+    uint64_t words[2];
+#endif
 
-    switch (x->family) {
+    switch (address->family) {
 #ifdef USE_IPV4
         case AF_INET:
-            px = (const uint8_t *) &x->ip.ipv4;
-            py = (const uint8_t *) &y->ip.ipv4;
+            hash ^= (uint64_t) address->ip.ipv4.s_addr << 8;
             break;
 #endif
 #ifdef USE_IPV6
         case AF_INET6:
-            px = (const uint8_t *) &x->ip.ipv6;
-            py = (const uint8_t *) &y->ip.ipv6;
+            memcpy(words, &address->ip.ipv6, sizeof(ipv6_t));
+            hash ^= words[0];
+            hash = (hash ^ (hash >> 32)) * 0x9e3779b97f4a7c15ull;
+            hash ^= words[1];
             break;
 #endif
     }
 
-    for (i = 0; (i < address_size) && (*px++ == *py++); i++);
-    return *--px - *--py;
+    // Mix the bits, so that the low bits used to index a hash table
+    // depend on every byte of the address.
+    hash = (hash ^ (hash >> 32)) * 0x9e3779b97f4a7c15ull;
+    return (size_t) (hash ^ (hash >> 29));
 }
 
 int address_to_string(const address_t * address, char ** pbuffer)
@@ -284,17 +329,24 @@ bool address_resolv(const address_t * address, char ** phostname, int mask_cache
 {
     struct hostent * hp;
     bool             found = false;
-    const void     * data;
+#ifdef USE_CACHE
+    char          ** data;
+#endif
 
     if (!address) goto ERR_INVALID_PARAMETER;
+    pthread_mutex_lock(&address_resolv_mutex);
 
 #ifdef USE_CACHE
     if (cache_ip_hostname && (mask_cache & CACHE_READ)) {
-        found = map_find(cache_ip_hostname, address, &data); //phostname);
+        found = hashmap_find(cache_ip_hostname, address, &data);
+        if (found && !**data) {
+            // Negative entry (see address_cache_hostname)
+            goto ERR_GETHOSTBYADDR;
+        }
         if (found) {
             // We've to strdup the cached value, otherwise the function
             // calling address_resolv will erase this cached value.
-            *phostname = strdup(data);
+            *phostname = strdup(*data);
         }
     }
 #endif
@@ -312,17 +364,41 @@ bool address_resolv(const address_t * address, char ** phostname, int mask_cache
         }
 #ifdef USE_CACHE
         if (mask_cache & CACHE_WRITE) {
-            map_update(cache_ip_hostname, address, *phostname);
+            cache_ip_hostname_update(address, *phostname);
+            cachefile_append_hostname(address, *phostname, CACHEFILE_DEFAULT_TTL);
         }
     }
 #endif
 
+    pthread_mutex_unlock(&address_resolv_mutex);
     return true;
 
 ERR_GETHOSTBYADDR:
     // This is to avoid to get errno set to 22 (EINVAL) if the DNS lookup fails.
     errno = 0;
 ERR_STRDUP:
+    pthread_mutex_unlock(&address_resolv_mutex);
 ERR_INVALID_PARAMETER:
     return false;
 }
+
+bool address_is_cached(const address_t * address)
+{
+    bool found = false;
+#ifdef USE_CACHE
+    pthread_mutex_lock(&address_resolv_mutex);
+    if (cache_ip_hostname) found = hashmap_find(cache_ip_hostname, address, NULL);
+    pthread_mutex_unlock(&address_resolv_mutex);
+#endif
+    return found;
+}
+
+void address_cache_hostname(const address_t * address, const char * hostname, uint32_t ttl)
+{
+#ifdef USE_CACHE
+    pthread_mutex_lock(&address_resolv_mutex);
+    cache_ip_hostname_update(address, hostname ? hostname : "");
+    pthread_mutex_unlock(&address_resolv_mutex);
+#endif
+    cachefile_append_hostname(address, hostname ? hostname : "", ttl);
+}
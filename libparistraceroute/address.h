@@ -4,6 +4,9 @@
 #define ADDRESS_H
 
 #include <stdbool.h>    // bool
+#include <stdint.h>     // uint32_t
+#include <stdio.h>      // FILE
+#include <string.h>     // memcpy
 #include <netinet/in.h> // in_addr, in6_addr
 
 //---------------------------------------------------------------------------
@@ -76,6 +79,51 @@ address_t * address_create();
 
 int address_compare(const address_t * x, const address_t * y);
 
+/**
+ * \brief Test whether two address_t instances are equal. This is
+ *    equivalent to address_compare(x, y) == 0, but cheaper: the IP
+ *    addresses are compared by words (one for IPv4, two for IPv6)
+ *    instead of byte per byte.
+ * \param x The first address_t instance.
+ * \param y The second address_t instance.
+ * \return true iif x and y belong to the same family and carry the
+ *    same IP address.
+ */
+
+static inline bool address_equals(const address_t * x, const address_t * y) {
+#ifdef USE_IPV6
+    uint64_t x64[2], y64[2];
+#endif
+
+    if (x->family != y->family) return false;
+
+    switch (x->family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            return x->ip.ipv4.s_addr == y->ip.ipv4.s_addr;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            memcpy(x64, &x->ip.ipv6, sizeof(ipv6_t));
+            memcpy(y64, &y->ip.ipv6, sizeof(ipv6_t));
+            return ((x64[0] ^ y64[0]) | (x64[1] ^ y64[1])) == 0;
+#endif
+        default:
+            return true;
+    }
+}
+
+/**
+ * \brief Hash an address_t instance. Only its family and the bytes of
+ *    its IP address are hashed, so that two addresses equal according
+ *    to address_compare have the same hash, whatever the unused bytes
+ *    of their ip_t.
+ * \param address The address_t instance.
+ * \return The corresponding hash.
+ */
+
+size_t address_hash(const address_t * address);
+
 /**
  * \brief Release an address_t instance from the memory.
  * \param address An address instance.
@@ -118,6 +166,14 @@ size_t address_get_size(const address_t * address);
 
 void address_dump(const address_t * address);
 
+/**
+ * \brief Print an address in a given stream
+ * \param out The output stream
+ * \param address The address to print
+ */
+
+void address_fdump(FILE * out, const address_t * address);
+
 /**
  * \brief Guess address family of an IP by using the
  *    first result of getaddrinfo (if any).
@@ -175,4 +231,26 @@ int address_to_string(const address_t * addr, char ** pbuffer);
 
 bool address_resolv(const address_t * address, char ** phostname, int mask_cache);
 
+/**
+ * \brief Check whether the hostname of an address is cached, i.e.
+ *    whether address_resolv(address, ..., CACHE_ENABLED) returns without
+ *    performing a DNS lookup.
+ * \param address An address_t instance
+ * \return true iif the address is cached (see USE_CACHE)
+ */
+
+bool address_is_cached(const address_t * address);
+
+/**
+ * \brief Store in the cache the result of a DNS lookup performed
+ *    elsewhere (e.g. by resolver.h).
+ * \param address An address_t instance
+ * \param hostname The corresponding FQDN, or NULL if the lookup failed:
+ *    address_resolv will then fail without looking this address up again.
+ * \param ttl The number of seconds during which the result may be saved
+ *    in the cache file (see cachefile.h), 0 if it must not be saved.
+ */
+
+void address_cache_hostname(const address_t * address, const char * hostname, uint32_t ttl);
+
 #endif 
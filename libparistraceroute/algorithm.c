@@ -11,6 +11,8 @@
 #include "dynarray.h"
 #include "event.h"
 #include "pt_loop.h"
+#include "tracepoint.h"
+#include "common.h"      // get_time_ns
 
 static void * algorithms_root = NULL;
 
@@ -72,6 +74,29 @@ static algorithm_instance_t * pt_algorithm_instance_del(
     algorithm_instance_t * instance
 );
 
+/**
+ * \brief Append an instance to the ready list of its loop.
+ * \param loop The libparistraceroute loop
+ * \param instance The instance, which must not be in the ready list.
+ * \return true iif the ready list was empty.
+ */
+
+static bool pt_ready_list_push(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance
+);
+
+/**
+ * \brief Remove an instance from the ready list of its loop (if listed).
+ * \param loop The libparistraceroute loop
+ * \param instance The instance
+ */
+
+static void pt_ready_list_del(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance
+);
+
 //--------------------------------------------------------------------
 // algorithm_t (internal usage)
 //--------------------------------------------------------------------
@@ -121,14 +146,24 @@ static algorithm_instance_t * algorithm_instance_create(
         return NULL;
     }
 
+    if (!(instance->memstats = memstats_create())) {
+        free(instance);
+        return NULL;
+    }
+
     instance->id         = loop->next_algorithm_id++;
     instance->algorithm  = algorithm;
     instance->options    = options;
     instance->probe_skel = probe_skel;
     instance->data       = NULL;
+    instance->outputs    = NULL;
     instance->events     = dynarray_create();
     instance->caller     = NULL;
     instance->loop       = loop;
+    instance->prev_ready = NULL;
+    instance->next_ready = NULL;
+    instance->is_ready   = false;
+    instance->has_terminated = false;
     return instance;
 }
 
@@ -140,7 +175,15 @@ static algorithm_instance_t * algorithm_instance_create(
 static void algorithm_instance_free(algorithm_instance_t * instance)
 {
     if (instance) {
+        // Its pending events are dropped
+        pt_ready_list_del(instance->loop, instance);
         algorithm_instance_clear_events(instance);
+
+        // Its probes may still be in flight, and the next replies to its
+        // former probes are no longer passed to it
+        network_forget_caller(instance->loop->network, instance);
+        memstats_release_owner(instance->memstats);
+        results_free(instance->outputs);
         free(instance);
     }
 }
@@ -176,6 +219,43 @@ static inline algorithm_instance_t * pt_algorithm_instance_del(
     );
 }
 
+static bool pt_ready_list_push(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance
+) {
+    bool was_empty = !loop->first_ready_instance;
+
+    instance->prev_ready = loop->last_ready_instance;
+    instance->next_ready = NULL;
+    if (was_empty) {
+        loop->first_ready_instance = instance;
+    } else {
+        loop->last_ready_instance->next_ready = instance;
+    }
+    loop->last_ready_instance = instance;
+    return was_empty;
+}
+
+static void pt_ready_list_del(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance
+) {
+    if (!instance->prev_ready && loop->first_ready_instance != instance) return;
+
+    if (instance->prev_ready) {
+        instance->prev_ready->next_ready = instance->next_ready;
+    } else {
+        loop->first_ready_instance = instance->next_ready;
+    }
+    if (instance->next_ready) {
+        instance->next_ready->prev_ready = instance->prev_ready;
+    } else {
+        loop->last_ready_instance = instance->prev_ready;
+    }
+    instance->prev_ready = NULL;
+    instance->next_ready = NULL;
+}
+
 //--------------------------------------------------------------------
 // algorithm_instance_t
 //--------------------------------------------------------------------
@@ -202,6 +282,10 @@ inline event_t ** algorithm_instance_get_events(algorithm_instance_t * instance)
         NULL;
 }
 
+inline results_t * algorithm_instance_get_outputs(algorithm_instance_t * instance) {
+    return instance ? instance->outputs : NULL;
+}
+
 inline void algorithm_instance_clear_events(algorithm_instance_t * instance) {
     if (instance) {
         dynarray_clear(instance->events, (ELEMENT_FREE) event_free);
@@ -216,34 +300,56 @@ inline unsigned int algorithm_instance_get_num_events(algorithm_instance_t * ins
 // pt_loop: user interface
 //--------------------------------------------------------------------
 
-void pt_process_instance(const void * node, VISIT visit, int level)
+void pt_process_instances(pt_loop_t * loop)
 {
-    algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
-    size_t                 i, num_events;
-    uint64_t               ret;
-    ssize_t                count;
+    uint64_t ret;
 
-    // Save temporarily this algorithm context
-    instance->loop->cur_instance = instance;
+    // eventfd_algorithm is notified once per non-empty ready list
+    if (read(loop->eventfd_algorithm, &ret, sizeof(ret)) == -1) return;
+    pt_dispatch_instances(loop);
+}
 
-    // Execute algorithm handler for events of each algorithm
-    num_events = dynarray_get_size(instance->events);
-    for (i = 0; i < num_events; i++) {
-        event_t * event;
+void pt_dispatch_instances(pt_loop_t * loop)
+{
+    algorithm_instance_t * instance;
+    event_t              * event;
+    size_t                 i;
+    uint64_t               start = 0;
+
+    // A handler processing an event must not process the next ones
+    if (loop->is_processing_instances) return;
+    loop->is_processing_instances = true;
+
+    while ((instance = loop->first_ready_instance)) {
+        pt_ready_list_del(loop, instance);
+
+        // Save temporarily this algorithm context
+        loop->cur_instance = instance;
+
+        // Execute algorithm handler for each event, including the ones
+        // the handler raises for this instance
+        for (i = 0; i < dynarray_get_size(instance->events); i++) {
+            event = dynarray_get_ith_element(instance->events, i);
+            TRACEPOINT(event_dispatch, instance->id, event->type, event);
+            if (loop->profiler) start = get_time_ns();
+            instance->algorithm->handler(loop, event, &instance->data, instance->probe_skel, instance->options);
+            if (loop->profiler) {
+                profiler_entry_add(
+                    profiler_get_entry(loop->profiler, PROFILER_ALGORITHM, instance->algorithm->name),
+                    get_time_ns() - start
+                );
+            }
+        }
 
-        count = read(instance->loop->eventfd_algorithm, &ret, sizeof(ret));
-        if (count == -1)
-            return;
+        // Restore the algorithm context
+        loop->cur_instance = NULL;
 
-        event = dynarray_get_ith_element(instance->events, i);
-        instance->algorithm->handler(instance->loop, event, &instance->data, instance->probe_skel, instance->options);
+        // Flush events queue
+        algorithm_instance_clear_events(instance);
+        instance->is_ready = false;
     }
 
-    // Restore the algorithm context
-    instance->loop->cur_instance = NULL;
-
-    // Flush events queue
-    algorithm_instance_clear_events(instance);
+    loop->is_processing_instances = false;
 }
 
 void pt_free_instance(
@@ -252,7 +358,11 @@ void pt_free_instance(
     int          level
 ) {
     algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
-    algorithm_instance_free(instance); // No notification
+
+    // twalk visits the internal nodes three times
+    if (visit == postorder || visit == leaf) {
+        algorithm_instance_free(instance); // No notification
+    }
 }
 
 // Notify the called algorithm that it can start
@@ -304,6 +414,9 @@ void pt_stop_instance(
     // Notify the caller that this instance will be freed
     pt_throw(NULL, instance, event_create(ALGORITHM_TERM, NULL, NULL, NULL));
 
+    // Its events waiting for a DNS lookup are discarded
+    pt_loop_cancel_deferred_events(loop, instance);
+
     // Unregister this instance from the loop
     pt_algorithm_instance_del(loop, instance);
 
@@ -315,12 +428,31 @@ void pt_throw(
     pt_loop_t            * loop,
     algorithm_instance_t * instance,
     event_t              * event
+) {
+    // Preserve the order of the events following a deferred event
+    if (event && pt_loop_defer_event(instance ? instance->loop : loop, instance, event)) return;
+    pt_throw_now(loop, instance, event);
+}
+
+void pt_throw_now(
+    pt_loop_t            * loop,
+    algorithm_instance_t * instance,
+    event_t              * event
 ) {
     if (event) {
         if (instance) {
-            // Enqueue an algorithm event
+            // Enqueue an algorithm event and schedule this instance
             dynarray_push_element(instance->events, event);
-            eventfd_write(instance->loop->eventfd_algorithm, 1);
+            if (!instance->is_ready) {
+                instance->is_ready = true;
+
+                // With direct dispatch, the running handler is followed
+                // by a pass over the ready list (see pt_loop_dispatch)
+                if (pt_ready_list_push(instance->loop, instance)
+                && !(instance->loop->is_direct_dispatch && instance->loop->is_handling)) {
+                    eventfd_write(instance->loop->eventfd_algorithm, 1);
+                }
+            }
         } else if (loop) {
             // Enqueue an user event
             dynarray_push_element(loop->events_user, event);
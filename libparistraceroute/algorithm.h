@@ -13,6 +13,7 @@
 #include "dynarray.h"   // dynarray_t
 #include "pt_loop.h"    // pt_loop_t
 #include "optparse.h"   // opt_spec
+#include "results.h"    // results_t
 
 /**
  * \enum status_t
@@ -54,10 +55,15 @@ typedef struct algorithm_instance_s {
     void                        * options;    /**< Pointer to an option structure specific to the algorithm */
     probe_t                     * probe_skel; /**< Skeleton for probes forged by this algorithm instance */
     void                        * data;       /**< Internal algorithm data */
-    void                        * outputs;    /**< Data exposed to the caller and filled by the instance */ 
+    results_t                   * outputs;    /**< Results exposed to the caller and filled by the instance, NULL if none (see pt_get_results) */
     dynarray_t                  * events;     /**< An array of events received by the algorithm */
     struct algorithm_instance_s * caller;     /**< Reference to the entity that called the algorithm (NULL if called by user program) */
     struct pt_loop_s            * loop;       /**< Pointer to a library context */
+    struct algorithm_instance_s * prev_ready; /**< Previous instance in the ready list of the loop */
+    struct algorithm_instance_s * next_ready; /**< Next instance in the ready list of the loop */
+    bool                          is_ready;   /**< True iif this instance is in the ready list or is processing its events */
+    bool                          has_terminated; /**< True iif the user has been notified that this instance has terminated */
+    memstats_t                  * memstats;   /**< Accounts the probes sent and the replies received by this instance */
 } algorithm_instance_t;
 
 //--------------------------------------------------------------------
@@ -93,6 +99,7 @@ void    *  algorithm_instance_get_options   (algorithm_instance_t * instance);
 probe_t *  algorithm_instance_get_probe_skel(algorithm_instance_t * instance);
 void    *  algorithm_instance_get_data      (algorithm_instance_t * instance);
 event_t ** algorithm_instance_get_events    (algorithm_instance_t * instance);
+results_t* algorithm_instance_get_outputs   (algorithm_instance_t * instance);
 unsigned   algorithm_instance_get_num_events(algorithm_instance_t * instance);
 void       algorithm_instance_set_data      (algorithm_instance_t * instance, void * data);
 void       algorithm_instance_clear_events  (algorithm_instance_t * instance);
@@ -150,16 +157,35 @@ algorithm_instance_t * pt_add_instance(
 //--------------------------------------------------------------------
 
 /**
- * \brief process algorithm events (internal usage, see visitor for twalk)
- * \param node Current instance
- * \param visit Unused
- * \param level Unused
+ * \brief Process the pending events of the instances of the ready list
+ *    (internal usage). The events raised meanwhile are processed too.
+ * \param loop The libparistraceroute loop
  */
 
-void pt_process_instance(
-    const void * node,
-    VISIT        visit,
-    int          level
+void pt_process_instances(struct pt_loop_s * loop);
+
+/**
+ * \brief Process the pending events of the instances of the ready list
+ *    without reading loop->eventfd_algorithm (internal usage, see
+ *    pt_loop_set_direct_dispatch). Nothing is done if the ready list is
+ *    already being processed: the new events are processed by this pass.
+ * \param loop The libparistraceroute loop
+ */
+
+void pt_dispatch_instances(struct pt_loop_s * loop);
+
+/**
+ * \brief Throw an event without checking whether it must wait for
+ *    some deferred events (internal usage, see pt_loop_defer_event).
+ * \param loop See pt_throw
+ * \param instance See pt_throw
+ * \param event See pt_throw
+ */
+
+void pt_throw_now(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    event_t              * event
 );
 
 /**
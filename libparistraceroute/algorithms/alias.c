@@ -0,0 +1,538 @@
+#include "alias.h"
+
+#include <errno.h>       // errno, EINVAL
+#include <stdlib.h>      // calloc, malloc, free, qsort, bsearch
+#include <stdio.h>       // fprintf
+#include <string.h>      // memset
+
+#include "../probe.h"
+#include "../event.h"
+#include "../algorithm.h"
+#include "../address.h"  // address_compare
+#include "../common.h"   // MIN, MAX, NS_TO_SECONDS
+
+// Maximum number of probes crafted and sent at once (see alias_send_round)
+#define ALIAS_BATCH_SIZE 16
+
+// TTL of the probes, large enough to reach any interface
+#define ALIAS_PROBE_TTL 255
+
+// Maximum ratio between the velocities of two interfaces tested as aliases
+#define ALIAS_VELOCITY_RATIO 2.0
+
+// An increase of the IP identification must be lower than half of its range
+#define ALIAS_MAX_STEP 0x8000
+
+//-----------------------------------------------------------------
+// Alias options
+//-----------------------------------------------------------------
+
+// Bounded integer parameters
+static unsigned num_rounds[4] = OPTIONS_ALIAS_NUM_ROUNDS;
+
+static option_t alias_options[] = {
+    // action              short      long              metavar   help                    variable
+    {opt_store_int_lim_en, OPT_NO_SF, "--alias-rounds", "ROUNDS", ALIAS_HELP_alias_rounds, num_rounds},
+    END_OPT_SPECS
+};
+
+size_t options_alias_get_num_rounds() {
+    return num_rounds[0];
+}
+
+unsigned options_alias_get_is_set() {
+    return num_rounds[3];
+}
+
+const option_t * alias_get_options() {
+    return alias_options;
+}
+
+alias_options_t alias_get_default_options() {
+    alias_options_t alias_options = {
+        .interfaces     = NULL,
+        .num_interfaces = 0,
+        .num_rounds     = OPTIONS_ALIAS_NUM_ROUNDS_DEFAULT,
+    };
+    return alias_options;
+}
+
+void options_alias_init(alias_options_t * alias_options) {
+    alias_options->num_rounds = options_alias_get_num_rounds();
+}
+
+//-----------------------------------------------------------------
+// Alias algorithm's data
+//-----------------------------------------------------------------
+
+static int alias_interface_compare(const void * x, const void * y) {
+    return address_compare(
+        &((const alias_interface_t *) x)->address,
+        &((const alias_interface_t *) y)->address
+    );
+}
+
+/**
+ * \brief Release an alias_data_t instance from the memory.
+ * \param data The alias_data_t instance we want to release.
+ */
+
+void alias_data_free(alias_data_t * data) {
+    if (data) {
+        // The probes in flight are released by the network layer
+        if (data->probe_skel) probe_free(data->probe_skel);
+        free(data->interfaces);
+        free(data->samples);
+        free(data);
+    }
+}
+
+/**
+ * \brief Allocate an alias_data_t instance. The IPv4 candidate interfaces
+ *    are sorted, and their duplicates are removed.
+ * \param probe_skel The probe skeleton passed to this instance.
+ * \param options The options of this instance.
+ * \return The newly allocated alias_data_t instance, NULL in case of
+ *    failure.
+ */
+
+static alias_data_t * alias_data_create(const probe_t * probe_skel, const alias_options_t * options) {
+    alias_data_t * data;
+    size_t         i, num_interfaces = 0;
+
+    if (!(data = calloc(1, sizeof(alias_data_t))))   goto ERR_MALLOC;
+    if (!(data->probe_skel = probe_dup(probe_skel))) goto ERR_PROBE_DUP;
+    if (!(data->interfaces = calloc(MAX(options->num_interfaces, 1), sizeof(alias_interface_t)))) goto ERR_INTERFACES;
+
+    for (i = 0; i < options->num_interfaces; i++) {
+        if (options->interfaces[i].family == AF_INET) {
+            data->interfaces[num_interfaces++].address = options->interfaces[i];
+        }
+    }
+    qsort(data->interfaces, num_interfaces, sizeof(alias_interface_t), alias_interface_compare);
+    for (i = 0; i < num_interfaces; i++) {
+        if (!data->num_interfaces || !address_equals(&data->interfaces[data->num_interfaces - 1].address, &data->interfaces[i].address)) {
+            data->interfaces[data->num_interfaces++].address = data->interfaces[i].address;
+        }
+    }
+
+    if (!(data->samples = calloc(MAX(data->num_interfaces * options->num_rounds, 1), sizeof(alias_sample_t)))) goto ERR_SAMPLES;
+    for (i = 0; i < data->num_interfaces; i++) {
+        data->interfaces[i].samples = &data->samples[i * options->num_rounds];
+        data->interfaces[i].parent  = i;
+    }
+    return data;
+
+ERR_SAMPLES:
+    free(data->interfaces);
+ERR_INTERFACES:
+    probe_free(data->probe_skel);
+ERR_PROBE_DUP:
+    free(data);
+ERR_MALLOC:
+    return NULL;
+}
+
+//-----------------------------------------------------------------
+// Alias default handler
+//-----------------------------------------------------------------
+
+/**
+ * \brief Release an alias_router_t instance from the memory.
+ * \param router The alias_router_t instance.
+ */
+
+static void alias_router_free(void * router) {
+    if (router) {
+        free(((alias_router_t *) router)->interfaces);
+        free(router);
+    }
+}
+
+void alias_event_fdump(FILE * out, const alias_event_t * alias_event) {
+    const alias_router_t * router;
+    size_t                 i;
+
+    switch (alias_event->type) {
+        case ALIAS_ROUTER:
+            router = alias_event->data;
+            fprintf(out, "router");
+            for (i = 0; i < router->num_interfaces; i++) {
+                fprintf(out, " ");
+                address_fdump(out, &router->interfaces[i]);
+            }
+            fprintf(out, "\n");
+            fflush(out);
+            break;
+        default:
+            break;
+    }
+}
+
+bool alias_router_output(output_t * output, const address_t * dst_addr, const alias_router_t * router) {
+    output_record_t record;
+    size_t          i;
+    bool            ret = true;
+
+    memset(&record, 0, sizeof(output_record_t));
+    record.type = OUTPUT_RECORD_ALIAS;
+    record.dst  = dst_addr;
+    record.to   = &router->interfaces[0];
+    for (i = 1; i < router->num_interfaces; i++) {
+        record.from = &router->interfaces[i];
+        ret = ret && output_write_record(output, &record);
+    }
+    return ret;
+}
+
+//-----------------------------------------------------------------
+// Alias algorithm
+//-----------------------------------------------------------------
+
+/**
+ * \brief Retrieve the interface probed at a given position of a round.
+ *    The odd rounds probe the interfaces in the reverse order.
+ * \param data Data attached to this instance of alias algorithm
+ * \param round The round.
+ * \param position The position of the probe in the round.
+ * \return The index of the interface in data->interfaces. Conversely,
+ *    this is the position of the probe sent to an interface of index
+ *    position.
+ */
+
+static inline size_t alias_get_position(const alias_data_t * data, size_t round, size_t position) {
+    return round % 2 ? data->num_interfaces - 1 - position : position;
+}
+
+/**
+ * \brief Send the probes of the current round, as long as the network
+ *    layer grants credits, and start the next rounds once the current one
+ *    is over.
+ * \param loop The main loop
+ * \param data Data attached to this instance of alias algorithm
+ * \param options Options attached to this instance of alias algorithm
+ * \return true iif successful
+ */
+
+static bool alias_send_round(pt_loop_t * loop, alias_data_t * data, const alias_options_t * options) {
+    probe_t * probes[ALIAS_BATCH_SIZE];
+    size_t    i, num_credits, num_crafted = 0;
+
+    while (data->round < options->num_rounds) {
+        if (data->num_sent == data->num_interfaces) {
+            // Wait for the replies of this round before starting the next one
+            if (data->num_flying) return true;
+            data->round++;
+            data->num_sent = 0;
+            continue;
+        }
+
+        // The network layer holds enough probes: the next ones are sent
+        // once some slots are freed
+        if (!(num_credits = pt_get_send_credits(loop))) {
+            return pt_wait_send_credits(loop);
+        }
+
+        num_credits = MIN(MIN(num_credits, ALIAS_BATCH_SIZE), data->num_interfaces - data->num_sent);
+        for (num_crafted = 0; num_crafted < num_credits; num_crafted++) {
+            i = alias_get_position(data, data->round, data->num_sent + num_crafted);
+            if (!(probes[num_crafted] = probe_dup(data->probe_skel))) goto ERR_PROBE_DUP;
+            if (!probe_set_fields(probes[num_crafted],
+                ADDRESS("dst_ip", &data->interfaces[i].address),
+                I8("ttl", ALIAS_PROBE_TTL),
+                NULL
+            )) {
+                probe_free(probes[num_crafted]);
+                goto ERR_PROBE_SET_FIELDS;
+            }
+        }
+        if (!pt_send_probes(loop, probes, num_crafted)) goto ERR_PT_SEND_PROBES;
+        data->num_sent   += num_crafted;
+        data->num_flying += num_crafted;
+        data->num_probes += num_crafted;
+    }
+    return true;
+
+ERR_PROBE_SET_FIELDS:
+ERR_PROBE_DUP:
+    for (i = 0; i < num_crafted; i++) probe_free(probes[i]);
+ERR_PT_SEND_PROBES:
+    fprintf(stderr, "Error in alias_send_round\n");
+    return false;
+}
+
+/**
+ * \brief Record the IP identification of a reply sent by a probed
+ *    interface. The replies sent by another address are ignored.
+ * \param data Data attached to this instance of alias algorithm
+ * \param options Options attached to this instance of alias algorithm
+ * \param probe_reply The probe and its reply.
+ */
+
+static void alias_handle_reply(alias_data_t * data, const alias_options_t * options, const probe_reply_t * probe_reply) {
+    alias_interface_t   key,
+                      * interface;
+    address_t           src_ip;
+    alias_sample_t    * sample;
+    uint16_t            ip_id;
+
+    memset(&key, 0, sizeof(alias_interface_t));
+    if (!probe_extract(probe_reply->probe, "dst_ip", &key.address))  return;
+    if (!probe_extract(probe_reply->reply, "src_ip", &src_ip))       return;
+    if (!address_equals(&key.address, &src_ip))                     return;
+    if (!probe_extract(probe_reply->reply, "identification", &ip_id)) return;
+    if (!(interface = bsearch(&key, data->interfaces, data->num_interfaces, sizeof(alias_interface_t), alias_interface_compare))) return;
+    if (interface->num_samples == options->num_rounds)                return;
+
+    // Every probe of a round is sent before the next round starts
+    sample = &interface->samples[interface->num_samples++];
+    sample->rank  = data->round * data->num_interfaces + alias_get_position(data, data->round, interface - data->interfaces);
+    sample->time  = probe_get_sending_time(probe_reply->probe);
+    sample->ip_id = ip_id;
+}
+
+/**
+ * \brief Check whether the IP identification of an interface strictly
+ *    increases, and compute its velocity.
+ * \param interface The analyzed interface.
+ */
+
+static void alias_interface_analyze(alias_interface_t * interface) {
+    const alias_sample_t * samples = interface->samples;
+    double                 span;
+    size_t                 i, total = 0;
+    uint16_t               step;
+
+    interface->velocity = 0;
+    interface->max_step = 0;
+    if (interface->num_samples < ALIAS_MIN_SAMPLES) return;
+
+    for (i = 1; i < interface->num_samples; i++) {
+        step = samples[i].ip_id - samples[i - 1].ip_id;
+        if (!step || step >= ALIAS_MAX_STEP) {
+            interface->max_step = 0;
+            return;
+        }
+        interface->max_step = MAX(interface->max_step, step);
+        total += step;
+    }
+
+    span = NS_TO_SECONDS(samples[interface->num_samples - 1].time - samples[0].time);
+    if (span > 0) interface->velocity = total / span;
+}
+
+/**
+ * \brief Monotonic bounds test: check whether the samples of two
+ *    interfaces, merged in the order of the probes, form a single
+ *    counter.
+ * \param x An analyzed interface.
+ * \param y Another analyzed interface.
+ * \return true iif both interfaces are deemed aliased.
+ */
+
+static bool alias_is_monotonic(const alias_interface_t * x, const alias_interface_t * y) {
+    const alias_sample_t * prev = NULL,
+                         * sample;
+    size_t                 i = 0, j = 0;
+    uint16_t               step,
+                           max_step = MAX(x->max_step, y->max_step);
+
+    while (i < x->num_samples || j < y->num_samples) {
+        if (j == y->num_samples || (i < x->num_samples && x->samples[i].rank < y->samples[j].rank)) {
+            sample = &x->samples[i++];
+        } else {
+            sample = &y->samples[j++];
+        }
+        if (prev) {
+            step = sample->ip_id - prev->ip_id;
+            if (!step || step > max_step) return false;
+        }
+        prev = sample;
+    }
+    return true;
+}
+
+/**
+ * \brief Retrieve the representative of the set of aliases of an
+ *    interface, i.e. its interface having the lowest address.
+ * \param data Data attached to this instance of alias algorithm
+ * \param i The index of the interface.
+ * \return The index of the representative.
+ */
+
+static size_t alias_find(alias_data_t * data, size_t i) {
+    while (data->interfaces[i].parent != i) {
+        data->interfaces[i].parent = data->interfaces[data->interfaces[i].parent].parent;
+        i = data->interfaces[i].parent;
+    }
+    return i;
+}
+
+static int alias_velocity_compare(const void * x, const void * y) {
+    double vx = (*(const alias_interface_t * const *) x)->velocity,
+           vy = (*(const alias_interface_t * const *) y)->velocity;
+
+    return (vx > vy) - (vx < vy);
+}
+
+/**
+ * \brief Test the candidate pairs, merge the aliases, and notify the
+ *    routers made of several interfaces to the caller.
+ * \param loop The main loop
+ * \param data Data attached to this instance of alias algorithm
+ * \return true iif successful
+ */
+
+static bool alias_resolve(pt_loop_t * loop, alias_data_t * data) {
+    alias_interface_t ** analyzed;
+    alias_router_t     * router;
+    size_t             * sizes;
+    size_t               i, j, x, y, num_analyzed = 0;
+
+    if (!(analyzed = malloc(MAX(data->num_interfaces, 1) * sizeof(alias_interface_t *)))) goto ERR_ANALYZED;
+    if (!(sizes = calloc(MAX(data->num_interfaces, 1), sizeof(size_t))))                 goto ERR_SIZES;
+
+    for (i = 0; i < data->num_interfaces; i++) {
+        alias_interface_analyze(&data->interfaces[i]);
+        if (data->interfaces[i].velocity > 0) analyzed[num_analyzed++] = &data->interfaces[i];
+    }
+
+    // Only the interfaces whose velocities are similar are tested
+    qsort(analyzed, num_analyzed, sizeof(alias_interface_t *), alias_velocity_compare);
+    for (i = 0; i < num_analyzed; i++) {
+        for (j = i + 1; j < num_analyzed && analyzed[j]->velocity <= ALIAS_VELOCITY_RATIO * analyzed[i]->velocity; j++) {
+            x = alias_find(data, analyzed[i] - data->interfaces);
+            y = alias_find(data, analyzed[j] - data->interfaces);
+            if (x != y && alias_is_monotonic(analyzed[i], analyzed[j])) {
+                data->interfaces[MAX(x, y)].parent = MIN(x, y);
+            }
+        }
+    }
+
+    // Gather the interfaces of each router, by increasing address
+    for (i = 0; i < data->num_interfaces; i++) {
+        sizes[alias_find(data, i)]++;
+    }
+    for (i = 0; i < data->num_interfaces; i++) {
+        if (sizes[i] < 2) continue;
+        if (!(router = malloc(sizeof(alias_router_t))))                           goto ERR_ROUTER;
+        if (!(router->interfaces = malloc(sizes[i] * sizeof(address_t)))) {
+            free(router);
+            goto ERR_ROUTER;
+        }
+        router->num_interfaces = 0;
+        for (j = i; router->num_interfaces < sizes[i]; j++) {
+            if (alias_find(data, j) == i) {
+                router->interfaces[router->num_interfaces++] = data->interfaces[j].address;
+            }
+        }
+        pt_raise_event(loop, event_create(ALIAS_ROUTER, router, NULL, alias_router_free));
+    }
+
+    free(sizes);
+    free(analyzed);
+    return true;
+
+ERR_ROUTER:
+    free(sizes);
+ERR_SIZES:
+    free(analyzed);
+ERR_ANALYZED:
+    return false;
+}
+
+/**
+ * \brief Handle events to an alias algorithm instance
+ * \param loop The main loop
+ * \param event The raised event
+ * \param pdata Points to a (void *) address that may be altered by alias_loop_handler in order
+ *   to manage data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet
+ * \param opts Points to the option related to this instance (== loop->cur_instance->options)
+ */
+
+int alias_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
+{
+    alias_data_t    * data = NULL;     // Current state of the algorithm instance
+    alias_options_t * options = opts;  // Options passed to this instance
+
+    switch (event->type) {
+
+        case ALGORITHM_INIT:
+            // Check options
+            if (!options || options->num_rounds < ALIAS_MIN_SAMPLES) {
+                fprintf(stderr, "Invalid alias options\n");
+                errno = EINVAL;
+                goto FAILURE;
+            }
+
+            // Allocate structure storing current state information and update *pdata
+            if (!(data = alias_data_create(probe_skel, options))) {
+                goto FAILURE;
+            }
+            *pdata = data;
+            break;
+
+        case PROBE_REPLY:
+            data = *pdata;
+            data->num_flying--;
+            alias_handle_reply(data, options, event->data);
+            break;
+
+        case PROBE_TIMEOUT:
+            data = *pdata;
+            data->num_flying--;
+            break;
+
+        case ALGORITHM_TERM:
+            // The caller allows us to free alias's data
+            alias_data_free(*pdata);
+            *pdata = NULL;
+            pt_raise_terminated(loop);
+            return 0;
+
+        case ALGORITHM_ERROR:
+            goto FAILURE;
+
+        case PROBE_REPLY_DUPLICATE:
+        case PROBE_REPLY_LATE:
+            // Its probe has already been accounted for
+            return 0;
+
+        case NETWORK_READY:
+            // Resume the round deferred by alias_send_round
+            data = *pdata;
+            break;
+
+        default:
+            return 0;
+    }
+
+    if (!data->is_finished) {
+        if (!alias_send_round(loop, data, options)) goto FAILURE;
+
+        // Every round is over
+        if (data->round == options->num_rounds) {
+            if (!alias_resolve(loop, data)) goto FAILURE;
+            data->is_finished = true;
+            pt_raise_terminated(loop);
+        }
+    }
+
+    // The handled event is released by the algorithm layer when leaving the handler
+    return 0;
+
+FAILURE:
+    // Sent to the current instance a ALGORITHM_FAILURE notification.
+    // The caller has to free the data allocated by the algorithm.
+    pt_raise_error(loop);
+    return EINVAL;
+}
+
+static algorithm_t alias = {
+    .name    = "alias",
+    .handler = alias_loop_handler,
+    .options = (const option_t *) &alias_options
+};
+
+ALGORITHM_REGISTER(alias);
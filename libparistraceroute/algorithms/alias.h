@@ -0,0 +1,188 @@
+#ifndef ALGORITHMS_ALIAS_H
+#define ALGORITHMS_ALIAS_H
+
+#include <stdbool.h>     // bool
+#include <stdint.h>      // uint*_t
+#include <stddef.h>      // size_t
+#include <stdio.h>       // FILE
+
+#include "../address.h"  // address_t
+#include "../pt_loop.h"  // pt_loop_t
+#include "../event.h"    // event_t
+#include "../options.h"  // option_t
+#include "../output.h"   // output_t
+#include "../probe.h"    // probe_t
+
+// Minimum number of samples of an interface whose IP identification is analyzed
+#define ALIAS_MIN_SAMPLES 3
+
+#define OPTIONS_ALIAS_NUM_ROUNDS_DEFAULT 10
+
+//                                def                               min                max  enabled
+#define OPTIONS_ALIAS_NUM_ROUNDS {OPTIONS_ALIAS_NUM_ROUNDS_DEFAULT, ALIAS_MIN_SAMPLES, 255, 0}
+
+#define ALIAS_HELP_alias_rounds "Set the number of times each interface is probed when resolving the aliases (default: 10)."
+
+/*
+ * Principle: Alias resolution (MIDAR, Ally)
+ *
+ * Many routers stamp the packets they send with a single IP identification
+ * counter, shared by all their interfaces. The replies sent by two aliases
+ * (i.e. two interfaces of the same router) thus form a single monotonic
+ * time series, while the counters of distinct routers are unrelated.
+ *
+ * Algorithm: every candidate interface is probed directly, once per round,
+ * during num_rounds rounds. A round probes the interfaces in turn, in the
+ * order of their addresses (even rounds) or in the reverse order (odd
+ * rounds), so that the samples of any two interfaces are interleaved both
+ * ways. The next round starts once every probe of the current round is
+ * answered or lost. The probes of a round are sent in batches, as long as
+ * the network layer grants credits, so that a whole campaign shares the
+ * probing budget of the other instances.
+ *
+ *     An interface is analyzed if it has replied ALIAS_MIN_SAMPLES times,
+ *     and if its IP identification strictly increases (modulo 2^16) in the
+ *     order of the probes. Its velocity is the increase of its counter per
+ *     second.
+ *
+ *     The candidate pairs are the analyzed interfaces whose velocities are
+ *     similar (within a factor ALIAS_VELOCITY_RATIO).
+ *
+ *     Monotonic bounds test: a pair is deemed aliased if the samples of both
+ *     interfaces, merged in the order of the probes, strictly increase, and
+ *     none of these increases exceeds the largest increase between two
+ *     consecutive samples of either interface.
+ *
+ * The aliased pairs are merged transitively, and each router made of
+ * several interfaces is notified to the caller. Only the IPv4 interfaces
+ * are resolved, as IPv6 packets carry no identification unless they are
+ * fragmented.
+ */
+
+//--------------------------------------------------------------------
+// Options
+//--------------------------------------------------------------------
+
+typedef struct {
+    const address_t * interfaces;     /**< The candidate interfaces (duplicates are ignored) */
+    size_t            num_interfaces; /**< Number of candidate interfaces */
+    size_t            num_rounds;     /**< Number of probes sent to each interface */
+} alias_options_t;
+
+size_t   options_alias_get_num_rounds();
+unsigned options_alias_get_is_set();
+
+const option_t * alias_get_options();
+
+/**
+ * \brief Retrieve the default options of alias.
+ * \return The corresponding alias_options_t structure.
+ */
+
+alias_options_t alias_get_default_options();
+
+/**
+ * \brief Initialize the alias options structure according to the command
+ *    line (see alias_get_options). The candidate interfaces are set by the
+ *    caller.
+ * \param alias_options The corresponding alias_options_t structure.
+ */
+
+void options_alias_init(alias_options_t * alias_options);
+
+//--------------------------------------------------------------------
+// Custom-events raised by alias algorithm
+//--------------------------------------------------------------------
+
+typedef enum {
+    // event_type      | data (type)      | data (meaning)
+    // ----------------+------------------+--------------------------------------------
+    ALIAS_ROUTER    // | alias_router_t * | A router made of several candidate interfaces
+} alias_event_type_t;
+
+typedef struct {
+    alias_event_type_t type;
+    void             * data;
+    void            (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
+    void             * zero;
+} alias_event_t;
+
+typedef struct {
+    address_t * interfaces;     /**< Its interfaces, by increasing address. The first one represents the router */
+    size_t      num_interfaces; /**< Number of interfaces (at least 2) */
+} alias_router_t;
+
+//--------------------------------------------------------------------
+// Data
+//--------------------------------------------------------------------
+
+typedef struct {
+    uint64_t rank;  /**< Rank of its probe among the probes sent by this instance */
+    uint64_t time;  /**< Sending time of its probe (see get_time_ns) */
+    uint16_t ip_id; /**< IP identification of the reply */
+} alias_sample_t;
+
+typedef struct {
+    address_t        address;     /**< Address of the interface */
+    alias_sample_t * samples;     /**< Its samples, ordered by rank (num_rounds slots) */
+    size_t           num_samples; /**< Number of samples collected so far */
+    double           velocity;    /**< Increase of its IP identification per second, 0 if it is not analyzed */
+    uint16_t         max_step;    /**< Largest increase between two consecutive samples */
+    size_t           parent;      /**< Index of its parent in the set of its aliases (union-find) */
+} alias_interface_t;
+
+typedef struct {
+    probe_t           * probe_skel;     /**< The skeleton of the probes */
+    alias_interface_t * interfaces;     /**< The IPv4 candidate interfaces, by increasing address */
+    size_t              num_interfaces; /**< Number of interfaces */
+    alias_sample_t    * samples;        /**< The samples of every interface */
+    size_t              round;          /**< The current round */
+    size_t              num_sent;       /**< Number of probes of the current round sent so far */
+    size_t              num_flying;     /**< Number of probes sent and neither replied nor expired */
+    size_t              num_probes;     /**< Number of probes sent so far */
+    bool                is_finished;    /**< True iif the aliases have been notified */
+} alias_data_t;
+
+/**
+ * \brief Release an alias_data_t structure from the memory.
+ * \param data A pointer to the alias_data_t instance.
+ */
+
+void alias_data_free(alias_data_t * data);
+
+//--------------------------------------------------------------------
+// Output
+//--------------------------------------------------------------------
+
+/**
+ * \brief Print an alias_event_t event in a given stream.
+ * \param out The output stream.
+ * \param alias_event The printed event.
+ */
+
+void alias_event_fdump(FILE * out, const alias_event_t * alias_event);
+
+/**
+ * \brief Write a router in a structured output: each of its interfaces
+ *    but the first one is mapped to the first one.
+ * \param output The output_t instance.
+ * \param dst_addr The destination of the records, NULL if none.
+ * \param router The router.
+ * \return true iif successful
+ */
+
+bool alias_router_output(output_t * output, const address_t * dst_addr, const alias_router_t * router);
+
+/**
+ * \brief Handle events to an alias algorithm instance.
+ * \param loop The main loop.
+ * \param event The raised event.
+ * \param pdata Points to the data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packets.
+ *    Its destination and its TTL are overwritten.
+ * \param opts Points to the alias_options_t of this instance.
+ */
+
+int alias_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts);
+
+#endif // ALGORITHMS_ALIAS_H
@@ -11,20 +11,16 @@
 #include "../pt_loop.h"    // pt_send_probe
 #include "../lattice.h"    // LATTICE_*
 #include "../probe.h"      // probe_t
+#include "../results.h"    // results_add_link
+#include "mda/topology.h"  // mda_topology_*
 
 //---------------------------------------------------------------------------
 // Private structures
 //---------------------------------------------------------------------------
 
-typedef struct {
-    address_t     * address;
-    lattice_elt_t * result;
-} mda_address_t;
-
 typedef struct {
     uint8_t         ttl;
     uintmax_t       flow_id;
-    lattice_elt_t * result;
 } mda_search_data_t;
 
 //---------------------------------------------------------------------------
@@ -33,6 +29,8 @@ typedef struct {
 //---------------------------------------------------------------------------
 
 static unsigned mda_values[10] = OPTIONS_MDA_BOUND_MAXBRANCH;
+static bool     pipeline        = OPTIONS_MDA_PIPELINE_DEFAULT;
+static struct opt_str cache_filename = {NULL, 0};
 
 // MDA options
 // TODO: Can only pass integer values for confidence (thus cannot, for
@@ -40,6 +38,8 @@ static unsigned mda_values[10] = OPTIONS_MDA_BOUND_MAXBRANCH;
 static option_t mda_opt_specs[] = {
     // action           short long          metavar                          help    variable
     {opt_store_int_3,   "B",  "--mda",      "bound,max_branch,max_children", HELP_B, mda_values},
+    {opt_store_1,       OPT_NO_SF, "--mda-pipeline", OPT_NO_METAVAR,         HELP_mda_pipeline, &pipeline},
+    {opt_store_str,     OPT_NO_SF, "--mda-cache",    "FILE",                 HELP_mda_cache,    &cache_filename},
     END_OPT_SPECS
     // {opt_store_int, OPT_NO_SF, "confidence", "PERCENTAGE", "level of confidence", 0},
     // per dest
@@ -63,8 +63,16 @@ unsigned options_mda_get_max_children() {
     return mda_values[6];
 }
 
+bool options_mda_get_pipeline() {
+    return pipeline;
+}
+
+const char * options_mda_get_cache_filename() {
+    return cache_filename.s;
+}
+
 unsigned options_mda_get_is_set() {
-    return mda_values[9];
+    return mda_values[9] || pipeline || cache_filename.s;
 }
 
 void options_mda_init(mda_options_t * mda_options)
@@ -72,6 +80,7 @@ void options_mda_init(mda_options_t * mda_options)
     mda_options->bound        = options_mda_get_bound();
     mda_options->max_branch   = options_mda_get_max_branch();
     mda_options->max_children = options_mda_get_max_children();
+    mda_options->pipeline     = options_mda_get_pipeline();
 }
 
 inline mda_options_t mda_get_default_options() {
@@ -80,7 +89,8 @@ inline mda_options_t mda_get_default_options() {
          .traceroute_options = traceroute_get_default_options(),
          .bound              = 95,
          .max_branch         = 16,
-         .max_children       = 128
+         .max_children       = 128,
+         .pipeline           = OPTIONS_MDA_PIPELINE_DEFAULT
     };
 
     return mda_options;
@@ -134,14 +144,27 @@ static int mda_stopping_points(unsigned int num_interfaces, unsigned int confide
 
 static bool mda_event_new_link(pt_loop_t * loop, mda_interface_t * src, mda_interface_t * dst)
 {
-    event_t          * mda_event;
-    mda_interface_t ** link;
+    event_t             * mda_event;
+    mda_interface_t    ** link;
+    const mda_options_t * options = algorithm_instance_get_options(loop->cur_instance);
+
+    // The results only keep the addresses of the link
+    if (!results_add_link(
+        pt_get_results(loop),
+        src->num_ttls ? src->ttl_set[0] : 0,
+        src->address,
+        dst ? dst->address : NULL
+    )) {
+        goto ERR_LINK;
+    }
 
     if (!(link = malloc(2 * sizeof(mda_interface_t)))) goto ERR_LINK;
     link[0] = src;
     link[1] = dst;
     if (!(mda_event = event_create(MDA_NEW_LINK, link, NULL, free))) goto ERR_MDA_EVENT;
-    return pt_raise_event(loop, mda_event);
+
+    // The caller may print the hostname of the source of the link (see mda_link_dump)
+    return pt_raise_event_resolved(loop, mda_event, src->address, options->traceroute_options.do_resolv ? PT_LOOKUP_HOSTNAME : 0);
 
 ERR_MDA_EVENT:
     free(link);
@@ -177,10 +200,147 @@ ERR_LINK:
  * \return
  */
 
-static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data)
+/**
+ * \brief Set the TTL and the flow identifier of a probe duplicated from
+ *   the probe skeleton.
+ * \param mda_data Data attached to this instance of mda.
+ * \param probe The probe to update.
+ * \param ttl The TTL of the probe.
+ * \param flow_id The flow identifier of the probe.
+ * \return true iif successful
+ */
+
+static bool mda_set_probe_fields(mda_data_t * mda_data, probe_t * probe, uint8_t ttl, uintmax_t flow_id)
+{
+    // The skeleton has been finalized in mda_handler_init and the checksums
+    // are computed by the network layer, so we only have to store the fields.
+    if (mda_data->has_fields) {
+        return probe_write_resolved_field(probe, &mda_data->ttl_field, ttl)
+            && probe_write_resolved_field(probe, &mda_data->flow_id_field, (uint16_t) flow_id);
+    }
+
+    // I16 casts flow_id into a uint16_t before memcpy
+    return probe_set_fields_deferred(probe, I8("ttl", ttl), I16("flow_id", flow_id), NULL);
+}
+
+/**
+ * \brief Compute the number of probes that an interface must send to
+ *    enumerate its next hops with mda-lite.
+ *
+ * The stopping rule is applied to the whole hop (with the total number of
+ * next hops discovered from this hop). Assuming that the load balancing is
+ * uniform, each interface gets a share of these probes proportional to the
+ * number of flows which have reached it (at least one probe).
+ *
+ * \param elt A lattice node.
+ * \param bound The bound used by the stopping rule.
+ * \return The number of probes this interface still has to send.
+ */
+
+static int mda_lite_get_num_to_send(const lattice_elt_t * elt, bound_t * bound)
+{
+    const lattice_elt_t   * sibling;
+    const mda_interface_t * interface = lattice_elt_get_data(elt),
+                          * sibling_interface;
+    size_t                  i, num_siblings = lattice_elt_get_num_siblings(elt),
+                            num_next = 0, num_flows = 0, hop_num_flows = 0,
+                            hop_to_send;
+
+    for (i = 0; i < num_siblings; i++) {
+        sibling = lattice_elt_get_ith_sibling(elt, i);
+        sibling_interface = lattice_elt_get_data(sibling);
+        num_next      += lattice_elt_get_num_next(sibling);
+        hop_num_flows += sibling_interface->num_ttl_flows
+            - mda_interface_get_num_flows(sibling_interface, MDA_FLOW_TESTING);
+    }
+    num_flows = interface->num_ttl_flows
+        - mda_interface_get_num_flows(interface, MDA_FLOW_TESTING);
+
+    // Share of this interface, rounded up
+    hop_to_send = bound_get_nk(bound, MAX(num_next + 1, 2));
+    hop_to_send = hop_num_flows ?
+        (hop_to_send * num_flows + hop_num_flows - 1) / hop_num_flows :
+        (hop_to_send + num_siblings - 1) / num_siblings;
+    return (int) MAX(hop_to_send, 1) - (int) interface->sent;
+}
+
+/**
+ * \brief Retrieve the addresses of the next hops of an interface.
+ * \param elt A lattice node.
+ * \param next_hops An array of MDA_TOPOLOGY_MAX_NEXT_HOPS addresses, in
+ *    which the addresses are written.
+ * \return The number of next hops, 0 if they cannot be stored in the
+ *    topology file (a star, or too many next hops).
+ */
+
+static size_t mda_get_next_hops(const lattice_elt_t * elt, const address_t ** next_hops)
+{
+    const mda_interface_t * next_interface;
+    size_t                  i, num_next = lattice_elt_get_num_next(elt);
+
+    if (num_next > MDA_TOPOLOGY_MAX_NEXT_HOPS) return 0;
+    for (i = 0; i < num_next; i++) {
+        next_interface = lattice_elt_get_data(lattice_elt_get_ith_next(elt, i));
+        if (!(next_hops[i] = next_interface->address)) return 0;
+    }
+    return num_next;
+}
+
+/**
+ * \brief Adjust the number of probes an interface has to send according to
+ *    the next hops enumerated by a previous run (see topology.h). Once
+ *    every known next hop has been found again, the interface is verified
+ *    and stops enumerating. If a new next hop has been found, or if a
+ *    known one has not, the enumeration goes on as usual.
+ * \param elt The lattice node of this interface.
+ * \param to_send The number of probes to send according to the stopping
+ *    rule.
+ * \return The number of probes to send.
+ */
+
+static int mda_topology_get_num_to_send(lattice_elt_t * elt, int to_send)
+{
+    mda_interface_t * interface = lattice_elt_get_data(elt);
+    const address_t * next_hops[MDA_TOPOLOGY_MAX_NEXT_HOPS];
+    size_t            num_next, num_known;
+    int               num_verify;
+
+    if (interface->is_verified) return 0;
+    if (!interface->address || to_send <= 0) return to_send;
+
+    num_next = mda_get_next_hops(elt, next_hops);
+    if (num_next != lattice_elt_get_num_next(elt)
+    || !(num_known = mda_topology_check(interface->address, next_hops, num_next))) {
+        return to_send;
+    }
+
+    num_verify = num_known + MDA_TOPOLOGY_NUM_EXTRA_PROBES - interface->sent;
+    if (num_verify > 0) {
+        return MIN(to_send, num_verify);
+    } else if (num_next == num_known) {
+        interface->is_verified = true;
+        return 0;
+    }
+    return to_send;
+}
+
+/**
+ * \brief Send the probes needed to enumerate the next hops of an interface.
+ * \param elt The lattice node of this interface.
+ * \param mda_data The data related to this mda instance.
+ * \param is_speculative Pass true if the enumeration of the previous hops is
+ *    not complete. In this case, we only send probes with the flows already
+ *    known to reach this interface (no new flow is created or tested), so
+ *    that no probe is wasted.
+ * \return A value among LATTICE_DONE, LATTICE_CONTINUE (waiting for replies),
+ *    LATTICE_INTERRUPT_NEXT (enumeration not complete) or LATTICE_ERROR.
+ */
+
+static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data, bool is_speculative)
 {
     mda_interface_t * interface = lattice_elt_get_data(elt);
     mda_ttl_flow_t  * mda_ttl_flow;
+    const address_t * next_hops[MDA_TOPOLOGY_MAX_NEXT_HOPS];
     /* Number of interfaces at the same TTL */
     size_t    num_nexthops = 0;
     probe_t * probe;
@@ -195,19 +355,30 @@ static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data
 
     // Determine the number of next hop interfaces
     num_nexthops = lattice_elt_get_num_next(elt);
+    num_siblings = lattice_elt_get_num_siblings(elt);
 
     // ... and thus deduce how many packets we have to send
     /*to_send = mda_stopping_points(MAX(num_nexthops + 1, 2),
      * mda_data->confidence) - interface->sent;*/
-    to_send = bound_get_nk(mda_data->bound, MAX(num_nexthops + 1, 2)) - interface->sent;
+    if (mda_data->is_lite && num_siblings > 1 && !interface->is_meshed) {
+        // mda-lite considers the whole hop, unless it is meshed
+        to_send = mda_lite_get_num_to_send(elt, mda_data->bound);
+    } else {
+        to_send = bound_get_nk(mda_data->bound, MAX(num_nexthops + 1, 2)) - interface->sent;
+    }
+    to_send = mda_topology_get_num_to_send(elt, to_send);
 
     //printf("find next hops of %s (to_send= %zu)\n", interface->address, to_send);
     //printf("Interface %s : to_send %d - sent %zu - received %zu\n", interface->address, to_send, interface->sent, interface->received);
     if ((to_send <= 0) && (interface->sent == interface->received + interface->timeout)) {
+        // Save the next hops enumerated (see topology.h)
+        if (!interface->is_verified && interface->address) {
+            mda_topology_update(interface->address, next_hops, mda_get_next_hops(elt, next_hops));
+        }
         return LATTICE_DONE; // Done enumerating, walking/DFS can continue
     }
 
-    if (interface->address && (address_compare(interface->address, mda_data->dst_ip) == 0)) {
+    if (interface->address && address_equals(interface->address, mda_data->dst_ip)) {
         return (interface->sent == interface->received) ? LATTICE_DONE : LATTICE_CONTINUE;
     }
 
@@ -215,8 +386,9 @@ static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data
 
     /* How many interfaces at current ttl */
     // Only if the previous is done enumerating
-    num_siblings = lattice_elt_get_num_siblings(elt);
-    if (num_siblings > 1) {
+    if (is_speculative) {
+        num_flows_avail = mda_interface_get_num_flows(interface, MDA_FLOW_AVAILABLE);
+    } else if (num_siblings > 1) {
         /* There are many interfaces at this TTL, we must ensure we have enough
          * flows available at the current ttl */
 
@@ -235,12 +407,17 @@ static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data
                  * flight for each interface ? or multiply the number of probes in
                  * flight by the number of interface (might overestimate ?)*/
                 ttl = interface->ttl_set[i % interface->num_ttls]; // Vary ttl over all possible
-                probe = probe_dup(mda_data->skel);
                 flow_id = ++mda_data->last_flow_id;
                 mda_interface_add_flow_id(interface, ttl, flow_id, MDA_FLOW_TESTING); // TODO control returned value
-                // I16 casts flow_id into a uint16_t before memcpy
-                probe_set_fields(probe, I8("ttl", ttl), I16("flow_id", flow_id), NULL); // TODO control returned value, free fields
-                pt_send_probe(mda_data->loop, probe); // TODO control returned value
+                if (!mda_index_add_flow(mda_data->index, ttl, flow_id, MDA_FLOW_TESTING, elt)) {
+                    goto ERR_INDEX_ADD_FLOW;
+                }
+                if (!(probe = probe_dup(mda_data->skel))) {
+                    goto ERR_PROBE_DUP;
+                }
+                mda_set_probe_fields(mda_data, probe, ttl, flow_id); // TODO control returned value
+                if (pt_send_probe(mda_data->loop, probe)) mda_data->num_flying++; // TODO control returned value
+                mda_data->num_probes++;
             }
         }
     } else {
@@ -267,20 +444,25 @@ static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data
             break;
         }
         
-        flow_id = mda_ttl_flow->mda_flow->flow_id;
+        flow_id = mda_ttl_flow->mda_flow.flow_id;
         ttl     = mda_ttl_flow->ttl;
+        if (!mda_index_add_flow(mda_data->index, ttl, flow_id, mda_ttl_flow->mda_flow.state, elt)) {
+            goto ERR_INDEX_ADD_FLOW;
+        }
         // Send corresponding probe with ttl + 1
         if (!(probe = probe_dup(mda_data->skel))) {
             goto ERR_PROBE_DUP;
         }
-        probe_set_fields(probe, I16("flow_id", flow_id), I8("ttl", ttl + 1), NULL); // TODO control returned value, free fields
-        pt_send_probe(mda_data->loop, probe);
+        mda_set_probe_fields(mda_data, probe, ttl + 1, flow_id); // TODO control returned value
+        if (pt_send_probe(mda_data->loop, probe)) mda_data->num_flying++;
+        mda_data->num_probes++;
         interface->sent++;
     }
 
     return LATTICE_INTERRUPT_NEXT; // OK, but enumeration not complete, interrupt walk
 
 ERR_PROBE_DUP:
+ERR_INDEX_ADD_FLOW:
     return LATTICE_ERROR;
 }
 
@@ -350,7 +532,7 @@ static lattice_return_t mda_process_interface(lattice_elt_t * elt, void * data)
     //    - Requires enough flow_ids from previous interfaces .prev[] (summed)
     //    - To be transformed into a link query
 
-    if ((ret = mda_enumerate(elt, mda_data)) < 0) {
+    if ((ret = mda_enumerate(elt, mda_data, false)) < 0) {
         goto ERR_FIND_NEXT_HOPS;
     }
 
@@ -374,66 +556,20 @@ ERR_CLASSIFY:
     return LATTICE_ERROR;
 }
 
-static lattice_return_t mda_search_source(lattice_elt_t * elt, void * data)
-{
-    mda_interface_t   * interface = lattice_elt_get_data(elt);
-    mda_search_data_t * search    = data;
-    mda_flow_t        * mda_flow;
-    mda_ttl_flow_t    * mda_ttl_flow;
-    size_t              i, j, size;
-    uint8_t             ttl;
-
-    for (i = 0; i < interface->num_ttls; ++i) {
-        ttl = interface->ttl_set[i];
-        if (ttl == search->ttl) {
-            size = dynarray_get_size(interface->ttl_flows);
-            for (j = 0; j < size; j++) {
-                mda_ttl_flow = dynarray_get_ith_element(interface->ttl_flows, j);
-                mda_flow = mda_ttl_flow->mda_flow;
-                if ((mda_flow->flow_id == search->flow_id) 
-                && (mda_ttl_flow->ttl == search->ttl)
-                &&  (mda_flow->state != MDA_FLOW_TESTING)) {
-                    search->result = elt;
-                    return LATTICE_INTERRUPT_ALL;
-                }
-            }
-
-            /**
-             * Note: Awkward check is needed because in the case of nodes with
-             * multiple ttl_set, it is possible for a pair of nodes to have the
-             * same ttl while simultaneously being in a parent/child
-             * relationship. Thus, if the parent is searched unsuccessfuly at
-             * the correct ttl, we still must search the child as it could
-             * have both the correct ttl and the correct flow_id. - T.D.
-             */
-            if (interface->num_ttls == 1) {
-                return LATTICE_INTERRUPT_NEXT; // don't process children
-            }
-        }
-    }
-    return LATTICE_CONTINUE; // continue until we reach the right ttl
-}
-
 static lattice_return_t mda_delete_flow(lattice_elt_t * elt, void * data)
 {
     mda_interface_t    * interface = lattice_elt_get_data(elt);
     mda_search_data_t  * search    = data;
-    mda_flow_t         * mda_flow;
     mda_ttl_flow_t     * mda_ttl_flow;
-    size_t               i, j, size;
+    size_t               i;
     uint8_t              ttl;
 
     for (i = 0; i < interface->num_ttls; ++i) {
         ttl = interface->ttl_set[i];
         if (ttl == search->ttl) {
-            size = dynarray_get_size(interface->ttl_flows);
-            for (j = 0; j < size; j++) {
-                mda_ttl_flow = dynarray_get_ith_element(interface->ttl_flows, j);
-                mda_flow     = mda_ttl_flow->mda_flow;
-                if ((mda_flow->flow_id == search->flow_id) && (mda_flow->state == MDA_FLOW_TESTING)) {
-                    dynarray_del_ith_element(interface->ttl_flows, j, (ELEMENT_FREE) mda_ttl_flow_free);
-                    return LATTICE_INTERRUPT_ALL;
-                }
+            if ((mda_ttl_flow = mda_interface_find_flow(interface, search->flow_id, MDA_FLOW_TESTING))) {
+                mda_interface_del_flow(interface, mda_ttl_flow);
+                return LATTICE_INTERRUPT_ALL;
             }
             return LATTICE_INTERRUPT_NEXT; // don't process children
         }
@@ -445,23 +581,17 @@ static lattice_return_t mda_timeout_flow(lattice_elt_t * elt, void * data)
 {
     mda_interface_t    * interface = lattice_elt_get_data(elt);
     mda_search_data_t  * search    = data;
-    mda_flow_t         * mda_flow;
     mda_ttl_flow_t     * mda_ttl_flow;
-    size_t               i, j, size;
+    size_t               i;
     uint8_t              ttl;
 
     for (i = 0; i < interface->num_ttls; ++i) {
         ttl = interface->ttl_set[i];
 
         if (ttl == search->ttl) {
-            size = dynarray_get_size(interface->ttl_flows);
-            for (j = 0; j < size; j++) {
-                mda_ttl_flow = dynarray_get_ith_element(interface->ttl_flows, j);
-                mda_flow     = mda_ttl_flow->mda_flow;
-                if ((mda_flow->flow_id == search->flow_id) && (mda_flow->state == MDA_FLOW_UNAVAILABLE)) {
-                    mda_flow->state = MDA_FLOW_TIMEOUT;
-                    return LATTICE_INTERRUPT_ALL;
-                }
+            if ((mda_ttl_flow = mda_interface_find_flow(interface, search->flow_id, MDA_FLOW_UNAVAILABLE))) {
+                mda_interface_set_flow_state(interface, mda_ttl_flow, MDA_FLOW_TIMEOUT);
+                return LATTICE_INTERRUPT_ALL;
             }
             return LATTICE_INTERRUPT_NEXT; // don't process children
         }
@@ -469,16 +599,368 @@ static lattice_return_t mda_timeout_flow(lattice_elt_t * elt, void * data)
     return LATTICE_CONTINUE; // continue until we reach the right ttl
 }
 
-static lattice_return_t mda_search_interface(lattice_elt_t * elt, void * data)
+//---------------------------------------------------------------------------
+// Incremental processing
+//
+// Instead of walking the whole lattice after each event, mda only processes
+// again the interfaces affected by this event (the "dirty" ones). A dirty
+// interface is processed only if it would have been reached by a DFS walk,
+// i.e. if at least one of its previous hops is "walkable" (processed and
+// not interrupting the walk). Changing the walkability of an interface
+// dirties its next hops.
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Schedule a lattice node to be processed again.
+ * \param data The data related to this mda instance.
+ * \param elt A lattice node.
+ * \return true iif successful
+ */
+
+static bool mda_mark_dirty(mda_data_t * data, lattice_elt_t * elt)
 {
     mda_interface_t * interface = lattice_elt_get_data(elt);
-    mda_address_t   * search    = data;
 
-    if (interface->address && address_compare(interface->address, search->address) == 0) {
-        search->result = elt;
-        return LATTICE_INTERRUPT_ALL;
+    if (interface->is_dirty) return true;
+    interface->is_dirty = true;
+    return deque_push_back(data->dirty, elt);
+}
+
+/**
+ * \brief Schedule all the interfaces of a hop to be processed again.
+ * \param data The data related to this mda instance.
+ * \param elt A lattice node of this hop.
+ * \return true iif successful
+ */
+
+static bool mda_mark_hop_dirty(mda_data_t * data, lattice_elt_t * elt)
+{
+    size_t i, num_siblings = lattice_elt_get_num_siblings(elt);
+
+    // The siblings of elt include elt
+    for (i = 0; i < num_siblings; i++) {
+        if (!mda_mark_dirty(data, lattice_elt_get_ith_sibling(elt, i))) {
+            return false;
+        }
     }
-    return LATTICE_CONTINUE;
+    return true;
+}
+
+/**
+ * \brief Check whether the links leaving a hop are meshed, i.e. whether an
+ *    interface of this hop having several next hops reaches an interface
+ *    having several previous hops. If so, mda-lite explores this hop with
+ *    the full MDA.
+ * \param data The data related to this mda instance.
+ * \param elt A lattice node of this hop.
+ * \return true iif successful
+ */
+
+static bool mda_lite_check_meshing(mda_data_t * data, lattice_elt_t * elt)
+{
+    const lattice_elt_t   * sibling;
+    const mda_interface_t * next_interface;
+    size_t                  i, j, k, num_siblings, num_next;
+
+    if (((const mda_interface_t *) lattice_elt_get_data(elt))->is_meshed) return true;
+
+    num_siblings = lattice_elt_get_num_siblings(elt);
+    for (i = 0; i < num_siblings; i++) {
+        sibling = lattice_elt_get_ith_sibling(elt, i);
+        if ((num_next = lattice_elt_get_num_next(sibling)) < 2) continue;
+
+        for (j = 0; j < num_next; j++) {
+            next_interface = lattice_elt_get_data(lattice_elt_get_ith_next(sibling, j));
+            if (next_interface->num_prev > 1) {
+                for (k = 0; k < num_siblings; k++) {
+                    sibling = lattice_elt_get_ith_sibling(elt, k);
+                    ((mda_interface_t *) lattice_elt_get_data(sibling))->is_meshed = true;
+                }
+                return mda_mark_hop_dirty(data, elt);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Record a new link of the lattice. The destination and
+ *    its siblings (whose number of siblings has changed) become dirty.
+ * \param data The data related to this mda instance.
+ * \param source_elt The source of the link.
+ * \param dest_elt The destination of the link.
+ * \return true iif successful
+ */
+
+static bool mda_add_link(mda_data_t * data, lattice_elt_t * source_elt, lattice_elt_t * dest_elt)
+{
+    const mda_interface_t * source_interface = lattice_elt_get_data(source_elt);
+    mda_interface_t       * dest_interface = lattice_elt_get_data(dest_elt);
+
+    dest_interface->num_prev++;
+    if (source_interface->is_walkable) {
+        dest_interface->num_walkable_prev++;
+    }
+    if (source_interface->is_visited) {
+        dest_interface->num_visited_prev++;
+    }
+
+    if (data->is_lite && !mda_lite_check_meshing(data, source_elt)) {
+        return false;
+    }
+
+    return mda_mark_hop_dirty(data, dest_elt);
+}
+
+/**
+ * \brief Add an interface to the lattice (and to its indexes).
+ * \param data The data related to this mda instance.
+ * \param source_elt The previous hop, or NULL for the root.
+ * \param interface The new interface.
+ * \return The corresponding lattice node, NULL in case of failure.
+ */
+
+static lattice_elt_t * mda_add_interface(mda_data_t * data, lattice_elt_t * source_elt, mda_interface_t * interface)
+{
+    lattice_elt_t * elt;
+    bool            is_new = interface->address && !mda_index_find_interface(data->index, interface->address);
+
+    if (!(elt = lattice_add_element(data->lattice, source_elt, interface))) goto ERR_LATTICE_ADD_ELEMENT;
+    if (!mda_index_add_interface(data->index, elt))                    goto ERR_INDEX_ADD_INTERFACE;
+    data->num_pending++;
+
+    // Keep the next hops shared by the other instances (see topology.h)
+    if (is_new) mda_topology_ref(interface->address);
+
+    if (source_elt) {
+        if (!mda_add_link(data, source_elt, elt)) goto ERR_ADD_LINK;
+    } else {
+        interface->num_walkable_prev = 1;
+        if (!mda_mark_dirty(data, elt)) goto ERR_MARK_DIRTY;
+    }
+    return elt;
+
+ERR_MARK_DIRTY:
+ERR_ADD_LINK:
+ERR_INDEX_ADD_INTERFACE:
+ERR_LATTICE_ADD_ELEMENT:
+    return NULL;
+}
+
+/**
+ * \brief Connect two interfaces already stored in the lattice.
+ * \param data The data related to this mda instance.
+ * \param source_elt The source of the link.
+ * \param dest_elt The destination of the link.
+ * \return true iif successful
+ */
+
+static bool mda_connect(mda_data_t * data, lattice_elt_t * source_elt, lattice_elt_t * dest_elt)
+{
+    size_t num_next = lattice_elt_get_num_next(source_elt);
+
+    if (!lattice_connect(data->lattice, source_elt, dest_elt)) return false;
+
+    // lattice_connect does nothing if the link already exists
+    return lattice_elt_get_num_next(source_elt) == num_next
+        || mda_add_link(data, source_elt, dest_elt);
+}
+
+/**
+ * \brief Report the links discovered from an interface once all the probes it
+ *    has sent have been answered or have timed out. If they have all timed out,
+ *    a star interface is added as its next hop.
+ * \param data The data related to this mda instance.
+ * \param source_elt The lattice node of this interface.
+ * \param ttl The TTL of its next hops.
+ * \param options The options passed to mda.
+ * \return true iif successful
+ */
+
+static bool mda_complete_interface(mda_data_t * data, lattice_elt_t * source_elt, uint8_t ttl, const mda_options_t * options)
+{
+    mda_interface_t * source_interface = lattice_elt_get_data(source_elt),
+                    * new_iface;
+    lattice_elt_t   * next_elt;
+    size_t            i, num_next;
+
+    if (source_interface->timeout == source_interface->sent) { // XXX to_send ??
+        // All timeouts, we need to add a star interface, and start a new
+        // discovery at the next ttl. Currently, that supposes we have only
+        // one interface...
+        if (source_interface->num_stars < options->traceroute_options.max_undiscovered) {
+            if (!(new_iface = mda_interface_create(NULL))) {
+                return false;
+            }
+            new_iface->ttl_set[0] = ttl; // This interface's first ttl (messy way of doing it:
+                                         // create technically makes first ttl 0, this overwrites).
+
+            new_iface->num_stars = source_interface->num_stars + 1;
+
+            return mda_add_interface(data, source_elt, new_iface)
+                && mda_event_new_link(data->loop, source_interface, new_iface);
+        }
+        return mda_event_new_link(data->loop, source_interface, NULL);
+    }
+
+    // We have received all answers, and the last is a timeout (since we
+    // are processing it
+    num_next = lattice_elt_get_num_next(source_elt);
+    for (i = 0; i < num_next; i++) {
+        next_elt = lattice_elt_get_ith_next(source_elt, i);
+        if (!mda_event_new_link(data->loop, source_interface, lattice_elt_get_data(next_elt))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Update the walkability of an interface. If it changes, its next
+ *    hops become dirty.
+ * \param data The data related to this mda instance.
+ * \param elt A lattice node.
+ * \param is_walkable The new walkability of this node.
+ * \return true iif successful
+ */
+
+static bool mda_set_walkable(mda_data_t * data, lattice_elt_t * elt, bool is_walkable)
+{
+    mda_interface_t * interface = lattice_elt_get_data(elt),
+                    * next_interface;
+    lattice_elt_t   * next_elt;
+    size_t            i, num_next;
+
+    if (interface->is_walkable == is_walkable) return true;
+    interface->is_walkable = is_walkable;
+
+    num_next = lattice_elt_get_num_next(elt);
+    for (i = 0; i < num_next; i++) {
+        next_elt = lattice_elt_get_ith_next(elt, i);
+        next_interface = lattice_elt_get_data(next_elt);
+        if (is_walkable) {
+            next_interface->num_walkable_prev++;
+        } else {
+            next_interface->num_walkable_prev--;
+        }
+        if (!mda_mark_dirty(data, next_elt)) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Record that an interface has been processed. The first time, its
+ *    next hops become dirty, since they may now be probed speculatively.
+ * \param data The data related to this mda instance.
+ * \param elt A lattice node.
+ * \return true iif successful
+ */
+
+static bool mda_set_visited(mda_data_t * data, lattice_elt_t * elt)
+{
+    mda_interface_t * interface = lattice_elt_get_data(elt),
+                    * next_interface;
+    lattice_elt_t   * next_elt;
+    size_t            i, num_next;
+
+    if (interface->is_visited) return true;
+    interface->is_visited = true;
+
+    num_next = lattice_elt_get_num_next(elt);
+    for (i = 0; i < num_next; i++) {
+        next_elt = lattice_elt_get_ith_next(elt, i);
+        next_interface = lattice_elt_get_data(next_elt);
+        next_interface->num_visited_prev++;
+        if (!mda_mark_dirty(data, next_elt)) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Process the dirty interfaces (and those they make dirty).
+ * \param data The data related to this mda instance.
+ * \param options The options passed to mda.
+ * \return true iif successful
+ */
+
+static bool mda_process_dirty(mda_data_t * data, const mda_options_t * options)
+{
+    lattice_elt_t    * elt;
+    mda_interface_t  * interface;
+    lattice_return_t   ret;
+    bool               is_walkable, was_speculative;
+
+    // data->dirty may grow while being processed
+    while (deque_get_size(data->dirty)) {
+        // The network layer holds enough probes: the remaining interfaces
+        // stay dirty and are enumerated once some slots are freed
+        if (pt_get_send_credits(data->loop) == 0) {
+            return pt_wait_send_credits(data->loop);
+        }
+
+        elt = deque_pop_front(data->dirty);
+        interface = lattice_elt_get_data(elt);
+        interface->is_dirty = false;
+
+        if (interface->num_walkable_prev) {
+            was_speculative = interface->is_speculative;
+            interface->is_speculative = false;
+            if ((ret = mda_process_interface(elt, data)) == LATTICE_ERROR) {
+                goto ERR_PROCESS_INTERFACE;
+            }
+
+            // The links discovered by speculative probes have not been
+            // reported yet if they have all been answered meanwhile
+            if (was_speculative && interface->sent
+            && interface->sent == interface->received + interface->timeout) {
+                if (!mda_complete_interface(data, elt, interface->ttl_set[0] + 1, options)) {
+                    goto ERR_COMPLETE_INTERFACE;
+                }
+            }
+
+            if (interface->is_done != (ret == LATTICE_DONE)) {
+                interface->is_done = (ret == LATTICE_DONE);
+                if (interface->is_done) {
+                    data->num_pending--;
+                } else {
+                    data->num_pending++;
+                }
+            }
+            is_walkable = (ret != LATTICE_INTERRUPT_NEXT);
+            if (!mda_set_visited(data, elt)) {
+                goto ERR_SET_VISITED;
+            }
+        } else {
+            // Not reachable by a walk, it will be dirtied again once a
+            // previous hop becomes walkable
+            is_walkable = false;
+
+            // In pipelined mode, probe its next hops anyway as soon as
+            // one of its previous hops has been processed
+            if (data->is_pipelined && interface->num_visited_prev) {
+                interface->is_speculative = true;
+                if (mda_enumerate(elt, data, true) == LATTICE_ERROR) {
+                    goto ERR_PROCESS_INTERFACE;
+                }
+                if (!mda_set_visited(data, elt)) {
+                    goto ERR_SET_VISITED;
+                }
+            }
+        }
+
+        if (!mda_set_walkable(data, elt, is_walkable)) {
+            goto ERR_SET_WALKABLE;
+        }
+    }
+
+    return true;
+
+ERR_SET_WALKABLE:
+ERR_SET_VISITED:
+ERR_COMPLETE_INTERFACE:
+ERR_PROCESS_INTERFACE:
+    deque_clear(data->dirty, NULL);
+    return false;
 }
 
 //---------------------------------------------------------------------------
@@ -492,9 +974,10 @@ static lattice_return_t mda_search_interface(lattice_elt_t * elt, void * data)
  * \param pdata The data related to this algorithm instance.
  * \param skel The probe skeleton.
  * \param options The options passed to mda.
+ * \param is_lite Pass true to run mda-lite.
  */
 
-static void mda_handler_init(pt_loop_t * loop, event_t * event, mda_data_t ** pdata, probe_t * skel, const mda_options_t * options)
+static void mda_handler_init(pt_loop_t * loop, event_t * event, mda_data_t ** pdata, probe_t * skel, const mda_options_t * options, bool is_lite)
 {
     mda_data_t * data;
 
@@ -518,18 +1001,26 @@ static void mda_handler_init(pt_loop_t * loop, event_t * event, mda_data_t ** pd
     // Initialize algorithm's data
     data->skel = skel;
     data->loop = loop;
+    data->is_pipelined = options->pipeline;
+    data->is_lite = is_lite;
     *pdata = data;
 
+    // Finalize the skeleton once for all (e.g. its source IP), so that
+    // each probe only differs from it by its TTL and its flow identifier
+    data->has_fields = probe_update_fields(skel)
+        && probe_resolve_field(skel, "ttl", &data->ttl_field)
+        && probe_resolve_field(skel, "flow_id", &data->flow_id_field);
+
     // Create a dummy first hop, root of a lattice of discovered interfaces:
     // - not a tree since some interfaces might have several predecessors (diamonds)
     // - we assume the initial hop is not a load balancer
-    if (!lattice_add_element(data->lattice, NULL, mda_interface_create(NULL))) {
-        goto ERR_LATTICE_ADD_ELEMENT;
+    if (!mda_add_interface(data, NULL, mda_interface_create(NULL))) {
+        goto ERR_ADD_INTERFACE;
     }
 
     return;
 
-ERR_LATTICE_ADD_ELEMENT:
+ERR_ADD_INTERFACE:
 ERR_EXTRACT_DST_IP:
     mda_data_free(data);
 ERR_MDA_DATA_CREATE:
@@ -550,24 +1041,21 @@ static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * da
     const probe_t    * probe,
                      * reply;
     lattice_elt_t    * source_elt,
-                     * dest_elt;
+                     * dest_elt,
+                     * testing_elt;
     mda_interface_t  * source_interface,
                      * dest_interface;
     mda_search_data_t  search_ttl_flow;
-    mda_address_t      search_interface;
-    mda_ttl_flow_t   * mda_ttl_flow;
-    mda_flow_t       * mda_flow;
     address_t          addr;
     uint16_t           flow_id_u16;
     uint8_t            ttl, src_ttl;
-    int                ret;
     size_t             i, j;
 
     probe = ((const probe_reply_t *) event->data)->probe;
     reply = ((const probe_reply_t *) event->data)->reply;
 
     if (!(probe_extract(probe, "ttl",     &ttl)))         goto ERR_EXTRACT_TTL;
-    if (!(probe_extract(probe, "flow_id", &flow_id_u16))) goto ERR_EXTRACT_FLOW_ID;
+    if (!(probe_get_flow_id(probe, &flow_id_u16)))        goto ERR_EXTRACT_FLOW_ID;
     if (!(probe_extract(reply, "src_ip",  &addr)))        goto ERR_EXTRACT_SRC_IP;
 
     //printf("Probe reply received: %hhu %s [%ju]\n", ttl, addr, flow_id_u16);
@@ -579,18 +1067,13 @@ static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * da
      *  - probe->flow_id : disambiguate between several possible
      *      interfaces at the same ttl, since one flow_id will typically
      *      pass though one only.
-     *  The corresponding addr is searched thanks to
-     *  mda_interface_find_rec, recursively from the root interface
+     *  The corresponding interface is retrieved thanks to data->index
      *
      *  destination: reply->src_ip
      */
 
-    search_interface.address = &addr;
-    search_interface.result = NULL;
-    ret = lattice_walk(data->lattice, mda_search_interface, &search_interface, LATTICE_WALK_DFS);
-    if (ret == LATTICE_INTERRUPT_ALL) {
+    if ((dest_elt = mda_index_find_interface(data->index, &addr))) {
         // Destination found
-        dest_elt = search_interface.result;
         dest_interface = lattice_elt_get_data(dest_elt);
     } else {
         dest_elt = NULL;
@@ -599,18 +1082,13 @@ static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * da
                                        // create technically makes first ttl 0, this overwrites).
     }
 
-    search_ttl_flow.ttl = ttl - 1;
-    search_ttl_flow.flow_id = flow_id_u16;
-    search_ttl_flow.result = NULL;
-    ret = lattice_walk(data->lattice, mda_search_source, &search_ttl_flow, LATTICE_WALK_DFS);
-    if (ret == LATTICE_INTERRUPT_ALL) {
+    if ((source_elt = mda_index_find_source(data->index, ttl - 1, flow_id_u16))) {
         // Found
-        source_elt = search_ttl_flow.result;
         source_interface = lattice_elt_get_data(source_elt);
 
         if (dest_elt) {
-            if (!lattice_connect(data->lattice, source_elt, dest_elt)) {
-                goto ERR_LATTICE_CONNECT;
+            if (!mda_connect(data, source_elt, dest_elt)) {
+                goto ERR_CONNECT;
             }
 
             /* For every source ttl + 1 that is not contained in dest_interface ttl_set,
@@ -647,15 +1125,22 @@ static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * da
              */
 
         } else {
-            if (!lattice_add_element(data->lattice, source_elt, dest_interface)) {
-                goto ERR_LATTICE_ADD_ELEMENT;
+            if (!(dest_elt = mda_add_interface(data, source_elt, dest_interface))) {
+                goto ERR_ADD_INTERFACE;
             }
         }
 
         source_interface->received++;
 
-        // We have received the last needed flow
-        if (source_interface->received + source_interface->timeout == source_interface->sent) {
+        // mda-lite shares the probes of a hop among its interfaces
+        if (!(data->is_lite ? mda_mark_hop_dirty(data, source_elt) : mda_mark_dirty(data, source_elt))) {
+            goto ERR_MARK_DIRTY;
+        }
+
+        // We have received the last needed flow (if this interface is
+        // walkable, otherwise see mda_process_dirty)
+        if (source_interface->received + source_interface->timeout == source_interface->sent
+        && !source_interface->is_speculative) {
             if (!mda_event_new_link(loop, source_interface, dest_interface)) {
                 goto ERR_MDA_EVENT_NEW_LINK;
             }
@@ -663,33 +1148,37 @@ static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * da
     }
 
     // Insert flow in the right interface
-    if (!(mda_flow = mda_flow_create(flow_id_u16, MDA_FLOW_AVAILABLE))) {
-        goto ERR_MDA_FLOW_CREATE;
+    if (!mda_interface_add_flow_id(dest_interface, ttl, flow_id_u16, MDA_FLOW_AVAILABLE)) {
+        goto ERR_ADD_FLOW_ID;
     }
 
-    if (!(mda_ttl_flow = mda_ttl_flow_create(ttl, mda_flow))) {
-        goto ERR_MDA_TTL_FLOW_CREATE;
-    }
-
-    if (!dynarray_push_element(dest_interface->ttl_flows, mda_ttl_flow)) {
-        goto ERR_DYNARRAY_PUSH_ELEMENT;
+    if (dest_elt) {
+        if (!mda_index_add_flow(data->index, ttl, flow_id_u16, MDA_FLOW_AVAILABLE, dest_elt)) {
+            goto ERR_INDEX_ADD_FLOW;
+        }
+        if (!mda_mark_dirty(data, dest_elt)) {
+            goto ERR_MARK_DIRTY;
+        }
     }
 
     // Delete flow in all siblings. Right?
     search_ttl_flow.ttl = ttl;
     search_ttl_flow.flow_id = flow_id_u16;
-    search_ttl_flow.result = NULL;
-    lattice_walk(data->lattice, mda_delete_flow, &search_ttl_flow, LATTICE_WALK_DFS);
+    if ((testing_elt = mda_index_take_testing(data->index, ttl, flow_id_u16))) {
+        mda_delete_flow(testing_elt, &search_ttl_flow);
+        if (!mda_mark_dirty(data, testing_elt)) {
+            goto ERR_MARK_DIRTY;
+        }
+    }
 
     return;
 
-ERR_DYNARRAY_PUSH_ELEMENT:
-    mda_flow_free(mda_flow);
-ERR_MDA_TTL_FLOW_CREATE:
-ERR_MDA_FLOW_CREATE:
+ERR_MARK_DIRTY:
+ERR_INDEX_ADD_FLOW:
+ERR_ADD_FLOW_ID:
 ERR_MDA_EVENT_NEW_LINK:
-ERR_LATTICE_ADD_ELEMENT:
-ERR_LATTICE_CONNECT:
+ERR_ADD_INTERFACE:
+ERR_CONNECT:
 ERR_EXTRACT_SRC_IP:
 ERR_EXTRACT_FLOW_ID:
 ERR_EXTRACT_TTL:
@@ -704,72 +1193,44 @@ static void mda_handler_timeout(pt_loop_t *loop, event_t *event, mda_data_t * da
     mda_search_data_t       search_ttl_flow;
     uint16_t                flow_id_u16 = 0;
     uint8_t                 ttl;
-    int                     ret;
-    size_t                  i, num_next;
 
     probe = event->data;
 
     if (!(probe_extract(probe, "ttl",     &ttl)))     goto ERR_EXTRACT_TTL;
-    if (!(probe_extract(probe, "flow_id", &flow_id_u16))) goto ERR_EXTRACT_FLOW_ID;
+    if (!(probe_get_flow_id(probe, &flow_id_u16)))    goto ERR_EXTRACT_FLOW_ID;
 
-    search_ttl_flow.ttl = ttl - 1;
-    search_ttl_flow.flow_id = flow_id_u16;
-    search_ttl_flow.result = NULL;
-    ret = lattice_walk(data->lattice, mda_search_source, &search_ttl_flow, LATTICE_WALK_DFS);
-    if (ret == LATTICE_INTERRUPT_ALL) {
+    if ((source_elt = mda_index_find_source(data->index, ttl - 1, flow_id_u16))) {
         // Found
-        source_elt = search_ttl_flow.result;
         source_interface = lattice_elt_get_data(source_elt);
         source_interface->timeout++;
 
         // Mark the flow as timeout
         search_ttl_flow.ttl = ttl - 1;
         search_ttl_flow.flow_id = flow_id_u16;
-        search_ttl_flow.result = NULL;
         mda_timeout_flow(source_elt, &search_ttl_flow);
+        if (!(data->is_lite ? mda_mark_hop_dirty(data, source_elt) : mda_mark_dirty(data, source_elt))) {
+            goto ERROR;
+        }
 
-        if (source_interface->timeout == source_interface->sent) { // XXX to_send ??
-            // All timeouts, we need to add a star interface, and start a new
-            // discovery at the next ttl. Currently, that supposes we have only
-            // one interface...
-            if (source_interface->num_stars < options->traceroute_options.max_undiscovered) {
-                mda_interface_t * new_iface = mda_interface_create(NULL);
-                new_iface->ttl_set[0] = ttl; // This interface's first ttl (messy way of doing it: 
-                                          // create technically makes first ttl 0, this overwrites).
-
-                new_iface->num_stars = source_interface->num_stars + 1;
-
-                if (!lattice_add_element(data->lattice, source_elt, new_iface)) {
-                    goto ERROR;
-                }
-
-                if (!mda_event_new_link(loop, source_interface, new_iface)) {
-                    goto ERROR;
-                }
-            } else if (!mda_event_new_link(loop, source_interface, NULL)) {
+        // Wait for this interface to be walkable before reporting its links
+        if (source_interface->timeout + source_interface->received == source_interface->sent
+        && !source_interface->is_speculative) {
+            if (!mda_complete_interface(data, source_elt, ttl, options)) {
                 goto ERROR;
             }
-        } else if (source_interface->timeout + source_interface->received == source_interface->sent) {
-            // We have received all answers, and the last is a timeout (since we
-            // are processing it
-            num_next = dynarray_get_size(source_elt->next);
-            for (i = 0; i < num_next; i++) {
-                lattice_elt_t   * next_elt = dynarray_get_ith_element(source_elt->next, i);
-                mda_interface_t * next_iface = lattice_elt_get_data(next_elt);
-                if (!mda_event_new_link(loop, source_interface, next_iface)) {
-                    goto ERROR;
-                }
-            }
         }
-
     } else {
         // Delete flow in all siblings
         search_ttl_flow.ttl = ttl;
         search_ttl_flow.flow_id = flow_id_u16;
-        search_ttl_flow.result = NULL;
 
         // Mark the flow as timeout
-        lattice_walk(data->lattice, mda_timeout_flow, &search_ttl_flow, LATTICE_WALK_DFS);
+        if ((source_elt = mda_index_find_source(data->index, ttl, flow_id_u16))) {
+            mda_timeout_flow(source_elt, &search_ttl_flow);
+            if (!mda_mark_dirty(data, source_elt)) {
+                goto ERROR;
+            }
+        }
     }
 
     return;
@@ -791,25 +1252,28 @@ ERR_EXTRACT_TTL:
  * \param probe_skel a skeleton of a probe that will be used as a model
  * \param data a personal structure that can be used by the algorithm
  * \param events an array of events that have occured since last invocation
+ * \param is_lite Pass true to run mda-lite.
  * \return 0 iif successful
  */
 
-int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * opts)
+static int mda_handler_common(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * opts, bool is_lite)
 {
     mda_data_t          * data = (mda_data_t *) *pdata;
     const mda_options_t * options = opts;
 
     switch (event->type) {
         case ALGORITHM_INIT:
-            mda_handler_init(loop, event, (mda_data_t **) pdata, skel, options);
+            mda_handler_init(loop, event, (mda_data_t **) pdata, skel, options, is_lite);
             data = *pdata;
             break;
         case PROBE_REPLY:
             data = *pdata;
+            data->num_flying--;
             mda_handler_reply(loop, event, data, skel, options);
             break;
         case PROBE_TIMEOUT:
             data = *pdata;
+            data->num_flying--;
             mda_handler_timeout(loop, event, data, skel, options);
             break;
         case ALGORITHM_TERM:
@@ -817,24 +1281,45 @@ int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel
             // We should release the memory here
             pt_raise_terminated(loop);
             break;
+        case PROBE_REPLY_DUPLICATE:
+        case PROBE_REPLY_LATE:
+            // Its probe has already been accounted for
+            return 0;
+        case NETWORK_READY:
+            // Resume the interfaces deferred by mda_process_dirty
+            data = *pdata;
+            break;
         default:
             fprintf(stderr, "mda_handler: ignoring unhandled event (type = %d)\n", event->type);
             return 0;
     }
 
-    // Process available interfaces
-    switch (lattice_walk(data->lattice, mda_process_interface, data, LATTICE_WALK_DFS)) {
-        case LATTICE_ERROR:
-            fprintf(stderr, "mda_handler: LATTICE_ERROR\n");
-            return -1;
-        case LATTICE_DONE:  break;
-        default:            return 0;
+    // Process the interfaces affected by this event
+    if (!mda_process_dirty(data, options)) {
+        fprintf(stderr, "mda_handler: LATTICE_ERROR\n");
+        return -1;
     }
 
+    if (data->num_pending || deque_get_size(data->dirty)) return 0;
+
+    // Wait for the probes still in transit (e.g. sent speculatively), as
+    // their replies are delivered to this instance as long as it runs.
+    if (data->num_flying) return 0;
+
     pt_raise_terminated(loop);
     return 0;
 }
 
+int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * opts)
+{
+    return mda_handler_common(loop, event, pdata, skel, opts, false);
+}
+
+int mda_lite_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * opts)
+{
+    return mda_handler_common(loop, event, pdata, skel, opts, true);
+}
+
 static algorithm_t mda = {
     .name     = "mda",
     .handler  = mda_handler,
@@ -842,3 +1327,11 @@ static algorithm_t mda = {
 };
 
 ALGORITHM_REGISTER(mda);
+
+static algorithm_t mda_lite = {
+    .name     = "mda-lite",
+    .handler  = mda_lite_handler,
+    .options  = (const struct opt_spec *) &mda_opt_specs
+};
+
+ALGORITHM_REGISTER(mda_lite);
@@ -1,6 +1,8 @@
 #ifndef ALGORITHMS_MDA_H
 #define ALGORITHMS_MDA_H
 
+#include <stdbool.h>
+
 #include "mda/data.h"
 #include "mda/flow.h"
 #include "mda/interface.h"
@@ -10,15 +12,19 @@
 
 //mda command line help messages
 #define HELP_B "Multipath tracing  bound: an upper bound on the probability that multipath tracing will fail to find all of the paths (default 0.05) max_branch: the maximum number of branching points that can be encountered for the bound still to hold (default 5)"
+#define HELP_mda_pipeline "Probe the next hops of an interface with the flows known to reach it, without waiting for the enumeration of the previous hops to complete"
+#define HELP_mda_cache "Load the next hops enumerated by the previous runs from FILE, and save those enumerated by this run. The next hops already known are only verified with a few probes"
 
 //                                   def1 min1 max1 def2 min2 max2     def3  min3 max3     mda_enabled
 #define OPTIONS_MDA_BOUND_MAXBRANCH {95,  0,   100, 5,   1,   INT_MAX, 128,  1,   INT_MAX, 0}
+#define OPTIONS_MDA_PIPELINE_DEFAULT false
 
 typedef struct {
     traceroute_options_t traceroute_options;
     unsigned             bound;
     unsigned             max_branch;
     unsigned             max_children;
+    bool                 pipeline;     /**< Probe deeper hops while the previous ones are still enumerated */
 } mda_options_t;
 
 typedef enum {
@@ -34,6 +40,8 @@ typedef struct {
 
 unsigned options_mda_get_bound();
 unsigned options_mda_get_max_branch();
+bool options_mda_get_pipeline();
+const char * options_mda_get_cache_filename();
 unsigned options_mda_get_is_set();
 
 const option_t * mda_get_options();
@@ -63,4 +71,24 @@ void options_mda_init(mda_options_t * mda_options);
 
 int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * options);
 
+/**
+ * \brief Default mda-lite handler.
+ *
+ * mda-lite assumes that the load balanced hops form uniform and unmeshed
+ * diamonds: the next hops of a whole hop are enumerated with the flows
+ * which have reached this hop, regardless of the interface they have
+ * reached. Hence it does not spend probes to ensure that each interface
+ * has enough flows (node control). Once a meshing is detected at a hop,
+ * this hop is explored with the full MDA.
+ *
+ * \param loop The main loop.
+ * \param event The event handled by mda-lite.
+ * \param pdata Data attached to the current mda-lite algorithm instance.
+ * \param skel The probe skeleton used to craft probe packets.
+ * \param options The options passed to the current mda-lite algorithm
+ *    instance (mda_options_t).
+ */
+
+int mda_lite_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * options);
+
 #endif
@@ -14,6 +14,10 @@
 
 #include "bound.h"
 
+#ifndef BOUND_STANDALONE
+#    include "bound_tables.h" // bound_tables
+#endif
+
 // We condiser a set of diagonal vectors (indexed by i) made of several cells (indexed by j)
 #define PROBA_HOR(i, j)    ((long double)(j) / (i))              // Probability to follow a horizontal transition
 #define PROBA_VER(i, j)    ((long double)((i) - (j) + 1) / (i)) // Probability to follow a vertical transition
@@ -203,9 +207,31 @@ static bool reallocate_bound(bound_t * bound, size_t new_max_n)
         return false;
 }
 
+/**
+ * \brief Retrieve the precomputed stopping points related to a given
+ *    confidence and max_branch.
+ * \return The corresponding bound_table_t, NULL if not precomputed.
+ */
+
+static const bound_table_t * bound_find_table(double confidence, size_t max_branch)
+{
+#ifndef BOUND_STANDALONE
+    size_t i;
+
+    for (i = 0; i < sizeof(bound_tables) / sizeof(bound_table_t); i++) {
+        if (bound_tables[i].confidence == confidence && bound_tables[i].max_branch == max_branch) {
+            return &bound_tables[i];
+        }
+    }
+#endif
+    return NULL;
+}
+
 bound_t * bound_create(double confidence, size_t max_interfaces, size_t max_branch)
 {
-    bound_t * bound;
+    bound_t             * bound;
+    const bound_table_t * table;
+    size_t                max_n;
 
     // Allocate and populate bound_t structure
     if (!(bound = malloc(sizeof(bound_t)))) goto ERR_BOUND_MALLOC;
@@ -237,7 +263,18 @@ bound_t * bound_create(double confidence, size_t max_interfaces, size_t max_bran
     bound->nk_table[1] = 0.0;
     bound->pk_table[0] = 0.0;
     bound->pk_table[1] = 0.0;
-    bound_build(bound, bound->max_n); // Calculate stopping points
+
+    if ((table = bound_find_table(confidence, max_branch))) {
+        // Use the precomputed stopping points, and compute the next ones if needed
+        max_n = max_interfaces < BOUND_TABLES_MAX_N ? max_interfaces : BOUND_TABLES_MAX_N;
+        memcpy(bound->nk_table, table->nk_table, (max_n + 1) * sizeof(size_t));
+        bound->max_n = max_n;
+        if (max_interfaces > max_n) {
+            bound_build(bound, max_interfaces);
+        }
+    } else {
+        bound_build(bound, bound->max_n); // Calculate stopping points
+    }
 
     return bound;
 
@@ -308,11 +345,53 @@ void bound_build(bound_t * bound, size_t end)
         fprintf(stderr, "Provided bound struct contained null values or was itself null\n");
 }
 
+bound_t * bound_get(double confidence, size_t max_interfaces, size_t max_branch)
+{
+    // The bound_t instances shared by the whole process. They are never
+    // released, but there is one per (confidence, max_branch) pair.
+    static struct {
+        double    confidence;
+        size_t    max_branch;
+        bound_t * bound;
+    }             * cache = NULL;
+    static size_t   cache_size = 0;
+    void          * entries;
+    bound_t       * bound;
+    size_t          i;
+
+    for (i = 0; i < cache_size; i++) {
+        if (cache[i].confidence == confidence && cache[i].max_branch == max_branch) {
+            bound = cache[i].bound;
+            if (bound->max_n < max_interfaces) {
+                bound_build(bound, max_interfaces);
+            }
+            return bound;
+        }
+    }
+
+    if (!(entries = realloc(cache, (cache_size + 1) * sizeof(*cache)))) goto ERR_REALLOC;
+    cache = entries;
+    if (!(bound = bound_create(confidence, max_interfaces, max_branch))) goto ERR_BOUND_CREATE;
+    cache[cache_size].confidence = confidence;
+    cache[cache_size].max_branch = max_branch;
+    cache[cache_size].bound      = bound;
+    cache_size++;
+    return bound;
+
+ERR_BOUND_CREATE:
+ERR_REALLOC:
+    return NULL;
+}
+
 size_t bound_get_nk(bound_t * bound, size_t k)
 {
     size_t ret = 0;
 
     if (bound) {
+        // Extend the table (at least twice as large) if needed
+        if ((bound->nk_table) && (bound->max_n < k)) {
+            bound_build(bound, k > 2 * bound->max_n ? k : 2 * bound->max_n);
+        }
         if ((bound->nk_table) && (bound->max_n >= k)) {
             ret = (bound->nk_table)[k];
         }
@@ -350,20 +429,28 @@ void bound_free(bound_t * bound)
     }
 }
 
+#ifdef BOUND_STANDALONE
+
+// Generate bound_tables.h (see Makefile): print the stopping points related
+// to the most common confidences, for the default max_branch.
 int main(int argc, const char * argv[]) {
-    long double confidence;
-    size_t      interfaces;
-    size_t      max_branch;
-
-//    sscanf(argv[1], "%Lf", &confidence);
-//    sscanf(argv[2], "%d", &interfaces);
-    confidence = .05;
-    interfaces = 16;
-    max_branch = 1;
-    bound_t * bound = bound_create(confidence, interfaces, max_branch);
-    bound_dump(bound);
-    bound_failure_dump(bound);
-    bound_free(bound);
+    static const double confidences[] = {0.05, 0.01};
+    size_t              max_n = BOUND_TABLES_MAX_N, max_branch = 5, i, k;
+    bound_t           * bound;
+
+    printf("// Generated by bound.c (make -C libparistraceroute/algorithms/mda bound_tables.h), do not edit.\n");
+    printf("static const bound_table_t bound_tables[] = {\n");
+    for (i = 0; i < sizeof(confidences) / sizeof(double); i++) {
+        if (!(bound = bound_create(confidences[i], max_n, max_branch))) return 1;
+        printf("    {%.17g, %zu, {", confidences[i], max_branch);
+        for (k = 0; k <= max_n; k++) {
+            printf("%s%zu", k ? (k % 16 ? ", " : ",\n        ") : "\n        ", bound_get_nk(bound, k));
+        }
+        printf("\n    }},\n");
+        bound_free(bound);
+    }
+    printf("};\n");
     return 0;
 }
 
+#endif
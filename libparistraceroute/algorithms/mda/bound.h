@@ -10,6 +10,9 @@
 
 typedef long double probability_t;
 
+// Number of hypotheses stored in bound_tables.h
+#define BOUND_TABLES_MAX_N 128
+
 /**
  * \struct bound_state_t
  * \brief Structure containing references to dynamic vectors
@@ -40,6 +43,17 @@ typedef struct {
 } bound_t;
 
 
+/**
+ * \struct bound_table_t
+ * \brief Precomputed stopping points (see bound_tables.h)
+ */
+
+typedef struct {
+    double          confidence;                       /**< Graph-wide failure confidence */
+    size_t          max_branch;                       /**< Max number of branching points */
+    size_t          nk_table[BOUND_TABLES_MAX_N + 1]; /**< Stopping points */
+} bound_table_t;
+
 /**
  * \brief Create a bound_t structure and build up to max_interfaces
  * \param confidence User-specified failure confidence
@@ -50,6 +64,20 @@ typedef struct {
 
 bound_t * bound_create(double confidence, size_t max_interfaces, size_t max_branch);
 
+/**
+ * \brief Retrieve the bound_t shared by the whole process for a given
+ *    confidence and max_branch (the stopping points do not depend on
+ *    anything else). It is created on the first call.
+ * \param confidence User-specified failure confidence
+ * \param max_interfaces User-specified max branching at an interface
+ *    (the table is extended if needed)
+ * \param max_branch User-specified max number of branching points in network
+ * \return Reference to the shared bound_t structure (do not free it),
+ *    NULL in case of failure
+ */
+
+bound_t * bound_get(double confidence, size_t max_interfaces, size_t max_branch);
+
 /**
  * \brief Compute stopping points
  * \param bound Reference to bound_t structure
@@ -59,7 +87,8 @@ bound_t * bound_create(double confidence, size_t max_interfaces, size_t max_bran
 void bound_build(bound_t * bound, size_t end);
 
 /**
- * \brief Get stopping point for a given hypothesis
+ * \brief Get stopping point for a given hypothesis. The stopping points
+ *    are computed on demand if k is greater than bound->max_n.
  * \param bound Reference to bound_t structure
  * \param k Given hypothesis (number of presumed children)
  * \return Associated stopping point (probes to send)
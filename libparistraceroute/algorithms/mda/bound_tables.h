@@ -0,0 +1,25 @@
+// Generated by bound.c (make -C libparistraceroute/algorithms/mda bound_tables.h), do not edit.
+static const bound_table_t bound_tables[] = {
+    {0.050000000000000003, 5, {
+        0, 0, 8, 15, 21, 28, 36, 43, 50, 58, 66, 74, 82, 90, 98, 106,
+        114, 123, 131, 140, 148, 157, 165, 174, 183, 192, 200, 209, 218, 227, 236, 245,
+        254, 263, 272, 281, 290, 299, 309, 318, 327, 336, 346, 355, 364, 374, 383, 393,
+        402, 411, 421, 430, 440, 449, 459, 469, 478, 488, 497, 507, 517, 526, 536, 546,
+        555, 565, 575, 585, 594, 604, 614, 624, 634, 644, 653, 663, 673, 683, 693, 703,
+        713, 723, 733, 743, 753, 763, 773, 783, 793, 803, 813, 823, 833, 843, 854, 864,
+        874, 884, 894, 904, 914, 925, 935, 945, 955, 965, 976, 986, 996, 1006, 1017, 1027,
+        1037, 1048, 1058, 1068, 1079, 1089, 1099, 1110, 1120, 1130, 1141, 1151, 1161, 1172, 1182, 1193,
+        1203
+    }},
+    {0.01, 5, {
+        0, 0, 10, 19, 27, 36, 44, 53, 63, 72, 81, 91, 100, 110, 120, 130,
+        140, 150, 160, 170, 180, 190, 200, 211, 221, 231, 242, 252, 263, 273, 284, 295,
+        305, 316, 327, 337, 348, 359, 370, 381, 391, 402, 413, 424, 435, 446, 457, 468,
+        479, 490, 502, 513, 524, 535, 546, 557, 569, 580, 591, 602, 614, 625, 636, 648,
+        659, 670, 682, 693, 704, 716, 727, 739, 750, 762, 773, 785, 796, 808, 819, 831,
+        843, 854, 866, 877, 889, 901, 912, 924, 936, 947, 959, 971, 982, 994, 1006, 1018,
+        1029, 1041, 1053, 1065, 1077, 1088, 1100, 1112, 1124, 1136, 1148, 1159, 1171, 1183, 1195, 1207,
+        1219, 1231, 1243, 1255, 1267, 1279, 1291, 1303, 1315, 1327, 1339, 1351, 1363, 1375, 1387, 1399,
+        1411
+    }},
+};
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include "data.h"
 #include "interface.h"
+#include "topology.h"
 #include "../mda.h"
 
 #define PERCENT_TO_INVERSE_DECIMAL(X) ((double)(100 - (X)) / 100.0)
@@ -19,6 +20,14 @@ mda_data_t * mda_data_create()
         goto ERR_LATTICE_CREATE;
     }
 
+    if (!(data->index = mda_index_create())) {
+        goto ERR_INDEX_CREATE;
+    }
+
+    if (!(data->dirty = deque_create())) {
+        goto ERR_DIRTY_CREATE;
+    }
+
     if (!(data->dst_ip = address_create())) {
         goto ERR_ADDRESS_CREATE;
     }
@@ -28,9 +37,11 @@ mda_data_t * mda_data_create()
 
     failure = PERCENT_TO_INVERSE_DECIMAL(mda_options.bound);
 
-    if (!(data->bound = bound_create(
-        failure, 
-        mda_options.max_children, 
+    // The stopping points only depend on these options, share them
+    // among every MDA instance
+    if (!(data->bound = bound_get(
+        failure,
+        mda_options.max_children,
         mda_options.max_branch
     ))) {
         goto ERR_BOUND_CREATE;
@@ -41,6 +52,10 @@ mda_data_t * mda_data_create()
 ERR_BOUND_CREATE:
     address_free(data->dst_ip); 
 ERR_ADDRESS_CREATE:
+    deque_free(data->dirty, NULL);
+ERR_DIRTY_CREATE:
+    mda_index_free(data->index);
+ERR_INDEX_CREATE:
     lattice_free(data->lattice, (ELEMENT_FREE) mda_interface_free);
 ERR_LATTICE_CREATE:
     free(data);
@@ -50,8 +65,18 @@ ERR_MALLOC:
 
 void mda_data_free(mda_data_t * data)
 {
+    size_t i;
+
     if (data) {
+        // Release the entries shared with the other instances (see topology.h)
+        for (i = 0; i < data->index->max_addresses; i++) {
+            if (data->index->addresses[i].elt) {
+                mda_topology_unref(&data->index->addresses[i].address);
+            }
+        }
         lattice_free(data->lattice, (ELEMENT_FREE) mda_interface_free);
+        mda_index_free(data->index);
+        deque_free(data->dirty, NULL);
         address_free(data->dst_ip);
         free(data);
     }
@@ -2,18 +2,30 @@
 #define MDA_DATA_H
 
 #include "bound.h"          // bound_t
+#include "index.h"          // mda_index_t
 #include "../../address.h"  // address_t
+#include "../../deque.h"    // deque_t
 #include "../../lattice.h"  // lattice_t
 #include "../../pt_loop.h"  // pt_loop_t
-#include "../../probe.h"    // probe_t
+#include "../../probe.h"    // probe_t, probe_field_t
 
 typedef struct {
     lattice_t    * lattice;      /**< Root of the lattice storing the interfaces */
+    mda_index_t  * index;        /**< Indexes of the lattice (by address and by (ttl, flow_id)) */
+    deque_t      * dirty;        /**< Lattice nodes to process again since the last event (FIFO) */
+    size_t         num_pending;  /**< Number of interfaces not yet fully processed */
     uintmax_t      last_flow_id;
     address_t    * dst_ip;       /**< Destination IP */
     pt_loop_t    * loop;         /**< Main loop */
     probe_t      * skel;         /**< Probe skeleton */
     bound_t      * bound;        /**< Bound on probes to send */
+    probe_field_t  ttl_field;    /**< The "ttl" field of skel */
+    probe_field_t  flow_id_field;/**< The "flow_id" metafield of skel */
+    bool           has_fields;   /**< True iif ttl_field and flow_id_field are resolved */
+    bool           is_pipelined; /**< True iif deeper hops are probed speculatively (see mda_options_t) */
+    bool           is_lite;      /**< True iif this instance runs mda-lite */
+    size_t         num_probes;   /**< Number of probes sent so far */
+    size_t         num_flying;   /**< Number of probes sent and neither replied nor expired */
 } mda_data_t;
 
 /**
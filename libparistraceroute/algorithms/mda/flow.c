@@ -2,6 +2,8 @@
 
 #include <stdlib.h>
 
+#include "../../memstats.h" // memstats_track_*
+
 mda_flow_t * mda_flow_create(uintmax_t flow_id, mda_flow_state_t state)
 {
     mda_flow_t * mda_flow;
@@ -9,6 +11,7 @@ mda_flow_t * mda_flow_create(uintmax_t flow_id, mda_flow_state_t state)
     if ((mda_flow = malloc(sizeof(mda_flow_t)))) {
         mda_flow->flow_id = flow_id;
         mda_flow->state = state;
+        memstats_track_alloc(MEMSTATS_FLOW, sizeof(mda_flow_t));
     }
 
     return mda_flow;
@@ -16,7 +19,10 @@ mda_flow_t * mda_flow_create(uintmax_t flow_id, mda_flow_state_t state)
 
 void mda_flow_free(mda_flow_t * mda_flow)
 {
-    if (mda_flow) free(mda_flow);
+    if (mda_flow) {
+        memstats_track_free(MEMSTATS_FLOW, sizeof(mda_flow_t));
+        free(mda_flow);
+    }
 }
 
 char mda_flow_state_to_char(const mda_flow_t * mda_flow) {
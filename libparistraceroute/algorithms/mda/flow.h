@@ -11,6 +11,8 @@ typedef enum {
     MDA_FLOW_TIMEOUT
 } mda_flow_state_t;
 
+#define MDA_FLOW_NUM_STATES (MDA_FLOW_TIMEOUT + 1)
+
 /**
  * A structure containing flow information, to be used within MDA link discovery
  */
@@ -0,0 +1,203 @@
+#include <stdlib.h>         // calloc, free
+#include <stdint.h>         // uint8_t
+
+#include "index.h"
+#include "../../hugemem.h"  // hugemem_*
+#include "interface.h"      // mda_interface_t
+
+//---------------------------------------------------------------------------
+// Hash functions
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Hash a (ttl, flow_id) pair.
+ * \param ttl The TTL.
+ * \param flow_id The flow identifier.
+ * \return The corresponding hash.
+ */
+
+static inline size_t mda_index_hash_flow(uint8_t ttl, uintmax_t flow_id) {
+    uint64_t hash = ((uint64_t) flow_id << 8 | ttl) * 0x9e3779b97f4a7c15ull;
+    return (size_t) (hash ^ (hash >> 32));
+}
+
+//---------------------------------------------------------------------------
+// Lookups
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Find the slot storing an address, or the free slot where it must be stored.
+ * \param entries The hash table.
+ * \param max_entries The number of slots (power of 2).
+ * \param address The searched address.
+ * \return The address of the corresponding slot.
+ */
+
+static mda_address_entry_t * mda_index_lookup_address(mda_address_entry_t * entries, size_t max_entries, const address_t * address) {
+    size_t i = address_hash(address) & (max_entries - 1);
+
+    while (entries[i].elt && !address_equals(&entries[i].address, address)) {
+        i = (i + 1) & (max_entries - 1);
+    }
+    return &entries[i];
+}
+
+/**
+ * \brief Find the slot storing a (ttl, flow_id) pair, or the free slot where
+ *    it must be stored.
+ * \param entries The hash table.
+ * \param max_entries The number of slots (power of 2).
+ * \param ttl The TTL.
+ * \param flow_id The flow identifier.
+ * \return The address of the corresponding slot.
+ */
+
+static mda_flow_entry_t * mda_index_lookup_flow(mda_flow_entry_t * entries, size_t max_entries, uint8_t ttl, uintmax_t flow_id) {
+    size_t i = mda_index_hash_flow(ttl, flow_id) & (max_entries - 1);
+
+    while (entries[i].is_used && (entries[i].ttl != ttl || entries[i].flow_id != flow_id)) {
+        i = (i + 1) & (max_entries - 1);
+    }
+    return &entries[i];
+}
+
+//---------------------------------------------------------------------------
+// Growth
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Double the size of the address table of a mda_index_t.
+ * \param index A mda_index_t instance.
+ * \return true iif successful
+ */
+
+static bool mda_index_grow_addresses(mda_index_t * index) {
+    mda_address_entry_t * entries;
+    size_t                i, max_entries = 2 * index->max_addresses;
+
+    if (!(entries = hugemem_calloc(max_entries, sizeof(mda_address_entry_t)))) return false;
+    for (i = 0; i < index->max_addresses; i++) {
+        if (index->addresses[i].elt) {
+            *mda_index_lookup_address(entries, max_entries, &index->addresses[i].address) = index->addresses[i];
+        }
+    }
+    hugemem_free(index->addresses, index->max_addresses, sizeof(mda_address_entry_t));
+    index->addresses = entries;
+    index->max_addresses = max_entries;
+    return true;
+}
+
+/**
+ * \brief Double the size of the flow table of a mda_index_t.
+ * \param index A mda_index_t instance.
+ * \return true iif successful
+ */
+
+static bool mda_index_grow_flows(mda_index_t * index) {
+    mda_flow_entry_t * entries;
+    size_t             i, max_entries = 2 * index->max_flows;
+
+    if (!(entries = hugemem_calloc(max_entries, sizeof(mda_flow_entry_t)))) return false;
+    for (i = 0; i < index->max_flows; i++) {
+        if (index->flows[i].is_used) {
+            *mda_index_lookup_flow(entries, max_entries, index->flows[i].ttl, index->flows[i].flow_id) = index->flows[i];
+        }
+    }
+    hugemem_free(index->flows, index->max_flows, sizeof(mda_flow_entry_t));
+    index->flows = entries;
+    index->max_flows = max_entries;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// mda_index_t
+//---------------------------------------------------------------------------
+
+mda_index_t * mda_index_create() {
+    mda_index_t * index;
+
+    if (!(index = malloc(sizeof(mda_index_t)))) goto ERR_MALLOC;
+    if (!(index->addresses = hugemem_calloc(MDA_INDEX_INITIAL_SIZE, sizeof(mda_address_entry_t)))) goto ERR_ADDRESSES;
+    if (!(index->flows = hugemem_calloc(MDA_INDEX_INITIAL_SIZE, sizeof(mda_flow_entry_t)))) goto ERR_FLOWS;
+    index->num_addresses = 0;
+    index->max_addresses = MDA_INDEX_INITIAL_SIZE;
+    index->num_flows     = 0;
+    index->max_flows     = MDA_INDEX_INITIAL_SIZE;
+    return index;
+
+ERR_FLOWS:
+    hugemem_free(index->addresses, MDA_INDEX_INITIAL_SIZE, sizeof(mda_address_entry_t));
+ERR_ADDRESSES:
+    free(index);
+ERR_MALLOC:
+    return NULL;
+}
+
+void mda_index_free(mda_index_t * index) {
+    if (index) {
+        hugemem_free(index->flows, index->max_flows, sizeof(mda_flow_entry_t));
+        hugemem_free(index->addresses, index->max_addresses, sizeof(mda_address_entry_t));
+        free(index);
+    }
+}
+
+bool mda_index_add_interface(mda_index_t * index, lattice_elt_t * elt) {
+    const mda_interface_t * interface = lattice_elt_get_data(elt);
+    mda_address_entry_t   * entry;
+
+    if (!interface->address) return true;
+
+    // Keep the load factor under 1/2
+    if (2 * (index->num_addresses + 1) > index->max_addresses && !mda_index_grow_addresses(index)) {
+        return false;
+    }
+
+    entry = mda_index_lookup_address(index->addresses, index->max_addresses, interface->address);
+    if (!entry->elt) {
+        entry->address = *interface->address;
+        entry->elt = elt;
+        index->num_addresses++;
+    }
+    return true;
+}
+
+lattice_elt_t * mda_index_find_interface(const mda_index_t * index, const address_t * address) {
+    return mda_index_lookup_address(index->addresses, index->max_addresses, address)->elt;
+}
+
+bool mda_index_add_flow(mda_index_t * index, uint8_t ttl, uintmax_t flow_id, mda_flow_state_t state, lattice_elt_t * elt) {
+    mda_flow_entry_t * entry;
+
+    // Keep the load factor under 1/2
+    if (2 * (index->num_flows + 1) > index->max_flows && !mda_index_grow_flows(index)) {
+        return false;
+    }
+
+    entry = mda_index_lookup_flow(index->flows, index->max_flows, ttl, flow_id);
+    if (!entry->is_used) {
+        entry->ttl     = ttl;
+        entry->flow_id = flow_id;
+        entry->is_used = true;
+        index->num_flows++;
+    }
+
+    if (state == MDA_FLOW_TESTING) {
+        if (!entry->testing) entry->testing = elt;
+    } else {
+        if (!entry->source) entry->source = elt;
+    }
+    return true;
+}
+
+lattice_elt_t * mda_index_find_source(const mda_index_t * index, uint8_t ttl, uintmax_t flow_id) {
+    return mda_index_lookup_flow(index->flows, index->max_flows, ttl, flow_id)->source;
+}
+
+lattice_elt_t * mda_index_take_testing(mda_index_t * index, uint8_t ttl, uintmax_t flow_id) {
+    mda_flow_entry_t * entry = mda_index_lookup_flow(index->flows, index->max_flows, ttl, flow_id);
+    lattice_elt_t    * elt = entry->testing;
+
+    // The slot remains used, so that linear probing is not broken
+    entry->testing = NULL;
+    return elt;
+}
@@ -0,0 +1,136 @@
+#ifndef MDA_INDEX_H
+#define MDA_INDEX_H
+
+/**
+ * \file index.h
+ * \brief Indexes of the lattice built by mda.
+ *
+ * Each reply (or timeout) handled by mda requires to retrieve:
+ * - the interface having a given address (the destination of the link);
+ * - the interface having sent a given (ttl, flow_id) pair (the source of
+ *   the link), or the interface testing it.
+ * Instead of walking the whole lattice, mda maintains two hash tables
+ * (open addressing, linear probing), updated whenever an interface or a
+ * flow is added. Hence those lookups are O(1).
+ */
+
+#include <stdbool.h>           // bool
+#include <stddef.h>            // size_t
+#include <stdint.h>            // uint8_t, uintmax_t
+
+#include "flow.h"              // mda_flow_state_t
+#include "../../address.h"     // address_t
+#include "../../lattice.h"     // lattice_elt_t
+
+// Initial number of slots of each hash table. Must be a power of 2.
+#define MDA_INDEX_INITIAL_SIZE 256
+
+/**
+ * \struct mda_address_entry_t
+ * \brief An interface of the lattice, indexed by its address.
+ */
+
+typedef struct {
+    address_t       address; /**< The address of the interface */
+    lattice_elt_t * elt;     /**< The corresponding lattice node, NULL if the slot is free */
+} mda_address_entry_t;
+
+/**
+ * \struct mda_flow_entry_t
+ * \brief The interfaces related to a (ttl, flow_id) pair.
+ */
+
+typedef struct {
+    uintmax_t       flow_id; /**< The flow identifier */
+    uint8_t         ttl;     /**< The TTL */
+    bool            is_used; /**< True iif the slot stores this pair */
+    lattice_elt_t * source;  /**< The first interface reached by this flow at this TTL (see mda_search_source), NULL if none */
+    lattice_elt_t * testing; /**< The interface testing this flow at this TTL (MDA_FLOW_TESTING), NULL if none */
+} mda_flow_entry_t;
+
+/**
+ * \struct mda_index_t
+ * \brief Indexes of a lattice of mda_interface_t.
+ */
+
+typedef struct {
+    mda_address_entry_t * addresses;     /**< Hash table address -> interface */
+    size_t                num_addresses; /**< Number of used slots in addresses */
+    size_t                max_addresses; /**< Number of slots in addresses (power of 2) */
+    mda_flow_entry_t    * flows;         /**< Hash table (ttl, flow_id) -> interfaces */
+    size_t                num_flows;     /**< Number of used slots in flows */
+    size_t                max_flows;     /**< Number of slots in flows (power of 2) */
+} mda_index_t;
+
+/**
+ * \brief Create a mda_index_t instance.
+ * \return The newly created mda_index_t instance, NULL in case of failure.
+ */
+
+mda_index_t * mda_index_create();
+
+/**
+ * \brief Release a mda_index_t instance from the memory. The indexed
+ *    lattice nodes are not released.
+ * \param index A mda_index_t instance.
+ */
+
+void mda_index_free(mda_index_t * index);
+
+/**
+ * \brief Index a lattice node by the address of its interface. Nodes
+ *    having no address (stars) are ignored.
+ * \param index A mda_index_t instance.
+ * \param elt A lattice node storing a mda_interface_t.
+ * \return true iif successful
+ */
+
+bool mda_index_add_interface(mda_index_t * index, lattice_elt_t * elt);
+
+/**
+ * \brief Retrieve the lattice node of the interface having a given address.
+ * \param index A mda_index_t instance.
+ * \param address The searched address.
+ * \return The corresponding lattice node, NULL if not found.
+ */
+
+lattice_elt_t * mda_index_find_interface(const mda_index_t * index, const address_t * address);
+
+/**
+ * \brief Record that a (ttl, flow_id) pair has been added to an interface.
+ *    A pair keeps the first source and the first testing interface it has
+ *    been recorded with.
+ * \param index A mda_index_t instance.
+ * \param ttl The TTL.
+ * \param flow_id The flow identifier.
+ * \param state The state of the flow (MDA_FLOW_TESTING to record the
+ *    interface testing this flow).
+ * \param elt The lattice node storing the interface.
+ * \return true iif successful
+ */
+
+bool mda_index_add_flow(mda_index_t * index, uint8_t ttl, uintmax_t flow_id, mda_flow_state_t state, lattice_elt_t * elt);
+
+/**
+ * \brief Retrieve the interface from which a given flow has been sent
+ *    with a given TTL.
+ * \param index A mda_index_t instance.
+ * \param ttl The TTL.
+ * \param flow_id The flow identifier.
+ * \return The corresponding lattice node, NULL if not found.
+ */
+
+lattice_elt_t * mda_index_find_source(const mda_index_t * index, uint8_t ttl, uintmax_t flow_id);
+
+/**
+ * \brief Retrieve and forget the interface testing a given flow with a
+ *    given TTL.
+ * \param index A mda_index_t instance.
+ * \param ttl The TTL.
+ * \param flow_id The flow identifier.
+ * \return The corresponding lattice node, NULL if not found.
+ */
+
+lattice_elt_t * mda_index_take_testing(mda_index_t * index, uint8_t ttl, uintmax_t flow_id);
+
+#endif // MDA_INDEX_H
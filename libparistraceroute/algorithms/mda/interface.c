@@ -1,11 +1,13 @@
 #include "interface.h"
 
 #include <stdlib.h>         // free
-#include <stdio.h>          // printf
-#include <string.h>         // strdup
+#include <stdio.h>          // fprintf, printf
+#include <string.h>         // strdup, memset
 
 #include "../../common.h"   // ELEMENT_FREE 
 
+#define MDA_INTERFACE_INIT_TTL_FLOWS 4 // Initial number of allocated ttl/flow tuples
+
 mda_interface_t * mda_interface_create(const address_t * address)
 {
     mda_interface_t * mda_interface;
@@ -20,9 +22,12 @@ mda_interface_t * mda_interface_create(const address_t * address)
         }
     }
 
-    if (!(mda_interface->ttl_flows = dynarray_create())) {
+    if (!(mda_interface->ttl_flows = malloc(MDA_INTERFACE_INIT_TTL_FLOWS * sizeof(mda_ttl_flow_t)))) {
         goto ERR_FLOWS;
     }
+    mda_interface->max_ttl_flows   = MDA_INTERFACE_INIT_TTL_FLOWS;
+    mda_interface->first_available = MDA_TTL_FLOW_NONE;
+    mda_interface->last_available  = MDA_TTL_FLOW_NONE;
 
     memset(mda_interface->ttl_set, 0, MAX_TTLS);
     mda_interface->num_ttls = 1;
@@ -41,72 +46,163 @@ ERR_INTERFACE:
 void mda_interface_free(mda_interface_t * interface)
 {
     if (interface) {
-        dynarray_free(interface->ttl_flows, (ELEMENT_FREE) mda_ttl_flow_free);
+        free(interface->ttl_flows);
         if (interface->address) address_free(interface->address);
         free(interface);
     }
 }
 
-bool mda_interface_add_flow_id(mda_interface_t * interface, uint8_t ttl, uintmax_t flow_id, mda_flow_state_t state)
+//---------------------------------------------------------------------------
+// List of available flows
+//---------------------------------------------------------------------------
+
+static void mda_interface_push_available(mda_interface_t * interface, size_t i)
 {
-    mda_flow_t     * mda_flow;
-    mda_ttl_flow_t * mda_ttl_flow;
+    mda_ttl_flow_t * mda_ttl_flow = &interface->ttl_flows[i];
+
+    mda_ttl_flow->prev_available = interface->last_available;
+    mda_ttl_flow->next_available = MDA_TTL_FLOW_NONE;
+    if (interface->last_available != MDA_TTL_FLOW_NONE) {
+        interface->ttl_flows[interface->last_available].next_available = i;
+    } else {
+        interface->first_available = i;
+    }
+    interface->last_available = i;
+}
+
+static void mda_interface_unlink_available(mda_interface_t * interface, size_t i)
+{
+    mda_ttl_flow_t * mda_ttl_flow = &interface->ttl_flows[i];
 
-    if (!(mda_flow = mda_flow_create(flow_id, state))) {
-        goto ERR_MDA_FLOW_CREATE;
+    if (mda_ttl_flow->prev_available != MDA_TTL_FLOW_NONE) {
+        interface->ttl_flows[mda_ttl_flow->prev_available].next_available = mda_ttl_flow->next_available;
+    } else {
+        interface->first_available = mda_ttl_flow->next_available;
     }
+    if (mda_ttl_flow->next_available != MDA_TTL_FLOW_NONE) {
+        interface->ttl_flows[mda_ttl_flow->next_available].prev_available = mda_ttl_flow->prev_available;
+    } else {
+        interface->last_available = mda_ttl_flow->prev_available;
+    }
+}
 
-    if (!(mda_ttl_flow = mda_ttl_flow_create(ttl, mda_flow))) {
-        goto ERR_TTL_FLOW_CREATE;
+// Update the neighbours of an available tuple moved to index j
+static void mda_interface_move_available(mda_interface_t * interface, size_t j)
+{
+    mda_ttl_flow_t * mda_ttl_flow = &interface->ttl_flows[j];
+
+    if (mda_ttl_flow->prev_available != MDA_TTL_FLOW_NONE) {
+        interface->ttl_flows[mda_ttl_flow->prev_available].next_available = j;
+    } else {
+        interface->first_available = j;
+    }
+    if (mda_ttl_flow->next_available != MDA_TTL_FLOW_NONE) {
+        interface->ttl_flows[mda_ttl_flow->next_available].prev_available = j;
+    } else {
+        interface->last_available = j;
     }
+}
+
+//---------------------------------------------------------------------------
+// ttl/flow tuples
+//---------------------------------------------------------------------------
 
-    if (!(dynarray_push_element(interface->ttl_flows, mda_ttl_flow))) {
-        goto ERR_DYNARRAY_PUSH_ELEMENT;
+bool mda_interface_add_flow_id(mda_interface_t * interface, uint8_t ttl, uintmax_t flow_id, mda_flow_state_t state)
+{
+    mda_ttl_flow_t * ttl_flows;
+    size_t           i = interface->num_ttl_flows;
+
+    if (i == interface->max_ttl_flows) {
+        if (!(ttl_flows = realloc(interface->ttl_flows, 2 * interface->max_ttl_flows * sizeof(mda_ttl_flow_t)))) {
+            goto ERR_REALLOC;
+        }
+        interface->ttl_flows = ttl_flows;
+        interface->max_ttl_flows *= 2;
     }
 
+    interface->ttl_flows[i].ttl              = ttl;
+    interface->ttl_flows[i].mda_flow.flow_id = flow_id;
+    interface->ttl_flows[i].mda_flow.state   = state;
+    interface->num_ttl_flows++;
+    interface->num_flows[state]++;
+    if (state == MDA_FLOW_AVAILABLE) {
+        mda_interface_push_available(interface, i);
+    }
     return true;
 
-ERR_DYNARRAY_PUSH_ELEMENT:
-    mda_ttl_flow_free(mda_ttl_flow);
-ERR_TTL_FLOW_CREATE:
-    mda_flow_free(mda_flow);
-ERR_MDA_FLOW_CREATE:
+ERR_REALLOC:
     return false;
 }
 
-size_t mda_interface_get_num_flows(const mda_interface_t * interface, mda_flow_state_t state)
+mda_ttl_flow_t * mda_interface_find_flow(mda_interface_t * interface, uintmax_t flow_id, mda_flow_state_t state)
 {
-    const mda_ttl_flow_t * mda_ttl_flow;
-    size_t                 i,
-                           num_flows = dynarray_get_size(interface->ttl_flows),
-                           num_flows_with_state = 0;
-
-    for (i = 0; i < num_flows; i++) {
-        mda_ttl_flow = dynarray_get_ith_element(interface->ttl_flows, i);
-        if (mda_ttl_flow->mda_flow->state == state) {
-            num_flows_with_state++;
+    mda_ttl_flow_t * mda_ttl_flow;
+    size_t           i;
+
+    if (interface->num_flows[state]) {
+        for (i = 0; i < interface->num_ttl_flows; i++) {
+            mda_ttl_flow = &interface->ttl_flows[i];
+            if (mda_ttl_flow->mda_flow.flow_id == flow_id && mda_ttl_flow->mda_flow.state == state) {
+                return mda_ttl_flow;
+            }
         }
     }
+    return NULL;
+}
+
+void mda_interface_set_flow_state(mda_interface_t * interface, mda_ttl_flow_t * mda_ttl_flow, mda_flow_state_t state)
+{
+    size_t i = mda_ttl_flow - interface->ttl_flows;
 
-    return num_flows_with_state;
+    if (mda_ttl_flow->mda_flow.state == state) return;
+
+    if (mda_ttl_flow->mda_flow.state == MDA_FLOW_AVAILABLE) {
+        mda_interface_unlink_available(interface, i);
+    } else if (state == MDA_FLOW_AVAILABLE) {
+        mda_interface_push_available(interface, i);
+    }
+    interface->num_flows[mda_ttl_flow->mda_flow.state]--;
+    interface->num_flows[state]++;
+    mda_ttl_flow->mda_flow.state = state;
+}
+
+void mda_interface_del_flow(mda_interface_t * interface, mda_ttl_flow_t * mda_ttl_flow)
+{
+    size_t i    = mda_ttl_flow - interface->ttl_flows,
+           last = interface->num_ttl_flows - 1;
+
+    if (mda_ttl_flow->mda_flow.state == MDA_FLOW_AVAILABLE) {
+        mda_interface_unlink_available(interface, i);
+    }
+    interface->num_flows[mda_ttl_flow->mda_flow.state]--;
+
+    // Move the last tuple in the released slot
+    if (i != last) {
+        interface->ttl_flows[i] = interface->ttl_flows[last];
+        if (interface->ttl_flows[i].mda_flow.state == MDA_FLOW_AVAILABLE) {
+            mda_interface_move_available(interface, i);
+        }
+    }
+    interface->num_ttl_flows--;
+}
+
+size_t mda_interface_get_num_flows(const mda_interface_t * interface, mda_flow_state_t state)
+{
+    return interface->num_flows[state];
 }
 
 mda_ttl_flow_t * mda_interface_get_available_flow_id(mda_interface_t * interface, size_t num_siblings, mda_data_t * data)
 {
     uintmax_t        flow_id;
     mda_ttl_flow_t * mda_ttl_flow;
-    mda_flow_t *     mda_flow;
-    size_t           i, size = dynarray_get_size(interface->ttl_flows);
+    size_t           size = interface->num_ttl_flows;
     uint8_t          ttl;
 
-    // Search in the flow list for the first available one
-    for (i = 0; i < size; i++) {
-        mda_ttl_flow = dynarray_get_ith_element(interface->ttl_flows, i);
-        mda_flow = mda_ttl_flow->mda_flow;
-        if (mda_flow->state == MDA_FLOW_AVAILABLE) {
-            mda_flow->state = MDA_FLOW_UNAVAILABLE;
-            return mda_ttl_flow;
-        }
+    // Take the first available flow
+    if (interface->first_available != MDA_TTL_FLOW_NONE) {
+        mda_ttl_flow = &interface->ttl_flows[interface->first_available];
+        mda_interface_set_flow_state(interface, mda_ttl_flow, MDA_FLOW_UNAVAILABLE);
+        return mda_ttl_flow;
     }
 
     // TODO the num ttl_set restriction could be a problem
@@ -121,26 +217,27 @@ mda_ttl_flow_t * mda_interface_get_available_flow_id(mda_interface_t * interface
         if (!mda_interface_add_flow_id(interface, ttl, flow_id, MDA_FLOW_UNAVAILABLE)) {
             return NULL; // error adding flow id to the list
         }
-        return dynarray_get_ith_element(interface->ttl_flows, size);
+        return &interface->ttl_flows[size];
     }
 
     return NULL;
 }
 
-static void flow_dump(const mda_interface_t * interface)
+static void flow_fdump(FILE * out, const mda_interface_t * interface)
 {
     const  mda_flow_t * mda_flow;
     const  mda_ttl_flow_t * mda_ttl_flow;
     size_t              i, size;
 
     if(!interface) {
-        printf("(null)");
+        fprintf(out, "(null)");
     } else {
-        size = dynarray_get_size(interface->ttl_flows);
+        size = interface->num_ttl_flows;
         for (i = 0; i < size; i++) {
-            mda_ttl_flow = dynarray_get_ith_element(interface->ttl_flows, i);
-            mda_flow = mda_ttl_flow->mda_flow;
-            printf(
+            mda_ttl_flow = &interface->ttl_flows[i];
+            mda_flow = &mda_ttl_flow->mda_flow;
+            fprintf(
+                out,
                 " %d%c%ju%c",
                 mda_ttl_flow->ttl,
                 mda_flow_state_to_char(mda_flow),
@@ -151,23 +248,32 @@ static void flow_dump(const mda_interface_t * interface)
     }
 }
 
+static inline void flow_dump(const mda_interface_t * interface) {
+    flow_fdump(stdout, interface);
+}
+
 /**
- * \brief Print to the standard output a mda_interface_t instance.
+ * \brief Print a mda_interface_t instance in a given stream.
+ * \param out The output stream.
  * \param hop The mda_interface_t we want to print.
  * \param hostname The FQDN related to this hop.
  */
 
 // TODO improve the 3 following functions
-static void mda_hop_dump(const mda_interface_t * hop, char * hostname)
+static void mda_hop_fdump(FILE * out, const mda_interface_t * hop, char * hostname)
 {
     if (hop->address) {
-        address_dump(hop->address);
-    } else printf("None");
+        address_fdump(out, hop->address);
+    } else fprintf(out, "None");
     if (hostname) {
-        printf(" (%s)", hostname);
+        fprintf(out, " (%s)", hostname);
     }
 }
 
+static inline void mda_hop_dump(const mda_interface_t * hop, char * hostname) {
+    mda_hop_fdump(stdout, hop, hostname);
+}
+
 static inline void mda_hop_dump_without_resolv(const lattice_elt_t * elt) {
     const mda_interface_t * hop = lattice_elt_get_data(elt);
     mda_hop_dump(hop, NULL);
@@ -182,7 +288,7 @@ static inline void mda_hop_dump_with_resolv(const lattice_elt_t * elt) {
     if (hostname) free(hostname);
 }
 
-void mda_link_dump(const mda_interface_t * link[2], bool do_resolv)
+void mda_link_fdump(FILE * out, const mda_interface_t ** link, bool do_resolv)
 {
     char *  hostname = NULL;
     uint8_t ttl;
@@ -191,36 +297,62 @@ void mda_link_dump(const mda_interface_t * link[2], bool do_resolv)
     // Print TTL
     for (i = 0; i < link[0]->num_ttls; ++i) {
         ttl = link[0]->ttl_set[i];
-        printf("%hhu ", ttl);
+        fprintf(out, "%hhu ", ttl);
     }
 
     // Print source of the link
     if (do_resolv && link[0]->address) {
         address_resolv(link[0]->address, &hostname, CACHE_ENABLED);
     }
-    mda_hop_dump(link[0], hostname);
+    mda_hop_fdump(out, link[0], hostname);
     if (hostname) free(hostname);
 
     // Print target of the link (if any)
     if (link[1]) {
-        printf(" -> ");
-        mda_hop_dump(link[1], NULL);
+        fprintf(out, " -> ");
+        mda_hop_fdump(out, link[1], NULL);
     }
 
     // Print flow information
-    printf(" [{");
-    flow_dump(link[0]);
-    printf("} -> { ");
-    flow_dump(link[1]);
-    printf("}]\n");
+    fprintf(out, " [{");
+    flow_fdump(out, link[0]);
+    fprintf(out, "} -> { ");
+    flow_fdump(out, link[1]);
+    fprintf(out, "}]\n");
+}
+
+void mda_link_dump(const mda_interface_t ** link, bool do_resolv)
+{
+    mda_link_fdump(stdout, link, do_resolv);
+}
+
+bool mda_link_output(output_t * output, const address_t * dst_addr, const mda_interface_t ** link, bool do_resolv)
+{
+    output_record_t record;
+    char          * hostname = NULL;
+    bool            ret;
+
+    memset(&record, 0, sizeof(output_record_t));
+    record.type = OUTPUT_RECORD_LINK;
+    record.dst  = dst_addr;
+    record.ttl  = link[0]->num_ttls ? link[0]->ttl_set[0] : 0;
+    record.from = link[0]->address;
+    record.to   = link[1] ? link[1]->address : NULL;
+
+    if (do_resolv && link[0]->address) {
+        address_resolv(link[0]->address, &hostname, CACHE_ENABLED);
+    }
+    record.hostname = hostname;
+
+    ret = output_write_record(output, &record);
+    if (hostname) free(hostname);
+    return ret;
 }
 
 void mda_lattice_elt_dump(const lattice_elt_t * lattice_elt) //, bool do_resolv)
 {
-    size_t                  num_nexthops;
+    size_t                  i, num_nexthops;
 //    const mda_interface_t * curr_hop;
-    const dynarray_t      * next_hops;
-    char                  * hostname = NULL;
 
     if (!lattice_elt) goto ERROR;
 
@@ -228,18 +360,16 @@ void mda_lattice_elt_dump(const lattice_elt_t * lattice_elt) //, bool do_resolv)
 //    curr_hop = lattice_elt_get_data(lattice_elt);
     mda_hop_dump_without_resolv(lattice_elt);
     
-    // Get next hops
-    if (!(next_hops = lattice_elt->next)) {
-        // We should retrieve an empty dynarray if there is no next hop
-        goto ERROR_NEXTHOPS;
-    }
-
-    num_nexthops = dynarray_get_size(next_hops);
+    num_nexthops = lattice_elt_get_num_next(lattice_elt);
 
     // Print next hops
     if (num_nexthops) {
-        printf(" -> ");
-        dynarray_dump(next_hops, (ELEMENT_DUMP) mda_hop_dump_without_resolv);
+        printf(" -> [ ");
+        for (i = 0; i < num_nexthops; ++i) {
+            if (i > 0) printf(", ");
+            mda_hop_dump_without_resolv(lattice_elt_get_ith_next(lattice_elt, i));
+        }
+        printf(" ]");
     }
     printf("\n");
 
@@ -250,15 +380,13 @@ void mda_lattice_elt_dump(const lattice_elt_t * lattice_elt) //, bool do_resolv)
     if (num_nexthops) {
         printf(" -> ");
         for (i = 0; i < num_nexthops; ++i) {
-            next_hop = lattice_elt_get_data(dynarray_get_ith_element(next_hops, i));
+            next_hop = lattice_elt_get_data(lattice_elt_get_ith_next(lattice_elt, i));
             flow_dump(next_hop);
         }
     }
     printf("]");
 */
 
-ERROR_NEXTHOPS:
-    if (hostname) free(hostname);
 ERROR:
     return;
 }
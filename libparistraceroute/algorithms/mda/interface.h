@@ -3,12 +3,14 @@
 
 #include <stdbool.h>        // bool
 #include <stddef.h>         // size_t
+#include <stdio.h>          // FILE
 
 #include "data.h"           // mda_data_t
 #include "flow.h"           // mda_flow_state_t
 #include "ttl_flow.h"       // mda_ttl_flow_t
 #include "../../address.h"  // address_t
 #include "../../dynarray.h" // dynarray_t
+#include "../../output.h"   // output_t
 
 typedef enum {
     MDA_LB_TYPE_UNKNOWN,             /**< IP hop state not yet classified  */
@@ -26,18 +28,30 @@ typedef struct {
                   received,         
                   timeout,
                   num_stars;         /**< Number of timeout for this hop          */
-    dynarray_t  * ttl_flows;         /**< ttl-flow_id tuples related to this hop  */
+    mda_ttl_flow_t * ttl_flows;      /**< ttl-flow_id tuples related to this hop (by value) */
+    size_t        num_ttl_flows;     /**< Number of tuples in ttl_flows           */
+    size_t        max_ttl_flows;     /**< Number of tuples allocated in ttl_flows */
+    size_t        num_flows[MDA_FLOW_NUM_STATES]; /**< Number of tuples per flow state */
+    size_t        first_available;   /**< Index of the first available tuple (or MDA_TTL_FLOW_NONE) */
+    size_t        last_available;    /**< Index of the last available tuple (or MDA_TTL_FLOW_NONE) */
     uint8_t       ttl_set[MAX_TTLS]; /**< The set of ttls that can reach this hop. 
                                           This structure is used to improve 
                                           efficiency later in the code.           */ 
     size_t        num_ttls;          /**< Number of ttls contained in this hop    */
     bool          enumeration_done;
     mda_lb_type_t type;              /**< Type of load balancer            */
+    bool          is_dirty;          /**< True iif this hop is in mda_data_t::dirty */
+    bool          is_done;           /**< True iif this hop has been fully processed */
+    bool          is_walkable;       /**< True iif its next hops may be processed */
+    size_t        num_walkable_prev; /**< Number of walkable previous hops (1 for the root) */
+    bool          is_visited;        /**< True iif this hop has been processed at least once */
+    size_t        num_visited_prev;  /**< Number of visited previous hops */
+    bool          is_speculative;    /**< True iif it has been last processed while its previous hops were not walkable */
+    size_t        num_prev;          /**< Number of previous hops */
+    bool          is_meshed;         /**< True iif mda-lite has detected meshing at this hop (full MDA is then used) */
+    bool          is_verified;       /**< True iif its next hops have been verified against the topology file (see topology.h) */
 } mda_interface_t;
 
-
-void mda_ttl_flow_free(mda_ttl_flow_t * mda_ttl_flow);
-
 /**
  * \brief Allocate a new mda_interface_t instance, which corresponds to
  *    an IP hop discovered by mda.
@@ -56,14 +70,45 @@ mda_interface_t * mda_interface_create(const address_t * address);
 void mda_interface_free(mda_interface_t * interface);
 
 /**
- * \brief Allocate and attach a new mda_flow_t instance to a given
- *    mda_interface_t instance.
+ * \brief Attach a new ttl/flow tuple to a given mda_interface_t instance.
+ * \param ttl The ttl of the tuple.
  * \param flow_id The new flow id.
  * \param flow_state The flow state.
+ * \return true iif successful.
  */
 
 bool mda_interface_add_flow_id(mda_interface_t * interface, uint8_t ttl, uintmax_t flow_id, mda_flow_state_t state);
 
+/**
+ * \brief Retrieve the ttl/flow tuple of an interface having a given
+ *    flow id and a given state.
+ * \param interface A mda_interface_t instance.
+ * \param flow_id The searched flow id.
+ * \param state The searched flow state.
+ * \return The corresponding tuple if found, NULL otherwise. This pointer
+ *    is invalidated once a flow is added to or deleted from interface.
+ */
+
+mda_ttl_flow_t * mda_interface_find_flow(mda_interface_t * interface, uintmax_t flow_id, mda_flow_state_t state);
+
+/**
+ * \brief Update the state of a ttl/flow tuple of an interface.
+ * \param interface A mda_interface_t instance.
+ * \param mda_ttl_flow A tuple of interface.
+ * \param state The new flow state.
+ */
+
+void mda_interface_set_flow_state(mda_interface_t * interface, mda_ttl_flow_t * mda_ttl_flow, mda_flow_state_t state);
+
+/**
+ * \brief Remove a ttl/flow tuple from an interface. The last tuple
+ *    of the interface is moved in its slot.
+ * \param interface A mda_interface_t instance.
+ * \param mda_ttl_flow A tuple of interface.
+ */
+
+void mda_interface_del_flow(mda_interface_t * interface, mda_ttl_flow_t * mda_ttl_flow);
+
 /**
  * \brief Retrieve the number of flows having a given state.
  * \param state The flow state. This is a value among {MDA_FLOW_AVAILABLE,
@@ -89,7 +134,9 @@ size_t mda_interface_get_num_flows(const mda_interface_t * interface, mda_flow_s
  *    this TTL.
  * \param data A mda_data_t instance which stores the last used flow id.
  *    This last ID is updated.
- * \return A flow-id > 0 if successful, 0 otherwise.
+ * \return The tuple of the flow (now unavailable) if successful,
+ *    NULL otherwise. This pointer is invalidated once a flow is added
+ *    to or deleted from interface.
  */
 
 mda_ttl_flow_t * mda_interface_get_available_flow_id(mda_interface_t * interface, size_t num_siblings, mda_data_t * data);
@@ -113,6 +160,30 @@ void mda_flow_dump(const mda_interface_t * interface);
 
 void mda_link_dump(const mda_interface_t ** link, bool do_resolv);
 
+/**
+ * \brief Print a pair of mda_interface_t instances in a given stream.
+ * \param out The output stream.
+ * \param link Points to a pair of mda_interface_t interfaces
+ *    (link[0] must be set).
+ * \param do_resolv Pass true to resolv IP address and print
+ *    the corresponding FQDN.
+ */
+
+void mda_link_fdump(FILE * out, const mda_interface_t ** link, bool do_resolv);
+
+/**
+ * \brief Write a pair of mda_interface_t instances as a record of a
+ *    structured output (see output.h).
+ * \param output The output_t instance.
+ * \param dst_addr The destination of the mda instance.
+ * \param link Points to a pair of mda_interface_t interfaces
+ *    (link[1] may be NULL).
+ * \param do_resolv Pass true to resolv the source of the link.
+ * \return true iif successful.
+ */
+
+bool mda_link_output(output_t * output, const address_t * dst_addr, const mda_interface_t ** link, bool do_resolv);
+
 /**
  * \brief Callback used by lattice_dump
  * \param elt A lattice node instance
@@ -0,0 +1,286 @@
+#include <stdlib.h>                   // malloc, free, strtoull
+#include <stdio.h>                    // fopen, getline, perror, rename
+#include <string.h>                   // memcpy, memset, strchr, strcmp, strdup, strtok_r
+#include <errno.h>                    // errno, ENOENT
+#include <inttypes.h>                 // PRIu64
+#include <time.h>                     // time
+#include <unistd.h>                   // unlink
+#include <arpa/inet.h>                // inet_pton, inet_ntop
+#include <pthread.h>                  // pthread_mutex_*
+
+#include "topology.h"
+#include "../../containers/hashmap.h" // hashmap_t
+
+typedef struct {
+    uint64_t    expiry;        /**< When the entry expires (seconds since the Epoch) */
+    address_t * next_hops;     /**< The next hops of the interface */
+    size_t      num_next_hops; /**< Number of addresses stored in next_hops, 0 if not enumerated yet */
+    size_t      num_refs;      /**< Number of running mda instances holding this interface (see mda_topology_ref) */
+} mda_topology_entry_t;
+
+// Maps the address_t of each interface to its mda_topology_entry_t,
+// NULL if no topology file is opened and the entries are not shared
+static hashmap_t * topology = NULL;
+
+// The opened topology file, NULL if the entries are only shared
+static char * topology_filename = NULL;
+
+// The topology is shared by the threads running a pt_loop_t
+static pthread_mutex_t topology_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void mda_topology_entry_free(mda_topology_entry_t * entry) {
+    free(entry->next_hops);
+}
+
+/**
+ * \brief Parse an IPv4 or an IPv6 address.
+ * \param s The address.
+ * \param address The address_t instance to fill.
+ * \return true iif successful.
+ */
+
+static bool mda_topology_parse_address(const char * s, address_t * address) {
+    memset(address, 0, sizeof(address_t));
+    address->family = strchr(s, ':') ? AF_INET6 : AF_INET;
+    return inet_pton(address->family, s, &address->ip) == 1;
+}
+
+/**
+ * \brief Parse a line of the topology file and store the corresponding
+ *    entry (unless it has expired).
+ * \param line The line.
+ * \param now The current date.
+ * \return true iif successful.
+ */
+
+static bool mda_topology_load_line(char * line, time_t now) {
+    mda_topology_entry_t   entry;
+    address_t              address,
+                           next_hops[MDA_TOPOLOGY_MAX_NEXT_HOPS];
+    char                 * token,
+                         * end,
+                         * saveptr;
+
+    if (!(token = strtok_r(line, " \n", &saveptr))) return false;
+    entry.expiry = strtoull(token, &end, 10);
+    if (*end) return false;
+
+    if (!(token = strtok_r(NULL, " \n", &saveptr))
+    ||  !mda_topology_parse_address(token, &address)) {
+        return false;
+    }
+
+    for (entry.num_next_hops = 0; (token = strtok_r(NULL, " \n", &saveptr)); entry.num_next_hops++) {
+        if (entry.num_next_hops == MDA_TOPOLOGY_MAX_NEXT_HOPS
+        || !mda_topology_parse_address(token, &next_hops[entry.num_next_hops])) {
+            return false;
+        }
+    }
+    if (!entry.num_next_hops) return false;
+    if (entry.expiry <= (uint64_t) now) return true;
+    entry.num_refs = 0;
+
+    if (!(entry.next_hops = malloc(entry.num_next_hops * sizeof(address_t)))) return false;
+    memcpy(entry.next_hops, next_hops, entry.num_next_hops * sizeof(address_t));
+    if (!hashmap_update(topology, &address, &entry)) {
+        free(entry.next_hops);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Create the (empty) table of the entries.
+ * \return true iif successful.
+ */
+
+static bool mda_topology_create() {
+    return (topology = hashmap_create(
+        sizeof(address_t),            address_hash,            address_compare, address_dump,
+        sizeof(mda_topology_entry_t), mda_topology_entry_free, NULL
+    )) != NULL;
+}
+
+bool mda_topology_open(const char * filename)
+{
+    FILE   * file;
+    char   * line = NULL;
+    size_t   line_size = 0;
+    time_t   now = time(NULL);
+
+    mda_topology_close();
+
+    if (!(topology_filename = strdup(filename))) goto ERR_STRDUP;
+    if (!mda_topology_create())                  goto ERR_HASHMAP_CREATE;
+
+    // A new topology file
+    if (!(file = fopen(filename, "r"))) {
+        if (errno == ENOENT) return true;
+        perror(filename);
+        goto ERR_FOPEN;
+    }
+
+    if (getline(&line, &line_size, file) == -1
+    ||  strcmp(line, MDA_TOPOLOGY_MAGIC "\n") != 0) {
+        goto ERR_INVALID_FILE;
+    }
+    while (getline(&line, &line_size, file) != -1) {
+        if (!mda_topology_load_line(line, now)) goto ERR_INVALID_FILE;
+    }
+
+    free(line);
+    fclose(file);
+    return true;
+
+ERR_INVALID_FILE:
+    fprintf(stderr, "%s: invalid topology file\n", filename);
+    free(line);
+    fclose(file);
+ERR_FOPEN:
+    hashmap_free(topology);
+    topology = NULL;
+ERR_HASHMAP_CREATE:
+    free(topology_filename);
+    topology_filename = NULL;
+ERR_STRDUP:
+    return false;
+}
+
+bool mda_topology_share()
+{
+    return topology || mda_topology_create();
+}
+
+/**
+ * \brief Write an address in the topology file.
+ * \param file The topology file.
+ * \param address The address.
+ */
+
+static void mda_topology_write_address(FILE * file, const address_t * address) {
+    char buffer[INET6_ADDRSTRLEN];
+
+    if (inet_ntop(address->family, &address->ip, buffer, sizeof(buffer))) {
+        fprintf(file, " %s", buffer);
+    }
+}
+
+void mda_topology_close()
+{
+    const address_t            * address;
+    const mda_topology_entry_t * entry;
+    char                       * tmp_filename;
+    FILE                       * file;
+    size_t                       i = 0, j;
+
+    if (!topology) return;
+    if (!topology_filename) goto DONE_SHARE;
+
+    // The file is replaced at once, so that it is never partly written
+    if (!(tmp_filename = malloc(strlen(topology_filename) + 5))) goto ERR_MALLOC;
+    sprintf(tmp_filename, "%s.tmp", topology_filename);
+
+    if (!(file = fopen(tmp_filename, "w"))) goto ERR_FOPEN;
+    fprintf(file, "%s\n", MDA_TOPOLOGY_MAGIC);
+    while (hashmap_next(topology, &i, &address, &entry)) {
+        if (!entry->num_next_hops) continue;
+        fprintf(file, "%" PRIu64, entry->expiry);
+        mda_topology_write_address(file, address);
+        for (j = 0; j < entry->num_next_hops; j++) {
+            mda_topology_write_address(file, &entry->next_hops[j]);
+        }
+        fprintf(file, "\n");
+    }
+    if (fclose(file) != 0)                            goto ERR_FCLOSE;
+    if (rename(tmp_filename, topology_filename) != 0) goto ERR_RENAME;
+    goto DONE;
+
+ERR_FCLOSE:
+ERR_RENAME:
+    unlink(tmp_filename);
+ERR_FOPEN:
+    perror(tmp_filename);
+DONE:
+    free(tmp_filename);
+ERR_MALLOC:
+    free(topology_filename);
+    topology_filename = NULL;
+DONE_SHARE:
+    hashmap_free(topology);
+    topology = NULL;
+}
+
+size_t mda_topology_check(const address_t * address, const address_t * const * next_hops, size_t num_next_hops)
+{
+    const mda_topology_entry_t * entry;
+    size_t                       i, j, ret = 0;
+
+    if (!topology) return 0;
+
+    pthread_mutex_lock(&topology_mutex);
+    if (hashmap_find(topology, address, &entry)) {
+        ret = entry->num_next_hops;
+        for (i = 0; i < num_next_hops && ret; i++) {
+            for (j = 0; j < entry->num_next_hops; j++) {
+                if (address_equals(next_hops[i], &entry->next_hops[j])) break;
+            }
+            if (j == entry->num_next_hops) ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&topology_mutex);
+    return ret;
+}
+
+void mda_topology_update(const address_t * address, const address_t * const * next_hops, size_t num_next_hops)
+{
+    mda_topology_entry_t * entry;
+    address_t            * copy;
+    size_t                 i;
+
+    if (!topology || !num_next_hops || num_next_hops > MDA_TOPOLOGY_MAX_NEXT_HOPS) return;
+
+    if (!(copy = malloc(num_next_hops * sizeof(address_t)))) return;
+    for (i = 0; i < num_next_hops; i++) {
+        copy[i] = *next_hops[i];
+    }
+
+    // The entry keeps its references
+    pthread_mutex_lock(&topology_mutex);
+    if ((entry = hashmap_emplace(topology, address, NULL))) {
+        free(entry->next_hops);
+        entry->next_hops     = copy;
+        entry->num_next_hops = num_next_hops;
+        entry->expiry        = time(NULL) + MDA_TOPOLOGY_TTL;
+    } else {
+        free(copy);
+    }
+    pthread_mutex_unlock(&topology_mutex);
+}
+
+void mda_topology_ref(const address_t * address)
+{
+    mda_topology_entry_t * entry;
+
+    if (!topology) return;
+
+    pthread_mutex_lock(&topology_mutex);
+    if ((entry = hashmap_emplace(topology, address, NULL))) {
+        entry->num_refs++;
+    }
+    pthread_mutex_unlock(&topology_mutex);
+}
+
+void mda_topology_unref(const address_t * address)
+{
+    mda_topology_entry_t * entry;
+
+    if (!topology) return;
+
+    // The entries stored in the topology file are kept once enumerated
+    pthread_mutex_lock(&topology_mutex);
+    if (hashmap_find(topology, address, &entry) && entry->num_refs && !--entry->num_refs
+    && (!topology_filename || !entry->num_next_hops)) {
+        hashmap_erase(topology, address);
+    }
+    pthread_mutex_unlock(&topology_mutex);
+}
@@ -0,0 +1,116 @@
+#ifndef MDA_TOPOLOGY_H
+#define MDA_TOPOLOGY_H
+
+/**
+ * \file topology.h
+ * \brief Persistent cache of the next hops enumerated by mda.
+ *
+ * Enumerating the next hops of a load balancer requires many probes
+ * (see bound_get_nk), although most load balancers barely change between
+ * two runs. Once a topology file is opened, the next hops enumerated by
+ * a previous run are only verified: an interface stops enumerating its
+ * next hops once it has found again every next hop known for it, after
+ * MDA_TOPOLOGY_NUM_EXTRA_PROBES extra probes. If a new next hop shows up
+ * (or if a known one is not found), the full enumeration is carried on.
+ *
+ * An entry is only refreshed by a full enumeration, so that each load
+ * balancer is enumerated again once its entry has expired.
+ *
+ * The file is a text file, made of a header line (MDA_TOPOLOGY_MAGIC)
+ * followed by a line per interface:
+ *
+ *     expiry address next_hop1 next_hop2 ...
+ *
+ * where expiry is in seconds since the Epoch. It is rewritten when it
+ * is closed (see mda_topology_close).
+ *
+ * The entries are also shared by the mda instances running at once (e.g.
+ * toward the destinations of a prefix, see mda_topology_share): the next
+ * hops enumerated by an instance are only verified by the others, which
+ * thus enumerate only the part of their lattice diverging from the
+ * lattices of the others. Each entry counts the running instances holding
+ * its interface, and an entry which is not stored in a topology file is
+ * released once no instance holds its interface anymore.
+ */
+
+#include <stdbool.h>           // bool
+#include <stddef.h>            // size_t
+
+#include "../../address.h"     // address_t
+
+#define MDA_TOPOLOGY_MAGIC             "paris-traceroute-topology 1"
+
+// Lifetime (in seconds) of an entry
+#define MDA_TOPOLOGY_TTL               86400
+
+// Number of probes sent by an interface, besides one per known next hop,
+// before its next hops are verified
+#define MDA_TOPOLOGY_NUM_EXTRA_PROBES  2
+
+// Maximum number of next hops stored per interface
+#define MDA_TOPOLOGY_MAX_NEXT_HOPS     128
+
+/**
+ * \brief Open a topology file (or create it), and load the entries
+ *    which have not expired.
+ * \param filename The topology file.
+ * \return true iif successful.
+ */
+
+bool mda_topology_open(const char * filename);
+
+/**
+ * \brief Share the next hops enumerated by the mda instances running at
+ *    once, even if no topology file is opened.
+ * \return true iif successful.
+ */
+
+bool mda_topology_share();
+
+/**
+ * \brief Write the entries which have not expired in the topology file
+ *    (if any) and close it. The entries are not shared anymore.
+ */
+
+void mda_topology_close();
+
+/**
+ * \brief Compare the next hops of an interface to the entry of the
+ *    topology file.
+ * \param address The address of the interface.
+ * \param next_hops The next hops found so far.
+ * \param num_next_hops The number of next hops found so far.
+ * \return The number of next hops known for this interface, 0 if it is
+ *    unknown (or if the entries are neither stored in a topology file nor
+ *    shared) or if one of next_hops is not known.
+ */
+
+size_t mda_topology_check(const address_t * address, const address_t * const * next_hops, size_t num_next_hops);
+
+/**
+ * \brief Store the next hops enumerated from an interface (if a topology
+ *    file is opened or if the entries are shared).
+ * \param address The address of the interface.
+ * \param next_hops Its next hops.
+ * \param num_next_hops The number of next hops.
+ */
+
+void mda_topology_update(const address_t * address, const address_t * const * next_hops, size_t num_next_hops);
+
+/**
+ * \brief Record that an mda instance holds an interface in its lattice,
+ *    so that its entry is kept while this instance is running.
+ * \param address The address of the interface.
+ */
+
+void mda_topology_ref(const address_t * address);
+
+/**
+ * \brief Record that an mda instance does not hold an interface anymore
+ *    (see mda_topology_ref).
+ * \param address The address of the interface.
+ */
+
+void mda_topology_unref(const address_t * address);
+
+#endif // MDA_TOPOLOGY_H
@@ -1,30 +1,26 @@
 #ifndef MDA_TTL_FLOW_H
 #define MDA_TTL_FLOW_H
 
-#include "flow.h"           // mda_flow_state_t
+#include <stddef.h>         // size_t
+
+#include "flow.h"           // mda_flow_t
 
 #define MAX_TTLS 5 // Max ttls we assume can be associated with this interface
                    // TODO Avoid hardcoding
 
-typedef struct {
-    uint8_t      ttl;
-    mda_flow_t * mda_flow;
-} mda_ttl_flow_t;
+#define MDA_TTL_FLOW_NONE ((size_t) -1) // End of the list of available flows
 
 /**
- * \brief Allocate new ttl/flow tuple
- * \param ttl The ttl for this tuple
- * \param mda_flow the flow for this tuple
- * \return A pointer to the ttl/flow tuple
+ * A ttl/flow tuple. The tuples of an interface are stored by value
+ * in a contiguous array (see mda_interface_t), and the available ones
+ * are chained (by index) in a list.
  */
 
-mda_ttl_flow_t * mda_ttl_flow_create(uint8_t ttl, mda_flow_t * mda_flow);
-
-/**
- * \brief Free a given ttl/flow tuple
- * \param mda_ttl_flow The given tuple to free
- */
-
-void mda_ttl_flow_free(mda_ttl_flow_t * mda_ttl_flow);
+typedef struct {
+    uint8_t      ttl;
+    mda_flow_t   mda_flow;
+    size_t       prev_available; /**< Previous available flow (if mda_flow.state == MDA_FLOW_AVAILABLE) */
+    size_t       next_available; /**< Next available flow (if mda_flow.state == MDA_FLOW_AVAILABLE) */
+} mda_ttl_flow_t;
 
 #endif // MDA_TTL_FLOW_H
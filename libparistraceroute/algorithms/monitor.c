@@ -0,0 +1,579 @@
+#include "monitor.h"
+
+#include <errno.h>       // errno, EINVAL
+#include <stdlib.h>      // calloc, malloc, free
+#include <stdio.h>       // fprintf
+#include <string.h>      // memset
+#include <math.h>        // ceil, sqrt
+
+#include "../probe.h"
+#include "../event.h"
+#include "../algorithm.h"
+#include "../address.h"  // address_resolv
+#include "../common.h"   // MIN, MAX, get_time_ns, get_realtime_offset_ns
+#include "../network.h"  // options_network_get_timeout
+#include "../whois.h"    // whois_get_asn
+
+//-----------------------------------------------------------------
+// Monitor options
+//-----------------------------------------------------------------
+
+// Bounded parameters
+static double   interval[4] = OPTIONS_MONITOR_INTERVAL;
+static unsigned count[4]    = OPTIONS_MONITOR_COUNT;
+
+static option_t monitor_options[] = {
+    // action                 short      long                metavar    help                         variable
+    {opt_store_double_lim_en, OPT_NO_SF, "--train-interval", "SECONDS", MONITOR_HELP_train_interval, interval},
+    {opt_store_int_lim_en,    OPT_NO_SF, "--trains",         "NUM",     MONITOR_HELP_trains,         count},
+    END_OPT_SPECS
+};
+
+double options_monitor_get_interval() {
+    return interval[0];
+}
+
+size_t options_monitor_get_count() {
+    return count[0];
+}
+
+unsigned options_monitor_get_is_set() {
+    return interval[3] || count[3];
+}
+
+const option_t * monitor_get_options() {
+    return monitor_options;
+}
+
+monitor_options_t monitor_get_default_options() {
+    monitor_options_t monitor_options = {
+        .traceroute_options = traceroute_get_default_options(),
+        .interval           = OPTIONS_MONITOR_INTERVAL_DEFAULT,
+        .count              = OPTIONS_MONITOR_COUNT_DEFAULT,
+    };
+    return monitor_options;
+}
+
+void options_monitor_init(monitor_options_t * monitor_options) {
+    monitor_options->interval = options_monitor_get_interval();
+    monitor_options->count    = options_monitor_get_count();
+}
+
+//-----------------------------------------------------------------
+// Monitor algorithm's data
+//-----------------------------------------------------------------
+
+void monitor_data_free(monitor_data_t * data) {
+    size_t i;
+
+    if (data) {
+        // The probes in flight are released by the network layer
+        for (i = 0; i < MONITOR_MAX_TRAINS; i++) {
+            free(data->slots[i].train);
+            free(data->slots[i].probes);
+        }
+        if (data->probe_skel) probe_free(data->probe_skel);
+        free(data->hops);
+        free(data);
+    }
+}
+
+/**
+ * \brief Allocate a monitor_data_t instance, and prepare the skeleton of
+ *    the probes: it is finalized once for all, so that the probes of a
+ *    train only differ by their TTL.
+ * \param probe_skel The probe skeleton passed to this instance.
+ * \param options The options of this instance.
+ * \return The newly allocated monitor_data_t instance, NULL in case of
+ *    failure.
+ */
+
+static monitor_data_t * monitor_data_create(const probe_t * probe_skel, const monitor_options_t * options) {
+    monitor_data_t * data;
+    size_t           i;
+
+    if (!(data = calloc(1, sizeof(monitor_data_t))))     goto ERR_MALLOC;
+    if (!(data->probe_skel = probe_dup(probe_skel)))     goto ERR_PROBE_DUP;
+    if (!probe_update_fields(data->probe_skel))          goto ERR_UPDATE_FIELDS;
+    if (!probe_resolve_field(data->probe_skel, "ttl", &data->ttl_field)) goto ERR_RESOLVE_TTL;
+
+    data->max_hops = options->traceroute_options.max_ttl - options->traceroute_options.min_ttl + 1;
+    if (!(data->hops = calloc(data->max_hops, sizeof(monitor_hop_t)))) goto ERR_HOPS;
+    for (i = 0; i < MONITOR_MAX_TRAINS; i++) {
+        if (!(data->slots[i].probes = calloc(data->max_hops, sizeof(probe_t *)))) goto ERR_SLOTS;
+    }
+
+    // Enough trains are in flight to cover the timeout of their probes
+    data->max_flying = MIN((size_t) ceil(options_network_get_timeout() / options->interval) + 1, MONITOR_MAX_TRAINS);
+    data->realtime_offset = get_realtime_offset_ns();
+    return data;
+
+ERR_SLOTS:
+    for (i = 0; i < MONITOR_MAX_TRAINS; i++) {
+        free(data->slots[i].probes);
+    }
+    free(data->hops);
+ERR_HOPS:
+ERR_RESOLVE_TTL:
+ERR_UPDATE_FIELDS:
+    probe_free(data->probe_skel);
+ERR_PROBE_DUP:
+    free(data);
+ERR_MALLOC:
+    return NULL;
+}
+
+//-----------------------------------------------------------------
+// Monitor default handler
+//-----------------------------------------------------------------
+
+/**
+ * \brief Print an interface, and its hostname if requested.
+ * \param out The output stream.
+ * \param interface The interface.
+ * \param do_resolv Pass true to print its hostname.
+ */
+
+static void monitor_interface_fdump(FILE * out, const address_t * interface, bool do_resolv) {
+    char * hostname;
+
+    if (do_resolv && address_resolv(interface, &hostname, CACHE_ENABLED)) {
+        fprintf(out, "%s (", hostname);
+        free(hostname);
+        address_fdump(out, interface);
+        fprintf(out, ")");
+    } else {
+        address_fdump(out, interface);
+    }
+}
+
+void monitor_event_fdump(
+    FILE                    * out,
+    const monitor_event_t   * monitor_event,
+    const monitor_options_t * monitor_options
+) {
+    const monitor_train_t   * train;
+    const monitor_outcome_t * outcome;
+    size_t                    i;
+
+    switch (monitor_event->type) {
+        case MONITOR_TRAIN:
+            train = monitor_event->data;
+
+            // The first train reveals the monitored path
+            if (train->index == 0) {
+                for (i = 0; i < train->num_hops; i++) {
+                    outcome = &train->outcomes[i];
+                    fprintf(out, "%2zu  ", train->min_ttl + i);
+                    if (outcome->has_reply) {
+                        monitor_interface_fdump(out, &outcome->interface, monitor_options->traceroute_options.do_resolv);
+                    } else {
+                        fprintf(out, "*");
+                    }
+                    fprintf(out, "\n");
+                }
+            }
+
+            fprintf(out, "train %zu:", train->index);
+            for (i = 0; i < train->num_hops; i++) {
+                outcome = &train->outcomes[i];
+                if (outcome->has_reply) {
+                    fprintf(out, "  %.3lf", outcome->rtt / 1000000.0);
+                } else {
+                    fprintf(out, "  *");
+                }
+            }
+            fprintf(out, " ms\n");
+            fflush(out);
+            break;
+
+        default:
+            break;
+    }
+}
+
+bool monitor_event_output(
+    output_t                * output,
+    const monitor_event_t   * monitor_event,
+    const monitor_options_t * monitor_options
+) {
+    const traceroute_options_t * traceroute_options = &monitor_options->traceroute_options;
+    const monitor_train_t      * train;
+    const monitor_outcome_t    * outcome;
+    output_record_t              record;
+    char                       * hostname;
+    size_t                       i;
+    bool                         ret = true;
+
+    switch (monitor_event->type) {
+        case MONITOR_TRAIN:
+            train = monitor_event->data;
+            for (i = 0; i < train->num_hops; i++) {
+                outcome  = &train->outcomes[i];
+                hostname = NULL;
+
+                memset(&record, 0, sizeof(output_record_t));
+                record.dst  = traceroute_options->dst_addr;
+                record.time = train->time;
+                record.ttl  = train->min_ttl + i;
+                if (outcome->has_reply) {
+                    record.type = OUTPUT_RECORD_REPLY;
+                    record.from = &outcome->interface;
+                    record.rtt  = outcome->rtt;
+                    if (traceroute_options->do_resolv
+                    &&  address_resolv(&outcome->interface, &hostname, CACHE_ENABLED)) {
+                        record.hostname = hostname;
+                    }
+                    if (traceroute_options->resolv_asn) {
+                        whois_get_asn(&outcome->interface, &record.asn, CACHE_ENABLED);
+                    }
+                } else {
+                    record.type = OUTPUT_RECORD_STAR;
+                }
+                ret = output_write_record(output, &record) && ret;
+                if (hostname) free(hostname);
+            }
+            break;
+
+        default:
+            break;
+    }
+    return ret;
+}
+
+void monitor_statistics_fdump(
+    FILE                    * out,
+    const monitor_data_t    * data,
+    const monitor_options_t * monitor_options
+) {
+    const monitor_hop_t * hop;
+    size_t                i, num_rtts;
+
+    fprintf(out, "---Monitor statistics---\n");
+    fprintf(out, "%zu trains reported, %zu probes scheduled\n", data->num_reported, data->num_probes);
+    for (i = 0; i < data->num_hops; i++) {
+        hop = &data->hops[i];
+        fprintf(out, "%2zu  ", monitor_options->traceroute_options.min_ttl + i);
+        if (hop->has_interface) {
+            monitor_interface_fdump(out, &hop->interface, monitor_options->traceroute_options.do_resolv);
+        } else {
+            fprintf(out, "*");
+        }
+        fprintf(out, "  %zu sent, %u%% loss",
+            hop->num_probes,
+            hop->num_probes ? (unsigned) (100 * hop->num_losses / hop->num_probes) : 0
+        );
+        if ((num_rtts = hop->num_probes - hop->num_losses)) {
+            fprintf(out, ", rtt min/avg/max/mdev = %.3lf/%.3lf/%.3lf/%.3lf ms",
+                hop->rtt_min, hop->rtt_mean, hop->rtt_max, sqrt(hop->rtt_m2 / num_rtts)
+            );
+        }
+        fprintf(out, "\n");
+    }
+}
+
+//-----------------------------------------------------------------
+// Monitor algorithm
+//-----------------------------------------------------------------
+
+/**
+ * \brief Account the outcome of a probe in the statistics of its hop.
+ * \param hop The statistics of the hop.
+ * \param outcome The outcome of the probe.
+ */
+
+static void monitor_hop_add(monitor_hop_t * hop, const monitor_outcome_t * outcome) {
+    double rtt_ms, delta;
+    size_t num_rtts;
+
+    hop->num_probes++;
+    if (!outcome->has_reply) {
+        hop->num_losses++;
+        return;
+    }
+
+    hop->interface     = outcome->interface;
+    hop->has_interface = true;
+
+    rtt_ms   = outcome->rtt / 1000000.0;
+    delta    = rtt_ms - hop->rtt_mean;
+    num_rtts = hop->num_probes - hop->num_losses;
+    if (num_rtts == 1 || rtt_ms < hop->rtt_min) hop->rtt_min = rtt_ms;
+    if (num_rtts == 1 || rtt_ms > hop->rtt_max) hop->rtt_max = rtt_ms;
+
+    // Welford's algorithm
+    hop->rtt_mean += delta / num_rtts;
+    hop->rtt_m2   += delta * (rtt_ms - hop->rtt_mean);
+}
+
+/**
+ * \brief Send the next train: one probe per hop, stamped out of the
+ *    skeleton. Except the first one, a train is scheduled interval after
+ *    the previous one.
+ * \param loop The main loop
+ * \param data Data attached to this instance of monitor algorithm
+ * \param options Options attached to this instance of monitor algorithm
+ * \return true iif successful
+ */
+
+static bool monitor_send_train(pt_loop_t * loop, monitor_data_t * data, const monitor_options_t * options) {
+    monitor_slot_t      * slot = &data->slots[data->num_sent % MONITOR_MAX_TRAINS];
+    size_t                num_hops = data->num_sent ? data->num_hops : data->max_hops;
+    probe_field_range_t   ttl_range;
+    field_t             * delay;
+    uint64_t              now = get_time_ns(), send_time = now;
+    size_t                i;
+
+    if (!(slot->train = malloc(sizeof(monitor_train_t) + num_hops * sizeof(monitor_outcome_t)))) goto ERR_MALLOC;
+    memset(slot->train->outcomes, 0, num_hops * sizeof(monitor_outcome_t));
+
+    ttl_range.field  = data->ttl_field;
+    ttl_range.first  = options->traceroute_options.min_ttl;
+    ttl_range.step   = 1;
+    ttl_range.period = 1;
+    if (!probe_skel_stamp(data->probe_skel, slot->probes, num_hops, &ttl_range, 1)) goto ERR_PROBE_SKEL_STAMP;
+
+    if (data->num_sent) {
+        send_time = data->schedule_time + (uint64_t) ((data->num_sent - 1) * options->interval * 1000000000);
+        if (send_time < now) send_time = now;
+        if (!(delay = DOUBLE("delay", NS_TO_SECONDS(send_time - now)))) goto ERR_DELAY;
+        for (i = 0; i < num_hops; i++) {
+            probe_set_delay(slot->probes[i], delay);
+        }
+        field_free(delay);
+    }
+
+    slot->train->index    = data->num_sent;
+    slot->train->time     = send_time + data->realtime_offset;
+    slot->train->min_ttl  = options->traceroute_options.min_ttl;
+    slot->train->num_hops = num_hops;
+    slot->num_pending     = num_hops;
+
+    // The probes are released by the network layer once their outcome is known
+    if (!pt_send_probes(loop, slot->probes, num_hops)) goto ERR_PT_SEND_PROBES;
+    data->num_sent++;
+    data->num_probes += num_hops;
+    return true;
+
+ERR_DELAY:
+    for (i = 0; i < num_hops; i++) {
+        probe_free(slot->probes[i]);
+    }
+ERR_PT_SEND_PROBES:
+    memset(slot->probes, 0, num_hops * sizeof(probe_t *));
+ERR_PROBE_SKEL_STAMP:
+    free(slot->train);
+    slot->train = NULL;
+ERR_MALLOC:
+    fprintf(stderr, "Error in monitor_send_train\n");
+    return false;
+}
+
+/**
+ * \brief Fix the hops monitored by the next trains once the first train
+ *    is complete: up to the destination if it has replied, otherwise up
+ *    to the last hop which has replied. The first train is truncated
+ *    accordingly.
+ * \param data Data attached to this instance of monitor algorithm
+ * \param options Options attached to this instance of monitor algorithm
+ * \param train The first train.
+ */
+
+static void monitor_set_path(monitor_data_t * data, const monitor_options_t * options, monitor_train_t * train) {
+    size_t i, num_hops = 0;
+    double delay;
+
+    for (i = 0; i < train->num_hops; i++) {
+        if (!train->outcomes[i].has_reply) continue;
+        num_hops = i + 1;
+        if (address_equals(options->traceroute_options.dst_addr, &train->outcomes[i].interface)) break;
+    }
+    data->num_hops  = num_hops ? num_hops : data->max_hops;
+    train->num_hops = data->num_hops;
+
+    // The second train is sent interval after the first one
+    delay = (double) (get_time_ns() - (train->time - data->realtime_offset)) / 1000000000;
+    data->schedule_time = get_time_ns();
+    if (delay < options->interval) {
+        data->schedule_time += (uint64_t) ((options->interval - delay) * 1000000000);
+    }
+}
+
+/**
+ * \brief Report the complete trains in order, and send the next ones.
+ *    Once count trains are reported, the caller is notified that the
+ *    monitoring is over.
+ * \param loop The main loop
+ * \param data Data attached to this instance of monitor algorithm
+ * \param options Options attached to this instance of monitor algorithm
+ * \return true iif successful
+ */
+
+static bool monitor_report(pt_loop_t * loop, monitor_data_t * data, const monitor_options_t * options) {
+    monitor_slot_t  * slot;
+    monitor_train_t * train;
+    size_t            i;
+
+    while (!data->is_finished && data->num_reported < data->num_sent) {
+        slot = &data->slots[data->num_reported % MONITOR_MAX_TRAINS];
+        if (slot->num_pending) break;
+
+        train = slot->train;
+        slot->train = NULL;
+        if (train->index == 0) monitor_set_path(data, options, train);
+        for (i = 0; i < train->num_hops; i++) {
+            monitor_hop_add(&data->hops[i], &train->outcomes[i]);
+        }
+        pt_raise_event(loop, event_create(MONITOR_TRAIN, train, NULL, free));
+        data->num_reported++;
+
+        if (options->count && data->num_reported == options->count) {
+            data->is_finished = true;
+            pt_raise_terminated(loop);
+        }
+    }
+
+    while (!data->is_finished
+        && data->num_reported
+        && data->num_sent - data->num_reported < data->max_flying
+        && (!options->count || data->num_sent < options->count)
+    ) {
+        if (!monitor_send_train(loop, data, options)) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Record the outcome of a probe in its train.
+ * \param data Data attached to this instance of monitor algorithm
+ * \param options Options attached to this instance of monitor algorithm
+ * \param probe The probe.
+ * \param reply Its reply, NULL if it is lost.
+ */
+
+static void monitor_handle_outcome(monitor_data_t * data, const monitor_options_t * options, const probe_t * probe, const probe_t * reply) {
+    monitor_slot_t    * slot;
+    monitor_outcome_t * outcome;
+    uintmax_t           ttl;
+    size_t              hop, k;
+    int64_t             rtt;
+
+    if (!probe_extract_resolved_field(probe, &data->ttl_field, &ttl)) return;
+    if (ttl < options->traceroute_options.min_ttl) return;
+    hop = ttl - options->traceroute_options.min_ttl;
+
+    // The network layer notifies the outcome of the probe it has been passed
+    for (k = data->num_reported; k < data->num_sent; k++) {
+        slot = &data->slots[k % MONITOR_MAX_TRAINS];
+        if (hop >= slot->train->num_hops || slot->probes[hop] != probe) continue;
+
+        slot->probes[hop] = NULL;
+        slot->num_pending--;
+        if (reply) {
+            outcome = &slot->train->outcomes[hop];
+            if (!probe_extract(reply, "src_ip", &outcome->interface)) return;
+            rtt = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+            outcome->rtt       = rtt > 0 ? rtt : 0;
+            outcome->has_reply = true;
+        }
+        return;
+    }
+}
+
+/**
+ * \brief Handle events to a monitor algorithm instance
+ * \param loop The main loop
+ * \param event The raised event
+ * \param pdata Points to a (void *) address that may be altered by monitor_loop_handler in order
+ *   to manage data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet
+ * \param opts Points to the option related to this instance (== loop->cur_instance->options)
+ */
+
+int monitor_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
+{
+    monitor_data_t    * data = NULL;     // Current state of the algorithm instance
+    monitor_options_t * options = opts;  // Options passed to this instance
+    probe_reply_t     * probe_reply;
+
+    switch (event->type) {
+
+        case ALGORITHM_INIT:
+            // Check options
+            if (!options
+            ||  options->traceroute_options.min_ttl > options->traceroute_options.max_ttl
+            ||  options->interval <= 0
+            ) {
+                fprintf(stderr, "Invalid monitor options\n");
+                errno = EINVAL;
+                goto FAILURE;
+            }
+
+            // Allocate structure storing current state information and update *pdata
+            if (!(data = monitor_data_create(probe_skel, options))) {
+                goto FAILURE;
+            }
+            *pdata = data;
+
+            // The first train probes every TTL
+            if (!monitor_send_train(loop, data, options)) goto FAILURE;
+            return 0;
+
+        case PROBE_REPLY:
+            data = *pdata;
+            if (data->is_finished) return 0;
+            probe_reply = event->data;
+            monitor_handle_outcome(data, options, probe_reply->probe, probe_reply->reply);
+            break;
+
+        case PROBE_TIMEOUT:
+            data = *pdata;
+            if (data->is_finished) return 0;
+            monitor_handle_outcome(data, options, event->data, NULL);
+            break;
+
+        case ALGORITHM_TERM:
+            // Interrupted: the trains in flight are given up, and the
+            // caller reads the statistics, then frees monitor's data
+            data = *pdata;
+            if (data && !data->is_finished) {
+                data->is_finished = true;
+                pt_raise_terminated(loop);
+            }
+            return 0;
+
+        case ALGORITHM_ERROR:
+            goto FAILURE;
+
+        case PROBE_REPLY_DUPLICATE:
+        case PROBE_REPLY_LATE:
+            // Its probe has already been accounted for
+            return 0;
+
+        case NETWORK_READY:
+            // This algorithm does not wait for credits
+            return 0;
+
+        default:
+            return 0;
+    }
+
+    if (!monitor_report(loop, data, options)) goto FAILURE;
+
+    // The handled event is released by the algorithm layer when leaving the handler
+    return 0;
+
+FAILURE:
+    // Sent to the current instance a ALGORITHM_FAILURE notification.
+    // The caller has to free the data allocated by the algorithm.
+    pt_raise_error(loop);
+    return EINVAL;
+}
+
+static algorithm_t monitor = {
+    .name    = "monitor",
+    .handler = monitor_loop_handler,
+    .options = (const option_t *) &monitor_options
+};
+
+ALGORITHM_REGISTER(monitor);
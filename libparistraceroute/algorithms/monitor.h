@@ -0,0 +1,245 @@
+#ifndef ALGORITHMS_MONITOR_H
+#define ALGORITHMS_MONITOR_H
+
+#include <limits.h>      // INT_MAX
+#include <stdbool.h>     // bool
+#include <stdint.h>      // uint*_t
+#include <stddef.h>      // size_t
+#include <stdio.h>       // FILE
+
+#include "traceroute.h"  // traceroute_options_t
+#include "../address.h"  // address_t
+#include "../pt_loop.h"  // pt_loop_t
+#include "../event.h"    // event_t
+#include "../options.h"  // option_t
+#include "../output.h"   // output_t
+#include "../probe.h"    // probe_t, probe_field_t
+
+#define OPTIONS_MONITOR_INTERVAL_DEFAULT 1.0
+#define OPTIONS_MONITOR_COUNT_DEFAULT    0
+
+//                                def                               min   max      enabled
+#define OPTIONS_MONITOR_INTERVAL {OPTIONS_MONITOR_INTERVAL_DEFAULT, 0.01, 86400,   0}
+#define OPTIONS_MONITOR_COUNT    {OPTIONS_MONITOR_COUNT_DEFAULT,    0,    INT_MAX, 0}
+
+// Maximum number of trains in flight at once
+#define MONITOR_MAX_TRAINS 64
+
+#define MONITOR_HELP_train_interval "Set the time between two trains of probes when using -a monitor (in seconds, default: 1)."
+#define MONITOR_HELP_trains         "Stop after NUM trains of probes when using -a monitor (default: 0, i.e. until interrupted)."
+
+/*
+ * Principle: per-hop latency monitoring with trains of probes
+ *
+ * Monitoring the latency toward each hop of a path with a ping per hop
+ * costs one pinger per hop, and the flow of the echo requests differs from
+ * the flow of the traceroute which has revealed the path, so that behind
+ * a load balancer they may monitor other routers.
+ *
+ * Instead, every interval, a single train of probes is sent toward the
+ * destination: one probe per TTL, from min_ttl to the last hop of the
+ * path. The probes are stamped out of the skeleton, and only differ by
+ * their TTL: they share the flow identifier of a Paris traceroute, and
+ * thus follow the same path.
+ *
+ * The first train covers every TTL up to max_ttl. Once its outcomes are
+ * known, the last hop of the path is the destination (if it has replied),
+ * or the last hop which has replied, and the next trains stop there. The
+ * next trains are scheduled (see probe_set_delay) interval after each
+ * other, enough of them being in flight to cover the timeout of the
+ * probes, so that a silent hop does not delay the trains.
+ *
+ * The outcome of each probe feeds the statistics of its hop (losses, RTT
+ * min/mean/max/mdev, computed on the fly), and each train is reported to
+ * the caller once every outcome of this train and of the previous trains
+ * is known.
+ */
+
+//--------------------------------------------------------------------
+// Options
+//--------------------------------------------------------------------
+
+typedef struct {
+    traceroute_options_t traceroute_options; /**< Must be the first member. A train probes each TTL from min_ttl once */
+    double               interval;           /**< Time between two trains (in seconds) */
+    size_t               count;              /**< Number of trains, 0 to monitor until the instance is interrupted */
+} monitor_options_t;
+
+double   options_monitor_get_interval();
+size_t   options_monitor_get_count();
+unsigned options_monitor_get_is_set();
+
+const option_t * monitor_get_options();
+
+/**
+ * \brief Retrieve the default options of monitor.
+ * \return The corresponding monitor_options_t structure.
+ */
+
+monitor_options_t monitor_get_default_options();
+
+/**
+ * \brief Initialize the monitor options structure according to the
+ *    command line (see monitor_get_options). The traceroute options must
+ *    be set by options_traceroute_init.
+ * \param monitor_options The corresponding monitor_options_t structure.
+ */
+
+void options_monitor_init(monitor_options_t * monitor_options);
+
+//--------------------------------------------------------------------
+// Custom-events raised by monitor algorithm
+//--------------------------------------------------------------------
+
+typedef enum {
+    // event_type                 | data (type)       | data (meaning)
+    // ---------------------------+-------------------+--------------------------------------------
+    MONITOR_TRAIN,             // | monitor_train_t * | The outcomes of a train
+} monitor_event_type_t;
+
+typedef struct {
+    monitor_event_type_t type;
+    void               * data;
+    void              (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
+    void               * zero;
+} monitor_event_t;
+
+/**
+ * \struct monitor_outcome_t
+ * \brief The outcome of a probe of a train.
+ */
+
+typedef struct {
+    address_t interface;   /**< Interface which has replied (if has_reply) */
+    uint64_t  rtt;         /**< Round-trip time (in nanoseconds, if has_reply) */
+    bool      has_reply;   /**< False iif the probe is lost */
+} monitor_outcome_t;
+
+/**
+ * \struct monitor_train_t
+ * \brief The outcomes of a train.
+ */
+
+typedef struct {
+    size_t            index;       /**< Rank of this train (0 for the first one) */
+    uint64_t          time;        /**< When the train has been sent (nanoseconds since the Epoch) */
+    uint8_t           min_ttl;     /**< TTL of the first probe */
+    size_t            num_hops;    /**< Number of probes of the train */
+    monitor_outcome_t outcomes[];  /**< The outcome of each probe, by TTL */
+} monitor_train_t;
+
+//--------------------------------------------------------------------
+// Data
+//--------------------------------------------------------------------
+
+/**
+ * \struct monitor_hop_t
+ * \brief The statistics of a hop, updated by each train.
+ */
+
+typedef struct {
+    address_t interface;     /**< Last interface which has replied (if has_interface) */
+    bool      has_interface; /**< True iif interface is set */
+    size_t    num_probes;    /**< Number of probes replied or lost */
+    size_t    num_losses;    /**< Number of probes lost */
+    double    rtt_min;       /**< Smallest RTT (in milliseconds) */
+    double    rtt_max;       /**< Greatest RTT (in milliseconds) */
+    double    rtt_mean;      /**< Mean of the RTTs (in milliseconds) */
+    double    rtt_m2;        /**< Sum of the squared differences between the RTTs and rtt_mean (Welford's algorithm) */
+} monitor_hop_t;
+
+/**
+ * \struct monitor_slot_t
+ * \brief A train in flight.
+ */
+
+typedef struct {
+    monitor_train_t  * train;       /**< The outcomes of this train */
+    probe_t         ** probes;      /**< The probes waiting for their outcome, by TTL (NULL once known) */
+    size_t             num_pending; /**< Number of probes waiting for their outcome */
+} monitor_slot_t;
+
+typedef struct {
+    probe_t        * probe_skel;                 /**< The skeleton of the probes, finalized */
+    probe_field_t    ttl_field;                  /**< The "ttl" field of probe_skel */
+    monitor_hop_t  * hops;                       /**< The statistics of each hop, from min_ttl */
+    size_t           max_hops;                   /**< Number of hops probed by the first train */
+    size_t           num_hops;                   /**< Number of hops probed by the next trains (0 until the first train is complete) */
+    monitor_slot_t   slots[MONITOR_MAX_TRAINS];  /**< The trains in flight, by rank modulo MONITOR_MAX_TRAINS */
+    size_t           num_sent;                   /**< Number of trains sent (== rank of the next train) */
+    size_t           num_reported;               /**< Number of trains reported (== rank of the next train to report) */
+    size_t           max_flying;                 /**< Number of trains in flight once the first train is complete */
+    uint64_t         schedule_time;              /**< When the second train is sent (see get_time_ns), the next ones follow every interval */
+    int64_t          realtime_offset;            /**< See get_realtime_offset_ns */
+    size_t           num_probes;                 /**< Number of probes passed to the network layer so far */
+    bool             is_finished;                /**< True iif no more train has to be sent */
+} monitor_data_t;
+
+/**
+ * \brief Release a monitor_data_t structure from the memory.
+ * \param data A pointer to the monitor_data_t instance.
+ */
+
+void monitor_data_free(monitor_data_t * data);
+
+//--------------------------------------------------------------------
+// Output
+//--------------------------------------------------------------------
+
+/**
+ * \brief Print a monitor_event_t event in a given stream.
+ * \param out The output stream.
+ * \param monitor_event The printed event.
+ * \param monitor_options Options related to this instance of monitor.
+ */
+
+void monitor_event_fdump(
+    FILE                    * out,
+    const monitor_event_t   * monitor_event,
+    const monitor_options_t * monitor_options
+);
+
+/**
+ * \brief Write a monitor_event_t event in the structured output: a
+ *    REPLY or a STAR record per probe of a train, timed by the train.
+ * \param output The output_t instance.
+ * \param monitor_event The written event.
+ * \param monitor_options Options related to this instance of monitor.
+ * \return true iif successful.
+ */
+
+bool monitor_event_output(
+    output_t                * output,
+    const monitor_event_t   * monitor_event,
+    const monitor_options_t * monitor_options
+);
+
+/**
+ * \brief Print the statistics of each hop in a given stream.
+ * \param out The output stream.
+ * \param data The data of the monitor instance.
+ * \param monitor_options Options related to this instance of monitor.
+ */
+
+void monitor_statistics_fdump(
+    FILE                    * out,
+    const monitor_data_t    * data,
+    const monitor_options_t * monitor_options
+);
+
+/**
+ * \brief Handle events to a monitor algorithm instance. Once it has
+ *    reported every train, or once it is interrupted, the instance
+ *    notifies the caller, which may read its data (see
+ *    monitor_statistics_fdump) and then has to free it (see
+ *    monitor_data_free).
+ * \param loop The main loop.
+ * \param event The raised event.
+ * \param pdata Points to the data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packets.
+ * \param opts Points to the monitor_options_t of this instance.
+ */
+
+int monitor_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts);
+
+#endif // ALGORITHMS_MONITOR_H
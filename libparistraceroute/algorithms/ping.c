@@ -5,15 +5,18 @@
 #include <stdio.h>            // fprintf
 #include <string.h>           // memset()
 #include <math.h>             // abs(), ceil()
-#include <netinet/ip_icmp.h>  // icmpv4 constants
-#include <netinet/icmp6.h>    // icmpv6 constants
 
 #include "../probe.h"
 #include "../event.h"
 #include "../algorithm.h"
 #include "../address.h"       // address_resolv
-#include "../common.h"        // get_timestamp
+#include "../common.h"        // get_timestamp, get_time_ns
 #include "../network.h"       // options_network_get_timeout
+#include "../metrics.h"       // metrics_write_*
+#include "../results.h"       // results_add_stats
+
+// Maximum number of probes stamped and sent at once (see send_ping_probes)
+#define PING_BATCH_SIZE 16
 
 //-----------------------------------------------------------------
 // Ping options
@@ -22,16 +25,18 @@
 // Bounded integer parameters
 static bool         do_resolv      = OPTIONS_PING_DO_RESOLV_DEFAULT;
 static bool         show_timestamp = OPTIONS_PING_SHOW_TIMESTAMP_DEFAULT;
+static bool         show_percentiles = OPTIONS_PING_SHOW_PERCENTILES_DEFAULT;
 static bool         is_quiet       = OPTIONS_PING_IS_QUIET_DEFAULT;
 static unsigned int count[3]       = OPTIONS_PING_COUNT;
 
 static option_t ping_options[] = {
-    // action       short long       metavar         help         data
-    {opt_store_int, "c",  OPT_NO_LF, " COUNT",       PING_HELP_c, &count},
-    {opt_store_1,   "D",  OPT_NO_LF, OPT_NO_METAVAR, PING_HELP_D, &show_timestamp},
-    {opt_store_0,   "n",  OPT_NO_LF, OPT_NO_METAVAR, PING_HELP_n, &do_resolv},
-    {opt_store_1,   "q",  OPT_NO_LF, OPT_NO_METAVAR, PING_HELP_q, &is_quiet},
-    {opt_help,      "v",  OPT_NO_LF, OPT_NO_METAVAR, OPT_NO_HELP, OPT_NO_DATA},
+    // action       short      long             metavar         help                   data
+    {opt_store_int, "c",       OPT_NO_LF,       " COUNT",       PING_HELP_c,           &count},
+    {opt_store_1,   "D",       OPT_NO_LF,       OPT_NO_METAVAR, PING_HELP_D,           &show_timestamp},
+    {opt_store_0,   "n",       OPT_NO_LF,       OPT_NO_METAVAR, PING_HELP_n,           &do_resolv},
+    {opt_store_1,   "q",       OPT_NO_LF,       OPT_NO_METAVAR, PING_HELP_q,           &is_quiet},
+    {opt_help,      "v",       OPT_NO_LF,       OPT_NO_METAVAR, OPT_NO_HELP,           OPT_NO_DATA},
+    {opt_store_1,   OPT_NO_SF, "--percentiles", OPT_NO_METAVAR, PING_HELP_percentiles, &show_percentiles},
     END_OPT_SPECS
 };
 
@@ -43,6 +48,10 @@ bool options_ping_get_show_timestamp() {
     return show_timestamp;
 }
 
+bool options_ping_get_show_percentiles() {
+    return show_percentiles;
+}
+
 bool options_ping_get_is_quiet() {
     return is_quiet;
 }
@@ -64,7 +73,9 @@ void options_ping_init(
     ping_options->count          = options_ping_get_count();
     ping_options->dst_addr       = address;
     ping_options->interval       = interval;
+    ping_options->offset         = 0;
     ping_options->show_timestamp = options_ping_get_show_timestamp();
+    ping_options->show_percentiles = options_ping_get_show_percentiles();
     ping_options->is_quiet       = options_ping_get_is_quiet();
     ping_options->do_resolv      = options_ping_get_do_resolv();
     ping_options->max_ttl        = max_ttl;
@@ -75,101 +86,40 @@ inline ping_options_t ping_get_default_options() {
         .dst_addr       = NULL,
         .do_resolv      = OPTIONS_PING_DO_RESOLV_DEFAULT,
         .interval       = OPTIONS_PING_INTERVAL_DEFAULT,
+        .offset         = 0,
         .count          = OPTIONS_PING_COUNT_DEFAULT,
         .show_timestamp = OPTIONS_PING_SHOW_TIMESTAMP_DEFAULT,
+        .show_percentiles = OPTIONS_PING_SHOW_PERCENTILES_DEFAULT,
         .is_quiet       = OPTIONS_PING_IS_QUIET_DEFAULT,
     };
     return ping_options;
 };
 
 //--------------------------------------------------------------------------------------
-// statistics computing    NOTE: these functions probably have to be put in another file
+// statistics computing
 //--------------------------------------------------------------------------------------
 
-
 /**
- * \brief compute the minimum of the values contained in array
- * \param array the array containing values of type double
- * \return the computed minimum
+ * \brief Account a measured RTT in the statistics of a ping instance.
+ * \param ping_data The data of the ping instance.
+ * \param rtt The RTT (in nanoseconds).
  */
 
-static double compute_minimum(dynarray_t * array) {
-    size_t   array_length = dynarray_get_size(array);
-    double   current_min  = 0;
-    unsigned i;
-
-    if (array_length != 0) {
-        current_min = *((double*) dynarray_get_ith_element(array, 0));
-        for (i = 1; i < array_length; i++) {
-            if (*((double *) dynarray_get_ith_element(array, i)) < current_min) {
-                current_min = *((double *) dynarray_get_ith_element(array, i));
-            }
-        }
-    }
-    return current_min;
-}
+static void ping_data_add_rtt(ping_data_t * ping_data, uint64_t rtt) {
+    double rtt_ms = rtt / 1000000.0,
+           delta  = rtt_ms - ping_data->rtt_mean;
 
-/**
- * \brief compute the maximum of the values contained in array
- * \param array the array containing values of type double
- * \return the computed maximum
- */
+    if (!ping_data->num_rtts || rtt_ms < ping_data->rtt_min) ping_data->rtt_min = rtt_ms;
+    if (!ping_data->num_rtts || rtt_ms > ping_data->rtt_max) ping_data->rtt_max = rtt_ms;
 
-static double compute_maximum(dynarray_t * array) {
-    size_t   array_length = dynarray_get_size(array);
-    double   current_max  = 0;
-    unsigned i;
+    // Welford's algorithm
+    ping_data->num_rtts++;
+    ping_data->rtt_mean += delta / ping_data->num_rtts;
+    ping_data->rtt_m2   += delta * (rtt_ms - ping_data->rtt_mean);
 
-    if (array_length != 0) {
-        current_max = *((double*) dynarray_get_ith_element(array, 0));
-        for (i = 1; i < array_length; i++) {
-            if (*((double *) dynarray_get_ith_element(array, i)) > current_max) {
-                current_max = *((double *) dynarray_get_ith_element(array, i));
-            }
-        }
+    if (ping_data->rtt_histogram) {
+        histogram_add(ping_data->rtt_histogram, rtt);
     }
-    return current_max;
-}
-
-/**
- * \brief compute the mean of the values contained in array
- * \param array the array containing values of type double
- * \return the computed mean
- */
-
-static double compute_mean(dynarray_t * array) {
-    size_t   array_length = dynarray_get_size(array);
-    double   sum          = 0;
-    unsigned i;
-
-    if (array_length != 0) {
-        for (i = 0; i < array_length; i++) {
-            sum += *((double *) dynarray_get_ith_element(array, i));
-        }
-        sum /= array_length;
-    }
-    return sum;
-}
-
-/**
- * \brief compute the mean deviation of the values contained in array
- * \param array the array containing values of type double
- * \return the computed mean deviation
- */
-
-static double compute_mean_deviation(dynarray_t * array) {
-    size_t   array_length = dynarray_get_size(array);
-    double   sum          = 0;
-    double   mean         = compute_mean(array);
-    unsigned i;
-
-    if (array_length != 0) {
-        for (i = 0; i < array_length; i++) {
-            sum += fabs(*((double *) dynarray_get_ith_element(array, i)) - mean);
-        }
-        sum /= array_length;
-    }
-    return sum;
 }
 
 /**
@@ -178,16 +128,13 @@ static double compute_mean_deviation(dynarray_t * array) {
  */
 
 void ping_dump_statistics(ping_data_t * ping_data) {
-    double max, min, avg, mdev;
+    double mdev;
 
-    if (ping_data == NULL || ping_data->rtt_results == NULL) {
+    if (ping_data == NULL) {
         fprintf(stderr, "An error occured while computing statistics...\n");
     } else {
         printf("---Ping statistics---\n");
-        max  = compute_maximum(ping_data->rtt_results);
-        min  = compute_minimum(ping_data->rtt_results);
-        avg  = compute_mean(ping_data->rtt_results);
-        mdev = compute_mean_deviation(ping_data->rtt_results);
+        mdev = ping_data->num_rtts ? sqrt(ping_data->rtt_m2 / ping_data->num_rtts) : 0;
 
         printf("%zu packets transmitted, %zu received, %u%% packet loss, time %zums\n",
             ping_data->num_replies,
@@ -196,204 +143,141 @@ void ping_dump_statistics(ping_data_t * ping_data) {
             (size_t) (1000 * (ping_data->last_time - ping_data->start_time))
         );
 
-        printf("rtt max/min/avg/mdev = %.3lf/%.3lf/%.3lf/%.3lf ms\n", max, min, avg, mdev);
-    }
-}
-
-//-------------------------------------------------------------
-// ICMP error analysing    NOTE: these functions probably have to be put in another file
-//-------------------------------------------------------------
-
-/**
- * \brief check whether the algorithm has encountered a "network unreachable" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
- */
-
-static bool destination_network_unreachable(const probe_t * reply) {
-    bool    ret = false;
-    uint8_t code, type, version;
-
-    if (probe_extract(reply, "version", &version)
-     && probe_extract(reply, "code",    &code)
-     && probe_extract(reply, "type",    &type)
-    ) {
-        switch (version){
-            case 4:
-                ret = (type == ICMP_UNREACH && code == ICMP_UNREACH_HOST);
-                break;
-            case 6:
-                ret = (type == ICMP6_DST_UNREACH && code == ICMP6_DST_UNREACH_ADDR);
-                break;
-            default:
-                fprintf(stderr, "destination_network_unreachable: invalid version = %d\n", version);
-                break;
-        }
-    }
-    return ret;
-}
-
-/**
- * \brief check whether the algorithm has encountered a "host unreachable" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
- */
+        printf("rtt max/min/avg/mdev = %.3lf/%.3lf/%.3lf/%.3lf ms\n",
+            ping_data->rtt_max, ping_data->rtt_min, ping_data->rtt_mean, mdev
+        );
 
-static bool destination_host_unreachable(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
-
-    if (probe_extract(reply, "version", &version)
-     && probe_extract(reply, "code",    &code)
-     && probe_extract(reply, "type",    &type)
-    ) {
-        if (version == 4) {
-            return (type == ICMP_UNREACH) && (code == ICMP_UNREACH_NET);
-        } else {
-            return (type == ICMP6_DST_UNREACH) && (code == ICMP6_DST_UNREACH_NOROUTE);
+        if (ping_data->rtt_histogram) {
+            printf("rtt p50/p90/p99 = %.3lf/%.3lf/%.3lf ms\n",
+                histogram_get_quantile(ping_data->rtt_histogram, 0.50) / 1000000.0,
+                histogram_get_quantile(ping_data->rtt_histogram, 0.90) / 1000000.0,
+                histogram_get_quantile(ping_data->rtt_histogram, 0.99) / 1000000.0
+            );
         }
     }
-    return false;
 }
 
 /**
- * \brief check whether the algorithm has encountered a "network unreachable" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
+ * \brief Write the samples of a metric family for every ping instance.
+ * \param file The output stream.
+ * \param name The name of the samples.
+ * \param targets The name of the target of each instance.
+ * \param ping_datas The data of each instance (NULL if terminated).
+ * \param num_targets The number of instances.
+ * \param get_value Returns the value of the sample of an instance, a
+ *    negative value if it has no such sample.
  */
 
-static bool destination_port_unreachable(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
-
-    if (probe_extract(reply, "version", &version) && probe_extract(reply, "code", &code)
-        && probe_extract(reply, "type", &type)) {
+static void ping_write_samples(
+    FILE                     * file,
+    const char               * name,
+    const char * const       * targets,
+    ping_data_t * const      * ping_datas,
+    size_t                     num_targets,
+    double                  (* get_value)(const ping_data_t *)
+) {
+    double value;
+    size_t i;
 
-        if (version == 4) {
-            return (type == ICMP_UNREACH) && (code == ICMP_UNREACH_PORT);
-        } else {
-            return (type == ICMP6_DST_UNREACH) && (code == ICMP6_DST_UNREACH_NOPORT);
-        }
+    for (i = 0; i < num_targets; i++) {
+        if (!ping_datas[i] || (value = get_value(ping_datas[i])) < 0) continue;
+        fprintf(file, "%s{target=\"", name);
+        metrics_write_label_value(file, targets[i]);
+        fprintf(file, "\"} %.9g\n", value);
     }
-    return false;
 }
 
-/**
- * \brief check whether the algorithm has encountered a "protocol unreachable" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
- */
-
-static bool destination_protocol_unreachable(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
-
-    if (probe_extract(reply, "version", &version) && probe_extract(reply, "code", &code)
-        && probe_extract(reply, "type", &type)) {
-
-        if (version == 4) {
-            return (type == ICMP_UNREACH) && (code == ICMP_UNREACH_PROTOCOL);
-        } else {
-            return (type == ICMP6_PARAM_PROB) && (code == ICMP6_PARAMPROB_NEXTHEADER);
-        }
-    }
-    return false;
+static double ping_get_num_sent(const ping_data_t * ping_data) {
+    return ping_data->num_sent;
 }
 
-/**
- * \brief check whether the algorithm has encountered a "ttl exceeded" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
- */
-
-static bool ttl_exceeded(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
-
-    if (probe_extract(reply, "version", &version) && probe_extract(reply, "code", &code)
-        && probe_extract(reply, "type", &type)) {
-
-        if (version == 4) {
-            return (type == ICMP_TIMXCEED) && (code == ICMP_TIMXCEED_INTRANS);
-        } else {
-            return (type == ICMP6_TIME_EXCEEDED) && (code == ICMP6_TIME_EXCEED_TRANSIT);
-        }
-    }
-    return false;
+static double ping_get_num_received(const ping_data_t * ping_data) {
+    return ping_data->num_replies - ping_data->num_losses;
 }
 
-/**
- * \brief check whether the algorithm has encountered a "fragment reassembly time exceeded" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
- */
-
-static bool fragment_reassembly_time_exceeded(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
+static double ping_get_num_losses(const ping_data_t * ping_data) {
+    return ping_data->num_losses;
+}
 
-    if (probe_extract(reply, "version", &version) && probe_extract(reply, "code", &code)
-        && probe_extract(reply, "type", &type)) {
+static double ping_get_num_probes_in_flight(const ping_data_t * ping_data) {
+    return ping_data->num_probes_in_flight;
+}
 
-        if (version == 4) {
-            return (type == ICMP_TIMXCEED) && (code == ICMP_TIMXCEED_REASS);
-        } else {
-            return (type == ICMP6_TIME_EXCEEDED) && (code == ICMP6_TIME_EXCEED_REASSEMBLY);
-        }
-    }
-    return false;
+static double ping_get_rtt_min(const ping_data_t * ping_data) {
+    return ping_data->num_rtts ? ping_data->rtt_min / 1000 : -1;
 }
 
-/**
- * \brief check whether the algorithm has encountered a "redirect" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
- */
+static double ping_get_rtt_mean(const ping_data_t * ping_data) {
+    return ping_data->num_rtts ? ping_data->rtt_mean / 1000 : -1;
+}
 
-static bool redirect(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
+static double ping_get_rtt_max(const ping_data_t * ping_data) {
+    return ping_data->num_rtts ? ping_data->rtt_max / 1000 : -1;
+}
 
-    if (probe_extract(reply, "version", &version) && probe_extract(reply, "code", &code)
-        && probe_extract(reply, "type", &type)) {
+static double ping_get_rtt_mdev(const ping_data_t * ping_data) {
+    return ping_data->num_rtts ? sqrt(ping_data->rtt_m2 / ping_data->num_rtts) / 1000 : -1;
+}
 
-        if (version == 4) {
-            return (type == ICMP_REDIRECT) && (code == ICMP_REDIRECT_NET);
-        } else {
-            return (type == ND_REDIRECT);
+void ping_write_metrics(FILE * file, const char * const * targets, ping_data_t * const * ping_datas, size_t num_targets)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    size_t              i, j;
+
+    metrics_write_family(file, "paristraceroute_ping_probes_sent", "counter", "Echo requests sent");
+    ping_write_samples(file, "paristraceroute_ping_probes_sent_total", targets, ping_datas, num_targets, ping_get_num_sent);
+    metrics_write_family(file, "paristraceroute_ping_replies", "counter", "Replies received");
+    ping_write_samples(file, "paristraceroute_ping_replies_total", targets, ping_datas, num_targets, ping_get_num_received);
+    metrics_write_family(file, "paristraceroute_ping_losses", "counter", "Probes lost");
+    ping_write_samples(file, "paristraceroute_ping_losses_total", targets, ping_datas, num_targets, ping_get_num_losses);
+    metrics_write_family(file, "paristraceroute_ping_probes_in_flight", "gauge", "Probes waiting for their reply");
+    ping_write_samples(file, "paristraceroute_ping_probes_in_flight", targets, ping_datas, num_targets, ping_get_num_probes_in_flight);
+    metrics_write_family(file, "paristraceroute_ping_rtt_min_seconds", "gauge", "Smallest RTT");
+    ping_write_samples(file, "paristraceroute_ping_rtt_min_seconds", targets, ping_datas, num_targets, ping_get_rtt_min);
+    metrics_write_family(file, "paristraceroute_ping_rtt_mean_seconds", "gauge", "Mean RTT");
+    ping_write_samples(file, "paristraceroute_ping_rtt_mean_seconds", targets, ping_datas, num_targets, ping_get_rtt_mean);
+    metrics_write_family(file, "paristraceroute_ping_rtt_max_seconds", "gauge", "Greatest RTT");
+    ping_write_samples(file, "paristraceroute_ping_rtt_max_seconds", targets, ping_datas, num_targets, ping_get_rtt_max);
+    metrics_write_family(file, "paristraceroute_ping_rtt_mdev_seconds", "gauge", "Standard deviation of the RTTs");
+    ping_write_samples(file, "paristraceroute_ping_rtt_mdev_seconds", targets, ping_datas, num_targets, ping_get_rtt_mdev);
+
+    // The percentiles are only available with --percentiles
+    metrics_write_family(file, "paristraceroute_ping_rtt_seconds", "summary", "Distribution of the RTTs");
+    for (i = 0; i < num_targets; i++) {
+        if (!ping_datas[i] || !ping_datas[i]->rtt_histogram) continue;
+        for (j = 0; j < sizeof(quantiles) / sizeof(double); j++) {
+            fprintf(file, "paristraceroute_ping_rtt_seconds{target=\"");
+            metrics_write_label_value(file, targets[i]);
+            fprintf(file, "\",quantile=\"%g\"} %.9f\n", quantiles[j], histogram_get_quantile(ping_datas[i]->rtt_histogram, quantiles[j]) / 1e9);
         }
+        fprintf(file, "paristraceroute_ping_rtt_seconds_count{target=\"");
+        metrics_write_label_value(file, targets[i]);
+        fprintf(file, "\"} %zu\n", ping_datas[i]->num_rtts);
     }
-    return false;
 }
 
+//-------------------------------------------------------------
+// ICMP error analysing (see reply_class.h)
+//-------------------------------------------------------------
+
 /**
- * \brief check whether the algorithm has encountered a "parameter" problem
- * \param reply the probe to analyse
- * \return true if this error has occured, false otherwise
+ * \brief Retrieve the ping event related to an ICMP error.
+ * \param reply The reply, which does not come from the destination.
+ * \return The corresponding ping event type.
  */
 
-static bool parameter_problem(const probe_t *reply) {
-    uint8_t version = 0,
-            code    = 0,
-            type    = 0;
-
-   if (probe_extract(reply, "version", &version) && probe_extract(reply, "code", &code)
-       && probe_extract(reply, "type", &type)) {
-
-        if (version == 4) {
-            return (type == ICMP_PARAMPROB);
-        } else {
-            return (type == ICMP6_PARAM_PROB ) && ((code == ICMP6_PARAMPROB_HEADER)
-                || (code == ICMP6_PARAMPROB_OPTION));
-        }
+static ping_event_type_t ping_get_error_type(const probe_t * reply) {
+    switch (probe_get_reply_class(reply)) {
+        case REPLY_CLASS_NET_UNREACHABLE:          return PING_DST_NET_UNREACHABLE;
+        case REPLY_CLASS_HOST_UNREACHABLE:         return PING_DST_HOST_UNREACHABLE;
+        case REPLY_CLASS_PROTOCOL_UNREACHABLE:     return PING_DST_PROT_UNREACHABLE;
+        case REPLY_CLASS_PORT_UNREACHABLE:         return PING_DST_PORT_UNREACHABLE;
+        case REPLY_CLASS_TTL_EXCEEDED:             return PING_TTL_EXCEEDED_TRANSIT;
+        case REPLY_CLASS_REASSEMBLY_TIME_EXCEEDED: return PING_TIME_EXCEEDED_REASSEMBLY;
+        case REPLY_CLASS_REDIRECT:                 return PING_REDIRECT;
+        case REPLY_CLASS_PARAMETER_PROBLEM:        return PING_PARAMETER_PROBLEM;
+        default:                                   return PING_GEN_ERROR;
     }
-    return false;
 }
 
 /**
@@ -407,64 +291,32 @@ static inline bool destination_reached(const address_t * dst_addr, const probe_t
     address_t   discovered_addr;
 
     if (probe_extract(reply, "src_ip", &discovered_addr)) {
-        ret = (address_compare(dst_addr, &discovered_addr) == 0);
+        ret = address_equals(dst_addr, &discovered_addr);
     }
     return ret;
 }
 
-//-----------------------------------------------------------------
-// Operations on double     // NOTE: these functions probably have to be put in another file
-// These functions are needed to store and free the rtt results correctly
-//-----------------------------------------------------------------
-
-/**
- * \brief free a pointer to a double
- * \param double_to_delete  pointer to the location in memory to free
- */
-
-static void double_free(double * double_to_delete) {
-    if (!double_to_delete) {
-        free(double_to_delete);
-    }
-}
-
-/**
- * \brief duplicate a pointer to a double
- * \param double_to_duplicate the pointer to duplicated
- * \return a pointer to the copied double
- */
-
-static double * double_dup(double * double_to_duplicate) {
-    double * new_double = NULL;
-
-    if (double_to_duplicate == NULL) {
-        return new_double;
-    }
-    if (!(new_double = (double *) malloc(sizeof(double)))) {
-        return new_double;
-    }
-    *new_double = *double_to_duplicate;
-    return new_double;
-}
-
 //-----------------------------------------------------------------
 // Ping algorithm's data
 //-----------------------------------------------------------------
 
 /**
  * \brief Allocate a ping_data_t instance
+ * \param options The options of the ping instance.
  * \return The newly allocated ping_data_t instance,
  *    NULL in case of failure
  */
 
-static ping_data_t * ping_data_create() {
+static ping_data_t * ping_data_create(const ping_options_t * options) {
     ping_data_t * ping_data;
 
-    if (!(ping_data = calloc(1, sizeof(ping_data_t))))    goto ERR_MALLOC;
-    if (!(ping_data->rtt_results = dynarray_create()))    goto ERR_RTT_RESULTS;
+    if (!(ping_data = calloc(1, sizeof(ping_data_t)))) goto ERR_MALLOC;
+    if (options->show_percentiles) {
+        if (!(ping_data->rtt_histogram = histogram_create())) goto ERR_RTT_HISTOGRAM;
+    }
     return ping_data;
 
-ERR_RTT_RESULTS:
+ERR_RTT_HISTOGRAM:
     free(ping_data);
 ERR_MALLOC:
     return NULL;
@@ -485,16 +337,12 @@ static ping_data_t * ping_data_dup(ping_data_t * ping_data) {
     if (!(new_ping_data = (ping_data_t *)malloc(sizeof(ping_data_t)))) {
         return new_ping_data;
     }
-    if (!(new_ping_data->rtt_results = dynarray_dup(ping_data->rtt_results,
-        (void * (*)(void *)) double_dup))) {
+    *new_ping_data = *ping_data;
+    if (ping_data->rtt_histogram
+    && !(new_ping_data->rtt_histogram = histogram_dup(ping_data->rtt_histogram))) {
+        free(new_ping_data);
         return NULL;
     }
-    new_ping_data->num_replies = ping_data->num_replies;
-    new_ping_data->num_sent = ping_data->num_sent;
-    new_ping_data->num_losses = ping_data->num_losses;
-    new_ping_data->num_probes_in_flight = ping_data->num_probes_in_flight;
-    new_ping_data->start_time = ping_data->start_time;
-    new_ping_data->last_time = ping_data->last_time;
 
     return new_ping_data;
 }
@@ -506,9 +354,7 @@ static ping_data_t * ping_data_dup(ping_data_t * ping_data) {
 
 static void ping_data_free(ping_data_t * ping_data) {
     if (ping_data) {
-        if (ping_data->rtt_results) {
-            dynarray_free(ping_data->rtt_results, (ELEMENT_FREE) double_free);
-        }
+        histogram_free(ping_data->rtt_histogram);
         free(ping_data);
     }
 }
@@ -546,13 +392,13 @@ static inline void discovered_ip_dump(const probe_t * reply, bool do_resolv) {
 }
 
 static inline void delay_dump(const probe_t * probe, const probe_t * reply) {
-    double send_time = probe_get_sending_time(probe),
-           recv_time = probe_get_recv_time(reply);
-    printf("%.2lf ms", 1000 * (recv_time - send_time));
+    int64_t rtt = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+    printf("%.2lf ms", rtt / 1000000.0);
 }
 
-static inline double delay_get(const probe_t * probe, const probe_t * reply) {
-    return 1000 * (probe_get_recv_time(reply) - probe_get_sending_time(probe));
+static inline uint64_t delay_get(const probe_t * probe, const probe_t * reply) {
+    int64_t rtt = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+    return rtt > 0 ? rtt : 0;
 }
 
 void ping_handler(
@@ -563,7 +409,6 @@ void ping_handler(
 ) {
     const probe_t * probe;
     const probe_t * reply;
-    double        * delay;
     const char    * error;
 
     switch (ping_event->type) {
@@ -590,17 +435,8 @@ void ping_handler(
                 printf("\n");
             }
 
-            if (!(delay = (double *) malloc(sizeof(double)))) {
-                fprintf(stderr, "Error while processing data \n");
-                pt_raise_error(loop);
-            }
-
-            *delay = delay_get(probe, reply);
-
-            // Store the rtts to compute statistics later
-            if (!dynarray_push_element(ping_data->rtt_results, delay)) {
-                pt_raise_error(loop);
-            }
+            // Update the statistics
+            ping_data_add_rtt(ping_data, delay_get(probe, reply));
             break;
 
         case PING_PRINT_STATISTICS:
@@ -663,64 +499,53 @@ void ping_handler(
 // Ping algorithm
 //-----------------------------------------------------------------
 
-/**
- * \brief Send a ping probe packet
- * \param loop The main loop
- * \param pnum_sent The address of the current the sequence number
- * \param probe_skel The probe skeleton used to craft the probe packet
- * \param ttl The TTL that we set for this packet
- */
-
-static bool send_ping_probe(
-    pt_loop_t     * loop,
-    size_t        * pnum_sent,
-    const probe_t * probe_skel,
-    size_t          i
-) {
-    probe_t * probe;
-    double    delay;
-
-    // a probe must never be altered, otherwise the network layer may
-    // manage corrupted probes.
-    if (!(probe = probe_dup(probe_skel))) goto ERR_PROBE_DUP;
-    if (probe_get_delay(probe) != DELAY_BEST_EFFORT) {
-        delay = i * probe_get_delay(probe_skel);
-        probe_set_delay(probe, DOUBLE("delay", delay));
-    }
-
-    probe_set_fields(probe, NULL); // set source ip
-
-    ++(*pnum_sent);
-    return pt_send_probe(loop, probe);
-
-ERR_PROBE_DUP:
-    fprintf(stderr, "Error in send_ping_probe\n");
-    return false;
-}
-
 /**
  * \brief Send n ping probes toward a destination with a given TTL
+ *    The n-th probe departs n intervals (plus options->offset) after
+ *    the first call.
  * \param loop The paris traceroute loop
- * \param pnum_sent The address of the current the sequence number
- *    ping measurements.
+ * \param data The data of the ping instance. data->num_sent is the
+ *    sequence number of the next probe.
+ * \param options The options of the ping instance.
  * \param probe_skel The probe skeleton used to craft the probe packet
  * \param num_probes The amount of probe to send
  * \return true if successful
  */
 
 bool send_ping_probes(
-    pt_loop_t     * loop,
-    size_t        * pnum_sent,
-    probe_t       * probe_skel,
-    size_t          num_probes
+    pt_loop_t            * loop,
+    ping_data_t          * data,
+    const ping_options_t * options,
+    probe_t              * probe_skel,
+    size_t                 num_probes
 ) {
-    size_t i;
-    for (i = 0; i < num_probes; ++i) {
-        if (!(send_ping_probe(loop, pnum_sent, probe_skel, i + 1))) {
-            return false;
+    probe_t * probes[PING_BATCH_SIZE];
+    size_t    i, j, num_stamped;
+    double    now = NS_TO_SECONDS(get_time_ns()), delay;
+
+    // The delay of a scheduled probe is counted from the time it is sent
+    if (data->num_sent == 0) data->first_send_time = now;
+
+    for (i = 0; i < num_probes; i += num_stamped) {
+        num_stamped = num_probes - i < PING_BATCH_SIZE ? num_probes - i : PING_BATCH_SIZE;
+        if (!probe_skel_stamp(probe_skel, probes, num_stamped, NULL, 0)) goto ERR_PROBE_SKEL_STAMP;
+
+        for (j = 0; j < num_stamped; j++) {
+            if (probe_get_delay(probes[j]) != DELAY_BEST_EFFORT) {
+                delay = data->first_send_time + options->offset + (data->num_sent + i + j + 1) * probe_get_delay(probe_skel) - now;
+                probe_set_delay(probes[j], DOUBLE("delay", delay > 0 ? delay : 0));
+            }
         }
+
+        data->num_sent += num_stamped;
+        if (!pt_send_probes(loop, probes, num_stamped)) goto ERR_PT_SEND_PROBES;
     }
     return true;
+
+ERR_PT_SEND_PROBES:
+ERR_PROBE_SKEL_STAMP:
+    fprintf(stderr, "Error in send_ping_probes\n");
+    return false;
 }
 
 /**
@@ -745,6 +570,8 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
     size_t                 num_probes_to_send  = 0;        // the number of probes to send
     double                 num_max_probes_to_schedule = 0; // the maximum number of probes to schedule at the same time
     bool                   has_terminated = false;         // Indicates whether the algorithm has terminated or not
+    ping_event_type_t      type;                           // Type of the event raised for a reply
+    address_t              discovered_addr;                // Source of the reply
 
     switch (event->type) {
         case ALGORITHM_INIT:
@@ -755,7 +582,7 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
                 goto FAILURE;
             }
             // Allocate structure storing current state information and update *pdata
-            if (!(data = ping_data_create())) {
+            if (!(data = ping_data_create(options))) {
                 goto FAILURE;
             }
             *pdata = data;
@@ -772,33 +599,24 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
 
             ++(data->num_replies);
             --(data->num_probes_in_flight);
-            data->last_time = reply->recv_time;
+            data->last_time = NS_TO_SECONDS(reply->recv_time);
 
             // Notify the caller we've got a response
             if (destination_reached(options->dst_addr, reply)) {
-                pt_raise_event(loop, event_create(PING_PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                type = PING_PROBE_REPLY;
             } else {
                 ++(data->num_losses);
-                if (destination_network_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_NET_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (destination_host_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_HOST_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (destination_protocol_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_PROT_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (destination_port_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_PORT_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (ttl_exceeded(reply)) {
-                    pt_raise_event(loop, event_create(PING_TTL_EXCEEDED_TRANSIT, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (fragment_reassembly_time_exceeded(reply)) {
-                    pt_raise_event(loop, event_create(PING_TIME_EXCEEDED_REASSEMBLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (redirect(reply)) {
-                    pt_raise_event(loop, event_create(PING_REDIRECT, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else if (parameter_problem(reply)) {
-                    pt_raise_event(loop, event_create(PING_PARAMETER_PROBLEM, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                } else {
-                    pt_raise_event(loop, event_create(PING_GEN_ERROR, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-                }
+                type = ping_get_error_type(reply);
             }
+            results_add_stats(pt_get_results(loop), probe, type == PING_PROBE_REPLY ? reply : NULL);
+
+            // The caller may print the hostname of the replying interface
+            pt_raise_event_resolved(
+                loop,
+                event_create_probe_reply(type, probe, probe_reply->reply, NULL),
+                probe_extract(reply, "src_ip", &discovered_addr) ? &discovered_addr : NULL,
+                options->do_resolv ? PT_LOOKUP_HOSTNAME : 0
+            );
 
             num_probes_to_send = data->num_sent != options->count; // we should send only 1 or 0 probes
             break;
@@ -810,10 +628,11 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
             ++(data->num_replies);
             ++(data->num_losses);
             --(data->num_probes_in_flight);
-            data->last_time = probe->sending_time + network_get_timeout(loop->network);
+            data->last_time = NS_TO_SECONDS(probe->sending_time) + network_get_timeout(loop->network);
+            results_add_stats(pt_get_results(loop), probe, NULL);
 
             // Notify the caller we've got a probe timeout
-            pt_raise_event(loop, event_create(PING_TIMEOUT, probe, NULL, (ELEMENT_FREE) probe_free));
+            pt_raise_event(loop, event_create(PING_TIMEOUT, probe_ref(probe), NULL, (ELEMENT_FREE) probe_free));
 
             num_probes_to_send = data->num_sent != options->count;
             break;
@@ -835,18 +654,27 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
         case ALGORITHM_ERROR:
             goto FAILURE;
 
+        case PROBE_REPLY_DUPLICATE:
+        case PROBE_REPLY_LATE:
+            // Its probe has already been accounted for
+            return 0;
+
+        case NETWORK_READY:
+            // This algorithm does not wait for credits
+            return 0;
+
         default:
             break;
     }
 
     // If this corresponds to the 1st probe
     if ((event->type == PROBE_REPLY || event->type == PROBE_TIMEOUT) && data->num_replies == 1) {
-        data->start_time = probe->sending_time;
+        data->start_time = NS_TO_SECONDS(probe->sending_time);
     }
 
     // check if we can send another probe or if we have already sent the maximum number of probes
     if (num_probes_to_send > 0) {
-        send_ping_probes(loop, &data->num_sent, probe_skel, num_probes_to_send);
+        send_ping_probes(loop, data, options, probe_skel, num_probes_to_send);
         data->num_probes_in_flight += num_probes_to_send;
     } else {
         if (data->num_probes_in_flight == 0) { // we've recieved a response from all the probes we sent
@@ -855,8 +683,7 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
         }
     }
 
-    // Handled event must always been freed when leaving the handler
-    event_free(event);
+    // The handled event is released by the algorithm layer when leaving the handler
     return 0;
 
 HAS_TERMINATED:
@@ -867,13 +694,11 @@ HAS_TERMINATED:
         pt_raise_terminated(loop);
     }
 
-    // Handled event must always been freed when leaving the handler
-    event_free(event);
+    // The handled event is released by the algorithm layer when leaving the handler
     return 0;
 
 FAILURE:
-    // Handled event must always been freed when leaving the handler
-    event_free(event);
+    // The handled event is released by the algorithm layer when leaving the handler
 
     // Sent to the current instance a ALGORITHM_FAILURE notification.
     // The caller has to free the data allocated by the algorithm.
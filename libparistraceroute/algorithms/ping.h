@@ -4,16 +4,18 @@
 #include <stdbool.h>     // bool
 #include <stdint.h>      // uint*_t
 #include <stddef.h>      // size_t
+#include <stdio.h>       // FILE
 #include <limits.h>      // INT_MAX
 
-#include "../address.h"  // address_t
-#include "../pt_loop.h"  // pt_loop_t
-#include "../dynarray.h" // dynarray_t
-#include "../options.h"  // option_t
+#include "../address.h"   // address_t
+#include "../pt_loop.h"   // pt_loop_t
+#include "../histogram.h" // histogram_t
+#include "../options.h"   // option_t
 
 #define OPTIONS_PING_MAX_TTL_DEFAULT                  255
 #define OPTIONS_PING_PACKET_SIZE_DEFAULT              56
 #define OPTIONS_PING_SHOW_TIMESTAMP_DEFAULT           false
+#define OPTIONS_PING_SHOW_PERCENTILES_DEFAULT         false
 #define OPTIONS_PING_IS_QUIET_DEFAULT                 false
 #define OPTIONS_PING_COUNT_DEFAULT                    INT_MAX
 #define OPTIONS_PING_DO_RESOLV_DEFAULT                true
@@ -31,11 +33,13 @@
 #define PING_HELP_q      "Quiet output. Nothing is displayed except the summary lines at startup time and when finished."
 #define PING_HELP_v      "Verbose output."
 #define PING_HELP_t      "Set the IP Time to Live."
+#define PING_HELP_percentiles "Print the 50th, 90th and 99th percentiles of the RTTs in the statistics."
 
 // Get the different values of ping options
 bool         options_ping_get_do_resolv();
 double       options_ping_get_interval();
 bool         options_ping_get_show_timestamp();
+bool         options_ping_get_show_percentiles();
 bool         options_ping_get_is_quiet();
 unsigned int options_ping_get_count();
 
@@ -49,8 +53,10 @@ typedef struct {
     const address_t * dst_addr;         /**< The target IP */
     bool              do_resolv;        /**< Resolv each discovered IP hop */
     double            interval;         /**< The time to wait to send each packet; in seconds */
+    double            offset;           /**< Additional delay of the first packet, to interleave the packets of several instances; in seconds */
     bool              is_quiet;         /**< If enabled, only summary lines at startup time and when finished are shown */
     bool              show_timestamp;   /**< If enabled, timestamp is shown */
+    bool              show_percentiles; /**< If enabled, the percentiles of the RTTs are shown in the statistics */
 } ping_options_t;
 
 const option_t * ping_get_options();
@@ -90,14 +96,23 @@ typedef struct {
     void                  * zero;
 } ping_event_t;
 
+// The RTT statistics are updated on the fly (see ping_data_add_rtt), so
+// that they are computed in O(1) time and memory per probe.
+
 typedef struct {
-    size_t       num_replies;          /**< Total of probe sent for this instance */
-    size_t       num_losses;           /**< Number of packets lost */
-    size_t       num_probes_in_flight; /**< The number of probes which haven't provoked a reply so far */
-    dynarray_t * rtt_results;          /**< RTTs in order to be able to compute statistics */
-    size_t       num_sent;             /**< The number of probes sent (== the sequence number of the next probe packet) */
-    double       start_time;           /**< The date at which ping starts measurement (in microsecond) */
-    double       last_time;            /**< The date at which the last reply or timeout have been handled (in microsecond) */
+    size_t        num_replies;          /**< Total of probe sent for this instance */
+    size_t        num_losses;           /**< Number of packets lost */
+    size_t        num_probes_in_flight; /**< The number of probes which haven't provoked a reply so far */
+    size_t        num_rtts;             /**< Number of RTTs measured so far */
+    double        rtt_min;              /**< Smallest RTT (in milliseconds) */
+    double        rtt_max;              /**< Greatest RTT (in milliseconds) */
+    double        rtt_mean;             /**< Mean of the RTTs (in milliseconds) */
+    double        rtt_m2;               /**< Sum of the squared differences between the RTTs and rtt_mean (Welford's algorithm) */
+    histogram_t * rtt_histogram;        /**< Distribution of the RTTs (in nanoseconds), NULL unless ping_options_t.show_percentiles is set */
+    size_t        num_sent;             /**< The number of probes sent (== the sequence number of the next probe packet) */
+    double        start_time;           /**< The date at which ping starts measurement (in seconds, see get_time_ns) */
+    double        last_time;            /**< The date at which the last reply or timeout have been handled (in seconds, see get_time_ns) */
+    double        first_send_time;      /**< The date at which the first probe has been handed over to the network layer (in seconds, see get_time_ns) */
 } ping_data_t;
 
 /**
@@ -107,6 +122,17 @@ typedef struct {
 
 void ping_dump_statistics(ping_data_t * ping_data);
 
+/**
+ * \brief Write the statistics of several ping instances in the OpenMetrics
+ *    text format (see metrics.h), each sample being labelled by its target.
+ * \param file The output stream.
+ * \param targets The name of the target of each instance.
+ * \param ping_datas The data of each instance (NULL if it has terminated).
+ * \param num_targets The number of instances.
+ */
+
+void ping_write_metrics(FILE * file, const char * const * targets, ping_data_t * const * ping_datas, size_t num_targets);
+
 //-----------------------------------------------------------------
 // Ping default handler
 //-----------------------------------------------------------------
@@ -0,0 +1,569 @@
+#include "pmtud.h"
+
+#include <errno.h>       // errno, EINVAL
+#include <stdlib.h>      // calloc, malloc, free
+#include <stdio.h>       // fprintf
+#include <string.h>      // memset
+#include <netinet/ip.h>  // IP_DF
+
+#include "../probe.h"
+#include "../event.h"
+#include "../algorithm.h"
+#include "../address.h"  // address_resolv
+#include "../common.h"   // MIN, MAX
+
+// Maximum number of probes stamped and sent at once (see pmtud_send_probes)
+#define PMTUD_BATCH_SIZE 16
+
+//-----------------------------------------------------------------
+// Pmtud options
+//-----------------------------------------------------------------
+
+// Bounded integer parameters
+static unsigned max_mtu[4] = OPTIONS_PMTUD_MAX_MTU;
+
+static option_t pmtud_options[] = {
+    // action              short      long         metavar    help                variable
+    {opt_store_int_lim_en, OPT_NO_SF, "--max-mtu", "MAX_MTU", PMTUD_HELP_max_mtu, max_mtu},
+    END_OPT_SPECS
+};
+
+size_t options_pmtud_get_max_mtu() {
+    return max_mtu[0];
+}
+
+unsigned options_pmtud_get_is_set() {
+    return max_mtu[3];
+}
+
+const option_t * pmtud_get_options() {
+    return pmtud_options;
+}
+
+pmtud_options_t pmtud_get_default_options() {
+    pmtud_options_t pmtud_options = {
+        .traceroute_options = traceroute_get_default_options(),
+        .max_mtu            = OPTIONS_PMTUD_MAX_MTU_DEFAULT,
+    };
+    return pmtud_options;
+}
+
+void options_pmtud_init(pmtud_options_t * pmtud_options) {
+    pmtud_options->max_mtu = options_pmtud_get_max_mtu();
+}
+
+//-----------------------------------------------------------------
+// Pmtud algorithm's data
+//-----------------------------------------------------------------
+
+/**
+ * \brief Release a pmtud_data_t instance from the memory.
+ * \param data The pmtud_data_t instance we want to release.
+ */
+
+void pmtud_data_free(pmtud_data_t * data) {
+    if (data) {
+        // The probes in flight are released by the network layer
+        if (data->probe_skel) probe_free(data->probe_skel);
+        free(data->searches);
+        free(data);
+    }
+}
+
+/**
+ * \brief Allocate a pmtud_data_t instance, and prepare the skeleton of
+ *    the probes: its DF bit is set and it is finalized once for all.
+ * \param probe_skel The probe skeleton passed to this instance.
+ * \param options The options of this instance.
+ * \return The newly allocated pmtud_data_t instance, NULL in case of
+ *    failure.
+ */
+
+static pmtud_data_t * pmtud_data_create(const probe_t * probe_skel, const pmtud_options_t * options) {
+    pmtud_data_t * data;
+    int            family = options->traceroute_options.dst_addr->family;
+
+    if (!(data = calloc(1, sizeof(pmtud_data_t))))       goto ERR_MALLOC;
+    if (!(data->probe_skel = probe_dup(probe_skel)))     goto ERR_PROBE_DUP;
+
+    // IPv6 routers never fragment the packets
+    if (family == AF_INET && !probe_set_fields(data->probe_skel, I16("fragoff", IP_DF), NULL)) {
+        goto ERR_SET_DF;
+    }
+    if (!probe_update_fields(data->probe_skel))          goto ERR_UPDATE_FIELDS;
+    if (!probe_resolve_field(data->probe_skel, "ttl", &data->ttl_field)) goto ERR_RESOLVE_TTL;
+
+    data->header_size = probe_get_size(data->probe_skel) - probe_get_payload_size(data->probe_skel);
+    data->min_size    = MAX(family == AF_INET6 ? PMTUD_IPV6_MIN_MTU : PMTUD_IPV4_MIN_MTU, probe_get_size(data->probe_skel));
+    data->max_size    = options->max_mtu;
+    data->num_hops    = options->traceroute_options.max_ttl - options->traceroute_options.min_ttl + 1;
+    data->ttl         = options->traceroute_options.min_ttl;
+    if (!(data->searches = calloc(data->num_hops, sizeof(pmtud_search_t)))) goto ERR_SEARCHES;
+    return data;
+
+ERR_SEARCHES:
+ERR_RESOLVE_TTL:
+ERR_UPDATE_FIELDS:
+ERR_SET_DF:
+    probe_free(data->probe_skel);
+ERR_PROBE_DUP:
+    free(data);
+ERR_MALLOC:
+    return NULL;
+}
+
+//-----------------------------------------------------------------
+// Pmtud default handler
+//-----------------------------------------------------------------
+
+void pmtud_event_fdump(
+    FILE                  * out,
+    const pmtud_event_t   * pmtud_event,
+    const pmtud_options_t * pmtud_options
+) {
+    const pmtud_hop_t * hop;
+    char              * hostname;
+
+    switch (pmtud_event->type) {
+        case PMTUD_HOP:
+            hop = pmtud_event->data;
+            fprintf(out, "%2d ", hop->ttl);
+            if (hop->has_interface) {
+                fprintf(out, " ");
+                if (pmtud_options->traceroute_options.do_resolv
+                &&  address_resolv(&hop->interface, &hostname, CACHE_ENABLED)) {
+                    fprintf(out, "%s (", hostname);
+                    free(hostname);
+                    address_fdump(out, &hop->interface);
+                    fprintf(out, ")");
+                } else {
+                    address_fdump(out, &hop->interface);
+                }
+            } else {
+                fprintf(out, " *");
+            }
+            if (hop->mtu) {
+                fprintf(out, "  pmtu %zu", hop->mtu);
+            }
+            fprintf(out, "\n");
+            fflush(out);
+            break;
+
+        case PMTUD_DESTINATION_REACHED:
+        case PMTUD_MAX_TTL_REACHED:
+        case PMTUD_TOO_MANY_STARS:
+        default:
+            break;
+    }
+}
+
+//-----------------------------------------------------------------
+// Pmtud algorithm
+//-----------------------------------------------------------------
+
+/**
+ * \brief Retrieve the search related to a TTL.
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param options Options attached to this instance of pmtud algorithm
+ * \param ttl The TTL.
+ * \return The corresponding search, NULL if it has not started.
+ */
+
+static inline pmtud_search_t * pmtud_get_search(pmtud_data_t * data, const pmtud_options_t * options, uint8_t ttl) {
+    size_t hop = ttl - options->traceroute_options.min_ttl;
+
+    return ttl >= options->traceroute_options.min_ttl && hop < data->num_sent_hops ? &data->searches[hop] : NULL;
+}
+
+/**
+ * \brief Send the probes of an attempt: num_probes probes of a given size
+ *    and a given TTL, stamped out of the skeleton resized accordingly.
+ * \param loop The main loop
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param num_probes The number of probes
+ * \param ttl The TTL of the probes
+ * \param size The size of the probes (IP header included)
+ * \return true iif successful
+ */
+
+static bool pmtud_send_probes(
+    pt_loop_t    * loop,
+    pmtud_data_t * data,
+    size_t         num_probes,
+    uint8_t        ttl,
+    size_t         size
+) {
+    probe_t             * probe_sized;
+    probe_t             * probes[PMTUD_BATCH_SIZE];
+    probe_field_range_t   ttl_range;
+    size_t                i, num_stamped;
+
+    // The checksums of the resized skeleton are updated once, the
+    // stamped probes only differ from it by their TTL
+    if (!(probe_sized = probe_dup(data->probe_skel)))                      goto ERR_PROBE_DUP;
+    if (!probe_payload_resize(probe_sized, size - data->header_size))     goto ERR_PAYLOAD_RESIZE;
+
+    ttl_range.field  = data->ttl_field;
+    ttl_range.first  = ttl;
+    ttl_range.step   = 0;
+    ttl_range.period = 1;
+
+    for (i = 0; i < num_probes; i += num_stamped) {
+        num_stamped = MIN(num_probes - i, PMTUD_BATCH_SIZE);
+        if (!probe_skel_stamp(probe_sized, probes, num_stamped, &ttl_range, 1)) goto ERR_PROBE_SKEL_STAMP;
+        if (!pt_send_probes(loop, probes, num_stamped))                    goto ERR_PT_SEND_PROBES;
+        data->num_flying += num_stamped;
+        data->num_probes += num_stamped;
+    }
+    probe_free(probe_sized);
+    return true;
+
+ERR_PT_SEND_PROBES:
+ERR_PROBE_SKEL_STAMP:
+ERR_PAYLOAD_RESIZE:
+    probe_free(probe_sized);
+ERR_PROBE_DUP:
+    fprintf(stderr, "Error in pmtud_send_probes\n");
+    return false;
+}
+
+/**
+ * \brief Pick the size probed by the next attempt of a search.
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param search The search.
+ * \return The next size, 0 if the search is over.
+ */
+
+static size_t pmtud_search_next_size(const pmtud_data_t * data, pmtud_search_t * search) {
+    size_t size, lo;
+
+    // Inconsistent bounds (e.g. lost probes): trust the replies
+    if (search->lo > search->hi) search->hi = search->lo;
+    if (search->has_interface) search->is_checking = false;
+
+    // The bounds may be known thanks to the other hops before this hop replies
+    if (search->lo == search->hi) {
+        if (search->has_interface || !search->lo) return 0;
+        search->is_checking = true;
+    }
+    if (search->hi < data->min_size) return 0;
+    if (search->is_checking) return MAX(search->lo, data->min_size);
+
+    // Sizes below min_size are known to reach the hop
+    lo = MAX(search->lo, data->min_size - 1);
+    if (search->hint > lo && search->hint <= search->hi) {
+        size = search->hint;
+    } else {
+        size = (lo + search->hi + 1) / 2;
+    }
+    search->hint = 0;
+    return size;
+}
+
+/**
+ * \brief Start the searches of the hops entering the window, which spans
+ *    num_parallel_hops hops from the first hop not reported yet. No hop
+ *    is probed beyond the destination.
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param options Options attached to this instance of pmtud algorithm
+ */
+
+static void pmtud_open_window(pmtud_data_t * data, const pmtud_options_t * options) {
+    const traceroute_options_t * traceroute_options = &options->traceroute_options;
+    pmtud_search_t             * search;
+    size_t                       last = MIN(data->ttl + MAX(traceroute_options->num_parallel_hops, 1) - 1, traceroute_options->max_ttl);
+
+    if (data->dst_ttl) last = MIN(last, data->dst_ttl);
+    while (traceroute_options->min_ttl + data->num_sent_hops <= last) {
+        search = &data->searches[data->num_sent_hops++];
+        memset(search, 0, sizeof(pmtud_search_t));
+
+        // Start with the largest size which may reach this hop
+        search->hi   = data->max_size;
+        search->hint = data->max_size;
+    }
+}
+
+/**
+ * \brief Start the next attempt of the searches whose current attempt is
+ *    over, or complete them.
+ * \param loop The main loop
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param options Options attached to this instance of pmtud algorithm
+ * \return true iif successful
+ */
+
+static bool pmtud_send_window(pt_loop_t * loop, pmtud_data_t * data, const pmtud_options_t * options) {
+    pmtud_search_t * search;
+    size_t           hop, size;
+    uint8_t          ttl;
+
+    for (hop = data->ttl - options->traceroute_options.min_ttl; hop < data->num_sent_hops; hop++) {
+        search = &data->searches[hop];
+        ttl = options->traceroute_options.min_ttl + hop;
+        if (search->is_complete || (data->dst_ttl && ttl > data->dst_ttl)) continue;
+
+        // The current attempt is still informative
+        if (search->size && (search->is_checking ?
+            !search->has_interface :
+            search->size > search->lo && search->size <= search->hi
+        )) continue;
+
+        if (!(size = pmtud_search_next_size(data, search))) {
+            search->is_complete = true;
+            continue;
+        }
+        search->size     = size;
+        search->num_lost = 0;
+        if (!pmtud_send_probes(loop, data, options->traceroute_options.num_probes, ttl, size)) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Report the complete hops in order, and check whether the
+ *    discovery must stop. If so, the reason is notified to the caller.
+ * \param loop The main loop
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param options Options attached to this instance of pmtud algorithm
+ * \return The number of reported hops.
+ */
+
+static size_t pmtud_report(pt_loop_t * loop, pmtud_data_t * data, const pmtud_options_t * options) {
+    const traceroute_options_t * traceroute_options = &options->traceroute_options;
+    pmtud_search_t             * search;
+    pmtud_hop_t                * hop;
+    size_t                       num_reported = 0;
+
+    while (!data->is_finished
+        && (search = pmtud_get_search(data, options, data->ttl))
+        && search->is_complete
+    ) {
+        if ((hop = malloc(sizeof(pmtud_hop_t)))) {
+            hop->ttl           = data->ttl;
+            hop->interface     = search->interface;
+            hop->has_interface = search->has_interface;
+            hop->mtu           = search->lo;
+            pt_raise_event_resolved(
+                loop,
+                event_create(PMTUD_HOP, hop, NULL, free),
+                search->has_interface ? &search->interface : NULL,
+                (traceroute_options->do_resolv ? PT_LOOKUP_HOSTNAME : 0)
+            );
+        }
+        num_reported++;
+
+        if (data->dst_ttl == data->ttl) {
+            // We've reached the destination
+            pt_raise_event(loop, event_create(PMTUD_DESTINATION_REACHED, NULL, NULL, NULL));
+            data->is_finished = true;
+        } else if (data->ttl >= traceroute_options->max_ttl) {
+            // We've reached the maximum TTL
+            pt_raise_event(loop, event_create(PMTUD_MAX_TTL_REACHED, NULL, NULL, NULL));
+            data->is_finished = true;
+        } else if (!search->has_interface && ++(data->num_undiscovered) == traceroute_options->max_undiscovered) {
+            // The last "max_undiscovered" hops are silent, so give up
+            pt_raise_event(loop, event_create(PMTUD_TOO_MANY_STARS, NULL, NULL, NULL));
+            data->is_finished = true;
+        } else {
+            if (search->has_interface) data->num_undiscovered = 0;
+            (data->ttl)++;
+        }
+    }
+    return num_reported;
+}
+
+/**
+ * \brief Narrow the searches according to a reply.
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param options Options attached to this instance of pmtud algorithm
+ * \param probe_reply The probe and its reply.
+ */
+
+static void pmtud_handle_reply(pmtud_data_t * data, const pmtud_options_t * options, const probe_reply_t * probe_reply) {
+    pmtud_search_t * search;
+    address_t        interface;
+    uintmax_t        value;
+    size_t           size, bound, mtu, hop, first_hop;
+    uint8_t          ttl;
+
+    if (!probe_extract_resolved_field(probe_reply->probe, &data->ttl_field, &value)) return;
+    ttl = value;
+    if (!(search = pmtud_get_search(data, options, ttl))) return;
+    size = probe_get_size(probe_reply->probe);
+    first_hop = data->ttl - options->traceroute_options.min_ttl;
+
+    // The current attempt is answered, its other probes are still accounted
+    if (size == search->size) search->size = 0;
+
+    if (probe_get_reply_class(probe_reply->reply) == REPLY_CLASS_PACKET_TOO_BIG) {
+        // The MTU toward this hop and toward the next ones is too small
+        mtu = probe_get_reply_next_hop_mtu(probe_reply->reply);
+        bound = mtu >= data->min_size && mtu < size ? mtu : size - 1;
+        for (hop = ttl - options->traceroute_options.min_ttl; hop < data->num_sent_hops; hop++) {
+            if (hop < first_hop || data->searches[hop].is_complete) continue;
+            data->searches[hop].hi = MIN(data->searches[hop].hi, bound);
+            if (bound == mtu) data->searches[hop].hint = mtu;
+
+            // A size deemed to reach this hop does not (e.g. the route has changed)
+            if (data->searches[hop].lo > data->searches[hop].hi) data->searches[hop].lo = 0;
+        }
+        data->max_size = MIN(data->max_size, bound);
+        return;
+    }
+
+    // This size reaches this hop, and the previous ones
+    for (hop = first_hop; hop <= (size_t) (ttl - options->traceroute_options.min_ttl); hop++) {
+        if (!data->searches[hop].is_complete) {
+            data->searches[hop].lo = MAX(data->searches[hop].lo, size);
+        }
+    }
+
+    if (probe_extract(probe_reply->reply, "src_ip", &interface)) {
+        if (!search->has_interface) {
+            search->interface     = interface;
+            search->has_interface = true;
+        }
+        if (address_equals(options->traceroute_options.dst_addr, &interface)
+        &&  (!data->dst_ttl || ttl < data->dst_ttl)
+        ) {
+            data->dst_ttl = ttl;
+        }
+    }
+}
+
+/**
+ * \brief Account a lost probe. Once every probe of an attempt is lost,
+ *    its size is deemed too large. If the hop has never replied, it is
+ *    then probed with a size deemed to reach it, and it is deemed silent
+ *    if these probes are lost as well.
+ * \param data Data attached to this instance of pmtud algorithm
+ * \param options Options attached to this instance of pmtud algorithm
+ * \param probe The lost probe.
+ */
+
+static void pmtud_handle_timeout(pmtud_data_t * data, const pmtud_options_t * options, const probe_t * probe) {
+    pmtud_search_t * search;
+    uintmax_t        ttl;
+    size_t           size;
+
+    if (!probe_extract_resolved_field(probe, &data->ttl_field, &ttl)) return;
+    if (!(search = pmtud_get_search(data, options, ttl)) || search->is_complete) return;
+
+    // The probes of the previous attempts are ignored
+    size = probe_get_size(probe);
+    if (size != search->size || ++(search->num_lost) < options->traceroute_options.num_probes) return;
+
+    search->size = 0;
+    if (search->is_checking) {
+        search->is_complete = true;
+    } else {
+        search->hi = MIN(search->hi, size - 1);
+        search->is_checking = !search->has_interface;
+    }
+}
+
+/**
+ * \brief Handle events to a pmtud algorithm instance
+ * \param loop The main loop
+ * \param event The raised event
+ * \param pdata Points to a (void *) address that may be altered by pmtud_loop_handler in order
+ *   to manage data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet
+ * \param opts Points to the option related to this instance (== loop->cur_instance->options)
+ */
+
+int pmtud_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
+{
+    pmtud_data_t    * data = NULL;     // Current state of the algorithm instance
+    pmtud_options_t * options = opts;  // Options passed to this instance
+
+    switch (event->type) {
+
+        case ALGORITHM_INIT:
+            // Check options
+            if (!options
+            ||  options->traceroute_options.min_ttl > options->traceroute_options.max_ttl
+            ||  !options->traceroute_options.num_probes
+            ) {
+                fprintf(stderr, "Invalid pmtud options\n");
+                errno = EINVAL;
+                goto FAILURE;
+            }
+
+            // Allocate structure storing current state information and update *pdata
+            if (!(data = pmtud_data_create(probe_skel, options))) {
+                goto FAILURE;
+            }
+            *pdata = data;
+            if (options->max_mtu < data->min_size) {
+                fprintf(stderr, "pmtud: the maximum MTU must be at least %zu\n", data->min_size);
+                errno = EINVAL;
+                goto FAILURE;
+            }
+            break;
+
+        case PROBE_REPLY:
+            data = *pdata;
+            data->num_flying--;
+            pmtud_handle_reply(data, options, event->data);
+            break;
+
+        case PROBE_TIMEOUT:
+            data = *pdata;
+            data->num_flying--;
+            pmtud_handle_timeout(data, options, event->data);
+            break;
+
+        case ALGORITHM_TERM:
+            // The caller allows us to free pmtud's data
+            pmtud_data_free(*pdata);
+            *pdata = NULL;
+            pt_raise_terminated(loop);
+            return 0;
+
+        case ALGORITHM_ERROR:
+            goto FAILURE;
+
+        case PROBE_REPLY_DUPLICATE:
+        case PROBE_REPLY_LATE:
+            // Its probe has already been accounted for
+            return 0;
+
+        case NETWORK_READY:
+            // This algorithm does not wait for credits
+            return 0;
+
+        default:
+            return 0;
+    }
+
+    // Report the complete hops, and probe the next ones
+    do {
+        pmtud_open_window(data, options);
+        if (!data->is_finished && !pmtud_send_window(loop, data, options)) goto FAILURE;
+    } while (pmtud_report(loop, data, options) && !data->is_finished);
+
+    // Wait for the probes still in transit before terminating, as their
+    // replies are delivered to this instance.
+    if (data->is_finished && !data->num_flying) {
+        pt_raise_terminated(loop);
+    }
+
+    // The handled event is released by the algorithm layer when leaving the handler
+    return 0;
+
+FAILURE:
+    // Sent to the current instance a ALGORITHM_FAILURE notification.
+    // The caller has to free the data allocated by the algorithm.
+    pt_raise_error(loop);
+    return EINVAL;
+}
+
+static algorithm_t pmtud = {
+    .name    = "pmtud",
+    .handler = pmtud_loop_handler,
+    .options = (const option_t *) &pmtud_options
+};
+
+ALGORITHM_REGISTER(pmtud);
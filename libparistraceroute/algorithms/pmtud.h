@@ -0,0 +1,198 @@
+#ifndef ALGORITHMS_PMTUD_H
+#define ALGORITHMS_PMTUD_H
+
+#include <stdbool.h>     // bool
+#include <stdint.h>      // uint*_t
+#include <stddef.h>      // size_t
+#include <stdio.h>       // FILE
+
+#include "traceroute.h"  // traceroute_options_t
+#include "../address.h"  // address_t
+#include "../pt_loop.h"  // pt_loop_t
+#include "../event.h"    // event_t
+#include "../options.h"  // option_t
+#include "../probe.h"    // probe_t, probe_field_t
+
+// Smallest MTU of a link (RFC 791, RFC 8200)
+#define PMTUD_IPV4_MIN_MTU 68
+#define PMTUD_IPV6_MIN_MTU 1280
+
+#define OPTIONS_PMTUD_MAX_MTU_DEFAULT 1500
+
+//                             def                            min                 max    enabled
+#define OPTIONS_PMTUD_MAX_MTU {OPTIONS_PMTUD_MAX_MTU_DEFAULT, PMTUD_IPV4_MIN_MTU, 65535, 0}
+
+#define PMTUD_HELP_max_mtu "Set the size of the largest probe sent when using -a pmtud (default: 1500)."
+
+/*
+ * Principle: Path MTU discovery (RFC 1191, RFC 8201)
+ *
+ * A probe whose DF bit is set (IPv6 probes are never fragmented by the
+ * routers) only reaches a hop if it fits in the MTU of every link leading
+ * to this hop. Otherwise the router which cannot forward it replies with
+ * an ICMP fragmentation needed (packet too big in IPv6), which usually
+ * carries the MTU of its next hop, or silently drops it (black hole).
+ *
+ * Algorithm: the MTU toward each hop is binary searched over the sizes of
+ * the probes, between the minimum MTU of the address family and max_mtu.
+ *
+ *     For each hop (TTL), [lo, hi] brackets the MTU toward this hop:
+ *         - lo is the largest size known to reach it (0 if none)
+ *         - hi is the largest size which may reach it
+ *
+ *     SEND: send num_probes probes of a given size with this TTL, starting
+ *           with hi.
+ *
+ *     PROBE_REPLY:
+ *         fragmentation needed (MTU m):   hi = min(size - 1, m), probe m next
+ *         any other reply (e.g. time exceeded, or from the destination):
+ *                                         lo = max(lo, size)
+ *     PROBE_TIMEOUT (every probe of the size is lost):
+ *         hi = size - 1
+ *
+ *     The next size is (lo + hi + 1) / 2, and the hop is complete once
+ *     lo == hi and it has replied. A hop which has never replied when
+ *     its probes are lost (or when lo == hi) is probed with a size deemed
+ *     to reach it (lo, or the minimum MTU), and it is reported as a star
+ *     if they are lost as well.
+ *
+ * Since the MTU toward a hop never exceeds the MTU toward the previous
+ * hops, a size reaching a hop raises lo for the previous hops, and a
+ * fragmentation needed triggered by a probe lowers hi for the next hops.
+ *
+ * The searches of num_parallel_hops consecutive hops run at once, and the
+ * hops are reported in order. As for traceroute, no hop is probed beyond
+ * the destination, and the discovery stops after max_undiscovered silent
+ * hops or at max_ttl.
+ *
+ * The probes are stamped out of a skeleton finalized once for all (see
+ * probe_skel_stamp), resized for each size, so that their checksums are
+ * updated incrementally by the network layer.
+ */
+
+//--------------------------------------------------------------------
+// Options
+//--------------------------------------------------------------------
+
+typedef struct {
+    traceroute_options_t traceroute_options; /**< Must be the first member. num_probes probes are sent per size */
+    size_t               max_mtu;            /**< Size of the largest probe */
+} pmtud_options_t;
+
+size_t   options_pmtud_get_max_mtu();
+unsigned options_pmtud_get_is_set();
+
+const option_t * pmtud_get_options();
+
+/**
+ * \brief Retrieve the default options of pmtud.
+ * \return The corresponding pmtud_options_t structure.
+ */
+
+pmtud_options_t pmtud_get_default_options();
+
+/**
+ * \brief Initialize the pmtud options structure according to the command
+ *    line (see pmtud_get_options). The traceroute options must be set by
+ *    options_traceroute_init.
+ * \param pmtud_options The corresponding pmtud_options_t structure.
+ */
+
+void options_pmtud_init(pmtud_options_t * pmtud_options);
+
+//--------------------------------------------------------------------
+// Custom-events raised by pmtud algorithm
+//--------------------------------------------------------------------
+
+typedef enum {
+    // event_type                 | data (type)     | data (meaning)
+    // ---------------------------+-----------------+--------------------------------------------
+    PMTUD_HOP,                 // | pmtud_hop_t *   | A hop and the MTU toward it
+    PMTUD_DESTINATION_REACHED, // | NULL            | N/A
+    PMTUD_MAX_TTL_REACHED,     // | NULL            | N/A
+    PMTUD_TOO_MANY_STARS       // | NULL            | N/A
+} pmtud_event_type_t;
+
+typedef struct {
+    pmtud_event_type_t type;
+    void             * data;
+    void            (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
+    void             * zero;
+} pmtud_event_t;
+
+typedef struct {
+    uint8_t   ttl;           /**< TTL of this hop */
+    address_t interface;     /**< Interface replying to the probes of this TTL (if has_interface) */
+    bool      has_interface; /**< True iif interface is set */
+    size_t    mtu;           /**< Size of the largest probe reaching this hop, 0 if unknown */
+} pmtud_hop_t;
+
+//--------------------------------------------------------------------
+// Data
+//--------------------------------------------------------------------
+
+typedef struct {
+    size_t    lo;            /**< Largest size known to reach this hop (0 if none) */
+    size_t    hi;            /**< Largest size which may reach this hop */
+    size_t    size;          /**< Size probed by the current attempt (0 if none) */
+    size_t    hint;          /**< Next-hop MTU carried by the last fragmentation needed (0 if none) */
+    size_t    num_lost;      /**< Number of probes of the current attempt lost so far */
+    address_t interface;     /**< Interface replying to the probes of this TTL (if has_interface) */
+    bool      has_interface; /**< True iif interface is set */
+    bool      is_checking;   /**< True iif the current attempt checks whether this hop replies, with a size deemed to reach it */
+    bool      is_complete;   /**< True iif the search is over */
+} pmtud_search_t;
+
+typedef struct {
+    probe_t        * probe_skel;       /**< The skeleton of the probes (DF bit set), finalized */
+    probe_field_t    ttl_field;        /**< The "ttl" field of probe_skel */
+    size_t           header_size;      /**< Size of probe_skel without its payload */
+    size_t           min_size;         /**< Size of the smallest probe */
+    size_t           max_size;         /**< Upper bound of the MTU toward the hops not probed yet */
+    pmtud_search_t * searches;         /**< The searches of the hops, from min_ttl */
+    size_t           num_hops;         /**< Number of hops between min_ttl and max_ttl */
+    size_t           num_sent_hops;    /**< Number of hops whose search has started, from min_ttl */
+    uint8_t          ttl;              /**< Next hop to report */
+    uint8_t          dst_ttl;          /**< Smallest TTL at which the destination has replied, 0 if none */
+    size_t           num_undiscovered; /**< Number of consecutive silent hops reported */
+    size_t           num_flying;       /**< Number of probes sent and neither replied nor expired */
+    size_t           num_probes;       /**< Number of probes sent so far */
+    bool             is_finished;      /**< True iif no more hop has to be reported */
+} pmtud_data_t;
+
+/**
+ * \brief Release a pmtud_data_t structure from the memory.
+ * \param data A pointer to the pmtud_data_t instance.
+ */
+
+void pmtud_data_free(pmtud_data_t * data);
+
+//--------------------------------------------------------------------
+// Output
+//--------------------------------------------------------------------
+
+/**
+ * \brief Print a pmtud_event_t event in a given stream.
+ * \param out The output stream.
+ * \param pmtud_event The printed event.
+ * \param pmtud_options Options related to this instance of pmtud.
+ */
+
+void pmtud_event_fdump(
+    FILE                  * out,
+    const pmtud_event_t   * pmtud_event,
+    const pmtud_options_t * pmtud_options
+);
+
+/**
+ * \brief Handle events to a pmtud algorithm instance.
+ * \param loop The main loop.
+ * \param event The raised event.
+ * \param pdata Points to the data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packets.
+ * \param opts Points to the pmtud_options_t of this instance.
+ */
+
+int pmtud_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts);
+
+#endif // ALGORITHMS_PMTUD_H
@@ -0,0 +1,255 @@
+#include "stateless.h"
+
+#include <errno.h>       // errno, EINVAL
+#include <stdlib.h>      // malloc
+#include <stdio.h>       // fprintf
+#include <string.h>      // strcmp
+
+#include "../probe.h"
+#include "../event.h"
+#include "../algorithm.h"
+#include "../network.h"  // network_add_stateless_caller
+#include "../common.h"   // MIN
+
+// Maximum number of probes stamped and sent at once (see stateless_send_window)
+#define STATELESS_BATCH_SIZE 16
+
+inline stateless_options_t stateless_get_default_options() {
+    stateless_options_t stateless_options = {
+        .targets     = NULL,
+        .num_targets = 0,
+        .min_ttl     = OPTIONS_STATELESS_MIN_TTL_DEFAULT,
+        .max_ttl     = OPTIONS_STATELESS_MAX_TTL_DEFAULT,
+        .window      = OPTIONS_STATELESS_WINDOW_DEFAULT,
+        .seed        = 0,
+        .offset      = 0,
+    };
+    return stateless_options;
+};
+
+/**
+ * \brief Check whether the options of a stateless instance are valid.
+ * \param options The options of the instance.
+ * \param probe_skel The probe skeleton.
+ * \return true iif valid
+ */
+
+static bool stateless_check_options(const stateless_options_t * options, const probe_t * probe_skel)
+{
+    const layer_t * layer;
+
+    if (!options->targets || !options->num_targets) {
+        fprintf(stderr, "stateless: no target\n");
+        return false;
+    }
+
+    if (options->min_ttl < 1 || options->max_ttl < options->min_ttl || !options->window) {
+        fprintf(stderr, "stateless: invalid options\n");
+        return false;
+    }
+
+    // The state of the probes is stored in the IPv4 identification
+    if (!(layer = probe_get_layer(probe_skel, 0))
+    ||  !layer->protocol
+    ||  strcmp(layer->protocol->name, "ipv4") != 0) {
+        fprintf(stderr, "stateless: only IPv4 probes are supported\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * \brief Rewrite a probe so that it probes the next (target, TTL) pair.
+ *    There must be a pair left (see permutation_has_next).
+ * \param data The data of the instance.
+ * \param options The options of the instance.
+ * \param probe The probe to rewrite.
+ * \return true iif successful
+ */
+
+static bool stateless_set_next_probe(stateless_data_t * data, const stateless_options_t * options, probe_t * probe)
+{
+    uint64_t i;
+    size_t   num_ttls = options->max_ttl - options->min_ttl + 1;
+    uint8_t  ttl;
+
+    if (!permutation_next(&data->permutation, &i)) return false;
+
+    ttl = options->min_ttl + i % num_ttls;
+    // The network layer finalizes the probe before sending it
+    return probe_set_fields_deferred(
+        probe,
+        ADDRESS("dst_ip", &options->targets[i / num_ttls]),
+        I8("ttl", ttl),
+        I16("identification", stateless_make_identification(data->instance_id, ttl)),
+        NULL
+    );
+}
+
+/**
+ * \brief Stamp the probes of the window out of the probe skeleton and
+ *    send them.
+ * \param loop The main loop.
+ * \param data The data of the instance.
+ * \param options The options of the instance.
+ * \param probe_skel The probe skeleton.
+ * \return true iif successful
+ */
+
+static bool stateless_send_window(
+    pt_loop_t                 * loop,
+    stateless_data_t          * data,
+    const stateless_options_t * options,
+    const probe_t             * probe_skel
+) {
+    probe_t * probes[STATELESS_BATCH_SIZE];
+    size_t    i, num_stamped,
+              num_probes = MIN(options->window, data->permutation.n - permutation_get_offset(&data->permutation));
+
+    while (num_probes > 0) {
+        num_stamped = MIN(num_probes, STATELESS_BATCH_SIZE);
+        if (!probe_skel_stamp(probe_skel, probes, num_stamped, NULL, 0)) goto ERR_PROBE_SKEL_STAMP;
+
+        for (i = 0; i < num_stamped; i++) {
+            if (!stateless_set_next_probe(data, options, probes[i])) goto ERR_SET_NEXT_PROBE;
+        }
+
+        if (!pt_send_probes(loop, probes, num_stamped)) goto ERR_PT_SEND_PROBES;
+        data->num_probes_queued += num_stamped;
+        num_probes -= num_stamped;
+    }
+    return true;
+
+ERR_SET_NEXT_PROBE:
+    for (i = 0; i < num_stamped; i++) probe_free(probes[i]);
+ERR_PT_SEND_PROBES:
+ERR_PROBE_SKEL_STAMP:
+    fprintf(stderr, "Error in stateless_send_window\n");
+    return false;
+}
+
+void stateless_data_free(pt_loop_t * loop, stateless_data_t * data)
+{
+    if (data) {
+        if (data->is_registered) {
+            network_del_stateless_caller(loop->network, data->instance_id);
+        }
+        free(data);
+    }
+}
+
+uint64_t stateless_get_offset(const stateless_data_t * data) {
+    return permutation_get_offset(&data->permutation) - data->num_probes_queued;
+}
+
+/**
+ * \brief Handle events to a stateless algorithm instance
+ * \param loop The main loop
+ * \param event The raised event
+ * \param pdata Points to a (void *) address that may be altered by the handler
+ *   in order to manage data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packets
+ * \param opts Points to the option related to this instance (== loop->cur_instance->options)
+ */
+
+int stateless_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
+{
+    stateless_data_t          * data    = *pdata;
+    const stateless_options_t * options = opts;
+    probe_t                   * probe;
+    probe_reply_t             * probe_reply;
+    stateless_reply_t         * stateless_reply;
+
+    switch (event->type) {
+        case ALGORITHM_INIT:
+            if (!options || !stateless_check_options(options, probe_skel)) {
+                errno = EINVAL;
+                goto FAILURE;
+            }
+
+            if (!(data = calloc(1, sizeof(stateless_data_t)))) goto FAILURE;
+            *pdata = data;
+
+            if (!network_add_stateless_caller(loop->network, loop->cur_instance, &data->instance_id)) {
+                goto FAILURE;
+            }
+            data->is_registered = true;
+
+            permutation_init(
+                &data->permutation,
+                (uint64_t) options->num_targets * (options->max_ttl - options->min_ttl + 1),
+                options->seed
+            );
+            permutation_seek(&data->permutation, options->offset);
+
+            if (!stateless_send_window(loop, data, options, probe_skel)) goto FAILURE;
+            break;
+
+        case PROBE_SENT:
+            // The network layer gives the probe back: reuse it for the next
+            // (target, TTL) pair, if any.
+            probe = (probe_t *) event->data;
+            data->num_probes_queued--;
+            data->num_probes_sent++;
+
+            if (permutation_has_next(&data->permutation)) {
+                if (!stateless_set_next_probe(data, options, probe)
+                ||  !pt_send_probe(loop, probe)) {
+                    probe_free(probe);
+                    goto FAILURE;
+                }
+                data->num_probes_queued++;
+            } else {
+                probe_free(probe);
+                if (data->num_probes_queued == 0) {
+                    pt_raise_event(loop, event_create(STATELESS_ALL_PROBES_SENT, NULL, NULL, NULL));
+                }
+            }
+            break;
+
+        case PROBE_REPLY:
+            // The probe is NULL: the network layer has not tracked it
+            probe_reply = (probe_reply_t *) event->data;
+
+            if ((stateless_reply = malloc(sizeof(stateless_reply_t)))) {
+                if (stateless_reply_decode(probe_reply->reply, stateless_reply)
+                &&  stateless_reply->instance_id == data->instance_id) {
+                    data->num_replies++;
+                    pt_raise_event(loop, event_create(STATELESS_REPLY, stateless_reply, NULL, free));
+                } else {
+                    free(stateless_reply);
+                }
+            }
+            break;
+
+        case ALGORITHM_TERM:
+            // The sweep is interrupted. The caller releases our data (see
+            // stateless_data_free) and may resume it (see stateless_get_offset).
+            pt_raise_terminated(loop);
+            break;
+
+        case ALGORITHM_ERROR:
+            goto FAILURE;
+
+        default:
+            break;
+    }
+
+    // The handled event is released by the algorithm layer when leaving the handler
+    return 0;
+
+FAILURE:
+    // Sent to the current instance a ALGORITHM_FAILURE notification.
+    // The caller has to free the data allocated by the algorithm.
+    pt_raise_error(loop);
+    return EINVAL;
+}
+
+static algorithm_t stateless = {
+    .name    = "stateless",
+    .handler = stateless_loop_handler,
+    .options = NULL
+};
+
+ALGORITHM_REGISTER(stateless);
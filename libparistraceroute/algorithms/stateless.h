@@ -0,0 +1,108 @@
+#ifndef ALGORITHMS_STATELESS_H
+#define ALGORITHMS_STATELESS_H
+
+#include <stdbool.h>        // bool
+#include <stdint.h>         // uint*_t
+#include <stddef.h>         // size_t
+
+#include "../address.h"     // address_t
+#include "../pt_loop.h"     // pt_loop_t
+#include "../permutation.h" // permutation_t
+#include "../stateless.h"   // stateless_reply_t
+
+/*
+ * Principle:
+ *
+ * The stateless algorithm sweeps a set of targets, sending a probe per
+ * (target, TTL) pair, in a pseudo-random order. Neither the algorithm nor
+ * the network layer track the probes: their state is encoded in the
+ * packets (see stateless.h), so that the memory does not depend on the
+ * number of probes in flight.
+ *
+ * The probes are stamped once out of the probe skeleton (which must be an
+ * IPv4 probe). The network layer gives each of them back once it is sent
+ * (PROBE_SENT), and it is then rewritten and sent to the next (target, TTL)
+ * pair. Thus, options.window probes at most are queued at a given time.
+ *
+ * Each reply is decoded and passed to the caller in a STATELESS_REPLY
+ * event. Once every probe has been sent, STATELESS_ALL_PROBES_SENT is
+ * raised: the caller should then wait for the last replies (e.g. during
+ * the network timeout) before stopping the instance.
+ *
+ * A sweep is fully defined by (targets, TTLs, seed): an interrupted sweep
+ * may be resumed by passing the same seed and, as offset, the number of
+ * probes sent so far (see stateless_get_offset). Its data must then
+ * be released thanks to stateless_data_free.
+ */
+
+#define OPTIONS_STATELESS_MIN_TTL_DEFAULT 1
+#define OPTIONS_STATELESS_MAX_TTL_DEFAULT 32
+#define OPTIONS_STATELESS_WINDOW_DEFAULT  256
+
+//--------------------------------------------------------------------
+// Options
+//--------------------------------------------------------------------
+
+typedef struct {
+    const address_t * targets;     /**< The IPv4 destinations */
+    size_t            num_targets; /**< Number of destinations */
+    uint8_t           min_ttl;     /**< Minimum TTL (at least 1) */
+    uint8_t           max_ttl;     /**< Maximum TTL */
+    size_t            window;      /**< Maximum number of probes handed over to the network layer at once */
+    uint64_t          seed;        /**< Selects the order in which the (target, TTL) pairs are probed */
+    uint64_t          offset;      /**< Number of (target, TTL) pairs to skip, e.g. to resume an interrupted sweep having the same seed */
+} stateless_options_t;
+
+stateless_options_t stateless_get_default_options();
+
+//--------------------------------------------------------------------
+// Custom-events raised by stateless algorithm
+//--------------------------------------------------------------------
+
+typedef enum {
+    // event_type                 | data (type)         | data (meaning)
+    // ---------------------------+---------------------+--------------------------------------------
+    STATELESS_REPLY,           // | stateless_reply_t * | The decoded reply
+    STATELESS_ALL_PROBES_SENT  // | NULL                | N/A
+} stateless_event_type_t;
+
+// TODO since this structure should exactly match with a standard event_t, define a macro allowing to define custom events
+typedef struct {
+    stateless_event_type_t  type;
+    void                  * data;
+    void                 (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
+    void                  * zero;
+} stateless_event_t;
+
+//--------------------------------------------------------------------
+// Data
+//--------------------------------------------------------------------
+
+typedef struct {
+    permutation_t           permutation;       /**< Order of the (target, TTL) pairs */
+    uint8_t                 instance_id;       /**< Instance ID carried by the probes (see network_add_stateless_caller) */
+    bool                    is_registered;     /**< true iif instance_id is registered in the network layer */
+    size_t                  num_probes_queued; /**< Number of probes handed over to the network layer */
+    size_t                  num_probes_sent;   /**< Number of probes sent so far */
+    size_t                  num_replies;       /**< Number of replies decoded so far */
+} stateless_data_t;
+
+/**
+ * \brief Release the data of a stateless instance. Its instance ID is
+ *    released, so that the network layer discards the next replies.
+ * \param loop The main loop.
+ * \param data The data of the instance.
+ */
+
+void stateless_data_free(pt_loop_t * loop, stateless_data_t * data);
+
+/**
+ * \brief Retrieve the offset from which a sweep can be resumed. The
+ *    probes queued in the network layer are not considered as sent.
+ * \param data The data of the instance.
+ * \return The offset to pass in stateless_options_t.offset.
+ */
+
+uint64_t stateless_get_offset(const stateless_data_t * data);
+
+#endif // ALGORITHMS_STATELESS_H
@@ -10,18 +10,25 @@
 #include "../algorithm.h"
 #include "../address.h"  // address_resolv
 #include "../whois.h"	 // whois_get_asn
+#include "../common.h"   // MIN
+#include "../output.h"   // output_t
+#include "../results.h"  // results_add_hop
+
+// Maximum number of probes stamped and sent at once (see send_traceroute_probes)
+#define TRACEROUTE_BATCH_SIZE 16
 
 //-----------------------------------------------------------------
 // Traceroute options
 //-----------------------------------------------------------------
 
 // Bounded integer parameters
-static unsigned min_ttl[3]          = OPTIONS_TRACEROUTE_MIN_TTL;
-static unsigned max_ttl[3]          = OPTIONS_TRACEROUTE_MAX_TTL;
-static unsigned max_undiscovered[3] = OPTIONS_TRACEROUTE_MAX_UNDISCOVERED;
-static unsigned num_queries[3]      = OPTIONS_TRACEROUTE_NUM_QUERIES;
-static bool     do_resolv           = OPTIONS_TRACEROUTE_DO_RESOLV_DEFAULT;
-static bool     resolv_asn          = OPTIONS_TRACEROUTE_RESOLV_ASN_DEFAULT;
+static unsigned min_ttl[3]           = OPTIONS_TRACEROUTE_MIN_TTL;
+static unsigned max_ttl[3]           = OPTIONS_TRACEROUTE_MAX_TTL;
+static unsigned max_undiscovered[3]  = OPTIONS_TRACEROUTE_MAX_UNDISCOVERED;
+static unsigned num_queries[3]       = OPTIONS_TRACEROUTE_NUM_QUERIES;
+static unsigned num_parallel_hops[3] = OPTIONS_TRACEROUTE_NUM_PARALLEL_HOPS;
+static bool     do_resolv            = OPTIONS_TRACEROUTE_DO_RESOLV_DEFAULT;
+static bool     resolv_asn           = OPTIONS_TRACEROUTE_RESOLV_ASN_DEFAULT;
 
 static option_t traceroute_options[] = {
     // action           short long                  metavar             help    data
@@ -31,6 +38,7 @@ static option_t traceroute_options[] = {
     {opt_store_0,       "n",  OPT_NO_LF,            OPT_NO_METAVAR,     TRACEROUTE_HELP_n, &do_resolv},
     {opt_store_int_lim, "q",  "--num-queries",      "NUM_QUERIES",      TRACEROUTE_HELP_q, num_queries},
     {opt_store_int_lim, "M",  "--max-undiscovered", "MAX_UNDISCOVERED", TRACEROUTE_HELP_M, max_undiscovered},
+    {opt_store_int_lim, "N",  "--parallel-hops",    "NUM_HOPS",         TRACEROUTE_HELP_N, num_parallel_hops},
     END_OPT_SPECS
 };
 
@@ -50,6 +58,10 @@ uint8_t options_traceroute_get_num_queries() {
     return num_queries[0];
 }
 
+uint8_t options_traceroute_get_num_parallel_hops() {
+    return num_parallel_hops[0];
+}
+
 bool options_traceroute_get_do_resolv() {
     return do_resolv;
 }
@@ -64,24 +76,29 @@ const option_t * traceroute_get_options() {
 
 void options_traceroute_init(traceroute_options_t * traceroute_options, address_t * address)
 {
-    traceroute_options->min_ttl          = options_traceroute_get_min_ttl();
-    traceroute_options->max_ttl          = options_traceroute_get_max_ttl();
-    traceroute_options->num_probes       = options_traceroute_get_num_queries();
-    traceroute_options->max_undiscovered = options_traceroute_get_max_undiscovered();
-    traceroute_options->dst_addr         = address;
-    traceroute_options->do_resolv        = options_traceroute_get_do_resolv();
-    traceroute_options->resolv_asn       = options_traceroute_get_resolv_asn();
+    traceroute_options->min_ttl           = options_traceroute_get_min_ttl();
+    traceroute_options->max_ttl           = options_traceroute_get_max_ttl();
+    traceroute_options->num_probes        = options_traceroute_get_num_queries();
+    traceroute_options->max_undiscovered  = options_traceroute_get_max_undiscovered();
+    traceroute_options->num_parallel_hops = options_traceroute_get_num_parallel_hops();
+    traceroute_options->dst_addr          = address;
+    traceroute_options->do_resolv         = options_traceroute_get_do_resolv();
+    traceroute_options->resolv_asn        = options_traceroute_get_resolv_asn();
 }
 
 inline traceroute_options_t traceroute_get_default_options() {
     traceroute_options_t traceroute_options = {
-        .min_ttl          = OPTIONS_TRACEROUTE_MIN_TTL_DEFAULT,
-        .max_ttl          = OPTIONS_TRACEROUTE_MAX_TTL_DEFAULT,
-        .num_probes       = OPTIONS_TRACEROUTE_NUM_QUERIES_DEFAULT,
-        .max_undiscovered = OPTIONS_TRACEROUTE_MAX_UNDISCOVERED_DEFAULT,
-        .dst_addr         = NULL,
-        .do_resolv        = OPTIONS_TRACEROUTE_DO_RESOLV_DEFAULT,
-        .resolv_asn       = OPTIONS_TRACEROUTE_RESOLV_ASN_DEFAULT,
+        .min_ttl           = OPTIONS_TRACEROUTE_MIN_TTL_DEFAULT,
+        .max_ttl           = OPTIONS_TRACEROUTE_MAX_TTL_DEFAULT,
+        .num_probes        = OPTIONS_TRACEROUTE_NUM_QUERIES_DEFAULT,
+        .max_undiscovered  = OPTIONS_TRACEROUTE_MAX_UNDISCOVERED_DEFAULT,
+        .num_parallel_hops = OPTIONS_TRACEROUTE_NUM_PARALLEL_HOPS_DEFAULT,
+        .dst_addr          = NULL,
+        .do_resolv         = OPTIONS_TRACEROUTE_DO_RESOLV_DEFAULT,
+        .resolv_asn        = OPTIONS_TRACEROUTE_RESOLV_ASN_DEFAULT,
+        .stopset           = NULL,
+        .initial_ttl       = 0,
+        .retain_probes     = false,
     };
     return traceroute_options;
 };
@@ -100,11 +117,8 @@ static traceroute_data_t * traceroute_data_create() {
     traceroute_data_t * traceroute_data;
 
     if (!(traceroute_data = calloc(1, sizeof(traceroute_data_t)))) goto ERR_MALLOC;
-    if (!(traceroute_data->probes = dynarray_create()))            goto ERR_PROBES;
     return traceroute_data;
 
-ERR_PROBES:
-    free(traceroute_data);
 ERR_MALLOC:
     return NULL;
 }
@@ -115,71 +129,138 @@ ERR_MALLOC:
  */
 
 static void traceroute_data_free(traceroute_data_t * traceroute_data) {
+    size_t i, j;
+
     if (traceroute_data) {
-        if (traceroute_data->probes) {
-            // TODO this will provoke a double free
-            // dynarray_free(traceroute_data->probes, (ELEMENT_FREE) probe_free);
+        // The probes in flight are released by the network layer
+        if (traceroute_data->probes)  dynarray_free(traceroute_data->probes,  (ELEMENT_FREE) probe_free);
+        if (traceroute_data->replies) dynarray_free(traceroute_data->replies, (ELEMENT_FREE) probe_free);
+        if (traceroute_data->pending) {
+            // Release the events of the hops that have not been reported
+            for (i = 0; i < traceroute_data->num_hops; i++) {
+                for (j = 0; j < traceroute_data->num_pending[i]; j++) {
+                    event_free(traceroute_data->pending[i * traceroute_data->num_probes + j]);
+                }
+            }
+            free(traceroute_data->pending);
+            free(traceroute_data->num_pending);
         }
         free(traceroute_data);
     }
 }
 
+/**
+ * \brief Allocate the slots storing the events received out of order
+ *    (see traceroute_options_t::num_parallel_hops).
+ * \param traceroute_data The traceroute_data_t instance.
+ * \param options The options of this traceroute instance.
+ * \return true iif successful
+ */
+
+static bool traceroute_data_init_pending(traceroute_data_t * traceroute_data, const traceroute_options_t * options) {
+    traceroute_data->num_hops   = options->max_ttl - options->min_ttl + 1;
+    traceroute_data->num_probes = options->num_probes;
+    if (!(traceroute_data->num_pending = calloc(traceroute_data->num_hops, sizeof(size_t)))) goto ERR_NUM_PENDING;
+    if (!(traceroute_data->pending = malloc(traceroute_data->num_hops * options->num_probes * sizeof(event_t *)))) goto ERR_PENDING;
+    return true;
+
+ERR_PENDING:
+    free(traceroute_data->num_pending);
+    traceroute_data->num_pending = NULL;
+ERR_NUM_PENDING:
+    return false;
+}
+
+/**
+ * \brief Allocate the arrays retaining the probes and the replies
+ *    (see traceroute_options_t::retain_probes).
+ * \param traceroute_data The traceroute_data_t instance.
+ * \return true iif successful
+ */
+
+static bool traceroute_data_init_retained(traceroute_data_t * traceroute_data) {
+    if (!(traceroute_data->probes  = dynarray_create())) goto ERR_PROBES;
+    if (!(traceroute_data->replies = dynarray_create())) goto ERR_REPLIES;
+    return true;
+
+ERR_REPLIES:
+    dynarray_free(traceroute_data->probes, NULL);
+    traceroute_data->probes = NULL;
+ERR_PROBES:
+    return false;
+}
+
+/**
+ * \brief Retain a probe or a reply if the instance retains them
+ *    (see traceroute_options_t::retain_probes).
+ * \param retained traceroute_data_t::probes or traceroute_data_t::replies.
+ * \param probe The probe or the reply.
+ * \return true iif successful
+ */
+
+static bool traceroute_retain(dynarray_t * retained, probe_t * probe) {
+    if (!retained) return true;
+    if (!dynarray_push_element(retained, probe_ref(probe))) {
+        probe_free(probe);
+        return false;
+    }
+    return true;
+}
+
 //-----------------------------------------------------------------
 // Traceroute default handler
 //-----------------------------------------------------------------
 
-static inline void ttl_dump(const probe_t * probe) {
+static inline void ttl_dump(FILE * out, const probe_t * probe) {
     uint8_t ttl;
-    if (probe_extract(probe, "ttl", &ttl)) printf("%2d ", ttl);
+    if (probe_extract(probe, "ttl", &ttl)) fprintf(out, "%2d ", ttl);
 }
 
-static inline void discovered_ip_dump(const probe_t * reply, bool do_resolv, bool resolv_asn) {
+static inline void discovered_ip_dump(FILE * out, const probe_t * reply, bool do_resolv, bool resolv_asn) {
     address_t   discovered_addr;
     char      * discovered_hostname;
 
     if (probe_extract(reply, "src_ip", &discovered_addr)) {
-        printf(" ");
+        fprintf(out, " ");
         if (do_resolv) {
             if (address_resolv(&discovered_addr, &discovered_hostname, CACHE_ENABLED)) {
-                printf("%s", discovered_hostname);
+                fprintf(out, "%s", discovered_hostname);
                 free(discovered_hostname);
             } else {
-                address_dump(&discovered_addr);
+                address_fdump(out, &discovered_addr);
             }
-            printf(" (");
+            fprintf(out, " (");
         }
 
-        address_dump(&discovered_addr);
+        address_fdump(out, &discovered_addr);
 
         if (do_resolv) {
-            printf(")");
+            fprintf(out, ")");
         }
 
 		if (resolv_asn) {
 			uint32_t asn = 0;
 			bool found = whois_get_asn(&discovered_addr, &asn, CACHE_ENABLED);
 			if (found) {
-				printf(" [AS%u]", asn);
+				fprintf(out, " [AS%u]", asn);
 			}
 		}
     }
 }
 
-static inline void delay_dump(const probe_t * probe, const probe_t * reply) {
-    double send_time = probe_get_sending_time(probe),
-           recv_time = probe_get_recv_time(reply);
-    printf("  %-5.3lfms  ", 1000 * (recv_time - send_time));
+static inline void delay_dump(FILE * out, const probe_t * probe, const probe_t * reply) {
+    int64_t rtt = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+    fprintf(out, "  %-5.3lfms  ", rtt / 1000000.0);
 }
 
-void traceroute_handler(
-    pt_loop_t                  * loop,
-    traceroute_event_t         * traceroute_event,
+void traceroute_event_fdump(
+    FILE                       * out,
+    const traceroute_event_t   * traceroute_event,
     const traceroute_options_t * traceroute_options,
-    const traceroute_data_t    * traceroute_data
+    size_t                     * pnum_probes_printed
 ) {
     const probe_t * probe;
     const probe_t * reply;
-    static size_t   num_probes_printed = 0;
 
     switch (traceroute_event->type) {
         case TRACEROUTE_PROBE_REPLY:
@@ -189,29 +270,29 @@ void traceroute_handler(
             reply = ((const probe_reply_t *) traceroute_event->data)->reply;
 
             // Print TTL and discovered IP if this is the first probe related to this TTL
-            if (num_probes_printed % traceroute_options->num_probes == 0) {
-                ttl_dump(probe);
-                discovered_ip_dump(reply, traceroute_options->do_resolv, traceroute_options->resolv_asn);
+            if (*pnum_probes_printed % traceroute_options->num_probes == 0) {
+                ttl_dump(out, probe);
+                discovered_ip_dump(out, reply, traceroute_options->do_resolv, traceroute_options->resolv_asn);
             }
 
             // Print delay
-            delay_dump(probe, reply);
-            fflush(stdout);
-            num_probes_printed++;
+            delay_dump(out, probe, reply);
+            fflush(out);
+            (*pnum_probes_printed)++;
             break;
 
         case TRACEROUTE_STAR:
             probe = (const probe_t *) traceroute_event->data;
-            if (num_probes_printed % traceroute_options->num_probes == 0) {
-                ttl_dump(probe);
+            if (*pnum_probes_printed % traceroute_options->num_probes == 0) {
+                ttl_dump(out, probe);
             }
-            printf(" *");
-            num_probes_printed++;
+            fprintf(out, " *");
+            (*pnum_probes_printed)++;
             break;
 
         case TRACEROUTE_ICMP_ERROR:
-            printf(" !");
-            num_probes_printed++;
+            fprintf(out, " !");
+            (*pnum_probes_printed)++;
             break;
 
         case TRACEROUTE_DESTINATION_REACHED:
@@ -221,11 +302,72 @@ void traceroute_handler(
             break;
     }
 
-    if (num_probes_printed % traceroute_options->num_probes == 0) {
-        printf("\n");
+    if (*pnum_probes_printed % traceroute_options->num_probes == 0) {
+        fprintf(out, "\n");
     }
 }
 
+bool traceroute_event_output(
+    output_t                   * output,
+    const traceroute_event_t   * traceroute_event,
+    const traceroute_options_t * traceroute_options
+) {
+    const probe_t   * probe;
+    const probe_t   * reply;
+    output_record_t   record;
+    address_t         discovered_addr;
+    char            * discovered_hostname = NULL;
+    bool              ret;
+
+    memset(&record, 0, sizeof(output_record_t));
+    record.dst = traceroute_options->dst_addr;
+
+    switch (traceroute_event->type) {
+        case TRACEROUTE_PROBE_REPLY:
+            probe = ((const probe_reply_t *) traceroute_event->data)->probe;
+            reply = ((const probe_reply_t *) traceroute_event->data)->reply;
+            if (!probe_extract(reply, "src_ip", &discovered_addr)) return false;
+
+            record.type = OUTPUT_RECORD_REPLY;
+            record.from = &discovered_addr;
+            record.rtt  = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+            if (traceroute_options->do_resolv
+            &&  address_resolv(&discovered_addr, &discovered_hostname, CACHE_ENABLED)) {
+                record.hostname = discovered_hostname;
+            }
+            if (traceroute_options->resolv_asn) {
+                whois_get_asn(&discovered_addr, &record.asn, CACHE_ENABLED);
+            }
+            break;
+        case TRACEROUTE_STAR:
+            probe = (const probe_t *) traceroute_event->data;
+            record.type = OUTPUT_RECORD_STAR;
+            break;
+        case TRACEROUTE_ICMP_ERROR:
+            probe = (const probe_t *) traceroute_event->data;
+            record.type = OUTPUT_RECORD_ERROR;
+            break;
+        default:
+            return true;
+    }
+
+    probe_extract(probe, "ttl", &record.ttl);
+    ret = output_write_record(output, &record);
+    if (discovered_hostname) free(discovered_hostname);
+    return ret;
+}
+
+void traceroute_handler(
+    pt_loop_t                  * loop,
+    traceroute_event_t         * traceroute_event,
+    const traceroute_options_t * traceroute_options,
+    const traceroute_data_t    * traceroute_data
+) {
+    static size_t num_probes_printed = 0;
+
+    traceroute_event_fdump(stdout, traceroute_event, traceroute_options, &num_probes_printed);
+}
+
 
 //-----------------------------------------------------------------
 // Traceroute algorithm
@@ -242,7 +384,7 @@ static inline bool destination_reached(const address_t * dst_addr, const probe_t
     address_t   discovered_addr;
 
     if (probe_extract(reply, "src_ip", &discovered_addr)) {
-        ret = (address_compare(dst_addr, &discovered_addr) == 0);
+        ret = address_equals(dst_addr, &discovered_addr);
     }
     return ret;
 }
@@ -271,12 +413,20 @@ static bool send_traceroute_probe(
         delay = i * probe_get_delay(probe_skel);
         probe_set_delay(probe, DOUBLE("delay", delay));
     }
-    if (!probe_set_fields(probe, I8("ttl", ttl), NULL))         goto ERR_PROBE_SET_FIELDS;
-    if (!dynarray_push_element(traceroute_data->probes, probe)) goto ERR_PROBE_PUSH_ELEMENT;
 
-    return pt_send_probe(loop, probe);
+    // The skeleton has been finalized in ALGORITHM_INIT and the checksums
+    // are computed by the network layer, so we only have to store the TTL.
+    if (traceroute_data->has_ttl_field) {
+        if (!probe_write_resolved_field(probe, &traceroute_data->ttl_field, ttl)) goto ERR_PROBE_SET_FIELDS;
+    } else if (!probe_set_fields_deferred(probe, I8("ttl", ttl), NULL)) goto ERR_PROBE_SET_FIELDS;
+    if (!traceroute_retain(traceroute_data->probes, probe))    goto ERR_RETAIN;
 
-ERR_PROBE_PUSH_ELEMENT:
+    // The network layer now holds this probe
+    if (!pt_send_probe(loop, probe)) goto ERR_PT_SEND_PROBE;
+    return true;
+
+ERR_PT_SEND_PROBE:
+ERR_RETAIN:
 ERR_PROBE_SET_FIELDS:
     probe_free(probe);
 ERR_PROBE_DUP:
@@ -310,11 +460,13 @@ ERR_PROBE_DUP:
 */
 
 /**
- * \brief Send n traceroute probes toward a destination with a given TTL
+ * \brief Send n traceroute probes toward a destination for each TTL of
+ *    a range of consecutive TTLs.
  * \param pt_loop The paris traceroute loop
  * \param probe_skel The probe skeleton used to craft the probe packet
- * \param num_probes The amount of probe to send
- * \param ttl Time To Live related to our probe
+ * \param num_probes The amount of probe to send per TTL
+ * \param ttl Time To Live related to the first probes
+ * \param num_hops The number of consecutive TTLs to probe
  * \return true if successful
  */
 
@@ -323,14 +475,319 @@ bool send_traceroute_probes(
     traceroute_data_t * traceroute_data,
     probe_t           * probe_skel,
     size_t              num_probes,
-    uint8_t             ttl
+    uint8_t             ttl,
+    size_t              num_hops
 ) {
-    size_t i;
+    probe_t             * probes[TRACEROUTE_BATCH_SIZE];
+    probe_field_range_t   ttl_range;
+    size_t                i, j, num_stamped, offset,
+                          num_total = num_hops * num_probes;
+
+    // The TTL cannot be stamped, craft the probes one by one
+    if (!traceroute_data->has_ttl_field) {
+        for (i = 0; i < num_total; ++i) {
+            if (!(send_traceroute_probe(loop, traceroute_data, probe_skel, ttl + i / num_probes, i + 1))) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-    for (i = 0; i < num_probes; ++i) {
-        if (!(send_traceroute_probe(loop, traceroute_data, probe_skel, ttl, i + 1))) {
-            return false;
+    // The probes of a given TTL are consecutive
+    ttl_range.field  = traceroute_data->ttl_field;
+    ttl_range.step   = 1;
+    ttl_range.period = num_probes;
+
+    for (i = 0; i < num_total; i += num_stamped) {
+        // A batch either starts with the first probe of a TTL (and then
+        // carries as many whole TTLs as possible) or ends the current TTL.
+        offset = i % num_probes;
+        num_stamped = offset ? num_probes - offset :
+            num_probes <= TRACEROUTE_BATCH_SIZE ? TRACEROUTE_BATCH_SIZE - TRACEROUTE_BATCH_SIZE % num_probes :
+            TRACEROUTE_BATCH_SIZE;
+        num_stamped = MIN(MIN(num_stamped, num_total - i), TRACEROUTE_BATCH_SIZE);
+        ttl_range.first = ttl + i / num_probes;
+        if (!probe_skel_stamp(probe_skel, probes, num_stamped, &ttl_range, 1)) goto ERR_PROBE_SKEL_STAMP;
+
+        for (j = 0; j < num_stamped; j++) {
+            if (probe_get_delay(probes[j]) != DELAY_BEST_EFFORT) {
+                probe_set_delay(probes[j], DOUBLE("delay", (i + j + 1) * probe_get_delay(probe_skel)));
+            }
+            if (!traceroute_retain(traceroute_data->probes, probes[j])) goto ERR_RETAIN;
         }
+        if (!pt_send_probes(loop, probes, num_stamped)) goto ERR_PT_SEND_PROBES;
+    }
+    return true;
+
+ERR_RETAIN:
+    for (j = 0; j < num_stamped; j++) probe_free(probes[j]);
+ERR_PT_SEND_PROBES:
+    // The network layer has released the probes it could not queue
+ERR_PROBE_SKEL_STAMP:
+    fprintf(stderr, "Error in send_traceroute_probes\n");
+    return false;
+}
+
+/**
+ * \brief Update the counters of a traceroute instance according to a reply
+ *    or a probe timeout, record its result (see results.h), and notify the
+ *    caller.
+ * \param loop The main loop
+ * \param data Data attached to this instance of traceroute algorithm
+ * \param options Options attached to this instance of traceroute algorithm
+ * \param event A PROBE_REPLY or a PROBE_TIMEOUT event
+ */
+
+static void traceroute_account_event(
+    pt_loop_t                  * loop,
+    traceroute_data_t          * data,
+    const traceroute_options_t * options,
+    const event_t              * event
+) {
+    const probe_reply_t * probe_reply;
+    address_t             interface;
+
+    switch (event->type) {
+        case PROBE_REPLY:
+            probe_reply = (const probe_reply_t *) event->data;
+
+            // Reinitialize star counters, check wether we've discovered an IP address
+            data->num_stars = 0;
+            data->num_undiscovered = 0;
+            ++(data->num_replies);
+            data->destination_reached |= destination_reached(options->dst_addr, probe_reply->reply);
+            if (!traceroute_retain(data->replies, probe_reply->reply)) {
+                fprintf(stderr, "traceroute: cannot retain the reply\n");
+            }
+            if (!results_add_hop(pt_get_results(loop), probe_reply->probe, probe_reply->reply)) {
+                fprintf(stderr, "traceroute: cannot record the reply\n");
+            }
+
+            // Doubletree: check whether this interface is known, then share it
+            if (options->stopset && probe_extract(probe_reply->reply, "src_ip", &interface)) {
+                data->stop_set_reached |= data->is_backward ?
+                    stopset_has_interface(options->stopset, &interface, data) :
+                    stopset_has_pair(options->stopset, &interface, options->dst_addr, data);
+                if (!stopset_add(options->stopset, &interface, options->dst_addr, data)) {
+                    fprintf(stderr, "traceroute: cannot update the stop set\n");
+                }
+            }
+
+            // Notify the caller we've discovered an IP address, once its
+            // hostname and AS are known if the caller prints them
+            pt_raise_event_resolved(
+                loop,
+                event_create_probe_reply(TRACEROUTE_PROBE_REPLY, probe_reply->probe, probe_reply->reply, NULL),
+                probe_extract(probe_reply->reply, "src_ip", &interface) ? &interface : NULL,
+                (options->do_resolv  ? PT_LOOKUP_HOSTNAME : 0)
+              | (options->resolv_asn ? PT_LOOKUP_ASN      : 0)
+            );
+            break;
+
+        case PROBE_TIMEOUT:
+            // Update counters
+            ++(data->num_stars);
+            ++(data->num_replies);
+            if (!results_add_hop(pt_get_results(loop), event->data, NULL)) {
+                fprintf(stderr, "traceroute: cannot record the star\n");
+            }
+
+            // Notify the caller we've got a probe timeout
+            pt_raise_event(loop, event_create(TRACEROUTE_STAR, probe_ref(event->data), NULL, (ELEMENT_FREE) probe_free));
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * \brief Check whether the forward probing of a traceroute instance must
+ *    stop once a hop has been entirely accounted (see traceroute_account_event).
+ *    If so, the reason is notified to the caller.
+ * \param loop The main loop
+ * \param data Data attached to this instance of traceroute algorithm
+ * \param options Options attached to this instance of traceroute algorithm
+ * \param ttl The TTL of this hop
+ * \return true iif no further hop must be explored
+ */
+
+static bool traceroute_is_last_hop(
+    pt_loop_t                  * loop,
+    traceroute_data_t          * data,
+    const traceroute_options_t * options,
+    uint8_t                      ttl
+) {
+    if (data->destination_reached) {
+        // We've reached the destination
+        pt_raise_event(loop, event_create(TRACEROUTE_DESTINATION_REACHED, NULL, NULL, NULL));
+    } else if (data->stop_set_reached) {
+        // Doubletree: the remainder of the path is already known
+        pt_raise_event(loop, event_create(TRACEROUTE_STOP_SET_REACHED, NULL, NULL, NULL));
+    } else if (ttl >= options->max_ttl) {
+        // We've reached the maximum TTL
+        pt_raise_event(loop, event_create(TRACEROUTE_MAX_TTL_REACHED, NULL, NULL, NULL));
+    } else if (data->num_stars == options->num_probes
+           && ++(data->num_undiscovered) == options->max_undiscovered) {
+        // We've only discovered stars for the last "max_undiscovered" hops, so give up
+        pt_raise_event(loop, event_create(TRACEROUTE_TOO_MANY_STARS, NULL, NULL, NULL));
+    } else {
+        // Explore the next hop, even if we've only discovered stars for this one
+        data->num_stars = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Probe the next hop below the first probed hop once the forward
+ *    probing is over (Doubletree backward probing), or terminate the
+ *    instance if there is no such hop to probe.
+ * \param loop The main loop
+ * \param data Data attached to this instance of traceroute algorithm
+ * \param options Options attached to this instance of traceroute algorithm
+ * \param probe_skel The probe skeleton used to craft the probe packets
+ * \return true iif successful
+ */
+
+static bool traceroute_explore_backward(
+    pt_loop_t                  * loop,
+    traceroute_data_t          * data,
+    const traceroute_options_t * options,
+    probe_t                    * probe_skel
+) {
+    // Lowest hop probed so far
+    uint8_t ttl = data->is_backward ? data->ttl : data->first_ttl;
+
+    if (data->is_backward && data->stop_set_reached) {
+        // The beginning of the path is already known
+        pt_raise_event(loop, event_create(TRACEROUTE_STOP_SET_REACHED, NULL, NULL, NULL));
+    } else if (ttl > options->min_ttl) {
+        data->is_backward = true;
+        data->stop_set_reached = false;
+        data->ttl = ttl - 1;
+        return send_traceroute_probes(loop, data, probe_skel, options->num_probes, data->ttl, 1);
+    }
+
+    pt_raise_terminated(loop);
+    return true;
+}
+
+/**
+ * \brief Retrieve the TTL of a probe sent by a traceroute instance.
+ * \param data Data attached to this instance of traceroute algorithm
+ * \param probe The probe
+ * \return The TTL of the probe, 0 if it cannot be extracted.
+ */
+
+static uint8_t traceroute_get_probe_ttl(const traceroute_data_t * data, const probe_t * probe) {
+    uintmax_t value;
+    uint8_t   ttl = 0;
+
+    if (data->has_ttl_field) {
+        if (probe_extract_resolved_field(probe, &data->ttl_field, &value)) ttl = value;
+    } else {
+        probe_extract(probe, "ttl", &ttl);
+    }
+    return ttl;
+}
+
+/**
+ * \brief (Parallel hops) Probe the hops entering the window of a traceroute
+ *    instance, which spans num_parallel_hops hops from the first hop not
+ *    reported yet. No hop is probed beyond the destination.
+ * \param loop The main loop
+ * \param data Data attached to this instance of traceroute algorithm
+ * \param options Options attached to this instance of traceroute algorithm
+ * \param probe_skel The probe skeleton used to craft the probe packets
+ * \return true iif successful
+ */
+
+static bool traceroute_send_window(
+    pt_loop_t                  * loop,
+    traceroute_data_t          * data,
+    const traceroute_options_t * options,
+    probe_t                    * probe_skel
+) {
+    size_t first = data->first_ttl + data->num_sent_hops,
+           last  = MIN(data->ttl + options->num_parallel_hops - 1, options->max_ttl);
+
+    if (data->dst_ttl) last = MIN(last, data->dst_ttl);
+    if (first > last) return true;
+
+    if (!send_traceroute_probes(loop, data, probe_skel, options->num_probes, first, last - first + 1)) {
+        return false;
+    }
+    data->num_sent_hops += last - first + 1;
+    data->num_flying += (last - first + 1) * options->num_probes;
+    return true;
+}
+
+/**
+ * \brief (Parallel hops) Handle a reply or a probe timeout. The event is
+ *    kept until every previous hop is complete. Then the complete hops are
+ *    reported in order, and the window slides accordingly.
+ * \param loop The main loop
+ * \param data Data attached to this instance of traceroute algorithm
+ * \param options Options attached to this instance of traceroute algorithm
+ * \param probe_skel The probe skeleton used to craft the probe packets
+ * \param event A PROBE_REPLY or a PROBE_TIMEOUT event
+ * \return true iif successful
+ */
+
+static bool traceroute_handle_parallel_hops(
+    pt_loop_t                  * loop,
+    traceroute_data_t          * data,
+    const traceroute_options_t * options,
+    probe_t                    * probe_skel,
+    event_t                    * event
+) {
+    const probe_t * probe;
+    event_t      ** events;
+    size_t          i, hop;
+    uint8_t         ttl;
+
+    probe = event->type == PROBE_REPLY ? ((const probe_reply_t *) event->data)->probe : event->data;
+    ttl = traceroute_get_probe_ttl(data, probe);
+    --(data->num_flying);
+
+    // Results of hops already reported or beyond the last reported hop are ignored
+    if (!data->is_finished && ttl >= data->ttl && ttl <= options->max_ttl) {
+        hop = ttl - options->min_ttl;
+        if (data->num_pending[hop] < options->num_probes) {
+            if (event->type == PROBE_REPLY
+            &&  (!data->dst_ttl || ttl < data->dst_ttl)
+            &&  destination_reached(options->dst_addr, ((const probe_reply_t *) event->data)->reply)
+            ) {
+                data->dst_ttl = ttl;
+            }
+            data->pending[hop * options->num_probes + data->num_pending[hop]++] = event_ref(event);
+        }
+    }
+
+    // Report the complete hops in order. The caller gets our reference on their events.
+    while (!data->is_finished
+        && data->num_pending[hop = data->ttl - options->min_ttl] == options->num_probes
+    ) {
+        events = &data->pending[hop * options->num_probes];
+        for (i = 0; i < options->num_probes; i++) {
+            traceroute_account_event(loop, data, options, events[i]);
+            pt_throw(loop, loop->cur_instance->caller, events[i]);
+        }
+        data->num_pending[hop] = 0;
+
+        if (traceroute_is_last_hop(loop, data, options, data->ttl)) {
+            data->is_finished = true;
+        } else {
+            (data->ttl)++;
+            if (!traceroute_send_window(loop, data, options, probe_skel)) return false;
+        }
+    }
+
+    // Wait for the probes still in transit before probing backward or
+    // terminating, as their replies are delivered to this instance.
+    if (data->is_finished && !data->num_flying) {
+        return traceroute_explore_backward(loop, data, options, probe_skel);
     }
     return true;
 }
@@ -349,18 +806,17 @@ bool send_traceroute_probes(
 int traceroute_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
 {
     traceroute_data_t    * data = NULL;     // Current state of the algorithm instance
-    probe_t              * probe;           // Probe
-    const probe_t        * reply;           // Reply
-    probe_reply_t        * probe_reply;     // (Probe, Reply) pair
     traceroute_options_t * options = opts;  // Options passed to this instance
-    bool                   discover_next_hop = false;
     bool                   has_terminated = false;
 
     switch (event->type) {
 
         case ALGORITHM_INIT:
             // Check options
-            if (!options || options->min_ttl > options->max_ttl) {
+            if (!options
+            ||  options->min_ttl > options->max_ttl
+            ||  (options->initial_ttl && (options->initial_ttl < options->min_ttl || options->initial_ttl > options->max_ttl))
+            ) {
                 fprintf(stderr, "Invalid traceroute options\n");
                 errno = EINVAL;
                 goto FAILURE;
@@ -371,34 +827,41 @@ int traceroute_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, pr
                 goto FAILURE;
             }
             *pdata = data;
-            data->ttl = options->min_ttl;
-            break;
-
-        case PROBE_REPLY:
-            data        = *pdata;
-            probe_reply = (probe_reply_t *) event->data;
-            reply       = probe_reply->reply;
+            if (options->retain_probes && !traceroute_data_init_retained(data)) {
+                goto FAILURE;
+            }
+            data->ttl = options->stopset && options->initial_ttl ? options->initial_ttl : options->min_ttl;
+            data->first_ttl = data->ttl;
 
-            // Reinitialize star counters, check wether we've discovered an IP address
-            data->num_stars = 0;
-            data->num_undiscovered = 0;
-            ++(data->num_replies);
-            data->destination_reached |= destination_reached(options->dst_addr, reply);
+            // Finalize the skeleton once for all (e.g. its source IP), so
+            // that each probe only differs from it by its TTL
+            if (probe_update_fields(probe_skel)) {
+                data->has_ttl_field = probe_resolve_field(probe_skel, "ttl", &data->ttl_field);
+            }
 
-            // Notify the caller we've discovered an IP address
-            pt_raise_event(loop, event_create(TRACEROUTE_PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+            // Probe the first hops at once
+            if (options->num_parallel_hops > 1) {
+                if (!traceroute_data_init_pending(data, options)
+                ||  !traceroute_send_window(loop, data, options, probe_skel)
+                ) {
+                    goto FAILURE;
+                }
+            }
             break;
 
+        case PROBE_REPLY:
         case PROBE_TIMEOUT:
-            data  = *pdata;
-            probe = (probe_t *) event->data;
-
-            // Update counters
-            ++(data->num_stars);
-            ++(data->num_replies);
-
-            // Notify the caller we've got a probe timeout
-            pt_raise_event(loop, event_create(TRACEROUTE_STAR, probe, NULL, (ELEMENT_FREE) probe_free));
+            data = *pdata;
+
+            // The events are forwarded to the caller once their hop is reported
+            // (the backward probing is performed hop by hop).
+            if (options->num_parallel_hops > 1 && !data->is_backward) {
+                if (!traceroute_handle_parallel_hops(loop, data, options, probe_skel, event)) {
+                    goto FAILURE;
+                }
+                return 0;
+            }
+            traceroute_account_event(loop, data, options, event);
             break;
 
         case ALGORITHM_TERM:
@@ -412,46 +875,37 @@ int traceroute_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, pr
         case ALGORITHM_ERROR:
             goto FAILURE;
 
+        case PROBE_REPLY_DUPLICATE:
+        case PROBE_REPLY_LATE:
+            // Its probe has already been accounted for
+            return 0;
+
+        case NETWORK_READY:
+            // This algorithm does not wait for credits
+            return 0;
+
         default:
             break;
     }
 
-    // Forward event to the caller
-    pt_throw(loop, loop->cur_instance->caller, event);
+    // Forward event to the caller, which gets its own reference
+    pt_throw(loop, loop->cur_instance->caller, event_ref(event));
 
     // Explore next hop
-    if ((data->num_replies % options->num_probes) == 0) {
-        if (data->destination_reached) {
-            // We've reached the destination
-            pt_raise_event(loop, event_create(TRACEROUTE_DESTINATION_REACHED, NULL, NULL, NULL));
-            pt_raise_terminated(loop);
-        } else if (data->ttl > options->max_ttl) {
-            // We've reached the maximum TTL
-            pt_raise_event(loop, event_create(TRACEROUTE_MAX_TTL_REACHED, NULL, NULL, NULL));
-            pt_raise_terminated(loop);
-        } else if (data->num_stars == options->num_probes) {
-            // We've only discovered stars for the current hop
-            ++(data->num_undiscovered);
-            if (data->num_undiscovered == options->max_undiscovered) {
-                // We've only discovered stars for the last "max_undiscovered" hops, so give up
-                pt_raise_event(loop, event_create(TRACEROUTE_TOO_MANY_STARS, NULL, NULL, NULL));
-                pt_raise_terminated(loop);
-            } else {
-                // Skip this hop and explore the next one
-                discover_next_hop = true;
+    if ((options->num_parallel_hops <= 1 || data->is_backward) && (data->num_replies % options->num_probes) == 0) {
+        if (event->type != ALGORITHM_INIT
+        && (data->is_backward || traceroute_is_last_hop(loop, data, options, data->ttl - 1))
+        ) {
+            if (!traceroute_explore_backward(loop, data, options, probe_skel)) {
+                goto FAILURE;
             }
-        } else discover_next_hop = true;
-
-        if (discover_next_hop) {
-            data->num_stars = 0;
-
+        } else {
             // Discover the next hop
-            if (!send_traceroute_probes(loop, data, probe_skel, options->num_probes, data->ttl)) {
+            if (!send_traceroute_probes(loop, data, probe_skel, options->num_probes, data->ttl, 1)) {
                 goto FAILURE;
             }
             (data->ttl)++;
         }
-
     }
 
 HAS_TERMINATED:
@@ -462,13 +916,11 @@ HAS_TERMINATED:
         pt_raise_terminated(loop);
     }
 
-    // Handled event must always been free when leaving the handler
-    event_free(event);
+    // The handled event is released by the algorithm layer when leaving the handler
     return 0;
 
 FAILURE:
-    // Handled event must always been free when leaving the handler
-    event_free(event);
+    // The handled event is released by the algorithm layer when leaving the handler
 
     // Sent to the current instance a ALGORITHM_FAILURE notification.
     // The caller has to free the data allocated by the algorithm.
@@ -4,16 +4,22 @@
 #include <stdbool.h>     // bool
 #include <stdint.h>      // uint*_t
 #include <stddef.h>      // size_t
+#include <stdio.h>       // FILE
 
 #include "../address.h"  // address_t
 #include "../pt_loop.h"  // pt_loop_t
 #include "../dynarray.h" // dynarray_t
+#include "../event.h"    // event_t
 #include "../options.h"  // option_t
+#include "../output.h"   // output_t
+#include "../probe.h"    // probe_field_t
+#include "../stopset.h"  // stopset_t
 
 #define OPTIONS_TRACEROUTE_MIN_TTL_DEFAULT            1
 #define OPTIONS_TRACEROUTE_MAX_TTL_DEFAULT            30
 #define OPTIONS_TRACEROUTE_MAX_UNDISCOVERED_DEFAULT   3
 #define OPTIONS_TRACEROUTE_NUM_QUERIES_DEFAULT        3
+#define OPTIONS_TRACEROUTE_NUM_PARALLEL_HOPS_DEFAULT  1
 #define OPTIONS_TRACEROUTE_DO_RESOLV_DEFAULT          true
 #define OPTIONS_TRACEROUTE_RESOLV_ASN_DEFAULT         false
 
@@ -21,6 +27,7 @@
 #define OPTIONS_TRACEROUTE_MAX_TTL          {OPTIONS_TRACEROUTE_MAX_TTL_DEFAULT,          1, 255}
 #define OPTIONS_TRACEROUTE_MAX_UNDISCOVERED {OPTIONS_TRACEROUTE_MAX_UNDISCOVERED_DEFAULT, 1, 255}
 #define OPTIONS_TRACEROUTE_NUM_QUERIES      {OPTIONS_TRACEROUTE_NUM_QUERIES_DEFAULT,      1, 255}
+#define OPTIONS_TRACEROUTE_NUM_PARALLEL_HOPS {OPTIONS_TRACEROUTE_NUM_PARALLEL_HOPS_DEFAULT, 1, 255}
 
 #define TRACEROUTE_HELP_A "Perform AS path lookups in routing registries and print results directly after the corresponding addresses."
 #define TRACEROUTE_HELP_f "Start from the MIN_TTL hop (instead from 1), MIN_TTL must be between 1 and 255."
@@ -28,12 +35,14 @@
 #define TRACEROUTE_HELP_n "Do not resolve IP addresses to their domain names"
 #define TRACEROUTE_HELP_q "Set the number of probes per hop (default: 3)."
 #define TRACEROUTE_HELP_M "Set the maximum number of consecutive unresponsive hops which causes the program to abort (default 3)."
+#define TRACEROUTE_HELP_N "Set the number of consecutive hops probed simultaneously (default: 1). The results are still reported hop by hop."
 
 // Get the different values of traceroute options
 uint8_t options_traceroute_get_min_ttl();
 uint8_t options_traceroute_get_max_ttl();
 uint8_t options_traceroute_get_num_queries();
 uint8_t options_traceroute_get_max_undiscovered();
+uint8_t options_traceroute_get_num_parallel_hops();
 bool    options_traceroute_get_do_resolv();
 bool    options_traceroute_get_resolv_asn();
 
@@ -63,6 +72,24 @@ bool    options_traceroute_get_resolv_asn();
  *                 EXIT
  *             cur_ttl += 1
  *             SEND
+ *
+ * If num_parallel_hops > 1, the probes of the next num_parallel_hops hops
+ * are sent at once, and the window slides each time its first hop is
+ * complete. The results received out of order are kept until the
+ * previous hops are complete, so that they are still reported hop by hop.
+ * No hop is probed beyond the first one where the destination has replied.
+ *
+ * If a stop set is shared by several instances (Doubletree), the forward
+ * probing starts at initial_ttl, and it stops as soon as a discovered
+ * interface has already been discovered toward the same destination
+ * prefix by another instance. The hops below initial_ttl are then probed
+ * backward, hop by hop, until a discovered interface has already been
+ * discovered by another instance (or min_ttl is reached).
+ *
+ * The probes and the replies are released as soon as their hop has been
+ * reported to the caller, so that the memory of an instance does not grow
+ * with the number of probes sent. An instance may retain them until it is
+ * released (see traceroute_options_t::retain_probes), e.g. to archive them.
  */
 
 //--------------------------------------------------------------------
@@ -70,13 +97,17 @@ bool    options_traceroute_get_resolv_asn();
 //--------------------------------------------------------------------
 
 typedef struct {
-    uint8_t           min_ttl;          /**< Minimum ttl at which to send probes. */
-    uint8_t           max_ttl;          /**< Maximum ttl at which to send probes. */
-    size_t            num_probes;       /**< Number of probes per hop.            */
-    size_t            max_undiscovered; /**< Maximum number of consecutives undiscovered hops. */
-    const address_t * dst_addr;         /**< The target IP. */
-    bool              do_resolv;        /**< Resolv each discovered IP hop. */
-    bool              resolv_asn;       /**< Perform AS path lookups for each discovered IP hop. */
+    uint8_t           min_ttl;           /**< Minimum ttl at which to send probes. */
+    uint8_t           max_ttl;           /**< Maximum ttl at which to send probes. */
+    size_t            num_probes;        /**< Number of probes per hop.            */
+    size_t            max_undiscovered;  /**< Maximum number of consecutives undiscovered hops. */
+    size_t            num_parallel_hops; /**< Number of consecutive hops probed simultaneously (1: hop by hop). */
+    const address_t * dst_addr;          /**< The target IP. */
+    bool              do_resolv;         /**< Resolv each discovered IP hop. */
+    bool              resolv_asn;        /**< Perform AS path lookups for each discovered IP hop. */
+    stopset_t       * stopset;           /**< Doubletree stop set shared by several instances (NULL: disabled). */
+    uint8_t           initial_ttl;       /**< Doubletree: TTL at which the forward probing starts (0: min_ttl). */
+    bool              retain_probes;     /**< Keep the probes and the replies until the instance is released (see traceroute_data_t::probes). */
 } traceroute_options_t;
 
 const option_t * traceroute_get_options();
@@ -97,7 +128,8 @@ typedef enum {
     TRACEROUTE_ICMP_ERROR,          // | probe_t *       | The probe which has provoked the ICMP error
     TRACEROUTE_STAR,                // | probe_t *       | The probe which has been lost
     TRACEROUTE_MAX_TTL_REACHED,     // | NULL            | N/A
-    TRACEROUTE_TOO_MANY_STARS       // | NULL            | N/A
+    TRACEROUTE_TOO_MANY_STARS,      // | NULL            | N/A
+    TRACEROUTE_STOP_SET_REACHED     // | NULL            | N/A (see traceroute_options_t::stopset)
 } traceroute_event_type_t;
 
 // TODO since this structure should exactly match with a standard event_t, define a macro allowing to define custom events
@@ -111,11 +143,25 @@ typedef struct {
 
 typedef struct {
     bool          destination_reached; /**< True iif the destination has been reached at least once for the current TTL */
-    uint8_t       ttl;                 /**< TTL currently explored                   */
+    uint8_t       ttl;                 /**< TTL currently explored (parallel hops: next hop to report) */
     size_t        num_replies;         /**< Total of probe sent for this instance    */
     size_t        num_undiscovered;    /**< Number of consecutive undiscovered hops  */
     size_t        num_stars;           /**< Number of probe lost for the current hop */
-    dynarray_t  * probes;              /**< Probe instances allocated by traceroute  */
+    dynarray_t  * probes;              /**< (Retained) The probes sent so far, NULL unless traceroute_options_t::retain_probes is set */
+    dynarray_t  * replies;             /**< (Retained) The replies received so far, NULL unless traceroute_options_t::retain_probes is set */
+    probe_field_t ttl_field;           /**< The "ttl" field of the probe skeleton    */
+    bool          has_ttl_field;       /**< True iif ttl_field has been resolved     */
+    event_t    ** pending;             /**< (Parallel hops) num_probes slots per hop (from min_ttl) storing the events not reported yet */
+    size_t        num_hops;            /**< (Parallel hops) Number of hops between min_ttl and max_ttl */
+    size_t        num_probes;          /**< (Parallel hops) Number of slots per hop */
+    size_t      * num_pending;         /**< (Parallel hops) Number of events stored in pending for each hop */
+    size_t        num_sent_hops;       /**< (Parallel hops) Number of hops probed so far, from min_ttl */
+    uint8_t       dst_ttl;             /**< (Parallel hops) Smallest TTL at which the destination has replied, 0 if none */
+    size_t        num_flying;          /**< (Parallel hops) Number of probes sent and neither replied nor expired */
+    bool          is_finished;         /**< (Parallel hops) True iif no more hop has to be reported */
+    uint8_t       first_ttl;           /**< TTL at which the forward probing has started */
+    bool          is_backward;         /**< (Doubletree) True iif the hops below first_ttl are being probed */
+    bool          stop_set_reached;    /**< (Doubletree) True iif an interface of the stop set has been discovered */
 } traceroute_data_t;
 
 //-----------------------------------------------------------------
@@ -137,4 +183,38 @@ void traceroute_handler(
     const traceroute_data_t    * traceroute_data
 );
 
+/**
+ * \brief Print a traceroute_event_t event in a given stream. Unlike
+ *    traceroute_handler, it may be used to print the events of several
+ *    concurrent traceroute instances.
+ * \param out The output stream.
+ * \param traceroute_event The printed event.
+ * \param traceroute_options Options related to this instance of traceroute.
+ * \param pnum_probes_printed Points to the number of probes printed so
+ *    far for this instance (initially 0). It is updated accordingly.
+ */
+
+void traceroute_event_fdump(
+    FILE                       * out,
+    const traceroute_event_t   * traceroute_event,
+    const traceroute_options_t * traceroute_options,
+    size_t                     * pnum_probes_printed
+);
+
+/**
+ * \brief Write a traceroute_event_t event as a record of a structured
+ *    output (see output.h). Only the replies, stars and ICMP errors
+ *    produce a record.
+ * \param output The output_t instance.
+ * \param traceroute_event The event.
+ * \param traceroute_options Options related to this instance of traceroute.
+ * \return true iif successful.
+ */
+
+bool traceroute_event_output(
+    output_t                   * output,
+    const traceroute_event_t   * traceroute_event,
+    const traceroute_options_t * traceroute_options
+);
+
 #endif
@@ -0,0 +1,602 @@
+#include "config.h"
+
+#include <stdlib.h>     // malloc, realloc, free, qsort, mkstemp
+#include <stdio.h>      // fdopen, fwrite, fprintf, snprintf, sscanf
+#include <string.h>     // memcmp, memcpy, memset, strdup, strlen
+#include <errno.h>      // errno
+#include <fcntl.h>      // open
+#include <unistd.h>     // close, link, unlink
+#include <time.h>       // clock_gettime
+#include <dirent.h>     // opendir, readdir, closedir
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat, fchmod, mkdir
+
+#include "archive.h"
+
+// Initial number of records allocated by a writer
+#define ARCHIVE_SIZE_INIT 1024
+
+/**
+ * \brief An entry of an index being built.
+ */
+
+typedef struct {
+    archive_address_t key;   /**< The indexed address */
+    uint32_t          entry; /**< The rank of the record, possibly flagged with ARCHIVE_INDEX_TO */
+} archive_entry_t;
+
+static void archive_address_set(archive_address_t * archive_address, const address_t * address)
+{
+    memset(archive_address, 0, sizeof(archive_address_t));
+    switch (address ? address->family : AF_UNSPEC) {
+        case AF_INET:
+            archive_address->family = 4;
+            memcpy(archive_address->bytes, &address->ip.ipv4, sizeof(ipv4_t));
+            break;
+        case AF_INET6:
+            archive_address->family = 6;
+            memcpy(archive_address->bytes, &address->ip.ipv6, sizeof(ipv6_t));
+            break;
+        default:
+            break;
+    }
+}
+
+bool archive_address_get(const archive_address_t * archive_address, address_t * address)
+{
+    memset(address, 0, sizeof(address_t));
+    switch (archive_address->family) {
+        case 4:
+            address->family = AF_INET;
+            memcpy(&address->ip.ipv4, archive_address->bytes, sizeof(ipv4_t));
+            break;
+        case 6:
+            address->family = AF_INET6;
+            memcpy(&address->ip.ipv6, archive_address->bytes, sizeof(ipv6_t));
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static inline int archive_address_compare(const archive_address_t * x, const archive_address_t * y) {
+    return memcmp(x, y, sizeof(archive_address_t));
+}
+
+static int archive_entry_compare(const void * x, const void * y)
+{
+    const archive_entry_t * entry1 = x,
+                          * entry2 = y;
+    int                     ret;
+
+    // Equal addresses are kept by increasing time
+    if ((ret = archive_address_compare(&entry1->key, &entry2->key))) return ret;
+    return (entry1->entry & ~ARCHIVE_INDEX_TO) < (entry2->entry & ~ARCHIVE_INDEX_TO) ? -1 : 1;
+}
+
+//---------------------------------------------------------------------------
+// Writer
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Sort the entries of an index and write them.
+ * \param file The segment.
+ * \param entries The entries.
+ * \param num_entries The number of entries.
+ * \return true iif successful.
+ */
+
+static bool archive_write_index(FILE * file, archive_entry_t * entries, size_t num_entries)
+{
+    size_t i;
+
+    qsort(entries, num_entries, sizeof(archive_entry_t), archive_entry_compare);
+    for (i = 0; i < num_entries; i++) {
+        if (fwrite(&entries[i].entry, sizeof(uint32_t), 1, file) != 1) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Write the buffered records of a writer in a segment.
+ * \param writer The archive_writer_t instance.
+ * \param file The segment.
+ * \return true iif successful.
+ */
+
+static bool archive_write_segment(const archive_writer_t * writer, FILE * file)
+{
+    archive_header_t   header;
+    archive_entry_t  * entries;
+    size_t             i, num_interfaces = 0;
+    bool               ret = false;
+
+    // A record is listed at most twice in the interface index
+    if (!(entries = malloc(2 * writer->num_records * sizeof(archive_entry_t)))) goto ERR_MALLOC;
+
+    for (i = 0; i < writer->num_records; i++) {
+        if (writer->records[i].from.family) num_interfaces++;
+        if (writer->records[i].to.family
+        &&  archive_address_compare(&writer->records[i].to, &writer->records[i].from) != 0) {
+            num_interfaces++;
+        }
+    }
+
+    memset(&header, 0, sizeof(archive_header_t));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version        = ARCHIVE_VERSION;
+    header.byte_order     = ARCHIVE_BYTE_ORDER;
+    header.num_records    = writer->num_records;
+    header.num_interfaces = num_interfaces;
+    header.time_min       = writer->records[0].time;
+    header.time_max       = writer->records[writer->num_records - 1].time;
+
+    if (fwrite(&header, sizeof(archive_header_t), 1, file) != 1
+    ||  fwrite(writer->records, sizeof(archive_record_t), writer->num_records, file) != writer->num_records) {
+        goto ERR_FWRITE;
+    }
+
+    // Destination index
+    for (i = 0; i < writer->num_records; i++) {
+        entries[i].key   = writer->records[i].dst;
+        entries[i].entry = i;
+    }
+    if (!archive_write_index(file, entries, writer->num_records)) goto ERR_FWRITE;
+
+    // Interface index
+    num_interfaces = 0;
+    for (i = 0; i < writer->num_records; i++) {
+        const archive_record_t * record = &writer->records[i];
+
+        if (record->from.family) {
+            entries[num_interfaces].key   = record->from;
+            entries[num_interfaces].entry = i;
+            num_interfaces++;
+        }
+        if (record->to.family && archive_address_compare(&record->to, &record->from) != 0) {
+            entries[num_interfaces].key   = record->to;
+            entries[num_interfaces].entry = i | ARCHIVE_INDEX_TO;
+            num_interfaces++;
+        }
+    }
+    if (!archive_write_index(file, entries, num_interfaces)) goto ERR_FWRITE;
+    ret = true;
+
+ERR_FWRITE:
+    free(entries);
+ERR_MALLOC:
+    return ret;
+}
+
+/**
+ * \brief Find the number of the next segment of an archive.
+ * \param directory The directory of the archive.
+ * \param pnext_segment Address of an unsigned, where the number is written.
+ * \return true iif successful.
+ */
+
+static bool archive_get_next_segment(const char * directory, unsigned * pnext_segment)
+{
+    DIR           * dir;
+    struct dirent * entry;
+    unsigned        number;
+
+    if (!(dir = opendir(directory))) {
+        perror(directory);
+        return false;
+    }
+
+    *pnext_segment = 0;
+    while ((entry = readdir(dir))) {
+        if (sscanf(entry->d_name, ARCHIVE_SEGMENT_FORMAT, &number) == 1 && number >= *pnext_segment) {
+            *pnext_segment = number + 1;
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+archive_writer_t * archive_writer_create(const char * directory)
+{
+    archive_writer_t * writer;
+
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        perror(directory);
+        goto ERR_MKDIR;
+    }
+
+    if (!(writer = calloc(1, sizeof(archive_writer_t))))            goto ERR_CALLOC;
+    if (!(writer->directory = strdup(directory)))                   goto ERR_STRDUP;
+    if (!archive_get_next_segment(directory, &writer->next_segment)) goto ERR_GET_NEXT_SEGMENT;
+    return writer;
+
+ERR_GET_NEXT_SEGMENT:
+    free(writer->directory);
+ERR_STRDUP:
+    free(writer);
+ERR_CALLOC:
+ERR_MKDIR:
+    return NULL;
+}
+
+void archive_writer_free(archive_writer_t * writer)
+{
+    if (writer) {
+        archive_writer_flush(writer);
+        free(writer->records);
+        free(writer->directory);
+        free(writer);
+    }
+}
+
+bool archive_writer_flush(archive_writer_t * writer)
+{
+    char   * tmp_filename,
+           * filename;
+    size_t   size;
+    int      fd;
+    FILE   * file;
+    bool     ret = false;
+
+    if (!writer->num_records) return true;
+
+    size = strlen(writer->directory) + sizeof(ARCHIVE_SEGMENT_FORMAT) + 16;
+    if (!(tmp_filename = malloc(size))) goto ERR_MALLOC_TMP_FILENAME;
+    if (!(filename = malloc(size)))     goto ERR_MALLOC_FILENAME;
+
+    snprintf(tmp_filename, size, "%s/.segment-XXXXXX", writer->directory);
+    if ((fd = mkstemp(tmp_filename)) == -1) {
+        perror(tmp_filename);
+        goto ERR_MKSTEMP;
+    }
+
+    // mkstemp() restricts the file to its owner
+    if (fchmod(fd, 0644) == -1 || !(file = fdopen(fd, "w"))) {
+        perror(tmp_filename);
+        close(fd);
+        goto ERR_FDOPEN;
+    }
+
+    if (!archive_write_segment(writer, file)) {
+        perror(tmp_filename);
+        fclose(file);
+        goto ERR_WRITE_SEGMENT;
+    }
+    if (fclose(file) != 0) {
+        perror(tmp_filename);
+        goto ERR_FCLOSE;
+    }
+
+    // Another writer may have written a segment meanwhile: link() does
+    // not replace it
+    for (;;) {
+        snprintf(filename, size, "%s/" ARCHIVE_SEGMENT_FORMAT, writer->directory, writer->next_segment);
+        if (link(tmp_filename, filename) == 0) break;
+        if (errno != EEXIST) {
+            perror(filename);
+            goto ERR_LINK;
+        }
+        writer->next_segment++;
+    }
+    writer->next_segment++;
+    writer->num_records = 0;
+    ret = true;
+
+ERR_LINK:
+ERR_FCLOSE:
+ERR_WRITE_SEGMENT:
+ERR_FDOPEN:
+    unlink(tmp_filename);
+ERR_MKSTEMP:
+    free(filename);
+ERR_MALLOC_FILENAME:
+    free(tmp_filename);
+ERR_MALLOC_TMP_FILENAME:
+    return ret;
+}
+
+bool archive_writer_add(archive_writer_t * writer, const output_record_t * record)
+{
+    archive_record_t * archive_record;
+    struct timespec    now;
+    uint64_t           time;
+    size_t             max_records;
+
+    if (record->type == OUTPUT_RECORD_REJECT) return true;
+
+    if (writer->num_records == ARCHIVE_SEGMENT_RECORDS && !archive_writer_flush(writer)) {
+        return false;
+    }
+    if (writer->num_records == writer->max_records) {
+        max_records = writer->max_records ? 2 * writer->max_records : ARCHIVE_SIZE_INIT;
+        if (!(archive_record = realloc(writer->records, max_records * sizeof(archive_record_t)))) return false;
+        writer->records     = archive_record;
+        writer->max_records = max_records;
+    }
+
+    // The records must be sorted by time
+    clock_gettime(CLOCK_REALTIME, &now);
+    time = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    if (time < writer->last_time) time = writer->last_time;
+    writer->last_time = time;
+
+    archive_record = &writer->records[writer->num_records++];
+    memset(archive_record, 0, sizeof(archive_record_t));
+    archive_record->time = time;
+    archive_record->rtt  = record->rtt;
+    archive_record->asn  = record->asn;
+    archive_record->size = record->size;
+    archive_record->type = record->type;
+    archive_record->ttl  = record->type == OUTPUT_RECORD_TRACE ? record->max_ttl : record->ttl;
+    archive_address_set(&archive_record->dst,  record->dst);
+    archive_address_set(&archive_record->from, record->from);
+    archive_address_set(&archive_record->to,   record->to);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Reader
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Map a segment in memory.
+ * \param segment The archive_segment_t to fill.
+ * \param filename The segment file.
+ * \return true iif successful.
+ */
+
+static bool archive_segment_open(archive_segment_t * segment, const char * filename)
+{
+    struct stat   st;
+    int           fd;
+
+    if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1
+    ||  fstat(fd, &st) == -1) {
+        perror(filename);
+        goto ERR_OPEN;
+    }
+
+    if ((size_t) st.st_size < sizeof(archive_header_t)) goto ERR_INVALID_SEGMENT;
+
+    segment->size = st.st_size;
+    if ((segment->base = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror(filename);
+        goto ERR_MMAP;
+    }
+
+    segment->header     = segment->base;
+    segment->records    = (const archive_record_t *) (segment->header + 1);
+    segment->dsts       = (const uint32_t *) (segment->records + segment->header->num_records);
+    segment->interfaces = segment->dsts + segment->header->num_records;
+
+    if (memcmp(segment->header->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0
+    ||  segment->header->version        != ARCHIVE_VERSION
+    ||  segment->header->byte_order     != ARCHIVE_BYTE_ORDER
+    ||  segment->header->num_records    >  segment->size / sizeof(archive_record_t)
+    ||  segment->header->num_interfaces >  segment->size / sizeof(uint32_t)
+    ||  segment->size != sizeof(archive_header_t)
+                       + segment->header->num_records    * (sizeof(archive_record_t) + sizeof(uint32_t))
+                       + segment->header->num_interfaces * sizeof(uint32_t)) {
+        goto ERR_INVALID_HEADER;
+    }
+
+    close(fd);
+    return true;
+
+ERR_INVALID_HEADER:
+    munmap(segment->base, segment->size);
+ERR_MMAP:
+ERR_INVALID_SEGMENT:
+    fprintf(stderr, "%s: invalid archive segment\n", filename);
+    close(fd);
+ERR_OPEN:
+    return false;
+}
+
+static int archive_number_compare(const void * x, const void * y)
+{
+    unsigned number1 = *(const unsigned *) x,
+             number2 = *(const unsigned *) y;
+
+    return number1 < number2 ? -1 : number1 > number2;
+}
+
+archive_reader_t * archive_reader_open(const char * directory)
+{
+    archive_reader_t * reader;
+    DIR              * dir;
+    struct dirent    * entry;
+    unsigned         * numbers = NULL,
+                     * new_numbers,
+                       number;
+    size_t             num_numbers = 0, max_numbers = 0, i, size;
+    char             * filename;
+
+    if (!(reader = calloc(1, sizeof(archive_reader_t)))) goto ERR_CALLOC;
+
+    if (!(dir = opendir(directory))) {
+        perror(directory);
+        goto ERR_OPENDIR;
+    }
+
+    // The segments are read in the order they have been written
+    while ((entry = readdir(dir))) {
+        if (sscanf(entry->d_name, ARCHIVE_SEGMENT_FORMAT, &number) != 1) continue;
+        if (num_numbers == max_numbers) {
+            max_numbers = max_numbers ? 2 * max_numbers : 16;
+            if (!(new_numbers = realloc(numbers, max_numbers * sizeof(unsigned)))) goto ERR_REALLOC;
+            numbers = new_numbers;
+        }
+        numbers[num_numbers++] = number;
+    }
+    qsort(numbers, num_numbers, sizeof(unsigned), archive_number_compare);
+
+    size = strlen(directory) + sizeof(ARCHIVE_SEGMENT_FORMAT) + 16;
+    if (!(filename = malloc(size)))                                               goto ERR_MALLOC_FILENAME;
+    if (num_numbers && !(reader->segments = malloc(num_numbers * sizeof(archive_segment_t)))) goto ERR_MALLOC_SEGMENTS;
+
+    // An invalid segment is skipped
+    for (i = 0; i < num_numbers; i++) {
+        snprintf(filename, size, "%s/" ARCHIVE_SEGMENT_FORMAT, directory, numbers[i]);
+        if (archive_segment_open(&reader->segments[reader->num_segments], filename)) {
+            reader->num_segments++;
+        }
+    }
+
+    free(filename);
+    free(numbers);
+    closedir(dir);
+    return reader;
+
+ERR_MALLOC_SEGMENTS:
+    free(filename);
+ERR_MALLOC_FILENAME:
+ERR_REALLOC:
+    free(numbers);
+    closedir(dir);
+ERR_OPENDIR:
+    free(reader);
+ERR_CALLOC:
+    return NULL;
+}
+
+void archive_reader_close(archive_reader_t * reader)
+{
+    size_t i;
+
+    if (reader) {
+        for (i = 0; i < reader->num_segments; i++) {
+            munmap(reader->segments[i].base, reader->segments[i].size);
+        }
+        free(reader->segments);
+        free(reader);
+    }
+}
+
+/**
+ * \brief Retrieve the address of a record listed in an index.
+ * \param segment The segment.
+ * \param index The index (dsts or interfaces).
+ * \param i The rank of the entry in the index.
+ * \return The corresponding address.
+ */
+
+static inline const archive_address_t * archive_segment_get_key(const archive_segment_t * segment, const uint32_t * index, size_t i)
+{
+    const archive_record_t * record = &segment->records[index[i] & ~ARCHIVE_INDEX_TO];
+
+    if (index == segment->dsts)           return &record->dst;
+    if (index[i] & ARCHIVE_INDEX_TO)      return &record->to;
+    return &record->from;
+}
+
+/**
+ * \brief Find the first entry of an index greater or equal to an address.
+ * \param segment The segment.
+ * \param index The index (dsts or interfaces).
+ * \param num_entries The number of entries of the index.
+ * \param key The address.
+ * \return The rank of this entry, num_entries if none.
+ */
+
+static size_t archive_segment_lower_bound(const archive_segment_t * segment, const uint32_t * index, size_t num_entries, const archive_address_t * key)
+{
+    size_t low = 0, high = num_entries, middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (archive_address_compare(archive_segment_get_key(segment, index, middle), key) < 0) low  = middle + 1;
+        else                                                                               high = middle;
+    }
+    return low;
+}
+
+/**
+ * \brief Check whether a record matches a query.
+ * \param record The record.
+ * \param query The query.
+ * \param dst The destination of the query (if query->dst is set).
+ * \param interface The interface of the query (if query->interface is set).
+ * \param time_max The last time of the query.
+ * \return true iif the record matches.
+ */
+
+static bool archive_record_match(
+    const archive_record_t  * record,
+    const archive_query_t   * query,
+    const archive_address_t * dst,
+    const archive_address_t * interface,
+    uint64_t                  time_max
+) {
+    return record->time >= query->time_min
+        && record->time <= time_max
+        && (!query->asn || record->asn == query->asn)
+        && (!query->dst || archive_address_compare(&record->dst, dst) == 0)
+        && (!query->interface
+            || archive_address_compare(&record->from, interface) == 0
+            || archive_address_compare(&record->to,   interface) == 0);
+}
+
+size_t archive_reader_find(
+    const archive_reader_t * reader,
+    const archive_query_t  * query,
+    bool                  (* callback)(const archive_record_t * record, void * data),
+    void                   * data
+) {
+    const archive_segment_t * segment;
+    const archive_record_t  * record;
+    const archive_address_t * key = NULL;
+    const uint32_t          * index = NULL;
+    archive_address_t         dst, interface;
+    uint64_t                  time_max = query->time_max ? query->time_max : UINT64_MAX;
+    size_t                    i, j, low, high, num_entries = 0, num_found = 0;
+
+    archive_address_set(&dst, query->dst);
+    archive_address_set(&interface, query->interface);
+
+    for (i = 0; i < reader->num_segments; i++) {
+        segment = &reader->segments[i];
+        if (segment->header->time_max < query->time_min
+        ||  segment->header->time_min > time_max) {
+            continue;
+        }
+
+        // The interface index is the most selective one
+        if (query->interface) {
+            index       = segment->interfaces;
+            num_entries = segment->header->num_interfaces;
+            key         = &interface;
+        } else if (query->dst) {
+            index       = segment->dsts;
+            num_entries = segment->header->num_records;
+            key         = &dst;
+        }
+
+        if (index) {
+            for (j = archive_segment_lower_bound(segment, index, num_entries, key); j < num_entries; j++) {
+                if (archive_address_compare(archive_segment_get_key(segment, index, j), key) != 0) break;
+                record = &segment->records[index[j] & ~ARCHIVE_INDEX_TO];
+                if (!archive_record_match(record, query, &dst, &interface, time_max)) continue;
+                num_found++;
+                if (!callback(record, data)) return num_found;
+            }
+        } else {
+            // Otherwise, the records are sorted by time
+            low = 0;
+            high = segment->header->num_records;
+            while (low < high) {
+                j = low + (high - low) / 2;
+                if (segment->records[j].time < query->time_min) low  = j + 1;
+                else                                            high = j;
+            }
+            for (j = low; j < segment->header->num_records && segment->records[j].time <= time_max; j++) {
+                record = &segment->records[j];
+                if (!archive_record_match(record, query, &dst, &interface, time_max)) continue;
+                num_found++;
+                if (!callback(record, data)) return num_found;
+            }
+        }
+    }
+    return num_found;
+}
@@ -0,0 +1,236 @@
+#include "use.h"
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+/**
+ * \file archive.h
+ * \brief Indexed archive of the measurement results.
+ *
+ * An archive is a directory of segment files. The records written in the
+ * structured output (see output.h) are also appended to the archive (see
+ * output_set_archive) as fixed-size archive_record_t records, timestamped
+ * when they are written. Once ARCHIVE_SEGMENT_RECORDS records are
+ * buffered (or once the writer is released), they are written in a new
+ * segment "segment-NNNNNNNNNN.pta" along with its indexes:
+ *
+ * - the records are stored by increasing time (a timestamp never
+ *   decreases within an archive, even if the clock is stepped back), and
+ *   the header stores the time range of the segment;
+ * - the destination index lists the records sorted by destination;
+ * - the interface index lists the records sorted by interface, i.e. by
+ *   the from and to addresses of the records (a link is listed twice).
+ *
+ * The segments are mmap()ed read-only by archive_reader_open: a query
+ * (e.g. "every record involving 192.0.2.1 during the last week") skips
+ * the segments out of its time range, and looks up the others by binary
+ * search in the most selective index, without reading the rest of the
+ * archive. The hostnames, the names of the algorithms and the rejected
+ * requests are not archived.
+ *
+ * A segment is first written in a temporary file, then linked to its
+ * final name, so that a reader never sees a partial segment, and that
+ * several writers may share a directory. Like an AS map (see asmap.h), a
+ * segment is only readable on a host having the same byte order.
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+
+#include "address.h"    // address_t
+#include "output.h"     // output_record_t
+
+#define ARCHIVE_MAGIC      "PTARCH"
+#define ARCHIVE_VERSION    1
+
+// Written in the header to detect a segment written on a host having another byte order
+#define ARCHIVE_BYTE_ORDER 0x01020304
+
+// Maximum number of records of a segment
+#define ARCHIVE_SEGMENT_RECORDS (1 << 18)
+
+// Name of the segment files (printf format, see archive_writer_t::next_segment)
+#define ARCHIVE_SEGMENT_FORMAT  "segment-%010u.pta"
+
+// Flag set in an entry of the interface index referring to the to address of a record
+#define ARCHIVE_INDEX_TO        0x80000000
+
+/**
+ * \struct archive_address_t
+ * \brief An address, comparable with memcmp.
+ */
+
+typedef struct {
+    uint8_t  family;         /**< IP version (4 or 6), 0 if none */
+    uint8_t  bytes[16];      /**< The address, padded with zeros */
+} archive_address_t;
+
+/**
+ * \struct archive_record_t
+ * \brief An archived record (see output_record_t).
+ */
+
+typedef struct {
+    uint64_t          time;  /**< When the record has been written (nanoseconds since the Epoch) */
+    uint64_t          rtt;   /**< REPLY: round-trip time (nanoseconds) */
+    uint32_t          asn;   /**< REPLY: origin AS of from, 0 if unknown */
+    uint16_t          size;  /**< TRACE: size of the probe packets */
+    uint8_t           type;  /**< The type of the record (see output_record_type_t) */
+    uint8_t           ttl;   /**< TTL of the probe, first TTL of the link, TRACE: maximum TTL */
+    archive_address_t dst;   /**< The destination of the trace */
+    archive_address_t from;  /**< REPLY, LINK, ALIAS: see output_record_t */
+    archive_address_t to;    /**< LINK, ALIAS: see output_record_t */
+} archive_record_t;
+
+typedef struct {
+    char     magic[8];       /**< ARCHIVE_MAGIC */
+    uint32_t version;        /**< ARCHIVE_VERSION */
+    uint32_t byte_order;     /**< ARCHIVE_BYTE_ORDER */
+    uint64_t num_records;    /**< Number of archive_record_t following the header */
+    uint64_t num_interfaces; /**< Number of entries of the interface index */
+    uint64_t time_min;       /**< Time of the first record */
+    uint64_t time_max;       /**< Time of the last record */
+} archive_header_t;
+
+// The records are followed by the destination index (num_records uint32_t)
+// and the interface index (num_interfaces uint32_t). An entry is the rank
+// of a record, possibly flagged with ARCHIVE_INDEX_TO.
+
+//---------------------------------------------------------------------------
+// Writer
+//---------------------------------------------------------------------------
+
+/**
+ * \struct archive_writer_t
+ * \brief Appends records to an archive.
+ */
+
+typedef struct archive_writer_s {
+    char             * directory;    /**< The directory of the archive */
+    archive_record_t * records;      /**< The records of the next segment */
+    size_t             num_records;  /**< Number of records */
+    size_t             max_records;  /**< Number of records allocated */
+    uint64_t           last_time;    /**< Time of the last record */
+    unsigned           next_segment; /**< Number of the next segment */
+} archive_writer_t;
+
+/**
+ * \brief Create an archive writer.
+ * \param directory The directory of the archive, created if needed. The
+ *    segments already stored in it are kept.
+ * \return The newly created archive_writer_t instance, NULL in case of failure.
+ */
+
+archive_writer_t * archive_writer_create(const char * directory);
+
+/**
+ * \brief Write the buffered records and release an archive writer.
+ * \param writer The archive_writer_t instance (may be NULL).
+ */
+
+void archive_writer_free(archive_writer_t * writer);
+
+/**
+ * \brief Append a record to an archive. A segment is written once
+ *    ARCHIVE_SEGMENT_RECORDS records are buffered.
+ * \param writer The archive_writer_t instance.
+ * \param record The record. A REJECT record is ignored.
+ * \return true iif successful.
+ */
+
+bool archive_writer_add(archive_writer_t * writer, const output_record_t * record);
+
+/**
+ * \brief Write the buffered records in a new segment.
+ * \param writer The archive_writer_t instance.
+ * \return true iif successful.
+ */
+
+bool archive_writer_flush(archive_writer_t * writer);
+
+//---------------------------------------------------------------------------
+// Reader
+//---------------------------------------------------------------------------
+
+/**
+ * \struct archive_segment_t
+ * \brief A mapped segment.
+ */
+
+typedef struct {
+    void                   * base;       /**< The mapped file */
+    size_t                   size;       /**< Size of the mapped file */
+    const archive_header_t * header;
+    const archive_record_t * records;    /**< The records, sorted by time */
+    const uint32_t         * dsts;       /**< The destination index */
+    const uint32_t         * interfaces; /**< The interface index */
+} archive_segment_t;
+
+/**
+ * \struct archive_reader_t
+ * \brief The segments of an archive.
+ */
+
+typedef struct {
+    archive_segment_t * segments;     /**< The segments, in the order they have been written */
+    size_t              num_segments; /**< Number of segments */
+} archive_reader_t;
+
+/**
+ * \struct archive_query_t
+ * \brief The criteria of a query. The records matching all of them are
+ *    selected.
+ */
+
+typedef struct {
+    const address_t * dst;       /**< The destination, NULL if any */
+    const address_t * interface; /**< The from or to address, NULL if any */
+    uint32_t          asn;       /**< The origin AS of from, 0 if any */
+    uint64_t          time_min;  /**< First time (nanoseconds since the Epoch), 0 if none */
+    uint64_t          time_max;  /**< Last time (idem), 0 if none */
+} archive_query_t;
+
+/**
+ * \brief Map the segments of an archive in memory.
+ * \param directory The directory of the archive.
+ * \return The archive_reader_t instance, NULL in case of failure.
+ */
+
+archive_reader_t * archive_reader_open(const char * directory);
+
+/**
+ * \brief Unmap an archive.
+ * \param reader The archive_reader_t instance (may be NULL).
+ */
+
+void archive_reader_close(archive_reader_t * reader);
+
+/**
+ * \brief Select the records matching a query, segment by segment. Within
+ *    a segment, they are sorted by the index used to look them up.
+ * \param reader The archive_reader_t instance.
+ * \param query The query.
+ * \param callback Called on each matching record. It returns false to
+ *    stop the query.
+ * \param data Passed to the callback.
+ * \return The number of records passed to the callback.
+ */
+
+size_t archive_reader_find(
+    const archive_reader_t * reader,
+    const archive_query_t  * query,
+    bool                  (* callback)(const archive_record_t * record, void * data),
+    void                   * data
+);
+
+/**
+ * \brief Convert an archived address.
+ * \param archive_address The archived address.
+ * \param address Address of an address_t, where the address is written.
+ * \return true iif the archived address is set.
+ */
+
+bool archive_address_get(const archive_address_t * archive_address, address_t * address);
+
+#endif // ARCHIVE_H
@@ -0,0 +1,482 @@
+#include "config.h"
+
+#include <stdlib.h>     // malloc, realloc, qsort
+#include <stdio.h>      // fopen, fprintf
+#include <string.h>     // memcmp, memset
+#include <errno.h>      // errno
+#include <fcntl.h>      // open
+#include <unistd.h>     // close
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <arpa/inet.h>  // inet_pton, ntohl
+
+#include "asmap.h"
+
+// Maximum number of nested prefixes (one per prefix length)
+#define ASMAP_MAX_DEPTH 129
+
+/**
+ * \brief A 128-bit address (IPv4 addresses are stored in low).
+ */
+
+typedef struct {
+    uint64_t high;
+    uint64_t low;
+} asmap_key_t;
+
+typedef struct {
+    asmap_key_t start;
+    asmap_key_t end;   /**< Last address of the prefix */
+    uint32_t    asn;
+} asmap_prefix_t;
+
+typedef struct {
+    asmap_key_t start;
+    uint32_t    asn;
+} asmap_range_t;
+
+// Growable arrays used while building a map
+
+typedef struct {
+    asmap_prefix_t * prefixes;
+    size_t           size;
+    size_t           capacity;
+} asmap_prefixes_t;
+
+typedef struct {
+    asmap_range_t  * ranges;
+    size_t           size;
+    size_t           capacity;
+} asmap_ranges_t;
+
+static inline int asmap_key_compare(const asmap_key_t * x, const asmap_key_t * y) {
+    if (x->high != y->high) return x->high < y->high ? -1 : 1;
+    if (x->low  != y->low)  return x->low  < y->low  ? -1 : 1;
+    return 0;
+}
+
+/**
+ * \brief Retrieve the host bits of a prefix.
+ * \param num_bits The number of host bits (128 - length for IPv6).
+ * \return The corresponding mask.
+ */
+
+static asmap_key_t asmap_key_hostmask(unsigned num_bits)
+{
+    asmap_key_t mask;
+
+    if (num_bits >= 64) {
+        mask.high = num_bits == 128 ? UINT64_MAX : (1ULL << (num_bits - 64)) - 1;
+        mask.low  = UINT64_MAX;
+    } else {
+        mask.high = 0;
+        mask.low  = num_bits == 0 ? 0 : (1ULL << num_bits) - 1;
+    }
+    return mask;
+}
+
+/**
+ * \brief Compare two prefixes: by start, then by decreasing size, so that
+ *    a prefix comes before the prefixes it covers.
+ */
+
+static int asmap_prefix_compare(const void * x, const void * y)
+{
+    const asmap_prefix_t * px = x,
+                         * py = y;
+    int                    ret;
+
+    if ((ret = asmap_key_compare(&px->start, &py->start))) return ret;
+    return -asmap_key_compare(&px->end, &py->end);
+}
+
+static bool asmap_prefixes_push(asmap_prefixes_t * prefixes, const asmap_prefix_t * prefix)
+{
+    asmap_prefix_t * reallocated;
+    size_t           capacity;
+
+    if (prefixes->size == prefixes->capacity) {
+        capacity = prefixes->capacity ? 2 * prefixes->capacity : 1024;
+        if (!(reallocated = realloc(prefixes->prefixes, capacity * sizeof(asmap_prefix_t)))) return false;
+        prefixes->prefixes = reallocated;
+        prefixes->capacity = capacity;
+    }
+    prefixes->prefixes[prefixes->size++] = *prefix;
+    return true;
+}
+
+/**
+ * \brief Append a range to the flattened map. A range starting where the
+ *    previous one starts replaces it, a range having the same AS as the
+ *    previous one is merged into it.
+ * \param ranges The ranges built so far.
+ * \param start The start of the range.
+ * \param asn The AS of the range.
+ * \return true iif successful.
+ */
+
+static bool asmap_ranges_push(asmap_ranges_t * ranges, const asmap_key_t * start, uint32_t asn)
+{
+    asmap_range_t * reallocated;
+    size_t          capacity;
+
+    if (ranges->size && asmap_key_compare(&ranges->ranges[ranges->size - 1].start, start) == 0) {
+        ranges->size--;
+    }
+    if (ranges->size ? ranges->ranges[ranges->size - 1].asn == asn : asn == 0) {
+        return true;
+    }
+
+    if (ranges->size == ranges->capacity) {
+        capacity = ranges->capacity ? 2 * ranges->capacity : 1024;
+        if (!(reallocated = realloc(ranges->ranges, capacity * sizeof(asmap_range_t)))) return false;
+        ranges->ranges   = reallocated;
+        ranges->capacity = capacity;
+    }
+    ranges->ranges[ranges->size].start = *start;
+    ranges->ranges[ranges->size].asn   = asn;
+    ranges->size++;
+    return true;
+}
+
+/**
+ * \brief Leave the innermost prefix covering the current address: the
+ *    addresses following it belong to the enclosing prefix (if any).
+ * \param ranges The ranges built so far.
+ * \param stack The nested prefixes covering the current address.
+ * \param pdepth Points to the number of prefixes in stack (updated).
+ * \param last The last address of the family.
+ * \return true iif successful.
+ */
+
+static bool asmap_flatten_pop(
+    asmap_ranges_t        * ranges,
+    const asmap_prefix_t ** stack,
+    size_t                * pdepth,
+    const asmap_key_t     * last
+) {
+    asmap_key_t next = stack[--(*pdepth)]->end;
+
+    // The prefix ends at the last address
+    if (asmap_key_compare(&next, last) == 0) return true;
+
+    if (++next.low == 0) next.high++;
+    return asmap_ranges_push(ranges, &next, *pdepth ? stack[*pdepth - 1]->asn : 0);
+}
+
+/**
+ * \brief Flatten a set of prefixes into disjoint ranges.
+ * \param prefixes The prefixes of a given family. They are sorted.
+ * \param ranges The ranges, initially empty.
+ * \param family The family of the prefixes.
+ * \return true iif successful.
+ */
+
+static bool asmap_flatten(asmap_prefixes_t * prefixes, asmap_ranges_t * ranges, int family)
+{
+    asmap_key_t            last = asmap_key_hostmask(family == AF_INET ? 32 : 128);
+    const asmap_prefix_t * stack[ASMAP_MAX_DEPTH],
+                         * prefix;
+    size_t                 i, depth = 0;
+
+    qsort(prefixes->prefixes, prefixes->size, sizeof(asmap_prefix_t), asmap_prefix_compare);
+
+    for (i = 0; i < prefixes->size; i++) {
+        prefix = &prefixes->prefixes[i];
+
+        // A prefix listed twice: keep the first one
+        if (i > 0 && asmap_prefix_compare(prefix, prefix - 1) == 0) continue;
+
+        // Leave the prefixes ending before this one. The prefixes are
+        // either nested or disjoint.
+        while (depth && asmap_key_compare(&stack[depth - 1]->end, &prefix->start) < 0) {
+            if (!asmap_flatten_pop(ranges, stack, &depth, &last)) return false;
+        }
+
+        if (!asmap_ranges_push(ranges, &prefix->start, prefix->asn)) return false;
+        stack[depth++] = prefix;
+    }
+
+    while (depth) {
+        if (!asmap_flatten_pop(ranges, stack, &depth, &last)) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Parse a line of a pfx2as dump.
+ * \param line The line.
+ * \param prefix The prefix to initialize.
+ * \param pfamily Address of an int, where the family of the prefix is written.
+ * \return true iif successful.
+ */
+
+static bool asmap_parse_line(const char * line, asmap_prefix_t * prefix, int * pfamily)
+{
+    char          ip[INET6_ADDRSTRLEN], asns[64];
+    unsigned      length;
+    unsigned long asn;
+    ipv4_t        ipv4;
+    ipv6_t        ipv6;
+    asmap_key_t   mask;
+    size_t        i;
+
+    if (sscanf(line, "%45s %u %63s", ip, &length, asns) != 3) return false;
+
+    if (inet_pton(AF_INET, ip, &ipv4) == 1) {
+        if (length > 32) return false;
+        prefix->start.high = 0;
+        prefix->start.low  = ntohl(ipv4.s_addr);
+        mask = asmap_key_hostmask(32 - length);
+        *pfamily = AF_INET;
+    } else if (inet_pton(AF_INET6, ip, &ipv6) == 1) {
+        if (length > 128) return false;
+        prefix->start.high = prefix->start.low = 0;
+        for (i = 0; i < 8; i++) {
+            prefix->start.high = (prefix->start.high << 8) | ipv6.s6_addr[i];
+            prefix->start.low  = (prefix->start.low  << 8) | ipv6.s6_addr[i + 8];
+        }
+        mask = asmap_key_hostmask(128 - length);
+        *pfamily = AF_INET6;
+    } else {
+        return false;
+    }
+
+    // Multi-origin prefixes ("4134_4809") and AS sets ("7545,4826"):
+    // keep the first AS.
+    errno = 0;
+    asn = strtoul(asns, NULL, 10);
+    if (errno || asn > UINT32_MAX) return false;
+
+    prefix->start.high &= ~mask.high;
+    prefix->start.low  &= ~mask.low;
+    prefix->end.high    = prefix->start.high | mask.high;
+    prefix->end.low     = prefix->start.low  | mask.low;
+    prefix->asn         = asn;
+    return true;
+}
+
+/**
+ * \brief Write an AS map.
+ * \param filename The file to write.
+ * \param ipv4 The IPv4 ranges.
+ * \param ipv6 The IPv6 ranges.
+ * \return true iif successful.
+ */
+
+static bool asmap_write(const char * filename, const asmap_ranges_t * ipv4, const asmap_ranges_t * ipv6)
+{
+    FILE               * file;
+    asmap_header_t       header;
+    asmap_ipv4_range_t   ipv4_range;
+    asmap_ipv6_range_t   ipv6_range;
+    size_t               i;
+
+    if (!(file = fopen(filename, "w"))) {
+        perror(filename);
+        goto ERR_FOPEN;
+    }
+
+    memset(&header, 0, sizeof(asmap_header_t));
+    memcpy(header.magic, ASMAP_MAGIC, sizeof(ASMAP_MAGIC));
+    header.version    = ASMAP_VERSION;
+    header.byte_order = ASMAP_BYTE_ORDER;
+    header.num_ipv4   = ipv4->size;
+    header.num_ipv6   = ipv6->size;
+    if (fwrite(&header, sizeof(asmap_header_t), 1, file) != 1) goto ERR_FWRITE;
+
+    for (i = 0; i < ipv4->size; i++) {
+        ipv4_range.start = ipv4->ranges[i].start.low;
+        ipv4_range.asn   = ipv4->ranges[i].asn;
+        if (fwrite(&ipv4_range, sizeof(asmap_ipv4_range_t), 1, file) != 1) goto ERR_FWRITE;
+    }
+
+    memset(&ipv6_range, 0, sizeof(asmap_ipv6_range_t));
+    for (i = 0; i < ipv6->size; i++) {
+        ipv6_range.start_high = ipv6->ranges[i].start.high;
+        ipv6_range.start_low  = ipv6->ranges[i].start.low;
+        ipv6_range.asn        = ipv6->ranges[i].asn;
+        if (fwrite(&ipv6_range, sizeof(asmap_ipv6_range_t), 1, file) != 1) goto ERR_FWRITE;
+    }
+
+    if (fclose(file) != 0) {
+        perror(filename);
+        goto ERR_FCLOSE;
+    }
+    return true;
+
+ERR_FWRITE:
+    perror(filename);
+    fclose(file);
+ERR_FCLOSE:
+ERR_FOPEN:
+    return false;
+}
+
+bool asmap_build(const char * pfx2as_filename, const char * filename)
+{
+    FILE             * pfx2as;
+    char             * line = NULL,
+                     * tmp_filename;
+    size_t             size = 0, num_lines = 0;
+    bool               ret = false;
+    int                family;
+    asmap_prefix_t     prefix;
+    asmap_prefixes_t   ipv4_prefixes = {NULL, 0, 0},
+                       ipv6_prefixes = {NULL, 0, 0};
+    asmap_ranges_t     ipv4_ranges   = {NULL, 0, 0},
+                       ipv6_ranges   = {NULL, 0, 0};
+
+    if (!(pfx2as = fopen(pfx2as_filename, "r"))) {
+        perror(pfx2as_filename);
+        goto ERR_FOPEN;
+    }
+
+    while (getline(&line, &size, pfx2as) != -1) {
+        num_lines++;
+        if (!asmap_parse_line(line, &prefix, &family)) {
+            fprintf(stderr, "%s:%zu: invalid line ignored\n", pfx2as_filename, num_lines);
+            continue;
+        }
+        if (!asmap_prefixes_push(family == AF_INET ? &ipv4_prefixes : &ipv6_prefixes, &prefix)) {
+            goto ERR_PREFIXES_PUSH;
+        }
+    }
+
+    if (!asmap_flatten(&ipv4_prefixes, &ipv4_ranges, AF_INET)
+    ||  !asmap_flatten(&ipv6_prefixes, &ipv6_ranges, AF_INET6)) {
+        goto ERR_FLATTEN;
+    }
+
+    // Processes may be using the previous map: replace it atomically
+    if (!(tmp_filename = malloc(strlen(filename) + 5))) goto ERR_TMP_FILENAME;
+    sprintf(tmp_filename, "%s.tmp", filename);
+    if (!asmap_write(tmp_filename, &ipv4_ranges, &ipv6_ranges)) goto ERR_WRITE;
+    if (rename(tmp_filename, filename) != 0) {
+        perror(filename);
+        goto ERR_RENAME;
+    }
+    ret = true;
+
+ERR_RENAME:
+    if (!ret) unlink(tmp_filename);
+ERR_WRITE:
+    free(tmp_filename);
+ERR_TMP_FILENAME:
+ERR_FLATTEN:
+ERR_PREFIXES_PUSH:
+    free(ipv4_ranges.ranges);
+    free(ipv6_ranges.ranges);
+    free(ipv4_prefixes.prefixes);
+    free(ipv6_prefixes.prefixes);
+    free(line);
+    fclose(pfx2as);
+ERR_FOPEN:
+    return ret;
+}
+
+asmap_t * asmap_open(const char * filename)
+{
+    asmap_t     * asmap;
+    struct stat   st;
+    int           fd;
+
+    if (!(asmap = malloc(sizeof(asmap_t)))) goto ERR_MALLOC;
+
+    if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1
+    ||  fstat(fd, &st) == -1) {
+        perror(filename);
+        goto ERR_OPEN;
+    }
+
+    if ((size_t) st.st_size < sizeof(asmap_header_t)) goto ERR_INVALID_MAP;
+
+    asmap->size = st.st_size;
+    if ((asmap->base = mmap(NULL, asmap->size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror(filename);
+        goto ERR_MMAP;
+    }
+
+    asmap->header = asmap->base;
+    asmap->ipv4   = (const asmap_ipv4_range_t *) (asmap->header + 1);
+    asmap->ipv6   = (const asmap_ipv6_range_t *) (asmap->ipv4 + asmap->header->num_ipv4);
+
+    if (memcmp(asmap->header->magic, ASMAP_MAGIC, sizeof(ASMAP_MAGIC)) != 0
+    ||  asmap->header->version    != ASMAP_VERSION
+    ||  asmap->header->byte_order != ASMAP_BYTE_ORDER
+    ||  asmap->header->num_ipv4   >  asmap->size / sizeof(asmap_ipv4_range_t)
+    ||  asmap->header->num_ipv6   >  asmap->size / sizeof(asmap_ipv6_range_t)
+    ||  asmap->size != sizeof(asmap_header_t)
+                     + asmap->header->num_ipv4 * sizeof(asmap_ipv4_range_t)
+                     + asmap->header->num_ipv6 * sizeof(asmap_ipv6_range_t)) {
+        goto ERR_INVALID_HEADER;
+    }
+
+    close(fd);
+    return asmap;
+
+ERR_INVALID_HEADER:
+    munmap(asmap->base, asmap->size);
+ERR_MMAP:
+ERR_INVALID_MAP:
+    fprintf(stderr, "%s: invalid AS map\n", filename);
+    close(fd);
+ERR_OPEN:
+    free(asmap);
+ERR_MALLOC:
+    return NULL;
+}
+
+void asmap_close(asmap_t * asmap)
+{
+    if (asmap) {
+        munmap(asmap->base, asmap->size);
+        free(asmap);
+    }
+}
+
+bool asmap_lookup(const asmap_t * asmap, const address_t * address, uint32_t * pasn)
+{
+    size_t      low = 0, high, middle;
+    uint32_t    ipv4;
+    asmap_key_t ipv6, start;
+    size_t      i;
+
+    // Find the last range starting before the address
+    switch (address->family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            ipv4 = ntohl(address->ip.ipv4.s_addr);
+            high = asmap->header->num_ipv4;
+            while (low < high) {
+                middle = low + (high - low) / 2;
+                if (asmap->ipv4[middle].start <= ipv4) low  = middle + 1;
+                else                                   high = middle;
+            }
+            *pasn = low ? asmap->ipv4[low - 1].asn : 0;
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            ipv6.high = ipv6.low = 0;
+            for (i = 0; i < 8; i++) {
+                ipv6.high = (ipv6.high << 8) | address->ip.ipv6.s6_addr[i];
+                ipv6.low  = (ipv6.low  << 8) | address->ip.ipv6.s6_addr[i + 8];
+            }
+            high = asmap->header->num_ipv6;
+            while (low < high) {
+                middle = low + (high - low) / 2;
+                start.high = asmap->ipv6[middle].start_high;
+                start.low  = asmap->ipv6[middle].start_low;
+                if (asmap_key_compare(&start, &ipv6) <= 0) low  = middle + 1;
+                else                                       high = middle;
+            }
+            *pasn = low ? asmap->ipv6[low - 1].asn : 0;
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    return *pasn != 0;
+}
@@ -0,0 +1,99 @@
+#include "use.h"
+
+#ifndef ASMAP_H
+#define ASMAP_H
+
+/**
+ * \file asmap.h
+ * \brief Offline IP to origin AS lookups.
+ *
+ * An AS map is built once out of a prefix to AS dump (e.g. the CAIDA
+ * RouteViews pfx2as dumps: one "prefix<tab>length<tab>ASN" line per
+ * announced prefix) and saved in a compact binary file.
+ *
+ * The prefixes are flattened into disjoint ranges, each of them mapped to
+ * the origin AS of the longest prefix covering it (or to AS0 if none),
+ * and sorted: a lookup is a binary search, without any allocation.
+ *
+ * The file is mmap()ed read-only by asmap_open, so that its pages are
+ * shared by every thread (see pt_shards.h) and process using it.
+ */
+
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint*_t
+#include <stddef.h>     // size_t
+
+#include "address.h"    // address_t
+
+#define ASMAP_MAGIC     "PTASMAP"
+#define ASMAP_VERSION   1
+
+// Written in the header to detect a map built on a host having another byte order
+#define ASMAP_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char     magic[8];   /**< ASMAP_MAGIC */
+    uint32_t version;    /**< ASMAP_VERSION */
+    uint32_t byte_order; /**< ASMAP_BYTE_ORDER */
+    uint64_t num_ipv4;   /**< Number of asmap_ipv4_range_t following the header */
+    uint64_t num_ipv6;   /**< Number of asmap_ipv6_range_t following the IPv4 ranges */
+} asmap_header_t;
+
+typedef struct {
+    uint32_t start;      /**< First address of the range (host byte order) */
+    uint32_t asn;        /**< Origin AS of the range, 0 if none */
+} asmap_ipv4_range_t;
+
+typedef struct {
+    uint64_t start_high; /**< First address of the range (64 most significant bits) */
+    uint64_t start_low;  /**< First address of the range (64 least significant bits) */
+    uint32_t asn;        /**< Origin AS of the range, 0 if none */
+    uint32_t padding;
+} asmap_ipv6_range_t;
+
+// A range lasts until the start of the next range of the same family.
+
+typedef struct {
+    void                     * base;  /**< The mapped file */
+    size_t                     size;  /**< Size of the mapped file */
+    const asmap_header_t     * header;
+    const asmap_ipv4_range_t * ipv4;  /**< The IPv4 ranges, sorted by start */
+    const asmap_ipv6_range_t * ipv6;  /**< The IPv6 ranges, sorted by start */
+} asmap_t;
+
+/**
+ * \brief Build an AS map out of a prefix to AS dump.
+ * \param pfx2as_filename The dump. When a prefix is announced by several
+ *    AS (e.g. "4134_4809" or "7545,4826"), the first one is kept.
+ * \param filename The AS map to write.
+ * \return true iif successful.
+ */
+
+bool asmap_build(const char * pfx2as_filename, const char * filename);
+
+/**
+ * \brief Map an AS map in memory.
+ * \param filename The AS map (see asmap_build).
+ * \return The asmap_t instance, NULL in case of failure.
+ */
+
+asmap_t * asmap_open(const char * filename);
+
+/**
+ * \brief Unmap an AS map.
+ * \param asmap The asmap_t instance.
+ */
+
+void asmap_close(asmap_t * asmap);
+
+/**
+ * \brief Retrieve the origin AS of an address.
+ * \param asmap The asmap_t instance.
+ * \param address The address.
+ * \param pasn Address of an uint32_t, where the ASN is written.
+ * \return true iif the address is announced.
+ */
+
+bool asmap_lookup(const asmap_t * asmap, const address_t * address, uint32_t * pasn);
+
+#endif // ASMAP_H
@@ -0,0 +1,563 @@
+#include "use.h"
+#include "config.h"
+
+#include <errno.h>        // errno, EINTR, EPROTO
+#include <poll.h>         // poll
+#include <signal.h>       // sigset_t, sigprocmask, sigtimedwait, SIGINT, SIGTERM
+#include <stdio.h>        // fprintf, perror
+#include <stdlib.h>       // calloc, free
+#include <string.h>       // memcpy, memset, strcpy, strdup, strerror, strlen
+#include <time.h>         // struct timespec
+#ifdef USE_KQUEUE
+#    include <sys/event.h> // kqueue, kevent
+#else
+#    include <sys/signalfd.h> // signalfd
+#endif
+#include <sys/socket.h>   // socket, bind, listen, accept4, sendmsg, recvmsg
+#include <sys/stat.h>     // chmod, lstat, S_ISSOCK
+#include <sys/time.h>     // struct timeval
+#include <sys/un.h>       // struct sockaddr_un
+#include <unistd.h>       // close, unlink
+#include <netinet/in.h>   // IPPROTO_*
+
+#include "broker.h"
+#include "sniffer.h"      // sniffer_open_socket
+
+// Version of the messages exchanged when a client connects
+#define BROKER_VERSION 1
+
+// Flags of a request
+#define BROKER_WITH_TCP 1 /**< The sockets sniffing the TCP replies are requested */
+
+/**
+ * \struct broker_request_t
+ * \brief Sent by a client once connected.
+ */
+
+typedef struct {
+    uint32_t version;   /**< BROKER_VERSION */
+    uint32_t flags;     /**< BROKER_WITH_* */
+} broker_request_t;
+
+/**
+ * \struct broker_response_t
+ * \brief Sent by the server along with the sockets (unless error is set).
+ */
+
+typedef struct {
+    uint32_t version;   /**< BROKER_VERSION */
+    int32_t  error;     /**< 0 if successful, an errno value otherwise */
+    uint32_t mask;      /**< The bit i is set iif the socket of index i is passed, in the order of the indexes */
+} broker_response_t;
+
+// The sockets fetched by the calling thread (see broker_client_fetch).
+static __thread broker_sockets_t broker_fetched = {{-1, -1, -1, -1, -1, -1}};
+
+/**
+ * \brief Fill the address of a UNIX socket.
+ * \param path The path of the socket.
+ * \param addr The sockaddr_un instance to fill.
+ * \return true iif successful.
+ */
+
+static bool broker_make_address(const char * path, struct sockaddr_un * addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "broker: %s: path too long\n", path);
+        return false;
+    }
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+/**
+ * \brief Close the sockets of a set.
+ * \param sockets A broker_sockets_t instance.
+ */
+
+static void broker_sockets_close(broker_sockets_t * sockets)
+{
+    size_t i;
+
+    for (i = 0; i < BROKER_NUM_SOCKETS; i++) {
+        if (sockets->fds[i] != -1) close(sockets->fds[i]);
+        sockets->fds[i] = -1;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Server
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Set the size of a buffer of a socket. The system limits are
+ *    overridden if possible (CAP_NET_ADMIN).
+ * \param sockfd The socket.
+ * \param is_send Pass true to set the send buffer, false to set the
+ *    receive buffer.
+ * \param size The size of the buffer (in bytes).
+ * \return true iif successful.
+ */
+
+static bool broker_set_buffer_size(int sockfd, bool is_send, size_t size)
+{
+    int value = size;
+
+#if defined(SO_SNDBUFFORCE) && defined(SO_RCVBUFFORCE)
+    if (setsockopt(sockfd, SOL_SOCKET, is_send ? SO_SNDBUFFORCE : SO_RCVBUFFORCE, &value, sizeof(value)) == 0) {
+        return true;
+    }
+#endif
+    return setsockopt(sockfd, SOL_SOCKET, is_send ? SO_SNDBUF : SO_RCVBUF, &value, sizeof(value)) == 0;
+}
+
+/**
+ * \brief Open and configure a set of sockets.
+ * \param sockets The broker_sockets_t instance to fill.
+ * \param buffer_size The size of the buffers of the sockets (in bytes),
+ *    0 to keep the default of the system.
+ * \return true iif successful.
+ */
+
+static bool broker_sockets_open(broker_sockets_t * sockets, size_t buffer_size)
+{
+    size_t i;
+
+    for (i = 0; i < BROKER_NUM_SOCKETS; i++) sockets->fds[i] = -1;
+
+    // The sniffing sockets are configured like those of a sniffer
+#ifdef USE_IPV4
+    if ((sockets->fds[BROKER_SOCKET_IPV4_RAW] = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW)) == -1) goto ERR_OPEN;
+    if ((sockets->fds[BROKER_SOCKET_ICMPV4] = sniffer_open_socket(AF_INET, IPPROTO_ICMP)) == -1)               goto ERR_OPEN;
+    if ((sockets->fds[BROKER_SOCKET_TCPV4]  = sniffer_open_socket(AF_INET, IPPROTO_TCP)) == -1)                goto ERR_OPEN;
+#endif
+#ifdef USE_IPV6
+    if ((sockets->fds[BROKER_SOCKET_IPV6_RAW] = socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW)) == -1) goto ERR_OPEN;
+    if ((sockets->fds[BROKER_SOCKET_ICMPV6] = sniffer_open_socket(AF_INET6, IPPROTO_ICMPV6)) == -1)            goto ERR_OPEN;
+    if ((sockets->fds[BROKER_SOCKET_TCPV6]  = sniffer_open_socket(AF_INET6, IPPROTO_TCP)) == -1)               goto ERR_OPEN;
+#endif
+
+    // Optional, the default sizes are then used
+    if (buffer_size > 0) {
+        for (i = 0; i < BROKER_NUM_SOCKETS; i++) {
+            if (sockets->fds[i] == -1) continue;
+            if (!broker_set_buffer_size(sockets->fds[i], i == BROKER_SOCKET_IPV4_RAW || i == BROKER_SOCKET_IPV6_RAW, buffer_size)) {
+                perror("broker_sockets_open: cannot set the buffer size");
+            }
+        }
+    }
+    return true;
+
+ERR_OPEN:
+    perror("broker_sockets_open");
+    broker_sockets_close(sockets);
+    return false;
+}
+
+/**
+ * \brief Discard the packets queued on the sniffing sockets of a set
+ *    since they have been opened.
+ * \param sockets A broker_sockets_t instance.
+ */
+
+static void broker_sockets_drain(broker_sockets_t * sockets)
+{
+    char   byte;
+    size_t i;
+
+    for (i = 0; i < BROKER_NUM_SOCKETS; i++) {
+        if (sockets->fds[i] == -1 || i == BROKER_SOCKET_IPV4_RAW || i == BROKER_SOCKET_IPV6_RAW) continue;
+        while (recv(sockets->fds[i], &byte, sizeof(byte), MSG_DONTWAIT | MSG_TRUNC) != -1 || errno == EINTR);
+    }
+}
+
+/**
+ * \brief Open a non-blocking socket listening to a UNIX socket path.
+ * \param path The path of the socket (see broker_server_create).
+ * \return The socket, -1 in case of failure.
+ */
+
+static int broker_listen(const char * path)
+{
+    struct sockaddr_un addr;
+    struct stat        st;
+    int                sockfd;
+
+    if (!broker_make_address(path, &addr)) goto ERR_PATH;
+
+    // Only a socket left by a previous run is replaced
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    if ((sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) goto ERR_SOCKET;
+    if (bind(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)      goto ERR_BIND;
+
+    // The unprivileged clients must be able to connect (see broker.h)
+    if (chmod(path, 0666) == -1)                                                        goto ERR_CHMOD;
+    if (listen(sockfd, SOMAXCONN) == -1)                                                goto ERR_LISTEN;
+    return sockfd;
+
+ERR_LISTEN:
+ERR_CHMOD:
+    unlink(path);
+ERR_BIND:
+    close(sockfd);
+ERR_SOCKET:
+    perror(path);
+ERR_PATH:
+    return -1;
+}
+
+/**
+ * \brief Open the missing spare sets of a server.
+ * \param server A broker_server_t instance.
+ * \return true iif at least one set is available.
+ */
+
+static bool broker_server_refill(broker_server_t * server)
+{
+    while (server->num_spares < BROKER_NUM_SPARES
+    &&     broker_sockets_open(&server->spares[server->num_spares], server->buffer_size)) {
+        server->num_spares++;
+    }
+    return server->num_spares > 0;
+}
+
+broker_server_t * broker_server_create(const char * path, size_t buffer_size)
+{
+    broker_server_t * server;
+
+    if (!(server = calloc(1, sizeof(broker_server_t))))      goto ERR_CALLOC;
+    server->buffer_size = buffer_size;
+    if (!(server->path = strdup(path)))                      goto ERR_STRDUP;
+    if (!broker_server_refill(server))                       goto ERR_REFILL;
+    if ((server->sockfd = broker_listen(path)) == -1)        goto ERR_LISTEN;
+    return server;
+
+ERR_LISTEN:
+    while (server->num_spares > 0) broker_sockets_close(&server->spares[--server->num_spares]);
+ERR_REFILL:
+    free(server->path);
+ERR_STRDUP:
+    free(server);
+ERR_CALLOC:
+    return NULL;
+}
+
+void broker_server_free(broker_server_t * server)
+{
+    if (server) {
+        while (server->num_spares > 0) broker_sockets_close(&server->spares[--server->num_spares]);
+        close(server->sockfd);
+        unlink(server->path);
+        free(server->path);
+        free(server);
+    }
+}
+
+/**
+ * \brief Answer the request of a client, and hand a set of sockets over to it.
+ * \param server A broker_server_t instance.
+ * \param sockfd The connection of the client.
+ * \return true iif successful.
+ */
+
+static bool broker_server_serve(broker_server_t * server, int sockfd)
+{
+    broker_request_t   request;
+    broker_response_t  response;
+    broker_sockets_t   sockets;
+    struct msghdr      msg;
+    struct iovec       iov;
+    struct cmsghdr   * cmsg;
+    char               control[CMSG_SPACE(BROKER_NUM_SOCKETS * sizeof(int))];
+    int                fds[BROKER_NUM_SOCKETS];
+    size_t             i, num_fds = 0;
+    ssize_t            num_bytes;
+
+    memset(&response, 0, sizeof(broker_response_t));
+    response.version = BROKER_VERSION;
+    for (i = 0; i < BROKER_NUM_SOCKETS; i++) sockets.fds[i] = -1;
+
+    while ((num_bytes = recv(sockfd, &request, sizeof(broker_request_t), 0)) == -1 && errno == EINTR);
+    if (num_bytes != sizeof(broker_request_t) || request.version != BROKER_VERSION) {
+        response.error = EPROTO;
+    } else if (!broker_server_refill(server)) {
+        response.error = errno ? errno : EAGAIN;
+    } else {
+        sockets = server->spares[--server->num_spares];
+        broker_sockets_drain(&sockets);
+        for (i = 0; i < BROKER_NUM_SOCKETS; i++) {
+            if (sockets.fds[i] == -1) continue;
+            if (!(request.flags & BROKER_WITH_TCP) && (i == BROKER_SOCKET_TCPV4 || i == BROKER_SOCKET_TCPV6)) continue;
+            response.mask |= 1u << i;
+            fds[num_fds++] = sockets.fds[i];
+        }
+    }
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base   = &response;
+    iov.iov_len    = sizeof(broker_response_t);
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+    if (num_fds > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control    = control;
+        msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+    }
+    if (sendmsg(sockfd, &msg, MSG_NOSIGNAL) == -1 && response.error == 0) {
+        response.error = errno;
+    }
+
+    // The client owns its own copies of the sockets, and a set is never reused
+    broker_sockets_close(&sockets);
+    return response.error == 0;
+}
+
+/**
+ * \brief Answer the pending connections.
+ * \param server A broker_server_t instance.
+ */
+
+static void broker_server_accept(broker_server_t * server)
+{
+    struct timeval timeout = {BROKER_CONNECT_TIMEOUT, 0};
+    int            sockfd;
+
+    while ((sockfd = accept4(server->sockfd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+        // A client which does not send its request does not block the server
+        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0
+        &&  broker_server_serve(server, sockfd)) {
+            server->num_served++;
+        } else {
+            server->num_failed++;
+        }
+        close(sockfd);
+    }
+}
+
+/**
+ * \brief Create a signalfd activated by SIGINT and SIGTERM, which are
+ *    blocked. With kqueue, this is a kqueue instance watching these
+ *    signals, which is readable once one of them is pending.
+ * \param old_mask Address of the sigset_t in which the previous mask is saved.
+ * \return The signalfd, -1 in case of failure.
+ */
+
+static int broker_make_signal_fd(sigset_t * old_mask)
+{
+    sigset_t      mask;
+    int           sfd;
+#ifdef USE_KQUEUE
+    struct kevent events[2];
+#endif
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, old_mask) == -1) return -1;
+#ifdef USE_KQUEUE
+    // EVFILT_SIGNAL also notices the blocked signals
+    if ((sfd = kqueue()) != -1) {
+        EV_SET(&events[0], SIGINT,  EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+        EV_SET(&events[1], SIGTERM, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+        if (kevent(sfd, events, 2, NULL, 0, NULL) == -1) {
+            close(sfd);
+            sfd = -1;
+        }
+    }
+#else
+    sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+#endif
+    if (sfd == -1) {
+        sigprocmask(SIG_SETMASK, old_mask, NULL);
+    }
+    return sfd;
+}
+
+/**
+ * \brief Discard the pending SIGINT and SIGTERM, which would otherwise
+ *    terminate the process once they are unblocked.
+ */
+
+static void broker_discard_signals()
+{
+    sigset_t        mask;
+    struct timespec timeout = {0, 0};
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    while (sigtimedwait(&mask, NULL, &timeout) > 0);
+}
+
+bool broker_server_run(broker_server_t * server)
+{
+    struct pollfd fds[2];
+    sigset_t      old_mask;
+    int           sfd;
+
+    if ((sfd = broker_make_signal_fd(&old_mask)) == -1) goto ERR_MAKE_SIGNAL_FD;
+
+    fds[0].fd     = server->sockfd;
+    fds[0].events = POLLIN;
+    fds[1].fd     = sfd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            goto ERR_POLL;
+        }
+        if (fds[1].revents) break;
+        if (fds[0].revents) broker_server_accept(server);
+
+        // Prepare the next sets while no client is waiting
+        broker_server_refill(server);
+    }
+
+    broker_discard_signals();
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return true;
+
+ERR_POLL:
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+ERR_MAKE_SIGNAL_FD:
+    perror("broker_server_run");
+    return false;
+}
+
+void broker_server_dump(const broker_server_t * server, FILE * file)
+{
+    fprintf(file, "broker: %llu served, %llu failed\n",
+        (unsigned long long) server->num_served,
+        (unsigned long long) server->num_failed
+    );
+}
+
+//---------------------------------------------------------------------------
+// Client
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Receive the response of the server and the sockets it carries.
+ * \param sockfd The connection to the server.
+ * \param response The broker_response_t instance to fill.
+ * \param sockets The set in which the sockets are written, according
+ *    to response->mask.
+ * \return true iif successful.
+ */
+
+static bool broker_client_recv_response(int sockfd, broker_response_t * response, broker_sockets_t * sockets)
+{
+    struct msghdr    msg;
+    struct iovec     iov;
+    struct cmsghdr * cmsg;
+    char             control[CMSG_SPACE(BROKER_NUM_SOCKETS * sizeof(int))];
+    int              fds[BROKER_NUM_SOCKETS];
+    size_t           i, j, num_fds = 0;
+    ssize_t          num_bytes;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base       = response;
+    iov.iov_len        = sizeof(broker_response_t);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    while ((num_bytes = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    if (num_bytes == -1) return false;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+        }
+    }
+
+    // The sockets are passed in the order of their indexes
+    for (i = 0, j = 0; i < BROKER_NUM_SOCKETS; i++) {
+        sockets->fds[i] = (response->mask & (1u << i)) && j < num_fds ? fds[j++] : -1;
+    }
+    for (; j < num_fds; j++) close(fds[j]);
+
+    return num_bytes == sizeof(broker_response_t) && !(msg.msg_flags & MSG_CTRUNC);
+}
+
+bool broker_client_fetch(const char * path, bool with_tcp)
+{
+    struct sockaddr_un  addr;
+    struct timeval      timeout = {BROKER_CONNECT_TIMEOUT, 0};
+    broker_request_t    request;
+    broker_response_t   response;
+    broker_sockets_t    sockets;
+    int                 sockfd;
+
+    if (!broker_make_address(path, &addr)) goto ERR_PATH;
+
+    if ((sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1)            goto ERR_SOCKET;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) goto ERR_SETSOCKOPT;
+    if (connect(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1) goto ERR_CONNECT;
+
+    memset(&request, 0, sizeof(broker_request_t));
+    request.version = BROKER_VERSION;
+    request.flags   = with_tcp ? BROKER_WITH_TCP : 0;
+    if (send(sockfd, &request, sizeof(broker_request_t), MSG_NOSIGNAL) == -1) goto ERR_SEND;
+
+    memset(&response, 0, sizeof(broker_response_t));
+    if (!broker_client_recv_response(sockfd, &response, &sockets)) {
+        broker_sockets_close(&sockets);
+        goto ERR_RECV_RESPONSE;
+    }
+    close(sockfd);
+
+    if (response.version != BROKER_VERSION || response.error != 0) {
+        fprintf(stderr, "broker: %s: %s\n", path,
+            response.version != BROKER_VERSION ? "protocol mismatch" : strerror(response.error)
+        );
+        broker_sockets_close(&sockets);
+        goto ERR_RESPONSE;
+    }
+
+    broker_client_release();
+    broker_fetched = sockets;
+    return true;
+
+ERR_RECV_RESPONSE:
+ERR_SEND:
+ERR_CONNECT:
+ERR_SETSOCKOPT:
+    close(sockfd);
+ERR_SOCKET:
+    perror(path);
+ERR_RESPONSE:
+ERR_PATH:
+    return false;
+}
+
+int broker_take_socket(size_t index)
+{
+    int sockfd;
+
+    if (index >= BROKER_NUM_SOCKETS) return -1;
+    sockfd = broker_fetched.fds[index];
+    broker_fetched.fds[index] = -1;
+    return sockfd;
+}
+
+bool broker_has_socket(size_t index) {
+    return index < BROKER_NUM_SOCKETS && broker_fetched.fds[index] != -1;
+}
+
+void broker_client_release() {
+    broker_sockets_close(&broker_fetched);
+}
@@ -0,0 +1,163 @@
+#include "use.h"
+
+#ifndef BROKER_H
+#define BROKER_H
+
+/**
+ * \file broker.h
+ * \brief Privileged broker handing raw sockets over to unprivileged processes.
+ *
+ * Opening the raw sockets sending the probes (see socketpool_create) and
+ * sniffing the replies (see sniffer_create) requires root privileges
+ * (CAP_NET_RAW), and tuning their buffers beyond the system limits
+ * requires CAP_NET_ADMIN. A broker_server_t is the only privileged
+ * process: it opens and configures these sockets (binding, socket
+ * filters, timestamping, buffer sizes) like the sniffer and the
+ * socketpool would, and passes them (SCM_RIGHTS) to each process started
+ * with --broker-client PATH connecting to the UNIX socket PATH.
+ *
+ * A process fetches a set of sockets for the calling thread (see
+ * broker_client_fetch) before creating its network layer. The socketpool
+ * and the sniffer then take the sockets of this set (see broker_take_socket)
+ * instead of opening their own, so that the process needs no privilege,
+ * and may drop the sockets it does not use (see broker_client_release).
+ * Since the kernel delivers every reply to every raw socket, each
+ * process (or thread) gets its own set, which is never reused.
+ *
+ * In order to answer at once, the server keeps BROKER_NUM_SPARES sets
+ * opened in advance, and opens a new one once a set has been handed over.
+ * The packets queued on a spare set meanwhile are discarded before it is
+ * handed over. Anyone allowed to connect to PATH is granted raw sockets:
+ * the access to the broker is controlled by the permissions of the
+ * directory of PATH.
+ */
+
+#include <stdbool.h>      // bool
+#include <stddef.h>       // size_t
+#include <stdint.h>       // uint*_t
+#include <stdio.h>        // FILE
+
+// Indexes of the sockets of a set.
+#define BROKER_SOCKET_IPV4_RAW 0 /**< Sends the IPv4 probes */
+#define BROKER_SOCKET_IPV6_RAW 1 /**< Sends the IPv6 probes */
+#define BROKER_SOCKET_ICMPV4   2 /**< Sniffs the ICMPv4 replies */
+#define BROKER_SOCKET_ICMPV6   3 /**< Sniffs the ICMPv6 replies */
+#define BROKER_SOCKET_TCPV4    4 /**< Sniffs the IPv4/TCP replies (see sniffer_enable_tcp) */
+#define BROKER_SOCKET_TCPV6    5 /**< Sniffs the IPv6/TCP replies (idem) */
+#define BROKER_NUM_SOCKETS     6
+
+// Number of sets of sockets opened in advance by the server.
+#define BROKER_NUM_SPARES 4
+
+// Default size of the buffers of the sockets (in bytes).
+#define BROKER_DEFAULT_BUFFER_SIZE (4 << 20)
+
+// Time given to the server to answer a client (in seconds).
+#define BROKER_CONNECT_TIMEOUT 5
+
+/**
+ * \struct broker_sockets_t
+ * \brief A set of sockets.
+ */
+
+typedef struct {
+    int fds[BROKER_NUM_SOCKETS]; /**< The sockets, indexed by BROKER_SOCKET_*, -1 if not available */
+} broker_sockets_t;
+
+//---------------------------------------------------------------------------
+// Server
+//---------------------------------------------------------------------------
+
+/**
+ * \struct broker_server_t
+ * \brief A broker handing sets of sockets over to its clients.
+ */
+
+typedef struct {
+    char             * path;                        /**< Path of the listening socket */
+    int                sockfd;                      /**< The listening socket */
+    size_t             buffer_size;                 /**< Size of the buffers of the sockets (in bytes) */
+    broker_sockets_t   spares[BROKER_NUM_SPARES];   /**< The sets opened in advance */
+    size_t             num_spares;                  /**< Number of sets in spares */
+    uint64_t           num_served;                  /**< Number of sets handed over */
+    uint64_t           num_failed;                  /**< Number of requests which could not be served */
+} broker_server_t;
+
+/**
+ * \brief Create a broker. It opens the first sets of sockets (root
+ *    privileges are required).
+ * \param path The path of the UNIX socket accepting the clients. A
+ *    socket left by a previous run is replaced.
+ * \param buffer_size The size of the send and receive buffers of the
+ *    sockets (in bytes), 0 to keep the default of the system.
+ * \return The newly created server, NULL in case of failure.
+ */
+
+broker_server_t * broker_server_create(const char * path, size_t buffer_size);
+
+/**
+ * \brief Release a broker. The sockets already handed over remain usable.
+ * \param server A broker_server_t instance.
+ */
+
+void broker_server_free(broker_server_t * server);
+
+/**
+ * \brief Answer the clients of a broker until SIGINT or SIGTERM is
+ *    received.
+ * \param server A broker_server_t instance.
+ * \return true iif successful.
+ */
+
+bool broker_server_run(broker_server_t * server);
+
+/**
+ * \brief Print the counters of a broker.
+ * \param server A broker_server_t instance.
+ * \param file The output file (e.g. stderr).
+ */
+
+void broker_server_dump(const broker_server_t * server, FILE * file);
+
+//---------------------------------------------------------------------------
+// Client
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Fetch a set of sockets from a broker. They are taken by the next
+ *    socketpool and sniffer created by the calling thread, and replace
+ *    the sockets previously fetched (if any).
+ * \param path The path of the UNIX socket of the server.
+ * \param with_tcp Pass true to also fetch the sockets sniffing the TCP
+ *    replies.
+ * \return true iif successful.
+ */
+
+bool broker_client_fetch(const char * path, bool with_tcp);
+
+/**
+ * \brief Take a socket fetched by the calling thread (see
+ *    broker_client_fetch). The caller becomes its owner.
+ * \param index The index of the socket (see BROKER_SOCKET_*).
+ * \return The socket, -1 if it has not been fetched.
+ */
+
+int broker_take_socket(size_t index);
+
+/**
+ * \brief Test whether the calling thread has fetched a socket which has
+ *    not been taken yet.
+ * \param index The index of the socket (see BROKER_SOCKET_*).
+ * \return true iif the socket is available.
+ */
+
+bool broker_has_socket(size_t index);
+
+/**
+ * \brief Close the sockets fetched by the calling thread which have not
+ *    been taken.
+ */
+
+void broker_client_release();
+
+#endif // BROKER_H
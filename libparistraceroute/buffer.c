@@ -5,11 +5,25 @@
 #include <string.h>
 
 #include "buffer.h"
+#include "pool.h"       // pool_t
+
+static __thread pool_t buffer_pool = POOL_INITIALIZER(sizeof(buffer_t), free);
+
+static void buffer_pool_clear() __attribute__((destructor));
+
+static void buffer_pool_clear() {
+    pool_clear(&buffer_pool, free);
+}
+
+static inline bool buffer_is_inline(const buffer_t * buffer) {
+    return buffer->data == buffer->inline_data;
+}
 
 buffer_t * buffer_create() {
     buffer_t * buffer;
+    bool       recycled;
 
-    if ((buffer = malloc(sizeof(buffer_t)))) {
+    if ((buffer = pool_alloc(&buffer_pool, &recycled))) {
         buffer->data = NULL;
         buffer->size = 0;
     }
@@ -20,16 +34,15 @@ buffer_t * buffer_dup(const buffer_t * buffer)
 {
     buffer_t * ret;
 
-    if (!buffer)                                goto ERR_INVALID_PARAMETER;
-    if (!(ret = buffer_create()))               goto ERR_BUFFER_CREATE;
-    if (!(ret->data = calloc(1, buffer->size))) goto ERR_BUFFER_DATA;
+    if (!buffer)                           goto ERR_INVALID_PARAMETER;
+    if (!(ret = buffer_create()))          goto ERR_BUFFER_CREATE;
+    if (!buffer_resize(ret, buffer->size)) goto ERR_BUFFER_RESIZE;
 
-    memcpy(ret->data, buffer->data, buffer->size);
-    ret->size = buffer->size;
+    if (buffer->size) memcpy(ret->data, buffer->data, buffer->size);
     return ret;
 
-ERR_BUFFER_DATA:
-    free(ret);
+ERR_BUFFER_RESIZE:
+    buffer_free(ret);
 ERR_BUFFER_CREATE:
 ERR_INVALID_PARAMETER:
     return NULL;
@@ -38,35 +51,47 @@ ERR_INVALID_PARAMETER:
 void buffer_free(buffer_t * buffer)
 {
     if (buffer) {
-        if (buffer->data) {
-            free(buffer->data);
-        }
-        free(buffer);
+        buffer_clear(buffer);
+        if (!pool_release(&buffer_pool, buffer)) free(buffer);
     }
 }
 
+void buffer_clear(buffer_t * buffer)
+{
+    if (buffer->data && !buffer_is_inline(buffer)) {
+        free(buffer->data);
+    }
+    buffer->data = NULL;
+    buffer->size = 0;
+}
+
 bool buffer_resize(buffer_t * buffer, size_t size)
 {
     uint8_t * data2;
-    bool      ret = true;
     size_t    old_size = buffer->size;
 
     if (old_size != size) {
-        if (buffer->data) {
-            data2 = realloc(buffer->data, size * sizeof(uint8_t));
-            if (data2 && size > old_size) {
-                memset(data2 + old_size, 0, size - old_size); 
+        if (!buffer->data || buffer_is_inline(buffer)) {
+            if (size <= BUFFER_INLINE_SIZE) {
+                data2 = buffer->inline_data;
+            } else if ((data2 = malloc(size * sizeof(uint8_t)))) {
+                if (buffer->data) memcpy(data2, buffer->data, old_size);
             }
         } else {
-            data2 = calloc(size, sizeof(uint8_t));
+            data2 = realloc(buffer->data, size * sizeof(uint8_t));
         }
-        if (data2) {
-            buffer->data = data2;
-            buffer->size = size;
+
+        if (!data2) return false;
+
+        if (!buffer->data) old_size = 0;
+        if (size > old_size) {
+            memset(data2 + old_size, 0, size - old_size);
         }
-        ret = (data2 != NULL);
+        buffer->data = data2;
+        buffer->size = size;
     }
-    return ret;
+
+    return true;
 }
 
 inline uint8_t * buffer_get_data(const buffer_t * buffer) {
@@ -5,14 +5,19 @@
 #include <stdbool.h> // bool
 #include <stdint.h>
 
+// Buffers up to this size (in bytes) are stored in the buffer_t instance
+// itself, so that probe packets do not require any additional allocation.
+#define BUFFER_INLINE_SIZE 128
+
 /**
  * \struct buffer_t
  * \brief A buffer structure.
  */
 
 typedef struct {
-    uint8_t * data; /**< Data stored in the buffer   */
-    size_t    size; /**< Size of the data (in bytes) */
+    uint8_t * data;                            /**< Data stored in the buffer (may point to inline_data) */
+    size_t    size;                            /**< Size of the data (in bytes) */
+    uint8_t   inline_data[BUFFER_INLINE_SIZE]; /**< Storage of small buffers */
 } buffer_t;
 
 //-----------------------------------------------------------------
@@ -44,6 +49,13 @@ buffer_t * buffer_dup(const buffer_t * buffer);
 
 void buffer_free(buffer_t * buffer);
 
+/**
+ * \brief Release the data stored in a buffer. The buffer is then empty.
+ * \param buffer Pointer to the buffer structure to clear
+ */
+
+void buffer_clear(buffer_t * buffer);
+
 //-----------------------------------------------------------------
 // Accessors
 //-----------------------------------------------------------------
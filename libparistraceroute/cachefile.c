@@ -0,0 +1,318 @@
+#include "config.h"
+
+#include <stdlib.h>             // malloc, free
+#include <stdio.h>              // fprintf, perror, rename
+#include <string.h>             // memcpy, memset, memcmp
+#include <time.h>               // time
+#include <fcntl.h>              // open
+#include <unistd.h>             // write, close
+#include <sys/mman.h>           // mmap, munmap
+#include <sys/stat.h>           // fstat
+
+#include "cachefile.h"
+#include "whois.h"              // whois_cache_asn
+#include "containers/hashmap.h" // hashmap_t
+
+// Hostnames longer than this are not saved
+#define CACHEFILE_MAX_HOSTNAME_LENGTH 1024
+
+// Size of a record and of the hostname following it
+#define CACHEFILE_RECORD_SIZE(length) (sizeof(cachefile_record_t) + (((length) + 7) & ~((size_t) 7)))
+
+// The file in which the results are appended, -1 if none
+static int cachefile_fd = -1;
+
+/**
+ * \brief Identifies the entry updated by a record.
+ */
+
+typedef struct {
+    uint8_t type;
+    uint8_t ip_version;
+    uint8_t ip[16];
+} cachefile_key_t;
+
+static size_t cachefile_key_hash(const cachefile_key_t * key) {
+    return hashmap_hash_bytes(key, sizeof(cachefile_key_t));
+}
+
+static int cachefile_key_compare(const cachefile_key_t * key1, const cachefile_key_t * key2) {
+    return memcmp(key1, key2, sizeof(cachefile_key_t));
+}
+
+/**
+ * \brief Check whether a record is well-formed.
+ * \param record The record.
+ * \return true iif valid.
+ */
+
+static bool cachefile_record_is_valid(const cachefile_record_t * record) {
+    return (record->type == CACHEFILE_HOSTNAME || (record->type == CACHEFILE_ASN && record->length == 0))
+        && (record->ip_version == 4 || record->ip_version == 6)
+        && record->length <= CACHEFILE_MAX_HOSTNAME_LENGTH;
+}
+
+/**
+ * \brief Load a record in the cache of address_resolv or whois_get_asn.
+ * \param record A valid record.
+ * \param hostname The hostname following the record.
+ */
+
+static void cachefile_record_load(const cachefile_record_t * record, const char * hostname) {
+    address_t address;
+    char      buffer[CACHEFILE_MAX_HOSTNAME_LENGTH + 1];
+
+    memset(&address, 0, sizeof(address_t));
+    if (record->ip_version == 4) {
+        address.family = AF_INET;
+        memcpy(&address.ip.ipv4, record->ip, sizeof(ipv4_t));
+    } else {
+        address.family = AF_INET6;
+        memcpy(&address.ip.ipv6, record->ip, sizeof(ipv6_t));
+    }
+
+    // The results loaded are not appended again (ttl == 0)
+    switch (record->type) {
+        case CACHEFILE_HOSTNAME:
+            memcpy(buffer, hostname, record->length);
+            buffer[record->length] = '\0';
+            address_cache_hostname(&address, record->length ? buffer : NULL, 0);
+            break;
+        case CACHEFILE_ASN:
+            whois_cache_asn(&address, record->asn, 0);
+            break;
+    }
+}
+
+/**
+ * \brief Write a cache file only made of the records which have not
+ *    expired, and replace the previous one.
+ * \param filename The cache file.
+ * \param base The content of the previous file.
+ * \param index Maps each cachefile_key_t to the offset of its latest record.
+ * \param now The current date.
+ * \return The file descriptor of the new file, -1 in case of failure.
+ */
+
+static int cachefile_compact(const char * filename, const uint8_t * base, const hashmap_t * index, time_t now) {
+    const cachefile_record_t * record;
+    const size_t             * poffset;
+    char                     * tmp_filename;
+    int                        fd = -1;
+    FILE                     * file;
+    size_t                     i = 0;
+
+    if (!(tmp_filename = malloc(strlen(filename) + 5))) goto ERR_MALLOC;
+    sprintf(tmp_filename, "%s.tmp", filename);
+
+    if (!(file = fopen(tmp_filename, "w"))) goto ERR_FOPEN;
+    if (fwrite(base, sizeof(cachefile_header_t), 1, file) != 1) goto ERR_FWRITE;
+
+    while (hashmap_next(index, &i, NULL, &poffset)) {
+        record = (const cachefile_record_t *) (base + *poffset);
+        if (record->expiry > (uint64_t) now
+        &&  fwrite(record, CACHEFILE_RECORD_SIZE(record->length), 1, file) != 1) {
+            goto ERR_FWRITE;
+        }
+    }
+
+    if (fclose(file) != 0) goto ERR_FCLOSE;
+    if (rename(tmp_filename, filename) != 0) goto ERR_RENAME;
+    if ((fd = open(filename, O_WRONLY | O_APPEND | O_CLOEXEC)) == -1) goto ERR_OPEN;
+    free(tmp_filename);
+    return fd;
+
+ERR_FWRITE:
+    fclose(file);
+ERR_FCLOSE:
+ERR_RENAME:
+    unlink(tmp_filename);
+ERR_OPEN:
+ERR_FOPEN:
+    perror(tmp_filename);
+    free(tmp_filename);
+ERR_MALLOC:
+    return -1;
+}
+
+bool cachefile_open(const char * filename)
+{
+    int                        fd, compacted_fd;
+    struct stat                st;
+    uint8_t                  * base;
+    cachefile_header_t         header;
+    const cachefile_record_t * record;
+    cachefile_key_t            key;
+    hashmap_t                * index;
+    size_t                     offset, i = 0, num_records = 0, num_live = 0;
+    const size_t             * poffset;
+    bool                       is_truncated = false;
+    time_t                     now = time(NULL);
+
+    cachefile_close();
+
+    if ((fd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1
+    ||  fstat(fd, &st) == -1) {
+        perror(filename);
+        goto ERR_OPEN;
+    }
+
+    memset(&header, 0, sizeof(cachefile_header_t));
+    memcpy(header.magic, CACHEFILE_MAGIC, sizeof(CACHEFILE_MAGIC));
+    header.version    = CACHEFILE_VERSION;
+    header.byte_order = CACHEFILE_BYTE_ORDER;
+
+    // A new cache file
+    if (st.st_size == 0) {
+        if (write(fd, &header, sizeof(cachefile_header_t)) != sizeof(cachefile_header_t)) {
+            perror(filename);
+            goto ERR_WRITE;
+        }
+        cachefile_fd = fd;
+        return true;
+    }
+
+    if ((size_t) st.st_size < sizeof(cachefile_header_t)) {
+        fprintf(stderr, "%s: invalid cache file\n", filename);
+        goto ERR_INVALID_FILE;
+    }
+
+    if ((base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror(filename);
+        goto ERR_MMAP;
+    }
+
+    if (memcmp(base, &header, sizeof(cachefile_header_t)) != 0) {
+        fprintf(stderr, "%s: invalid cache file\n", filename);
+        goto ERR_INVALID_HEADER;
+    }
+
+    if (!(index = hashmap_create(
+        sizeof(cachefile_key_t), cachefile_key_hash, cachefile_key_compare, NULL,
+        sizeof(size_t),          NULL,               NULL
+    ))) goto ERR_HASHMAP_CREATE;
+
+    // Find the latest record of each entry. A record may have been partly
+    // written, e.g. if a process has crashed.
+    for (offset = sizeof(cachefile_header_t); offset < (size_t) st.st_size; offset += CACHEFILE_RECORD_SIZE(record->length)) {
+        record = (const cachefile_record_t *) (base + offset);
+        if (offset + sizeof(cachefile_record_t) > (size_t) st.st_size
+        ||  !cachefile_record_is_valid(record)
+        ||  offset + CACHEFILE_RECORD_SIZE(record->length) > (size_t) st.st_size) {
+            is_truncated = true;
+            break;
+        }
+
+        memset(&key, 0, sizeof(cachefile_key_t));
+        key.type       = record->type;
+        key.ip_version = record->ip_version;
+        memcpy(key.ip, record->ip, sizeof(key.ip));
+        if (!hashmap_update(index, &key, &offset)) goto ERR_HASHMAP_UPDATE;
+        num_records++;
+    }
+
+    while (hashmap_next(index, &i, NULL, &poffset)) {
+        record = (const cachefile_record_t *) (base + *poffset);
+        if (record->expiry > (uint64_t) now) {
+            cachefile_record_load(record, (const char *) (record + 1));
+            num_live++;
+        }
+    }
+
+    // The records appended after a truncated record could not be read
+    if (is_truncated || num_records > 2 * num_live) {
+        if ((compacted_fd = cachefile_compact(filename, base, index, now)) == -1) {
+            goto ERR_COMPACT;
+        }
+        close(fd);
+        fd = compacted_fd;
+    }
+
+    hashmap_free(index);
+    munmap(base, st.st_size);
+    cachefile_fd = fd;
+    return true;
+
+ERR_COMPACT:
+ERR_HASHMAP_UPDATE:
+    hashmap_free(index);
+ERR_HASHMAP_CREATE:
+ERR_INVALID_HEADER:
+    munmap(base, st.st_size);
+ERR_MMAP:
+ERR_INVALID_FILE:
+ERR_WRITE:
+    close(fd);
+ERR_OPEN:
+    return false;
+}
+
+void cachefile_close()
+{
+    if (cachefile_fd != -1) {
+        close(cachefile_fd);
+        cachefile_fd = -1;
+    }
+}
+
+/**
+ * \brief Append a record (and the hostname following it) to the cache file.
+ * \param record The record, whose ip_version and ip are set by this function.
+ * \param address The looked up address.
+ * \param hostname The hostname (of record->length bytes), NULL if none.
+ * \param ttl The number of seconds during which the result is valid.
+ */
+
+static void cachefile_append(cachefile_record_t * record, const address_t * address, const char * hostname, uint32_t ttl)
+{
+    uint8_t buffer[CACHEFILE_RECORD_SIZE(CACHEFILE_MAX_HOSTNAME_LENGTH)];
+    size_t  size = CACHEFILE_RECORD_SIZE(record->length);
+
+    switch (address->family) {
+        case AF_INET:
+            record->ip_version = 4;
+            memcpy(record->ip, &address->ip.ipv4, sizeof(ipv4_t));
+            break;
+        case AF_INET6:
+            record->ip_version = 6;
+            memcpy(record->ip, &address->ip.ipv6, sizeof(ipv6_t));
+            break;
+        default:
+            return;
+    }
+    record->expiry = time(NULL) + (ttl < CACHEFILE_MAX_TTL ? ttl : CACHEFILE_MAX_TTL);
+
+    // A single write, so that the records appended by several processes
+    // are not interleaved.
+    memset(buffer, 0, size);
+    memcpy(buffer, record, sizeof(cachefile_record_t));
+    if (hostname) memcpy(buffer + sizeof(cachefile_record_t), hostname, record->length);
+    if (write(cachefile_fd, buffer, size) != (ssize_t) size) {
+        perror("cachefile_append");
+    }
+}
+
+void cachefile_append_hostname(const address_t * address, const char * hostname, uint32_t ttl)
+{
+    cachefile_record_t record;
+    size_t             length = strlen(hostname);
+
+    if (cachefile_fd == -1 || ttl == 0 || length > CACHEFILE_MAX_HOSTNAME_LENGTH) return;
+
+    memset(&record, 0, sizeof(cachefile_record_t));
+    record.type   = CACHEFILE_HOSTNAME;
+    record.length = length;
+    cachefile_append(&record, address, hostname, ttl);
+}
+
+void cachefile_append_asn(const address_t * address, uint32_t asn, uint32_t ttl)
+{
+    cachefile_record_t record;
+
+    if (cachefile_fd == -1 || ttl == 0) return;
+
+    memset(&record, 0, sizeof(cachefile_record_t));
+    record.type = CACHEFILE_ASN;
+    record.asn  = asn;
+    cachefile_append(&record, address, NULL, ttl);
+}
@@ -0,0 +1,103 @@
+#include "use.h"
+
+#ifndef CACHEFILE_H
+#define CACHEFILE_H
+
+/**
+ * \file cachefile.h
+ * \brief Persistent cache of the hostnames and origin AS of the
+ *    discovered addresses.
+ *
+ * The caches of address_resolv and whois_get_asn only last for the
+ * lifetime of the process. Once a cache file is opened, the entries
+ * stored by a previous run which have not expired are loaded (the file is
+ * mmap()ed) into these caches, and every new lookup result is appended
+ * to the file along with its expiry date. Repeated campaigns then skip
+ * nearly all the DNS and whois traffic.
+ *
+ * The file is a header followed by a log of records, each one being
+ * written at once (O_APPEND), so that several processes may share a
+ * cache file. The latest record of an address overrides the previous
+ * ones. The file is compacted when it is opened, if most of its records
+ * are expired or overridden.
+ */
+
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint*_t
+
+#include "address.h"    // address_t
+
+#define CACHEFILE_MAGIC      "PTCACHE"
+#define CACHEFILE_VERSION    1
+
+// Written in the header to detect a file written on a host having another byte order
+#define CACHEFILE_BYTE_ORDER 0x01020304
+
+// Lifetime (in seconds) of the results which are not retrieved from a DNS
+// record (gethostbyaddr, whois)
+#define CACHEFILE_DEFAULT_TTL  86400
+
+// Lifetime (in seconds) of a name which does not exist (or has no record)
+#define CACHEFILE_NEGATIVE_TTL 3600
+
+// Maximum lifetime (in seconds) of an entry
+#define CACHEFILE_MAX_TTL      (7 * 86400)
+
+typedef enum {
+    CACHEFILE_HOSTNAME = 1, /**< A reverse DNS lookup (see address_resolv) */
+    CACHEFILE_ASN      = 2  /**< An origin AS lookup (see whois_get_asn) */
+} cachefile_type_t;
+
+typedef struct {
+    char     magic[8];      /**< CACHEFILE_MAGIC */
+    uint32_t version;       /**< CACHEFILE_VERSION */
+    uint32_t byte_order;    /**< CACHEFILE_BYTE_ORDER */
+} cachefile_header_t;
+
+typedef struct {
+    uint64_t expiry;        /**< When the entry expires (seconds since the Epoch) */
+    uint32_t asn;           /**< CACHEFILE_ASN: the origin AS, 0 if the lookup has failed */
+    uint8_t  type;          /**< A cachefile_type_t */
+    uint8_t  ip_version;    /**< 4 or 6 */
+    uint16_t length;        /**< CACHEFILE_HOSTNAME: length of the hostname following
+                                 the record (0 if the lookup has failed). The record is
+                                 then padded to a multiple of 8 bytes. */
+    uint8_t  ip[16];        /**< The address */
+} cachefile_record_t;
+
+/**
+ * \brief Open a cache file (or create it), and load the entries which
+ *    have not expired into the caches of address_resolv and whois_get_asn.
+ * \param filename The cache file.
+ * \return true iif successful.
+ */
+
+bool cachefile_open(const char * filename);
+
+/**
+ * \brief Close the cache file. The lookup results are no longer saved.
+ */
+
+void cachefile_close();
+
+/**
+ * \brief Append the result of a reverse DNS lookup to the cache file
+ *    (if opened).
+ * \param address The looked up address.
+ * \param hostname Its hostname, "" if the lookup has failed.
+ * \param ttl The number of seconds during which the result is valid.
+ */
+
+void cachefile_append_hostname(const address_t * address, const char * hostname, uint32_t ttl);
+
+/**
+ * \brief Append the result of an origin AS lookup to the cache file
+ *    (if opened).
+ * \param address The looked up address.
+ * \param asn Its origin AS, 0 if the lookup has failed.
+ * \param ttl The number of seconds during which the result is valid.
+ */
+
+void cachefile_append_asn(const address_t * address, uint32_t asn, uint32_t ttl);
+
+#endif // CACHEFILE_H
@@ -0,0 +1,331 @@
+#include "config.h"
+
+#include <stdlib.h>     // malloc, free
+#include <stdio.h>      // perror
+#include <string.h>     // memcpy, memset, strlen
+#include <errno.h>      // errno, EINTR
+#include <time.h>       // clock_gettime
+#include <fcntl.h>      // open
+#include <unistd.h>     // write, close
+
+#include "capture.h"
+#include "common.h"     // get_time_ns
+
+// See https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html
+#define PCAPNG_SECTION_HEADER_BLOCK   0x0a0d0d0a
+#define PCAPNG_INTERFACE_BLOCK        0x00000001
+#define PCAPNG_ENHANCED_PACKET_BLOCK  0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC       0x1a2b3c4d
+#define PCAPNG_OPT_ENDOFOPT           0
+#define PCAPNG_OPT_COMMENT            1
+#define PCAPNG_OPT_SHB_USERAPPL       4
+#define PCAPNG_OPT_IF_TSRESOL         9
+#define PCAPNG_OPT_EPB_FLAGS          2
+#define PCAPNG_LINKTYPE_RAW           101
+#define PCAPNG_TSRESOL_NS             9
+
+#define CAPTURE_USERAPPL "libparistraceroute"
+
+// Longer comments are truncated
+#define CAPTURE_MAX_COMMENT_LENGTH    1024
+
+#define PAD4(size) (((size) + 3) & ~((size_t) 3))
+
+//---------------------------------------------------------------------------
+// pcapng blocks
+//---------------------------------------------------------------------------
+
+// The blocks are written in the byte order of the host, which is given
+// by the byte-order magic of the section header.
+
+static inline uint8_t * put_uint16(uint8_t * p, uint16_t x) {
+    memcpy(p, &x, sizeof(x));
+    return p + sizeof(x);
+}
+
+static inline uint8_t * put_uint32(uint8_t * p, uint32_t x) {
+    memcpy(p, &x, sizeof(x));
+    return p + sizeof(x);
+}
+
+static inline uint8_t * put_bytes(uint8_t * p, const void * bytes, size_t size) {
+    if (size) memcpy(p, bytes, size);
+    memset(p + size, 0, PAD4(size) - size);
+    return p + PAD4(size);
+}
+
+static inline uint8_t * put_option(uint8_t * p, uint16_t code, const void * value, uint16_t length) {
+    p = put_uint16(p, code);
+    p = put_uint16(p, length);
+    return put_bytes(p, value, length);
+}
+
+/**
+ * \brief Write the section header and the description of the interface.
+ * \param p Where the blocks are written.
+ * \return The end of the blocks.
+ */
+
+static uint8_t * put_header(uint8_t * p) {
+    uint8_t   tsresol = PCAPNG_TSRESOL_NS;
+    uint32_t  size;
+
+    size = 28 + 4 + PAD4(sizeof(CAPTURE_USERAPPL) - 1) + 4;
+    p = put_uint32(p, PCAPNG_SECTION_HEADER_BLOCK);
+    p = put_uint32(p, size);
+    p = put_uint32(p, PCAPNG_BYTE_ORDER_MAGIC);
+    p = put_uint16(p, 1);                    // major version
+    p = put_uint16(p, 0);                    // minor version
+    p = put_uint32(p, 0xffffffff);           // section length: unspecified
+    p = put_uint32(p, 0xffffffff);
+    p = put_option(p, PCAPNG_OPT_SHB_USERAPPL, CAPTURE_USERAPPL, sizeof(CAPTURE_USERAPPL) - 1);
+    p = put_option(p, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    p = put_uint32(p, size);
+
+    size = 20 + 4 + PAD4(sizeof(tsresol)) + 4;
+    p = put_uint32(p, PCAPNG_INTERFACE_BLOCK);
+    p = put_uint32(p, size);
+    p = put_uint16(p, PCAPNG_LINKTYPE_RAW);
+    p = put_uint16(p, 0);                    // reserved
+    p = put_uint32(p, 0);                    // snap length: unlimited
+    p = put_option(p, PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+    p = put_option(p, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    p = put_uint32(p, size);
+
+    return p;
+}
+
+//---------------------------------------------------------------------------
+// Writer
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Write a buffer in a file.
+ * \param fd The file descriptor.
+ * \param bytes The buffer.
+ * \param size The size of the buffer.
+ * \return true iif successful.
+ */
+
+static bool write_all(int fd, const uint8_t * bytes, size_t size) {
+    ssize_t written;
+
+    while (size > 0) {
+        if ((written = write(fd, bytes, size)) == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        size  -= written;
+    }
+    return true;
+}
+
+/**
+ * \brief Body of the thread writing the buffers handed by the probing loop.
+ * \param data The capture_t instance.
+ * \return NULL
+ */
+
+static void * capture_writer(void * data) {
+    capture_t        * capture = data;
+    capture_buffer_t * buffer;
+    bool               has_failed = false;
+
+    pthread_mutex_lock(&capture->mutex);
+    for (;;) {
+        while (!capture->num_full && !capture->is_closing) {
+            pthread_cond_wait(&capture->cond, &capture->mutex);
+        }
+        if (!capture->num_full) break;
+
+        // The probing loop does not touch the full buffers
+        buffer = &capture->buffers[capture->first_full];
+        pthread_mutex_unlock(&capture->mutex);
+
+        if (!has_failed && !write_all(capture->fd, buffer->bytes, buffer->size)) {
+            perror("capture_writer");
+            has_failed = true;
+        }
+        buffer->size = 0;
+
+        pthread_mutex_lock(&capture->mutex);
+        capture->first_full = (capture->first_full + 1) % CAPTURE_NUM_BUFFERS;
+        capture->num_full--;
+    }
+    pthread_mutex_unlock(&capture->mutex);
+    return NULL;
+}
+
+/**
+ * \brief Hand the current buffer to the writer, and move to the next
+ *    buffer of the ring.
+ * \param capture A capture_t instance.
+ * \param now The current time (see get_time_ns).
+ * \return true iif successful, false if the ring is full.
+ */
+
+static bool capture_hand_off(capture_t * capture, uint64_t now) {
+    bool ret;
+
+    if (!capture->buffers[capture->current].size) return true;
+
+    // The buffer following the current one must not be written, otherwise
+    // the ring is full.
+    pthread_mutex_lock(&capture->mutex);
+    if ((ret = capture->num_full < CAPTURE_NUM_BUFFERS - 1)) {
+        capture->num_full++;
+        capture->current = (capture->current + 1) % CAPTURE_NUM_BUFFERS;
+        pthread_cond_signal(&capture->cond);
+    }
+    pthread_mutex_unlock(&capture->mutex);
+
+    if (ret) capture->last_flush = now;
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// capture_t
+//---------------------------------------------------------------------------
+
+capture_t * capture_create(const char * filename)
+{
+    capture_t       * capture;
+    struct timespec   now;
+    size_t            i;
+
+    if (!(capture = calloc(1, sizeof(capture_t)))) goto ERR_CALLOC;
+
+    for (i = 0; i < CAPTURE_NUM_BUFFERS; i++) {
+        if (!(capture->buffers[i].bytes = malloc(CAPTURE_BUFFER_SIZE))) goto ERR_MALLOC;
+    }
+
+    if ((capture->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        perror(filename);
+        goto ERR_OPEN;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    capture->last_flush  = get_time_ns();
+    capture->time_offset = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - capture->last_flush;
+    capture->buffers[0].size = put_header(capture->buffers[0].bytes) - capture->buffers[0].bytes;
+
+    if (pthread_mutex_init(&capture->mutex, NULL) != 0)  goto ERR_MUTEX_INIT;
+    if (pthread_cond_init(&capture->cond, NULL) != 0)    goto ERR_COND_INIT;
+    if (pthread_create(&capture->writer, NULL, capture_writer, capture) != 0) {
+        perror("capture_create");
+        goto ERR_PTHREAD_CREATE;
+    }
+    return capture;
+
+ERR_PTHREAD_CREATE:
+    pthread_cond_destroy(&capture->cond);
+ERR_COND_INIT:
+    pthread_mutex_destroy(&capture->mutex);
+ERR_MUTEX_INIT:
+    close(capture->fd);
+ERR_OPEN:
+ERR_MALLOC:
+    for (i = 0; i < CAPTURE_NUM_BUFFERS; i++) {
+        free(capture->buffers[i].bytes);
+    }
+    free(capture);
+ERR_CALLOC:
+    return NULL;
+}
+
+void capture_free(capture_t * capture)
+{
+    capture_buffer_t * buffer;
+    size_t             i;
+
+    if (capture) {
+        // The writer terminates once every full buffer is written
+        pthread_mutex_lock(&capture->mutex);
+        capture->is_closing = true;
+        pthread_cond_signal(&capture->cond);
+        pthread_mutex_unlock(&capture->mutex);
+        pthread_join(capture->writer, NULL);
+
+        buffer = &capture->buffers[capture->current];
+        if (!write_all(capture->fd, buffer->bytes, buffer->size)) {
+            perror("capture_free");
+        }
+        if (capture->num_dropped) {
+            fprintf(stderr, "capture: %zu packets dropped\n", capture->num_dropped);
+        }
+
+        close(capture->fd);
+        pthread_cond_destroy(&capture->cond);
+        pthread_mutex_destroy(&capture->mutex);
+        for (i = 0; i < CAPTURE_NUM_BUFFERS; i++) {
+            free(capture->buffers[i].bytes);
+        }
+        free(capture);
+    }
+}
+
+bool capture_write_packet(
+    capture_t           * capture,
+    const uint8_t       * bytes,
+    size_t                size,
+    uint64_t              time,
+    capture_direction_t   direction,
+    const char          * comment
+) {
+    capture_buffer_t * buffer = &capture->buffers[capture->current];
+    size_t             comment_length = comment ? strlen(comment) : 0,
+                       block_size;
+    uint64_t           timestamp = time + capture->time_offset;
+    uint32_t           flags = direction;
+    uint8_t          * p;
+
+    if (comment_length > CAPTURE_MAX_COMMENT_LENGTH) comment_length = CAPTURE_MAX_COMMENT_LENGTH;
+    block_size = 28 + PAD4(size)
+               + 4 + PAD4(sizeof(flags))
+               + (comment_length ? 4 + PAD4(comment_length) : 0)
+               + 4 + 4;
+    if (block_size > CAPTURE_BUFFER_SIZE) goto ERR_TOO_LARGE;
+
+    // Hand the current buffer to the writer once it is full or once it
+    // has not been written for a while.
+    if (buffer->size + block_size > CAPTURE_BUFFER_SIZE
+    ||  time > capture->last_flush + CAPTURE_FLUSH_INTERVAL) {
+        if (!capture_hand_off(capture, time) && buffer->size + block_size > CAPTURE_BUFFER_SIZE) {
+            goto ERR_RING_FULL;
+        }
+        buffer = &capture->buffers[capture->current];
+    }
+
+    p = buffer->bytes + buffer->size;
+    p = put_uint32(p, PCAPNG_ENHANCED_PACKET_BLOCK);
+    p = put_uint32(p, block_size);
+    p = put_uint32(p, 0);                    // interface ID
+    p = put_uint32(p, timestamp >> 32);
+    p = put_uint32(p, timestamp);
+    p = put_uint32(p, size);                 // captured length
+    p = put_uint32(p, size);                 // original length
+    p = put_bytes (p, bytes, size);
+    p = put_option(p, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+    if (comment_length) {
+        p = put_option(p, PCAPNG_OPT_COMMENT, comment, comment_length);
+    }
+    p = put_option(p, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    p = put_uint32(p, block_size);
+
+    buffer->size += block_size;
+    return true;
+
+ERR_RING_FULL:
+ERR_TOO_LARGE:
+    capture->num_dropped++;
+    return false;
+}
+
+bool capture_flush(capture_t * capture) {
+    return capture_hand_off(capture, get_time_ns());
+}
+
+size_t capture_get_num_dropped(const capture_t * capture) {
+    return capture->num_dropped;
+}
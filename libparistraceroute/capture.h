@@ -0,0 +1,115 @@
+#include "use.h"
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/**
+ * \file capture.h
+ * \brief Capture of the probes sent and of the replies received in a
+ *    pcapng file.
+ *
+ * The packets are recorded by the network layer itself, so that each
+ * Enhanced Packet Block carries, as a comment, the tag and the instance
+ * related to the packet (see network_set_capture). The packets are raw
+ * IP packets (LINKTYPE_RAW) timestamped in nanoseconds.
+ *
+ * The blocks are appended to a ring of CAPTURE_NUM_BUFFERS preallocated
+ * buffers. Once a buffer is full (or CAPTURE_FLUSH_INTERVAL has elapsed),
+ * it is handed to a background thread writing it to the file, and the
+ * next buffer of the ring is used. Writing a packet thus never blocks
+ * the probing loop: if the file cannot be written fast enough and the
+ * ring is full, the packet is dropped (see capture_get_num_dropped).
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <pthread.h>    // pthread_*
+
+// Number of buffers of the ring
+#define CAPTURE_NUM_BUFFERS    8
+
+// Size of a buffer (in bytes)
+#define CAPTURE_BUFFER_SIZE    (256 * 1024)
+
+// Maximum delay before the captured packets are handed to the writer (in nanoseconds)
+#define CAPTURE_FLUSH_INTERVAL 1000000000ULL
+
+typedef enum {
+    CAPTURE_INBOUND  = 1, /**< A received packet (see epb_flags) */
+    CAPTURE_OUTBOUND = 2  /**< A sent packet (see epb_flags) */
+} capture_direction_t;
+
+typedef struct {
+    uint8_t * bytes;               /**< The blocks */
+    size_t    size;                /**< Number of bytes stored in bytes */
+} capture_buffer_t;
+
+typedef struct {
+    int              fd;                           /**< The pcapng file */
+    capture_buffer_t buffers[CAPTURE_NUM_BUFFERS]; /**< The ring of buffers */
+    size_t           current;      /**< Index of the buffer filled by the probing loop */
+    size_t           first_full;   /**< Index of the oldest buffer handed to the writer */
+    size_t           num_full;     /**< Number of buffers handed to the writer */
+    bool             is_closing;   /**< True once the writer must terminate */
+    pthread_mutex_t  mutex;        /**< Protects first_full, num_full and is_closing */
+    pthread_cond_t   cond;         /**< Signaled when a buffer is handed to the writer */
+    pthread_t        writer;       /**< The thread writing the full buffers */
+    uint64_t         last_flush;   /**< When the current buffer has been started (see get_time_ns) */
+    uint64_t         time_offset;  /**< Converts get_time_ns() into nanoseconds since the Epoch */
+    size_t           num_dropped;  /**< Number of packets dropped */
+} capture_t;
+
+/**
+ * \brief Create a pcapng file and start the thread writing it.
+ * \param filename The pcapng file (it is truncated if it exists).
+ * \return The newly created capture_t instance, NULL in case of failure.
+ */
+
+capture_t * capture_create(const char * filename);
+
+/**
+ * \brief Write the packets captured so far, stop the writer and close
+ *    the file.
+ * \param capture A capture_t instance.
+ */
+
+void capture_free(capture_t * capture);
+
+/**
+ * \brief Capture a packet.
+ * \param capture A capture_t instance.
+ * \param bytes The bytes of the packet, starting with its IP header.
+ * \param size The size of the packet.
+ * \param time When the packet has been sent or received (see get_time_ns).
+ * \param direction The direction of the packet.
+ * \param comment The comment of the packet, NULL if none.
+ * \return true iif the packet has been captured, false if it has been dropped.
+ */
+
+bool capture_write_packet(
+    capture_t           * capture,
+    const uint8_t       * bytes,
+    size_t                size,
+    uint64_t              time,
+    capture_direction_t   direction,
+    const char          * comment
+);
+
+/**
+ * \brief Hand the packets captured so far to the writer.
+ * \param capture A capture_t instance.
+ * \return true iif successful, false if the ring is full.
+ */
+
+bool capture_flush(capture_t * capture);
+
+/**
+ * \brief Retrieve the number of packets dropped since the ring was full.
+ * \param capture A capture_t instance.
+ * \return The number of packets dropped.
+ */
+
+size_t capture_get_num_dropped(const capture_t * capture);
+
+#endif // CAPTURE_H
@@ -3,14 +3,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>       // clock_gettime
 
 #include "common.h"
 
-// Note: for measuring intervals !
-//#include <time.h>
-//struct timespec ts;
-//clock_gettime(CLOCK_MONOTONIC, &ts);
-
 double get_timestamp()
 {
     struct timeval tim;
@@ -19,6 +15,26 @@ double get_timestamp()
     return tim.tv_sec + (tim.tv_usec / 1000000.0);
 }
 
+uint64_t get_time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int64_t get_realtime_offset_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ((uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec - get_time_ns());
+}
+
+inline uint64_t realtime_to_time_ns(const struct timespec * ts, int64_t offset) {
+    return (uint64_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec - offset;
+}
+
 void print_indent(unsigned int indent)
 {
     unsigned int i;
@@ -1,6 +1,10 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint64_t, int64_t
+#include <time.h>     // struct timespec
+
 /**
  * \brief Type related to a *_free() function
  */
@@ -25,6 +29,12 @@
 
 #define ELEMENT_COMPARE int (*)(const void *, const void *)
 
+/**
+ * \brief Type related to a *_hash() function
+ */
+
+#define ELEMENT_HASH size_t (*)(const void *)
+
 /**
  * \brief Macro returning the minimal value of two elements
  * \param x The left operand
@@ -49,6 +59,45 @@
 
 double get_timestamp();
 
+// Number of nanoseconds per second
+#define NSEC_PER_SEC 1000000000ULL
+
+/**
+ * \brief Macros converting a number of nanoseconds (see get_time_ns)
+ *    into seconds, and conversely.
+ */
+
+#define NS_TO_SECONDS(ns) ((ns) / 1000000000.0)
+#define SECONDS_TO_NS(s)  ((uint64_t) ((s) * 1000000000.0))
+
+/**
+ * \brief Read CLOCK_MONOTONIC, which is not affected by the changes of the
+ *    system time. It is the time base of the probes and of the network
+ *    layer (sending and reception times, timeouts, delays...).
+ * \return The number of nanoseconds elapsed since an arbitrary origin.
+ */
+
+uint64_t get_time_ns();
+
+/**
+ * \brief Retrieve the offset between CLOCK_REALTIME, used by the kernel
+ *    to timestamp the packets, and get_time_ns.
+ * \return The offset (in nanoseconds).
+ */
+
+int64_t get_realtime_offset_ns();
+
+/**
+ * \brief Convert a CLOCK_REALTIME timestamp (e.g. SO_TIMESTAMPING) into
+ *    the time base of get_time_ns.
+ * \param ts The timestamp.
+ * \param offset The offset returned by get_realtime_offset_ns, which
+ *    may be read once for a batch of timestamps.
+ * \return The corresponding number of nanoseconds.
+ */
+
+uint64_t realtime_to_time_ns(const struct timespec * ts, int64_t offset);
+
 /**
  * \bruef Print some space characters
  * \param indent The number of space characters to print
@@ -0,0 +1,285 @@
+#include "config.h"
+
+#include <stdlib.h>              // malloc, calloc, free
+#include <string.h>              // memcpy, memset
+#include <stdio.h>               // printf
+#include <assert.h>              // assert
+
+#include "containers/hashmap.h"  // hashmap_t
+#include "hugemem.h"              // hugemem_*
+
+// Alignment of the keys and values stored in the slots
+#define HASHMAP_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+
+/**
+ * \brief Scramble the hash returned by key_hash, since the slot of a key
+ *    only depends on the lowest bits of its hash.
+ * \param hash The hash returned by key_hash.
+ * \return The hash stored in the hashmap_t (never 0).
+ */
+
+static inline size_t hashmap_mix(size_t hash) {
+    uint64_t h = hash;
+
+    // Finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    // 0 tags the free slots
+    return (size_t) h ? (size_t) h : 1;
+}
+
+static inline void * hashmap_get_key(const hashmap_t * hashmap, size_t i) {
+    return hashmap->slots + i * hashmap->slot_size;
+}
+
+static inline void * hashmap_get_data(const hashmap_t * hashmap, size_t i) {
+    return hashmap->slots + i * hashmap->slot_size + hashmap->data_offset;
+}
+
+/**
+ * \brief Find the slot storing a key, or the free slot where it must be
+ *    stored.
+ * \param hashmap A hashmap_t instance.
+ * \param key The key.
+ * \param hash The hash of the key (see hashmap_mix).
+ * \param pfound Address of a bool, set to true iif the key is stored.
+ * \return The index of the corresponding slot.
+ */
+
+static size_t hashmap_lookup(const hashmap_t * hashmap, const void * key, size_t hash, bool * pfound) {
+    size_t mask = hashmap->max_entries - 1,
+           i    = hash & mask;
+
+    for (; hashmap->hashes[i]; i = (i + 1) & mask) {
+        if (hashmap->hashes[i] == hash
+        &&  hashmap->key_compare(hashmap_get_key(hashmap, i), key) == 0) {
+            *pfound = true;
+            return i;
+        }
+    }
+    *pfound = false;
+    return i;
+}
+
+/**
+ * \brief Release the table of a hashmap_t.
+ * \param hashmap A hashmap_t instance.
+ */
+
+static void hashmap_free_table(hashmap_t * hashmap) {
+    hugemem_free(hashmap->hashes, hashmap->max_entries, sizeof(size_t));
+    hugemem_free(hashmap->slots, hashmap->max_entries, hashmap->slot_size);
+}
+
+/**
+ * \brief Resize the table of a hashmap_t.
+ * \param hashmap A hashmap_t instance.
+ * \param max_entries The new number of slots (power of 2).
+ * \return true iif successful
+ */
+
+static bool hashmap_resize(hashmap_t * hashmap, size_t max_entries) {
+    size_t  * hashes;
+    uint8_t * slots;
+    size_t    i, j, mask = max_entries - 1;
+
+    if (!(hashes = hugemem_calloc(max_entries, sizeof(size_t))))     goto ERR_CALLOC;
+    if (!(slots  = hugemem_calloc(max_entries, hashmap->slot_size))) goto ERR_MALLOC;
+
+    // The keys are already known to be distinct
+    for (i = 0; i < hashmap->max_entries; i++) {
+        if (hashmap->hashes[i]) {
+            for (j = hashmap->hashes[i] & mask; hashes[j]; j = (j + 1) & mask);
+            hashes[j] = hashmap->hashes[i];
+            memcpy(slots + j * hashmap->slot_size, hashmap_get_key(hashmap, i), hashmap->slot_size);
+        }
+    }
+
+    hashmap_free_table(hashmap);
+    hashmap->hashes      = hashes;
+    hashmap->slots       = slots;
+    hashmap->max_entries = max_entries;
+    return true;
+
+ERR_MALLOC:
+    hugemem_free(hashes, max_entries, sizeof(size_t));
+ERR_CALLOC:
+    return false;
+}
+
+hashmap_t * hashmap_create_impl(
+    size_t   key_size,
+    size_t (*key_hash)(const void * key),
+    int    (*key_compare)(const void * key1, const void * key2),
+    void   (*key_dump)(const void * key),
+    size_t   data_size,
+    void   (*data_free)(void * data),
+    void   (*data_dump)(const void * data)
+) {
+    hashmap_t * hashmap;
+
+    assert(key_hash);
+    assert(key_compare);
+
+    if (!(hashmap = malloc(sizeof(hashmap_t)))) goto ERR_MALLOC;
+
+    hashmap->key_size    = key_size;
+    hashmap->data_size   = data_size;
+    hashmap->data_offset = HASHMAP_ALIGN(key_size);
+    hashmap->slot_size   = HASHMAP_ALIGN(hashmap->data_offset + data_size);
+    hashmap->key_hash    = key_hash;
+    hashmap->key_compare = key_compare;
+    hashmap->key_dump    = key_dump;
+    hashmap->data_free   = data_free;
+    hashmap->data_dump   = data_dump;
+    hashmap->num_entries = 0;
+    hashmap->max_entries = HASHMAP_INITIAL_SIZE;
+
+    if (!(hashmap->hashes = hugemem_calloc(hashmap->max_entries, sizeof(size_t))))     goto ERR_CALLOC;
+    if (!(hashmap->slots  = hugemem_calloc(hashmap->max_entries, hashmap->slot_size))) goto ERR_MALLOC_SLOTS;
+    return hashmap;
+
+ERR_MALLOC_SLOTS:
+    hugemem_free(hashmap->hashes, hashmap->max_entries, sizeof(size_t));
+ERR_CALLOC:
+    free(hashmap);
+ERR_MALLOC:
+    return NULL;
+}
+
+void hashmap_free(hashmap_t * hashmap) {
+    if (hashmap) {
+        hashmap_clear(hashmap);
+        hashmap_free_table(hashmap);
+        free(hashmap);
+    }
+}
+
+void hashmap_clear(hashmap_t * hashmap) {
+    size_t i;
+
+    if (hashmap->data_free) {
+        for (i = 0; i < hashmap->max_entries; i++) {
+            if (hashmap->hashes[i]) hashmap->data_free(hashmap_get_data(hashmap, i));
+        }
+    }
+    memset(hashmap->hashes, 0, hashmap->max_entries * sizeof(size_t));
+    hashmap->num_entries = 0;
+}
+
+inline size_t hashmap_get_size(const hashmap_t * hashmap) {
+    return hashmap->num_entries;
+}
+
+bool hashmap_find_impl(const hashmap_t * hashmap, const void * key, void ** pdata) {
+    bool   found;
+    size_t i = hashmap_lookup(hashmap, key, hashmap_mix(hashmap->key_hash(key)), &found);
+
+    if (found && pdata) *pdata = hashmap_get_data(hashmap, i);
+    return found;
+}
+
+void * hashmap_emplace(hashmap_t * hashmap, const void * key, bool * pinserted) {
+    bool   found;
+    size_t i, hash = hashmap_mix(hashmap->key_hash(key));
+
+    i = hashmap_lookup(hashmap, key, hash, &found);
+    if (!found) {
+        // Keep the load factor under 3/4
+        if (4 * (hashmap->num_entries + 1) > 3 * hashmap->max_entries) {
+            if (!hashmap_resize(hashmap, 2 * hashmap->max_entries)) return NULL;
+            i = hashmap_lookup(hashmap, key, hash, &found);
+        }
+        hashmap->hashes[i] = hash;
+        memcpy(hashmap_get_key(hashmap, i), key, hashmap->key_size);
+        memset(hashmap_get_data(hashmap, i), 0, hashmap->data_size);
+        hashmap->num_entries++;
+    }
+
+    if (pinserted) *pinserted = !found;
+    return hashmap_get_data(hashmap, i);
+}
+
+bool hashmap_update_impl(hashmap_t * hashmap, const void * key, const void * data) {
+    void * slot_data;
+    bool   inserted;
+
+    if (!(slot_data = hashmap_emplace(hashmap, key, &inserted))) return false;
+
+    if (!inserted && hashmap->data_free) hashmap->data_free(slot_data);
+    if (data) memcpy(slot_data, data, hashmap->data_size);
+    else      memset(slot_data, 0,    hashmap->data_size);
+    return true;
+}
+
+bool hashmap_erase_impl(hashmap_t * hashmap, const void * key) {
+    bool   found;
+    size_t i, j, k,
+           mask = hashmap->max_entries - 1;
+
+    i = hashmap_lookup(hashmap, key, hashmap_mix(hashmap->key_hash(key)), &found);
+    if (!found) return false;
+
+    if (hashmap->data_free) hashmap->data_free(hashmap_get_data(hashmap, i));
+    hashmap->hashes[i] = 0;
+    hashmap->num_entries--;
+
+    // Backward shift: move back the following keys of the cluster which
+    // could not be stored in their own slot (no tombstone is needed).
+    for (j = (i + 1) & mask; hashmap->hashes[j]; j = (j + 1) & mask) {
+        k = hashmap->hashes[j] & mask;
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+
+        hashmap->hashes[i] = hashmap->hashes[j];
+        memcpy(hashmap_get_key(hashmap, i), hashmap_get_key(hashmap, j), hashmap->slot_size);
+        hashmap->hashes[j] = 0;
+        i = j;
+    }
+    return true;
+}
+
+bool hashmap_next_impl(const hashmap_t * hashmap, size_t * pi, const void ** pkey, void ** pdata) {
+    for (; *pi < hashmap->max_entries; (*pi)++) {
+        if (hashmap->hashes[*pi]) {
+            if (pkey)  *pkey  = hashmap_get_key(hashmap, *pi);
+            if (pdata) *pdata = hashmap_get_data(hashmap, *pi);
+            (*pi)++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void hashmap_dump(const hashmap_t * hashmap) {
+    size_t i;
+
+    printf("{");
+    for (i = 0; i < hashmap->max_entries; i++) {
+        if (!hashmap->hashes[i]) continue;
+
+        printf(" ");
+        if (hashmap->key_dump) hashmap->key_dump(hashmap_get_key(hashmap, i));
+        else printf("?");
+
+        if (hashmap->data_size) {
+            printf(": ");
+            if (hashmap->data_dump) hashmap->data_dump(hashmap_get_data(hashmap, i));
+            else printf("?");
+        }
+    }
+    printf(" }");
+}
+
+size_t hashmap_hash_bytes(const void * bytes, size_t size) {
+    const uint8_t * p = bytes;
+    size_t          i, hash = 2166136261u;
+
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
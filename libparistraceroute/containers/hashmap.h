@@ -0,0 +1,209 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint8_t
+
+#include "common.h"  // ELEMENT_*
+
+/**
+ * hashmap_t is an open addressing (linear probing) hash table storing
+ * fixed-size key-value pairs.
+ *
+ * Unlike map_t, which allocates a pair_t and two object_t for each entry,
+ * the keys and the values are copied into the table itself: a key_t
+ * (resp. data_t) is stored by value, like in a key_t[] (resp. data_t[]).
+ * A value may be a pointer (e.g. a char *), in which case data_free
+ * releases the pointed memory once the entry is erased or overwritten.
+ *
+ * Two keys are equal iif key_compare returns 0, and equal keys must have
+ * the same hash (e.g. address_hash and address_compare).
+ *
+ * A set is a hashmap_t whose values are empty (see hashset_*).
+ *
+ * Any insertion or removal invalidates the addresses returned by the
+ * hashmap_t (see hashmap_find, hashmap_emplace and hashmap_next).
+ * A hashmap_t is not thread-safe.
+ */
+
+// Initial number of slots allocated by a hashmap_t. Must be a power of 2.
+#define HASHMAP_INITIAL_SIZE 16
+
+typedef struct {
+    size_t   key_size;      /**< Size of a key */
+    size_t   data_size;     /**< Size of a value (0 for a set) */
+    size_t   data_offset;   /**< Offset of the value in a slot */
+    size_t   slot_size;     /**< Size of a slot */
+    size_t (*key_hash)(const void * key);
+    int    (*key_compare)(const void * key1, const void * key2);
+    void   (*key_dump)(const void * key);
+    void   (*data_free)(void * data);
+    void   (*data_dump)(const void * data);
+    size_t * hashes;        /**< Hash of the key stored in each slot, 0 if the slot is free */
+    uint8_t* slots;         /**< The key-value pairs */
+    size_t   num_entries;   /**< Number of used slots */
+    size_t   max_entries;   /**< Number of slots (power of 2) */
+} hashmap_t;
+
+/**
+ * \brief Create a hashmap_t instance. Some callbacks may be set to NULL.
+ * \param key_size The size of a key (e.g. sizeof(address_t)).
+ * \param key_hash Callback used to hash keys (mandatory).
+ * \param key_compare Callback used to compare keys (mandatory).
+ * \param key_dump Callback used to dump keys (may be set to NULL).
+ * \param data_size The size of a value, 0 for a set.
+ * \param data_free Callback releasing what a value refers to (may be set
+ *    to NULL). It is passed the address of the value.
+ * \param data_dump Callback used to dump values (may be set to NULL). It
+ *    is passed the address of the value.
+ * \return The newly allocated hashmap_t instance if successful, NULL otherwise.
+ */
+
+hashmap_t * hashmap_create_impl(
+    size_t   key_size,
+    size_t (*key_hash)(const void * key),
+    int    (*key_compare)(const void * key1, const void * key2),
+    void   (*key_dump)(const void * key),
+    size_t   data_size,
+    void   (*data_free)(void * data),
+    void   (*data_dump)(const void * data)
+);
+
+#define hashmap_create(                         \
+    key_size,  key_hash,  key_compare, key_dump,\
+    data_size, data_free, data_dump             \
+) hashmap_create_impl(                          \
+    key_size,                                   \
+    (ELEMENT_HASH)    key_hash,                 \
+    (ELEMENT_COMPARE) key_compare,              \
+    (ELEMENT_DUMP)    key_dump,                 \
+    data_size,                                  \
+    (ELEMENT_FREE)    data_free,                \
+    (ELEMENT_DUMP)    data_dump                 \
+)
+
+/**
+ * \brief Release a hashmap_t instance from the memory.
+ * \param hashmap A hashmap_t instance.
+ */
+
+void hashmap_free(hashmap_t * hashmap);
+
+/**
+ * \brief Remove every entry from a hashmap_t instance.
+ * \param hashmap A hashmap_t instance.
+ */
+
+void hashmap_clear(hashmap_t * hashmap);
+
+/**
+ * \brief Retrieve the number of entries stored in a hashmap_t instance.
+ * \param hashmap A hashmap_t instance.
+ * \return The number of entries.
+ */
+
+size_t hashmap_get_size(const hashmap_t * hashmap);
+
+/**
+ * \brief Search a key in a hashmap_t instance.
+ * \param hashmap A hashmap_t instance.
+ * \param key The key we're seeking.
+ * \param pdata Address of a pointer, where the address of the value
+ *    stored in the hashmap_t is written (if found). May be NULL.
+ * \return true if the key has been found, false otherwise.
+ */
+
+bool hashmap_find_impl(const hashmap_t * hashmap, const void * key, void ** pdata);
+
+#define hashmap_find(hashmap, key, pdata) hashmap_find_impl(hashmap, (const void *) key, (void **) pdata)
+
+/**
+ * \brief Retrieve the slot of a key, and add the key if needed.
+ * \param hashmap A hashmap_t instance.
+ * \param key The key.
+ * \param pinserted Address of a bool, set to true iif the key has been
+ *    added (its value is then zeroed). May be NULL.
+ * \return The address of the value of this key, NULL in case of failure.
+ */
+
+void * hashmap_emplace(hashmap_t * hashmap, const void * key, bool * pinserted);
+
+/**
+ * \brief Insert a new key-value pair in a hashmap_t instance. If the key
+ *    already exists, its value is released (see data_free) and replaced.
+ * \param hashmap A hashmap_t instance.
+ * \param key The key.
+ * \param data Points to the value, which is copied (data_size bytes).
+ *    The hashmap_t is then in charge of releasing it (see data_free).
+ * \return true iif successful.
+ */
+
+bool hashmap_update_impl(hashmap_t * hashmap, const void * key, const void * data);
+
+#define hashmap_update(hashmap, key, data) hashmap_update_impl(hashmap, (const void *) key, (const void *) data)
+
+/**
+ * \brief Remove a key (and release its value) from a hashmap_t instance.
+ * \param hashmap A hashmap_t instance.
+ * \param key The key.
+ * \return true iif the key has been found.
+ */
+
+bool hashmap_erase_impl(hashmap_t * hashmap, const void * key);
+
+#define hashmap_erase(hashmap, key) hashmap_erase_impl(hashmap, (const void *) key)
+
+/**
+ * \brief Iterate over the entries of a hashmap_t instance.
+ * \example
+ *     size_t i = 0;
+ *     const address_t * key;
+ *     char ** data;
+ *     while (hashmap_next(hashmap, &i, &key, &data)) { ... }
+ * \param hashmap A hashmap_t instance.
+ * \param pi Address of the iterator, initially set to 0 (updated).
+ * \param pkey Where the address of the next key is written. May be NULL.
+ * \param pdata Where the address of the next value is written. May be NULL.
+ * \return true iif an entry has been retrieved.
+ */
+
+bool hashmap_next_impl(const hashmap_t * hashmap, size_t * pi, const void ** pkey, void ** pdata);
+
+#define hashmap_next(hashmap, pi, pkey, pdata) hashmap_next_impl(hashmap, pi, (const void **) pkey, (void **) pdata)
+
+/**
+ * \brief Print a hashmap_t instance in the standard output.
+ * \param hashmap A hashmap_t instance.
+ */
+
+void hashmap_dump(const hashmap_t * hashmap);
+
+/**
+ * \brief Hash a buffer (FNV-1a). May be used to implement key_hash.
+ * \param bytes The buffer.
+ * \param size The size of the buffer.
+ * \return The corresponding hash.
+ */
+
+size_t hashmap_hash_bytes(const void * bytes, size_t size);
+
+//---------------------------------------------------------------------------
+// hashset_t
+//---------------------------------------------------------------------------
+
+typedef hashmap_t hashset_t;
+
+#define hashset_create(key_size, key_hash, key_compare, key_dump) \
+    hashmap_create(key_size, key_hash, key_compare, key_dump, 0, NULL, NULL)
+
+#define hashset_free(hashset)                  hashmap_free(hashset)
+#define hashset_clear(hashset)                 hashmap_clear(hashset)
+#define hashset_get_size(hashset)              hashmap_get_size(hashset)
+#define hashset_find(hashset, key)             hashmap_find(hashset, key, NULL)
+#define hashset_insert(hashset, key)           hashmap_update(hashset, key, NULL)
+#define hashset_erase(hashset, key)            hashmap_erase(hashset, key)
+#define hashset_next(hashset, pi, pkey)        hashmap_next(hashset, pi, pkey, NULL)
+#define hashset_dump(hashset)                  hashmap_dump(hashset)
+
+#endif
@@ -12,7 +12,8 @@
  * TODO: This implementation is not very efficient.
  * So far, a map_t instance manages a set of pair<object<key>, object<data> >.
  * It would be nice to manage a set of pair<key, value> to reduce the
- * memory consumption.
+ * memory consumption. hashmap_t (see containers/hashmap.h) does so for
+ * fixed-size keys and values.
  */
 
 typedef struct {
@@ -0,0 +1,484 @@
+#include "use.h"
+#include "config.h"
+
+#include <ctype.h>        // isalnum
+#include <errno.h>        // errno, EAGAIN, EINTR
+#include <signal.h>       // signal, SIGPIPE, SIG_IGN
+#include <stdio.h>        // fprintf, perror
+#include <stdlib.h>       // calloc, free, strtoul
+#include <string.h>       // memcpy, memmove, memset, strchr, strcmp, strcpy, strdup, strlen
+#ifdef USE_KQUEUE
+#    include <sys/event.h> // kqueue, kevent
+#else
+#    include <sys/epoll.h> // epoll_*
+#endif
+#include <sys/socket.h>   // socket, bind, listen, accept4, recv, setsockopt
+#include <sys/stat.h>     // lstat, S_ISSOCK
+#include <sys/time.h>     // struct timeval
+#include <sys/un.h>       // struct sockaddr_un
+#include <unistd.h>       // close, unlink
+
+#include "control.h"
+
+// Maximum number of events fetched at once from the epoll (or kqueue) instance
+#define CONTROL_MAX_EVENTS 16
+
+/**
+ * \brief Watch the readability of a socket thanks to the epoll (or kqueue)
+ *    instance of a control_t.
+ * \param control A control_t instance.
+ * \param sockfd The socket.
+ * \param client The client related to the socket, NULL for the listening socket.
+ * \return true iif successful.
+ */
+
+static bool control_watch(control_t * control, int sockfd, control_client_t * client)
+{
+#ifdef USE_KQUEUE
+    struct kevent      event;
+
+    EV_SET(&event, sockfd, EVFILT_READ, EV_ADD, 0, 0, client);
+    return kevent(control->efd, &event, 1, NULL, 0, NULL) != -1;
+#else
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events   = EPOLLIN;
+    event.data.ptr = client;
+    return epoll_ctl(control->efd, EPOLL_CTL_ADD, sockfd, &event) != -1;
+#endif
+}
+
+/**
+ * \brief Open a non-blocking socket listening to a UNIX socket path.
+ * \param path The path of the socket (see control_create).
+ * \return The socket, -1 in case of failure.
+ */
+
+static int control_listen(const char * path)
+{
+    struct sockaddr_un addr;
+    struct stat        st;
+    int                sockfd;
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "control: %s: path too long\n", path);
+        goto ERR_PATH;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // Only a socket left by a previous run is replaced
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    if ((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) goto ERR_SOCKET;
+    if (bind(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)   goto ERR_BIND;
+    if (listen(sockfd, SOMAXCONN) == -1)                                             goto ERR_LISTEN;
+    return sockfd;
+
+ERR_LISTEN:
+    unlink(path);
+ERR_BIND:
+    close(sockfd);
+ERR_SOCKET:
+    perror(path);
+ERR_PATH:
+    return -1;
+}
+
+control_t * control_create(const char * path, const char * format_name, control_callback_t callback, void * data)
+{
+    control_t * control;
+
+    if (!(control = calloc(1, sizeof(control_t))))              goto ERR_CALLOC;
+    if (!(control->path = strdup(path)))                        goto ERR_STRDUP;
+    if ((control->sockfd = control_listen(path)) == -1)         goto ERR_LISTEN;
+#ifdef USE_KQUEUE
+    if ((control->efd = kqueue()) == -1)                        goto ERR_EPOLL_CREATE;
+#else
+    if ((control->efd = epoll_create1(EPOLL_CLOEXEC)) == -1)    goto ERR_EPOLL_CREATE;
+#endif
+
+    // The listening socket is identified by a NULL pointer
+    if (!control_watch(control, control->sockfd, NULL))         goto ERR_EPOLL_CTL;
+
+    // A client may close its connection while its results are written
+    signal(SIGPIPE, SIG_IGN);
+
+    control->format_name = format_name;
+    control->callback    = callback;
+    control->data        = data;
+    return control;
+
+ERR_EPOLL_CTL:
+    close(control->efd);
+ERR_EPOLL_CREATE:
+    close(control->sockfd);
+    unlink(control->path);
+ERR_LISTEN:
+    free(control->path);
+ERR_STRDUP:
+    free(control);
+ERR_CALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Close the connection of a client, and release the reference
+ *    held by its slot.
+ * \param control A control_t instance.
+ * \param slot The slot of the client.
+ */
+
+static void control_client_close(control_t * control, control_client_t ** slot)
+{
+    control_client_t * client = *slot;
+
+    // The records which cannot be sent anymore are dropped
+    if (client->output) client->output->size = 0;
+    output_free(client->output);
+
+    // Closing the socket removes it from the epoll (or kqueue) instance
+    close(client->sockfd);
+    client->output = NULL;
+    client->sockfd = -1;
+    *slot = NULL;
+    control_client_release(client);
+}
+
+void control_free(control_t * control)
+{
+    size_t i;
+
+    if (control) {
+        for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            if (control->clients[i]) control_client_close(control, &control->clients[i]);
+        }
+        close(control->efd);
+        close(control->sockfd);
+        unlink(control->path);
+        free(control->path);
+        free(control);
+    }
+}
+
+inline int control_get_fd(const control_t * control) {
+    return control->efd;
+}
+
+//---------------------------------------------------------------------------
+// Requests
+//---------------------------------------------------------------------------
+
+static inline char * skip_spaces(char * s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+    return s;
+}
+
+/**
+ * \brief Decode in place a JSON string.
+ * \param s Points to the opening double quote.
+ * \param pvalue Address of a pointer set to the decoded string.
+ * \return A pointer to the character following the closing double quote,
+ *    NULL if the string is invalid. Only the escaped characters of the
+ *    ASCII range are supported.
+ */
+
+static char * control_parse_string(char * s, const char ** pvalue)
+{
+    char          * out = ++s,
+                  * end;
+    char            hex[5] = {0};
+    unsigned long   code;
+
+    *pvalue = s;
+    for (; *s != '"'; s++) {
+        if (*s == '\0') return NULL;
+        if (*s != '\\') {
+            *out++ = *s;
+            continue;
+        }
+        switch (*++s) {
+            case '"':
+            case '\\':
+            case '/': *out++ = *s;   break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u':
+                if (!(s[1] && s[2] && s[3] && s[4])) return NULL;
+                memcpy(hex, s + 1, 4);
+                code = strtoul(hex, &end, 16);
+                if (*end || code == 0 || code > 0x7f) return NULL;
+                *out++ = code;
+                s += 4;
+                break;
+            default:
+                return NULL;
+        }
+    }
+    *out = '\0';
+    return s + 1;
+}
+
+/**
+ * \brief Parse in place a request, i.e. a flat JSON object.
+ * \param request The control_request_t instance to fill.
+ * \param line The request, without its trailing line feed.
+ * \return true iif successful.
+ */
+
+static bool control_request_parse(control_request_t * request, char * line)
+{
+    char            * s = skip_spaces(line),
+                    * end;
+    control_field_t * field;
+
+    request->num_fields = 0;
+    if (*s++ != '{') return false;
+
+    for (s = skip_spaces(s); *s != '}'; ) {
+        if (request->num_fields == CONTROL_MAX_FIELDS) return false;
+        field = &request->fields[request->num_fields++];
+
+        // "key"
+        if (*s != '"' || !(s = control_parse_string(s, &field->key))) return false;
+        s = skip_spaces(s);
+        if (*s++ != ':') return false;
+
+        // "string" | number | true | false | null
+        s = skip_spaces(s);
+        if (*s == '"') {
+            if (!(s = control_parse_string(s, &field->value))) return false;
+            end = s;
+        } else {
+            field->value = s;
+            for (end = s; *end && (isalnum(*end) || strchr("+-.", *end)); end++);
+            if (end == s) return false;
+            s = end;
+        }
+
+        s = skip_spaces(s);
+        if (*s == ',') {
+            *end = '\0';
+            s = skip_spaces(s + 1);
+            if (*s == '}') return false;
+        } else if (*s == '}') {
+            // The value may be followed by the closing brace
+            *end = '\0';
+            break;
+        } else {
+            return false;
+        }
+    }
+
+    return *skip_spaces(s + 1) == '\0';
+}
+
+const char * control_request_get(const control_request_t * request, const char * key)
+{
+    size_t i;
+
+    // The last occurrence of a key prevails
+    for (i = request->num_fields; i > 0; i--) {
+        if (strcmp(request->fields[i - 1].key, key) == 0) return request->fields[i - 1].value;
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Clients
+//---------------------------------------------------------------------------
+
+control_client_t * control_client_ref(control_client_t * client) {
+    client->num_references++;
+    return client;
+}
+
+void control_client_release(control_client_t * client) {
+    if (client && --client->num_references == 0) free(client);
+}
+
+inline output_t * control_client_get_output(const control_client_t * client) {
+    return client->output;
+}
+
+/**
+ * \brief Retrieve the slot of a client.
+ * \param control A control_t instance.
+ * \param client A client.
+ * \return The slot of the client, NULL if its connection is closed.
+ */
+
+static control_client_t ** control_get_slot(control_t * control, const control_client_t * client)
+{
+    size_t i;
+
+    for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control->clients[i] == client) return &control->clients[i];
+    }
+    return NULL;
+}
+
+bool control_client_flush(control_client_t * client)
+{
+    if (!client->output) return false;
+    if (!output_flush(client->output)) {
+        // The next results are dropped. The slot of the client is released
+        // once the server notices the shutdown (see control_client_process).
+        output_free(client->output);
+        client->output = NULL;
+        shutdown(client->sockfd, SHUT_RDWR);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Accept the pending connections. A connection is closed at once
+ *    if every slot is already used.
+ * \param control A control_t instance.
+ */
+
+static void control_accept(control_t * control)
+{
+    struct timeval       timeout = {CONTROL_SEND_TIMEOUT, 0};
+    control_client_t   * client;
+    control_client_t  ** slot;
+    int                  sockfd;
+    size_t               i;
+
+    while ((sockfd = accept4(control->sockfd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+        for (i = 0, slot = NULL; i < CONTROL_MAX_CLIENTS; i++) {
+            if (!control->clients[i]) {
+                slot = &control->clients[i];
+                break;
+            }
+        }
+        if (!slot)                                            goto ERR_SLOT;
+        if (!(client = calloc(1, sizeof(control_client_t))))  goto ERR_CALLOC;
+
+        // The results are written by blocking writes (see output_flush),
+        // which give up once the timeout expires.
+        if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) goto ERR_SETSOCKOPT;
+        if (!(client->output = output_create(sockfd, control->format_name, NULL)))         goto ERR_OUTPUT_CREATE;
+
+        if (!control_watch(control, sockfd, client))                                         goto ERR_EPOLL_CTL;
+
+        client->sockfd         = sockfd;
+        client->num_references = 1;
+        *slot = client;
+        continue;
+
+ERR_EPOLL_CTL:
+        client->output->size = 0;
+        output_free(client->output);
+ERR_OUTPUT_CREATE:
+ERR_SETSOCKOPT:
+        free(client);
+ERR_CALLOC:
+ERR_SLOT:
+        close(sockfd);
+    }
+}
+
+/**
+ * \brief Process the events of a client: receive its requests, and pass
+ *    each of them to the callback of the server.
+ * \param control A control_t instance.
+ * \param client The client.
+ */
+
+static void control_client_process(control_t * control, control_client_t * client)
+{
+    control_request_t    request;
+    control_client_t  ** slot;
+    output_record_t      record;
+    char               * line,
+                       * end;
+    ssize_t              num_bytes;
+
+    // The callback may release the reference held by the slot
+    control_client_ref(client);
+
+    for (;;) {
+        num_bytes = recv(
+            client->sockfd,
+            client->request + client->request_size,
+            CONTROL_REQUEST_SIZE - 1 - client->request_size,
+            MSG_DONTWAIT
+        );
+        if (num_bytes == -1 && errno == EINTR) continue;
+        if (num_bytes == -1 && errno == EAGAIN) break;
+        if (num_bytes <= 0) goto CLOSE;
+
+        client->request_size += num_bytes;
+        client->request[client->request_size] = '\0';
+
+        // Process every complete line
+        for (line = client->request; (end = strchr(line, '\n')); line = end + 1) {
+            *end = '\0';
+            if (*line == '\0' || *line == '\r') continue;
+
+            if (control_request_parse(&request, line)) {
+                control->callback(client, &request, control->data);
+            } else if (client->output) {
+                memset(&record, 0, sizeof(output_record_t));
+                record.type   = OUTPUT_RECORD_REJECT;
+                record.reason = "invalid request";
+                output_write_record(client->output, &record);
+                control_client_flush(client);
+            }
+            if (!client->output) goto CLOSE;
+        }
+
+        client->request_size -= line - client->request;
+        memmove(client->request, line, client->request_size + 1);
+        if (client->request_size == CONTROL_REQUEST_SIZE - 1) goto CLOSE;
+    }
+    control_client_release(client);
+    return;
+
+CLOSE:
+    if ((slot = control_get_slot(control, client))) control_client_close(control, slot);
+    control_client_release(client);
+}
+
+bool control_process(control_t * control)
+{
+#ifdef USE_KQUEUE
+    struct kevent        events[CONTROL_MAX_EVENTS];
+    struct timespec      timeout = {0, 0};
+#else
+    struct epoll_event   events[CONTROL_MAX_EVENTS];
+#endif
+    control_client_t   * client;
+    int                  i, num_events;
+
+    // Never wait: the pt_loop_t has already been woken up by control->efd
+#ifdef USE_KQUEUE
+    if ((num_events = kevent(control->efd, NULL, 0, events, CONTROL_MAX_EVENTS, &timeout)) == -1) {
+#else
+    if ((num_events = epoll_wait(control->efd, events, CONTROL_MAX_EVENTS, 0)) == -1) {
+#endif
+        return false;
+    }
+
+    for (i = 0; i < num_events; i++) {
+#ifdef USE_KQUEUE
+        client = (control_client_t *) events[i].udata;
+#else
+        client = events[i].data.ptr;
+#endif
+        if (client) {
+            control_client_process(control, client);
+        } else {
+            control_accept(control);
+        }
+    }
+
+    return num_events == CONTROL_MAX_EVENTS;
+}
@@ -0,0 +1,189 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+/**
+ * \file control.h
+ * \brief A server accepting measurement requests over a UNIX socket, so
+ *    that a long-running process (see pt_loop_set_control) serves many
+ *    measurements without paying the startup cost of each of them (raw
+ *    sockets, DNS and AS caches, topology cache...).
+ *
+ * A control_t instance is driven by a pt_loop_t, like a metrics_t
+ * instance: it watches its listening socket and its clients thanks to its
+ * own epoll instance, whose file descriptor is the only one registered in
+ * the loop.
+ *
+ * A client sends its requests as JSON Lines, i.e. one flat JSON object
+ * per line whose values are strings, numbers or literals, e.g.
+ *     {"dst":"8.8.8.8","algorithm":"mda","max_ttl":20}
+ * Each request is passed to the callback of the server, which typically
+ * starts an algorithm instance (see pt_add_instance) and streams its
+ * results back through the output_t of the client (see output.h).
+ *
+ * A client is reference counted: a measurement holds a reference on the
+ * client which has requested it, so that it may safely outlive the
+ * connection. Once the connection is closed, the results of the
+ * measurements still running are dropped.
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+
+#include "output.h"     // output_t
+
+// Maximum number of clients connected at once. Further clients are rejected.
+#define CONTROL_MAX_CLIENTS  64
+
+// Maximum size of a request (in bytes). The connection of a client
+// sending a larger request is closed.
+#define CONTROL_REQUEST_SIZE 4096
+
+// Maximum number of fields in a request
+#define CONTROL_MAX_FIELDS   16
+
+// Maximum time spent writing the results to a client (in seconds). The
+// connection of a client which does not read its results is closed.
+#define CONTROL_SEND_TIMEOUT 5
+
+/**
+ * \struct control_field_t
+ * \brief A field of a request.
+ */
+
+typedef struct {
+    const char * key;   /**< The name of the field */
+    const char * value; /**< The value of the field (the literals and the numbers are not quoted) */
+} control_field_t;
+
+/**
+ * \struct control_request_t
+ * \brief A measurement request. Its fields point to the buffer of the
+ *    client, and are only valid while the callback is running.
+ */
+
+typedef struct {
+    control_field_t fields[CONTROL_MAX_FIELDS]; /**< The fields of the request */
+    size_t          num_fields;                 /**< Number of fields */
+} control_request_t;
+
+/**
+ * \struct control_client_t
+ * \brief A connection to a control_t server.
+ */
+
+typedef struct {
+    int        sockfd;                        /**< The socket of this client, -1 once the connection is closed */
+    char       request[CONTROL_REQUEST_SIZE]; /**< The bytes received and not processed yet */
+    size_t     request_size;                  /**< Number of bytes stored in request */
+    output_t * output;                        /**< Streams the results to this client, NULL once the connection is closed */
+    size_t     num_references;                /**< Number of references (see control_client_ref) */
+} control_client_t;
+
+/**
+ * \brief Process a request.
+ * \param client The client which has sent the request. The callback
+ *    must call control_client_ref to use it once it returns.
+ * \param request The request.
+ * \param data The data passed to control_create.
+ */
+
+typedef void (* control_callback_t)(control_client_t * client, const control_request_t * request, void * data);
+
+/**
+ * \struct control_t
+ * \brief A server accepting measurement requests.
+ */
+
+typedef struct {
+    int                  efd;                          /**< epoll instance watching sockfd and the clients */
+    int                  sockfd;                       /**< The listening socket */
+    char               * path;                         /**< The path of the listening socket */
+    const char         * format_name;                  /**< The format of the results (see output_create) */
+    control_client_t   * clients[CONTROL_MAX_CLIENTS]; /**< The connected clients (NULL if the slot is unused) */
+    control_callback_t   callback;                     /**< Processes the requests */
+    void               * data;                         /**< Passed to callback */
+} control_t;
+
+/**
+ * \brief Create a server accepting measurement requests.
+ * \param path The path of the UNIX socket to listen to. A stale socket
+ *    left at this path is replaced.
+ * \param format_name The format of the results ("json" or "binary", see
+ *    output_create).
+ * \param callback Processes the requests.
+ * \param data Passed to callback.
+ * \return The newly allocated control_t instance, NULL in case of failure.
+ */
+
+control_t * control_create(const char * path, const char * format_name, control_callback_t callback, void * data);
+
+/**
+ * \brief Release a server, close its connections and remove its socket.
+ *    The clients still referenced remain allocated until they are released.
+ * \param control A control_t instance.
+ */
+
+void control_free(control_t * control);
+
+/**
+ * \brief Retrieve the file descriptor activated when the server has
+ *    connections or requests to process.
+ * \param control A control_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int control_get_fd(const control_t * control);
+
+/**
+ * \brief Accept the new connections, and process the pending requests.
+ *    This is called whenever the control_t file descriptor is activated.
+ * \param control A control_t instance.
+ * \return true iif some events may still be pending.
+ */
+
+bool control_process(control_t * control);
+
+/**
+ * \brief Retrieve the value of a field of a request.
+ * \param request A control_request_t instance.
+ * \param key The name of the field.
+ * \return The value of the field, NULL if unset.
+ */
+
+const char * control_request_get(const control_request_t * request, const char * key);
+
+/**
+ * \brief Take a reference on a client.
+ * \param client A control_client_t instance.
+ * \return The client.
+ */
+
+control_client_t * control_client_ref(control_client_t * client);
+
+/**
+ * \brief Release a reference on a client. The client is released from
+ *    the memory once its last reference is released.
+ * \param client A control_client_t instance.
+ */
+
+void control_client_release(control_client_t * client);
+
+/**
+ * \brief Retrieve the stream of the results of a client.
+ * \param client A control_client_t instance.
+ * \return The output_t instance of the client, NULL once the connection
+ *    is closed.
+ */
+
+output_t * control_client_get_output(const control_client_t * client);
+
+/**
+ * \brief Send the results written so far to a client. The connection is
+ *    closed if they cannot be sent.
+ * \param client A control_client_t instance.
+ * \return true iif successful.
+ */
+
+bool control_client_flush(control_client_t * client);
+
+#endif // CONTROL_H
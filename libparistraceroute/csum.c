@@ -0,0 +1,211 @@
+#include "use.h"
+#include "config.h"
+
+#include <string.h>         // memcpy, strcmp
+
+#include "csum.h"
+
+#if defined(USE_SIMD_CSUM) && (defined(__x86_64__) || defined(__i386__))
+#    define CSUM_X86
+#    include <immintrin.h>  // _mm_*, _mm256_*
+#elif defined(USE_SIMD_CSUM) && defined(__ARM_NEON)
+#    define CSUM_NEON
+#    include <arm_neon.h>   // v*q_u16, v*q_u32
+#endif
+
+// Below this number of bytes (e.g. an IPv4 header), the scalar version is faster.
+#define CSUM_SIMD_MIN_SIZE 64
+
+// Number of vectors summed in 32-bit lanes before they are added to the
+// 64-bit sum. Each vector adds at most 2 * 0xffff to each lane.
+#define CSUM_SIMD_BLOCK_SIZE 16384
+
+/**
+ * \brief Fold a 64-bit one's complement sum into 16 bits.
+ * \param sum The sum.
+ * \return The folded sum.
+ */
+
+static inline uint16_t csum_fold(uint64_t sum) {
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return (uint16_t) sum;
+}
+
+/**
+ * \brief Sum the 16-bit words of a sequence of bytes.
+ * \param sum The current (unfolded) sum.
+ * \param bytes The bytes to add.
+ * \param size Number of bytes.
+ * \return The updated (unfolded) sum.
+ */
+
+static inline uint64_t csum_add_words(uint64_t sum, const uint8_t * bytes, size_t size) {
+    uint16_t word;
+
+    for (; size > 1; bytes += 2, size -= 2) {
+        memcpy(&word, bytes, sizeof(uint16_t));
+        sum += word;
+    }
+    if (size) {
+        word = 0;
+        memcpy(&word, bytes, 1);
+        sum += word;
+    }
+    return sum;
+}
+
+uint16_t csum_add_scalar(uint16_t sum, const uint8_t * bytes, size_t size) {
+    return csum_fold(csum_add_words(sum, bytes, size));
+}
+
+#ifdef CSUM_X86
+
+__attribute__((target("sse2")))
+static uint16_t csum_add_sse2(uint16_t sum, const uint8_t * bytes, size_t size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t      total = sum;
+    uint32_t      lanes[4];
+    __m128i       acc, v;
+    size_t        i, n;
+
+    while (size >= sizeof(__m128i)) {
+        acc = _mm_setzero_si128();
+        n = size / sizeof(__m128i);
+        if (n > CSUM_SIMD_BLOCK_SIZE) n = CSUM_SIMD_BLOCK_SIZE;
+
+        for (i = 0; i < n; i++, bytes += sizeof(__m128i)) {
+            v   = _mm_loadu_si128((const __m128i *) bytes);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        size -= n * sizeof(__m128i);
+
+        _mm_storeu_si128((__m128i *) lanes, acc);
+        total += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return csum_fold(csum_add_words(total, bytes, size));
+}
+
+__attribute__((target("avx2")))
+static uint16_t csum_add_avx2(uint16_t sum, const uint8_t * bytes, size_t size)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t      total = sum;
+    uint32_t      lanes[8];
+    __m256i       acc, v;
+    size_t        i, n;
+
+    while (size >= sizeof(__m256i)) {
+        acc = _mm256_setzero_si256();
+        n = size / sizeof(__m256i);
+        if (n > CSUM_SIMD_BLOCK_SIZE) n = CSUM_SIMD_BLOCK_SIZE;
+
+        // Unpacking works within each 128-bit lane, which does not matter for a sum
+        for (i = 0; i < n; i++, bytes += sizeof(__m256i)) {
+            v   = _mm256_loadu_si256((const __m256i *) bytes);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        }
+        size -= n * sizeof(__m256i);
+
+        _mm256_storeu_si256((__m256i *) lanes, acc);
+        for (i = 0; i < 8; i++) total += lanes[i];
+    }
+    return csum_fold(csum_add_words(total, bytes, size));
+}
+
+#endif // CSUM_X86
+
+#ifdef CSUM_NEON
+
+static uint16_t csum_add_neon(uint16_t sum, const uint8_t * bytes, size_t size)
+{
+    uint64_t   total = sum;
+    uint32x4_t acc;
+    size_t     i, n;
+
+    while (size >= sizeof(uint16x8_t)) {
+        acc = vdupq_n_u32(0);
+        n = size / sizeof(uint16x8_t);
+        if (n > CSUM_SIMD_BLOCK_SIZE) n = CSUM_SIMD_BLOCK_SIZE;
+
+        // Add pairs of adjacent words to the 32-bit lanes
+        for (i = 0; i < n; i++, bytes += sizeof(uint16x8_t)) {
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(bytes)));
+        }
+        size -= n * sizeof(uint16x8_t);
+
+        total += (uint64_t) vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1)
+               + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    }
+    return csum_fold(csum_add_words(total, bytes, size));
+}
+
+#endif // CSUM_NEON
+
+// Implementation used by csum_add for large inputs, selected by csum_init.
+static uint16_t   (* csum_add_impl)(uint16_t sum, const uint8_t * bytes, size_t size) = csum_add_scalar;
+static const char  * csum_impl_name = "scalar";
+
+static void csum_init() __attribute__((constructor));
+
+static void csum_init() {
+    // Pick the widest vector instructions supported by the CPU
+    if (!csum_set_implementation("avx2") && !csum_set_implementation("sse2")) {
+        csum_set_implementation("neon");
+    }
+}
+
+uint16_t csum_add(uint16_t sum, const uint8_t * bytes, size_t size) {
+    return size < CSUM_SIMD_MIN_SIZE ?
+        csum_add_scalar(sum, bytes, size) :
+        csum_add_impl(sum, bytes, size);
+}
+
+uint16_t csum(const uint16_t * bytes, size_t size) {
+    return (uint16_t) ~csum_add(0, (const uint8_t *) bytes, size);
+}
+
+uint16_t csum_update(uint16_t checksum, uint16_t delta) {
+    uint32_t sum = (uint16_t) ~checksum + (uint32_t) delta;
+
+    sum  = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+const char * csum_get_implementation() {
+    return csum_impl_name;
+}
+
+bool csum_set_implementation(const char * name) {
+#if defined(CSUM_X86)
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        csum_add_impl  = csum_add_avx2;
+        csum_impl_name = "avx2";
+        return true;
+    }
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        csum_add_impl  = csum_add_sse2;
+        csum_impl_name = "sse2";
+        return true;
+    }
+#elif defined(CSUM_NEON)
+    if (strcmp(name, "neon") == 0) {
+        csum_add_impl  = csum_add_neon;
+        csum_impl_name = "neon";
+        return true;
+    }
+#endif
+    if (strcmp(name, "scalar") == 0) {
+        csum_add_impl  = csum_add_scalar;
+        csum_impl_name = "scalar";
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,82 @@
+#include "use.h"
+
+#ifndef CSUM_H
+#define CSUM_H
+
+/**
+ * \file csum.h
+ * \brief Internet checksum (RFC 1071).
+ *
+ * The bytes are summed as 16-bit words in memory order, so that the
+ * resulting checksum can be written as is in a packet. If USE_SIMD_CSUM
+ * is set, the sum is computed thanks to the widest vector instructions
+ * supported by the CPU (SSE2 or AVX2 on x86, NEON on ARM), which are
+ * detected when the first checksum is computed.
+ */
+
+#include <stdbool.h> // bool
+#include <stdint.h>  // uint8_t, uint16_t
+#include <stddef.h>  // size_t
+
+/**
+ * \brief Calculate an Internet checksum.
+ * \param bytes Bytes used to compute the checksum
+ * \param size Number of bytes to consider
+ * \return The corresponding checksum
+ */
+
+uint16_t csum(const uint16_t * buf, size_t size);
+
+/**
+ * \brief Add a sequence of bytes to a one's complement sum.
+ *    The bytes are summed as 16-bit words stored in memory, as in csum.
+ * \param sum The current sum (e.g. 0).
+ * \param bytes The bytes to add. If size is odd, the last byte is
+ *    padded with zero.
+ * \param size Number of bytes.
+ * \return The updated (folded) sum.
+ */
+
+uint16_t csum_add(uint16_t sum, const uint8_t * bytes, size_t size);
+
+/**
+ * \brief Same as csum_add, without vector instructions. This is the
+ *    reference implementation of csum_add.
+ * \param sum The current sum (e.g. 0).
+ * \param bytes The bytes to add. If size is odd, the last byte is
+ *    padded with zero.
+ * \param size Number of bytes.
+ * \return The updated (folded) sum.
+ */
+
+uint16_t csum_add_scalar(uint16_t sum, const uint8_t * bytes, size_t size);
+
+/**
+ * \brief Update an Internet checksum according to the changes made
+ *    in the checksummed data (see RFC 1624, eqn. 3).
+ * \param checksum The checksum of the original data.
+ * \param delta The one's complement sum of the changes, i.e. the sum of
+ *    the new words and of the one's complement of the old words.
+ * \return The checksum of the updated data.
+ */
+
+uint16_t csum_update(uint16_t checksum, uint16_t delta);
+
+/**
+ * \brief Retrieve the name of the implementation used by csum_add.
+ * \return "avx2", "sse2", "neon" or "scalar".
+ */
+
+const char * csum_get_implementation();
+
+/**
+ * \brief Select the implementation used by csum_add, e.g. to check the
+ *    vector implementations against csum_add_scalar (see csum_bench).
+ * \param name "avx2", "sse2", "neon" or "scalar".
+ * \return true iif successful, false if this implementation is not
+ *    compiled or not supported by the CPU.
+ */
+
+bool csum_set_implementation(const char * name);
+
+#endif
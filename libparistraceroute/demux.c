@@ -0,0 +1,887 @@
+#include "use.h"
+#include "config.h"
+
+#include <errno.h>        // errno, EAGAIN, EINTR, ENOSPC, EPROTO
+#include <signal.h>       // sigset_t, sigprocmask, sigtimedwait, SIGINT, SIGTERM
+#include <stdio.h>        // fprintf, perror
+#include <stdlib.h>       // calloc, free
+#include <string.h>       // memcpy, memset, strcpy, strdup, strlen
+#include <time.h>         // struct timespec
+#ifdef USE_KQUEUE
+#    include <sys/event.h> // kqueue, kevent
+#else
+#    include <sys/epoll.h> // epoll_*
+#    include <sys/signalfd.h> // signalfd
+#endif
+#include <sys/eventfd.h>  // eventfd
+#include <sys/mman.h>     // memfd_create, mmap, munmap
+#include <sys/socket.h>   // socket, bind, listen, accept4, sendmsg, recvmsg
+#include <sys/stat.h>     // fstat, lstat, S_ISSOCK
+#include <sys/time.h>     // struct timeval
+#include <sys/un.h>       // struct sockaddr_un
+#include <unistd.h>       // close, ftruncate, read, write, unlink
+#include <netinet/in.h>   // IPPROTO_*
+
+#include "demux.h"
+#include "common.h"       // get_time_ns
+
+// Version of the messages exchanged when a client connects
+#define DEMUX_VERSION 1
+
+// Maximum number of events fetched at once from the epoll instance
+#define DEMUX_MAX_EVENTS 16
+
+// epoll_event::data.u64 of the file descriptors watched by the server
+// (the connections of the clients are identified by their index).
+#define DEMUX_EVENT_LISTEN (DEMUX_MAX_CLIENTS + 0)
+#define DEMUX_EVENT_ICMPV4 (DEMUX_MAX_CLIENTS + 1)
+#define DEMUX_EVENT_ICMPV6 (DEMUX_MAX_CLIENTS + 2)
+#define DEMUX_EVENT_SIGNAL (DEMUX_MAX_CLIENTS + 3)
+
+/**
+ * \struct demux_request_t
+ * \brief Sent by a client once connected.
+ */
+
+typedef struct {
+    uint32_t version;   /**< DEMUX_VERSION */
+    uint32_t num_tags;  /**< Number of tags requested */
+} demux_request_t;
+
+/**
+ * \struct demux_response_t
+ * \brief Sent by the server along with the ring and the eventfd of the
+ *    client (unless error is set).
+ */
+
+typedef struct {
+    uint32_t version;   /**< DEMUX_VERSION */
+    int32_t  error;     /**< 0 if successful, an errno value otherwise */
+    uint32_t first_tag; /**< First tag routed to the client */
+    uint32_t last_tag;  /**< Last tag routed to the client */
+} demux_response_t;
+
+//---------------------------------------------------------------------------
+// Tags
+//---------------------------------------------------------------------------
+
+static inline uint16_t read_be16(const uint8_t * bytes) {
+    return (uint16_t) (bytes[0] << 8 | bytes[1]);
+}
+
+static inline uint16_t csum_add16(uint16_t a, uint16_t b) {
+    uint32_t sum = (uint32_t) a + b;
+    return (uint16_t) ((sum & 0xffff) + (sum >> 16));
+}
+
+/**
+ * \brief Retrieve the checksum of the echo request answered by an echo
+ *    reply. Both messages only differ by their type, so the checksum of
+ *    the request is derived from the one of the reply (RFC 1624).
+ * \param checksum The checksum of the echo reply.
+ * \param request_type The type of the echo request.
+ * \param reply_type The type of the echo reply.
+ * \return The checksum of the echo request.
+ */
+
+static uint16_t demux_get_echo_request_checksum(uint16_t checksum, uint8_t request_type, uint8_t reply_type) {
+    return ~csum_add16(csum_add16(~checksum, request_type << 8), ~(reply_type << 8));
+}
+
+/**
+ * \brief Read the checksum of a transport header quoted in an ICMP error.
+ * \param protocol The transport protocol.
+ * \param transport The transport header.
+ * \param end The end of the reply.
+ * \param ptag Address of an uint16_t in which the checksum is written.
+ * \return true iif successful.
+ */
+
+static bool demux_get_quoted_checksum(uint8_t protocol, const uint8_t * transport, const uint8_t * end, uint16_t * ptag)
+{
+    size_t offset;
+
+    switch (protocol) {
+        case IPPROTO_UDP:    offset = 6;  break;
+        case IPPROTO_TCP:    offset = 16; break;
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6: offset = 2;  break;
+        default:             return false;
+    }
+    if (transport + offset + 2 > end) return false;
+    *ptag = read_be16(transport + offset);
+    return true;
+}
+
+/**
+ * \brief Extract the tag of a reply (see network_extract_tag), i.e. the
+ *    transport checksum of the probe quoted by an ICMP error, or the
+ *    checksum of the echo request answered by an echo reply.
+ * \param bytes The reply, starting with its IP header.
+ * \param size The size of the reply.
+ * \param ptag Address of an uint16_t in which the tag is written.
+ * \return true iif successful.
+ */
+
+static bool demux_get_tag(const uint8_t * bytes, size_t size, uint16_t * ptag)
+{
+    const uint8_t * end = bytes + size,
+                  * icmp,
+                  * quoted;
+    size_t          ihl;
+
+    if (size < 1) return false;
+
+    switch (bytes[0] >> 4) {
+        case 4:
+            if (size < 20 || bytes[9] != IPPROTO_ICMP) return false;
+            ihl  = (bytes[0] & 0x0f) * 4;
+            icmp = bytes + ihl;
+            if (ihl < 20 || icmp + 8 > end) return false;
+            switch (icmp[0]) {
+                case 0:  // Echo reply
+                    *ptag = demux_get_echo_request_checksum(read_be16(icmp + 2), 8, 0);
+                    return true;
+                case 3:  // Destination unreachable
+                case 11: // Time exceeded
+                case 12: // Parameter problem
+                    quoted = icmp + 8;
+                    if (quoted + 20 > end) return false;
+                    ihl = (quoted[0] & 0x0f) * 4;
+                    return ihl >= 20 && demux_get_quoted_checksum(quoted[9], quoted + ihl, end, ptag);
+                default:
+                    return false;
+            }
+        case 6:
+            if (size < 40 || bytes[6] != IPPROTO_ICMPV6) return false;
+            icmp = bytes + 40;
+            if (icmp + 8 > end) return false;
+            switch (icmp[0]) {
+                case 129: // Echo reply
+                    *ptag = demux_get_echo_request_checksum(read_be16(icmp + 2), 128, 129);
+                    return true;
+                case 1:   // Destination unreachable
+                case 2:   // Packet too big
+                case 3:   // Time exceeded
+                case 4:   // Parameter problem
+                    quoted = icmp + 8;
+                    return quoted + 40 <= end && demux_get_quoted_checksum(quoted[6], quoted + 40, end, ptag);
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Server
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Open a non-blocking socket listening to a UNIX socket path.
+ * \param path The path of the socket (see demux_server_create).
+ * \return The socket, -1 in case of failure.
+ */
+
+static int demux_listen(const char * path)
+{
+    struct sockaddr_un addr;
+    struct stat        st;
+    int                sockfd;
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "demux: %s: path too long\n", path);
+        goto ERR_PATH;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // Only a socket left by a previous run is replaced
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    if ((sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) goto ERR_SOCKET;
+    if (bind(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)      goto ERR_BIND;
+    if (listen(sockfd, SOMAXCONN) == -1)                                                goto ERR_LISTEN;
+    return sockfd;
+
+ERR_LISTEN:
+    unlink(path);
+ERR_BIND:
+    close(sockfd);
+ERR_SOCKET:
+    perror(path);
+ERR_PATH:
+    return -1;
+}
+
+/**
+ * \brief Watch a file descriptor in the epoll (or kqueue) instance of a server.
+ * \param server A demux_server_t instance.
+ * \param fd The file descriptor.
+ * \param id The identifier of this file descriptor (see DEMUX_EVENT_*).
+ * \return true iif successful.
+ */
+
+static bool demux_server_watch(demux_server_t * server, int fd, uint64_t id)
+{
+#ifdef USE_KQUEUE
+    struct kevent      event;
+
+    EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, (void *) (uintptr_t) id);
+    return kevent(server->efd, &event, 1, NULL, 0, NULL) == 0;
+#else
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events   = EPOLLIN;
+    event.data.u64 = id;
+    return epoll_ctl(server->efd, EPOLL_CTL_ADD, fd, &event) == 0;
+#endif
+}
+
+/**
+ * \brief Store a reply in the ring of a client.
+ * \param server A demux_server_t instance.
+ * \param peer The client.
+ * \param bytes The reply.
+ * \param size The size of the reply.
+ * \param recv_time The receive time of the reply.
+ */
+
+static void demux_peer_push(demux_server_t * server, demux_peer_t * peer, const uint8_t * bytes, size_t size, uint64_t recv_time)
+{
+    demux_ring_t * ring = peer->ring;
+    demux_slot_t * slot;
+    unsigned int   head = atomic_load_explicit(&ring->head, memory_order_relaxed),
+                   tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (size > sizeof(slot->bytes) || head - tail >= DEMUX_RING_NUM_SLOTS) {
+        atomic_fetch_add_explicit(&ring->num_dropped, 1, memory_order_relaxed);
+        server->num_dropped++;
+        return;
+    }
+
+    slot = &ring->slots[head & (DEMUX_RING_NUM_SLOTS - 1)];
+    slot->size      = size;
+    slot->recv_time = recv_time;
+    memcpy(slot->bytes, bytes, size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    peer->is_pending = true;
+}
+
+/**
+ * \brief Route the replies sniffed by a server (see sniffer_create).
+ * \param packets The sniffed replies.
+ * \param num_packets The number of replies.
+ * \param data Points to the demux_server_t instance.
+ * \return true
+ */
+
+static bool demux_server_route(packet_t ** packets, size_t num_packets, void * data)
+{
+    demux_server_t * server = data;
+    demux_peer_t   * peer;
+    const uint8_t  * bytes;
+    size_t           i, j, size;
+    uint64_t         recv_time;
+    uint16_t         tag;
+    uint64_t         one = 1;
+
+    for (i = 0; i < num_packets; i++) {
+        bytes = packet_get_bytes(packets[i]);
+        size  = packet_get_size(packets[i]);
+        if (!(recv_time = packet_get_recv_time(packets[i]))) recv_time = get_time_ns();
+
+        if (demux_get_tag(bytes, size, &tag)) {
+            if (tag != 0 && server->owners[tag]) {
+                demux_peer_push(server, &server->peers[server->owners[tag] - 1], bytes, size, recv_time);
+                server->num_routed++;
+            } else {
+                server->num_unrouted++;
+            }
+        } else {
+            for (j = 0; j < DEMUX_MAX_CLIENTS; j++) {
+                if (server->peers[j].ring) demux_peer_push(server, &server->peers[j], bytes, size, recv_time);
+            }
+            server->num_broadcast++;
+        }
+        packet_free(packets[i]);
+    }
+
+    // Each client is woken up once per batch
+    for (j = 0; j < DEMUX_MAX_CLIENTS; j++) {
+        peer = &server->peers[j];
+        if (peer->is_pending) {
+            if (write(peer->eventfd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+                perror("demux_server_route");
+            }
+            peer->is_pending = false;
+        }
+    }
+
+    return true;
+}
+
+demux_server_t * demux_server_create(const char * path)
+{
+    demux_server_t * server;
+    size_t           i;
+
+    if (!(server = calloc(1, sizeof(demux_server_t))))       goto ERR_CALLOC;
+    for (i = 0; i < DEMUX_MAX_CLIENTS; i++) {
+        server->peers[i].sockfd  = -1;
+        server->peers[i].eventfd = -1;
+    }
+    if (!(server->path = strdup(path)))                      goto ERR_STRDUP;
+#ifdef USE_KQUEUE
+    if ((server->efd = kqueue()) == -1)                      goto ERR_EPOLL_CREATE;
+#else
+    if ((server->efd = epoll_create1(EPOLL_CLOEXEC)) == -1)  goto ERR_EPOLL_CREATE;
+#endif
+    if (!(server->sniffer = sniffer_create(server, demux_server_route))) goto ERR_SNIFFER_CREATE;
+    if ((server->sockfd = demux_listen(path)) == -1)         goto ERR_LISTEN;
+
+    if (!demux_server_watch(server, server->sockfd, DEMUX_EVENT_LISTEN)) goto ERR_WATCH;
+#ifdef USE_IPV4
+    if (!demux_server_watch(server, sniffer_get_icmpv4_sockfd(server->sniffer), DEMUX_EVENT_ICMPV4)) goto ERR_WATCH;
+#endif
+#ifdef USE_IPV6
+    if (!demux_server_watch(server, sniffer_get_icmpv6_sockfd(server->sniffer), DEMUX_EVENT_ICMPV6)) goto ERR_WATCH;
+#endif
+    return server;
+
+ERR_WATCH:
+    close(server->sockfd);
+    unlink(server->path);
+ERR_LISTEN:
+    sniffer_free(server->sniffer);
+ERR_SNIFFER_CREATE:
+    close(server->efd);
+ERR_EPOLL_CREATE:
+    free(server->path);
+ERR_STRDUP:
+    free(server);
+ERR_CALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Disconnect a client, and release its tags and its ring.
+ * \param server A demux_server_t instance.
+ * \param peer The client.
+ */
+
+static void demux_peer_close(demux_server_t * server, demux_peer_t * peer)
+{
+    if (peer->ring) {
+        memset(server->owners + peer->first_tag, 0, peer->last_tag - peer->first_tag + 1);
+        munmap(peer->ring, sizeof(demux_ring_t));
+        close(peer->eventfd);
+    }
+
+    // Closing the socket removes it from the epoll (or kqueue) instance
+    close(peer->sockfd);
+    memset(peer, 0, sizeof(demux_peer_t));
+    peer->sockfd  = -1;
+    peer->eventfd = -1;
+}
+
+void demux_server_free(demux_server_t * server)
+{
+    size_t i;
+
+    if (server) {
+        for (i = 0; i < DEMUX_MAX_CLIENTS; i++) {
+            if (server->peers[i].sockfd != -1) demux_peer_close(server, &server->peers[i]);
+        }
+        close(server->sockfd);
+        unlink(server->path);
+        sniffer_free(server->sniffer);
+        close(server->efd);
+        free(server->path);
+        free(server);
+    }
+}
+
+/**
+ * \brief Accept the pending connections. A connection is closed at once
+ *    if every slot is already used.
+ * \param server A demux_server_t instance.
+ */
+
+static void demux_server_accept(demux_server_t * server)
+{
+    int    sockfd;
+    size_t i;
+
+    while ((sockfd = accept4(server->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        for (i = 0; i < DEMUX_MAX_CLIENTS; i++) {
+            if (server->peers[i].sockfd == -1) break;
+        }
+        if (i == DEMUX_MAX_CLIENTS || !demux_server_watch(server, sockfd, i)) {
+            close(sockfd);
+            continue;
+        }
+        server->peers[i].sockfd = sockfd;
+    }
+}
+
+/**
+ * \brief Find a range of tags which are not routed yet.
+ * \param server A demux_server_t instance.
+ * \param num_tags The size of the range.
+ * \param pfirst Address of an uint32_t in which the first tag is written.
+ * \return true iif successful.
+ */
+
+static bool demux_server_find_tags(const demux_server_t * server, size_t num_tags, uint32_t * pfirst)
+{
+    uint32_t tag, first = 1;
+
+    for (tag = 1; tag <= DEMUX_NUM_TAGS; tag++) {
+        if (server->owners[tag]) {
+            first = tag + 1;
+        } else if (tag - first + 1 == num_tags) {
+            *pfirst = first;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief Create the ring of a client and map it in the memory.
+ * \param peer The client.
+ * \return The memfd storing the ring, -1 in case of failure.
+ */
+
+static int demux_peer_create_ring(demux_peer_t * peer)
+{
+    int memfd;
+
+#ifdef HAVE_MEMFD_CREATE
+    if ((memfd = memfd_create("paris-traceroute-demux", MFD_CLOEXEC)) == -1) goto ERR_MEMFD_CREATE;
+#else
+    // e.g. NetBSD < 11: no client can be served
+    errno = ENOSYS;
+    goto ERR_MEMFD_CREATE;
+#endif
+    if (ftruncate(memfd, sizeof(demux_ring_t)) == -1)                         goto ERR_FTRUNCATE;
+    if ((peer->ring = mmap(NULL, sizeof(demux_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+        goto ERR_MMAP;
+    }
+    atomic_init(&peer->ring->head, 0);
+    atomic_init(&peer->ring->tail, 0);
+    atomic_init(&peer->ring->num_dropped, 0);
+    return memfd;
+
+ERR_MMAP:
+    peer->ring = NULL;
+ERR_FTRUNCATE:
+    close(memfd);
+ERR_MEMFD_CREATE:
+    perror("demux_peer_create_ring");
+    return -1;
+}
+
+/**
+ * \brief Answer the request of a client, and grant it a ring and a
+ *    range of tags.
+ * \param server A demux_server_t instance.
+ * \param peer The client.
+ * \param request Its request.
+ * \return true iif successful.
+ */
+
+static bool demux_peer_register(demux_server_t * server, demux_peer_t * peer, const demux_request_t * request)
+{
+    demux_response_t   response;
+    struct msghdr      msg;
+    struct iovec       iov;
+    struct cmsghdr   * cmsg;
+    char               control[CMSG_SPACE(2 * sizeof(int))];
+    int                fds[2] = {-1, -1};
+
+    memset(&response, 0, sizeof(demux_response_t));
+    response.version = DEMUX_VERSION;
+
+    if (request->version != DEMUX_VERSION || request->num_tags == 0 || request->num_tags > DEMUX_NUM_TAGS) {
+        response.error = EPROTO;
+    } else if (!demux_server_find_tags(server, request->num_tags, &response.first_tag)) {
+        response.error = ENOSPC;
+    } else if ((fds[0] = demux_peer_create_ring(peer)) == -1
+           ||  (fds[1] = peer->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        response.error = errno;
+    } else {
+        response.last_tag = response.first_tag + request->num_tags - 1;
+    }
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base   = &response;
+    iov.iov_len    = sizeof(demux_response_t);
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+    if (response.error == 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(2 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+    }
+    if (sendmsg(peer->sockfd, &msg, MSG_NOSIGNAL) == -1 && response.error == 0) {
+        response.error = errno;
+    }
+
+    // The ring remains mapped once its memfd is closed
+    if (fds[0] != -1) close(fds[0]);
+    if (response.error != 0) {
+        if (peer->ring) munmap(peer->ring, sizeof(demux_ring_t));
+        if (peer->eventfd != -1) close(peer->eventfd);
+        peer->ring    = NULL;
+        peer->eventfd = -1;
+        return false;
+    }
+
+    peer->first_tag = response.first_tag;
+    peer->last_tag  = response.last_tag;
+    memset(server->owners + peer->first_tag, peer - server->peers + 1, peer->last_tag - peer->first_tag + 1);
+    return true;
+}
+
+/**
+ * \brief Process the events of a client: its request, or its disconnection.
+ * \param server A demux_server_t instance.
+ * \param peer The client.
+ */
+
+static void demux_peer_process(demux_server_t * server, demux_peer_t * peer)
+{
+    demux_request_t request;
+    ssize_t         num_bytes;
+
+    while ((num_bytes = recv(peer->sockfd, &request, sizeof(demux_request_t), 0)) == -1 && errno == EINTR);
+    if (num_bytes == -1 && errno == EAGAIN) return;
+
+    // A registered client only sends its request once
+    if (num_bytes == sizeof(demux_request_t) && !peer->ring
+    &&  demux_peer_register(server, peer, &request)) {
+        return;
+    }
+    demux_peer_close(server, peer);
+}
+
+/**
+ * \brief Create a signalfd activated by SIGINT and SIGTERM, which are
+ *    blocked. With kqueue, this is a kqueue instance watching these
+ *    signals, which is readable once one of them is pending.
+ * \param old_mask Address of the sigset_t in which the previous mask is saved.
+ * \return The signalfd, -1 in case of failure.
+ */
+
+static int demux_make_signal_fd(sigset_t * old_mask)
+{
+    sigset_t      mask;
+    int           sfd;
+#ifdef USE_KQUEUE
+    struct kevent events[2];
+#endif
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, old_mask) == -1) return -1;
+#ifdef USE_KQUEUE
+    // EVFILT_SIGNAL also notices the blocked signals
+    if ((sfd = kqueue()) != -1) {
+        EV_SET(&events[0], SIGINT,  EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+        EV_SET(&events[1], SIGTERM, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+        if (kevent(sfd, events, 2, NULL, 0, NULL) == -1) {
+            close(sfd);
+            sfd = -1;
+        }
+    }
+#else
+    sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+#endif
+    if (sfd == -1) {
+        sigprocmask(SIG_SETMASK, old_mask, NULL);
+    }
+    return sfd;
+}
+
+/**
+ * \brief Discard the pending SIGINT and SIGTERM, which would otherwise
+ *    terminate the process once they are unblocked.
+ */
+
+static void demux_discard_signals()
+{
+    sigset_t        mask;
+    struct timespec timeout = {0, 0};
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    while (sigtimedwait(&mask, NULL, &timeout) > 0);
+}
+
+bool demux_server_run(demux_server_t * server)
+{
+#ifdef USE_KQUEUE
+    struct kevent      events[DEMUX_MAX_EVENTS];
+#else
+    struct epoll_event events[DEMUX_MAX_EVENTS];
+#endif
+    sigset_t           old_mask;
+    uint64_t           id;
+    int                i, num_events, sfd;
+    bool               is_running = true;
+
+    if ((sfd = demux_make_signal_fd(&old_mask)) == -1)               goto ERR_MAKE_SIGNAL_FD;
+    if (!demux_server_watch(server, sfd, DEMUX_EVENT_SIGNAL))        goto ERR_WATCH;
+
+    while (is_running) {
+#ifdef USE_KQUEUE
+        if ((num_events = kevent(server->efd, NULL, 0, events, DEMUX_MAX_EVENTS, NULL)) == -1) {
+#else
+        if ((num_events = epoll_wait(server->efd, events, DEMUX_MAX_EVENTS, -1)) == -1) {
+#endif
+            if (errno == EINTR) continue;
+            goto ERR_EPOLL_WAIT;
+        }
+
+        for (i = 0; i < num_events; i++) {
+#ifdef USE_KQUEUE
+            id = (uintptr_t) events[i].udata;
+#else
+            id = events[i].data.u64;
+#endif
+            switch (id) {
+                case DEMUX_EVENT_LISTEN:
+                    demux_server_accept(server);
+                    break;
+#ifdef USE_IPV4
+                case DEMUX_EVENT_ICMPV4:
+                    sniffer_process_packets(server->sniffer, IPPROTO_ICMP);
+                    break;
+#endif
+#ifdef USE_IPV6
+                case DEMUX_EVENT_ICMPV6:
+                    sniffer_process_packets(server->sniffer, IPPROTO_ICMPV6);
+                    break;
+#endif
+                case DEMUX_EVENT_SIGNAL:
+                    is_running = false;
+                    break;
+                default:
+                    demux_peer_process(server, &server->peers[id]);
+                    break;
+            }
+        }
+    }
+
+    demux_discard_signals();
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return true;
+
+ERR_EPOLL_WAIT:
+ERR_WATCH:
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+ERR_MAKE_SIGNAL_FD:
+    perror("demux_server_run");
+    return false;
+}
+
+void demux_server_dump(const demux_server_t * server, FILE * file)
+{
+    fprintf(file, "demux: %llu routed, %llu broadcast, %llu unrouted, %llu dropped\n",
+        (unsigned long long) server->num_routed,
+        (unsigned long long) server->num_broadcast,
+        (unsigned long long) server->num_unrouted,
+        (unsigned long long) server->num_dropped
+    );
+}
+
+//---------------------------------------------------------------------------
+// Client
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Receive the response of the server and the file descriptors
+ *    it carries.
+ * \param sockfd The connection to the server.
+ * \param response The demux_response_t instance to fill.
+ * \param fds The array in which the memfd and the eventfd are written.
+ * \return true iif successful.
+ */
+
+static bool demux_client_recv_response(int sockfd, demux_response_t * response, int * fds)
+{
+    struct msghdr    msg;
+    struct iovec     iov;
+    struct cmsghdr * cmsg;
+    char             control[CMSG_SPACE(2 * sizeof(int))];
+    ssize_t          num_bytes;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base       = response;
+    iov.iov_len        = sizeof(demux_response_t);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    while ((num_bytes = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    if (num_bytes != sizeof(demux_response_t)) return false;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET
+        &&  cmsg->cmsg_type  == SCM_RIGHTS
+        &&  cmsg->cmsg_len   == CMSG_LEN(2 * sizeof(int))) {
+            memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+        }
+    }
+    return true;
+}
+
+demux_client_t * demux_client_create(
+    const char * path,
+    size_t       num_tags,
+    void       * recv_param,
+    bool      (* recv_callback)(packet_t **, size_t, void *)
+) {
+    demux_client_t     * client;
+    struct sockaddr_un   addr;
+    struct timeval       timeout = {DEMUX_CONNECT_TIMEOUT, 0};
+    struct stat          st;
+    demux_request_t      request;
+    demux_response_t     response;
+    int                  fds[2] = {-1, -1};
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "demux: %s: path too long\n", path);
+        goto ERR_PATH;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (!(client = calloc(1, sizeof(demux_client_t)))) goto ERR_CALLOC;
+    if ((client->sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1)         goto ERR_SOCKET;
+    if (setsockopt(client->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) goto ERR_SETSOCKOPT;
+    if (connect(client->sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1) goto ERR_CONNECT;
+
+    request.version  = DEMUX_VERSION;
+    request.num_tags = num_tags;
+    if (send(client->sockfd, &request, sizeof(demux_request_t), MSG_NOSIGNAL) == -1) goto ERR_SEND;
+    if (!demux_client_recv_response(client->sockfd, &response, fds))                goto ERR_RECV_RESPONSE;
+
+    if (response.version != DEMUX_VERSION || response.error != 0 || fds[0] == -1 || fds[1] == -1) {
+        fprintf(stderr, "demux: %s: %s\n", path,
+            response.version != DEMUX_VERSION ? "protocol mismatch" :
+            response.error == ENOSPC          ? "not enough tags left" :
+            strerror(response.error ? response.error : EPROTO)
+        );
+        goto ERR_RESPONSE;
+    }
+
+    // The size of the ring is checked before accessing it
+    if (fstat(fds[0], &st) == -1 || (size_t) st.st_size < sizeof(demux_ring_t)) goto ERR_FSTAT;
+    if ((client->ring = mmap(NULL, sizeof(demux_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0)) == MAP_FAILED) {
+        goto ERR_MMAP;
+    }
+    close(fds[0]);
+
+    client->eventfd       = fds[1];
+    client->first_tag     = response.first_tag;
+    client->last_tag      = response.last_tag;
+    client->recv_param    = recv_param;
+    client->recv_callback = recv_callback;
+    return client;
+
+ERR_MMAP:
+ERR_FSTAT:
+ERR_RESPONSE:
+    if (fds[0] != -1) close(fds[0]);
+    if (fds[1] != -1) close(fds[1]);
+    close(client->sockfd);
+    free(client);
+    return NULL;
+
+ERR_RECV_RESPONSE:
+ERR_SEND:
+ERR_CONNECT:
+ERR_SETSOCKOPT:
+    close(client->sockfd);
+ERR_SOCKET:
+    perror(path);
+    free(client);
+ERR_CALLOC:
+ERR_PATH:
+    return NULL;
+}
+
+void demux_client_free(demux_client_t * client)
+{
+    if (client) {
+        munmap(client->ring, sizeof(demux_ring_t));
+        close(client->eventfd);
+        close(client->sockfd);
+        free(client);
+    }
+}
+
+inline int demux_client_get_fd(const demux_client_t * client) {
+    return client->eventfd;
+}
+
+void demux_client_get_tags(const demux_client_t * client, uint32_t * pfirst, uint32_t * plast) {
+    *pfirst = client->first_tag;
+    *plast  = client->last_tag;
+}
+
+bool demux_client_process(demux_client_t * client)
+{
+    demux_ring_t * ring = client->ring;
+    demux_slot_t * slot;
+    packet_t     * packets[DEMUX_BATCH_SIZE];
+    size_t         num_packets;
+    unsigned int   head, tail;
+    uint64_t       value;
+    bool           ret = true;
+
+    // Acknowledge the notification before draining the ring, so that
+    // the replies stored meanwhile activate the eventfd again.
+    if (read(client->eventfd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("demux_client_process");
+        return false;
+    }
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail != (head = atomic_load_explicit(&ring->head, memory_order_acquire))) {
+        for (num_packets = 0; tail != head && num_packets < DEMUX_BATCH_SIZE; tail++) {
+            slot = &ring->slots[tail & (DEMUX_RING_NUM_SLOTS - 1)];
+            if (slot->size > sizeof(slot->bytes)) continue;
+            if ((packets[num_packets] = packet_borrow_bytes(slot->bytes, slot->size))) {
+                packet_set_recv_time(packets[num_packets], slot->recv_time);
+                num_packets++;
+            }
+        }
+
+        // The slots must not be referenced anymore once handed back
+        if (num_packets > 0 && !client->recv_callback(packets, num_packets, client->recv_param)) {
+            fprintf(stderr, "Error in demux's callback\n");
+            ret = false;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    return ret;
+}
@@ -0,0 +1,242 @@
+#include "use.h"
+
+#ifndef DEMUX_H
+#define DEMUX_H
+
+/**
+ * \file demux.h
+ * \brief Host-level demultiplexer of the ICMP replies.
+ *
+ * The kernel delivers every ICMP packet received by the host to every raw
+ * ICMP socket, so that N measurement processes running on the same host
+ * (paris-traceroute, paris-ping...) receive, parse and discard N times
+ * the replies of each other.
+ *
+ * A demux_server_t is the only process sniffing the ICMP replies. Each
+ * process started with --demux-client PATH connects to the server
+ * listening on the UNIX socket PATH (see demux_client_create), and is
+ * granted a range of tags (probe IDs, see network_tag_probe) that its
+ * network layer allocates exclusively (see tag_allocator_set_range). The
+ * server reads the tag of each reply (the checksum of the quoted probe,
+ * or of the echo request of an echo reply) and copies the reply in the
+ * shared-memory ring of the process owning this tag, which is woken up
+ * by an eventfd once per batch of replies. The replies carrying no tag
+ * (e.g. an ICMP error quoting an unsupported protocol) are copied to
+ * every process, which would have received them anyway.
+ *
+ * The ring of a client is a memfd, shared with the server along with the
+ * eventfd (SCM_RIGHTS) when the client connects. Where memfd_create is
+ * missing (e.g. NetBSD < 11), the server rejects every client. It is a single producer
+ * (the server), single consumer (the client) ring of fixed-size slots.
+ * The replies are passed to the client callback without copying them
+ * (see packet_borrow_bytes), and the slots are handed back to the server
+ * once the callback has returned. If the ring of a client is full, its
+ * replies are dropped (and counted).
+ *
+ * The server only routes the replies: the probes are still sent by each
+ * process through its own raw sockets. Since tags are only 16 bits wide
+ * in the checksums, the processes must use 16-bit tags (see --tag-bits),
+ * and stateless probes (see stateless.h), which are not tagged, cannot be
+ * demultiplexed.
+ */
+
+#include <stdatomic.h>    // atomic_uint, atomic_ullong
+#include <stdbool.h>      // bool
+#include <stddef.h>       // size_t
+#include <stdint.h>       // uint*_t
+#include <stdio.h>        // FILE
+
+#include "packet.h"       // packet_t
+#include "sniffer.h"      // sniffer_t
+
+// Size of a slot of a ring (header included). Larger replies are dropped.
+#define DEMUX_SLOT_SIZE      2048
+
+// Number of slots of the ring of each client. Must be a power of 2.
+#define DEMUX_RING_NUM_SLOTS 1024
+
+// Maximum number of clients connected at once. Further clients are rejected.
+#define DEMUX_MAX_CLIENTS    64
+
+// Number of tags (16 bits, tag 0 excepted) shared among the clients.
+#define DEMUX_NUM_TAGS       65535
+
+// Maximum number of replies passed at once to the callback of a client.
+#define DEMUX_BATCH_SIZE     32
+
+// Time given to the server to answer a client (in seconds).
+#define DEMUX_CONNECT_TIMEOUT 5
+
+// Used to store the producer and consumer indexes in distinct cache lines.
+#define DEMUX_CACHE_LINE     64
+
+/**
+ * \struct demux_slot_t
+ * \brief A reply stored in a ring.
+ */
+
+typedef struct {
+    uint32_t size;                          /**< Size of the reply (in bytes) */
+    uint32_t padding;
+    uint64_t recv_time;                     /**< Receive time of the reply (see get_time_ns) */
+    uint8_t  bytes[DEMUX_SLOT_SIZE - 16];   /**< The reply, starting with its IP header */
+} demux_slot_t;
+
+/**
+ * \struct demux_ring_t
+ * \brief The ring shared by the server and a client.
+ */
+
+typedef struct {
+    _Alignas(DEMUX_CACHE_LINE)
+    atomic_uint   head;        /**< Next position written by the server */
+    atomic_ullong num_dropped; /**< Number of replies dropped because the ring was full */
+    _Alignas(DEMUX_CACHE_LINE)
+    atomic_uint   tail;        /**< Next position read by the client */
+    _Alignas(DEMUX_CACHE_LINE)
+    demux_slot_t  slots[DEMUX_RING_NUM_SLOTS];
+} demux_ring_t;
+
+//---------------------------------------------------------------------------
+// Server
+//---------------------------------------------------------------------------
+
+/**
+ * \struct demux_peer_t
+ * \brief A client connected to the server.
+ */
+
+typedef struct {
+    int            sockfd;      /**< The connection of this client, -1 if the slot is free */
+    demux_ring_t * ring;        /**< The ring of this client, NULL until it is registered */
+    int            eventfd;     /**< Notifies this client of new replies */
+    uint32_t       first_tag;   /**< First tag routed to this client */
+    uint32_t       last_tag;    /**< Last tag routed to this client */
+    bool           is_pending;  /**< True iif replies have been stored since the last notification */
+} demux_peer_t;
+
+/**
+ * \struct demux_server_t
+ * \brief A demultiplexer routing the replies to its clients.
+ */
+
+typedef struct {
+    char         * path;                        /**< Path of the listening socket */
+    int            sockfd;                      /**< The listening socket */
+    int            efd;                         /**< epoll (kqueue if USE_KQUEUE) instance watching the sockets */
+    sniffer_t    * sniffer;                     /**< Sniffs the replies of the host */
+    demux_peer_t   peers[DEMUX_MAX_CLIENTS];    /**< The clients */
+    uint8_t        owners[DEMUX_NUM_TAGS + 1];  /**< Index + 1 of the peer owning each tag, 0 if none */
+    uint64_t       num_routed;                  /**< Replies copied to the client owning their tag */
+    uint64_t       num_broadcast;               /**< Replies without tag, copied to every client */
+    uint64_t       num_unrouted;                /**< Replies whose tag is not owned by any client */
+    uint64_t       num_dropped;                 /**< Replies dropped because a ring was full or they were too large */
+} demux_server_t;
+
+/**
+ * \brief Create a demultiplexer. It opens the raw sockets sniffing the
+ *    ICMP replies (root privileges are required).
+ * \param path The path of the UNIX socket accepting the clients. A
+ *    socket left by a previous run is replaced.
+ * \return The newly created server, NULL in case of failure.
+ */
+
+demux_server_t * demux_server_create(const char * path);
+
+/**
+ * \brief Release a demultiplexer. Its clients are disconnected, and do
+ *    not receive any reply anymore.
+ * \param server A demux_server_t instance.
+ */
+
+void demux_server_free(demux_server_t * server);
+
+/**
+ * \brief Route the replies to the clients of a demultiplexer until
+ *    SIGINT or SIGTERM is received.
+ * \param server A demux_server_t instance.
+ * \return true iif successful.
+ */
+
+bool demux_server_run(demux_server_t * server);
+
+/**
+ * \brief Print the counters of a demultiplexer.
+ * \param server A demux_server_t instance.
+ * \param file The output file (e.g. stderr).
+ */
+
+void demux_server_dump(const demux_server_t * server, FILE * file);
+
+//---------------------------------------------------------------------------
+// Client
+//---------------------------------------------------------------------------
+
+/**
+ * \struct demux_client_t
+ * \brief The connection of a process to a demultiplexer, replacing its
+ *    sniffer.
+ */
+
+typedef struct {
+    int            sockfd;        /**< The connection to the server */
+    demux_ring_t * ring;          /**< The ring filled by the server */
+    int            eventfd;       /**< Activated by the server when the ring is filled */
+    uint32_t       first_tag;     /**< First tag routed to this client */
+    uint32_t       last_tag;      /**< Last tag routed to this client */
+    void         * recv_param;    /**< Passed to recv_callback */
+    bool        (* recv_callback)(packet_t ** packets, size_t num_packets, void * recv_param); /**< Called for the received replies */
+} demux_client_t;
+
+/**
+ * \brief Connect to a demultiplexer.
+ * \param path The path of the UNIX socket of the server.
+ * \param num_tags The number of tags requested.
+ * \param recv_param Passed to recv_callback.
+ * \param recv_callback Called with the replies routed to this client,
+ *    as the callback of a sniffer (see sniffer_create). The packets are
+ *    borrowed (see packet_is_borrowed).
+ * \return The newly created client, NULL in case of failure.
+ */
+
+demux_client_t * demux_client_create(
+    const char * path,
+    size_t       num_tags,
+    void       * recv_param,
+    bool      (* recv_callback)(packet_t **, size_t, void *)
+);
+
+/**
+ * \brief Disconnect from a demultiplexer.
+ * \param client A demux_client_t instance.
+ */
+
+void demux_client_free(demux_client_t * client);
+
+/**
+ * \brief Retrieve the file descriptor activated when replies are
+ *    stored in the ring of a client.
+ * \param client A demux_client_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int demux_client_get_fd(const demux_client_t * client);
+
+/**
+ * \brief Retrieve the range of tags routed to a client.
+ * \param client A demux_client_t instance.
+ * \param pfirst Address of an uint32_t in which the first tag is written.
+ * \param plast Address of an uint32_t in which the last tag is written.
+ */
+
+void demux_client_get_tags(const demux_client_t * client, uint32_t * pfirst, uint32_t * plast);
+
+/**
+ * \brief Pass the replies stored in the ring of a client to its callback.
+ * \param client A demux_client_t instance.
+ * \return true iif successful.
+ */
+
+bool demux_client_process(demux_client_t * client);
+
+#endif // DEMUX_H
@@ -0,0 +1,133 @@
+#include "config.h"
+
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memcpy
+
+#include "deque.h"
+
+/**
+ * \brief Retrieve the cell of the i-th element of a deque.
+ * \param deque A deque_t instance.
+ * \param i The index of the element, starting from the front.
+ * \return The index of the corresponding cell.
+ */
+
+static inline size_t deque_get_cell(const deque_t * deque, size_t i) {
+    return (deque->first + i) & (deque->max_size - 1);
+}
+
+/**
+ * \brief Double the capacity of a deque. The elements are moved to the
+ *    beginning of the new buffer.
+ * \param deque A deque_t instance.
+ * \return true iif successful
+ */
+
+static bool deque_grow(deque_t * deque)
+{
+    void   ** elements;
+    size_t    num_first = deque->max_size - deque->first;
+
+    if (!(elements = malloc(2 * deque->max_size * sizeof(void *)))) return false;
+
+    // The elements may wrap around the end of the buffer
+    if (num_first > deque->size) num_first = deque->size;
+    memcpy(elements, deque->elements + deque->first, num_first * sizeof(void *));
+    memcpy(elements + num_first, deque->elements, (deque->size - num_first) * sizeof(void *));
+
+    free(deque->elements);
+    deque->elements = elements;
+    deque->first    = 0;
+    deque->max_size *= 2;
+    return true;
+}
+
+deque_t * deque_create()
+{
+    deque_t * deque;
+
+    if (!(deque = malloc(sizeof(deque_t)))) {
+        goto ERR_MALLOC;
+    }
+
+    if (!(deque->elements = malloc(DEQUE_SIZE_INIT * sizeof(void *)))) {
+        goto ERR_MALLOC_ELEMENTS;
+    }
+
+    deque->first    = 0;
+    deque->size     = 0;
+    deque->max_size = DEQUE_SIZE_INIT;
+    return deque;
+
+ERR_MALLOC_ELEMENTS:
+    free(deque);
+ERR_MALLOC:
+    return NULL;
+}
+
+void deque_free(deque_t * deque, void (*element_free)(void * element))
+{
+    if (deque) {
+        deque_clear(deque, element_free);
+        free(deque->elements);
+        free(deque);
+    }
+}
+
+bool deque_push_back(deque_t * deque, void * element)
+{
+    if (deque->size == deque->max_size && !deque_grow(deque)) return false;
+    deque->elements[deque_get_cell(deque, deque->size)] = element;
+    deque->size++;
+    return true;
+}
+
+bool deque_push_front(deque_t * deque, void * element)
+{
+    if (deque->size == deque->max_size && !deque_grow(deque)) return false;
+    deque->first = (deque->first - 1) & (deque->max_size - 1);
+    deque->elements[deque->first] = element;
+    deque->size++;
+    return true;
+}
+
+void * deque_pop_front(deque_t * deque)
+{
+    void * element;
+
+    if (!deque->size) return NULL;
+    element = deque->elements[deque->first];
+    deque->first = deque_get_cell(deque, 1);
+    deque->size--;
+    return element;
+}
+
+void * deque_pop_back(deque_t * deque)
+{
+    if (!deque->size) return NULL;
+    deque->size--;
+    return deque->elements[deque_get_cell(deque, deque->size)];
+}
+
+void * deque_get_ith_element(const deque_t * deque, size_t i) {
+    return i < deque->size ? deque->elements[deque_get_cell(deque, i)] : NULL;
+}
+
+size_t deque_get_size(const deque_t * deque) {
+    return deque ? deque->size : 0;
+}
+
+void deque_clear(deque_t * deque, void (*element_free)(void * element))
+{
+    size_t i;
+
+    if (deque) {
+        if (element_free) {
+            for (i = 0; i < deque->size; i++) {
+                element_free(deque->elements[deque_get_cell(deque, i)]);
+            }
+        }
+        deque->first = 0;
+        deque->size  = 0;
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stddef.h>  // size_t
+#include <stdbool.h> // bool
+
+/**
+ * \file deque.h
+ * \brief Header file: double-ended queue
+ *
+ * deque_t stores pointers in a ring buffer, whose capacity is a power of
+ * 2 and is doubled whenever it is full. Unlike a dynarray_t, elements are
+ * pushed and popped at both ends in O(1) (amortized), without shifting
+ * the other elements: it suits the FIFO structures (e.g. a work list
+ * processed from its front while being filled at its back).
+ *
+ * Unlike queue_t (see queue.h), a deque_t is not thread-safe.
+ */
+
+// Initial number of cells of a deque. Must be a power of 2.
+#define DEQUE_SIZE_INIT 8
+
+/**
+ * \struct deque_t
+ * \brief Structure representing a double-ended queue.
+ */
+
+typedef struct {
+    void   ** elements;  /**< Ring buffer of max_size cells */
+    size_t    first;     /**< Index in elements of the front element */
+    size_t    size;      /**< Number of elements stored in the deque */
+    size_t    max_size;  /**< Number of cells of elements (power of 2) */
+} deque_t;
+
+/**
+ * \brief Create an empty deque.
+ * \return The newly created deque_t instance, NULL in case of failure.
+ */
+
+deque_t * deque_create();
+
+/**
+ * \brief Release a deque from the memory.
+ * \param deque A deque_t instance.
+ * \param element_free Pointer to a function used to free up element resources
+ *     (can be NULL)
+ */
+
+void deque_free(deque_t * deque, void (*element_free)(void * element));
+
+/**
+ * \brief Add an element at the back of a deque.
+ * \param deque A deque_t instance.
+ * \param element The element to add.
+ * \return true iif successful
+ */
+
+bool deque_push_back(deque_t * deque, void * element);
+
+/**
+ * \brief Add an element at the front of a deque.
+ * \param deque A deque_t instance.
+ * \param element The element to add.
+ * \return true iif successful
+ */
+
+bool deque_push_front(deque_t * deque, void * element);
+
+/**
+ * \brief Remove the front element of a deque.
+ * \param deque A deque_t instance.
+ * \return The removed element, NULL if the deque is empty.
+ */
+
+void * deque_pop_front(deque_t * deque);
+
+/**
+ * \brief Remove the back element of a deque.
+ * \param deque A deque_t instance.
+ * \return The removed element, NULL if the deque is empty.
+ */
+
+void * deque_pop_back(deque_t * deque);
+
+/**
+ * \brief Retrieve the i-th element of a deque, starting from its front.
+ * \param deque A deque_t instance.
+ * \param i The index of the element.
+ * \return The corresponding element, NULL if i is out of range.
+ */
+
+void * deque_get_ith_element(const deque_t * deque, size_t i);
+
+/**
+ * \brief Retrieve the number of elements stored in a deque.
+ * \param deque A deque_t instance.
+ * \return The number of elements.
+ */
+
+size_t deque_get_size(const deque_t * deque);
+
+/**
+ * \brief Remove every element of a deque. Its buffer is kept for the
+ *    next elements.
+ * \param deque A deque_t instance.
+ * \param element_free Pointer to a function used to free up element resources
+ *     (can be NULL)
+ */
+
+void deque_clear(deque_t * deque, void (*element_free)(void * element));
+
+#endif // DEQUE_H
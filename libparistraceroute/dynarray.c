@@ -8,7 +8,6 @@
 #include "dynarray.h"
 
 #define DYNARRAY_SIZE_INIT  5
-#define DYNARRAY_SIZE_INC   5
 
 dynarray_t * dynarray_create()
 {
@@ -75,19 +74,16 @@ void dynarray_free(dynarray_t * dynarray, void (*element_free)(void *element)) {
 
 bool dynarray_push_element(dynarray_t * dynarray, void * element)
 {
-    // If the dynarray is full, allocate DYNARRAY_SIZE_INC
-    // cells in the dynarray
+    void   ** elements;
+    size_t    max_size;
+
+    // If the dynarray is full, double its capacity, so that n pushes
+    // cost O(n) copies overall
     if (dynarray->size == dynarray->max_size) {
-        dynarray->elements = realloc(
-            dynarray->elements,
-            (dynarray->size + DYNARRAY_SIZE_INC) * sizeof(void *)
-        );
-        if (!dynarray->elements) return false;
-        memset(
-            dynarray->elements + dynarray->size, 0,
-            DYNARRAY_SIZE_INC * sizeof(void *)
-        );
-        dynarray->max_size += DYNARRAY_SIZE_INC;
+        max_size = dynarray->max_size ? 2 * dynarray->max_size : DYNARRAY_SIZE_INIT;
+        if (!(elements = realloc(dynarray->elements, max_size * sizeof(void *)))) return false;
+        dynarray->elements = elements;
+        dynarray->max_size = max_size;
     }
 
     // Add the new element and update exposed size
@@ -129,10 +125,9 @@ void dynarray_clear(dynarray_t * dynarray, void (*element_free)(void * element))
                 element_free(dynarray->elements[i]);
             }
         }
-        dynarray->elements = realloc(dynarray->elements, DYNARRAY_SIZE_INIT * sizeof(void *)); // XXX
-        memset(dynarray->elements, 0, DYNARRAY_SIZE_INIT * sizeof(void *));
+        // The buffer is kept, since a cleared dynarray is usually
+        // filled again (e.g. the events of an algorithm instance)
         dynarray->size = 0;
-        dynarray->max_size = DYNARRAY_SIZE_INIT;
     }
 }
 
@@ -150,7 +145,7 @@ void * dynarray_get_ith_element(const dynarray_t * dynarray, unsigned int i) {
 
 bool dynarray_set_ith_element(dynarray_t * dynarray, unsigned int i, void * element)
 {
-    if (i > dynarray->size) return false; // out of range
+    if (i >= dynarray->size) return false; // out of range
     dynarray->elements[i] = element;
     return true;
 }
@@ -8,9 +8,11 @@
  * \file dynarray.h
  * \brief Header file: dynamic array structure
  *
- * dynarray_t manages a dynamic array of potentially infinite size, by
- * allocating memory in a chunk-by-chunk fashion. An initial memory_size is
- * allocated, and this size is increased by a given amount when needed.
+ * dynarray_t manages a dynamic array of potentially infinite size. An
+ * initial buffer is allocated, and its capacity is doubled whenever it is
+ * full, so that pushing n elements costs O(n) copies overall. Deleting
+ * the first elements shifts the whole array: FIFO structures should use
+ * a deque_t instead (see deque.h).
  */
 
 /**
@@ -20,8 +22,8 @@
 
 typedef struct {
     void   ** elements;  /**< Pointer to the array of elements */
-    size_t    size;      /**< Size of the array (in bytes) (should be always <= to max_size) */
-    size_t    max_size;  /**< Size of the allocated buffer (in bytes) */ 
+    size_t    size;      /**< Number of elements (always <= max_size) */
+    size_t    max_size;  /**< Number of elements the allocated buffer can store */
 } dynarray_t;
 
 /**
@@ -83,8 +85,9 @@ bool dynarray_del_ith_element(dynarray_t * dynarray, size_t i, void (*element_fr
  */
 
 bool dynarray_del_n_elements(dynarray_t * dynarray, size_t i, size_t n, void (*element_free)(void * element));
+
 /**
- * \brief Clear a dynamic array.
+ * \brief Clear a dynamic array. Its buffer is kept for the next elements.
  * \param dynarray Pointer to a dynamic array structure
  * \param element_free Pointer to a function used to free up element resources
  *     (can be NULL)
@@ -118,6 +121,17 @@ void ** dynarray_get_elements(dynarray_t * dynarray);
 
 void * dynarray_get_ith_element(const dynarray_t * dynarray, unsigned int i);
 
+/**
+ * \brief Replace the i-th element stored in a dynarray.
+ * \param dynarray A dynarray_t instance.
+ * \param i The index of the element to replace.
+ *    Valid values are between 0 and dynarray_get_size() - 1
+ * \param element The new element.
+ * \return true iif successful
+ */
+
+bool dynarray_set_ith_element(dynarray_t * dynarray, unsigned int i, void * element);
+
 /**
  * \brief Dump dynarray contents.
  * \param dynarray A dynarray_t instance.
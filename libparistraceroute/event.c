@@ -1,8 +1,18 @@
 #include "config.h"
 
-#include <stdlib.h> // malloc
+#include <stdlib.h> // free
 
 #include "event.h"
+#include "pool.h"   // pool_t
+#include "memstats.h" // memstats_track_*
+
+static __thread pool_t event_pool = POOL_INITIALIZER(sizeof(event_t), free);
+
+static void event_pool_clear() __attribute__((destructor));
+
+static void event_pool_clear() {
+    pool_clear(&event_pool, free);
+}
 
 event_t * event_create(
     event_type_t type,
@@ -11,22 +21,58 @@ event_t * event_create(
     void (*data_free) (void * data)
 ) {
     event_t * event;
-    if ((event = malloc(sizeof(event_t)))) {
+    bool      recycled;
+
+    if ((event = pool_alloc(&event_pool, &recycled))) {
         event->type = type;
         event->data = data;
         event->issuer = issuer;
         event->data_free = data_free;
+        event->num_references = 1;
+        memstats_track_alloc(MEMSTATS_EVENT, sizeof(event_t));
+    }
+    return event;
+}
+
+/**
+ * \brief Release the (probe, reply) pair of an event (see event_create_probe_reply).
+ * \param probe_reply The pair stored in the event.
+ */
+
+static void event_probe_reply_release(void * probe_reply) {
+    probe_free(((probe_reply_t *) probe_reply)->probe);
+    probe_free(((probe_reply_t *) probe_reply)->reply);
+}
+
+event_t * event_create_probe_reply(
+    event_type_t type,
+    probe_t    * probe,
+    probe_t    * reply,
+    struct algorithm_instance_s * issuer
+) {
+    event_t * event;
+
+    if ((event = event_create(type, NULL, issuer, event_probe_reply_release))) {
+        event->probe_reply.probe = probe_ref(probe);
+        event->probe_reply.reply = probe_ref(reply);
+        event->data = &event->probe_reply;
     }
     return event;
 }
 
+event_t * event_ref(event_t * event)
+{
+    if (event) event->num_references++;
+    return event;
+}
+
 void event_free(event_t * event)
 {
-    if (event) {
+    if (event && --event->num_references == 0) {
         if (event->data && event->data_free) {
             event->data_free(event->data);
         }
-        // TODO: trigger a double free. Ex: paris-traceroute -n 8.8.8.8
-        // free(event);
+        memstats_track_free(MEMSTATS_EVENT, sizeof(event_t));
+        if (!pool_release(&event_pool, event)) free(event);
     }
 }
@@ -3,6 +3,10 @@
 
 // Do not include "algorithm.h" to avoid mutual inclusion
 
+#include <stddef.h>   // size_t
+
+#include "probe.h"    // probe_reply_t
+
 /**
  * \file event.h
  * \brief
@@ -15,6 +19,11 @@
  *   does the algorithm.
  *
  *   Specific-algorithm event are nested in a ALGORITHM_ANSWER event.
+ *
+ *   Events are recycled thanks to a thread-local pool. An event may be
+ *   queued (see pt_throw) for several recipients, for instance when an
+ *   algorithm forwards an event to its caller: each recipient then holds
+ *   a reference (see event_ref) and releases it thanks to event_free.
  */
 
 /**
@@ -27,6 +36,10 @@ typedef enum {
     // Such events are dispatched to the appropriate algorithm instances
     PROBE_REPLY,               /**< A reply has been sniffed           */
     PROBE_TIMEOUT,             /**< No reply sniffed for a given probe */
+    PROBE_SENT,                /**< A stateless probe has been sent and is given back to its caller */
+    PROBE_REPLY_DUPLICATE,     /**< A reply has been sniffed for a probe already matched (see recent_probes.h) */
+    PROBE_REPLY_LATE,          /**< A reply has been sniffed for a probe already expired (see recent_probes.h) */
+    NETWORK_READY,             /**< Some probes may be sent again without exceeding the window (see network_wait_credits) */
 
     // Events handled the algorithm layer
     ALGORITHM_INIT,            /**< An algorithm can start             */
@@ -48,6 +61,8 @@ typedef struct {
     void                        * data;               /**< Data carried by the event */
     void                       (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
     struct algorithm_instance_s * issuer;             /**< Instance which has raised the event. NULL if raised by pt_loop. */
+    size_t                        num_references;     /**< Number of references to this event (see event_ref) */
+    probe_reply_t                 probe_reply;        /**< Storage of the (probe, reply) pair (see event_create_probe_reply) */
 } event_t;
 
 /** 
@@ -66,7 +81,38 @@ event_t * event_create(
 );
 
 /**
- * \brief Release an event when done
+ * \brief Create a new event carrying a (probe, reply) pair. The pair is
+ *    stored in the event itself, so event->data points to event->probe_reply
+ *    and nothing has to be allocated besides the (pooled) event.
+ *    The event takes a reference to the probe and to the reply, which
+ *    are released along with the event (see probe_ref): a handler keeping
+ *    them beyond the event must take its own references.
+ * \param type Event type (e.g. PROBE_REPLY)
+ * \param probe The probe (may be NULL)
+ * \param reply The reply related to this probe
+ * \param issuer
+ * \return Newly created event structure
+ */
+
+event_t * event_create_probe_reply(
+    event_type_t type,
+    probe_t    * probe,
+    probe_t    * reply,
+    struct algorithm_instance_s * issuer
+);
+
+/**
+ * \brief Take a new reference to an event, e.g. before passing an event
+ *    received by an algorithm to another recipient (see pt_throw).
+ * \param event The event
+ * \return The event
+ */
+
+event_t * event_ref(event_t * event);
+
+/**
+ * \brief Release a reference to an event when done. The event
+ *    (and its data) is destroyed once its last reference is released.
  * \param event The event to destroy
  */
 
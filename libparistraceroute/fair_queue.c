@@ -0,0 +1,259 @@
+#include "config.h"
+
+#include <stdint.h>       // uint64_t, uintptr_t
+#include <stdlib.h>       // calloc, free, malloc
+
+#include "fair_queue.h"
+
+fair_queue_t * fair_queue_create(double rate, size_t burst)
+{
+    fair_queue_t * fair_queue;
+
+    if (rate < 0 || burst == 0)                          goto ERR_INVALID_PARAMETER;
+    if (!(fair_queue = calloc(1, sizeof(fair_queue_t)))) goto ERR_CALLOC;
+
+    fair_queue->rate  = rate;
+    fair_queue->burst = burst;
+    return fair_queue;
+
+ERR_CALLOC:
+ERR_INVALID_PARAMETER:
+    return NULL;
+}
+
+static void fair_flow_free(fair_flow_t * flow, void (* element_free)(void * element))
+{
+    size_t i;
+
+    if (element_free) {
+        for (i = 0; i < flow->size; i++) {
+            element_free(flow->probes[(flow->first + i) & (flow->capacity - 1)]);
+        }
+    }
+    free(flow->probes);
+    free(flow);
+}
+
+void fair_queue_free(fair_queue_t * fair_queue, void (* element_free)(void * element))
+{
+    fair_flow_t * flow;
+    size_t        i;
+
+    if (fair_queue) {
+        for (i = 0; i < FAIR_QUEUE_NUM_BUCKETS; i++) {
+            while ((flow = fair_queue->buckets[i])) {
+                fair_queue->buckets[i] = flow->bucket_next;
+                fair_flow_free(flow, element_free);
+            }
+        }
+        free(fair_queue);
+    }
+}
+
+static inline fair_flow_t ** fair_queue_get_bucket(fair_queue_t * fair_queue, const void * caller) {
+    return &fair_queue->buckets[(((uint64_t) (uintptr_t) caller * 0x9e3779b97f4a7c15ULL) >> 32) & (FAIR_QUEUE_NUM_BUCKETS - 1)];
+}
+
+/**
+ * \brief Retrieve the flow of a caller.
+ * \param fair_queue A fair_queue_t instance.
+ * \param caller The caller.
+ * \param do_create Pass true to create the flow if it does not exist yet.
+ * \return The flow, NULL if not found or in case of failure.
+ */
+
+static fair_flow_t * fair_queue_get_flow(fair_queue_t * fair_queue, const void * caller, bool do_create)
+{
+    fair_flow_t ** pbucket = fair_queue_get_bucket(fair_queue, caller),
+                 * flow;
+
+    for (flow = *pbucket; flow; flow = flow->bucket_next) {
+        if (flow->caller == caller) return flow;
+    }
+
+    if (!do_create || !(flow = calloc(1, sizeof(fair_flow_t)))) return NULL;
+
+    flow->caller        = caller;
+    flow->weight        = 1;
+    flow->rate          = fair_queue->rate;
+    flow->bucket.tokens = fair_queue->burst;
+    flow->bucket_next   = *pbucket;
+    *pbucket = flow;
+    return flow;
+}
+
+/**
+ * \brief Unlink an empty flow from its bucket and release it.
+ * \param fair_queue A fair_queue_t instance.
+ * \param flow The flow, which must not be active.
+ */
+
+static void fair_queue_del_flow(fair_queue_t * fair_queue, fair_flow_t * flow)
+{
+    fair_flow_t ** pcur;
+
+    for (pcur = fair_queue_get_bucket(fair_queue, flow->caller); *pcur; pcur = &(*pcur)->bucket_next) {
+        if (*pcur == flow) {
+            *pcur = flow->bucket_next;
+            break;
+        }
+    }
+    fair_flow_free(flow, NULL);
+}
+
+bool fair_queue_set_default_share(fair_queue_t * fair_queue, double rate, size_t burst)
+{
+    fair_flow_t * flow;
+    size_t        i;
+
+    if (rate < 0 || burst == 0) return false;
+
+    fair_queue->rate  = rate;
+    fair_queue->burst = burst;
+    for (i = 0; i < FAIR_QUEUE_NUM_BUCKETS; i++) {
+        for (flow = fair_queue->buckets[i]; flow; flow = flow->bucket_next) {
+            if (!flow->is_shared) flow->rate = rate;
+        }
+    }
+    return true;
+}
+
+bool fair_queue_set_share(fair_queue_t * fair_queue, const void * caller, size_t weight, double rate)
+{
+    fair_flow_t * flow;
+
+    if (weight == 0 || rate < 0)                                   return false;
+    if (!(flow = fair_queue_get_flow(fair_queue, caller, true)))   return false;
+
+    if (!flow->is_shared) fair_queue->num_shared++;
+    flow->weight    = weight;
+    flow->rate      = rate;
+    flow->is_shared = true;
+    return true;
+}
+
+void fair_queue_forget_caller(fair_queue_t * fair_queue, const void * caller)
+{
+    fair_flow_t * flow;
+
+    if ((flow = fair_queue_get_flow(fair_queue, caller, false))) {
+        if (flow->is_shared) fair_queue->num_shared--;
+        if (flow->size == 0) {
+            fair_queue_del_flow(fair_queue, flow);
+        } else {
+            // Released by fair_queue_pop once empty
+            flow->weight    = 1;
+            flow->rate      = 0;
+            flow->is_shared = false;
+        }
+    }
+}
+
+bool fair_queue_push(fair_queue_t * fair_queue, probe_t * probe)
+{
+    fair_flow_t  * flow;
+    probe_t     ** probes;
+    size_t         i, capacity;
+
+    if (!(flow = fair_queue_get_flow(fair_queue, probe->caller, true))) return false;
+
+    if (flow->size == flow->capacity) {
+        capacity = flow->capacity ? 2 * flow->capacity : FAIR_QUEUE_FLOW_CAPACITY;
+        if (!(probes = malloc(capacity * sizeof(probe_t *)))) return false;
+
+        // Unwrap the ring
+        for (i = 0; i < flow->size; i++) {
+            probes[i] = flow->probes[(flow->first + i) & (flow->capacity - 1)];
+        }
+        free(flow->probes);
+        flow->probes   = probes;
+        flow->capacity = capacity;
+        flow->first    = 0;
+    }
+
+    flow->probes[(flow->first + flow->size) & (flow->capacity - 1)] = probe;
+
+    // An empty flow joins the end of the current round
+    if (flow->size++ == 0) {
+        flow->deficit     = 0;
+        flow->active_next = NULL;
+        if (fair_queue->last_active) {
+            fair_queue->last_active->active_next = flow;
+        } else {
+            fair_queue->first_active = flow;
+        }
+        fair_queue->last_active = flow;
+        fair_queue->num_active++;
+    }
+    fair_queue->size++;
+    return true;
+}
+
+/**
+ * \brief Move the flow currently served to the end of the round.
+ * \param fair_queue A fair_queue_t instance with at least one active flow.
+ */
+
+static void fair_queue_rotate(fair_queue_t * fair_queue)
+{
+    fair_flow_t * flow = fair_queue->first_active;
+
+    if (flow->active_next) {
+        fair_queue->first_active = flow->active_next;
+        flow->active_next = NULL;
+        fair_queue->last_active->active_next = flow;
+        fair_queue->last_active = flow;
+    }
+}
+
+size_t fair_queue_pop(fair_queue_t * fair_queue, probe_t ** probes, size_t max_probes, double now, double * pdelay)
+{
+    fair_flow_t * flow;
+    size_t        num_probes = 0,
+                  num_blocked = 0;
+    double        delay;
+
+    *pdelay = 0;
+
+    // Stop once every active flow waits for a token
+    while (num_probes < max_probes && (flow = fair_queue->first_active) && num_blocked < fair_queue->num_active) {
+        // A new turn of this flow
+        if (flow->deficit == 0) flow->deficit = flow->weight;
+        if (flow->rate > 0) token_bucket_refill(&flow->bucket, flow->rate, fair_queue->burst, now);
+
+        while (num_probes < max_probes && flow->deficit > 0 && flow->size > 0
+        && (flow->rate == 0 || flow->bucket.tokens >= 1)) {
+            probes[num_probes++] = flow->probes[flow->first];
+            flow->first = (flow->first + 1) & (flow->capacity - 1);
+            flow->size--;
+            flow->deficit--;
+            if (flow->rate > 0) flow->bucket.tokens -= 1;
+        }
+        if (flow->size == 0) {
+            // This flow leaves the round. It only carries its share (or
+            // the state of its token bucket) from now on.
+            fair_queue->first_active = flow->active_next;
+            if (!fair_queue->first_active) fair_queue->last_active = NULL;
+            flow->deficit = 0;
+            fair_queue->num_active--;
+            if (!flow->is_shared && flow->rate == 0) {
+                fair_queue_del_flow(fair_queue, flow);
+            }
+        } else if (flow->deficit == 0) {
+            // Its quantum is consumed
+            fair_queue_rotate(fair_queue);
+            num_blocked = 0;
+        } else if (num_probes < max_probes) {
+            // It waits for a token and gives its turn away
+            delay = (1 - flow->bucket.tokens) / flow->rate;
+            if (*pdelay == 0 || delay < *pdelay) *pdelay = delay;
+            flow->deficit = 0;
+            fair_queue_rotate(fair_queue);
+            num_blocked++;
+        }
+        // Otherwise its turn goes on at the next call
+    }
+
+    fair_queue->size -= num_probes;
+    return num_probes;
+}
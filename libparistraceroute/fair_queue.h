@@ -0,0 +1,163 @@
+#ifndef FAIR_QUEUE_H
+#define FAIR_QUEUE_H
+
+/**
+ * \file fair_queue.h
+ * \brief Probes waiting in the network layer, shared fairly between the
+ *    instances which have sent them.
+ *
+ * Each instance (the caller of its probes) has its own FIFO, called a
+ * flow. The flows holding probes are served by deficit round-robin: in
+ * each round, a flow may release as many probes as its weight, so that
+ * an instance sending many probes (e.g. mda on a large load balancer)
+ * does not delay the instances sharing the network layer. A flow may
+ * also be capped by a token bucket, in which case it is skipped until
+ * a token is available.
+ *
+ * The flows are indexed by caller in a fixed-size hash table. An
+ * uncapped flow with the default share is released as soon as it is
+ * empty, the other ones once their caller is forgotten.
+ */
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+
+#include "pacer.h"    // token_bucket_t
+#include "probe.h"    // probe_t
+
+// Number of buckets indexing the flows. Must be a power of 2.
+#define FAIR_QUEUE_NUM_BUCKETS 256
+
+// Initial number of probes a flow can hold before being resized.
+#define FAIR_QUEUE_FLOW_CAPACITY 16
+
+/**
+ * \struct fair_flow_t
+ * \brief The probes of a given caller waiting in a fair_queue_t.
+ */
+
+typedef struct fair_flow_s {
+    const void          * caller;      /**< The instance which has sent these probes (may be NULL) */
+    probe_t            ** probes;      /**< Ring of the waiting probes */
+    size_t                capacity;    /**< Number of slots of fair_flow_t::probes, a power of 2 */
+    size_t                first;       /**< Index of the oldest probe */
+    size_t                size;        /**< Number of waiting probes */
+    size_t                weight;      /**< Number of probes released per round */
+    size_t                deficit;     /**< Number of probes this flow may still release in the current round */
+    double                rate;        /**< Maximal rate of this flow (in probes per second), 0 if unlimited */
+    token_bucket_t        bucket;      /**< Paces this flow if rate > 0 */
+    bool                  is_shared;   /**< true iif the share of this flow has been set (see fair_queue_set_share) */
+    struct fair_flow_s  * bucket_next; /**< Next flow stored in the same bucket */
+    struct fair_flow_s  * active_next; /**< Next flow to serve, NULL if this one is the last or is empty */
+} fair_flow_t;
+
+/**
+ * \struct fair_queue_t
+ * \brief The flows of a network layer.
+ */
+
+typedef struct {
+    fair_flow_t * buckets[FAIR_QUEUE_NUM_BUCKETS]; /**< The flows, indexed by caller */
+    fair_flow_t * first_active;  /**< Flow currently served */
+    fair_flow_t * last_active;   /**< Flow served last in the current round */
+    size_t        size;          /**< Number of waiting probes */
+    size_t        num_active;    /**< Number of flows holding probes */
+    size_t        num_shared;    /**< Number of flows whose share has been set */
+    double        rate;          /**< Default rate of a flow (in probes per second), 0 if unlimited */
+    size_t        burst;         /**< Capacity of the token buckets (in probes) */
+} fair_queue_t;
+
+/**
+ * \brief Create a fair_queue_t instance.
+ * \param rate The default rate of a flow (in probes per second), 0 if unlimited.
+ * \param burst The number of probes a capped flow may release at once (>= 1).
+ * \return The newly allocated fair_queue_t instance, NULL in case of failure.
+ */
+
+fair_queue_t * fair_queue_create(double rate, size_t burst);
+
+/**
+ * \brief Release a fair_queue_t instance and its flows from the memory.
+ * \param fair_queue A fair_queue_t instance.
+ * \param element_free Called on each waiting probe (may be NULL).
+ */
+
+void fair_queue_free(fair_queue_t * fair_queue, void (* element_free)(void * element));
+
+/**
+ * \brief Set the default share of the flows.
+ * \param fair_queue A fair_queue_t instance.
+ * \param rate The default rate of a flow (in probes per second), 0 if unlimited.
+ * \param burst The number of probes a capped flow may release at once (>= 1).
+ * \return true iif successful
+ */
+
+bool fair_queue_set_default_share(fair_queue_t * fair_queue, double rate, size_t burst);
+
+/**
+ * \brief Set the share of the flow of a given caller. This share is kept
+ *    until fair_queue_forget_caller is called.
+ * \param fair_queue A fair_queue_t instance.
+ * \param caller The caller.
+ * \param weight The number of probes released per round (>= 1).
+ * \param rate The maximal rate of this flow (in probes per second),
+ *    0 if unlimited.
+ * \return true iif successful
+ */
+
+bool fair_queue_set_share(fair_queue_t * fair_queue, const void * caller, size_t weight, double rate);
+
+/**
+ * \brief Forget the share of a caller (e.g. because it is being
+ *    released). Its waiting probes are still released.
+ * \param fair_queue A fair_queue_t instance.
+ * \param caller The caller.
+ */
+
+void fair_queue_forget_caller(fair_queue_t * fair_queue, const void * caller);
+
+/**
+ * \brief Append a probe to the flow of its caller (see probe_set_caller).
+ * \param fair_queue A fair_queue_t instance.
+ * \param probe The probe.
+ * \return true iif successful
+ */
+
+bool fair_queue_push(fair_queue_t * fair_queue, probe_t * probe);
+
+/**
+ * \brief Pop the next probes according to the deficit round-robin.
+ * \param fair_queue A fair_queue_t instance.
+ * \param probes The array in which the probes are written.
+ * \param max_probes The maximal number of probes popped.
+ * \param now The current timestamp (in seconds).
+ * \param pdelay Address of a double in which the delay (in seconds)
+ *    before a capped flow gets a token is written, 0 if no flow is
+ *    waiting for a token.
+ * \return The number of probes popped.
+ */
+
+size_t fair_queue_pop(fair_queue_t * fair_queue, probe_t ** probes, size_t max_probes, double now, double * pdelay);
+
+/**
+ * \brief Retrieve the number of probes waiting in a fair_queue_t.
+ * \param fair_queue A fair_queue_t instance.
+ * \return The number of waiting probes.
+ */
+
+static inline size_t fair_queue_get_size(const fair_queue_t * fair_queue) {
+    return fair_queue->size;
+}
+
+/**
+ * \brief Tell whether the flows of a fair_queue_t are shaped, i.e. some
+ *    flows are capped or weighted.
+ * \param fair_queue A fair_queue_t instance.
+ * \return true iif some flows are capped or weighted.
+ */
+
+static inline bool fair_queue_is_shaping(const fair_queue_t * fair_queue) {
+    return fair_queue->rate > 0 || fair_queue->num_shared > 0;
+}
+
+#endif // FAIR_QUEUE_H
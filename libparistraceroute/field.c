@@ -17,8 +17,9 @@ field_t * field_create(fieldtype_t type, const char * key, const void * value) {
     field_t * field;
 
     if (!(field = malloc(sizeof(field_t)))) goto ERR_MALLOC;
-    field->key  = key;
-    field->type = type;
+    field->key    = key;
+    field->key_id = field_key_search(key);
+    field->type   = type;
 
     if (value) {
         switch (type) {
@@ -102,8 +103,9 @@ field_t * field_create_bits(const char * key, const void * value, size_t offset_
     size_t    offset_in_bits_out;
 
     if (!(field = malloc(sizeof(field_t)))) goto ERR_MALLOC;
-    field->key  = key;
-    field->type = TYPE_BITS;
+    field->key    = key;
+    field->key_id = field_key_search(key);
+    field->type   = TYPE_BITS;
     memset(&field->value.bits, 0, sizeof(field->value.bits));
 
     offset_in_bits_out = 8 * sizeof(field->value.bits) - size_in_bits;
@@ -158,14 +160,19 @@ field_t * field_create_generator(const char * key, struct generator_s * value) {
 
 field_t * field_dup(const field_t * field) {
     const char * key_dup;
+    const void * value;
 
     if (!(key_dup = strdup(field->key))) goto ERR_STRDUP;
 
-    // Note: if the field stores a pointer (TYPE_STRING, TYPE_GENERATOR),
-    // we only copies this pointer. Thus the both fields points to the
-    // same object.
+    // The string or the generator stored in the field (if any) is
+    // duplicated by field_create.
+    switch (field->type) {
+        case TYPE_STRING:    value = field->value.string;    break;
+        case TYPE_GENERATOR: value = field->value.generator; break;
+        default:             value = &field->value;          break;
+    }
 
-    return field_create(field->type, key_dup, &field->value);
+    return field_create(field->type, key_dup, value);
 
 ERR_STRDUP:
     return NULL;
@@ -232,7 +239,12 @@ const char * field_get_key(field_t * field) {
 // Dump
 
 bool field_match(const field_t * field1, const field_t * field2) {
-    return field1 && field2 && field1->type == field2->type && strcmp(field1->key, field2->key) == 0;
+    if (!(field1 && field2 && field1->type == field2->type)) return false;
+
+    // Fields declared statically (e.g. by a generator) have no interned key
+    return field1->key_id && field2->key_id ?
+        field1->key_id == field2->key_id :
+        strcmp(field1->key, field2->key) == 0;
 }
 
 const char * field_type_to_string(fieldtype_t type) {
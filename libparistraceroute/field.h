@@ -10,7 +10,8 @@
 #include <stdint.h>  // uint*_t
 #include <stdbool.h> // bool
 
-#include "address.h" // address_t, ipv4_t, ipv6_t
+#include "address.h"   // address_t, ipv4_t, ipv6_t
+#include "field_key.h" // field_key_t
 
 struct generator_s;
 
@@ -107,13 +108,16 @@ void value_dump_hex(const value_t * value, size_t num_bytes, size_t offset_in_bi
  */
 
 typedef struct {
-    const char  * key;   /**< Pointer to a unique identifier key; the
-                          * referenced memory is not freed when the
-                          * field is freed */
-    value_t       value; /**< Union of all field data; the referenced
-                          * memory is freed if it's a string or
-                          * generator, when the field is freed */
-    fieldtype_t   type;  /**< Type of data stored in the field */
+    const char  * key;    /**< Pointer to a unique identifier key; the
+                           * referenced memory is not freed when the
+                           * field is freed */
+    field_key_t   key_id; /**< Interned key (FIELD_KEY_NONE if key is not
+                           * registered or if this field has not been
+                           * allocated by field_create*) */
+    value_t       value;  /**< Union of all field data; the referenced
+                           * memory is freed if it's a string or
+                           * generator, when the field is freed */
+    fieldtype_t   type;   /**< Type of data stored in the field */
 } field_t;
 
 /**
@@ -412,6 +416,13 @@ size_t field_get_size(const field_t * field);
  */
 //int field_compare(const field_t * field1, const field_t * field2);
 
+/**
+ * \brief Test whether two fields have the same key and the same type.
+ * \param field1 The first field instance
+ * \param field2 The second field instance
+ * \return true iif both fields match.
+ */
+
 bool field_match(const field_t * field1, const field_t * field2);
 
 
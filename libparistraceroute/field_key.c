@@ -0,0 +1,88 @@
+#include "config.h"
+
+#include <stdio.h>          // fprintf
+#include <string.h>         // strcmp
+
+#include "field_key.h"
+
+// Number of slots of the hash table. Must be a power of 2 greater than FIELD_KEY_MAX.
+#define FIELD_KEY_NUM_SLOTS 256
+
+static const char  * field_key_names[FIELD_KEY_MAX] = {
+    [FIELD_KEY_NONE]     = NULL,
+    [FIELD_KEY_BODY]     = "body",
+    [FIELD_KEY_CHECKSUM] = "checksum",
+    [FIELD_KEY_DST_IP]   = "dst_ip",
+    [FIELD_KEY_FLOW_ID]  = "flow_id",
+    [FIELD_KEY_LENGTH]   = "length",
+    [FIELD_KEY_PROTOCOL] = "protocol",
+    [FIELD_KEY_SRC_IP]   = "src_ip",
+    [FIELD_KEY_SRC_PORT] = "src_port",
+    [FIELD_KEY_TTL]      = "ttl",
+};
+
+static field_key_t   field_key_slots[FIELD_KEY_NUM_SLOTS]; /**< Keys indexed by the hash of their name (FIELD_KEY_NONE if unused) */
+static size_t        field_key_num_keys = 0;               /**< Number of registered keys (including FIELD_KEY_NONE) */
+
+static inline size_t field_key_hash(const char * name) {
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (; *name; name++) hash = (hash ^ (uint8_t) *name) * 16777619u;
+    return hash & (FIELD_KEY_NUM_SLOTS - 1);
+}
+
+/**
+ * \brief Retrieve the slot of the hash table related to a name.
+ * \param name The name of the field.
+ * \return The slot in which the key of name is (or would be) stored.
+ */
+
+static field_key_t * field_key_get_slot(const char * name) {
+    size_t i = field_key_hash(name);
+
+    while (field_key_slots[i] && strcmp(field_key_names[field_key_slots[i]], name) != 0) {
+        i = (i + 1) & (FIELD_KEY_NUM_SLOTS - 1);
+    }
+    return &field_key_slots[i];
+}
+
+/**
+ * \brief (Internal use) Store the well-known keys in the hash table.
+ *    Keys may be registered by constructors, so this is done on demand.
+ */
+
+static void field_key_init() {
+    field_key_t key;
+
+    for (key = FIELD_KEY_NONE + 1; key < FIELD_KEY_NUM_WELL_KNOWN; key++) {
+        *field_key_get_slot(field_key_names[key]) = key;
+    }
+    field_key_num_keys = FIELD_KEY_NUM_WELL_KNOWN;
+}
+
+field_key_t field_key_register(const char * name)
+{
+    field_key_t * slot;
+
+    if (!field_key_num_keys) field_key_init();
+
+    if (!*(slot = field_key_get_slot(name))) {
+        if (field_key_num_keys == FIELD_KEY_MAX) {
+            fprintf(stderr, "field_key_register: too many keys, cannot register '%s'\n", name);
+            return FIELD_KEY_NONE;
+        }
+        field_key_names[field_key_num_keys] = name;
+        *slot = field_key_num_keys++;
+    }
+    return *slot;
+}
+
+field_key_t field_key_search(const char * name) {
+    if (!name) return FIELD_KEY_NONE;
+    if (!field_key_num_keys) field_key_init();
+    return *field_key_get_slot(name);
+}
+
+const char * field_key_get_name(field_key_t key) {
+    return key < field_key_num_keys ? field_key_names[key] : NULL;
+}
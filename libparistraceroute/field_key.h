@@ -0,0 +1,73 @@
+#ifndef FIELD_KEY_H
+#define FIELD_KEY_H
+
+/**
+ * \file field_key.h
+ * \brief Registry of interned field keys.
+ *
+ * Each field name declared by a protocol (see PROTOCOL_REGISTER) or a
+ * metafield (see METAFIELD_REGISTER) is mapped to a small integer when it
+ * is registered. Fields can then be compared by comparing their keys, and
+ * protocol fields can be retrieved by indexing an array with their key.
+ *
+ * The keys used by libparistraceroute itself are registered in advance,
+ * so that they can be used as constants (see field_key_well_known_t).
+ */
+
+#include <stdint.h>  // uint8_t
+
+// Maximum number of registered keys (including FIELD_KEY_NONE).
+#define FIELD_KEY_MAX 128
+
+/**
+ * \brief An interned key, FIELD_KEY_NONE if the name is not registered.
+ */
+
+typedef uint8_t field_key_t;
+
+/**
+ * \enum field_key_well_known_t
+ * \brief Keys registered in advance.
+ */
+
+typedef enum {
+    FIELD_KEY_NONE = 0,
+    FIELD_KEY_BODY,
+    FIELD_KEY_CHECKSUM,
+    FIELD_KEY_DST_IP,
+    FIELD_KEY_FLOW_ID,
+    FIELD_KEY_LENGTH,
+    FIELD_KEY_PROTOCOL,
+    FIELD_KEY_SRC_IP,
+    FIELD_KEY_SRC_PORT,
+    FIELD_KEY_TTL,
+    FIELD_KEY_NUM_WELL_KNOWN
+} field_key_well_known_t;
+
+/**
+ * \brief Register a field name (if not yet registered).
+ * \param name The name of the field. This string must remain valid
+ *    until the end of the program (e.g. a string literal).
+ * \return The corresponding key, FIELD_KEY_NONE if the registry is full.
+ */
+
+field_key_t field_key_register(const char * name);
+
+/**
+ * \brief Retrieve the key related to a field name.
+ * \param name The name of the field.
+ * \return The corresponding key, FIELD_KEY_NONE if this name has not
+ *    been registered.
+ */
+
+field_key_t field_key_search(const char * name);
+
+/**
+ * \brief Retrieve the name related to a key.
+ * \param key A registered key.
+ * \return The corresponding name, NULL if key is not registered.
+ */
+
+const char * field_key_get_name(field_key_t key);
+
+#endif
@@ -19,19 +19,61 @@ static int generator_compare(
     return strcmp(generator1->name, generator2->name);
 }
 
+/**
+ * \brief Duplicate a field of a generator. Its key is not duplicated, as
+ *    it belongs to the registered generator.
+ * \param field The field of a generator (a number).
+ * \return The newly allocated field, NULL in case of failure.
+ */
+
+static field_t * generator_field_dup(const field_t * field) {
+    return field_create(field->type, field->key, &field->value);
+}
+
 static field_t * generator_get_field(const generator_t * generator, const char * key) {
-    field_t * field;
+    size_t i;
 
     if (generator->fields) {
-        for (field = generator->fields[0]; field->key; field++) {
-            if (strcmp(field->key, key) == 0) {
-                return field;
+        for (i = 0; i < generator->num_fields; i++) {
+            if (strcmp(generator->fields[i]->key, key) == 0) {
+                return generator->fields[i];
             }
         }
     }
     return NULL;
 }
 
+/**
+ * \brief Resolve the parameters of a generator from its fields, and
+ *    discard the intervals drawn with the previous parameters.
+ * \param generator A generator_t instance.
+ * \return true iif successful.
+ */
+
+static bool generator_update(generator_t * generator) {
+    generator->num_samples = 0;
+    return generator->update ? generator->update(generator) : true;
+}
+
+/**
+ * \brief Draw the next intervals of a generator.
+ * \param generator A generator_t instance.
+ * \param intervals The buffer receiving the intervals.
+ * \param num_intervals The number of intervals to draw.
+ */
+
+static void generator_draw(generator_t * generator, double * intervals, size_t num_intervals) {
+    size_t i;
+
+    if (generator->fill) {
+        generator->fill(generator, intervals, num_intervals);
+    } else {
+        for (i = 0; i < num_intervals; i++) {
+            intervals[i] = generator->get_next_value(generator);
+        }
+    }
+}
+
 generator_t * generator_create_by_name(const char * name)
 {
     size_t              size, i, num_fields;
@@ -45,29 +87,36 @@ generator_t * generator_create_by_name(const char * name)
 
     size = generator_get_size(search);
     if (!(generator = calloc(1, size))) goto ERR_CALLOC;
-    memcpy(generator, search, size);
+    // A registered generator is a bare generator_t, its parameters are resolved below
+    memcpy(generator, search, sizeof(generator_t));
     num_fields = generator->num_fields;
-    if (!(generator->fields = malloc(num_fields * sizeof(field_t *)))) goto ERR_MALLOC;
+    if (!(generator->fields = calloc(num_fields, sizeof(field_t *)))) goto ERR_CALLOC_FIELDS;
+
+    // The fields of a registered generator are stored in an array of field_t
     for (i = 0; i < num_fields; ++i) {
-        if (!(generator->fields[i] = field_dup((const field_t *)(search->fields + i)))) {
+        if (!(generator->fields[i] = generator_field_dup(((const field_t *) search->fields) + i))) {
             goto ERR_FIELD_DUP;
         }
     }
+    if (!generator_update(generator)) goto ERR_UPDATE;
     return generator;
 
+ERR_UPDATE:
 ERR_FIELD_DUP:
-    free(generator->fields);
-ERR_MALLOC:
     generator_free(generator);
+    return NULL;
+ERR_CALLOC_FIELDS:
+    free(generator);
 ERR_CALLOC:
 ERR_SEARCH:
     return NULL;
 }
 
 void generator_free(generator_t * generator) {
-    size_t i, num_fields = generator_get_num_fields(generator);
+    size_t i;
+
     if (generator) {
-        for (i = 0; i < num_fields; ++i) {
+        for (i = 0; i < generator->num_fields; ++i) {
             if (generator->fields[i]) field_free(generator->fields[i]);
         }
         free(generator->fields);
@@ -81,12 +130,24 @@ size_t generator_get_size(const generator_t * generator) {
 
 generator_t * generator_dup(const generator_t * generator) {
     generator_t * gdup;
-    size_t        size = generator_get_size(generator);
+    size_t        i, size = generator_get_size(generator);
 
     if (!(gdup = malloc(size))) goto ERR_MALLOC;
     memcpy(gdup, generator, size);
+
+    // The resolved parameters and the intervals already drawn are copied
+    // along with the generator, its fields are duplicated.
+    if (!(gdup->fields = calloc(generator->num_fields, sizeof(field_t *)))) goto ERR_CALLOC_FIELDS;
+    for (i = 0; i < generator->num_fields; ++i) {
+        if (!(gdup->fields[i] = generator_field_dup(generator->fields[i]))) goto ERR_FIELD_DUP;
+    }
     return gdup;
 
+ERR_FIELD_DUP:
+    generator_free(gdup);
+    return NULL;
+ERR_CALLOC_FIELDS:
+    free(gdup);
 ERR_MALLOC:
     return NULL;
 }
@@ -98,7 +159,8 @@ bool generator_set_field(generator_t * generator, field_t * field) {
     for (i = 0; i < num_fields; i++) {
         field_to_update = generator->fields[i];
         if (field_match(field_to_update, field)) {
-            return field_set_value(field_to_update, &field->value);
+            return field_set_value(field_to_update, &field->value)
+                && generator_update(generator);
         }
     }
     return false;
@@ -143,10 +205,30 @@ double generator_get_value(const generator_t * generator) {
 }
 
 double generator_next_value(generator_t * generator) {
-    generator->value += generator->get_next_value(generator);
+    if (generator->num_samples == 0) {
+        generator_draw(generator, generator->samples, GENERATOR_NUM_SAMPLES);
+        generator->num_samples = GENERATOR_NUM_SAMPLES;
+    }
+    generator->value += generator->samples[GENERATOR_NUM_SAMPLES - generator->num_samples--];
     return generator->value;
 }
 
+void generator_fill(generator_t * generator, double * values, size_t num_values) {
+    size_t i;
+
+    // Consume the intervals already drawn, then draw the others in place
+    for (i = 0; i < num_values && generator->num_samples > 0; i++) {
+        values[i] = generator_next_value(generator);
+    }
+    if (i < num_values) {
+        generator_draw(generator, values + i, num_values - i);
+        for (; i < num_values; i++) {
+            generator->value += values[i];
+            values[i] = generator->value;
+        }
+    }
+}
+
 const generator_t * generator_search(const char * name)
 {
     generator_t ** generator, search;
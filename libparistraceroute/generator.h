@@ -5,18 +5,32 @@
 
 #define END_GENERATOR_FIELDS { .key = NULL }
 
+// Number of intervals drawn at once by a generator_t instance and
+// consumed by generator_next_value.
+#define GENERATOR_NUM_SAMPLES 64
+
 /**
  * A generator_t in an object which produce a sequence of values.
+ * Each value is the previous one plus an interval drawn by the generator.
+ *
+ * The parameters of a generator are resolved from its fields once they
+ * are set (see the update callback), and its intervals are drawn by
+ * batches of GENERATOR_NUM_SAMPLES, so that no field is looked up per
+ * value.
  */
 
 typedef struct generator_s {
     const char * name;                                    /**< Name of the generator */
-    double    (* get_next_value)(struct generator_s * g); /**< We generate the i-th value */
+    double    (* get_next_value)(struct generator_s * g); /**< Draw the next interval (used if fill is NULL) */
+    void      (* fill)(struct generator_s * g, double * intervals, size_t num_intervals); /**< Draw num_intervals intervals at once, NULL if none */
+    bool      (* update)(struct generator_s * g);         /**< Resolve the parameters from the fields, NULL if none */
     // TODO we should use field_t * to be coherent with protocol.h (or adapt protocol module)
     field_t ** fields;                                    /**< Fields embedded in the generator */
     size_t     num_fields;                                /**< Number of fields embedded in the generator */
     size_t     size;                                      /**< The size in bytes of a generator_t instance */
     double     value;                                     /**< The current value returned by the generator */
+    double     samples[GENERATOR_NUM_SAMPLES];            /**< Intervals drawn and not consumed yet (the last num_samples ones) */
+    size_t     num_samples;                               /**< Number of intervals left in samples */
 } generator_t;
 
 /**
@@ -87,7 +101,18 @@ double generator_get_value(const generator_t * generator);
 double generator_next_value(generator_t * generator);
 
 /**
- * \brief Initializes a generator field.
+ * \brief Fetch the next values produced by a generator_t instance, as
+ *    successive calls to generator_next_value would.
+ * \param generator A generator_t instance.
+ * \param values The buffer receiving the values.
+ * \param num_values The number of values to produce.
+ */
+
+void generator_fill(generator_t * generator, double * values, size_t num_values);
+
+/**
+ * \brief Initializes a generator field. The intervals drawn with the
+ *   previous parameters are discarded.
  *   Example: generator_set(u, DOUBLE("mean", 2.3))
  * \param generator A generator_t instance.
  * \param field A field_t instance having a key recognized by thus generator.
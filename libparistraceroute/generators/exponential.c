@@ -0,0 +1,117 @@
+#include <math.h>             // log()
+#include <stdint.h>           // uint64_t
+
+#include "field.h"
+#include "../generator.h"     // generator_t
+
+// Exponentially distributed intervals: the values form a Poisson process,
+// so that the probes sent at these times sample the network without bias
+// (PASTA property). The "exponential" generator is set by its mean
+// interval (in seconds), the "poisson" generator by its rate (in values
+// per second). The "seed" field makes the sequence reproducible.
+
+static field_t exponential_fields[] = {
+    {
+        .key       = "mean",
+        .type      = TYPE_DOUBLE,
+        .value.dbl = 2,
+    },
+    {
+        .key         = "seed",
+        .type        = TYPE_UINT64,
+        .value.int64 = 1,
+    },
+    END_GENERATOR_FIELDS
+};
+
+static field_t poisson_fields[] = {
+    {
+        .key       = "rate",
+        .type      = TYPE_DOUBLE,
+        .value.dbl = 0.5,
+    },
+    {
+        .key         = "seed",
+        .type        = TYPE_UINT64,
+        .value.int64 = 1,
+    },
+    END_GENERATOR_FIELDS
+};
+
+typedef struct {
+    generator_t generator; // parent class
+    double      mean;      // resolved from the "mean" or the "rate" field
+    uint64_t    state;     // state of the pseudo-random generator, reset by the "seed" field
+} exponential_generator_t;
+
+// Pseudo-random generator (splitmix64), see simulator.c
+static inline uint64_t exponential_generator_next_random(exponential_generator_t * exponential_generator) {
+    uint64_t x = (exponential_generator->state += 0x9e3779b97f4a7c15ULL);
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static bool exponential_generator_update(generator_t * exponential_generator) {
+    exponential_generator_t * generator = (exponential_generator_t *) exponential_generator;
+
+    return generator_extract_value(exponential_generator, "mean", &generator->mean)
+        && generator_extract_value(exponential_generator, "seed", &generator->state)
+        && generator->mean >= 0;
+}
+
+static bool poisson_generator_update(generator_t * poisson_generator) {
+    exponential_generator_t * generator = (exponential_generator_t *) poisson_generator;
+    double                    rate;
+
+    if (!generator_extract_value(poisson_generator, "rate", &rate) || rate <= 0) return false;
+    generator->mean = 1 / rate;
+    return generator_extract_value(poisson_generator, "seed", &generator->state);
+}
+
+static void exponential_generator_fill(generator_t * exponential_generator, double * intervals, size_t num_intervals) {
+    exponential_generator_t * generator = (exponential_generator_t *) exponential_generator;
+    size_t                    i;
+
+    // Draw the uniform variates in (0, 1] first, then transform them in a
+    // separate loop the compiler may vectorize.
+    for (i = 0; i < num_intervals; i++) {
+        intervals[i] = ((exponential_generator_next_random(generator) >> 11) + 1) * 0x1.0p-53;
+    }
+    for (i = 0; i < num_intervals; i++) {
+        intervals[i] = -generator->mean * log(intervals[i]);
+    }
+}
+
+static double exponential_generator_get_next_value(generator_t * exponential_generator) {
+    double interval;
+
+    exponential_generator_fill(exponential_generator, &interval, 1);
+    return interval;
+}
+
+static generator_t exponential = {
+    .name           = "exponential",
+    .get_next_value = exponential_generator_get_next_value,
+    .fill           = exponential_generator_fill,
+    .update         = exponential_generator_update,
+    .fields         = (field_t **) &exponential_fields,
+    .num_fields     = 2,
+    .size           = sizeof(exponential_generator_t),
+    .value          = 0,
+};
+
+static generator_t poisson = {
+    .name           = "poisson",
+    .get_next_value = exponential_generator_get_next_value,
+    .fill           = exponential_generator_fill,
+    .update         = poisson_generator_update,
+    .fields         = (field_t **) &poisson_fields,
+    .num_fields     = 2,
+    .size           = sizeof(exponential_generator_t),
+    .value          = 0,
+};
+
+GENERATOR_REGISTER(exponential);
+GENERATOR_REGISTER(poisson);
@@ -15,12 +15,24 @@ static field_t uniform_fields[] = {
 
 typedef struct {
     generator_t generator; // parent class
+    double      mean;      // resolved from the "mean" field
 } uniform_generator_t;
 
+static bool uniform_generator_update(generator_t * uniform_generator) {
+    return generator_extract_value(uniform_generator, "mean", &((uniform_generator_t *) uniform_generator)->mean);
+}
+
 static double uniform_generator_get_next_value(generator_t * uniform_generator) {
-    double next_value;
-    generator_extract_value(uniform_generator, "mean", &next_value);
-    return next_value;
+    return ((uniform_generator_t *) uniform_generator)->mean;
+}
+
+static void uniform_generator_fill(generator_t * uniform_generator, double * intervals, size_t num_intervals) {
+    double mean = ((uniform_generator_t *) uniform_generator)->mean;
+    size_t i;
+
+    for (i = 0; i < num_intervals; i++) {
+        intervals[i] = mean;
+    }
 }
 
 
@@ -35,6 +47,8 @@ void uniform_generator_free(uniform_generator_t * uniform_generator) {
 static generator_t uniform = {
     .name           = "uniform",
     .get_next_value = uniform_generator_get_next_value,
+    .fill           = uniform_generator_fill,
+    .update         = uniform_generator_update,
     .fields         = (field_t **) &uniform_fields,
     .num_fields     = 1,
     .size           = sizeof(uniform_generator_t),
@@ -0,0 +1,94 @@
+#include "config.h"
+
+#include <stdlib.h>       // malloc, calloc, free
+#include <string.h>       // memcpy
+
+#include "histogram.h"
+
+/**
+ * \brief Retrieve the bucket in which a value is counted.
+ * \param value A value.
+ * \return The index of the corresponding bucket.
+ */
+
+static inline size_t histogram_get_bucket(uint64_t value) {
+    size_t exponent;
+
+    if (value < HISTOGRAM_SUB_BUCKET_SIZE) return value;
+
+    // value is in [2^exponent, 2^(exponent + 1)[, and its
+    // HISTOGRAM_SUB_BUCKET_BITS next bits select the sub-bucket.
+    exponent = 63 - __builtin_clzll(value);
+    return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKET_SIZE
+        + (value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) - HISTOGRAM_SUB_BUCKET_SIZE;
+}
+
+/**
+ * \brief Retrieve the value representing a bucket (the middle of its range).
+ * \param bucket The index of the bucket.
+ * \return The corresponding value.
+ */
+
+static inline uint64_t histogram_get_bucket_value(size_t bucket) {
+    size_t   shift;
+    uint64_t lower;
+
+    if (bucket < HISTOGRAM_SUB_BUCKET_SIZE) return bucket;
+
+    shift = bucket / HISTOGRAM_SUB_BUCKET_SIZE - 1;
+    lower = (uint64_t) (HISTOGRAM_SUB_BUCKET_SIZE + bucket % HISTOGRAM_SUB_BUCKET_SIZE) << shift;
+    return lower + (((uint64_t) 1 << shift) - 1) / 2;
+}
+
+histogram_t * histogram_create() {
+    return calloc(1, sizeof(histogram_t));
+}
+
+histogram_t * histogram_dup(const histogram_t * histogram) {
+    histogram_t * histogram_dup;
+
+    if ((histogram_dup = malloc(sizeof(histogram_t)))) {
+        memcpy(histogram_dup, histogram, sizeof(histogram_t));
+    }
+    return histogram_dup;
+}
+
+void histogram_free(histogram_t * histogram) {
+    if (histogram) free(histogram);
+}
+
+void histogram_add(histogram_t * histogram, uint64_t value) {
+    if (!histogram->num_values || value < histogram->min) histogram->min = value;
+    if (!histogram->num_values || value > histogram->max) histogram->max = value;
+    histogram->counts[histogram_get_bucket(value)]++;
+    histogram->num_values++;
+}
+
+inline uint64_t histogram_get_num_values(const histogram_t * histogram) {
+    return histogram->num_values;
+}
+
+uint64_t histogram_get_quantile(const histogram_t * histogram, double q) {
+    uint64_t rank, num_values = 0, value;
+    size_t   i;
+
+    if (!histogram->num_values) return 0;
+
+    // Rank (starting from 1) of the value corresponding to this quantile
+    // (nearest-rank method: rank = ceil(q * num_values))
+    rank = (uint64_t) (q * histogram->num_values);
+    if (rank < q * histogram->num_values) rank++;
+    if (rank < 1) rank = 1;
+    if (rank >= histogram->num_values) return histogram->max;
+
+    for (i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        num_values += histogram->counts[i];
+        if (num_values >= rank) break;
+    }
+
+    // The extremal buckets are bounded by the extremal values
+    value = histogram_get_bucket_value(i);
+    if (value < histogram->min) value = histogram->min;
+    if (value > histogram->max) value = histogram->max;
+    return value;
+}
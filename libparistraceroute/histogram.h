@@ -0,0 +1,92 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/**
+ * \file histogram.h
+ * \brief Fixed-memory histogram used to estimate the quantiles of a
+ *    stream of values (e.g. RTTs).
+ *
+ * Values are counted in log-linear buckets (as in HDR histograms): the
+ * values lower than 2^HISTOGRAM_SUB_BUCKET_BITS have their own bucket,
+ * and each range [2^e, 2^(e+1)[ above is split in
+ * 2^HISTOGRAM_SUB_BUCKET_BITS buckets of equal width. Hence a quantile
+ * is estimated with a relative error lower than
+ * 2^-HISTOGRAM_SUB_BUCKET_BITS, whatever the number of recorded values.
+ *
+ * Recording a value is O(1), estimating a quantile is O(number of
+ * buckets), and the memory footprint does not depend on the number of
+ * recorded values.
+ */
+
+#include <stdbool.h>   // bool
+#include <stddef.h>    // size_t
+#include <stdint.h>    // uint64_t
+
+// Each power of 2 is split in 2^HISTOGRAM_SUB_BUCKET_BITS buckets.
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKET_SIZE (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+// Number of buckets needed to cover the uint64_t values.
+#define HISTOGRAM_NUM_BUCKETS     ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKET_SIZE)
+
+/**
+ * \struct histogram_t
+ * \brief A log-linear histogram of uint64_t values.
+ */
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_NUM_BUCKETS]; /**< Number of values recorded in each bucket */
+    uint64_t num_values;                    /**< Number of recorded values */
+    uint64_t min;                           /**< Smallest recorded value */
+    uint64_t max;                           /**< Greatest recorded value */
+} histogram_t;
+
+/**
+ * \brief Create a histogram_t instance.
+ * \return The newly created histogram_t instance, NULL in case of failure.
+ */
+
+histogram_t * histogram_create();
+
+/**
+ * \brief Duplicate a histogram_t instance.
+ * \param histogram A histogram_t instance.
+ * \return The newly created histogram_t instance, NULL in case of failure.
+ */
+
+histogram_t * histogram_dup(const histogram_t * histogram);
+
+/**
+ * \brief Release a histogram_t instance from the memory.
+ * \param histogram A histogram_t instance.
+ */
+
+void histogram_free(histogram_t * histogram);
+
+/**
+ * \brief Record a value in a histogram_t.
+ * \param histogram A histogram_t instance.
+ * \param value The recorded value.
+ */
+
+void histogram_add(histogram_t * histogram, uint64_t value);
+
+/**
+ * \brief Retrieve the number of values recorded in a histogram_t.
+ * \param histogram A histogram_t instance.
+ * \return The number of recorded values.
+ */
+
+uint64_t histogram_get_num_values(const histogram_t * histogram);
+
+/**
+ * \brief Estimate a quantile of the values recorded in a histogram_t.
+ * \param histogram A histogram_t instance.
+ * \param q The quantile (between 0 and 1, e.g. 0.99 for the 99th
+ *    percentile).
+ * \return The estimated quantile, 0 if no value has been recorded.
+ */
+
+uint64_t histogram_get_quantile(const histogram_t * histogram, double q);
+
+#endif
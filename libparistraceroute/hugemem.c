@@ -0,0 +1,146 @@
+#include "use.h"
+#include "config.h"
+
+#include <stdio.h>              // snprintf, sscanf
+#include <stdlib.h>             // calloc, free
+#include <string.h>             // memset
+#include <dirent.h>             // opendir, readdir, closedir
+#include <sys/mman.h>           // mmap, munmap, madvise
+
+#ifdef USE_NUMA
+#  include <unistd.h>           // syscall
+#  include <sys/syscall.h>      // SYS_mbind, SYS_set_mempolicy
+#endif
+
+#include "hugemem.h"
+
+#ifdef USE_NUMA
+// Memory policies (see <numaif.h>, which requires libnuma)
+#  ifndef MPOL_DEFAULT
+#    define MPOL_DEFAULT   0
+#    define MPOL_PREFERRED 1
+#  endif
+
+// Maximum number of NUMA nodes handled by hugemem_set_node.
+#  define HUGEMEM_MAX_NODES 1024
+
+#  define HUGEMEM_BITS_PER_WORD (8 * sizeof(unsigned long))
+
+// The NUMA node of the calling thread, -1 if none (see hugemem_set_node).
+static __thread int hugemem_node = -1;
+
+/**
+ * \brief (Internal usage) Make the mask of a NUMA node.
+ * \param node The NUMA node.
+ * \param mask The mask to fill.
+ */
+
+static void hugemem_make_mask(int node, unsigned long mask[HUGEMEM_MAX_NODES / HUGEMEM_BITS_PER_WORD]) {
+    memset(mask, 0, HUGEMEM_MAX_NODES / 8);
+    mask[node / HUGEMEM_BITS_PER_WORD] = 1UL << (node % HUGEMEM_BITS_PER_WORD);
+}
+#endif
+
+/**
+ * \brief (Internal usage) Compute the size of the mapping of a table.
+ * \param num_elements The number of elements of the table.
+ * \param element_size The size of an element (in bytes).
+ * \return The size of the mapping, 0 if the table is allocated by calloc.
+ */
+
+static size_t hugemem_get_map_size(size_t num_elements, size_t element_size) {
+    size_t size = num_elements * element_size;
+
+    if (element_size && size / element_size != num_elements) return 0;
+    if (size < HUGEMEM_MIN_SIZE) return 0;
+
+    // Round up to a multiple of the huge page size, since a MAP_HUGETLB
+    // mapping is unmapped by huge pages.
+    return (size + HUGEMEM_MIN_SIZE - 1) & ~((size_t) HUGEMEM_MIN_SIZE - 1);
+}
+
+void * hugemem_calloc(size_t num_elements, size_t element_size) {
+    void   * table = MAP_FAILED;
+    size_t   map_size;
+#ifdef USE_NUMA
+    unsigned long mask[HUGEMEM_MAX_NODES / HUGEMEM_BITS_PER_WORD];
+#endif
+
+    if (!(map_size = hugemem_get_map_size(num_elements, element_size))) {
+        return calloc(num_elements, element_size);
+    }
+
+#if defined(USE_HUGEPAGES) && defined(MAP_HUGETLB)
+    table = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (table == MAP_FAILED) {
+        if ((table = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+            return NULL;
+        }
+#if defined(USE_HUGEPAGES) && defined(MADV_HUGEPAGE)
+        // Transparent huge pages may be disabled: this is not an error.
+        madvise(table, map_size, MADV_HUGEPAGE);
+#endif
+    }
+
+#ifdef USE_NUMA
+    // The pages are not faulted in yet, so they are all allocated on this
+    // node, whichever thread touches them first.
+    if (hugemem_node >= 0) {
+        hugemem_make_mask(hugemem_node, mask);
+        syscall(SYS_mbind, table, map_size, MPOL_PREFERRED, mask, HUGEMEM_MAX_NODES, 0);
+    }
+#endif
+
+    return table;
+}
+
+void hugemem_free(void * table, size_t num_elements, size_t element_size) {
+    size_t map_size;
+
+    if (!table) return;
+    if ((map_size = hugemem_get_map_size(num_elements, element_size))) {
+        munmap(table, map_size);
+    } else {
+        free(table);
+    }
+}
+
+int hugemem_get_cpu_node(size_t cpu) {
+    int node = -1;
+#ifdef USE_NUMA
+    char            path[64];
+    DIR           * dir;
+    struct dirent * entry;
+
+    // /sys/devices/system/cpu/cpuX contains a nodeY link per node of cpu X
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu", cpu);
+    if (!(dir = opendir(path))) return -1;
+    while ((entry = readdir(dir))) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1 && node >= 0 && node < HUGEMEM_MAX_NODES) break;
+        node = -1;
+    }
+    closedir(dir);
+#else
+    (void) cpu;
+#endif
+    return node;
+}
+
+bool hugemem_set_node(int node) {
+#ifdef USE_NUMA
+    unsigned long mask[HUGEMEM_MAX_NODES / HUGEMEM_BITS_PER_WORD];
+
+    if (node >= HUGEMEM_MAX_NODES) return false;
+    if (node < 0) {
+        if (syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) != 0) return false;
+    } else {
+        hugemem_make_mask(node, mask);
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, HUGEMEM_MAX_NODES) != 0) return false;
+    }
+    hugemem_node = node < 0 ? -1 : node;
+#else
+    (void) node;
+#endif
+    return true;
+}
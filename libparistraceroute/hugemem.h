@@ -0,0 +1,69 @@
+#ifndef HUGEMEM_H
+#define HUGEMEM_H
+
+/**
+ * \file hugemem.h
+ * \brief Allocation of the large tables of libparistraceroute (indexes of
+ *    the recent probes, of the mda lookups, hashmaps...) in huge pages and
+ *    on the NUMA node of the thread using them.
+ *
+ * A table of at least HUGEMEM_MIN_SIZE bytes is mapped apart from the heap:
+ * - If USE_HUGEPAGES is set, it is first mapped with MAP_HUGETLB, which
+ *   only succeeds if huge pages have been reserved (vm.nr_hugepages).
+ *   Otherwise, the kernel is advised to back it with transparent huge
+ *   pages (MADV_HUGEPAGE), so that a lookup costs fewer TLB misses.
+ * - If USE_NUMA is set and the calling thread has a NUMA node (see
+ *   hugemem_set_node), the table is bound to this node.
+ * Smaller tables are allocated thanks to calloc.
+ *
+ * A table is released by hugemem_free, given the size it was allocated
+ * with, since this size determines how it has been allocated.
+ */
+
+#include <stdbool.h>   // bool
+#include <stddef.h>    // size_t
+
+// Size of a huge page (in bytes), i.e. the minimal size of the tables
+// mapped apart from the heap.
+#define HUGEMEM_MIN_SIZE (2 * 1024 * 1024)
+
+/**
+ * \brief Allocate a zeroed table.
+ * \param num_elements The number of elements of the table.
+ * \param element_size The size of an element (in bytes).
+ * \return The address of the table, NULL in case of failure.
+ */
+
+void * hugemem_calloc(size_t num_elements, size_t element_size);
+
+/**
+ * \brief Release a table allocated by hugemem_calloc.
+ * \param table The table (may be NULL).
+ * \param num_elements The number of elements passed to hugemem_calloc.
+ * \param element_size The size of an element passed to hugemem_calloc.
+ */
+
+void hugemem_free(void * table, size_t num_elements, size_t element_size);
+
+/**
+ * \brief Retrieve the NUMA node of a CPU.
+ * \param cpu The CPU.
+ * \return The NUMA node of this CPU, -1 if it is unknown or if USE_NUMA
+ *    is not set.
+ */
+
+int hugemem_get_cpu_node(size_t cpu);
+
+/**
+ * \brief Set the NUMA node from which the calling thread allocates its
+ *    memory: the tables allocated by hugemem_calloc are bound to it, and
+ *    the other pages it faults in (heap, rings allocated by the kernel
+ *    on behalf of this thread...) preferably come from it.
+ * \param node The NUMA node, -1 to restore the default policy (i.e. the
+ *    node of the CPU on which the memory is touched first).
+ * \return true iif successful (always true if USE_NUMA is not set).
+ */
+
+bool hugemem_set_node(int node);
+
+#endif // HUGEMEM_H
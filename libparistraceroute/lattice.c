@@ -4,48 +4,29 @@
 #include <stddef.h>  // size_t
 #include <stdbool.h> // bool
 #include <stdio.h>   // fprintf
+#include <string.h>  // memset
 
 #include "lattice.h"
+#include "memstats.h" // memstats_track_*
 
 //---------------------------------------------------------------------------
 // lattice_elt_t 
 //---------------------------------------------------------------------------
 
-lattice_elt_t * lattice_elt_create(void * data)
-{
-    lattice_elt_t * elt;
-
-    if (!(elt = malloc(sizeof(lattice_elt_t))))     goto ERR_MALLOC;
-    if (!(elt->next = dynarray_create()))           goto ERR_DYNARRAY_CREATE;
-    if (!(elt->siblings = dynarray_create()))       goto ERR_DYNARRAY_CREATE2;
-    if (!dynarray_push_element(elt->siblings, elt)) goto ERR_DYNARRAY_PUSH_ELEMENT;
-    elt->data = data;
-
-    return elt;
-
-ERR_DYNARRAY_PUSH_ELEMENT:
-    dynarray_free(elt->siblings, NULL);
-ERR_DYNARRAY_CREATE2:
-    dynarray_free(elt->next, NULL);
-ERR_DYNARRAY_CREATE:
-    free(elt);
-ERR_MALLOC:
-    return NULL;
+size_t lattice_elt_get_num_next(const lattice_elt_t * elt) {
+    return elt->num_next;
 }
 
-void lattice_elt_free(lattice_elt_t * elt) {
-    // TODO element_free
-    dynarray_free(elt->siblings, NULL);
-    dynarray_free(elt->next, NULL);
-    free(elt);
+size_t lattice_elt_get_num_siblings(const lattice_elt_t * elt) {
+    return elt->lattice->layers[elt->depth].num_elts;
 }
 
-size_t lattice_elt_get_num_next(const lattice_elt_t * elt) {
-    return dynarray_get_size(elt->next);
+lattice_elt_t * lattice_elt_get_ith_next(const lattice_elt_t * elt, size_t i) {
+    return lattice_get_elt(elt->lattice, elt->next[i]);
 }
 
-size_t lattice_elt_get_num_siblings(const lattice_elt_t * elt) {
-    return dynarray_get_size(elt->siblings);
+lattice_elt_t * lattice_elt_get_ith_sibling(const lattice_elt_t * elt, size_t i) {
+    return lattice_get_elt(elt->lattice, elt->lattice->layers[elt->depth].elts[i]);
 }
 
 void * lattice_elt_get_data(const lattice_elt_t * elt) {
@@ -57,25 +38,35 @@ void * lattice_elt_get_data(const lattice_elt_t * elt) {
 //---------------------------------------------------------------------------
 
 lattice_t * lattice_create() {
-    lattice_t * lattice;
-
-    if (!(lattice = calloc(1, sizeof(lattice_t)))) goto ERR_MALLOC;
-    if (!(lattice->roots = dynarray_create()))     goto ERR_DYNARRAY_CREATE;
-      
-    return lattice;
-ERR_DYNARRAY_CREATE:
-    free(lattice);
-ERR_MALLOC:
-    return NULL;
+    return calloc(1, sizeof(lattice_t));
 }
 
 void lattice_free(lattice_t * lattice, void (*lattice_element_free)(void *element))
 {
-    /* TODO Free elements and data if needed ? */
-    //if (lattice_element_free)
-    //    lattice_element_free();
+    lattice_elt_t * elt;
+    size_t          i;
+
+    if (lattice) {
+        for (i = 0; i < lattice->num_elts; i++) {
+            elt = lattice_get_elt(lattice, i);
+            if (lattice_element_free && elt->data) lattice_element_free(elt->data);
+            free(elt->next);
+        }
+        for (i = 0; i < lattice->num_blocks; i++) {
+            free(lattice->blocks[i]);
+            memstats_track_free(MEMSTATS_LATTICE, LATTICE_BLOCK_SIZE * sizeof(lattice_elt_t));
+        }
+        for (i = 0; i < lattice->num_layers; i++) {
+            free(lattice->layers[i].elts);
+        }
+        free(lattice->blocks);
+        free(lattice->layers);
+        free(lattice);
+    }
+}
 
-    free(lattice);
+lattice_elt_t * lattice_get_elt(const lattice_t * lattice, lattice_id_t id) {
+    return &lattice->blocks[id / LATTICE_BLOCK_SIZE][id % LATTICE_BLOCK_SIZE];
 }
 
 // Accessors
@@ -92,7 +83,7 @@ static lattice_return_t lattice_walk_dfs_rec(
     void          * data
 ) {
     lattice_elt_t    * elt_iter;
-    unsigned int       i, num_next;
+    size_t             i;
     lattice_return_t   ret;
     bool               done = true;
 
@@ -107,9 +98,8 @@ static lattice_return_t lattice_walk_dfs_rec(
     }
 
     // ... then recurse on next ones 
-    num_next = dynarray_get_size(elt->next);
-    for (i = 0; i < num_next; i++) {
-        elt_iter = dynarray_get_ith_element(elt->next, i);
+    for (i = 0; i < elt->num_next; i++) {
+        elt_iter = lattice_elt_get_ith_next(elt, i);
         ret = lattice_walk_dfs_rec(elt_iter, visitor, data);
         switch (ret) {
             case LATTICE_DONE:           break;
@@ -128,14 +118,13 @@ static lattice_return_t lattice_walk_dfs(
     void      * data
 ) {
     lattice_elt_t *  root;
-    size_t           i, num_roots;
+    size_t           i;
     lattice_return_t ret;
     bool             done = true;
     
     // Process all roots
-    num_roots = dynarray_get_size(lattice->roots);
-    for (i = 0; i < num_roots; i++) {
-        root = dynarray_get_ith_element(lattice->roots, i);
+    for (i = 0; lattice->num_layers && i < lattice->layers[0].num_elts; i++) {
+        root = lattice_get_elt(lattice, lattice->layers[0].elts[i]);
         ret = lattice_walk_dfs_rec(root, visitor, data);
         switch (ret) {
             case LATTICE_DONE:           break;
@@ -148,6 +137,58 @@ static lattice_return_t lattice_walk_dfs(
     return done ? LATTICE_DONE : LATTICE_CONTINUE;
 }
 
+static lattice_return_t lattice_walk_bfs(
+    lattice_t * lattice,         
+    lattice_return_t (* visitor)(lattice_elt_t *, void *),
+    void      * data
+) {
+    lattice_elt_t    * elt;
+    lattice_id_t     * queue;
+    bool             * is_queued;
+    size_t             i, first = 0, last = 0;
+    lattice_return_t   ret = LATTICE_DONE;
+    bool               done = true;
+
+    // Each node is queued at most once
+    if (!(queue = malloc((lattice->num_elts + 1) * sizeof(lattice_id_t)))) goto ERR_QUEUE;
+    if (!(is_queued = calloc(lattice->num_elts + 1, sizeof(bool))))       goto ERR_IS_QUEUED;
+
+    for (i = 0; lattice->num_layers && i < lattice->layers[0].num_elts; i++) {
+        queue[last++] = lattice->layers[0].elts[i];
+        is_queued[lattice->layers[0].elts[i]] = true;
+    }
+
+    while (first < last) {
+        elt = lattice_get_elt(lattice, queue[first++]);
+        ret = visitor(elt, data);
+        switch (ret) {
+            case LATTICE_DONE:           break;
+            case LATTICE_CONTINUE:       break;
+            case LATTICE_INTERRUPT_NEXT: done = false; continue;
+            case LATTICE_INTERRUPT_ALL:  goto END;
+            default:                     ret = LATTICE_ERROR; goto END;
+        }
+
+        for (i = 0; i < elt->num_next; i++) {
+            if (!is_queued[elt->next[i]]) {
+                queue[last++] = elt->next[i];
+                is_queued[elt->next[i]] = true;
+            }
+        }
+    }
+    ret = done ? LATTICE_DONE : LATTICE_CONTINUE;
+
+END:
+    free(is_queued);
+    free(queue);
+    return ret;
+
+ERR_IS_QUEUED:
+    free(queue);
+ERR_QUEUE:
+    return LATTICE_ERROR;
+}
+
 lattice_return_t lattice_walk(
     lattice_t         * lattice,
     lattice_return_t (* visitor)(lattice_elt_t *, void * data),
@@ -158,131 +199,155 @@ lattice_return_t lattice_walk(
         case LATTICE_WALK_DFS:
             return lattice_walk_dfs(lattice, visitor, data);
         case LATTICE_WALK_BFS:
-            fprintf(stderr, "lattice_walk: walk = LATTICE_WALK_BFS not yet implemented\n");
-            break;
+            return lattice_walk_bfs(lattice, visitor, data);
         default:
             break;
     }
     return LATTICE_ERROR;
 }
 
-/*
-static lattice_elt_t * lattice_find_elt(lattice_elt_t * elt, void * data, int (*cmp)(const void * elt1, const void * elt2))
-{
-    lattice_elt_t * elt_iter,
-                  * elt_search;
-    size_t          i, num_next;
+/**
+ * \brief Append a node id to a layer.
+ * \param layer A lattice_layer_t instance.
+ * \param id The id of the node.
+ * \return true iif successful.
+ */
 
-    if ((cmp && (cmp(elt->data, data) == 0)) || (elt->data == data)) {
-        return elt;
-    }
+static bool lattice_layer_push(lattice_layer_t * layer, lattice_id_t id)
+{
+    lattice_id_t * elts;
+    size_t         max_elts;
 
-    num_next = dynarray_get_size(elt->next);
-    for (i = 0; i < num_next; i++) {
-        elt_iter = dynarray_get_ith_element(elt->next, i);
-        if ((elt_search = lattice_find_elt(elt_iter, data, cmp))) {
-            return elt_search;
+    if (layer->num_elts == layer->max_elts) {
+        max_elts = layer->max_elts ? 2 * layer->max_elts : 4;
+        if (!(elts = realloc(layer->elts, max_elts * sizeof(lattice_id_t)))) {
+            return false;
         }
+        layer->elts     = elts;
+        layer->max_elts = max_elts;
     }
-    return NULL;
+    layer->elts[layer->num_elts++] = id;
+    return true;
 }
 
-static void * lattice_find(lattice_t * lattice, void * data)
+/**
+ * \brief Allocate a new node in the arena of a lattice, and store it
+ *    in the corresponding layer.
+ * \param lattice A lattice_t instance.
+ * \param depth The layer of the new node.
+ * \param data This address is stored in the newly allocated node.
+ * \return The newly allocated node if successful, NULL otherwise.
+ */
+
+static lattice_elt_t * lattice_elt_create(lattice_t * lattice, size_t depth, void * data)
 {
-    lattice_elt_t * elt_search,
-                  * elt_root;
-    size_t          i, num_roots;
-    
-    num_roots = dynarray_get_size(lattice->roots);
-    for (i = 0; i < num_roots; i++) {
-        elt_root = dynarray_get_ith_element(lattice->roots, i);
-        if ((elt_search = lattice_find_elt(elt_root, data, lattice->cmp))) {
-            return elt_search->data;
+    lattice_elt_t   ** blocks;
+    lattice_layer_t  * layers;
+    lattice_elt_t    * elt;
+
+    if (lattice->num_elts == (lattice_id_t) -1) goto ERR_TOO_MANY_ELTS;
+
+    // Allocate a new block if the last one is full
+    if (lattice->num_elts == lattice->num_blocks * LATTICE_BLOCK_SIZE) {
+        if (!(blocks = realloc(lattice->blocks, (lattice->num_blocks + 1) * sizeof(lattice_elt_t *)))) {
+            goto ERR_REALLOC_BLOCKS;
+        }
+        lattice->blocks = blocks;
+        if (!(blocks[lattice->num_blocks] = malloc(LATTICE_BLOCK_SIZE * sizeof(lattice_elt_t)))) {
+            goto ERR_MALLOC_BLOCK;
+        }
+        memstats_track_alloc(MEMSTATS_LATTICE, LATTICE_BLOCK_SIZE * sizeof(lattice_elt_t));
+        lattice->num_blocks++;
+    }
+
+    // Allocate the layer if needed
+    if (depth == lattice->num_layers) {
+        if (!(layers = realloc(lattice->layers, (depth + 1) * sizeof(lattice_layer_t)))) {
+            goto ERR_REALLOC_LAYERS;
         }
+        lattice->layers = layers;
+        memset(&layers[depth], 0, sizeof(lattice_layer_t));
+        lattice->num_layers++;
+    }
+
+    if (!lattice_layer_push(&lattice->layers[depth], lattice->num_elts)) {
+        goto ERR_LAYER_PUSH;
     }
 
+    elt = lattice_get_elt(lattice, lattice->num_elts);
+    elt->id       = lattice->num_elts;
+    elt->depth    = depth;
+    elt->num_next = 0;
+    elt->max_next = 0;
+    elt->next     = NULL;
+    elt->data     = data;
+    elt->lattice  = lattice;
+    lattice->num_elts++;
+    return elt;
+
+ERR_LAYER_PUSH:
+ERR_REALLOC_LAYERS:
+    // The new block (if any) is kept, it will be used by the next node
+ERR_MALLOC_BLOCK:
+ERR_REALLOC_BLOCKS:
+ERR_TOO_MANY_ELTS:
     return NULL;
 }
-*/
 
-bool lattice_add_element(lattice_t * lattice, lattice_elt_t * predecessor, void * data)
+lattice_elt_t * lattice_add_element(lattice_t * lattice, lattice_elt_t * predecessor, void * data)
 {
     lattice_elt_t * elt;
    
-    if (!(elt = lattice_elt_create(data))) goto ERR_LATTICE_ELT_CREATE;
+    if (!(elt = lattice_elt_create(lattice, predecessor ? predecessor->depth + 1 : 0, data))) {
+        goto ERR_LATTICE_ELT_CREATE;
+    }
 
-    if (!predecessor) {
-        // No predecessors, so the new node is stored as a new root.
-        if (!dynarray_push_element(lattice->roots, elt)) {
-            goto ERR_DYNARRAY_PUSH_ELEMENT;
-        }
-    } else {
-        // This node has some a predecessor so connect the both nodes.
-        if (!lattice_connect(lattice, predecessor, elt)) {
-            goto ERR_LATTICE_CONNECT;
-        }
+    // If this node has a predecessor, connect the both nodes.
+    if (predecessor && !lattice_connect(lattice, predecessor, elt)) {
+        goto ERR_LATTICE_CONNECT;
     }
 
-    return true;
+    return elt;
 
 ERR_LATTICE_CONNECT:
-ERR_DYNARRAY_PUSH_ELEMENT:
-    lattice_elt_free(elt);
+    // elt is the last node of the lattice and of its layer
+    lattice->layers[elt->depth].num_elts--;
+    lattice->num_elts--;
 ERR_LATTICE_ELT_CREATE:
-    return false;
+    return NULL;
 }
 
 bool lattice_connect(lattice_t * lattice, lattice_elt_t * u, lattice_elt_t * v)
 {
-    size_t          i, j, num_next, num_siblings;
+    size_t          i;
+    lattice_id_t  * next;
+    lattice_id_t    max_next;
     const void    * elt_data = lattice_elt_get_data(v),
                   * cur_data;
-    lattice_elt_t * cur_elt,
-                  * sibling;
     
     // Return if the element already existing in next hops
-    num_next = dynarray_get_size(u->next);
-    for (i = 0; i < num_next; i++) {
-        cur_elt = dynarray_get_ith_element(u->next, i);
-        cur_data = lattice_elt_get_data(cur_elt);
+    for (i = 0; i < u->num_next; i++) {
+        cur_data = lattice_elt_get_data(lattice_elt_get_ith_next(u, i));
         if ((lattice->cmp && (lattice->cmp(cur_data, elt_data) == 0))
         ||  (cur_data == elt_data)) {
             return true;
         }
     }
-    
-    // We need to update all siblings: the siblings of my child are the children
-    // of all my siblings
-    // Go though all my siblings, including me
-    num_siblings = dynarray_get_size(u->siblings);
-    for (i = 0; i < num_siblings; i++) {
-        sibling = dynarray_get_ith_element(u->siblings, i);
-
-        num_next = dynarray_get_size(sibling->next);
-        for (j = 0; j < num_next; j++) {
-
-            // Existing interfaces get a new sibling
-            cur_elt = dynarray_get_ith_element(sibling->next, j);
-            if (!dynarray_push_element(cur_elt->siblings, v)) {
-                goto ERR_DYNARRAY_PUSH_ELEMENT1;
-            }
 
-            // Existing interfaces are a new sibling for the new interface
-            if (!dynarray_push_element(v->siblings, cur_elt)) {
-                goto ERR_DYNARRAY_PUSH_ELEMENT2;
-            }
+    // Siblings are implicit (see lattice_t::layers), only u is updated
+    if (u->num_next == u->max_next) {
+        max_next = u->max_next ? 2 * u->max_next : 2;
+        if (!(next = realloc(u->next, max_next * sizeof(lattice_id_t)))) {
+            goto ERR_REALLOC;
         }
+        u->next     = next;
+        u->max_next = max_next;
     }
-
-    if (!dynarray_push_element(u->next, v)) {
-        goto ERR_DYNARRAY_PUSH_ELEMENT3;
-    }
+    u->next[u->num_next++] = v->id;
 
     return true;
 
-ERR_DYNARRAY_PUSH_ELEMENT3:
-ERR_DYNARRAY_PUSH_ELEMENT2:
-ERR_DYNARRAY_PUSH_ELEMENT1:
+ERR_REALLOC:
     return false;
 }
 
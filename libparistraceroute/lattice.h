@@ -1,7 +1,9 @@
 #ifndef STRUCTURE_LATTICE_H
 #define STRUCTURE_LATTICE_H
 
-#include "dynarray.h"
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t
 
 typedef enum {
     LATTICE_DONE,
@@ -20,27 +22,19 @@ typedef enum {
 // lattice_elt_t 
 //---------------------------------------------------------------------------
 
-typedef struct {
-    dynarray_t * next;     /**< Successors of this node */
-    dynarray_t * siblings; /**< Sibling elements (element having the same depth from the root) */
-    void       * data;     /**< Data stored in this node */
-} lattice_elt_t;
+typedef uint32_t lattice_id_t; /**< Identifies a node in its lattice */
 
-/**
- * \brief Allocate a lattice_elt_t instance (lattice node).
- * \param data This address is stored in the newly allocated node.
- * \return The newly allocated lattice_elt_t instance if successful,
- *    NULL otherwise.
- */
-
-lattice_elt_t * lattice_elt_create(void * data);
-
-/**
- * \brief Release a lattice_elt_t instance from the memory.
- * \param elt A lattice_elt_t instance.
- */
+struct lattice_s;
 
-void lattice_elt_free(lattice_elt_t * elt);
+typedef struct {
+    lattice_id_t       id;       /**< Index of this node in lattice_t::blocks */
+    lattice_id_t       depth;    /**< Layer of this node (0 for the roots) */
+    lattice_id_t       num_next; /**< Number of successors */
+    lattice_id_t       max_next; /**< Number of successors allocated in next */
+    lattice_id_t     * next;     /**< Successors of this node */
+    void             * data;     /**< Data stored in this node */
+    struct lattice_s * lattice;  /**< The lattice storing this node */
+} lattice_elt_t;
 
 void * lattice_elt_get_data(const lattice_elt_t * elt);
 
@@ -48,26 +42,43 @@ void * lattice_elt_get_data(const lattice_elt_t * elt);
 // lattice_t
 //---------------------------------------------------------------------------
 
+/**
+ * Nodes are allocated by blocks of LATTICE_BLOCK_SIZE (so that a
+ * lattice_elt_t * remains valid while the lattice grows) and are
+ * identified by an integer. They are also stored by depth (layers):
+ * the siblings of a node are the nodes of its layer.
+ */
+
+#define LATTICE_BLOCK_SIZE 256
+
 typedef struct {
-    //lattice_elt_t *root;
-    dynarray_t * roots;
-    int       (* cmp)(const void *, const void *);
+    lattice_id_t * elts;     /**< Nodes of this layer */
+    size_t         num_elts; /**< Number of nodes in this layer */
+    size_t         max_elts; /**< Number of nodes allocated in elts */
+} lattice_layer_t;
+
+typedef struct lattice_s {
+    lattice_elt_t   ** blocks;     /**< Nodes, by blocks of LATTICE_BLOCK_SIZE */
+    size_t             num_blocks; /**< Number of allocated blocks */
+    size_t             num_elts;   /**< Number of nodes */
+    lattice_layer_t  * layers;     /**< Nodes by depth (layers[0] stores the roots) */
+    size_t             num_layers; /**< Number of layers */
+    int             (* cmp)(const void *, const void *);
 } lattice_t;
 
 /**
  * \brief Allocate a lattice_t instance. 
- * \param data This address is stored in the newly allocated node.
- * \return The newly allocated lattice_elt_t instance if successful,
+ * \return The newly allocated lattice_t instance if successful,
  *    NULL otherwise.
  */
 
 lattice_t * lattice_create();
 
 /**
- * \brief Release a lattice_t instance from the memory.
+ * \brief Release a lattice_t instance (and its nodes) from the memory.
  * \param lattice A lattice_t instance.
- * \param lattice_element_free This callback is called for each released
- *    lattice_elt_t instance belonging to this lattice.
+ * \param lattice_element_free This callback is called on the data of each
+ *    released node. You may pass NULL if unused.
  */
 
 void lattice_free(lattice_t * lattice, void (*lattice_element_free)(void *element));
@@ -89,8 +100,50 @@ size_t lattice_elt_get_num_next(const lattice_elt_t * elt);
 
 size_t lattice_elt_get_num_siblings(const lattice_elt_t * elt);
 
+/**
+ * \brief Retrieve the i-th successor of a given lattice node.
+ * \param elt A lattice node.
+ * \param i An index lower than lattice_elt_get_num_next(elt).
+ * \return The corresponding lattice node.
+ */
+
+lattice_elt_t * lattice_elt_get_ith_next(const lattice_elt_t * elt, size_t i);
+
+/**
+ * \brief Retrieve the i-th sibling node of a given lattice node
+ *    (including this node).
+ * \param elt A lattice node.
+ * \param i An index lower than lattice_elt_get_num_siblings(elt).
+ * \return The corresponding lattice node.
+ */
+
+lattice_elt_t * lattice_elt_get_ith_sibling(const lattice_elt_t * elt, size_t i);
+
+/**
+ * \brief Retrieve a node of a lattice by its id.
+ * \param lattice A lattice_t instance.
+ * \param id The id of the node (lower than lattice->num_elts).
+ * \return The corresponding lattice node.
+ */
+
+lattice_elt_t * lattice_get_elt(const lattice_t * lattice, lattice_id_t id);
+
 //void lattice_set_cmp(lattice_t * lattice, int (*cmp)(const void *, const void *));
 
+/**
+ * \brief Walk a lattice and call a visitor on its nodes.
+ * \param lattice A lattice_t instance.
+ * \param visitor The callback called on each visited node. If it returns
+ *    LATTICE_INTERRUPT_NEXT, the successors of this node are not visited
+ *    (from this node). If it returns LATTICE_INTERRUPT_ALL, the walk stops.
+ * \param data This address is passed to visitor.
+ * \param walk LATTICE_WALK_DFS (a node is visited once per path leading
+ *    to it) or LATTICE_WALK_BFS (a node is visited at most once).
+ * \return LATTICE_INTERRUPT_ALL if the walk has been interrupted,
+ *    LATTICE_ERROR in case of failure, LATTICE_CONTINUE if a visitor
+ *    returned LATTICE_INTERRUPT_NEXT, LATTICE_DONE otherwise.
+ */
+
 lattice_return_t lattice_walk(lattice_t * lattice, lattice_return_t (*visitor)(lattice_elt_t *, void *), void * data, lattice_walk_t walk);
 
 /**
@@ -106,10 +159,12 @@ bool lattice_connect(lattice_t * lattice, lattice_elt_t * u, lattice_elt_t * v);
  * \brief Add a new node in the lattice.
  * \param predecessor The predecessor of this node in the lattice.
  *    You may pass NULL if there is no predecessor. In this case, the new
- *    nodes is stored in lattice->roots.
+ *    node is a root (depth 0). Otherwise, the new node is stored in the
+ *    layer following the one of its predecessor.
+ * \return The newly created node if successful, NULL otherwise.
  */
 
-bool lattice_add_element(lattice_t * lattice, lattice_elt_t * predecessor, void * data);
+lattice_elt_t * lattice_add_element(lattice_t * lattice, lattice_elt_t * predecessor, void * data);
 
 /**
  * \brief Dump a lattice_t structure to the standard output.
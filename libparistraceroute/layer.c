@@ -9,23 +9,31 @@
 
 #include "layer.h"
 #include "common.h"
+#include "pool.h"     // pool_t
+#include "field_key.h" // FIELD_KEY_CHECKSUM
 
-#ifdef USE_BITS
-#    include "bits.h"
-#endif
+static __thread pool_t layer_pool = POOL_INITIALIZER(sizeof(layer_t), free);
+
+static void layer_pool_clear() __attribute__((destructor));
+
+static void layer_pool_clear() {
+    pool_clear(&layer_pool, free);
+}
 
 layer_t * layer_create() {
-    layer_t * layer = calloc(1, sizeof(layer_t));
-    if (!layer) goto ERR_CALLOC;
+    bool      recycled;
+    layer_t * layer = pool_alloc(&layer_pool, &recycled);
+    if (!layer) goto ERR_POOL_ALLOC;
+    if (recycled) memset(layer, 0, sizeof(layer_t));
     layer->mask = NULL;
     return layer;
 
-ERR_CALLOC:
+ERR_POOL_ALLOC:
     return NULL;
 }
 
 void layer_free(layer_t * layer) {
-    if (layer) {
+    if (layer && !pool_release(&layer_pool, layer)) {
         free(layer);
     }
 }
@@ -126,7 +134,15 @@ bool layer_set_field(layer_t * layer, const field_t * field) {
         goto ERR_INVALID_FIELD;
     }
 
-    if (!(protocol_field = layer_get_protocol_field(layer, field->key))) {
+    if (!layer->protocol) {
+        goto ERR_LAYER_GET_PROTOCOL_FIELD;
+    }
+
+    // Fields allocated by field_create* carry their interned key
+    if (!(protocol_field = field->key_id ?
+        protocol_get_field_by_key(layer->protocol, field->key_id) :
+        protocol_get_field(layer->protocol, field->key))
+    ) {
         goto ERR_LAYER_GET_PROTOCOL_FIELD;
     }
 
@@ -140,30 +156,98 @@ bool layer_set_field(layer_t * layer, const field_t * field) {
         goto ERR_INVALID_FIELD_TYPE;
     }
 
+    return layer_set_protocol_field(layer, protocol_field, field);
+
+ERR_INVALID_FIELD_TYPE:
+ERR_LAYER_GET_PROTOCOL_FIELD:
+ERR_INVALID_FIELD:
+    return false;
+}
+
+/**
+ * \brief (Internal use) Retrieve the 16-bit words of a layer altered
+ *    when a protocol field is set.
+ * \param layer The layer.
+ * \param protocol_field The protocol field.
+ * \param poffset Address of a size_t in which the offset of the first
+ *    word (relative to the beginning of the segment) is written.
+ * \return The size (in bytes) of the words.
+ */
+
+static size_t layer_get_field_words(const layer_t * layer, const protocol_field_t * protocol_field, size_t * poffset)
+{
+    size_t size;
+
+    if (protocol_field->set) {
+        // The bytes altered by a custom setter are not known, consider the whole header
+        *poffset = 0;
+        size = layer->protocol->get_header_size(layer->segment);
+        return size < layer->segment_size ? size : layer->segment_size;
+    }
+
+#ifdef USE_BITS
+    if (protocol_field->type == TYPE_BITS) {
+        size = (protocol_field->offset_in_bits + protocol_field->size_in_bits + 7) / 8;
+    } else
+#endif
+    size = protocol_field_get_size(protocol_field);
+
+    // Headers are made of 16-bit words
+    *poffset = protocol_field->offset & ~(size_t) 1;
+    return (protocol_field->offset + size + 1 - *poffset) & ~(size_t) 1;
+}
+
+bool layer_set_protocol_field(layer_t * layer, const protocol_field_t * protocol_field, const field_t * field)
+{
+    size_t   offset = 0,
+             size = 0;
+    uint16_t old_sum = 0;
+
+    // Writing the checksum itself breaks the incremental update
+    if (protocol_field->key_id == FIELD_KEY_CHECKSUM) {
+        layer_invalidate_checksum(layer);
+    } else if (layer->is_checksum_valid) {
+        size = layer_get_field_words(layer, protocol_field, &offset);
+        old_sum = csum_add(0, layer->segment + offset, size);
+    }
+
     // Copy the field value into the buffer
     // If we have a setter function, use it ; otherwise write it by using the generic function
-    if ((protocol_field->set && !protocol_field->set(layer->segment, field)) 
+    if ((protocol_field->set && !protocol_field->set(layer->segment, field))
     || (!protocol_field->set && !protocol_field_set(protocol_field, layer->segment, field))
     ){
-        fprintf(stderr, "layer_set_field: can't set field '%s' (layer %s)\n", field->key, layer->protocol->name);
+        fprintf(stderr, "layer_set_protocol_field: can't set field '%s' (layer %s)\n", protocol_field->key, layer->protocol->name);
+        layer_invalidate_checksum(layer);
         goto ERR_PROTOCOL_FIELD_SET;
     }
 
-    // TODO update segment of mask here
+    if (layer->is_checksum_valid) {
+        layer_add_checksum_change(layer, old_sum, csum_add(0, layer->segment + offset, size));
+    }
 
     return true;
 
 ERR_PROTOCOL_FIELD_SET:
-ERR_INVALID_FIELD_TYPE:
-ERR_LAYER_GET_PROTOCOL_FIELD:
-ERR_INVALID_FIELD:
     return false;
 }
 
+void layer_add_checksum_change(layer_t * layer, uint16_t old_sum, uint16_t new_sum) {
+    // -old_sum is ~old_sum in one's complement arithmetic
+    uint16_t words[2] = { new_sum, (uint16_t) ~old_sum };
+
+    layer->checksum_delta = csum_add(layer->checksum_delta, (const uint8_t *) words, sizeof(words));
+}
+
+inline void layer_invalidate_checksum(layer_t * layer) {
+    layer->is_checksum_valid = false;
+    layer->checksum_delta    = 0;
+}
+
 bool layer_write_field(layer_t * layer, const char * key, const void * bytes, size_t num_bytes) {
     const protocol_field_t * protocol_field;
     uint8_t * segment;
     size_t    segment_size;
+    uint16_t  old_sum = 0;
 
     if (!(protocol_field = layer_get_protocol_field(layer, key))) {
         goto ERR_LAYER_GET_PROTOCOL_FIELD;
@@ -183,9 +267,19 @@ bool layer_write_field(layer_t * layer, const char * key, const void * bytes, si
     }
 
     segment = layer->segment + protocol_field->offset;
+    if (protocol_field->key_id == FIELD_KEY_CHECKSUM || (protocol_field->offset | segment_size) & 1) {
+        layer_invalidate_checksum(layer);
+    } else if (layer->is_checksum_valid) {
+        old_sum = csum_add(0, segment, segment_size);
+    }
+
     memcpy(segment, bytes, num_bytes);
     if (segment_size - num_bytes) memset(segment + num_bytes, 0, segment_size - num_bytes);
 
+    if (layer->is_checksum_valid) {
+        layer_add_checksum_change(layer, old_sum, csum_add(0, segment, segment_size));
+    }
+
     return true;
 
 ERR_SEGMENT_TOO_SMALL:
@@ -244,17 +338,10 @@ ERR_CREATE_LAYER:
 static bool segment_extract(const uint8_t * segment, const protocol_field_t * protocol_field, void * value) {
     bool ret = true;
 
-    segment += protocol_field->offset;
-
     switch (protocol_field->type) {
 #ifdef USE_BITS
         case TYPE_BITS:
-            ret = (bits_extract(
-                segment,
-                protocol_field->offset_in_bits,
-                protocol_field->size_in_bits,
-                value
-            ) != NULL);
+            ret = protocol_field_extract_bits(protocol_field, segment, value);
             break;
 #endif
 #ifdef USE_IPV4
@@ -269,7 +356,7 @@ static bool segment_extract(const uint8_t * segment, const protocol_field_t * pr
         case TYPE_UINT64:
         case TYPE_UINT128:
         case TYPE_UINTMAX:
-            memcpy(value, segment, field_get_type_size(protocol_field->type));
+            memcpy(value, segment + protocol_field->offset, field_get_type_size(protocol_field->type));
             break;
         default:
             fprintf(
@@ -411,9 +498,9 @@ void layer_debug(const layer_t * layer1, const layer_t * layer2, unsigned int in
         // Dump each (relevant) field
         for(protocol_field = layer1->protocol->fields; protocol_field->key; protocol_field++) {
             // Print field2 (if relevant)
-            if (strcmp(protocol_field->key, "length")   == 0
-            ||  strcmp(protocol_field->key, "checksum") == 0
-            ||  strcmp(protocol_field->key, "protocol") == 0) {
+            if (protocol_field->key_id == FIELD_KEY_LENGTH
+            ||  protocol_field->key_id == FIELD_KEY_CHECKSUM
+            ||  protocol_field->key_id == FIELD_KEY_PROTOCOL) {
                 // Print caption
                 print_indent(indent);
                 printf("%-15s ", protocol_field->key);
@@ -40,6 +40,8 @@ typedef struct layer_s {
                                           Indicates which bits have been set. 
                                           Should points to probe's bitfield */
     size_t             segment_size; /**< Size of segment (e.g. header) related to this layer */
+    bool               is_checksum_valid; /**< True iif the checksum of this layer is valid once updated according to checksum_delta */
+    uint16_t           checksum_delta;    /**< One's complement sum of the changes made in the data covered by the checksum since it is valid */
 } layer_t;
 
 /**
@@ -97,6 +99,36 @@ void layer_set_protocol(layer_t * layer, const protocol_t * protocol);
 
 bool layer_set_field(layer_t * layer, const field_t * field);
 
+/**
+ * \brief Update the segment managed by layer according to a field
+ *    of its protocol. Contrary to layer_set_field, the type of the
+ *    field is not checked.
+ * \param layer Pointer to the layer structure to update.
+ * \param protocol_field The protocol field to update.
+ * \param field Pointer to the field we assign in this layer.
+ * \return true iif successful
+ */
+
+bool layer_set_protocol_field(layer_t * layer, const protocol_field_t * protocol_field, const field_t * field);
+
+/**
+ * \brief Account a change of the bytes covered by the checksum of a layer,
+ *    so that its checksum can be updated incrementally (see probe_update_checksum).
+ * \param layer Pointer to the layer structure.
+ * \param old_sum The one's complement sum of the altered 16-bit words before the change.
+ * \param new_sum The one's complement sum of the same words after the change.
+ */
+
+void layer_add_checksum_change(layer_t * layer, uint16_t old_sum, uint16_t new_sum);
+
+/**
+ * \brief Mark the checksum of a layer as invalid, so that it will be
+ *    computed from scratch by the next call to probe_update_checksum.
+ * \param layer Pointer to the layer structure.
+ */
+
+void layer_invalidate_checksum(layer_t * layer);
+
 const protocol_field_t * layer_get_protocol_field(const layer_t * layer, const char * key);
 uint8_t * layer_get_field_segment(const layer_t * layer, const char * key);
 bool layer_write_field(layer_t * layer, const char * key, const void * bytes, size_t num_bytes);
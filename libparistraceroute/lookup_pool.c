@@ -0,0 +1,210 @@
+#include "config.h"
+
+#include <stdio.h>         // perror
+#include <stdlib.h>        // malloc, free
+#include <string.h>        // strdup, memset
+#include <stdint.h>        // uint64_t
+#include <errno.h>         // errno, EAGAIN
+#include <unistd.h>        // close, read, write
+#include <sys/eventfd.h>   // eventfd
+
+#include "lookup_pool.h"
+
+static void lookup_free(lookup_t * lookup) {
+    if (lookup) {
+        free(lookup->hostname);
+        free(lookup);
+    }
+}
+
+static void lookup_list_free(lookup_t * lookup) {
+    lookup_t * next;
+
+    for (; lookup; lookup = next) {
+        next = lookup->next;
+        lookup_free(lookup);
+    }
+}
+
+/**
+ * \brief Run a lookup, as resolve_destination (see paris-traceroute) does.
+ * \param lookup The lookup. Its address is set if successful.
+ */
+
+static void lookup_run(lookup_t * lookup)
+{
+    int family = lookup->family;
+
+    memset(&lookup->address, 0, sizeof(address_t));
+    lookup->is_resolved = (family != AF_UNSPEC || address_guess_family(lookup->hostname, &family))
+        && address_from_string(family, lookup->hostname, &lookup->address) == 0;
+}
+
+/**
+ * \brief Thread running the lookups of a pool until it is stopped.
+ * \param arg The pool.
+ * \return NULL
+ */
+
+static void * lookup_pool_run(void * arg)
+{
+    lookup_pool_t * pool = arg;
+    lookup_t      * lookup;
+    uint64_t        one = 1;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        pool->num_idle++;
+        while (!pool->pending && !pool->is_stopping) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        pool->num_idle--;
+        if (pool->is_stopping) break;
+
+        lookup = pool->pending;
+        if (!(pool->pending = lookup->next)) pool->pending_end = &pool->pending;
+        pthread_mutex_unlock(&pool->mutex);
+
+        lookup_run(lookup);
+
+        pthread_mutex_lock(&pool->mutex);
+        lookup->next    = NULL;
+        *pool->done_end = lookup;
+        pool->done_end  = &lookup->next;
+        if (write(pool->eventfd, &one, sizeof(one)) == -1) {
+            perror("lookup_pool_run");
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+lookup_pool_t * lookup_pool_create(size_t max_threads)
+{
+    lookup_pool_t * pool;
+
+    if (!max_threads || max_threads > LOOKUP_POOL_MAX_THREADS) goto ERR_MAX_THREADS;
+    if (!(pool = calloc(1, sizeof(lookup_pool_t))))                goto ERR_CALLOC;
+    if (!(pool->threads = malloc(max_threads * sizeof(pthread_t)))) goto ERR_MALLOC;
+    if ((pool->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) goto ERR_EVENTFD;
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) goto ERR_MUTEX_INIT;
+    if (pthread_cond_init(&pool->cond, NULL) != 0)   goto ERR_COND_INIT;
+
+    pool->max_threads = max_threads;
+    pool->pending_end = &pool->pending;
+    pool->done_end    = &pool->done;
+    return pool;
+
+ERR_COND_INIT:
+    pthread_mutex_destroy(&pool->mutex);
+ERR_MUTEX_INIT:
+    close(pool->eventfd);
+ERR_EVENTFD:
+    free(pool->threads);
+ERR_MALLOC:
+    free(pool);
+ERR_CALLOC:
+ERR_MAX_THREADS:
+    return NULL;
+}
+
+void lookup_pool_free(lookup_pool_t * pool)
+{
+    size_t i;
+
+    if (pool) {
+        // The running lookups cannot be cancelled: wait for them
+        pthread_mutex_lock(&pool->mutex);
+        pool->is_stopping = true;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+        for (i = 0; i < pool->num_threads; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        lookup_list_free(pool->pending);
+        lookup_list_free(pool->done);
+        pthread_cond_destroy(&pool->cond);
+        pthread_mutex_destroy(&pool->mutex);
+        close(pool->eventfd);
+        free(pool->threads);
+        free(pool);
+    }
+}
+
+bool lookup_pool_resolve(
+    lookup_pool_t     * pool,
+    int                 family,
+    const char        * hostname,
+    lookup_callback_t   callback,
+    void              * data
+) {
+    lookup_t * lookup;
+
+    if (!(lookup = calloc(1, sizeof(lookup_t))))   goto ERR_CALLOC;
+    if (!(lookup->hostname = strdup(hostname)))    goto ERR_STRDUP;
+    lookup->family   = family;
+    lookup->callback = callback;
+    lookup->data     = data;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    // Start a thread if every thread is busy
+    if (pool->num_idle == 0 && pool->num_threads < pool->max_threads) {
+        if (pthread_create(&pool->threads[pool->num_threads], NULL, lookup_pool_run, pool) == 0) {
+            pool->num_threads++;
+        } else if (pool->num_threads == 0) {
+            pthread_mutex_unlock(&pool->mutex);
+            perror("lookup_pool_resolve");
+            goto ERR_PTHREAD_CREATE;
+        }
+    }
+
+    *pool->pending_end = lookup;
+    pool->pending_end  = &lookup->next;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    pool->num_lookups++;
+    return true;
+
+ERR_PTHREAD_CREATE:
+ERR_STRDUP:
+    lookup_free(lookup);
+ERR_CALLOC:
+    return false;
+}
+
+bool lookup_pool_process(lookup_pool_t * pool)
+{
+    lookup_t * lookup,
+             * next;
+    uint64_t   value;
+
+    if (read(pool->eventfd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("lookup_pool_process");
+        return false;
+    }
+
+    // Detach the lookups over, so that the callbacks may start new lookups
+    pthread_mutex_lock(&pool->mutex);
+    lookup = pool->done;
+    pool->done     = NULL;
+    pool->done_end = &pool->done;
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (; lookup; lookup = next) {
+        next = lookup->next;
+        pool->num_lookups--;
+        lookup->callback(lookup->is_resolved ? &lookup->address : NULL, lookup->data);
+        lookup_free(lookup);
+    }
+    return true;
+}
+
+int lookup_pool_get_fd(const lookup_pool_t * pool) {
+    return pool->eventfd;
+}
+
+size_t lookup_pool_get_num_lookups(const lookup_pool_t * pool) {
+    return pool->num_lookups;
+}
@@ -0,0 +1,124 @@
+#ifndef LOOKUP_POOL_H
+#define LOOKUP_POOL_H
+
+/**
+ * \file lookup_pool.h
+ * \brief Resolve hostnames into addresses concurrently.
+ *
+ * address_from_string relies on getaddrinfo, which blocks the calling
+ * thread until the nameservers answer (or time out), so that a list of
+ * hostnames is resolved one at a time.
+ *
+ * A lookup_pool_t runs the lookups on a pool of threads (started on
+ * demand), and queues their results. The results are delivered to the
+ * thread owning the pool (see lookup_pool_process) once
+ * lookup_pool_get_fd becomes readable, e.g. by pt_loop
+ * (see pt_loop_set_lookups).
+ */
+
+#include <stdbool.h>   // bool
+#include <stddef.h>    // size_t
+#include <pthread.h>   // pthread_*
+
+#include "address.h"   // address_t
+
+// Maximum number of threads of a lookup_pool_t
+#define LOOKUP_POOL_MAX_THREADS 256
+
+/**
+ * \brief Called once a lookup is over.
+ * \param address The resolved address, NULL if the lookup has failed.
+ * \param data The data passed to lookup_pool_resolve.
+ */
+
+typedef void (* lookup_callback_t)(const address_t * address, void * data);
+
+typedef struct lookup_s {
+    int                 family;      /**< AF_INET, AF_INET6, or AF_UNSPEC to guess it (see address_guess_family) */
+    char              * hostname;    /**< The looked up hostname */
+    address_t           address;     /**< The resolved address */
+    bool                is_resolved; /**< True iif address is set */
+    lookup_callback_t   callback;    /**< Called once the lookup is over */
+    void              * data;        /**< Passed to callback */
+    struct lookup_s   * next;        /**< Next lookup of the same queue */
+} lookup_t;
+
+typedef struct {
+    pthread_t         * threads;     /**< The threads started so far */
+    size_t              num_threads; /**< Number of threads started */
+    size_t              max_threads; /**< Maximum number of threads */
+    size_t              num_idle;    /**< Number of threads waiting for a lookup */
+    pthread_mutex_t     mutex;       /**< Protects the queues and is_stopping */
+    pthread_cond_t      cond;        /**< Signaled when a lookup is queued or the pool is stopping */
+    lookup_t          * pending;     /**< Lookups waiting for a thread (FIFO) */
+    lookup_t         ** pending_end; /**< Where the next pending lookup is chained */
+    lookup_t          * done;        /**< Lookups over, waiting for lookup_pool_process (FIFO) */
+    lookup_t         ** done_end;    /**< Where the next lookup over is chained */
+    size_t              num_lookups; /**< Number of lookups whose callback has not been called yet (only accessed by the owner) */
+    int                 eventfd;     /**< Notified when a lookup is over */
+    bool                is_stopping; /**< True once the threads must exit */
+} lookup_pool_t;
+
+/**
+ * \brief Create a lookup_pool_t instance.
+ * \param max_threads The maximum number of lookups run simultaneously
+ *    (at most LOOKUP_POOL_MAX_THREADS).
+ * \return The newly created pool, NULL in case of failure.
+ */
+
+lookup_pool_t * lookup_pool_create(size_t max_threads);
+
+/**
+ * \brief Release a lookup_pool_t instance, once its running lookups are
+ *    over. The other lookups are discarded without calling their
+ *    callbacks.
+ * \param pool The pool.
+ */
+
+void lookup_pool_free(lookup_pool_t * pool);
+
+/**
+ * \brief Look up a hostname, as address_guess_family (if family is
+ *    AF_UNSPEC) and address_from_string would do.
+ * \param pool The pool.
+ * \param family The address family (AF_INET, AF_INET6 or AF_UNSPEC).
+ * \param hostname The hostname (copied).
+ * \param callback Called once the lookup is over (never from this call).
+ * \param data Passed to callback.
+ * \return true iif the lookup is queued.
+ */
+
+bool lookup_pool_resolve(
+    lookup_pool_t     * pool,
+    int                 family,
+    const char        * hostname,
+    lookup_callback_t   callback,
+    void              * data
+);
+
+/**
+ * \brief Call the callbacks of the lookups which are over.
+ * \param pool The pool.
+ * \return true iif successful.
+ */
+
+bool lookup_pool_process(lookup_pool_t * pool);
+
+/**
+ * \brief Retrieve the file descriptor notified when a lookup is over.
+ * \param pool The pool.
+ * \return The file descriptor to watch.
+ */
+
+int lookup_pool_get_fd(const lookup_pool_t * pool);
+
+/**
+ * \brief Retrieve the number of lookups whose callback has not been
+ *    called yet.
+ * \param pool The pool.
+ * \return The number of lookups in progress.
+ */
+
+size_t lookup_pool_get_num_lookups(const lookup_pool_t * pool);
+
+#endif // LOOKUP_POOL_H
@@ -0,0 +1,44 @@
+#include "config.h"
+
+#include <string.h>    // memset
+
+#include "match_key.h"
+#include "layer.h"     // layer_t
+#include "protocol.h"  // protocol_t
+
+void match_key_from_probe(match_key_t * key, const probe_t * probe)
+{
+    const layer_t * layer;
+    size_t          i;
+
+    memset(key, 0, sizeof(match_key_t));
+
+    for (i = 0; i < MATCH_KEY_NUM_LAYERS; i++) {
+        if ((layer = probe_get_layer(probe, i)) && layer->protocol) {
+            key->protocols[i] = layer->protocol->protocol;
+        }
+    }
+
+    if (probe_extract(probe, "src_ip", &key->src_ip)
+    &&  probe_extract(probe, "dst_ip", &key->dst_ip)) {
+        key->flags |= MATCH_KEY_IP;
+    }
+
+    if (probe_extract_ext(probe, "src_ip", 2, &key->quoted_src_ip)
+    &&  probe_extract_ext(probe, "dst_ip", 2, &key->quoted_dst_ip)) {
+        key->flags |= MATCH_KEY_QUOTED_IP;
+    }
+
+    if (probe_extract(probe, "src_port", &key->src_port)
+    &&  probe_extract(probe, "dst_port", &key->dst_port)) {
+        key->flags |= MATCH_KEY_PORTS;
+    }
+
+    if (probe_extract(probe, "type", &key->type)) key->flags |= MATCH_KEY_TYPE;
+    if (probe_extract(probe, "code", &key->code)) key->flags |= MATCH_KEY_CODE;
+
+    if (probe_extract_ext(probe, "type", 3, &key->quoted_type)
+    &&  probe_extract_ext(probe, "code", 3, &key->quoted_code)) {
+        key->flags |= MATCH_KEY_QUOTED_ICMP;
+    }
+}
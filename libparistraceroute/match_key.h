@@ -0,0 +1,88 @@
+#ifndef MATCH_KEY_H
+#define MATCH_KEY_H
+
+/**
+ * \file match_key.h
+ * \brief The fields of a probe (or of a reply) compared by the matches
+ *    callback of each protocol (see protocol_t::matches).
+ *
+ * Matching a reply used to extract each compared field by name, from both
+ * the reply and the candidate probe, once per candidate. These fields are
+ * now extracted once per packet into a match_key_t, so that comparing a
+ * reply to a candidate only compares integers and addresses.
+ *
+ * A field is extracted as probe_extract (or probe_extract_ext) would do,
+ * i.e. from the first layer carrying it. For instance, the ports of an
+ * ICMP error are those of the probe it quotes.
+ */
+
+#include <stdbool.h>   // bool
+#include <stdint.h>    // uint*_t
+
+#include "address.h"   // address_t
+#include "probe.h"     // probe_t
+
+// Number of layers whose protocol is recorded in a match_key_t
+// (IP / ICMP / IP / transport for an ICMP error).
+#define MATCH_KEY_NUM_LAYERS 4
+
+// Flags of match_key_t::flags, set if the corresponding fields are present.
+#define MATCH_KEY_IP          (1 << 0) /**< src_ip and dst_ip */
+#define MATCH_KEY_QUOTED_IP   (1 << 1) /**< quoted_src_ip and quoted_dst_ip */
+#define MATCH_KEY_PORTS       (1 << 2) /**< src_port and dst_port */
+#define MATCH_KEY_TYPE        (1 << 3) /**< type */
+#define MATCH_KEY_CODE        (1 << 4) /**< code */
+#define MATCH_KEY_QUOTED_ICMP (1 << 5) /**< quoted_type and quoted_code */
+
+/**
+ * \struct match_key_t
+ * \brief The fields of a packet involved in the matching of the replies.
+ */
+
+typedef struct match_key_s {
+    uint8_t   protocols[MATCH_KEY_NUM_LAYERS]; /**< Protocol of the first layers (see protocol_t::protocol), 0 if none */
+    address_t src_ip;         /**< "src_ip" (outer IP header) */
+    address_t dst_ip;         /**< "dst_ip" (outer IP header) */
+    address_t quoted_src_ip;  /**< "src_ip" from the layer 2 (quoted IP header) */
+    address_t quoted_dst_ip;  /**< "dst_ip" from the layer 2 (quoted IP header) */
+    uint16_t  src_port;       /**< "src_port" */
+    uint16_t  dst_port;       /**< "dst_port" */
+    uint8_t   type;           /**< "type" */
+    uint8_t   code;           /**< "code" */
+    uint8_t   quoted_type;    /**< "type" from the layer 3 (quoted ICMP header) */
+    uint8_t   quoted_code;    /**< "code" from the layer 3 (quoted ICMP header) */
+    uint8_t   flags;          /**< Fields present (see MATCH_KEY_*) */
+} match_key_t;
+
+/**
+ * \brief Extract the key of a probe or of a reply.
+ * \param key The match_key_t instance to fill.
+ * \param probe The probe or the reply.
+ */
+
+void match_key_from_probe(match_key_t * key, const probe_t * probe);
+
+/**
+ * \brief Retrieve the protocol of a layer of a match_key_t.
+ * \param key A match_key_t instance.
+ * \param depth The index of the layer (< MATCH_KEY_NUM_LAYERS).
+ * \return The protocol (see protocol_t::protocol), 0 if there is no
+ *    such layer.
+ */
+
+static inline uint8_t match_key_get_protocol(const match_key_t * key, size_t depth) {
+    return key->protocols[depth];
+}
+
+/**
+ * \brief Tell whether a match_key_t carries some fields.
+ * \param key A match_key_t instance.
+ * \param flags The fields (see MATCH_KEY_*).
+ * \return true iif all these fields are present.
+ */
+
+static inline bool match_key_has(const match_key_t * key, uint8_t flags) {
+    return (key->flags & flags) == flags;
+}
+
+#endif // MATCH_KEY_H
@@ -0,0 +1,165 @@
+#include "config.h"
+
+#include <inttypes.h>     // PRId64
+#include <stdlib.h>       // calloc, free
+
+#include "memstats.h"
+#include "metrics.h"      // metrics_write_family, metrics_write_label_value
+
+// The global counters, shared by every thread
+static memstats_t memstats_global;
+
+static const char * memstats_tag_names[MEMSTATS_NUM_TAGS] = {
+    [MEMSTATS_PROBE]   = "probe",
+    [MEMSTATS_PACKET]  = "packet",
+    [MEMSTATS_EVENT]   = "event",
+    [MEMSTATS_LATTICE] = "lattice",
+    [MEMSTATS_FLOW]    = "flow",
+    [MEMSTATS_CACHE]   = "cache"
+};
+
+const char * memstats_tag_get_name(memstats_tag_t tag) {
+    return memstats_tag_names[tag];
+}
+
+memstats_t * memstats_create() {
+    return calloc(1, sizeof(memstats_t));
+}
+
+/**
+ * \brief Tell whether a memstats_t instance has live objects.
+ * \param memstats A memstats_t instance.
+ * \return true iif it has live objects.
+ */
+
+static bool memstats_has_objects(const memstats_t * memstats) {
+    size_t i;
+
+    for (i = 0; i < MEMSTATS_NUM_TAGS; i++) {
+        if (memstats->counters[i].num_objects) return true;
+    }
+    return false;
+}
+
+void memstats_release_owner(memstats_t * memstats) {
+    if (memstats) {
+        if (memstats_has_objects(memstats)) {
+            memstats->is_orphan = true;
+        } else {
+            free(memstats);
+        }
+    }
+}
+
+void memstats_add(memstats_t * memstats, memstats_tag_t tag, size_t num_bytes) {
+    memstats_counter_t * counter;
+
+    if (memstats) {
+        counter = &memstats->counters[tag];
+        counter->num_objects++;
+        counter->num_bytes += num_bytes;
+        if (counter->num_bytes > counter->peak_bytes) counter->peak_bytes = counter->num_bytes;
+    }
+}
+
+void memstats_sub(memstats_t * memstats, memstats_tag_t tag, size_t num_bytes) {
+    memstats_counter_t * counter;
+
+    if (memstats) {
+        counter = &memstats->counters[tag];
+        counter->num_objects--;
+        counter->num_bytes -= num_bytes;
+        if (memstats->is_orphan && counter->num_objects == 0 && !memstats_has_objects(memstats)) {
+            free(memstats);
+        }
+    }
+}
+
+int64_t memstats_get_num_bytes(const memstats_t * memstats) {
+    int64_t num_bytes = 0;
+    size_t  i;
+
+    for (i = 0; i < MEMSTATS_NUM_TAGS; i++) {
+        num_bytes += memstats->counters[i].num_bytes;
+    }
+    return num_bytes;
+}
+
+void memstats_track_alloc(memstats_tag_t tag, size_t num_bytes) {
+    memstats_counter_t * counter = &memstats_global.counters[tag];
+    int64_t              total, peak;
+
+    __atomic_fetch_add(&counter->num_objects, 1, __ATOMIC_RELAXED);
+    total = __atomic_add_fetch(&counter->num_bytes, (int64_t) num_bytes, __ATOMIC_RELAXED);
+
+    // The peak may be updated concurrently
+    peak = __atomic_load_n(&counter->peak_bytes, __ATOMIC_RELAXED);
+    while (total > peak && !__atomic_compare_exchange_n(&counter->peak_bytes, &peak, total, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void memstats_track_free(memstats_tag_t tag, size_t num_bytes) {
+    memstats_counter_t * counter = &memstats_global.counters[tag];
+
+    __atomic_fetch_sub(&counter->num_objects, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&counter->num_bytes, (int64_t) num_bytes, __ATOMIC_RELAXED);
+}
+
+void memstats_get_global(memstats_t * memstats) {
+    size_t i;
+
+    for (i = 0; i < MEMSTATS_NUM_TAGS; i++) {
+        memstats->counters[i].num_objects = __atomic_load_n(&memstats_global.counters[i].num_objects, __ATOMIC_RELAXED);
+        memstats->counters[i].num_bytes   = __atomic_load_n(&memstats_global.counters[i].num_bytes,   __ATOMIC_RELAXED);
+        memstats->counters[i].peak_bytes  = __atomic_load_n(&memstats_global.counters[i].peak_bytes,  __ATOMIC_RELAXED);
+    }
+    memstats->is_orphan = false;
+}
+
+void memstats_dump(const memstats_t * memstats, FILE * file)
+{
+    const memstats_counter_t * counter;
+    size_t                     i;
+
+    fprintf(file, "total %.1f KiB", memstats_get_num_bytes(memstats) / 1024.0);
+    for (i = 0; i < MEMSTATS_NUM_TAGS; i++) {
+        counter = &memstats->counters[i];
+        if (!counter->peak_bytes) continue;
+        fprintf(file, " %s %" PRId64 " (%.1f KiB, peak %.1f KiB)",
+            memstats_tag_get_name(i),
+            counter->num_objects,
+            counter->num_bytes / 1024.0,
+            counter->peak_bytes / 1024.0
+        );
+    }
+}
+
+/**
+ * \brief Write a family of gauges, one per tag, in the OpenMetrics text format.
+ * \param file The output file.
+ * \param memstats A memstats_t instance.
+ * \param name The name of the family.
+ * \param help The description of the family.
+ * \param offset The offset of the gauge in memstats_counter_t.
+ */
+
+static void memstats_write_gauges(FILE * file, const memstats_t * memstats, const char * name, const char * help, size_t offset)
+{
+    size_t i;
+
+    metrics_write_family(file, name, "gauge", help);
+    for (i = 0; i < MEMSTATS_NUM_TAGS; i++) {
+        fprintf(file, "%s{tag=\"", name);
+        metrics_write_label_value(file, memstats_tag_get_name(i));
+        fprintf(file, "\"} %" PRId64 "\n", *(const int64_t *) ((const char *) &memstats->counters[i] + offset));
+    }
+}
+
+void memstats_write_metrics(FILE * file, void * unused)
+{
+    memstats_t memstats;
+
+    memstats_get_global(&memstats);
+    memstats_write_gauges(file, &memstats, "paristraceroute_memory_objects",    "Live objects",                         offsetof(memstats_counter_t, num_objects));
+    memstats_write_gauges(file, &memstats, "paristraceroute_memory_bytes",      "Size of the live objects",             offsetof(memstats_counter_t, num_bytes));
+    memstats_write_gauges(file, &memstats, "paristraceroute_memory_peak_bytes", "Greatest size of the live objects",    offsetof(memstats_counter_t, peak_bytes));
+}
@@ -0,0 +1,155 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+/**
+ * \file memstats.h
+ * \brief Accounting of the objects allocated by libparistraceroute, to
+ *    find out which subsystem (and which algorithm instance) makes the
+ *    memory of a measurement grow.
+ *
+ * The major allocators (probes, packets, events, lattices, flows of mda,
+ * lookup caches) account their objects under a memstats_tag_t:
+ * - globally, thanks to memstats_track_alloc and memstats_track_free.
+ *   The global counters are updated atomically, since an object may be
+ *   allocated and released by different threads (see pt_shards.h);
+ * - per owner (e.g. per algorithm instance), thanks to memstats_add and
+ *   memstats_sub, for the objects whose owner is known.
+ *
+ * The accounted bytes are the size of the tracked structures: the
+ * variable-size memory they refer to (e.g. the layers of a probe, the
+ * bytes of a reply) is not accounted.
+ *
+ * An owner may be released while some of its objects are still alive
+ * (e.g. probes in flight): memstats_release_owner then postpones the
+ * release of the memstats_t instance until its last object is released.
+ */
+
+#include <stdbool.h>   // bool
+#include <stddef.h>    // size_t
+#include <stdint.h>    // int64_t
+#include <stdio.h>     // FILE
+
+typedef enum {
+    MEMSTATS_PROBE,    /**< probe_t (probes and replies) */
+    MEMSTATS_PACKET,   /**< packet_t */
+    MEMSTATS_EVENT,    /**< event_t */
+    MEMSTATS_LATTICE,  /**< Blocks of lattice_elt_t */
+    MEMSTATS_FLOW,     /**< mda_flow_t */
+    MEMSTATS_CACHE,    /**< Entries of the hostname and AS caches */
+    MEMSTATS_NUM_TAGS
+} memstats_tag_t;
+
+/**
+ * \struct memstats_counter_t
+ * \brief The objects accounted under a tag.
+ */
+
+typedef struct {
+    int64_t num_objects;  /**< Number of live objects */
+    int64_t num_bytes;    /**< Size of the live objects (in bytes) */
+    int64_t peak_bytes;   /**< Greatest value of num_bytes */
+} memstats_counter_t;
+
+/**
+ * \struct memstats_t
+ * \brief The objects accounted for an owner.
+ */
+
+typedef struct {
+    memstats_counter_t counters[MEMSTATS_NUM_TAGS]; /**< The counters, indexed by tag */
+    bool               is_orphan;                   /**< True iif the owner has been released (see memstats_release_owner) */
+} memstats_t;
+
+/**
+ * \brief Retrieve the name of a tag.
+ * \param tag A memstats_tag_t value.
+ * \return The corresponding name (e.g. "probe").
+ */
+
+const char * memstats_tag_get_name(memstats_tag_t tag);
+
+/**
+ * \brief Create a memstats_t instance, accounting the objects of an owner.
+ * \return The newly allocated memstats_t instance, NULL in case of failure.
+ */
+
+memstats_t * memstats_create();
+
+/**
+ * \brief Notify that the owner of a memstats_t instance is released. The
+ *    instance is released at once if it has no live object, otherwise
+ *    once its last object is released (see memstats_sub).
+ * \param memstats A memstats_t instance (NULL is ignored).
+ */
+
+void memstats_release_owner(memstats_t * memstats);
+
+/**
+ * \brief Account an object for an owner.
+ * \param memstats A memstats_t instance (NULL is ignored).
+ * \param tag The kind of object.
+ * \param num_bytes The size of the object.
+ */
+
+void memstats_add(memstats_t * memstats, memstats_tag_t tag, size_t num_bytes);
+
+/**
+ * \brief Stop accounting an object for an owner. The memstats_t instance
+ *    is released if its owner is released and this was its last object.
+ * \param memstats A memstats_t instance (NULL is ignored).
+ * \param tag The kind of object.
+ * \param num_bytes The size of the object (see memstats_add).
+ */
+
+void memstats_sub(memstats_t * memstats, memstats_tag_t tag, size_t num_bytes);
+
+/**
+ * \brief Retrieve the size of the live objects of a memstats_t instance.
+ * \param memstats A memstats_t instance.
+ * \return The corresponding number of bytes.
+ */
+
+int64_t memstats_get_num_bytes(const memstats_t * memstats);
+
+/**
+ * \brief Account a newly allocated object in the global counters.
+ * \param tag The kind of object.
+ * \param num_bytes The size of the object.
+ */
+
+void memstats_track_alloc(memstats_tag_t tag, size_t num_bytes);
+
+/**
+ * \brief Account a released object in the global counters.
+ * \param tag The kind of object.
+ * \param num_bytes The size of the object (see memstats_track_alloc).
+ */
+
+void memstats_track_free(memstats_tag_t tag, size_t num_bytes);
+
+/**
+ * \brief Retrieve the global counters.
+ * \param memstats The memstats_t instance in which the global counters
+ *    are copied.
+ */
+
+void memstats_get_global(memstats_t * memstats);
+
+/**
+ * \brief Print the counters of a memstats_t instance (on a single line).
+ * \param memstats A memstats_t instance.
+ * \param file The output file.
+ */
+
+void memstats_dump(const memstats_t * memstats, FILE * file);
+
+/**
+ * \brief Write the global counters in the OpenMetrics text format
+ *    (see metrics_callback_t).
+ * \param file The output file.
+ * \param unused Unused.
+ */
+
+void memstats_write_metrics(FILE * file, void * unused);
+
+#endif // MEMSTATS_H
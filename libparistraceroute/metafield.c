@@ -2,29 +2,16 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <search.h>
 
 #include "metafield.h"
 #include "common.h"
 
-static void * metafields_root = NULL;
-
-static int metafield_compare(
-    const metafield_t * metafield1,
-    const metafield_t * metafield2
-) {
-    return strcmp(metafield1->name, metafield2->name);
-}
+// Registered metafields, indexed by the interned key of their name.
+static metafield_t * metafields[FIELD_KEY_MAX];
 
 metafield_t* metafield_search(const char * name)
 {
-    metafield_t **metafield, search;
-
-    if (!name) return NULL;
-    search.name = name;
-    metafield = tfind(&search, &metafields_root, (ELEMENT_COMPARE) metafield_compare);
-
-    return metafield ? *metafield : NULL;
+    return metafields[field_key_search(name)];
 }
 
 void metafield_register(metafield_t * metafield)
@@ -32,8 +19,10 @@ void metafield_register(metafield_t * metafield)
     // Process the patterns
     // XXX
 
-    // Insert the metafield in the tree if the keys does not yet exist
-    tsearch(metafield, &metafields_root, (ELEMENT_COMPARE) metafield_compare);
+    // Index the metafield if its name is not yet registered
+    if ((metafield->key = field_key_register(metafield->name)) && !metafields[metafield->key]) {
+        metafields[metafield->key] = metafield;
+    }
 }
 
 ////--------------------------------------------------------------------------
@@ -5,6 +5,7 @@
 #include "dynarray.h"
 #include "bitfield.h"
 #include "protocol_field.h"
+#include "field_key.h"      // field_key_t
 
 // metafield = sur champ
 // définit pour une clé par exemple flow le bon bitfield
@@ -28,12 +29,19 @@ typedef struct metafield_s {
 
     /* Internal fields */
     bitfield_t   bitfield;    /**< Bits related to the metafield    */
+    field_key_t  key;         /**< Interned name (set by metafield_register) */
 
 } metafield_t;
 
 metafield_t* metafield_search(const char * name);
 void metafield_register(metafield_t * metafield);
 
+#define METAFIELD_REGISTER(MOD)    \
+static void __init_ ## MOD (void) __attribute__ ((constructor));    \
+static void __init_ ## MOD (void) {    \
+    metafield_register(&MOD); \
+}
+
 // - pattern matching
 // - successor of a value
 // - bitmask of unauthorized bits ?
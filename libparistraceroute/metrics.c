@@ -0,0 +1,427 @@
+#include "use.h"
+#include "config.h"
+
+#include <errno.h>        // errno, EAGAIN, EINTR
+#include <netdb.h>        // getaddrinfo, freeaddrinfo
+#include <stdlib.h>       // calloc, malloc, free
+#include <string.h>       // memcpy, memset, strchr, strcspn, strdup, strndup, strncmp, strrchr, strspn, strstr
+#ifdef USE_KQUEUE
+#    include <sys/event.h> // kqueue, kevent
+#else
+#    include <sys/epoll.h> // epoll_*
+#endif
+#include <sys/socket.h>   // socket, bind, listen, accept4, recv, send
+#include <unistd.h>       // close
+
+#include "metrics.h"
+
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+// Maximum number of events fetched at once from the epoll (or kqueue) instance
+#define METRICS_MAX_EVENTS   16
+
+/**
+ * \brief Split the address of a server in a host and a port.
+ * \param address The address (see metrics_create).
+ * \param phost Address of a pointer set to the host (NULL if unset). It
+ *    must be released by the caller.
+ * \param pport Address of a pointer set to the port. It must be released
+ *    by the caller.
+ * \return true iif successful.
+ */
+
+static bool metrics_parse_address(const char * address, char ** phost, char ** pport)
+{
+    const char * colon = strrchr(address, ':'),
+               * port = NULL,
+               * end;
+
+    *phost = NULL;
+    *pport = NULL;
+
+    if (address[0] == '[') {
+        // "[IPV6]" or "[IPV6]:PORT"
+        if (!(end = strchr(address, ']'))
+        ||  (end[1] && end[1] != ':')) {
+            return false;
+        }
+        if (!(*phost = strndup(address + 1, end - address - 1))) return false;
+        if (end[1]) port = end + 2;
+    } else if (address[strspn(address, "0123456789")] == '\0') {
+        // "PORT"
+        port = address;
+    } else if (colon && strchr(address, ':') != colon) {
+        // "IPV6"
+        if (!(*phost = strdup(address))) return false;
+    } else {
+        // "HOST" or "HOST:PORT"
+        if (!(*phost = strndup(address, colon ? (size_t) (colon - address) : strlen(address)))) return false;
+        if (colon) port = colon + 1;
+    }
+
+    if (!(*pport = strdup(port && *port ? port : METRICS_DEFAULT_PORT))) {
+        free(*phost);
+        *phost = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Open a non-blocking socket listening to an address.
+ * \param address The address (see metrics_create).
+ * \return The socket, -1 in case of failure.
+ */
+
+static int metrics_listen(const char * address)
+{
+    struct addrinfo   hints,
+                    * results,
+                    * result;
+    char            * host,
+                    * port;
+    int               sockfd = -1,
+                      error,
+                      one = 1;
+
+    if (!metrics_parse_address(address, &host, &port)) {
+        fprintf(stderr, "metrics: invalid address %s\n", address);
+        goto ERR_PARSE_ADDRESS;
+    }
+
+    // Without host, the server only listens to the IPv4 loopback, as
+    // most exporters do
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((error = getaddrinfo(host ? host : METRICS_DEFAULT_HOST, port, &hints, &results)) != 0) {
+        fprintf(stderr, "metrics: %s: %s\n", address, gai_strerror(error));
+        goto ERR_GETADDRINFO;
+    }
+
+    for (result = results; result; result = result->ai_next) {
+        if ((sockfd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, result->ai_protocol)) == -1) {
+            continue;
+        }
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(sockfd, result->ai_addr, result->ai_addrlen) == 0
+        &&  listen(sockfd, SOMAXCONN) == 0) {
+            break;
+        }
+        close(sockfd);
+        sockfd = -1;
+    }
+    if (sockfd == -1) perror("metrics");
+
+    freeaddrinfo(results);
+ERR_GETADDRINFO:
+    free(host);
+    free(port);
+ERR_PARSE_ADDRESS:
+    return sockfd;
+}
+
+/**
+ * \brief Watch a socket thanks to the epoll (or kqueue) instance of a
+ *    metrics_t.
+ * \param metrics A metrics_t instance.
+ * \param sockfd The socket.
+ * \param client The client related to the socket, NULL for the listening socket.
+ * \param is_sending Pass false to watch a new socket until it is readable,
+ *    true to watch an already watched socket until it is writable instead.
+ * \return true iif successful.
+ */
+
+static bool metrics_watch(metrics_t * metrics, int sockfd, metrics_client_t * client, bool is_sending)
+{
+#ifdef USE_KQUEUE
+    struct kevent      events[2];
+
+    if (is_sending) {
+        EV_SET(&events[0], sockfd, EVFILT_READ,  EV_DELETE, 0, 0, client);
+        EV_SET(&events[1], sockfd, EVFILT_WRITE, EV_ADD,    0, 0, client);
+        return kevent(metrics->efd, events, 2, NULL, 0, NULL) != -1;
+    }
+    EV_SET(&events[0], sockfd, EVFILT_READ, EV_ADD, 0, 0, client);
+    return kevent(metrics->efd, events, 1, NULL, 0, NULL) != -1;
+#else
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events   = is_sending ? EPOLLOUT : EPOLLIN;
+    event.data.ptr = client;
+    return epoll_ctl(metrics->efd, is_sending ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, sockfd, &event) != -1;
+#endif
+}
+
+metrics_t * metrics_create(const char * address)
+{
+    metrics_t * metrics;
+    size_t      i;
+
+    if (!(metrics = calloc(1, sizeof(metrics_t))))              goto ERR_CALLOC;
+    if ((metrics->sockfd = metrics_listen(address)) == -1)      goto ERR_LISTEN;
+#ifdef USE_KQUEUE
+    if ((metrics->efd = kqueue()) == -1)                        goto ERR_EPOLL_CREATE;
+#else
+    if ((metrics->efd = epoll_create1(EPOLL_CLOEXEC)) == -1)    goto ERR_EPOLL_CREATE;
+#endif
+
+    // The listening socket is identified by a NULL pointer
+    if (!metrics_watch(metrics, metrics->sockfd, NULL, false))  goto ERR_EPOLL_CTL;
+
+    for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        metrics->clients[i].sockfd = -1;
+    }
+    return metrics;
+
+ERR_EPOLL_CTL:
+    close(metrics->efd);
+ERR_EPOLL_CREATE:
+    close(metrics->sockfd);
+ERR_LISTEN:
+    free(metrics);
+ERR_CALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Close the connection of a client, and release its slot.
+ * \param client A client of a metrics_t instance.
+ */
+
+static void metrics_client_close(metrics_client_t * client) {
+    // Closing the socket removes it from the epoll (or kqueue) instance
+    close(client->sockfd);
+    free(client->response);
+    client->sockfd       = -1;
+    client->request_size = 0;
+    client->response     = NULL;
+}
+
+void metrics_free(metrics_t * metrics)
+{
+    size_t i;
+
+    if (metrics) {
+        for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (metrics->clients[i].sockfd != -1) metrics_client_close(&metrics->clients[i]);
+        }
+        close(metrics->efd);
+        close(metrics->sockfd);
+        free(metrics);
+    }
+}
+
+bool metrics_add_source(metrics_t * metrics, metrics_callback_t callback, void * data)
+{
+    if (metrics->num_sources == METRICS_MAX_SOURCES) return false;
+
+    metrics->sources[metrics->num_sources].callback = callback;
+    metrics->sources[metrics->num_sources].data     = data;
+    metrics->num_sources++;
+    return true;
+}
+
+inline int metrics_get_fd(const metrics_t * metrics) {
+    return metrics->efd;
+}
+
+void metrics_write_family(FILE * file, const char * name, const char * type, const char * help) {
+    fprintf(file, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+void metrics_write_label_value(FILE * file, const char * value) {
+    for (; *value; value++) {
+        switch (*value) {
+            case '\\': fputs("\\\\", file); break;
+            case '"':  fputs("\\\"", file); break;
+            case '\n': fputs("\\n", file);  break;
+            default:   fputc(*value, file); break;
+        }
+    }
+}
+
+/**
+ * \brief Accept the pending connections. A connection is closed at once
+ *    if every slot is already used.
+ * \param metrics A metrics_t instance.
+ */
+
+static void metrics_accept(metrics_t * metrics)
+{
+    metrics_client_t   * client;
+    int                  sockfd;
+    size_t               i;
+
+    while ((sockfd = accept4(metrics->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        for (i = 0, client = NULL; i < METRICS_MAX_CLIENTS; i++) {
+            if (metrics->clients[i].sockfd == -1) {
+                client = &metrics->clients[i];
+                break;
+            }
+        }
+
+        if (!client || !metrics_watch(metrics, sockfd, client, false)) {
+            close(sockfd);
+            continue;
+        }
+        client->sockfd = sockfd;
+    }
+}
+
+/**
+ * \brief Prepare the response to the request of a client.
+ * \param metrics A metrics_t instance.
+ * \param client The client, whose request is complete.
+ * \return true iif successful.
+ */
+
+static bool metrics_client_prepare_response(metrics_t * metrics, metrics_client_t * client)
+{
+    const char * status = "200 OK",
+               * content_type = METRICS_CONTENT_TYPE,
+               * path,
+               * path_end;
+    char       * body = NULL,
+                 header[256];
+    size_t       body_size = 0,
+                 path_size,
+                 i;
+    int          header_size;
+    FILE       * file;
+
+    if (!(file = open_memstream(&body, &body_size))) goto ERR_OPEN_MEMSTREAM;
+
+    if (strncmp(client->request, "GET ", 4) != 0) {
+        status       = "405 Method Not Allowed";
+        content_type = "text/plain";
+        fprintf(file, "Method Not Allowed\n");
+    } else {
+        path      = client->request + 4;
+        path_end  = path + strcspn(path, " ?\r\n");
+        path_size = path_end - path;
+        if ((path_size == 1 && path[0] == '/')
+        ||  (path_size == 8 && strncmp(path, "/metrics", 8) == 0)) {
+            for (i = 0; i < metrics->num_sources; i++) {
+                metrics->sources[i].callback(file, metrics->sources[i].data);
+            }
+            fprintf(file, "# EOF\n");
+        } else {
+            status       = "404 Not Found";
+            content_type = "text/plain";
+            fprintf(file, "Not Found\n");
+        }
+    }
+    if (fclose(file) != 0) goto ERR_FCLOSE;
+
+    header_size = snprintf(
+        header, sizeof(header),
+        "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, content_type, body_size
+    );
+    if (!(client->response = malloc(header_size + body_size))) goto ERR_MALLOC;
+    memcpy(client->response, header, header_size);
+    memcpy(client->response + header_size, body, body_size);
+    client->response_size = header_size + body_size;
+    client->num_sent      = 0;
+    free(body);
+    return true;
+
+ERR_MALLOC:
+ERR_FCLOSE:
+    free(body);
+ERR_OPEN_MEMSTREAM:
+    return false;
+}
+
+/**
+ * \brief Process the events of a client: receive its request, and send
+ *    the response (as long as its socket accepts it).
+ * \param metrics A metrics_t instance.
+ * \param client The client.
+ */
+
+static void metrics_client_process(metrics_t * metrics, metrics_client_t * client)
+{
+    ssize_t num_bytes;
+
+    // Receive the request, until its headers are over
+    while (!client->response) {
+        num_bytes = recv(
+            client->sockfd,
+            client->request + client->request_size,
+            METRICS_REQUEST_SIZE - 1 - client->request_size,
+            0
+        );
+        if (num_bytes == -1 && errno == EINTR) continue;
+        if (num_bytes == -1 && errno == EAGAIN) return;
+        if (num_bytes <= 0) goto CLOSE;
+
+        client->request_size += num_bytes;
+        client->request[client->request_size] = '\0';
+        if (!strstr(client->request, "\r\n\r\n") && !strstr(client->request, "\n\n")) {
+            if (client->request_size == METRICS_REQUEST_SIZE - 1) goto CLOSE;
+            continue;
+        }
+
+        if (!metrics_client_prepare_response(metrics, client)) goto CLOSE;
+    }
+
+    // Send the response
+    while (client->num_sent < client->response_size) {
+        num_bytes = send(
+            client->sockfd,
+            client->response + client->num_sent,
+            client->response_size - client->num_sent,
+            MSG_NOSIGNAL
+        );
+        if (num_bytes == -1 && errno == EINTR) continue;
+        if (num_bytes == -1 && errno == EAGAIN) {
+            // Wait until the socket accepts the remaining bytes
+            if (!metrics_watch(metrics, client->sockfd, client, true)) goto CLOSE;
+            return;
+        }
+        if (num_bytes == -1) goto CLOSE;
+        client->num_sent += num_bytes;
+    }
+
+CLOSE:
+    metrics_client_close(client);
+}
+
+bool metrics_process(metrics_t * metrics)
+{
+#ifdef USE_KQUEUE
+    struct kevent        events[METRICS_MAX_EVENTS];
+    struct timespec      timeout = {0, 0};
+#else
+    struct epoll_event   events[METRICS_MAX_EVENTS];
+#endif
+    metrics_client_t   * client;
+    int                  i, num_events;
+
+    // Never wait: the pt_loop_t has already been woken up by metrics->efd
+#ifdef USE_KQUEUE
+    if ((num_events = kevent(metrics->efd, NULL, 0, events, METRICS_MAX_EVENTS, &timeout)) == -1) {
+#else
+    if ((num_events = epoll_wait(metrics->efd, events, METRICS_MAX_EVENTS, 0)) == -1) {
+#endif
+        return false;
+    }
+
+    for (i = 0; i < num_events; i++) {
+#ifdef USE_KQUEUE
+        client = (metrics_client_t *) events[i].udata;
+#else
+        client = events[i].data.ptr;
+#endif
+        if (client) {
+            metrics_client_process(metrics, client);
+        } else {
+            metrics_accept(metrics);
+        }
+    }
+
+    return num_events == METRICS_MAX_EVENTS;
+}
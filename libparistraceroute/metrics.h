@@ -0,0 +1,152 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * \file metrics.h
+ * \brief A minimal HTTP server exporting metrics in the OpenMetrics
+ *    (Prometheus) text format, so that a long-running measurement can be
+ *    scraped instead of parsing its output.
+ *
+ * A metrics_t instance is driven by a pt_loop_t (see pt_loop_set_metrics):
+ * it watches its listening socket and its clients thanks to its own epoll
+ * instance, whose file descriptor is the only one registered in the loop.
+ * Every socket is non-blocking and every request is served at once from
+ * the loop thread, so that the exporter neither requires a thread nor
+ * blocks the probes.
+ *
+ * The metrics are written by sources (see metrics_add_source), called
+ * whenever a request is served. Any GET request on /metrics (or /) is
+ * answered with the metrics of every source, and the connection is
+ * closed once the response has been sent.
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdio.h>      // FILE
+
+// Maximum number of clients served at once. Further clients are rejected.
+#define METRICS_MAX_CLIENTS  16
+
+// Maximum number of sources
+#define METRICS_MAX_SOURCES  8
+
+// Maximum size of a request (in bytes). Larger requests are rejected.
+#define METRICS_REQUEST_SIZE 2048
+
+// Host and port used when the address of the server does not specify them
+#define METRICS_DEFAULT_HOST "127.0.0.1"
+#define METRICS_DEFAULT_PORT "9101"
+
+/**
+ * \brief Write the metrics of a source.
+ * \param file The output stream. Each metric family must be introduced
+ *    by metrics_write_family.
+ * \param data The data passed to metrics_add_source.
+ */
+
+typedef void (* metrics_callback_t)(FILE * file, void * data);
+
+/**
+ * \struct metrics_source_t
+ * \brief A source of metrics.
+ */
+
+typedef struct {
+    metrics_callback_t   callback; /**< Writes the metrics of this source */
+    void               * data;     /**< Passed to callback */
+} metrics_source_t;
+
+/**
+ * \struct metrics_client_t
+ * \brief A connection to a metrics_t server.
+ */
+
+typedef struct {
+    int      sockfd;                        /**< The socket of this client, -1 if this slot is unused */
+    char     request[METRICS_REQUEST_SIZE]; /**< The bytes of the request received so far */
+    size_t   request_size;                  /**< Number of bytes stored in request */
+    char   * response;                      /**< The response, NULL until the request is complete */
+    size_t   response_size;                 /**< Size of the response (in bytes) */
+    size_t   num_sent;                      /**< Number of bytes of the response already sent */
+} metrics_client_t;
+
+/**
+ * \struct metrics_t
+ * \brief An HTTP server exporting metrics.
+ */
+
+typedef struct {
+    int                efd;                           /**< epoll instance watching sockfd and the clients */
+    int                sockfd;                        /**< The listening socket */
+    metrics_client_t   clients[METRICS_MAX_CLIENTS];  /**< The connected clients */
+    metrics_source_t   sources[METRICS_MAX_SOURCES];  /**< The sources of metrics */
+    size_t             num_sources;                   /**< Number of sources */
+} metrics_t;
+
+/**
+ * \brief Create an HTTP server exporting metrics.
+ * \param address The address to listen to: "PORT", "HOST:PORT",
+ *    "[IPV6]:PORT" or "HOST". Without HOST, METRICS_DEFAULT_HOST
+ *    (the loopback) is used, and without PORT, METRICS_DEFAULT_PORT.
+ * \return The newly allocated metrics_t instance, NULL in case of failure.
+ */
+
+metrics_t * metrics_create(const char * address);
+
+/**
+ * \brief Release an HTTP server exporting metrics, and close its connections.
+ * \param metrics A metrics_t instance.
+ */
+
+void metrics_free(metrics_t * metrics);
+
+/**
+ * \brief Register a source of metrics. The sources are called in the
+ *    order of their registration.
+ * \param metrics A metrics_t instance.
+ * \param callback Writes the metrics of this source.
+ * \param data Passed to callback.
+ * \return true iif successful.
+ */
+
+bool metrics_add_source(metrics_t * metrics, metrics_callback_t callback, void * data);
+
+/**
+ * \brief Retrieve the file descriptor activated when the server has
+ *    connections or requests to process.
+ * \param metrics A metrics_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int metrics_get_fd(const metrics_t * metrics);
+
+/**
+ * \brief Accept the new connections, and serve the pending requests.
+ *    This is called whenever the metrics_t file descriptor is activated.
+ * \param metrics A metrics_t instance.
+ * \return true iif some events may still be pending.
+ */
+
+bool metrics_process(metrics_t * metrics);
+
+/**
+ * \brief Introduce a metric family (see the OpenMetrics specification).
+ * \param file The output stream passed to a metrics_callback_t.
+ * \param name The name of the family, e.g. "paristraceroute_probes"
+ *    (the samples of a counter family are suffixed by "_total").
+ * \param type The type of the family ("counter", "gauge", "summary"...).
+ * \param help A description of the family.
+ */
+
+void metrics_write_family(FILE * file, const char * name, const char * type, const char * help);
+
+/**
+ * \brief Write the value of a label, escaping its backslashes, double
+ *    quotes and line feeds.
+ * \param file The output stream passed to a metrics_callback_t.
+ * \param value The value of the label (without the enclosing double quotes).
+ */
+
+void metrics_write_label_value(FILE * file, const char * value);
+
+#endif // METRICS_H
@@ -7,8 +7,12 @@
 #include <time.h>        // time_t
 #include <unistd.h>      // close
 #include <sys/timerfd.h> // timerfd_create, timerfd_settime
+#include <sys/eventfd.h> // eventfd_write
 #include <arpa/inet.h>   // htons
+#include <netinet/tcp.h> // TH_ACK
 #include <limits.h>      // INT_MAX
+#include <errno.h>       // errno
+#include <float.h>       // DBL_MAX
 
 #include "protocol.h"    // struct probe_s
 #include "network.h"
@@ -17,21 +21,60 @@
 #include "queue.h"
 #include "options.h"     // option_t
 #include "probe.h"       // probe_extract_ext, probe_set_field_ext
+#include "protocol_stack.h" // protocol_stack_*
+#include "ratelimit.h"   // ratelimit_*
 #include "algorithm.h"   // pt_algorithm_throw
-
-// TODO static variable as timeout. Control extra_delay and timeout values consistency
-#define EXTRA_DELAY 0.01 // this extra delay provokes a probe timeout event if a probe will expires in less than EXTRA_DELAY seconds. Must be less than network->timeout.
+#include "broker.h"      // broker_client_fetch, broker_client_release
+#include "src_cache.h"   // src_cache_set_source
+#include "stateless.h"   // stateless_*
+#include "tracepoint.h"  // TRACEPOINT
 
 
 //---------------------------------------------------------------------------
 // Network options
 //---------------------------------------------------------------------------
 
-static double timeout[3] = OPTIONS_NETWORK_WAIT;
+static double timeout[3]  = OPTIONS_NETWORK_WAIT;
+static int    tag_bits[3] = OPTIONS_NETWORK_TAG_BITS;
+static double pps[3]        = OPTIONS_NETWORK_PPS;
+static double prefix_pps[3] = OPTIONS_NETWORK_PREFIX_PPS;
+static int    burst[3]      = OPTIONS_NETWORK_BURST;
+static int    detect_rate_limits = 0;
+static int    max_flying[3] = OPTIONS_NETWORK_MAX_FLYING;
+static double instance_pps[3] = OPTIONS_NETWORK_INSTANCE_PPS;
+static double min_timeout[3] = OPTIONS_NETWORK_MIN_WAIT;
+static struct opt_str capture_filename = {NULL, 0};
+static struct opt_str simulation_filename = {NULL, 0};
+static struct opt_str demux_path = {NULL, 0};
+static int    demux_tags[3] = OPTIONS_NETWORK_DEMUX_TAGS;
+static struct opt_str broker_path = {NULL, 0};
+static struct opt_str source = {NULL, 0};
+static double stats_interval[3] = OPTIONS_NETWORK_STATS;
+static int    seq_tags = 0;
+static int    do_profile = 0;
+static int    do_direct_dispatch = 0;
 
 static option_t network_options[] = {
-    // action              short long          metavar         help    variable
-    {opt_store_double_lim, "w",  "--wait",     "TIMEOUT",      HELP_w, timeout},
+    // action              short      long            metavar         help             variable
+    {opt_store_double_lim, "w",       "--wait",       "TIMEOUT",      HELP_w,          timeout},
+    {opt_store_int_lim,    OPT_NO_SF, "--tag-bits",   "BITS",         HELP_tag_bits,   tag_bits},
+    {opt_store_double_lim, OPT_NO_SF, "--pps",        "RATE",         HELP_pps,        pps},
+    {opt_store_double_lim, OPT_NO_SF, "--prefix-pps", "RATE",         HELP_prefix_pps, prefix_pps},
+    {opt_store_int_lim,    OPT_NO_SF, "--burst",      "PROBES",       HELP_burst,      burst},
+    {opt_store_1,          OPT_NO_SF, "--detect-rate-limits", OPT_NO_METAVAR, HELP_detect_rate_limits, &detect_rate_limits},
+    {opt_store_int_lim,    OPT_NO_SF, "--max-flying", "PROBES",       HELP_max_flying, max_flying},
+    {opt_store_double_lim, OPT_NO_SF, "--instance-pps", "RATE",       HELP_instance_pps, instance_pps},
+    {opt_store_double_lim, OPT_NO_SF, "--min-wait",   "MIN_TIMEOUT",  HELP_min_wait,   min_timeout},
+    {opt_store_str,        OPT_NO_SF, "--pcap",       "FILE",         HELP_pcap,       &capture_filename},
+    {opt_store_str,        OPT_NO_SF, "--simulate",   "TOPOLOGY",     HELP_simulate,   &simulation_filename},
+    {opt_store_str,        OPT_NO_SF, "--demux-client", "PATH",       HELP_demux,      &demux_path},
+    {opt_store_int_lim,    OPT_NO_SF, "--demux-tags", "NUM",          HELP_demux_tags, demux_tags},
+    {opt_store_str,        OPT_NO_SF, "--broker-client", "PATH",      HELP_broker,     &broker_path},
+    {opt_store_1,          OPT_NO_SF, "--seq-tags",   OPT_NO_METAVAR, HELP_seq_tags,   &seq_tags},
+    {opt_store_str,        OPT_NO_SF, "--source",     "ADDRESS",      HELP_source,     &source},
+    {opt_store_double_lim, OPT_NO_SF, "--stats",      "SECONDS",      HELP_stats,      stats_interval},
+    {opt_store_1,          OPT_NO_SF, "--profile",    OPT_NO_METAVAR, HELP_profile,    &do_profile},
+    {opt_store_1,          OPT_NO_SF, "--direct-dispatch", OPT_NO_METAVAR, HELP_direct_dispatch, &do_direct_dispatch},
     END_OPT_SPECS
 };
 
@@ -48,40 +91,301 @@ double options_network_get_timeout() {
     return timeout[0];
 }
 
+size_t options_network_get_tag_bits() {
+    return tag_bits[0];
+}
+
+double options_network_get_pps() {
+    return pps[0];
+}
+
+double options_network_get_prefix_pps() {
+    return prefix_pps[0];
+}
+
+size_t options_network_get_burst() {
+    return burst[0];
+}
+
+bool options_network_get_detect_rate_limits() {
+    return detect_rate_limits;
+}
+
+size_t options_network_get_max_flying() {
+    return max_flying[0];
+}
+
+double options_network_get_instance_pps() {
+    return instance_pps[0];
+}
+
+double options_network_get_min_timeout() {
+    return min_timeout[0];
+}
+
+const char * options_network_get_capture_filename() {
+    return capture_filename.s;
+}
+
+const char * options_network_get_simulation_filename() {
+    return simulation_filename.s;
+}
+
+const char * options_network_get_demux_path() {
+    return demux_path.s;
+}
+
+size_t options_network_get_demux_tags() {
+    return demux_tags[0];
+}
+
+const char * options_network_get_broker_path() {
+    return broker_path.s;
+}
+
+bool options_network_get_seq_tags() {
+    return seq_tags;
+}
+
+const char * options_network_get_source() {
+    return source.s;
+}
+
+double options_network_get_stats_interval() {
+    return stats_interval[0];
+}
+
+bool options_network_get_profile() {
+    return do_profile;
+}
+
+bool options_network_get_direct_dispatch() {
+    return do_direct_dispatch;
+}
+
 void network_set_is_verbose(network_t * network, bool verbose) {
      network->is_verbose = verbose;
 }
 
 void options_network_init(network_t * network, bool verbose)
 {
+    address_t source_address;
+    int       family;
+
     network_set_is_verbose(network, verbose);
     network_set_timeout(network, options_network_get_timeout());
+    if (!network_set_tag_bits(network, options_network_get_tag_bits())) {
+        fprintf(stderr, "Can't set the number of bits of the probe IDs\n");
+    }
+    if (!network_set_rate_limit_detection(network, options_network_get_detect_rate_limits())) {
+        fprintf(stderr, "Can't detect the rate limits\n");
+    }
+    if (!network_set_pacing(network, options_network_get_pps(), options_network_get_prefix_pps(), options_network_get_burst())) {
+        fprintf(stderr, "Can't pace the probes\n");
+    }
+    if (!network_set_max_flying(network, options_network_get_max_flying())) {
+        fprintf(stderr, "Can't bound the number of probes in transit\n");
+    }
+    if (!network_set_instance_pacing(network, options_network_get_instance_pps(), options_network_get_burst())) {
+        fprintf(stderr, "Can't pace the instances\n");
+    }
+    if (!network_set_adaptive_timeout(network, options_network_get_min_timeout())) {
+        fprintf(stderr, "Can't adapt the probe timeouts\n");
+    }
+    if (options_network_get_capture_filename()
+    && !network_set_capture(network, options_network_get_capture_filename())) {
+        fprintf(stderr, "Can't record the packets\n");
+    }
+    if (options_network_get_source()
+    && !(address_guess_family(options_network_get_source(), &family)
+        && address_from_string(family, options_network_get_source(), &source_address) == 0
+        && src_cache_set_source(&source_address))) {
+        fprintf(stderr, "Can't set the source address\n");
+    }
+    if (!network_set_stats_interval(network, options_network_get_stats_interval())) {
+        fprintf(stderr, "Can't print the network statistics\n");
+    }
 }
 
 //---------------------------------------------------------------------------
 // Private functions
 //---------------------------------------------------------------------------
 
+/**
+ * \brief Check whether a probe carries its tag in its TCP sequence number
+ *    (see network->has_seq_tags).
+ * \param network The network layer
+ * \param probe The probe.
+ * \return true iif this is a TCP probe tagged in its sequence number.
+ */
+
+static bool network_has_seq_tag(const network_t * network, const probe_t * probe)
+{
+    const layer_t * layer;
+
+    return network->has_seq_tags
+        && (layer = probe_get_layer(probe, 1))
+        && layer->protocol
+        && layer->protocol->protocol == IPPROTO_TCP;
+}
+
+/**
+ * \brief Retrieve the number of bits of the tag that can be carried by a probe.
+ * \param network The network layer
+ * \param probe The probe to tag
+ * \return The number of bits of its tag. Only IPv4 probes may carry
+ *    more than 16 bits in their IP identification, unless they are tagged
+ *    in their TCP sequence number.
+ */
+
+static size_t network_get_probe_tag_bits(const network_t * network, const probe_t * probe)
+{
+    const layer_t * layer;
+    size_t          tag_bits = network_get_tag_bits(network);
+
+    if (tag_bits > 16) {
+        if (!(layer = probe_get_layer(probe, 0))
+        ||  !layer->protocol
+        ||  strcmp(layer->protocol->name, "ipv4") != 0
+        ||  network_has_seq_tag(network, probe)) {
+            tag_bits = 16;
+        }
+    }
+
+    return tag_bits;
+}
+
+/**
+ * \brief Extract the probe ID (tag) from a protocol stack (see network_extract_tag).
+ * \param network The network layer
+ * \param stack The stack of a probe, or the stack quoted in a reply.
+ * \param ptag Address of an uint32_t in which we will write the tag
+ * \return true iif successful
+ */
+
+static bool network_extract_stack_tag(const network_t * network, const protocol_stack_t * stack, uint32_t * ptag)
+{
+    uint16_t checksum, identification;
+    uint32_t seq_num;
+
+    // The tag of a TCP probe is read in the upper 16 bits of its sequence number
+    if (network->has_seq_tags && protocol_stack_is_tcp(stack)) {
+        if (!protocol_stack_get_seq_num(stack, &seq_num)) return false;
+        *ptag = seq_num >> 16;
+        return true;
+    }
+
+    if (!protocol_stack_get_checksum(stack, &checksum)) return false;
+    *ptag = checksum;
+
+    if (network_get_tag_bits(network) > 16
+    &&  protocol_stack_get_identification(stack, &identification)
+    &&  identification > 0) {
+        *ptag |= (uint32_t) (identification - 1) << 16;
+    }
+
+    return true;
+}
+
+/**
+ * \brief Extract the probe ID (tag) from a TCP segment sent by the
+ *    destination of a probe tagged in its sequence number (see
+ *    network->has_seq_tags). A SYN/ACK, or a RST answering a SYN,
+ *    acknowledges the sequence number of the probe (plus its SYN flag and
+ *    its payload). A RST answering an ACK takes its sequence number from
+ *    the acknowledgment number of the probe (see probe_write_seq_tag).
+ * \param segment The stack of the segment (see protocol_stack_from_tcp_reply).
+ * \param ptag Address of an uint32_t in which we will write the tag
+ * \return true iif successful
+ */
+
+static bool network_extract_segment_tag(const protocol_stack_t * segment, uint32_t * ptag)
+{
+    uint32_t number;
+
+    if (!protocol_stack_get_ack_num(segment, &number)
+    &&  !protocol_stack_get_seq_num(segment, &number)) {
+        return false;
+    }
+    *ptag = number >> 16;
+    return true;
+}
+
+/**
+ * \brief Extract the probe ID (tag) from a probe or from a reply. The lower
+ *    16 bits are stored in a checksum. If the network uses tags wider than
+ *    16 bits, the upper bits are stored in the IP identification (shifted
+ *    by one, since the kernel overwrites a null identification). The tag of
+ *    a TCP probe may be stored in its sequence number instead (see
+ *    network->has_seq_tags).
+ * \param network The network layer
+ * \param probe The queried probe
+ * \param depth The depth of the IP layer related to the tag.
+ * \param ptag Address of an uint32_t in which we will write the tag
+ * \return true iif successful
+ */
+
+static bool network_extract_tag(const network_t * network, const probe_t * probe, size_t depth, uint32_t * ptag)
+{
+    uint16_t         checksum, identification;
+    uint32_t         seq_num;
+    protocol_stack_t stack, quoted;
+
+    // Fast path: the tag is read at a fixed offset
+    if (depth == 0 ?
+        protocol_stack_from_probe(&stack, probe) && network_extract_stack_tag(network, &stack, ptag) :
+        protocol_stack_from_reply(&stack, &quoted, probe) && network_extract_stack_tag(network, &quoted, ptag)
+    ) {
+        return true;
+    }
+
+    if (network->has_seq_tags) {
+        if (depth > 0
+        &&  protocol_stack_from_tcp_reply(&stack, probe)
+        &&  network_extract_segment_tag(&stack, ptag)) {
+            return true;
+        }
+        if ((depth > 0 || network_has_seq_tag(network, probe))
+        &&  probe_extract_ext(probe, "seq_num", depth + 1, &seq_num)) {
+            *ptag = seq_num >> 16;
+            return true;
+        }
+    }
+
+    if (!probe_extract_ext(probe, "checksum", depth + 1, &checksum)) return false;
+    *ptag = checksum;
+
+    if (network_get_tag_bits(network) > 16
+    &&  probe_extract_ext(probe, "identification", depth, &identification)
+    &&  identification > 0) {
+        *ptag |= (uint32_t) (identification - 1) << 16;
+    }
+
+    return true;
+}
+
 /**
  * \brief Extract the probe ID (tag) from a probe
+ * \param network The network layer
  * \param probe The queried probe
- * \param ptag_probe Address of an uint16_t in which we will write the tag
+ * \param ptag_probe Address of an uint32_t in which we will write the tag
  * \return true iif successful
  */
 
-static inline bool probe_extract_tag(const probe_t * probe, uint16_t * ptag_probe) {
-    return probe_extract_ext(probe, "checksum", 1, ptag_probe);
+static inline bool probe_extract_tag(const network_t * network, const probe_t * probe, uint32_t * ptag_probe) {
+    return network_extract_tag(network, probe, 0, ptag_probe);
 }
 
 /**
- * \brief Extract the probe ID (tag) from a reply
+ * \brief Extract the probe ID (tag) from a reply.
+ * \param network The network layer
  * \param reply The queried reply
- * \param ptag_reply Address of the uint16_t in which the tag is written
+ * \param ptag_reply Address of the uint32_t in which the tag is written
  * \return true iif successful
  */
 
-static inline bool reply_extract_tag(const probe_t * reply, uint16_t * ptag_reply) {
-    return probe_extract_ext(reply, "checksum", 3, ptag_reply);
+static inline bool reply_extract_tag(const network_t * network, const probe_t * reply, uint32_t * ptag_reply) {
+    return network_extract_tag(network, reply, 2, ptag_reply);
 }
 
 /**
@@ -91,6 +395,29 @@ static inline bool reply_extract_tag(const probe_t * reply, uint16_t * ptag_repl
  * \return true iif successful
  */
 
+/**
+ * \brief Retrieve the tag of a probe, as reported by the tracepoints.
+ * \param network The network layer.
+ * \param probe A probe_t instance.
+ * \return The tag of the probe, 0 if it cannot be extracted.
+ */
+
+static inline uint32_t probe_get_traced_tag(const network_t * network, const probe_t * probe) {
+    uint32_t tag = 0;
+    return probe_extract_tag(network, probe, &tag) ? tag : 0;
+}
+
+/**
+ * \brief Retrieve the ID of the algorithm instance which has created a
+ *    probe, as reported by the tracepoints.
+ * \param probe A probe_t instance.
+ * \return The ID of its caller, 0 if unknown.
+ */
+
+static inline unsigned int probe_get_traced_instance_id(const probe_t * probe) {
+    return probe->caller ? ((const algorithm_instance_t *) probe->caller)->id : 0;
+}
+
 static bool probe_set_tag(probe_t * probe, uint16_t tag_probe) {
     bool      ret = false;
     field_t * field;
@@ -103,24 +430,176 @@ static bool probe_set_tag(probe_t * probe, uint16_t tag_probe) {
     return ret;
 }
 
+static bool network_process_packet(network_t * network, packet_t * packet, reply_class_t reply_class);
+
+/**
+ * \brief Record a probe or a reply in network->capture.
+ * \param network The network layer
+ * \param packet The probe or the reply.
+ * \param time Its sending or receive time.
+ * \param direction CAPTURE_OUTBOUND for a probe, CAPTURE_INBOUND for a reply.
+ * \param probe The probe related to this packet (the packet itself for
+ *    a probe), NULL if it is a reply to a stateless probe or an unmatched reply.
+ * \param caller The instance related to this packet, NULL if unmatched.
+ */
+
+static void network_capture(
+    network_t           * network,
+    const probe_t       * packet,
+    uint64_t              time,
+    capture_direction_t   direction,
+    const probe_t       * probe,
+    const void          * caller
+) {
+    char     comment[64];
+    uint32_t tag;
+    uint8_t  instance_id;
+    size_t   depth = direction == CAPTURE_OUTBOUND ? 0 : 2;
+    int      length = 0;
+
+    if (direction == CAPTURE_INBOUND && !caller) {
+        length = snprintf(comment, sizeof(comment), "unmatched");
+        if (reply_extract_tag(network, packet, &tag)) {
+            snprintf(comment + length, sizeof(comment) - length, " tag=%u", tag);
+        }
+    } else {
+        if (!probe && stateless_extract_instance_id(packet, depth, &instance_id)) {
+            length = snprintf(comment, sizeof(comment), "stateless=%u ", instance_id);
+        } else if (probe && probe_extract_tag(network, probe, &tag)) {
+            length = snprintf(comment, sizeof(comment), "tag=%u ", tag);
+        }
+        if (caller) {
+            length += snprintf(comment + length, sizeof(comment) - length, "instance=%u",
+                ((const algorithm_instance_t *) caller)->id
+            );
+        }
+        if (length > 0 && comment[length - 1] == ' ') length--;
+        comment[length] = '\0';
+    }
+
+    capture_write_packet(
+        network->capture,
+        packet_get_bytes(packet->packet),
+        packet_get_size(packet->packet),
+        time,
+        direction,
+        comment
+    );
+}
+
 /**
  * \brief Handler called by the sniffer to allow the network layer
- *    to process sniffed packets.
+ *    to process sniffed packets. The packets are pushed in network->recvq,
+ *    except borrowed packets (e.g. referencing a frame of a capture ring)
+ *    which are processed right now since their bytes are only valid
+ *    until this function returns.
+ * \param packets The sniffed packets
+ * \param num_packets The number of sniffed packets
  * \param network The network layer
- * \param packet The sniffed packet
  */
 
-static bool network_sniffer_callback(packet_t * packet, void * recvq) {
-    return queue_push_element((queue_t *) recvq, packet);
+static bool network_sniffer_callback(packet_t ** packets, size_t num_packets, void * network) {
+    size_t i, num_queued = 0;
+
+    for (i = 0; i < num_packets; i++) {
+        if (packet_is_borrowed(packets[i])) {
+            network_process_packet(
+                (network_t *) network, packets[i],
+                reply_classify_bytes(packet_get_bytes(packets[i]), packet_get_size(packets[i]))
+            );
+        } else {
+            packets[num_queued++] = packets[i];
+        }
+    }
+
+    if (num_queued == 0) return true;
+
+    // The packets which do not fit in a full recvq are processed right now
+    i = queue_push_elements(((network_t *) network)->recvq, (void **) packets, num_queued);
+    for (; i < num_queued; i++) {
+        network_process_packet(
+            (network_t *) network, packets[i],
+            reply_classify_bytes(packet_get_bytes(packets[i]), packet_get_size(packets[i]))
+        );
+    }
+    return true;
 }
 
 /**
  * \brief Retrieve a tag (probe ID) not yet used.
- * \return An available tag
+ * \param network The network layer
+ * \param tag_bits The number of bits of the tag.
+ * \param ptag Address of an uint32_t in which the tag is written.
+ * \return true iif successful, false if every tag is in use.
+ */
+
+static bool network_get_available_tag(network_t * network, size_t tag_bits, uint32_t * ptag) {
+    return tag_allocator_get_tag(network->tags, tag_bits, ptag);
+}
+
+/**
+ * \brief Release the tag (probe ID) of a probe which is not in transit.
+ * \param network The network layer
+ * \param probe A tagged probe.
+ */
+
+static void network_release_probe_tag(network_t * network, const probe_t * probe) {
+    uint32_t tag;
+
+    if (probe_extract_tag(network, probe, &tag)) {
+        tag_allocator_release_tag(network->tags, tag);
+    }
+}
+
+/**
+ * \brief Retrieve the stateless instance related to a probe or to a reply
+ *    (see network_add_stateless_caller).
+ * \param network The network layer
+ * \param packet The probe or the reply.
+ * \param depth The depth of the IP layer carrying the instance ID (0 for
+ *    a probe, 2 for a reply).
+ * \return The corresponding instance, NULL if the packet is not related
+ *    to a stateless probe.
+ */
+
+static void * network_get_stateless_caller(const network_t * network, const probe_t * packet, size_t depth) {
+    uint8_t instance_id;
+
+    if (network->num_stateless_callers == 0
+    || !stateless_extract_instance_id(packet, depth, &instance_id)) {
+        return NULL;
+    }
+    return network->stateless_callers[instance_id];
+}
+
+/**
+ * \brief Check whether a probe is a stateless probe.
+ * \param network The network layer
+ * \param probe The probe.
+ * \return true iif the probe has been sent by a stateless instance and
+ *    carries its instance ID.
+ */
+
+static bool network_is_stateless_probe(const network_t * network, const probe_t * probe) {
+    void * caller = network_get_stateless_caller(network, probe, 0);
+    return caller && caller == probe->caller;
+}
+
+/**
+ * \brief Release a probe which is not in transit. A stateless probe is
+ *    given back to its caller (see PROBE_SENT), otherwise its tag and the
+ *    reference of the network layer are released.
+ * \param network The network layer
+ * \param probe The probe.
  */
 
-static uint16_t network_get_available_tag(network_t * network) {
-    return ++network->last_tag;
+static void network_release_probe(network_t * network, probe_t * probe) {
+    if (network_is_stateless_probe(network, probe)) {
+        pt_throw(NULL, probe->caller, event_create(PROBE_SENT, probe, NULL, NULL));
+    } else {
+        network_release_probe_tag(network, probe);
+        probe_free(probe);
+    }
 }
 
 /**
@@ -129,41 +608,163 @@ static uint16_t network_get_available_tag(network_t * network) {
  */
 
 static void network_flying_probes_dump(network_t * network) {
-    size_t     i, num_flying_probes = dynarray_get_size(network->probes);
-    uint16_t   tag_probe;
-    probe_t  * probe;
+    flying_probe_t * flying_probe;
 
-    printf("\n%u flying probe(s) :\n", (unsigned int)num_flying_probes);
-    for (i = 0; i < num_flying_probes; i++) {
-        probe = dynarray_get_ith_element(network->probes, i);
-        probe_extract_tag(probe, &tag_probe) ?
-            printf(" 0x%x", tag_probe):
-            printf(" (invalid tag)");
-        printf("\n");
+    printf("\n%u flying probe(s) :\n", (unsigned int) network->num_flying_probes);
+    for (flying_probe = network->oldest_probe; flying_probe; flying_probe = flying_probe->younger) {
+        printf(" 0x%x\n", flying_probe->tag);
     }
 }
 
 /**
- * \brief Get the oldest probe in network
- * \param network Pointer to network instance
- * \return A pointer to oldest probe if any, NULL otherwise
+ * \brief Retrieve the bucket of network->buckets related to a given tag.
+ * \param network The network layer
+ * \param tag A tag (host-side endianness)
+ * \return The address of the head of the corresponding bucket
+ */
+
+static inline flying_probe_t ** network_get_bucket(network_t * network, uint32_t tag) {
+    return &network->buckets[tag & (NETWORK_NUM_BUCKETS - 1)];
+}
+
+#ifdef USE_TIMESTAMPING
+/**
+ * \brief Retrieve the slot of network->tx_pending related to a given
+ *    transmit timestamp key.
+ * \param network The network layer
+ * \param tx_key A key (its family must not be AF_UNSPEC).
+ * \return The address of the corresponding slot
+ */
+
+static inline flying_probe_t ** network_get_tx_slot(network_t * network, const socketpool_tx_key_t * tx_key) {
+    return &network->tx_pending[
+        (tx_key->key ^ (tx_key->family == AF_INET6 ? NETWORK_NUM_TX_KEYS / 2 : 0)) & (NETWORK_NUM_TX_KEYS - 1)
+    ];
+}
+#endif
+
+/**
+ * \brief Register a probe which has just been sent in network->buckets,
+ *    in the list of flying probes and in network->timeouts.
+ * \param network The network layer
+ * \param probe The probe in transit. It must be already tagged and its
+ *    sending time must be set.
+ * \param tx_key Identifies the transmit timestamps of this probe.
+ * \return true iif successful
  */
 
-static probe_t * network_get_oldest_probe(const network_t * network) {
-    return dynarray_get_ith_element(network->probes, 0);
+static bool network_flying_probe_add(network_t * network, probe_t * probe, const socketpool_tx_key_t * tx_key)
+{
+    flying_probe_t  * flying_probe;
+    flying_probe_t ** pbucket;
+    double            timeout = network_get_timeout(network);
+    address_t         dst;
+
+    if (!(flying_probe = malloc(sizeof(flying_probe_t)))) goto ERR_MALLOC;
+    if (!probe_extract_tag(network, probe, &flying_probe->tag)) goto ERR_EXTRACT_TAG;
+    flying_probe->probe = probe;
+    flying_probe->has_key = false;
+
+    // Index this probe by tag
+    pbucket = network_get_bucket(network, flying_probe->tag);
+    flying_probe->bucket_next = *pbucket;
+    *pbucket = flying_probe;
+
+    // This probe is the youngest one
+    flying_probe->older   = network->youngest_probe;
+    flying_probe->younger = NULL;
+    if (network->youngest_probe) {
+        network->youngest_probe->younger = flying_probe;
+    } else {
+        network->oldest_probe = flying_probe;
+    }
+    network->youngest_probe = flying_probe;
+
+    // Schedule its timeout. If the wheel is empty, it may not have been
+    // advanced for a while: synchronize it (no timer can expire).
+    if (network->num_flying_probes == 0) {
+        timing_wheel_advance(network->timeouts, NS_TO_SECONDS(probe_get_sending_time(probe)), NULL, NULL);
+    }
+    if (network->rtt_estimator) {
+        memset(&dst, 0, sizeof(address_t));
+        probe_extract(probe, "dst_ip", &dst);
+        timeout = rtt_estimator_get_timeout(network->rtt_estimator, &dst);
+    }
+    wheel_timer_init(&flying_probe->timer, flying_probe);
+    timing_wheel_add(
+        network->timeouts,
+        &flying_probe->timer,
+        NS_TO_SECONDS(probe_get_sending_time(probe)) + timeout
+    );
+
+#ifdef USE_TIMESTAMPING
+    // Wait for its transmit timestamp. If the slot is still used, the
+    // kernel has not reported the timestamp of the previous probe: this
+    // probe keeps its current sending time.
+    flying_probe->tx_key = *tx_key;
+    if (tx_key->family != AF_UNSPEC) {
+        *network_get_tx_slot(network, tx_key) = flying_probe;
+    }
+#endif
+
+    network->num_flying_probes++;
+    return true;
+
+ERR_EXTRACT_TAG:
+    free(flying_probe);
+ERR_MALLOC:
+    return false;
 }
 
 /**
- * \brief Compute when a probe expires
+ * \brief Unregister a flying probe from network->buckets, from the list of
+ *    flying probes and from network->timeouts, and release the corresponding
+ *    flying_probe_t instance. The probe_t instance is not released.
  * \param network The network layer
- * \param probe A probe instance. Its sending time must be set.
- * \return The timeout of the probe. This value may be negative. If so,
- *    it means that this probe has already expired and a PROBE_TIMEOUT
- *    should be raised.
+ * \param flying_probe The flying_probe_t instance to remove.
  */
 
-static double network_get_probe_timeout(const network_t * network, const probe_t * probe) {
-    return network_get_timeout(network) - (get_timestamp() - probe_get_sending_time(probe));
+static void network_flying_probe_del(network_t * network, flying_probe_t * flying_probe)
+{
+    flying_probe_t ** pcur;
+
+    for (pcur = network_get_bucket(network, flying_probe->tag); *pcur; pcur = &(*pcur)->bucket_next) {
+        if (*pcur == flying_probe) {
+            *pcur = flying_probe->bucket_next;
+            break;
+        }
+    }
+
+    if (flying_probe->older) {
+        flying_probe->older->younger = flying_probe->younger;
+    } else {
+        network->oldest_probe = flying_probe->younger;
+    }
+
+    if (flying_probe->younger) {
+        flying_probe->younger->older = flying_probe->older;
+    } else {
+        network->youngest_probe = flying_probe->older;
+    }
+
+#ifdef USE_TIMESTAMPING
+    if (flying_probe->tx_key.family != AF_UNSPEC) {
+        pcur = network_get_tx_slot(network, &flying_probe->tx_key);
+        if (*pcur == flying_probe) *pcur = NULL;
+    }
+#endif
+
+    timing_wheel_del(network->timeouts, &flying_probe->timer);
+    tag_allocator_release_tag(network->tags, flying_probe->tag);
+    network->num_flying_probes--;
+    free(flying_probe);
+
+    // A slot is freed: the held probes and the waiting callers are served
+    // by network_process_sendq, once the replies have been processed
+    if (network->max_flying_probes
+    && (fair_queue_get_size(network->held_probes) || dynarray_get_size(network->waiting_callers))) {
+        eventfd_write(queue_get_fd(network->sendq), 1);
+    }
 }
 
 /**
@@ -176,7 +777,7 @@ static void itimerspec_set_delay(struct itimerspec * timer, double delay) {
     time_t delay_sec = (time_t) delay;
 
     timer->it_value.tv_sec     = delay_sec;
-    timer->it_value.tv_nsec    = 1000000 * (delay - delay_sec);
+    timer->it_value.tv_nsec    = 1000000000 * (delay - delay_sec);
     timer->it_interval.tv_sec  = 0;
     timer->it_interval.tv_nsec = 0;
 }
@@ -184,7 +785,7 @@ static void itimerspec_set_delay(struct itimerspec * timer, double delay) {
 /**
  * \brief Update a timer in order to expire at a given moment .
  * \param timerfd The file descriptor related to the timer.
- * \param delay The delay (in micro seconds).
+ * \param delay The delay (in seconds). 0 disarms the timer.
  * \return true iif successful.
  */
 
@@ -207,23 +808,35 @@ ERR_INVALID_DELAY:
 
 /**
  * \brief Update network->timerfd file descriptor to make it activated
- *   if a timeout occurs for oldest probe.
+ *   when the next tick of network->timeouts must be processed. The
+ *   timer is only updated if this tick has changed.
  * \param network The updated network layer.
  * \return true iif successful
  */
 
 static bool network_update_next_timeout(network_t * network)
 {
-    probe_t * probe;
-    double    next_timeout;
-
-    if ((probe = network_get_oldest_probe(network))) {
-        next_timeout = network_get_probe_timeout(network, probe);
-    } else {
-        // The timer will be disarmed since there is no more flying probes
-        next_timeout = 0;
+    uint64_t tick;
+    double   delay;
+
+    if (!timing_wheel_get_next_tick(network->timeouts, &tick)) {
+        // The timer is disarmed since there is no more flying probes
+        if (!network->is_armed) return true;
+        network->is_armed = false;
+        return update_timer(network->timerfd, 0);
     }
-    return update_timer(network->timerfd, next_timeout);
+
+    // The timer is already armed for this tick
+    if (network->is_armed && network->armed_tick == tick) return true;
+
+    // This tick may be already reached. A null delay would disarm the
+    // timer, so we make it expire as soon as possible.
+    delay = timing_wheel_get_tick_time(network->timeouts, tick) - NS_TO_SECONDS(get_time_ns());
+    if (delay < NETWORK_TIMER_TICK / 1000) delay = NETWORK_TIMER_TICK / 1000;
+
+    network->armed_tick = tick;
+    network->is_armed   = true;
+    return update_timer(network->timerfd, delay);
 }
 
 /**
@@ -247,17 +860,17 @@ bool probe_match(const probe_t * probe, const probe_t * reply)
 }
 */
 
-bool probe_match(const struct probe_s * probe, const struct probe_s * reply)
+bool probe_match(const probe_t * probe, const match_key_t * probe_key, const match_key_t * reply_key)
 {
-    size_t    num_layers       = probe_get_num_layers((const probe_t *)probe);
+    size_t    num_layers       = probe_get_num_layers(probe);
     size_t    i                = 0;
     layer_t * layer_to_analyse = NULL;
 
     for (i = 0; i < num_layers - 1; i++)
     {
-        layer_to_analyse = probe_get_layer((const probe_t *)probe, i);
+        layer_to_analyse = probe_get_layer(probe, i);
         if (layer_to_analyse->protocol->matches != NULL) {
-            if (!layer_to_analyse->protocol->matches(probe, reply)) {
+            if (!layer_to_analyse->protocol->matches(probe_key, reply_key)) {
                 return false;
             }
         } else {
@@ -267,7 +880,72 @@ bool probe_match(const struct probe_s * probe, const struct probe_s * reply)
     return true;
 }
 
-static probe_t * network_get_matching_probe(network_t * network, const probe_t * reply)
+/**
+ * \brief The data passed to network_recent_probe_matches.
+ */
+
+typedef struct {
+    const probe_t          * reply;     /**< The reply */
+    const protocol_stack_t * stacks;    /**< Its stacks (see network_probe_matches) */
+    match_key_t              reply_key; /**< Its key, extracted on demand (see network_probe_matches) */
+    bool                     has_reply_key; /**< true iif reply_key has been extracted */
+} network_match_ctx_t;
+
+/**
+ * \brief Check whether a reply has been provoked by a probe.
+ * \param probe The probe.
+ * \param probe_key The key of the probe. It is extracted on demand.
+ * \param phas_probe_key Address of a bool telling whether probe_key has
+ *    been extracted, updated accordingly.
+ * \param ctx The reply, its stacks (see protocol_stack_from_reply), NULL if
+ *    the reply does not belong to a common stack, and its key, extracted
+ *    on demand.
+ * \return true iif the reply matches the probe.
+ */
+
+static bool network_probe_matches(const probe_t * probe, match_key_t * probe_key, bool * phas_probe_key, network_match_ctx_t * ctx)
+{
+    protocol_stack_t probe_stack;
+    bool             matches;
+
+    if (ctx->stacks
+    &&  protocol_stack_from_probe(&probe_stack, probe)
+    &&  protocol_stack_matches(&probe_stack, &ctx->stacks[0], &ctx->stacks[1], &matches)) {
+        return matches;
+    }
+
+    // Each key is extracted once, however many probes the reply is compared to
+    if (!ctx->has_reply_key) {
+        match_key_from_probe(&ctx->reply_key, ctx->reply);
+        ctx->has_reply_key = true;
+    }
+    if (!*phas_probe_key) {
+        match_key_from_probe(probe_key, probe);
+        *phas_probe_key = true;
+    }
+    return probe_match(probe, probe_key, &ctx->reply_key);
+}
+
+static bool network_recent_probe_matches(const probe_t * probe, void * data)
+{
+    match_key_t probe_key;
+    bool        has_probe_key = false;
+
+    return network_probe_matches(probe, &probe_key, &has_probe_key, data);
+}
+
+/**
+ * \brief Find the probe in transit matched by a reply, and unregister it.
+ * \param network The network layer.
+ * \param reply The reply.
+ * \param precent Set to the entry of network->recent_probes matched by
+ *    the reply if it matches no probe in transit (duplicate or late
+ *    reply), NULL otherwise.
+ * \return The matched probe (the reference held by the network layer is
+ *    passed to the caller), NULL if none.
+ */
+
+static probe_t * network_get_matching_probe(network_t * network, const probe_t * reply, recent_probe_t ** precent)
 {
 
     // Suppose we perform a traceroute measurement thanks to IPv4/UDP packet
@@ -277,47 +955,69 @@ static probe_t * network_get_matching_probe(network_t * network, const probe_t *
     // retrieve the checksum (= our probe ID) of the second IP layer, which
     // corresponds to the 3rd checksum field of our probe.
 
-    uint16_t   tag_probe, tag_reply;
-    probe_t  * probe;
-    size_t     i, num_flying_probes;
+    uint32_t                 tag_reply = 0;
+    probe_t                * probe;
+    flying_probe_t         * flying_probe = NULL;
+    protocol_stack_t         reply_stacks[2];
+    const protocol_stack_t * stacks;
+    network_match_ctx_t      ctx;
+    bool                     has_tag, is_segment;
+
+    *precent = NULL;
+
+    // Most replies are ICMP errors quoting a common stack: they are not dissected.
+    stacks = protocol_stack_from_reply(&reply_stacks[0], &reply_stacks[1], reply) ? reply_stacks : NULL;
+
+    // A SYN/ACK or a RST sent by the destination is matched as if it
+    // quoted the probe it answers (see protocol_stack_matches).
+    is_segment = false;
+    if (!stacks && network->has_seq_tags && protocol_stack_from_tcp_reply(&reply_stacks[0], reply)) {
+        reply_stacks[1] = reply_stacks[0];
+        stacks = reply_stacks;
+        is_segment = true;
+    }
 
-    // XXX
-    /*
-    // Fetch the tag from the reply. Its the 3rd checksum field.
-    if (!(reply_extract_tag(reply, &tag_reply))) {
-        // This is not an IP / ICMP / IP / * reply :(
-        if (network->is_verbose) fprintf(stderr, "Can't retrieve tag from reply\n");
-        return NULL;
+    ctx.reply         = reply;
+    ctx.stacks        = stacks;
+    ctx.has_reply_key = false;
+
+    // Fetch the tag from the reply. Its the 3rd checksum field. The tag only
+    // narrows the set of candidates (the quoted packet may have been altered
+    // by a middlebox), so each candidate is still checked by probe_match.
+    has_tag = is_segment ?
+        network_extract_segment_tag(&stacks[0], &tag_reply) :
+        (stacks && network_extract_stack_tag(network, &stacks[1], &tag_reply))
+        || reply_extract_tag(network, reply, &tag_reply);
+    if (has_tag) {
+        for (flying_probe = *network_get_bucket(network, tag_reply); flying_probe; flying_probe = flying_probe->bucket_next) {
+            if (flying_probe->tag == tag_reply
+            &&  network_probe_matches(flying_probe->probe, &flying_probe->key, &flying_probe->has_key, &ctx)) {
+                break;
+            }
+        }
     }
 
-    num_flying_probes = dynarray_get_size(network->probes);
-    for (i = 0; i < num_flying_probes; i++) {
-        probe = dynarray_get_ith_element(network->probes, i);
+    // A duplicate or a late reply is classified without scanning every
+    // probe in transit.
+    if (!flying_probe && has_tag) {
+        if ((*precent = recent_probes_find(network->recent_probes, tag_reply, get_time_ns(), network_recent_probe_matches, &ctx))) {
+            return NULL;
+        }
+    }
 
-        // Reply / probe comparison. In our probe packet, the probe ID
-        // is stored in the checksum of the (first) IP layer.
-        if (probe_extract_tag(probe, &tag_probe)) {
-            if (tag_reply == tag_probe) break;
+    // This is not an IP / ICMP / IP / * reply (e.g. an ICMP echo reply), or
+    // the quoted packet has been altered: fall back on a linear scan.
+    if (!flying_probe) {
+        for (flying_probe = network->oldest_probe; flying_probe; flying_probe = flying_probe->younger) {
+            if (network_probe_matches(flying_probe->probe, &flying_probe->key, &flying_probe->has_key, &ctx)) {
+                break;
+            }
         }
     }
-    */
 
-    // XXX BEGIN Harcoded ICMP response (JA 17/07/2014)
-    tag_reply = 0; tag_probe = 0; tag_probe++; tag_reply++;
-
-    num_flying_probes = dynarray_get_size(network->probes);
-    for (i = 0; i < num_flying_probes; i++) {
-        probe = dynarray_get_ith_element(network->probes, i);
-
-        // Reply / probe comparison. In our probe packet, the probe ID
-        // is stored in the checksum of the (first) IP layer.
-        if (probe_match((const struct probe_s *)probe, (const struct probe_s *)reply))
-            break;
-    }
-    // XXX END Hardcoded ICMP response
-
-    // No match found if we reached the end of the array
-    if (i == num_flying_probes) {
+    // No match found
+    if (!flying_probe) {
+        TRACEPOINT(reply_unmatched, reply, tag_reply, probe_get_recv_time(reply));
         if (network->is_verbose) {
             fprintf(stderr, "network_get_matching_probe: This reply has been discarded: tag = 0x%x.\n", tag_reply);
             network_flying_probes_dump(network);
@@ -325,23 +1025,19 @@ static probe_t * network_get_matching_probe(network_t * network, const probe_t *
         return NULL;
     }
 
-    // We delete the corresponding probe
-
-    // TODO: ... but it should be kept, for archive purposes, and to match for duplicates...
-    // But we cannot reenable it until we set the probe ID into the
-    // checksum, since probes with same flow_id and different TTL have the
-    // same checksum
-
-    dynarray_del_ith_element(network->probes, i, NULL);
-
-    // The matching probe is the oldest one and there are other probes, update
-    // the timer according to the next unexpired probe timeout.
-    if (i == 0) {
-        if (!(network_update_next_timeout(network))) {
-            fprintf(stderr, "Error while updating timeout\n");
-        }
-    }
-
+    // We delete the corresponding probe, which is kept a while in
+    // network->recent_probes to classify its next replies.
+    // Its timer is removed from network->timeouts. network->timerfd is not
+    // updated: if it is activated for nothing, the next tick is rescheduled.
+    probe = flying_probe->probe;
+    TRACEPOINT(
+        probe_matched, probe, flying_probe->tag,
+        probe_get_traced_instance_id(probe),
+        probe_get_sending_time(probe),
+        probe_get_recv_time(reply)
+    );
+    recent_probes_add(network->recent_probes, probe, flying_probe->tag, RECENT_PROBE_MATCHED, get_time_ns());
+    network_flying_probe_del(network, flying_probe);
     return probe;
 }
 
@@ -352,52 +1048,164 @@ static probe_t * network_get_matching_probe(network_t * network, const probe_t *
 network_t * network_create()
 {
     network_t * network;
+    uint32_t    first_tag, last_tag;
 
     if (!(network = malloc(sizeof(network_t))))          goto ERR_NETWORK;
-    if (!(network->socketpool   = socketpool_create()))  goto ERR_SOCKETPOOL;
+
+    // The probes are either sent through raw sockets or through a
+    // simulated network (see simulator.h)
+    network->socketpool = NULL;
+    network->sniffer    = NULL;
+    network->simulator  = NULL;
+    network->demux      = NULL;
+    network->has_seq_tags = options_network_get_seq_tags();
+    if (network->has_seq_tags && options_network_get_demux_path()) {
+        // The demultiplexer routes the replies according to their checksum
+        fprintf(stderr, "network_create: --seq-tags cannot be combined with --demux-client\n");
+        goto ERR_BROKER_CLIENT_FETCH;
+    }
+    if (options_network_get_broker_path()
+    &&  !options_network_get_simulation_filename()
+    &&  !broker_client_fetch(options_network_get_broker_path(), network->has_seq_tags)) goto ERR_BROKER_CLIENT_FETCH;
+    if (!options_network_get_simulation_filename()
+    &&  !(network->socketpool = socketpool_create()))    goto ERR_SOCKETPOOL;
     if (!(network->sendq        = queue_create()))       goto ERR_SENDQ;
     if (!(network->recvq        = queue_create()))       goto ERR_RECVQ;
 
-    if ((network->timerfd = timerfd_create(CLOCK_REALTIME, 0)) == -1) {
+    if ((network->timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) == -1) {
         goto ERR_TIMERFD;
     }
 
+    if (!(network->timeouts = timing_wheel_create(NETWORK_TIMER_TICK, NS_TO_SECONDS(get_time_ns())))) {
+        goto ERR_TIMEOUTS;
+    }
+
+    if (!(network->tags = tag_allocator_create(NETWORK_DEFAULT_TAG_BITS))) {
+        goto ERR_TAGS;
+    }
+
+    if (!(network->recent_probes = recent_probes_create(
+        NETWORK_NUM_RECENT_PROBES,
+        SECONDS_TO_NS(NETWORK_RECENT_PROBES_LIFETIME)
+    ))) {
+        goto ERR_RECENT_PROBES;
+    }
+
+    if (!(network->paced_probes = dynarray_create())) {
+        goto ERR_PACED_PROBES;
+    }
+
+    if (!(network->held_probes = fair_queue_create(NETWORK_DEFAULT_INSTANCE_PPS, NETWORK_DEFAULT_BURST))) {
+        goto ERR_HELD_PROBES;
+    }
+
+    if (!(network->waiting_callers = dynarray_create())) {
+        goto ERR_WAITING_CALLERS;
+    }
+
+    if ((network->pacer_timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) == -1) {
+        goto ERR_PACER_TIMERFD;
+    }
+
+    if (!(network->stats = network_stats_create(NS_TO_SECONDS(get_time_ns())))) {
+        goto ERR_STATS;
+    }
+
+    if ((network->stats_timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) == -1) {
+        goto ERR_STATS_TIMERFD;
+    }
+
 #ifdef USE_SCHEDULING
-    if ((network->scheduled_timerfd = timerfd_create(CLOCK_REALTIME, 0)) == -1) {
+    if ((network->scheduled_timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) == -1) {
         goto ERR_GROUP_TIMERFD;
     }
-    if (!(network->scheduled_probes = probe_group_create(network->scheduled_timerfd))) {
+    if (!(network->scheduled_probes = probe_heap_create())) {
         goto ERR_GROUP;
     }
 #endif
-    if (!(network->sniffer = sniffer_create(network->recvq, network_sniffer_callback))) {
+    if (options_network_get_simulation_filename()) {
+        if (!(network->simulator = simulator_create(options_network_get_simulation_filename(), network, network_sniffer_callback))) {
+            goto ERR_SNIFFER;
+        }
+    } else if (options_network_get_demux_path()) {
+        // The replies are routed according to their tag: only the tags
+        // granted by the demultiplexer are allocated.
+        if (!(network->demux = demux_client_create(options_network_get_demux_path(), options_network_get_demux_tags(), network, network_sniffer_callback))) {
+            goto ERR_SNIFFER;
+        }
+        demux_client_get_tags(network->demux, &first_tag, &last_tag);
+        if (!tag_allocator_set_range(network->tags, first_tag, last_tag)) {
+            demux_client_free(network->demux);
+            goto ERR_SNIFFER;
+        }
+    } else if (!(network->sniffer = sniffer_create(network, network_sniffer_callback))) {
+        goto ERR_SNIFFER;
+    } else if (network->has_seq_tags && !sniffer_enable_tcp(network->sniffer)) {
+        sniffer_free(network->sniffer);
         goto ERR_SNIFFER;
     }
 
-    if (!(network->probes = dynarray_create())) goto ERR_PROBES;
+    // The sockets fetched from the broker which are not used (e.g. with
+    // --demux-client) are useless
+    broker_client_release();
 
-    network->last_tag = 0;
+    memset(network->buckets, 0, sizeof(network->buckets));
+#ifdef USE_TIMESTAMPING
+    memset(network->tx_pending, 0, sizeof(network->tx_pending));
+#endif
+    network->oldest_probe = NULL;
+    network->youngest_probe = NULL;
+    network->num_flying_probes = 0;
+    network->max_flying_probes = 0;
+    network->armed_tick = 0;
+    network->is_armed = false;
     network->timeout = NETWORK_DEFAULT_TIMEOUT;
+    network->pacer = NULL;
+    network->rtt_estimator = NULL;
+    memset(network->stateless_callers, 0, sizeof(network->stateless_callers));
+    network->num_stateless_callers = 0;
+    network->capture = NULL;
+    network->stats_interval = 0;
+    network->shard = 0;
+    network->num_shards = 1;
     network->is_verbose = false;
     return network;
 
-ERR_PROBES:
-    sniffer_free(network->sniffer);
 ERR_SNIFFER:
 #ifdef USE_SCHEDULING
-    probe_group_free(network->scheduled_probes);
+    probe_heap_free(network->scheduled_probes, NULL);
 ERR_GROUP :
     close(network->scheduled_timerfd);
 ERR_GROUP_TIMERFD :
 #endif
+    close(network->stats_timerfd);
+ERR_STATS_TIMERFD:
+    network_stats_free(network->stats);
+ERR_STATS:
+    close(network->pacer_timerfd);
+ERR_PACER_TIMERFD:
+    dynarray_free(network->waiting_callers, NULL);
+ERR_WAITING_CALLERS:
+    fair_queue_free(network->held_probes, NULL);
+ERR_HELD_PROBES:
+    dynarray_free(network->paced_probes, NULL);
+ERR_PACED_PROBES:
+    recent_probes_free(network->recent_probes);
+ERR_RECENT_PROBES:
+    tag_allocator_free(network->tags);
+ERR_TAGS:
+    timing_wheel_free(network->timeouts);
+ERR_TIMEOUTS:
     close(network->timerfd);
 ERR_TIMERFD:
     queue_free(network->recvq, (ELEMENT_FREE) packet_free);
 ERR_RECVQ:
     queue_free(network->sendq, (ELEMENT_FREE) probe_free);
 ERR_SENDQ:
-    socketpool_free(network->socketpool);
+    if (network->socketpool) socketpool_free(network->socketpool);
 ERR_SOCKETPOOL:
+    broker_client_release();
+ERR_BROKER_CLIENT_FETCH:
     free(network);
 ERR_NETWORK:
     return NULL;
@@ -405,15 +1213,35 @@ ERR_NETWORK:
 
 void network_free(network_t * network)
 {
+    flying_probe_t * flying_probe;
+
     if (network) {
-        dynarray_free(network->probes, (ELEMENT_FREE) probe_free);
+        while ((flying_probe = network->oldest_probe)) {
+            network->oldest_probe = flying_probe->younger;
+            probe_free(flying_probe->probe);
+            free(flying_probe);
+        }
+        tag_allocator_free(network->tags);
+        recent_probes_free(network->recent_probes);
+        timing_wheel_free(network->timeouts);
         close(network->timerfd);
-        sniffer_free(network->sniffer);
+        pacer_free(network->pacer);
+        rtt_estimator_free(network->rtt_estimator);
+        capture_free(network->capture);
+        close(network->pacer_timerfd);
+        network_stats_free(network->stats);
+        close(network->stats_timerfd);
+        dynarray_free(network->paced_probes, (ELEMENT_FREE) probe_free);
+        fair_queue_free(network->held_probes, (ELEMENT_FREE) probe_free);
+        dynarray_free(network->waiting_callers, NULL);
+        if (network->sniffer)    sniffer_free(network->sniffer);
+        simulator_free(network->simulator);
+        demux_client_free(network->demux);
         queue_free(network->sendq, (ELEMENT_FREE) probe_free);
-        queue_free(network->recvq, (ELEMENT_FREE) probe_free);
-        socketpool_free(network->socketpool);
+        queue_free(network->recvq, (ELEMENT_FREE) packet_free);
+        if (network->socketpool) socketpool_free(network->socketpool);
 #ifdef USE_SCHEDULING
-        probe_group_free(network->scheduled_probes);
+        probe_heap_free(network->scheduled_probes, (ELEMENT_FREE) probe_free);
 #endif
         free(network);
     }
@@ -421,12 +1249,72 @@ void network_free(network_t * network)
 
 void network_set_timeout(network_t * network, double new_timeout) {
     network->timeout = new_timeout;
+    if (network->rtt_estimator) {
+        network->rtt_estimator->max_timeout = new_timeout;
+        if (network->rtt_estimator->min_timeout > new_timeout) {
+            network->rtt_estimator->min_timeout = new_timeout;
+        }
+    }
 }
 
 double network_get_timeout(const network_t * network) {
     return network->timeout;
 }
 
+bool network_set_tag_bits(network_t * network, size_t tag_bits)
+{
+    tag_allocator_t * tags;
+
+    if (tag_bits == network_get_tag_bits(network)) return true;
+
+    // The tags of the probes in transit would be lost, and the
+    // demultiplexer only routes 16-bit tags
+    if (tag_bits < 16 || network->num_flying_probes > 0 || network->demux) return false;
+
+    if (!(tags = tag_allocator_create(tag_bits))) return false;
+    tag_allocator_free(network->tags);
+    network->tags = tags;
+    return true;
+}
+
+bool network_set_shard(network_t * network, size_t shard, size_t num_shards)
+{
+    // A simulated network only delivers the replies to its own probes
+    if (network->sniffer && !sniffer_set_shard(network->sniffer, shard, num_shards)) {
+        return false;
+    }
+
+    network->shard = shard;
+    network->num_shards = num_shards;
+    return true;
+}
+
+size_t network_get_destination_shard(const address_t * dst, size_t num_shards)
+{
+    // The sniffer filters (see sniffer.c) select the replies according to
+    // the last byte of the probe destination.
+    const uint8_t * bytes = (const uint8_t *) &dst->ip;
+
+    return bytes[address_get_size(dst) - 1] % num_shards;
+}
+
+bool network_accept_destination(network_t * network, const address_t * dst)
+{
+    const uint8_t * bytes = (const uint8_t *) &dst->ip;
+
+    if (network->num_shards == 1
+    ||  network->simulator
+    ||  network->demux
+    ||  network_get_destination_shard(dst, network->num_shards) == network->shard) {
+        return true;
+    }
+    return sniffer_accept_bucket(network->sniffer, bytes[address_get_size(dst) - 1]);
+}
+
+inline size_t network_get_tag_bits(const network_t * network) {
+    return tag_allocator_get_num_bits(network->tags);
+}
+
 inline int network_get_sendq_fd(network_t * network) {
     return queue_get_fd(network->sendq);
 }
@@ -435,6 +1323,22 @@ inline int network_get_recvq_fd(network_t * network) {
     return queue_get_fd(network->recvq);
 }
 
+inline bool network_is_simulated(const network_t * network) {
+    return network->simulator != NULL;
+}
+
+inline int network_get_simulator_fd(network_t * network) {
+    return simulator_get_timerfd(network->simulator);
+}
+
+inline bool network_is_demultiplexed(const network_t * network) {
+    return network->demux != NULL;
+}
+
+inline int network_get_demux_fd(network_t * network) {
+    return demux_client_get_fd(network->demux);
+}
+
 #ifdef USE_IPV4
 inline int network_get_icmpv4_sockfd(network_t * network) {
     return sniffer_get_icmpv4_sockfd(network->sniffer);
@@ -447,21 +1351,50 @@ inline int network_get_icmpv6_sockfd(network_t * network) {
 }
 #endif
 
+#ifdef USE_IPV4
+int network_get_tcpv4_sockfd(network_t * network) {
+    return network->sniffer ? sniffer_get_tcpv4_sockfd(network->sniffer) : -1;
+}
+#endif
+
+#ifdef USE_IPV6
+int network_get_tcpv6_sockfd(network_t * network) {
+    return network->sniffer ? sniffer_get_tcpv6_sockfd(network->sniffer) : -1;
+}
+#endif
+
 inline int network_get_timerfd(network_t * network) {
     return network->timerfd;
 }
 
+inline int network_get_pacer_fd(network_t * network) {
+    return network->pacer_timerfd;
+}
+
+inline int network_get_stats_fd(network_t * network) {
+    return network->stats_timerfd;
+}
+
 #ifdef USE_SCHEDULING
 inline int network_get_group_timerfd(network_t * network) {
     return network->scheduled_timerfd;
 }
 
-probe_group_t * network_get_scheduled_probes(network_t * network) {
+inline probe_heap_t * network_get_scheduled_probes(network_t * network) {
     return network->scheduled_probes;
 }
 #endif
 
-bool network_tag_probe(network_t * network, probe_t * probe)
+/**
+ * \brief Write a 16-bit tag in the transport checksum of a probe. The
+ *    2 first bytes of the payload (or of the body, e.g. for ICMP) are set
+ *    so that the checksum remains valid.
+ * \param probe The probe to update.
+ * \param probe_tag The tag (host-side endianness).
+ * \return true iif successful
+ */
+
+static bool probe_write_tag(probe_t * probe, uint16_t probe_tag)
 {
     uint16_t   tag,         // Network-side endianness
                checksum;    // Host-side endianness
@@ -473,23 +1406,8 @@ bool network_tag_probe(network_t * network, probe_t * probe)
     layer_t  * last_layer;
     bool       tag_in_body = false;
 
-    /* The probe gets assigned a unique tag. Currently we encode it in the UDP
-     * checksum, but I guess the tag will be protocol dependent. Also, since the
-     * tag changes the probe, the user has no direct control of what is sent on
-     * the wire, since typically a packet is tagged just before sending, after
-     * scheduling, to maximize the number of probes in flight. Available space
-     * in the headers is used for tagging, + encoding some information... */
-    /* XXX hardcoded XXX */
-
-    /* 1) Set payload = tag : this is only possible if both the payload and the
-     * checksum have not been set by the user.
-     * We need a list of used tags = in flight... + an efficient way to get a
-     * free one... Also, we need to share tags between several instances ?
-     * randomized tags ? Also, we need to determine how much size we have to
-     * encode information. */
-
     if (num_layers < 2 || !(last_layer = probe_get_layer(probe, num_layers - 2))) {
-        fprintf(stderr, "network_tag_probe: not enough layer (num_layers = %d)\n", (unsigned int)num_layers);
+        fprintf(stderr, "probe_write_tag: not enough layer (num_layers = %d)\n", (unsigned int)num_layers);
         goto ERR_GET_LAYER;
     }
 
@@ -500,7 +1418,7 @@ bool network_tag_probe(network_t * network, probe_t * probe)
         tag_in_body = true;
     }
 
-    tag = htons(network_get_available_tag(network));
+    tag = htons(probe_tag);
 
     // Write the tag at offset zero of the payload
     if (tag_in_body) {
@@ -516,20 +1434,21 @@ bool network_tag_probe(network_t * network, probe_t * probe)
         }
     }
 
-    // Fix checksum to get a well-formed packet
-    if (!(probe_update_checksum(probe))) {
+    // Finalize the layers updated since the probe was last finalized (e.g.
+    // its source address) and fix checksum to get a well-formed packet
+    if (!(probe_update_fields(probe))) {
         fprintf(stderr, "Can't update fields\n");
         goto ERR_PROBE_UPDATE_FIELDS;
     }
 
     // Retrieve the checksum of UDP/TCP/ICMP checksum (host-side endianness)
-    if (!(probe_extract_tag(probe, &checksum))) {
+    if (!(probe_extract_ext(probe, "checksum", 1, &checksum))) {
         fprintf(stderr, "Can't extract tag\n");
         goto ERR_PROBE_EXTRACT_CHECKSUM;
     }
 
     // Write the probe ID in the UDP/TCP/ICMP checksum
-    if (!(probe_set_tag(probe, ntohs(tag)))) {
+    if (!(probe_set_tag(probe, probe_tag))) {
         fprintf(stderr, "Can't set tag\n");
         goto ERR_PROBE_SET_TAG;
     }
@@ -561,240 +1480,1269 @@ ERR_GET_LAYER:
     return false;
 }
 
-bool network_send_probe(network_t * network, probe_t * probe)
-{
-    // - Best effort probes are directly pushed in our sendq.
-    // - Scheduled probes are scheduled, stored in the probe group, and
-    // pushed in the sendq when the probe_group notify pt_loop.
-
-#ifdef USE_SCHEDULING
-    if (probe_get_delay(probe) == DELAY_BEST_EFFORT) {
-#endif
-        probe_set_queueing_time(probe, get_timestamp());
-        return queue_push_element(network->sendq, probe);
-#ifdef USE_SCHEDULING
-    } else {
-       return probe_group_add(network->scheduled_probes, probe);
-    }
-#endif
-}
+/**
+ * \brief Write a 16-bit tag in the upper bits of the sequence number of a
+ *    TCP probe, and in its acknowledgment number if its ACK flag is set.
+ *    The destination echoes it in the acknowledgment number of its SYN/ACK
+ *    or RST (see network_extract_segment_tag), and the routers quote it in
+ *    their ICMP errors even when they only quote 8 bytes of the segment,
+ *    unlike its checksum.
+ * \param probe The probe to update.
+ * \param probe_tag The tag (host-side endianness).
+ * \return true iif successful
+ */
 
-// TODO This could be replaced by watchers: FD -> action
-bool network_process_sendq(network_t * network)
+static bool probe_write_seq_tag(probe_t * probe, uint16_t probe_tag)
 {
-    probe_t           * probe;
-    packet_t          * packet;
-    size_t              num_flying_probes;
-    struct itimerspec   new_timeout;
+    const layer_t * layer;
+    field_t       * field;
+    bool            has_ack;
 
-    // Probe skeleton when entering the network layer.
-    // We have to duplicate the probe since the same address of skeleton
-    // may have been passed to pt_send_probe.
-    // => We duplicate this probe in the
-    // network layer registry (network->probes) and then tagged.
+    if (!(layer = probe_get_layer(probe, 1))) goto ERR_GET_LAYER;
+    has_ack = layer_get_segment(layer)[13] & TH_ACK;
 
-    // Do not free probe at the end of this function.
-    // Its address will be saved in network->probes and freed later.
-    probe = queue_pop_element(network->sendq, NULL);
+    if (!(field = I32("seq_num", (uint32_t) probe_tag << 16))) goto ERR_SET_FIELD;
+    if (!probe_set_field_ext(probe, 1, field)) goto ERR_PROBE_SET_FIELD;
+    field_free(field);
 
-    // Tag the probe
-    if (!network_tag_probe(network, probe)) {
-        fprintf(stderr, "Can't tag probe\n");
-        goto ERR_TAG_PROBE;
+    if (has_ack) {
+        if (!(field = I32("ack_num", (uint32_t) probe_tag << 16))) goto ERR_SET_FIELD;
+        if (!probe_set_field_ext(probe, 1, field)) goto ERR_PROBE_SET_FIELD;
+        field_free(field);
     }
 
-    if (network->is_verbose) {
-        printf("Sending probe packet:\n");
-        probe_dump(probe);
+    // Finalize the layers and fix the TCP checksum
+    if (!(probe_update_fields(probe))) {
+        fprintf(stderr, "Can't update fields\n");
+        goto ERR_PROBE_UPDATE_FIELDS;
     }
 
-    // Make a packet from the probe structure
-    if (!(packet = probe_create_packet(probe))) {
-        fprintf(stderr, "Can't create packet\n");
-    	goto ERR_CREATE_PACKET;
-    }
+    return true;
 
-    // Send the packet
-    if (!(socketpool_send_packet(network->socketpool, packet))) {
-        fprintf(stderr, "Can't send packet\n");
-        goto ERR_SEND_PACKET;
-    }
+ERR_PROBE_SET_FIELD:
+    field_free(field);
+ERR_PROBE_UPDATE_FIELDS:
+ERR_SET_FIELD:
+ERR_GET_LAYER:
+    return false;
+}
+
+bool network_tag_probe(network_t * network, probe_t * probe)
+{
+    uint32_t   probe_tag;   // Host-side endianness
+    size_t     probe_tag_bits;
+    field_t  * field;
+
+    /* The probe gets assigned a unique tag. Currently we encode it in the UDP
+     * checksum, but I guess the tag will be protocol dependent. Also, since the
+     * tag changes the probe, the user has no direct control of what is sent on
+     * the wire, since typically a packet is tagged just before sending, after
+     * scheduling, to maximize the number of probes in flight. Available space
+     * in the headers is used for tagging, + encoding some information... */
+    /* XXX hardcoded XXX */
 
-    // Update the sending time
-    probe_set_sending_time(probe, get_timestamp());
+    /* 1) Set payload = tag : this is only possible if both the payload and the
+     * checksum have not been set by the user.
+     * We need a list of used tags = in flight... + an efficient way to get a
+     * free one... Also, we need to share tags between several instances ?
+     * randomized tags ? Also, we need to determine how much size we have to
+     * encode information. */
 
-    // Register this probe in the list of flying probes
-    if (!(dynarray_push_element(network->probes, probe))) {
-        fprintf(stderr, "Can't register probe\n");
-        goto ERR_PUSH_PROBE;
+    probe_tag_bits = network_get_probe_tag_bits(network, probe);
+    if (!network_get_available_tag(network, probe_tag_bits, &probe_tag)) {
+        fprintf(stderr, "network_tag_probe: no more available tag (%u probes in transit)\n", (unsigned int) network->num_flying_probes);
+        goto ERR_GET_AVAILABLE_TAG;
     }
 
-    // We've just sent a probe and currently, this is the only one in transit.
-    // So currently, there is no running timer, prepare timerfd.
-    num_flying_probes = dynarray_get_size(network->probes);
-    if (num_flying_probes == 1) {
-        itimerspec_set_delay(&new_timeout, network_get_timeout(network));
-        if (timerfd_settime(network->timerfd, 0, &new_timeout, NULL) == -1) {
-            fprintf(stderr, "Can't set timerfd\n");
-            goto ERR_TIMERFD;
+    // Write the upper bits of the tag in the IP identification. This must be
+    // done before updating the checksums.
+    if (probe_tag_bits > 16) {
+        if (!(field = I16("identification", (probe_tag >> 16) + 1))) {
+            goto ERR_SET_IDENTIFICATION;
+        }
+        if (!probe_set_field_ext(probe, 0, field)) {
+            field_free(field);
+            fprintf(stderr, "Can't set identification\n");
+            goto ERR_SET_IDENTIFICATION;
         }
+        field_free(field);
+    }
+
+    if (network_has_seq_tag(network, probe) ?
+        !probe_write_seq_tag(probe, probe_tag & 0xffff) :
+        !probe_write_tag(probe, probe_tag & 0xffff)
+    ) {
+        goto ERR_PROBE_WRITE_TAG;
     }
+
     return true;
 
-ERR_TIMERFD:
-ERR_PUSH_PROBE:
-ERR_SEND_PACKET:
-    packet_free(packet);
-ERR_CREATE_PACKET:
-ERR_TAG_PROBE:
+ERR_PROBE_WRITE_TAG:
+ERR_SET_IDENTIFICATION:
+    tag_allocator_release_tag(network->tags, probe_tag);
+ERR_GET_AVAILABLE_TAG:
     return false;
 }
 
-bool network_process_recvq(network_t * network)
+#ifdef USE_SCHEDULING
+static bool network_schedule_probe(network_t * network, probe_t * probe, uint64_t origin);
+#endif
+
+bool network_send_probe(network_t * network, probe_t * probe)
 {
-    probe_t       * probe,
-                  * reply;
-    packet_t      * packet;
-    probe_reply_t * probe_reply;
+    // - Best effort probes are directly pushed in our sendq.
+    // - Scheduled probes are stored in network->scheduled_probes, and
+    // pushed in the sendq once network->scheduled_timerfd expires.
 
-    // Pop the packet from the queue
-    if (!(packet = queue_pop_element(network->recvq, NULL))) {
-        goto ERR_PACKET_POP;
+#ifdef USE_SCHEDULING
+    if (probe_get_delay(probe) == DELAY_BEST_EFFORT) {
+#endif
+        probe_set_queueing_time(probe, get_time_ns());
+        TRACEPOINT(probe_queued, probe, probe_get_traced_instance_id(probe), probe_get_queueing_time(probe));
+        return queue_push_element(network->sendq, probe);
+#ifdef USE_SCHEDULING
+    } else {
+       return network_schedule_probe(network, probe, get_time_ns());
     }
+#endif
+}
 
-    // Transform the reply into a probe_t instance
-    if(!(reply = probe_wrap_packet(packet))) {
-        goto ERR_PROBE_WRAP_PACKET;
-    }
-    probe_set_recv_time(reply, get_timestamp());
+/**
+ * \brief Release a probe which could not be handed over to the network
+ *    layer. It is accounted as discarded.
+ * \param network The network layer
+ * \param probe The probe (not tagged yet)
+ */
 
-    if (network->is_verbose) {
-        printf("Got reply:\n");
-        probe_dump(reply);
-    }
+static void network_discard_submitted_probe(network_t * network, probe_t * probe) {
+    TRACEPOINT(probe_dropped, probe, probe_get_traced_instance_id(probe));
+    probe_free(probe);
+    network->stats->counters.num_discarded++;
+}
 
-    // Find the probe corresponding to this reply
-    // The corresponding pointer (if any) is removed from network->probes
-    if (!(probe = network_get_matching_probe(network, reply))) {
-        goto ERR_PROBE_DISCARDED;
+bool network_submit_probes(network_t * network, probe_t ** probes, size_t num_probes)
+{
+    size_t   i;
+    bool     ret = true;
+    uint64_t queueing_time = get_time_ns();
+
+    for (i = 0; i < num_probes; i++) {
+#ifdef USE_SCHEDULING
+        if (probe_get_delay(probes[i]) != DELAY_BEST_EFFORT) break;
+#endif
+        probe_set_queueing_time(probes[i], queueing_time);
+        TRACEPOINT(probe_queued, probes[i], probe_get_traced_instance_id(probes[i]), queueing_time);
     }
 
-    // Build a pair made of the probe and its corresponding reply
-    if (!(probe_reply = probe_reply_create())) {
-        goto ERR_PROBE_REPLY_CREATE;
+    // Best effort batch: a single push in our sendq. The probes which do
+    // not fit in a full sendq are discarded.
+    if (i == num_probes) {
+        for (i = queue_push_elements(network->sendq, (void **) probes, num_probes); i < num_probes; i++) {
+            fprintf(stderr, "Can't queue probe: sendq is full\n");
+            network_discard_submitted_probe(network, probes[i]);
+            ret = false;
+        }
+        return ret;
     }
 
-    // We're pass to the upper layer the probe and the reply to the upper layer.
-    probe_reply_set_probe(probe_reply, probe);
-    probe_reply_set_reply(probe_reply, reply);
+    for (i = 0; i < num_probes; i++) {
+        if (!network_send_probe(network, probes[i])) {
+            network_discard_submitted_probe(network, probes[i]);
+            ret = false;
+        }
+    }
+    return ret;
+}
 
-    // Notify the instance which has build the probe that we've got the corresponding reply
+/**
+ * \brief Overwrite the sending time of the flying probes with the
+ *    transmit timestamps reported by the kernel. The timeouts of these
+ *    probes are not rescheduled.
+ * \param network The network layer
+ */
 
-    // TODO this provokes a double free:
-    //pt_throw(NULL, probe->caller, event_create(PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-    pt_throw(NULL, probe->caller, event_create(PROBE_REPLY, probe_reply, NULL, NULL));
+static void network_update_sending_times(network_t * network)
+{
+#ifdef USE_TIMESTAMPING
+    socketpool_tx_timestamp_t   timestamps[NETWORK_SEND_BATCH_SIZE];
+    flying_probe_t           ** pslot;
+    size_t                      i, num_timestamps;
+
+    // The simulated packets are never timestamped
+    if (!network->socketpool) return;
+
+    while ((num_timestamps = socketpool_fetch_tx_timestamps(network->socketpool, timestamps, NETWORK_SEND_BATCH_SIZE)) > 0) {
+        for (i = 0; i < num_timestamps; i++) {
+            pslot = network_get_tx_slot(network, &timestamps[i].tx_key);
+
+            // This probe has been matched or has expired
+            if (!*pslot
+            ||  (*pslot)->tx_key.family != timestamps[i].tx_key.family
+            ||  (*pslot)->tx_key.key    != timestamps[i].tx_key.key) {
+                continue;
+            }
 
-    // TODO probe_reply_free frees only the reply but probe_reply_deep_free cannot be used as other things may have references to its contents.
-    return true;
+            probe_set_sending_time((*pslot)->probe, timestamps[i].timestamp);
 
-ERR_PROBE_REPLY_CREATE:
-ERR_PROBE_DISCARDED:
-    probe_free(reply);
-ERR_PROBE_WRAP_PACKET:
-    //packet_free(packet); TODO provoke segfault in case of stars
-ERR_PACKET_POP:
-    return false;
+            // The packet has been passed to the driver, no further timestamp
+            if (timestamps[i].is_final) {
+                (*pslot)->tx_key.family = AF_UNSPEC;
+                *pslot = NULL;
+            }
+        }
+    }
+#endif
 }
 
-void network_process_sniffer(network_t * network, uint8_t protocol_id) {
-    sniffer_process_packets(network->sniffer, protocol_id);
-}
+/**
+ * \brief Tag and send a batch of probes popped from network->sendq.
+ * \param network The network layer
+ * \param probes The probes to send.
+ * \param num_probes The number of probes stored in probes.
+ * \return true iif successful
+ */
 
-bool network_drop_expired_flying_probe(network_t * network)
+static bool network_send_probes(network_t * network, probe_t ** probes, size_t num_probes)
 {
-    // Drop every expired probes
-    size_t    i, num_flying_probes = dynarray_get_size(network->probes);
-    bool      ret = false;
-    probe_t * probe;
+    probe_t             * probe;
+    packet_t            * packets[NETWORK_SEND_BATCH_SIZE];
+    socketpool_tx_key_t   tx_keys[NETWORK_SEND_BATCH_SIZE];
+    size_t                i, j, num_packets = 0, num_sent;
+    bool                  ret = true;
+    uint64_t              sending_time;
+
+    for (i = 0; i < num_probes; i++) {
+        probe = probes[i];
+
+        // Tag the probe. A stateless probe carries its sending time instead
+        // of a tag (see stateless.h).
+        if (network_is_stateless_probe(network, probe)) {
+            if (!probe_write_tag(probe, stateless_make_timestamp(get_time_ns()))) {
+                fprintf(stderr, "Can't timestamp probe\n");
+                TRACEPOINT(probe_dropped, probe, probe_get_traced_instance_id(probe));
+                network_release_probe(network, probe);
+                network->stats->counters.num_discarded++;
+                ret = false;
+                continue;
+            }
+        } else if (!network_tag_probe(network, probe)) {
+            fprintf(stderr, "Can't tag probe\n");
+            TRACEPOINT(probe_dropped, probe, probe_get_traced_instance_id(probe));
+            network->stats->counters.num_discarded++;
+            ret = false;
+            continue;
+        }
+
+        if (network->is_verbose) {
+            printf("Sending probe packet:\n");
+            probe_dump(probe);
+        }
 
-    // Is there flying probe(s) ?
-    if (num_flying_probes > 0) {
+        // Make a packet from the probe structure
+        if (!(packets[num_packets] = probe_create_packet(probe))) {
+            fprintf(stderr, "Can't create packet\n");
+            TRACEPOINT(probe_dropped, probe, probe_get_traced_instance_id(probe));
+            network_release_probe(network, probe);
+            network->stats->counters.num_discarded++;
+            ret = false;
+            continue;
+        }
 
-        // Iterate on each expired probes (at least the oldest one has expired)
-        for (i = 0 ;i < num_flying_probes; i++) {
-            probe = dynarray_get_ith_element(network->probes, i);
+        probes[num_packets++] = probe;
+    }
 
-            // Some probe may expires very soon and may expire before the next probe timeout
-            // update. If so, the timer will be disarmed and libparistraceroute may freeze.
-            // To avoid this kind of deadlock, we provoke a probe timeout for each probe
-            // expiring in less that EXTRA_DELAY seconds.
-            if (network_get_probe_timeout(network, probe) - EXTRA_DELAY > 0) break;
+    for (i = 0; i < num_packets; i += num_sent) {
+        // Send the packets. The sending time is fetched before the system
+        // call, since a reply may be timestamped by the kernel before it returns.
+        sending_time = get_time_ns();
+        num_sent = network->simulator ?
+            simulator_send_packets(network->simulator, packets + i, num_packets - i, tx_keys + i) :
+            socketpool_send_packets(network->socketpool, packets + i, num_packets - i, tx_keys + i);
+        network->stats->counters.num_sent += num_sent;
+
+        // Update the sending time
+        for (j = i; j < i + num_sent; j++) {
+            probe_set_sending_time(probes[j], sending_time);
+#ifdef USE_TXTIME
+            // The kernel holds this packet until its departure time
+            if (packet_get_departure_time(packets[j]) > sending_time) {
+                probe_set_sending_time(probes[j], packet_get_departure_time(packets[j]));
+            }
+            packet_set_departure_time(packets[j], 0);
+#endif
+            if (probe_get_queueing_time(probes[j])
+            &&  probe_get_queueing_time(probes[j]) <= probe_get_sending_time(probes[j])) {
+                histogram_add(network->stats->queue_to_wire, probe_get_sending_time(probes[j]) - probe_get_queueing_time(probes[j]));
+            }
+            TRACEPOINT(
+                probe_sent, probes[j],
+                probe_get_traced_tag(network, probes[j]),
+                probe_get_traced_instance_id(probes[j]),
+                probe_get_queueing_time(probes[j]),
+                probe_get_sending_time(probes[j])
+            );
+
+            if (network->capture) {
+                network_capture(
+                    network, probes[j], probe_get_sending_time(probes[j]), CAPTURE_OUTBOUND,
+                    network_is_stateless_probe(network, probes[j]) ? NULL : probes[j],
+                    probes[j]->caller
+                );
+            }
 
-            // This probe has expired, raise a PROBE_TIMEOUT event.
-            pt_throw(NULL, probe->caller, event_create(PROBE_TIMEOUT, probe, NULL, NULL)); //(ELEMENT_FREE) probe_free));
+            // Register this probe in the list of flying probes. A stateless
+            // probe is not tracked: it is given back to its caller.
+            if (network_is_stateless_probe(network, probes[j])) {
+                network_release_probe(network, probes[j]);
+            } else if (!(network_flying_probe_add(network, probes[j], &tx_keys[j]))) {
+                fprintf(stderr, "Can't register probe\n");
+                network_release_probe_tag(network, probes[j]);
+                probe_free(probes[j]);
+                ret = false;
+            } else {
+                // Until it is matched, the probe is only read by protocol_stack_from_probe
+                probe_compact(probes[j]);
+            }
         }
 
-        // Delete the i oldest probes, which have expired.
-        if (i != 0) {
-            dynarray_del_n_elements(network->probes, 0, i, NULL);
+        // Skip the packet that could not be sent
+        if (i + num_sent < num_packets) {
+            fprintf(stderr, "Can't send packet\n");
+            TRACEPOINT(probe_dropped, probes[i + num_sent], probe_get_traced_instance_id(probes[i + num_sent]));
+            network_release_probe(network, probes[i + num_sent]);
+            network->stats->counters.num_discarded++;
+            ret = false;
+            num_sent++;
         }
+    }
 
-        ret = network_update_next_timeout(network);
-    } else {
-        fprintf(stderr, "network_drop_expired_flying_probe: a probe has expired, but there are no more flying probes!\n");
+    // Software transmit timestamps are usually already available
+    network_update_sending_times(network);
+
+    // Arm timerfd if these probes expire before the currently scheduled tick.
+    if (!network_update_next_timeout(network)) {
+        fprintf(stderr, "Can't set timerfd\n");
+        ret = false;
     }
 
     return ret;
 }
 
-//------------------------------------------------------------------------------------
-// Scheduling
-//------------------------------------------------------------------------------------
-
-#ifdef USE_SCHEDULING
+/**
+ * \brief Send (in order) the paced probes allowed by network->pacer.
+ *    A probe whose prefix bucket is empty does not delay the probes towards
+ *    other prefixes.
+ * \param network The network layer
+ * \param pdelay Address of a double in which the delay (in seconds) before
+ *    the next token is available is written, 0 if no probe is waiting.
+ * \return true iif successful
+ */
 
-static bool network_process_probe_node(network_t * network, tree_node_t * node, size_t i)
+static bool network_send_paced_probes(network_t * network, double * pdelay)
 {
-    tree_node_probe_t * tree_node_probe = get_node_data(node);
-    probe_t           * probe;
+    probe_t  * probes[NETWORK_SEND_BATCH_SIZE],
+             * probe;
+    void    ** paced_probes = dynarray_get_elements(network->paced_probes);
+    size_t     i, num_paced_probes = dynarray_get_size(network->paced_probes),
+               num_kept = 0,
+               num_probes = 0;
+    double     now = NS_TO_SECONDS(get_time_ns()),
+               delay,
+               next_delay = 0;
+    address_t  dst;
+    uint8_t    ttl;
+    bool       ret = true;
+
+    for (i = 0; i < num_paced_probes; i++) {
+        probe = paced_probes[i];
+
+        if (network->pacer) {
+            // No probe can be sent until the global bucket is refilled
+            if ((delay = pacer_get_global_delay(network->pacer, now)) > 0) {
+                if (next_delay == 0 || delay < next_delay) next_delay = delay;
+                break;
+            }
 
-    if (!(tree_node_probe->tag == PROBE))                               goto ERR_TAG;
-    probe = (probe_t *) (tree_node_probe->data.probe);
-    //TODO packet_from_probe must manage generator
+            // A probe without destination is only paced by the global bucket
+            memset(&dst, 0, sizeof(address_t));
+            probe_extract(probe, "dst_ip", &dst);
+            ttl = 0;
+            if (network->pacer->ratelimit) probe_extract(probe, "ttl", &ttl);
 
-    probe_set_queueing_time(probe, get_timestamp());
-    if (!(queue_push_element(network->sendq, probe)))                   goto ERR_QUEUE_PUSH;
-    /*
-    probe_set_left_to_send(probe, probe_get_left_to_send(probe) - 1);
-    num_probes_to_send = probe_get_left_to_send(probe);
+            if (!pacer_take(network->pacer, &dst, ttl, now, &delay)) {
+                if (next_delay == 0 || delay < next_delay) next_delay = delay;
+                paced_probes[num_kept++] = probe;
+                continue;
+            }
+        }
 
-    if (num_probes_to_send == 0) {
-    */
-    if (--(probe->left_to_send) == 0) {
-        if (!(probe_group_del(network->scheduled_probes, node->parent, i)))  goto ERR_PROBE_GROUP_DEL;
-    } else {
-        get_node_next_delay(node);
-        probe_group_update_delay(network->scheduled_probes, node);
-        return true;
+        probes[num_probes++] = probe;
+        if (num_probes == NETWORK_SEND_BATCH_SIZE) {
+            if (!network_send_probes(network, probes, num_probes)) ret = false;
+            num_probes = 0;
+        }
     }
 
-ERR_PROBE_GROUP_DEL:
-ERR_QUEUE_PUSH:
-ERR_TAG:
-    return false;
-}
+    if (num_probes > 0 && !network_send_probes(network, probes, num_probes)) {
+        ret = false;
+    }
+
+    // Keep the probes which are still waiting, in order
+    memmove(paced_probes + num_kept, paced_probes + i, (num_paced_probes - i) * sizeof(void *));
+    num_kept += num_paced_probes - i;
+    dynarray_del_n_elements(network->paced_probes, num_kept, num_paced_probes - num_kept, NULL);
+
+    *pdelay = num_kept > 0 ? next_delay : 0;
+    return ret;
+}
+
+/**
+ * \brief Release probes popped from the sendq (and allowed by the window
+ *    of the network layer): they are sent at once, or wait for their turn
+ *    behind the paced probes.
+ * \param network The network layer.
+ * \param probes The probes to release.
+ * \param num_probes The number of probes.
+ * \return true iif successful
+ */
+
+static bool network_release_probes(network_t * network, probe_t ** probes, size_t num_probes)
+{
+    size_t i;
+    bool   ret = true;
+
+    if (network->pacer) {
+        // These probes wait for their turn behind the paced probes
+        for (i = 0; i < num_probes; i++) {
+            if (!dynarray_push_element(network->paced_probes, probes[i])) {
+                fprintf(stderr, "Can't pace probe\n");
+                network->stats->counters.num_discarded++;
+                ret = false;
+            }
+        }
+    } else if (!network_send_probes(network, probes, num_probes)) {
+        ret = false;
+    }
+
+    return ret;
+}
+
+/**
+ * \brief Release the held probes by deficit round-robin between their
+ *    instances, as long as they fit in the window of the network layer,
+ *    in the backlog of the pacer and in max_probes. Notify the instances
+ *    waiting for credits if some credits remain.
+ * \param network The network layer.
+ * \param max_probes The maximum number of probes released, 0 if unlimited.
+ * \param pdelay Address of a double in which the delay (in seconds) before
+ *    a capped instance may send its next probe is written, 0 if none.
+ * \return true iif successful
+ */
+
+static bool network_send_held_probes(network_t * network, size_t max_probes, double * pdelay)
+{
+    probe_t  * probes[NETWORK_SEND_BATCH_SIZE];
+    void    ** waiting_callers;
+    size_t     i, num_probes, num_busy, num_waiting_callers,
+               num_slots = SIZE_MAX;
+    double     now = NS_TO_SECONDS(get_time_ns()),
+               delay = 0;
+    bool       is_budgeted, ret = true;
+
+    // The probes released here are either in transit or paced
+    if (network->max_flying_probes) {
+        num_busy  = network->num_flying_probes + dynarray_get_size(network->paced_probes);
+        num_slots = num_busy < network->max_flying_probes ? network->max_flying_probes - num_busy : 0;
+    }
+    if (network->pacer) {
+        num_busy  = dynarray_get_size(network->paced_probes);
+        num_slots = MIN(num_slots, num_busy < NETWORK_PACED_BACKLOG ? NETWORK_PACED_BACKLOG - num_busy : 0);
+    }
+    if ((is_budgeted = (max_probes && max_probes < num_slots))) {
+        num_slots = max_probes;
+    }
+
+    *pdelay = 0;
+    while (num_slots > 0 && (num_probes = fair_queue_pop(network->held_probes, probes, MIN(num_slots, NETWORK_SEND_BATCH_SIZE), now, &delay)) > 0) {
+        if (!network_release_probes(network, probes, num_probes)) ret = false;
+        num_slots -= num_probes;
+    }
+    if (num_slots > 0) *pdelay = delay;
+
+    // The probes left because of max_probes are released on the next call
+    if (is_budgeted && num_slots == 0 && fair_queue_get_size(network->held_probes)) {
+        eventfd_write(queue_get_fd(network->sendq), 1);
+    }
+
+    // The callers registered meanwhile wait for the next free slot
+    if ((num_waiting_callers = dynarray_get_size(network->waiting_callers)) > 0
+    && network_get_num_credits(network) > 0) {
+        waiting_callers = dynarray_get_elements(network->waiting_callers);
+        for (i = 0; i < num_waiting_callers; i++) {
+            pt_throw(NULL, waiting_callers[i], event_create(NETWORK_READY, NULL, NULL, NULL));
+        }
+        dynarray_del_n_elements(network->waiting_callers, 0, num_waiting_callers, NULL);
+    }
+
+    return ret;
+}
+
+/**
+ * \brief Send the held probes and the paced probes which may be sent right
+ *    now, and arm network->pacer_timerfd to expire when the next token (of
+ *    the pacer or of a capped instance) is available.
+ * \param network The network layer.
+ * \param max_probes The maximum number of held probes released, 0 if unlimited.
+ * \return true iif successful
+ */
+
+static bool network_send_pending_probes(network_t * network, size_t max_probes)
+{
+    double held_delay = 0,
+           paced_delay = 0,
+           delay;
+    bool   ret = true;
+
+    if (!network_send_held_probes(network, max_probes, &held_delay)) {
+        ret = false;
+    }
+    if (dynarray_get_size(network->paced_probes) && !network_send_paced_probes(network, &paced_delay)) {
+        ret = false;
+    }
+
+    delay = held_delay == 0 ? paced_delay : paced_delay == 0 ? held_delay : MIN(held_delay, paced_delay);
+    if (delay > 0) {
+        // A null delay would disarm the timer
+        if (delay < NETWORK_TIMER_TICK / 1000) delay = NETWORK_TIMER_TICK / 1000;
+        if (!update_timer(network->pacer_timerfd, delay)) {
+            fprintf(stderr, "Can't set pacer_timerfd\n");
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * \brief Tell whether the probes popped from the sendq must be held, i.e.
+ *    some of them may not be sent right now, so that they are released
+ *    fairly between the instances (see network_send_held_probes).
+ * \param network The network layer.
+ * \param max_probes The maximum number of probes sent, 0 if unlimited.
+ * \return true iif the probes must be held.
+ */
+
+static bool network_is_holding(const network_t * network, size_t max_probes) {
+    return max_probes
+        || network->max_flying_probes
+        || network->pacer
+        || fair_queue_is_shaping(network->held_probes)
+        || fair_queue_get_size(network->held_probes);
+}
+
+// TODO This could be replaced by watchers: FD -> action
+bool network_process_sendq(network_t * network, size_t max_probes)
+{
+    probe_t * probes[NETWORK_SEND_BATCH_SIZE];
+    size_t    i, num_probes, num_released;
+    bool      is_holding = network_is_holding(network, max_probes),
+              ret = true;
+
+    // Probe skeleton when entering the network layer.
+    // We have to duplicate the probe since the same address of skeleton
+    // may have been passed to pt_send_probe.
+    // => We duplicate this probe in the
+    // network layer registry (network->buckets) and then tagged.
+
+    // Do not free probe at the end of this function.
+    // Its address will be saved in network->buckets and freed later.
+    // We drain the sendq NETWORK_SEND_BATCH_SIZE probes at a time, so that
+    // each batch is sent through a single system call.
+    network_stats_set_sendq_depth(network->stats, queue_get_size(network->sendq));
+    while ((num_probes = queue_drain(network->sendq, (void **) probes, NETWORK_SEND_BATCH_SIZE)) > 0) {
+        network->stats->counters.num_queued += num_probes;
+        if (is_holding) {
+            // These probes wait for their turn in the flow of their
+            // instance. A stateless probe never is in transit and is
+            // already paced by its instance, so it is not held.
+            for (i = 0, num_released = 0; i < num_probes; i++) {
+                if (network_is_stateless_probe(network, probes[i])) {
+                    probes[num_released++] = probes[i];
+                } else if (!fair_queue_push(network->held_probes, probes[i])) {
+                    fprintf(stderr, "Can't hold probe\n");
+                    network->stats->counters.num_discarded++;
+                    probe_free(probes[i]);
+                    ret = false;
+                }
+            }
+            num_probes = num_released;
+        }
+        if (num_probes > 0 && !network_release_probes(network, probes, num_probes)) {
+            ret = false;
+        }
+    }
+
+    if (is_holding && !network_send_pending_probes(network, max_probes)) {
+        ret = false;
+    }
+
+    return ret;
+}
+
+bool network_set_max_flying(network_t * network, size_t max_flying_probes)
+{
+    network->max_flying_probes = max_flying_probes;
+
+    // The probes already held are released according to the new window
+    return network_send_pending_probes(network, 0);
+}
+
+bool network_set_instance_pacing(network_t * network, double pps, size_t burst)
+{
+    if (!fair_queue_set_default_share(network->held_probes, pps, burst)) return false;
+    return network_send_pending_probes(network, 0);
+}
+
+bool network_set_caller_share(network_t * network, const void * caller, size_t weight, double pps)
+{
+    if (!fair_queue_set_share(network->held_probes, caller, weight, pps)) return false;
+    return network_send_pending_probes(network, 0);
+}
+
+size_t network_get_num_credits(const network_t * network)
+{
+    size_t num_busy;
+
+    if (!network->max_flying_probes) return SIZE_MAX;
+
+    num_busy = network->num_flying_probes
+        + dynarray_get_size(network->paced_probes)
+        + fair_queue_get_size(network->held_probes)
+        + queue_get_size(network->sendq);
+    return num_busy < network->max_flying_probes ? network->max_flying_probes - num_busy : 0;
+}
+
+bool network_wait_credits(network_t * network, void * caller)
+{
+    size_t i, num_waiting_callers = dynarray_get_size(network->waiting_callers);
+
+    for (i = 0; i < num_waiting_callers; i++) {
+        if (dynarray_get_ith_element(network->waiting_callers, i) == caller) return true;
+    }
+    return dynarray_push_element(network->waiting_callers, caller);
+}
+
+bool network_process_paced_probes(network_t * network)
+{
+    uint64_t num_expirations;
+
+    // Acknowledge the expiration of pacer_timerfd, otherwise it remains activated
+    if (read(network->pacer_timerfd, &num_expirations, sizeof(num_expirations)) == -1 && errno != EAGAIN) {
+        return false;
+    }
+
+    return network_send_pending_probes(network, 0);
+}
+
+bool network_set_pacing(network_t * network, double pps, double prefix_pps, size_t burst)
+{
+    pacer_t * pacer = NULL;
+    bool      detects_rate_limits = network->pacer && network->pacer->ratelimit;
+
+    if ((pps > 0 || prefix_pps > 0 || detects_rate_limits)
+    && !(pacer = pacer_create(pps, prefix_pps, burst, NS_TO_SECONDS(get_time_ns())))) {
+        return false;
+    }
+
+    // The new pacer keeps the rate limits detected so far
+    if (detects_rate_limits) {
+        pacer->ratelimit = network->pacer->ratelimit;
+        network->pacer->ratelimit = NULL;
+    }
+
+    pacer_free(network->pacer);
+    network->pacer = pacer;
+
+    // The probes already waiting are released according to the new rates
+    return network_send_pending_probes(network, 0);
+}
+
+bool network_set_rate_limit_detection(network_t * network, bool detect)
+{
+    pacer_t * pacer = network->pacer;
+
+    if (detect == (pacer && pacer->ratelimit)) return true;
+
+    if (!detect) {
+        ratelimit_free(pacer->ratelimit);
+        pacer->ratelimit = NULL;
+
+        // This pacer no longer paces anything
+        if (pacer->rate == 0 && pacer->prefix_rate == 0) {
+            pacer_free(pacer);
+            network->pacer = NULL;
+        }
+        return network_send_pending_probes(network, 0);
+    }
+
+    // The probes must be paced to be spaced towards the rate limited interfaces
+    if (!pacer && !(pacer = pacer_create(0, 0, NETWORK_DEFAULT_BURST, NS_TO_SECONDS(get_time_ns())))) {
+        goto ERR_PACER_CREATE;
+    }
+    if (!(pacer->ratelimit = ratelimit_create())) goto ERR_RATELIMIT_CREATE;
+    network->pacer = pacer;
+    return true;
+
+ERR_RATELIMIT_CREATE:
+    if (pacer != network->pacer) pacer_free(pacer);
+ERR_PACER_CREATE:
+    return false;
+}
+
+bool network_set_adaptive_timeout(network_t * network, double min_timeout)
+{
+    rtt_estimator_t * rtt_estimator = NULL;
+
+    if (min_timeout > network->timeout) min_timeout = network->timeout;
+    if (min_timeout > 0
+    && !(rtt_estimator = rtt_estimator_create(min_timeout, network->timeout))) {
+        return false;
+    }
+
+    rtt_estimator_free(network->rtt_estimator);
+    network->rtt_estimator = rtt_estimator;
+    return true;
+}
+
+bool network_set_capture(network_t * network, const char * filename)
+{
+    capture_t * capture = NULL;
+
+    if (filename && !(capture = capture_create(filename))) {
+        return false;
+    }
+
+    capture_free(network->capture);
+    network->capture = capture;
+    return true;
+}
+
+inline const network_stats_t * network_get_stats(const network_t * network) {
+    return network->stats;
+}
+
+void network_dump_stats(network_t * network, FILE * file) {
+    network_stats_dump(
+        network->stats, file,
+        network->num_flying_probes,
+        dynarray_get_size(network->paced_probes),
+        NS_TO_SECONDS(get_time_ns())
+    );
+}
+
+void network_write_metrics(FILE * file, void * network) {
+    network_stats_write_metrics(
+        ((network_t *) network)->stats, file,
+        ((network_t *) network)->num_flying_probes,
+        dynarray_get_size(((network_t *) network)->paced_probes)
+    );
+}
+
+bool network_set_stats_interval(network_t * network, double interval)
+{
+    if (interval < 0) return false;
+    network->stats_interval = interval;
+    return update_timer(network->stats_timerfd, interval);
+}
+
+bool network_process_stats(network_t * network)
+{
+    uint64_t num_expirations;
+
+    // Acknowledge the expiration of stats_timerfd, otherwise it remains activated
+    if (read(network->stats_timerfd, &num_expirations, sizeof(num_expirations)) == -1 && errno != EAGAIN) {
+        return false;
+    }
+
+    network_dump_stats(network, stderr);
+    return update_timer(network->stats_timerfd, network->stats_interval);
+}
+
+bool network_add_stateless_caller(network_t * network, void * caller, uint8_t * pinstance_id)
+{
+    size_t i;
+
+    // The stateless probes are not tagged, so the demultiplexer cannot
+    // route their replies
+    if (network->demux) {
+        fprintf(stderr, "network_add_stateless_caller: stateless probes cannot be demultiplexed\n");
+        return false;
+    }
+
+    for (i = 0; i < STATELESS_MAX_INSTANCES; i++) {
+        if (!network->stateless_callers[i]) {
+            network->stateless_callers[i] = caller;
+            network->num_stateless_callers++;
+            *pinstance_id = i;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "network_add_stateless_caller: too many stateless instances\n");
+    return false;
+}
+
+void network_forget_caller(network_t * network, const void * caller) {
+    size_t i;
+
+    recent_probes_forget_caller(network->recent_probes, caller);
+    fair_queue_forget_caller(network->held_probes, caller);
+    for (i = 0; i < dynarray_get_size(network->waiting_callers); i++) {
+        if (dynarray_get_ith_element(network->waiting_callers, i) == caller) {
+            dynarray_del_ith_element(network->waiting_callers, i, NULL);
+            break;
+        }
+    }
+}
+
+void network_del_stateless_caller(network_t * network, uint8_t instance_id)
+{
+    if (network->stateless_callers[instance_id]) {
+        network->stateless_callers[instance_id] = NULL;
+        network->num_stateless_callers--;
+    }
+}
+
+/**
+ * \brief Account the outcome of a probe in the rate limit detector of
+ *    network->pacer (if any).
+ * \param network The network layer
+ * \param probe The probe.
+ * \param reply Its reply, NULL if it has expired.
+ */
+
+static void network_account_rate_limit(network_t * network, const probe_t * probe, const probe_t * reply)
+{
+    ratelimit_t * ratelimit;
+    address_t     dst, interface;
+    uint8_t       ttl;
+    double        sending_time;
+
+    if (!network->pacer || !(ratelimit = network->pacer->ratelimit)) return;
+
+    memset(&dst, 0, sizeof(address_t));
+    if (!probe_extract(probe, "dst_ip", &dst) || !probe_extract(probe, "ttl", &ttl)) return;
+    sending_time = NS_TO_SECONDS(probe_get_sending_time(probe));
+
+    if (reply) {
+        memset(&interface, 0, sizeof(address_t));
+        if (probe_extract(reply, "src_ip", &interface)) {
+            ratelimit_add_reply(ratelimit, &dst, ttl, &interface, sending_time);
+        }
+    } else {
+        ratelimit_add_loss(ratelimit, &dst, ttl, sending_time);
+    }
+}
+
+/**
+ * \brief Classify a reply matching a probe which is no longer in transit,
+ *    and notify the instance which has sent this probe (if still running).
+ * \param network The network layer
+ * \param packet The received packet.
+ * \param reply The reply wrapping packet. It is released.
+ * \param entry The entry of network->recent_probes matched by the reply.
+ * \return true iif successful
+ */
+
+static bool network_process_recent_reply(network_t * network, packet_t * packet, probe_t * reply, recent_probe_t * entry)
+{
+    event_type_t   type;
+    event_t      * event;
+    packet_t     * kept_packet;
+    uint64_t       recv_time = probe_get_recv_time(reply);
+
+    if (entry->state == RECENT_PROBE_EXPIRED) {
+        // The next replies to this probe are duplicates
+        type = PROBE_REPLY_LATE;
+        entry->state = RECENT_PROBE_MATCHED;
+        network->stats->counters.num_late++;
+        TRACEPOINT(reply_late, reply, entry->tag, probe_get_traced_instance_id(entry->probe), recv_time);
+    } else {
+        type = PROBE_REPLY_DUPLICATE;
+        network->stats->counters.num_duplicates++;
+        TRACEPOINT(reply_duplicate, reply, entry->tag, probe_get_traced_instance_id(entry->probe), recv_time);
+    }
+
+    if (network->capture) {
+        network_capture(network, reply, recv_time, CAPTURE_INBOUND, entry->probe, entry->caller);
+    }
+
+    // The instance which has sent this probe has been released
+    if (!entry->caller) goto DONE;
+
+    if (packet_is_borrowed(packet)) {
+        if (!(kept_packet = packet_dup(packet))) goto ERR_PACKET_DUP;
+        probe_free(reply);
+        if (!(reply = probe_wrap_packet(kept_packet))) {
+            packet_free(kept_packet);
+            goto ERR_PROBE_WRAP_KEPT_PACKET;
+        }
+        probe_set_recv_time(reply, recv_time);
+    }
+    probe_set_memstats(reply, entry->probe->memstats);
+
+    if (!(event = event_create_probe_reply(type, entry->probe, reply, NULL))) {
+        goto ERR_EVENT_CREATE_PROBE_REPLY;
+    }
+    pt_throw(NULL, entry->caller, event);
+DONE:
+    probe_free(reply);
+    return true;
+
+ERR_EVENT_CREATE_PROBE_REPLY:
+ERR_PACKET_DUP:
+    probe_free(reply);
+ERR_PROBE_WRAP_KEPT_PACKET:
+    return false;
+}
+
+/**
+ * \brief Match a packet popped from network->recvq with its probe and
+ *    notify the instance which has sent this probe.
+ * \param network The network layer
+ * \param packet The received packet.
+ * \param reply_class The class of the packet (see reply_classify_packets).
+ * \return true iif successful
+ */
+
+static bool network_process_packet(network_t * network, packet_t * packet, reply_class_t reply_class)
+{
+    probe_t        * probe,
+                   * reply;
+    event_t        * event;
+    packet_t       * kept_packet;
+    address_t        dst;
+    void           * caller;
+    recent_probe_t * recent;
+    uint64_t         recv_time = packet_get_recv_time(packet),
+                     dispatch_time;
+
+    // Transform the reply into a probe_t instance
+    if(!(reply = probe_wrap_packet(packet))) {
+        goto ERR_PROBE_WRAP_PACKET;
+    }
+
+    // Prefer the timestamp set by the kernel (if any)
+    if (recv_time == 0) recv_time = get_time_ns();
+    probe_set_recv_time(reply, recv_time);
+    probe_set_reply_class(reply, reply_class);
+    TRACEPOINT(reply_received, reply, packet_get_size(packet), recv_time);
+
+    if (network->is_verbose) {
+        printf("Got reply:\n");
+        probe_dump(reply);
+    }
+
+    // Find the probe corresponding to this reply
+    // The corresponding pointer (if any) is removed from network->buckets
+    if ((probe = network_get_matching_probe(network, reply, &recent))) {
+        caller = probe->caller;
+        probe_set_memstats(reply, probe->memstats);
+    } else if (recent) {
+        return network_process_recent_reply(network, packet, reply, recent);
+    } else {
+        caller = network_get_stateless_caller(network, reply, 2);
+    }
+
+    if (network->capture) {
+        network_capture(network, reply, recv_time, CAPTURE_INBOUND, probe, caller);
+    }
+
+    // This reply is not related to a stateless probe either
+    if (!probe && !caller) {
+        network->stats->counters.num_unmatched++;
+        goto ERR_PROBE_DISCARDED;
+    }
+    network->stats->counters.num_matched++;
+
+    // Refine the timeouts of the next probes sent towards this destination
+    if (probe && network->rtt_estimator) {
+        memset(&dst, 0, sizeof(address_t));
+        if (probe_extract(probe, "dst_ip", &dst)) {
+            rtt_estimator_update(
+                network->rtt_estimator,
+                &dst,
+                NS_TO_SECONDS(recv_time) - NS_TO_SECONDS(probe_get_sending_time(probe))
+            );
+        }
+    }
+
+    // Detect whether the interface which has replied is rate limited
+    if (probe) network_account_rate_limit(network, probe, reply);
+
+    // This reply is kept by the upper layers: if its bytes are borrowed,
+    // this is the time to copy them.
+    if (packet_is_borrowed(packet)) {
+        if (!(kept_packet = packet_dup(packet))) goto ERR_PACKET_DUP;
+        probe_free(reply);
+        if (!(reply = probe_wrap_packet(kept_packet))) {
+            packet_free(kept_packet);
+            goto ERR_PROBE_WRAP_KEPT_PACKET;
+        }
+        probe_set_recv_time(reply, recv_time);
+    }
+
+    // Notify the instance which has build the probe that we've got the corresponding reply.
+    // The (probe, reply) pair is stored in the event itself. The probe is
+    // NULL if the reply is related to a stateless probe.
+    if (!(event = event_create_probe_reply(PROBE_REPLY, probe, reply, NULL))) {
+        goto ERR_EVENT_CREATE_PROBE_REPLY;
+    }
+    if ((dispatch_time = get_time_ns()) >= recv_time) {
+        histogram_add(network->stats->reply_to_dispatch, dispatch_time - recv_time);
+    }
+    pt_throw(NULL, caller, event);
+
+    // The event holds its own references to the probe and to the reply
+    probe_free(probe);
+    probe_free(reply);
+    return true;
+
+ERR_EVENT_CREATE_PROBE_REPLY:
+ERR_PACKET_DUP:
+ERR_PROBE_DISCARDED:
+    probe_free(reply);
+ERR_PROBE_WRAP_KEPT_PACKET:
+    // The matched probe (if any) is lost: its caller is not notified
+    probe_free(probe);
+    return false;
+ERR_PROBE_WRAP_PACKET:
+    packet_free(packet);
+    return false;
+}
+
+bool network_process_recvq(network_t * network)
+{
+    packet_t      * packets[NETWORK_RECV_BATCH_SIZE];
+    reply_class_t   reply_classes[NETWORK_RECV_BATCH_SIZE];
+    size_t          i, num_packets;
+    bool            ret = true;
+
+    // Pop every pending packet from the queue. Each batch is classified
+    // at once, before the replies are matched one by one.
+    network_stats_set_recvq_depth(network->stats, queue_get_size(network->recvq));
+    while ((num_packets = queue_drain(network->recvq, (void **) packets, NETWORK_RECV_BATCH_SIZE)) > 0) {
+        reply_classify_packets(packets, num_packets, reply_classes);
+        for (i = 0; i < num_packets; i++) {
+            if (!network_process_packet(network, packets[i], reply_classes[i])) {
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
+bool network_process_sniffer(network_t * network, uint8_t protocol_id) {
+    // Replies must not be matched before the sending time of their probe is known
+    network_update_sending_times(network);
+    return sniffer_process_packets(network->sniffer, protocol_id);
+}
+
+bool network_process_tcp_sniffer(network_t * network, int family) {
+    // Replies must not be matched before the sending time of their probe is known
+    network_update_sending_times(network);
+    return sniffer_process_tcp_packets(network->sniffer, family);
+}
+
+bool network_process_simulator(network_t * network) {
+    return simulator_process_replies(network->simulator);
+}
+
+bool network_process_demux(network_t * network) {
+    // Replies must not be matched before the sending time of their probe is known
+    network_update_sending_times(network);
+    return demux_client_process(network->demux);
+}
+
+/**
+ * \brief Callback called by timing_wheel_advance for each expired probe.
+ * \param timer The timer of the expired flying probe. It has already been
+ *    removed from network->timeouts.
+ * \param network The network layer
+ */
+
+static void network_flying_probe_expire(wheel_timer_t * timer, void * network)
+{
+    flying_probe_t * flying_probe = timer->data;
+    probe_t        * probe = flying_probe->probe;
+
+    // This probe has expired, raise a PROBE_TIMEOUT event.
+    ((network_t *) network)->stats->counters.num_timeouts++;
+    TRACEPOINT(probe_timeout, probe, flying_probe->tag, probe_get_traced_instance_id(probe), probe_get_sending_time(probe));
+    recent_probes_add(((network_t *) network)->recent_probes, probe, flying_probe->tag, RECENT_PROBE_EXPIRED, get_time_ns());
+    network_account_rate_limit((network_t *) network, probe, NULL);
+    network_flying_probe_del((network_t *) network, flying_probe);
+    pt_throw(NULL, probe->caller, event_create(PROBE_TIMEOUT, probe, NULL, (ELEMENT_FREE) probe_free));
+}
+
+bool network_inject_probe(network_t * network, probe_t * probe)
+{
+    // No transmit timestamp is expected
+    socketpool_tx_key_t tx_key = { .family = AF_UNSPEC, .key = 0 };
+
+    probe_set_sending_time(probe, get_time_ns());
+    if (!network_flying_probe_add(network, probe, &tx_key)) return false;
+    network->stats->counters.num_sent++;
+    return network_update_next_timeout(network);
+}
+
+bool network_inject_replies(network_t * network, packet_t ** packets, size_t num_packets) {
+    return network_sniffer_callback(packets, num_packets, network);
+}
+
+bool network_drop_expired_flying_probe(network_t * network)
+{
+    uint64_t num_expirations;
+
+    // Acknowledge the expiration of timerfd, otherwise it remains activated
+    if (read(network->timerfd, &num_expirations, sizeof(num_expirations)) == -1 && errno != EAGAIN) {
+        return false;
+    }
+    network->is_armed = false;
+
+    // Drop every probe expiring up to the current tick. Probes matched in
+    // the meantime are no longer in network->timeouts.
+    timing_wheel_advance(network->timeouts, NS_TO_SECONDS(get_time_ns()), network_flying_probe_expire, network);
+
+    return network_update_next_timeout(network);
+}
+
+//------------------------------------------------------------------------------------
+// Scheduling
+//------------------------------------------------------------------------------------
+
+#ifdef USE_SCHEDULING
+
+/**
+ * \brief Push in network->sendq and send the scheduled probes departing
+ *    at a given time at the latest. The probes which must be sent again
+ *    are rescheduled once they have been sent.
+ * \param network The network layer.
+ * \param until The latest departure time (see get_time_ns).
+ */
+
+static void network_release_scheduled_probes(network_t * network, uint64_t until)
+{
+    probe_heap_entry_t entries[NETWORK_SEND_BATCH_SIZE];
+    probe_t          * probe;
+    size_t             i, num_entries;
+    uint64_t           now = get_time_ns();
+
+    while ((num_entries = probe_heap_pop(network->scheduled_probes, until, entries, NETWORK_SEND_BATCH_SIZE)) > 0) {
+        for (i = 0; i < num_entries; i++) {
+            probe = entries[i].probe;
+            probe_set_queueing_time(probe, now);
+            TRACEPOINT(probe_queued, probe, probe_get_traced_instance_id(probe), now);
+#ifdef USE_TXTIME
+            // The kernel holds this packet until its departure time
+            packet_set_departure_time(probe->packet, entries[i].departure > now ? entries[i].departure : 0);
+#endif
+            if (!queue_push_element(network->sendq, probe)) {
+                fprintf(stderr, "Can't release scheduled probe\n");
+            }
+        }
+
+        // These probes must have left the sendq before being rescheduled
+        if (!network_process_sendq(network, 0)) {
+            fprintf(stderr, "Can't send scheduled probes\n");
+        }
+
+        // Stamped probes may not set left_to_send: they are sent once.
+        for (i = 0; i < num_entries; i++) {
+            probe = entries[i].probe;
+            if (probe->left_to_send > 1) {
+                --(probe->left_to_send);
+                probe_next_delay(probe);
+                if (!probe_heap_push(network->scheduled_probes, probe, entries[i].origin)) {
+                    fprintf(stderr, "Can't reschedule probe\n");
+                }
+            }
+        }
+    }
+}
+
+/**
+ * \brief Arm network->scheduled_timerfd so that it expires when the next
+ *    scheduled probe must be released (see network_process_scheduled_probe).
+ * \param network The network layer.
+ * \return true iif successful
+ */
+
+static bool network_arm_scheduled_timer(network_t * network)
+{
+    uint64_t departure = probe_heap_get_next_departure(network->scheduled_probes),
+             now;
+
+    if (departure == UINT64_MAX) {
+        return update_timer(network->scheduled_timerfd, 0);
+    }
+#ifdef USE_TXTIME
+    if (network->socketpool && socketpool_has_txtime(network->socketpool)) {
+        departure -= MIN(departure, SECONDS_TO_NS(NETWORK_TXTIME_HORIZON));
+    }
+#endif
+
+    // A null delay would disarm the timer
+    now = get_time_ns();
+    return update_timer(
+        network->scheduled_timerfd,
+        departure > now ? MAX(NS_TO_SECONDS(departure - now), NETWORK_SCHEDULING_MIN_DELAY) : NETWORK_SCHEDULING_MIN_DELAY
+    );
+}
+
+/**
+ * \brief Store a probe in network->scheduled_probes.
+ * \param network The network layer.
+ * \param probe A probe whose delay is set.
+ * \param origin The timestamp from which its delay is counted (see get_time_ns).
+ * \return true iif the probe is stored (the network layer then holds it).
+ */
+
+static bool network_schedule_probe(network_t * network, probe_t * probe, uint64_t origin)
+{
+    uint64_t departure = probe_heap_get_next_departure(network->scheduled_probes);
+
+    if (!probe_heap_push(network->scheduled_probes, probe, origin)) return false;
+
+    // The timer is only updated if this probe departs first. If it can't
+    // be armed, the probe is released by the next expiration of the timer.
+    if (probe_heap_get_next_departure(network->scheduled_probes) < departure
+    && !network_arm_scheduled_timer(network)) {
+        fprintf(stderr, "Can't arm the scheduling timer\n");
+    }
+    return true;
+}
 
 void network_process_scheduled_probe(network_t * network) {
-    tree_node_t * root;
-
-    if ((root = probe_group_get_root(network->scheduled_probes))) {
-        // Handle every probe that must be sent right now
-        probe_group_iter_next_scheduled_probes(
-            probe_group_get_root(network->scheduled_probes),
-            (void (*) (void *, tree_node_t *, size_t)) network_process_probe_node,
-            (void *) network
-        );
+    uint64_t until = get_time_ns();
+
+#ifdef USE_TXTIME
+    // Probes departing within the horizon are handed over to the kernel at once
+    if (network->socketpool && socketpool_has_txtime(network->socketpool)) {
+        until += SECONDS_TO_NS(NETWORK_TXTIME_HORIZON);
     }
+#endif
+    network_release_scheduled_probes(network, until);
+    network_arm_scheduled_timer(network);
+}
+
+double network_get_next_scheduled_probe_delay(const network_t * network) {
+    uint64_t departure = probe_heap_get_next_departure(network->scheduled_probes),
+             now = get_time_ns();
+
+    return departure == UINT64_MAX ? DBL_MAX :
+        departure > now ? NS_TO_SECONDS(departure - now) : -NS_TO_SECONDS(now - departure);
 }
 
 bool network_update_scheduled_timer(network_t * network, double delay) {
@@ -22,9 +22,22 @@
 #include "queue.h"       // queue_t
 #include "socketpool.h"  // socketpool_t
 #include "sniffer.h"     // sniffer_t
-#include "dynarray.h"    // dynarray_t
+#include "timing_wheel.h" // timing_wheel_t
+#include "tag_allocator.h" // tag_allocator_t
+#include "probe.h"       // probe_t
 #include "options.h"     // option_t
-#include "probe_group.h" // probe_group_t
+#include "probe_heap.h"  // probe_heap_t
+#include "pacer.h"       // pacer_t
+#include "fair_queue.h"  // fair_queue_t
+#include "match_key.h"   // match_key_t
+#include "rtt_estimator.h" // rtt_estimator_t
+#include "stateless.h"   // STATELESS_MAX_INSTANCES
+#include "dynarray.h"    // dynarray_t
+#include "capture.h"     // capture_t
+#include "simulator.h"   // simulator_t
+#include "demux.h"       // demux_client_t
+#include "network_stats.h" // network_stats_t
+#include "recent_probes.h" // recent_probes_t
 
 // If no matching reply has been sniffed in the next 3 sec, we
 // consider that we won't never sniff such a reply. The
@@ -35,6 +48,124 @@
 #define OPTIONS_NETWORK_WAIT {NETWORK_DEFAULT_TIMEOUT, 0, INT_MAX}
 #define HELP_w "Set the number of seconds to wait for response to a probe (default is 5.0)"
 
+// The timeout of a probe may instead be adapted to the RTT measured towards
+// its destination (see rtt_estimator.h). TIMEOUT (-w) is then the upper bound
+// of the timeouts, and is used until a first reply has been received.
+
+#define NETWORK_DEFAULT_MIN_TIMEOUT 0
+#define OPTIONS_NETWORK_MIN_WAIT {NETWORK_DEFAULT_MIN_TIMEOUT, 0, INT_MAX}
+#define HELP_min_wait "Adapt the timeout of each probe to the RTT measured towards its destination (smoothed RTT + 4 * RTT variation), without waiting less than MIN_TIMEOUT seconds nor more than TIMEOUT seconds (default is 0, i.e. always wait TIMEOUT seconds)"
+
+// Probe IDs (tags) are encoded in the checksum of the transport layer, so
+// that at most 2^16 probes may be in transit at once. Beyond 16 bits, IPv4
+// probes also carry the upper bits of their tag in the IP identification.
+// IPv6 probes, and TCP probes tagged in their sequence number (see
+// HELP_seq_tags), are always tagged on 16 bits.
+
+#define NETWORK_DEFAULT_TAG_BITS 16
+#define OPTIONS_NETWORK_TAG_BITS {NETWORK_DEFAULT_TAG_BITS, 16, TAG_ALLOCATOR_MAX_BITS}
+#define HELP_tag_bits "Set the number of bits of the probe IDs, so that more probes can be in transit at once. Beyond 16 bits, IPv4 probes also carry their ID in the IP identification field (default is 16)"
+
+// Best-effort probes may be paced by token buckets (see pacer.h), globally
+// and per destination prefix, to avoid bursts triggering ICMP rate limiting.
+// A rate of 0 means that the probes are sent as soon as possible.
+
+#define NETWORK_DEFAULT_PPS 0
+#define OPTIONS_NETWORK_PPS {NETWORK_DEFAULT_PPS, 0, INT_MAX}
+#define HELP_pps "Set the maximum number of probes sent per second (default is 0, i.e. unlimited)"
+
+#define NETWORK_DEFAULT_PREFIX_PPS 0
+#define OPTIONS_NETWORK_PREFIX_PPS {NETWORK_DEFAULT_PREFIX_PPS, 0, INT_MAX}
+#define HELP_prefix_pps "Set the maximum number of probes sent per second towards a given /24 (IPv4) or /48 (IPv6) prefix (default is 0, i.e. unlimited)"
+
+#define NETWORK_DEFAULT_BURST 1
+#define OPTIONS_NETWORK_BURST {NETWORK_DEFAULT_BURST, 1, INT_MAX}
+#define HELP_burst "Set the number of probes which may be sent at once when the probes are paced (default is 1)"
+
+// The routers rate limiting their replies may also be detected from the
+// replies and the timeouts of the probes (see ratelimit.h), and the probes
+// expected to reach them are then paced at the rate at which they reply.
+
+#define HELP_detect_rate_limits "Detect the routers rate limiting their replies, and pace the probes expected to reach them at the rate at which they reply"
+
+// The number of probes in transit may be bounded: the probes beyond this
+// window wait in the network layer, and the algorithms may wait for free
+// slots before generating further probes (see network_wait_credits).
+// A window of 0 means that the number of probes in transit is unlimited.
+
+#define NETWORK_DEFAULT_MAX_FLYING 0
+#define OPTIONS_NETWORK_MAX_FLYING {NETWORK_DEFAULT_MAX_FLYING, 0, INT_MAX}
+#define HELP_max_flying "Set the maximum number of probes in transit at once, the further probes being held until a reply or a timeout frees a slot (default is 0, i.e. unlimited)"
+
+// The probes held by the network layer (because of the window, of the
+// pacing, or because the main loop has replies to process first) are
+// released fairly between the instances which have sent them (see
+// fair_queue.h). Each instance may also be capped.
+
+#define NETWORK_DEFAULT_INSTANCE_PPS 0
+#define OPTIONS_NETWORK_INSTANCE_PPS {NETWORK_DEFAULT_INSTANCE_PPS, 0, INT_MAX}
+#define HELP_instance_pps "Set the maximum number of probes sent per second by each algorithm instance, e.g. each traceroute run with -F (default is 0, i.e. unlimited)"
+
+// Maximum number of probes released from the fair queue which may wait
+// for a token of the pacer, so that the pacer does not undo the fairness.
+#define NETWORK_PACED_BACKLOG 256
+
+// The probes sent and the replies received may be recorded in a pcapng file
+// (see capture.h), each packet being commented with its tag and its instance.
+
+#define HELP_pcap "Record the probes sent and the replies received in the pcapng file FILE"
+
+// The probes may be sent through a simulated network instead of raw
+// sockets (see simulator.h), which does not require root privileges.
+
+#define HELP_simulate "Send the probes through a simulated network, whose topology (hops, load balancers, losses, rate limits and RTTs) is described in the file TOPOLOGY, instead of the real network"
+
+// The replies may be received from a host-level demultiplexer (see
+// demux.h) instead of being sniffed, so that several processes running
+// on the same host do not parse the replies of each other. Each process
+// is granted a range of tags, which bounds its number of probes in transit.
+
+#define NETWORK_DEFAULT_DEMUX_TAGS 4096
+#define OPTIONS_NETWORK_DEMUX_TAGS {NETWORK_DEFAULT_DEMUX_TAGS, 1, DEMUX_NUM_TAGS}
+#define HELP_demux "Receive the replies from the demultiplexer listening on the UNIX socket PATH (see --demux-server) instead of sniffing them"
+#define HELP_demux_tags "Set the number of probe IDs requested to the demultiplexer, i.e. the maximum number of probes in transit (default is 4096)"
+
+// The raw sockets may be opened by a privileged broker (see broker.h)
+// instead of this process, which then requires no privilege.
+
+#define HELP_broker "Use the raw sockets opened by the broker listening on the UNIX socket PATH (see --broker-server), so that no privilege is required"
+
+// The TCP probes may carry their tag in the upper 16 bits of their sequence
+// number instead of their checksum, like SYN cookies. The destinations
+// echo it in the acknowledgment number of their SYN/ACK and RST, which are
+// then sniffed too, and ICMP errors quoting only 8 bytes of the TCP header
+// still carry it. Their replies are matched without scanning every probe
+// in transit (see network_get_matching_probe).
+
+#define HELP_seq_tags "Carry the probe IDs of the TCP probes in their sequence number, and match the SYN/ACK and RST sent by the destinations"
+
+// The source address of the probes is the one picked by the kernel for
+// each destination, which is cached (see src_cache.h), unless it is fixed.
+
+#define HELP_source "Set ADDRESS as the source address of the probes, instead of the address picked by the kernel towards each destination"
+
+// The statistics of the network layer (see network_stats.h) may be printed
+// periodically on the standard error, to tune the rates of a measurement.
+
+#define NETWORK_DEFAULT_STATS_INTERVAL 0
+#define OPTIONS_NETWORK_STATS {NETWORK_DEFAULT_STATS_INTERVAL, 0, INT_MAX}
+// The main loop may be profiled (see profiler.h) to find out whether it
+// is saturated, and which handlers consume its time.
+
+#define HELP_profile "Profile the main loop (utilization, events per wakeup, calls and time spent per file descriptor and per algorithm), print the profile along with the statistics of the network layer (see --stats) and on exit, and export it with the metrics"
+
+// The replies may be passed to the algorithms as soon as they are matched
+// (see pt_loop_set_direct_dispatch).
+
+#define HELP_direct_dispatch "Pass the replies to the algorithms as soon as they are matched, instead of on the next wake up of the main loop"
+
+#define HELP_stats "Print the statistics of the network layer (probes queued, sent, matched, timed out, discarded, replies unmatched, queue depths and per-stage delays) and the memory used by each subsystem on the standard error every SECONDS seconds (default is 0, i.e. never)"
+
 /**
  * \struct network_t
  * \brief Structure describing a network
@@ -44,7 +175,7 @@
 // We choose (1) because this is more efficient
 //
 // ---------------------------------------------------------------------------
-// 1) Delegate probe_t and packet_t frees to upper layers
+// 1) Share probe_t and packet_t with the upper layers (reference counting)
 // ---------------------------------------------------------------------------
 //
 // *** Advantages / drawbacks
@@ -56,29 +187,32 @@
 //
 // *** Probes memory management:
 //
-// The network layer..must never free probe (e.g. probe_t instances referenced
-// in network->probes and in network->sendq) since they are allocated by the
-// upper layers.
+// The probe_t instances are reference counted (see probe_ref, probe_free).
+// pt_send_probe hands the reference of the upper layer to the network
+// layer, which keeps it while the probe is queued or in flight (e.g.
+// network->sendq, network->buckets), and releases it if the probe cannot
+// be sent. Once the probe is answered or expires, this reference is handed
+// to the PROBE_REPLY or PROBE_TIMEOUT event: the probe is released along
+// with the event, unless a handler takes its own reference (see probe_ref).
+// A stateless probe is given back to its caller (see PROBE_SENT).
 //
 // Upper layers must never alters probe passed to the network layer..while they
 // are in flight, otherwise the network layer..won't be able to match replies
 // with their corresponding probes.
 //
-// If needed, upper layers could duplicate these probe by using probe_dup.
-//
 // *** Replies memory management:
 //
-// The network layer..do not free by itself packet_t referenced in
-// network->recvq since they'll be wrapped in probe_t by pt_loop. Freeing those
-// probe_t instance will free the corresponding packet_t instance in the
-// network layer..
+// The packet_t instances of network->recvq are owned by the network layer,
+// which wraps each of them in a reply (probe_t). A PROBE_REPLY event holds
+// a reference to the reply and to its probe (see event_create_probe_reply):
+// both are released with the last event referencing them. Upper layers
+// forwarding them in their own events (e.g. TRACEROUTE_PROBE_REPLY) thus
+// share them instead of duplicating them.
 //
 // Upper layer must never alter reply raised by PROBE_REPLY event otherwise the
 // corresponding packet_t instance (stored in the network layer.) will also be
 // altered.
 //
-// If needed, upper layers could duplicate these probe by using probe_dup.
-//
 // ---------------------------------------------------------------------------
 // 2) Duplicate probe_t instance passed to the network layer..and duplicate
 // packet_t instance raised to pt_loop
@@ -97,27 +231,128 @@
 //
 // The network layer..has to free its probe_t and packet_t by itself in
 // network_free().  Each probe_t instance is only referenced once (either in
-// network->sendq if it is not yet sent, or either in network->probes if it is
+// network->sendq if it is not yet sent, or either in network->buckets if it is
 // in flight).
 //
 // Matching probes (see network_get_matching_probe) must be freed once
 // duplicated and raised to the upper layers, or move in a dedicated
 // dynarray for archive or duplicate detection purposes.
+//
+// ---------------------------------------------------------------------------
+// Duplicate and late replies
+// ---------------------------------------------------------------------------
+//
+// Once matched or expired, a probe is recorded in network->recent_probes,
+// which holds its own reference for a while (see recent_probes.h). A reply
+// matching none of the probes in transit but one of these probes is
+// passed to the caller of this probe in a PROBE_REPLY_DUPLICATE or a
+// PROBE_REPLY_LATE event (as a PROBE_REPLY event) instead of being
+// compared to every probe in transit and discarded. The next replies to a
+// late probe are duplicates.
+
+// Maximum number of probes popped from the sendq and sent at once by
+// network_process_sendq().
+#define NETWORK_SEND_BATCH_SIZE SOCKETPOOL_BATCH_SIZE
+
+// Maximum number of packets popped at once from the recvq by
+// network_process_recvq().
+#define NETWORK_RECV_BATCH_SIZE SNIFFER_BATCH_SIZE
+
+// Number of buckets used to index the flying probes by tag. Must be a power of 2.
+#define NETWORK_NUM_BUCKETS 1024
+
+// Maximum number of probes recently matched or expired kept to classify
+// the duplicate and late replies, and for how long (in seconds).
+#define NETWORK_NUM_RECENT_PROBES     4096
+#define NETWORK_RECENT_PROBES_LIFETIME 10
+
+// Granularity of probe timeouts (in seconds). Probes expiring during
+// the same tick are dropped at once, and network->timerfd is armed at
+// most once per tick.
+#define NETWORK_TIMER_TICK 0.01
+
+#ifdef USE_SCHEDULING
+// Minimal delay (in seconds) used to arm network->scheduled_timerfd when
+// a scheduled probe is already due (a null delay disarms a timerfd).
+#    define NETWORK_SCHEDULING_MIN_DELAY 0.000001
+#endif
+
+#ifdef USE_TXTIME
+// Scheduled probes departing within this delay (in seconds) are handed
+// over to the kernel at once, along with their departure time.
+#    define NETWORK_TXTIME_HORIZON 0.1
+#endif
+
+#ifdef USE_TIMESTAMPING
+// Number of slots used to index the flying probes by transmit timestamp
+// key (see socketpool_tx_key_t). Must be a power of 2.
+#    define NETWORK_NUM_TX_KEYS 1024
+#endif
+
+/**
+ * \struct flying_probe_t
+ * \brief Structure describing a probe in transit. Each flying_probe_t
+ *    instance is linked in network->buckets (to match replies according to
+ *    their tag), in the list of flying probes (from the oldest to the
+ *    youngest one) and in network->timeouts (to manage its timeout).
+ */
+
+typedef struct flying_probe_s {
+    probe_t               * probe;       /**< The probe_t instance in transit */
+    uint32_t                tag;         /**< The tag (probe ID) carried by this probe (host-side endianness) */
+    wheel_timer_t           timer;       /**< Timer stored in network->timeouts */
+    match_key_t             key;         /**< Fields compared to the replies, extracted on demand (see network_probe_matches) */
+    bool                    has_key;     /**< true iif key has been extracted */
+#ifdef USE_TIMESTAMPING
+    socketpool_tx_key_t     tx_key;      /**< Identifies the transmit timestamps of this probe */
+#endif
+    struct flying_probe_s * bucket_next; /**< Next flying probe stored in the same bucket */
+    struct flying_probe_s * older;       /**< Previous flying probe sent by this network */
+    struct flying_probe_s * younger;     /**< Next flying probe sent by this network */
+} flying_probe_t;
 
 typedef struct network_s {
-    socketpool_t  * socketpool;        /**< Pool of sockets used by this network */
-    queue_t       * sendq;             /**< Queue containing packet to send  (probe_t instances) */
-    queue_t       * recvq;             /**< Queue containing received packet (packet_t instances) */
-    sniffer_t     * sniffer;           /**< Sniffer to use on this network */
-    dynarray_t    * probes;            /**< Probes in transit, from the oldest probe_t instance to the youngest one. */
-    int             timerfd;           /**< Used for probe timeouts. Linux specific. Activated when a probe timeout occurs */
-    uint16_t        last_tag;          /**< Last probe ID used */
-    double          timeout;           /**< The timeout value used by this network (in seconds) */
+    socketpool_t   * socketpool;        /**< Pool of sockets used by this network (NULL if simulated) */
+    queue_t        * sendq;             /**< Queue containing packet to send  (probe_t instances) */
+    queue_t        * recvq;             /**< Queue containing received packet (packet_t instances) */
+    sniffer_t      * sniffer;           /**< Sniffer to use on this network (NULL if simulated) */
+    simulator_t    * simulator;         /**< Simulated network replacing the socketpool and the sniffer (NULL if disabled) */
+    demux_client_t * demux;             /**< Receives the replies routed by a host demultiplexer, replacing the sniffer (NULL if disabled) */
+    bool             has_seq_tags;      /**< true iif the TCP probes carry their tag in their sequence number (see HELP_seq_tags) */
+    flying_probe_t * oldest_probe;      /**< Oldest probe in transit */
+    flying_probe_t * youngest_probe;    /**< Youngest probe in transit */
+    size_t           num_flying_probes; /**< Number of probes in transit */
+    size_t           max_flying_probes; /**< Maximum number of probes in transit (0 if unlimited) */
+    fair_queue_t   * held_probes;       /**< Probes popped from the sendq and waiting for their turn (see fair_queue.h) */
+    dynarray_t     * waiting_callers;   /**< Instances waiting for a free slot (see network_wait_credits) */
+    flying_probe_t * buckets[NETWORK_NUM_BUCKETS]; /**< Probes in transit, indexed by tag */
+    timing_wheel_t * timeouts;          /**< Timeouts of the probes in transit */
+    recent_probes_t * recent_probes;    /**< Probes recently matched or expired, to classify the duplicate and late replies */
+    int              timerfd;           /**< Used for probe timeouts. Linux specific. Activated when a tick of network->timeouts must be processed */
+    uint64_t         armed_tick;        /**< Tick of network->timeouts for which network->timerfd is armed */
+    bool             is_armed;          /**< true iif network->timerfd is armed */
+    tag_allocator_t * tags;             /**< Probe IDs in use */
+#ifdef USE_TIMESTAMPING
+    flying_probe_t * tx_pending[NETWORK_NUM_TX_KEYS]; /**< Probes waiting for their transmit timestamp, indexed by key */
+#endif
+    double           timeout;           /**< The timeout value used by this network (in seconds) */
+    size_t           shard;             /**< Shard of the destinations probed by this network */
+    size_t           num_shards;        /**< Number of shards (1 if this network is not sharded) */
+    pacer_t        * pacer;             /**< Paces the best-effort probes (NULL if they are sent as soon as possible) */
+    dynarray_t     * paced_probes;      /**< Probes popped from the sendq and waiting for a token of network->pacer */
+    int              pacer_timerfd;     /**< Activated when network->pacer may release a paced probe */
+    rtt_estimator_t * rtt_estimator;    /**< Adapts the timeout of each probe (NULL if network->timeout is always used) */
+    void           * stateless_callers[STATELESS_MAX_INSTANCES]; /**< Instances sending stateless probes, indexed by instance ID (see stateless.h) */
+    size_t           num_stateless_callers; /**< Number of instances stored in network->stateless_callers */
+    capture_t      * capture;           /**< Records the probes sent and the replies received (NULL if disabled) */
+    network_stats_t * stats;            /**< Counters and delays of each stage crossed by the probes */
+    int              stats_timerfd;     /**< Activated when network->stats must be printed */
+    double           stats_interval;    /**< Period at which network->stats is printed (in seconds), 0 if never */
 #ifdef USE_SCHEDULING
-    int             scheduled_timerfd; /**< Used for probe delays. Activated when a probe delay occurs */
-    probe_group_t * scheduled_probes;  /**< Scheduled probes */
+    int              scheduled_timerfd; /**< Used for probe delays. Activated when a probe delay occurs */
+    probe_heap_t   * scheduled_probes;  /**< Scheduled probes, ordered by departure time */
 #endif
-    bool            is_verbose;        /**< Print debug messages*/
+    bool             is_verbose;        /**< Print debug messages*/
 } network_t;
 
 /**
@@ -128,6 +363,158 @@ typedef struct network_s {
 
 double options_network_get_timeout();
 
+/**
+ * \brief Retrieve the number of bits of the probe IDs defined in
+ *    the network layer.
+ * \return The value set in the network layer (in bits)
+ */
+
+size_t options_network_get_tag_bits();
+
+/**
+ * \brief Retrieve the maximum global rate of probes defined in
+ *    the network layer.
+ * \return The value set in the network layer (in probes per second,
+ *    0 if unlimited)
+ */
+
+double options_network_get_pps();
+
+/**
+ * \brief Retrieve the maximum rate of probes per destination prefix
+ *    defined in the network layer.
+ * \return The value set in the network layer (in probes per second,
+ *    0 if unlimited)
+ */
+
+double options_network_get_prefix_pps();
+
+/**
+ * \brief Retrieve the burst size of the paced probes defined in
+ *    the network layer.
+ * \return The value set in the network layer (in probes)
+ */
+
+size_t options_network_get_burst();
+
+/**
+ * \brief Tell whether the rate limited routers must be detected (see
+ *    network_set_rate_limit_detection).
+ * \return true iif the rate limited routers must be detected.
+ */
+
+bool options_network_get_detect_rate_limits();
+
+/**
+ * \brief Retrieve the maximum number of probes in transit defined in
+ *    the network layer.
+ * \return The value set in the network layer (in probes, 0 if unlimited)
+ */
+
+size_t options_network_get_max_flying();
+
+/**
+ * \brief Retrieve the maximum rate of each instance defined in the
+ *    network layer.
+ * \return The value set in the network layer (in probes per second,
+ *    0 if unlimited)
+ */
+
+double options_network_get_instance_pps();
+
+/**
+ * \brief Retrieve the minimal adaptive timeout defined in the
+ *    network layer.
+ * \return The value set in the network layer (in seconds, 0 if
+ *    the timeouts are not adaptive)
+ */
+
+double options_network_get_min_timeout();
+
+/**
+ * \brief Retrieve the pcapng file in which the packets are recorded,
+ *    defined in the network layer.
+ * \return The corresponding path, NULL if the packets are not recorded.
+ */
+
+const char * options_network_get_capture_filename();
+
+/**
+ * \brief Retrieve the topology of the simulated network, defined in
+ *    the network layer. It must be set before network_create is called.
+ * \return The corresponding path, NULL if the network is not simulated.
+ */
+
+const char * options_network_get_simulation_filename();
+
+/**
+ * \brief Retrieve the UNIX socket of the demultiplexer from which the
+ *    replies are received, defined in the network layer. It must be set
+ *    before network_create is called.
+ * \return The corresponding path, NULL if the replies are sniffed.
+ */
+
+const char * options_network_get_demux_path();
+
+/**
+ * \brief Retrieve the number of tags requested to the demultiplexer,
+ *    defined in the network layer.
+ * \return The number of tags.
+ */
+
+size_t options_network_get_demux_tags();
+
+/**
+ * \brief Retrieve the UNIX socket of the broker from which the raw
+ *    sockets are fetched, defined in the network layer. It must be set
+ *    before network_create is called.
+ * \return The corresponding path, NULL if the raw sockets are opened
+ *    by this process.
+ */
+
+const char * options_network_get_broker_path();
+
+/**
+ * \brief Tell whether the TCP probes carry their tag in their sequence
+ *    number, defined in the network layer. It must be set before
+ *    network_create is called.
+ * \return true iif the TCP probes are tagged in their sequence number.
+ */
+
+bool options_network_get_seq_tags();
+
+/**
+ * \brief Retrieve the source address of the probes, defined in the
+ *    network layer.
+ * \return The corresponding address (string format), NULL if it is
+ *    picked by the kernel for each destination.
+ */
+
+const char * options_network_get_source();
+
+/**
+ * \brief Retrieve the period at which the statistics of the network
+ *    layer are printed, defined in the network layer.
+ * \return The corresponding period (in seconds), 0 if they are never printed.
+ */
+
+double options_network_get_stats_interval();
+
+/**
+ * \brief Tell whether the main loop must be profiled (see pt_loop_set_profiler).
+ * \return true iif the main loop must be profiled.
+ */
+
+bool options_network_get_profile();
+
+/**
+ * \brief Tell whether the events must be dispatched directly (see
+ *    pt_loop_set_direct_dispatch).
+ * \return true iif the events must be dispatched directly.
+ */
+
+bool options_network_get_direct_dispatch();
+
 /**
  * \brief Get the commandline options related to the layer network
  * \returna pointer to a tructure containing the options
@@ -173,6 +560,246 @@ double network_get_timeout(const network_t * network);
 
 void network_set_is_verbose(network_t * network, bool verbose);
 
+/**
+ * \brief Set the number of bits of the tags (probe IDs) allocated by
+ *    a network_t instance. This is only possible if no probe is in transit,
+ *    and if the replies are not demultiplexed (see demux.h), which
+ *    requires 16-bit tags.
+ * \param network The network layer.
+ * \param tag_bits The new number of bits, in [16, TAG_ALLOCATOR_MAX_BITS].
+ * \return true iif successful
+ */
+
+bool network_set_tag_bits(network_t * network, size_t tag_bits);
+
+/**
+ * \brief Retrieve the number of bits of the tags (probe IDs) allocated
+ *    by a network_t instance.
+ * \param network The network layer.
+ * \return The number of bits of the tags.
+ */
+
+size_t network_get_tag_bits(const network_t * network);
+
+/**
+ * \brief Pace the best-effort probes sent by a network_t instance. The
+ *    probes exceeding the allowed rates are delayed (in order) until
+ *    the corresponding token buckets are refilled.
+ * \param network The network layer.
+ * \param pps The maximum global rate (in probes per second), 0 if unlimited.
+ * \param prefix_pps The maximum rate towards a given destination prefix
+ *    (in probes per second), 0 if unlimited.
+ * \param burst The number of probes which may be sent at once.
+ * \return true iif successful
+ */
+
+bool network_set_pacing(network_t * network, double pps, double prefix_pps, size_t burst);
+
+/**
+ * \brief Detect the interfaces which rate limit their replies to the
+ *    probes sent by a network_t instance (see ratelimit.h), and pace the
+ *    probes expected to reach them. This setting is kept by
+ *    network_set_pacing.
+ * \param network The network layer.
+ * \param detect Pass true to enable the detection, false to disable it.
+ * \return true iif successful
+ */
+
+bool network_set_rate_limit_detection(network_t * network, bool detect);
+
+/**
+ * \brief Bound the number of probes in transit. The probes popped from
+ *    the sendq beyond this window are held (in order) until a reply or
+ *    a timeout frees a slot.
+ * \param network The network layer.
+ * \param max_flying_probes The maximum number of probes in transit,
+ *    0 if unlimited.
+ * \return true iif successful
+ */
+
+bool network_set_max_flying(network_t * network, size_t max_flying_probes);
+
+/**
+ * \brief Cap the rate of each instance sending probes through a network_t
+ *    instance (unless its share is set by network_set_caller_share).
+ * \param network The network layer.
+ * \param pps The maximum rate of an instance (in probes per second),
+ *    0 if unlimited.
+ * \param burst The number of probes an instance may send at once.
+ * \return true iif successful
+ */
+
+bool network_set_instance_pacing(network_t * network, double pps, size_t burst);
+
+/**
+ * \brief Set the share of the held probes released for a given instance.
+ *    The held probes are released by deficit round-robin, so an instance
+ *    whose weight is w sends w probes per round.
+ * \param network The network layer.
+ * \param caller The instance.
+ * \param weight The weight of the instance (>= 1).
+ * \param pps The maximum rate of the instance (in probes per second),
+ *    0 if unlimited.
+ * \return true iif successful
+ */
+
+bool network_set_caller_share(network_t * network, const void * caller, size_t weight, double pps);
+
+/**
+ * \brief Retrieve the number of probes which may still be submitted
+ *    before exceeding the window of a network_t instance (see
+ *    network_set_max_flying). The probes in transit, paced, held and
+ *    queued all consume a credit.
+ * \param network The network layer.
+ * \return The number of credits, SIZE_MAX if the window is unlimited.
+ */
+
+size_t network_get_num_credits(const network_t * network);
+
+/**
+ * \brief Register an instance waiting for credits: a NETWORK_READY event
+ *    is passed to it once some slots are freed. The instance is
+ *    notified only once per registration.
+ * \param network The network layer.
+ * \param caller The instance.
+ * \return true iif successful
+ */
+
+bool network_wait_credits(network_t * network, void * caller);
+
+/**
+ * \brief Adapt the timeout of each probe sent by a network_t instance
+ *    to the RTT measured towards its destination (see rtt_estimator.h).
+ *    The timeout set by network_set_timeout() is the upper bound of
+ *    the adaptive timeouts.
+ * \param network The network layer.
+ * \param min_timeout The lower bound of the adaptive timeouts (in
+ *    seconds), 0 to always use the timeout of the network.
+ * \return true iif successful
+ */
+
+bool network_set_adaptive_timeout(network_t * network, double min_timeout);
+
+/**
+ * \brief Record the probes sent and the replies received by a network_t
+ *    instance in a pcapng file (see capture.h). Each packet is commented
+ *    with its tag (or its stateless instance ID) and the ID of the
+ *    algorithm instance it is related to; a reply which does not match
+ *    any probe is commented as "unmatched".
+ * \param network The network layer.
+ * \param filename The pcapng file, NULL to stop recording.
+ * \return true iif successful
+ */
+
+bool network_set_capture(network_t * network, const char * filename);
+
+/**
+ * \brief Retrieve the statistics of a network_t instance (see network_stats.h).
+ * \param network The network layer.
+ * \return The corresponding network_stats_t instance.
+ */
+
+const network_stats_t * network_get_stats(const network_t * network);
+
+/**
+ * \brief Print the statistics of a network_t instance (see network_stats_dump).
+ * \param network The network layer.
+ * \param file The output file.
+ */
+
+void network_dump_stats(network_t * network, FILE * file);
+
+/**
+ * \brief Write the statistics of a network_t instance in the OpenMetrics
+ *    text format (see metrics_callback_t).
+ * \param file The output file.
+ * \param network The network layer.
+ */
+
+void network_write_metrics(FILE * file, void * network);
+
+/**
+ * \brief Print periodically the statistics of a network_t instance on the
+ *    standard error (see network_process_stats).
+ * \param network The network layer.
+ * \param interval The period (in seconds), 0 to stop printing them.
+ * \return true iif successful
+ */
+
+bool network_set_stats_interval(network_t * network, double interval);
+
+/**
+ * \brief Register an instance sending stateless probes (see stateless.h).
+ *    The probes of this instance carrying its instance ID are not tracked
+ *    by the network layer: once sent, each of them is given back to the
+ *    instance thanks to a PROBE_SENT event, and the replies quoting its
+ *    instance ID are passed in PROBE_REPLY events whose probe is NULL.
+ * \param network The network layer.
+ * \param caller The instance (see probe_set_caller).
+ * \param pinstance_id Address of an uint8_t in which the instance ID
+ *    allocated to the caller is written.
+ * \return true iif successful, false if every instance ID is in use or
+ *    if the replies are demultiplexed (they could not be routed to
+ *    this network).
+ */
+
+bool network_add_stateless_caller(network_t * network, void * caller, uint8_t * pinstance_id);
+
+/**
+ * \brief Unregister an instance sending stateless probes. The replies
+ *    related to its probes are then discarded.
+ * \param network The network layer.
+ * \param instance_id The instance ID returned by network_add_stateless_caller.
+ */
+
+void network_del_stateless_caller(network_t * network, uint8_t instance_id);
+
+/**
+ * \brief Forget an instance which is being released: the next duplicate
+ *    and late replies to its probes are no longer passed to it, nor
+ *    the NETWORK_READY event it waits for, and its share is reset.
+ * \param network The network layer.
+ * \param caller The instance.
+ */
+
+void network_forget_caller(network_t * network, const void * caller);
+
+/**
+ * \brief Dedicate a network_t instance to a shard of the destinations.
+ *    Several network_t instances (e.g. one per thread and per core) may
+ *    then run in the same process: each of them owns its sockets, and the
+ *    kernel only passes to its sniffer the replies related to its shard.
+ *    The caller must only send through a network the probes whose
+ *    destination belongs to its shard (see network_get_destination_shard).
+ * \param network The network layer.
+ * \param shard The shard of this network (in [0, num_shards - 1]).
+ * \param num_shards The number of shards.
+ * \return true iif successful
+ */
+
+bool network_set_shard(network_t * network, size_t shard, size_t num_shards);
+
+/**
+ * \brief Retrieve the shard to which a destination belongs.
+ * \param dst The destination of a probe.
+ * \param num_shards The number of shards.
+ * \return The corresponding shard, in [0, num_shards - 1].
+ */
+
+size_t network_get_destination_shard(const address_t * dst, size_t num_shards);
+
+/**
+ * \brief Allow a sharded network to probe a destination belonging to
+ *    another shard (e.g. stolen from a busy shard). Its replies are then
+ *    received by both networks, each of them dropping the replies which
+ *    do not match its own probes.
+ * \param network The network layer.
+ * \param dst The destination.
+ * \return true iif successful
+ */
+
+bool network_accept_destination(network_t * network, const address_t * dst);
+
 /**
  * \brief Set a new timeout for the network structure.
  * \param network The network layer.
@@ -217,6 +844,24 @@ int network_get_recvq_fd(network_t * network);
 
 int network_get_timerfd(network_t * network);
 
+/**
+ * \brief Retrieve the file descriptor activated whenever a
+ *   paced probe may be sent.
+ * \param network The network layer.
+ * \return The corresponding file descriptor
+ */
+
+int network_get_pacer_fd(network_t * network);
+
+/**
+ * \brief Retrieve the file descriptor activated whenever the
+ *   statistics of the network layer must be printed.
+ * \param network The network layer.
+ * \return The corresponding file descriptor
+ */
+
+int network_get_stats_fd(network_t * network);
+
 /**
  * \brief Retrieve the file descriptor activated whenever a
  *   delay occurs.
@@ -226,26 +871,46 @@ int network_get_timerfd(network_t * network);
 
 int network_get_group_timerfd(network_t * network);
 
+#ifdef USE_SCHEDULING
 /**
- * \brief Retrieve the tree of probes handled by this
- *   network instance
- * \param network The network layer..
- * \return a Pointer to the tree of group of probes
+ * \brief Retrieve the probes scheduled by this network instance
+ * \param network The network layer.
+ * \return The heap of scheduled probes
  */
 
-probe_group_t * network_get_group_probes(network_t * network);
+probe_heap_t * network_get_scheduled_probes(network_t * network);
+#endif
 
 /**
- * \brief Send the next packet stored network->sendq
+ * \brief Send the packets stored network->sendq (at most
+ *    NETWORK_SEND_BATCH_SIZE packets are sent at once). If the probes
+ *    cannot all be sent right now, the sendq is drained in
+ *    network->held_probes, from which they are released fairly between
+ *    the instances. The sendq file descriptor remains activated while
+ *    some probes are left because of max_probes.
  * \param network The network layer..
+ * \param max_probes The maximum number of probes sent,
+ *    0 if unlimited.
  * \return true iif successfull
  */
 
-bool network_process_sendq(network_t * network);
+bool network_process_sendq(network_t * network, size_t max_probes);
+
+/**
+ * \brief Send the held and paced probes allowed by the instance caps and
+ *    by network->pacer, and arm network->pacer_timerfd if some probes
+ *    are still waiting for a token.
+ *    This is called whenever network->pacer_timerfd is activated.
+ * \param network The network layer.
+ * \return true iif successful
+ */
+
+bool network_process_paced_probes(network_t * network);
 
 /**
  * \brief Process received packets: match them with a probe, or discard them.
  * In practice, the receive queue stores all the packets handled by the sniffer.
+ * Every pending packet is processed, NETWORK_RECV_BATCH_SIZE packets at a time.
  * \param network The network layer.
  * \return true iif successful
  */
@@ -257,21 +922,95 @@ bool network_process_recvq(network_t * network);
  *   to fetch a received packet.
  * \param network The network layer..
  * \param protocol_id The family of the packet to fetch (IPPROTO_ICMP, IPPROTO_ICMPV6)
+ * \return true iif some packets may still be pending (see sniffer_process_packets).
  */
 
-void network_process_sniffer(network_t * network, uint8_t protocol_id);
+bool network_process_sniffer(network_t * network, uint8_t protocol_id);
 
 /**
- * \brief Drop the oldest flying probe (if any) attached to a network_t
- *    instance. The oldest probe is removed from network->probes
- *    and network->timerfd is refreshed to manage the next timeout
- *    if there is still at least one flying probe.
+ * \brief Fetch the TCP segments sniffed by the network layer (see
+ *    network->has_seq_tags).
+ * \param network The network layer.
+ * \param family The family of the segments to fetch (AF_INET, AF_INET6).
+ * \return true iif some segments may still be pending (see sniffer_process_tcp_packets).
+ */
+
+bool network_process_tcp_sniffer(network_t * network, int family);
+
+/**
+ * \brief Deliver the replies of the simulated network whose RTT has
+ *    elapsed. This is called whenever the simulator timer is activated.
+ * \param network The network layer (it must be simulated).
+ * \return true iif successful
+ */
+
+bool network_process_simulator(network_t * network);
+
+/**
+ * \brief Process the replies routed to this network by the
+ *    demultiplexer. This is called whenever the demultiplexer notifies
+ *    this network.
+ * \param network The network layer (its replies must be demultiplexed).
+ * \return true iif successful.
+ */
+
+bool network_process_demux(network_t * network);
+
+/**
+ * \brief Print the statistics of the network layer on the standard error.
+ *    This is called whenever network->stats_timerfd is activated.
+ * \param network The network layer.
+ * \return true iif successful
+ */
+
+bool network_process_stats(network_t * network);
+
+/**
+ * \brief Drop every expired flying probe attached to a network_t
+ *    instance. A PROBE_TIMEOUT event is raised for each of them,
+ *    and network->timerfd is refreshed to manage the next tick of
+ *    network->timeouts if there is still at least one flying probe.
  * \param network The network layer.
  * \return true iif successful
  */
 
 bool network_drop_expired_flying_probe(network_t * network);
 
+/**
+ * \brief Assign a free tag to a probe (see network->tags) and update its
+ *    checksums accordingly.
+ * \param network The network layer.
+ * \param probe The probe to tag.
+ * \return true iif successful
+ */
+
+bool network_tag_probe(network_t * network, probe_t * probe);
+
+/**
+ * \brief Register a probe which has already been sent (e.g. a probe read
+ *    from a capture, see capture.h) as if it had just been sent by this
+ *    network layer: it is matched against the next replies, and it
+ *    expires after the timeout of the network layer.
+ * \param network The network layer.
+ * \param probe The probe. Its packet must carry its tag (see network_tag_probe),
+ *    and its caller must be set (see probe_set_caller).
+ * \return true iif successful
+ */
+
+bool network_inject_probe(network_t * network, probe_t * probe);
+
+/**
+ * \brief Queue packets in the recvq of the network layer as if they had
+ *    been sniffed (e.g. replies read from a capture, see capture.h).
+ *    They are processed once the recvq is drained (see network_process_recvq).
+ * \param network The network layer.
+ * \param packets The packets. They are owned by the network layer once queued.
+ * \param num_packets The number of packets.
+ * \return true iif successful
+ */
+
+bool network_inject_replies(network_t * network, packet_t ** packets, size_t num_packets);
+
 /**
  * \brief handle the scheduled probes when network->scheduled_timerfd is activated
  * \param network The network layer.
@@ -279,10 +1018,28 @@ bool network_drop_expired_flying_probe(network_t * network);
 
 bool network_send_probe(network_t * network, probe_t * probe);
 
+/**
+ * \brief Hand a batch of probes over to the network layer (see
+ *    network_send_probe). If every probe is best effort, they are
+ *    pushed in the sendq at once.
+ * \param network The network layer.
+ * \param probes The probes to send. The network layer holds all of
+ *    them, even in case of failure: the probes which cannot be queued
+ *    (e.g. if the sendq is full) are released, and accounted in the
+ *    num_discarded counter of the network statistics.
+ * \param num_probes The number of probes.
+ * \return true iif every probe has been queued
+ */
+
+bool network_submit_probes(network_t * network, probe_t ** probes, size_t num_probes);
+
 #ifdef USE_SCHEDULING
 
 /**
- * \brief handle the scheduled probes when network->scheduled_timerfd is activated
+ * \brief handle the scheduled probes when network->scheduled_timerfd is activated.
+ *    If USE_TXTIME is set and supported by the socketpool, every probe
+ *    departing within NETWORK_TXTIME_HORIZON is sent at once, and the
+ *    kernel holds it until its departure time.
  * \param network The network layer.
  */
 
@@ -291,7 +1048,8 @@ void network_process_scheduled_probe(network_t * network);
 /**
  * \brief Retrieve the next delay to send scheduled probes
  * \param network The network layer.
- * \return the next delay.
+ * \return the next delay (in seconds, <= 0 if a probe is already due),
+ *    DBL_MAX if no probe is scheduled.
  */
 
 double network_get_next_scheduled_probe_delay(const network_t * network);
@@ -317,6 +1075,40 @@ bool network_update_scheduled_timer(network_t * network, double delay);
 // TODO move this outside network
 bool update_timer(int timerfd, double delay);
 
+/**
+ * \brief Check whether the probes are sent through a simulated network.
+ * \param network The network layer.
+ * \return true iif the network is simulated (see network->simulator).
+ */
+
+bool network_is_simulated(const network_t * network);
+
+/**
+ * \brief Retrieve the file descriptor activated when the replies of the
+ *    simulated network must be delivered.
+ * \param network The network layer (it must be simulated).
+ * \return The corresponding file descriptor.
+ */
+
+int network_get_simulator_fd(network_t * network);
+
+/**
+ * \brief Check whether the replies are received from a demultiplexer.
+ * \param network The network layer.
+ * \return true iif the replies are demultiplexed (see network->demux).
+ */
+
+bool network_is_demultiplexed(const network_t * network);
+
+/**
+ * \brief Retrieve the file descriptor activated when the demultiplexer
+ *    has routed replies to this network.
+ * \param network The network layer (its replies must be demultiplexed).
+ * \return The corresponding file descriptor.
+ */
+
+int network_get_demux_fd(network_t * network);
+
 #ifdef USE_IPV4
 /**
  * \brief Retrieve the socket file descriptor related to the ICMPv4
@@ -326,6 +1118,16 @@ bool update_timer(int timerfd, double delay);
  */
 
 int network_get_icmpv4_sockfd(network_t * network);
+
+/**
+ * \brief Retrieve the socket file descriptor related to the IPv4/TCP
+ *    raw socket managed by network->sniffer.
+ * \param network The network layer.
+ * \return The corresponding socket file descriptor, -1 if the TCP
+ *    segments are not sniffed (see network->has_seq_tags).
+ */
+
+int network_get_tcpv4_sockfd(network_t * network);
 #endif
 
 #ifdef USE_IPV6
@@ -337,6 +1139,16 @@ int network_get_icmpv4_sockfd(network_t * network);
  */
 
 int network_get_icmpv6_sockfd(network_t * network);
+
+/**
+ * \brief Retrieve the socket file descriptor related to the IPv6/TCP
+ *    raw socket managed by network->sniffer.
+ * \param network The network layer.
+ * \return The corresponding socket file descriptor, -1 if the TCP
+ *    segments are not sniffed (see network->has_seq_tags).
+ */
+
+int network_get_tcpv6_sockfd(network_t * network);
 #endif
 
 #endif
@@ -0,0 +1,177 @@
+#include "config.h"
+
+#include <inttypes.h>     // PRIu64
+#include <stdlib.h>       // calloc, free
+
+#include "network_stats.h"
+#include "metrics.h"      // metrics_write_family
+
+network_stats_t * network_stats_create(double now)
+{
+    network_stats_t * stats;
+
+    if (!(stats = calloc(1, sizeof(network_stats_t)))) goto ERR_CALLOC;
+    if (!(stats->queue_to_wire     = histogram_create())) goto ERR_QUEUE_TO_WIRE;
+    if (!(stats->reply_to_dispatch = histogram_create())) goto ERR_REPLY_TO_DISPATCH;
+    stats->last_time = now;
+    return stats;
+
+ERR_REPLY_TO_DISPATCH:
+    histogram_free(stats->queue_to_wire);
+ERR_QUEUE_TO_WIRE:
+    free(stats);
+ERR_CALLOC:
+    return NULL;
+}
+
+void network_stats_free(network_stats_t * stats) {
+    if (stats) {
+        histogram_free(stats->queue_to_wire);
+        histogram_free(stats->reply_to_dispatch);
+        free(stats);
+    }
+}
+
+void network_stats_set_sendq_depth(network_stats_t * stats, size_t depth) {
+    stats->sendq_depth = depth;
+    if (depth > stats->sendq_peak) stats->sendq_peak = depth;
+}
+
+void network_stats_set_recvq_depth(network_stats_t * stats, size_t depth) {
+    stats->recvq_depth = depth;
+    if (depth > stats->recvq_peak) stats->recvq_peak = depth;
+}
+
+/**
+ * \brief Print a counter and its rate.
+ * \param file The output file.
+ * \param name The name of the counter.
+ * \param value The value of the counter.
+ * \param last_value The value of the counter at the previous dump.
+ * \param elapsed The number of seconds since the previous dump.
+ */
+
+static void network_stats_dump_counter(FILE * file, const char * name, uint64_t value, uint64_t last_value, double elapsed) {
+    fprintf(file, " %s %" PRIu64 " (%.0f/s)", name, value, elapsed > 0 ? (value - last_value) / elapsed : 0);
+}
+
+/**
+ * \brief Print the median, the 99th percentile and the maximum of a
+ *    histogram of delays.
+ * \param file The output file.
+ * \param name The name of the histogram.
+ * \param histogram The histogram (in ns).
+ */
+
+static void network_stats_dump_histogram(FILE * file, const char * name, const histogram_t * histogram) {
+    fprintf(file, " %s p50 %.3f p99 %.3f max %.3f ms",
+        name,
+        histogram_get_quantile(histogram, 0.50) / 1000000.0,
+        histogram_get_quantile(histogram, 0.99) / 1000000.0,
+        histogram_get_quantile(histogram, 1.00) / 1000000.0
+    );
+}
+
+void network_stats_dump(network_stats_t * stats, FILE * file, size_t num_flying, size_t num_paced, double now)
+{
+    const network_stats_counters_t * counters = &stats->counters,
+                                   * last     = &stats->last_counters;
+    double                           elapsed  = now - stats->last_time;
+
+    fprintf(file, "network:");
+    network_stats_dump_counter(file, "queued",    counters->num_queued,    last->num_queued,    elapsed);
+    network_stats_dump_counter(file, "sent",      counters->num_sent,      last->num_sent,      elapsed);
+    network_stats_dump_counter(file, "discarded", counters->num_discarded, last->num_discarded, elapsed);
+    network_stats_dump_counter(file, "matched",   counters->num_matched,   last->num_matched,   elapsed);
+    network_stats_dump_counter(file, "duplicates", counters->num_duplicates, last->num_duplicates, elapsed);
+    network_stats_dump_counter(file, "late",      counters->num_late,      last->num_late,      elapsed);
+    network_stats_dump_counter(file, "unmatched", counters->num_unmatched, last->num_unmatched, elapsed);
+    network_stats_dump_counter(file, "timeouts",  counters->num_timeouts,  last->num_timeouts,  elapsed);
+    fprintf(file, " flying %zu paced %zu sendq %zu (peak %zu) recvq %zu (peak %zu)",
+        num_flying, num_paced,
+        stats->sendq_depth, stats->sendq_peak,
+        stats->recvq_depth, stats->recvq_peak
+    );
+    network_stats_dump_histogram(file, "queue-to-wire",     stats->queue_to_wire);
+    network_stats_dump_histogram(file, "reply-to-dispatch", stats->reply_to_dispatch);
+    fprintf(file, "\n");
+    fflush(file);
+
+    stats->last_counters = stats->counters;
+    stats->last_time     = now;
+}
+
+/**
+ * \brief Write a counter in the OpenMetrics text format.
+ * \param file The output file.
+ * \param name The name of the counter family.
+ * \param help The description of the counter.
+ * \param value The value of the counter.
+ */
+
+static void network_stats_write_counter(FILE * file, const char * name, const char * help, uint64_t value) {
+    metrics_write_family(file, name, "counter", help);
+    fprintf(file, "%s_total %" PRIu64 "\n", name, value);
+}
+
+/**
+ * \brief Write a gauge in the OpenMetrics text format.
+ * \param file The output file.
+ * \param name The name of the gauge.
+ * \param help The description of the gauge.
+ * \param value The value of the gauge.
+ */
+
+static void network_stats_write_gauge(FILE * file, const char * name, const char * help, size_t value) {
+    metrics_write_family(file, name, "gauge", help);
+    fprintf(file, "%s %zu\n", name, value);
+}
+
+/**
+ * \brief Write a histogram of delays as an OpenMetrics summary.
+ * \param file The output file.
+ * \param name The name of the summary.
+ * \param help The description of the summary.
+ * \param histogram The histogram (in ns).
+ */
+
+static void network_stats_write_summary(FILE * file, const char * name, const char * help, const histogram_t * histogram) {
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    size_t              i;
+
+    metrics_write_family(file, name, "summary", help);
+    for (i = 0; i < sizeof(quantiles) / sizeof(double); i++) {
+        fprintf(file, "%s{quantile=\"%g\"} %.9f\n", name, quantiles[i], histogram_get_quantile(histogram, quantiles[i]) / 1e9);
+    }
+    fprintf(file, "%s_count %" PRIu64 "\n", name, histogram_get_num_values(histogram));
+}
+
+void network_stats_write_metrics(const network_stats_t * stats, FILE * file, size_t num_flying, size_t num_paced)
+{
+    const network_stats_counters_t * counters = &stats->counters;
+
+    network_stats_write_counter(file, "paristraceroute_network_probes_queued",    "Probes popped from the sendq",         counters->num_queued);
+    network_stats_write_counter(file, "paristraceroute_network_probes_sent",      "Probes sent",                          counters->num_sent);
+    network_stats_write_counter(file, "paristraceroute_network_probes_discarded", "Probes which could not be sent",       counters->num_discarded);
+    network_stats_write_counter(file, "paristraceroute_network_probes_timed_out", "Probes which have expired",            counters->num_timeouts);
+    network_stats_write_counter(file, "paristraceroute_network_replies_matched",  "Replies matching a probe",             counters->num_matched);
+    network_stats_write_counter(file, "paristraceroute_network_replies_duplicate", "Replies to a probe already matched",  counters->num_duplicates);
+    network_stats_write_counter(file, "paristraceroute_network_replies_late",     "Replies to a probe already expired",   counters->num_late);
+    network_stats_write_counter(file, "paristraceroute_network_replies_unmatched", "Replies discarded",                   counters->num_unmatched);
+    network_stats_write_gauge(file, "paristraceroute_network_probes_flying",      "Probes in transit",                    num_flying);
+    network_stats_write_gauge(file, "paristraceroute_network_probes_paced",       "Probes waiting for the pacer",         num_paced);
+    network_stats_write_gauge(file, "paristraceroute_network_sendq_depth",        "Probes in the sendq when last drained", stats->sendq_depth);
+    network_stats_write_gauge(file, "paristraceroute_network_sendq_peak_depth",   "Maximal depth of the sendq",           stats->sendq_peak);
+    network_stats_write_gauge(file, "paristraceroute_network_recvq_depth",        "Replies in the recvq when last drained", stats->recvq_depth);
+    network_stats_write_gauge(file, "paristraceroute_network_recvq_peak_depth",   "Maximal depth of the recvq",           stats->recvq_peak);
+    network_stats_write_summary(
+        file, "paristraceroute_network_queue_to_wire_seconds",
+        "Delay from the queueing of the probes to their sending",
+        stats->queue_to_wire
+    );
+    network_stats_write_summary(
+        file, "paristraceroute_network_reply_to_dispatch_seconds",
+        "Delay from the reception of the replies to their dispatch",
+        stats->reply_to_dispatch
+    );
+}
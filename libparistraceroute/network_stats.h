@@ -0,0 +1,121 @@
+#ifndef NETWORK_STATS_H
+#define NETWORK_STATS_H
+
+/**
+ * \file network_stats.h
+ * \brief Counters and delay histograms describing each stage crossed by
+ *    the probes of a network_t instance.
+ *
+ * A probe popped from the sendq is queued; it is then either sent or
+ * discarded (it could not be tagged, built or sent). A sent probe is
+ * either matched by a reply or times out. A reply matching neither a
+ * probe in transit nor a stateless instance is either a duplicate (its
+ * probe has already been matched), late (its probe has already expired),
+ * or unmatched.
+ *
+ * Two delays are recorded (in nanoseconds):
+ * - queue-to-wire: from the queueing time of a probe (see
+ *   probe_set_queueing_time) to the time it is handed over to the kernel
+ *   (or to its departure time, if the kernel holds it), i.e. the time
+ *   spent in the sendq and in the pacer;
+ * - reply-to-dispatch: from the receiving time of a reply (see
+ *   packet_get_recv_time) to the time it is passed to its instance, i.e.
+ *   the time spent in the socket buffers, in the recvq and in matching.
+ *
+ * The depth of the queues is sampled whenever they are drained, so that
+ * their peak depth reveals the bursts that the network layer has absorbed.
+ */
+
+#include <stdio.h>        // FILE
+#include <stddef.h>       // size_t
+#include <stdint.h>       // uint64_t
+
+#include "histogram.h"    // histogram_t
+
+/**
+ * \struct network_stats_counters_t
+ * \brief The counters of a network_stats_t instance.
+ */
+
+typedef struct {
+    uint64_t num_queued;     /**< Number of probes popped from the sendq */
+    uint64_t num_sent;       /**< Number of probes sent */
+    uint64_t num_discarded;  /**< Number of probes which could not be sent */
+    uint64_t num_matched;    /**< Number of replies related to a probe in transit or to a stateless instance */
+    uint64_t num_unmatched;  /**< Number of replies discarded */
+    uint64_t num_timeouts;   /**< Number of probes which have expired */
+    uint64_t num_duplicates; /**< Number of replies to a probe already matched */
+    uint64_t num_late;       /**< Number of replies to a probe already expired */
+} network_stats_counters_t;
+
+/**
+ * \struct network_stats_t
+ * \brief The statistics of a network_t instance.
+ */
+
+typedef struct {
+    network_stats_counters_t   counters;          /**< Counters since the creation of the network */
+    network_stats_counters_t   last_counters;     /**< Counters when they have been dumped for the last time */
+    double                     last_time;         /**< When the counters have been dumped for the last time (in seconds) */
+    histogram_t              * queue_to_wire;     /**< Delays from the queueing time of the probes to their sending time (in ns) */
+    histogram_t              * reply_to_dispatch; /**< Delays from the receiving time of the replies to their dispatch (in ns) */
+    size_t                     sendq_depth;       /**< Number of probes in the sendq when it has been drained for the last time */
+    size_t                     sendq_peak;        /**< Maximal value of sendq_depth */
+    size_t                     recvq_depth;       /**< Number of replies in the recvq when it has been drained for the last time */
+    size_t                     recvq_peak;        /**< Maximal value of recvq_depth */
+} network_stats_t;
+
+/**
+ * \brief Create a network_stats_t instance whose counters are null.
+ * \param now The current timestamp (in seconds).
+ * \return The newly allocated network_stats_t instance, NULL in case of failure.
+ */
+
+network_stats_t * network_stats_create(double now);
+
+/**
+ * \brief Release a network_stats_t instance.
+ * \param stats A network_stats_t instance.
+ */
+
+void network_stats_free(network_stats_t * stats);
+
+/**
+ * \brief Record the depth of the sendq.
+ * \param stats A network_stats_t instance.
+ * \param depth The number of probes stored in the sendq.
+ */
+
+void network_stats_set_sendq_depth(network_stats_t * stats, size_t depth);
+
+/**
+ * \brief Record the depth of the recvq.
+ * \param stats A network_stats_t instance.
+ * \param depth The number of replies stored in the recvq.
+ */
+
+void network_stats_set_recvq_depth(network_stats_t * stats, size_t depth);
+
+/**
+ * \brief Print the statistics on a single line, including the rate of
+ *    each counter since the previous call.
+ * \param stats A network_stats_t instance.
+ * \param file The output file (e.g. stderr).
+ * \param num_flying The number of probes in transit.
+ * \param num_paced The number of probes waiting for the pacer.
+ * \param now The current timestamp (in seconds).
+ */
+
+void network_stats_dump(network_stats_t * stats, FILE * file, size_t num_flying, size_t num_paced, double now);
+
+/**
+ * \brief Write the statistics in the OpenMetrics text format (see metrics.h).
+ * \param stats A network_stats_t instance.
+ * \param file The output file.
+ * \param num_flying The number of probes in transit.
+ * \param num_paced The number of probes waiting for the pacer.
+ */
+
+void network_stats_write_metrics(const network_stats_t * stats, FILE * file, size_t num_flying, size_t num_paced);
+
+#endif // NETWORK_STATS_H
@@ -34,15 +34,6 @@ static void option_dump(const option_t * option) {
     printf("option : %s\t%s\n", option->sf, option->lf);
 }
 
-/**
- * \brief Free an opt_spect_t instance.
- * \param option The opt_spect_t instance to free.
- */
-
-static void option_free(option_t * option) {
-    free(option);
-}
-
 /**
  * \brief Check whether an option_t instance collides with one contained in an
  *    options_t instance.
@@ -105,9 +96,10 @@ options_t * options_create(bool (* collision_callback)(option_t * option1, const
         goto ERR_MALLOC;
     }
 
+    // The options are stored by value: their strings are not duplicated
     if (!(options->optspecs = vector_create(
         sizeof(option_t),
-        (ELEMENT_FREE) option_free,
+        NULL,
         (ELEMENT_DUMP) option_dump
     ))) {
         goto ERR_VECTOR_CREATE;
@@ -144,8 +136,8 @@ bool options_add_optspec(options_t * options, const option_t * option)
     option_t * colliding_option = options_search_colliding_option(options, option);
 
     if (!colliding_option) {
-        // No collision, add this option
-        ret = vector_push_element(options->optspecs, (void *) option_dup(option));
+        // No collision, add a copy of this option
+        ret = vector_push_element(options->optspecs, (void *) option);
     } else if (options->collision_callback) {
         // Collision detected, call collision_callback
         ret = options->collision_callback(colliding_option, option);
@@ -184,6 +176,14 @@ bool options_add_common(options_t * options, char * version)
 
 int options_parse(options_t * options, const char * usage, char ** args)
 {
+    option_t end = END_OPT_SPECS;
+    size_t   num_optspecs = vector_get_num_cells(options->optspecs);
+
+    // opt_parse expects an array terminated by END_OPT_SPECS: push it to
+    // ensure that a zeroed cell follows the last option_t, then hide it.
+    if (!vector_push_element(options->optspecs, &end)) return -1;
+    vector_del_ith_element(options->optspecs, num_optspecs);
+
     opt_options1st();
     return opt_parse(usage, (struct opt_spec *)(options->optspecs->cells), args);
 }
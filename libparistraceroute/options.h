@@ -81,7 +81,9 @@ bool options_add_optspecs(options_t * options, const option_t * option);
 /**
  * \brief Add one option to an array of options
  * \param options A pointer to an options_t structure containing the array of options to fill
- * \param option A pointer to the  options to add
+ * \param option A pointer to the  options to add. It is copied, but not
+ *    the strings and the data it points to, which must outlive options
+ *    (e.g. static option tables).
  * \return true iif successful
  */
 
@@ -115,6 +117,7 @@ void options_dump(const options_t * options);
  * \param options Pointer to options used
  * \param usage a string containig the message to put when no argument passed
  * \param args vector containing the arguments passed
+ * \return The number of positional arguments, -1 in case of failure.
  */
 int options_parse(options_t * options, const char * usage, char ** args);
 
@@ -0,0 +1,690 @@
+#include "config.h"
+
+#include <stdlib.h>       // malloc, free
+#include <stdio.h>        // vsnprintf, perror
+#include <stdarg.h>       // va_list
+#include <string.h>       // strcmp, strlen, memcpy
+#include <errno.h>        // errno, EINTR
+#include <unistd.h>       // write
+#include <arpa/inet.h>    // inet_ntop
+#include <pthread.h>      // pthread_*
+
+#ifdef HAVE_LIBZ
+#  include <zlib.h>       // deflate*
+#endif
+#ifdef HAVE_LIBZSTD
+#  include <zstd.h>       // ZSTD_*
+#endif
+
+#include "output.h"
+#include "common.h"       // get_time_ns
+#include "archive.h"      // archive_writer_add
+
+// Maximum size of a binary record
+#define OUTPUT_BINARY_MAX_RECORD_SIZE 1024
+
+// Size of the chunks written by the codecs
+#define OUTPUT_CODEC_CHUNK_SIZE       (64 * 1024)
+
+/**
+ * \brief Write a buffer in a file.
+ * \param fd The file descriptor.
+ * \param bytes The buffer.
+ * \param size The size of the buffer.
+ * \return true iif successful.
+ */
+
+static bool write_all(int fd, const void * bytes, size_t size)
+{
+    size_t  offset = 0;
+    ssize_t written;
+
+    while (offset < size) {
+        if ((written = write(fd, (const char *) bytes + offset, size - offset)) == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        offset += written;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Codecs
+//---------------------------------------------------------------------------
+
+/**
+ * \struct output_codec_t
+ * \brief A compression of the stream.
+ */
+
+typedef struct {
+    const char * name;                                  /**< Name of the compression */
+    void     * (* create)();                            /**< Allocate the state of a stream */
+    bool       (* compress)(void * state, int fd, const char * bytes, size_t size, bool is_last); /**< Compress and write a flushed block (the last one ends the stream) */
+    void       (* free)(void * state);                  /**< Release the state of a stream */
+} output_codec_t;
+
+#ifdef HAVE_LIBZ
+static void * output_gzip_create() {
+    z_stream * stream;
+
+    if (!(stream = calloc(1, sizeof(z_stream)))) return NULL;
+
+    // 15 + 16: the largest window, with a gzip header and trailer
+    if (deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+static bool output_gzip_compress(void * state, int fd, const char * bytes, size_t size, bool is_last) {
+    z_stream      * stream = state;
+    unsigned char   chunk[OUTPUT_CODEC_CHUNK_SIZE];
+
+    stream->next_in  = (unsigned char *) bytes;
+    stream->avail_in = size;
+    do {
+        stream->next_out  = chunk;
+        stream->avail_out = sizeof(chunk);
+        if (deflate(stream, is_last ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR) return false;
+        if (!write_all(fd, chunk, sizeof(chunk) - stream->avail_out)) return false;
+    } while (stream->avail_out == 0);
+    return true;
+}
+
+static void output_gzip_free(void * state) {
+    deflateEnd(state);
+    free(state);
+}
+#endif
+
+#ifdef HAVE_LIBZSTD
+static void * output_zstd_create() {
+    return ZSTD_createCCtx();
+}
+
+static bool output_zstd_compress(void * state, int fd, const char * bytes, size_t size, bool is_last) {
+    char           chunk[OUTPUT_CODEC_CHUNK_SIZE];
+    ZSTD_inBuffer  in = {bytes, size, 0};
+    ZSTD_outBuffer out;
+    size_t         remaining;
+
+    // Once the block is flushed (or the frame is ended), 0 is returned
+    do {
+        out.dst  = chunk;
+        out.size = sizeof(chunk);
+        out.pos  = 0;
+        remaining = ZSTD_compressStream2(state, &out, &in, is_last ? ZSTD_e_end : ZSTD_e_flush);
+        if (ZSTD_isError(remaining)) return false;
+        if (!write_all(fd, chunk, out.pos)) return false;
+    } while (remaining > 0);
+    return true;
+}
+
+static void output_zstd_free(void * state) {
+    ZSTD_freeCCtx(state);
+}
+#endif
+
+static const output_codec_t output_codecs[] = {
+#ifdef HAVE_LIBZ
+    {"gzip", output_gzip_create, output_gzip_compress, output_gzip_free},
+#endif
+#ifdef HAVE_LIBZSTD
+    {"zstd", output_zstd_create, output_zstd_compress, output_zstd_free},
+#endif
+    {NULL,   NULL,               NULL,                 NULL}
+};
+
+//---------------------------------------------------------------------------
+// Writer thread
+//---------------------------------------------------------------------------
+
+/**
+ * \struct output_writer_s
+ * \brief Compresses and writes the buffers flushed by an output_t. The
+ *    buffers of the ring from first_full (num_full buffers) are handed to
+ *    the writer, the next one is output_t::buffer.
+ */
+
+struct output_writer_s {
+    const output_codec_t * codec;                       /**< The compression */
+    void                 * state;                       /**< State of the compressed stream */
+    int                    fd;                          /**< The output file descriptor */
+    char                 * buffers[OUTPUT_NUM_BUFFERS]; /**< The ring of buffers */
+    size_t                 sizes[OUTPUT_NUM_BUFFERS];   /**< Number of bytes stored in each buffer */
+    size_t                 first_full;                  /**< Index of the oldest buffer handed to the writer */
+    size_t                 num_full;                    /**< Number of buffers handed to the writer */
+    bool                   is_closing;                  /**< True once the stream must be ended */
+    bool                   has_failed;                  /**< True if a buffer could not be written */
+    pthread_mutex_t        mutex;                       /**< Protects the members above */
+    pthread_cond_t         has_full;                    /**< Signaled when a buffer is handed to the writer */
+    pthread_cond_t         has_free;                    /**< Signaled when a buffer has been written */
+    pthread_t              thread;                      /**< The writer thread */
+};
+
+/**
+ * \brief Body of the writer thread.
+ * \param data The output_writer_t instance.
+ * \return NULL
+ */
+
+static void * output_writer_run(void * data)
+{
+    output_writer_t * writer = data;
+    size_t            i;
+    bool              ret;
+
+    pthread_mutex_lock(&writer->mutex);
+    for (;;) {
+        while (!writer->num_full && !writer->is_closing) {
+            pthread_cond_wait(&writer->has_full, &writer->mutex);
+        }
+        if (!writer->num_full) break;
+
+        // The output_t does not touch the buffers handed to the writer
+        i = writer->first_full;
+        pthread_mutex_unlock(&writer->mutex);
+        ret = writer->codec->compress(writer->state, writer->fd, writer->buffers[i], writer->sizes[i], false);
+        pthread_mutex_lock(&writer->mutex);
+
+        if (!ret) writer->has_failed = true;
+        writer->first_full = (writer->first_full + 1) % OUTPUT_NUM_BUFFERS;
+        writer->num_full--;
+        pthread_cond_signal(&writer->has_free);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+
+    // End the stream
+    if (!writer->codec->compress(writer->state, writer->fd, NULL, 0, true)) {
+        writer->has_failed = true;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Release an output_writer_t instance.
+ * \param writer The output_writer_t instance.
+ */
+
+static void output_writer_free(output_writer_t * writer)
+{
+    size_t i;
+
+    pthread_cond_destroy(&writer->has_free);
+    pthread_cond_destroy(&writer->has_full);
+    pthread_mutex_destroy(&writer->mutex);
+    writer->codec->free(writer->state);
+    for (i = 0; i < OUTPUT_NUM_BUFFERS; i++) {
+        free(writer->buffers[i]);
+    }
+    free(writer);
+}
+
+/**
+ * \brief Create an output_writer_t instance and start its thread.
+ * \param fd The output file descriptor.
+ * \param codec The compression.
+ * \return The newly created output_writer_t instance, NULL in case of failure.
+ */
+
+static output_writer_t * output_writer_create(int fd, const output_codec_t * codec)
+{
+    output_writer_t * writer;
+    size_t            i;
+
+    if (!(writer = calloc(1, sizeof(output_writer_t)))) goto ERR_CALLOC;
+    writer->fd    = fd;
+    writer->codec = codec;
+
+    for (i = 0; i < OUTPUT_NUM_BUFFERS; i++) {
+        if (!(writer->buffers[i] = malloc(OUTPUT_BUFFER_SIZE))) goto ERR_MALLOC;
+    }
+    if (!(writer->state = codec->create()))                         goto ERR_CODEC_CREATE;
+    if (pthread_mutex_init(&writer->mutex, NULL) != 0)              goto ERR_MUTEX_INIT;
+    if (pthread_cond_init(&writer->has_full, NULL) != 0)            goto ERR_HAS_FULL_INIT;
+    if (pthread_cond_init(&writer->has_free, NULL) != 0)            goto ERR_HAS_FREE_INIT;
+    if (pthread_create(&writer->thread, NULL, output_writer_run, writer) != 0) {
+        goto ERR_PTHREAD_CREATE;
+    }
+    return writer;
+
+ERR_PTHREAD_CREATE:
+    pthread_cond_destroy(&writer->has_free);
+ERR_HAS_FREE_INIT:
+    pthread_cond_destroy(&writer->has_full);
+ERR_HAS_FULL_INIT:
+    pthread_mutex_destroy(&writer->mutex);
+ERR_MUTEX_INIT:
+    codec->free(writer->state);
+ERR_CODEC_CREATE:
+ERR_MALLOC:
+    for (i = 0; i < OUTPUT_NUM_BUFFERS; i++) {
+        free(writer->buffers[i]);
+    }
+    free(writer);
+ERR_CALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Hand the current buffer of an output_t to its writer, and
+ *    move to the next buffer of the ring. Wait if every buffer is
+ *    still being written.
+ * \param output The output_t instance.
+ * \return true iif successful.
+ */
+
+static bool output_writer_push(output_t * output)
+{
+    output_writer_t * writer = output->writer;
+    size_t            i;
+    bool              ret;
+
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->num_full == OUTPUT_NUM_BUFFERS - 1) {
+        pthread_cond_wait(&writer->has_free, &writer->mutex);
+    }
+    i = (writer->first_full + writer->num_full) % OUTPUT_NUM_BUFFERS;
+    writer->sizes[i] = output->size;
+    writer->num_full++;
+    output->buffer = writer->buffers[(i + 1) % OUTPUT_NUM_BUFFERS];
+    ret = !writer->has_failed;
+    pthread_cond_signal(&writer->has_full);
+    pthread_mutex_unlock(&writer->mutex);
+
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// Buffer
+//---------------------------------------------------------------------------
+
+bool output_flush(output_t * output)
+{
+    bool ret = true;
+
+    if (output->size > 0) {
+        if (output->writer) {
+            ret = output_writer_push(output);
+        } else if (!(ret = write_all(output->fd, output->buffer, output->size))) {
+            perror("output_flush");
+        }
+    }
+
+    output->size       = 0;
+    output->last_flush = get_time_ns();
+    return ret;
+}
+
+bool output_append(output_t * output, const void * bytes, size_t size)
+{
+    if (output->size + size > output->capacity) {
+        if (!output_flush(output)) return false;
+        if (size > output->capacity) return false;
+    }
+    memcpy(output->buffer + output->size, bytes, size);
+    output->size += size;
+    return true;
+}
+
+bool output_printf(output_t * output, const char * format, ...)
+{
+    va_list args;
+    int     size;
+    size_t  i;
+
+    // Retry once the buffer is flushed if the string does not fit
+    for (i = 0; i < 2; i++) {
+        va_start(args, format);
+        size = vsnprintf(output->buffer + output->size, output->capacity - output->size, format, args);
+        va_end(args);
+
+        if (size < 0) return false;
+        if ((size_t) size < output->capacity - output->size) {
+            output->size += size;
+            return true;
+        }
+        if (i == 0 && !output_flush(output)) return false;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+// JSON Lines
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Append a JSON string.
+ * \param output The output_t instance.
+ * \param s The string.
+ * \return true iif successful.
+ */
+
+static bool output_json_string(output_t * output, const char * s)
+{
+    const char * c;
+    bool         ret = output_append(output, "\"", 1);
+
+    for (c = s; ret && *c; c++) {
+        switch (*c) {
+            case '"':  ret = output_append(output, "\\\"", 2); break;
+            case '\\': ret = output_append(output, "\\\\", 2); break;
+            default:
+                ret = (unsigned char) *c < 0x20 ?
+                    output_printf(output, "\\u%04x", (unsigned char) *c) :
+                    output_append(output, c, 1);
+                break;
+        }
+    }
+    return ret && output_append(output, "\"", 1);
+}
+
+/**
+ * \brief Append a "key":"address" member.
+ * \param output The output_t instance.
+ * \param key The key.
+ * \param address The address, NULL to write null.
+ * \return true iif successful.
+ */
+
+static bool output_json_address(output_t * output, const char * key, const address_t * address)
+{
+    char buffer[INET6_ADDRSTRLEN];
+
+    if (!address || !inet_ntop(address->family, &address->ip, buffer, sizeof(buffer))) {
+        return output_printf(output, ",\"%s\":null", key);
+    }
+    return output_printf(output, ",\"%s\":\"%s\"", key, buffer);
+}
+
+static bool output_json_write_record(output_t * output, const output_record_t * record)
+{
+    static const char * types[] = {
+        [OUTPUT_RECORD_TRACE]  = "trace",
+        [OUTPUT_RECORD_REPLY]  = "reply",
+        [OUTPUT_RECORD_STAR]   = "star",
+        [OUTPUT_RECORD_ERROR]  = "error",
+        [OUTPUT_RECORD_LINK]   = "link",
+        [OUTPUT_RECORD_END]    = "end",
+        [OUTPUT_RECORD_REJECT] = "reject",
+        [OUTPUT_RECORD_ALIAS]  = "alias"
+    };
+    bool ret;
+
+    ret = output_printf(output, "{\"type\":\"%s\"", types[record->type])
+       && output_json_address(output, "dst", record->dst);
+    if (record->time && record->type != OUTPUT_RECORD_TRACE) {
+        ret = ret && output_printf(output, ",\"time\":%.6lf", record->time / 1e9);
+    }
+
+    switch (record->type) {
+        case OUTPUT_RECORD_TRACE:
+            ret = ret
+               && output_printf(output, ",\"time\":%.6lf,\"max_ttl\":%u,\"size\":%u,\"algorithm\":",
+                      record->time / 1e9, record->max_ttl, record->size)
+               && output_json_string(output, record->algorithm);
+            break;
+        case OUTPUT_RECORD_REPLY:
+            ret = ret
+               && output_printf(output, ",\"ttl\":%u", record->ttl)
+               && output_json_address(output, "from", record->from)
+               && output_printf(output, ",\"rtt\":%.3lf", record->rtt / 1e6);
+            if (record->asn) {
+                ret = ret && output_printf(output, ",\"asn\":%u", record->asn);
+            }
+            if (record->hostname) {
+                ret = ret
+                   && output_append(output, ",\"hostname\":", 12)
+                   && output_json_string(output, record->hostname);
+            }
+            break;
+        case OUTPUT_RECORD_STAR:
+        case OUTPUT_RECORD_ERROR:
+            ret = ret && output_printf(output, ",\"ttl\":%u", record->ttl);
+            break;
+        case OUTPUT_RECORD_LINK:
+            ret = ret
+               && output_printf(output, ",\"ttl\":%u", record->ttl)
+               && output_json_address(output, "from", record->from)
+               && output_json_address(output, "to", record->to);
+            if (record->hostname) {
+                ret = ret
+                   && output_append(output, ",\"hostname\":", 12)
+                   && output_json_string(output, record->hostname);
+            }
+            break;
+        case OUTPUT_RECORD_END:
+            break;
+        case OUTPUT_RECORD_REJECT:
+            ret = ret
+               && output_append(output, ",\"reason\":", 10)
+               && output_json_string(output, record->reason);
+            break;
+        case OUTPUT_RECORD_ALIAS:
+            ret = ret
+               && output_json_address(output, "from", record->from)
+               && output_json_address(output, "to", record->to);
+            break;
+    }
+
+    return ret && output_append(output, "}\n", 2);
+}
+
+//---------------------------------------------------------------------------
+// Binary
+//---------------------------------------------------------------------------
+
+static inline void put_uint8(uint8_t * buffer, size_t * poffset, uint8_t x) {
+    buffer[(*poffset)++] = x;
+}
+
+static inline void put_uint16(uint8_t * buffer, size_t * poffset, uint16_t x) {
+    put_uint8(buffer, poffset, x >> 8);
+    put_uint8(buffer, poffset, x);
+}
+
+static inline void put_uint32(uint8_t * buffer, size_t * poffset, uint32_t x) {
+    put_uint16(buffer, poffset, x >> 16);
+    put_uint16(buffer, poffset, x);
+}
+
+static inline void put_uint64(uint8_t * buffer, size_t * poffset, uint64_t x) {
+    put_uint32(buffer, poffset, x >> 32);
+    put_uint32(buffer, poffset, x);
+}
+
+static void put_address(uint8_t * buffer, size_t * poffset, const address_t * address) {
+    switch (address ? address->family : AF_UNSPEC) {
+        case AF_INET:
+            put_uint8(buffer, poffset, 4);
+            memcpy(buffer + *poffset, &address->ip.ipv4, sizeof(ipv4_t));
+            *poffset += sizeof(ipv4_t);
+            break;
+        case AF_INET6:
+            put_uint8(buffer, poffset, 6);
+            memcpy(buffer + *poffset, &address->ip.ipv6, sizeof(ipv6_t));
+            *poffset += sizeof(ipv6_t);
+            break;
+        default:
+            put_uint8(buffer, poffset, 0);
+            break;
+    }
+}
+
+static void put_string(uint8_t * buffer, size_t * poffset, const char * s) {
+    size_t length = s ? strlen(s) : 0;
+
+    // Longer strings are truncated
+    if (length > UINT8_MAX) length = UINT8_MAX;
+    put_uint8(buffer, poffset, length);
+    memcpy(buffer + *poffset, s, length);
+    *poffset += length;
+}
+
+static bool output_binary_write_header(output_t * output)
+{
+    uint8_t header[8] = OUTPUT_BINARY_MAGIC;
+
+    header[5] = OUTPUT_BINARY_VERSION;
+    return output_append(output, header, sizeof(header));
+}
+
+static bool output_binary_write_record(output_t * output, const output_record_t * record)
+{
+    uint8_t buffer[OUTPUT_BINARY_MAX_RECORD_SIZE];
+    size_t  offset = 4, size;
+
+    switch (record->type) {
+        case OUTPUT_RECORD_TRACE:
+            put_uint64 (buffer, &offset, record->time);
+            put_address(buffer, &offset, record->dst);
+            put_uint8  (buffer, &offset, record->max_ttl);
+            put_uint16 (buffer, &offset, record->size);
+            put_string (buffer, &offset, record->algorithm);
+            break;
+        case OUTPUT_RECORD_REPLY:
+            put_address(buffer, &offset, record->dst);
+            put_uint8  (buffer, &offset, record->ttl);
+            put_address(buffer, &offset, record->from);
+            put_uint64 (buffer, &offset, record->rtt);
+            put_uint32 (buffer, &offset, record->asn);
+            put_string (buffer, &offset, record->hostname);
+            break;
+        case OUTPUT_RECORD_STAR:
+        case OUTPUT_RECORD_ERROR:
+            put_address(buffer, &offset, record->dst);
+            put_uint8  (buffer, &offset, record->ttl);
+            break;
+        case OUTPUT_RECORD_LINK:
+            put_address(buffer, &offset, record->dst);
+            put_uint8  (buffer, &offset, record->ttl);
+            put_address(buffer, &offset, record->from);
+            put_address(buffer, &offset, record->to);
+            put_string (buffer, &offset, record->hostname);
+            break;
+        case OUTPUT_RECORD_END:
+            put_address(buffer, &offset, record->dst);
+            break;
+        case OUTPUT_RECORD_REJECT:
+            put_address(buffer, &offset, record->dst);
+            put_string (buffer, &offset, record->reason);
+            break;
+        case OUTPUT_RECORD_ALIAS:
+            put_address(buffer, &offset, record->dst);
+            put_address(buffer, &offset, record->from);
+            put_address(buffer, &offset, record->to);
+            break;
+    }
+
+    size   = offset;
+    offset = 0;
+    put_uint16(buffer, &offset, record->type);
+    put_uint16(buffer, &offset, size - 4);
+    return output_append(output, buffer, size);
+}
+
+//---------------------------------------------------------------------------
+// output_t
+//---------------------------------------------------------------------------
+
+static const output_format_t output_formats[] = {
+    {"json",   NULL,                       output_json_write_record},
+    {"binary", output_binary_write_header, output_binary_write_record}
+};
+
+#define NUM_OUTPUT_FORMATS (sizeof(output_formats) / sizeof(output_format_t))
+
+output_t * output_create(int fd, const char * format_name, const char * compression_name)
+{
+    output_t             * output;
+    const output_codec_t * codec = NULL;
+    size_t                 i;
+
+    for (i = 0; i < NUM_OUTPUT_FORMATS && strcmp(output_formats[i].name, format_name) != 0; i++);
+    if (i == NUM_OUTPUT_FORMATS) {
+        fprintf(stderr, "output_create: unknown format '%s'\n", format_name);
+        goto ERR_FORMAT;
+    }
+
+    if (compression_name && strcmp(compression_name, "none") != 0) {
+        for (codec = output_codecs; codec->name && strcmp(codec->name, compression_name) != 0; codec++);
+        if (!codec->name) {
+            fprintf(stderr, "output_create: unsupported compression '%s'\n", compression_name);
+            goto ERR_CODEC;
+        }
+    }
+
+    if (!(output = calloc(1, sizeof(output_t)))) goto ERR_CALLOC;
+
+    // A compressed stream is written from the ring of its writer
+    if (codec) {
+        if (!(output->writer = output_writer_create(fd, codec))) goto ERR_WRITER_CREATE;
+        output->buffer = output->writer->buffers[0];
+    } else if (!(output->buffer = malloc(OUTPUT_BUFFER_SIZE))) {
+        goto ERR_MALLOC_BUFFER;
+    }
+
+    output->fd         = fd;
+    output->format     = &output_formats[i];
+    output->size       = 0;
+    output->capacity   = OUTPUT_BUFFER_SIZE;
+    output->last_flush = get_time_ns();
+
+    if (output->format->write_header && !output->format->write_header(output)) {
+        goto ERR_WRITE_HEADER;
+    }
+    return output;
+
+ERR_WRITE_HEADER:
+    output->size = 0;
+    output_free(output);
+    return NULL;
+ERR_MALLOC_BUFFER:
+ERR_WRITER_CREATE:
+    free(output);
+ERR_CALLOC:
+ERR_CODEC:
+ERR_FORMAT:
+    return NULL;
+}
+
+void output_free(output_t * output)
+{
+    output_writer_t * writer;
+
+    if (output) {
+        output_flush(output);
+        if ((writer = output->writer)) {
+            // The writer ends the stream once every buffer is written
+            pthread_mutex_lock(&writer->mutex);
+            writer->is_closing = true;
+            pthread_cond_signal(&writer->has_full);
+            pthread_mutex_unlock(&writer->mutex);
+            pthread_join(writer->thread, NULL);
+
+            if (writer->has_failed) fprintf(stderr, "output_free: cannot write the compressed stream\n");
+            output_writer_free(writer);
+        } else {
+            free(output->buffer);
+        }
+        free(output);
+    }
+}
+
+void output_set_archive(output_t * output, archive_writer_t * archive) {
+    output->archive = archive;
+}
+
+bool output_write_record(output_t * output, const output_record_t * record)
+{
+    if (output->archive && !archive_writer_add(output->archive, record)) return false;
+    if (!output->format->write_record(output, record)) return false;
+
+    if (get_time_ns() - output->last_flush >= OUTPUT_FLUSH_INTERVAL) {
+        return output_flush(output);
+    }
+    return true;
+}
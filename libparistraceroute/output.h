@@ -0,0 +1,193 @@
+#include "use.h"
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+/**
+ * \file output.h
+ * \brief Structured streaming output of the measurements.
+ *
+ * The algorithms report their results as output_record_t records (a hop
+ * reply, a lost probe, an MDA link...), written as soon as they are known
+ * in a given format:
+ *
+ * - "json": JSON Lines, i.e. one JSON object per line, e.g.
+ *     {"type":"reply","dst":"8.8.8.8","ttl":2,"from":"10.0.0.1","rtt":1.234}
+ *
+ * - "binary": a compact binary format (in the spirit of warts). The stream
+ *   starts with a header: the magic "PTOUT" followed by a version byte
+ *   (OUTPUT_BINARY_VERSION) and two null bytes. Each record is then made
+ *   of its type (uint16_t) and the size of its payload (uint16_t),
+ *   followed by the payload, whose fields are listed in output_record_t.
+ *   Integers are written in network byte order. An address is written as
+ *   its IP version (uint8_t: 4, 6, or 0 if none) followed by its 4 or 16
+ *   bytes. A string is written as its length (uint8_t) followed by its
+ *   bytes (0 if none).
+ *
+ * The records are written in a large user-space buffer, flushed once it
+ * is full, once OUTPUT_FLUSH_INTERVAL has elapsed since the previous
+ * flush, or explicitly (see output_flush, e.g. at the end of a trace), so
+ * that the output may be consumed from a pipe at the probing rate.
+ *
+ * The stream may be compressed ("gzip" or "zstd", if libparistraceroute is
+ * built with zlib or libzstd). A flushed buffer is then handed to a writer
+ * thread, which compresses it and writes it, while the records are written
+ * in the next buffer of a ring of OUTPUT_NUM_BUFFERS buffers. Each buffer
+ * is compressed as a flushed block, so that a reader of the stream may
+ * decompress every record written so far.
+ *
+ * The records may also be appended to an indexed archive (see archive.h
+ * and output_set_archive).
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+
+#include "address.h"    // address_t
+
+// Size of the buffer of an output_t (in bytes)
+#define OUTPUT_BUFFER_SIZE    (1 << 20)
+
+// Maximum delay before the buffered records are written (in nanoseconds)
+#define OUTPUT_FLUSH_INTERVAL 1000000000ULL
+
+// Number of buffers handed to the writer thread of a compressed stream
+#define OUTPUT_NUM_BUFFERS    4
+
+#define OUTPUT_BINARY_MAGIC   "PTOUT"
+#define OUTPUT_BINARY_VERSION 1
+
+typedef enum {
+    // record type              | fields set (in the order of the binary payload)
+    // -------------------------+--------------------------------------------------------
+    OUTPUT_RECORD_TRACE  = 1, //| time, dst, max_ttl, size, algorithm
+    OUTPUT_RECORD_REPLY  = 2, //| dst, ttl, from, rtt, asn, hostname
+    OUTPUT_RECORD_STAR   = 3, //| dst, ttl
+    OUTPUT_RECORD_ERROR  = 4, //| dst, ttl (the probe has provoked an ICMP error)
+    OUTPUT_RECORD_LINK   = 5, //| dst, ttl, from, to, hostname (MDA)
+    OUTPUT_RECORD_END    = 6, //| dst
+    OUTPUT_RECORD_REJECT = 7, //| dst, reason (a measurement request has been rejected, see control.h)
+    OUTPUT_RECORD_ALIAS  = 8  //| dst, from, to (from is an alias of to, see alias.h)
+} output_record_type_t;
+
+/**
+ * \struct output_record_t
+ * \brief A result to output. The meaning of each field depends on its type.
+ */
+
+typedef struct {
+    output_record_type_t   type;
+    uint64_t               time;      /**< TRACE: start of the trace (nanoseconds since the Epoch), other types: when the result has been archived, 0 if unknown (json only) */
+    const address_t      * dst;       /**< The destination of the trace */
+    uint8_t                max_ttl;   /**< TRACE: maximum TTL */
+    uint16_t               size;      /**< TRACE: size of the probe packets */
+    const char           * algorithm; /**< TRACE: name of the algorithm */
+    uint8_t                ttl;       /**< TTL of the probe, first TTL of the link */
+    const address_t      * from;      /**< REPLY: source of the reply, LINK: source of the link, ALIAS: an interface */
+    const address_t      * to;        /**< LINK: target of the link, NULL if none, ALIAS: the interface representing its router */
+    uint64_t               rtt;       /**< REPLY: round-trip time (nanoseconds) */
+    uint32_t               asn;       /**< REPLY: origin AS of from, 0 if unknown */
+    const char           * hostname;  /**< REPLY, LINK: hostname of from, NULL if unknown */
+    const char           * reason;    /**< REJECT: why the request has been rejected */
+} output_record_t;
+
+typedef struct output_s output_t;
+
+typedef struct output_writer_s output_writer_t;
+
+struct archive_writer_s;
+
+/**
+ * \struct output_format_t
+ * \brief A serialization format.
+ */
+
+typedef struct {
+    const char * name;                                                /**< Name of the format */
+    bool      (* write_header)(output_t * output);                    /**< Start the stream (may be NULL) */
+    bool      (* write_record)(output_t * output, const output_record_t * record); /**< Serialize a record */
+} output_format_t;
+
+struct output_s {
+    int                       fd;         /**< The output file descriptor */
+    const output_format_t   * format;     /**< The format of the records */
+    char                    * buffer;     /**< The records not written yet */
+    size_t                    size;       /**< Number of bytes stored in buffer */
+    size_t                    capacity;   /**< Size of buffer */
+    uint64_t                  last_flush; /**< Time of the last flush (see get_time_ns) */
+    output_writer_t         * writer;     /**< Compresses and writes the flushed buffers (NULL if the stream is not compressed) */
+    struct archive_writer_s * archive;    /**< Also archives the records (NULL if none, see output_set_archive) */
+};
+
+/**
+ * \brief Create an output_t instance and write the header of the stream.
+ * \param fd The output file descriptor (e.g. STDOUT_FILENO).
+ * \param format_name The name of the format ("json" or "binary").
+ * \param compression_name The name of the compression ("gzip" or "zstd"),
+ *    NULL or "none" if the stream is not compressed.
+ * \return The newly created output_t instance, NULL in case of failure.
+ */
+
+output_t * output_create(int fd, const char * format_name, const char * compression_name);
+
+/**
+ * \brief Flush and release an output_t instance. A compressed stream is
+ *    terminated. The file descriptor is not closed.
+ * \param output The output_t instance.
+ */
+
+void output_free(output_t * output);
+
+/**
+ * \brief Write a record.
+ * \param output The output_t instance.
+ * \param record The record.
+ * \return true iif successful.
+ */
+
+bool output_write_record(output_t * output, const output_record_t * record);
+
+/**
+ * \brief Append the records written from now on to an archive.
+ * \param output The output_t instance.
+ * \param archive The archive_writer_t instance, NULL to stop archiving.
+ *    It is not released by output_free.
+ */
+
+void output_set_archive(output_t * output, struct archive_writer_s * archive);
+
+/**
+ * \brief Write the buffered records. If the stream is compressed, they
+ *    are handed to the writer thread, and this function only waits if
+ *    every buffer of the ring is still being written.
+ * \param output The output_t instance.
+ * \return true iif successful.
+ */
+
+bool output_flush(output_t * output);
+
+//---------------------------------------------------------------------------
+// Helpers for the output_format_t implementations
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Append bytes to the buffer of an output_t instance.
+ * \param output The output_t instance.
+ * \param bytes The bytes.
+ * \param size The number of bytes.
+ * \return true iif successful.
+ */
+
+bool output_append(output_t * output, const void * bytes, size_t size);
+
+/**
+ * \brief Append a formatted string to the buffer of an output_t instance.
+ * \param output The output_t instance.
+ * \param format The format (see printf).
+ * \return true iif successful.
+ */
+
+bool output_printf(output_t * output, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // OUTPUT_H
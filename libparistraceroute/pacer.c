@@ -0,0 +1,170 @@
+#include "config.h"
+
+#include <stdint.h>     // uint8_t, uint32_t
+#include <stdlib.h>     // calloc, free
+#include <string.h>     // memcpy, memcmp, memset
+#include <sys/socket.h> // AF_INET, AF_INET6
+
+#include "pacer.h"
+#include "ratelimit.h"
+
+pacer_t * pacer_create(double rate, double prefix_rate, size_t burst, double now)
+{
+    pacer_t * pacer;
+
+    if (rate < 0 || prefix_rate < 0 || burst == 0) goto ERR_INVALID_PARAMETER;
+    if (!(pacer = calloc(1, sizeof(pacer_t))))     goto ERR_CALLOC;
+
+    pacer->rate          = rate;
+    pacer->prefix_rate   = prefix_rate;
+    pacer->burst         = burst;
+    pacer->bucket.tokens = burst;
+    pacer->bucket.last   = now;
+    return pacer;
+
+ERR_CALLOC:
+ERR_INVALID_PARAMETER:
+    return NULL;
+}
+
+void pacer_free(pacer_t * pacer) {
+    if (pacer) {
+        ratelimit_free(pacer->ratelimit);
+        free(pacer);
+    }
+}
+
+void token_bucket_refill(token_bucket_t * bucket, double rate, double burst, double now)
+{
+    if (now > bucket->last) {
+        bucket->tokens += (now - bucket->last) * rate;
+        if (bucket->tokens > burst) bucket->tokens = burst;
+        bucket->last = now;
+    }
+}
+
+/**
+ * \brief Compute the prefix of a destination.
+ * \param dst The destination.
+ * \param prefix Address of an address_t in which the prefix is written.
+ * \return The number of significant bytes of the prefix, 0 if the
+ *    family of dst is not supported.
+ */
+
+static size_t pacer_get_prefix(const address_t * dst, address_t * prefix)
+{
+    size_t size;
+
+    switch (dst->family) {
+#ifdef USE_IPV4
+        case AF_INET:  size = PACER_IPV4_PREFIX_LEN / 8; break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6: size = PACER_IPV6_PREFIX_LEN / 8; break;
+#endif
+        default: return 0;
+    }
+
+    memset(prefix, 0, sizeof(address_t));
+    prefix->family = dst->family;
+    memcpy(&prefix->ip, &dst->ip, size);
+    return size;
+}
+
+/**
+ * \brief Retrieve the token bucket related to the prefix of a destination.
+ *    If this prefix has no bucket yet, a full bucket is assigned to it.
+ * \param pacer A pacer_t instance.
+ * \param dst The destination.
+ * \param now The current timestamp (in seconds).
+ * \return The corresponding bucket (refilled), NULL if the family of dst
+ *    is not supported.
+ */
+
+static token_bucket_t * pacer_get_prefix_bucket(pacer_t * pacer, const address_t * dst, double now)
+{
+    address_t        prefix;
+    pacer_prefix_t * slot,
+                   * free_slot = NULL;
+    const uint8_t  * bytes = (const uint8_t *) &prefix.ip;
+    uint32_t         hash = 2166136261u; // FNV-1a
+    size_t           i, size;
+
+    if (!(size = pacer_get_prefix(dst, &prefix))) return NULL;
+    for (i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 16777619u;
+
+    for (i = 0; i < PACER_MAX_PROBES; i++) {
+        slot = &pacer->prefixes[(hash + i) & (PACER_NUM_PREFIXES - 1)];
+
+        if (slot->prefix.family == prefix.family
+        &&  memcmp(&slot->prefix.ip, &prefix.ip, size) == 0) {
+            token_bucket_refill(&slot->bucket, pacer->prefix_rate, pacer->burst, now);
+            return &slot->bucket;
+        }
+
+        // An unused slot, or a full bucket, can be handed over to this prefix
+        if (!free_slot) {
+            if (!slot->prefix.family) {
+                free_slot = slot;
+            } else {
+                token_bucket_refill(&slot->bucket, pacer->prefix_rate, pacer->burst, now);
+                if (slot->bucket.tokens >= pacer->burst) free_slot = slot;
+            }
+        }
+    }
+
+    // Every slot is in use: share the bucket of another prefix
+    if (!free_slot) {
+        slot = &pacer->prefixes[hash & (PACER_NUM_PREFIXES - 1)];
+        token_bucket_refill(&slot->bucket, pacer->prefix_rate, pacer->burst, now);
+        return &slot->bucket;
+    }
+
+    free_slot->prefix        = prefix;
+    free_slot->bucket.tokens = pacer->burst;
+    free_slot->bucket.last   = now;
+    return &free_slot->bucket;
+}
+
+double pacer_get_global_delay(pacer_t * pacer, double now)
+{
+    if (pacer->rate == 0) return 0;
+
+    token_bucket_refill(&pacer->bucket, pacer->rate, pacer->burst, now);
+    return pacer->bucket.tokens >= 1 ? 0 : (1 - pacer->bucket.tokens) / pacer->rate;
+}
+
+bool pacer_take(pacer_t * pacer, const address_t * dst, uint8_t ttl, double now, double * pdelay)
+{
+    token_bucket_t        * prefix_bucket = NULL;
+    ratelimit_interface_t * interface = NULL;
+    double                  delay, prefix_delay, interface_delay;
+
+    delay = pacer_get_global_delay(pacer, now);
+
+    if (pacer->prefix_rate > 0
+    && (prefix_bucket = pacer_get_prefix_bucket(pacer, dst, now))
+    &&  prefix_bucket->tokens < 1) {
+        prefix_delay = (1 - prefix_bucket->tokens) / pacer->prefix_rate;
+        if (prefix_delay > delay) delay = prefix_delay;
+    }
+
+    if (pacer->ratelimit
+    && (interface = ratelimit_get_limited_interface(pacer->ratelimit, dst, ttl))) {
+        token_bucket_refill(&interface->bucket, interface->rate, pacer->burst, now);
+        if (interface->bucket.tokens < 1) {
+            interface_delay = (1 - interface->bucket.tokens) / interface->rate;
+            if (interface_delay > delay) delay = interface_delay;
+        }
+    }
+
+    if (delay > 0) {
+        *pdelay = delay;
+        return false;
+    }
+
+    if (pacer->rate > 0) pacer->bucket.tokens -= 1;
+    if (prefix_bucket)   prefix_bucket->tokens -= 1;
+    if (interface)       interface->bucket.tokens -= 1;
+    return true;
+}
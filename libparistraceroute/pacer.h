@@ -0,0 +1,126 @@
+#include "use.h"
+
+#ifndef PACER_H
+#define PACER_H
+
+/**
+ * \file pacer.h
+ * \brief Token buckets pacing the probes sent by a network_t instance.
+ *
+ * A pacer_t combines a global token bucket, which bounds the overall rate
+ * of probes, and a token bucket per destination prefix, which bounds the
+ * rate of probes sent towards a given network (and thus crossing the same
+ * routers). A probe may be sent iif both buckets hold at least one token.
+ *
+ * The prefix buckets are stored in a fixed-size hash table. A bucket which
+ * has been refilled up to the burst size carries no state, so that its
+ * slot may be reused by another prefix. If no slot is available, a prefix
+ * shares the bucket of another one, which only makes the pacing stricter.
+ *
+ * A pacer_t may also pace the probes expected to reach a router which
+ * rate limits its replies, as detected by a ratelimit_t (see ratelimit.h).
+ */
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint8_t
+
+#include "address.h"  // address_t
+
+struct ratelimit_s;
+
+// Length of the prefixes paced together (in bits).
+#define PACER_IPV4_PREFIX_LEN 24
+#define PACER_IPV6_PREFIX_LEN 48
+
+// Number of prefix buckets. Must be a power of 2.
+#define PACER_NUM_PREFIXES 4096
+
+// Maximum number of slots probed when seeking the bucket of a prefix.
+#define PACER_MAX_PROBES 8
+
+/**
+ * \struct token_bucket_t
+ * \brief A token bucket.
+ */
+
+typedef struct {
+    double tokens;  /**< Number of available tokens */
+    double last;    /**< When tokens has been computed (in seconds) */
+} token_bucket_t;
+
+/**
+ * \brief Add to a token bucket the tokens earned since its last update.
+ * \param bucket A token_bucket_t instance.
+ * \param rate The rate of the bucket (in tokens per second).
+ * \param burst The capacity of the bucket.
+ * \param now The current timestamp (in seconds).
+ */
+
+void token_bucket_refill(token_bucket_t * bucket, double rate, double burst, double now);
+
+/**
+ * \struct pacer_prefix_t
+ * \brief The token bucket related to a destination prefix.
+ */
+
+typedef struct {
+    address_t      prefix;  /**< The prefix (family == 0 if this slot is unused) */
+    token_bucket_t bucket;  /**< Its token bucket */
+} pacer_prefix_t;
+
+/**
+ * \struct pacer_t
+ * \brief Structure describing a pacer.
+ */
+
+typedef struct {
+    double         rate;         /**< Global rate (in probes per second), 0 if unlimited */
+    double         prefix_rate;  /**< Rate per prefix (in probes per second), 0 if unlimited */
+    double         burst;        /**< Capacity of the buckets (in probes) */
+    token_bucket_t bucket;       /**< The global bucket */
+    pacer_prefix_t prefixes[PACER_NUM_PREFIXES]; /**< The prefix buckets, indexed by prefix */
+    struct ratelimit_s * ratelimit; /**< Detects the rate limited interfaces (NULL if disabled), released along with the pacer */
+} pacer_t;
+
+/**
+ * \brief Create a pacer_t instance.
+ * \param rate The global rate (in probes per second), 0 if unlimited.
+ * \param prefix_rate The rate per prefix (in probes per second), 0 if unlimited.
+ * \param burst The number of probes which may be sent at once (>= 1).
+ * \param now The current timestamp (in seconds).
+ * \return The newly allocated pacer_t instance, NULL in case of failure.
+ */
+
+pacer_t * pacer_create(double rate, double prefix_rate, size_t burst, double now);
+
+/**
+ * \brief Release a pacer_t instance from the memory.
+ * \param pacer A pacer_t instance.
+ */
+
+void pacer_free(pacer_t * pacer);
+
+/**
+ * \brief Retrieve how long a pacer must wait before sending any probe.
+ * \param pacer A pacer_t instance.
+ * \param now The current timestamp (in seconds).
+ * \return The delay (in seconds), 0 if the global bucket holds a token.
+ */
+
+double pacer_get_global_delay(pacer_t * pacer, double now);
+
+/**
+ * \brief Consume a token (if any) to send a probe towards a destination.
+ * \param pacer A pacer_t instance.
+ * \param dst The destination of the probe.
+ * \param ttl The TTL of the probe.
+ * \param now The current timestamp (in seconds).
+ * \param pdelay Address of a double in which the delay (in seconds)
+ *    before a token is available is written if the probe cannot be sent.
+ * \return true iif the probe can be sent right now.
+ */
+
+bool pacer_take(pacer_t * pacer, const address_t * dst, uint8_t ttl, double now, double * pdelay);
+
+#endif
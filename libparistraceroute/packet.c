@@ -1,26 +1,41 @@
 #include "config.h"
 
+#include <stddef.h>     // offsetof
 #include <stdlib.h>     // malloc, calloc, free
-#include <string.h>     // strdup
+#include <string.h>     // memcpy, memset
 #include <stdio.h>      // printf
 #include <sys/socket.h> // AF_INET, AF_INET6
 
 #include "packet.h"
+#include "pool.h"       // pool_t
+#include "memstats.h"   // memstats_track_*
+
+// Released packets are recycled along with their (empty) buffer.
+static __thread pool_t packet_pool = POOL_INITIALIZER(sizeof(packet_t), free);
+
+static void packet_pool_clear() __attribute__((destructor));
+
+static void packet_pool_clear() {
+    pool_clear(&packet_pool, free);
+}
 
 packet_t * packet_create() {
     packet_t * packet;
+    bool       recycled;
 
-    if (!(packet = calloc(1, sizeof(packet_t)))) goto ERR_CALLOC;
-    if (!(packet->buffer = buffer_create()))     goto ERR_BUFFER_CREATE;
-    if (!(packet->dst_ip = address_create()))    goto ERR_ADDRESS_CREATE;
-    return packet;
+    if (!(packet = pool_alloc(&packet_pool, &recycled))) return NULL;
 
-ERR_ADDRESS_CREATE:
-    buffer_free(packet->buffer);
-ERR_BUFFER_CREATE:
-    free(packet);
-ERR_CALLOC:
-    return NULL;
+    // The inline bytes of the buffer do not need to be reset
+    if (recycled) {
+        memset(packet, 0, offsetof(packet_t, inline_buffer));
+        memset(&packet->inline_dst_ip, 0, sizeof(address_t));
+    }
+    packet->inline_buffer.data = NULL;
+    packet->inline_buffer.size = 0;
+    packet->buffer = &packet->inline_buffer;
+    packet->dst_ip = &packet->inline_dst_ip;
+    memstats_track_alloc(MEMSTATS_PACKET, sizeof(packet_t));
+    return packet;
 }
 
 packet_t * packet_wrap_bytes(uint8_t * bytes, size_t num_bytes) {
@@ -33,6 +48,28 @@ packet_t * packet_wrap_bytes(uint8_t * bytes, size_t num_bytes) {
     return packet;
 }
 
+packet_t * packet_borrow_bytes(uint8_t * bytes, size_t num_bytes) {
+    packet_t * packet;
+
+    if ((packet = packet_wrap_bytes(bytes, num_bytes))) {
+        packet->is_borrowed = true;
+    }
+    return packet;
+}
+
+packet_t * packet_lend_bytes(uint8_t * bytes, size_t num_bytes, void (* release_bytes)(uint8_t * bytes)) {
+    packet_t * packet;
+
+    if ((packet = packet_wrap_bytes(bytes, num_bytes))) {
+        packet->release_bytes = release_bytes;
+    }
+    return packet;
+}
+
+inline bool packet_is_borrowed(const packet_t * packet) {
+    return packet->is_borrowed;
+}
+
 packet_t * packet_create_from_bytes(uint8_t * bytes, size_t num_bytes) {
     packet_t * packet;
 
@@ -44,33 +81,70 @@ packet_t * packet_create_from_bytes(uint8_t * bytes, size_t num_bytes) {
 
 packet_t * packet_dup(const packet_t * packet) {
     packet_t * ret = NULL;
+    size_t     size = packet_get_size(packet);
 
-    if ((ret = malloc(sizeof(packet_t)))) {
-        if (!(ret->buffer = buffer_dup(packet->buffer))) goto ERR_BUFFER_DUP;
+    if ((ret = packet_create())) {
+        if (!buffer_resize(ret->buffer, size)) goto ERR_BUFFER_RESIZE;
+        if (size) memcpy(packet_get_bytes(ret), packet_get_bytes(packet), size);
         if (packet->dst_ip) {
-            if (!(ret->dst_ip = address_dup(packet->dst_ip))) goto ERR_DST_IP_DUP;
-        } else ret->dst_ip = NULL;
+            memcpy(ret->dst_ip, packet->dst_ip, sizeof(address_t));
+        } else {
+            ret->dst_ip = NULL;
+        }
+        ret->recv_time   = packet->recv_time;
+#ifdef USE_TXTIME
+        ret->departure_time = packet->departure_time;
+#endif
     }
 
     return ret;
 
-ERR_DST_IP_DUP:
-    buffer_free(ret->buffer);
-ERR_BUFFER_DUP:
+ERR_BUFFER_RESIZE:
+    packet_free(ret);
     return NULL;
 }
 
 void packet_free(packet_t * packet) {
     if (packet) {
         if (packet->buffer) {
-            buffer_free(packet->buffer);
+            // Borrowed bytes must not be released, lent bytes are given back
+            if (packet->release_bytes && packet->buffer->data) {
+                packet->release_bytes(packet->buffer->data);
+            }
+            if (packet->is_borrowed || packet->release_bytes) packet->buffer->data = NULL;
+
+            // A buffer installed by packet_set_buffer is owned by the packet
+            if (packet->buffer == &packet->inline_buffer) {
+                buffer_clear(packet->buffer);
+            } else {
+                buffer_free(packet->buffer);
+            }
         }
-        if (packet->dst_ip) address_free(packet->dst_ip);
-        free(packet);
+
+        // The (empty) inline buffer is recycled along with the packet
+        memstats_track_free(MEMSTATS_PACKET, sizeof(packet_t));
+        if (!pool_release(&packet_pool, packet)) free(packet);
     }
 }
 
 bool packet_resize(packet_t * packet, size_t new_size) {
+    uint8_t * bytes;
+    size_t    size;
+
+    // Lent bytes cannot be reallocated, copy them into the buffer
+    if (packet->release_bytes) {
+        bytes = packet->buffer->data;
+        size  = packet->buffer->size < new_size ? packet->buffer->size : new_size;
+        packet->buffer->data = NULL;
+        packet->buffer->size = 0;
+        if (!buffer_write_bytes(packet->buffer, bytes, size)) {
+            packet->buffer->data = bytes;
+            return false;
+        }
+        packet->release_bytes(bytes);
+        packet->release_bytes = NULL;
+    }
+
     return buffer_resize(packet->buffer, new_size);
 }
 
@@ -103,6 +177,24 @@ void packet_set_buffer(packet_t * packet, buffer_t * buffer) {
     packet->buffer = buffer;
 }
 
+inline uint64_t packet_get_recv_time(const packet_t * packet) {
+    return packet->recv_time;
+}
+
+inline void packet_set_recv_time(packet_t * packet, uint64_t recv_time) {
+    packet->recv_time = recv_time;
+}
+
+#ifdef USE_TXTIME
+inline uint64_t packet_get_departure_time(const packet_t * packet) {
+    return packet->departure_time;
+}
+
+inline void packet_set_departure_time(packet_t * packet, uint64_t departure_time) {
+    packet->departure_time = departure_time;
+}
+#endif
+
 void packet_dump(const packet_t * packet) {
     buffer_dump(packet->buffer);
 }
@@ -6,21 +6,40 @@
  * \brief Header for network packets
  */
 
+#include <stdint.h>     // uint64_t
+
 #include "buffer.h"    // buffer_t
 #include "address.h"   // address_t
 
 /**
  * \struct packet_t
- * \brief Structure describing a network packet
+ * \brief Structure describing a network packet. The buffer and the
+ *    destination address are stored in the packet_t instance itself,
+ *    and so are the bytes of small packets (see BUFFER_INLINE_SIZE),
+ *    so that a probe packet is a single allocation.
  */
 
 typedef struct packet_s {
-    buffer_t  * buffer;   /**< Buffer to hold the packet data */
+    buffer_t  * buffer;   /**< Buffer to hold the packet data (points to inline_buffer) */
 
     // The following fields are those used by the socket pool
     // to send the packet.
 
-    address_t * dst_ip;   /**< Destination address (mandatory) */
+    address_t * dst_ip;   /**< Destination address (mandatory, points to inline_dst_ip) */
+#ifdef USE_TXTIME
+    uint64_t    departure_time; /**< When the kernel must send this packet (see SO_TXTIME, in nanoseconds, see get_time_ns), 0 if as soon as possible */
+#endif
+
+    // The following fields are set by the sniffer.
+
+    uint64_t    recv_time;   /**< Timestamp set by the kernel when the packet has been sniffed (in nanoseconds, see get_time_ns), 0 if unknown */
+    bool        is_borrowed; /**< true iif the bytes of this packet are not owned by this packet_t instance (see packet_borrow_bytes) */
+    void     (* release_bytes)(uint8_t * bytes); /**< Releases the bytes lent to this packet (see packet_lend_bytes), NULL if its buffer owns them */
+
+    // Storage of the buffer and of the destination address.
+
+    buffer_t    inline_buffer; /**< Storage of *buffer */
+    address_t   inline_dst_ip; /**< Storage of *dst_ip */
 } packet_t;
 
 /**
@@ -48,6 +67,40 @@ packet_t * packet_create_from_bytes(uint8_t * bytes, size_t num_bytes);
 
 packet_t * packet_wrap_bytes(uint8_t * bytes, size_t num_bytes);
 
+/**
+ * \brief Create a new packet referencing bytes it does not own (for
+ *    instance, a frame stored in a capture ring). These bytes are not
+ *    released by packet_free. Use packet_dup to get a packet owning
+ *    a copy of these bytes.
+ * \param bytes The bytes carried by the packet
+ * \param num_bytes The packet size (in bytes)
+ * \return The newly allocated packet_t instance, NULL in case of failure
+ */
+
+packet_t * packet_borrow_bytes(uint8_t * bytes, size_t num_bytes);
+
+/**
+ * \brief Test whether a packet owns its bytes.
+ * \param packet A packet_t instance
+ * \return true iif the bytes of this packet are borrowed
+ */
+
+bool packet_is_borrowed(const packet_t * packet);
+
+/**
+ * \brief Create a new packet taking over bytes allocated by another
+ *    module (for instance, a reception buffer of the sniffer), so that
+ *    they are not copied. Contrary to borrowed bytes, lent bytes remain
+ *    valid until packet_free is called, which releases them thanks to
+ *    release_bytes. They are copied if the packet is resized.
+ * \param bytes The bytes carried by the packet
+ * \param num_bytes The packet size (in bytes)
+ * \param release_bytes The function called to release bytes.
+ * \return The newly allocated packet_t instance, NULL in case of failure
+ */
+
+packet_t * packet_lend_bytes(uint8_t * bytes, size_t num_bytes, void (* release_bytes)(uint8_t * bytes));
+
 /**
  * \brief Resize a packet
  * \param new_size The new packet size
@@ -111,4 +164,14 @@ buffer_t * packet_get_buffer(packet_t * packet);
 
 void packet_set_buffer(packet_t * packet, buffer_t * buffer);
 
+uint64_t packet_get_recv_time(const packet_t * packet);
+
+void packet_set_recv_time(packet_t * packet, uint64_t recv_time);
+
+#ifdef USE_TXTIME
+uint64_t packet_get_departure_time(const packet_t * packet);
+
+void packet_set_departure_time(packet_t * packet, uint64_t departure_time);
+#endif
+
 #endif
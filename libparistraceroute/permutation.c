@@ -0,0 +1,90 @@
+#include "config.h"
+
+#include <stddef.h>   // size_t
+
+#include "permutation.h"
+
+/**
+ * \brief Scramble a 64-bit integer (splitmix64 finalizer).
+ * \param x The integer.
+ * \return The scrambled integer.
+ */
+
+static uint64_t permutation_mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * \brief Encrypt a value of [0, 4^k - 1] thanks to the Feistel network.
+ * \param permutation The permutation_t instance.
+ * \param x The value.
+ * \return The encrypted value, in [0, 4^k - 1].
+ */
+
+static uint64_t permutation_encrypt(const permutation_t * permutation, uint64_t x)
+{
+    uint64_t left  = x >> permutation->half_bits,
+             right = x & permutation->half_mask,
+             tmp;
+    size_t   i;
+
+    for (i = 0; i < PERMUTATION_NUM_ROUNDS; i++) {
+        tmp   = right;
+        right = left ^ (permutation_mix(right ^ permutation->keys[i]) & permutation->half_mask);
+        left  = tmp;
+    }
+
+    return (left << permutation->half_bits) | right;
+}
+
+void permutation_init(permutation_t * permutation, uint64_t n, uint64_t seed)
+{
+    size_t i;
+
+    permutation->n         = n;
+    permutation->offset    = 0;
+    permutation->half_bits = 1;
+    while (permutation->half_bits < 31 && (1ULL << (2 * permutation->half_bits)) < n) {
+        permutation->half_bits++;
+    }
+    permutation->half_mask = (1ULL << permutation->half_bits) - 1;
+
+    for (i = 0; i < PERMUTATION_NUM_ROUNDS; i++) {
+        permutation->keys[i] = permutation_mix(seed + i);
+    }
+}
+
+uint64_t permutation_get(const permutation_t * permutation, uint64_t i)
+{
+    // Cycle walking: i < n, so this loop ends on the cycle of i.
+    do {
+        i = permutation_encrypt(permutation, i);
+    } while (i >= permutation->n);
+
+    return i;
+}
+
+bool permutation_next(permutation_t * permutation, uint64_t * pvalue)
+{
+    if (!permutation_has_next(permutation)) return false;
+
+    *pvalue = permutation_get(permutation, permutation->offset++);
+    return true;
+}
+
+void permutation_seek(permutation_t * permutation, uint64_t offset)
+{
+    permutation->offset = offset < permutation->n ? offset : permutation->n;
+}
+
+uint64_t permutation_get_offset(const permutation_t * permutation) {
+    return permutation->offset;
+}
+
+bool permutation_has_next(const permutation_t * permutation) {
+    return permutation->offset < permutation->n;
+}
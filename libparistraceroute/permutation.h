@@ -0,0 +1,93 @@
+#include "use.h"
+
+#ifndef PERMUTATION_H
+#define PERMUTATION_H
+
+/**
+ * \file permutation.h
+ * \brief Pseudo-random permutation of [0, n - 1] in O(1) memory.
+ *
+ * A campaign probes every (target, TTL) pair once. Walking them in a
+ * pseudo-random order spreads the probes sent at a given time over many
+ * routers, instead of hammering the first hops of every target at once.
+ *
+ * The i-th value of the permutation is computed independently of the
+ * previous ones: a balanced Feistel network is a bijection over [0, 4^k - 1]
+ * (with 4^k >= n), and its outputs greater than n - 1 are encrypted again
+ * until they fall in [0, n - 1] (cycle walking). Since 4^k < 4n, it costs
+ * less than 4 encryptions per value on average. A permutation is fully
+ * defined by (n, seed), so that a campaign can be resumed from any offset
+ * (see permutation_seek).
+ */
+
+#include <stdbool.h>  // bool
+#include <stdint.h>   // uint64_t
+
+// Number of rounds of the Feistel network
+#define PERMUTATION_NUM_ROUNDS 4
+
+/**
+ * \struct permutation_t
+ * \brief Structure describing a permutation of [0, n - 1].
+ */
+
+typedef struct {
+    uint64_t n;                            /**< Number of values */
+    uint64_t offset;                       /**< Index of the next value returned by permutation_next */
+    unsigned half_bits;                    /**< k: each half of the Feistel network is made of k bits */
+    uint64_t half_mask;                    /**< 2^k - 1 */
+    uint64_t keys[PERMUTATION_NUM_ROUNDS]; /**< Round keys, derived from the seed */
+} permutation_t;
+
+/**
+ * \brief Initialize a permutation.
+ * \param permutation The permutation_t instance.
+ * \param n The number of values (at most 2^62).
+ * \param seed Selects the permutation.
+ */
+
+void permutation_init(permutation_t * permutation, uint64_t n, uint64_t seed);
+
+/**
+ * \brief Retrieve the i-th value of a permutation.
+ * \param permutation The permutation_t instance.
+ * \param i The index of the value, in [0, n - 1].
+ * \return The corresponding value, in [0, n - 1].
+ */
+
+uint64_t permutation_get(const permutation_t * permutation, uint64_t i);
+
+/**
+ * \brief Draw the next value of a permutation.
+ * \param permutation The permutation_t instance.
+ * \param pvalue Address of an uint64_t in which the value is written.
+ * \return true iif successful, false once the n values have been drawn.
+ */
+
+bool permutation_next(permutation_t * permutation, uint64_t * pvalue);
+
+/**
+ * \brief Move to a given offset, e.g. to resume an interrupted campaign.
+ * \param permutation The permutation_t instance.
+ * \param offset The index of the next value to draw (at most n).
+ */
+
+void permutation_seek(permutation_t * permutation, uint64_t offset);
+
+/**
+ * \brief Retrieve the number of values drawn so far.
+ * \param permutation The permutation_t instance.
+ * \return The index of the next value to draw.
+ */
+
+uint64_t permutation_get_offset(const permutation_t * permutation);
+
+/**
+ * \brief Check whether some values have not been drawn yet.
+ * \param permutation The permutation_t instance.
+ * \return true iif there is a value left.
+ */
+
+bool permutation_has_next(const permutation_t * permutation);
+
+#endif // PERMUTATION_H
@@ -0,0 +1,72 @@
+#include "use.h"
+#include "config.h"
+
+#include <stdlib.h>     // calloc
+#include <pthread.h>    // pthread_key_*, pthread_once
+
+#include "pool.h"
+
+#ifdef USE_POOLS
+
+// The pools in which the calling thread has cached objects
+static __thread pool_t * thread_pools = NULL;
+static pthread_key_t     thread_pools_key;
+static pthread_once_t    thread_pools_once = PTHREAD_ONCE_INIT;
+
+static void thread_pools_clear(void * unused) {
+    pool_t * pool;
+
+    for (pool = thread_pools; pool; pool = pool->next) {
+        pool_clear(pool, pool->element_free);
+    }
+}
+
+static void thread_pools_key_create() {
+    pthread_key_create(&thread_pools_key, thread_pools_clear);
+}
+
+/**
+ * \brief Clear a pool once its thread exits.
+ * \param pool A thread-local pool_t instance.
+ */
+
+static void pool_register(pool_t * pool) {
+    pthread_once(&thread_pools_once, thread_pools_key_create);
+    pool->next = thread_pools;
+    pool->is_registered = true;
+    thread_pools = pool;
+    pthread_setspecific(thread_pools_key, pool);
+}
+
+#endif
+
+void * pool_alloc(pool_t * pool, bool * precycled)
+{
+#ifdef USE_POOLS
+    if (pool->num_elements) {
+        *precycled = true;
+        return pool->elements[--pool->num_elements];
+    }
+#endif
+    *precycled = false;
+    return calloc(1, pool->element_size);
+}
+
+bool pool_release(pool_t * pool, void * element)
+{
+#ifdef USE_POOLS
+    if (pool->num_elements < POOL_MAX_ELEMENTS) {
+        if (!pool->is_registered) pool_register(pool);
+        pool->elements[pool->num_elements++] = element;
+        return true;
+    }
+#endif
+    return false;
+}
+
+void pool_clear(pool_t * pool, void (*element_free)(void * element))
+{
+    while (pool->num_elements) {
+        element_free(pool->elements[--pool->num_elements]);
+    }
+}
@@ -0,0 +1,86 @@
+#include "use.h"
+
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * \file pool.h
+ * \brief Caches of released objects of a given size.
+ *
+ * Objects allocated and released at a high rate (e.g. one probe_t, its
+ * layers, its packet_t and its buffer_t per probe sent and per reply
+ * received) are kept in a pool_t once released, so that they can be handed
+ * out again without calling malloc and free. Since the content of a cached
+ * object is preserved, an object may keep its own allocations (e.g. the
+ * array of layers of a probe) while it stays in the pool.
+ *
+ * A pool_t is not thread-safe: the pools of libparistraceroute are
+ * thread-local, so each thread running a pt_loop_t has its own pools.
+ * Objects are allocated thanks to malloc, so an object allocated by a
+ * thread may be released by another one. The objects cached by a thread
+ * are freed once it exits (the objects cached by the main thread are freed
+ * by the destructor of each pool).
+ *
+ * If USE_POOLS is not set, pool_alloc() and pool_release() never recycle
+ * any object.
+ */
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+
+// Maximum number of released objects kept by a pool.
+#define POOL_MAX_ELEMENTS 256
+
+/**
+ * \struct pool_t
+ * \brief A cache of released objects.
+ */
+
+typedef struct pool_s {
+    size_t          element_size;                  /**< Size of the objects (in bytes) */
+    size_t          num_elements;                  /**< Number of cached objects */
+    void          * elements[POOL_MAX_ELEMENTS];   /**< The cached objects */
+    void         (* element_free)(void *);         /**< Frees a cached object once the thread of this pool exits */
+    struct pool_s * next;                          /**< Next pool of the same thread having cached objects */
+    bool            is_registered;                 /**< true once this pool is in the list of its thread */
+} pool_t;
+
+/**
+ * \brief Initializer of a (static, thread-local) pool_t instance.
+ * \param size The size of the objects managed by this pool.
+ * \param free_element The function freeing a cached object (see pool_clear).
+ */
+
+#define POOL_INITIALIZER(size, free_element) { .element_size = (size), .num_elements = 0, .element_free = (free_element) }
+
+/**
+ * \brief Retrieve an object from a pool.
+ * \param pool A pool_t instance.
+ * \param precycled Address of a bool set to true if the object has been
+ *    recycled (its content is then the one it had when it has been
+ *    released), false if it has just been allocated (it is then zeroed).
+ * \return The object, NULL in case of failure.
+ */
+
+void * pool_alloc(pool_t * pool, bool * precycled);
+
+/**
+ * \brief Hand a released object over to a pool.
+ * \param pool A pool_t instance.
+ * \param element The object, allocated by pool_alloc.
+ * \return true iif the object is now cached by the pool. Otherwise
+ *    the pool is full and the caller must free the object.
+ */
+
+bool pool_release(pool_t * pool, void * element);
+
+/**
+ * \brief Free every object cached by a pool.
+ * \param pool A pool_t instance.
+ * \param element_free The function used to release each cached object
+ *    (and its own allocations), e.g. free.
+ */
+
+void pool_clear(pool_t * pool, void (*element_free)(void * element));
+
+#endif
@@ -6,12 +6,37 @@
 #include <errno.h>           // errno, EINVAL
 #include <stdarg.h>          // va_start, va_copy, va_arg
 #include <string.h>          // memcpy
+#include <arpa/inet.h>       // ntohs, ntohl
+#include <netinet/in.h>      // IPPROTO_IPIP, IPPROTO_IPV6
 
 #include "probe.h"
 #include "buffer.h"          // buffer_t
 #include "protocol.h"        // protocol_t
-#include "common.h"          // ELEMENT_FREE
+#include "common.h"          // ELEMENT_FREE, MIN
 #include "generator.h"       // generator_*
+#include "pool.h"            // pool_t
+#include "field_key.h"       // FIELD_KEY_CHECKSUM
+
+// TODO: TEMP HACK IPv4 flow id is encoded in src_port. We add this value
+// to the port to increase chances to traverse firewalls.
+#define FLOW_ID_PORT_OFFSET 24000
+
+// Maximum size of a header saved by probe_save_header (IPv4 options included).
+#define PROBE_MAX_HEADER_SIZE 64
+
+/**
+ * \struct header_snapshot_t
+ * \brief A copy of a header, used to detect whether the pseudo header
+ *    computed by its nested layer has been altered.
+ */
+
+typedef struct {
+    layer_t * layer;                         /**< The layer being updated */
+    layer_t * nested_layer;                  /**< The layer whose checksum depends on layer, NULL if it is not valid */
+    bool      is_raw;                        /**< True iif the update bypasses the layer API (see layer_set_protocol_field) */
+    size_t    size;                          /**< Size of the saved header */
+    uint8_t   header[PROBE_MAX_HEADER_SIZE]; /**< The header of layer before the update */
+} header_snapshot_t;
 
 //-----------------------------------------------------------
 // Probe consistency
@@ -95,28 +120,183 @@ static void probe_layers_clear(probe_t * probe);
 
 static bool probe_packet_resize(probe_t * probe, size_t size);
 
+/**
+ * \brief (Internal use) Dissect the next layer of a probe wrapping a packet
+ *    (see probe_wrap_packet). The payload layer is pushed once the last
+ *    protocol layer is dissected.
+ * \param probe The probe we're dissecting. probe->next_protocol must be set.
+ * \return true iif successful
+ */
+
+static bool probe_dissect_next_layer(probe_t * probe);
+
+/**
+ * \brief (Internal use) Save the header of a layer of a probe before updating it.
+ * \param probe The probe we're updating
+ * \param i The index of the layer
+ * \param is_raw Pass true if the header is updated by writing directly its
+ *    bytes, so that the checksum of this layer has to be updated too.
+ * \param snapshot The header_snapshot_t instance in which the header is saved.
+ */
+
+static void probe_save_header(const probe_t * probe, size_t i, bool is_raw, header_snapshot_t * snapshot);
+
+/**
+ * \brief (Internal use) Compare a header saved by probe_save_header with its
+ *    current version, and invalidate or update the checksums it affects.
+ * \param snapshot The header_snapshot_t instance filled by probe_save_header.
+ */
+
+static void probe_check_header(header_snapshot_t * snapshot);
+
+/**
+ * \brief (Internal use) Mark the checksum of every layer of a probe as invalid.
+ * \param probe The probe we're updating
+ */
+
+static void probe_invalidate_checksums(probe_t * probe);
+
+/**
+ * \brief (Internal use) Mark a layer of a probe as dirty (see
+ *    probe_update_fields) if a field set in this layer is involved in
+ *    the update of the probe.
+ * \param probe The probe we're updating
+ * \param i The index of the layer
+ * \param protocol_field The field set in this layer.
+ */
+
+static void probe_set_dirty(probe_t * probe, size_t i, const protocol_field_t * protocol_field);
+
+#ifdef USE_COMPACT_PROBES
+/**
+ * \brief (Internal use) Rebuild the packet and the layers of a compact
+ *    probe (see probe_compact) from the snapshot it shares.
+ * \param probe The compact probe.
+ * \return true iif successful
+ */
+
+static bool probe_materialize(probe_t * probe);
+
+/**
+ * \brief (Internal use) Take a snapshot of a probe skeleton, shared by
+ *    the probes stamped out of it (see probe_skel_stamp), unless the
+ *    current one is still identical to the skeleton.
+ * \param probe_skel The probe skeleton.
+ */
+
+static void probe_skel_share(probe_t * probe_skel);
+#endif
+
 //-----------------------------------------------------------
 // Static functions (implementation)
 //-----------------------------------------------------------
 
+// The layers beyond the 31th share the last bit of probe_t::dirty_layers.
+static inline uint32_t probe_get_dirty_bit(size_t i) {
+    return 1u << (i < 31 ? i : 31);
+}
+
+// A compact probe is logically const even if it is rebuilt on access.
+static inline bool probe_unpack(const probe_t * probe) {
+#ifdef USE_COMPACT_PROBES
+    if (!probe->packet) return probe_materialize((probe_t *) probe);
+#endif
+    return true;
+}
+
 static bool probe_finalize(probe_t * probe)
 {
     bool      ret = true;
     size_t    i, num_layers = probe_get_num_layers(probe);
     layer_t * layer;
 
+    header_snapshot_t snapshot;
+
     // Allow the protocol to do some processing before computing checksums.
     for (i = 0; i < num_layers; i++) {
+        if (!(probe->dirty_layers & probe_get_dirty_bit(i))) continue;
         layer = probe_get_layer(probe, i);
         if (layer->protocol && layer->protocol->finalize) {
+            probe_save_header(probe, i, true, &snapshot);
             if (!(ret &= layer->protocol->finalize(layer->segment))) {
                 fprintf(stderr, "W: Can't finalize layer %s\n", layer->protocol->name);
             }
+            probe_check_header(&snapshot);
         }
     }
     return ret;
 }
 
+static void probe_save_header(const probe_t * probe, size_t i, bool is_raw, header_snapshot_t * snapshot)
+{
+    layer_t * layer = probe_get_layer(probe, i),
+            * nested_layer = NULL;
+
+    if (i + 1 < probe_get_num_layers(probe)) {
+        nested_layer = probe_get_layer(probe, i + 1);
+        if (!nested_layer->protocol
+        ||  !nested_layer->protocol->create_pseudo_header
+        ||  !nested_layer->is_checksum_valid) nested_layer = NULL;
+    }
+
+    snapshot->layer        = layer;
+    snapshot->nested_layer = nested_layer;
+    snapshot->is_raw       = is_raw && layer->is_checksum_valid;
+    snapshot->size         = 0;
+
+    if (nested_layer || snapshot->is_raw) {
+        snapshot->size = layer->protocol->get_header_size(layer->segment);
+        if (snapshot->size > PROBE_MAX_HEADER_SIZE || snapshot->size > layer->segment_size) {
+            // Too large to be saved, fall back to a full computation
+            if (nested_layer)     layer_invalidate_checksum(nested_layer);
+            if (snapshot->is_raw) layer_invalidate_checksum(layer);
+            snapshot->nested_layer = NULL;
+            snapshot->is_raw       = false;
+        } else {
+            memcpy(snapshot->header, layer->segment, snapshot->size);
+        }
+    }
+}
+
+static void probe_check_header(header_snapshot_t * snapshot)
+{
+    const uint8_t * segment = snapshot->layer->segment;
+
+    if ((snapshot->nested_layer || snapshot->is_raw)
+    &&  memcmp(snapshot->header, segment, snapshot->size) != 0) {
+        if (snapshot->nested_layer) {
+            layer_invalidate_checksum(snapshot->nested_layer);
+        }
+        if (snapshot->is_raw) {
+            layer_add_checksum_change(
+                snapshot->layer,
+                csum_add(0, snapshot->header, snapshot->size),
+                csum_add(0, segment, snapshot->size)
+            );
+        }
+    }
+}
+
+static void probe_invalidate_checksums(probe_t * probe)
+{
+    size_t i, num_layers = probe_get_num_layers(probe);
+
+    for (i = 0; i < num_layers; i++) {
+        layer_invalidate_checksum(probe_get_layer(probe, i));
+    }
+}
+
+static void probe_set_dirty(probe_t * probe, size_t i, const protocol_field_t * protocol_field)
+{
+    // The other fields (ttl, ports...) are only covered by the checksums,
+    // which are tracked by each layer.
+    if (protocol_field->in_pseudo_header
+    ||  protocol_field->key_id == FIELD_KEY_LENGTH
+    ||  protocol_field->key_id == FIELD_KEY_PROTOCOL) {
+        probe->dirty_layers |= probe_get_dirty_bit(i);
+    }
+}
+
 static bool layer_set_field_and_free(layer_t * layer, field_t * field) {
     bool ret = false;
 
@@ -132,12 +312,15 @@ static bool probe_update_protocol(probe_t * probe)
     size_t    i, num_layers = probe_get_num_layers(probe);
     layer_t * layer,
             * prev_layer;
+    header_snapshot_t snapshot;
 
     for (i = 0, prev_layer = NULL; i < num_layers; i++, prev_layer = layer) {
         layer = probe_get_layer(probe, i);
-        if (layer->protocol && prev_layer) {
+        if (layer->protocol && prev_layer && (probe->dirty_layers & probe_get_dirty_bit(i))) {
             // Update 'protocol' field (if any)
+            probe_save_header(probe, i, false, &snapshot);
             layer_set_field_and_free(layer, I8("protocol", prev_layer->protocol->protocol));
+            probe_check_header(&snapshot);
         }
     }
     return true;
@@ -145,19 +328,31 @@ static bool probe_update_protocol(probe_t * probe)
 
 static bool probe_update_length(probe_t * probe)
 {
-    bool      ret = true;
+    bool      ret = true,
+              is_dirty = false;
     size_t    i, offset,
               num_layers = probe_get_num_layers(probe),
               packet_size = probe_get_size(probe);
     layer_t * layer;
+    header_snapshot_t snapshot;
 
     for (i = 0, offset = 0; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
+
+        // The size of a dirty layer may have changed, so the lengths of the
+        // next layers are updated too.
+        if (!(is_dirty |= (probe->dirty_layers & probe_get_dirty_bit(i)) != 0)) {
+            if (layer->protocol) offset += layer->protocol->get_header_size(layer->segment);
+            continue;
+        }
+
         if (layer->protocol) {
             // Update 'length' field (if any)
             // This protocol field must always corresponds to the size of the
             // header + its contents.
+            probe_save_header(probe, i, false, &snapshot);
             layer_set_field_and_free(layer, I16("length", packet_size - offset));
+            probe_check_header(&snapshot);
             offset += layer->protocol->get_header_size(layer->segment);
         } else {
             // Update payload size
@@ -174,12 +369,36 @@ bool probe_update_checksum(probe_t * probe)
     layer_t  * layer,
              * layer_prev;
     buffer_t * pseudo_header;
+    const protocol_field_t * checksum_field;
+    uint16_t   checksum;
 
     // Update each layers from the (last - 1) one to the first one.
     for (j = 0; j < num_layers; j++) {
         i = num_layers - j - 1;
         layer = probe_get_layer(probe, i);
 
+        // The changes made in a nested protocol layer (e.g. the header
+        // quoted in an ICMP error) are not tracked by this layer.
+        if (i > 0 && i + 1 < num_layers && probe_get_layer(probe, i + 1)->protocol) {
+            layer_invalidate_checksum(layer);
+        }
+
+        if (layer->protocol && layer->protocol->write_checksum && layer->is_checksum_valid) {
+            // The checksum only has to be updated according to the changes
+            // made in the layer since its last computation (RFC 1624).
+            if (layer->checksum_delta) {
+                if (!(checksum_field = protocol_get_field_by_key(layer->protocol, FIELD_KEY_CHECKSUM))) {
+                    layer_invalidate_checksum(layer);
+                } else {
+                    memcpy(&checksum, layer->segment + checksum_field->offset, sizeof(uint16_t));
+                    checksum = csum_update(checksum, layer->checksum_delta);
+                    memcpy(layer->segment + checksum_field->offset, &checksum, sizeof(uint16_t));
+                    layer->checksum_delta = 0;
+                    continue;
+                }
+            } else continue;
+        }
+
         // Does the protocol require a pseudoheader to compute its checksum?
         if (layer->protocol && layer->protocol->write_checksum) {
 
@@ -217,12 +436,21 @@ bool probe_update_checksum(probe_t * probe)
 
             // Release the pseudo header (if any) from the memory
             if (pseudo_header) buffer_free(pseudo_header);
+
+            layer->is_checksum_valid = true;
+            layer->checksum_delta    = 0;
         }
     }
     return true;
 }
 
 layer_t * probe_get_layer(const probe_t * probe, size_t i) {
+    if (!probe_unpack(probe)) return NULL;
+
+    // A probe is logically const even if its layers are not dissected yet
+    while (probe->next_protocol && i >= dynarray_get_size(probe->layers)) {
+        if (!probe_dissect_next_layer((probe_t *) probe)) break;
+    }
     return dynarray_get_ith_element(probe->layers, i);
 }
 
@@ -311,11 +539,13 @@ static bool probe_packet_resize(probe_t * probe, size_t size)
     layer_t * layer;
     uint8_t * segment;
 
-    if (!packet_resize(probe->packet, size)) {
+    if (!probe_unpack(probe) || !packet_resize(probe->packet, size)) {
         return false;
     }
 
-    // TODO update bitfield
+    // The data covered by the checksums has moved
+    probe_invalidate_checksums(probe);
+    probe->dirty_layers = PROBE_DIRTY_ALL;
 
     // Update each layer's segment
     for (i = 0; i < num_layers; i++) {
@@ -338,71 +568,156 @@ static bool probe_packet_resize(probe_t * probe, size_t size)
 // Allocation
 //-----------------------------------------------------------
 
+static void probe_pool_free(probe_t * probe) {
+    probe_layers_free(probe);
+    free(probe);
+}
+
+// Released probes are recycled along with their (empty) array of layers.
+static __thread pool_t probe_pool = POOL_INITIALIZER(sizeof(probe_t), (ELEMENT_FREE) probe_pool_free);
+
+static void probe_pool_clear() __attribute__((destructor));
+
+static void probe_pool_clear() {
+    pool_clear(&probe_pool, (ELEMENT_FREE) probe_pool_free);
+}
+
 probe_t * probe_create()
 {
-    probe_t * probe;
+    probe_t    * probe;
+    dynarray_t * layers;
+    bool         recycled;
+
+    // Fresh probes are zeroed to set *_time and caller members to 0
+    if (!(probe = pool_alloc(&probe_pool, &recycled))) goto ERR_PROBE;
+    if (recycled) {
+        layers = probe->layers;
+        memset(probe, 0, sizeof(probe_t));
+        probe->layers = layers;
+    } else if (!(probe->layers = dynarray_create())) goto ERR_LAYERS;
 
-    // We calloc probe to set *_time and caller members to 0
-    if (!(probe = calloc(1, sizeof(probe_t))))   goto ERR_PROBE;
     if (!(probe->packet = packet_create())) {
         fprintf(stderr, "Cannot create packet\n");
         goto ERR_PACKET;
     }
-    if (!(probe->layers = dynarray_create()))    goto ERR_LAYERS;
-//    if (!(probe->bitfield = bitfield_create(0))) goto ERR_BITFIELD;
+    probe->dirty_layers = PROBE_DIRTY_ALL;
     probe_set_left_to_send(probe, 1);
+    probe->num_references = 1;
+    memstats_track_alloc(MEMSTATS_PROBE, sizeof(probe_t));
     return probe;
 
-    /*
-ERR_BITFIELD:
+ERR_PACKET:
     probe_layers_free(probe);
-    */
 ERR_LAYERS:
-    packet_free(probe->packet);
-ERR_PACKET:
     free(probe);
 ERR_PROBE:
     return NULL;
 }
 
+/**
+ * \brief Copy the layers of a probe into another one, whose packet is a
+ *    copy of the packet of the original probe. The segments are rebased
+ *    on the bytes of the copy, so the protocols are not dissected again.
+ * \param probe The original probe.
+ * \param ret The copy, without any layer.
+ * \return true iif successful.
+ */
+
+static bool probe_layers_dup(const probe_t * probe, probe_t * ret)
+{
+    const uint8_t * bytes     = packet_get_bytes(probe->packet);
+    uint8_t       * bytes_ret = packet_get_bytes(ret->packet);
+    layer_t       * layer,
+                  * layer_ret;
+    size_t          i, num_layers = dynarray_get_size(probe->layers);
+
+    for (i = 0; i < num_layers; i++) {
+        layer = dynarray_get_ith_element(probe->layers, i);
+        if (!(layer_ret = layer_create_from_segment(
+            layer->protocol,
+            bytes_ret + (layer->segment - bytes),
+            layer->segment_size
+        ))) goto ERR_LAYER_CREATE;
+
+        // The checksums of the copy are as valid as the original ones
+        layer_ret->is_checksum_valid = layer->is_checksum_valid;
+        layer_ret->checksum_delta    = layer->checksum_delta;
+
+        if (!probe_push_layer(ret, layer_ret)) goto ERR_PUSH_LAYER;
+    }
+
+    // The layers not yet dissected in the original probe are dissected on demand
+    ret->next_protocol = probe->next_protocol;
+    ret->next_offset   = probe->next_offset;
+    return true;
+
+ERR_PUSH_LAYER:
+    layer_free(layer_ret);
+ERR_LAYER_CREATE:
+    probe_layers_clear(ret);
+    return false;
+}
+
 probe_t * probe_dup(const probe_t * probe)
 {
     probe_t  * ret;
     packet_t * packet;
 
+    if (!probe_unpack(probe))                             goto ERR_PROBE_UNPACK;
     if (!(packet = packet_dup(probe->packet)))            goto ERR_PACKET_DUP;
-    if (!(ret = probe_wrap_packet(packet)))               goto ERR_PROBE_WRAP_PACKET;
-//    if (!(ret->bitfield = bitfield_dup(probe->bitfield))) goto ERR_BITFIELD_DUP;
+    if (!(ret = probe_create()))                          goto ERR_PROBE_CREATE;
+
+    packet_free(ret->packet);
+    ret->packet = packet;
+    probe_layers_clear(ret);
+    if (!probe_layers_dup(probe, ret))                    goto ERR_LAYERS_DUP;
 
     ret->sending_time  = probe->sending_time;
     ret->queueing_time = probe->queueing_time;
     ret->recv_time     = probe->recv_time;
+    ret->reply_class   = probe->reply_class;
+    ret->dirty_layers  = probe->dirty_layers;
     ret->caller        = probe->caller;
 #ifdef USE_SCHEDULING
     ret->delay         = probe->delay ? field_dup(probe->delay): NULL;
+#endif
+#ifdef USE_COMPACT_PROBES
+    ret->shared        = probe_ref(probe->shared);
 #endif
     return ret;
 
-    /*
-ERR_BITFIELD_DUP:
+ERR_LAYERS_DUP:
     probe_free(ret);
-    packet = NULL;
-    */
-ERR_PROBE_WRAP_PACKET:
-    if (packet) packet_free(packet);
+    return NULL;
+ERR_PROBE_CREATE:
+    packet_free(packet);
 ERR_PACKET_DUP:
+ERR_PROBE_UNPACK:
     return NULL;
 }
 
+probe_t * probe_ref(probe_t * probe)
+{
+    if (probe) probe->num_references++;
+    return probe;
+}
+
 void probe_free(probe_t * probe)
 {
-    if (probe) {
-//        bitfield_free(probe->bitfield);
-        probe_layers_free(probe);
+    if (probe && --probe->num_references == 0) {
         if (probe->packet) {
             packet_free(probe->packet);
         }
-        free(probe);
+        if (probe->delay) {
+            field_free(probe->delay);
+        }
+#ifdef USE_COMPACT_PROBES
+        probe_free(probe->shared);
+#endif
+        probe_layers_clear(probe);
+        memstats_sub(probe->memstats, MEMSTATS_PROBE, sizeof(probe_t));
+        memstats_track_free(MEMSTATS_PROBE, sizeof(probe_t));
+        if (!pool_release(&probe_pool, probe)) probe_pool_free(probe);
     }
 }
 
@@ -461,12 +776,13 @@ void probe_debug(const probe_t * probe) {
 static const protocol_t * get_first_protocol(const packet_t * packet) {
     const protocol_t * protocol = NULL;
 
+    // IPv4 and IPv6 are registered with the ID used to encapsulate them
     switch (packet_guess_address_family(packet)) {
         case AF_INET:
-            protocol = protocol_search("ipv4");
+            protocol = protocol_search_by_id(IPPROTO_IPIP);
             break;
         case AF_INET6:
-            protocol = protocol_search("ipv6");
+            protocol = protocol_search_by_id(IPPROTO_IPV6);
             break;
         default:
             fprintf(stderr, "Cannot guess Internet address family\n");
@@ -475,71 +791,67 @@ static const protocol_t * get_first_protocol(const packet_t * packet) {
     return protocol;
 }
 
-probe_t * probe_wrap_packet(packet_t * packet)
+static bool probe_dissect_next_layer(probe_t * probe)
 {
-    probe_t          * probe;
-    size_t             segment_size, remaining_size;
+    const protocol_t * protocol = probe->next_protocol;
+    size_t             segment_size,
+                       remaining_size = packet_get_size(probe->packet) - probe->next_offset;
     layer_t          * layer;
-    uint8_t          * segment;
-    const protocol_t * protocol;
-
-    if (!(probe = probe_create())) {
-        goto ERR_PROBE_CREATE;
-    }
+    uint8_t          * segment = packet_get_bytes(probe->packet) + probe->next_offset;
 
-    // Clear the probe
-    packet_free(probe->packet);
-    probe->packet = packet;
-    probe_layers_clear(probe);
-
-    // Prepare iteration
-    segment = packet_get_bytes(probe->packet);
-    remaining_size = packet_get_size(probe->packet);
+    // The probe is not dissected again if a failure occurs
+    probe->next_protocol = NULL;
 
-    // Push layers
-    for (protocol = get_first_protocol(packet); protocol; protocol = protocol->get_next_protocol(layer)) {
-        if (remaining_size < protocol->write_default_header(NULL)) {
-            // Not enough bytes left for the header, packet is truncated
-            segment_size = remaining_size;
-        } else {
-            segment_size = protocol->get_header_size(segment);
-        }
+    if (remaining_size < protocol->write_default_header(NULL)) {
+        // Not enough bytes left for the header, packet is truncated
+        segment_size = remaining_size;
+    } else {
+        segment_size = protocol->get_header_size(segment);
+        if (segment_size > remaining_size) segment_size = remaining_size;
+    }
 
-        if (!(layer = layer_create_from_segment(protocol, segment, segment_size))) {
-            goto ERR_CREATE_LAYER;
-        }
+    if (!(layer = layer_create_from_segment(protocol, segment, segment_size))) {
+        goto ERR_CREATE_LAYER;
+    }
 
-        if (!probe_push_layer(probe, layer)) {
-            goto ERR_PUSH_LAYER;
-        }
+    if (!probe_push_layer(probe, layer)) {
+        goto ERR_PUSH_LAYER;
+    }
 
-        segment += segment_size;
-        remaining_size -= segment_size;
-        if (remaining_size < 0) {
-            fprintf(stderr, "probe_wrap_packet: Truncated packet\n");
-            goto ERR_TRUNCATED_PACKET;
-        }
+    probe->next_offset += segment_size;
+    remaining_size     -= segment_size;
 
-        if (!protocol->get_next_protocol) {
-            break;
-        }
-        continue;
+    if (!protocol->get_next_protocol || !(probe->next_protocol = protocol->get_next_protocol(layer))) {
+        // Rq: Some packets (e.g ICMP type 3) do not have payload.
+        // In this case we push an empty payload
+        probe_push_payload(probe, remaining_size);
+    }
+    return true;
 
-ERR_TRUNCATED_PACKET:
 ERR_PUSH_LAYER:
-        layer_free(layer);
+    layer_free(layer);
 ERR_CREATE_LAYER:
-        goto ERR_LAYER_DISCOVER_LAYER;
+    return false;
+}
+
+probe_t * probe_wrap_packet(packet_t * packet)
+{
+    probe_t * probe;
+
+    if (!(probe = probe_create())) {
+        goto ERR_PROBE_CREATE;
     }
 
-    // Rq: Some packets (e.g ICMP type 3) do not have payload.
-    // In this case we push an empty payload
-    probe_push_payload(probe, remaining_size);
+    // Clear the probe
+    packet_free(probe->packet);
+    probe->packet = packet;
+    probe_layers_clear(probe);
 
+    // The layers are dissected by probe_get_layer and probe_get_num_layers
+    probe->next_protocol = get_first_protocol(packet);
+    probe->next_offset   = 0;
     return probe;
 
-ERR_LAYER_DISCOVER_LAYER:
-    probe_free(probe);
 ERR_PROBE_CREATE:
     return NULL;
 }
@@ -549,6 +861,10 @@ ERR_PROBE_CREATE:
 //-----------------------------------------------------------
 
 size_t probe_get_num_layers(const probe_t * probe) {
+    if (!probe_unpack(probe)) return 0;
+    while (probe->next_protocol) {
+        if (!probe_dissect_next_layer((probe_t *) probe)) break;
+    }
     return dynarray_get_size(probe->layers);
 }
 
@@ -581,6 +897,7 @@ bool probe_set_protocols(probe_t * probe, const char * name1, ...)
     const protocol_t * protocol;
 
     // Remove the former layer structure
+    if (!probe_unpack(probe)) goto ERR_PROBE_UNPACK;
     probe_layers_clear(probe);
 
     // Set up the new layer structure
@@ -641,6 +958,7 @@ bool probe_set_protocols(probe_t * probe, const char * name1, ...)
     }
 
     // Size and checksum are pending, they depend on payload
+    probe->dirty_layers = PROBE_DIRTY_ALL;
     return true;
 
 ERR_PUSH_PAYLOAD:
@@ -652,11 +970,12 @@ ERR_PROTOCOL_SEARCH2:
     probe_layers_clear(probe);
 ERR_PACKET_RESIZE:
 ERR_PROTOCOL_SEARCH:
+ERR_PROBE_UNPACK:
     return false;
 }
 
 size_t probe_get_size(const probe_t * probe) {
-    return packet_get_size(probe->packet);
+    return probe_unpack(probe) ? packet_get_size(probe->packet) : 0;
 }
 
 bool probe_payload_resize(probe_t * probe, size_t payload_size)
@@ -700,6 +1019,7 @@ bool probe_write_payload(probe_t * probe, const void * bytes, size_t num_bytes)
 bool probe_write_payload_ext(probe_t * probe, const void * bytes, size_t num_bytes, size_t offset)
 {
     layer_t * payload_layer;
+    size_t    num_layers;
 
     if (!(payload_layer = probe_get_layer_payload(probe))) {
         goto ERR_PROBE_GET_LAYER_PAYLOAD;
@@ -715,6 +1035,12 @@ bool probe_write_payload_ext(probe_t * probe, const void * bytes, size_t num_byt
         goto ERR_LAYER_WRITE_PAYLOAD_EXT;
     }
 
+    // The part of the payload covered by the checksum of the last protocol
+    // layer depends on the protocol (see *_write_checksum).
+    if ((num_layers = probe_get_num_layers(probe)) > 1) {
+        layer_invalidate_checksum(probe_get_layer(probe, num_layers - 2));
+    }
+
     return true;
 
 ERR_LAYER_WRITE_PAYLOAD_EXT:
@@ -728,21 +1054,33 @@ ERR_PROBE_GET_LAYER_PAYLOAD:
 
 bool probe_update_fields(probe_t * probe)
 {
-    return probe_finalize(probe)
-        && probe_update_protocol(probe)
-        && probe_update_length(probe)
-        && probe_update_checksum(probe);
+    if (probe->dirty_layers) {
+        if (!(probe_finalize(probe)
+        &&    probe_update_protocol(probe)
+        &&    probe_update_length(probe))) {
+            return false;
+        }
+        probe->dirty_layers = 0;
+    }
+    return probe_update_checksum(probe);
 }
 
 bool probe_set_field_ext(probe_t * probe, size_t depth, const field_t * field)
 {
-    bool      ret = false;
-    size_t    i, num_layers = probe_get_num_layers(probe);
-    layer_t * layer;
+    bool                     ret = false;
+    size_t                   i, num_layers = probe_get_num_layers(probe);
+    layer_t                * layer;
+    const protocol_field_t * protocol_field;
+    header_snapshot_t        snapshot;
 
     for (i = depth; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
+        if (!layer->protocol) continue;
+        if (!(protocol_field = protocol_get_field_by_key(layer->protocol, field->key_id ? field->key_id : field_key_search(field->key)))) continue;
+        if (protocol_field->in_pseudo_header) probe_save_header(probe, i, false, &snapshot);
         if (layer_set_field(layer, field)) {
+            if (protocol_field->in_pseudo_header) probe_check_header(&snapshot);
+            probe_set_dirty(probe, i, protocol_field);
             ret = true;
             break;
         }
@@ -755,13 +1093,20 @@ bool probe_set_field(probe_t * probe, const field_t * field) {
 }
 
 bool probe_write_field_ext(probe_t * probe, size_t depth, const char * name, void * bytes, size_t num_bytes) {
-    bool      ret = false;
-    size_t    i, num_layers = probe_get_num_layers(probe);
-    layer_t * layer;
+    bool                     ret = false;
+    size_t                   i, num_layers = probe_get_num_layers(probe);
+    layer_t                * layer;
+    const protocol_field_t * protocol_field;
+    header_snapshot_t        snapshot;
 
     for (i = depth; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
+        if (!layer->protocol) continue;
+        if (!(protocol_field = protocol_get_field(layer->protocol, name))) continue;
+        if (protocol_field->in_pseudo_header) probe_save_header(probe, i, false, &snapshot);
         if (layer_write_field(layer, name, bytes, num_bytes)) {
+            if (protocol_field->in_pseudo_header) probe_check_header(&snapshot);
+            probe_set_dirty(probe, i, protocol_field);
             ret = true;
             break;
         }
@@ -775,22 +1120,13 @@ bool probe_write_field(probe_t * probe, const char * name, void * bytes, size_t
 
 bool probe_set_metafield_ext(probe_t * probe, size_t depth, field_t * field)
 {
-    bool          ret = true;
-    field_t     * hacked_field;
-
-    // TODO: TEMP HACK IPv4 flow id is encoded in src_port
-    if (strcmp(field->key, "flow_id") != 0) {
+    // TODO: TEMP HACK flow id is encoded in src_port (see probe_set_flow_id)
+    if (field->key_id != FIELD_KEY_FLOW_ID) {
         fprintf(stderr, "probe_set_metafield_ext: cannot set %s\n", field->key);
         return false;
     }
 
-    // We add 24000 to use port to increase chances to traverse firewalls
-    if ((hacked_field = I16("src_port", 24000 + field->value.int16))) {
-        ret = probe_set_field(probe, hacked_field);
-        field_free(hacked_field);
-    }
-
-    return ret;
+    return probe_set_flow_id(probe, field->value.int16);
 
     /*
     metafield = metafield_search(field->key);
@@ -808,29 +1144,86 @@ bool probe_set_metafield(probe_t * probe, field_t * field) {
 // Internal use
 static field_t * probe_create_metafield_ext(const probe_t * probe, const char * name, size_t depth)
 {
-    uint16_t src_port;
+    uint16_t flow_id;
 
     // TODO to generalize to any metafield
     if (strcmp(name, "flow_id") != 0) return NULL;
 
-    // TODO We've hardcoded the flow-id in the src_port and we only support the "flow_id" metafield
-    // In IPv6, flow_id should be set thanks to probe_set_field
-    // We substract 24000 to the port (see probe_set_metafield_ext)
-    return probe_extract(probe, "src_port", &src_port) ?
-        IMAX("flow_id", src_port - 24000) :
-        NULL;
+    return probe_get_flow_id(probe, &flow_id) ? IMAX("flow_id", flow_id) : NULL;
+}
+
+/**
+ * \brief (Internal use) Retrieve the transport layer of a probe carrying
+ *    its flow identifier in its source port.
+ * \param probe The queried probe.
+ * \return The UDP or TCP layer, NULL if the probe has no such layer.
+ */
+
+static layer_t * probe_get_flow_id_layer(const probe_t * probe) {
+    layer_t * layer;
+
+    if (!(layer = probe_get_layer(probe, 1)) || !layer->protocol) return NULL;
+    switch (layer->protocol->protocol) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+            // The source port is the first field of UDP and TCP headers
+            return layer->segment_size >= sizeof(uint16_t) ? layer : NULL;
+        default:
+            return NULL;
+    }
+}
+
+bool probe_get_flow_id(const probe_t * probe, uint16_t * pflow_id)
+{
+    const layer_t * layer;
+    uint16_t        src_port;
+
+    // We substract FLOW_ID_PORT_OFFSET to the port (see probe_set_flow_id)
+    if ((layer = probe_get_flow_id_layer(probe))) {
+        memcpy(&src_port, layer->segment, sizeof(uint16_t));
+        *pflow_id = ntohs(src_port) - FLOW_ID_PORT_OFFSET;
+        return true;
+    }
+
+    return false;
+}
+
+bool probe_set_flow_id(probe_t * probe, uint16_t flow_id)
+{
+    layer_t                * layer;
+    const protocol_field_t * protocol_field;
+    field_t                  field;
+
+    if (!(layer = probe_get_flow_id_layer(probe))
+    ||  !(protocol_field = protocol_get_field_by_key(layer->protocol, FIELD_KEY_SRC_PORT))) {
+        return false;
+    }
+
+    // Set the field in place (see probe_set_field), checksum tracking included
+    field.key         = protocol_field->key;
+    field.key_id      = protocol_field->key_id;
+    field.type        = TYPE_UINT16;
+    field.value.int16 = FLOW_ID_PORT_OFFSET + flow_id;
+    return layer_set_protocol_field(layer, protocol_field, &field);
 }
 
 field_t * probe_create_metafield(const probe_t * probe, const char * name) {
     return probe_create_metafield_ext(probe, name, 0);
 }
 
-bool probe_set_fields(probe_t * probe, field_t * field1, ...) {
-    va_list   args;
+/**
+ * \brief (Internal use) Assigns a set of fields to a probe, without
+ *    updating it (see probe_set_fields).
+ * \param probe The probe we're updating
+ * \param field1 The first field. Each field is freed from the memory.
+ * \param args The next fields, terminated by NULL.
+ * \return true iif successful
+ */
+
+static bool probe_set_fields_va(probe_t * probe, field_t * field1, va_list args) {
     field_t * field;
     bool      ret = true;
 
-    va_start(args, field1);
     for (field = field1; field; field = va_arg(args, field_t *)) {
         // Update the first matching field
         if (!probe_set_field(probe, field)) {
@@ -841,44 +1234,85 @@ bool probe_set_fields(probe_t * probe, field_t * field1, ...) {
         }
         field_free(field);
     }
+    return ret;
+}
+
+bool probe_set_fields(probe_t * probe, field_t * field1, ...) {
+    va_list   args;
+    bool      ret;
+
+    va_start(args, field1);
+    ret = probe_set_fields_va(probe, field1, args);
     va_end(args);
     probe_update_fields(probe);
 
     return ret;
 }
 
+bool probe_set_fields_deferred(probe_t * probe, field_t * field1, ...) {
+    va_list   args;
+    bool      ret;
+
+    va_start(args, field1);
+    ret = probe_set_fields_va(probe, field1, args);
+    va_end(args);
+
+    return ret;
+}
+
 void probe_set_caller(probe_t * probe, void * caller) {
     probe->caller = caller;
 }
 
+void probe_set_memstats(probe_t * probe, memstats_t * memstats) {
+    if (probe->memstats != memstats) {
+        memstats_sub(probe->memstats, MEMSTATS_PROBE, sizeof(probe_t));
+        memstats_add(memstats, MEMSTATS_PROBE, sizeof(probe_t));
+        probe->memstats = memstats;
+    }
+}
+
 void * probe_get_caller(const probe_t * probe) {
     return probe->caller;
 }
 
-void probe_set_sending_time(probe_t * probe, double time) {
+void probe_set_sending_time(probe_t * probe, uint64_t time) {
     probe->sending_time = time;
 }
 
-double probe_get_sending_time(const probe_t * probe) {
+uint64_t probe_get_sending_time(const probe_t * probe) {
     return probe->sending_time;
 }
 
-void probe_set_queueing_time(probe_t * probe, double time) {
+void probe_set_queueing_time(probe_t * probe, uint64_t time) {
     probe->queueing_time = time;
 }
 
-double probe_get_queueing_time(const probe_t * probe) {
+uint64_t probe_get_queueing_time(const probe_t * probe) {
     return probe->queueing_time;
 }
 
-void probe_set_recv_time(probe_t * probe, double time) {
+void probe_set_recv_time(probe_t * probe, uint64_t time) {
     probe->recv_time = time;
 }
 
-double probe_get_recv_time(const probe_t * probe) {
+uint64_t probe_get_recv_time(const probe_t * probe) {
     return probe->recv_time;
 }
 
+void probe_set_reply_class(probe_t * reply, reply_class_t reply_class) {
+    reply->reply_class = reply_class;
+}
+
+reply_class_t probe_get_reply_class(const probe_t * reply) {
+    return reply->reply_class != REPLY_CLASS_UNKNOWN ? reply->reply_class :
+        reply_classify_bytes(packet_get_bytes(reply->packet), packet_get_size(reply->packet));
+}
+
+uint32_t probe_get_reply_next_hop_mtu(const probe_t * reply) {
+    return reply_get_next_hop_mtu(packet_get_bytes(reply->packet), packet_get_size(reply->packet));
+}
+
 #ifdef USE_SCHEDULING
 bool probe_set_delay(probe_t * probe, field_t * delay)
 {
@@ -995,13 +1429,13 @@ field_t * probe_create_field(const probe_t * probe, const char * name) {
 }
 
 bool probe_extract_ext(const probe_t * probe, const char * name, size_t depth, void * value) {
-    size_t                   i, num_layers = probe_get_num_layers(probe);
+    size_t                   i;
     const layer_t          * layer;
     const protocol_field_t * protocol_field;
 
-    // We go through the layers until we get the required field
-    for(i = depth; i < num_layers; i++) {
-        layer = probe_get_layer(probe, i);
+    // We go through the layers until we get the required field.
+    // The next layers (if any) are not dissected.
+    for(i = depth; (layer = probe_get_layer(probe, i)); i++) {
         if (!(protocol_field = layer_get_protocol_field(layer, name))) continue;
 
         // Hack to convert ipv*_t extracted into address_t value.
@@ -1033,21 +1467,200 @@ bool probe_extract_ext(const probe_t * probe, const char * name, size_t depth, v
 }
 
 bool probe_extract(const probe_t * probe, const char * name, void * dst) {
-    field_t * flow_id_field;
-
     // TEMPORARY HACK TO MANAGE flow_id metafield
     if (!strcmp(name, "flow_id")) {
-        if ((flow_id_field = probe_create_metafield(probe, "flow_id")) != NULL) {
-            memcpy(dst, &flow_id_field->value.int16, sizeof(uint16_t));
-            field_free(flow_id_field);
-            return true;
-        }
-        return false;
+        return probe_get_flow_id(probe, dst);
     }
 
     return probe_extract_ext(probe, name, 0, dst);
 }
 
+//-----------------------------------------------------------
+// Resolved fields
+//-----------------------------------------------------------
+
+bool probe_resolve_field(const probe_t * probe, const char * name, probe_field_t * probe_field)
+{
+    size_t                   i, num_layers = probe_get_num_layers(probe);
+    uintmax_t                value_offset = 0;
+    const layer_t          * layer;
+    const protocol_field_t * protocol_field;
+
+    // flow_id metafield (see probe_set_metafield_ext)
+    if (!strcmp(name, "flow_id")) {
+        name = "src_port";
+        value_offset = FLOW_ID_PORT_OFFSET;
+    }
+
+    for (i = 0; i < num_layers; i++) {
+        layer = probe_get_layer(probe, i);
+        if (!layer->protocol) continue;
+        if (!(protocol_field = layer_get_protocol_field(layer, name))) continue;
+
+        switch (protocol_field->type) {
+            case TYPE_UINT8:
+            case TYPE_UINT16:
+            case TYPE_UINT32:
+#ifdef USE_BITS
+            case TYPE_BITS:
+#endif
+                probe_field->depth          = i;
+                probe_field->protocol       = layer->protocol;
+                probe_field->protocol_field = protocol_field;
+                probe_field->value_offset   = value_offset;
+                return true;
+            default:
+                fprintf(stderr, "probe_resolve_field: '%s' is not an integer field\n", name);
+                return false;
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief (Internal use) Retrieve the layer carrying a resolved field.
+ * \param probe A probe_t instance.
+ * \param probe_field A field resolved by probe_resolve_field.
+ * \return The corresponding layer, NULL if this probe has not the
+ *    protocol stack of the probe used to resolve this field.
+ */
+
+static layer_t * probe_get_resolved_layer(const probe_t * probe, const probe_field_t * probe_field)
+{
+    layer_t * layer;
+
+    if (probe_field->depth >= probe_get_num_layers(probe)
+    || !(layer = probe_get_layer(probe, probe_field->depth))
+    ||  layer->protocol != probe_field->protocol) {
+        fprintf(stderr, "probe_get_resolved_layer: '%s' does not match this probe\n", probe_field->protocol_field->key);
+        return NULL;
+    }
+    return layer;
+}
+
+bool probe_write_resolved_field(probe_t * probe, const probe_field_t * probe_field, uintmax_t value)
+{
+    const protocol_field_t * protocol_field = probe_field->protocol_field;
+    layer_t                * layer;
+    field_t                  field;
+    header_snapshot_t        snapshot;
+
+    if (!(layer = probe_get_resolved_layer(probe, probe_field))) goto ERR_GET_RESOLVED_LAYER;
+
+    value += probe_field->value_offset;
+    field.key    = protocol_field->key;
+    field.key_id = protocol_field->key_id;
+    field.type   = protocol_field->type;
+    switch (protocol_field->type) {
+        case TYPE_UINT8:  field.value.int8  = value; break;
+        case TYPE_UINT16: field.value.int16 = value; break;
+        case TYPE_UINT32: field.value.int32 = value; break;
+#ifdef USE_BITS
+        case TYPE_BITS:   field.value.bits  = value; break;
+#endif
+        default: goto ERR_INVALID_TYPE;
+    }
+
+    // Same as layer_set_field, without looking for the field
+    if (protocol_field->in_pseudo_header) probe_save_header(probe, probe_field->depth, false, &snapshot);
+    if (!layer_set_protocol_field(layer, protocol_field, &field)) {
+        fprintf(stderr, "probe_write_resolved_field: can't set field '%s'\n", protocol_field->key);
+        goto ERR_PROTOCOL_FIELD_SET;
+    }
+    if (protocol_field->in_pseudo_header) probe_check_header(&snapshot);
+    probe_set_dirty(probe, probe_field->depth, protocol_field);
+    return true;
+
+ERR_PROTOCOL_FIELD_SET:
+ERR_INVALID_TYPE:
+ERR_GET_RESOLVED_LAYER:
+    return false;
+}
+
+bool probe_extract_resolved_field(const probe_t * probe, const probe_field_t * probe_field, uintmax_t * pvalue)
+{
+    const protocol_field_t * protocol_field = probe_field->protocol_field;
+    const layer_t          * layer;
+    const uint8_t          * segment_field;
+    field_t                * field;
+    uintmax_t                value;
+
+    if (!(layer = probe_get_resolved_layer(probe, probe_field))) goto ERR_GET_RESOLVED_LAYER;
+
+    if (protocol_field->get) {
+        if (!(field = protocol_field->get(layer->segment))) goto ERR_PROTOCOL_FIELD_GET;
+        switch (protocol_field->type) {
+            case TYPE_UINT8:  value = field->value.int8;  break;
+            case TYPE_UINT16: value = field->value.int16; break;
+            case TYPE_UINT32: value = field->value.int32; break;
+            default:          value = field->value.bits;  break;
+        }
+        field_free(field);
+    } else {
+        segment_field = layer->segment + protocol_field->offset;
+        switch (protocol_field->type) {
+            case TYPE_UINT8:  value = *segment_field; break;
+            case TYPE_UINT16: value = ntohs(*(const uint16_t *) segment_field); break;
+            case TYPE_UINT32: value = ntohl(*(const uint32_t *) segment_field); break;
+#ifdef USE_BITS
+            case TYPE_BITS: {
+                uint8_t bits = 0;
+                if (!protocol_field_extract_bits(protocol_field, layer->segment, &bits)) {
+                    goto ERR_BITS_EXTRACT;
+                }
+                value = bits;
+                break;
+            }
+#endif
+            default: goto ERR_INVALID_TYPE;
+        }
+    }
+
+    *pvalue = value - probe_field->value_offset;
+    return true;
+
+#ifdef USE_BITS
+ERR_BITS_EXTRACT:
+#endif
+ERR_INVALID_TYPE:
+ERR_PROTOCOL_FIELD_GET:
+ERR_GET_RESOLVED_LAYER:
+    return false;
+}
+
+bool probe_skel_stamp(
+    const probe_t             * probe_skel,
+    probe_t                  ** probes,
+    size_t                      num_probes,
+    const probe_field_range_t * ranges,
+    size_t                      num_ranges
+) {
+    size_t                      i, j;
+    const probe_field_range_t * range;
+
+#ifdef USE_COMPACT_PROBES
+    // A probe skeleton is logically const even if it is shared
+    probe_skel_share((probe_t *) probe_skel);
+#endif
+    for (i = 0; i < num_probes; i++) {
+        if (!(probes[i] = probe_dup(probe_skel))) goto ERR_PROBE_DUP;
+        for (j = 0; j < num_ranges; j++) {
+            range = &ranges[j];
+            if (!probe_write_resolved_field(
+                probes[i], &range->field,
+                range->first + (i / (range->period ? range->period : 1)) * range->step
+            )) goto ERR_PROBE_WRITE_RESOLVED_FIELD;
+        }
+    }
+    return true;
+
+ERR_PROBE_WRITE_RESOLVED_FIELD:
+    probe_free(probes[i]);
+ERR_PROBE_DUP:
+    while (i--) probe_free(probes[i]);
+    return false;
+}
+
 packet_t * probe_create_packet(probe_t * probe) {
     // TODO
     // See packet.c: we store in packet.c the destination IP.
@@ -1055,6 +1668,7 @@ packet_t * probe_create_packet(probe_t * probe) {
 
     // The destination IP is a mandatory field
 
+    if (!probe_unpack(probe)) goto ERR_PROBE_UNPACK;
     if (!(probe_extract(probe, "dst_ip", probe->packet->dst_ip))) {
         fprintf(stderr, "probe_create_packet: This probe does not carry 'dst_ip' field!\n");
         goto ERR_EXTRACT_DST_IP;
@@ -1063,9 +1677,197 @@ packet_t * probe_create_packet(probe_t * probe) {
     return probe->packet;
 
 ERR_EXTRACT_DST_IP:
+ERR_PROBE_UNPACK:
     return NULL;
 }
 
+//---------------------------------------------------------------------------
+// Compact probes
+//---------------------------------------------------------------------------
+
+// A run of delta starts with its offset (uint16_t) and its size (uint8_t)
+#define PROBE_DELTA_HEADER_SIZE (sizeof(uint16_t) + sizeof(uint8_t))
+
+#ifdef USE_COMPACT_PROBES
+/**
+ * \brief (Internal use) Write the delta of a compact probe over a copy
+ *    of the bytes of the snapshot it shares.
+ * \param probe The compact probe.
+ * \param bytes The copy of the bytes of probe->shared.
+ * \param size The number of bytes of the copy (the runs beyond are
+ *    ignored).
+ */
+
+static void probe_delta_apply(const probe_t * probe, uint8_t * bytes, size_t size)
+{
+    size_t   i, run_size;
+    uint16_t offset;
+
+    for (i = 0; i < probe->delta_size; i += PROBE_DELTA_HEADER_SIZE + run_size) {
+        memcpy(&offset, probe->delta + i, sizeof(uint16_t));
+        run_size = probe->delta[i + sizeof(uint16_t)];
+        if (offset < size) {
+            memcpy(bytes + offset, probe->delta + i + PROBE_DELTA_HEADER_SIZE, MIN(run_size, size - offset));
+        }
+    }
+}
+
+static bool probe_materialize(probe_t * probe)
+{
+    const probe_t * shared = probe->shared;
+    packet_t      * packet;
+    layer_t       * layer;
+    size_t          i, num_layers;
+
+    if (!(packet = packet_dup(shared->packet))) goto ERR_PACKET_DUP;
+    probe_delta_apply(probe, packet_get_bytes(packet), packet_get_size(packet));
+    probe->packet = packet;
+    if (!probe_layers_dup(shared, probe)) goto ERR_LAYERS_DUP;
+
+    // The fields were up to date once compacted, and the valid checksums too
+    num_layers = dynarray_get_size(probe->layers);
+    for (i = 0; i < num_layers; i++) {
+        layer = dynarray_get_ith_element(probe->layers, i);
+        layer->is_checksum_valid = probe->valid_checksums & (1u << i);
+        layer->checksum_delta    = 0;
+    }
+    probe->dirty_layers = 0;
+    probe->delta_size   = 0;
+    return true;
+
+ERR_LAYERS_DUP:
+    probe->packet = NULL;
+    packet_free(packet);
+ERR_PACKET_DUP:
+    fprintf(stderr, "probe_materialize: can't rebuild a compact probe\n");
+    return false;
+}
+
+static void probe_skel_share(probe_t * probe_skel)
+{
+    probe_t * shared = probe_skel->shared;
+    size_t    size;
+
+    if (!probe_unpack(probe_skel)) return;
+    size = packet_get_size(probe_skel->packet);
+    if (shared
+    &&  packet_get_size(shared->packet) == size
+    &&  memcmp(packet_get_bytes(shared->packet), packet_get_bytes(probe_skel->packet), size) == 0) {
+        return;
+    }
+
+    // The probes already stamped keep the former snapshot (if any).
+    // Failing to take a new one only prevents compacting the next probes.
+    if (!(shared = probe_dup(probe_skel))) return;
+    probe_free(shared->shared);
+    shared->shared = NULL;
+#ifdef USE_SCHEDULING
+    if (shared->delay) {
+        field_free(shared->delay);
+        shared->delay = NULL;
+    }
+#endif
+    probe_free(probe_skel->shared);
+    probe_skel->shared = shared;
+}
+#endif
+
+bool probe_compact(probe_t * probe)
+{
+#ifdef USE_COMPACT_PROBES
+    const probe_t * shared = probe->shared;
+    const uint8_t * bytes,
+                  * shared_bytes;
+    const layer_t * layer,
+                  * shared_layer;
+    size_t          i, j, start, end, size, num_layers,
+                    delta_size = 0;
+    uint16_t        offset;
+    uint8_t         valid_checksums = 0;
+
+    if (!probe->packet) return true;
+
+    // A probe sent several times keeps its packet (see probe_set_left_to_send)
+    if (!shared || probe->next_protocol || probe->dirty_layers || probe->left_to_send > 1) return false;
+
+    size       = packet_get_size(probe->packet);
+    num_layers = dynarray_get_size(probe->layers);
+    if (size > UINT16_MAX
+    ||  num_layers > 8 * sizeof(valid_checksums)
+    ||  size != packet_get_size(shared->packet)
+    ||  num_layers != dynarray_get_size(shared->layers)) {
+        return false;
+    }
+
+    // The probe is rebuilt with the layers of the snapshot, so they must
+    // match, and its valid checksums must be up to date.
+    bytes        = packet_get_bytes(probe->packet);
+    shared_bytes = packet_get_bytes(shared->packet);
+    for (i = 0; i < num_layers; i++) {
+        layer        = dynarray_get_ith_element(probe->layers, i);
+        shared_layer = dynarray_get_ith_element(shared->layers, i);
+        if (layer->protocol != shared_layer->protocol
+        ||  layer->segment - bytes != shared_layer->segment - shared_bytes
+        ||  layer->segment_size != shared_layer->segment_size) {
+            return false;
+        }
+        if (layer->is_checksum_valid) {
+            if (layer->checksum_delta) return false;
+            valid_checksums |= 1u << i;
+        }
+    }
+
+    // Encode the bytes differing from the snapshot as runs. A run spans
+    // the equal bytes which would cost more than the header of a new run.
+    for (i = 0; i < size; i = end) {
+        end = i + 1;
+        if (bytes[i] == shared_bytes[i]) continue;
+
+        start = i;
+        for (j = end; j < size && j - end < PROBE_DELTA_HEADER_SIZE && j - start < UINT8_MAX; j++) {
+            if (bytes[j] != shared_bytes[j]) end = j + 1;
+        }
+        if (delta_size + PROBE_DELTA_HEADER_SIZE + end - start > PROBE_DELTA_SIZE) {
+            return false;
+        }
+
+        offset = start;
+        memcpy(probe->delta + delta_size, &offset, sizeof(uint16_t));
+        probe->delta[delta_size + sizeof(uint16_t)] = end - start;
+        memcpy(probe->delta + delta_size + PROBE_DELTA_HEADER_SIZE, bytes + start, end - start);
+        delta_size += PROBE_DELTA_HEADER_SIZE + end - start;
+    }
+
+    probe->delta_size      = delta_size;
+    probe->valid_checksums = valid_checksums;
+    packet_free(probe->packet);
+    probe->packet = NULL;
+    probe_layers_clear(probe);
+    return true;
+#else
+    (void) probe;
+    return false;
+#endif
+}
+
+const uint8_t * probe_peek_bytes(const probe_t * probe, const probe_t ** playout, size_t * psize)
+{
+#ifdef USE_COMPACT_PROBES
+    static __thread uint8_t bytes[PROBE_PEEK_SIZE];
+
+    if (!probe->packet) {
+        *playout = probe->shared;
+        *psize   = MIN(packet_get_size(probe->shared->packet), PROBE_PEEK_SIZE);
+        memcpy(bytes, packet_get_bytes(probe->shared->packet), *psize);
+        probe_delta_apply(probe, bytes, *psize);
+        return bytes;
+    }
+#endif
+    *playout = probe;
+    *psize   = packet_get_size(probe->packet);
+    return packet_get_bytes(probe->packet);
+}
+
 //---------------------------------------------------------------------------
 // probe_reply_t
 //---------------------------------------------------------------------------
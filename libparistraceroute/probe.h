@@ -10,14 +10,29 @@
 
 #include <stdbool.h>   // bool
 #include <stddef.h>    // size_t
+#include <stdint.h>    // uint64_t
 
 #include "field.h"     // field_t
 #include "layer.h"     // layer_t
-//#include "bitfield.h"
 #include "dynarray.h"  // dynarray_t
 #include "packet.h"    // packet_t
+#include "memstats.h"  // memstats_t
+#include "reply_class.h" // reply_class_t
 
 #define DELAY_BEST_EFFORT -1 // This MUST be < 0, see network_send_probe
+
+// Every layer of a probe is dirty (see probe_t::dirty_layers). The layers
+// beyond the 31st one share the last bit.
+#define PROBE_DIRTY_ALL UINT32_MAX
+
+// Maximum size of the bytes a compact probe does not share with its
+// skeleton (see probe_compact).
+#define PROBE_DELTA_SIZE 32
+
+// Number of leading bytes of a compact probe rebuilt by probe_peek_bytes:
+// an IPv6 header followed by a TCP header carrying options.
+#define PROBE_PEEK_SIZE  128
+
 /**
  * \struct probe_t
  * \brief Structure representing a probe
@@ -27,20 +42,61 @@
  * For instance a probe ipv4/udp/payload is made of 3 layers.
  */
 
-typedef struct {
+typedef struct probe_s {
     dynarray_t * layers;        /**< List of layers forming the packet */
     packet_t   * packet;        /**< The packet we're crafting */
-//    bitfield_t * bitfield;      /**< Bitfield to keep track of modified fields (bits set to 1) vs. default ones (bits set to 0) */
+    uint32_t     dirty_layers;  /**< Layers to finalize by the next probe_update_fields (bit i for the i-th layer) */
     void       * caller;        /**< Algorithm instance which has created this probe */
-    double       sending_time;  /**< Timestamp set by network layer just after sending the packet (0 if not set) (in micro seconds) */
-    double       queueing_time; /**< Timestamp set by pt_loop just before sending the packet (0 if not set) (in micro seconds) */
-    double       recv_time;     /**< Only set if this instance is related to a reply. Timestamp set by network layer just after sniffing the reply */
+    memstats_t * memstats;      /**< Accounts this probe for its owner (see probe_set_memstats), NULL if none */
+    uint64_t     sending_time;  /**< Timestamp set by network layer just after sending the packet (0 if not set) (in nanoseconds, see get_time_ns) */
+    uint64_t     queueing_time; /**< Timestamp set by pt_loop just before sending the packet (0 if not set) (in nanoseconds) */
+    uint64_t     recv_time;     /**< Only set if this instance is related to a reply. Timestamp set by network layer just after sniffing the reply (in nanoseconds) */
+    reply_class_t reply_class;  /**< Only set if this instance is related to a reply. Class decoded by the network layer (see reply_class.h) */
 #ifdef USE_SCHEDULING
     field_t    * delay;         /**< The time to send this probe */
 #endif
     size_t       left_to_send;  /**< Number of times left to use this probe instance to send packets */
+    const protocol_t * next_protocol; /**< Protocol of the next layer to dissect (see probe_wrap_packet), NULL if every layer is dissected */
+    size_t       next_offset;   /**< Offset of the next layer to dissect in the packet */
+    size_t       num_references; /**< Number of references to this probe (see probe_ref) */
+#ifdef USE_COMPACT_PROBES
+    struct probe_s * shared;    /**< Skeleton: snapshot shared by the probes stamped out of it. Stamped probe: the snapshot it is a copy of (see probe_skel_stamp). NULL if none */
+    uint8_t      delta[PROBE_DELTA_SIZE]; /**< Compact probe: the runs of bytes differing from shared (see probe_compact) */
+    uint8_t      delta_size;    /**< Number of bytes of delta */
+    uint8_t      valid_checksums; /**< Compact probe: bit i is set iif the checksum of the i-th layer is valid */
+#endif
 } probe_t;
 
+/**
+ * \struct probe_field_t
+ * \brief A field of a probe resolved once for all (see probe_resolve_field),
+ *    so that it can be read and written without looking up its name in
+ *    the layers of the probe. A probe_field_t instance is valid for every
+ *    probe having the same protocol stack, e.g. every probe duplicated from
+ *    the same skeleton.
+ */
+
+typedef struct {
+    size_t                   depth;          /**< Index of the layer carrying this field */
+    const protocol_t       * protocol;       /**< Protocol of this layer */
+    const protocol_field_t * protocol_field; /**< The field in this layer */
+    uintmax_t                value_offset;   /**< Added to the written values and substracted from the extracted ones */
+} probe_field_t;
+
+/**
+ * \struct probe_field_range_t
+ * \brief Values taken by a resolved field over a batch of probes (see
+ *    probe_skel_stamp). The i-th probe of the batch gets the value
+ *    first + (i / period) * step.
+ */
+
+typedef struct {
+    probe_field_t field;                     /**< The stamped field */
+    uintmax_t     first;                     /**< Value of the first probe (host-side endianness) */
+    uintmax_t     step;                      /**< Difference between two consecutive values */
+    size_t        period;                    /**< Number of consecutive probes sharing a value (0 means 1) */
+} probe_field_range_t;
+
 /**
  * \brief Create a probe
  * \return A pointer to a probe_t structure containing the probe
@@ -49,14 +105,26 @@ typedef struct {
 probe_t * probe_create();
 
 /**
- * \brief Duplicate a probe from probe skeleton
+ * \brief Duplicate a probe from probe skeleton. The layers of the copy
+ *    point to its own bytes at the same offsets as in the original probe,
+ *    so the copy is not dissected again.
  * \return A pointer to a probe_t structure containing the probe
  */
 
 probe_t * probe_dup(const probe_t * probe_skel);
 
 /**
- * \brief Free a probe
+ * \brief Take a reference to a probe, e.g. to keep the probe or the
+ *    reply carried by an event once this event is released.
+ * \param probe A probe_t instance (NULL is ignored).
+ * \return The probe.
+ */
+
+probe_t * probe_ref(probe_t * probe);
+
+/**
+ * \brief Release a reference to a probe. The probe is freed once its
+ *    last reference is released (see probe_ref).
  * \param probe A pointer to a probe_t structure containing the probe
  */
 
@@ -73,6 +141,9 @@ size_t probe_get_size(const probe_t * probe);
 /**
  * \brief Create a probe_t according to a packet_t instance.
  *   The previous value of probe->packet (if any) is not freed.
+ *   The layers of the packet are dissected on demand, the first
+ *   time they are queried (see probe_get_layer, probe_extract_ext),
+ *   so that matching a reply only dissects the layers it involves.
  * \return A pointer to a newly allocated probe_t instance if
  *   if successful, NULL otherwise
  */
@@ -133,11 +204,32 @@ bool probe_update_checksum(probe_t * probe);
 /**
  * \brief Update 'length', 'checksum' and 'protocol' fields for each
  *   network protocol layer making the probe.
+ *
+ *   Only the dirty layers are finalized and get their 'length' and
+ *   'protocol' fields updated, i.e. the layers whose structure (e.g. their
+ *   size) or whose fields involved in these updates (addresses, 'length',
+ *   'protocol'...) have changed since the last call. Setting the TTL of a
+ *   finalized probe only updates its checksums.
+ *
+ *   The network layer calls this function before sending a probe, so the
+ *   fields of a probe may be set without updating it (see probe_set_field,
+ *   probe_set_fields_deferred): it is then finalized once.
  * \return true iif successful
  */
 
 bool probe_update_fields(probe_t * probe);
 
+/**
+ * \brief Tell whether some layers of a probe have to be finalized by
+ *    probe_update_fields.
+ * \param probe A probe_t instance.
+ * \return true iif some layers are dirty.
+ */
+
+static inline bool probe_is_dirty(const probe_t * probe) {
+    return probe->dirty_layers != 0;
+}
+
 /**
  * \brief Assigns a set of fields to a probe
  * \param probe A pointer to a probe_t structure representing the probe
@@ -148,6 +240,18 @@ bool probe_update_fields(probe_t * probe);
 
 bool probe_set_fields(probe_t * probe, field_t * field1, ...);
 
+/**
+ * \brief Assigns a set of fields to a probe, like probe_set_fields, but
+ *    without updating the probe: it is finalized once, by the network
+ *    layer, right before being sent (see probe_update_fields).
+ * \param probe A pointer to a probe_t structure representing the probe
+ * \param field1 The first of a list of pointers to a field_t structure
+ *    representing a field to add. Each field is freed from the memory.
+ * \return true iif successful,
+ */
+
+bool probe_set_fields_deferred(probe_t * probe, field_t * field1, ...);
+
 /**
  * \brief Assigns a set of fields to a probe
  * \param probe A pointer to a probe_t structure representing the probe
@@ -180,6 +284,118 @@ void probe_iter_fields(probe_t *probe, void *data, void (*callback)(field_t *fie
 
 bool probe_extract(const probe_t * probe, const char * name, void * dst);
 
+/**
+ * \brief Retrieve the flow identifier of a probe (the "flow_id" metafield)
+ *    straight from its bytes. The flow identifier is encoded in the source
+ *    port of UDP and TCP probes, shifted by a constant offset.
+ * \param probe The queried probe.
+ * \param pflow_id Address of an uint16_t in which the flow identifier is written.
+ * \return true iif successful, false if the probe does not carry any flow
+ *    identifier (e.g. an ICMPv4 probe, whose flow is set by its checksum).
+ */
+
+bool probe_get_flow_id(const probe_t * probe, uint16_t * pflow_id);
+
+/**
+ * \brief Set the flow identifier of a probe (the "flow_id" metafield)
+ *    without allocating any field_t (see probe_get_flow_id).
+ * \param probe The updated probe.
+ * \param flow_id The flow identifier.
+ * \return true iif successful
+ */
+
+bool probe_set_flow_id(probe_t * probe, uint16_t flow_id);
+
+/**
+ * \brief Resolve an integer field (or the flow_id metafield) of a probe.
+ * \param probe The probe carrying this field (e.g. a probe skeleton).
+ * \param name The name of the field.
+ * \param probe_field The probe_field_t instance which is initialized.
+ * \return true iif successful
+ */
+
+bool probe_resolve_field(const probe_t * probe, const char * name, probe_field_t * probe_field);
+
+/**
+ * \brief Write the value of a resolved field in a probe. Contrary to
+ *    probe_set_fields, the checksums are not updated.
+ * \param probe The probe to update.
+ * \param probe_field A field resolved by probe_resolve_field.
+ * \param value The value to write (host-side endianness).
+ * \return true iif successful
+ */
+
+bool probe_write_resolved_field(probe_t * probe, const probe_field_t * probe_field, uintmax_t value);
+
+/**
+ * \brief Extract the value of a resolved field from a probe.
+ * \param probe The queried probe.
+ * \param probe_field A field resolved by probe_resolve_field.
+ * \param pvalue Address of an uintmax_t in which the value is written
+ *    (host-side endianness).
+ * \return true iif successful
+ */
+
+bool probe_extract_resolved_field(const probe_t * probe, const probe_field_t * probe_field, uintmax_t * pvalue);
+
+/**
+ * \brief Stamp a batch of probes out of a (finalized) probe skeleton.
+ *    Each probe is a copy of the skeleton in which the fields listed
+ *    in ranges are written, so that it costs a copy of the packet plus
+ *    a few stores. The checksums are then updated incrementally by the
+ *    network layer. The batch may be sent at once thanks to pt_send_probes.
+ *    The probes refer to a snapshot of the skeleton, taken again if the
+ *    skeleton has changed since the previous batch, so that they can be
+ *    compacted once sent (see probe_compact).
+ * \param probe_skel The probe skeleton.
+ * \param probes An array of at least num_probes pointers in which the
+ *    stamped probes are stored.
+ * \param num_probes The number of probes to stamp.
+ * \param ranges The values taken by each stamped field (may be NULL).
+ * \param num_ranges The number of elements of ranges.
+ * \return true iif successful. Otherwise no probe is stamped.
+ */
+
+bool probe_skel_stamp(
+    const probe_t             * probe_skel,
+    probe_t                  ** probes,
+    size_t                      num_probes,
+    const probe_field_range_t * ranges,
+    size_t                      num_ranges
+);
+
+/**
+ * \brief Release the packet and the layers of a probe stamped out of a
+ *    skeleton (see probe_skel_stamp), keeping only the bytes which differ
+ *    from the snapshot of the skeleton it shares. The probe is rebuilt
+ *    transparently the next time its layers, its size or its packet are
+ *    accessed, and probe_peek_bytes reads it without rebuilding it.
+ *    The network layer compacts the probes in transit once they are sent.
+ * \param probe The probe. Its fields must be up to date (see
+ *    probe_update_fields), and no pointer to its layers or to its packet
+ *    must be held by the caller.
+ * \return true iif the probe is compact, false if it is left untouched
+ *    (e.g. it has not been stamped, or it differs too much from its
+ *    skeleton).
+ */
+
+bool probe_compact(probe_t * probe);
+
+/**
+ * \brief Read the bytes of a probe, without rebuilding it if it is
+ *    compact (see probe_compact).
+ * \param probe The probe.
+ * \param playout Address of a pointer set to the probe whose layers
+ *    describe the returned bytes: the probe itself, or the snapshot it
+ *    shares if it is compact.
+ * \param psize Address of a size_t set to the number of returned bytes.
+ *    Only the PROBE_PEEK_SIZE first bytes of a compact probe are returned.
+ * \return The bytes of the probe. Those of a compact probe are rebuilt
+ *    in a buffer of the calling thread, overwritten by the next call.
+ */
+
+const uint8_t * probe_peek_bytes(const probe_t * probe, const probe_t ** playout, size_t * psize);
+
 /**
  * \brief Extract a value from a probe
  * \param probe The probe from which we're retrieving a field
@@ -304,17 +520,52 @@ void probe_set_caller(probe_t * probe, void * caller);
 
 void * probe_get_caller(const probe_t * probe);
 
-void probe_set_sending_time(probe_t * probe, double time);
+/**
+ * \brief Account a probe for an owner (e.g. the algorithm instance which
+ *    has sent this probe, or which receives this reply), instead of its
+ *    previous owner (if any). The probe is accounted until it is released.
+ * \param probe A probe_t instance.
+ * \param memstats The memstats_t instance of its owner, NULL if none.
+ */
+
+void probe_set_memstats(probe_t * probe, memstats_t * memstats);
+
+// The timestamps of a probe are expressed in nanoseconds (see get_time_ns).
+// Their differences (e.g. an RTT) are not affected by the changes of the
+// system time.
 
-double probe_get_sending_time(const probe_t * probe);
+void probe_set_sending_time(probe_t * probe, uint64_t time);
 
-void probe_set_queueing_time(probe_t * probe, double time);
+uint64_t probe_get_sending_time(const probe_t * probe);
 
-double probe_get_queueing_time(const probe_t * probe);
+void probe_set_queueing_time(probe_t * probe, uint64_t time);
 
-void probe_set_recv_time(probe_t * probe, double time);
+uint64_t probe_get_queueing_time(const probe_t * probe);
+
+void probe_set_recv_time(probe_t * probe, uint64_t time);
+
+uint64_t probe_get_recv_time(const probe_t * probe);
+
+void probe_set_reply_class(probe_t * reply, reply_class_t reply_class);
+
+/**
+ * \brief Retrieve the class of a reply (ICMP type and code, see
+ *    reply_class.h). It is decoded from the reply if the network layer
+ *    has not classified it.
+ * \param reply A reply.
+ * \return The class of the reply.
+ */
+
+reply_class_t probe_get_reply_class(const probe_t * reply);
+
+/**
+ * \brief Retrieve the MTU of the next hop carried by an ICMP fragmentation
+ *    needed or packet too big reply (see reply_get_next_hop_mtu).
+ * \param reply A reply.
+ * \return The MTU of the next hop, 0 if unknown.
+ */
 
-double probe_get_recv_time(const probe_t * probe);
+uint32_t probe_get_reply_next_hop_mtu(const probe_t * reply);
 
 bool probe_set_delay(probe_t * probe, field_t * delay);
 
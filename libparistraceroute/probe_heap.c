@@ -0,0 +1,139 @@
+#include "config.h"
+
+#include <stdlib.h>       // malloc, realloc, free
+
+#include "common.h"       // SECONDS_TO_NS
+
+#include "probe_heap.h"
+
+/**
+ * \brief Test whether an entry must be popped before another one.
+ * \param x A probe_heap_entry_t instance.
+ * \param y A probe_heap_entry_t instance.
+ * \return true iif x departs before y.
+ */
+
+static inline bool probe_heap_entry_less(const probe_heap_entry_t * x, const probe_heap_entry_t * y) {
+    return x->departure < y->departure
+        || (x->departure == y->departure && x->rank < y->rank);
+}
+
+/**
+ * \brief Move an entry towards the root until the heap is ordered.
+ * \param heap A probe_heap_t instance.
+ * \param i The index of the entry.
+ */
+
+static void probe_heap_sift_up(probe_heap_t * heap, size_t i)
+{
+    probe_heap_entry_t entry = heap->entries[i];
+    size_t             parent;
+
+    for (; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (!probe_heap_entry_less(&entry, &heap->entries[parent])) break;
+        heap->entries[i] = heap->entries[parent];
+    }
+    heap->entries[i] = entry;
+}
+
+/**
+ * \brief Move an entry towards the leaves until the heap is ordered.
+ * \param heap A probe_heap_t instance.
+ * \param i The index of the entry.
+ */
+
+static void probe_heap_sift_down(probe_heap_t * heap, size_t i)
+{
+    probe_heap_entry_t entry = heap->entries[i];
+    size_t             child;
+
+    for (; (child = 2 * i + 1) < heap->num_entries; i = child) {
+        if (child + 1 < heap->num_entries
+        &&  probe_heap_entry_less(&heap->entries[child + 1], &heap->entries[child])) {
+            ++child;
+        }
+        if (!probe_heap_entry_less(&heap->entries[child], &entry)) break;
+        heap->entries[i] = heap->entries[child];
+    }
+    heap->entries[i] = entry;
+}
+
+probe_heap_t * probe_heap_create()
+{
+    probe_heap_t * heap;
+
+    if (!(heap = malloc(sizeof(probe_heap_t)))) goto ERR_MALLOC;
+    if (!(heap->entries = malloc(PROBE_HEAP_INITIAL_SIZE * sizeof(probe_heap_entry_t)))) goto ERR_ENTRIES;
+    heap->num_entries = 0;
+    heap->max_entries = PROBE_HEAP_INITIAL_SIZE;
+    heap->next_rank = 0;
+    return heap;
+
+ERR_ENTRIES:
+    free(heap);
+ERR_MALLOC:
+    return NULL;
+}
+
+void probe_heap_free(probe_heap_t * heap, void (*element_free)(void *))
+{
+    size_t i;
+
+    if (heap) {
+        if (element_free) {
+            for (i = 0; i < heap->num_entries; i++) {
+                element_free(heap->entries[i].probe);
+            }
+        }
+        free(heap->entries);
+        free(heap);
+    }
+}
+
+inline size_t probe_heap_get_size(const probe_heap_t * heap) {
+    return heap->num_entries;
+}
+
+bool probe_heap_push(probe_heap_t * heap, probe_t * probe, uint64_t origin)
+{
+    probe_heap_entry_t * entries;
+    probe_heap_entry_t * entry;
+
+    if (heap->num_entries == heap->max_entries) {
+        if (!(entries = realloc(heap->entries, 2 * heap->max_entries * sizeof(probe_heap_entry_t)))) {
+            return false;
+        }
+        heap->entries = entries;
+        heap->max_entries *= 2;
+    }
+
+    entry = &heap->entries[heap->num_entries];
+    entry->probe     = probe;
+    entry->origin    = origin;
+    entry->departure = origin + SECONDS_TO_NS(probe_get_delay(probe));
+    entry->rank      = heap->next_rank++;
+    probe_heap_sift_up(heap, heap->num_entries++);
+    return true;
+}
+
+inline uint64_t probe_heap_get_next_departure(const probe_heap_t * heap) {
+    return heap->num_entries ? heap->entries[0].departure : UINT64_MAX;
+}
+
+size_t probe_heap_pop(probe_heap_t * heap, uint64_t until, probe_heap_entry_t * entries, size_t max_entries)
+{
+    size_t num_popped = 0;
+
+    while (num_popped < max_entries
+        && heap->num_entries
+        && heap->entries[0].departure <= until
+    ) {
+        entries[num_popped++] = heap->entries[0];
+        if (--heap->num_entries) {
+            heap->entries[0] = heap->entries[heap->num_entries];
+            probe_heap_sift_down(heap, 0);
+        }
+    }
+    return num_popped;
+}
@@ -0,0 +1,105 @@
+#ifndef PROBE_HEAP_H
+#define PROBE_HEAP_H
+
+/**
+ * \file probe_heap.h
+ * \brief Binary min-heap of scheduled probes, keyed by departure time.
+ *
+ * The delay of a scheduled probe (see probe_get_delay) is counted from the
+ * time it has been handed over to the network layer (its origin), so its
+ * departure time is origin + delay. Probes departing at the same time are
+ * popped in the order they have been pushed.
+ *
+ * Pushing a probe is O(log n), retrieving the next departure time is O(1)
+ * and popping the k probes due at a given time is O(k log n).
+ */
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+#include "probe.h"   // probe_t
+
+// Initial number of entries allocated by a probe_heap_t.
+#define PROBE_HEAP_INITIAL_SIZE 64
+
+/**
+ * \struct probe_heap_entry_t
+ * \brief A probe stored in a probe_heap_t.
+ */
+
+typedef struct {
+    probe_t * probe;     /**< The scheduled probe */
+    uint64_t  origin;    /**< Timestamp from which the delay of the probe is counted (in nanoseconds, see get_time_ns) */
+    uint64_t  departure; /**< Timestamp at which the probe must be sent (in nanoseconds) */
+    uint64_t  rank;      /**< Push order, to pop in FIFO order the probes departing at the same time */
+} probe_heap_entry_t;
+
+/**
+ * \struct probe_heap_t
+ * \brief A binary min-heap of probe_heap_entry_t.
+ */
+
+typedef struct {
+    probe_heap_entry_t * entries;     /**< entries[i] departs before entries[2i + 1] and entries[2i + 2] */
+    size_t               num_entries; /**< Number of scheduled probes */
+    size_t               max_entries; /**< Number of allocated entries */
+    uint64_t             next_rank;   /**< Rank of the next pushed probe */
+} probe_heap_t;
+
+/**
+ * \brief Create a probe_heap_t instance.
+ * \return The newly created probe_heap_t instance, NULL in case of failure.
+ */
+
+probe_heap_t * probe_heap_create();
+
+/**
+ * \brief Release a probe_heap_t instance from the memory.
+ * \param heap A probe_heap_t instance.
+ * \param element_free Function called to release each scheduled probe
+ *    (pass NULL to keep them in memory).
+ */
+
+void probe_heap_free(probe_heap_t * heap, void (*element_free)(void *));
+
+/**
+ * \brief Retrieve the number of probes stored in a probe_heap_t.
+ * \param heap A probe_heap_t instance.
+ * \return The number of scheduled probes.
+ */
+
+size_t probe_heap_get_size(const probe_heap_t * heap);
+
+/**
+ * \brief Schedule a probe according to its current delay.
+ * \param heap A probe_heap_t instance.
+ * \param probe A probe whose delay is set (see probe_set_delay).
+ * \param origin The timestamp from which its delay is counted (see get_time_ns).
+ * \return true iif successful
+ */
+
+bool probe_heap_push(probe_heap_t * heap, probe_t * probe, uint64_t origin);
+
+/**
+ * \brief Retrieve the departure time of the next scheduled probe.
+ * \param heap A probe_heap_t instance.
+ * \return The corresponding timestamp (see get_time_ns), UINT64_MAX if
+ *    the heap is empty.
+ */
+
+uint64_t probe_heap_get_next_departure(const probe_heap_t * heap);
+
+/**
+ * \brief Pop the probes departing at a given time at the latest, in
+ *    order of departure.
+ * \param heap A probe_heap_t instance.
+ * \param until The latest departure time (see get_time_ns).
+ * \param entries Preallocated array where the popped entries are written.
+ * \param max_entries The size of this array.
+ * \return The number of popped entries.
+ */
+
+size_t probe_heap_pop(probe_heap_t * heap, uint64_t until, probe_heap_entry_t * entries, size_t max_entries);
+
+#endif
@@ -0,0 +1,151 @@
+#include "config.h"
+
+#include <inttypes.h>     // PRIu64
+#include <stdlib.h>       // calloc, free
+
+#include "profiler.h"
+#include "metrics.h"      // metrics_write_family, metrics_write_label_value
+
+profiler_t * profiler_create()
+{
+    profiler_t * profiler;
+
+    if (!(profiler = calloc(1, sizeof(profiler_t))))         goto ERR_CALLOC;
+    if (!(profiler->batch_sizes = histogram_create()))       goto ERR_BATCH_SIZES;
+    return profiler;
+
+ERR_BATCH_SIZES:
+    free(profiler);
+ERR_CALLOC:
+    return NULL;
+}
+
+void profiler_free(profiler_t * profiler) {
+    if (profiler) {
+        histogram_free(profiler->batch_sizes);
+        free(profiler);
+    }
+}
+
+profiler_entry_t * profiler_get_entry(profiler_t * profiler, profiler_category_t category, const char * name)
+{
+    profiler_entry_t * entry;
+    size_t             i;
+
+    for (i = 0; i < profiler->num_entries; i++) {
+        entry = &profiler->entries[i];
+        if (entry->category == category && entry->name == name) return entry;
+    }
+
+    if (profiler->num_entries == PROFILER_MAX_ENTRIES) return NULL;
+    entry = &profiler->entries[profiler->num_entries++];
+    entry->category = category;
+    entry->name     = name;
+    return entry;
+}
+
+/**
+ * \brief Retrieve the name of a category of entries.
+ * \param category A profiler_category_t value.
+ * \return The corresponding name.
+ */
+
+static const char * profiler_category_get_name(profiler_category_t category) {
+    return category == PROFILER_FD ? "fd" : "algorithm";
+}
+
+void profiler_add_iteration(profiler_t * profiler, size_t num_events, uint64_t idle, uint64_t busy) {
+    histogram_add(profiler->batch_sizes, num_events);
+    profiler->idle_ns += idle;
+    profiler->busy_ns += busy;
+}
+
+/**
+ * \brief Compute the utilization of a loop.
+ * \param busy The time spent dispatching events.
+ * \param idle The time spent waiting for events.
+ * \return The utilization (in %).
+ */
+
+static double profiler_get_utilization(uint64_t busy, uint64_t idle) {
+    return busy + idle ? 100.0 * busy / (busy + idle) : 0;
+}
+
+void profiler_dump(profiler_t * profiler, FILE * file)
+{
+    const profiler_entry_t * entry;
+    size_t                   i;
+
+    fprintf(file, "loop: utilization %.1f%% (overall %.1f%%) busy %.3f s idle %.3f s batch p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 "\n",
+        profiler_get_utilization(profiler->busy_ns - profiler->last_busy_ns, profiler->idle_ns - profiler->last_idle_ns),
+        profiler_get_utilization(profiler->busy_ns, profiler->idle_ns),
+        profiler->busy_ns / 1e9,
+        profiler->idle_ns / 1e9,
+        histogram_get_quantile(profiler->batch_sizes, 0.50),
+        histogram_get_quantile(profiler->batch_sizes, 0.99),
+        histogram_get_quantile(profiler->batch_sizes, 1.00)
+    );
+
+    for (i = 0; i < profiler->num_entries; i++) {
+        entry = &profiler->entries[i];
+        if (!entry->num_calls) continue;
+        fprintf(file, "loop:   %s %s calls %" PRIu64 " total %.3f ms (%.1f%%) avg %.3f us max %.3f ms\n",
+            profiler_category_get_name(entry->category), entry->name, entry->num_calls,
+            entry->total_ns / 1e6,
+            profiler->busy_ns ? 100.0 * entry->total_ns / profiler->busy_ns : 0,
+            entry->total_ns / 1e3 / entry->num_calls,
+            entry->max_ns / 1e6
+        );
+    }
+    fflush(file);
+
+    profiler->last_busy_ns = profiler->busy_ns;
+    profiler->last_idle_ns = profiler->idle_ns;
+}
+
+/**
+ * \brief Write the labels of an entry in the OpenMetrics text format.
+ * \param file The output file.
+ * \param entry A profiler_entry_t instance.
+ */
+
+static void profiler_write_labels(FILE * file, const profiler_entry_t * entry) {
+    fprintf(file, "{category=\"");
+    metrics_write_label_value(file, profiler_category_get_name(entry->category));
+    fprintf(file, "\",name=\"");
+    metrics_write_label_value(file, entry->name);
+    fprintf(file, "\"}");
+}
+
+void profiler_write_metrics(FILE * file, void * data)
+{
+    const profiler_t       * profiler = data;
+    const profiler_entry_t * entry;
+    size_t                   i;
+
+    metrics_write_family(file, "paristraceroute_loop_busy_seconds", "counter", "Time spent by the loop dispatching events");
+    fprintf(file, "paristraceroute_loop_busy_seconds_total %.9f\n", profiler->busy_ns / 1e9);
+    metrics_write_family(file, "paristraceroute_loop_idle_seconds", "counter", "Time spent by the loop waiting for events");
+    fprintf(file, "paristraceroute_loop_idle_seconds_total %.9f\n", profiler->idle_ns / 1e9);
+
+    metrics_write_family(file, "paristraceroute_loop_batch_size", "summary", "Number of events returned by each wait");
+    fprintf(file, "paristraceroute_loop_batch_size{quantile=\"0.5\"} %" PRIu64 "\n",  histogram_get_quantile(profiler->batch_sizes, 0.50));
+    fprintf(file, "paristraceroute_loop_batch_size{quantile=\"0.99\"} %" PRIu64 "\n", histogram_get_quantile(profiler->batch_sizes, 0.99));
+    fprintf(file, "paristraceroute_loop_batch_size_count %" PRIu64 "\n", histogram_get_num_values(profiler->batch_sizes));
+
+    metrics_write_family(file, "paristraceroute_loop_dispatches", "counter", "Calls to each handler of the loop");
+    for (i = 0; i < profiler->num_entries; i++) {
+        entry = &profiler->entries[i];
+        fprintf(file, "paristraceroute_loop_dispatches_total");
+        profiler_write_labels(file, entry);
+        fprintf(file, " %" PRIu64 "\n", entry->num_calls);
+    }
+
+    metrics_write_family(file, "paristraceroute_loop_dispatch_seconds", "counter", "Time spent in each handler of the loop");
+    for (i = 0; i < profiler->num_entries; i++) {
+        entry = &profiler->entries[i];
+        fprintf(file, "paristraceroute_loop_dispatch_seconds_total");
+        profiler_write_labels(file, entry);
+        fprintf(file, " %.9f\n", entry->total_ns / 1e9);
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/**
+ * \file profiler.h
+ * \brief Profile the dispatch of the events by a pt_loop_t, to tell
+ *    whether its thread is saturated (and should be sharded, see
+ *    pt_shards.h) and which handlers consume its time.
+ *
+ * A profiler_t records:
+ * - the time spent by the loop waiting for events (idle) and dispatching
+ *   them (busy), hence the utilization of the loop;
+ * - the number of events returned by each wait (batch sizes);
+ * - for each entry (a watched file descriptor or an algorithm), its
+ *   number of calls and the time spent in its handler.
+ *
+ * The algorithms are run by the "algorithm" file descriptor, and the user
+ * handler by the "user" file descriptor: the time of the "algorithm"
+ * entry is broken down by the algorithm entries.
+ */
+
+#include <stdint.h>       // uint64_t
+#include <stdio.h>        // FILE
+
+#include "histogram.h"    // histogram_t
+
+// Maximum number of entries of a profiler_t
+#define PROFILER_MAX_ENTRIES 32
+
+typedef enum {
+    PROFILER_FD,        /**< A file descriptor watched by the loop */
+    PROFILER_ALGORITHM  /**< An algorithm run by the loop */
+} profiler_category_t;
+
+/**
+ * \struct profiler_entry_t
+ * \brief The calls to a profiled handler.
+ */
+
+typedef struct {
+    profiler_category_t   category;  /**< The kind of handler */
+    const char          * name;      /**< The name of the file descriptor or of the algorithm */
+    uint64_t              num_calls; /**< Number of calls */
+    uint64_t              total_ns;  /**< Time spent in the handler (in ns) */
+    uint64_t              max_ns;    /**< Longest call (in ns) */
+} profiler_entry_t;
+
+/**
+ * \struct profiler_t
+ * \brief The profile of a pt_loop_t.
+ */
+
+typedef struct {
+    profiler_entry_t   entries[PROFILER_MAX_ENTRIES]; /**< The profiled handlers */
+    size_t             num_entries;                   /**< Number of entries */
+    histogram_t      * batch_sizes;                   /**< Number of events returned by each wait */
+    uint64_t           busy_ns;                       /**< Time spent dispatching the events (in ns) */
+    uint64_t           idle_ns;                       /**< Time spent waiting for the events (in ns) */
+    uint64_t           last_busy_ns;                  /**< busy_ns at the previous dump */
+    uint64_t           last_idle_ns;                  /**< idle_ns at the previous dump */
+} profiler_t;
+
+/**
+ * \brief Create a profiler_t instance.
+ * \return The newly allocated profiler_t instance, NULL in case of failure.
+ */
+
+profiler_t * profiler_create();
+
+/**
+ * \brief Release a profiler_t instance.
+ * \param profiler A profiler_t instance.
+ */
+
+void profiler_free(profiler_t * profiler);
+
+/**
+ * \brief Retrieve an entry of a profiler_t, and add it if needed.
+ * \param profiler A profiler_t instance.
+ * \param category The category of the entry.
+ * \param name The name of the entry. It is compared by address, and must
+ *    not be released before the profiler.
+ * \return The corresponding entry, NULL if there are already
+ *    PROFILER_MAX_ENTRIES entries.
+ */
+
+profiler_entry_t * profiler_get_entry(profiler_t * profiler, profiler_category_t category, const char * name);
+
+/**
+ * \brief Record a call to a profiled handler.
+ * \param entry A profiler_entry_t instance (NULL is ignored).
+ * \param elapsed The duration of the call (in ns).
+ */
+
+static inline void profiler_entry_add(profiler_entry_t * entry, uint64_t elapsed) {
+    if (entry) {
+        entry->num_calls++;
+        entry->total_ns += elapsed;
+        if (elapsed > entry->max_ns) entry->max_ns = elapsed;
+    }
+}
+
+/**
+ * \brief Record an iteration of a loop.
+ * \param profiler A profiler_t instance.
+ * \param num_events The number of events returned by the wait.
+ * \param idle The time spent waiting for these events (in ns).
+ * \param busy The time spent dispatching these events (in ns).
+ */
+
+void profiler_add_iteration(profiler_t * profiler, size_t num_events, uint64_t idle, uint64_t busy);
+
+/**
+ * \brief Print the utilization of the loop (since the previous dump and
+ *    overall), its batch sizes and its entries.
+ * \param profiler A profiler_t instance.
+ * \param file The output file.
+ */
+
+void profiler_dump(profiler_t * profiler, FILE * file);
+
+/**
+ * \brief Write the profile of a loop in the OpenMetrics text format
+ *    (see metrics_callback_t).
+ * \param file The output file.
+ * \param profiler A profiler_t instance.
+ */
+
+void profiler_write_metrics(FILE * file, void * profiler);
+
+#endif // PROFILER_H
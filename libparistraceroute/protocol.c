@@ -1,7 +1,6 @@
 #include "config.h"
 
 #include <string.h>         // strcmp(), ...
-#include <search.h>         // tfind(), tdestroy(), twalk(), preorder...
 #include <stdio.h>          // perror()
 
 #include "protocol.h"
@@ -10,71 +9,84 @@
 #include "protocol_field.h" // protocol_field_t
 #include "layer.h"          // layer_t, layer_extract()
 
-// Protocols are registered in the following trees.
-// We require two trees since a protocol may be retrieved
+// Number of slots of the table indexing protocols by name. Must be a power
+// of 2, far greater than the number of protocols, so that most lookups
+// hit the right slot at once.
+#define PROTOCOL_NUM_SLOTS 64
+
+// Protocols are registered in the following tables.
+// We require two tables since a protocol may be retrieved
 // by using either its name or its protocol_id.
 
-static void * protocols_root    = NULL;  /**< Tree ordered by name */
-static void * protocols_id_root = NULL;  /**< Tree ordered by id   */
+static const protocol_t * protocols_by_name[PROTOCOL_NUM_SLOTS]; /**< Indexed by the hash of their name */
+static const protocol_t * protocols_by_id[UINT8_MAX + 1];        /**< Indexed by their id */
 
-static void protocol_clear() __attribute__((destructor));
+static inline size_t protocol_hash(const char * name) {
+    uint32_t hash = 2166136261u; // FNV-1a
 
-static int protocol_compare(
-    const protocol_t * protocol1,
-    const protocol_t * protocol2
-) {
-    return strcmp(protocol1->name, protocol2->name);
+    for (; *name; name++) hash = (hash ^ (uint8_t) *name) * 16777619u;
+    return hash & (PROTOCOL_NUM_SLOTS - 1);
 }
 
-static int protocol_id_compare(
-    const protocol_t * protocol1,
-    const protocol_t * protocol2
-) {
-    return protocol1->protocol - protocol2->protocol;
-}
+/**
+ * \brief Retrieve the slot of protocols_by_name related to a name.
+ * \param name The name of the protocol.
+ * \return The slot in which the protocol is (or would be) stored,
+ *    NULL if the table is full.
+ */
+
+static const protocol_t ** protocol_get_slot(const char * name) {
+    size_t i, j = protocol_hash(name);
 
-static void nothing_to_free() {}
+    for (i = 0; i < PROTOCOL_NUM_SLOTS; i++, j = (j + 1) & (PROTOCOL_NUM_SLOTS - 1)) {
+        if (!protocols_by_name[j] || strcmp(protocols_by_name[j]->name, name) == 0) {
+            return &protocols_by_name[j];
+        }
+    }
+    return NULL;
+}
 
 const protocol_t * protocol_search(const char * name) {
-    protocol_t ** protocol, search;
+    const protocol_t ** slot;
 
     if (!name) return NULL;
-    search.name = name;
-    protocol = tfind(&search, &protocols_root, (ELEMENT_COMPARE) protocol_compare);
-
-    return protocol ? *protocol : NULL;
+    return (slot = protocol_get_slot(name)) ? *slot : NULL;
 }
 
-const protocol_t * protocol_search_by_id(uint8_t id) {
-    protocol_t ** protocol, search;
-
-    search.protocol = id;
-    protocol = tfind(&search, &protocols_id_root, (ELEMENT_COMPARE) protocol_id_compare);
-
-    return protocol ? *protocol : NULL;
+inline const protocol_t * protocol_search_by_id(uint8_t id) {
+    return protocols_by_id[id];
 }
 
 void protocol_register(protocol_t * protocol) {
-    // Insert the protocol in the tree if the keys does not exist yet
-    tsearch(protocol, &protocols_root,    (ELEMENT_COMPARE) protocol_compare);
-    tsearch(protocol, &protocols_id_root, (ELEMENT_COMPARE) protocol_id_compare);
-}
-
-static void protocol_clear() {
-    tdestroy(protocols_root, nothing_to_free);
-    tdestroy(protocols_id_root, nothing_to_free);
-}
-
-const protocol_field_t * protocol_get_field(const protocol_t * protocol, const char * name)
-{
-    protocol_field_t * protocol_field;
+    protocol_field_t  * protocol_field;
+    const protocol_t ** slot;
 
+    // Intern the keys of the fields and select their accessors
     for (protocol_field = protocol->fields; protocol_field->key; protocol_field++) {
-        if (strcmp(protocol_field->key, name) == 0) {
-            return protocol_field;
+        protocol_field_init(protocol_field);
+        if ((protocol_field->key_id = field_key_register(protocol_field->key))) {
+            protocol->fields_by_key[protocol_field->key_id] = protocol_field;
         }
     }
-    return NULL;
+
+    // Index the protocol if the keys does not exist yet
+    if (!(slot = protocol_get_slot(protocol->name))) {
+        fprintf(stderr, "protocol_register: too many protocols, cannot register '%s'\n", protocol->name);
+    } else if (!*slot) {
+        *slot = protocol;
+    }
+    if (!protocols_by_id[protocol->protocol]) {
+        protocols_by_id[protocol->protocol] = protocol;
+    }
+}
+
+const protocol_field_t * protocol_get_field(const protocol_t * protocol, const char * name) {
+    // Every key of a protocol field is registered by protocol_register
+    return protocol_get_field_by_key(protocol, field_key_search(name));
+}
+
+inline const protocol_field_t * protocol_get_field_by_key(const protocol_t * protocol, field_key_t key) {
+    return protocol->fields_by_key[key];
 }
 
 void protocol_iter_fields(
@@ -88,22 +100,6 @@ void protocol_iter_fields(
     }
 }
 
-uint16_t csum(const uint16_t * bytes, size_t size) {
-    // Adapted from http://www.netpatch.ru/windows-files/pingscan/raw_ping.c.html
-    uint32_t sum = 0;
-
-    while (size > 1) {
-        sum += *bytes++;
-        size -= sizeof(uint16_t);
-    }
-    if (size) {
-        sum += * (const uint8_t *) bytes;
-    }
-    sum  = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
-    return (uint16_t) ~sum;
-}
-
 static inline void callback_protocol_field_dump(const protocol_field_t * protocol_field, void * data) {
     protocol_field_dump(protocol_field);
 }
@@ -113,22 +109,12 @@ void protocol_dump(const protocol_t * protocol) {
 //    protocol_iter_fields(protocol, NULL, callback_protocol_field_dump);
 }
 
-static void callback_protocols_dump(const void * node, VISIT visit, int level) {
-    const protocol_t * protocol;
-
-    switch (visit) {
-        case leaf:      // 1st visit (leaf)
-        case postorder: // 3rd visit
-            protocol = *((protocol_t * const *) node);
-            protocol_dump(protocol);
-            break;
-        default:        // endorder (2nd visit) and preorder (1st visit, not leaf)
-            break;
-    }
-}
-
 void protocols_dump() {
-    twalk(protocols_root, callback_protocols_dump);
+    size_t id;
+
+    for (id = 0; id <= UINT8_MAX; id++) {
+        if (protocols_by_id[id]) protocol_dump(protocols_by_id[id]);
+    }
 }
 
 const protocol_t * protocol_get_next_protocol(const layer_t * layer) {
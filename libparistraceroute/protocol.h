@@ -9,12 +9,15 @@
 #include <stdbool.h>
 
 #include "protocol_field.h"
+#include "field_key.h"      // field_key_t, FIELD_KEY_MAX
 #include "buffer.h"
+#include "csum.h"           // csum
 
 #define END_PROTOCOL_FIELDS { .key = NULL }
 
 struct layer_s;
 struct probe_s;
+struct match_key_s;
 
 /**
  * \struct protocol_t
@@ -109,10 +112,16 @@ typedef struct protocol_s {
 
     /**
      * \brief Checks whether the protocols of two probes match
-     * \param probe the probe to analyse
-     * \param reply the reply to the probe to analyse
+     * \param probe the key of the probe to analyse (see match_key.h)
+     * \param reply the key of the reply to the probe to analyse
      */
-    bool (*matches)(const struct probe_s * probe, const struct probe_s * reply);
+    bool (*matches)(const struct match_key_s * probe, const struct match_key_s * reply);
+
+    /**
+     * Fields of this protocol indexed by their interned key (set by protocol_register)
+     */
+
+    const protocol_field_t * fields_by_key[FIELD_KEY_MAX];
 
 } protocol_t;
 
@@ -125,7 +134,9 @@ typedef struct protocol_s {
 const protocol_t * protocol_search(const char * name);
 
 /**
- * \brief Search a registered protocol in the library according to its ID
+ * \brief Search a registered protocol in the library according to its ID.
+ *    Contrary to protocol_search, this is a mere array lookup, hence it
+ *    should be preferred when dissecting packets.
  * \param name The ID of the protocol (for example 17 corrresponds to UDP)
  * \return A pointer to the corresponding protocol if any, NULL othewise
  */
@@ -162,13 +173,13 @@ void protocol_iter_fields(const protocol_t * protocol, void * data, void (*callb
 const protocol_field_t * protocol_get_field(const protocol_t * protocol, const char * name);
 
 /**
- * \brief Calculate an Internet checksum.
- * \param bytes Bytes used to compute the checksum
- * \param size Number of bytes to consider
- * \return The corresponding checksum
+ * \brief Retrieve a field belonging to a protocol according to its interned key
+ * \param protocol The queried network protocol
+ * \param key The interned key of the field (see field_key.h)
+ * \return A pointer to the corresponding protocol_field_t instance if any, NULL otherwise
  */
 
-uint16_t csum(const uint16_t * buf, size_t size);
+const protocol_field_t * protocol_get_field_by_key(const protocol_t * protocol, field_key_t key);
 
 /**
  * \brief Print information stored in a protocol instance
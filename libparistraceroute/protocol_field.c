@@ -6,9 +6,33 @@
 
 #include "protocol_field.h"
 #ifdef USE_BITS
-#    include "bits.h"         // bits_write
+#    include "bits.h"         // bits_extract, bits_write, byte_make_mask
 #endif
 
+#ifdef USE_BITS
+/**
+ * \brief (Internal use) Retrieve the shift of a TYPE_BITS field held by a single byte.
+ * \param protocol_field A pointer to the protocol_field_t instance
+ * \return The number of bits between the field and the end of its byte.
+ */
+
+static inline size_t protocol_field_get_bits_shift(const protocol_field_t * protocol_field) {
+    return 8 - protocol_field->offset_in_bits - protocol_field->size_in_bits;
+}
+#endif
+
+void protocol_field_init(protocol_field_t * protocol_field)
+{
+#ifdef USE_BITS
+    protocol_field->bits_mask = 0;
+    if (protocol_field->type == TYPE_BITS
+    &&  protocol_field->size_in_bits
+    &&  protocol_field->offset_in_bits + protocol_field->size_in_bits <= 8) {
+        protocol_field->bits_mask = byte_make_mask(protocol_field->offset_in_bits, protocol_field->size_in_bits);
+    }
+#endif
+}
+
 bool protocol_field_set(const protocol_field_t * protocol_field, uint8_t * segment, const field_t * field)
 {
     bool      ret = true;
@@ -36,6 +60,11 @@ bool protocol_field_set(const protocol_field_t * protocol_field, uint8_t * segme
             break;
 #ifdef USE_BITS
         case TYPE_BITS:
+            if (protocol_field->bits_mask) {
+                *segment_field = (*segment_field & ~protocol_field->bits_mask)
+                    | ((field->value.bits << protocol_field_get_bits_shift(protocol_field)) & protocol_field->bits_mask);
+                break;
+            }
             ret = bits_write(
                 segment_field,
                 protocol_field->offset_in_bits,
@@ -54,6 +83,25 @@ bool protocol_field_set(const protocol_field_t * protocol_field, uint8_t * segme
     return ret;
 }
 
+#ifdef USE_BITS
+bool protocol_field_extract_bits(const protocol_field_t * protocol_field, const uint8_t * segment, uint8_t * value)
+{
+    const uint8_t * segment_field = segment + protocol_field->offset;
+
+    if (protocol_field->bits_mask) {
+        *value = (*segment_field & protocol_field->bits_mask) >> protocol_field_get_bits_shift(protocol_field);
+        return true;
+    }
+
+    return bits_extract(
+        segment_field,
+        protocol_field->offset_in_bits,
+        protocol_field->size_in_bits,
+        value
+    ) != NULL;
+}
+#endif
+
 inline size_t protocol_field_get_offset(const protocol_field_t * protocol_field) {
     return protocol_field->offset;
 }
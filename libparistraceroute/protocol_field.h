@@ -19,12 +19,15 @@
 
 typedef struct {
     const char  * key;            /**< Pointer to an identifying key */
+    field_key_t   key_id;         /**< Interned key (set by protocol_register) */
     fieldtype_t   type;           /**< Enum to set the type of data stored in the field */
     size_t        offset;         /**< Offset from start of segment data */
 #ifdef USE_BITS
     size_t        offset_in_bits; /**< Additional offset in bits for non-aligned fields (set to 0 otherwise) */
     size_t        size_in_bits;   /**< Size in bits (only useful for non-aligned fields and fields not having a size equal to 8 * n bits */
+    uint8_t       bits_mask;      /**< Mask of a TYPE_BITS field held by a single byte, 0 otherwise (set by protocol_field_init) */
 #endif
+    bool          in_pseudo_header; /**< True iif this field is involved in the pseudo header of the nested layer (see protocol_t::create_pseudo_header) */
 
     // The following callbacks allows to perform specific treatment when we translate
     // field content in packet content and vice versa. Most of time there are set
@@ -34,6 +37,17 @@ typedef struct {
     bool          (*set)(uint8_t * segment, const field_t * field); /**< Update a segment according to a field. Return true iif successful */
 } protocol_field_t;
 
+/**
+ * \brief Select how the value of a protocol field is read and written.
+ *    Byte-aligned fields are always accessed directly, and so are the
+ *    TYPE_BITS fields held by a single byte (e.g. IPv4 ihl, TCP flags).
+ *    The other TYPE_BITS fields rely on bits_extract and bits_write.
+ *    This function is called by protocol_register.
+ * \param protocol_field A pointer to the protocol_field_t instance
+ */
+
+void protocol_field_init(protocol_field_t * protocol_field);
+
 /**
  * \brief Retrieve the size (in bytes) to a protocol field
  * \param protocol_field A pointer to the protocol_field_t instance
@@ -53,6 +67,19 @@ size_t protocol_field_get_size(const protocol_field_t * protocol_field);
 
 bool protocol_field_set(const protocol_field_t * protocol_field, uint8_t * segment, const field_t * field);
 
+#ifdef USE_BITS
+/**
+ * \brief Read the value of a TYPE_BITS protocol field in a segment.
+ * \param protocol_field A pointer to the corresponding protocol field.
+ * \param segment The segment related to the layer we're reading.
+ * \param value The buffer in which the value is written (right-aligned).
+ *    It must be at least of size (size_in_bits + 7) / 8.
+ * \return true iif successful
+ */
+
+bool protocol_field_extract_bits(const protocol_field_t * protocol_field, const uint8_t * segment, uint8_t * value);
+#endif
+
 /**
  * \brief Retrieve the offset stored in a protocol_field_t instance.
  * \param protocol_field A pointer to a protocol_field_t instance.
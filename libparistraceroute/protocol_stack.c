@@ -0,0 +1,375 @@
+#include "config.h"
+#include "use.h"
+
+#include <arpa/inet.h>        // ntohs
+#include <netinet/in.h>       // IPPROTO_*
+#include <netinet/ip.h>       // iphdr
+#include <netinet/ip6.h>      // ip6_hdr
+#include <netinet/ip_icmp.h>  // icmphdr, ICMP_DEST_UNREACH, ICMP_TIME_EXCEEDED
+#include <netinet/icmp6.h>    // ICMP6_DST_UNREACH, ICMP6_TIME_EXCEEDED
+#include <netinet/tcp.h>      // tcphdr
+#include <netinet/udp.h>      // udphdr
+#include <stddef.h>           // offsetof
+#include <string.h>           // memcmp, memcpy
+
+#include "protocol_stack.h"
+#include "layer.h"            // layer_t
+#include "packet.h"           // packet_get_bytes, packet_get_size
+#include "protocol.h"         // protocol_t
+
+// Size of the ICMP and ICMPv6 headers preceding the quoted packet
+#define PROTOCOL_STACK_ICMP_HEADER_SIZE 8
+
+// Offsets of the ports in the UDP and TCP headers
+#define PROTOCOL_STACK_SRC_PORT_OFFSET  0
+#define PROTOCOL_STACK_DST_PORT_OFFSET  2
+
+// Offsets of the sequence and acknowledgment numbers and of the flags in the TCP header
+#define PROTOCOL_STACK_SEQ_NUM_OFFSET   offsetof(struct tcphdr, th_seq)
+#define PROTOCOL_STACK_ACK_NUM_OFFSET   offsetof(struct tcphdr, th_ack)
+#define PROTOCOL_STACK_FLAGS_OFFSET     offsetof(struct tcphdr, th_flags)
+
+// Offsets of the type and the code in the ICMP and ICMPv6 headers
+#define PROTOCOL_STACK_TYPE_OFFSET      0
+#define PROTOCOL_STACK_CODE_OFFSET      1
+
+/**
+ * \struct protocol_stack_desc_t
+ * \brief The layout of a supported stack.
+ */
+
+typedef struct {
+    uint8_t ip_version;       /**< 4 or 6, 0 if the stack is not compiled */
+    uint8_t protocol;         /**< Protocol of the transport layer */
+    size_t  checksum_offset;  /**< Offset of the checksum in the transport header */
+    bool    has_ports;        /**< True iif the transport header starts with the ports (UDP, TCP) */
+} protocol_stack_desc_t;
+
+static const protocol_stack_desc_t protocol_stacks[] = {
+#ifdef USE_IPV4
+    [PROTOCOL_STACK_IPV4_UDP]    = { 4, IPPROTO_UDP,    offsetof(struct udphdr, uh_sum),        true  },
+    [PROTOCOL_STACK_IPV4_ICMP]   = { 4, IPPROTO_ICMP,   offsetof(struct icmphdr, checksum),     false },
+    [PROTOCOL_STACK_IPV4_TCP]    = { 4, IPPROTO_TCP,    offsetof(struct tcphdr, th_sum),        true  },
+#endif
+#ifdef USE_IPV6
+    [PROTOCOL_STACK_IPV6_UDP]    = { 6, IPPROTO_UDP,    offsetof(struct udphdr, uh_sum),        true  },
+    [PROTOCOL_STACK_IPV6_ICMPV6] = { 6, IPPROTO_ICMPV6, offsetof(struct icmp6_hdr, icmp6_cksum), false },
+    [PROTOCOL_STACK_IPV6_TCP]    = { 6, IPPROTO_TCP,    offsetof(struct tcphdr, th_sum),        true  },
+#endif
+};
+
+#define PROTOCOL_STACK_NUM_STACKS (sizeof(protocol_stacks) / sizeof(protocol_stack_desc_t))
+
+static inline const protocol_stack_desc_t * protocol_stack_get_desc(const protocol_stack_t * stack) {
+    return &protocol_stacks[stack->id];
+}
+
+/**
+ * \brief Fill a protocol_stack_t instance.
+ * \param stack The protocol_stack_t instance to fill.
+ * \param ip_version The version of the IP header (4 or 6).
+ * \param protocol The protocol of the transport layer.
+ * \param ip The IP header.
+ * \param transport The transport header.
+ * \param transport_size Number of bytes available from the transport header.
+ * \return true iif this stack is supported.
+ */
+
+static bool protocol_stack_init(
+    protocol_stack_t * stack,
+    uint8_t            ip_version,
+    uint8_t            protocol,
+    const uint8_t    * ip,
+    const uint8_t    * transport,
+    size_t             transport_size
+) {
+    size_t i;
+
+    for (i = 0; i < PROTOCOL_STACK_NUM_STACKS; i++) {
+        if (protocol_stacks[i].ip_version == ip_version
+        &&  protocol_stacks[i].protocol   == protocol) {
+            stack->id             = i;
+            stack->ip             = ip;
+            stack->transport      = transport;
+            stack->transport_size = transport_size;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief Retrieve the stack starting at a given IP header.
+ * \param stack The protocol_stack_t instance to fill.
+ * \param bytes The IP header.
+ * \param size Number of bytes available from the IP header.
+ * \param ip_version The expected version of the IP header (4 or 6).
+ * \return true iif successful.
+ */
+
+static bool protocol_stack_parse(protocol_stack_t * stack, const uint8_t * bytes, size_t size, uint8_t ip_version)
+{
+    size_t  ip_header_size;
+    uint8_t protocol;
+
+    if (size == 0 || bytes[0] >> 4 != ip_version) return false;
+
+    switch (ip_version) {
+#ifdef USE_IPV4
+        case 4:
+            ip_header_size = 4 * (bytes[0] & 0x0f);
+            if (ip_header_size < sizeof(struct iphdr) || ip_header_size > size) return false;
+            protocol = ((const struct iphdr *) bytes)->protocol;
+            break;
+#endif
+#ifdef USE_IPV6
+        case 6:
+            ip_header_size = sizeof(struct ip6_hdr);
+            if (ip_header_size > size) return false;
+            protocol = ((const struct ip6_hdr *) bytes)->ip6_nxt;
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    return protocol_stack_init(stack, ip_version, protocol, bytes, bytes + ip_header_size, size - ip_header_size);
+}
+
+bool protocol_stack_from_probe(protocol_stack_t * stack, const probe_t * probe)
+{
+#ifdef USE_PROTOCOL_STACKS
+    const probe_t * layout;
+    const layer_t * ip_layer,
+                  * transport_layer,
+                  * payload_layer;
+    const uint8_t * layout_bytes;
+    size_t          size, ip_offset, transport_offset;
+    const uint8_t * bytes = probe_peek_bytes(probe, &layout, &size);
+    uint8_t         ip_version;
+
+    // The layers of a probe are set by probe_set_protocols, so they are
+    // trusted rather than its bytes (like in probe_match). Those of a
+    // compact probe are the layers of its skeleton (see probe_compact).
+    if (probe_get_num_layers(layout) != 3
+    || !(ip_layer        = probe_get_layer(layout, 0)) || !ip_layer->protocol
+    || !(transport_layer = probe_get_layer(layout, 1)) || !transport_layer->protocol
+    || !(payload_layer   = probe_get_layer(layout, 2)) ||  payload_layer->protocol) {
+        return false;
+    }
+
+    switch (ip_layer->protocol->protocol) {
+        case IPPROTO_IPIP: ip_version = 4; break;
+        case IPPROTO_IPV6: ip_version = 6; break;
+        default: return false;
+    }
+
+    layout_bytes     = packet_get_bytes(layout->packet);
+    ip_offset        = ip_layer->segment - layout_bytes;
+    transport_offset = transport_layer->segment - layout_bytes;
+    if (transport_offset > size) return false;
+
+    return protocol_stack_init(
+        stack, ip_version, transport_layer->protocol->protocol,
+        bytes + ip_offset, bytes + transport_offset,
+        size - transport_offset
+    );
+#else
+    return false;
+#endif
+}
+
+bool protocol_stack_from_reply(protocol_stack_t * stack, protocol_stack_t * quoted, const probe_t * reply)
+{
+#ifdef USE_PROTOCOL_STACKS
+    const uint8_t * bytes = packet_get_bytes(reply->packet);
+    size_t          size  = packet_get_size(reply->packet);
+    uint8_t         type;
+
+    if (size == 0 || !protocol_stack_parse(stack, bytes, size, bytes[0] >> 4)) return false;
+    if (stack->transport_size < PROTOCOL_STACK_ICMP_HEADER_SIZE) return false;
+
+    // Only the ICMP errors quote a probe (see icmpv4_get_next_protocol
+    // and icmpv6_get_next_protocol).
+    type = stack->transport[PROTOCOL_STACK_TYPE_OFFSET];
+    switch (stack->id) {
+        case PROTOCOL_STACK_IPV4_ICMP:
+            if (type != ICMP_DEST_UNREACH && type != ICMP_TIME_EXCEEDED) return false;
+            break;
+        case PROTOCOL_STACK_IPV6_ICMPV6:
+            if (type != ICMP6_DST_UNREACH && type != ICMP6_TIME_EXCEEDED) return false;
+            break;
+        default:
+            return false;
+    }
+
+    return protocol_stack_parse(
+        quoted,
+        stack->transport + PROTOCOL_STACK_ICMP_HEADER_SIZE,
+        stack->transport_size - PROTOCOL_STACK_ICMP_HEADER_SIZE,
+        protocol_stack_get_desc(stack)->ip_version
+    );
+#else
+    return false;
+#endif
+}
+
+bool protocol_stack_from_tcp_reply(protocol_stack_t * stack, const probe_t * reply)
+{
+#ifdef USE_PROTOCOL_STACKS
+    const uint8_t * bytes = packet_get_bytes(reply->packet);
+    size_t          size  = packet_get_size(reply->packet);
+
+    return size > 0
+        && protocol_stack_parse(stack, bytes, size, bytes[0] >> 4)
+        && protocol_stack_is_tcp(stack)
+        && stack->transport_size >= sizeof(struct tcphdr);
+#else
+    return false;
+#endif
+}
+
+bool protocol_stack_is_tcp(const protocol_stack_t * stack) {
+    return protocol_stack_get_desc(stack)->protocol == IPPROTO_TCP;
+}
+
+/**
+ * \brief Read a 32-bit field of a transport header.
+ * \param stack A protocol_stack_t instance.
+ * \param offset The offset of the field in the transport header.
+ * \param pvalue Address of an uint32_t in which the field is written
+ *    (host-side endianness).
+ * \return true iif the field is not truncated.
+ */
+
+static inline bool protocol_stack_get_transport_uint32(const protocol_stack_t * stack, size_t offset, uint32_t * pvalue)
+{
+    if (offset + sizeof(uint32_t) > stack->transport_size) return false;
+    memcpy(pvalue, stack->transport + offset, sizeof(uint32_t));
+    *pvalue = ntohl(*pvalue);
+    return true;
+}
+
+/**
+ * \brief Read a 16-bit field of a transport header.
+ * \param stack A protocol_stack_t instance.
+ * \param offset The offset of the field in the transport header.
+ * \param pvalue Address of an uint16_t in which the field is written
+ *    (network-side endianness).
+ * \return true iif the field is not truncated.
+ */
+
+static inline bool protocol_stack_get_transport_uint16(const protocol_stack_t * stack, size_t offset, uint16_t * pvalue)
+{
+    if (offset + sizeof(uint16_t) > stack->transport_size) return false;
+    memcpy(pvalue, stack->transport + offset, sizeof(uint16_t));
+    return true;
+}
+
+bool protocol_stack_get_checksum(const protocol_stack_t * stack, uint16_t * pchecksum)
+{
+    if (!protocol_stack_get_transport_uint16(stack, protocol_stack_get_desc(stack)->checksum_offset, pchecksum)) {
+        return false;
+    }
+    *pchecksum = ntohs(*pchecksum);
+    return true;
+}
+
+bool protocol_stack_get_identification(const protocol_stack_t * stack, uint16_t * pidentification)
+{
+#ifdef USE_IPV4
+    if (protocol_stack_get_desc(stack)->ip_version == 4) {
+        *pidentification = ntohs(((const struct iphdr *) stack->ip)->id);
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool protocol_stack_get_seq_num(const protocol_stack_t * stack, uint32_t * pseq_num)
+{
+    return protocol_stack_is_tcp(stack)
+        && protocol_stack_get_transport_uint32(stack, PROTOCOL_STACK_SEQ_NUM_OFFSET, pseq_num);
+}
+
+bool protocol_stack_get_ack_num(const protocol_stack_t * stack, uint32_t * pack_num)
+{
+    return protocol_stack_is_tcp(stack)
+        && PROTOCOL_STACK_FLAGS_OFFSET < stack->transport_size
+        && (stack->transport[PROTOCOL_STACK_FLAGS_OFFSET] & TH_ACK)
+        && protocol_stack_get_transport_uint32(stack, PROTOCOL_STACK_ACK_NUM_OFFSET, pack_num);
+}
+
+/**
+ * \brief Compare the 16-bit fields of two transport headers.
+ * \param stack1 A protocol_stack_t instance.
+ * \param offset1 The offset of the field in the transport header of stack1.
+ * \param stack2 A protocol_stack_t instance.
+ * \param offset2 The offset of the field in the transport header of stack2.
+ * \return true iif both fields are equal.
+ */
+
+static inline bool protocol_stack_transport_equals(
+    const protocol_stack_t * stack1, size_t offset1,
+    const protocol_stack_t * stack2, size_t offset2
+) {
+    return !memcmp(stack1->transport + offset1, stack2->transport + offset2, sizeof(uint16_t));
+}
+
+bool protocol_stack_matches(
+    const protocol_stack_t * probe,
+    const protocol_stack_t * reply,
+    const protocol_stack_t * quoted,
+    bool                   * pmatches
+) {
+    size_t address_size, src_offset, dst_offset;
+    bool   ip_matches, transport_matches;
+
+    if (probe->id != quoted->id) return false;
+
+    switch (protocol_stack_get_desc(probe)->ip_version) {
+#ifdef USE_IPV4
+        case 4:
+            address_size = sizeof(uint32_t);
+            src_offset   = offsetof(struct iphdr, saddr);
+            dst_offset   = offsetof(struct iphdr, daddr);
+            break;
+#endif
+#ifdef USE_IPV6
+        case 6:
+            address_size = sizeof(struct in6_addr);
+            src_offset   = offsetof(struct ip6_hdr, ip6_src);
+            dst_offset   = offsetof(struct ip6_hdr, ip6_dst);
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    // See ipv4_matches and ipv6_matches: either the reply comes from the
+    // destination, or it quotes the addresses of the probe.
+    ip_matches =
+        (  !memcmp(probe->ip + src_offset, reply->ip  + dst_offset, address_size)
+        && !memcmp(probe->ip + dst_offset, reply->ip  + src_offset, address_size))
+     || (  !memcmp(probe->ip + src_offset, quoted->ip + src_offset, address_size)
+        && !memcmp(probe->ip + dst_offset, quoted->ip + dst_offset, address_size));
+
+    if (protocol_stack_get_desc(probe)->has_ports) {
+        // See udp_matches and tcp_matches
+        if (quoted->transport_size < PROTOCOL_STACK_DST_PORT_OFFSET + sizeof(uint16_t)) return false;
+        transport_matches =
+            (  protocol_stack_transport_equals(probe, PROTOCOL_STACK_SRC_PORT_OFFSET, quoted, PROTOCOL_STACK_DST_PORT_OFFSET)
+            && protocol_stack_transport_equals(probe, PROTOCOL_STACK_DST_PORT_OFFSET, quoted, PROTOCOL_STACK_SRC_PORT_OFFSET))
+         || (  protocol_stack_transport_equals(probe, PROTOCOL_STACK_SRC_PORT_OFFSET, quoted, PROTOCOL_STACK_SRC_PORT_OFFSET)
+            && protocol_stack_transport_equals(probe, PROTOCOL_STACK_DST_PORT_OFFSET, quoted, PROTOCOL_STACK_DST_PORT_OFFSET));
+    } else {
+        // See icmpv4_matches and icmpv6_matches
+        if (quoted->transport_size <= PROTOCOL_STACK_CODE_OFFSET) return false;
+        transport_matches =
+            probe->transport[PROTOCOL_STACK_TYPE_OFFSET] == quoted->transport[PROTOCOL_STACK_TYPE_OFFSET]
+         && probe->transport[PROTOCOL_STACK_CODE_OFFSET] == quoted->transport[PROTOCOL_STACK_CODE_OFFSET];
+    }
+
+    *pmatches = ip_matches && transport_matches;
+    return true;
+}
@@ -0,0 +1,161 @@
+#include "use.h"
+
+#ifndef PROTOCOL_STACK_H
+#define PROTOCOL_STACK_H
+
+/**
+ * \file protocol_stack.h
+ * \brief Fast paths for the common protocol stacks.
+ *
+ * Most probes are IPv4/UDP, IPv4/ICMP, IPv4/TCP, IPv6/UDP, IPv6/ICMPv6 or
+ * IPv6/TCP packets, and most replies are ICMP errors quoting such a probe. For
+ * these stacks, the fields involved in the matching of the replies (tag,
+ * addresses, ports, ICMP type and code) are read at fixed offsets, without
+ * dissecting the packet layer by layer (see probe_wrap_packet) nor looking
+ * up the protocol fields by name.
+ *
+ * Each function of this module returns false if the packet does not
+ * belong to a common stack (or is truncated). The caller must then fall
+ * back on the generic functions of probe.h, which give the same results.
+ */
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint*_t
+
+#include "probe.h"    // probe_t
+
+/**
+ * \enum protocol_stack_id_t
+ * \brief The supported stacks.
+ */
+
+typedef enum {
+    PROTOCOL_STACK_IPV4_UDP,
+    PROTOCOL_STACK_IPV4_ICMP,
+    PROTOCOL_STACK_IPV4_TCP,
+    PROTOCOL_STACK_IPV6_UDP,
+    PROTOCOL_STACK_IPV6_ICMPV6,
+    PROTOCOL_STACK_IPV6_TCP
+} protocol_stack_id_t;
+
+/**
+ * \struct protocol_stack_t
+ * \brief An IP header followed by a transport header, belonging to a
+ *    supported stack.
+ */
+
+typedef struct {
+    protocol_stack_id_t   id;              /**< The stack */
+    const uint8_t       * ip;              /**< The IP header */
+    const uint8_t       * transport;       /**< The transport header (UDP, TCP, ICMP or ICMPv6) */
+    size_t                transport_size;  /**< Number of bytes available from the transport header */
+} protocol_stack_t;
+
+/**
+ * \brief Retrieve the stack of a probe.
+ * \param stack The protocol_stack_t instance to fill.
+ * \param probe The probe. It must carry an IP layer, a transport layer
+ *    and its payload. A compact probe is not rebuilt: the stack then
+ *    points to a copy of its headers, valid until the next call made by
+ *    the calling thread (see probe_peek_bytes).
+ * \return true iif successful.
+ */
+
+bool protocol_stack_from_probe(protocol_stack_t * stack, const probe_t * probe);
+
+/**
+ * \brief Retrieve the stacks of an ICMP error (time exceeded, destination
+ *    unreachable), i.e. of the reply itself and of the probe it quotes.
+ * \param stack The protocol_stack_t instance related to the reply
+ *    (IPv4/ICMP or IPv6/ICMPv6).
+ * \param quoted The protocol_stack_t instance related to the quoted probe.
+ * \param reply The reply.
+ * \return true iif successful.
+ */
+
+bool protocol_stack_from_reply(protocol_stack_t * stack, protocol_stack_t * quoted, const probe_t * reply);
+
+/**
+ * \brief Retrieve the stack of a TCP segment acknowledging or resetting
+ *    a probe (e.g. SYN/ACK, RST), sent by its destination.
+ * \param stack The protocol_stack_t instance to fill.
+ * \param reply The reply.
+ * \return true iif successful.
+ */
+
+bool protocol_stack_from_tcp_reply(protocol_stack_t * stack, const probe_t * reply);
+
+/**
+ * \brief Tell whether the transport layer of a stack is TCP.
+ * \param stack A protocol_stack_t instance.
+ * \return true iif this is an IPv4/TCP or an IPv6/TCP stack.
+ */
+
+bool protocol_stack_is_tcp(const protocol_stack_t * stack);
+
+/**
+ * \brief Extract the transport checksum of a stack (see the "checksum"
+ *    field of the transport protocols).
+ * \param stack A protocol_stack_t instance.
+ * \param pchecksum Address of an uint16_t in which the checksum is
+ *    written (host-side endianness).
+ * \return true iif successful.
+ */
+
+bool protocol_stack_get_checksum(const protocol_stack_t * stack, uint16_t * pchecksum);
+
+/**
+ * \brief Extract the IP identification of an IPv4 stack.
+ * \param stack A protocol_stack_t instance.
+ * \param pidentification Address of an uint16_t in which the identification
+ *    is written (host-side endianness).
+ * \return true iif successful, false if this is not an IPv4 stack.
+ */
+
+bool protocol_stack_get_identification(const protocol_stack_t * stack, uint16_t * pidentification);
+
+/**
+ * \brief Extract the sequence number of a TCP stack. It is available
+ *    even if the stack is quoted by an ICMP error carrying only the first
+ *    8 bytes of the transport header.
+ * \param stack A protocol_stack_t instance.
+ * \param pseq_num Address of an uint32_t in which the sequence number
+ *    is written (host-side endianness).
+ * \return true iif successful, false if this is not a TCP stack.
+ */
+
+bool protocol_stack_get_seq_num(const protocol_stack_t * stack, uint32_t * pseq_num);
+
+/**
+ * \brief Extract the acknowledgment number of a TCP stack.
+ * \param stack A protocol_stack_t instance.
+ * \param pack_num Address of an uint32_t in which the acknowledgment
+ *    number is written (host-side endianness).
+ * \return true iif successful, false if this is not a TCP stack or if
+ *    its ACK flag is not set.
+ */
+
+bool protocol_stack_get_ack_num(const protocol_stack_t * stack, uint32_t * pack_num);
+
+/**
+ * \brief Check whether an ICMP error has been provoked by a probe, as
+ *    probe_match does. A TCP segment sent by the destination (see
+ *    protocol_stack_from_tcp_reply) is passed both as reply and quoted.
+ * \param probe The stack of the probe (see protocol_stack_from_probe).
+ * \param reply The stack of the ICMP error (see protocol_stack_from_reply).
+ * \param quoted The stack quoted in the ICMP error.
+ * \param pmatches Address of a bool in which the result is written.
+ * \return true iif successful, false if the result must be computed
+ *    by probe_match (e.g. the probe and the quoted packet do not belong to
+ *    the same stack).
+ */
+
+bool protocol_stack_matches(
+    const protocol_stack_t * probe,
+    const protocol_stack_t * reply,
+    const protocol_stack_t * quoted,
+    bool                   * pmatches
+);
+
+#endif // PROTOCOL_STACK_H
@@ -14,6 +14,7 @@
 #include "../protocol.h"
 #include "../layer.h"
 #include "../probe.h"
+#include "../match_key.h"  // match_key_t
 
 #define ICMPV4_FIELD_TYPE             "type"
 #define ICMPV4_FIELD_CODE             "code"
@@ -120,7 +121,7 @@ const protocol_t * icmpv4_get_next_protocol(const layer_t * icmpv4_layer) {
         switch (icmpv4_type) {
             case ICMP_DEST_UNREACH:
             case ICMP_TIME_EXCEEDED:
-                next_protocol = protocol_search("ipv4");
+                next_protocol = protocol_search_by_id(IPPROTO_IPIP);
                 break;
             default:
                 break;
@@ -131,35 +132,26 @@ const protocol_t * icmpv4_get_next_protocol(const layer_t * icmpv4_layer) {
 
 /**
  * \brief check whether the icmpv4 protocols of 2 probes match
- * \param _probe the probe to analyse
- * \param _reply the reply to the probe to analyse
+ * \param probe the key of the probe to analyse (see match_key.h)
+ * \param reply the key of the reply to the probe to analyse
  * \true if protocols match, false otherwise
  */
 
-bool icmpv4_matches(const struct probe_s * _probe, const struct probe_s * _reply)
+bool icmpv4_matches(const struct match_key_s * probe, const struct match_key_s * reply)
 {
-    uint8_t         reply_type = 0,
-                    reply_code = 0,
-                    probe_type = 0,
-                    probe_code = 0;
-    layer_t       * icmp_layer = NULL;
-    const probe_t * probe      = (const probe_t *) _probe;
-    const probe_t * reply      = (const probe_t *) _reply;
-
-    if (probe_extract(reply, "type", &reply_type)
-     && probe_extract(probe, "type", &probe_type)
-     && probe_extract(probe, "code", &probe_code)) {
-
-        if (reply_type == ICMP_ECHOREPLY) {
+    if (match_key_has(reply, MATCH_KEY_TYPE)
+     && match_key_has(probe, MATCH_KEY_TYPE | MATCH_KEY_CODE)) {
+
+        if (reply->type == ICMP_ECHOREPLY) {
             return true;
         }
 
-        if (!(icmp_layer = probe_get_layer(reply, 3)) || strcmp(icmp_layer->protocol->name, "icmpv4")) {
+        if (match_key_get_protocol(reply, 3) != IPPROTO_ICMP) {
             return false;
         }
 
-        if (probe_extract_ext(reply, "type", 3, &reply_type) && probe_extract_ext(reply, "code", 3, &reply_code)) {
-            return (probe_type == reply_type) && (probe_code == reply_code);
+        if (match_key_has(reply, MATCH_KEY_QUOTED_ICMP)) {
+            return (probe->type == reply->quoted_type) && (probe->code == reply->quoted_code);
         }
     }
     return false;
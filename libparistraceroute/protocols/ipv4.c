@@ -6,7 +6,6 @@
 
 #include <stdio.h>
 #include <stdbool.h>      // bool
-#include <unistd.h>       // close()
 #include <stddef.h>       // offsetof()
 #include <string.h>       // memcpy()
 #include <arpa/inet.h>    // inet_pton()
@@ -17,7 +16,8 @@
 
 #include "../field.h"     // field_t
 #include "../protocol.h"  // csum
-#include "../bits.h"      // byte_* // TODO to remove
+#include "../match_key.h" // match_key_t
+#include "../src_cache.h" // src_cache_get
 
 // Field names
 #define IPV4_FIELD_VERSION           "version"
@@ -42,7 +42,7 @@
 #define IPV4_DEFAULT_TTL             255
 #define IPV4_DEFAULT_PROTOCOL        IPPROTO_IPIP
 #define IPV4_DEFAULT_CHECKSUM        0
-#define IPV4_DEFAULT_SRC_IP          0 // See ipv4_get_default_src_ip()
+#define IPV4_DEFAULT_SRC_IP          0 // See src_cache.h
 #define IPV4_DEFAULT_DST_IP          0 // Must be set by the user (see network.c)
 
 // The following offsets cannot be retrieved with offsetof() so they are hardcoded
@@ -57,39 +57,6 @@
 // finalize callback
 //-----------------------------------------------------------
 
-bool ipv4_get_default_src_ip(uint32_t dst_ipv4, uint32_t * psrc_ipv4) {
-    struct sockaddr_in  addr, name;
-    int                 sockfd;
-    short               family  = AF_INET;
-    socklen_t           addrlen = sizeof(struct sockaddr_in);
-
-    if ((sockfd = socket(family, SOCK_DGRAM, 0)) == -1) {
-        goto ERR_SOCKET;
-    }
-
-    memset(&addr, 0, addrlen);
-    addr.sin_family = family;
-    addr.sin_addr.s_addr = dst_ipv4;
-
-    if (connect(sockfd, (struct sockaddr *) &addr, addrlen) == -1) {
-        goto ERR_CONNECT;
-    }
-
-    if (getsockname(sockfd, (struct sockaddr *) &name, &addrlen) == -1) {
-        goto ERR_GETSOCKNAME;
-    }
-
-    close(sockfd);
-    *psrc_ipv4 = name.sin_addr.s_addr;
-    return true;
-
-ERR_GETSOCKNAME:
-    close(sockfd);
-ERR_CONNECT:
-ERR_SOCKET:
-    return false;
-}
-
 /**
  * \brief Fill the unset parts of the IPv4 layer to coherent values
  * \param ipv4_header The IP header that must be updated
@@ -104,7 +71,7 @@ bool ipv4_finalize(uint8_t * ipv4_header)
                    ret = true;
 
 	if (do_update_src_ip) {
-        ret = ipv4_get_default_src_ip(iph->daddr, &iph->saddr);
+        ret = src_cache_get(AF_INET, &iph->daddr, &iph->saddr);
 	}
 
 	return ret;
@@ -121,12 +88,10 @@ bool ipv4_finalize(uint8_t * ipv4_header)
  */
 
 size_t ipv4_get_header_size(const uint8_t * ipv4_header) {
-    uint8_t         ihl;
     size_t          size;
 
     if (ipv4_header) {
-        bits_extract(ipv4_header, IPV4_OFFSET_IN_BITS_IHL, 4, &ihl);
-        size  = 4 * ihl;
+        size = 4 * ((const struct iphdr *) ipv4_header)->ihl;
     } else {
         //size = sizeof(struct iphdr);
         size = 0;
@@ -171,6 +136,7 @@ static protocol_field_t ipv4_fields[] = {
         .offset          = IPV4_OFFSET_IHL,
         .offset_in_bits  = IPV4_OFFSET_IN_BITS_IHL,
         .size_in_bits    = 4,
+        .in_pseudo_header = true,
     }, {
 #endif // USE_BITS
         .key             = IPV4_FIELD_TOS,
@@ -180,6 +146,7 @@ static protocol_field_t ipv4_fields[] = {
         .key             = IPV4_FIELD_LENGTH,
         .type            = TYPE_UINT16,
         .offset          = offsetof(struct iphdr, tot_len),
+        .in_pseudo_header = true,
     }, {
         .key             = IPV4_FIELD_IDENTIFICATION,
         .type            = TYPE_UINT16,
@@ -196,6 +163,7 @@ static protocol_field_t ipv4_fields[] = {
         .key             = IPV4_FIELD_PROTOCOL,
         .type            = TYPE_UINT8,
         .offset          = offsetof(struct iphdr, protocol),
+        .in_pseudo_header = true,
     }, {
         .key             = IPV4_FIELD_CHECKSUM,
         .type            = TYPE_UINT16,
@@ -204,10 +172,12 @@ static protocol_field_t ipv4_fields[] = {
         .key             = IPV4_FIELD_SRC_IP,
         .type            = TYPE_IPV4,
         .offset          = offsetof(struct iphdr, saddr),
+        .in_pseudo_header = true,
     }, {
         .key             = IPV4_FIELD_DST_IP,
         .type            = TYPE_IPV4,
         .offset          = offsetof(struct iphdr, daddr),
+        .in_pseudo_header = true,
     },
     END_PROTOCOL_FIELDS
     // options if header length > 5 (not yet implemented)
@@ -251,40 +221,27 @@ size_t ipv4_write_default_header(uint8_t * ipv4_header) {
  */
 
 bool ipv4_instance_of(uint8_t * bytes) {
-    uint8_t version;
-    return bits_extract(bytes, IPV4_OFFSET_IN_BITS_VERSION, 4, &version)
-        && version == IPV4_DEFAULT_VERSION;
+    return ((const struct iphdr *) bytes)->version == IPV4_DEFAULT_VERSION;
 }
 
 /**
  * \brief check whether the ipv4 protocols of 2 probes match
- * \param _probe the probe to analyse
- * \param _reply the reply to the probe to analyse
+ * \param probe the key of the probe to analyse (see match_key.h)
+ * \param reply the key of the reply to the probe to analyse
  * \true if protocols match, false otherwise
  */
 
-bool ipv4_matches(const struct probe_s * _probe, const struct probe_s * _reply)
+bool ipv4_matches(const struct match_key_s * probe, const struct match_key_s * reply)
 {
-    const probe_t * probe = (const probe_t *) _probe,
-                  * reply = (const probe_t *) _reply;
-    address_t       probe_src_ip,
-                    probe_dst_ip,
-                    reply_src_ip,
-                    reply_dst_ip;
-
-    if (probe_extract(probe, "src_ip", &probe_src_ip)
-     && probe_extract(probe, "dst_ip", &probe_dst_ip)
-     && probe_extract(reply, "src_ip", &reply_src_ip)
-     && probe_extract(reply, "dst_ip", &reply_dst_ip)) {
-
-        if (!(!address_compare(&probe_src_ip, &reply_dst_ip) && (!address_compare(&probe_dst_ip, &reply_src_ip)))) {
+    if (match_key_has(probe, MATCH_KEY_IP) && match_key_has(reply, MATCH_KEY_IP)) {
+
+        if (!(address_equals(&probe->src_ip, &reply->dst_ip) && address_equals(&probe->dst_ip, &reply->src_ip))) {
             // probe has most probably not reached its destination
-            if (!strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv4")
-             || !strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv6")) {
+            if (match_key_get_protocol(reply, 1) == IPPROTO_ICMP
+             || match_key_get_protocol(reply, 1) == IPPROTO_ICMPV6) {
 
-                if (probe_extract_ext(reply, "src_ip", 2, &reply_src_ip)
-                 && probe_extract_ext(reply, "dst_ip", 2, &reply_dst_ip)) {
-                    return !address_compare(&probe_src_ip, &reply_src_ip) && !address_compare(&probe_dst_ip, &reply_dst_ip);
+                if (match_key_has(reply, MATCH_KEY_QUOTED_IP)) {
+                    return address_equals(&probe->src_ip, &reply->quoted_src_ip) && address_equals(&probe->dst_ip, &reply->quoted_dst_ip);
                 }
             }
             return false;
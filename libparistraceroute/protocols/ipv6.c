@@ -6,7 +6,6 @@
 
 #include <stddef.h>       // offsetof()
 #include <string.h>       // memcpy(), memset()
-#include <unistd.h>       // close()
 #include <netinet/in.h>   // IPPROTO_UDP
 #include <netinet/ip6.h>  // ip6_hdr
 #include <stdio.h>        // perror
@@ -14,6 +13,8 @@
 #include "../probe.h"
 #include "../field.h"
 #include "../protocol.h"
+#include "../match_key.h" // match_key_t
+#include "../src_cache.h" // src_cache_get
 
 // TODO rfc6564/rfc6437/rfc5095 ?
 
@@ -94,20 +95,24 @@ static protocol_field_t ipv6_fields[] = {
         .key            = IPV6_FIELD_PAYLOAD_LENGTH,
         .type           = TYPE_UINT16,
         .offset         = offsetof(struct ip6_hdr, ip6_plen),
+        .in_pseudo_header = true,
     }, {
         .key            = IPV6_FIELD_LENGTH,
         .type           = TYPE_UINT16,
         .get            = ipv6_get_length,
         .set            = ipv6_set_length,
+        .in_pseudo_header = true,
     }, {
         // "next_header" is an alias of "protocol"
         .key            = IPV6_FIELD_NEXT_HEADER,
         .type           = TYPE_UINT8,
         .offset         = offsetof(struct ip6_hdr, ip6_nxt),
+        .in_pseudo_header = true,
     }, {
         .key            = IPV6_FIELD_PROTOCOL,
         .type           = TYPE_UINT8,
         .offset         = offsetof(struct ip6_hdr, ip6_nxt),
+        .in_pseudo_header = true,
     }, {
         .key            = IPV6_FIELD_HOPLIMIT,
         .type           = TYPE_UINT8,
@@ -121,10 +126,12 @@ static protocol_field_t ipv6_fields[] = {
         .key            = IPV6_FIELD_SRC_IP,
         .type           = TYPE_IPV6,
         .offset         = offsetof(struct ip6_hdr, ip6_src),
+        .in_pseudo_header = true,
     }, {
        .key             = IPV6_FIELD_DST_IP,
        .type            = TYPE_IPV6,
        .offset          = offsetof(struct ip6_hdr, ip6_dst),
+       .in_pseudo_header = true,
     },
     END_PROTOCOL_FIELDS
 };
@@ -138,40 +145,6 @@ static const struct ip6_hdr ipv6_default = {
     .ip6_dst.s6_addr32  = { IPV6_DEFAULT_DST_IP },
 };
 
-bool ipv6_get_default_src_ip(struct in6_addr dst_ipv6, struct in6_addr * psrc_ipv6) {
-    struct sockaddr_in6 addr, name;
-    int                 sockfd;
-    short               family  = AF_INET6;
-    socklen_t           addrlen = sizeof(struct sockaddr_in6);
-
-    if ((sockfd = socket(family, SOCK_DGRAM, 0)) == -1) {
-        goto ERR_SOCKET;
-    }
-
-    memset(&addr, 0, addrlen);
-    addr.sin6_family = family;
-    addr.sin6_addr = dst_ipv6;
-
-    if (connect(sockfd, (struct sockaddr *) &addr, addrlen) == -1) {
-        perror("E: Cannot create IPv6 socket");
-        goto ERR_CONNECT;
-    }
-
-    if (getsockname(sockfd, (struct sockaddr *) &name, &addrlen) == -1) {
-        goto ERR_GETSOCKNAME;
-    }
-
-    close(sockfd);
-    *psrc_ipv6 = name.sin6_addr;
-    return true;
-
-ERR_GETSOCKNAME:
-    close(sockfd);
-ERR_CONNECT:
-ERR_SOCKET:
-    return false;
-}
-
 /**
  * \brief A set of actions to be done before sending the packet.
  * \param ipv6_header Address of the IPv6 header we want to update.
@@ -194,7 +167,7 @@ bool ipv6_finalize(uint8_t * ipv6_header) {
 
     // ... otherwise, we set the src_ip
     if (do_update_src_ip) {
-        ret = ipv6_get_default_src_ip(iph->ip6_dst, &iph->ip6_src);
+        ret = src_cache_get(AF_INET6, &iph->ip6_dst, &iph->ip6_src);
     }
 
     return ret;
@@ -277,33 +250,22 @@ bool ipv6_instance_of(uint8_t * bytes) {
 
 /**
  * \brief check whether the ipv6 protocols of 2 probes match
- * \param _probe the probe to analyse
- * \param _reply the reply to the probe to analyse
+ * \param probe the key of the probe to analyse (see match_key.h)
+ * \param reply the key of the reply to the probe to analyse
  * \true if protocols match, false otherwise
  */
 
-bool ipv6_matches(const struct probe_s * _probe, const struct probe_s * _reply)
+bool ipv6_matches(const struct match_key_s * probe, const struct match_key_s * reply)
 {
-    const probe_t * probe = (const probe_t *) _probe,
-                  * reply = (const probe_t *) _reply;
-    address_t       probe_src_ip,
-                    probe_dst_ip,
-                    reply_src_ip,
-                    reply_dst_ip;
-
-    if (probe_extract(probe, "src_ip", &probe_src_ip)
-     && probe_extract(probe, "dst_ip", &probe_dst_ip)
-     && probe_extract(reply, "src_ip", &reply_src_ip)
-     && probe_extract(reply, "dst_ip", &reply_dst_ip)) {
-
-        if (!(!address_compare(&probe_src_ip, &reply_dst_ip) && (!address_compare(&probe_dst_ip, &reply_src_ip)))) {
+    if (match_key_has(probe, MATCH_KEY_IP) && match_key_has(reply, MATCH_KEY_IP)) {
+
+        if (!(address_equals(&probe->src_ip, &reply->dst_ip) && address_equals(&probe->dst_ip, &reply->src_ip))) {
             // probe has most probably not reached its destination
-            if (!strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv4")
-             || !strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv6")) {
+            if (match_key_get_protocol(reply, 1) == IPPROTO_ICMP
+             || match_key_get_protocol(reply, 1) == IPPROTO_ICMPV6) {
 
-                if (probe_extract_ext(reply, "src_ip", 2, &reply_src_ip)
-                 && probe_extract_ext(reply, "dst_ip", 2, &reply_dst_ip)) {
-                    return !address_compare(&probe_src_ip, &reply_src_ip) && !address_compare(&probe_dst_ip, &reply_dst_ip);
+                if (match_key_has(reply, MATCH_KEY_QUOTED_IP)) {
+                    return address_equals(&probe->src_ip, &reply->quoted_src_ip) && address_equals(&probe->dst_ip, &reply->quoted_dst_ip);
                 }
             }
             return false;
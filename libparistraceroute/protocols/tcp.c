@@ -12,6 +12,7 @@
 
 #include "../probe.h"
 #include "../protocol.h"      // csum
+#include "../match_key.h"     // match_key_t
 #include "../bits.h"
 
 #ifdef USE_IPV4
@@ -271,13 +272,39 @@ size_t tcp_write_default_header(uint8_t * tcp_segment) {
     return size;
 }
 
+/**
+ * \brief Retrieve the size of a TCP segment (header and payload) from
+ *    its pseudo header.
+ * \param ip_psh The pseudo header (see tcp_create_pseudo_header).
+ * \return The size of the TCP segment, 0 if the pseudo header is invalid.
+ */
+
+static size_t tcp_get_segment_size(const buffer_t * ip_psh)
+{
+    const uint8_t * data = buffer_get_data(ip_psh);
+
+    switch (buffer_get_size(ip_psh)) {
+#ifdef USE_IPV4
+        case sizeof(ipv4_pseudo_header_t):
+            return ntohs(((const ipv4_pseudo_header_t *) data)->size);
+#endif
+#ifdef USE_IPV6
+        case sizeof(ipv6_pseudo_header_t):
+            return ntohl(((const ipv6_pseudo_header_t *) data)->size);
+#endif
+        default:
+            return 0;
+    }
+}
+
 /**
  * \brief Compute and write the checksum related to an TCP header
  * \param tcp_segment Points to the begining of the TCP header and its content.
  *    The TCP checksum stored in this header is updated by this function.
  * \param ip_psh The IP layer part of the pseudo header. This buffer should
  *    contain the content of an ipv4_pseudo_header_t or an ipv6_pseudo_header_t
- *    structure.
+ *    structure. The size of the segment (and thus of its payload) is read
+ *    from it.
  * \sa http://www.networksorcery.com/enp/protocol/tcp.htm#Checksum
  * \return true if everything is fine, false otherwise
  */
@@ -285,9 +312,7 @@ size_t tcp_write_default_header(uint8_t * tcp_segment) {
 bool tcp_write_checksum(uint8_t * tcp_segment, buffer_t * ip_psh)
 {
     struct tcphdr * tcp_header = (struct tcphdr *) tcp_segment;
-    size_t          size_ip    = buffer_get_size(ip_psh),
-                    size_tcp   = tcp_get_header_size(tcp_segment) + 2, // hardcoded payload size
-                    size_psh   = size_ip + size_tcp;
+    size_t          size_ip, size_tcp, size_psh;
     uint8_t       * psh;
 
     // TCP checksum computation requires the IPv* header
@@ -296,6 +321,15 @@ bool tcp_write_checksum(uint8_t * tcp_segment, buffer_t * ip_psh)
         return false;
     }
 
+    size_ip  = buffer_get_size(ip_psh);
+    size_tcp = tcp_get_segment_size(ip_psh);
+    size_psh = size_ip + size_tcp;
+
+    if (size_tcp < tcp_get_header_size(tcp_segment)) {
+        errno = EINVAL;
+        return false;
+    }
+
     // Allocate the buffer which will contains the pseudo header
     if (!(psh = calloc(1, size_psh))) {
         return false;
@@ -342,36 +376,25 @@ buffer_t * tcp_create_pseudo_header(const uint8_t * ip_segment)
 
 /**
  * \brief check whether the tcp protocols of 2 probes match
- * \param _probe the probe to analyse
- * \param _reply the reply to the probe to analyse
+ * \param probe the key of the probe to analyse (see match_key.h)
+ * \param reply the key of the reply to the probe to analyse
  * \true if protocols match, false otherwise
  */
 
-bool tcp_matches(const struct probe_s * _probe, const struct probe_s * _reply)
+bool tcp_matches(const struct match_key_s * probe, const struct match_key_s * reply)
 {
-    const probe_t * probe = (const probe_t *) _probe,
-                  * reply = (const probe_t *) _reply;
-    uint16_t        probe_src_port = 0,
-                    probe_dst_port = 0,
-                    reply_src_port = 0,
-                    reply_dst_port = 0;
-    layer_t       * tcp_layer      = NULL;
-
-    if (probe_extract(probe, "src_port", &probe_src_port)
-     && probe_extract(probe, "dst_port", &probe_dst_port)
-     && probe_extract(reply, "src_port", &reply_src_port)
-     && probe_extract(reply, "dst_port", &reply_dst_port)) {
-
-        if (probe_src_port == reply_dst_port && reply_src_port == probe_dst_port) {
+    if (match_key_has(probe, MATCH_KEY_PORTS) && match_key_has(reply, MATCH_KEY_PORTS)) {
+
+        if (probe->src_port == reply->dst_port && reply->src_port == probe->dst_port) {
             return true;
         } else { // it is not a TCP probe; is it an ICMP probe?
-            if (!strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv4")
-             || !strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv6")) {
+            if (match_key_get_protocol(reply, 1) == IPPROTO_ICMP
+             || match_key_get_protocol(reply, 1) == IPPROTO_ICMPV6) {
 
-                if (!(tcp_layer = probe_get_layer(reply, 3)) || strcmp(tcp_layer->protocol->name, "tcp")) {
+                if (match_key_get_protocol(reply, 3) != IPPROTO_TCP) {
                     return false;
                 }
-                return (probe_src_port == reply_src_port) && (probe_dst_port == reply_dst_port);
+                return (probe->src_port == reply->src_port) && (probe->dst_port == reply->dst_port);
             }
         }
     }
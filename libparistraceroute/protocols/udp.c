@@ -11,6 +11,7 @@
 
 #include "../probe.h"
 #include "../protocol.h"      // csum
+#include "../match_key.h"     // match_key_t
 
 #ifdef USE_IPV4
 #    include "ipv4_pseudo_header.h"
@@ -178,37 +179,25 @@ buffer_t * udp_create_pseudo_header(const uint8_t * ip_segment)
 
 /**
  * \brief check whether the udp protocols of 2 probes match
- * \param _probe the probe to analyse
- * \param _reply the reply to the probe to analyse
+ * \param probe the key of the probe to analyse (see match_key.h)
+ * \param reply the key of the reply to the probe to analyse
  * \true if protocols match, false otherwise
  */
 
-bool udp_matches(const struct probe_s * _probe, const struct probe_s * _reply)
+bool udp_matches(const struct match_key_s * probe, const struct match_key_s * reply)
 {
-    const probe_t * probe = (const probe_t *) _probe,
-                  * reply = (const probe_t *) _reply;
+    if (match_key_has(probe, MATCH_KEY_PORTS) && match_key_has(reply, MATCH_KEY_PORTS)) {
 
-    uint16_t        probe_src_port = 0,
-                    probe_dst_port = 0,
-                    reply_src_port = 0,
-                    reply_dst_port = 0;
-    layer_t       * udp_layer      = NULL;
-
-    if (probe_extract(probe, "src_port", &probe_src_port)
-     && probe_extract(probe, "dst_port", &probe_dst_port)
-     && probe_extract(reply, "src_port", &reply_src_port)
-     && probe_extract(reply, "dst_port", &reply_dst_port)) {
-
-        if (probe_src_port == reply_dst_port && reply_src_port == probe_dst_port) {
+        if (probe->src_port == reply->dst_port && reply->src_port == probe->dst_port) {
             return true;
         } else { //it is not a UDP probe; is it an ICMP probe?
-            if (!strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv4")
-             || !strcmp((probe_get_layer(reply, 1))->protocol->name, "icmpv6")) {
+            if (match_key_get_protocol(reply, 1) == IPPROTO_ICMP
+             || match_key_get_protocol(reply, 1) == IPPROTO_ICMPV6) {
 
-                if (!(udp_layer = probe_get_layer(reply, 3)) || strcmp(udp_layer->protocol->name, "udp")) {
+                if (match_key_get_protocol(reply, 3) != IPPROTO_UDP) {
                     return false;
                 }
-                return (probe_src_port == reply_src_port) && (probe_dst_port == reply_dst_port);
+                return (probe->src_port == reply->src_port) && (probe->dst_port == reply->dst_port);
             }
         }
     }
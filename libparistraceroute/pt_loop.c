@@ -8,16 +8,29 @@
 #include <string.h>        // memset
 #include <errno.h>         // perror
 #include <unistd.h>        // close
-#include <sys/epoll.h>     // epoll_ctl
-#include <sys/signalfd.h>  // eventfd
+#ifdef USE_KQUEUE
+#    include <sys/event.h>     // kqueue, kevent
+#else
+#    include <sys/epoll.h>     // epoll_ctl
+#    include <sys/signalfd.h>  // signalfd
+#endif
 #include <signal.h>        // SIGINT, SIGQUIT
+#include <time.h>          // clock_gettime
 #include <netinet/in.h>    // IPPROTO_ICMP, IPPROTO_ICMPV6
 
 #include "pt_loop.h"
 #include "algorithm.h"
+#include "whois.h"         // whois_is_asn_cached
+#include "common.h"        // get_time_ns
 
 #define MAXEVENTS 100
 
+#ifdef USE_IO_URING
+// Size of the submission ring. It must exceed the number of file
+// descriptors watched by pt_loop.
+#    define URING_ENTRIES 64
+#endif
+
 //----------------------------------------------------------------
 // Static functions
 //----------------------------------------------------------------
@@ -31,58 +44,231 @@ static inline void pt_loop_clear_user_events(pt_loop_t * loop) {
     dynarray_clear(loop->events_user, NULL); //(ELEMENT_FREE) event_free); TODO this provoke a segfault in case of stars
 }
 
+#ifdef USE_KQUEUE
+// EV_CLEAR resets the state of the filter once it is returned, as EPOLLET
+#    ifdef USE_EPOLLET
+#        define PT_LOOP_KQUEUE_FLAGS (EV_ADD | EV_CLEAR)
+#    else
+#        define PT_LOOP_KQUEUE_FLAGS EV_ADD
+#    endif
+#else
+#    ifdef USE_EPOLLET
+#        define PT_LOOP_EPOLL_EVENTS (EPOLLIN | EPOLLET)
+#    else
+#        define PT_LOOP_EPOLL_EVENTS EPOLLIN
+#    endif
+#endif
+
 /**
- * \brief Register a file descriptor in Paris Traceroute loop
+ * \brief (Internal usage) Retrieve the handler related to an event
+ *    returned by pt_loop_wait.
+ * \param event An event of loop->events_pending.
+ * \return The corresponding handler.
+ */
+
+static inline pt_loop_handler_t * pt_loop_event_get_handler(const pt_loop_event_t * event) {
+#ifdef USE_KQUEUE
+    return (pt_loop_handler_t *) event->udata;
+#else
+    return event->data.ptr;
+#endif
+}
+
+/**
+ * \brief (Internal usage) Check whether an event returned by pt_loop_wait
+ *    notifies that its file descriptor is readable.
+ * \param event An event of loop->events_pending.
+ * \return false if an error has occured on the file descriptor.
+ */
+
+static inline bool pt_loop_event_is_readable(const pt_loop_event_t * event) {
+#ifdef USE_KQUEUE
+    return !(event->flags & (EV_ERROR | EV_EOF)) && event->filter == EVFILT_READ;
+#else
+    return !(event->events & (EPOLLERR | EPOLLHUP)) && (event->events & EPOLLIN);
+#endif
+}
+
+/**
+ * \brief (Internal usage) Register a pt_loop_handler_t in the epoll
+ *    (kqueue or io_uring) instance of a loop.
  * \param loop The main loop
- * \param fd A file descriptor
- * \return true iif successfull
+ * \param handler A handler of loop->handlers
+ * \return true iif successful
  */
 
-static bool register_efd(pt_loop_t * loop, int fd) {
+static bool register_handler(pt_loop_t * loop, pt_loop_handler_t * handler) {
+#ifdef USE_KQUEUE
+    struct kevent      event;
+#else
     struct epoll_event event;
+#endif
 
-    // Check whether the fd is fine or not
-    if (fd == -1) goto ERR_FD;
+#ifdef USE_IO_URING
+    if (loop->uring) {
+        if (!uring_poll_add(loop->uring, handler->fd, (uintptr_t) handler)) {
+            fprintf(stderr, "register_handler: submission ring full\n");
+            goto ERR_POLL_ADD;
+        }
+        return true;
+    }
+#endif
 
+#ifdef USE_KQUEUE
+    // Register fd in pt_loop
+    EV_SET(&event, handler->fd, EVFILT_READ, PT_LOOP_KQUEUE_FLAGS, 0, 0, handler);
+    if (kevent(loop->efd, &event, 1, NULL, 0, NULL) == -1) {
+        perror("Error kevent");
+        goto ERR_EPOLL_CTL;
+    }
+#else
     // Prepare epoll event structure
     memset(&event, 0, sizeof(struct epoll_event));
-    event.data.fd = fd;
-    event.events = EPOLLIN; // | EPOLLET;
+    event.data.ptr = handler;
+    event.events = PT_LOOP_EPOLL_EVENTS;
 
     // Register fd in pt_loop
-    if (epoll_ctl(loop->efd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    if (epoll_ctl(loop->efd, EPOLL_CTL_ADD, handler->fd, &event) == -1) {
         perror("Error epoll_ctl");
         goto ERR_EPOLL_CTL;
     }
+#endif
     return true;
 
 ERR_EPOLL_CTL:
+#ifdef USE_IO_URING
+ERR_POLL_ADD:
+#endif
+    return false;
+}
+
+/**
+ * \brief Watch a file descriptor in Paris Traceroute loop
+ * \param loop The main loop
+ * \param fd A file descriptor
+ * \param name The name of fd (see profiler.h)
+ * \param callback The function processing the events of fd. It returns
+ *    true iif some events may still be pending.
+ * \param context Passed to callback.
+ * \param is_interruptible Pass true to ignore the events of fd once the
+ *    loop is interrupted.
+ * \param priority When the events of fd are processed within an iteration.
+ * \return true iif successfull
+ */
+
+static bool register_efd(
+    pt_loop_t  * loop,
+    int          fd,
+    const char * name,
+    bool      (* callback)(pt_loop_t *, void *),
+    void       * context,
+    bool         is_interruptible,
+    pt_loop_priority_t priority
+) {
+    pt_loop_handler_t * handler;
+
+    // Check whether the fd is fine or not
+    if (fd == -1) goto ERR_FD;
+    if (loop->num_handlers == PT_LOOP_MAX_HANDLERS) {
+        fprintf(stderr, "register_efd: too many file descriptors\n");
+        goto ERR_NUM_HANDLERS;
+    }
+
+    handler = &loop->handlers[loop->num_handlers];
+    handler->fd               = fd;
+    handler->name             = name;
+    handler->callback         = callback;
+    handler->context          = context;
+    handler->is_interruptible = is_interruptible;
+    handler->priority         = priority;
+    handler->profile          = loop->profiler ? profiler_get_entry(loop->profiler, PROFILER_FD, name) : NULL;
+    if (!register_handler(loop, handler)) goto ERR_REGISTER_HANDLER;
+    loop->num_handlers++;
+    return true;
+
+ERR_REGISTER_HANDLER:
+ERR_NUM_HANDLERS:
 ERR_FD:
     return false;
 }
 
 /**
- * \brief Prepare a EFD_SEMAPHORE event_fd
+ * \brief Wait for the next events related to the file descriptors
+ *    registered in Paris Traceroute loop.
+ * \param loop The main loop. The events are written in loop->events_pending.
+ * \param max_events The maximum number of events (at most MAXEVENTS).
+ * \param timeout_ms The maximum waiting time (in milliseconds), -1 to
+ *    wait until an event occurs, 0 to return immediately.
+ * \return The number of events, -1 in case of failure.
+ */
+
+static int pt_loop_wait(pt_loop_t * loop, size_t max_events, int timeout_ms) {
+    int n;
+#ifdef USE_KQUEUE
+    struct timespec timeout;
+
+    timeout.tv_sec  = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    if ((n = kevent(loop->efd, NULL, 0, loop->events_pending, max_events, timeout_ms < 0 ? NULL : &timeout)) == -1 && errno == EINTR) {
+        n = 0;
+    }
+    return n;
+#else
+#ifdef USE_IO_URING
+    uring_completion_t completions[MAXEVENTS];
+    int                i;
+
+    if (loop->uring) {
+        if ((n = uring_wait(loop->uring, completions, max_events, timeout_ms)) == -1) return -1;
+
+        for (i = 0; i < n; i++) {
+            loop->events_pending[i].data.ptr = (pt_loop_handler_t *) (uintptr_t) completions[i].user_data;
+            loop->events_pending[i].events  = completions[i].res < 0 ? EPOLLERR : (uint32_t) completions[i].res;
+
+            // Poll this fd again. The request is only submitted by the next
+            // call to pt_loop_wait, once this event has been processed.
+            if (!(loop->events_pending[i].events & (EPOLLERR | EPOLLHUP))) {
+                register_handler(loop, loop->events_pending[i].data.ptr);
+            }
+        }
+
+        return n;
+    }
+#endif
+    if ((n = epoll_wait(loop->efd, loop->events_pending, max_events, timeout_ms)) == -1 && errno == EINTR) {
+        n = 0;
+    }
+    return n;
+#endif
+}
+
+/**
+ * \brief Prepare a non-blocking EFD_SEMAPHORE event_fd
  * \return The correspnding file descriptor, -1 in case of failure
  */
 
 static inline int make_event_fd() {
     int fd;
 
-    if ((fd = eventfd(0, EFD_SEMAPHORE)) == -1) {
+    if ((fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK)) == -1) {
         perror("Error eventfd");
     }
     return fd;
 }
 
 /**
- * \brief Prepare a signal file descriptor used to handle SIGINT and SIGQUIT signals
+ * \brief Prepare a signal file descriptor used to handle SIGINT and SIGQUIT signals.
+ *    With kqueue, this is a kqueue instance watching these signals, which is
+ *    readable once one of them is pending.
  * \return The correspnding file descriptor, -1 in case of failure
  */
 
 static int make_signal_fd() {
     int       sfd;
     sigset_t  mask;
+#ifdef USE_KQUEUE
+    struct kevent events[2];
+#endif
 
     // Signal processing
     // Block signals so that they are not managed by their handlers anymore
@@ -94,13 +280,32 @@ static int make_signal_fd() {
         goto ERR_SIGPROCMASK;
     }
 
-    if ((sfd = signalfd(-1, &mask, 0)) == -1) {
+#ifdef USE_KQUEUE
+    // EVFILT_SIGNAL also notices the blocked signals
+    if ((sfd = kqueue()) == -1) {
+        perror("Error kqueue");
+        goto ERR_SIGNALFD;
+    }
+
+    EV_SET(&events[0], SIGINT,  EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+    EV_SET(&events[1], SIGQUIT, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+    if (kevent(sfd, events, 2, NULL, 0, NULL) == -1) {
+        perror("Error kevent");
+        goto ERR_KEVENT;
+    }
+#else
+    if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK)) == -1) {
         perror("Error signalfd");
         goto ERR_SIGNALFD;
     }
+#endif
 
     return sfd;
 
+#ifdef USE_KQUEUE
+ERR_KEVENT:
+    close(sfd);
+#endif
 ERR_SIGPROCMASK:
 ERR_SIGNALFD:
     return -1;
@@ -130,6 +335,124 @@ static bool pt_raise_impl(pt_loop_t * loop, event_type_t type, event_t * nested_
     return true;
 }
 
+/**
+ * \brief Check whether a deferred event must be delivered before an
+ *    event having a given issuer and recipient.
+ * \param deferred_event The deferred event.
+ * \param issuer The issuer of the event.
+ * \param recipient The recipient of the event.
+ * \return true iif the deferred event comes first.
+ */
+
+static inline bool pt_deferred_event_precedes(
+    const pt_deferred_event_t   * deferred_event,
+    struct algorithm_instance_s * issuer,
+    struct algorithm_instance_s * recipient
+) {
+    return deferred_event->event
+        && deferred_event->issuer == issuer
+        && deferred_event->recipient == recipient;
+}
+
+/**
+ * \brief Deliver the deferred events which do not wait (anymore) for a
+ *    DNS lookup, unless a previous event of their issuer to their
+ *    recipient is still pending.
+ * \param loop The main loop
+ */
+
+static void pt_loop_flush_deferred_events(pt_loop_t * loop)
+{
+    pt_deferred_event_t ** deferred_events = (pt_deferred_event_t **) dynarray_get_elements(loop->events_deferred);
+    pt_deferred_event_t  * deferred_event;
+    size_t                 i, j, num_kept = 0,
+                           num_deferred_events = dynarray_get_size(loop->events_deferred);
+    bool                   is_blocked;
+
+    for (i = 0; i < num_deferred_events; i++) {
+        deferred_event = deferred_events[i];
+
+        is_blocked = deferred_event->num_pending > 0;
+        for (j = 0; !is_blocked && j < num_kept; j++) {
+            is_blocked = pt_deferred_event_precedes(deferred_events[j], deferred_event->issuer, deferred_event->recipient);
+        }
+
+        if (is_blocked) {
+            deferred_events[num_kept++] = deferred_event;
+        } else {
+            if (deferred_event->event) {
+                pt_throw_now(loop, deferred_event->recipient, deferred_event->event);
+            }
+            free(deferred_event);
+        }
+    }
+
+    dynarray_del_n_elements(loop->events_deferred, num_kept, num_deferred_events - num_kept, NULL);
+}
+
+/**
+ * \brief Called once a lookup of a deferred event is over
+ *    (see resolver_callback_t).
+ * \param address The looked up address.
+ * \param data The pt_deferred_event_t.
+ */
+
+static void pt_loop_handle_resolved(const address_t * address, void * data) {
+    pt_deferred_event_t * deferred_event = data;
+
+    deferred_event->num_pending--;
+    pt_loop_flush_deferred_events(deferred_event->loop);
+}
+
+/**
+ * \brief Create a deferred event and queue it.
+ * \param loop The main loop
+ * \param issuer The issuer of the event
+ * \param recipient The recipient of the event
+ * \param event The event
+ * \return The queued pt_deferred_event_t, NULL in case of failure.
+ */
+
+static pt_deferred_event_t * pt_loop_push_deferred_event(
+    pt_loop_t                   * loop,
+    struct algorithm_instance_s * issuer,
+    struct algorithm_instance_s * recipient,
+    event_t                     * event
+) {
+    pt_deferred_event_t * deferred_event;
+
+    if (!(deferred_event = malloc(sizeof(pt_deferred_event_t)))) goto ERR_MALLOC;
+    deferred_event->loop        = loop;
+    deferred_event->issuer      = issuer;
+    deferred_event->recipient   = recipient;
+    deferred_event->event       = event;
+    deferred_event->num_pending = 0;
+    if (!dynarray_push_element(loop->events_deferred, deferred_event)) goto ERR_PUSH;
+    return deferred_event;
+
+ERR_PUSH:
+    free(deferred_event);
+ERR_MALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Give up the DNS lookups and deliver every deferred event: the
+ *    user is waiting for the last events of an interrupted loop.
+ * \param loop The main loop
+ */
+
+static void pt_loop_release_deferred_events(pt_loop_t * loop)
+{
+    size_t i, num_deferred_events = dynarray_get_size(loop->events_deferred);
+
+    if (loop->resolver) resolver_clear(loop->resolver);
+    for (i = 0; i < num_deferred_events; i++) {
+        ((pt_deferred_event_t *) dynarray_get_ith_element(loop->events_deferred, i))->num_pending = 0;
+    }
+    pt_loop_flush_deferred_events(loop);
+}
+
 /**
  * \brief Process every pending user events (e.g. pt_loop_get_num_user_events(loop) events)
  * \param loop The main loop
@@ -140,6 +463,7 @@ static int pt_loop_process_user_events(pt_loop_t * loop) {
     event_t  ** events        = pt_loop_get_user_events(loop);
     size_t      i, num_events = pt_loop_get_num_user_events(loop);
     uint64_t    ret;
+    bool        has_terminated;
 
     for (i = 0; i < num_events; i++) {
         if (read(loop->eventfd_user, &ret, sizeof(ret)) == -1) {
@@ -147,8 +471,18 @@ static int pt_loop_process_user_events(pt_loop_t * loop) {
         }
         // TODO decrement the associated eventfd counter
 
+        // An interrupted instance may notify its termination twice
+        has_terminated = events[i]->type == ALGORITHM_HAS_TERMINATED
+            && events[i]->issuer
+            && !events[i]->issuer->has_terminated;
+        if (has_terminated) events[i]->issuer->has_terminated = true;
+
         // Call user-defined handler and pass the current user event
         loop->handler_user(loop, events[i], loop->user_data);
+
+        if (has_terminated && loop->handler_terminated) {
+            loop->handler_terminated(loop, loop->terminated_data);
+        }
     }
     return 1;
 }
@@ -165,7 +499,284 @@ static void pt_process_algorithms_terminate(const void * node, VISIT visit, int
     algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
 
     // The pt_loop_t must send a TERM event to the current instance
-    pt_throw(NULL, instance, event_create(ALGORITHM_TERM, NULL, NULL, NULL));
+    // (twalk visits the internal nodes three times)
+    if (visit == postorder || visit == leaf) {
+        pt_throw(NULL, instance, event_create(ALGORITHM_TERM, NULL, NULL, NULL));
+    }
+}
+
+/**
+ * \brief Notify the algorithms of a loop that they must terminate and
+ *    ignore the next network events.
+ * \param loop The main loop
+ */
+
+static void pt_loop_process_interrupt(pt_loop_t * loop) {
+    pt_loop_release_deferred_events(loop);
+    pt_instance_iter(loop, pt_process_algorithms_terminate);
+    loop->status = PT_LOOP_INTERRUPTED;
+
+    // An idle daemon has no event left to deliver (see pt_loop_set_control)
+    if (loop->control && !loop->algorithm_instances_root) pt_loop_terminate(loop);
+}
+
+//----------------------------------------------------------------
+// Handlers (see pt_loop_handler_t)
+//----------------------------------------------------------------
+
+// The network queues are drained by network_process_*, and the timers are
+// read once per wake up: none of these handlers has pending events left.
+
+static bool pt_loop_handle_sendq(pt_loop_t * loop, void * network) {
+    if (!network_process_sendq(network, loop->send_budget)) {
+        if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Can't send packet\n");
+    }
+    return false;
+}
+
+static bool pt_loop_handle_recvq(pt_loop_t * loop, void * network) {
+    if (!network_process_recvq(network)) {
+        if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Cannot fetch packet\n");
+    }
+    return false;
+}
+
+static bool pt_loop_handle_pacer(pt_loop_t * loop, void * network) {
+    if (!network_process_paced_probes(network)) {
+        if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Can't send paced packet\n");
+    }
+    return false;
+}
+
+// The instance accounting the most bytes (see pt_loop_find_greediest_instance)
+static __thread algorithm_instance_t * greediest_instance;
+
+/**
+ * \brief Remember the instance accounting the most bytes (see twalk).
+ * \param node The current algorithm_instance_t
+ * \param visit
+ * \param level
+ */
+
+static void pt_loop_find_greediest_instance(const void * node, VISIT visit, int level) {
+    algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
+
+    // twalk visits the internal nodes three times
+    if ((visit == postorder || visit == leaf)
+    &&  (!greediest_instance || memstats_get_num_bytes(instance->memstats) > memstats_get_num_bytes(greediest_instance->memstats))) {
+        greediest_instance = instance;
+    }
+}
+
+/**
+ * \brief Print the objects accounted globally (see memstats.h), and the
+ *    ones of the instance accounting the most bytes.
+ * \param loop The main loop
+ * \param file The output file
+ */
+
+static void pt_loop_dump_memstats(pt_loop_t * loop, FILE * file)
+{
+    memstats_t memstats;
+
+    memstats_get_global(&memstats);
+    fprintf(file, "memory: ");
+    memstats_dump(&memstats, file);
+    fprintf(file, "\n");
+
+    greediest_instance = NULL;
+    pt_instance_iter(loop, pt_loop_find_greediest_instance);
+    if (greediest_instance) {
+        fprintf(file, "memory: greediest instance %u (%s) ", greediest_instance->id, greediest_instance->algorithm->name);
+        memstats_dump(greediest_instance->memstats, file);
+        fprintf(file, "\n");
+    }
+    fflush(file);
+}
+
+static bool pt_loop_handle_stats(pt_loop_t * loop, void * network) {
+    if (!network_process_stats(network)) {
+        if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Can't print network statistics\n");
+    }
+    pt_loop_dump_memstats(loop, stderr);
+    if (loop->profiler) profiler_dump(loop->profiler, stderr);
+    return false;
+}
+
+static bool pt_loop_handle_scheduler(pt_loop_t * loop, void * network) {
+    network_process_scheduled_probe(network);
+    return false;
+}
+
+static bool pt_loop_handle_timeout(pt_loop_t * loop, void * network) {
+    // Timer managing timeout in network layer has expired
+    // At least one probe has expired
+    if (!network_drop_expired_flying_probe(network)) {
+        fprintf(stderr, "Error while processing timeout\n");
+    }
+    return false;
+}
+
+#ifdef USE_IPV4
+static bool pt_loop_handle_icmpv4(pt_loop_t * loop, void * network) {
+    return network_process_sniffer(network, IPPROTO_ICMP);
+}
+#endif
+
+#ifdef USE_IPV6
+static bool pt_loop_handle_icmpv6(pt_loop_t * loop, void * network) {
+    return network_process_sniffer(network, IPPROTO_ICMPV6);
+}
+#endif
+
+#ifdef USE_IPV4
+static bool pt_loop_handle_tcpv4(pt_loop_t * loop, void * network) {
+    return network_process_tcp_sniffer(network, AF_INET);
+}
+#endif
+
+#ifdef USE_IPV6
+static bool pt_loop_handle_tcpv6(pt_loop_t * loop, void * network) {
+    return network_process_tcp_sniffer(network, AF_INET6);
+}
+#endif
+
+static bool pt_loop_handle_simulator(pt_loop_t * loop, void * network) {
+    if (!network_process_simulator(network)) {
+        fprintf(stderr, "Error while processing simulated replies\n");
+    }
+    return false;
+}
+
+static bool pt_loop_handle_demux(pt_loop_t * loop, void * network) {
+    if (!network_process_demux(network)) {
+        fprintf(stderr, "Error while processing demultiplexed replies\n");
+    }
+    return false;
+}
+
+static bool pt_loop_handle_resolver(pt_loop_t * loop, void * resolver) {
+    if (!resolver_process_answers(resolver)) {
+        fprintf(stderr, "pt_loop: Can't process DNS answers\n");
+    }
+    return false;
+}
+
+static bool pt_loop_handle_resolver_timeout(pt_loop_t * loop, void * resolver) {
+    if (!resolver_process_timeouts(resolver)) {
+        fprintf(stderr, "pt_loop: Can't process DNS timeouts\n");
+    }
+    return false;
+}
+
+/**
+ * \brief Retrieve the resolver of a loop, created by the first reverse
+ *    DNS lookup: a measurement which resolves nothing (e.g. -n) neither
+ *    reads resolv.conf nor opens its socket.
+ * \param loop The main loop.
+ * \return The resolver, NULL if unavailable. Without resolver, the events
+ *    are raised at once and the lookups are performed by address_resolv
+ *    and whois_get_asn.
+ */
+
+static resolver_t * pt_loop_get_resolver(pt_loop_t * loop)
+{
+    if (!loop->has_resolver) {
+        loop->has_resolver = true;
+        if ((loop->resolver = resolver_create())) {
+            if (!register_efd(loop, resolver_get_sockfd(loop->resolver), "resolver", pt_loop_handle_resolver, loop->resolver, false, PT_LOOP_PRIORITY_DEFAULT)
+            ||  !register_efd(loop, resolver_get_timerfd(loop->resolver), "resolver_timeout", pt_loop_handle_resolver_timeout, loop->resolver, false, PT_LOOP_PRIORITY_DEFAULT)) {
+                // Closing its file descriptors unregisters them
+                resolver_free(loop->resolver);
+                loop->resolver = NULL;
+            }
+        }
+    }
+    return loop->resolver;
+}
+
+static bool pt_loop_handle_lookups(pt_loop_t * loop, void * lookups) {
+    if (!lookup_pool_process(lookups)) {
+        fprintf(stderr, "pt_loop: Can't process lookups\n");
+    }
+    return false;
+}
+
+static bool pt_loop_handle_metrics(pt_loop_t * loop, void * metrics) {
+    return metrics_process(metrics);
+}
+
+static bool pt_loop_handle_control(pt_loop_t * loop, void * control) {
+    return control_process(control);
+}
+
+static bool pt_loop_handle_algorithm(pt_loop_t * loop, void * unused) {
+    // Only the instances having pending events are visited
+    // (see pt_throw), they are listed in the ready list.
+    pt_process_instances(loop);
+    return false;
+}
+
+static bool pt_loop_handle_user(pt_loop_t * loop, void * unused) {
+    // Throw this event to the user-defined handler
+    pt_loop_process_user_events(loop);
+
+    // Flush the queue
+    pt_loop_clear_user_events(loop);
+    return false;
+}
+
+static bool pt_loop_handle_signal(pt_loop_t * loop, void * unused) {
+    pt_loop_t             * shard;
+    int                     signo;
+#ifdef USE_KQUEUE
+    struct kevent           event;
+    const struct timespec   no_wait = {0, 0};
+    int                     n;
+
+    // Handling signals (ctrl-c, etc.)
+    if ((n = kevent(loop->sfd, NULL, 0, &event, 1, &no_wait)) != 1) {
+        if (n == -1 && errno != EINTR) perror("kevent");
+        return false;
+    }
+    signo = event.ident;
+#else
+    struct signalfd_siginfo fdsi;
+
+    // Handling signals (ctrl-c, etc.)
+    if (read(loop->sfd, &fdsi, sizeof(struct signalfd_siginfo)) != sizeof(struct signalfd_siginfo)) {
+        if (errno != EAGAIN) perror("read");
+        return false;
+    }
+    signo = fdsi.ssi_signo;
+#endif
+
+    if (signo == SIGINT || signo == SIGQUIT) {
+        pt_loop_release_deferred_events(loop);
+        pt_instance_iter(loop, pt_process_algorithms_terminate);
+    } else {
+        perror("Read unexpected signal\n");
+    }
+    loop->status = PT_LOOP_INTERRUPTED;
+    if (loop->control && !loop->algorithm_instances_root) pt_loop_terminate(loop);
+
+    // The signal is only read by one shard, which forwards it.
+    for (shard = loop->next_shard; shard && shard != loop; shard = shard->next_shard) {
+        pt_loop_interrupt(shard);
+    }
+    return false;
+}
+
+static bool pt_loop_handle_terminate(pt_loop_t * loop, void * unused) {
+    uint64_t value;
+
+    // Interrupted by another thread (see pt_loop_interrupt)
+    if (read(loop->eventfd_terminate, &value, sizeof(value)) == -1) {
+        if (errno != EAGAIN) perror("read");
+        return false;
+    }
+    pt_loop_process_interrupt(loop);
+    return false;
 }
 
 //----------------------------------------------------------------
@@ -179,39 +790,73 @@ pt_loop_t * pt_loop_create(void (*handler_user)(pt_loop_t *, event_t *, void *),
     if (!(loop = malloc(sizeof(pt_loop_t)))) goto ERR_MALLOC;
     loop->handler_user = handler_user;
 
-    // Prepare epoll file descriptor
+    // Prepare io_uring, epoll or kqueue file descriptor
+    loop->efd = -1;
+    loop->num_handlers = 0;
+    loop->profiler = NULL;
+#ifdef USE_IO_URING
+    if (!(loop->uring = uring_create(URING_ENTRIES)))
+#endif
+#ifdef USE_KQUEUE
+    if ((loop->efd = kqueue()) == -1) {
+        perror("Error kqueue");
+        goto ERR_EPOLL;
+    }
+#else
     if ((loop->efd = epoll_create1(0)) == -1) {
         perror("Error epoll_create1");
         goto ERR_EPOLL;
     }
+#endif
 
     // Prepare algorithm events fd and register it in loop->efd
     if ((loop->eventfd_algorithm = make_event_fd()) == -1) goto ERR_MAKE_EVENTFD_ALGORITHM;
-    if (!register_efd(loop, loop->eventfd_algorithm))      goto ERR_EVENTFD_ALGORITHM;
+    if (!register_efd(loop, loop->eventfd_algorithm, "algorithm", pt_loop_handle_algorithm, NULL, false, PT_LOOP_PRIORITY_DEFAULT)) goto ERR_EVENTFD_ALGORITHM;
 
     // Prepare user events fd and register it in loop->efd
     if ((loop->eventfd_user = make_event_fd()) == -1)      goto ERR_MAKE_EVENTFD_USER;
-    if (!register_efd(loop, loop->eventfd_user))           goto ERR_EVENTFD_USER;
+    if (!register_efd(loop, loop->eventfd_user, "user", pt_loop_handle_user, NULL, false, PT_LOOP_PRIORITY_DEFAULT))           goto ERR_EVENTFD_USER;
+
+    // Prepare interruption fd and register it in loop->efd
+    if ((loop->eventfd_terminate = make_event_fd()) == -1) goto ERR_MAKE_EVENTFD_TERMINATE;
+    if (!register_efd(loop, loop->eventfd_terminate, "terminate", pt_loop_handle_terminate, NULL, true, PT_LOOP_PRIORITY_DEFAULT))  goto ERR_EVENTFD_TERMINATE;
 
     // Signal processing
     if ((loop->sfd = make_signal_fd()) == -1)              goto ERR_MAKE_SIGNALFD;
-    if (!register_efd(loop, loop->sfd))                    goto ERR_SIGNALFD;
+    if (!register_efd(loop, loop->sfd, "signal", pt_loop_handle_signal, NULL, true, PT_LOOP_PRIORITY_DEFAULT))                   goto ERR_SIGNALFD;
 
     // Prepare network layer and register it in pt_loop
     if (!(loop->network = network_create()))                           goto ERR_NETWORK_CREATE;
-    if (!register_efd(loop, network_get_sendq_fd(loop->network)))      goto ERR_EVENTFD_SENDQ;
-    if (!register_efd(loop, network_get_recvq_fd(loop->network)))      goto ERR_EVENTFD_RECVQ;
+    if (!register_efd(loop, network_get_sendq_fd(loop->network), "sendq", pt_loop_handle_sendq, loop->network, true, PT_LOOP_PRIORITY_SEND))          goto ERR_EVENTFD_SENDQ;
+    if (!register_efd(loop, network_get_recvq_fd(loop->network), "recvq", pt_loop_handle_recvq, loop->network, true, PT_LOOP_PRIORITY_RECEIVE))          goto ERR_EVENTFD_RECVQ;
+    if (network_is_simulated(loop->network)) {
+        if (!register_efd(loop, network_get_simulator_fd(loop->network), "simulator", pt_loop_handle_simulator, loop->network, true, PT_LOOP_PRIORITY_RECEIVE)) goto ERR_EVENTFD_SIMULATOR;
+    } else if (network_is_demultiplexed(loop->network)) {
+        if (!register_efd(loop, network_get_demux_fd(loop->network), "demux", pt_loop_handle_demux, loop->network, true, PT_LOOP_PRIORITY_RECEIVE)) goto ERR_EVENTFD_DEMUX;
+    } else {
+#ifdef USE_IPV4
+        if (!register_efd(loop, network_get_icmpv4_sockfd(loop->network), "icmpv4", pt_loop_handle_icmpv4, loop->network, true, PT_LOOP_PRIORITY_RECEIVE))    goto ERR_EVENTFD_SNIFFER_ICMPV4;
+#endif
+#ifdef USE_IPV6
+        if (!register_efd(loop, network_get_icmpv6_sockfd(loop->network), "icmpv6", pt_loop_handle_icmpv6, loop->network, true, PT_LOOP_PRIORITY_RECEIVE))    goto ERR_EVENTFD_SNIFFER_ICMPV6;
+#endif
+        // The TCP segments are only sniffed with --seq-tags
 #ifdef USE_IPV4
-    if (!register_efd(loop, network_get_icmpv4_sockfd(loop->network))) goto ERR_EVENTFD_SNIFFER_ICMPV4;
+        if (network_get_tcpv4_sockfd(loop->network) != -1
+        &&  !register_efd(loop, network_get_tcpv4_sockfd(loop->network), "tcpv4", pt_loop_handle_tcpv4, loop->network, true, PT_LOOP_PRIORITY_RECEIVE))      goto ERR_EVENTFD_SNIFFER_TCPV4;
 #endif
 #ifdef USE_IPV6
-    if (!register_efd(loop, network_get_icmpv6_sockfd(loop->network))) goto ERR_EVENTFD_SNIFFER_ICMPV6;
+        if (network_get_tcpv6_sockfd(loop->network) != -1
+        &&  !register_efd(loop, network_get_tcpv6_sockfd(loop->network), "tcpv6", pt_loop_handle_tcpv6, loop->network, true, PT_LOOP_PRIORITY_RECEIVE))      goto ERR_EVENTFD_SNIFFER_TCPV6;
 #endif
-    if (!register_efd(loop, network_get_timerfd(loop->network)))       goto ERR_EVENTFD_TIMEOUT;
-    if (!register_efd(loop, network_get_group_timerfd(loop->network))) goto ERR_EVENTFD_GROUP;
+    }
+    if (!register_efd(loop, network_get_timerfd(loop->network), "timeout", pt_loop_handle_timeout, loop->network, true, PT_LOOP_PRIORITY_DEFAULT))         goto ERR_EVENTFD_TIMEOUT;
+    if (!register_efd(loop, network_get_pacer_fd(loop->network), "pacer", pt_loop_handle_pacer, loop->network, true, PT_LOOP_PRIORITY_SEND))          goto ERR_EVENTFD_PACER;
+    if (!register_efd(loop, network_get_stats_fd(loop->network), "stats", pt_loop_handle_stats, loop->network, true, PT_LOOP_PRIORITY_DEFAULT))          goto ERR_EVENTFD_STATS;
+    if (!register_efd(loop, network_get_group_timerfd(loop->network), "scheduler", pt_loop_handle_scheduler, loop->network, true, PT_LOOP_PRIORITY_SEND)) goto ERR_EVENTFD_GROUP;
 
     // Buffer where pending events are stored
-    if (!(loop->epoll_events = calloc(MAXEVENTS, sizeof(struct epoll_event)))) {
+    if (!(loop->events_pending = calloc(MAXEVENTS, sizeof(pt_loop_event_t)))) {
         goto ERR_EVENTS;
     }
 
@@ -219,25 +864,60 @@ pt_loop_t * pt_loop_create(void (*handler_user)(pt_loop_t *, event_t *, void *),
         goto ERR_EVENTS_USER;
     }
 
+    if (!(loop->events_deferred = dynarray_create())) {
+        goto ERR_EVENTS_DEFERRED;
+    }
+
+    // Reverse DNS lookups are prepared once needed (see pt_loop_get_resolver)
+    loop->resolver = NULL;
+    loop->has_resolver = false;
+    loop->lookups = NULL;
+    loop->metrics = NULL;
+    loop->control = NULL;
     loop->user_data = user_data;
     loop->status = PT_LOOP_CONTINUE;
     loop->next_algorithm_id = 1; // 0 means unaffected ?
     loop->cur_instance = NULL;
     loop->algorithm_instances_root = NULL;
+    loop->first_ready_instance = NULL;
+    loop->last_ready_instance = NULL;
+    loop->is_direct_dispatch = options_network_get_direct_dispatch();
+    loop->is_handling = false;
+    loop->is_processing_instances = false;
+    loop->send_budget = 0;
+    loop->next_shard = NULL;
+    loop->handler_terminated = NULL;
+    loop->terminated_data = NULL;
+
+    if (options_network_get_profile() && !pt_loop_set_profiler(loop)) {
+        fprintf(stderr, "Can't profile the loop\n");
+    }
 
     return loop;
 
+ERR_EVENTS_DEFERRED:
+    dynarray_free(loop->events_user, NULL);
 ERR_EVENTS_USER:
-    free(loop->epoll_events);
+    free(loop->events_pending);
 ERR_EVENTS:
 ERR_EVENTFD_GROUP:
+ERR_EVENTFD_STATS:
+ERR_EVENTFD_PACER:
 ERR_EVENTFD_TIMEOUT:
+#ifdef USE_IPV6
+ERR_EVENTFD_SNIFFER_TCPV6:
+#endif
+#ifdef USE_IPV4
+ERR_EVENTFD_SNIFFER_TCPV4:
+#endif
 #ifdef USE_IPV4
 ERR_EVENTFD_SNIFFER_ICMPV4:
 #endif
 #ifdef USE_IPV6
 ERR_EVENTFD_SNIFFER_ICMPV6:
 #endif
+ERR_EVENTFD_DEMUX:
+ERR_EVENTFD_SIMULATOR:
 ERR_EVENTFD_RECVQ:
 ERR_EVENTFD_SENDQ:
     network_free(loop->network);
@@ -245,12 +925,18 @@ ERR_NETWORK_CREATE:
 ERR_SIGNALFD:
     close(loop->sfd);
 ERR_MAKE_SIGNALFD:
+ERR_EVENTFD_TERMINATE:
+    close(loop->eventfd_terminate);
+ERR_MAKE_EVENTFD_TERMINATE:
     close(loop->eventfd_user);
 ERR_EVENTFD_USER:
     close(loop->eventfd_algorithm);
 ERR_MAKE_EVENTFD_USER:
 ERR_EVENTFD_ALGORITHM:
-    close(loop->efd);
+    if (loop->efd != -1) close(loop->efd);
+#ifdef USE_IO_URING
+    uring_free(loop->uring);
+#endif
 ERR_MAKE_EVENTFD_ALGORITHM:
 ERR_EPOLL:
     free(loop);
@@ -261,13 +947,30 @@ ERR_MALLOC:
 void pt_loop_free(pt_loop_t * loop)
 {
     if (loop) {
+        // Closing its file descriptor unregisters it
+        lookup_pool_free(loop->lookups);
+        metrics_free(loop->metrics);
+        control_free(loop->control);
+        if (loop->profiler) {
+            profiler_dump(loop->profiler, stderr);
+            profiler_free(loop->profiler);
+        }
         if (loop->events_user)  dynarray_free(loop->events_user, (ELEMENT_FREE) event_free);
-        if (loop->epoll_events) free(loop->epoll_events);
+        resolver_free(loop->resolver);
+        if (loop->events_deferred) {
+            pt_loop_cancel_deferred_events(loop, NULL);
+            dynarray_free(loop->events_deferred, free);
+        }
+        if (loop->events_pending) free(loop->events_pending);
         network_free(loop->network);
         close(loop->sfd);
+        close(loop->eventfd_terminate);
         close(loop->eventfd_user);
         close(loop->eventfd_algorithm);
-        close(loop->efd);
+        if (loop->efd != -1) close(loop->efd);
+#ifdef USE_IO_URING
+        uring_free(loop->uring);
+#endif
 
         // Events are cleared while destroying algorithm instances
         pt_instance_iter(loop, pt_free_instance);
@@ -287,131 +990,285 @@ inline size_t pt_loop_get_num_user_events(pt_loop_t * loop) {
     return loop->events_user->size;
 }
 
-int pt_loop(pt_loop_t *loop, unsigned int timeout)
-{
-    int n, i, cur_fd;
+/**
+ * \brief Dispatch the events returned by pt_loop_wait to the network
+ *    layer, the algorithms and the user.
+ * \param loop The main loop.
+ * \param n The number of events stored in loop->events_pending.
+ */
 
-    // TODO set a flag to avoid issues due to several threads
-    // and put a critical section to manage this flag
+/**
+ * \brief Call the handler of a file descriptor. The replies are read by
+ *    batches until none is left, or up to PT_LOOP_RECEIVE_ROUNDS batches.
+ * \param loop The main loop.
+ * \param handler The handler.
+ * \return true iif some events may still be pending.
+ */
 
-    int network_sendq_fd      = network_get_sendq_fd(loop->network);
-    int network_recvq_fd      = network_get_recvq_fd(loop->network);
-#ifdef USE_IPV4
-    int network_icmpv4_sockfd = network_get_icmpv4_sockfd(loop->network);
-#endif
-#ifdef USE_IPV6
-    int network_icmpv6_sockfd = network_get_icmpv6_sockfd(loop->network);
-#endif
-    int network_timerfd       = network_get_timerfd(loop->network);
-    int network_group_timerfd = network_get_group_timerfd(loop->network);
-    ssize_t s;
-    struct signalfd_siginfo fdsi;
+static bool pt_loop_call_handler(pt_loop_t * loop, pt_loop_handler_t * handler)
+{
+    bool     is_pending;
+    size_t   num_rounds = 0;
+    uint64_t start = 0;
 
+    if (handler->profile) start = get_time_ns();
+    loop->is_handling = true;
     do {
-        /* Wait for events */
-        n = epoll_wait(loop->efd, loop->epoll_events, MAXEVENTS, -1);
-
-        /* XXX What kind of events do we have
-         * - sockets (packets received, timeouts, etc.)
-         * - internal queues where probes and packets are stored
-         * - ...
-         */
-        // Dispatch events
+        is_pending = handler->callback(loop, handler->context);
+        num_rounds++;
+#ifdef USE_EPOLLET
+    // An edge-triggered fd is not notified again until it is drained
+    } while (is_pending && !(loop->status == PT_LOOP_INTERRUPTED && handler->is_interruptible));
+#else
+    } while (is_pending
+        && handler->priority == PT_LOOP_PRIORITY_RECEIVE
+        && num_rounds < PT_LOOP_RECEIVE_ROUNDS
+        && !(loop->status == PT_LOOP_INTERRUPTED && handler->is_interruptible));
+#endif
+    loop->is_handling = false;
+    if (handler->profile) profiler_entry_add(handler->profile, get_time_ns() - start);
+
+    // The events raised by this handler have not been notified
+    if (loop->is_direct_dispatch && loop->first_ready_instance && loop->status != PT_LOOP_TERMINATE) {
+        pt_dispatch_instances(loop);
+    }
+    return is_pending;
+}
+
+/**
+ * \brief Compute how many probes may be popped from the sendq once the
+ *    replies have been read: the more replies are still waiting, the
+ *    fewer probes are sent before reading them.
+ * \param loop The main loop.
+ * \param num_pending_receivers The number of file descriptors of
+ *    replies which still had some replies left.
+ * \return The maximum number of probes, 0 if unlimited.
+ */
+
+static size_t pt_loop_get_send_budget(const pt_loop_t * loop, size_t num_pending_receivers)
+{
+    size_t num_batches = num_pending_receivers
+        + (queue_get_size(loop->network->recvq) + NETWORK_RECV_BATCH_SIZE - 1) / NETWORK_RECV_BATCH_SIZE;
+
+    return num_batches ?
+        MAX(PT_LOOP_SEND_BUDGET / (1 + num_batches), NETWORK_SEND_BATCH_SIZE) :
+        0;
+}
+
+static void pt_loop_dispatch(pt_loop_t * loop, int n)
+{
+    pt_loop_handler_t  * handler;
+    pt_loop_priority_t   priority;
+    size_t               num_pending_receivers = 0;
+    int                  i;
+
+    // The handlers are called by order of priority (see pt_loop_priority_t)
+    for (priority = 0; priority < PT_LOOP_NUM_PRIORITIES; priority++) {
+        if (priority == PT_LOOP_PRIORITY_SEND) {
+            loop->send_budget = pt_loop_get_send_budget(loop, num_pending_receivers);
+        }
+
+        // Each event refers to the handler of its file descriptor
         for (i = 0; i < n; i++) {
-            // cur_fd has been activated, so we have to manage
-            // the corresponding event.
-            cur_fd = loop->epoll_events[i].data.fd;
+            handler = pt_loop_event_get_handler(&loop->events_pending[i]);
+            if (handler->priority != priority) continue;
 
             // Handle errors on fds
-            if ((loop->epoll_events[i].events & EPOLLERR)
-            ||  (loop->epoll_events[i].events & EPOLLHUP)
-            || !(loop->epoll_events[i].events & EPOLLIN)
-            ) {
+            if (!pt_loop_event_is_readable(&loop->events_pending[i])) {
                 // An error has occured on this fd
                 perror("epoll error");
-                close(cur_fd);
+                close(handler->fd);
                 continue;
             }
 
-            if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_sendq_fd) {
-                if (!network_process_sendq(loop->network)) {
-                    if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Can't send packet\n");
-                }
-            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_recvq_fd) {
-                if (!network_process_recvq(loop->network)) {
-                    if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Cannot fetch packet\n");
-                }
-            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_group_timerfd) {
-                 //printf("pt_loop processing scheduled probes\n");
-                network_process_scheduled_probe(loop->network);
-#ifdef USE_IPV4
-            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_icmpv4_sockfd) {
-                network_process_sniffer(loop->network, IPPROTO_ICMP);
-#endif
-#ifdef USE_IPV6
-            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_icmpv6_sockfd) {
-                network_process_sniffer(loop->network, IPPROTO_ICMPV6);
-#endif
-            } else if (cur_fd == loop->eventfd_algorithm) {
-
-                // There is one common queue shared by every instancied algorithms.
-                // We call pt_process_algorithms_iter() to find for which instance
-                // the event has been raised. Then we process this event thanks
-                // to pt_process_algorithms_instance() that calls the handler.
-                pt_instance_iter(loop, pt_process_instance);
+            // Once interrupted, the loop only processes the pending
+            // algorithm and user events.
+            if (loop->status == PT_LOOP_INTERRUPTED && handler->is_interruptible) continue;
 
-            } else if (cur_fd == loop->eventfd_user) {
+            if (pt_loop_call_handler(loop, handler) && priority == PT_LOOP_PRIORITY_RECEIVE) {
+                num_pending_receivers++;
+            }
+        }
+    }
+}
 
-                // Throw this event to the user-defined handler
-                pt_loop_process_user_events(loop);
+int pt_loop_step(pt_loop_t * loop, size_t max_events, int timeout_ms)
+{
+    int      n;
+    uint64_t start = 0, woken = 0;
 
-                // Flush the queue
-                pt_loop_clear_user_events(loop);
+    // A pt_loop_t is not thread-safe: it must be run by a single thread.
+    // To use several cores, run a pt_loop_t per thread (see pt_shards.h).
 
-            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == loop->sfd) {
+    if (max_events == 0 || max_events > MAXEVENTS) max_events = MAXEVENTS;
 
-                // Handling signals (ctrl-c, etc.)
-                s = read(loop->sfd, &fdsi, sizeof(struct signalfd_siginfo));
-                if (s != sizeof(struct signalfd_siginfo)) {
-                    perror("read");
-                    continue;
-                }
+    if (loop->status == PT_LOOP_CONTINUE || loop->status == PT_LOOP_INTERRUPTED) {
+        if (loop->profiler) start = get_time_ns();
+        if ((n = pt_loop_wait(loop, max_events, timeout_ms)) == -1) return -1;
+        if (loop->profiler) woken = get_time_ns();
+        pt_loop_dispatch(loop, n);
+        if (loop->profiler) profiler_add_iteration(loop->profiler, n, woken - start, get_time_ns() - woken);
+    }
 
-                if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGQUIT) {
-                    pt_instance_iter(loop, pt_process_algorithms_terminate);
-                } else {
-                    perror("Read unexpected signal\n");
-                }
-                loop->status = PT_LOOP_INTERRUPTED;
-                break;
+    return loop->status == PT_LOOP_TERMINATE ? 0 : 1;
+}
 
-            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_timerfd) {
+inline int pt_loop_get_fd(const pt_loop_t * loop) {
+    return loop->efd;
+}
 
-                // Timer managing timeout in network layer has expired
-                // At least one probe has expired
-                if (!network_drop_expired_flying_probe(loop->network)) {
-                    fprintf(stderr, "Error while processing timeout\n");
-                }
-            }
+int pt_loop(pt_loop_t * loop, unsigned int timeout)
+{
+    struct timespec now, deadline;
+    int             ret, timeout_ms = timeout ? (int) timeout * 1000 : -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
+
+    // The loop may have been terminated before being run (see pt_shards_run)
+    while ((ret = pt_loop_step(loop, MAXEVENTS, timeout_ms)) > 0) {
+        if (timeout) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if (timeout_ms <= 0) break;
         }
-    } while (loop->status == PT_LOOP_CONTINUE || loop->status == PT_LOOP_INTERRUPTED);
+    }
 
-    // Process internal events
-    return loop->status == PT_LOOP_TERMINATE ? 0 : -1;
+    return ret;
 }
 
 bool pt_send_probe(pt_loop_t * loop, probe_t * probe) {
     // Annotate which algorithm has generated this probe
     probe_set_caller(probe, loop->cur_instance);
+    probe_set_memstats(probe, loop->cur_instance ? loop->cur_instance->memstats : NULL);
 
     // Tagging is achieved by network layer
     return network_send_probe(loop->network, probe);
 }
 
+bool pt_send_probes(pt_loop_t * loop, probe_t ** probes, size_t num_probes) {
+    size_t i;
+
+    for (i = 0; i < num_probes; i++) {
+        probe_set_caller(probes[i], loop->cur_instance);
+        probe_set_memstats(probes[i], loop->cur_instance ? loop->cur_instance->memstats : NULL);
+    }
+    return network_submit_probes(loop->network, probes, num_probes);
+}
+
+size_t pt_get_send_credits(pt_loop_t * loop) {
+    return network_get_num_credits(loop->network);
+}
+
+bool pt_wait_send_credits(pt_loop_t * loop) {
+    return loop->cur_instance && network_wait_credits(loop->network, loop->cur_instance);
+}
+
+bool pt_set_send_share(pt_loop_t * loop, size_t weight, double pps) {
+    return loop->cur_instance && network_set_caller_share(loop->network, loop->cur_instance, weight, pps);
+}
+
 void pt_loop_terminate(pt_loop_t * loop) {
     loop->status = PT_LOOP_TERMINATE;
 }
 
+void pt_loop_set_direct_dispatch(pt_loop_t * loop, bool is_direct_dispatch) {
+    loop->is_direct_dispatch = is_direct_dispatch;
+}
+
+bool pt_loop_set_metrics(pt_loop_t * loop, const char * address)
+{
+    metrics_t * metrics;
+
+    if (loop->metrics) return false;
+    if (!(metrics = metrics_create(address)))                                                 goto ERR_METRICS_CREATE;
+    if (!metrics_add_source(metrics, network_write_metrics, loop->network))                   goto ERR_ADD_SOURCE;
+    if (!metrics_add_source(metrics, memstats_write_metrics, NULL))                           goto ERR_ADD_SOURCE;
+    if (loop->profiler
+    && !metrics_add_source(metrics, profiler_write_metrics, loop->profiler))                  goto ERR_ADD_SOURCE;
+
+    // The requests are served even once the loop is interrupted
+    if (!register_efd(loop, metrics_get_fd(metrics), "metrics", pt_loop_handle_metrics, metrics, false, PT_LOOP_PRIORITY_DEFAULT)) goto ERR_REGISTER_EFD;
+    loop->metrics = metrics;
+    return true;
+
+ERR_REGISTER_EFD:
+ERR_ADD_SOURCE:
+    metrics_free(metrics);
+ERR_METRICS_CREATE:
+    return false;
+}
+
+bool pt_loop_set_lookups(pt_loop_t * loop, size_t max_threads)
+{
+    lookup_pool_t * lookups;
+
+    if (loop->lookups) return false;
+    if (!(lookups = lookup_pool_create(max_threads)))                                         goto ERR_LOOKUP_POOL_CREATE;
+
+    // The lookups are delivered even once the loop is interrupted, so that
+    // their callers can release them
+    if (!register_efd(loop, lookup_pool_get_fd(lookups), "lookups", pt_loop_handle_lookups, lookups, false, PT_LOOP_PRIORITY_DEFAULT)) goto ERR_REGISTER_EFD;
+    loop->lookups = lookups;
+    return true;
+
+ERR_REGISTER_EFD:
+    lookup_pool_free(lookups);
+ERR_LOOKUP_POOL_CREATE:
+    return false;
+}
+
+bool pt_loop_lookup(pt_loop_t * loop, int family, const char * hostname, lookup_callback_t callback, void * data) {
+    return loop->lookups
+        && lookup_pool_resolve(loop->lookups, family, hostname, callback, data);
+}
+
+bool pt_loop_set_control(pt_loop_t * loop, const char * path, const char * format_name, control_callback_t callback, void * data)
+{
+    control_t * control;
+
+    if (loop->control) return false;
+    if (!(control = control_create(path, format_name, callback, data)))                       goto ERR_CONTROL_CREATE;
+
+    // No request is accepted once the loop is interrupted
+    if (!register_efd(loop, control_get_fd(control), "control", pt_loop_handle_control, control, true, PT_LOOP_PRIORITY_DEFAULT)) goto ERR_REGISTER_EFD;
+    loop->control = control;
+    return true;
+
+ERR_REGISTER_EFD:
+    control_free(control);
+ERR_CONTROL_CREATE:
+    return false;
+}
+
+bool pt_loop_set_profiler(pt_loop_t * loop)
+{
+    profiler_t * profiler;
+    size_t       i;
+
+    if (loop->profiler) return true;
+    if (!(profiler = profiler_create()))                                                      goto ERR_PROFILER_CREATE;
+    if (loop->metrics
+    && !metrics_add_source(loop->metrics, profiler_write_metrics, profiler))                  goto ERR_ADD_SOURCE;
+
+    for (i = 0; i < loop->num_handlers; i++) {
+        loop->handlers[i].profile = profiler_get_entry(profiler, PROFILER_FD, loop->handlers[i].name);
+    }
+    loop->profiler = profiler;
+    return true;
+
+ERR_ADD_SOURCE:
+    profiler_free(profiler);
+ERR_PROFILER_CREATE:
+    return false;
+}
+
+bool pt_loop_interrupt(pt_loop_t * loop) {
+    uint64_t one = 1;
+
+    return write(loop->eventfd_terminate, &one, sizeof(one)) == sizeof(one);
+}
+
 bool pt_raise_event(pt_loop_t * loop, event_t * event) {
     return pt_raise_impl(loop, ALGORITHM_EVENT, event);
 }
@@ -423,3 +1280,87 @@ bool pt_raise_error(pt_loop_t * loop) {
 bool pt_raise_terminated(pt_loop_t * loop) {
     return pt_raise_impl(loop, ALGORITHM_HAS_TERMINATED, NULL);
 }
+
+results_t * pt_get_results(pt_loop_t * loop) {
+    algorithm_instance_t * instance = loop->cur_instance;
+
+    if (!instance) return NULL;
+    if (!instance->outputs) instance->outputs = results_create();
+    return instance->outputs;
+}
+
+bool pt_raise_event_resolved(pt_loop_t * loop, event_t * event, const address_t * address, int lookups) {
+    pt_deferred_event_t * deferred_event;
+    event_t             * algorithm_event;
+
+    // Skip the lookups already cached
+    if (address) {
+        if ((lookups & PT_LOOKUP_HOSTNAME) && address_is_cached(address))  lookups &= ~PT_LOOKUP_HOSTNAME;
+        if ((lookups & PT_LOOKUP_ASN)      && whois_is_asn_cached(address)) lookups &= ~PT_LOOKUP_ASN;
+    }
+
+    // Once interrupted, the user only waits for the last events
+    if (!address
+    ||  !lookups
+    ||  loop->status != PT_LOOP_CONTINUE
+    ||  !pt_loop_get_resolver(loop)) {
+        return pt_raise_event(loop, event);
+    }
+
+    if (!(algorithm_event = event_create(ALGORITHM_EVENT, event, loop->cur_instance, (ELEMENT_FREE) event_free))) {
+        goto ERR_EVENT_CREATE;
+    }
+
+    if (!(deferred_event = pt_loop_push_deferred_event(loop, loop->cur_instance, loop->cur_instance->caller, algorithm_event))) {
+        goto ERR_PUSH_DEFERRED_EVENT;
+    }
+
+    // A lookup which is not in flight has been cached (see /etc/hosts),
+    // or will be performed by the caller (see address_resolv).
+    if ((lookups & PT_LOOKUP_HOSTNAME)
+    &&  resolver_resolve(loop->resolver, address, RESOLVER_HOSTNAME, pt_loop_handle_resolved, deferred_event)) {
+        deferred_event->num_pending++;
+    }
+    if ((lookups & PT_LOOKUP_ASN)
+    &&  resolver_resolve(loop->resolver, address, RESOLVER_ASN, pt_loop_handle_resolved, deferred_event)) {
+        deferred_event->num_pending++;
+    }
+    if (!deferred_event->num_pending) pt_loop_flush_deferred_events(loop);
+    return true;
+
+ERR_PUSH_DEFERRED_EVENT:
+    event_free(algorithm_event);
+ERR_EVENT_CREATE:
+    return false;
+}
+
+bool pt_loop_defer_event(pt_loop_t * loop, struct algorithm_instance_s * recipient, event_t * event)
+{
+    size_t i, num_deferred_events;
+
+    if (!loop || !(num_deferred_events = dynarray_get_size(loop->events_deferred))) return false;
+
+    for (i = 0; i < num_deferred_events; i++) {
+        if (pt_deferred_event_precedes(dynarray_get_ith_element(loop->events_deferred, i), event->issuer, recipient)) {
+            return pt_loop_push_deferred_event(loop, event->issuer, recipient, event) != NULL;
+        }
+    }
+    return false;
+}
+
+void pt_loop_cancel_deferred_events(pt_loop_t * loop, struct algorithm_instance_s * instance)
+{
+    pt_deferred_event_t * deferred_event;
+    size_t                i, num_deferred_events = dynarray_get_size(loop->events_deferred);
+
+    // The pending ones are released once their lookup is over
+    for (i = 0; i < num_deferred_events; i++) {
+        deferred_event = dynarray_get_ith_element(loop->events_deferred, i);
+        if (deferred_event->event
+        && (!instance || deferred_event->issuer == instance || deferred_event->recipient == instance)) {
+            event_free(deferred_event->event);
+            deferred_event->event = NULL;
+        }
+    }
+    pt_loop_flush_deferred_events(loop);
+}
@@ -15,13 +15,28 @@
  *      see libparistraceroute/algorithms/
  */
 
-#include <sys/epoll.h>
+#include "use.h"
+
+#ifdef USE_KQUEUE
+#    include <sys/event.h>
+#else
+#    include <sys/epoll.h>
+#endif
 #include <sys/eventfd.h>
 
 // Do not include "algorithm.h" to avoid mutual inclusion
 #include "probe.h"
 #include "network.h"
 #include "event.h"
+#include "resolver.h"
+#include "lookup_pool.h"
+#include "metrics.h"
+#include "control.h"
+#include "profiler.h"
+#include "results.h"
+#ifdef USE_IO_URING
+#    include "uring.h"
+#endif
 
 typedef enum pt_loop_status_e {
     PT_LOOP_CONTINUE,    /**< Process and wait for next events */
@@ -29,6 +44,77 @@ typedef enum pt_loop_status_e {
     PT_LOOP_INTERRUPTED  /**< Abrupt interruption (ctrl c): process last pending events, ignore new events. */
 } pt_loop_status_t;
 
+struct pt_loop_s;
+
+// An event returned by the epoll (or kqueue) instance of a loop.
+#ifdef USE_KQUEUE
+typedef struct kevent pt_loop_event_t;
+#else
+typedef struct epoll_event pt_loop_event_t;
+#endif
+
+// Maximum number of file descriptors watched by a pt_loop_t.
+#define PT_LOOP_MAX_HANDLERS 16
+
+// Maximum number of batches of replies read from a socket before the
+// probes are sent, within an iteration (see pt_loop_dispatch).
+#define PT_LOOP_RECEIVE_ROUNDS 8
+
+// Maximum number of probes popped from the sendq within an iteration
+// while some replies are still waiting. It is divided by 1 + the number
+// of batches of replies waiting (see pt_loop_get_send_budget).
+#define PT_LOOP_SEND_BUDGET 1024
+
+/**
+ * \enum pt_loop_priority_t
+ * \brief When the events of a file descriptor are processed within an
+ *    iteration of a pt_loop_t. The replies are read before the timeouts
+ *    are processed and before further probes are sent, so that they do
+ *    not wait behind the probes (which would inflate their RTT, or make
+ *    them expire).
+ */
+
+typedef enum {
+    PT_LOOP_PRIORITY_RECEIVE, /**< The replies (sniffers, recvq, simulator) */
+    PT_LOOP_PRIORITY_DEFAULT, /**< The timeouts, the algorithms, the user... */
+    PT_LOOP_PRIORITY_SEND,    /**< The probes (sendq, pacer, scheduler) */
+    PT_LOOP_NUM_PRIORITIES
+} pt_loop_priority_t;
+
+/**
+ * \struct pt_loop_handler_t
+ * \brief A file descriptor watched by a pt_loop_t and the function
+ *    processing its events. The epoll (kqueue or io_uring) event directly
+ *    refers to its handler, so that pt_loop does not compare the fd of each
+ *    event to every watched file descriptor.
+ */
+
+typedef struct pt_loop_handler_s {
+    int    fd;                                          /**< The watched file descriptor */
+    const char * name;                                  /**< The name of fd (see profiler.h) */
+    bool (*callback)(struct pt_loop_s *, void *);       /**< Process the events of fd. Returns true iif some events
+                                                             may still be pending (see USE_EPOLLET) */
+    void * context;                                     /**< Passed to callback */
+    bool   is_interruptible;                            /**< True iif these events are ignored once the loop is interrupted */
+    pt_loop_priority_t priority;                        /**< When these events are processed within an iteration */
+    profiler_entry_t * profile;                         /**< The calls to callback, NULL unless the loop is profiled */
+} pt_loop_handler_t;
+
+/**
+ * \struct pt_deferred_event_t
+ * \brief An event waiting for some lookups (see pt_raise_event_resolved),
+ *    or following such an event: the events thrown by an instance to a
+ *    recipient are delivered in order.
+ */
+
+typedef struct {
+    struct pt_loop_s            * loop;        /**< The main loop */
+    struct algorithm_instance_s * recipient;   /**< The instance receiving the event, NULL for the user */
+    struct algorithm_instance_s * issuer;      /**< The instance which has raised the event */
+    event_t                     * event;       /**< The event, NULL if it has been cancelled */
+    size_t                        num_pending; /**< Number of lookups in flight */
+} pt_deferred_event_t;
+
 typedef struct pt_loop_s {
     // Network
     network_t                   * network;                  /**< The network layer */
@@ -36,11 +122,16 @@ typedef struct pt_loop_s {
     // Algorithms
     void                        * algorithm_instances_root;
     unsigned int                  next_algorithm_id;
-    int                           eventfd_algorithm;
+    int                           eventfd_algorithm;        /**< Notified when the ready list becomes non-empty */
+    struct algorithm_instance_s * first_ready_instance;     /**< Head of the instances having pending events (see pt_throw) */
+    struct algorithm_instance_s * last_ready_instance;      /**< Tail of the instances having pending events */
+    bool                          is_direct_dispatch;       /**< The events raised by a handler are dispatched once it returns (see pt_loop_set_direct_dispatch) */
+    bool                          is_handling;              /**< True while a handler is running (see pt_loop_dispatch) */
+    bool                          is_processing_instances;  /**< True while the ready list is processed (see pt_dispatch_instances) */
 
     // User
     int                           eventfd_user;             /**< User notification */
-    int                           eventfd_terminate;        /**< This eventfd_terminate is set when the pt_loop_t must break */
+    int                           eventfd_terminate;        /**< Notified when the pt_loop_t must be interrupted (see pt_loop_interrupt) */
     dynarray_t                  * events_user;              /**< User events queue (events raised from the library to a program */
 
     void (*handler_user)(
@@ -51,15 +142,44 @@ typedef struct pt_loop_s {
                                                                  raised an event for a program. */
     void                        * user_data;                /**< Data shared by the all algorithms running thanks to this pt_loop. */
 
+    // DNS
+    resolver_t                  * resolver;                 /**< Asynchronous reverse DNS lookups, NULL if unavailable or not needed yet */
+    bool                          has_resolver;             /**< True once the creation of resolver has been attempted (see pt_loop_get_resolver) */
+    lookup_pool_t               * lookups;                  /**< Resolves hostnames concurrently (see pt_loop_set_lookups), NULL if disabled */
+    dynarray_t                  * events_deferred;          /**< The pt_deferred_event_t, in the order they have been thrown */
+
+    // Metrics
+    metrics_t                   * metrics;                  /**< Exports metrics over HTTP (see pt_loop_set_metrics), NULL if disabled */
+    profiler_t                  * profiler;                 /**< Profiles the dispatch of the events (see pt_loop_set_profiler), NULL if disabled */
+
+    // Daemon
+    control_t                   * control;                  /**< Accepts measurement requests (see pt_loop_set_control), NULL if disabled */
+
     pt_loop_status_t              status;                   /**< State of the loop. See pt_loop_status_t for further details. */
 
     // Signal data
-    int                           sfd;                      // signalfd
+    int                           sfd;                      // signalfd (kqueue watching the signals if USE_KQUEUE)
+
+    size_t                        send_budget;              /**< Maximum number of probes popped from the sendq by the current iteration, 0 if unlimited */
 
     // Epoll data
-    int                           efd;
-    struct epoll_event          * epoll_events;
+    int                           efd;                      /**< epoll (kqueue if USE_KQUEUE) instance, -1 if loop->uring is used */
+    pt_loop_event_t             * events_pending;           /**< Pending events */
+    pt_loop_handler_t             handlers[PT_LOOP_MAX_HANDLERS]; /**< The watched file descriptors */
+    size_t                        num_handlers;             /**< Number of watched file descriptors */
+#ifdef USE_IO_URING
+    uring_t                     * uring;                    /**< io_uring instance, NULL if loop->efd is used */
+#endif
     struct algorithm_instance_s * cur_instance;
+
+    // Sharding
+    struct pt_loop_s            * next_shard;               /**< Next loop of the same pt_shards_t (they form a ring), NULL if not sharded */
+    void (*handler_terminated)(
+        struct pt_loop_s *,
+        void             *
+    );                                                      /**< Called once the user has been notified that an instance
+                                                                 has terminated (see pt_shards.h), NULL if unused */
+    void                        * terminated_data;          /**< Data passed to handler_terminated */
 } pt_loop_t;
 
 /**
@@ -94,7 +214,8 @@ void pt_loop_free(pt_loop_t * loop);
  * Example: See libparistraceroute/paris-traceroute/paris-traceroute.c.
  *
  * \param loop The libparistraceroute loop 
- * \param timeout The interval of time during 
+ * \param timeout The interval of time during which events are processed
+ *    (in seconds), 0 to process events until the loop is terminated.
  * \return The loop status. This is the min value among the values returned
  *    by the handlers called during the interval.
  *
@@ -105,6 +226,32 @@ void pt_loop_free(pt_loop_t * loop);
 
 int pt_loop(pt_loop_t * loop, unsigned int timeout);
 
+/**
+ * \brief Wait (at most once) for the next events and dispatch them. This
+ *    allows to drive a loop from an existing event loop (see pt_loop_get_fd),
+ *    or to drive several loops from the same thread.
+ * \param loop The libparistraceroute loop
+ * \param max_events The maximum number of events dispatched, 0 for the default.
+ * \param timeout_ms The maximum waiting time (in milliseconds), -1 to wait
+ *    until an event occurs, 0 to only dispatch the pending events.
+ * \return The loop status (see pt_loop): 0 if the loop is terminated,
+ *    > 0 if it must be stepped again, < 0 in case of failure.
+ */
+
+int pt_loop_step(pt_loop_t * loop, size_t max_events, int timeout_ms);
+
+/**
+ * \brief Retrieve the file descriptor which becomes readable whenever the
+ *    loop has pending events, e.g. to watch it with the epoll, poll or
+ *    select loop of a program, and call pt_loop_step(loop, 0, 0) once it
+ *    is readable.
+ * \param loop The libparistraceroute loop
+ * \return The epoll (or kqueue) file descriptor of the loop, -1 if the
+ *    loop relies on io_uring (see USE_IO_URING).
+ */
+
+int pt_loop_get_fd(const pt_loop_t * loop);
+
 /**
  * \brief Retrieve the user events stored in the user queue.
  * \param loop The libparistraceroute loop.
@@ -125,7 +272,9 @@ size_t pt_loop_get_num_user_events(pt_loop_t * loop);
 /**
  * \brief Send a probe packet across a network
  * \param network Pointer to the network to use
- * \param probe Pointer to the probe to use
+ * \param probe Pointer to the probe to use. If successful, the reference
+ *    of the caller is handed to the network layer, which hands it to the
+ *    PROBE_REPLY or PROBE_TIMEOUT event (see network.h).
  * \param callback Function pointer to a callback function
  *     (Does not appear to be used currently)
  * \return true iif successful 
@@ -133,6 +282,53 @@ size_t pt_loop_get_num_user_events(pt_loop_t * loop);
 
 bool pt_send_probe(pt_loop_t * loop, probe_t * probe);
 
+/**
+ * \brief Send a batch of probe packets across a network (e.g. probes
+ *    stamped by probe_skel_stamp). The best effort probes are queued
+ *    at once, so the network layer is woken up only once.
+ * \param loop The main loop
+ * \param probes The probes to send. The network layer holds all of them,
+ *    even in case of failure (see network_submit_probes).
+ * \param num_probes The number of probes
+ * \return true iif successful
+ */
+
+bool pt_send_probes(pt_loop_t * loop, probe_t ** probes, size_t num_probes);
+
+/**
+ * \brief Retrieve the number of probes the current instance may still
+ *    send without exceeding the window of the network layer (see
+ *    network_get_num_credits).
+ * \param loop The main loop
+ * \return The number of credits, SIZE_MAX if the window is unlimited.
+ */
+
+size_t pt_get_send_credits(pt_loop_t * loop);
+
+/**
+ * \brief Ask the network layer to pass a NETWORK_READY event to the
+ *    current instance once some probes may be sent again (see
+ *    network_wait_credits). An instance running out of credits may
+ *    thus generate its next probes lazily.
+ * \param loop The main loop
+ * \return true iif successful
+ */
+
+bool pt_wait_send_credits(pt_loop_t * loop);
+
+/**
+ * \brief Set the share of the probes sent by the current instance when
+ *    the network layer holds probes of several instances (see
+ *    network_set_caller_share).
+ * \param loop The main loop
+ * \param weight The weight of the current instance (>= 1, 1 by default).
+ * \param pps The maximum rate of the current instance (in probes per
+ *    second), 0 if unlimited.
+ * \return true iif successful
+ */
+
+bool pt_set_send_share(pt_loop_t * loop, size_t weight, double pps);
+
 /**
  * \brief Stop the main loop. It is usually used to break the pt_loop call in the main program.
  * \param loop The main loop
@@ -140,6 +336,97 @@ bool pt_send_probe(pt_loop_t * loop, probe_t * probe);
 
 void pt_loop_terminate(pt_loop_t * loop);
 
+/**
+ * \brief Export the metrics of a loop over HTTP (see metrics.h). The
+ *    statistics of its network layer and the memory used by each
+ *    subsystem (see memstats.h) are exported; further sources may be
+ *    added thanks to metrics_add_source(loop->metrics, ...).
+ * \param loop The main loop
+ * \param address The address the HTTP server listens to (see metrics_create).
+ * \return true iif successful
+ */
+
+bool pt_loop_set_metrics(pt_loop_t * loop, const char * address);
+
+/**
+ * \brief Resolve the hostnames passed to pt_loop_lookup concurrently, on
+ *    a pool of threads (see lookup_pool.h).
+ * \param loop The main loop
+ * \param max_threads The maximum number of hostnames resolved
+ *    simultaneously.
+ * \return true iif successful
+ */
+
+bool pt_loop_set_lookups(pt_loop_t * loop, size_t max_threads);
+
+/**
+ * \brief Resolve a hostname without blocking the loop. Requires
+ *    pt_loop_set_lookups.
+ * \param loop The main loop
+ * \param family The address family (AF_INET, AF_INET6 or AF_UNSPEC to
+ *    guess it).
+ * \param hostname The hostname.
+ * \param callback Called by the loop once the lookup is over, even if the
+ *    loop has been interrupted meanwhile (see lookup_callback_t).
+ * \param data Passed to callback.
+ * \return true iif the lookup is in progress.
+ */
+
+bool pt_loop_lookup(pt_loop_t * loop, int family, const char * hostname, lookup_callback_t callback, void * data);
+
+/**
+ * \brief Accept measurement requests over a UNIX socket (see control.h),
+ *    so that the loop runs as a daemon: it is only terminated by the user
+ *    (see pt_loop_terminate), or once it is interrupted and no algorithm
+ *    instance is left. No request is accepted once it is interrupted.
+ * \param loop The main loop
+ * \param path The path of the UNIX socket.
+ * \param format_name The format of the results sent to the clients (see
+ *    output_create).
+ * \param callback Processes the requests (see control_create).
+ * \param data Passed to callback.
+ * \return true iif successful
+ */
+
+bool pt_loop_set_control(pt_loop_t * loop, const char * path, const char * format_name, control_callback_t callback, void * data);
+
+/**
+ * \brief Profile the dispatch of the events by a loop (see profiler.h).
+ *    The profile is printed on the standard error along with the
+ *    statistics of the network layer (see network_set_stats_interval)
+ *    and once the loop is released, and it is exported with the metrics
+ *    of the loop (see pt_loop_set_metrics).
+ * \param loop The main loop
+ * \return true iif successful
+ */
+
+bool pt_loop_set_profiler(pt_loop_t * loop);
+
+/**
+ * \brief Dispatch the events raised by a handler of a loop (e.g. the
+ *    replies matched by the network layer) to the instances as soon as
+ *    this handler returns, instead of notifying loop->eventfd_algorithm
+ *    and dispatching them on the next wake up. This saves an eventfd
+ *    write, a read and an epoll cycle per batch of replies. The events
+ *    raised while the instances are processed are still dispatched in
+ *    order, by the same pass over the ready list.
+ * \param loop The main loop
+ * \param is_direct_dispatch Pass true to enable the direct dispatch.
+ */
+
+void pt_loop_set_direct_dispatch(pt_loop_t * loop, bool is_direct_dispatch);
+
+/**
+ * \brief Interrupt a loop as if it had received SIGINT: the running
+ *    instances receive an ALGORITHM_TERM event and the next events are
+ *    ignored. Unlike the other pt_loop_* functions, it may be called
+ *    from any thread (e.g. by a loop to interrupt the other shards).
+ * \param loop The main loop
+ * \return true iif successful
+ */
+
+bool pt_loop_interrupt(pt_loop_t * loop);
+
 /**
  * \brief (Used by algorithm) Notify pt_loop that the algorithm has raised a algorithm specific event.
  * \param loop The main loop
@@ -165,4 +452,53 @@ bool pt_raise_error(pt_loop_t * loop);
 
 bool pt_raise_terminated(pt_loop_t * loop);
 
+/**
+ * \brief (Used by algorithm) Retrieve the results of the current instance
+ *    (see algorithm_instance_t::outputs), which are created on demand.
+ * \param loop The main loop
+ * \return The results, NULL in case of failure.
+ */
+
+results_t * pt_get_results(pt_loop_t * loop);
+
+// Lookups performed by pt_raise_event_resolved
+#define PT_LOOKUP_HOSTNAME (1 << 0) /**< See address_resolv */
+#define PT_LOOKUP_ASN      (1 << 1) /**< See whois_get_asn */
+
+/**
+ * \brief Raise an event for the caller once the hostname and/or the
+ *    origin AS of an address are cached (see resolver.h), e.g. because
+ *    the caller prints them while handling this event. The events raised
+ *    meanwhile by this instance for its caller are delivered after this one.
+ * \param loop The main loop
+ * \param event The event
+ * \param address The address to look up, NULL to raise the event at once
+ *    (see pt_raise_event)
+ * \param lookups A combination of PT_LOOKUP_* flags, 0 to raise the event
+ *    at once
+ * \return true iif successful
+ */
+
+bool pt_raise_event_resolved(pt_loop_t * loop, event_t * event, const address_t * address, int lookups);
+
+/**
+ * \brief Queue an event after the deferred events having the same issuer
+ *    and recipient, if any (internal usage, see pt_throw).
+ * \param loop The main loop, NULL if unknown
+ * \param recipient The instance receiving the event, NULL for the user
+ * \param event The event
+ * \return true iif the event has been queued
+ */
+
+bool pt_loop_defer_event(pt_loop_t * loop, struct algorithm_instance_s * recipient, event_t * event);
+
+/**
+ * \brief Discard the deferred events issued or received by an instance
+ *    (internal usage, see pt_stop_instance).
+ * \param loop The main loop
+ * \param instance The instance
+ */
+
+void pt_loop_cancel_deferred_events(pt_loop_t * loop, struct algorithm_instance_s * instance);
+
 #endif
@@ -0,0 +1,321 @@
+#include "use.h"
+#include "config.h"
+
+#include <stdio.h>      // fprintf
+#include <stdlib.h>     // calloc, free
+#include <unistd.h>     // sysconf
+#ifdef USE_CPU_AFFINITY
+#  include <sched.h>    // cpu_set_t, CPU_*
+#endif
+#include <pthread.h>    // pthread_*
+
+#include "hugemem.h"    // hugemem_*
+#include "pt_shards.h"
+
+/**
+ * \struct pt_shards_request_t
+ * \brief An algorithm instance which has not been started yet.
+ */
+
+typedef struct pt_shards_request_s {
+    const char                 * name;       /**< Name of the algorithm */
+    void                       * options;    /**< Options of the instance */
+    probe_t                    * probe_skel; /**< Probe skeleton of the instance */
+    address_t                    dst;        /**< Destination of the instance */
+    struct pt_shards_request_s * prev;       /**< Older request of the same shard */
+    struct pt_shards_request_s * next;       /**< Newer request of the same shard */
+} pt_shards_request_t;
+
+/**
+ * \brief (Internal usage) Remove a request from the queue of a shard.
+ *    The mutex of the pt_shards_t must be held.
+ * \param shard A pt_shard_t instance.
+ * \param request A request queued in this shard.
+ */
+
+static void pt_shard_del_request(pt_shard_t * shard, pt_shards_request_t * request) {
+    if (request->prev) request->prev->next = request->next;
+    else               shard->first_pending = request->next;
+    if (request->next) request->next->prev = request->prev;
+    else               shard->last_pending = request->prev;
+    --shard->num_pending;
+}
+
+/**
+ * \brief (Internal usage) Fetch the next instance to be started by a shard:
+ *    its oldest queued instance, otherwise the newest instance queued
+ *    by the shard having the most queued instances.
+ * \param shard A pt_shard_t instance.
+ * \param can_steal Pass false to only fetch the instances of this shard.
+ * \return The corresponding request, NULL if there is no instance left.
+ */
+
+static pt_shards_request_t * pt_shard_next_request(pt_shard_t * shard, bool can_steal) {
+    pt_shards_t         * shards = shard->shards;
+    pt_shard_t          * victim = shard;
+    pt_shards_request_t * request;
+    size_t                i;
+
+    pthread_mutex_lock(&shards->mutex);
+    if (!shard->first_pending && can_steal) {
+        for (i = 0; i < shards->num_shards; i++) {
+            if (shards->shards[i].num_pending > victim->num_pending) {
+                victim = &shards->shards[i];
+            }
+        }
+    }
+    if ((request = victim == shard ? shard->first_pending : victim->last_pending)) {
+        pt_shard_del_request(victim, request);
+    }
+    pthread_mutex_unlock(&shards->mutex);
+    return request;
+}
+
+/**
+ * \brief (Internal usage) Start instances in a shard until it runs
+ *    shards->max_running instances. The loop is terminated once it
+ *    has no instance left.
+ * \param shard A pt_shard_t instance.
+ * \param can_steal Pass false to only start the instances of this shard.
+ */
+
+static void pt_shard_schedule(pt_shard_t * shard, bool can_steal) {
+    pt_shards_request_t * request;
+
+    while (shard->loop->status == PT_LOOP_CONTINUE
+        && shard->num_running < shard->shards->max_running
+        && (request = pt_shard_next_request(shard, can_steal))
+    ) {
+        // The replies of a stolen destination are delivered to its
+        // original shard, unless this network accepts them too.
+        if (!network_accept_destination(shard->loop->network, &request->dst)
+        ||  !pt_add_instance(shard->loop, request->name, request->options, request->probe_skel)
+        ) {
+            fprintf(stderr, "pt_shard_schedule: cannot start a %s instance\n", request->name);
+        } else {
+            ++shard->num_running;
+        }
+        free(request);
+    }
+
+    if (can_steal && !shard->num_running) {
+        pt_loop_terminate(shard->loop);
+    }
+}
+
+/**
+ * \brief (Internal usage) Called by a loop once an instance has terminated
+ *    (see pt_loop_t::handler_terminated).
+ * \param loop The loop of the shard.
+ * \param pshard Address of the pt_shard_t instance.
+ */
+
+static void pt_shard_handler_terminated(pt_loop_t * loop, void * pshard) {
+    pt_shard_t * shard = pshard;
+
+    --shard->num_running;
+    pt_shard_schedule(shard, true);
+}
+
+/**
+ * \brief (Internal usage) Run the loop of a shard.
+ * \param pshard Address of the pt_shard_t instance.
+ * \return NULL
+ */
+
+static void * pt_shard_run(void * pshard) {
+    pt_shard_t * shard = pshard;
+
+    if (shard->node >= 0 && !hugemem_set_node(shard->node)) {
+        fprintf(stderr, "pt_shard_run: cannot allocate the memory of cpu %zu on node %d\n", shard->cpu, shard->node);
+    }
+    shard->ret = pt_loop(shard->loop, 0);
+    return NULL;
+}
+
+pt_shards_t * pt_shards_create(
+    size_t num_shards,
+    void (*handler_user)(pt_loop_t *, event_t *, void *),
+    void * user_data
+) {
+    pt_shards_t * shards;
+    long          num_cpus;
+    size_t        i;
+
+    if (!num_shards) goto ERR_INVALID_PARAMETER;
+    if (!(shards = calloc(1, sizeof(pt_shards_t)))) goto ERR_MALLOC;
+    if (!(shards->shards = calloc(num_shards, sizeof(pt_shard_t)))) goto ERR_SHARDS;
+    shards->max_running = PT_SHARDS_MAX_RUNNING;
+    pthread_mutex_init(&shards->mutex, NULL);
+
+    if ((num_cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1) num_cpus = 1;
+
+    // The loops are created by the calling thread, so that every thread
+    // inherits the signals blocked by pt_loop_create. The memory of each
+    // loop (its tables, its rings...) is allocated on the NUMA node of
+    // the core of its shard. A single shard is run by the calling thread,
+    // which is not pinned.
+    for (i = 0; i < num_shards; i++, shards->num_shards++) {
+        shards->shards[i].cpu  = i % num_cpus;
+        shards->shards[i].node = num_shards > 1 ? hugemem_get_cpu_node(shards->shards[i].cpu) : -1;
+        if (shards->shards[i].node >= 0) hugemem_set_node(shards->shards[i].node);
+        shards->shards[i].loop = pt_loop_create(handler_user, user_data);
+        if (shards->shards[i].node >= 0) hugemem_set_node(-1);
+        if (!shards->shards[i].loop) {
+            goto ERR_PT_LOOP_CREATE;
+        }
+        if (num_shards > 1 && !network_set_shard(shards->shards[i].loop->network, i, num_shards)) {
+            pt_loop_free(shards->shards[i].loop);
+            goto ERR_NETWORK_SET_SHARD;
+        }
+        shards->shards[i].loop->handler_terminated = pt_shard_handler_terminated;
+        shards->shards[i].loop->terminated_data = &shards->shards[i];
+        shards->shards[i].shards = shards;
+    }
+
+    // Link the loops in a ring, so that each of them may interrupt the others.
+    if (num_shards > 1) {
+        for (i = 0; i < num_shards; i++) {
+            shards->shards[i].loop->next_shard = shards->shards[(i + 1) % num_shards].loop;
+        }
+    }
+
+    return shards;
+
+ERR_NETWORK_SET_SHARD:
+ERR_PT_LOOP_CREATE:
+    pt_shards_free(shards);
+    return NULL;
+ERR_SHARDS:
+    free(shards);
+ERR_MALLOC:
+ERR_INVALID_PARAMETER:
+    return NULL;
+}
+
+void pt_shards_free(pt_shards_t * shards) {
+    pt_shards_request_t * request;
+    size_t                i;
+
+    if (shards) {
+        for (i = 0; i < shards->num_shards; i++) {
+            while ((request = shards->shards[i].first_pending)) {
+                pt_shard_del_request(&shards->shards[i], request);
+                free(request);
+            }
+            pt_loop_free(shards->shards[i].loop);
+        }
+        pthread_mutex_destroy(&shards->mutex);
+        free(shards->shards);
+        free(shards);
+    }
+}
+
+inline size_t pt_shards_get_num_shards(const pt_shards_t * shards) {
+    return shards->num_shards;
+}
+
+inline pt_loop_t * pt_shards_get_shard_loop(pt_shards_t * shards, size_t shard) {
+    return shards->shards[shard].loop;
+}
+
+pt_loop_t * pt_shards_get_loop(pt_shards_t * shards, const address_t * dst) {
+    return shards->num_shards == 1 ?
+        shards->shards[0].loop :
+        shards->shards[network_get_destination_shard(dst, shards->num_shards)].loop;
+}
+
+void pt_shards_set_max_running(pt_shards_t * shards, size_t max_running) {
+    shards->max_running = max_running ? max_running : 1;
+}
+
+bool pt_shards_add_instance(
+    pt_shards_t     * shards,
+    const char      * name,
+    void            * options,
+    probe_t         * probe_skel,
+    const address_t * dst
+) {
+    pt_shards_request_t * request;
+    pt_shard_t          * shard;
+
+    if (!(request = malloc(sizeof(pt_shards_request_t)))) return false;
+    request->name       = name;
+    request->options    = options;
+    request->probe_skel = probe_skel;
+    request->dst        = *dst;
+    request->next       = NULL;
+
+    shard = shards->num_shards == 1 ?
+        &shards->shards[0] :
+        &shards->shards[network_get_destination_shard(dst, shards->num_shards)];
+
+    pthread_mutex_lock(&shards->mutex);
+    request->prev = shard->last_pending;
+    if (shard->last_pending) shard->last_pending->next = request;
+    else                     shard->first_pending = request;
+    shard->last_pending = request;
+    ++shard->num_pending;
+    pthread_mutex_unlock(&shards->mutex);
+    return true;
+}
+
+int pt_shards_run(pt_shards_t * shards) {
+    pthread_attr_t attr;
+#ifdef USE_CPU_AFFINITY
+    cpu_set_t      cpus;
+#endif
+    size_t         i, num_started;
+    int            ret = 1;
+
+    // Start the first instances of each shard, then let the idle shards
+    // steal. A shard having no instance to run is terminated right away.
+    for (i = 0; i < shards->num_shards; i++) {
+        pt_shard_schedule(&shards->shards[i], false);
+    }
+    for (i = 0; i < shards->num_shards; i++) {
+        pt_shard_schedule(&shards->shards[i], true);
+    }
+
+    // A single shard is run by the calling thread
+    if (shards->num_shards == 1) {
+        return pt_loop(shards->shards[0].loop, 0);
+    }
+
+    for (num_started = 0; num_started < shards->num_shards; num_started++) {
+        pt_shard_t * shard = &shards->shards[num_started];
+
+        if (pthread_attr_init(&attr) != 0) goto ERR_PTHREAD_ATTR_INIT;
+#ifdef USE_CPU_AFFINITY
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->cpu, &cpus);
+        if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus) != 0) {
+            fprintf(stderr, "pt_shards_run: cannot pin shard %zu to cpu %zu\n", num_started, shard->cpu);
+        }
+#endif
+        if (pthread_create(&shard->thread, &attr, pt_shard_run, shard) != 0) {
+            pthread_attr_destroy(&attr);
+            goto ERR_PTHREAD_CREATE;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    for (i = 0; i < shards->num_shards; i++) {
+        pthread_join(shards->shards[i].thread, NULL);
+        if (shards->shards[i].ret < ret) ret = shards->shards[i].ret;
+    }
+    return ret;
+
+ERR_PTHREAD_CREATE:
+ERR_PTHREAD_ATTR_INIT:
+    perror("pt_shards_run");
+
+    // Stop the shards already started
+    for (i = 0; i < num_started; i++) {
+        pt_loop_interrupt(shards->shards[i].loop);
+    }
+    for (i = 0; i < num_started; i++) {
+        pthread_join(shards->shards[i].thread, NULL);
+    }
+    return -1;
+}
@@ -0,0 +1,160 @@
+#ifndef PT_SHARDS_H
+#define PT_SHARDS_H
+
+/**
+ * \file pt_shards.h
+ * \brief Run several pt_loop_t instances in parallel, one per thread.
+ *
+ * A pt_loop_t and its network_t are not thread-safe, so a single loop
+ * only uses a single core. A pt_shards_t splits the destinations into
+ * shards (see network_get_destination_shard) and runs a pt_loop_t per
+ * shard, each of them in its own thread pinned to a core. Each loop owns
+ * its network_t (sockets, sniffer, flying probes...), and the kernel only
+ * passes to its sniffer the replies related to its shard (see
+ * network_set_shard), so the loops never share any state.
+ *
+ * The algorithm instances are queued in the shard of their destination
+ * (see pt_shards_add_instance), and each shard only runs a bounded number
+ * of them at once. Once a shard has no queued instance left, it steals
+ * the instances queued by the busiest shard, and then also receives the
+ * replies related to their destinations (see network_accept_destination).
+ * Hence the shards remain busy even if some destinations require much
+ * more probes than the others.
+ *
+ * - The algorithm instances must be added before calling pt_shards_run.
+ * - The user handler is called by the thread running the loop which raised
+ *   the event: it must be thread-safe. It must not call pt_loop_terminate:
+ *   a loop terminates once it has no instance left to run or to steal.
+ * - SIGINT and SIGQUIT interrupt every shard.
+ * - The memory of each shard comes from the NUMA node of its core (see
+ *   hugemem_set_node), so that the shards do not contend for the memory
+ *   of a single socket.
+ */
+
+#include <stddef.h>     // size_t
+#include <pthread.h>    // pthread_t, pthread_mutex_t
+
+#include "pt_loop.h"    // pt_loop_t
+#include "algorithm.h"  // algorithm_instance_t
+#include "address.h"    // address_t
+
+// Default maximum number of instances run at once by a shard.
+#define PT_SHARDS_MAX_RUNNING 16
+
+/**
+ * \struct pt_shard_t
+ * \brief A pt_loop_t, the thread running it and the instances it has not
+ *    started yet.
+ */
+
+typedef struct {
+    pt_loop_t                  * loop;          /**< The loop of this shard */
+    pthread_t                    thread;        /**< The thread running this loop */
+    size_t                       cpu;           /**< The core to which this thread is pinned */
+    int                          node;          /**< The NUMA node of this core, from which the memory of this shard is allocated (-1 if none) */
+    int                          ret;           /**< The value returned by pt_loop */
+    struct pt_shards_request_s * first_pending; /**< Oldest instance not started yet (protected by the mutex of the pt_shards_t) */
+    struct pt_shards_request_s * last_pending;  /**< Newest instance not started yet, stolen first (idem) */
+    size_t                       num_pending;   /**< Number of instances not started yet (idem) */
+    size_t                       num_running;   /**< Number of instances started and not terminated yet */
+    struct pt_shards_s         * shards;        /**< The pt_shards_t owning this shard */
+} pt_shard_t;
+
+/**
+ * \struct pt_shards_t
+ * \brief A set of pt_loop_t, each of them run by its own thread.
+ */
+
+typedef struct pt_shards_s {
+    size_t          num_shards;  /**< Number of shards */
+    pt_shard_t    * shards;      /**< The shards */
+    size_t          max_running; /**< Maximum number of instances run at once by a shard */
+    pthread_mutex_t mutex;       /**< Protects the instances not started yet */
+} pt_shards_t;
+
+/**
+ * \brief Create a pt_shards_t instance.
+ * \param num_shards The number of shards (e.g. the number of cores).
+ * \param handler_user The user handler passed to each loop (see pt_loop_create).
+ * \param user_data The data passed to each loop (see pt_loop_create).
+ * \return The newly created pt_shards_t instance, NULL in case of failure.
+ */
+
+pt_shards_t * pt_shards_create(
+    size_t num_shards,
+    void (*handler_user)(pt_loop_t *, event_t *, void *),
+    void * user_data
+);
+
+/**
+ * \brief Release a pt_shards_t instance and its loops from the memory.
+ * \param shards A pt_shards_t instance (which is not running).
+ */
+
+void pt_shards_free(pt_shards_t * shards);
+
+/**
+ * \brief Retrieve the number of shards.
+ * \param shards A pt_shards_t instance.
+ * \return The number of shards.
+ */
+
+size_t pt_shards_get_num_shards(const pt_shards_t * shards);
+
+/**
+ * \brief Retrieve the loop of a shard.
+ * \param shards A pt_shards_t instance.
+ * \param shard The shard, in [0, pt_shards_get_num_shards(shards) - 1].
+ * \return The corresponding loop.
+ */
+
+pt_loop_t * pt_shards_get_shard_loop(pt_shards_t * shards, size_t shard);
+
+/**
+ * \brief Retrieve the loop in charge of a destination (unless it is stolen).
+ * \param shards A pt_shards_t instance.
+ * \param dst The destination.
+ * \return The corresponding loop.
+ */
+
+pt_loop_t * pt_shards_get_loop(pt_shards_t * shards, const address_t * dst);
+
+/**
+ * \brief Set the maximum number of instances run at once by each shard.
+ *    The lower it is, the more instances remain available for stealing.
+ * \param shards A pt_shards_t instance (which is not running).
+ * \param max_running The maximum number of instances (at least 1).
+ */
+
+void pt_shards_set_max_running(pt_shards_t * shards, size_t max_running);
+
+/**
+ * \brief Queue a new algorithm instance in the shard in charge of a
+ *    destination. It is started by pt_shards_run (see pt_add_instance).
+ * \param shards A pt_shards_t instance.
+ * \param name Name of the corresponding algorithm (for instance 'traceroute').
+ * \param options Options passed to this instance. They must remain valid
+ *    until pt_shards_run returns.
+ * \param probe_skel Probe skeleton of this instance (see pt_add_instance).
+ * \param dst The destination probed by this instance.
+ * \return true iif successful
+ */
+
+bool pt_shards_add_instance(
+    pt_shards_t     * shards,
+    const char      * name,
+    void            * options,
+    probe_t         * probe_skel,
+    const address_t * dst
+);
+
+/**
+ * \brief Run each loop in its own thread until every instance has terminated.
+ * \param shards A pt_shards_t instance.
+ * \return The min value returned by pt_loop among the shards (see pt_loop),
+ *    -1 if a thread cannot be started.
+ */
+
+int pt_shards_run(pt_shards_t * shards);
+
+#endif
@@ -1,8 +1,10 @@
 #include "config.h"
 
-#include <errno.h>
-#include <stdlib.h>
-#include <unistd.h>
+#include <errno.h>   // errno
+#include <stdio.h>   // perror
+#include <stdint.h>  // intptr_t
+#include <stdlib.h>  // malloc, posix_memalign
+#include <unistd.h>  // close
 
 #include "queue.h"
 
@@ -10,23 +12,33 @@ queue_t * queue_create()
 {
     queue_t * queue;
 
-    // Alloc queue
-    if (!(queue = malloc(sizeof(queue_t)))) {
+    // Alloc queue. It must be aligned so that push_pos and pop_pos are
+    // stored in distinct cache lines.
+    if (posix_memalign((void **) &queue, QUEUE_CACHE_LINE, sizeof(queue_t)) != 0) {
         goto ERR_QUEUE;
     }
 
-    // Create an eventfd
-    if ((queue->eventfd = eventfd(0, EFD_SEMAPHORE)) == -1) {
+    // Create an eventfd. Its counter is not a semaphore: it is non-zero
+    // iif the queue may store elements, and is reset by the consumer
+    // whenever it drains the queue.
+    if ((queue->eventfd = eventfd(0, EFD_NONBLOCK)) == -1) {
         goto ERR_EVENTFD;
     }
 
-    // Create the list that will contain the elements
-    if (!(queue->elements = list_create())) {
-        goto ERR_ELEMENTS;
+    // Create the ring that will contain the elements. The sequences are
+    // stored relative to the index of their cell (see queue_cell_t), so
+    // that a zeroed ring is ready to use: its pages are only touched (and
+    // allocated by the kernel) once the queue grows that much.
+    if (!(queue->cells = calloc(QUEUE_CAPACITY, sizeof(queue_cell_t)))) {
+        goto ERR_CELLS;
     }
+
+    queue->mask = QUEUE_CAPACITY - 1;
+    atomic_init(&queue->push_pos, 0);
+    atomic_init(&queue->pop_pos, 0);
     return queue;
 
-ERR_ELEMENTS:
+ERR_CELLS:
     close(queue->eventfd);
 ERR_EVENTFD:
     free(queue);
@@ -34,10 +46,100 @@ ERR_QUEUE:
     return NULL;
 }
 
+/**
+ * \brief Retrieve the first position of the lap of the ring containing a
+ *    position. The sequence of a cell is stored relative to its index, so
+ *    it is compared with the lap of the position instead of the position
+ *    itself.
+ * \param queue A queue_t instance.
+ * \param pos A position in the ring.
+ * \return The position of the first cell of this lap.
+ */
+
+static inline size_t queue_get_lap(const queue_t * queue, size_t pos) {
+    return pos & ~queue->mask;
+}
+
+/**
+ * \brief Store an element in the ring of a queue, without notifying
+ *    the consumer.
+ * \param queue A queue_t instance.
+ * \param element The pushed element.
+ * \return true iif successful, false if the queue is full.
+ */
+
+static bool queue_ring_push(queue_t * queue, void * element)
+{
+    queue_cell_t * cell;
+    size_t         pos, sequence;
+    intptr_t       diff;
+
+    pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+    for (;;) {
+        cell     = &queue->cells[pos & queue->mask];
+        sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        diff     = (intptr_t) sequence - (intptr_t) queue_get_lap(queue, pos);
+
+        if (diff == 0) {
+            // This cell is free, try to reserve it
+            if (atomic_compare_exchange_weak_explicit(
+                &queue->push_pos, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed
+            )) break;
+        } else if (diff < 0) {
+            // The consumer has not yet released this cell: the queue is full
+            return false;
+        } else {
+            // Another producer has reserved this cell
+            pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+        }
+    }
+
+    // Publish the element
+    cell->element = element;
+    atomic_store_explicit(&cell->sequence, queue_get_lap(queue, pos) + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * \brief Fetch the oldest element stored in the ring of a queue. Must
+ *    only be called by the consumer.
+ * \param queue A queue_t instance.
+ * \return The poped element, NULL if the queue is empty.
+ */
+
+static void * queue_ring_pop(queue_t * queue)
+{
+    queue_cell_t * cell;
+    size_t         pos;
+    void         * element;
+
+    pos  = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+    cell = &queue->cells[pos & queue->mask];
+
+    // The cell is empty, or a producer is still writing it
+    if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != queue_get_lap(queue, pos) + 1) {
+        return NULL;
+    }
+
+    // Release the cell for the next round
+    element = cell->element;
+    atomic_store_explicit(&cell->sequence, queue_get_lap(queue, pos) + queue->mask + 1, memory_order_release);
+    atomic_store_explicit(&queue->pop_pos, pos + 1, memory_order_relaxed);
+    return element;
+}
+
 void queue_free(queue_t * queue, void (*element_free) (void * element))
 {
+    void * element;
+
     if (queue) {
-        if (queue->elements) list_free(queue->elements, element_free);
+        if (queue->cells) {
+            while ((element = queue_ring_pop(queue))) {
+                if (element_free) element_free(element);
+            }
+            free(queue->cells);
+        }
         close(queue->eventfd);
         free(queue);
     }
@@ -47,20 +149,78 @@ inline bool queue_push_element(queue_t *queue, void * element)
 {
     // Push an element in the queue
     // If successfull, write 1 in the file descriptor.
-    return list_push_element(queue->elements, element)
+    return queue_ring_push(queue, element)
         && (eventfd_write(queue->eventfd, 1) != -1);
 }
 
+size_t queue_push_elements(queue_t * queue, void ** elements, size_t num_elements)
+{
+    size_t i;
+
+    for (i = 0; i < num_elements; i++) {
+        if (!queue_ring_push(queue, elements[i])) break;
+    }
+
+    // Notify the elements actually pushed at once. They are in the ring
+    // anyway, and are popped with the next notified ones.
+    if (i > 0 && eventfd_write(queue->eventfd, i) == -1) {
+        perror("queue_push_elements: eventfd_write");
+    }
+
+    return i;
+}
+
 void * queue_pop_element(queue_t *queue, void (*element_free)(void * element))
+{
+    void * element;
+
+    if (queue_drain(queue, &element, 1) != 1) return NULL;
+    if (element_free) element_free(element);
+    return element;
+}
+
+size_t queue_drain(queue_t * queue, void ** elements, size_t max_elements)
 {
     eventfd_t value;
-    return (read(queue->eventfd, &value, sizeof(value)) != -1) ?
-        list_pop_element(queue->elements, element_free) :
-        NULL;
+    size_t    num_elements = 0;
+
+    // Reset the counter. This fails with EAGAIN if the counter is already 0.
+    // Producers notify the eventfd after having published their element,
+    // so no notification can be lost.
+    if (eventfd_read(queue->eventfd, &value) == -1 && errno != EAGAIN) {
+        return 0;
+    }
+
+    while (num_elements < max_elements && (elements[num_elements] = queue_ring_pop(queue))) {
+        num_elements++;
+    }
+
+    // Some elements are still pending, keep the file descriptor activated
+    if (!queue_is_empty(queue)) {
+        eventfd_write(queue->eventfd, 1);
+    }
+
+    return num_elements;
+}
+
+inline bool queue_is_empty(const queue_t * queue)
+{
+    size_t pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+
+    return atomic_load_explicit(&queue->cells[pos & queue->mask].sequence, memory_order_acquire) != queue_get_lap(queue, pos) + 1;
+}
+
+size_t queue_get_size(const queue_t * queue)
+{
+    size_t pop_pos  = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed),
+           push_pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+
+    // push_pos is reserved before the cell is written, and may be
+    // read before pop_pos has been updated by the consumer
+    return push_pos > pop_pos ? push_pos - pop_pos : 0;
 }
 
 inline int queue_get_fd(const queue_t * queue)
 {
     return queue->eventfd;
 }
-
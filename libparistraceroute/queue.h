@@ -3,12 +3,40 @@
 
 #include <sys/eventfd.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
 
-#include "list.h"
+/**
+ * A queue_t is a bounded ring buffer of QUEUE_CAPACITY cells, each cell
+ * carrying a sequence number (see D. Vyukov bounded queue). Several
+ * producers (e.g. algorithm or user threads) may push elements
+ * concurrently without taking a lock, while a single consumer (pt_loop)
+ * pops them. Pushes and pops never allocate memory.
+ *
+ * The eventfd counter is non-zero iif elements may be pending, so that
+ * the consumer can be woken up by epoll.
+ */
+
+// Number of cells of a queue. Must be a power of 2.
+#define QUEUE_CAPACITY   65536
+
+// Used to store the producer and consumer indexes in distinct cache lines.
+#define QUEUE_CACHE_LINE 64
 
 typedef struct {
-    list_t * elements; /**< Elements stored in the queue */
-    int      eventfd;  /**< File descriptor notifying an update in the queue */
+    atomic_size_t   sequence; /**< Ring position for which this cell may be written (or read, if sequence == position + 1), minus the index of the cell */
+    void          * element;  /**< Element stored in this cell */
+} queue_cell_t;
+
+typedef struct {
+    queue_cell_t  * cells;    /**< QUEUE_CAPACITY cells storing the elements */
+    size_t          mask;     /**< QUEUE_CAPACITY - 1 */
+    int             eventfd;  /**< File descriptor notifying an update in the queue */
+    _Alignas(QUEUE_CACHE_LINE)
+    atomic_size_t   push_pos; /**< Next position written by the producers */
+    _Alignas(QUEUE_CACHE_LINE)
+    atomic_size_t   pop_pos;  /**< Next position read by the consumer */
+    char            padding[QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
 } queue_t;
 
 /**
@@ -26,16 +54,32 @@ queue_t * queue_create();
 void queue_free(queue_t * queue, void (*element_free) (void * element));
 
 /**
- * \brief Push an element in the queue
+ * \brief Push an element in the queue. This function may be called
+ *    by several threads concurrently.
  * \param queue Points to the impacted queue instance
- * \param element Points to the pushed element
- * \return true iif successfull 
+ * \param element Points to the pushed element (must not be NULL)
+ * \return true iif successfull (false if the queue is full)
  */
 
 bool queue_push_element(queue_t * queue, void * element);
 
 /**
- * \brief Pop an element from the queue.
+ * \brief Push several elements in the queue. The queue file descriptor
+ *    is updated only once. This function may be called by several
+ *    threads concurrently, but their elements may then be interleaved.
+ * \param queue Points to the impacted queue instance
+ * \param elements An array of elements to push
+ * \param num_elements The number of elements stored in elements
+ * \return The number of elements pushed, i.e. the elements[0 ..
+ *    return value - 1]. It is lower than num_elements if the queue is
+ *    full: the caller still owns the remaining elements.
+ */
+
+size_t queue_push_elements(queue_t * queue, void ** elements, size_t num_elements);
+
+/**
+ * \brief Pop an element from the queue. Only one thread may pop
+ *    elements from a given queue.
  * \param queue The queue from which we pop an element.
  * \param element_free Function called back to free the poped element.
  * \return The address of the poped element, NULL in case of failure.
@@ -43,6 +87,37 @@ bool queue_push_element(queue_t * queue, void * element);
 
 void * queue_pop_element(queue_t * queue, void (*element_free)(void * element));
 
+/**
+ * \brief Pop several elements from the queue at once. If the queue
+ *    stores more than max_elements elements, its file descriptor
+ *    remains activated.
+ * \param queue The queue from which we pop the elements.
+ * \param elements A preallocated array of at least max_elements cells
+ *    in which the poped elements are written (from the oldest to the
+ *    youngest one).
+ * \param max_elements The maximum number of elements to pop.
+ * \return The number of poped elements.
+ */
+
+size_t queue_drain(queue_t * queue, void ** elements, size_t max_elements);
+
+/**
+ * \brief Test whether a queue is empty.
+ * \param queue A pointer to a queue instance.
+ * \return true iif the queue does not contain any element.
+ */
+
+bool queue_is_empty(const queue_t * queue);
+
+/**
+ * \brief Retrieve the number of elements stored in a queue. As the
+ *    producers may push elements concurrently, this is an estimate.
+ * \param queue A pointer to a queue instance.
+ * \return The number of elements stored in the queue.
+ */
+
+size_t queue_get_size(const queue_t * queue);
+
 /**
  * \brief Retrieve the file descriptor stored in a queue_t instance.
  * \param queue A pointer to a queue instance.
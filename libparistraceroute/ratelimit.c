@@ -0,0 +1,199 @@
+#include "config.h"
+
+#include <stdint.h>     // uint8_t, uint32_t
+#include <stdlib.h>     // calloc, free
+#include <string.h>     // memset
+
+#include "ratelimit.h"
+
+ratelimit_t * ratelimit_create() {
+    return calloc(1, sizeof(ratelimit_t));
+}
+
+void ratelimit_free(ratelimit_t * ratelimit) {
+    if (ratelimit) free(ratelimit);
+}
+
+/**
+ * \brief Compute the hash of an address, possibly combined with a TTL.
+ * \param address The address.
+ * \param ttl The TTL (0 to hash an interface).
+ * \return The corresponding hash.
+ */
+
+static uint32_t ratelimit_hash(const address_t * address, uint8_t ttl)
+{
+    const uint8_t * bytes = (const uint8_t *) &address->ip;
+    uint32_t        hash = 2166136261u; // FNV-1a
+    size_t          i, size = address_get_size(address);
+
+    for (i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return (hash ^ ttl) * 16777619u;
+}
+
+/**
+ * \brief Retrieve the hop related to a destination and a TTL.
+ * \param ratelimit A ratelimit_t instance.
+ * \param dst The destination.
+ * \param ttl The TTL.
+ * \param create Pass true to assign a slot to this hop if it is not
+ *    found, possibly replacing another hop.
+ * \return The corresponding hop, NULL if not found.
+ */
+
+static ratelimit_hop_t * ratelimit_get_hop(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl, bool create)
+{
+    ratelimit_hop_t * slot;
+    uint32_t          hash = ratelimit_hash(dst, ttl);
+    size_t            i;
+
+    for (i = 0; i < RATELIMIT_MAX_PROBES; i++) {
+        slot = &ratelimit->hops[(hash + i) & (RATELIMIT_NUM_HOPS - 1)];
+        if (slot->ttl == ttl && address_equals(&slot->dst, dst)) return slot;
+        if (!slot->dst.family) break;
+    }
+    if (!create) return NULL;
+
+    // Every slot is in use: replace another hop
+    if (i == RATELIMIT_MAX_PROBES) slot = &ratelimit->hops[hash & (RATELIMIT_NUM_HOPS - 1)];
+    slot->dst = *dst;
+    slot->ttl = ttl;
+    return slot;
+}
+
+/**
+ * \brief Retrieve the state related to an interface.
+ * \param ratelimit A ratelimit_t instance.
+ * \param address The interface.
+ * \param create Pass true to assign a slot to this interface if it is
+ *    not found, possibly reusing the slot of an interface which is not
+ *    paced.
+ * \return The corresponding interface, NULL if not found.
+ */
+
+static ratelimit_interface_t * ratelimit_get_interface(ratelimit_t * ratelimit, const address_t * address, bool create)
+{
+    ratelimit_interface_t * slot,
+                          * free_slot = NULL;
+    uint32_t                hash = ratelimit_hash(address, 0);
+    size_t                  i;
+
+    for (i = 0; i < RATELIMIT_MAX_PROBES; i++) {
+        slot = &ratelimit->interfaces[(hash + i) & (RATELIMIT_NUM_INTERFACES - 1)];
+        if (address_equals(&slot->address, address)) return slot;
+
+        // An unused slot, or an interface which is not paced, can be
+        // handed over to this interface
+        if (!free_slot && (!slot->address.family || (slot->rate == 0 && !slot->is_lossy))) {
+            free_slot = slot;
+        }
+        if (!slot->address.family) break;
+    }
+    if (!create || !free_slot) return NULL;
+
+    memset(free_slot, 0, sizeof(ratelimit_interface_t));
+    free_slot->address = *address;
+    return free_slot;
+}
+
+/**
+ * \brief Account the outcome of a probe expected to reach an interface,
+ *    and adapt the pacing of this interface once a window is complete.
+ * \param ratelimit A ratelimit_t instance.
+ * \param interface The interface.
+ * \param is_reply True iif the interface has replied to the probe.
+ * \param sending_time The sending time of the probe (in seconds).
+ */
+
+static void ratelimit_account(ratelimit_t * ratelimit, ratelimit_interface_t * interface, bool is_reply, double sending_time)
+{
+    double duration, loss, rate;
+
+    if (interface->is_lossy) return;
+
+    if (interface->num_replies + interface->num_losses == 0) {
+        interface->first_sent = interface->last_sent = sending_time;
+    } else {
+        if (sending_time < interface->first_sent) interface->first_sent = sending_time;
+        if (sending_time > interface->last_sent)  interface->last_sent  = sending_time;
+    }
+    if (is_reply) interface->num_replies++;
+    else          interface->num_losses++;
+    if (interface->num_replies + interface->num_losses < RATELIMIT_WINDOW) return;
+
+    loss = (double) interface->num_losses / RATELIMIT_WINDOW;
+    duration = interface->last_sent - interface->first_sent;
+    if (duration < RATELIMIT_MIN_DURATION) duration = RATELIMIT_MIN_DURATION;
+
+    if (loss >= RATELIMIT_LOSS_THRESHOLD && interface->num_replies > 0) {
+        if (interface->rate > 0 && loss >= interface->paced_loss) {
+            // Pacing has not reduced the losses: they are not due to a rate limit
+            interface->rate = 0;
+            interface->is_lossy = true;
+            ratelimit->num_limited--;
+        } else {
+            // The interface does not reply faster than it has replied in this window
+            rate = interface->num_replies / duration;
+            if (rate < RATELIMIT_MIN_PPS) rate = RATELIMIT_MIN_PPS;
+            if (interface->rate == 0) {
+                ratelimit->num_limited++;
+                interface->bucket.tokens = 0;
+                interface->bucket.last = interface->last_sent;
+                interface->paced_loss = loss;
+                interface->rate = rate;
+            } else if (rate < interface->rate) {
+                interface->rate = rate;
+            }
+        }
+    } else if (interface->rate > 0 && loss < RATELIMIT_LOSS_THRESHOLD / 2) {
+        // Check whether the interface sustains a higher rate
+        interface->rate *= RATELIMIT_INCREASE;
+        if (interface->rate > RATELIMIT_MAX_PPS) {
+            interface->rate = 0;
+            ratelimit->num_limited--;
+        }
+    }
+
+    interface->num_replies = 0;
+    interface->num_losses = 0;
+}
+
+void ratelimit_add_reply(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl, const address_t * interface, double sending_time)
+{
+    ratelimit_hop_t       * hop;
+    ratelimit_interface_t * state;
+
+    if (!dst->family || !interface->family) return;
+
+    hop = ratelimit_get_hop(ratelimit, dst, ttl, true);
+    hop->interface = *interface;
+    if ((state = ratelimit_get_interface(ratelimit, interface, true))) {
+        ratelimit_account(ratelimit, state, true, sending_time);
+    }
+}
+
+void ratelimit_add_loss(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl, double sending_time)
+{
+    ratelimit_hop_t       * hop;
+    ratelimit_interface_t * state;
+
+    if (!dst->family
+    || !(hop = ratelimit_get_hop(ratelimit, dst, ttl, false))
+    || !(state = ratelimit_get_interface(ratelimit, &hop->interface, false))) {
+        return;
+    }
+    ratelimit_account(ratelimit, state, false, sending_time);
+}
+
+ratelimit_interface_t * ratelimit_get_limited_interface(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl)
+{
+    ratelimit_hop_t       * hop;
+    ratelimit_interface_t * interface;
+
+    if (ratelimit->num_limited == 0 || !dst->family
+    || !(hop = ratelimit_get_hop(ratelimit, dst, ttl, false))
+    || !(interface = ratelimit_get_interface(ratelimit, &hop->interface, false))) {
+        return NULL;
+    }
+    return interface->rate > 0 ? interface : NULL;
+}
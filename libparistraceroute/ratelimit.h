@@ -0,0 +1,158 @@
+#include "use.h"
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+/**
+ * \file ratelimit.h
+ * \brief Detection of the routers rate limiting their ICMP replies.
+ *
+ * Routers commonly bound the rate of the ICMP errors they generate (e.g.
+ * time exceeded). Beyond this rate, the probes expiring on such a router
+ * are lost, and the algorithms report stars that do not exist.
+ *
+ * A ratelimit_t accounts, for each interface which has replied, the
+ * outcome of the probes expected to reach it, i.e. the probes sharing
+ * the destination and the TTL of a probe it has already replied to. The
+ * outcomes are analyzed by windows of RATELIMIT_WINDOW probes:
+ * - if at least RATELIMIT_LOSS_THRESHOLD of them are lost while the
+ *   interface still replies, the interface is considered as rate limited,
+ *   and the probes expected to reach it are paced (see pacer.h) at the
+ *   rate at which it has replied;
+ * - if the losses do not decrease once the probes are paced, they do not
+ *   depend on the rate, and the interface is never paced again;
+ * - a paced interface which no longer loses probes is paced faster, until
+ *   its rate exceeds RATELIMIT_MAX_PPS.
+ *
+ * The windows are timed by the sending times of the probes, since a reply
+ * (or a timeout) is processed some time after its probe has been sent.
+ *
+ * The interfaces and the hops are stored in fixed-size hash tables. An
+ * interface which is not paced carries no significant state, so that its
+ * slot may be reused by another interface. A hop only maps a destination
+ * and a TTL to the last interface which has replied, so a hop may replace
+ * another one. Behind a load balancer, the losses of a hop are attributed
+ * to the last interface which has replied, which makes the detection more
+ * conservative.
+ */
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint*_t
+
+#include "address.h"  // address_t
+#include "pacer.h"    // token_bucket_t
+
+// Number of interfaces tracked at once. Must be a power of 2.
+#define RATELIMIT_NUM_INTERFACES 4096
+
+// Number of hops tracked at once. Must be a power of 2.
+#define RATELIMIT_NUM_HOPS 8192
+
+// Maximum number of slots probed when seeking an interface or a hop.
+#define RATELIMIT_MAX_PROBES 8
+
+// Number of outcomes (replies and losses) analyzed at once.
+#define RATELIMIT_WINDOW 16
+
+// Ratio of losses in a window denoting a rate limit.
+#define RATELIMIT_LOSS_THRESHOLD 0.25
+
+// Minimum duration over which the reply rate of an interface is measured (in seconds).
+#define RATELIMIT_MIN_DURATION 1.0
+
+// Bounds of the rate granted to a rate limited interface (in probes per second).
+#define RATELIMIT_MIN_PPS 1.0
+#define RATELIMIT_MAX_PPS 1000.0
+
+// Factor applied to the rate of an interface which no longer loses probes.
+#define RATELIMIT_INCREASE 1.5
+
+/**
+ * \struct ratelimit_interface_t
+ * \brief The state related to an interface which has replied.
+ */
+
+typedef struct {
+    address_t      address;     /**< The interface (family == 0 if this slot is unused) */
+    double         rate;        /**< The rate granted to the probes expected to reach it (in probes per second), 0 if they are not paced */
+    token_bucket_t bucket;      /**< The bucket pacing these probes (if rate > 0) */
+    double         first_sent;  /**< Sending time of the first probe of the current window (in seconds) */
+    double         last_sent;   /**< Sending time of the last probe of the current window (in seconds) */
+    double         paced_loss;  /**< Loss ratio which has triggered the pacing (if rate > 0) */
+    uint8_t        num_replies; /**< Number of replies in the current window */
+    uint8_t        num_losses;  /**< Number of losses in the current window */
+    bool           is_lossy;    /**< True iif its losses do not depend on the rate */
+} ratelimit_interface_t;
+
+/**
+ * \struct ratelimit_hop_t
+ * \brief The interface which has replied to the probes sent towards a
+ *    destination with a given TTL.
+ */
+
+typedef struct {
+    address_t dst;       /**< The destination (family == 0 if this slot is unused) */
+    address_t interface; /**< The last interface which has replied */
+    uint8_t   ttl;       /**< The TTL */
+} ratelimit_hop_t;
+
+/**
+ * \struct ratelimit_t
+ * \brief Structure describing a rate limit detector.
+ */
+
+typedef struct ratelimit_s {
+    ratelimit_interface_t interfaces[RATELIMIT_NUM_INTERFACES]; /**< The interfaces, indexed by address */
+    ratelimit_hop_t       hops[RATELIMIT_NUM_HOPS];             /**< The hops, indexed by destination and TTL */
+    size_t                num_limited;                          /**< Number of interfaces currently paced */
+} ratelimit_t;
+
+/**
+ * \brief Create a ratelimit_t instance.
+ * \return The newly allocated ratelimit_t instance, NULL in case of failure.
+ */
+
+ratelimit_t * ratelimit_create();
+
+/**
+ * \brief Release a ratelimit_t instance from the memory.
+ * \param ratelimit A ratelimit_t instance.
+ */
+
+void ratelimit_free(ratelimit_t * ratelimit);
+
+/**
+ * \brief Account a reply.
+ * \param ratelimit A ratelimit_t instance.
+ * \param dst The destination of the probe.
+ * \param ttl The TTL of the probe.
+ * \param interface The interface which has replied.
+ * \param sending_time The sending time of the probe (in seconds).
+ */
+
+void ratelimit_add_reply(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl, const address_t * interface, double sending_time);
+
+/**
+ * \brief Account a probe which has expired. It is ignored if no interface
+ *    has replied to a probe sent towards the same destination with the
+ *    same TTL.
+ * \param ratelimit A ratelimit_t instance.
+ * \param dst The destination of the probe.
+ * \param ttl The TTL of the probe.
+ * \param sending_time The sending time of the probe (in seconds).
+ */
+
+void ratelimit_add_loss(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl, double sending_time);
+
+/**
+ * \brief Retrieve the paced interface expected to reply to a probe.
+ * \param ratelimit A ratelimit_t instance.
+ * \param dst The destination of the probe.
+ * \param ttl The TTL of the probe.
+ * \return The corresponding interface, NULL if the probe is not paced.
+ */
+
+ratelimit_interface_t * ratelimit_get_limited_interface(ratelimit_t * ratelimit, const address_t * dst, uint8_t ttl);
+
+#endif
@@ -0,0 +1,126 @@
+#include "config.h"
+
+#include <stdlib.h>       // calloc, free
+
+#include "hugemem.h"        // hugemem_*
+#include "recent_probes.h"
+
+recent_probes_t * recent_probes_create(size_t capacity, uint64_t lifetime)
+{
+    recent_probes_t * recent_probes;
+    size_t            rounded;
+
+    for (rounded = 1; rounded < capacity; rounded <<= 1);
+
+    if (!(recent_probes = calloc(1, sizeof(recent_probes_t))))                   goto ERR_CALLOC;
+    if (!(recent_probes->entries = hugemem_calloc(rounded, sizeof(recent_probe_t)))) goto ERR_CALLOC_ENTRIES;
+    if (!(recent_probes->buckets = hugemem_calloc(rounded, sizeof(uint32_t))))       goto ERR_CALLOC_BUCKETS;
+    recent_probes->capacity = rounded;
+    recent_probes->oldest   = 0;
+    recent_probes->lifetime = lifetime;
+    return recent_probes;
+
+ERR_CALLOC_BUCKETS:
+    hugemem_free(recent_probes->entries, rounded, sizeof(recent_probe_t));
+ERR_CALLOC_ENTRIES:
+    free(recent_probes);
+ERR_CALLOC:
+    return NULL;
+}
+
+void recent_probes_free(recent_probes_t * recent_probes)
+{
+    size_t i;
+
+    if (recent_probes) {
+        for (i = 0; i < recent_probes->capacity; i++) {
+            probe_free(recent_probes->entries[i].probe);
+        }
+        hugemem_free(recent_probes->buckets, recent_probes->capacity, sizeof(uint32_t));
+        hugemem_free(recent_probes->entries, recent_probes->capacity, sizeof(recent_probe_t));
+        free(recent_probes);
+    }
+}
+
+static inline uint32_t * recent_probes_get_bucket(recent_probes_t * recent_probes, uint32_t tag) {
+    return &recent_probes->buckets[tag & (recent_probes->capacity - 1)];
+}
+
+/**
+ * \brief Unlink an entry from its bucket and release its probe.
+ * \param recent_probes A recent_probes_t instance.
+ * \param index The index of the entry, which must be used.
+ */
+
+static void recent_probes_del(recent_probes_t * recent_probes, size_t index)
+{
+    recent_probe_t * entry = &recent_probes->entries[index];
+    uint32_t       * pnext;
+
+    for (pnext = recent_probes_get_bucket(recent_probes, entry->tag); *pnext; pnext = &recent_probes->entries[*pnext - 1].next) {
+        if (*pnext == index + 1) {
+            *pnext = entry->next;
+            break;
+        }
+    }
+    probe_free(entry->probe);
+    entry->probe  = NULL;
+    entry->caller = NULL;
+}
+
+void recent_probes_add(
+    recent_probes_t      * recent_probes,
+    probe_t              * probe,
+    uint32_t               tag,
+    recent_probe_state_t   state,
+    uint64_t               now
+) {
+    size_t           index = recent_probes->oldest;
+    recent_probe_t * entry = &recent_probes->entries[index];
+    uint32_t       * pbucket;
+
+    if (entry->probe) recent_probes_del(recent_probes, index);
+
+    // The newest entry is the head of its bucket
+    pbucket = recent_probes_get_bucket(recent_probes, tag);
+    entry->probe  = probe_ref(probe);
+    entry->caller = probe->caller;
+    entry->tag    = tag;
+    entry->state  = state;
+    entry->time   = now;
+    entry->next   = *pbucket;
+    *pbucket = index + 1;
+
+    recent_probes->oldest = (index + 1) & (recent_probes->capacity - 1);
+}
+
+recent_probe_t * recent_probes_find(
+    recent_probes_t      * recent_probes,
+    uint32_t               tag,
+    uint64_t               now,
+    recent_probe_match_t   match,
+    void                 * data
+) {
+    recent_probe_t * entry;
+    uint32_t         next;
+
+    for (next = *recent_probes_get_bucket(recent_probes, tag); next; next = entry->next) {
+        entry = &recent_probes->entries[next - 1];
+
+        // The next entries of this bucket are even older
+        if (now - entry->time > recent_probes->lifetime) break;
+        if (entry->tag == tag && match(entry->probe, data)) return entry;
+    }
+    return NULL;
+}
+
+void recent_probes_forget_caller(recent_probes_t * recent_probes, const void * caller)
+{
+    size_t i;
+
+    for (i = 0; i < recent_probes->capacity; i++) {
+        if (recent_probes->entries[i].caller == caller) {
+            recent_probes->entries[i].caller = NULL;
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef RECENT_PROBES_H
+#define RECENT_PROBES_H
+
+/**
+ * \file recent_probes.h
+ * \brief A bounded table of the probes recently matched or expired, so
+ *    that the network layer classifies the replies which no longer match
+ *    a probe in transit: a duplicate reply (its probe has already been
+ *    matched) or a late reply (its probe has already expired).
+ *
+ * The entries are stored in a ring: once the table is full, the oldest
+ * entry is overwritten. An entry also expires once it is older than the
+ * lifetime of the table. The entries are indexed by tag, so that a reply
+ * is classified in constant time instead of being compared to every
+ * probe in transit.
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+
+#include "probe.h"      // probe_t
+
+/**
+ * \enum recent_probe_state_t
+ * \brief Why a probe is no longer in transit.
+ */
+
+typedef enum {
+    RECENT_PROBE_MATCHED, /**< The probe has been matched by a reply */
+    RECENT_PROBE_EXPIRED  /**< The probe has expired */
+} recent_probe_state_t;
+
+/**
+ * \struct recent_probe_t
+ * \brief An entry of a recent_probes_t table.
+ */
+
+typedef struct {
+    probe_t              * probe;  /**< The probe (the table holds a reference), NULL if this entry is unused */
+    void                 * caller; /**< The instance which has sent the probe, NULL once released (see recent_probes_forget_caller) */
+    uint32_t               tag;    /**< The tag carried by the probe (host-side endianness) */
+    recent_probe_state_t   state;  /**< Why the probe is no longer in transit */
+    uint64_t               time;   /**< When the probe has been matched or has expired (see get_time_ns) */
+    uint32_t               next;   /**< Index + 1 of the next entry of the same bucket, 0 if none */
+} recent_probe_t;
+
+/**
+ * \struct recent_probes_t
+ * \brief The probes recently matched or expired, indexed by tag.
+ */
+
+typedef struct {
+    recent_probe_t * entries;  /**< The ring of entries */
+    uint32_t       * buckets;  /**< Index + 1 of the newest entry of each bucket, 0 if none */
+    size_t           capacity; /**< Number of entries (and of buckets), a power of 2 */
+    size_t           oldest;   /**< Index of the entry overwritten by the next recent_probes_add */
+    uint64_t         lifetime; /**< Lifetime of an entry (in nanoseconds) */
+} recent_probes_t;
+
+/**
+ * \brief Match a probe stored in a recent_probes_t table.
+ * \param probe The probe.
+ * \param data The data passed to recent_probes_find.
+ * \return true iif the probe matches.
+ */
+
+typedef bool (* recent_probe_match_t)(const probe_t * probe, void * data);
+
+/**
+ * \brief Create a recent_probes_t table.
+ * \param capacity The maximal number of entries. It is rounded up to a
+ *    power of 2.
+ * \param lifetime The lifetime of an entry (in nanoseconds).
+ * \return The newly allocated table, NULL in case of failure.
+ */
+
+recent_probes_t * recent_probes_create(size_t capacity, uint64_t lifetime);
+
+/**
+ * \brief Release a recent_probes_t table and the references to its probes.
+ * \param recent_probes A recent_probes_t instance.
+ */
+
+void recent_probes_free(recent_probes_t * recent_probes);
+
+/**
+ * \brief Record a probe which is no longer in transit. The oldest entry
+ *    is overwritten if the table is full.
+ * \param recent_probes A recent_probes_t instance.
+ * \param probe The probe. The table takes its own reference.
+ * \param tag The tag carried by the probe (host-side endianness).
+ * \param state Why the probe is no longer in transit.
+ * \param now The current time (see get_time_ns).
+ */
+
+void recent_probes_add(
+    recent_probes_t      * recent_probes,
+    probe_t              * probe,
+    uint32_t               tag,
+    recent_probe_state_t   state,
+    uint64_t               now
+);
+
+/**
+ * \brief Find a probe carrying a given tag which has not expired yet.
+ * \param recent_probes A recent_probes_t instance.
+ * \param tag The tag (host-side endianness).
+ * \param now The current time (see get_time_ns).
+ * \param match Called on each candidate, from the newest to the oldest.
+ * \param data Passed to match.
+ * \return The entry of the first candidate matched, NULL if none.
+ */
+
+recent_probe_t * recent_probes_find(
+    recent_probes_t      * recent_probes,
+    uint32_t               tag,
+    uint64_t               now,
+    recent_probe_match_t   match,
+    void                 * data
+);
+
+/**
+ * \brief Forget an instance, e.g. because it is being released: the
+ *    replies to its probes are still classified, but its entries no
+ *    longer refer to it.
+ * \param recent_probes A recent_probes_t instance.
+ * \param caller The instance.
+ */
+
+void recent_probes_forget_caller(recent_probes_t * recent_probes, const void * caller);
+
+#endif // RECENT_PROBES_H
@@ -0,0 +1,148 @@
+#include "use.h"
+#include "config.h"
+
+#include <netinet/in.h>       // IPPROTO_ICMP, IPPROTO_ICMPV6, IPPROTO_TCP
+#include <netinet/ip_icmp.h>  // ICMP_*
+
+#ifdef USE_IPV6
+#  include <netinet/icmp6.h>  // ICMP6_*, ND_REDIRECT
+#endif
+
+#include "reply_class.h"
+
+// Offset of the next header field in an IPv6 header.
+#define REPLY_CLASS_IPV6_NEXT_HEADER 6
+
+// Size of an IPv6 header (extension headers are not expected in a reply).
+#define REPLY_CLASS_IPV6_HEADER_SIZE 40
+
+// Offset of the protocol field in an IPv4 header.
+#define REPLY_CLASS_IPV4_PROTOCOL 9
+
+// Offset of the next-hop MTU in an ICMPv4 fragmentation needed (16 bits)
+// and in an ICMPv6 packet too big (32 bits).
+#define REPLY_CLASS_ICMPV4_MTU 6
+#define REPLY_CLASS_ICMPV6_MTU 4
+
+static reply_class_t reply_classify_icmpv4(uint8_t type, uint8_t code)
+{
+    switch (type) {
+        case ICMP_ECHOREPLY:
+            return REPLY_CLASS_ECHO_REPLY;
+        case ICMP_UNREACH:
+            switch (code) {
+                case ICMP_UNREACH_NET:           return REPLY_CLASS_NET_UNREACHABLE;
+                case ICMP_UNREACH_HOST:          return REPLY_CLASS_HOST_UNREACHABLE;
+                case ICMP_UNREACH_PROTOCOL:      return REPLY_CLASS_PROTOCOL_UNREACHABLE;
+                case ICMP_UNREACH_PORT:          return REPLY_CLASS_PORT_UNREACHABLE;
+                case ICMP_UNREACH_NEEDFRAG:      return REPLY_CLASS_PACKET_TOO_BIG;
+                case ICMP_UNREACH_NET_PROHIB:
+                case ICMP_UNREACH_HOST_PROHIB:
+                case ICMP_UNREACH_FILTER_PROHIB: return REPLY_CLASS_ADMIN_PROHIBITED;
+                default:                         return REPLY_CLASS_OTHER_UNREACHABLE;
+            }
+        case ICMP_TIMXCEED:
+            return code == ICMP_TIMXCEED_INTRANS ? REPLY_CLASS_TTL_EXCEEDED : REPLY_CLASS_REASSEMBLY_TIME_EXCEEDED;
+        case ICMP_REDIRECT:
+            return REPLY_CLASS_REDIRECT;
+        case ICMP_PARAMPROB:
+            return REPLY_CLASS_PARAMETER_PROBLEM;
+        default:
+            return REPLY_CLASS_OTHER;
+    }
+}
+
+#ifdef USE_IPV6
+static reply_class_t reply_classify_icmpv6(uint8_t type, uint8_t code)
+{
+    switch (type) {
+        case ICMP6_ECHO_REPLY:
+            return REPLY_CLASS_ECHO_REPLY;
+        case ICMP6_DST_UNREACH:
+            switch (code) {
+                case ICMP6_DST_UNREACH_NOROUTE: return REPLY_CLASS_NET_UNREACHABLE;
+                case ICMP6_DST_UNREACH_ADDR:    return REPLY_CLASS_HOST_UNREACHABLE;
+                case ICMP6_DST_UNREACH_NOPORT:  return REPLY_CLASS_PORT_UNREACHABLE;
+                case ICMP6_DST_UNREACH_ADMIN:   return REPLY_CLASS_ADMIN_PROHIBITED;
+                default:                        return REPLY_CLASS_OTHER_UNREACHABLE;
+            }
+        case ICMP6_PACKET_TOO_BIG:
+            return REPLY_CLASS_PACKET_TOO_BIG;
+        case ICMP6_TIME_EXCEEDED:
+            return code == ICMP6_TIME_EXCEED_TRANSIT ? REPLY_CLASS_TTL_EXCEEDED : REPLY_CLASS_REASSEMBLY_TIME_EXCEEDED;
+        case ND_REDIRECT:
+            return REPLY_CLASS_REDIRECT;
+        case ICMP6_PARAM_PROB:
+            // An unrecognized next header is the IPv6 protocol unreachable
+            return code == ICMP6_PARAMPROB_NEXTHEADER ? REPLY_CLASS_PROTOCOL_UNREACHABLE : REPLY_CLASS_PARAMETER_PROBLEM;
+        default:
+            return REPLY_CLASS_OTHER;
+    }
+}
+#endif
+
+reply_class_t reply_classify_bytes(const uint8_t * bytes, size_t size)
+{
+    size_t header_size;
+
+    if (size == 0) return REPLY_CLASS_OTHER;
+
+    switch (bytes[0] >> 4) {
+        case 4:
+            header_size = (bytes[0] & 0x0f) * 4;
+            if (size <= REPLY_CLASS_IPV4_PROTOCOL) break;
+            switch (bytes[REPLY_CLASS_IPV4_PROTOCOL]) {
+                case IPPROTO_ICMP:
+                    if (size < header_size + 2) break;
+                    return reply_classify_icmpv4(bytes[header_size], bytes[header_size + 1]);
+                case IPPROTO_TCP:
+                    return REPLY_CLASS_TCP;
+            }
+            break;
+#ifdef USE_IPV6
+        case 6:
+            if (size < REPLY_CLASS_IPV6_HEADER_SIZE + 2) break;
+            switch (bytes[REPLY_CLASS_IPV6_NEXT_HEADER]) {
+                case IPPROTO_ICMPV6:
+                    return reply_classify_icmpv6(bytes[REPLY_CLASS_IPV6_HEADER_SIZE], bytes[REPLY_CLASS_IPV6_HEADER_SIZE + 1]);
+                case IPPROTO_TCP:
+                    return REPLY_CLASS_TCP;
+            }
+            break;
+#endif
+    }
+    return REPLY_CLASS_OTHER;
+}
+
+void reply_classify_packets(packet_t * const * packets, size_t num_packets, reply_class_t * classes)
+{
+    size_t i;
+
+    for (i = 0; i < num_packets; i++) {
+        classes[i] = reply_classify_bytes(packet_get_bytes(packets[i]), packet_get_size(packets[i]));
+    }
+}
+
+uint32_t reply_get_next_hop_mtu(const uint8_t * bytes, size_t size)
+{
+    const uint8_t * icmp;
+
+    if (reply_classify_bytes(bytes, size) != REPLY_CLASS_PACKET_TOO_BIG) return 0;
+
+    switch (bytes[0] >> 4) {
+        case 4:
+            icmp = bytes + (bytes[0] & 0x0f) * 4;
+            if (size < (size_t) (icmp - bytes) + REPLY_CLASS_ICMPV4_MTU + 2) break;
+            return (icmp[REPLY_CLASS_ICMPV4_MTU] << 8) | icmp[REPLY_CLASS_ICMPV4_MTU + 1];
+#ifdef USE_IPV6
+        case 6:
+            icmp = bytes + REPLY_CLASS_IPV6_HEADER_SIZE;
+            if (size < REPLY_CLASS_IPV6_HEADER_SIZE + REPLY_CLASS_ICMPV6_MTU + 4) break;
+            return ((uint32_t) icmp[REPLY_CLASS_ICMPV6_MTU]     << 24)
+                 | ((uint32_t) icmp[REPLY_CLASS_ICMPV6_MTU + 1] << 16)
+                 | ((uint32_t) icmp[REPLY_CLASS_ICMPV6_MTU + 2] << 8)
+                 |  (uint32_t) icmp[REPLY_CLASS_ICMPV6_MTU + 3];
+#endif
+    }
+    return 0;
+}
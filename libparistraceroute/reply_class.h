@@ -0,0 +1,73 @@
+#ifndef REPLY_CLASS_H
+#define REPLY_CLASS_H
+
+/**
+ * \file reply_class.h
+ * \brief Classification of the replies according to their ICMP type and
+ *    code (or to their transport protocol).
+ *
+ * The class of a reply is decoded once, from the raw bytes of its IP and
+ * ICMP headers, when the network layer receives it (see
+ * network_process_recvq, which classifies each batch of replies at once).
+ * The algorithms then read it through probe_get_reply_class instead of
+ * extracting and comparing the "version", "type" and "code" fields.
+ */
+
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint8_t
+
+#include "packet.h"   // packet_t
+
+/**
+ * \enum reply_class_t
+ * \brief The class of a reply.
+ */
+
+typedef enum {
+    REPLY_CLASS_UNKNOWN = 0,              /**< Not classified yet */
+    REPLY_CLASS_ECHO_REPLY,               /**< ICMP echo reply */
+    REPLY_CLASS_TTL_EXCEEDED,             /**< ICMP time exceeded in transit */
+    REPLY_CLASS_REASSEMBLY_TIME_EXCEEDED, /**< ICMP fragment reassembly time exceeded */
+    REPLY_CLASS_NET_UNREACHABLE,          /**< ICMP network unreachable (no route to destination in IPv6) */
+    REPLY_CLASS_HOST_UNREACHABLE,         /**< ICMP host unreachable (address unreachable in IPv6) */
+    REPLY_CLASS_PROTOCOL_UNREACHABLE,     /**< ICMP protocol unreachable (unrecognized next header in IPv6) */
+    REPLY_CLASS_PORT_UNREACHABLE,         /**< ICMP port unreachable */
+    REPLY_CLASS_ADMIN_PROHIBITED,         /**< ICMP communication administratively prohibited */
+    REPLY_CLASS_OTHER_UNREACHABLE,        /**< Any other ICMP destination unreachable */
+    REPLY_CLASS_REDIRECT,                 /**< ICMP redirect */
+    REPLY_CLASS_PARAMETER_PROBLEM,        /**< ICMP parameter problem */
+    REPLY_CLASS_PACKET_TOO_BIG,           /**< ICMP fragmentation needed and DF set (packet too big in IPv6) */
+    REPLY_CLASS_TCP,                      /**< A TCP segment (e.g. SYN/ACK or RST) */
+    REPLY_CLASS_OTHER                     /**< Any other packet */
+} reply_class_t;
+
+/**
+ * \brief Classify a reply from its raw bytes.
+ * \param bytes The bytes of the reply, starting with its IP header.
+ * \param size The number of bytes.
+ * \return The class of the reply (REPLY_CLASS_OTHER if it cannot be decoded).
+ */
+
+reply_class_t reply_classify_bytes(const uint8_t * bytes, size_t size);
+
+/**
+ * \brief Classify a batch of replies (e.g. received by a single recvmmsg).
+ * \param packets The replies.
+ * \param num_packets The number of replies.
+ * \param classes The array in which the class of each reply is written.
+ */
+
+void reply_classify_packets(packet_t * const * packets, size_t num_packets, reply_class_t * classes);
+
+/**
+ * \brief Retrieve the MTU of the next hop carried by a reply of class
+ *    REPLY_CLASS_PACKET_TOO_BIG (RFC 1191, RFC 4443).
+ * \param bytes The bytes of the reply, starting with its IP header.
+ * \param size The number of bytes.
+ * \return The MTU of the next hop, 0 if the reply does not carry it
+ *    (e.g. a router predating RFC 1191).
+ */
+
+uint32_t reply_get_next_hop_mtu(const uint8_t * bytes, size_t size);
+
+#endif // REPLY_CLASS_H
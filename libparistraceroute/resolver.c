@@ -0,0 +1,738 @@
+#include "config.h"
+
+#include <stdlib.h>       // malloc, free
+#include <stdio.h>        // fopen, fprintf
+#include <string.h>       // memcpy, memcmp
+#include <errno.h>        // errno, EAGAIN
+#include <ctype.h>        // isalnum
+#include <unistd.h>       // close, read, getpid
+#include <sys/timerfd.h>  // timerfd_create
+#include <arpa/inet.h>    // inet_pton, htons
+
+#include "resolver.h"
+#include "common.h"       // get_time_ns
+#include "network.h"      // update_timer
+#include "whois.h"        // whois_cache_asn
+#include "cachefile.h"    // CACHEFILE_NEGATIVE_TTL
+
+// Where the nameservers are listed
+#define RESOLVER_RESOLV_CONF "/etc/resolv.conf"
+
+// Static table lookup for hostnames, read before querying the nameserver
+#define RESOLVER_HOSTS       "/etc/hosts"
+
+// DNS header (RFC 1035, 4.1.1)
+#define DNS_HEADER_SIZE  12
+#define DNS_FLAG_QR      0x8000
+#define DNS_FLAG_RD      0x0100
+#define DNS_RCODE_MASK   0x000f
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_TYPE_PTR     12
+#define DNS_TYPE_TXT     16
+#define DNS_CLASS_IN     1
+
+// Maximum number of compression pointers followed while reading a name
+#define DNS_MAX_JUMPS    16
+
+// Maximum length of a FQDN
+#define DNS_MAX_NAME     255
+
+// Zones mapping the IP addresses to their origin AS (Team Cymru)
+#define RESOLVER_ORIGIN_ZONE  "origin"
+#define RESOLVER_ORIGIN6_ZONE "origin6"
+
+static inline uint16_t read_uint16(const uint8_t * buffer) {
+    return (buffer[0] << 8) | buffer[1];
+}
+
+static inline void write_uint16(uint8_t * buffer, uint16_t value) {
+    buffer[0] = value >> 8;
+    buffer[1] = value & 0xff;
+}
+
+/**
+ * \brief Read the first usable nameserver of /etc/resolv.conf. Like the
+ *    libc, fall back on the local host if there is none.
+ * \param nameserver The sockaddr to initialize.
+ */
+
+static void resolver_read_nameserver(struct sockaddr_storage * nameserver)
+{
+    FILE                * file;
+    char                * line = NULL, ip[INET6_ADDRSTRLEN];
+    size_t                size = 0;
+    bool                  found = false;
+    struct sockaddr_in  * sin  = (struct sockaddr_in *) nameserver;
+    struct sockaddr_in6 * sin6 = (struct sockaddr_in6 *) nameserver;
+
+    memset(nameserver, 0, sizeof(struct sockaddr_storage));
+
+    if ((file = fopen(RESOLVER_RESOLV_CONF, "r"))) {
+        while (!found && getline(&line, &size, file) != -1) {
+            if (sscanf(line, "nameserver %45s", ip) != 1) continue;
+            if (inet_pton(AF_INET, ip, &sin->sin_addr) == 1) {
+                sin->sin_family = AF_INET;
+                found = true;
+            } else if (inet_pton(AF_INET6, ip, &sin6->sin6_addr) == 1) {
+                sin6->sin6_family = AF_INET6;
+                found = true;
+            }
+        }
+        free(line);
+        fclose(file);
+    }
+
+    if (!found) {
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+
+    // sin_port and sin6_port are located at the same offset
+    sin->sin_port = htons(53);
+}
+
+/**
+ * \brief Look up an address in /etc/hosts.
+ * \param address The address.
+ * \param hostname The buffer in which the first hostname of the address
+ *    is written (of at least DNS_MAX_NAME + 1 bytes).
+ * \return true iif found.
+ */
+
+static bool resolver_read_hosts(const address_t * address, char * hostname)
+{
+    FILE      * file;
+    char      * line = NULL, ip[INET6_ADDRSTRLEN], name[DNS_MAX_NAME + 1];
+    size_t      size = 0;
+    bool        found = false;
+    address_t   entry;
+
+    if (!(file = fopen(RESOLVER_HOSTS, "r"))) return false;
+
+    while (!found && getline(&line, &size, file) != -1) {
+        if (sscanf(line, "%45s %255s", ip, name) != 2 || ip[0] == '#') continue;
+
+        memset(&entry, 0, sizeof(address_t));
+        entry.family = address->family;
+        if (inet_pton(address->family, ip, &entry.ip) == 1
+        &&  address_equals(&entry, address)) {
+            strcpy(hostname, name);
+            found = true;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return found;
+}
+
+/**
+ * \brief Check whether an answer comes from the nameserver.
+ * \param resolver The resolver.
+ * \param from The source of the answer.
+ * \return true iif from is resolver->nameserver.
+ */
+
+static bool resolver_is_nameserver(const resolver_t * resolver, const struct sockaddr_storage * from)
+{
+    const struct sockaddr_in  * x4 = (const struct sockaddr_in *)  &resolver->nameserver,
+                              * y4 = (const struct sockaddr_in *)  from;
+    const struct sockaddr_in6 * x6 = (const struct sockaddr_in6 *) &resolver->nameserver,
+                              * y6 = (const struct sockaddr_in6 *) from;
+
+    if (from->ss_family != resolver->nameserver.ss_family) return false;
+
+    switch (from->ss_family) {
+        case AF_INET:
+            return x4->sin_port == y4->sin_port
+                && x4->sin_addr.s_addr == y4->sin_addr.s_addr;
+        case AF_INET6:
+            return x6->sin6_port == y6->sin6_port
+                && memcmp(&x6->sin6_addr, &y6->sin6_addr, sizeof(struct in6_addr)) == 0;
+        default:
+            return false;
+    }
+}
+
+/**
+ * \brief Append a label to a DNS name.
+ * \param buffer Where the label is written.
+ * \param label The label.
+ * \return The number of bytes written.
+ */
+
+static size_t dns_write_label(uint8_t * buffer, const char * label)
+{
+    size_t size = strlen(label);
+
+    buffer[0] = size;
+    memcpy(buffer + 1, label, size);
+    return size + 1;
+}
+
+/**
+ * \brief Write the query of a lookup. The hostname of an address is its
+ *    PTR record (RFC 1035, 3.5 and RFC 3596, 2.5). Its origin AS is the
+ *    TXT record of the same labels in origin(6).asn.cymru.com, e.g.
+ *    "15169 | 8.8.8.0/24 | US | arin | 2014-03-14" for 8.8.8.8.
+ * \param query The query, whose address, lookup and id are set.
+ * \return true iif successful.
+ */
+
+static bool resolver_query_write(resolver_query_t * query)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t         * buffer = query->packet;
+    const uint8_t   * bytes;
+    char              label[4];
+    size_t            offset = DNS_HEADER_SIZE;
+    int               i;
+
+    memset(buffer, 0, DNS_HEADER_SIZE);
+    write_uint16(buffer,     query->id);
+    write_uint16(buffer + 2, DNS_FLAG_RD);
+    write_uint16(buffer + 4, 1); // QDCOUNT
+
+    switch (query->address.family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            // d.c.b.a.in-addr.arpa
+            bytes = (const uint8_t *) &query->address.ip.ipv4;
+            for (i = 3; i >= 0; i--) {
+                snprintf(label, sizeof(label), "%u", bytes[i]);
+                offset += dns_write_label(buffer + offset, label);
+            }
+            if (query->lookup == RESOLVER_ASN) {
+                offset += dns_write_label(buffer + offset, RESOLVER_ORIGIN_ZONE);
+            } else {
+                offset += dns_write_label(buffer + offset, "in-addr");
+            }
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            // One label per nibble, from the last one
+            bytes = (const uint8_t *) &query->address.ip.ipv6;
+            label[1] = '\0';
+            for (i = 15; i >= 0; i--) {
+                label[0] = hex[bytes[i] & 0xf];
+                offset += dns_write_label(buffer + offset, label);
+                label[0] = hex[bytes[i] >> 4];
+                offset += dns_write_label(buffer + offset, label);
+            }
+            if (query->lookup == RESOLVER_ASN) {
+                offset += dns_write_label(buffer + offset, RESOLVER_ORIGIN6_ZONE);
+            } else {
+                offset += dns_write_label(buffer + offset, "ip6");
+            }
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    if (query->lookup == RESOLVER_ASN) {
+        offset += dns_write_label(buffer + offset, "asn");
+        offset += dns_write_label(buffer + offset, "cymru");
+        offset += dns_write_label(buffer + offset, "com");
+    } else {
+        offset += dns_write_label(buffer + offset, "arpa");
+    }
+    buffer[offset++] = 0;
+    write_uint16(buffer + offset,     query->lookup == RESOLVER_ASN ? DNS_TYPE_TXT : DNS_TYPE_PTR);
+    write_uint16(buffer + offset + 2, DNS_CLASS_IN);
+    query->size = offset + 4;
+    return true;
+}
+
+/**
+ * \brief Read a (possibly compressed) DNS name (RFC 1035, 4.1.4).
+ * \param message The DNS message.
+ * \param size The size of the message.
+ * \param poffset Points to the offset of the name, updated to the offset
+ *    of the next field.
+ * \param name The buffer in which the name is written (of at least
+ *    DNS_MAX_NAME + 1 bytes), NULL to skip the name.
+ * \return true iif successful.
+ */
+
+static bool dns_read_name(const uint8_t * message, size_t size, size_t * poffset, char * name)
+{
+    size_t offset     = *poffset,
+           length     = 0,
+           num_jumps  = 0,
+           label_size;
+    bool   has_jumped = false;
+
+    while (true) {
+        if (offset >= size) return false;
+        label_size = message[offset];
+
+        if ((label_size & 0xc0) == 0xc0) {
+            // Compression pointer
+            if (offset + 1 >= size || ++num_jumps > DNS_MAX_JUMPS) return false;
+            if (!has_jumped) *poffset = offset + 2;
+            has_jumped = true;
+            offset = ((label_size & 0x3f) << 8) | message[offset + 1];
+            continue;
+        } else if (label_size & 0xc0) {
+            return false;
+        }
+
+        offset++;
+        if (label_size == 0) break;
+        if (offset + label_size > size) return false;
+
+        if (name) {
+            if (length + label_size + 1 > DNS_MAX_NAME) return false;
+            if (length) name[length++] = '.';
+            memcpy(name + length, message + offset, label_size);
+            length += label_size;
+        }
+        offset += label_size;
+    }
+
+    if (name) name[length] = '\0';
+    if (!has_jumped) *poffset = offset;
+    return true;
+}
+
+/**
+ * \brief Check whether a hostname only contains the characters allowed
+ *    by RFC 952 (and '_'), as gethostbyaddr does.
+ * \param hostname The hostname.
+ * \return true iif valid.
+ */
+
+static bool dns_is_valid_hostname(const char * hostname)
+{
+    const char * c;
+
+    if (!*hostname) return false;
+    for (c = hostname; *c; c++) {
+        if (!isalnum((unsigned char) *c) && *c != '-' && *c != '.' && *c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Find the first record of a given type in the answer to a query.
+ * \param message The answer.
+ * \param size The size of the answer, at least query->size.
+ * \param query The query.
+ * \param type The type of the record (the class must be IN).
+ * \param prdoffset Points to the offset of the record data (updated).
+ * \param prdlength Points to the length of the record data (updated).
+ * \param pttl Points to the TTL of the record (updated).
+ * \return true iif found.
+ */
+
+static bool resolver_find_record(
+    const uint8_t          * message,
+    size_t                   size,
+    const resolver_query_t * query,
+    uint16_t                 type,
+    size_t                 * prdoffset,
+    size_t                 * prdlength,
+    uint32_t               * pttl
+) {
+    size_t offset = query->size, i, num_answers;
+
+    if (read_uint16(message + 2) & DNS_RCODE_MASK) return false;
+
+    num_answers = read_uint16(message + 6);
+    for (i = 0; i < num_answers; i++) {
+        if (!dns_read_name(message, size, &offset, NULL)) return false;
+        if (offset + 10 > size) return false;
+
+        *prdoffset = offset + 10;
+        *prdlength = read_uint16(message + offset + 8);
+        if (*prdoffset + *prdlength > size) return false;
+
+        // Skip the other records, e.g. CNAME records (RFC 2317)
+        if (read_uint16(message + offset) == type
+        &&  read_uint16(message + offset + 2) == DNS_CLASS_IN) {
+            *pttl = (uint32_t) read_uint16(message + offset + 4) << 16
+                  | read_uint16(message + offset + 6);
+            return true;
+        }
+        offset = *prdoffset + *prdlength;
+    }
+
+    return false;
+}
+
+/**
+ * \brief Extract the hostname (PTR record) from the answer to a query.
+ * \param message The answer.
+ * \param size The size of the answer, at least query->size.
+ * \param query The query.
+ * \param hostname The buffer in which the hostname is written (of
+ *    at least DNS_MAX_NAME + 1 bytes).
+ * \param pttl Points to the TTL of the record (updated).
+ * \return true iif a valid hostname has been found.
+ */
+
+static bool resolver_parse_hostname(const uint8_t * message, size_t size, const resolver_query_t * query, char * hostname, uint32_t * pttl)
+{
+    size_t rdoffset, rdlength;
+
+    return resolver_find_record(message, size, query, DNS_TYPE_PTR, &rdoffset, &rdlength, pttl)
+        && dns_read_name(message, size, &rdoffset, hostname)
+        && dns_is_valid_hostname(hostname);
+}
+
+/**
+ * \brief Extract the origin AS (TXT record) from the answer to a query.
+ *    If the prefix is announced by several AS, the first one is kept.
+ * \param message The answer.
+ * \param size The size of the answer, at least query->size.
+ * \param query The query.
+ * \param pasn Address of an uint32_t in which the ASN is written.
+ * \param pttl Points to the TTL of the record (updated).
+ * \return true iif an ASN has been found.
+ */
+
+static bool resolver_parse_asn(const uint8_t * message, size_t size, const resolver_query_t * query, uint32_t * pasn, uint32_t * pttl)
+{
+    size_t   rdoffset, rdlength, i, length;
+    uint64_t asn = 0;
+
+    if (!resolver_find_record(message, size, query, DNS_TYPE_TXT, &rdoffset, &rdlength, pttl) || rdlength == 0) {
+        return false;
+    }
+
+    // The record data starts with a <character-string>: a length byte
+    // followed by the text.
+    length = message[rdoffset];
+    if (length + 1 > rdlength) return false;
+
+    for (i = 1; i <= length && isdigit(message[rdoffset + i]); i++) {
+        asn = 10 * asn + (message[rdoffset + i] - '0');
+        if (asn > UINT32_MAX) return false;
+    }
+
+    *pasn = asn;
+    return i > 1 && asn != 0;
+}
+
+/**
+ * \brief Store the result of a lookup in the corresponding cache.
+ * \param query The query.
+ * \param message The answer, NULL if the lookup has failed.
+ * \param size The size of the answer, at least query->size.
+ */
+
+static void resolver_cache_result(const resolver_query_t * query, const uint8_t * message, size_t size)
+{
+    char     hostname[DNS_MAX_NAME + 1];
+    uint32_t asn, ttl = 0, record_ttl;
+    uint16_t rcode;
+    bool     found;
+
+    // A timeout or a server failure may be transient: only an answer
+    // denying the record is saved as a failed lookup.
+    if (message) {
+        rcode = read_uint16(message + 2) & DNS_RCODE_MASK;
+        if (rcode == 0 || rcode == DNS_RCODE_NXDOMAIN) ttl = CACHEFILE_NEGATIVE_TTL;
+    }
+
+    switch (query->lookup) {
+        case RESOLVER_HOSTNAME:
+            found = message && resolver_parse_hostname(message, size, query, hostname, &record_ttl);
+            address_cache_hostname(&query->address, found ? hostname : NULL, found ? record_ttl : ttl);
+            break;
+        case RESOLVER_ASN:
+            found = message && resolver_parse_asn(message, size, query, &asn, &record_ttl);
+            whois_cache_asn(&query->address, found ? asn : 0, found ? record_ttl : ttl);
+            break;
+    }
+}
+
+/**
+ * \brief Send a query (again).
+ * \param resolver The resolver.
+ * \param query The query.
+ * \return true iif successful.
+ */
+
+static bool resolver_send_query(resolver_t * resolver, resolver_query_t * query)
+{
+    socklen_t length = resolver->nameserver.ss_family == AF_INET ?
+        sizeof(struct sockaddr_in) :
+        sizeof(struct sockaddr_in6);
+
+    query->num_tries++;
+    query->deadline = get_time_ns() + RESOLVER_TIMEOUT * NSEC_PER_SEC;
+
+    // If the socket buffer is full, the query is sent again on timeout
+    if (sendto(
+        resolver->sockfd, query->packet, query->size, 0,
+        (const struct sockaddr *) &resolver->nameserver, length
+    ) == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("resolver_send_query: sendto");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Arm resolver->timerfd so that it expires when the next query
+ *    times out, disarm it if no query is in flight.
+ * \param resolver The resolver.
+ * \return true iif successful.
+ */
+
+static bool resolver_update_timer(resolver_t * resolver)
+{
+    const resolver_query_t * query;
+    uint64_t                 deadline = UINT64_MAX, now;
+
+    if (!resolver->queries) return update_timer(resolver->timerfd, 0);
+
+    for (query = resolver->queries; query; query = query->next) {
+        if (query->deadline < deadline) deadline = query->deadline;
+    }
+
+    // update_timer disarms the timer if the delay is 0
+    now = get_time_ns();
+    return update_timer(resolver->timerfd, deadline > now ? NS_TO_SECONDS(deadline - now) : 1e-9);
+}
+
+/**
+ * \brief Complete a lookup: cache its result, notify its waiters and
+ *    release the query.
+ * \param resolver The resolver.
+ * \param query The query, which is in flight.
+ * \param message The answer, NULL if the lookup has failed.
+ * \param size The size of the answer, at least query->size.
+ */
+
+static void resolver_complete(resolver_t * resolver, resolver_query_t * query, const uint8_t * message, size_t size)
+{
+    resolver_query_t  ** pquery;
+    resolver_waiter_t  * waiter, * next;
+
+    for (pquery = &resolver->queries; *pquery != query; pquery = &(*pquery)->next);
+    *pquery = query->next;
+    resolver->num_queries--;
+
+    resolver_cache_result(query, message, size);
+
+    // The callbacks may start new lookups
+    for (waiter = query->waiters; waiter; waiter = next) {
+        next = waiter->next;
+        waiter->callback(&query->address, waiter->data);
+        free(waiter);
+    }
+    free(query);
+}
+
+/**
+ * \brief Release a query without notifying its waiters.
+ * \param query The query.
+ */
+
+static void resolver_query_free(resolver_query_t * query)
+{
+    resolver_waiter_t * waiter, * next;
+
+    for (waiter = query->waiters; waiter; waiter = next) {
+        next = waiter->next;
+        free(waiter);
+    }
+    free(query);
+}
+
+resolver_t * resolver_create()
+{
+    resolver_t * resolver;
+
+    if (!(resolver = calloc(1, sizeof(resolver_t)))) goto ERR_MALLOC;
+    resolver_read_nameserver(&resolver->nameserver);
+
+    if ((resolver->sockfd = socket(resolver->nameserver.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        perror("resolver_create: socket");
+        goto ERR_SOCKET;
+    }
+
+    if ((resolver->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        perror("resolver_create: timerfd_create");
+        goto ERR_TIMERFD_CREATE;
+    }
+
+    resolver->next_id = get_time_ns() ^ getpid();
+    return resolver;
+
+ERR_TIMERFD_CREATE:
+    close(resolver->sockfd);
+ERR_SOCKET:
+    free(resolver);
+ERR_MALLOC:
+    return NULL;
+}
+
+void resolver_clear(resolver_t * resolver)
+{
+    resolver_query_t * query, * next;
+
+    for (query = resolver->queries; query; query = next) {
+        next = query->next;
+        resolver_query_free(query);
+    }
+    resolver->queries = NULL;
+    resolver->num_queries = 0;
+    resolver_update_timer(resolver);
+}
+
+void resolver_free(resolver_t * resolver)
+{
+    if (resolver) {
+        resolver_clear(resolver);
+        close(resolver->timerfd);
+        close(resolver->sockfd);
+        free(resolver);
+    }
+}
+
+/**
+ * \brief Retrieve the query in flight having a given DNS identifier.
+ * \param resolver The resolver.
+ * \param id The identifier.
+ * \return The query, NULL if not found.
+ */
+
+static resolver_query_t * resolver_find_query_by_id(const resolver_t * resolver, uint16_t id)
+{
+    resolver_query_t * query;
+
+    for (query = resolver->queries; query && query->id != id; query = query->next);
+    return query;
+}
+
+bool resolver_resolve(
+    resolver_t          * resolver,
+    const address_t     * address,
+    resolver_lookup_t     lookup,
+    resolver_callback_t   callback,
+    void                * data
+) {
+    resolver_query_t  * query;
+    resolver_waiter_t * waiter;
+    char                hostname[DNS_MAX_NAME + 1];
+
+    // Like gethostbyaddr, give precedence to /etc/hosts
+    if (lookup == RESOLVER_HOSTNAME && resolver_read_hosts(address, hostname)) {
+        address_cache_hostname(address, hostname, 0);
+        return false;
+    }
+
+    if (!(waiter = malloc(sizeof(resolver_waiter_t)))) goto ERR_WAITER;
+    waiter->callback = callback;
+    waiter->data     = data;
+
+    // Coalesce the lookups of a same address
+    for (query = resolver->queries; query; query = query->next) {
+        if (query->lookup == lookup && address_equals(&query->address, address)) {
+            waiter->next   = query->waiters;
+            query->waiters = waiter;
+            return true;
+        }
+    }
+
+    if (resolver->num_queries == RESOLVER_MAX_QUERIES) goto ERR_MAX_QUERIES;
+    if (!(query = calloc(1, sizeof(resolver_query_t)))) goto ERR_QUERY;
+
+    // Draw an identifier not in use
+    while (resolver_find_query_by_id(resolver, resolver->next_id)) resolver->next_id++;
+
+    query->address = *address;
+    query->lookup  = lookup;
+    query->id      = resolver->next_id++;
+    if (!resolver_query_write(query)) goto ERR_QUERY_WRITE;
+    if (!resolver_send_query(resolver, query)) goto ERR_SEND_QUERY;
+
+    waiter->next    = NULL;
+    query->waiters  = waiter;
+    query->next     = resolver->queries;
+    resolver->queries = query;
+    resolver->num_queries++;
+    resolver_update_timer(resolver);
+    return true;
+
+ERR_SEND_QUERY:
+ERR_QUERY_WRITE:
+    free(query);
+ERR_QUERY:
+ERR_MAX_QUERIES:
+    free(waiter);
+ERR_WAITER:
+    return false;
+}
+
+bool resolver_process_answers(resolver_t * resolver)
+{
+    uint8_t                  message[RESOLVER_PACKET_SIZE];
+    struct sockaddr_storage  from;
+    socklen_t                from_length;
+    ssize_t                  size;
+    resolver_query_t       * query;
+
+    while (true) {
+        from_length = sizeof(from);
+        if ((size = recvfrom(resolver->sockfd, message, sizeof(message), 0, (struct sockaddr *) &from, &from_length)) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("resolver_process_answers: recvfrom");
+            return false;
+        }
+
+        // Discard the unexpected messages. The question must be the one
+        // we have sent.
+        if (!resolver_is_nameserver(resolver, &from)
+        ||  size < DNS_HEADER_SIZE
+        || !(read_uint16(message + 2) & DNS_FLAG_QR)
+        || !(query = resolver_find_query_by_id(resolver, read_uint16(message)))
+        ||  (size_t) size < query->size
+        ||  read_uint16(message + 4) != 1
+        ||  memcmp(message + DNS_HEADER_SIZE, query->packet + DNS_HEADER_SIZE, query->size - DNS_HEADER_SIZE) != 0
+        ) {
+            continue;
+        }
+
+        resolver_complete(resolver, query, message, size);
+    }
+
+    return resolver_update_timer(resolver);
+}
+
+bool resolver_process_timeouts(resolver_t * resolver)
+{
+    resolver_query_t * query, * next;
+    uint64_t           now = get_time_ns(), expirations;
+
+    // Acknowledge the timer
+    if (read(resolver->timerfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("resolver_process_timeouts: read");
+    }
+
+    for (query = resolver->queries; query; query = next) {
+        next = query->next;
+        if (query->deadline > now) continue;
+
+        if (query->num_tries == RESOLVER_MAX_TRIES || !resolver_send_query(resolver, query)) {
+            resolver_complete(resolver, query, NULL, 0);
+        }
+    }
+
+    return resolver_update_timer(resolver);
+}
+
+int resolver_get_sockfd(const resolver_t * resolver) {
+    return resolver->sockfd;
+}
+
+int resolver_get_timerfd(const resolver_t * resolver) {
+    return resolver->timerfd;
+}
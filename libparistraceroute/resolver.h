@@ -0,0 +1,160 @@
+#include "use.h"
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+/**
+ * \file resolver.h
+ * \brief Asynchronous reverse DNS and origin AS lookups.
+ *
+ * address_resolv relies on gethostbyaddr, and whois_get_asn on two whois
+ * TCP connections, which block the calling thread until the servers
+ * answer (or time out): when called from a pt_loop handler, no probe is
+ * sent or received meanwhile.
+ *
+ * A resolver_t sends the DNS queries itself on a non-blocking UDP socket,
+ * to the first nameserver of /etc/resolv.conf (once /etc/hosts has been
+ * looked up), and is driven by pt_loop
+ * (see resolver_get_sockfd and resolver_get_timerfd). Concurrent lookups
+ * of a same address are coalesced in a single query. The results (even
+ * the failed ones) are stored in the cache of address_resolv (hostnames)
+ * or whois_get_asn (origin AS, looked up in the DNS zones of Team Cymru),
+ * which then return immediately.
+ */
+
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint*_t
+#include <stddef.h>     // size_t
+#include <sys/socket.h> // sockaddr_storage
+
+#include "address.h"    // address_t
+
+// Maximum number of queries in flight
+#define RESOLVER_MAX_QUERIES 256
+
+// Number of seconds before a query is sent again
+#define RESOLVER_TIMEOUT     2
+
+// Number of times a query is sent before the lookup is considered as failed
+#define RESOLVER_MAX_TRIES   2
+
+// Maximum size of a DNS message (RFC 1035, 4.2.1)
+#define RESOLVER_PACKET_SIZE 512
+
+typedef enum {
+    RESOLVER_HOSTNAME, /**< The hostname of the address (see address_resolv) */
+    RESOLVER_ASN       /**< The origin AS of the address (see whois_get_asn) */
+} resolver_lookup_t;
+
+/**
+ * \brief Called once a lookup is over. Its result is cached.
+ * \param address The looked up address.
+ * \param data The data passed to resolver_resolve.
+ */
+
+typedef void (* resolver_callback_t)(const address_t * address, void * data);
+
+typedef struct resolver_waiter_s {
+    resolver_callback_t         callback; /**< Called once the lookup is over */
+    void                      * data;     /**< Passed to callback */
+    struct resolver_waiter_s  * next;     /**< Next waiter of the same query */
+} resolver_waiter_t;
+
+typedef struct resolver_query_s {
+    address_t                   address;                      /**< The looked up address */
+    resolver_lookup_t           lookup;                       /**< What is looked up */
+    uint16_t                    id;                           /**< DNS identifier of the query */
+    uint8_t                     packet[RESOLVER_PACKET_SIZE]; /**< The query, sent again on timeout */
+    size_t                      size;                         /**< Size of packet */
+    size_t                      num_tries;                    /**< Number of times the query has been sent */
+    uint64_t                    deadline;                     /**< When the query times out (see get_time_ns) */
+    resolver_waiter_t         * waiters;                      /**< Callbacks waiting for this lookup */
+    struct resolver_query_s   * next;                         /**< Next query in flight */
+} resolver_query_t;
+
+typedef struct {
+    int                         sockfd;         /**< UDP socket sending the queries and receiving the answers */
+    int                         timerfd;        /**< Expires once the oldest query times out */
+    struct sockaddr_storage     nameserver;     /**< The DNS server */
+    uint16_t                    next_id;        /**< DNS identifier of the next query */
+    resolver_query_t          * queries;        /**< Queries in flight */
+    size_t                      num_queries;    /**< Number of queries in flight */
+} resolver_t;
+
+/**
+ * \brief Create a resolver_t instance.
+ * \return The newly created resolver, NULL if no nameserver can be used.
+ */
+
+resolver_t * resolver_create();
+
+/**
+ * \brief Release a resolver_t instance. The lookups in flight are
+ *    discarded without calling their callbacks.
+ * \param resolver The resolver.
+ */
+
+void resolver_free(resolver_t * resolver);
+
+/**
+ * \brief Look up an address. If it is already being looked up, the
+ *    callback waits for the query in flight.
+ * \param resolver The resolver.
+ * \param address The address to look up.
+ * \param lookup What is looked up.
+ * \param callback Called once the lookup is over (never from this call).
+ * \param data Passed to callback.
+ * \return true iif the lookup is in flight. Otherwise, callback will not
+ *    be called: either the hostname is listed in /etc/hosts, and has
+ *    been cached, or the lookup cannot be started (e.g. too many
+ *    queries in flight).
+ */
+
+bool resolver_resolve(
+    resolver_t          * resolver,
+    const address_t     * address,
+    resolver_lookup_t     lookup,
+    resolver_callback_t   callback,
+    void                * data
+);
+
+/**
+ * \brief Discard the lookups in flight without calling their callbacks.
+ * \param resolver The resolver.
+ */
+
+void resolver_clear(resolver_t * resolver);
+
+/**
+ * \brief Process the answers received on resolver->sockfd.
+ * \param resolver The resolver.
+ * \return true iif successful.
+ */
+
+bool resolver_process_answers(resolver_t * resolver);
+
+/**
+ * \brief Send again or give up the queries which have timed out.
+ * \param resolver The resolver.
+ * \return true iif successful.
+ */
+
+bool resolver_process_timeouts(resolver_t * resolver);
+
+/**
+ * \brief Retrieve the socket receiving the answers.
+ * \param resolver The resolver.
+ * \return The file descriptor to watch.
+ */
+
+int resolver_get_sockfd(const resolver_t * resolver);
+
+/**
+ * \brief Retrieve the timer activated once a query times out.
+ * \param resolver The resolver.
+ * \return The file descriptor to watch.
+ */
+
+int resolver_get_timerfd(const resolver_t * resolver);
+
+#endif // RESOLVER_H
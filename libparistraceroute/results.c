@@ -0,0 +1,113 @@
+#include "config.h"
+
+#include <stdlib.h>     // malloc, calloc, realloc, free
+#include <string.h>     // memset
+#include <math.h>       // sqrt
+
+#include "results.h"
+
+/**
+ * \brief (Internal usage) Make room for one more record in an array of a
+ *    results_t, whose capacity is doubled whenever it is full.
+ * \param precords Address of the array.
+ * \param num_records Number of records stored in the array.
+ * \param pmax_records Address of the number of records allocated.
+ * \param record_size The size of a record.
+ * \return true iif successful
+ */
+
+static bool results_reserve(void ** precords, size_t num_records, size_t * pmax_records, size_t record_size) {
+    size_t   max_records;
+    void   * records;
+
+    if (num_records < *pmax_records) return true;
+    max_records = *pmax_records ? 2 * *pmax_records : RESULTS_SIZE_INIT;
+    if (!(records = realloc(*precords, max_records * record_size))) return false;
+    *precords = records;
+    *pmax_records = max_records;
+    return true;
+}
+
+results_t * results_create() {
+    return calloc(1, sizeof(results_t));
+}
+
+void results_free(results_t * results) {
+    if (results) {
+        free(results->hops);
+        free(results->links);
+        free(results);
+    }
+}
+
+bool results_add_hop(results_t * results, const probe_t * probe, const probe_t * reply) {
+    result_hop_t * hop;
+
+    if (!results
+    ||  !results_reserve((void **) &results->hops, results->num_hops, &results->max_hops, sizeof(result_hop_t))
+    ) {
+        return false;
+    }
+
+    hop = &results->hops[results->num_hops++];
+    memset(hop, 0, sizeof(result_hop_t));
+    probe_extract(probe, "ttl", &hop->ttl);
+    probe_get_flow_id(probe, &hop->flow_id);
+    if (reply) {
+        probe_extract(reply, "src_ip", &hop->address);
+        hop->rtt = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+
+        // The ICMP header follows the IP header of the reply
+        if (probe_extract_ext(reply, "type", 1, &hop->icmp_type)) {
+            probe_extract_ext(reply, "code", 1, &hop->icmp_code);
+        }
+    } else {
+        hop->is_star = true;
+    }
+    return true;
+}
+
+bool results_add_link(results_t * results, uint8_t ttl, const address_t * from, const address_t * to) {
+    result_link_t * link;
+
+    if (!results
+    ||  !results_reserve((void **) &results->links, results->num_links, &results->max_links, sizeof(result_link_t))
+    ) {
+        return false;
+    }
+
+    link = &results->links[results->num_links++];
+    memset(link, 0, sizeof(result_link_t));
+    link->ttl = ttl;
+    if (from) link->from = *from;
+    if (to)   link->to   = *to;
+    return true;
+}
+
+void results_add_stats(results_t * results, const probe_t * probe, const probe_t * reply) {
+    result_stats_t * stats;
+    int64_t          rtt;
+    double           delta;
+
+    if (!results) return;
+    stats = &results->stats;
+    results->has_stats = true;
+    stats->num_probes++;
+    if (!reply) {
+        stats->num_losses++;
+        return;
+    }
+
+    rtt = probe_get_recv_time(reply) - probe_get_sending_time(probe);
+    if (rtt < 0) rtt = 0;
+    if (!stats->num_rtts || (uint64_t) rtt < stats->rtt_min) stats->rtt_min = rtt;
+    if (!stats->num_rtts || (uint64_t) rtt > stats->rtt_max) stats->rtt_max = rtt;
+
+    // Welford's algorithm
+    delta = rtt - results->rtt_mean;
+    stats->num_rtts++;
+    results->rtt_mean += delta / stats->num_rtts;
+    results->rtt_m2   += delta * (rtt - results->rtt_mean);
+    stats->rtt_mean = results->rtt_mean;
+    stats->rtt_mdev = sqrt(results->rtt_m2 / stats->num_rtts);
+}
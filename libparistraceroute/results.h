@@ -0,0 +1,140 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+/**
+ * \file results.h
+ * \brief Compact results filled by an algorithm instance (see
+ *    algorithm_instance_t::outputs).
+ *
+ * The events raised by traceroute, mda and ping carry the probes and the
+ * replies, so a caller building its results from them has to keep whole
+ * probes and packets around. Instead, these algorithms also append each
+ * result to contiguous arrays of fixed-size records:
+ * - traceroute: a result_hop_t per reply or lost probe, once its hop is
+ *   reported to the caller;
+ * - mda: a result_link_t per link discovered;
+ * - ping: the result_stats_t summarizing the probes accounted so far,
+ *   updated in constant time and memory per probe.
+ *
+ * The caller reads them (e.g. in its ALGORITHM_HAS_TERMINATED handler)
+ * until the instance is released by pt_stop_instance, so it may release
+ * the probes and the replies of the events as soon as it has handled them.
+ * A record holds no pointer, so an array may be written as is.
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+
+#include "address.h"    // address_t
+#include "probe.h"      // probe_t
+
+// Initial number of records of an array of a results_t.
+#define RESULTS_SIZE_INIT 16
+
+/**
+ * \struct result_hop_t
+ * \brief The outcome of a probe sent by traceroute.
+ */
+
+typedef struct {
+    address_t address;   /**< The interface which has replied (family is 0 if the probe is lost) */
+    uint64_t  rtt;       /**< Round-trip time (in nanoseconds), 0 if the probe is lost */
+    uint16_t  flow_id;   /**< Flow identifier of the probe */
+    uint8_t   ttl;       /**< TTL of the probe */
+    uint8_t   icmp_type; /**< ICMP type of the reply, 0 if the probe is lost or if the reply is not an ICMP packet */
+    uint8_t   icmp_code; /**< ICMP code of the reply (idem) */
+    bool      is_star;   /**< True iif the probe is lost */
+} result_hop_t;
+
+/**
+ * \struct result_link_t
+ * \brief A link discovered by mda.
+ */
+
+typedef struct {
+    address_t from;      /**< Source of the link (family is 0 if unknown, i.e. a star) */
+    address_t to;        /**< Target of the link (idem) */
+    uint8_t   ttl;       /**< First TTL of the source */
+} result_link_t;
+
+/**
+ * \struct result_stats_t
+ * \brief The statistics of a ping instance.
+ */
+
+typedef struct {
+    size_t    num_probes; /**< Number of probes replied or lost so far */
+    size_t    num_losses; /**< Number of probes lost or answered by an error */
+    size_t    num_rtts;   /**< Number of RTTs measured */
+    uint64_t  rtt_min;    /**< Smallest RTT (in nanoseconds), 0 if num_rtts is 0 */
+    uint64_t  rtt_max;    /**< Greatest RTT (idem) */
+    uint64_t  rtt_mean;   /**< Mean of the RTTs (idem) */
+    uint64_t  rtt_mdev;   /**< Standard deviation of the RTTs (idem) */
+} result_stats_t;
+
+/**
+ * \struct results_t
+ * \brief The results of an algorithm instance.
+ */
+
+typedef struct results_s {
+    result_hop_t   * hops;      /**< The hops, in the order they are reported */
+    size_t           num_hops;  /**< Number of hops */
+    size_t           max_hops;  /**< Number of hops allocated */
+    result_link_t  * links;     /**< The links, in the order they are discovered */
+    size_t           num_links; /**< Number of links */
+    size_t           max_links; /**< Number of links allocated */
+    result_stats_t   stats;     /**< The statistics (ping) */
+    bool             has_stats; /**< True iif stats is set */
+    double           rtt_mean;  /**< (Internal usage) Mean of the RTTs (in nanoseconds) */
+    double           rtt_m2;    /**< (Internal usage) Sum of the squared differences between the RTTs and rtt_mean (Welford's algorithm) */
+} results_t;
+
+/**
+ * \brief Create an empty results_t instance.
+ * \return The newly created results_t instance, NULL in case of failure.
+ */
+
+results_t * results_create();
+
+/**
+ * \brief Release a results_t instance from the memory.
+ * \param results A results_t instance (may be NULL).
+ */
+
+void results_free(results_t * results);
+
+/**
+ * \brief Append the outcome of a probe.
+ * \param results A results_t instance, NULL if it cannot be allocated
+ *    (see pt_get_results).
+ * \param probe The probe.
+ * \param reply Its reply, NULL if it is lost.
+ * \return true iif successful
+ */
+
+bool results_add_hop(results_t * results, const probe_t * probe, const probe_t * reply);
+
+/**
+ * \brief Append a link.
+ * \param results A results_t instance, NULL if it cannot be allocated.
+ * \param ttl The first TTL of the source of the link.
+ * \param from The source of the link, NULL if unknown.
+ * \param to The target of the link, NULL if unknown.
+ * \return true iif successful
+ */
+
+bool results_add_link(results_t * results, uint8_t ttl, const address_t * from, const address_t * to);
+
+/**
+ * \brief Account a probe in the statistics.
+ * \param results A results_t instance, NULL if it cannot be allocated.
+ * \param probe The probe.
+ * \param reply Its reply if it has reached the destination, NULL if it is
+ *    lost or answered by an error.
+ */
+
+void results_add_stats(results_t * results, const probe_t * probe, const probe_t * reply);
+
+#endif // RESULTS_H
@@ -0,0 +1,119 @@
+#include "config.h"
+
+#include <stdint.h>     // uint8_t, uint32_t
+#include <stdlib.h>     // calloc, free
+
+#include "rtt_estimator.h"
+
+rtt_estimator_t * rtt_estimator_create(double min_timeout, double max_timeout)
+{
+    rtt_estimator_t * estimator;
+
+    if (min_timeout < 0 || max_timeout < min_timeout)      goto ERR_INVALID_PARAMETER;
+    if (!(estimator = calloc(1, sizeof(rtt_estimator_t)))) goto ERR_CALLOC;
+
+    estimator->min_timeout = min_timeout;
+    estimator->max_timeout = max_timeout;
+    return estimator;
+
+ERR_CALLOC:
+ERR_INVALID_PARAMETER:
+    return NULL;
+}
+
+void rtt_estimator_free(rtt_estimator_t * estimator) {
+    if (estimator) free(estimator);
+}
+
+/**
+ * \brief Compute the hash of a destination.
+ * \param dst The destination.
+ * \return The corresponding hash.
+ */
+
+static uint32_t rtt_estimator_hash(const address_t * dst)
+{
+    const uint8_t * bytes = (const uint8_t *) &dst->ip;
+    uint32_t        hash = 2166136261u; // FNV-1a
+    size_t          i, size = address_get_size(dst);
+
+    for (i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static inline bool rtt_estimation_match(const rtt_estimation_t * estimation, const address_t * dst) {
+    return estimation->dst.family == dst->family
+        && address_equals(&estimation->dst, dst);
+}
+
+/**
+ * \brief Retrieve the estimation related to a destination.
+ * \param estimator An rtt_estimator_t instance.
+ * \param dst The destination.
+ * \return The corresponding estimation, NULL if not found.
+ */
+
+static const rtt_estimation_t * rtt_estimator_find(const rtt_estimator_t * estimator, const address_t * dst)
+{
+    const rtt_estimation_t * slot;
+    uint32_t                 hash = rtt_estimator_hash(dst);
+    size_t                   i;
+
+    for (i = 0; i < RTT_ESTIMATOR_MAX_PROBES; i++) {
+        slot = &estimator->dsts[(hash + i) & (RTT_ESTIMATOR_NUM_DSTS - 1)];
+        if (rtt_estimation_match(slot, dst)) return slot;
+        if (!slot->dst.family) break;
+    }
+    return NULL;
+}
+
+void rtt_estimator_update(rtt_estimator_t * estimator, const address_t * dst, double rtt)
+{
+    rtt_estimation_t * slot,
+                     * free_slot = NULL;
+    uint32_t           hash;
+    size_t             i;
+    double             delta;
+
+    if (!dst->family || rtt < 0) return;
+    hash = rtt_estimator_hash(dst);
+
+    for (i = 0; i < RTT_ESTIMATOR_MAX_PROBES; i++) {
+        slot = &estimator->dsts[(hash + i) & (RTT_ESTIMATOR_NUM_DSTS - 1)];
+
+        if (rtt_estimation_match(slot, dst)) {
+            delta = slot->srtt - rtt;
+            slot->rttvar += RTT_ESTIMATOR_BETA * ((delta < 0 ? -delta : delta) - slot->rttvar);
+            slot->srtt   += RTT_ESTIMATOR_ALPHA * (rtt - slot->srtt);
+            return;
+        }
+
+        if (!slot->dst.family) {
+            free_slot = slot;
+            break;
+        }
+    }
+
+    // Every slot is in use: replace the estimation of another destination
+    if (!free_slot) free_slot = &estimator->dsts[hash & (RTT_ESTIMATOR_NUM_DSTS - 1)];
+
+    // First sample (RFC 6298, section 2.2)
+    free_slot->dst    = *dst;
+    free_slot->srtt   = rtt;
+    free_slot->rttvar = rtt / 2;
+}
+
+double rtt_estimator_get_timeout(const rtt_estimator_t * estimator, const address_t * dst)
+{
+    const rtt_estimation_t * estimation;
+    double                   timeout;
+
+    if (!dst->family || !(estimation = rtt_estimator_find(estimator, dst))) {
+        return estimator->max_timeout;
+    }
+
+    timeout = estimation->srtt + 4 * estimation->rttvar;
+    if (timeout < estimator->min_timeout) timeout = estimator->min_timeout;
+    if (timeout > estimator->max_timeout) timeout = estimator->max_timeout;
+    return timeout;
+}
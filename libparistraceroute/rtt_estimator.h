@@ -0,0 +1,91 @@
+#include "use.h"
+
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+/**
+ * \file rtt_estimator.h
+ * \brief Adaptive probe timeouts, estimated per destination.
+ *
+ * An rtt_estimator_t maintains, for each destination, a smoothed RTT and
+ * an RTT variation computed like the TCP retransmission timeout (RFC 6298).
+ * The timeout of a probe is then srtt + 4 * rttvar, bounded by a minimum
+ * and a maximum timeout. A destination from which no reply has been
+ * received yet gets the maximum timeout.
+ *
+ * The estimations are stored in a fixed-size hash table. If no slot is
+ * available, the estimation of a destination replaces another one.
+ */
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+
+#include "address.h"  // address_t
+
+// Number of destinations tracked at once. Must be a power of 2.
+#define RTT_ESTIMATOR_NUM_DSTS 4096
+
+// Maximum number of slots probed when seeking the estimation of a destination.
+#define RTT_ESTIMATOR_MAX_PROBES 8
+
+// Weights of the new samples (RFC 6298, section 2).
+#define RTT_ESTIMATOR_ALPHA 0.125
+#define RTT_ESTIMATOR_BETA  0.25
+
+/**
+ * \struct rtt_estimation_t
+ * \brief The RTT estimated towards a destination.
+ */
+
+typedef struct {
+    address_t dst;    /**< The destination (family == 0 if this slot is unused) */
+    double    srtt;   /**< Smoothed RTT (in seconds) */
+    double    rttvar; /**< RTT variation (in seconds) */
+} rtt_estimation_t;
+
+/**
+ * \struct rtt_estimator_t
+ * \brief Structure describing an RTT estimator.
+ */
+
+typedef struct {
+    double           min_timeout; /**< Lower bound of the timeouts (in seconds) */
+    double           max_timeout; /**< Upper bound of the timeouts (in seconds) */
+    rtt_estimation_t dsts[RTT_ESTIMATOR_NUM_DSTS]; /**< The estimations, indexed by destination */
+} rtt_estimator_t;
+
+/**
+ * \brief Create an rtt_estimator_t instance.
+ * \param min_timeout The lower bound of the timeouts (in seconds).
+ * \param max_timeout The upper bound of the timeouts (in seconds).
+ * \return The newly allocated rtt_estimator_t instance, NULL in case of failure.
+ */
+
+rtt_estimator_t * rtt_estimator_create(double min_timeout, double max_timeout);
+
+/**
+ * \brief Release an rtt_estimator_t instance from the memory.
+ * \param estimator An rtt_estimator_t instance.
+ */
+
+void rtt_estimator_free(rtt_estimator_t * estimator);
+
+/**
+ * \brief Update the estimation related to a destination with a new sample.
+ * \param estimator An rtt_estimator_t instance.
+ * \param dst The destination of the probe.
+ * \param rtt The RTT measured for this probe (in seconds).
+ */
+
+void rtt_estimator_update(rtt_estimator_t * estimator, const address_t * dst, double rtt);
+
+/**
+ * \brief Compute the timeout of a probe sent towards a destination.
+ * \param estimator An rtt_estimator_t instance.
+ * \param dst The destination of the probe.
+ * \return The timeout (in seconds).
+ */
+
+double rtt_estimator_get_timeout(const rtt_estimator_t * estimator, const address_t * dst);
+
+#endif
@@ -0,0 +1,926 @@
+#include <stdlib.h>          // malloc, calloc, realloc, free, strtod, strtoul, strtoull
+#include <stdio.h>           // fopen, getline, fprintf, perror
+#include <string.h>          // memcpy, memset, strchr, strcmp, strtok_r
+#include <errno.h>           // errno, EAGAIN
+#include <unistd.h>          // read, close
+#include <sys/socket.h>      // AF_INET, AF_INET6, AF_UNSPEC
+#include <sys/timerfd.h>     // timerfd_create, timerfd_settime
+#include <arpa/inet.h>       // htons, htonl, inet_pton
+#include <netinet/in.h>      // IPPROTO_*
+#include <netinet/ip.h>      // struct ip
+#include <netinet/ip_icmp.h> // struct icmp, ICMP_*
+#include <netinet/ip6.h>     // struct ip6_hdr
+#include <netinet/icmp6.h>   // struct icmp6_hdr, ICMP6_*
+
+#include "simulator.h"
+#include "common.h"          // get_time_ns, NS_TO_SECONDS, SECONDS_TO_NS, MIN, MAX
+#include "csum.h"            // csum, csum_add
+
+// Hop limit of the replies sent by the hops and by the destinations
+#define SIMULATOR_HOP_TTL         255
+#define SIMULATOR_DESTINATION_TTL 64
+
+// Maximum size of a reply (RFC 1812 and RFC 4443)
+#define SIMULATOR_IPV4_MAX_REPLY_SIZE 576
+#define SIMULATOR_IPV6_MAX_REPLY_SIZE 1280
+
+// Default RTT of each hop (in seconds), multiplied by its TTL
+#define SIMULATOR_DEFAULT_RTT 0.001
+
+/**
+ * \struct simulator_reply_t
+ * \brief A reply in transit.
+ */
+
+typedef struct {
+    wheel_timer_t   timer;  /**< Expires when the reply must be delivered */
+    packet_t      * packet; /**< The reply */
+} simulator_reply_t;
+
+//---------------------------------------------------------------------------
+// Pseudo-random generator (splitmix64)
+//---------------------------------------------------------------------------
+
+static inline uint64_t simulator_mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x  = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x  = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * \brief Draw a pseudo-random number.
+ * \param simulator A simulator_t instance.
+ * \return The drawn number.
+ */
+
+static inline uint64_t simulator_next(simulator_t * simulator) {
+    simulator->state += 0x9e3779b97f4a7c15ULL;
+    return simulator_mix(simulator->state);
+}
+
+/**
+ * \brief Draw a number uniformly distributed in [0, 1).
+ * \param simulator A simulator_t instance.
+ * \return The drawn number.
+ */
+
+static inline double simulator_random(simulator_t * simulator) {
+    return (simulator_next(simulator) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/**
+ * \brief Hash the flow of a packet, i.e. its addresses, its protocol and
+ *    its ports (UDP and TCP), as a per-flow load balancer would.
+ * \param addresses Its source and destination addresses.
+ * \param addresses_size Size of addresses (in bytes).
+ * \param protocol Its transport protocol.
+ * \param transport The transport header.
+ * \param transport_size Size of the transport header and of its payload.
+ * \return The hash of the flow.
+ */
+
+static uint64_t simulator_hash_flow(
+    const uint8_t * addresses,
+    size_t          addresses_size,
+    uint8_t         protocol,
+    const uint8_t * transport,
+    size_t          transport_size
+) {
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    size_t   i;
+
+    for (i = 0; i < addresses_size; i++) {
+        hash = (hash ^ addresses[i]) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ protocol) * 0x100000001b3ULL;
+    if ((protocol == IPPROTO_UDP || protocol == IPPROTO_TCP) && transport_size >= 4) {
+        for (i = 0; i < 4; i++) {
+            hash = (hash ^ transport[i]) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+//---------------------------------------------------------------------------
+// Topology
+//---------------------------------------------------------------------------
+
+static void simulator_hop_init(simulator_hop_t * hop) {
+    memset(hop, 0, sizeof(simulator_hop_t));
+    hop->rtt = -1;
+}
+
+static void simulator_path_free(simulator_path_t * path) {
+    size_t i;
+
+    for (i = 0; i < path->num_hops; i++) {
+        free(path->hops[i].interfaces);
+    }
+    free(path->hops);
+}
+
+/**
+ * \brief Append a hop to a path.
+ * \param path A simulator_path_t instance.
+ * \param hop The appended hop. Its interfaces are duplicated.
+ * \return true iif successful.
+ */
+
+static bool simulator_path_push_hop(simulator_path_t * path, const simulator_hop_t * hop) {
+    simulator_hop_t * hops;
+    simulator_hop_t * pushed;
+
+    if (!(hops = realloc(path->hops, (path->num_hops + 1) * sizeof(simulator_hop_t)))) return false;
+    path->hops = hops;
+
+    pushed = &path->hops[path->num_hops];
+    *pushed = *hop;
+    if (hop->num_interfaces > 0) {
+        if (!(pushed->interfaces = malloc(hop->num_interfaces * sizeof(simulator_interface_t)))) return false;
+        memcpy(pushed->interfaces, hop->interfaces, hop->num_interfaces * sizeof(simulator_interface_t));
+    }
+    path->num_hops++;
+    return true;
+}
+
+/**
+ * \brief Parse the parameters (per-flow, per-packet, rtt, loss, rate, mtu)
+ *    ending a line of the topology file.
+ * \param token The first parameter.
+ * \param saveptr The state of strtok_r.
+ * \param hop The hop to update.
+ * \return true iif successful.
+ */
+
+static bool simulator_parse_parameters(char * token, char ** saveptr, simulator_hop_t * hop)
+{
+    char * value, * end;
+
+    for (; token; token = strtok_r(NULL, " \t\n", saveptr)) {
+        if (strcmp(token, "per-flow") == 0) {
+            hop->is_per_packet = false;
+        } else if (strcmp(token, "per-packet") == 0) {
+            hop->is_per_packet = true;
+        } else if (!(value = strtok_r(NULL, " \t\n", saveptr))) {
+            return false;
+        } else if (strcmp(token, "rtt") == 0) {
+            hop->rtt = strtod(value, &end) / 1000;
+            if (*end || hop->rtt < 0) return false;
+        } else if (strcmp(token, "loss") == 0) {
+            hop->loss = strtod(value, &end);
+            if (*end || hop->loss < 0 || hop->loss > 1) return false;
+        } else if (strcmp(token, "rate") == 0) {
+            hop->rate = strtod(value, &end);
+            if (*end || hop->rate < 0) return false;
+        } else if (strcmp(token, "mtu") == 0) {
+            hop->mtu = strtoul(value, &end, 10);
+            if (*end || *value == '-') return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Parse a hop of the topology file, and append it to the
+ *    corresponding path(s).
+ * \param simulator A simulator_t instance.
+ * \param saveptr The state of strtok_r (the "hop" keyword is consumed).
+ * \return true iif successful.
+ */
+
+static bool simulator_parse_hop(simulator_t * simulator, char ** saveptr)
+{
+    simulator_hop_t         hop;
+    simulator_interface_t * interfaces;
+    address_t               address;
+    char                  * token;
+    int                     family = AF_UNSPEC;
+    bool                    ret = false;
+
+    simulator_hop_init(&hop);
+    for (token = strtok_r(NULL, " \t\n", saveptr); token; token = strtok_r(NULL, " \t\n", saveptr)) {
+        if (strcmp(token, "*") == 0) continue;
+
+        memset(&address, 0, sizeof(address_t));
+        address.family = strchr(token, ':') ? AF_INET6 : AF_INET;
+        if (inet_pton(address.family, token, &address.ip) != 1) break;
+
+        // The interfaces of a hop belong to the same address family
+        if (family != AF_UNSPEC && family != address.family) goto ERR_PARSE;
+        family = address.family;
+
+        if (!(interfaces = realloc(hop.interfaces, (hop.num_interfaces + 1) * sizeof(simulator_interface_t)))) {
+            goto ERR_PARSE;
+        }
+        hop.interfaces = interfaces;
+        memset(&hop.interfaces[hop.num_interfaces], 0, sizeof(simulator_interface_t));
+        hop.interfaces[hop.num_interfaces++].address = address;
+    }
+
+    if (!simulator_parse_parameters(token, saveptr, &hop)) goto ERR_PARSE;
+
+    ret = (family == AF_INET6 || simulator_path_push_hop(&simulator->ipv4_path, &hop))
+       && (family == AF_INET  || simulator_path_push_hop(&simulator->ipv6_path, &hop));
+
+ERR_PARSE:
+    free(hop.interfaces);
+    return ret;
+}
+
+/**
+ * \brief Release the routers of a simulated network.
+ * \param simulator A simulator_t instance.
+ */
+
+static void simulator_routers_free(simulator_t * simulator) {
+    size_t i;
+
+    for (i = 0; i < simulator->num_routers; i++) {
+        free(simulator->routers[i].addresses);
+    }
+    free(simulator->routers);
+}
+
+/**
+ * \brief Parse a router of the topology file.
+ * \param simulator A simulator_t instance.
+ * \param saveptr The state of strtok_r (the "router" keyword is consumed).
+ * \return true iif successful.
+ */
+
+static bool simulator_parse_router(simulator_t * simulator, char ** saveptr)
+{
+    simulator_router_t * routers,
+                       * router;
+    address_t          * addresses;
+    char               * token;
+
+    if (!(routers = realloc(simulator->routers, (simulator->num_routers + 1) * sizeof(simulator_router_t)))) return false;
+    simulator->routers = routers;
+    router = &simulator->routers[simulator->num_routers++];
+    memset(router, 0, sizeof(simulator_router_t));
+
+    for (token = strtok_r(NULL, " \t\n", saveptr); token; token = strtok_r(NULL, " \t\n", saveptr)) {
+        if (!(addresses = realloc(router->addresses, (router->num_addresses + 1) * sizeof(address_t)))) return false;
+        router->addresses = addresses;
+        memset(&addresses[router->num_addresses], 0, sizeof(address_t));
+        addresses[router->num_addresses].family = strchr(token, ':') ? AF_INET6 : AF_INET;
+        if (inet_pton(addresses[router->num_addresses].family, token, &addresses[router->num_addresses].ip) != 1) return false;
+        router->num_addresses++;
+    }
+    return router->num_addresses > 0;
+}
+
+/**
+ * \brief Parse a line of the topology file.
+ * \param simulator A simulator_t instance.
+ * \param line The line.
+ * \return true iif successful.
+ */
+
+static bool simulator_parse_line(simulator_t * simulator, char * line)
+{
+    char * token,
+         * saveptr,
+         * end;
+
+    if ((token = strchr(line, '#'))) *token = '\0';
+    if (!(token = strtok_r(line, " \t\n", &saveptr))) return true;
+
+    if (strcmp(token, "hop") == 0) {
+        return simulator_parse_hop(simulator, &saveptr);
+    } else if (strcmp(token, "router") == 0) {
+        return simulator_parse_router(simulator, &saveptr);
+    } else if (strcmp(token, "destination") == 0) {
+        if ((token = strtok_r(NULL, " \t\n", &saveptr)) && strcmp(token, "silent") == 0) {
+            simulator->destination.num_interfaces = 0;
+            token = strtok_r(NULL, " \t\n", &saveptr);
+        }
+        return simulator_parse_parameters(token, &saveptr, &simulator->destination);
+    } else if (strcmp(token, "seed") == 0) {
+        if (!(token = strtok_r(NULL, " \t\n", &saveptr))) return false;
+        simulator->seed = strtoull(token, &end, 10);
+        return !*end && !strtok_r(NULL, " \t\n", &saveptr);
+    }
+    return false;
+}
+
+/**
+ * \brief Set the initial IP identification of the interfaces and of the
+ *    routers of a simulated network.
+ * \param simulator A simulator_t instance. Its pseudo-random generator
+ *    is seeded.
+ */
+
+static void simulator_init_ip_ids(simulator_t * simulator)
+{
+    simulator_path_t * paths[] = {&simulator->ipv4_path, &simulator->ipv6_path};
+    size_t             i, j, k;
+
+    for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        for (j = 0; j < paths[i]->num_hops; j++) {
+            for (k = 0; k < paths[i]->hops[j].num_interfaces; k++) {
+                paths[i]->hops[j].interfaces[k].ip_id = simulator_next(simulator);
+            }
+        }
+    }
+    for (i = 0; i < simulator->num_routers; i++) {
+        simulator->routers[i].ip_id = simulator_next(simulator);
+    }
+    if (simulator->destination.num_interfaces) {
+        simulator->destination.interfaces[0].ip_id = simulator_next(simulator);
+    }
+}
+
+/**
+ * \brief Load a topology file.
+ * \param simulator A simulator_t instance.
+ * \param filename The topology file.
+ * \return true iif successful.
+ */
+
+static bool simulator_load(simulator_t * simulator, const char * filename)
+{
+    FILE   * file;
+    char   * line = NULL;
+    size_t   line_size = 0,
+             line_number = 0;
+    bool     ret = true;
+
+    if (!(file = fopen(filename, "r"))) {
+        perror(filename);
+        return false;
+    }
+
+    while (ret && getline(&line, &line_size, file) != -1) {
+        line_number++;
+        if (!(ret = simulator_parse_line(simulator, line))) {
+            fprintf(stderr, "%s:%zu: invalid topology\n", filename, line_number);
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// Replies
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Find the interface of a path owning an address.
+ * \param path A simulator_path_t instance.
+ * \param family The address family of the path.
+ * \param ip The address (raw bytes).
+ * \param pinterface Set to the interface owning this address, NULL if none.
+ * \return The index of the hop of this interface, path->num_hops if none.
+ */
+
+static size_t simulator_path_find(const simulator_path_t * path, int family, const uint8_t * ip, simulator_interface_t ** pinterface)
+{
+    size_t i, j,
+           size = family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+
+    for (i = 0; i < path->num_hops; i++) {
+        for (j = 0; j < path->hops[i].num_interfaces; j++) {
+            if (memcmp(&path->hops[i].interfaces[j].address.ip, ip, size) == 0) {
+                *pinterface = &path->hops[i].interfaces[j];
+                return i;
+            }
+        }
+    }
+    *pinterface = NULL;
+    return path->num_hops;
+}
+
+/**
+ * \brief Pick the IP identification of a reply, and increment the
+ *    counter it is taken from.
+ * \param simulator A simulator_t instance.
+ * \param interface The interface sending the reply.
+ * \param family The address family of the reply.
+ * \param src_ip The source of the reply (raw bytes).
+ * \return The IP identification of the router of this interface (if
+ *    any), of the interface otherwise. The destinations share a counter,
+ *    offset according to their address.
+ */
+
+static uint16_t simulator_next_ip_id(simulator_t * simulator, simulator_interface_t * interface, int family, const uint8_t * src_ip)
+{
+    simulator_router_t * router;
+    uint64_t             offset = simulator->seed;
+    size_t               i, j,
+                         size = family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+
+    for (i = 0; i < simulator->num_routers; i++) {
+        router = &simulator->routers[i];
+        for (j = 0; j < router->num_addresses; j++) {
+            if (router->addresses[j].family == family
+            &&  memcmp(&router->addresses[j].ip, src_ip, size) == 0) {
+                return router->ip_id++;
+            }
+        }
+    }
+    if (interface == simulator->destination.interfaces) {
+        for (i = 0; i < size; i++) {
+            offset = simulator_mix(offset ^ src_ip[i]);
+        }
+        return interface->ip_id++ + (uint16_t) offset;
+    }
+    return interface->ip_id++;
+}
+
+/**
+ * \brief Take a token of the rate limiter of an interface.
+ * \param hop The hop of this interface.
+ * \param interface The interface.
+ * \param now The current time (in seconds).
+ * \return true iif the interface may reply.
+ */
+
+static bool simulator_take_token(const simulator_hop_t * hop, simulator_interface_t * interface, double now)
+{
+    double burst = MAX(hop->rate, 1);
+
+    if (hop->rate == 0) return true;
+
+    if (interface->last_time == 0) {
+        interface->tokens = burst;
+    } else {
+        interface->tokens = MIN(burst, interface->tokens + (now - interface->last_time) * hop->rate);
+    }
+    interface->last_time = now;
+
+    if (interface->tokens < 1) return false;
+    interface->tokens--;
+    return true;
+}
+
+/**
+ * \brief Write the IP header of a reply.
+ * \param bytes The buffer of the reply.
+ * \param family The address family of the reply.
+ * \param size The size of the reply (in bytes).
+ * \param ttl The TTL (or hop limit) of the reply.
+ * \param ip_id The IP identification of the reply (ignored in IPv6).
+ * \param src_ip The source of the reply.
+ * \param dst_ip The destination of the reply (raw bytes).
+ * \return The size of the IP header (in bytes).
+ */
+
+static size_t simulator_write_ip_header(
+    uint8_t         * bytes,
+    int               family,
+    size_t            size,
+    uint8_t           ttl,
+    uint16_t          ip_id,
+    const uint8_t   * src_ip,
+    const uint8_t   * dst_ip
+) {
+    struct ip      * ip_header;
+    struct ip6_hdr * ip6_header;
+
+    if (family == AF_INET) {
+        ip_header = (struct ip *) bytes;
+        memset(ip_header, 0, sizeof(struct ip));
+        ip_header->ip_v   = 4;
+        ip_header->ip_hl  = sizeof(struct ip) / 4;
+        ip_header->ip_len = htons(size);
+        ip_header->ip_id  = htons(ip_id);
+        ip_header->ip_ttl = ttl;
+        ip_header->ip_p   = IPPROTO_ICMP;
+        memcpy(&ip_header->ip_src, src_ip, sizeof(struct in_addr));
+        memcpy(&ip_header->ip_dst, dst_ip, sizeof(struct in_addr));
+        ip_header->ip_sum = csum((const uint16_t *) ip_header, sizeof(struct ip));
+        return sizeof(struct ip);
+    }
+
+    ip6_header = (struct ip6_hdr *) bytes;
+    memset(ip6_header, 0, sizeof(struct ip6_hdr));
+    ip6_header->ip6_flow = htonl(6 << 28);
+    ip6_header->ip6_plen = htons(size - sizeof(struct ip6_hdr));
+    ip6_header->ip6_nxt  = IPPROTO_ICMPV6;
+    ip6_header->ip6_hlim = ttl;
+    memcpy(&ip6_header->ip6_src, src_ip, sizeof(struct in6_addr));
+    memcpy(&ip6_header->ip6_dst, dst_ip, sizeof(struct in6_addr));
+    return sizeof(struct ip6_hdr);
+}
+
+/**
+ * \brief Compute the checksum of the ICMP message of a reply.
+ * \param bytes The reply. Its IP header is already written.
+ * \param family The address family of the reply.
+ * \param ip_header_size The size of its IP header.
+ * \param size The size of the reply.
+ * \return The checksum.
+ */
+
+static uint16_t simulator_icmp_checksum(const uint8_t * bytes, int family, size_t ip_header_size, size_t size)
+{
+    const struct ip6_hdr * ip6_header = (const struct ip6_hdr *) bytes;
+    uint32_t               pseudo_header[2];
+    uint16_t               sum = 0;
+
+    // ICMPv6 checksum covers a pseudo header (RFC 4443)
+    if (family == AF_INET6) {
+        pseudo_header[0] = htonl(size - ip_header_size);
+        pseudo_header[1] = htonl(IPPROTO_ICMPV6);
+        sum = csum_add(sum, (const uint8_t *) &ip6_header->ip6_src, 2 * sizeof(struct in6_addr));
+        sum = csum_add(sum, (const uint8_t *) pseudo_header, sizeof(pseudo_header));
+    }
+    return (uint16_t) ~csum_add(sum, bytes + ip_header_size, size - ip_header_size);
+}
+
+/**
+ * \brief Schedule the delivery of a reply.
+ * \param simulator A simulator_t instance.
+ * \param bytes The reply.
+ * \param size The size of the reply.
+ * \param delivery When the reply must be delivered (see get_time_ns).
+ * \return true iif successful.
+ */
+
+static bool simulator_push_reply(simulator_t * simulator, uint8_t * bytes, size_t size, uint64_t delivery)
+{
+    simulator_reply_t * reply;
+
+    if (!(reply = malloc(sizeof(simulator_reply_t))))               goto ERR_MALLOC;
+    if (!(reply->packet = packet_create_from_bytes(bytes, size)))  goto ERR_PACKET_CREATE;
+    packet_set_recv_time(reply->packet, delivery);
+
+    wheel_timer_init(&reply->timer, reply);
+    timing_wheel_add(simulator->replies, &reply->timer, NS_TO_SECONDS(delivery));
+    return true;
+
+ERR_PACKET_CREATE:
+    free(reply);
+ERR_MALLOC:
+    return false;
+}
+
+/**
+ * \brief Simulate the crossing of a probe, and schedule its reply (if any).
+ * \param simulator A simulator_t instance.
+ * \param packet The probe.
+ * \param now The sending time (see get_time_ns).
+ * \return true iif successful (even if the probe gets no reply).
+ */
+
+static bool simulator_send_packet(simulator_t * simulator, const packet_t * packet, uint64_t now)
+{
+    const uint8_t          * probe = packet_get_bytes(packet);
+    size_t                   probe_size = packet_get_size(packet),
+                             ip_header_size, addresses_size,
+                             reply_ip_header_size, max_size,
+                             copied_size, size, i, ttl, hop_ttl,
+                             num_hops, mtu = 0;
+    int                      family = packet_guess_address_family(packet);
+    const simulator_path_t * path;
+    simulator_hop_t        * hop;
+    simulator_interface_t  * interface,
+                           * target;
+    const uint8_t          * addresses,
+                           * transport,
+                           * src_ip;
+    uint8_t                  protocol, reply_ttl,
+                             reply[SIMULATOR_IPV6_MAX_REPLY_SIZE];
+    struct icmp            * icmp_header;
+    struct ip              * quoted_ip_header;
+    uint64_t                 delivery;
+    bool                     is_destination;
+
+    // Dissect the probe
+    switch (family) {
+        case AF_INET:
+            if (probe_size < sizeof(struct ip)) return false;
+            ip_header_size       = (probe[0] & 0x0f) * 4;
+            ttl                  = probe[8];
+            protocol             = probe[9];
+            addresses            = probe + 12;
+            addresses_size       = 2 * sizeof(struct in_addr);
+            path                 = &simulator->ipv4_path;
+            reply_ip_header_size = sizeof(struct ip);
+            max_size             = SIMULATOR_IPV4_MAX_REPLY_SIZE;
+            break;
+        case AF_INET6:
+            if (probe_size < sizeof(struct ip6_hdr)) return false;
+            ip_header_size       = sizeof(struct ip6_hdr);
+            ttl                  = probe[7];
+            protocol             = probe[6];
+            addresses            = probe + 8;
+            addresses_size       = 2 * sizeof(struct in6_addr);
+            path                 = &simulator->ipv6_path;
+            reply_ip_header_size = sizeof(struct ip6_hdr);
+            max_size             = SIMULATOR_IPV6_MAX_REPLY_SIZE;
+            break;
+        default:
+            return false;
+    }
+    if (probe_size < ip_header_size || ttl == 0) return false;
+    transport = probe + ip_header_size;
+
+    simulator->num_probes++;
+
+    // A probe toward an interface of a hop crosses the previous hops only
+    num_hops = simulator_path_find(path, family, addresses + addresses_size / 2, &target);
+
+    // The hops crossed before the probe expires may drop it
+    is_destination = ttl > num_hops;
+    for (i = 0; i < MIN(ttl, num_hops); i++) {
+        if (path->hops[i].loss > 0 && simulator_random(simulator) < path->hops[i].loss) {
+            simulator->num_lost++;
+            return true;
+        }
+    }
+
+    // A hop which should forward the probe on a link whose MTU is too small
+    // replies instead (unless an IPv4 probe may be fragmented)
+    hop_ttl = MIN(ttl, num_hops + 1);
+    for (i = 0; i + 1 < hop_ttl; i++) {
+        if (path->hops[i].mtu && probe_size > path->hops[i].mtu
+        && (family == AF_INET6 || (probe[6] & (IP_DF >> 8)))) {
+            is_destination = false;
+            hop_ttl = i + 1;
+            mtu = path->hops[i].mtu;
+            break;
+        }
+    }
+
+    // Pick the interface replying to the probe
+    if (is_destination) {
+        hop = target ? &path->hops[num_hops] : &simulator->destination;
+        if (hop->loss > 0 && simulator_random(simulator) < hop->loss) {
+            simulator->num_lost++;
+            return true;
+        }
+        if (hop->num_interfaces == 0) return true;
+        interface = target ? target : &hop->interfaces[0];
+        src_ip    = addresses + addresses_size / 2;
+        reply_ttl = SIMULATOR_DESTINATION_TTL - MIN(num_hops, SIMULATOR_DESTINATION_TTL - 1);
+    } else {
+        hop = &path->hops[hop_ttl - 1];
+        if (hop->num_interfaces == 0) return true;
+        interface = &hop->interfaces[
+            (hop->is_per_packet ?
+                simulator_next(simulator) :
+                simulator_mix(simulator_hash_flow(addresses, addresses_size, protocol, transport, probe_size - ip_header_size) ^ simulator->seed ^ hop_ttl)
+            ) % hop->num_interfaces
+        ];
+        src_ip    = (const uint8_t *) &interface->address.ip;
+        reply_ttl = SIMULATOR_HOP_TTL - (hop_ttl - 1);
+    }
+
+    if (!simulator_take_token(hop, interface, NS_TO_SECONDS(now))) {
+        simulator->num_limited++;
+        return true;
+    }
+
+    // Craft the reply. The ICMP type, code and checksum are located at
+    // the same offsets in ICMPv4 and in ICMPv6.
+    size = reply_ip_header_size;
+    icmp_header = (struct icmp *) (reply + size);
+
+    if (is_destination
+    && ((family == AF_INET  && protocol == IPPROTO_ICMP   && transport[0] == ICMP_ECHO)
+    ||  (family == AF_INET6 && protocol == IPPROTO_ICMPV6 && transport[0] == ICMP6_ECHO_REQUEST))) {
+        // Echo reply, carrying the identifier, the sequence and the body of the request
+        copied_size = MIN(max_size - size, probe_size - ip_header_size);
+        memcpy(reply + size, transport, copied_size);
+        size += copied_size;
+        icmp_header->icmp_type = family == AF_INET ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY;
+        icmp_header->icmp_code = 0;
+    } else {
+        if (mtu) {
+            icmp_header->icmp_type = family == AF_INET ? ICMP_UNREACH          : ICMP6_PACKET_TOO_BIG;
+            icmp_header->icmp_code = family == AF_INET ? ICMP_UNREACH_NEEDFRAG : 0;
+        } else if (!is_destination) {
+            icmp_header->icmp_type = family == AF_INET ? ICMP_TIMXCEED         : ICMP6_TIME_EXCEEDED;
+            icmp_header->icmp_code = family == AF_INET ? ICMP_TIMXCEED_INTRANS : ICMP6_TIME_EXCEED_TRANSIT;
+        } else if (protocol == IPPROTO_UDP || protocol == IPPROTO_TCP) {
+            icmp_header->icmp_type = family == AF_INET ? ICMP_UNREACH      : ICMP6_DST_UNREACH;
+            icmp_header->icmp_code = family == AF_INET ? ICMP_UNREACH_PORT : ICMP6_DST_UNREACH_NOPORT;
+        } else {
+            return true;
+        }
+        memset(reply + size + 2, 0, sizeof(struct icmp6_hdr) - 2);
+        if (mtu && family == AF_INET) {
+            icmp_header->icmp_nextmtu = htons(MIN(mtu, UINT16_MAX));
+        } else if (mtu) {
+            ((struct icmp6_hdr *) icmp_header)->icmp6_mtu = htonl(mtu);
+        }
+        size += sizeof(struct icmp6_hdr);
+
+        // Quote the probe as received by the replying hop
+        copied_size = MIN(max_size - size, probe_size);
+        memcpy(reply + size, probe, copied_size);
+        if (family == AF_INET) {
+            quoted_ip_header = (struct ip *) (reply + size);
+            quoted_ip_header->ip_ttl = ttl - (hop_ttl - 1);
+            quoted_ip_header->ip_sum = 0;
+            quoted_ip_header->ip_sum = csum((const uint16_t *) quoted_ip_header, ip_header_size);
+        } else {
+            reply[size + 7] = ttl - (hop_ttl - 1);
+        }
+        size += copied_size;
+    }
+
+    simulator_write_ip_header(reply, family, size, reply_ttl, simulator_next_ip_id(simulator, interface, family, src_ip), src_ip, addresses);
+    icmp_header->icmp_cksum = 0;
+    icmp_header->icmp_cksum = simulator_icmp_checksum(reply, family, reply_ip_header_size, size);
+
+    delivery = now + SECONDS_TO_NS(hop->rtt >= 0 ? hop->rtt : SIMULATOR_DEFAULT_RTT * hop_ttl);
+    if (delivery > simulator->last_delivery) simulator->last_delivery = delivery;
+    return simulator_push_reply(simulator, reply, size, delivery);
+}
+
+/**
+ * \brief Pass the batched replies to the recv_callback.
+ * \param simulator A simulator_t instance.
+ * \return true iif successful.
+ */
+
+static bool simulator_flush_replies(simulator_t * simulator)
+{
+    bool ret = true;
+
+    if (simulator->num_batched > 0) {
+        ret = simulator->recv_callback(simulator->batch, simulator->num_batched, simulator->recv_param);
+        simulator->num_replies += simulator->num_batched;
+        simulator->num_batched = 0;
+    }
+    return ret;
+}
+
+/**
+ * \brief Callback called by timing_wheel_advance for each reply to deliver.
+ * \param timer The timer of the reply.
+ * \param simulator The simulator_t instance.
+ */
+
+static void simulator_deliver_reply(wheel_timer_t * timer, void * simulator)
+{
+    simulator_reply_t * reply = timer->data;
+    simulator_t       * sim   = simulator;
+
+    sim->batch[sim->num_batched++] = reply->packet;
+    free(reply);
+    if (sim->num_batched == SIMULATOR_BATCH_SIZE) {
+        simulator_flush_replies(sim);
+    }
+}
+
+/**
+ * \brief Release a reply in transit.
+ * \param timer The timer of the reply.
+ * \param param Unused.
+ */
+
+static void simulator_drop_reply(wheel_timer_t * timer, void * param)
+{
+    simulator_reply_t * reply = timer->data;
+
+    packet_free(reply->packet);
+    free(reply);
+}
+
+/**
+ * \brief Arm simulator->timerfd so that it expires when the next tick of
+ *    simulator->replies must be processed.
+ * \param simulator A simulator_t instance.
+ * \return true iif successful.
+ */
+
+static bool simulator_update_timer(simulator_t * simulator)
+{
+    struct itimerspec timer;
+    uint64_t          tick;
+    double            delay;
+
+    memset(&timer, 0, sizeof(struct itimerspec));
+    if (!timing_wheel_get_next_tick(simulator->replies, &tick)) {
+        if (!simulator->is_armed) return true;
+        simulator->is_armed = false;
+        return timerfd_settime(simulator->timerfd, 0, &timer, NULL) != -1;
+    }
+
+    // The timer is already armed for this tick
+    if (simulator->is_armed && simulator->armed_tick == tick) return true;
+
+    // A null delay would disarm the timer
+    delay = timing_wheel_get_tick_time(simulator->replies, tick) - NS_TO_SECONDS(get_time_ns());
+    if (delay < SIMULATOR_TICK / 100) delay = SIMULATOR_TICK / 100;
+    timer.it_value.tv_sec  = (time_t) delay;
+    timer.it_value.tv_nsec = 1000000000 * (delay - (time_t) delay);
+
+    simulator->armed_tick = tick;
+    simulator->is_armed   = true;
+    return timerfd_settime(simulator->timerfd, 0, &timer, NULL) != -1;
+}
+
+//---------------------------------------------------------------------------
+// Public functions
+//---------------------------------------------------------------------------
+
+simulator_t * simulator_create(const char * filename, void * recv_param, bool (*recv_callback)(packet_t **, size_t, void *))
+{
+    simulator_t * simulator;
+
+    if (!(simulator = calloc(1, sizeof(simulator_t)))) goto ERR_CALLOC;
+    simulator->recv_param    = recv_param;
+    simulator->recv_callback = recv_callback;
+
+    // By default, the destinations reply without delay nor loss
+    simulator_hop_init(&simulator->destination);
+    if (!(simulator->destination.interfaces = calloc(1, sizeof(simulator_interface_t)))) goto ERR_DESTINATION;
+    simulator->destination.num_interfaces = 1;
+
+    if (!simulator_load(simulator, filename)) goto ERR_LOAD;
+    simulator->state = simulator->seed;
+    simulator_init_ip_ids(simulator);
+
+    if ((simulator->timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) == -1) {
+        perror("simulator_create");
+        goto ERR_TIMERFD;
+    }
+    if (!(simulator->replies = timing_wheel_create(SIMULATOR_TICK, NS_TO_SECONDS(get_time_ns())))) {
+        goto ERR_REPLIES;
+    }
+    return simulator;
+
+ERR_REPLIES:
+    close(simulator->timerfd);
+ERR_TIMERFD:
+ERR_LOAD:
+    simulator_path_free(&simulator->ipv4_path);
+    simulator_path_free(&simulator->ipv6_path);
+    simulator_routers_free(simulator);
+    free(simulator->destination.interfaces);
+ERR_DESTINATION:
+    free(simulator);
+ERR_CALLOC:
+    return NULL;
+}
+
+void simulator_free(simulator_t * simulator)
+{
+    if (simulator) {
+        fprintf(stderr,
+            "simulator: %zu probes, %zu replies, %zu lost, %zu rate limited\n",
+            simulator->num_probes, simulator->num_replies, simulator->num_lost, simulator->num_limited
+        );
+
+        // Drop the replies in transit
+        timing_wheel_advance(simulator->replies, NS_TO_SECONDS(simulator->last_delivery), simulator_drop_reply, NULL);
+        timing_wheel_free(simulator->replies);
+        close(simulator->timerfd);
+        simulator_path_free(&simulator->ipv4_path);
+        simulator_path_free(&simulator->ipv6_path);
+        simulator_routers_free(simulator);
+        free(simulator->destination.interfaces);
+        free(simulator);
+    }
+}
+
+size_t simulator_send_packets(simulator_t * simulator, packet_t ** packets, size_t num_packets, socketpool_tx_key_t * tx_keys)
+{
+    uint64_t now = get_time_ns();
+    size_t   i;
+
+    for (i = 0; i < num_packets; i++) {
+        tx_keys[i].family = AF_UNSPEC;
+        tx_keys[i].key    = 0;
+        if (!simulator_send_packet(simulator, packets[i], now)) {
+            fprintf(stderr, "simulator_send_packets: Can't simulate packet\n");
+        }
+    }
+
+    if (!simulator_update_timer(simulator)) {
+        perror("simulator_send_packets");
+    }
+    return num_packets;
+}
+
+inline int simulator_get_timerfd(const simulator_t * simulator) {
+    return simulator->timerfd;
+}
+
+bool simulator_process_replies(simulator_t * simulator)
+{
+    uint64_t num_expirations;
+    bool     ret;
+
+    // Acknowledge the expiration of timerfd, otherwise it remains activated
+    if (read(simulator->timerfd, &num_expirations, sizeof(num_expirations)) == -1 && errno != EAGAIN) {
+        return false;
+    }
+    simulator->is_armed = false;
+
+    timing_wheel_advance(simulator->replies, NS_TO_SECONDS(get_time_ns()), simulator_deliver_reply, simulator);
+    ret = simulator_flush_replies(simulator);
+
+    return simulator_update_timer(simulator) && ret;
+}
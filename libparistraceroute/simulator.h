@@ -0,0 +1,200 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+/**
+ * \file simulator.h
+ * \brief Simulated network, replacing the socketpool and the sniffer of
+ *    a network layer (see network_create).
+ *
+ * The probes handed over to the simulator cross an in-memory topology,
+ * and the simulator synthesizes the ICMP replies they would trigger.
+ * Each reply is delivered (as if it had been sniffed) once the RTT of
+ * the hop which has sent it has elapsed. The replies are decided by a
+ * pseudo-random generator whose seed is set by the topology, so that
+ * a simulated measurement is reproducible, and does not require root
+ * privileges.
+ *
+ * The topology is a text file. Each line describes a hop (in the order
+ * of the TTLs) or the destinations, and '#' starts a comment:
+ *
+ *     seed 42
+ *     hop 10.0.0.1 rtt 1
+ *     hop 10.0.1.1 10.0.1.2 per-flow rtt 2 loss 0.01
+ *     hop *
+ *     hop 10.0.3.1 10.0.3.2 10.0.3.3 per-packet rate 100
+ *     destination rtt 10
+ *
+ * - A hop lists the addresses of its interfaces. If it has several
+ *   interfaces, it is a load balancer, which picks the interface crossed
+ *   by each probe per flow (the default) or per packet. The flow of a
+ *   probe is made of its addresses, its protocol and its ports (if any).
+ *   A hop whose address is '*' never replies.
+ * - The IPv4 probes cross the hops having IPv4 addresses, and the IPv6
+ *   probes the hops having IPv6 addresses ('*' hops are crossed by both).
+ * - A probe whose TTL exceeds the number of hops reaches its destination,
+ *   which replies with an ICMP port unreachable (UDP and TCP probes) or
+ *   with an ICMP echo reply (ICMP echo probes). "destination silent"
+ *   makes the destinations unresponsive.
+ * - rtt sets the RTT (in milliseconds, default is 1 ms per hop), loss the
+ *   probability that a hop drops a packet (default is 0), and rate the
+ *   maximum number of replies per second sent by each interface (default
+ *   is 0, i.e. unlimited). The rate of the destinations is shared by
+ *   every destination.
+ * - mtu sets the MTU of the link leaving a hop toward the destinations
+ *   (default is 0, i.e. unlimited). The hop replies to the larger probes
+ *   it should forward with an ICMP fragmentation needed (if their DF bit
+ *   is set, the other IPv4 probes are forwarded) or packet too big.
+ *
+ * A probe whose destination is an interface of a hop reaches this
+ * interface (if its TTL is large enough), which replies as a destination
+ * would. Each interface (and each destination) stamps its replies with its
+ * own IPv4 identification, incremented by every reply and initially set by
+ * the pseudo-random generator. A router line lists the interfaces of a
+ * same router, which share their identification counter (see alias.h):
+ *
+ *     router 10.0.1.1 10.0.3.2
+ */
+
+#include <stdbool.h>      // bool
+#include <stddef.h>       // size_t
+#include <stdint.h>       // uint16_t, uint64_t
+
+#include "address.h"      // address_t
+#include "packet.h"       // packet_t
+#include "socketpool.h"   // socketpool_tx_key_t
+#include "timing_wheel.h" // timing_wheel_t
+
+// Granularity of the RTTs (in seconds)
+#define SIMULATOR_TICK 0.0001
+
+// Maximum number of replies delivered at once to the recv_callback
+#define SIMULATOR_BATCH_SIZE 32
+
+/**
+ * \struct simulator_interface_t
+ * \brief An interface of a simulated hop.
+ */
+
+typedef struct {
+    address_t address;   /**< Address of the interface */
+    double    tokens;    /**< Replies which may be sent right now (see simulator_hop_t::rate) */
+    double    last_time; /**< When tokens has been refilled (in seconds) */
+    uint16_t  ip_id;     /**< IP identification of its next reply, unless it belongs to a router */
+} simulator_interface_t;
+
+/**
+ * \struct simulator_router_t
+ * \brief A simulated router, whose interfaces share their IP
+ *    identification counter.
+ */
+
+typedef struct {
+    address_t * addresses;     /**< Addresses of its interfaces */
+    size_t      num_addresses; /**< Number of addresses */
+    uint16_t    ip_id;         /**< IP identification of its next reply */
+} simulator_router_t;
+
+/**
+ * \struct simulator_hop_t
+ * \brief A simulated hop, or the destinations.
+ */
+
+typedef struct {
+    simulator_interface_t * interfaces;     /**< Its interfaces. The destinations have a single interface, whose address is unused */
+    size_t                  num_interfaces; /**< Number of interfaces, 0 if the hop never replies */
+    bool                    is_per_packet;  /**< true iif the interface crossed by a probe is picked per packet (and not per flow) */
+    double                  rtt;            /**< RTT of the replies (in seconds), < 0 if unset */
+    double                  loss;           /**< Probability that a packet is dropped */
+    double                  rate;           /**< Maximum number of replies per second and per interface (0 if unlimited) */
+    size_t                  mtu;            /**< MTU of the link toward the next hop (0 if unlimited) */
+} simulator_hop_t;
+
+/**
+ * \struct simulator_path_t
+ * \brief The hops crossed by the probes of an address family.
+ */
+
+typedef struct {
+    simulator_hop_t * hops;     /**< The hops, ordered by TTL */
+    size_t            num_hops; /**< Number of hops */
+} simulator_path_t;
+
+/**
+ * \struct simulator_t
+ * \brief A simulated network. The simulator calls a function whenever
+ *    replies are delivered, as a sniffer would (see sniffer_t).
+ */
+
+typedef struct {
+    simulator_path_t     ipv4_path;     /**< Path of the IPv4 probes */
+    simulator_path_t     ipv6_path;     /**< Path of the IPv6 probes */
+    simulator_hop_t      destination;   /**< The destinations */
+    simulator_router_t * routers;       /**< The routers having several interfaces */
+    size_t               num_routers;   /**< Number of routers */
+    uint64_t             seed;          /**< Seed of the simulation */
+    uint64_t             state;         /**< State of the pseudo-random generator */
+    timing_wheel_t     * replies;       /**< The replies in transit */
+    uint64_t             last_delivery; /**< When the last reply in transit must be delivered (see get_time_ns) */
+    int                  timerfd;       /**< Activated when replies must be delivered (see simulator_process_replies) */
+    uint64_t             armed_tick;    /**< Tick of simulator->replies for which simulator->timerfd is armed */
+    bool                 is_armed;      /**< true iif simulator->timerfd is armed */
+    packet_t           * batch[SIMULATOR_BATCH_SIZE]; /**< Replies waiting to be passed to recv_callback */
+    size_t               num_batched;   /**< Number of replies stored in simulator->batch */
+    void               * recv_param;    /**< This pointer is passed whenever recv_callback is called */
+    bool              (* recv_callback)(packet_t ** packets, size_t num_packets, void * recv_param); /**< Callback for delivered replies */
+    size_t               num_probes;    /**< Number of probes sent */
+    size_t               num_replies;   /**< Number of replies delivered */
+    size_t               num_lost;      /**< Number of probes or replies dropped */
+    size_t               num_limited;   /**< Number of replies not sent because of the rate limits */
+} simulator_t;
+
+/**
+ * \brief Create a simulated network.
+ * \param filename The topology file.
+ * \param recv_param This pointer is passed whenever recv_callback is called.
+ * \param recv_callback This function is called whenever replies are
+ *    delivered (see sniffer_create). It is responsible for releasing them.
+ * \return The newly allocated simulator_t instance, NULL in case of failure.
+ */
+
+simulator_t * simulator_create(const char * filename, void * recv_param, bool (*recv_callback)(packet_t **, size_t, void *));
+
+/**
+ * \brief Release a simulated network, and the replies in transit. A
+ *    summary of the simulation is printed on the standard error.
+ * \param simulator A simulator_t instance.
+ */
+
+void simulator_free(simulator_t * simulator);
+
+/**
+ * \brief Send packets through a simulated network (see socketpool_send_packets).
+ * \param simulator A simulator_t instance.
+ * \param packets The packets to send.
+ * \param num_packets The number of packets.
+ * \param tx_keys An array of num_packets keys. The simulated packets are
+ *    never timestamped, so the family of each key is set to AF_UNSPEC.
+ * \return The number of packets sent (always num_packets).
+ */
+
+size_t simulator_send_packets(simulator_t * simulator, packet_t ** packets, size_t num_packets, socketpool_tx_key_t * tx_keys);
+
+/**
+ * \brief Retrieve the file descriptor activated when replies must be
+ *    delivered.
+ * \param simulator A simulator_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int simulator_get_timerfd(const simulator_t * simulator);
+
+/**
+ * \brief Deliver the replies whose RTT has elapsed to the recv_callback.
+ *    This is called whenever simulator->timerfd is activated.
+ * \param simulator A simulator_t instance.
+ * \return true iif successful.
+ */
+
+bool simulator_process_replies(simulator_t * simulator);
+
+#endif // SIMULATOR_H
@@ -6,18 +6,78 @@
 #include <string.h>      // memcpy, memset
 #include <unistd.h>      // fnctl
 #include <fcntl.h>       // fnctl
-#include <sys/socket.h>  // socket, bind,
+#include <sys/socket.h>  // socket, bind, recvmmsg
 #include <sys/types.h>   // socket, bind
 #include <arpa/inet.h>
+#include <sys/uio.h>     // struct iovec
 #include <netinet/in.h>  // IPPROTO_ICMP, IPPROTO_ICMPV6
 
 #ifdef USE_IPV6
 #  include <netinet/ip6.h> // ip6_hdr
 #endif
 
+#ifdef USE_PACKET_RING
+#  include <sys/mman.h>        // mmap, munmap
+#  include <net/ethernet.h>    // ETH_P_IP, ETH_P_IPV6
+#  include <linux/if_packet.h> // sockaddr_ll, tpacket_req3, tpacket_block_desc, tpacket3_hdr
+#endif
+
+#ifdef USE_SOCKET_FILTER
+#  include <netinet/ip_icmp.h>  // ICMP_*
+#  include <netinet/tcp.h>      // TH_*
+#  ifdef USE_IPV6
+#    include <netinet/icmp6.h>  // ICMP6_FILTER, ICMP6_*
+#  endif
+#  ifdef __linux__
+#    include <linux/filter.h>   // sock_filter, sock_fprog, BPF_*
+#  endif
+#endif
+
+#ifdef USE_TIMESTAMPING
+#  include <linux/errqueue.h>   // scm_timestamping
+#  include <linux/net_tstamp.h> // SOF_TIMESTAMPING_*
+#endif
+
 #include "sniffer.h"
+#include "broker.h"      // broker_take_socket, broker_has_socket
+#include "pool.h"        // pool_t
+#include "common.h"      // get_time_ns
+
+// Reception buffers are lent to the sniffed packets and given back once
+// these packets are released (possibly by another thread).
+static __thread pool_t sniffer_buffer_pool = POOL_INITIALIZER(SNIFFER_BUFLEN, free);
+
+static void sniffer_buffer_pool_clear() __attribute__((destructor));
+
+static void sniffer_buffer_pool_clear() {
+    pool_clear(&sniffer_buffer_pool, free);
+}
+
+/**
+ * \brief Give back a reception buffer (see packet_lend_bytes).
+ * \param bytes The buffer.
+ */
+
+static void sniffer_release_buffer(uint8_t * bytes) {
+    if (!pool_release(&sniffer_buffer_pool, bytes)) free(bytes);
+}
+
+/**
+ * \brief Retrieve the i-th reception buffer of a sniffer. Buffers handed
+ *    over to packets are replaced on demand.
+ * \param sniffer A sniffer_t instance.
+ * \param i The index of the buffer (< SNIFFER_BATCH_SIZE).
+ * \return The buffer (SNIFFER_BUFLEN bytes), NULL in case of failure.
+ */
 
-#define BUFLEN 4096
+static uint8_t * sniffer_get_recv_buffer(sniffer_t * sniffer, size_t i) {
+    bool recycled;
+
+    if (!sniffer->recv_buffers[i]) {
+        sniffer->recv_buffers[i] = pool_alloc(&sniffer_buffer_pool, &recycled);
+    }
+    return sniffer->recv_buffers[i];
+}
 
 // Solaris/Sun
 // http://livre.g6.asso.fr/index.php/L%27exemple_%C2%AB_mini-ping_%C2%BB_revisit%C3%A9
@@ -40,25 +100,230 @@
 #endif
 
 
+#if defined(USE_SOCKET_FILTER) && defined(SO_ATTACH_FILTER)
+// The following BPF programs end with SNIFFER_FILTER_SHARD_CHECK: the
+// byte loaded in A is the bucket of the probe destination (see
+// network_get_destination_shard), the packet is accepted iif this bucket
+// is set in the bitmap sniffer->buckets. The 8 words of the bitmap
+// are loaded as constants, set by attach_filter.
+#  define SNIFFER_FILTER_BUCKET_WORD(w) \
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   (w),                 0, 2), /* A == w ? */          \
+    BPF_STMT(BPF_LD  | BPF_IMM,           0),                         /* A = buckets[w] */    \
+    BPF_STMT(BPF_JMP | BPF_JA,            19 - 3 * (w))
+
+#  define SNIFFER_FILTER_SHARD_CHECK \
+    BPF_STMT(BPF_MISC | BPF_TAX,          0),                         /* X = bucket */        \
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K,   5),                         /* A = bucket / 32 */   \
+    SNIFFER_FILTER_BUCKET_WORD(0), SNIFFER_FILTER_BUCKET_WORD(1),                              \
+    SNIFFER_FILTER_BUCKET_WORD(2), SNIFFER_FILTER_BUCKET_WORD(3),                              \
+    SNIFFER_FILTER_BUCKET_WORD(4), SNIFFER_FILTER_BUCKET_WORD(5),                              \
+    SNIFFER_FILTER_BUCKET_WORD(6),                                                             \
+    BPF_STMT(BPF_LD  | BPF_IMM,           0),                         /* A = buckets[7] */    \
+    BPF_STMT(BPF_ST,                      0),                         /* M[0] = A */          \
+    BPF_STMT(BPF_MISC | BPF_TXA,          0),                                                 \
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K,   31),                                                \
+    BPF_STMT(BPF_MISC | BPF_TAX,          0),                         /* X = bucket % 32 */   \
+    BPF_STMT(BPF_LD  | BPF_MEM,           0),                         /* A = M[0] */          \
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_X,   0),                                                 \
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K,   1),                         /* A = bit X of A */    \
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0,                   1, 0),                         \
+    BPF_STMT(BPF_RET | BPF_K,             0xffffffff),                /* accept */            \
+    BPF_STMT(BPF_RET | BPF_K,             0)                          /* drop */
+
+// Number of instructions of SNIFFER_FILTER_SHARD_CHECK.
+#  define SNIFFER_FILTER_SHARD_CHECK_LEN 34
+
+// Offset of the instruction loading the word w of the bitmap in SNIFFER_FILTER_SHARD_CHECK.
+#  define SNIFFER_FILTER_BUCKET_WORD_OFFSET(w) ((w) < 7 ? 3 + 3 * (w) : 23)
+
+// Jump offsets to the final accept/drop instructions, from a jump followed
+// by n instructions before SNIFFER_FILTER_SHARD_CHECK.
+#  define SNIFFER_FILTER_ACCEPT(n) ((n) + SNIFFER_FILTER_SHARD_CHECK_LEN - 2)
+#  define SNIFFER_FILTER_DROP(n)   ((n) + SNIFFER_FILTER_SHARD_CHECK_LEN - 1)
+
+// Accept IPv4 packets carrying an ICMP echo reply or an ICMP error.
+// The packets are seen from their IP header.
+static const struct sock_filter icmpv4_filter[] = {
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 9),                         // A = IP protocol
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_ICMP,        0, SNIFFER_FILTER_DROP(9)),
+    BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 0),                         // X = IP header length
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_IND, 0),                         // A = ICMP type
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP_ECHOREPLY,      5, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP_DEST_UNREACH,   2, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP_TIME_EXCEEDED,  1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP_PARAMETERPROB,  0, SNIFFER_FILTER_DROP(3)),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_IND, 8 + 19),                    // A = last byte of the quoted IP destination
+    BPF_STMT(BPF_JMP | BPF_JA,            1),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 15),                        // A = last byte of the IP source
+    SNIFFER_FILTER_SHARD_CHECK
+};
+
+// Accept IPv4 packets carrying a TCP segment which acknowledges or resets
+// a probe (SYN/ACK, RST). Our own SYN probes, which are looped back when
+// probing a local address, are dropped. The packets are seen from their
+// IP header.
+static const struct sock_filter tcpv4_filter[] = {
+    BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 0),                         // X = IP header length
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_IND, 13),                        // A = TCP flags
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,  TH_SYN | TH_RST,     0, SNIFFER_FILTER_DROP(2)),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,  TH_ACK | TH_RST,     0, SNIFFER_FILTER_DROP(1)),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 15),                        // A = last byte of the IP source
+    SNIFFER_FILTER_SHARD_CHECK
+};
+
+#  ifdef USE_IPV6
+#    ifdef USE_PACKET_RING
+// Accept IPv6 packets carrying an ICMPv6 echo reply or an ICMPv6 error.
+// The packets are seen from their IPv6 header.
+static const struct sock_filter icmpv6_filter[] = {
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 6),                         // A = next header
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_ICMPV6,       0, SNIFFER_FILTER_DROP(9)),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 40),                        // A = ICMPv6 type
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP6_ECHO_REPLY,     6, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP6_DST_UNREACH,    3, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP6_PACKET_TOO_BIG, 2, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP6_TIME_EXCEEDED,  1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP6_PARAM_PROB,     0, SNIFFER_FILTER_DROP(3)),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 40 + 8 + 39),               // A = last byte of the quoted IPv6 destination
+    BPF_STMT(BPF_JMP | BPF_JA,            1),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 23),                        // A = last byte of the IPv6 source
+    SNIFFER_FILTER_SHARD_CHECK
+};
+#    endif
+
+// ICMPv6 raw sockets receive the packets from their ICMPv6 header and
+// rely on ICMP6_FILTER to select the ICMPv6 types. The source of echo
+// replies is not available, so they are accepted by every shard.
+static const struct sock_filter icmpv6_raw_filter[] = {
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 0),                         // A = ICMPv6 type
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   ICMP6_ECHO_REPLY,     SNIFFER_FILTER_ACCEPT(1), 0),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 8 + 39),                    // A = last byte of the quoted IPv6 destination
+    SNIFFER_FILTER_SHARD_CHECK
+};
+
+// TCPv6 raw sockets receive the packets from their TCP header (see
+// tcpv4_filter). Their source is not available, so they are accepted by
+// every shard.
+static const struct sock_filter tcpv6_raw_filter[] = {
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 13),                        // A = TCP flags
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,  TH_SYN | TH_RST,     0, SNIFFER_FILTER_DROP(1)),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,  TH_ACK | TH_RST,     SNIFFER_FILTER_ACCEPT(0), SNIFFER_FILTER_DROP(0)),
+    SNIFFER_FILTER_SHARD_CHECK
+};
+#  endif
+
+/**
+ * \brief Attach a classic BPF program to a socket, so that the kernel
+ *    drops the packets not accepted by this program.
+ * \param sockfd The socket.
+ * \param filter The BPF program. It must end with SNIFFER_FILTER_SHARD_CHECK.
+ * \param len The number of instructions of the BPF program.
+ * \param buckets The bitmap of the accepted buckets.
+ * \return true iif successful
+ */
+
+static bool attach_filter(int sockfd, const struct sock_filter * filter, size_t len, const uint32_t * buckets)
+{
+    struct sock_filter instructions[len];
+    struct sock_fprog  prog;
+    size_t             w;
+
+    memcpy(instructions, filter, len * sizeof(struct sock_filter));
+    for (w = 0; w < SNIFFER_NUM_BUCKETS / 32; w++) {
+        instructions[len - SNIFFER_FILTER_SHARD_CHECK_LEN + SNIFFER_FILTER_BUCKET_WORD_OFFSET(w)].k = buckets[w];
+    }
+
+    prog.len    = len;
+    prog.filter = instructions;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(struct sock_fprog)) == -1) {
+        perror("attach_filter: cannot filter packets in the kernel");
+        return false;
+    }
+
+    return true;
+}
+
+#  define FILTER_LEN(filter) (sizeof(filter) / sizeof(struct sock_filter))
+
+// Bitmap accepting every bucket, used until sniffer_set_shard is called.
+static const uint32_t sniffer_all_buckets[SNIFFER_NUM_BUCKETS / 32] = {
+    0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+    0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff
+};
+#endif
+
+#ifdef USE_TIMESTAMPING
+// Size of the ancillary data needed to fetch a reception timestamp
+#  define SNIFFER_TIMESTAMP_CMSG_SIZE CMSG_SPACE(sizeof(struct scm_timestamping))
+
+/**
+ * \brief Ask the kernel to timestamp the packets received on a raw socket.
+ *    The sniffer then uses these timestamps instead of userspace ones.
+ * \param sockfd The raw socket.
+ */
+
+static void enable_rx_timestamping(int sockfd) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+        perror("enable_rx_timestamping: reception timestamps not available");
+    }
+}
+#endif
+
+/**
+ * \brief Retrieve the reception timestamp stored in the ancillary data
+ *    of a received message.
+ * \param msg The received message.
+ * \param offset The offset between the kernel clock and get_time_ns
+ *    (see get_realtime_offset_ns).
+ * \param now The timestamp returned if the kernel has not timestamped
+ *    this message (read once for the whole batch).
+ * \return The reception timestamp (in nanoseconds, see get_time_ns).
+ */
+
+static uint64_t get_recv_time(struct msghdr * msg, int64_t offset, uint64_t now) {
+#ifdef USE_TIMESTAMPING
+    struct cmsghdr          * cmsg;
+    struct scm_timestamping * tss;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            // Software timestamp (hardware ones use the NIC clock)
+            tss = (struct scm_timestamping *) CMSG_DATA(cmsg);
+            return realtime_to_time_ns(&tss->ts[0], offset);
+        }
+    }
+#endif
+    return now;
+}
+
 /**
- * \brief Initialize an ICMPv4 raw socket in a sniffer_t instance
- * \param sniffer A pointer to a sniffer_t instance
+ * \brief Initialize an IPv4 raw socket
+ * \param psockfd Address of the int in which the socket is written
+ * \param protocol The sniffed protocol (IPPROTO_ICMP or IPPROTO_TCP)
  * \param port The listening port
  * \return true iif successful
  */
 #ifdef USE_IPV4
-static bool create_icmpv4_socket(sniffer_t * sniffer, uint16_t port)
+static bool create_ipv4_socket(int * psockfd, uint8_t protocol, uint16_t port)
 {
 	struct sockaddr_in saddr;
 
-	// Create a raw socket (man 7 ip) listening ICMPv4 packets
-	if ((sniffer->icmpv4_sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) == -1) {
-        perror("create_icmpv4_socket: error while creating socket");
+    // The socket may have been opened and configured by a broker (see broker.h)
+    if ((*psockfd = broker_take_socket(protocol == IPPROTO_TCP ? BROKER_SOCKET_TCPV4 : BROKER_SOCKET_ICMPV4)) != -1) {
+        return true;
+    }
+
+	// Create a raw socket (man 7 ip) listening ICMPv4 (or TCP) packets
+	if ((*psockfd = socket(AF_INET, SOCK_RAW, protocol)) == -1) {
+        perror("create_ipv4_socket: error while creating socket");
         goto ERR_SOCKET;
     }
 
     // Make the socket non-blocking
-    if (fcntl(sniffer->icmpv4_sockfd, F_SETFD, O_NONBLOCK) == -1) {
+    if (fcntl(*psockfd, F_SETFL, O_NONBLOCK) == -1) {
         goto ERR_FCNTL;
     }
 
@@ -68,42 +333,64 @@ static bool create_icmpv4_socket(sniffer_t * sniffer, uint16_t port)
 	saddr.sin_addr.s_addr = INADDR_ANY;
 	saddr.sin_port        = htons(port);
 
-	if (bind(sniffer->icmpv4_sockfd, (struct sockaddr *) &saddr, sizeof(struct sockaddr_in)) == -1) {
-        perror("create_icmpv4_socket: error while binding the socket");
+	if (bind(*psockfd, (struct sockaddr *) &saddr, sizeof(struct sockaddr_in)) == -1) {
+        perror("create_ipv4_socket: error while binding the socket");
         goto ERR_BIND;
     }
 
+#if defined(USE_SOCKET_FILTER) && defined(SO_ATTACH_FILTER)
+    // Optional, the unrelated packets are then dropped in userspace
+    if (protocol == IPPROTO_TCP) {
+        attach_filter(*psockfd, tcpv4_filter, FILTER_LEN(tcpv4_filter), sniffer_all_buckets);
+    } else {
+        attach_filter(*psockfd, icmpv4_filter, FILTER_LEN(icmpv4_filter), sniffer_all_buckets);
+    }
+#endif
+#ifdef USE_TIMESTAMPING
+    enable_rx_timestamping(*psockfd);
+#endif
+
     return true;
 
 ERR_BIND:
 ERR_FCNTL:
-    close(sniffer->icmpv4_sockfd);
+    close(*psockfd);
 ERR_SOCKET:
+    *psockfd = -1;
     return false;
 }
 #endif
 
 /**
- * \brief Initialize an ICMPv6 raw socket in a sniffer_t instance
- * \param sniffer A pointer to a sniffer_t instance
+ * \brief Initialize an IPv6 raw socket
+ * \param psockfd Address of the int in which the socket is written
+ * \param protocol The sniffed protocol (IPPROTO_ICMPV6 or IPPROTO_TCP)
  * \param port The listening port
  * \return true iif successful
  */
 #ifdef USE_IPV6
-static bool create_icmpv6_socket(sniffer_t * sniffer, uint16_t port)
+static bool create_ipv6_socket(int * psockfd, uint8_t protocol, uint16_t port)
 {
     struct in6_addr anyaddr = IN6ADDR_ANY_INIT;
     struct sockaddr_in6 saddr;
     int    on = 1;
+#ifdef USE_SOCKET_FILTER
+    struct icmp6_filter filter;
+#endif
+
+    // The socket may have been opened and configured by a broker (see broker.h)
+    if ((*psockfd = broker_take_socket(protocol == IPPROTO_TCP ? BROKER_SOCKET_TCPV6 : BROKER_SOCKET_ICMPV6)) != -1) {
+        return true;
+    }
 
-	// Create a raw socket (man 7 ip) listening ICMPv6 packets
-    if ((sniffer->icmpv6_sockfd = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) == -1) {
-        perror("create_icmpv6_socket: error while creating socket");
+	// Create a raw socket (man 7 ip) listening ICMPv6 (or TCP) packets
+    if ((*psockfd = socket(AF_INET6, SOCK_RAW, protocol)) == -1) {
+        perror("create_ipv6_socket: error while creating socket");
         goto ERR_SOCKET;
     }
 
     // Make the socket non-blocking
-    if (fcntl(sniffer->icmpv6_sockfd, F_SETFD, O_NONBLOCK) == -1) {
+    if (fcntl(*psockfd, F_SETFL, O_NONBLOCK) == -1) {
         goto ERR_FCNTL;
     }
 
@@ -114,14 +401,14 @@ static bool create_icmpv6_socket(sniffer_t * sniffer, uint16_t port)
     // http://h71000.www7.hp.com/doc/731final/tcprn/v53_relnotes_025.html
 	// http://livre.g6.asso.fr/index.php?title=L%27impl%C3%A9mentation&oldid=2961
 
-    if ((setsockopt(sniffer->icmpv6_sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO,  &on, sizeof(on)) == -1) // struct in6_pktinfo
-    ||  (setsockopt(sniffer->icmpv6_sockfd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) == -1) // int
-    ||  (setsockopt(sniffer->icmpv6_sockfd, IPPROTO_IPV6, IPV6_RECVRTHDR,    &on, sizeof(on)) == -1) // struct ip6_rthdr
-    ||  (setsockopt(sniffer->icmpv6_sockfd, IPPROTO_IPV6, IPV6_RECVHOPOPTS,  &on, sizeof(on)) == -1) // struct ip6_hbh
-    ||  (setsockopt(sniffer->icmpv6_sockfd, IPPROTO_IPV6, IPV6_RECVDSTOPTS,  &on, sizeof(on)) == -1) // struct ip6_dest
-    ||  (setsockopt(sniffer->icmpv6_sockfd, IPPROTO_IPV6, IPV6_RECVTCLASS,   &on, sizeof(on)) == -1) // int
+    if ((setsockopt(*psockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO,  &on, sizeof(on)) == -1) // struct in6_pktinfo
+    ||  (setsockopt(*psockfd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) == -1) // int
+    ||  (setsockopt(*psockfd, IPPROTO_IPV6, IPV6_RECVRTHDR,    &on, sizeof(on)) == -1) // struct ip6_rthdr
+    ||  (setsockopt(*psockfd, IPPROTO_IPV6, IPV6_RECVHOPOPTS,  &on, sizeof(on)) == -1) // struct ip6_hbh
+    ||  (setsockopt(*psockfd, IPPROTO_IPV6, IPV6_RECVDSTOPTS,  &on, sizeof(on)) == -1) // struct ip6_dest
+    ||  (setsockopt(*psockfd, IPPROTO_IPV6, IPV6_RECVTCLASS,   &on, sizeof(on)) == -1) // int
     ) {
-        perror("create_icmpv6_socket: error in setsockopt");
+        perror("create_ipv6_socket: error in setsockopt");
         goto ERR_SETSOCKOPT;
     }
 
@@ -131,35 +418,182 @@ static bool create_icmpv6_socket(sniffer_t * sniffer, uint16_t port)
     saddr.sin6_addr   = anyaddr;
     saddr.sin6_port   = htons(port);
 
-    if (bind(sniffer->icmpv6_sockfd, (struct sockaddr *) &saddr, sizeof(struct sockaddr_in6)) == -1) {
-        perror("create_icmpv6_socket: error while binding the socket");
+    if (bind(*psockfd, (struct sockaddr *) &saddr, sizeof(struct sockaddr_in6)) == -1) {
+        perror("create_ipv6_socket: error while binding the socket");
         goto ERR_BIND;
     }
 
+#ifdef USE_SOCKET_FILTER
+    if (protocol == IPPROTO_ICMPV6) {
+        // Only ICMPv6 echo replies and errors may be related to a probe (RFC 3542)
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY,     &filter);
+        ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH,    &filter);
+        ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+        ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED,  &filter);
+        ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB,     &filter);
+
+        if (setsockopt(*psockfd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(struct icmp6_filter)) == -1) {
+            perror("create_ipv6_socket: cannot filter ICMPv6 packets");
+        }
+    }
+#  ifdef SO_ATTACH_FILTER
+    if (protocol == IPPROTO_TCP) {
+        // Optional, the unrelated segments are then dropped in userspace
+        attach_filter(*psockfd, tcpv6_raw_filter, FILTER_LEN(tcpv6_raw_filter), sniffer_all_buckets);
+    }
+#  endif
+#endif
+#ifdef USE_TIMESTAMPING
+    enable_rx_timestamping(*psockfd);
+#endif
+
     return true;
 
 ERR_BIND:
 ERR_SETSOCKOPT:
 ERR_FCNTL:
-    close(sniffer->icmpv6_sockfd);
+    close(*psockfd);
+ERR_SOCKET:
+    *psockfd = -1;
+    return false;
+}
+#endif
+
+#ifdef USE_PACKET_RING
+/**
+ * \brief Initialize an AF_PACKET socket and its TPACKET_V3 reception ring
+ * \param ring The ring to initialize
+ * \param psockfd Address of the int in which the socket is written
+ * \param ethertype The captured network protocol (ETH_P_IP or ETH_P_IPV6)
+ * \return true iif successful
+ */
+
+static bool create_packet_ring(sniffer_ring_t * ring, int * psockfd, uint16_t ethertype)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll  saddr;
+    int                 version = TPACKET_V3;
+
+    // SOCK_DGRAM: frames are delivered without their link-layer header
+    if ((*psockfd = socket(AF_PACKET, SOCK_DGRAM, htons(ethertype))) == -1) {
+        perror("create_packet_ring: error while creating socket");
+        goto ERR_SOCKET;
+    }
+
+    if (setsockopt(*psockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        perror("create_packet_ring: TPACKET_V3 not supported");
+        goto ERR_SETSOCKOPT;
+    }
+
+#ifdef USE_SOCKET_FILTER
+    // The ring captures every IP packet: keep only the ICMP replies.
+    // Optional, sniffer_ring_accept checks the protocol anyway.
+    switch (ethertype) {
+#  ifdef USE_IPV4
+        case ETH_P_IP:
+            attach_filter(*psockfd, icmpv4_filter, FILTER_LEN(icmpv4_filter), sniffer_all_buckets);
+            break;
+#  endif
+#  ifdef USE_IPV6
+        case ETH_P_IPV6:
+            attach_filter(*psockfd, icmpv6_filter, FILTER_LEN(icmpv6_filter), sniffer_all_buckets);
+            break;
+#  endif
+    }
+#endif
+
+    memset(&req, 0, sizeof(struct tpacket_req3));
+    req.tp_block_size     = SNIFFER_RING_BLOCK_SIZE;
+    req.tp_block_nr       = SNIFFER_RING_NUM_BLOCKS;
+    req.tp_frame_size     = SNIFFER_RING_FRAME_SIZE;
+    req.tp_frame_nr       = (SNIFFER_RING_BLOCK_SIZE / SNIFFER_RING_FRAME_SIZE) * SNIFFER_RING_NUM_BLOCKS;
+    req.tp_retire_blk_tov = SNIFFER_RING_BLOCK_TIMEOUT;
+
+    if (setsockopt(*psockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(struct tpacket_req3)) == -1) {
+        perror("create_packet_ring: error while creating the ring");
+        goto ERR_SETSOCKOPT;
+    }
+
+    ring->map_size = SNIFFER_RING_BLOCK_SIZE * SNIFFER_RING_NUM_BLOCKS;
+    if ((ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, *psockfd, 0)) == MAP_FAILED) {
+        perror("create_packet_ring: error while mapping the ring");
+        goto ERR_MMAP;
+    }
+
+    // Make the socket non-blocking
+    if (fcntl(*psockfd, F_SETFL, O_NONBLOCK) == -1) {
+        goto ERR_FCNTL;
+    }
+
+    // Capture on every interface
+    memset(&saddr, 0, sizeof(struct sockaddr_ll));
+    saddr.sll_family   = AF_PACKET;
+    saddr.sll_protocol = htons(ethertype);
+    saddr.sll_ifindex  = 0;
+
+    if (bind(*psockfd, (struct sockaddr *) &saddr, sizeof(struct sockaddr_ll)) == -1) {
+        perror("create_packet_ring: error while binding the socket");
+        goto ERR_BIND;
+    }
+
+    ring->cur_block = 0;
+    return true;
+
+ERR_BIND:
+ERR_FCNTL:
+    munmap(ring->map, ring->map_size);
+ERR_MMAP:
+ERR_SETSOCKOPT:
+    close(*psockfd);
 ERR_SOCKET:
+    ring->map = NULL;
     return false;
 }
+
+/**
+ * \brief Release the memory mapped by a ring (if any).
+ * \param ring A sniffer_ring_t instance.
+ */
+
+static void packet_ring_free(sniffer_ring_t * ring) {
+    if (ring->map) {
+        munmap(ring->map, ring->map_size);
+        ring->map = NULL;
+    }
+}
 #endif
 
-sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t *, void *))
+sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t **, size_t, void *))
 {
     sniffer_t * sniffer;
 
     // TODO: We currently only listen for ICMP thanks to raw sockets which
     // requires root privileges
 	// Can we set port to 0 to capture all packets wheter ICMP, UDP or TCP?
-    if (!(sniffer = malloc(sizeof(sniffer_t)))) goto ERR_MALLOC;
+    if (!(sniffer = calloc(1, sizeof(sniffer_t)))) goto ERR_MALLOC;
+#ifdef USE_IPV6
+    if (!(sniffer->cmsg_bytes = malloc(SNIFFER_BATCH_SIZE * SNIFFER_BUFLEN))) goto ERR_CMSG_BYTES;
+#endif
+    // If the ring cannot be set up, fall back on the raw socket. The
+    // socket handed over by a broker (if any) is always used.
+#ifdef USE_IPV4
+#  ifdef USE_PACKET_RING
+    if (broker_has_socket(BROKER_SOCKET_ICMPV4) || !create_packet_ring(&sniffer->icmpv4_ring, &sniffer->icmpv4_sockfd, ETH_P_IP))
+#  endif
+    if (!create_ipv4_socket(&sniffer->icmpv4_sockfd, IPPROTO_ICMP, 0))   goto ERR_CREATE_ICMPV4_SOCKET;
+#endif
+#ifdef USE_IPV6
+#  ifdef USE_PACKET_RING
+    if (broker_has_socket(BROKER_SOCKET_ICMPV6) || !create_packet_ring(&sniffer->icmpv6_ring, &sniffer->icmpv6_sockfd, ETH_P_IPV6))
+#  endif
+    if (!create_ipv6_socket(&sniffer->icmpv6_sockfd, IPPROTO_ICMPV6, 0)) goto ERR_CREATE_ICMPV6_SOCKET;
+#endif
 #ifdef USE_IPV4
-    if (!create_icmpv4_socket(sniffer, 0))      goto ERR_CREATE_ICMPV4_SOCKET;
+    sniffer->tcpv4_sockfd = -1;
 #endif
 #ifdef USE_IPV6
-    if (!create_icmpv6_socket(sniffer, 0))      goto ERR_CREATE_ICMPV6_SOCKET;
+    sniffer->tcpv6_sockfd = -1;
 #endif
     sniffer->recv_param = recv_param;
     sniffer->recv_callback = recv_callback;
@@ -168,33 +602,177 @@ sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t *,
 ERR_CREATE_ICMPV6_SOCKET:
 #ifdef USE_IPV4
     close(sniffer->icmpv4_sockfd);
+#  ifdef USE_PACKET_RING
+    packet_ring_free(&sniffer->icmpv4_ring);
+#  endif
 #endif
 #endif
 #ifdef USE_IPV4
 ERR_CREATE_ICMPV4_SOCKET:
+#endif
+#ifdef USE_IPV6
+    free(sniffer->cmsg_bytes);
+ERR_CMSG_BYTES:
 #endif
     free(sniffer);
 ERR_MALLOC:
     return NULL;
 }
 
+int sniffer_open_socket(int family, uint8_t protocol)
+{
+    int sockfd = -1;
+
+    switch (family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            create_ipv4_socket(&sockfd, protocol, 0);
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            create_ipv6_socket(&sockfd, protocol, 0);
+            break;
+#endif
+        default:
+            break;
+    }
+    return sockfd;
+}
+
 void sniffer_free(sniffer_t * sniffer)
 {
+    size_t i;
+
     if (sniffer) {
 #ifdef USE_IPV4
         close(sniffer->icmpv4_sockfd);
+        if (sniffer->tcpv4_sockfd != -1) close(sniffer->tcpv4_sockfd);
+#  ifdef USE_PACKET_RING
+        packet_ring_free(&sniffer->icmpv4_ring);
+#  endif
 #endif
 #ifdef USE_IPV6
         close(sniffer->icmpv6_sockfd);
+        if (sniffer->tcpv6_sockfd != -1) close(sniffer->tcpv6_sockfd);
+#  ifdef USE_PACKET_RING
+        packet_ring_free(&sniffer->icmpv6_ring);
+#  endif
+        free(sniffer->cmsg_bytes);
 #endif
+        for (i = 0; i < SNIFFER_BATCH_SIZE; i++) {
+            if (sniffer->recv_buffers[i]) sniffer_release_buffer(sniffer->recv_buffers[i]);
+        }
         free(sniffer);
     }
 }
 
+/**
+ * \brief Attach to the sockets of a sniffer the filters accepting the
+ *    buckets set in sniffer->buckets.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return true iif successful
+ */
+
+static bool sniffer_attach_filters(sniffer_t * sniffer)
+{
+    bool ret = true;
+
+#if defined(USE_SOCKET_FILTER) && defined(SO_ATTACH_FILTER)
+#  ifdef USE_IPV4
+    // Both the raw socket and the ring see the packets from their IP header
+    ret &= attach_filter(sniffer->icmpv4_sockfd, icmpv4_filter, FILTER_LEN(icmpv4_filter), sniffer->buckets);
+    if (sniffer->tcpv4_sockfd != -1) {
+        ret &= attach_filter(sniffer->tcpv4_sockfd, tcpv4_filter, FILTER_LEN(tcpv4_filter), sniffer->buckets);
+    }
+#  endif
+#  ifdef USE_IPV6
+#    ifdef USE_PACKET_RING
+    if (sniffer->icmpv6_ring.map) {
+        ret &= attach_filter(sniffer->icmpv6_sockfd, icmpv6_filter, FILTER_LEN(icmpv6_filter), sniffer->buckets);
+    } else
+#    endif
+    if (sniffer->is_sharded) {
+        ret &= attach_filter(sniffer->icmpv6_sockfd, icmpv6_raw_filter, FILTER_LEN(icmpv6_raw_filter), sniffer->buckets);
+    } else {
+        // ICMP6_FILTER is enough
+        setsockopt(sniffer->icmpv6_sockfd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+    }
+#  endif
+#else
+    // Every sniffer receives every reply
+    if (sniffer->is_sharded) {
+        fprintf(stderr, "sniffer_attach_filters: replies cannot be filtered\n");
+        ret = false;
+    }
+#endif
+
+    return ret;
+}
+
+bool sniffer_set_shard(sniffer_t * sniffer, size_t shard, size_t num_shards)
+{
+    size_t bucket;
+
+    if (num_shards == 0 || shard >= num_shards) {
+        fprintf(stderr, "sniffer_set_shard: invalid shard %zu/%zu\n", shard, num_shards);
+        return false;
+    }
+
+    memset(sniffer->buckets, 0, sizeof(sniffer->buckets));
+    for (bucket = shard; bucket < SNIFFER_NUM_BUCKETS; bucket += num_shards) {
+        sniffer->buckets[bucket / 32] |= 1u << (bucket % 32);
+    }
+    sniffer->is_sharded = (num_shards > 1);
+
+    return sniffer_attach_filters(sniffer);
+}
+
+bool sniffer_accept_bucket(sniffer_t * sniffer, uint8_t bucket)
+{
+    uint32_t bit = 1u << (bucket % 32);
+
+    if (!sniffer->is_sharded || (sniffer->buckets[bucket / 32] & bit)) {
+        return true;
+    }
+
+    sniffer->buckets[bucket / 32] |= bit;
+    return sniffer_attach_filters(sniffer);
+}
+
+bool sniffer_enable_tcp(sniffer_t * sniffer)
+{
+#ifdef USE_IPV4
+    if (sniffer->tcpv4_sockfd == -1 && !create_ipv4_socket(&sniffer->tcpv4_sockfd, IPPROTO_TCP, 0)) goto ERR_CREATE_TCPV4_SOCKET;
+#endif
+#ifdef USE_IPV6
+    if (sniffer->tcpv6_sockfd == -1 && !create_ipv6_socket(&sniffer->tcpv6_sockfd, IPPROTO_TCP, 0)) goto ERR_CREATE_TCPV6_SOCKET;
+#endif
+
+    // Apply the current shard (see sniffer_set_shard)
+    return !sniffer->is_sharded || sniffer_attach_filters(sniffer);
+
+#ifdef USE_IPV6
+ERR_CREATE_TCPV6_SOCKET:
+#  ifdef USE_IPV4
+    close(sniffer->tcpv4_sockfd);
+    sniffer->tcpv4_sockfd = -1;
+#  endif
+#endif
+#ifdef USE_IPV4
+ERR_CREATE_TCPV4_SOCKET:
+#endif
+    return false;
+}
+
 #ifdef USE_IPV4
 int sniffer_get_icmpv4_sockfd(sniffer_t *sniffer) {
     return sniffer->icmpv4_sockfd;
 }
+
+int sniffer_get_tcpv4_sockfd(const sniffer_t * sniffer) {
+    return sniffer->tcpv4_sockfd;
+}
 #endif
 
 #ifdef USE_IPV6
@@ -202,12 +780,17 @@ int sniffer_get_icmpv6_sockfd(sniffer_t *sniffer) {
     return sniffer->icmpv6_sockfd;
 }
 
+int sniffer_get_tcpv6_sockfd(const sniffer_t * sniffer) {
+    return sniffer->tcpv6_sockfd;
+}
+
 /**
  * \brief Rebuild the missing parts of an IPv6 header.
  * \param ip6_header The IPv6 header we want to complete.
  * \param msghdr
  * \param from
  * \param num_bytes The size in bytes of the IPv6 header
+ * \param next_header The protocol of the received bytes (IPPROTO_ICMPV6, IPPROTO_TCP)
  * \return true iif successful
  */
 
@@ -215,7 +798,8 @@ static bool rebuild_ipv6_header(
     struct ip6_hdr            * ip6_header,
     struct msghdr             * msg,
     const struct sockaddr_in6 * from,
-    ssize_t                     num_bytes
+    ssize_t                     num_bytes,
+    uint8_t                     next_header
 ) {
     bool                 ret = true;
     struct cmsghdr     * cmsg;
@@ -233,7 +817,7 @@ static bool rebuild_ipv6_header(
     memcpy(&ip6_header->ip6_src, &(from->sin6_addr), sizeof(struct in6_addr));
 
     // protocol
-    ip6_header-> ip6_ctlun.ip6_un1.ip6_un1_nxt = IPPROTO_ICMPV6;
+    ip6_header-> ip6_ctlun.ip6_un1.ip6_un1_nxt = next_header;
 
     // Fetch ancillary data (e.g last parts of the IPv6 header)
     for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
@@ -263,6 +847,8 @@ static bool rebuild_ipv6_header(
                     ret = false;
                     break;
             }
+        } else if (cmsg->cmsg_level == SOL_SOCKET) {
+            // Reception timestamp (see get_recv_time)
         } else {
             // This should never occur
             fprintf(stderr, "Ignoring msg (level = %d)\n", cmsg->cmsg_level);
@@ -274,90 +860,275 @@ static bool rebuild_ipv6_header(
 }
 
 /**
- * \brief Fetch an IPv6/ICMPv6 packet from an IPv6 socket
- * \param ipv6_sockfd An IPv6 socket which is sniffing an ICMPv6 packet
- * \param bytes A preallocated buffer in which we write the full IPv6 packet.
- * \param len The size of the preallocated buffer
- * \param flags
+ * \brief Fetch the pending IPv6/ICMPv6 (or IPv6/TCP) packets from an IPv6 socket
+ * \param sniffer A sniffer_t instance. The packets are written in its
+ *    reception buffers (sniffer->recv_buffers).
+ * \param sockfd The raw socket (sniffer->icmpv6_sockfd or sniffer->tcpv6_sockfd).
+ * \param next_header The protocol sniffed by this socket (IPPROTO_ICMPV6, IPPROTO_TCP).
+ * \param num_bytes An array of SNIFFER_BATCH_SIZE cells in which we
+ *    write the size of each full IPv6 packet (0 if the packet is invalid).
+ * \param recv_times An array of SNIFFER_BATCH_SIZE cells in which we
+ *    write the reception timestamp of each packet (see get_recv_time).
+ * \return The number of fetched packets.
  */
 
-static ssize_t recv_icmpv6(int ipv6_sockfd, void * bytes, size_t len, int flags) {
-    ssize_t               num_bytes;
-    char                  cmsg_buf[BUFLEN];
-    struct sockaddr_in6   from;
-    struct ip6_hdr      * ip6_header = (struct ip6_hdr *) bytes;
-
-    struct iovec iov = {
-        .iov_base = ((uint8_t *) bytes) + sizeof(struct ip6_hdr),
-        .iov_len  = len - sizeof(struct ip6_hdr)
-    };
-
-    struct msghdr msg = {
-        .msg_name       = &from,            // socket address
-        .msg_namelen    = sizeof(from),     // sizeof socket
-        .msg_iov        = &iov,             // buffer (scather/gather array)
-        .msg_iovlen     = 1,                // number of msg_iov elements
-        .msg_control    = cmsg_buf,         // ancillary data
-        .msg_controllen = sizeof(cmsg_buf), // sizeof ancillary data
-        .msg_flags      = flags             // flags related to recv messages
-    };
+static size_t recv_ipv6(sniffer_t * sniffer, int sockfd, uint8_t next_header, size_t * num_bytes, uint64_t * recv_times) {
+    struct mmsghdr        msgs[SNIFFER_BATCH_SIZE];
+    struct iovec          iovecs[SNIFFER_BATCH_SIZE];
+    struct sockaddr_in6   froms[SNIFFER_BATCH_SIZE];
+    struct ip6_hdr      * ip6_header;
+    struct msghdr       * msg;
+    uint8_t             * recv_buffer;
+    int                   i, num_msgs;
+    int64_t               offset = 0;
+    uint64_t              now;
+
+    for (i = 0; i < SNIFFER_BATCH_SIZE; i++) {
+        if (!(recv_buffer = sniffer_get_recv_buffer(sniffer, i))) break;
+
+        // The IPv6 header is rebuilt in front of the received bytes
+        iovecs[i].iov_base = recv_buffer + sizeof(struct ip6_hdr);
+        iovecs[i].iov_len  = SNIFFER_BUFLEN - sizeof(struct ip6_hdr);
+
+        msg = &msgs[i].msg_hdr;
+        msg->msg_name       = &froms[i];                                 // socket address
+        msg->msg_namelen    = sizeof(struct sockaddr_in6);               // sizeof socket
+        msg->msg_iov        = &iovecs[i];                                // buffer (scather/gather array)
+        msg->msg_iovlen     = 1;                                         // number of msg_iov elements
+        msg->msg_control    = sniffer->cmsg_bytes + i * SNIFFER_BUFLEN;  // ancillary data
+        msg->msg_controllen = SNIFFER_BUFLEN;                            // sizeof ancillary data
+        msg->msg_flags      = 0;                                         // flags related to recv messages
+    }
 
     // We do not need memset since we will explicitely set each bit of
-    // the IPv6 header. Uncomment to debug.
-    //memset(bytes, 0, sizeof(struct ip6_hdr));
+    // the IPv6 header.
 
-    // Fetch the bytes nested in the IPv6 packet (in the case of traceroute,
+    // Fetch the bytes nested in the IPv6 packets (in the case of traceroute,
     // we fetch ICMPv6/UDP/payload layers).
-    if ((num_bytes = recvmsg(ipv6_sockfd, &msg, flags)) == -1) {
+    if (i == 0 || (num_msgs = recvmmsg(sockfd, msgs, i, MSG_DONTWAIT, NULL)) == -1) {
         fprintf(stderr, "recv_ipv6_header: Can't fetch data\n");
-        goto ERR_RECVMSG;
+        return 0;
     }
 
-    if (msg.msg_flags & MSG_TRUNC) {
-        fprintf(stderr, "recv_ipv6_header: data truncated\n");
-        goto ERR_MSG_TRUNC;
+    // The clocks are read once for the whole batch
+    now = get_time_ns();
+#ifdef USE_TIMESTAMPING
+    offset = get_realtime_offset_ns();
+#endif
+
+    for (i = 0; i < num_msgs; i++) {
+        msg        = &msgs[i].msg_hdr;
+        ip6_header = (struct ip6_hdr *) sniffer->recv_buffers[i];
+        num_bytes[i] = 0;
+
+        if (msg->msg_flags & MSG_TRUNC) {
+            fprintf(stderr, "recv_ipv6_header: data truncated\n");
+            continue;
+        }
+
+        if (msg->msg_flags & MSG_CTRUNC) {
+            fprintf(stderr, "recv_ipv6_header: ancillary data truncated\n");
+            continue;
+        }
+
+        if (!rebuild_ipv6_header(ip6_header, msg, &froms[i], msgs[i].msg_len, next_header)) {
+            fprintf(stderr, "recv_ipv6_header: error in rebuild_ipv6_header\n");
+            continue;
+        }
+
+        num_bytes[i]  = msgs[i].msg_len + sizeof(struct ip6_hdr);
+        recv_times[i] = get_recv_time(msg, offset, now);
     }
 
-    if (msg.msg_flags & MSG_CTRUNC) {
-        fprintf(stderr, "recv_ipv6_header: ancillary data truncated\n");
-        goto ERR_MSG_CTRUNK;
+    return num_msgs;
+}
+
+#endif // USE_IPV6
+
+#ifdef USE_IPV4
+/**
+ * \brief Fetch the pending IPv4/ICMPv4 (or IPv4/TCP) packets from an IPv4 socket
+ * \param sniffer A sniffer_t instance. The packets are written in its
+ *    reception buffers (sniffer->recv_buffers).
+ * \param sockfd The raw socket (sniffer->icmpv4_sockfd or sniffer->tcpv4_sockfd).
+ * \param num_bytes An array of SNIFFER_BATCH_SIZE cells in which we
+ *    write the size of each IPv4 packet.
+ * \param recv_times An array of SNIFFER_BATCH_SIZE cells in which we
+ *    write the reception timestamp of each packet (see get_recv_time).
+ * \return The number of fetched packets.
+ */
+
+static size_t recv_ipv4(sniffer_t * sniffer, int sockfd, size_t * num_bytes, uint64_t * recv_times) {
+    struct mmsghdr msgs[SNIFFER_BATCH_SIZE];
+    struct iovec   iovecs[SNIFFER_BATCH_SIZE];
+#ifdef USE_TIMESTAMPING
+    uint8_t        cmsgs[SNIFFER_BATCH_SIZE][SNIFFER_TIMESTAMP_CMSG_SIZE];
+#endif
+    uint8_t      * recv_buffer;
+    int            i, num_msgs;
+    int64_t        offset = 0;
+    uint64_t       now;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < SNIFFER_BATCH_SIZE; i++) {
+        if (!(recv_buffer = sniffer_get_recv_buffer(sniffer, i))) break;
+        iovecs[i].iov_base = recv_buffer;
+        iovecs[i].iov_len  = SNIFFER_BUFLEN;
+        msgs[i].msg_hdr.msg_iov    = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef USE_TIMESTAMPING
+        msgs[i].msg_hdr.msg_control    = cmsgs[i];
+        msgs[i].msg_hdr.msg_controllen = SNIFFER_TIMESTAMP_CMSG_SIZE;
+#endif
     }
 
-    if(!rebuild_ipv6_header(ip6_header, &msg, &from, num_bytes)) {
-        fprintf(stderr, "recv_ipv6_header: error in rebuild_ipv6_header\n");
-        goto ERR_REBUILD_IPV6_HEADER;
+    if (i == 0 || (num_msgs = recvmmsg(sockfd, msgs, i, MSG_DONTWAIT, NULL)) == -1) {
+        return 0;
     }
 
-    return num_bytes + sizeof(struct ip6_hdr);
-ERR_REBUILD_IPV6_HEADER:
-ERR_MSG_CTRUNK:
-ERR_MSG_TRUNC:
-ERR_RECVMSG:
-    return 0;
+    // The clocks are read once for the whole batch
+    now = get_time_ns();
+#ifdef USE_TIMESTAMPING
+    offset = get_realtime_offset_ns();
+#endif
+
+    for (i = 0; i < num_msgs; i++) {
+        num_bytes[i]  = msgs[i].msg_len;
+        recv_times[i] = get_recv_time(&msgs[i].msg_hdr, offset, now);
+    }
+
+    return num_msgs;
 }
+#endif // USE_IPV4
 
-#endif // USE_IPV6
+/**
+ * \brief Pass sniffed packets to the sniffer's callback.
+ * \param sniffer A sniffer_t instance.
+ * \param packets The sniffed packets.
+ * \param num_packets The number of sniffed packets.
+ */
+
+static void sniffer_notify(sniffer_t * sniffer, packet_t ** packets, size_t num_packets) {
+    if (num_packets > 0) {
+        if (!(sniffer->recv_callback(packets, num_packets, sniffer->recv_param))) {
+            fprintf(stderr, "Error in sniffer's callback\n");
+        }
+    }
+}
+
+#ifdef USE_PACKET_RING
+/**
+ * \brief Test whether a frame captured by a ring must be passed to the
+ *    sniffer's callback.
+ * \param frame The header of the frame.
+ * \param bytes The captured network-layer packet.
+ * \param protocol_id The expected transport protocol (IPPROTO_ICMP, IPPROTO_ICMPV6)
+ * \return true iif the frame is a complete incoming ICMP packet.
+ */
 
-void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id)
+static bool sniffer_ring_accept(const struct tpacket3_hdr * frame, const uint8_t * bytes, uint8_t protocol_id)
 {
-    uint8_t    recv_bytes[BUFLEN];
-    ssize_t    num_bytes = 0;
-    packet_t * packet;
+    const struct sockaddr_ll * sll = (const struct sockaddr_ll *) ((const uint8_t *) frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+    // Our own probes are also captured
+    if (sll->sll_pkttype == PACKET_OUTGOING) return false;
+
+    // The packet does not fit in the frame
+    if (frame->tp_snaplen < frame->tp_len) return false;
 
     switch (protocol_id) {
 #ifdef USE_IPV4
         case IPPROTO_ICMP:
-            num_bytes = recv(sniffer->icmpv4_sockfd, recv_bytes, BUFLEN, 0);
-            break;
+            return frame->tp_snaplen >= 20 && (bytes[0] >> 4) == 4 && bytes[9] == IPPROTO_ICMP;
 #endif
 #ifdef USE_IPV6
         case IPPROTO_ICMPV6:
-            num_bytes = recv_icmpv6(sniffer->icmpv6_sockfd, recv_bytes, BUFLEN, 0);
-            break;
+            return frame->tp_snaplen >= sizeof(struct ip6_hdr) && (bytes[0] >> 4) == 6 && bytes[6] == IPPROTO_ICMPV6;
 #endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * \brief Process every block of a ring handed over by the kernel. The
+ *    sniffed packets reference the frames of the ring, so each block is
+ *    handed back to the kernel once the callback has processed its packets.
+ * \param sniffer A sniffer_t instance.
+ * \param ring The ring to process.
+ * \param protocol_id The family of the packet to fetch (IPPROTO_ICMP, IPPROTO_ICMPV6)
+ */
+
+static void sniffer_process_ring(sniffer_t * sniffer, sniffer_ring_t * ring, uint8_t protocol_id)
+{
+    struct tpacket_block_desc * block;
+    struct tpacket3_hdr       * frame;
+    packet_t                  * packets[SNIFFER_BATCH_SIZE];
+    uint8_t                   * bytes;
+    size_t                      i, num_frames, num_packets = 0;
+    struct timespec             ts;
+    int64_t                     offset = get_realtime_offset_ns();
+
+    for (;;) {
+        block = (struct tpacket_block_desc *) (ring->map + ring->cur_block * SNIFFER_RING_BLOCK_SIZE);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) break;
+
+        num_frames = block->hdr.bh1.num_pkts;
+        frame = (struct tpacket3_hdr *) ((uint8_t *) block + block->hdr.bh1.offset_to_first_pkt);
+
+        for (i = 0; i < num_frames; i++) {
+            bytes = (uint8_t *) frame + frame->tp_net;
+
+            if (sniffer->recv_callback
+            &&  sniffer_ring_accept(frame, bytes, protocol_id)
+            &&  (packets[num_packets] = packet_borrow_bytes(bytes, frame->tp_snaplen))) {
+                ts.tv_sec  = frame->tp_sec;
+                ts.tv_nsec = frame->tp_nsec;
+                packet_set_recv_time(packets[num_packets], realtime_to_time_ns(&ts, offset));
+                if (++num_packets == SNIFFER_BATCH_SIZE) {
+                    sniffer_notify(sniffer, packets, num_packets);
+                    num_packets = 0;
+                }
+            }
+
+            frame = (struct tpacket3_hdr *) ((uint8_t *) frame + frame->tp_next_offset);
+        }
+
+        // The frames of this block must not be referenced anymore
+        sniffer_notify(sniffer, packets, num_packets);
+        num_packets = 0;
+
+        // Hand this block back to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->cur_block = (ring->cur_block + 1) % SNIFFER_RING_NUM_BLOCKS;
     }
+}
+#endif // USE_PACKET_RING
+
+/**
+ * \brief Pass the packets fetched in the reception buffers of a sniffer
+ *    to its callback.
+ * \param sniffer A sniffer_t instance.
+ * \param num_msgs The number of fetched packets.
+ * \param num_bytes The size of each packet (see recv_ipv4 and recv_ipv6).
+ * \param recv_times The reception timestamp of each packet.
+ * \return true iif some packets may still be pending (a full batch has
+ *   been fetched).
+ */
+
+static bool sniffer_deliver(sniffer_t * sniffer, size_t num_msgs, const size_t * num_bytes, const uint64_t * recv_times)
+{
+    uint8_t  * recv_bytes;
+    packet_t * packets[SNIFFER_BATCH_SIZE];
+    size_t     i, num_packets = 0;
+
+    // Nobody is interested in these packets
+    if (!sniffer->recv_callback) return num_msgs == SNIFFER_BATCH_SIZE;
+
+    for (i = 0; i < num_msgs; i++) {
+        if (num_bytes[i] < 4) continue;
+        recv_bytes = sniffer->recv_buffers[i];
 
-	if (num_bytes >= 4) {
 		// We have to make some modifications on the datagram
 		// received because the raw format varies between
 		// OSes:
@@ -371,13 +1142,79 @@ void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id)
 		uint16_t ip_len = read16(recv_bytes, 2);
 		writebe16(recv_bytes, 2, ip_len);
 #endif
-		if (sniffer->recv_callback != NULL) {
-            packet = packet_create_from_bytes(recv_bytes, num_bytes);
+        // The reception buffer is handed over to the packet
+        if ((packets[num_packets] = packet_lend_bytes(recv_bytes, num_bytes[i], sniffer_release_buffer))) {
+            sniffer->recv_buffers[i] = NULL;
+            packet_set_recv_time(packets[num_packets], recv_times[i]);
+            num_packets++;
+        }
+    }
+
+    sniffer_notify(sniffer, packets, num_packets);
+    return num_msgs == SNIFFER_BATCH_SIZE;
+}
+
+bool sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id)
+{
+    size_t     num_bytes[SNIFFER_BATCH_SIZE];
+    uint64_t   recv_times[SNIFFER_BATCH_SIZE];
+    size_t     num_msgs = 0;
 
-			if (!(sniffer->recv_callback(packet, sniffer->recv_param))) {
-                fprintf(stderr, "Error in sniffer's callback\n");
+#ifdef USE_PACKET_RING
+    switch (protocol_id) {
+#  ifdef USE_IPV4
+        case IPPROTO_ICMP:
+            if (sniffer->icmpv4_ring.map) {
+                sniffer_process_ring(sniffer, &sniffer->icmpv4_ring, protocol_id);
+                return false;
             }
-        }
-	}
+            break;
+#  endif
+#  ifdef USE_IPV6
+        case IPPROTO_ICMPV6:
+            if (sniffer->icmpv6_ring.map) {
+                sniffer_process_ring(sniffer, &sniffer->icmpv6_ring, protocol_id);
+                return false;
+            }
+            break;
+#  endif
+    }
+#endif
+
+    switch (protocol_id) {
+#ifdef USE_IPV4
+        case IPPROTO_ICMP:
+            num_msgs = recv_ipv4(sniffer, sniffer->icmpv4_sockfd, num_bytes, recv_times);
+            break;
+#endif
+#ifdef USE_IPV6
+        case IPPROTO_ICMPV6:
+            num_msgs = recv_ipv6(sniffer, sniffer->icmpv6_sockfd, IPPROTO_ICMPV6, num_bytes, recv_times);
+            break;
+#endif
+    }
+
+    return sniffer_deliver(sniffer, num_msgs, num_bytes, recv_times);
 }
 
+bool sniffer_process_tcp_packets(sniffer_t * sniffer, int family)
+{
+    size_t     num_bytes[SNIFFER_BATCH_SIZE];
+    uint64_t   recv_times[SNIFFER_BATCH_SIZE];
+    size_t     num_msgs = 0;
+
+    switch (family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            num_msgs = recv_ipv4(sniffer, sniffer->tcpv4_sockfd, num_bytes, recv_times);
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            num_msgs = recv_ipv6(sniffer, sniffer->tcpv6_sockfd, IPPROTO_TCP, num_bytes, recv_times);
+            break;
+#endif
+    }
+
+    return sniffer_deliver(sniffer, num_msgs, num_bytes, recv_times);
+}
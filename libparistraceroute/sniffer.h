@@ -8,39 +8,124 @@
  * \brief Header file : packet sniffer
  *
  * The current implementation is based on raw sockets, but we could envisage a
- * libpcap implementation too
+ * libpcap implementation too.
+ *
+ * If USE_PACKET_RING is defined (see use.h), the sniffer first tries to
+ * capture the ICMP packets thanks to an AF_PACKET socket and a memory-mapped
+ * TPACKET_V3 ring (Linux specific). The kernel fills blocks of frames that
+ * are processed at once, and sniffed packets reference the frames stored
+ * in the ring instead of copying them (see packet_borrow_bytes). If the
+ * ring cannot be set up, the sniffer falls back on a raw socket.
+ *
+ * The TCP segments sent by the destinations (SYN/ACK, RST) are only
+ * sniffed once sniffer_enable_tcp has been called, always thanks to raw
+ * sockets.
  */
 
 #include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint8_t
 #include "packet.h"  // packet_t
 
+// Maximum number of packets fetched at once by sniffer_process_packets().
+#define SNIFFER_BATCH_SIZE 32
+
+// Size of each preallocated reception buffer.
+#define SNIFFER_BUFLEN     4096
+
+// Number of buckets of destinations (see sniffer_set_shard).
+#define SNIFFER_NUM_BUCKETS 256
+
+#ifdef USE_PACKET_RING
+// Geometry of the TPACKET_V3 rings. SNIFFER_RING_BLOCK_SIZE must be a
+// multiple of the page size and of SNIFFER_RING_FRAME_SIZE.
+#    define SNIFFER_RING_BLOCK_SIZE (1 << 16)
+#    define SNIFFER_RING_NUM_BLOCKS 64
+#    define SNIFFER_RING_FRAME_SIZE 2048
+
+// Maximal delay before the kernel hands a partially filled block over
+// to the sniffer (in milliseconds).
+#    define SNIFFER_RING_BLOCK_TIMEOUT 1
+
+/**
+ * \struct sniffer_ring_t
+ * \brief A TPACKET_V3 reception ring mapped in the memory.
+ */
+
+typedef struct {
+    uint8_t * map;       /**< The mapped ring, NULL if the ring is not used */
+    size_t    map_size;  /**< Size of the mapped ring (in bytes) */
+    size_t    cur_block; /**< Index of the next block to process */
+} sniffer_ring_t;
+#endif
+
 /**
  * \struct sniffer_t
  * \brief Structure representing a packet sniffer. The sniffer calls
- *    a function whenever a packet is sniffed. For instance
+ *    a function whenever packets are sniffed. For instance
  *    sniffer->recv_param may point to a queue_t instance and
  *    sniffer->recv_callback may be used to feed this queue whenever
- *    a packet is sniffed.
+ *    packets are sniffed.
  */
 
 typedef struct {
 #ifdef USE_IPV4
-    int     icmpv4_sockfd;  /**< Raw socket for sniffing ICMPv4 packets */
+    int     icmpv4_sockfd;  /**< Raw (or packet) socket for sniffing ICMPv4 packets */
+#endif
+#ifdef USE_IPV6
+    int     icmpv6_sockfd;  /**< Raw (or packet) socket for sniffing ICMPv6 packets */
+#endif
+#ifdef USE_IPV4
+    int     tcpv4_sockfd;   /**< Raw socket for sniffing IPv4/TCP packets, -1 if disabled (see sniffer_enable_tcp) */
 #endif
 #ifdef USE_IPV6
-    int     icmpv6_sockfd;  /**< Raw socket for sniffing ICMPv6 packets */
+    int     tcpv6_sockfd;   /**< Raw socket for sniffing IPv6/TCP packets, -1 if disabled (see sniffer_enable_tcp) */
+#endif
+#ifdef USE_PACKET_RING
+#  ifdef USE_IPV4
+    sniffer_ring_t icmpv4_ring; /**< Ring related to sniffer->icmpv4_sockfd */
+#  endif
+#  ifdef USE_IPV6
+    sniffer_ring_t icmpv6_ring; /**< Ring related to sniffer->icmpv6_sockfd */
+#  endif
 #endif
-    void  * recv_param;     /**< This pointer is passed whenever recv_callback is called */
-    bool (* recv_callback)(packet_t * packet, void * recv_param); /**< Callback for received packets */
+    void    * recv_param;   /**< This pointer is passed whenever recv_callback is called */
+    bool   (* recv_callback)(packet_t ** packets, size_t num_packets, void * recv_param); /**< Callback for received packets */
+    uint8_t * recv_buffers[SNIFFER_BATCH_SIZE]; /**< Reception buffers of SNIFFER_BUFLEN bytes, handed over to the sniffed packets (NULL if not allocated yet) */
+#ifdef USE_IPV6
+    uint8_t * cmsg_bytes;   /**< SNIFFER_BATCH_SIZE preallocated buffers of SNIFFER_BUFLEN bytes for ancillary data */
+#endif
+    uint32_t  buckets[SNIFFER_NUM_BUCKETS / 32]; /**< Bitmap of the buckets whose replies are accepted (see sniffer_set_shard) */
+    bool      is_sharded;   /**< True iif some buckets are not accepted */
 } sniffer_t;
 
 /**
  * \brief Creates a new sniffer.
- * \param callback This function is called whenever a packet is sniffed.
+ * \param recv_param This pointer is passed whenever recv_callback is called.
+ * \param recv_callback This function is called whenever packets are sniffed.
+ *    It receives an array of packets and the number of packets it stores.
+ *    It is responsible for releasing these packets. The bytes of borrowed
+ *    packets (see packet_is_borrowed) are only valid until the callback
+ *    returns, so the callback must duplicate the packets it keeps. The
+ *    other packets are received in buffers lent by the sniffer (see
+ *    packet_lend_bytes) and can be kept as is.
  * \return Pointer to a sniffer_t structure representing a packet sniffer
  */
 
-sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t *, void *));
+sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t **, size_t, void *));
+
+/**
+ * \brief Open a raw socket sniffing the replies of a given protocol,
+ *    configured like the sockets of a sniffer (non-blocking, bound,
+ *    filtered and timestamped). This allows a broker (see broker.h)
+ *    to open the sockets of an unprivileged sniffer.
+ * \param family The family of the socket (AF_INET, AF_INET6).
+ * \param protocol The sniffed protocol (IPPROTO_ICMP, IPPROTO_ICMPV6
+ *    or IPPROTO_TCP).
+ * \return The socket, -1 in case of failure.
+ */
+
+int sniffer_open_socket(int family, uint8_t protocol);
 
 /**
  * \brief Free a sniffer_t structure.
@@ -49,6 +134,46 @@ sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t *,
 
 void sniffer_free(sniffer_t * sniffer);
 
+/**
+ * \brief Restrict a sniffer to the replies related to the probes of a given
+ *    shard (see network_get_destination_shard). Several networks may then
+ *    run in the same process, each of them probing its own destinations,
+ *    without processing the replies related to the other networks.
+ *    The replies are filtered in the kernel (requires USE_SOCKET_FILTER)
+ *    according to their bucket, i.e. the last byte of the probe
+ *    destination: the shard accepts the buckets b such that
+ *    b % num_shards == shard.
+ *    ICMPv6 echo replies received on a raw socket are not filtered.
+ * \param sniffer Points to a sniffer_t instance.
+ * \param shard The shard of this sniffer (in [0, num_shards - 1]).
+ * \param num_shards The number of shards (1 means no sharding).
+ * \return true iif successful
+ */
+
+bool sniffer_set_shard(sniffer_t * sniffer, size_t shard, size_t num_shards);
+
+/**
+ * \brief Accept the replies of an additional bucket of destinations, e.g.
+ *    because a destination of another shard is now probed by this sniffer.
+ *    The replies of this bucket are then received by both shards.
+ * \param sniffer Points to a sniffer_t instance.
+ * \param bucket The bucket (the last byte of the probe destination).
+ * \return true iif successful
+ */
+
+bool sniffer_accept_bucket(sniffer_t * sniffer, uint8_t bucket);
+
+/**
+ * \brief Also sniff the TCP segments acknowledging or resetting a probe
+ *    (SYN/ACK, RST), e.g. the replies of the destinations to TCP probes.
+ *    The other TCP segments received by the host are dropped in the
+ *    kernel (requires USE_SOCKET_FILTER).
+ * \param sniffer Points to a sniffer_t instance.
+ * \return true iif successful
+ */
+
+bool sniffer_enable_tcp(sniffer_t * sniffer);
+
 #ifdef USE_IPV4
 /**
  * \brief Return the file descriptor related to the ICMPv4 raw socket
@@ -58,6 +183,16 @@ void sniffer_free(sniffer_t * sniffer);
  */
 
 int sniffer_get_icmpv4_sockfd(sniffer_t * sniffer);
+
+/**
+ * \brief Return the file descriptor related to the IPv4/TCP raw socket
+ *    managed by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return The corresponding socket file descriptor, -1 if the TCP
+ *    segments are not sniffed (see sniffer_enable_tcp).
+ */
+
+int sniffer_get_tcpv4_sockfd(const sniffer_t * sniffer);
 #endif
 
 #ifdef USE_IPV6
@@ -69,17 +204,43 @@ int sniffer_get_icmpv4_sockfd(sniffer_t * sniffer);
  */
 
 int sniffer_get_icmpv6_sockfd(sniffer_t * sniffer);
+
+/**
+ * \brief Return the file descriptor related to the IPv6/TCP raw socket
+ *    managed by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return The corresponding socket file descriptor, -1 if the TCP
+ *    segments are not sniffed (see sniffer_enable_tcp).
+ */
+
+int sniffer_get_tcpv6_sockfd(const sniffer_t * sniffer);
 #endif
 
 /**
- * \brief Fetch a packet from the listening socket. The sniffer then
- *   call recv_callback and pass to this function this packet and
- *   eventual data stored in sniffer->recv_packet. If this callback
- *   returns false, a message is printed. 
+ * \brief Fetch the pending packets (at most SNIFFER_BATCH_SIZE) from the
+ *   listening socket using a single system call. The sniffer then
+ *   call recv_callback and pass to this function these packets and
+ *   eventual data stored in sniffer->recv_param. If this callback
+ *   returns false, a message is printed.
+ *   If the packets are captured thanks to a ring, every block handed
+ *   over by the kernel is processed, SNIFFER_BATCH_SIZE packets at a time.
  * \param sniffer Points to a sniffer_t instance.
  * \param protocol_id The family of the packet to fetch (IPPROTO_ICMP, IPPROTO_ICMPV6)
+ * \return true iif some packets may still be pending (a full batch has
+ *   been fetched), false if the socket (or the ring) has been drained.
+ */
+
+bool sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id);
+
+/**
+ * \brief Fetch the pending TCP segments (at most SNIFFER_BATCH_SIZE) and
+ *   pass them to recv_callback, as sniffer_process_packets does.
+ * \param sniffer Points to a sniffer_t instance. Its TCP segments must
+ *   be sniffed (see sniffer_enable_tcp).
+ * \param family The family of the segments to fetch (AF_INET, AF_INET6).
+ * \return true iif some segments may still be pending.
  */
 
-void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id);
+bool sniffer_process_tcp_packets(sniffer_t * sniffer, int family);
 
 #endif
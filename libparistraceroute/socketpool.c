@@ -4,15 +4,32 @@
 #include <stdlib.h>             // malloc
 #include <stdio.h>              // perror
 #include <unistd.h>             // close
-#include <sys/socket.h>         // socket, getaddrinfo
+#include <sys/socket.h>         // socket, getaddrinfo, sendmmsg
 #include <sys/types.h>          // getaddrinfo
 #include <netdb.h>              // getaddrinfo
 #include <arpa/inet.h>          // inet_pton
 #include <string.h>             // memset
+#include <sys/uio.h>            // struct iovec
+
+#ifdef USE_TIMESTAMPING
+#  include <errno.h>              // ENOMSG
+#  include <linux/errqueue.h>     // sock_extended_err, scm_timestamping
+#  include <linux/net_tstamp.h>   // SOF_TIMESTAMPING_*
+#endif
+
+#ifdef USE_TXTIME
+#  include <linux/net_tstamp.h>   // sock_txtime
+#  ifndef SO_TXTIME
+#    define SO_TXTIME 61
+#    define SCM_TXTIME SO_TXTIME
+#  endif
+#endif
 
 #include "socketpool.h"
 
 #include "address.h"            // address_guess_family
+#include "broker.h"             // broker_take_socket
+#include "common.h"             // get_realtime_offset_ns
 
 /*
 If we send UDP packet, we could get a return error channel.
@@ -45,7 +62,9 @@ typedef union sockaddr_union sockaddr_u;
 static bool create_raw_socket(int family, int * psockfd) {
 	int       sockfd;
 
-    if ((sockfd = socket(family, SOCK_RAW, IPPROTO_RAW)) == -1) {
+    // The socket may have been opened by a broker (see broker.h)
+    if ((sockfd = broker_take_socket(family == AF_INET ? BROKER_SOCKET_IPV4_RAW : BROKER_SOCKET_IPV6_RAW)) == -1
+    &&  (sockfd = socket(family, SOCK_RAW, IPPROTO_RAW)) == -1) {
         perror("Cannot create a raw socket (are you root?)");
         goto ERR_SOCKET;
     }
@@ -57,6 +76,55 @@ ERR_SOCKET:
     return false;
 }
 
+#ifdef USE_TIMESTAMPING
+/**
+ * \brief Ask the kernel to report the transmit timestamps of the packets
+ *    sent through a raw socket. Each packet is identified by a key
+ *    incremented whenever a packet is sent (SOF_TIMESTAMPING_OPT_ID).
+ * \param sockfd The raw socket.
+ * \return true iif successful
+ */
+
+static bool enable_tx_timestamping(int sockfd) {
+    int flags = SOF_TIMESTAMPING_TX_SCHED
+              | SOF_TIMESTAMPING_TX_SOFTWARE
+              | SOF_TIMESTAMPING_SOFTWARE
+              | SOF_TIMESTAMPING_OPT_ID
+              | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+        perror("enable_tx_timestamping: transmit timestamps not available");
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+#ifdef USE_TXTIME
+/**
+ * \brief Ask the kernel to hold the packets sent through a raw socket
+ *    until the departure time carried by their SCM_TXTIME message.
+ * \param sockfd The raw socket.
+ * \return true iif successful
+ */
+
+static bool enable_txtime(int sockfd) {
+    struct sock_txtime txtime = {
+        .clockid = CLOCK_MONOTONIC, // Expected by the fq qdisc
+        .flags   = 0
+    };
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == -1) {
+        perror("enable_txtime: departure times not available");
+        return false;
+    }
+
+    return true;
+}
+
+#endif
+
 socketpool_t * socketpool_create() {
     socketpool_t * socketpool;
     
@@ -66,6 +134,33 @@ socketpool_t * socketpool_create() {
 #endif
 #ifdef USE_IPV6
     if (!(create_raw_socket(AF_INET6, &socketpool->ipv6_sockfd))) goto ERR_CREATE_RAW_SOCKET_IPV6;
+#endif
+#ifdef USE_TIMESTAMPING
+    // Optional, the probes are then timestamped in userspace
+#  ifdef USE_IPV4
+    socketpool->ipv4_tx_key = 0;
+    socketpool->ipv4_is_timestamped = enable_tx_timestamping(socketpool->ipv4_sockfd);
+#  endif
+#  ifdef USE_IPV6
+    socketpool->ipv6_tx_key = 0;
+    socketpool->ipv6_is_timestamped = enable_tx_timestamping(socketpool->ipv6_sockfd);
+#  endif
+#endif
+#ifdef USE_TXTIME
+    // Optional, the scheduled probes are then released by the event loop
+    socketpool->has_txtime = true;
+#  ifdef USE_IPV4
+    socketpool->has_txtime &= enable_txtime(socketpool->ipv4_sockfd);
+#  endif
+#  ifdef USE_IPV6
+    socketpool->has_txtime &= enable_txtime(socketpool->ipv6_sockfd);
+#  endif
+#endif
+#ifdef USE_PACKET_TX_RING
+    // Optional, the raw sockets are used if the ring cannot be set up
+    if (!(socketpool->tx_ring = tx_ring_create())) {
+        fprintf(stderr, "socketpool_create: cannot create the transmit ring, using raw sockets\n");
+    }
 #endif
     return socketpool;
 
@@ -94,39 +189,53 @@ void socketpool_free(socketpool_t * socketpool) {
         if (close(socketpool->ipv6_sockfd) == -1) {
             perror("socketpool_free: Error while closing IPv6 socket");
         }
+#endif
+#ifdef USE_PACKET_TX_RING
+        tx_ring_free(socketpool->tx_ring);
 #endif
         free(socketpool);
     }
 }
 
-bool socketpool_send_packet(const socketpool_t * socketpool, const packet_t * packet)
-{
-	sockaddr_u              sock;
-    int                     sockfd;
-    socklen_t               socklen;
-    const struct sockaddr * dst_addr;
-    
-    memset(&sock, 0, sizeof(sockaddr_u));
+/**
+ * \brief Prepare the destination address and retrieve the socket to use
+ *    in order to send a given packet.
+ * \param socketpool The socketpool to use
+ * \param packet The packet to send
+ * \param sock The sockaddr_u instance in which the destination is written
+ * \param psocklen Address of a socklen_t in which the size of the
+ *    destination address is written
+ * \param psockfd Address of an integer in which the socket file
+ *    descriptor is written
+ * \return true iif successful
+ */
+
+static bool socketpool_prepare_packet(
+    const socketpool_t * socketpool,
+    const packet_t     * packet,
+    sockaddr_u         * sock,
+    socklen_t          * psocklen,
+    int                * psockfd
+) {
+    memset(sock, 0, sizeof(sockaddr_u));
 
     // Prepare socket 
     // We don't care about the dst_port set in the packet
     switch (packet->dst_ip->family) {
 #ifdef USE_IPV4
         case AF_INET:
-            sock.sin.sin_family = AF_INET;
-            sock.sin.sin_addr   = packet->dst_ip->ip.ipv4;
-            sockfd = socketpool->ipv4_sockfd;
-            socklen = sizeof(struct sockaddr_in);
-            dst_addr = (struct sockaddr *) &sock.sin;
+            sock->sin.sin_family = AF_INET;
+            sock->sin.sin_addr   = packet->dst_ip->ip.ipv4;
+            *psockfd  = socketpool->ipv4_sockfd;
+            *psocklen = sizeof(struct sockaddr_in);
             break;
 #endif
 #ifdef USE_IPV6
         case AF_INET6:
-            sock.sin6.sin6_family = AF_INET6;
-            memcpy(&sock.sin6.sin6_addr, &packet->dst_ip->ip.ipv6, sizeof(ipv6_t));
-            sockfd = socketpool->ipv6_sockfd;
-            socklen = sizeof(struct sockaddr_in6);
-            dst_addr = (struct sockaddr *) &sock.sin6;
+            sock->sin6.sin6_family = AF_INET6;
+            memcpy(&sock->sin6.sin6_addr, &packet->dst_ip->ip.ipv6, sizeof(ipv6_t));
+            *psockfd  = socketpool->ipv6_sockfd;
+            *psocklen = sizeof(struct sockaddr_in6);
             break;
 #endif
         default:
@@ -134,15 +243,276 @@ bool socketpool_send_packet(const socketpool_t * socketpool, const packet_t * pa
             goto ERR_INVALID_FAMILY;
     }
 
+    return true;
+
+ERR_INVALID_FAMILY:
+    return false;
+}
+
+/**
+ * \brief Report the keys assigned by the kernel to packets sent through
+ *    a raw socket.
+ * \param socketpool The socketpool to use
+ * \param family The family of the raw socket.
+ * \param tx_keys An array of num_packets cells, or NULL.
+ * \param num_packets The number of packets sent through this socket.
+ */
+
+static void socketpool_set_tx_keys(socketpool_t * socketpool, int family, socketpool_tx_key_t * tx_keys, size_t num_packets)
+{
+    uint32_t * ptx_key = NULL;
+    size_t     i;
+
+#ifdef USE_TIMESTAMPING
+    switch (family) {
+#  ifdef USE_IPV4
+        case AF_INET:
+            if (socketpool->ipv4_is_timestamped) ptx_key = &socketpool->ipv4_tx_key;
+            break;
+#  endif
+#  ifdef USE_IPV6
+        case AF_INET6:
+            if (socketpool->ipv6_is_timestamped) ptx_key = &socketpool->ipv6_tx_key;
+            break;
+#  endif
+    }
+#endif
+
+    for (i = 0; tx_keys && i < num_packets; i++) {
+        tx_keys[i].family = ptx_key ? family : AF_UNSPEC;
+        tx_keys[i].key    = ptx_key ? *ptx_key + i : 0;
+    }
+
+    if (ptx_key) *ptx_key += num_packets;
+}
+
+bool socketpool_send_packet(socketpool_t * socketpool, const packet_t * packet)
+{
+    sockaddr_u sock;
+    int        sockfd;
+    socklen_t  socklen;
+
+    if (!socketpool_prepare_packet(socketpool, packet, &sock, &socklen, &sockfd)) {
+        goto ERR_PREPARE_PACKET;
+    }
+
     // Send the packet
-    if (sendto(sockfd, packet_get_bytes(packet), packet_get_size(packet), 0, dst_addr, socklen) == -1) {
+    if (sendto(sockfd, packet_get_bytes(packet), packet_get_size(packet), 0, &sock.sa, socklen) == -1) {
         perror("send_data: Sending error in queue");
         goto ERR_SEND_TO;
     }
 
+    // The kernel has assigned a key to this packet
+    socketpool_set_tx_keys(socketpool, packet->dst_ip->family, NULL, 1);
     return true;
 
 ERR_SEND_TO:
-ERR_INVALID_FAMILY:
+ERR_PREPARE_PACKET:
     return false;
 }
+
+/**
+ * \brief Send several packets through the raw sockets of the pool.
+ * \param socketpool The socketpool to use
+ * \param packets An array of packets to send
+ * \param num_packets The number of packets stored in packets
+ * \param tx_keys An array of num_packets cells, or NULL.
+ * \return The number of packets sent (see socketpool_send_packets).
+ */
+
+static size_t socketpool_sendmmsg(socketpool_t * socketpool, packet_t ** packets, size_t num_packets, socketpool_tx_key_t * tx_keys)
+{
+    struct mmsghdr msgs[SOCKETPOOL_BATCH_SIZE];
+    struct iovec   iovecs[SOCKETPOOL_BATCH_SIZE];
+    sockaddr_u     socks[SOCKETPOOL_BATCH_SIZE];
+    int            sockfd, batch_sockfd = -1, ret;
+    size_t         i, num_msgs, num_sent = 0;
+#ifdef USE_TXTIME
+    // The departure time of each packet is passed in an SCM_TXTIME message
+    union {
+        struct cmsghdr cmsg;
+        uint8_t        bytes[CMSG_SPACE(sizeof(uint64_t))];
+    }                controls[SOCKETPOOL_BATCH_SIZE];
+    struct cmsghdr * cmsg;
+    uint64_t         departure_time;
+#endif
+
+    memset(msgs, 0, sizeof(msgs));
+
+    while (num_sent < num_packets) {
+        // Gather the next consecutive packets sent through the same socket
+        for (i = num_sent, num_msgs = 0; i < num_packets && num_msgs < SOCKETPOOL_BATCH_SIZE; i++, num_msgs++) {
+            if (!socketpool_prepare_packet(socketpool, packets[i], &socks[num_msgs], &msgs[num_msgs].msg_hdr.msg_namelen, &sockfd)) {
+                break;
+            }
+
+            if (num_msgs == 0) {
+                batch_sockfd = sockfd;
+            } else if (sockfd != batch_sockfd) {
+                break;
+            }
+
+            iovecs[num_msgs].iov_base         = packet_get_bytes(packets[i]);
+            iovecs[num_msgs].iov_len          = packet_get_size(packets[i]);
+            msgs[num_msgs].msg_hdr.msg_name   = &socks[num_msgs].sa;
+            msgs[num_msgs].msg_hdr.msg_iov    = &iovecs[num_msgs];
+            msgs[num_msgs].msg_hdr.msg_iovlen = 1;
+#ifdef USE_TXTIME
+            msgs[num_msgs].msg_hdr.msg_control    = NULL;
+            msgs[num_msgs].msg_hdr.msg_controllen = 0;
+            if (socketpool->has_txtime && (departure_time = packet_get_departure_time(packets[i])) > 0) {
+                // Departure times are already expressed in CLOCK_MONOTONIC (see get_time_ns)
+                msgs[num_msgs].msg_hdr.msg_control    = controls[num_msgs].bytes;
+                msgs[num_msgs].msg_hdr.msg_controllen = sizeof(controls[num_msgs].bytes);
+                cmsg = CMSG_FIRSTHDR(&msgs[num_msgs].msg_hdr);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type  = SCM_TXTIME;
+                cmsg->cmsg_len   = CMSG_LEN(sizeof(uint64_t));
+                *(uint64_t *) CMSG_DATA(cmsg) = departure_time;
+            }
+#endif
+        }
+
+        // packets[num_sent] cannot be sent
+        if (num_msgs == 0) break;
+
+        // Send the packets
+        if ((ret = sendmmsg(batch_sockfd, msgs, num_msgs, 0)) == -1) {
+            perror("socketpool_send_packets: Sending error in queue");
+            break;
+        }
+
+        socketpool_set_tx_keys(socketpool, packets[num_sent]->dst_ip->family, tx_keys ? tx_keys + num_sent : NULL, ret);
+        num_sent += ret;
+        if ((size_t) ret < num_msgs) break;
+    }
+
+    return num_sent;
+}
+
+size_t socketpool_send_packets(socketpool_t * socketpool, packet_t ** packets, size_t num_packets, socketpool_tx_key_t * tx_keys)
+{
+#ifdef USE_PACKET_TX_RING
+    size_t i, num_ring, num_sent = 0;
+
+    if (!socketpool->tx_ring) {
+        return socketpool_sendmmsg(socketpool, packets, num_packets, tx_keys);
+    }
+
+    while (num_sent < num_packets) {
+#  ifdef USE_TXTIME
+        // The ring ignores the departure times: such packets are sent
+        // through the raw sockets.
+        for (i = num_sent; i < num_packets && !(socketpool->has_txtime && packet_get_departure_time(packets[i]) > 0); i++);
+        num_ring = tx_ring_send_packets(socketpool->tx_ring, packets + num_sent, i - num_sent);
+#  else
+        num_ring = tx_ring_send_packets(socketpool->tx_ring, packets + num_sent, num_packets - num_sent);
+#  endif
+
+        // The packets sent through the ring are timestamped in userspace
+        for (i = 0; tx_keys && i < num_ring; i++) {
+            tx_keys[num_sent + i].family = AF_UNSPEC;
+        }
+
+        num_sent += num_ring;
+        if (num_sent == num_packets) break;
+
+        // The ring cannot handle packets[num_sent], use the raw socket.
+        // This also triggers the neighbour discovery if needed.
+        if (socketpool_sendmmsg(socketpool, packets + num_sent, 1, tx_keys ? tx_keys + num_sent : NULL) == 0) break;
+        num_sent++;
+    }
+
+    return num_sent;
+#else
+    return socketpool_sendmmsg(socketpool, packets, num_packets, tx_keys);
+#endif
+}
+
+#ifdef USE_TXTIME
+inline bool socketpool_has_txtime(const socketpool_t * socketpool) {
+    return socketpool->has_txtime;
+}
+#endif
+
+#ifdef USE_TIMESTAMPING
+/**
+ * \brief Fetch the transmit timestamps queued in the error queue of a
+ *    raw socket.
+ * \param sockfd The raw socket.
+ * \param family The family of the raw socket.
+ * \param timestamps An array in which the timestamps are written.
+ * \param max_timestamps The number of cells of timestamps.
+ * \return The number of timestamps written in timestamps.
+ */
+
+static size_t fetch_tx_timestamps(int sockfd, int family, socketpool_tx_timestamp_t * timestamps, size_t max_timestamps)
+{
+    uint8_t                    control[256];
+    struct msghdr              msg;
+    struct cmsghdr           * cmsg;
+    struct scm_timestamping  * tss;
+    struct sock_extended_err * serr;
+    size_t                     num_timestamps = 0;
+    int64_t                    offset = 0;
+
+    while (num_timestamps < max_timestamps) {
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        // EAGAIN: the error queue is empty
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) break;
+
+        tss  = NULL;
+        serr = NULL;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                tss = (struct scm_timestamping *) CMSG_DATA(cmsg);
+            } else if ((cmsg->cmsg_level == IPPROTO_IP   && cmsg->cmsg_type == IP_RECVERR)
+                   ||  (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            }
+        }
+
+        // Only keep software timestamps, since hardware timestamps are
+        // not expressed in CLOCK_REALTIME.
+        if (!tss || !serr
+        ||  serr->ee_errno != ENOMSG || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING
+        ||  (tss->ts[0].tv_sec == 0 && tss->ts[0].tv_nsec == 0)) {
+            continue;
+        }
+
+        // The clocks are read once for the whole batch
+        if (num_timestamps == 0) offset = get_realtime_offset_ns();
+
+        timestamps[num_timestamps].tx_key.family = family;
+        timestamps[num_timestamps].tx_key.key    = serr->ee_data;
+        timestamps[num_timestamps].timestamp     = realtime_to_time_ns(&tss->ts[0], offset);
+        timestamps[num_timestamps].is_final      = serr->ee_info == SCM_TSTAMP_SND;
+        num_timestamps++;
+    }
+
+    return num_timestamps;
+}
+#endif
+
+size_t socketpool_fetch_tx_timestamps(socketpool_t * socketpool, socketpool_tx_timestamp_t * timestamps, size_t max_timestamps)
+{
+    size_t num_timestamps = 0;
+
+#ifdef USE_TIMESTAMPING
+#  ifdef USE_IPV4
+    if (socketpool->ipv4_is_timestamped) {
+        num_timestamps += fetch_tx_timestamps(socketpool->ipv4_sockfd, AF_INET, timestamps, max_timestamps);
+    }
+#  endif
+#  ifdef USE_IPV6
+    if (socketpool->ipv6_is_timestamped) {
+        num_timestamps += fetch_tx_timestamps(socketpool->ipv6_sockfd, AF_INET6, timestamps + num_timestamps, max_timestamps - num_timestamps);
+    }
+#  endif
+#endif
+
+    return num_timestamps;
+}
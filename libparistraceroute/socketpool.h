@@ -1,10 +1,41 @@
 #include "use.h"
 
 #ifndef SOCKETPOOL_H
-#define SOCKETPOOl_H
+#define SOCKETPOOL_H
 
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
 #include "packet.h"
 
+#ifdef USE_PACKET_TX_RING
+#    include "tx_ring.h"
+#endif
+
+// Maximum number of packets passed to the kernel in a single sendmmsg call.
+#define SOCKETPOOL_BATCH_SIZE 64
+
+/**
+ * \struct socketpool_tx_key_t
+ * \brief Identifies the transmit timestamps related to a sent packet
+ *    (see SOF_TIMESTAMPING_OPT_ID).
+ */
+
+typedef struct {
+    int      family; /**< Family of the socket (AF_INET, AF_INET6), AF_UNSPEC if the packet is not timestamped */
+    uint32_t key;    /**< Index of the packet among those sent through this socket */
+} socketpool_tx_key_t;
+
+/**
+ * \struct socketpool_tx_timestamp_t
+ * \brief A transmit timestamp reported by the kernel.
+ */
+
+typedef struct {
+    socketpool_tx_key_t tx_key;    /**< The timestamped packet */
+    uint64_t            timestamp; /**< When the packet has been sent (in nanoseconds, see get_time_ns) */
+    bool                is_final;  /**< false if the packet was still queued in the kernel (qdisc), true if it has been passed to the driver */
+} socketpool_tx_timestamp_t;
+
 typedef struct {
 #ifdef USE_IPV4
     int ipv4_sockfd; /**< File descriptor of the IPv4 raw socket */
@@ -12,6 +43,22 @@ typedef struct {
 #ifdef USE_IPV6
     int ipv6_sockfd; /**< File descriptor of the IPv6 raw socket */
 #endif
+#ifdef USE_TIMESTAMPING
+#  ifdef USE_IPV4
+    bool     ipv4_is_timestamped; /**< true iif the kernel timestamps the packets sent through ipv4_sockfd */
+    uint32_t ipv4_tx_key;         /**< Key of the next packet sent through ipv4_sockfd */
+#  endif
+#  ifdef USE_IPV6
+    bool     ipv6_is_timestamped; /**< true iif the kernel timestamps the packets sent through ipv6_sockfd */
+    uint32_t ipv6_tx_key;         /**< Key of the next packet sent through ipv6_sockfd */
+#  endif
+#endif
+#ifdef USE_PACKET_TX_RING
+    tx_ring_t * tx_ring; /**< Transmit ring, NULL if not available */
+#endif
+#ifdef USE_TXTIME
+    bool has_txtime;     /**< true iif the raw sockets honor the departure time of the packets (SO_TXTIME) */
+#endif
 } socketpool_t;
 
 /**
@@ -37,6 +84,49 @@ void socketpool_free(socketpool_t * socketpool);
  * \return true iif successful
  */
 
-bool socketpool_send_packet(const socketpool_t * socketpool, const packet_t * packet);
+bool socketpool_send_packet(socketpool_t * socketpool, const packet_t * packet);
+
+/**
+ * \brief Sends several packets on the network using the sockets of the pool.
+ *    Consecutive packets related to the same socket are passed to the kernel
+ *    using a single system call (see sendmmsg). If USE_PACKET_TX_RING is
+ *    set, the packets are sent through the transmit ring whenever possible.
+ * \param socketpool The socketpool to use
+ * \param packets An array of packets to send
+ * \param num_packets The number of packets stored in packets
+ * \param tx_keys An array of num_packets cells, or NULL. If not NULL,
+ *    tx_keys[i] is set to the key identifying the transmit timestamp of
+ *    packets[i] (see socketpool_fetch_tx_timestamps).
+ *    If USE_TXTIME is set, the packets having a departure time are held by
+ *    the kernel until this time (see socketpool_has_txtime).
+ * \return The number of packets sent. If this value is lower than
+ *    num_packets, packets[return value] could not be sent, and the
+ *    next packets have not been processed.
+ */
+
+size_t socketpool_send_packets(socketpool_t * socketpool, packet_t ** packets, size_t num_packets, socketpool_tx_key_t * tx_keys);
+
+#ifdef USE_TXTIME
+/**
+ * \brief Test whether the kernel honors the departure time of the
+ *    packets sent through a socketpool (see packet_set_departure_time).
+ * \param socketpool The socketpool to use
+ * \return true iif the departure times are honored.
+ */
+
+bool socketpool_has_txtime(const socketpool_t * socketpool);
+#endif
+
+/**
+ * \brief Fetch the transmit timestamps reported by the kernel for the
+ *    packets previously sent through the raw sockets. This function
+ *    does not block.
+ * \param socketpool The socketpool to use
+ * \param timestamps An array in which the timestamps are written.
+ * \param max_timestamps The number of cells of timestamps.
+ * \return The number of timestamps written in timestamps.
+ */
+
+size_t socketpool_fetch_tx_timestamps(socketpool_t * socketpool, socketpool_tx_timestamp_t * timestamps, size_t max_timestamps);
 
 #endif
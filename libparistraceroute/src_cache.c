@@ -0,0 +1,305 @@
+#include "use.h"
+#include "config.h"
+
+#include <errno.h>                // errno, ENOBUFS
+#include <stdint.h>               // uint32_t, uint64_t
+#include <string.h>               // memcpy, memcmp, memset
+#include <unistd.h>               // close
+#include <pthread.h>              // pthread_mutex_*
+#include <sys/socket.h>           // socket, connect, getsockname, recv
+#include <netinet/in.h>           // sockaddr_in, sockaddr_in6
+#ifdef __linux__
+#    include <linux/netlink.h>    // sockaddr_nl, NETLINK_ROUTE
+#    include <linux/rtnetlink.h>  // RTMGRP_*
+#else
+#    include <net/route.h>        // PF_ROUTE
+#endif
+
+#include "src_cache.h"
+#include "common.h"               // get_time_ns, SECONDS_TO_NS
+
+/**
+ * \struct src_cache_entry_t
+ * \brief A destination and the source address used to reach it.
+ */
+
+typedef struct {
+    ip_t dst_ip;   /**< The destination */
+    ip_t src_ip;   /**< Its source address */
+    bool is_set;   /**< true iif this entry is in use */
+} src_cache_entry_t;
+
+/**
+ * \struct src_cache_family_t
+ * \brief The cache of an address family.
+ */
+
+typedef struct {
+    src_cache_entry_t entries[SRC_CACHE_NUM_ENTRIES]; /**< Indexed by destination */
+    ip_t              source;                         /**< The fixed source address */
+    bool              is_fixed;                       /**< true iif the source address is fixed */
+} src_cache_family_t;
+
+#ifdef USE_IPV4
+static src_cache_family_t src_cache_ipv4;
+#endif
+#ifdef USE_IPV6
+static src_cache_family_t src_cache_ipv6;
+#endif
+
+// Netlink (routing on BSD) socket notifying the changes of the routes and
+// of the addresses. -2 if not opened yet, -1 if not available.
+static int      src_cache_netlink_fd = -2;
+
+// Time (see get_time_ns) of the last check of the notifications.
+static uint64_t src_cache_last_check = 0;
+
+static pthread_mutex_t src_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void __src_cache_free() __attribute__((destructor));
+
+static void __src_cache_free() {
+    if (src_cache_netlink_fd >= 0) close(src_cache_netlink_fd);
+}
+
+static src_cache_family_t * src_cache_get_family(int family) {
+    switch (family) {
+#ifdef USE_IPV4
+        case AF_INET:  return &src_cache_ipv4;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6: return &src_cache_ipv6;
+#endif
+        default:       return NULL;
+    }
+}
+
+static size_t src_cache_get_ip_size(int family) {
+    return family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+}
+
+static size_t src_cache_get_index(const void * dst_ip, size_t ip_size)
+{
+    const uint8_t * bytes = dst_ip;
+    uint32_t        word, hash = 0;
+    size_t          i;
+
+    for (i = 0; i < ip_size; i += sizeof(uint32_t)) {
+        memcpy(&word, bytes + i, sizeof(uint32_t));
+        hash ^= word;
+    }
+    return ((uint64_t) hash * 0x9e3779b97f4a7c15ULL >> 32) & (SRC_CACHE_NUM_ENTRIES - 1);
+}
+
+/**
+ * \brief Open a netlink socket notifying the changes of the routes and of
+ *    the addresses. On BSD, a routing socket notifies them without any
+ *    subscription.
+ * \return The socket, -1 in case of failure.
+ */
+
+static int src_cache_open_netlink()
+{
+#ifdef __linux__
+    struct sockaddr_nl addr;
+#endif
+    int                sockfd;
+
+#ifdef __linux__
+    if ((sockfd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE)) == -1) {
+        goto ERR_SOCKET;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_nl));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK
+        | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE
+        | RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE;
+
+    if (bind(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_nl)) == -1) {
+        goto ERR_BIND;
+    }
+#else
+    if ((sockfd = socket(PF_ROUTE, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, AF_UNSPEC)) == -1) {
+        goto ERR_SOCKET;
+    }
+#endif
+
+    return sockfd;
+
+#ifdef __linux__
+ERR_BIND:
+    close(sockfd);
+#endif
+ERR_SOCKET:
+    return -1;
+}
+
+/**
+ * \brief Forget the cached source addresses. The caller must hold
+ *    src_cache_mutex.
+ */
+
+static void src_cache_clear()
+{
+#ifdef USE_IPV4
+    memset(src_cache_ipv4.entries, 0, sizeof(src_cache_ipv4.entries));
+#endif
+#ifdef USE_IPV6
+    memset(src_cache_ipv6.entries, 0, sizeof(src_cache_ipv6.entries));
+#endif
+}
+
+/**
+ * \brief Flush the cache if the routes or the addresses may have changed.
+ *    The caller must hold src_cache_mutex.
+ */
+
+static void src_cache_check_routes()
+{
+    char     buffer[4096];
+    ssize_t  num_bytes;
+    bool     is_changed = false;
+    uint64_t now = get_time_ns();
+
+    if (src_cache_last_check && now - src_cache_last_check < SECONDS_TO_NS(SRC_CACHE_CHECK_INTERVAL)) {
+        return;
+    }
+    src_cache_last_check = now;
+
+    if (src_cache_netlink_fd == -2) {
+        src_cache_netlink_fd = src_cache_open_netlink();
+    }
+
+    if (src_cache_netlink_fd == -1) {
+        // No notification: the entries expire
+        is_changed = true;
+    } else {
+        // Any notification (or a lost one) flushes the cache
+        while ((num_bytes = recv(src_cache_netlink_fd, buffer, sizeof(buffer), 0)) > 0
+        || (num_bytes == -1 && errno == ENOBUFS)) {
+            is_changed = true;
+        }
+    }
+
+    if (is_changed) src_cache_clear();
+}
+
+/**
+ * \brief Ask the kernel which source address it would use to reach a
+ *    destination.
+ * \param family The address family (AF_INET or AF_INET6).
+ * \param dst_ip The destination.
+ * \param src_ip The ip_t in which the source address is written.
+ * \return true iif successful
+ */
+
+static bool src_cache_lookup(int family, const void * dst_ip, ip_t * src_ip)
+{
+    struct sockaddr_storage addr, name;
+    int                     sockfd;
+    socklen_t               addrlen;
+
+    memset(&addr, 0, sizeof(struct sockaddr_storage));
+    addr.ss_family = family;
+    switch (family) {
+        case AF_INET:
+            addrlen = sizeof(struct sockaddr_in);
+            memcpy(&((struct sockaddr_in *) &addr)->sin_addr, dst_ip, sizeof(struct in_addr));
+            break;
+        case AF_INET6:
+            addrlen = sizeof(struct sockaddr_in6);
+            memcpy(&((struct sockaddr_in6 *) &addr)->sin6_addr, dst_ip, sizeof(struct in6_addr));
+            break;
+        default:
+            goto ERR_INVALID_FAMILY;
+    }
+
+    if ((sockfd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1) {
+        goto ERR_SOCKET;
+    }
+
+    if (connect(sockfd, (struct sockaddr *) &addr, addrlen) == -1) {
+        goto ERR_CONNECT;
+    }
+
+    if (getsockname(sockfd, (struct sockaddr *) &name, &addrlen) == -1) {
+        goto ERR_GETSOCKNAME;
+    }
+
+    close(sockfd);
+    if (family == AF_INET) {
+        memcpy(src_ip, &((struct sockaddr_in *) &name)->sin_addr, sizeof(struct in_addr));
+    } else {
+        memcpy(src_ip, &((struct sockaddr_in6 *) &name)->sin6_addr, sizeof(struct in6_addr));
+    }
+    return true;
+
+ERR_GETSOCKNAME:
+ERR_CONNECT:
+    close(sockfd);
+ERR_SOCKET:
+ERR_INVALID_FAMILY:
+    return false;
+}
+
+bool src_cache_get(int family, const void * dst_ip, void * src_ip)
+{
+    src_cache_family_t * cache;
+    src_cache_entry_t  * entry;
+    size_t               ip_size = src_cache_get_ip_size(family);
+    ip_t                 source;
+    bool                 ret = true;
+
+    if (!(cache = src_cache_get_family(family))) return false;
+
+    pthread_mutex_lock(&src_cache_mutex);
+    if (cache->is_fixed) {
+        memcpy(src_ip, &cache->source, ip_size);
+    } else {
+        src_cache_check_routes();
+        entry = &cache->entries[src_cache_get_index(dst_ip, ip_size)];
+        if (entry->is_set && memcmp(&entry->dst_ip, dst_ip, ip_size) == 0) {
+            memcpy(src_ip, &entry->src_ip, ip_size);
+        } else if ((ret = src_cache_lookup(family, dst_ip, &source))) {
+            memcpy(&entry->dst_ip, dst_ip, ip_size);
+            memcpy(&entry->src_ip, &source, ip_size);
+            entry->is_set = true;
+            memcpy(src_ip, &source, ip_size);
+        }
+    }
+    pthread_mutex_unlock(&src_cache_mutex);
+    return ret;
+}
+
+bool src_cache_set_source(const address_t * source)
+{
+    src_cache_family_t * cache;
+
+    if (!source) {
+        pthread_mutex_lock(&src_cache_mutex);
+#ifdef USE_IPV4
+        src_cache_ipv4.is_fixed = false;
+#endif
+#ifdef USE_IPV6
+        src_cache_ipv6.is_fixed = false;
+#endif
+        pthread_mutex_unlock(&src_cache_mutex);
+        return true;
+    }
+
+    if (!(cache = src_cache_get_family(source->family))) return false;
+
+    pthread_mutex_lock(&src_cache_mutex);
+    cache->source   = source->ip;
+    cache->is_fixed = true;
+    pthread_mutex_unlock(&src_cache_mutex);
+    return true;
+}
+
+void src_cache_flush()
+{
+    pthread_mutex_lock(&src_cache_mutex);
+    src_cache_clear();
+    pthread_mutex_unlock(&src_cache_mutex);
+}
@@ -0,0 +1,63 @@
+#ifndef SRC_CACHE_H
+#define SRC_CACHE_H
+
+/**
+ * \file src_cache.h
+ * \brief Cache of the source addresses of the probes.
+ *
+ * The source address of a probe is the one the kernel would pick to
+ * reach its destination. Retrieving it costs a socket, a connect (i.e.
+ * a route lookup), a getsockname and a close, so it is retrieved once
+ * per destination and cached in a direct-mapped table.
+ *
+ * The table is flushed as soon as the kernel notifies a change of the
+ * routes or of the addresses (through a netlink socket, or a routing
+ * socket on BSD, which is read
+ * at most every SRC_CACHE_CHECK_INTERVAL seconds). If these notifications
+ * are not available, the table is flushed every SRC_CACHE_CHECK_INTERVAL
+ * seconds instead.
+ *
+ * A source address may also be fixed (see src_cache_set_source), in which
+ * case the kernel is not queried at all for this address family.
+ *
+ * The cache is shared by the threads running a pt_loop_t.
+ */
+
+#include <stdbool.h>   // bool
+
+#include "address.h"   // address_t
+
+// Number of destinations cached per address family. Must be a power of 2.
+#define SRC_CACHE_NUM_ENTRIES 1024
+
+// Maximal delay (in seconds) before a change of the routes is taken into account.
+#define SRC_CACHE_CHECK_INTERVAL 1.0
+
+/**
+ * \brief Retrieve the source address used to reach a destination.
+ * \param family The address family (AF_INET or AF_INET6).
+ * \param dst_ip Address of the destination (a struct in_addr or a
+ *    struct in6_addr according to family).
+ * \param src_ip Address of the struct in_addr or struct in6_addr in
+ *    which the source address is written.
+ * \return true iif successful
+ */
+
+bool src_cache_get(int family, const void * dst_ip, void * src_ip);
+
+/**
+ * \brief Fix the source address of the probes of a given address family.
+ * \param source The source address, or NULL to go back to the address
+ *    picked by the kernel for each destination.
+ * \return true iif successful
+ */
+
+bool src_cache_set_source(const address_t * source);
+
+/**
+ * \brief Forget the cached source addresses (the fixed ones are kept).
+ */
+
+void src_cache_flush();
+
+#endif // SRC_CACHE_H
@@ -0,0 +1,77 @@
+#include "config.h"
+
+#include <string.h>     // memset, strcmp
+
+#include "stateless.h"
+#include "layer.h"      // layer_t
+
+// Nanoseconds per unit of the timestamps carried by the probes
+#define STATELESS_TIMESTAMP_NS 1000000
+
+uint16_t stateless_make_identification(uint8_t instance_id, uint8_t ttl) {
+    return ((uint16_t) instance_id << 8) | ttl;
+}
+
+uint16_t stateless_make_timestamp(uint64_t time) {
+    return (time / STATELESS_TIMESTAMP_NS) & 0xffff;
+}
+
+bool stateless_extract_instance_id(const probe_t * packet, size_t depth, uint8_t * pinstance_id)
+{
+    const layer_t * layer;
+    uint16_t        identification;
+
+    if (!(layer = probe_get_layer(packet, depth))
+    ||  !layer->protocol
+    ||  strcmp(layer->protocol->name, "ipv4") != 0
+    ||  !probe_extract_ext(packet, "identification", depth, &identification)
+    ||  (identification & 0xff) == 0) {
+        return false;
+    }
+
+    *pinstance_id = identification >> 8;
+    return true;
+}
+
+bool stateless_reply_decode(const probe_t * reply, stateless_reply_t * stateless_reply)
+{
+    uint16_t identification, timestamp, elapsed;
+
+    memset(stateless_reply, 0, sizeof(stateless_reply_t));
+
+    // The quoted probe must be an IPv4 packet, and at least its transport
+    // checksum must be quoted.
+    if (!stateless_extract_instance_id(reply, 2, &stateless_reply->instance_id)
+    ||  !probe_extract_ext(reply, "identification", 2, &identification)
+    ||  !probe_extract_ext(reply, "checksum", 3, &timestamp)
+    ||  !probe_extract_ext(reply, "dst_ip", 2, &stateless_reply->target)
+    ||  !probe_extract_ext(reply, "src_ip", 0, &stateless_reply->hop)) {
+        return false;
+    }
+
+    elapsed = stateless_make_timestamp(probe_get_recv_time(reply)) - timestamp;
+    stateless_reply->ttl = identification & 0xff;
+    stateless_reply->rtt = elapsed;
+    return true;
+}
+
+void stateless_reply_fdump(FILE * out, const stateless_reply_t * stateless_reply)
+{
+    address_fdump(out, &stateless_reply->target);
+    fprintf(out, " %u ", stateless_reply->ttl);
+    address_fdump(out, &stateless_reply->hop);
+    fprintf(out, " %.0lf ms\n", stateless_reply->rtt);
+}
+
+bool stateless_reply_output(output_t * output, const stateless_reply_t * stateless_reply)
+{
+    output_record_t record;
+
+    memset(&record, 0, sizeof(output_record_t));
+    record.type = OUTPUT_RECORD_REPLY;
+    record.dst  = &stateless_reply->target;
+    record.ttl  = stateless_reply->ttl;
+    record.from = &stateless_reply->hop;
+    record.rtt  = stateless_reply->rtt * 1000000;
+    return output_write_record(output, &record);
+}
@@ -0,0 +1,113 @@
+#include "use.h"
+
+#ifndef STATELESS_H
+#define STATELESS_H
+
+/**
+ * \file stateless.h
+ * \brief Stateless probing (Yarrp-style).
+ *
+ * A stateless probe carries everything needed to interpret its reply, so
+ * that the network layer does not keep it once it is sent (no flying
+ * probe, no timeout). Only IPv4 probes are supported, since the state is
+ * stored in the IP identification, which is quoted in the ICMP errors:
+ *
+ *  - IP identification: (instance ID << 8) | TTL. It is never null, since
+ *    the TTL of a probe is at least 1 (the kernel overwrites a null
+ *    identification);
+ *  - transport checksum: the sending time, in milliseconds, modulo 2^16.
+ *    It is enforced thanks to the 2 first bytes of the payload like the
+ *    tags of the regular probes (see network_tag_probe), so it is valid;
+ *  - destination IP: the target.
+ *
+ * The replies are ICMP errors (time exceeded, destination unreachable)
+ * quoting the probe. The RTT is then the difference between the receive
+ * time and the quoted sending time (modulo 2^16 ms, i.e. about 65s).
+ *
+ * The (target, TTL) pairs of a sweep are walked in a pseudo-random order
+ * (see permutation.h) to spread the load over the routers.
+ */
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+#include <stdint.h>   // uint*_t
+#include <stdio.h>    // FILE
+
+#include "address.h"  // address_t
+#include "output.h"   // output_t
+#include "probe.h"    // probe_t
+
+// Number of stateless instances that may share a network (see network_add_stateless_caller).
+#define STATELESS_MAX_INSTANCES 256
+
+/**
+ * \struct stateless_reply_t
+ * \brief The information decoded from a reply to a stateless probe.
+ */
+
+typedef struct {
+    address_t target;      /**< Destination of the probe */
+    address_t hop;         /**< Source of the reply */
+    uint8_t   ttl;         /**< TTL of the probe */
+    uint8_t   instance_id; /**< Instance which has sent the probe */
+    double    rtt;         /**< Round-trip time (in milliseconds) */
+} stateless_reply_t;
+
+/**
+ * \brief Compute the IP identification of a stateless probe.
+ * \param instance_id The instance sending this probe.
+ * \param ttl The TTL of the probe (at least 1).
+ * \return The corresponding identification (host-side endianness).
+ */
+
+uint16_t stateless_make_identification(uint8_t instance_id, uint8_t ttl);
+
+/**
+ * \brief Compute the timestamp carried by a stateless probe.
+ * \param time The sending time (in nanoseconds, see get_time_ns).
+ * \return The corresponding timestamp (host-side endianness).
+ */
+
+uint16_t stateless_make_timestamp(uint64_t time);
+
+/**
+ * \brief Retrieve the instance which has sent a stateless probe or which
+ *    is related to a reply.
+ * \param packet The probe or the reply.
+ * \param depth The depth of the IP layer carrying the identification
+ *    (0 for a probe, 2 for a reply).
+ * \param pinstance_id Address of an uint8_t in which the instance ID is written.
+ * \return true iif successful, false if the packet can't be related to
+ *    a stateless probe.
+ */
+
+bool stateless_extract_instance_id(const probe_t * packet, size_t depth, uint8_t * pinstance_id);
+
+/**
+ * \brief Decode a reply to a stateless probe.
+ * \param reply The reply (an IPv4 / ICMP / IPv4 / * packet).
+ * \param stateless_reply The stateless_reply_t instance to fill.
+ * \return true iif successful
+ */
+
+bool stateless_reply_decode(const probe_t * reply, stateless_reply_t * stateless_reply);
+
+/**
+ * \brief Print a stateless_reply_t instance.
+ * \param out The output stream.
+ * \param stateless_reply The stateless_reply_t instance.
+ */
+
+void stateless_reply_fdump(FILE * out, const stateless_reply_t * stateless_reply);
+
+/**
+ * \brief Write a stateless_reply_t instance as a record of a structured
+ *    output (see output.h).
+ * \param output The output_t instance.
+ * \param stateless_reply The stateless_reply_t instance.
+ * \return true iif successful.
+ */
+
+bool stateless_reply_output(output_t * output, const stateless_reply_t * stateless_reply);
+
+#endif // STATELESS_H
@@ -0,0 +1,193 @@
+#include "config.h"
+
+#include <stdlib.h>       // malloc, calloc, free
+#include <string.h>       // memset, memcpy, memcmp
+#include <sys/socket.h>   // AF_INET, AF_INET6, AF_UNSPEC
+
+#include "stopset.h"
+
+/**
+ * \brief Copy the significant bytes of an address in a zeroed address_t,
+ *    so that two equal addresses have the same bytes.
+ * \param dst The address_t instance to update.
+ * \param src The copied address.
+ * \param prefix_len Number of bits copied.
+ */
+
+static void stopset_copy_prefix(address_t * dst, const address_t * src, size_t prefix_len) {
+    uint8_t * bytes = (uint8_t *) &dst->ip;
+    size_t    size = address_get_size(src);
+
+    memset(dst, 0, sizeof(address_t));
+    dst->family = src->family;
+    if (prefix_len > 8 * size) prefix_len = 8 * size;
+    memcpy(bytes, &src->ip, (prefix_len + 7) / 8);
+    if (prefix_len % 8) {
+        bytes[prefix_len / 8] &= (uint8_t) (0xff << (8 - prefix_len % 8));
+    }
+}
+
+/**
+ * \brief Initialize the key of a stopset_entry_t.
+ * \param stopset A stopset_t instance.
+ * \param entry The entry to initialize.
+ * \param interface The discovered interface.
+ * \param dst The destination of the trace, NULL for an entry of the
+ *    local stop set.
+ */
+
+static void stopset_make_key(
+    const stopset_t * stopset,
+    stopset_entry_t * entry,
+    const address_t * interface,
+    const address_t * dst
+) {
+    stopset_copy_prefix(&entry->interface, interface, 8 * sizeof(ip_t));
+    if (dst) {
+        stopset_copy_prefix(
+            &entry->prefix, dst,
+            dst->family == AF_INET6 ? stopset->ipv6_prefix_len : stopset->ipv4_prefix_len
+        );
+    } else {
+        memset(&entry->prefix, 0, sizeof(address_t));
+        entry->prefix.family = AF_UNSPEC;
+    }
+}
+
+/**
+ * \brief Hash the key of a stopset_entry_t (FNV-1a).
+ * \param entry A stopset_entry_t instance initialized by stopset_make_key.
+ * \return The corresponding hash.
+ */
+
+static size_t stopset_hash(const stopset_entry_t * entry) {
+    const uint8_t * bytes = (const uint8_t *) entry;
+    size_t          i, hash = 2166136261u;
+
+    for (i = 0; i < 2 * sizeof(address_t); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * \brief Find the slot storing a key, or the free slot where it must be
+ *    stored.
+ * \param entries The hash table.
+ * \param max_entries The number of slots (power of 2).
+ * \param key A stopset_entry_t instance initialized by stopset_make_key.
+ * \return The address of the corresponding slot.
+ */
+
+static stopset_entry_t * stopset_lookup(stopset_entry_t * entries, size_t max_entries, const stopset_entry_t * key) {
+    size_t i = stopset_hash(key) & (max_entries - 1);
+
+    while (entries[i].owner
+       &&  memcmp(&entries[i], key, 2 * sizeof(address_t)) != 0
+    ) {
+        i = (i + 1) & (max_entries - 1);
+    }
+    return &entries[i];
+}
+
+/**
+ * \brief Double the size of the hash table of a stopset_t.
+ * \param stopset A stopset_t instance.
+ * \return true iif successful
+ */
+
+static bool stopset_grow(stopset_t * stopset) {
+    stopset_entry_t * entries;
+    size_t            i, max_entries = 2 * stopset->max_entries;
+
+    if (!(entries = calloc(max_entries, sizeof(stopset_entry_t)))) return false;
+    for (i = 0; i < stopset->max_entries; i++) {
+        if (stopset->entries[i].owner) {
+            *stopset_lookup(entries, max_entries, &stopset->entries[i]) = stopset->entries[i];
+        }
+    }
+    free(stopset->entries);
+    stopset->entries = entries;
+    stopset->max_entries = max_entries;
+    return true;
+}
+
+/**
+ * \brief Add an entry to a stopset_t unless it is already stored.
+ * \param stopset A stopset_t instance.
+ * \param key A stopset_entry_t instance initialized by stopset_make_key.
+ * \param owner The instance adding this entry.
+ * \return true iif successful
+ */
+
+static bool stopset_add_entry(stopset_t * stopset, stopset_entry_t * key, const void * owner) {
+    stopset_entry_t * entry;
+
+    // Keep the load factor under 1/2
+    if (2 * (stopset->num_entries + 1) > stopset->max_entries && !stopset_grow(stopset)) {
+        return false;
+    }
+
+    entry = stopset_lookup(stopset->entries, stopset->max_entries, key);
+    if (!entry->owner) {
+        key->owner = owner;
+        *entry = *key;
+        stopset->num_entries++;
+    }
+    return true;
+}
+
+stopset_t * stopset_create(uint8_t ipv4_prefix_len, uint8_t ipv6_prefix_len) {
+    stopset_t * stopset;
+
+    if (!(stopset = malloc(sizeof(stopset_t)))) goto ERR_MALLOC;
+    if (!(stopset->entries = calloc(STOPSET_INITIAL_SIZE, sizeof(stopset_entry_t)))) goto ERR_ENTRIES;
+    stopset->num_entries     = 0;
+    stopset->max_entries     = STOPSET_INITIAL_SIZE;
+    stopset->ipv4_prefix_len = ipv4_prefix_len;
+    stopset->ipv6_prefix_len = ipv6_prefix_len;
+    return stopset;
+
+ERR_ENTRIES:
+    free(stopset);
+ERR_MALLOC:
+    return NULL;
+}
+
+void stopset_free(stopset_t * stopset) {
+    if (stopset) {
+        free(stopset->entries);
+        free(stopset);
+    }
+}
+
+inline size_t stopset_get_size(const stopset_t * stopset) {
+    return stopset->num_entries;
+}
+
+bool stopset_add(stopset_t * stopset, const address_t * interface, const address_t * dst, const void * owner) {
+    stopset_entry_t key;
+
+    stopset_make_key(stopset, &key, interface, NULL);
+    if (!stopset_add_entry(stopset, &key, owner)) return false;
+    stopset_make_key(stopset, &key, interface, dst);
+    return stopset_add_entry(stopset, &key, owner);
+}
+
+bool stopset_has_pair(const stopset_t * stopset, const address_t * interface, const address_t * dst, const void * owner) {
+    stopset_entry_t   key;
+    stopset_entry_t * entry;
+
+    stopset_make_key(stopset, &key, interface, dst);
+    entry = stopset_lookup(stopset->entries, stopset->max_entries, &key);
+    return entry->owner && entry->owner != owner;
+}
+
+bool stopset_has_interface(const stopset_t * stopset, const address_t * interface, const void * owner) {
+    stopset_entry_t   key;
+    stopset_entry_t * entry;
+
+    stopset_make_key(stopset, &key, interface, NULL);
+    entry = stopset_lookup(stopset->entries, stopset->max_entries, &key);
+    return entry->owner && entry->owner != owner;
+}
@@ -0,0 +1,128 @@
+#ifndef STOPSET_H
+#define STOPSET_H
+
+/**
+ * \file stopset.h
+ * \brief Doubletree stop set shared by several traceroute instances.
+ *
+ * A stopset_t stores the interfaces discovered by the traceroute
+ * instances of a vantage point:
+ * - the global stop set is made of (interface, destination prefix) pairs:
+ *   a trace probing forward may stop once it discovers an interface
+ *   already discovered toward the same destination prefix, since the
+ *   rest of the path is already known;
+ * - the local stop set is made of interfaces: a trace probing backward
+ *   (toward the vantage point) may stop once it discovers an interface
+ *   already discovered by any trace.
+ *
+ * Each entry records the instance which has added it (its owner), so
+ * that an instance does not stop on the interfaces it has discovered
+ * itself. Both sets are stored in a single open addressing hash table,
+ * so that a lookup is O(1) and does not allocate.
+ *
+ * A stopset_t is not thread-safe: it may be shared by the instances run
+ * by a same pt_loop_t.
+ */
+
+#include <stdbool.h>   // bool
+#include <stddef.h>    // size_t
+#include <stdint.h>    // uint8_t
+
+#include "address.h"   // address_t
+
+// Initial number of slots allocated by a stopset_t. Must be a power of 2.
+#define STOPSET_INITIAL_SIZE     1024
+
+// Default length of the destination prefixes (in bits).
+#define STOPSET_IPV4_PREFIX_LEN  24
+#define STOPSET_IPV6_PREFIX_LEN  48
+
+/**
+ * \struct stopset_entry_t
+ * \brief An interface of the local stop set, or an (interface,
+ *     destination prefix) pair of the global stop set.
+ */
+
+typedef struct {
+    address_t    interface; /**< The discovered interface */
+    address_t    prefix;    /**< The destination prefix (family AF_UNSPEC for the local stop set) */
+    const void * owner;     /**< The instance which has added this entry, NULL if the slot is free */
+} stopset_entry_t;
+
+/**
+ * \struct stopset_t
+ * \brief A Doubletree stop set.
+ */
+
+typedef struct {
+    stopset_entry_t * entries;         /**< Hash table (linear probing) */
+    size_t            num_entries;     /**< Number of used slots */
+    size_t            max_entries;     /**< Number of slots (power of 2) */
+    uint8_t           ipv4_prefix_len; /**< Length of the IPv4 destination prefixes (in bits) */
+    uint8_t           ipv6_prefix_len; /**< Length of the IPv6 destination prefixes (in bits) */
+} stopset_t;
+
+/**
+ * \brief Create a stopset_t instance.
+ * \param ipv4_prefix_len Length of the IPv4 destination prefixes (in bits,
+ *    32 to store the destinations themselves).
+ * \param ipv6_prefix_len Length of the IPv6 destination prefixes (in bits,
+ *    128 to store the destinations themselves).
+ * \return The newly created stopset_t instance, NULL in case of failure.
+ */
+
+stopset_t * stopset_create(uint8_t ipv4_prefix_len, uint8_t ipv6_prefix_len);
+
+/**
+ * \brief Release a stopset_t instance from the memory.
+ * \param stopset A stopset_t instance.
+ */
+
+void stopset_free(stopset_t * stopset);
+
+/**
+ * \brief Retrieve the number of entries stored in a stopset_t (local and
+ *    global stop sets).
+ * \param stopset A stopset_t instance.
+ * \return The number of entries.
+ */
+
+size_t stopset_get_size(const stopset_t * stopset);
+
+/**
+ * \brief Add an interface to the local stop set, and the (interface,
+ *    destination prefix) pair to the global stop set. The entries already
+ *    stored keep their owner.
+ * \param stopset A stopset_t instance.
+ * \param interface The discovered interface.
+ * \param dst The destination of the trace which has discovered it.
+ * \param owner The instance which has discovered it (must not be NULL).
+ * \return true iif successful
+ */
+
+bool stopset_add(stopset_t * stopset, const address_t * interface, const address_t * dst, const void * owner);
+
+/**
+ * \brief Test whether an (interface, destination prefix) pair has been
+ *    added to the global stop set by another instance.
+ * \param stopset A stopset_t instance.
+ * \param interface The discovered interface.
+ * \param dst The destination of the trace which has discovered it.
+ * \param owner The instance looking up the stop set.
+ * \return true iif the forward probing of this instance may stop.
+ */
+
+bool stopset_has_pair(const stopset_t * stopset, const address_t * interface, const address_t * dst, const void * owner);
+
+/**
+ * \brief Test whether an interface has been added to the local stop set
+ *    by another instance.
+ * \param stopset A stopset_t instance.
+ * \param interface The discovered interface.
+ * \param owner The instance looking up the stop set.
+ * \return true iif the backward probing of this instance may stop.
+ */
+
+bool stopset_has_interface(const stopset_t * stopset, const address_t * interface, const void * owner);
+
+#endif
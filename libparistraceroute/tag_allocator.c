@@ -0,0 +1,167 @@
+#include "config.h"
+
+#include <stdlib.h>        // calloc, free
+
+#include "tag_allocator.h"
+
+#define WORD_BITS 64
+#define WORD_FULL (~(uint64_t) 0)
+
+// Number of words needed to store num_bits bits
+#define NUM_WORDS(num_bits) (((num_bits) + WORD_BITS - 1) / WORD_BITS)
+
+tag_allocator_t * tag_allocator_create(size_t num_bits)
+{
+    tag_allocator_t * tag_allocator;
+    uint64_t          num_tags;
+
+    if (num_bits == 0 || num_bits > TAG_ALLOCATOR_MAX_BITS) goto ERR_INVALID_NUM_BITS;
+    num_tags = (uint64_t) 1 << num_bits;
+
+    if (!(tag_allocator = calloc(1, sizeof(tag_allocator_t))))                               goto ERR_CALLOC;
+    tag_allocator->num_bits  = num_bits;
+    tag_allocator->num_words = NUM_WORDS(num_tags);
+    if (!(tag_allocator->words      = calloc(tag_allocator->num_words, sizeof(uint64_t))))            goto ERR_WORDS;
+    if (!(tag_allocator->full_words = calloc(NUM_WORDS(tag_allocator->num_words), sizeof(uint64_t)))) goto ERR_FULL_WORDS;
+
+    // The tags beyond the tag space (if num_tags < WORD_BITS) and tag 0 are never allocated
+    if (num_tags < WORD_BITS) tag_allocator->words[0] = WORD_FULL << num_tags;
+    tag_allocator->words[0] |= 1;
+    tag_allocator->next_tag = 1;
+    tag_allocator->num_tags = 0;
+    return tag_allocator;
+
+ERR_FULL_WORDS:
+    free(tag_allocator->words);
+ERR_WORDS:
+    free(tag_allocator);
+ERR_CALLOC:
+ERR_INVALID_NUM_BITS:
+    return NULL;
+}
+
+void tag_allocator_free(tag_allocator_t * tag_allocator) {
+    if (tag_allocator) {
+        free(tag_allocator->full_words);
+        free(tag_allocator->words);
+        free(tag_allocator);
+    }
+}
+
+inline size_t tag_allocator_get_num_bits(const tag_allocator_t * tag_allocator) {
+    return tag_allocator->num_bits;
+}
+
+/**
+ * \brief Seek the first word of tag_allocator->words which is not full.
+ * \param tag_allocator A tag_allocator_t instance.
+ * \param from The index of the first word to consider.
+ * \param to The index of the first word not to consider.
+ * \param pw Address of a size_t in which the index of the word is written.
+ * \return true iif a word has been found.
+ */
+
+static bool tag_allocator_find_word(const tag_allocator_t * tag_allocator, size_t from, size_t to, size_t * pw)
+{
+    size_t   w, i;
+    uint64_t not_full;
+
+    for (w = from; w < to; w = (i + 1) * WORD_BITS) {
+        i = w / WORD_BITS;
+        not_full = ~tag_allocator->full_words[i] & (WORD_FULL << (w % WORD_BITS));
+        if (not_full) {
+            w = i * WORD_BITS + __builtin_ctzll(not_full);
+            if (w >= to) break;
+            *pw = w;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tag_allocator_get_tag(tag_allocator_t * tag_allocator, size_t num_bits, uint32_t * ptag)
+{
+    uint64_t num_tags = (uint64_t) 1 << num_bits,
+             valid    = num_tags < WORD_BITS ? ~(WORD_FULL << num_tags) : WORD_FULL,
+             free_bits;
+    size_t   num_words = NUM_WORDS(num_tags),
+             w;
+    uint32_t start = tag_allocator->next_tag < num_tags ? tag_allocator->next_tag : 1;
+
+    // Fast path: a tag is available in the current word, after next_tag
+    w = start / WORD_BITS;
+    free_bits = ~tag_allocator->words[w] & valid & (WORD_FULL << (start % WORD_BITS));
+
+    if (!free_bits) {
+        // Seek the next word having a free tag, and wrap if needed
+        if (!tag_allocator_find_word(tag_allocator, w + 1, num_words, &w)
+        &&  !tag_allocator_find_word(tag_allocator, 0, w + 1, &w)) {
+            return false;
+        }
+
+        if (!(free_bits = ~tag_allocator->words[w] & valid)) return false;
+    }
+
+    // Mark this tag as used
+    *ptag = w * WORD_BITS + __builtin_ctzll(free_bits);
+    tag_allocator->words[w] |= (uint64_t) 1 << (*ptag % WORD_BITS);
+    if (tag_allocator->words[w] == WORD_FULL) {
+        tag_allocator->full_words[w / WORD_BITS] |= (uint64_t) 1 << (w % WORD_BITS);
+    }
+
+    tag_allocator->next_tag = *ptag + 1;
+    tag_allocator->num_tags++;
+    return true;
+}
+
+void tag_allocator_release_tag(tag_allocator_t * tag_allocator, uint32_t tag)
+{
+    size_t w = tag / WORD_BITS;
+
+    if (tag != 0 && tag_allocator_is_used(tag_allocator, tag)) {
+        tag_allocator->words[w] &= ~((uint64_t) 1 << (tag % WORD_BITS));
+        tag_allocator->full_words[w / WORD_BITS] &= ~((uint64_t) 1 << (w % WORD_BITS));
+        tag_allocator->num_tags--;
+    }
+}
+
+bool tag_allocator_set_range(tag_allocator_t * tag_allocator, uint32_t first, uint32_t last)
+{
+    uint64_t begin, end, keep;
+    size_t   w;
+
+    if (tag_allocator->num_tags > 0
+    ||  first == 0 || first > last
+    ||  last >= (uint64_t) 1 << tag_allocator->num_bits) {
+        return false;
+    }
+
+    // Each word stores the tags [w * WORD_BITS, (w + 1) * WORD_BITS - 1]:
+    // only the bits of [first, last] are left free.
+    for (w = 0; w < tag_allocator->num_words; w++) {
+        begin = (uint64_t) w * WORD_BITS;
+        end   = begin + WORD_BITS - 1;
+        if (last < begin || first > end) {
+            keep = 0;
+        } else {
+            keep = (WORD_FULL << (first > begin ? first - begin : 0))
+                 & (WORD_FULL >> (last < end ? end - last : 0));
+        }
+        tag_allocator->words[w] |= ~keep;
+        if (tag_allocator->words[w] == WORD_FULL) {
+            tag_allocator->full_words[w / WORD_BITS] |= (uint64_t) 1 << (w % WORD_BITS);
+        }
+    }
+
+    tag_allocator->next_tag = first;
+    return true;
+}
+
+bool tag_allocator_is_used(const tag_allocator_t * tag_allocator, uint32_t tag)
+{
+    size_t w = tag / WORD_BITS;
+
+    if (w >= tag_allocator->num_words) return false;
+    return (tag_allocator->words[w] >> (tag % WORD_BITS)) & 1;
+}
@@ -0,0 +1,101 @@
+#ifndef TAG_ALLOCATOR_H
+#define TAG_ALLOCATOR_H
+
+/**
+ * \file tag_allocator.h
+ * \brief Allocator of probe tags (probe IDs).
+ *
+ * A tag_allocator_t tracks which tags of [1, 2^num_bits - 1] are in use
+ * thanks to a bitmap (bit set iif the tag is in use) and a summary bitmap
+ * (bit i set iif the i-th word of the bitmap is full). Tag 0 is never
+ * allocated.
+ *
+ * Tags are allocated in a round-robin fashion (the search starts right
+ * after the last allocated tag), so that a released tag is not reused
+ * before the other free tags, which limits the risk of matching a late
+ * reply with a new probe. Allocating and releasing a tag are O(1) (plus a
+ * scan of the summary bitmap, i.e. one word per 4096 tags, when the
+ * allocator is almost full).
+ */
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t, uint64_t
+
+// The tag space may not exceed 2^TAG_ALLOCATOR_MAX_BITS tags.
+#define TAG_ALLOCATOR_MAX_BITS 24
+
+typedef struct {
+    uint64_t * words;       /**< Bitmap of the tags in use */
+    uint64_t * full_words;  /**< Bitmap of the full words of tag_allocator_t::words */
+    size_t     num_bits;    /**< The tags are stored on num_bits bits */
+    size_t     num_words;   /**< Number of words of tag_allocator_t::words */
+    uint32_t   next_tag;    /**< Tag from which the next search starts */
+    size_t     num_tags;    /**< Number of allocated tags */
+} tag_allocator_t;
+
+/**
+ * \brief Create a tag_allocator_t instance.
+ * \param num_bits The size of the tags (in bits). It must be in
+ *    [1, TAG_ALLOCATOR_MAX_BITS].
+ * \return The newly allocated tag_allocator_t instance, NULL in case of failure.
+ */
+
+tag_allocator_t * tag_allocator_create(size_t num_bits);
+
+/**
+ * \brief Release a tag_allocator_t instance from the memory.
+ * \param tag_allocator A tag_allocator_t instance.
+ */
+
+void tag_allocator_free(tag_allocator_t * tag_allocator);
+
+/**
+ * \brief Retrieve the size of the tags handled by a tag_allocator_t instance.
+ * \param tag_allocator A tag_allocator_t instance.
+ * \return The size of the tags (in bits).
+ */
+
+size_t tag_allocator_get_num_bits(const tag_allocator_t * tag_allocator);
+
+/**
+ * \brief Allocate a tag not yet in use.
+ * \param tag_allocator A tag_allocator_t instance.
+ * \param num_bits The allocated tag must be stored on num_bits bits. This
+ *    value must not exceed tag_allocator_get_num_bits(tag_allocator).
+ * \param ptag Address of an uint32_t in which the allocated tag is written.
+ * \return true iif successful, false if every tag is in use.
+ */
+
+bool tag_allocator_get_tag(tag_allocator_t * tag_allocator, size_t num_bits, uint32_t * ptag);
+
+/**
+ * \brief Release a tag previously allocated by tag_allocator_get_tag.
+ * \param tag_allocator A tag_allocator_t instance.
+ * \param tag The released tag.
+ */
+
+void tag_allocator_release_tag(tag_allocator_t * tag_allocator, uint32_t tag);
+
+/**
+ * \brief Restrict the tags allocated by a tag_allocator_t instance to a
+ *    range, e.g. the tags routed to this process by a reply
+ *    demultiplexer (see demux.h). The other tags are marked as used.
+ * \param tag_allocator A tag_allocator_t instance. No tag may be in use.
+ * \param first The first tag of the range (at least 1).
+ * \param last The last tag of the range (less than 2^num_bits).
+ * \return true iif successful.
+ */
+
+bool tag_allocator_set_range(tag_allocator_t * tag_allocator, uint32_t first, uint32_t last);
+
+/**
+ * \brief Test whether a tag is in use.
+ * \param tag_allocator A tag_allocator_t instance.
+ * \param tag A tag.
+ * \return true iif this tag is in use.
+ */
+
+bool tag_allocator_is_used(const tag_allocator_t * tag_allocator, uint32_t tag);
+
+#endif
@@ -0,0 +1,215 @@
+#include "config.h"
+
+#include <stdlib.h>       // calloc, free
+#include <math.h>         // ceil
+
+#include "timing_wheel.h"
+
+timing_wheel_t * timing_wheel_create(double tick, double now)
+{
+    timing_wheel_t * wheel;
+
+    if (!(wheel = calloc(1, sizeof(timing_wheel_t)))) goto ERR_CALLOC;
+    wheel->tick = tick;
+    wheel->cur_tick = timing_wheel_get_tick(wheel, now);
+    wheel->num_timers = 0;
+    return wheel;
+
+ERR_CALLOC:
+    return NULL;
+}
+
+void timing_wheel_free(timing_wheel_t * wheel) {
+    if (wheel) free(wheel);
+}
+
+void wheel_timer_init(wheel_timer_t * timer, void * data) {
+    timer->next   = NULL;
+    timer->pprev  = NULL;
+    timer->expiry = 0;
+    timer->data   = data;
+}
+
+inline bool wheel_timer_is_pending(const wheel_timer_t * timer) {
+    return timer->pprev != NULL;
+}
+
+inline uint64_t timing_wheel_get_tick(const timing_wheel_t * wheel, double timestamp) {
+    return (uint64_t) (timestamp / wheel->tick);
+}
+
+inline double timing_wheel_get_tick_time(const timing_wheel_t * wheel, uint64_t tick) {
+    return tick * wheel->tick;
+}
+
+/**
+ * \brief Link a timer at the head of a slot.
+ * \param pslot Address of the head of the slot.
+ * \param timer The timer to link.
+ */
+
+static void slot_push(wheel_timer_t ** pslot, wheel_timer_t * timer)
+{
+    timer->next = *pslot;
+    if (timer->next) timer->next->pprev = &timer->next;
+    timer->pprev = pslot;
+    *pslot = timer;
+}
+
+/**
+ * \brief Unlink a timer from its slot.
+ * \param timer The timer to unlink. It must be pending.
+ */
+
+static void slot_unlink(wheel_timer_t * timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next  = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * \brief Store a timer in the slot corresponding to timer->expiry.
+ * \param wheel A timing_wheel_t instance.
+ * \param timer The timer to store.
+ */
+
+static void timing_wheel_insert(timing_wheel_t * wheel, wheel_timer_t * timer)
+{
+    uint64_t expiry = timer->expiry,
+             delta;
+    size_t   level;
+
+    // Already expired timers are processed at the next tick
+    if (expiry < wheel->cur_tick) expiry = wheel->cur_tick;
+    delta = expiry - wheel->cur_tick;
+
+    for (level = 0; level < TIMING_WHEEL_NUM_LEVELS - 1; level++) {
+        if ((delta >> (TIMING_WHEEL_SLOT_BITS * (level + 1))) == 0) break;
+    }
+
+    // Timers too far in the future are stored in the last slot of the
+    // last level. They are cascaded again until they can be processed.
+    if ((delta >> (TIMING_WHEEL_SLOT_BITS * (level + 1))) != 0) {
+        expiry = wheel->cur_tick + ((uint64_t) 1 << (TIMING_WHEEL_SLOT_BITS * TIMING_WHEEL_NUM_LEVELS)) - 1;
+    }
+
+    slot_push(
+        &wheel->slots[level][(expiry >> (TIMING_WHEEL_SLOT_BITS * level)) & TIMING_WHEEL_SLOT_MASK],
+        timer
+    );
+}
+
+void timing_wheel_add(timing_wheel_t * wheel, wheel_timer_t * timer, double expiry)
+{
+    timer->expiry = (uint64_t) ceil(expiry / wheel->tick);
+    timing_wheel_insert(wheel, timer);
+    wheel->num_timers++;
+}
+
+void timing_wheel_del(timing_wheel_t * wheel, wheel_timer_t * timer)
+{
+    if (wheel_timer_is_pending(timer)) {
+        slot_unlink(timer);
+        wheel->num_timers--;
+    }
+}
+
+/**
+ * \brief Move the timers of the upper levels which expire in the next
+ *    TIMING_WHEEL_NUM_SLOTS ticks to the lower levels. This function
+ *    is called whenever the slot index of level 0 wraps.
+ * \param wheel A timing_wheel_t instance.
+ */
+
+static void timing_wheel_cascade(timing_wheel_t * wheel)
+{
+    size_t          level, index;
+    wheel_timer_t * cascaded,
+                  * timer;
+
+    for (level = 1; level < TIMING_WHEEL_NUM_LEVELS; level++) {
+        index = (wheel->cur_tick >> (TIMING_WHEEL_SLOT_BITS * level)) & TIMING_WHEEL_SLOT_MASK;
+
+        // Detach the slot, since a timer may be stored again in this
+        // slot if it expires during the next revolution of this level.
+        cascaded = wheel->slots[level][index];
+        wheel->slots[level][index] = NULL;
+        if (cascaded) cascaded->pprev = &cascaded;
+
+        while ((timer = cascaded)) {
+            slot_unlink(timer);
+            timing_wheel_insert(wheel, timer);
+        }
+
+        // The upper level must only be cascaded if this level wraps too
+        if (index != 0) break;
+    }
+}
+
+size_t timing_wheel_advance(
+    timing_wheel_t * wheel,
+    double           now,
+    void          (* callback)(wheel_timer_t * timer, void * param),
+    void           * param
+) {
+    uint64_t        target = timing_wheel_get_tick(wheel, now);
+    size_t          num_expired = 0;
+    wheel_timer_t * expired,
+                  * timer;
+
+    while (wheel->cur_tick <= target) {
+        // Nothing to do, jump directly to the target
+        if (wheel->num_timers == 0) {
+            wheel->cur_tick = target + 1;
+            break;
+        }
+
+        if ((wheel->cur_tick & TIMING_WHEEL_SLOT_MASK) == 0) {
+            timing_wheel_cascade(wheel);
+        }
+
+        // Detach the slot, so that timers added by the callback
+        // are not processed during this tick.
+        expired = wheel->slots[0][wheel->cur_tick & TIMING_WHEEL_SLOT_MASK];
+        wheel->slots[0][wheel->cur_tick & TIMING_WHEEL_SLOT_MASK] = NULL;
+        if (expired) expired->pprev = &expired;
+
+        while ((timer = expired)) {
+            slot_unlink(timer);
+            wheel->num_timers--;
+            num_expired++;
+            callback(timer, param);
+        }
+
+        wheel->cur_tick++;
+    }
+
+    return num_expired;
+}
+
+bool timing_wheel_get_next_tick(const timing_wheel_t * wheel, uint64_t * ptick)
+{
+    uint64_t tick;
+
+    if (wheel->num_timers == 0) return false;
+
+    // The upper levels must be cascaded right now
+    if ((wheel->cur_tick & TIMING_WHEEL_SLOT_MASK) == 0) {
+        *ptick = wheel->cur_tick;
+        return true;
+    }
+
+    // Seek the first non-empty slot of level 0 before the next cascade
+    for (tick = wheel->cur_tick; (tick & TIMING_WHEEL_SLOT_MASK) != 0; tick++) {
+        if (wheel->slots[0][tick & TIMING_WHEEL_SLOT_MASK]) {
+            *ptick = tick;
+            return true;
+        }
+    }
+
+    // Otherwise, wake up at the next cascade
+    *ptick = tick;
+    return true;
+}
@@ -0,0 +1,152 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+/**
+ * \file timing_wheel.h
+ * \brief Hierarchical timing wheel.
+ *
+ * A timing_wheel_t manages a set of timers expiring at a given tick.
+ * The wheel is made of TIMING_WHEEL_NUM_LEVELS levels of
+ * TIMING_WHEEL_NUM_SLOTS slots. A slot of level 0 covers one tick, a slot
+ * of level l covers TIMING_WHEEL_NUM_SLOTS^l ticks. Timers stored in an
+ * upper level are cascaded to the lower levels as the wheel advances.
+ *
+ * Adding and removing a timer are O(1). Expiring the timers of a tick
+ * is O(1) per expired timer (plus the amortized cascades).
+ * Timers are intrusive: the wheel never allocates memory.
+ */
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+#define TIMING_WHEEL_SLOT_BITS  6
+#define TIMING_WHEEL_NUM_SLOTS  (1 << TIMING_WHEEL_SLOT_BITS)
+#define TIMING_WHEEL_SLOT_MASK  (TIMING_WHEEL_NUM_SLOTS - 1)
+#define TIMING_WHEEL_NUM_LEVELS 4
+
+/**
+ * \struct wheel_timer_t
+ * \brief A timer stored in a timing_wheel_t. It is typically nested in
+ *    the structure it refers to.
+ */
+
+typedef struct wheel_timer_s {
+    struct wheel_timer_s  * next;   /**< Next timer stored in the same slot */
+    struct wheel_timer_s ** pprev;  /**< Address of the pointer to this timer, NULL if the timer is not pending */
+    uint64_t                expiry; /**< Tick at which this timer expires */
+    void                  * data;   /**< Data attached to this timer */
+} wheel_timer_t;
+
+/**
+ * \struct timing_wheel_t
+ * \brief Structure describing a hierarchical timing wheel.
+ */
+
+typedef struct {
+    wheel_timer_t * slots[TIMING_WHEEL_NUM_LEVELS][TIMING_WHEEL_NUM_SLOTS]; /**< Pending timers */
+    double          tick;        /**< Duration of a tick (in seconds) */
+    uint64_t        cur_tick;    /**< Next tick to be processed */
+    size_t          num_timers;  /**< Number of pending timers */
+} timing_wheel_t;
+
+/**
+ * \brief Create a timing_wheel_t instance.
+ * \param tick The duration of a tick (in seconds).
+ * \param now The current timestamp (in seconds).
+ * \return The newly allocated timing_wheel_t instance, NULL in case of failure.
+ */
+
+timing_wheel_t * timing_wheel_create(double tick, double now);
+
+/**
+ * \brief Release a timing_wheel_t instance from the memory. The pending
+ *    timers are not released.
+ * \param wheel A timing_wheel_t instance.
+ */
+
+void timing_wheel_free(timing_wheel_t * wheel);
+
+/**
+ * \brief Initialize a wheel_timer_t instance.
+ * \param timer The timer to initialize.
+ * \param data The data attached to this timer.
+ */
+
+void wheel_timer_init(wheel_timer_t * timer, void * data);
+
+/**
+ * \brief Test whether a timer is stored in a timing wheel.
+ * \param timer A wheel_timer_t instance.
+ * \return true iif the timer is pending.
+ */
+
+bool wheel_timer_is_pending(const wheel_timer_t * timer);
+
+/**
+ * \brief Convert a timestamp into a tick of a timing wheel.
+ * \param wheel A timing_wheel_t instance.
+ * \param timestamp A timestamp (in seconds).
+ * \return The corresponding tick.
+ */
+
+uint64_t timing_wheel_get_tick(const timing_wheel_t * wheel, double timestamp);
+
+/**
+ * \brief Add a timer in a timing wheel. If it expires before the next
+ *    processed tick, it expires during the next call to timing_wheel_advance.
+ * \param wheel A timing_wheel_t instance.
+ * \param timer A timer which is not pending.
+ * \param expiry When the timer expires (timestamp in seconds).
+ */
+
+void timing_wheel_add(timing_wheel_t * wheel, wheel_timer_t * timer, double expiry);
+
+/**
+ * \brief Remove a pending timer from a timing wheel. Nothing happens
+ *    if the timer is not pending.
+ * \param wheel A timing_wheel_t instance.
+ * \param timer A wheel_timer_t instance.
+ */
+
+void timing_wheel_del(timing_wheel_t * wheel, wheel_timer_t * timer);
+
+/**
+ * \brief Process every tick up to a given timestamp. The timer passed to
+ *    the callback is no longer pending, so the callback may release it.
+ *    It may also add or remove other timers.
+ * \param wheel A timing_wheel_t instance.
+ * \param now The current timestamp (in seconds).
+ * \param callback Function called for each expired timer.
+ * \param param This pointer is passed whenever callback is called.
+ * \return The number of expired timers.
+ */
+
+size_t timing_wheel_advance(
+    timing_wheel_t * wheel,
+    double           now,
+    void          (* callback)(wheel_timer_t * timer, void * param),
+    void           * param
+);
+
+/**
+ * \brief Retrieve the next tick at which timing_wheel_advance should be
+ *    called. This is either a tick with expiring timers, or a tick at which
+ *    upper levels are cascaded.
+ * \param wheel A timing_wheel_t instance.
+ * \param ptick Address of an uint64_t in which the tick is written.
+ * \return true iif there is at least one pending timer.
+ */
+
+bool timing_wheel_get_next_tick(const timing_wheel_t * wheel, uint64_t * ptick);
+
+/**
+ * \brief Retrieve the timestamp at which a tick starts.
+ * \param wheel A timing_wheel_t instance.
+ * \param tick A tick.
+ * \return The corresponding timestamp (in seconds).
+ */
+
+double timing_wheel_get_tick_time(const timing_wheel_t * wheel, uint64_t tick);
+
+#endif
@@ -0,0 +1,23 @@
+#include "config.h"
+
+#include "tracepoint.h"
+
+#if defined(USE_TRACEPOINTS) && defined(HAVE_SYS_SDT_H)
+
+// The semaphores are stored in the .probes section, where the tracers
+// look for them (see the systemtap SDT notes).
+#define TRACEPOINT_DEFINE(name) \
+    volatile unsigned short TRACEPOINT_SEMAPHORE(name) __attribute__((section(".probes"))) = 0
+
+TRACEPOINT_DEFINE(probe_queued);
+TRACEPOINT_DEFINE(probe_sent);
+TRACEPOINT_DEFINE(probe_dropped);
+TRACEPOINT_DEFINE(reply_received);
+TRACEPOINT_DEFINE(probe_matched);
+TRACEPOINT_DEFINE(reply_duplicate);
+TRACEPOINT_DEFINE(reply_late);
+TRACEPOINT_DEFINE(reply_unmatched);
+TRACEPOINT_DEFINE(probe_timeout);
+TRACEPOINT_DEFINE(event_dispatch);
+
+#endif
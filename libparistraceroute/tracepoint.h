@@ -0,0 +1,65 @@
+#include "use.h"
+
+#ifndef TRACEPOINT_H
+#define TRACEPOINT_H
+
+/**
+ * \file tracepoint.h
+ * \brief USDT tracepoints placed along the lifecycle of the probes.
+ *
+ * The tracepoints of the "paristraceroute" provider may be listed by
+ * "bpftrace -l 'usdt:/path/to/libparistraceroute.so:*'" and attached to
+ * a running process, e.g.:
+ *
+ *     bpftrace -p PID -e 'usdt:*:paristraceroute:probe_matched
+ *         { @rtt_us = hist((arg4 - arg3) / 1000); }'
+ *
+ * Each tracepoint has a semaphore, set by the tracer while it is
+ * attached: until then, a tracepoint costs a single test, and its
+ * arguments are not even evaluated. The timestamps are in nanoseconds
+ * (see get_time_ns), and the instance IDs are the IDs of the algorithm
+ * instances (0 if unknown).
+ *
+ * | Tracepoint     | Arguments                                             | Fired when
+ * |----------------|-------------------------------------------------------|-----------------------------------------------
+ * | probe_queued   | probe, instance ID, queueing time                     | a probe is pushed in the sendq
+ * | probe_sent     | probe, tag, instance ID, queueing time, sending time  | a probe has been handed over to the kernel
+ * | probe_dropped  | probe, instance ID                                    | a probe could not be sent
+ * | reply_received | reply, size, receiving time                           | a reply is processed by the network layer
+ * | probe_matched  | probe, tag, instance ID, sending time, receiving time | a reply matches a probe in transit
+ * | reply_duplicate| reply, tag, instance ID, receiving time               | a reply matches a probe already matched
+ * | reply_late     | reply, tag, instance ID, receiving time               | a reply matches a probe already expired
+ * | reply_unmatched| reply, tag, receiving time                            | a reply does not match any probe in transit
+ * | probe_timeout  | probe, tag, instance ID, sending time                 | a probe has expired
+ * | event_dispatch | instance ID, event type, event                        | an event is passed to an algorithm instance
+ */
+
+#if defined(USE_TRACEPOINTS) && defined(HAVE_SYS_SDT_H)
+// Each tracepoint refers to its semaphore (see tracepoint.c)
+#    define _SDT_HAS_SEMAPHORES 1
+#    include <sys/sdt.h>
+
+#    define TRACEPOINT_SEMAPHORE(name) paristraceroute_##name##_semaphore
+
+extern volatile unsigned short
+    TRACEPOINT_SEMAPHORE(probe_queued),
+    TRACEPOINT_SEMAPHORE(probe_sent),
+    TRACEPOINT_SEMAPHORE(probe_dropped),
+    TRACEPOINT_SEMAPHORE(reply_received),
+    TRACEPOINT_SEMAPHORE(probe_matched),
+    TRACEPOINT_SEMAPHORE(reply_duplicate),
+    TRACEPOINT_SEMAPHORE(reply_late),
+    TRACEPOINT_SEMAPHORE(reply_unmatched),
+    TRACEPOINT_SEMAPHORE(probe_timeout),
+    TRACEPOINT_SEMAPHORE(event_dispatch);
+
+#    define TRACEPOINT(name, ...) do { \
+         if (__builtin_expect(TRACEPOINT_SEMAPHORE(name), 0)) { \
+             STAP_PROBEV(paristraceroute, name, __VA_ARGS__); \
+         } \
+     } while (0)
+#else
+#    define TRACEPOINT(name, ...) do { } while (0)
+#endif
+
+#endif // TRACEPOINT_H
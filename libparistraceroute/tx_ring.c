@@ -0,0 +1,472 @@
+#include "use.h"
+#include "config.h"
+
+#ifdef USE_PACKET_TX_RING
+
+#include <errno.h>                // errno
+#include <stdio.h>                // perror
+#include <stdlib.h>               // calloc, free
+#include <string.h>               // memcpy, memset
+#include <unistd.h>               // close
+#include <sys/mman.h>             // mmap, munmap
+#include <sys/socket.h>           // socket, sendto
+#include <arpa/inet.h>            // htons
+#include <net/ethernet.h>         // ETH_P_IP, ETH_P_IPV6
+#include <linux/if_packet.h>      // sockaddr_ll, tpacket_req, tpacket2_hdr
+#include <linux/netlink.h>        // nlmsghdr
+#include <linux/rtnetlink.h>      // rtmsg, ndmsg, rtattr
+#include <linux/neighbour.h>      // NDA_*, NUD_*
+
+#include "tx_ring.h"
+#include "common.h"               // get_time_ns
+
+// Offset of the packet in a frame (no PACKET_TX_HAS_OFF)
+#define TX_RING_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+// Size of the buffer used to receive rtnetlink messages
+#define TX_RING_NETLINK_BUFLEN 32768
+
+// Valid states of a neighbour entry
+#define TX_RING_NUD_VALID (NUD_PERMANENT | NUD_NOARP | NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE)
+
+//---------------------------------------------------------------------------
+// Next hop resolution
+//---------------------------------------------------------------------------
+
+/**
+ * \struct tx_route_t
+ * \brief Route related to an IP destination, as returned by RTM_GETROUTE.
+ */
+
+typedef struct {
+    unsigned char type;        /**< Route type (RTN_UNICAST, RTN_LOCAL...) */
+    int           ifindex;     /**< Egress interface */
+    bool          has_gateway; /**< true iif the destination is not on-link */
+    ip_t          gateway;     /**< The gateway (if any) */
+} tx_route_t;
+
+/**
+ * \struct tx_neighbour_t
+ * \brief Neighbour looked up in a RTM_GETNEIGH dump.
+ */
+
+typedef struct {
+    int            family;   /**< Address family of the neighbour */
+    int            ifindex;  /**< Interface of the neighbour */
+    const ip_t   * ip;       /**< IP address of the neighbour */
+    tx_nexthop_t * nexthop;  /**< Updated if the neighbour is found */
+} tx_neighbour_t;
+
+/**
+ * \brief Send a rtnetlink request and process the replies.
+ * \param tx_ring A tx_ring_t instance.
+ * \param request The request. Its sequence number is set by this function.
+ * \param handler Function called for each reply. It returns true if the
+ *    reply is relevant.
+ * \param data This pointer is passed whenever handler is called.
+ * \return true iif handler has returned true at least once.
+ */
+
+static bool tx_ring_netlink_query(
+    tx_ring_t       * tx_ring,
+    struct nlmsghdr * request,
+    bool           (* handler)(const struct nlmsghdr *, void *),
+    void            * data
+) {
+    uint8_t           buffer[TX_RING_NETLINK_BUFLEN];
+    struct nlmsghdr * nlh;
+    ssize_t           len;
+    bool              is_dump = (request->nlmsg_flags & NLM_F_DUMP) != 0,
+                      ret = false;
+
+    request->nlmsg_seq = ++tx_ring->netlink_seq;
+    if (send(tx_ring->netlink_sockfd, request, request->nlmsg_len, 0) == -1) {
+        perror("tx_ring_netlink_query: can't send request");
+        return false;
+    }
+
+    for (;;) {
+        if ((len = recv(tx_ring->netlink_sockfd, buffer, sizeof(buffer), 0)) <= 0) {
+            return false;
+        }
+
+        for (nlh = (struct nlmsghdr *) buffer; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            // Reply to a previous request
+            if (nlh->nlmsg_seq != tx_ring->netlink_seq) continue;
+
+            switch (nlh->nlmsg_type) {
+                case NLMSG_DONE:
+                    return ret;
+                case NLMSG_ERROR:
+                    // e.g. the destination is unreachable
+                    return false;
+                default:
+                    if (handler(nlh, data)) ret = true;
+                    if (!is_dump) return ret;
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * \brief Parse a RTM_NEWROUTE message.
+ * \param nlh The received message.
+ * \param route The tx_route_t instance to fill.
+ * \return true iif successful
+ */
+
+static bool tx_ring_parse_route(const struct nlmsghdr * nlh, void * route)
+{
+    const struct rtmsg  * rtm = NLMSG_DATA(nlh);
+    const struct rtattr * rta;
+    tx_route_t          * r = route;
+    int                   len = RTM_PAYLOAD(nlh);
+
+    if (nlh->nlmsg_type != RTM_NEWROUTE) return false;
+
+    r->type        = rtm->rtm_type;
+    r->ifindex     = 0;
+    r->has_gateway = false;
+
+    for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+            case RTA_OIF:
+                r->ifindex = *(const int *) RTA_DATA(rta);
+                break;
+            case RTA_GATEWAY:
+                if (RTA_PAYLOAD(rta) <= sizeof(ip_t)) {
+                    memcpy(&r->gateway, RTA_DATA(rta), RTA_PAYLOAD(rta));
+                    r->has_gateway = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return r->ifindex != 0;
+}
+
+/**
+ * \brief Parse a RTM_NEWNEIGH message and update the next hop if it
+ *    corresponds to the neighbour we are looking for.
+ * \param nlh The received message.
+ * \param neighbour The tx_neighbour_t instance we are looking for.
+ * \return true iif this message is related to this neighbour
+ */
+
+static bool tx_ring_parse_neighbour(const struct nlmsghdr * nlh, void * neighbour)
+{
+    const struct ndmsg  * ndm = NLMSG_DATA(nlh);
+    const struct rtattr * rta, * dst = NULL, * lladdr = NULL;
+    tx_neighbour_t      * n = neighbour;
+    int                   len = RTM_PAYLOAD(nlh);
+
+    if (nlh->nlmsg_type != RTM_NEWNEIGH
+    ||  ndm->ndm_family  != n->family
+    ||  ndm->ndm_ifindex != n->ifindex
+    || !(ndm->ndm_state & TX_RING_NUD_VALID)) {
+        return false;
+    }
+
+    for (rta = (const struct rtattr *) ((const uint8_t *) ndm + NLMSG_ALIGN(sizeof(struct ndmsg))); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+            case NDA_DST:    dst = rta;    break;
+            case NDA_LLADDR: lladdr = rta; break;
+            default: break;
+        }
+    }
+
+    if (!dst || !lladdr
+    ||  RTA_PAYLOAD(lladdr) > TX_RING_MAX_LLADDR_SIZE
+    ||  memcmp(RTA_DATA(dst), n->ip, RTA_PAYLOAD(dst)) != 0) {
+        return false;
+    }
+
+    memcpy(n->nexthop->lladdr, RTA_DATA(lladdr), RTA_PAYLOAD(lladdr));
+    n->nexthop->lladdr_size = RTA_PAYLOAD(lladdr);
+    return true;
+}
+
+/**
+ * \brief Find the egress interface and the link-layer address of the
+ *    next hop related to an IP destination.
+ * \param tx_ring A tx_ring_t instance.
+ * \param dst The IP destination.
+ * \param nexthop The tx_nexthop_t instance to fill.
+ * \return true iif successful
+ */
+
+static bool tx_ring_resolve(tx_ring_t * tx_ring, const address_t * dst, tx_nexthop_t * nexthop)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct rtmsg    rtm;
+        uint8_t         attrs[RTA_SPACE(sizeof(ip_t))];
+    } route_request;
+    struct {
+        struct nlmsghdr nlh;
+        struct ndmsg    ndm;
+    } neighbour_request;
+    struct rtattr  * rta;
+    tx_route_t       route;
+    tx_neighbour_t   neighbour;
+    size_t           size = address_get_size(dst);
+
+    // Fetch the route towards this destination
+    memset(&route_request, 0, sizeof(route_request));
+    route_request.nlh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
+    route_request.nlh.nlmsg_type  = RTM_GETROUTE;
+    route_request.nlh.nlmsg_flags = NLM_F_REQUEST;
+    route_request.rtm.rtm_family  = dst->family;
+    route_request.rtm.rtm_dst_len = 8 * size;
+
+    rta = (struct rtattr *) ((uint8_t *) &route_request + NLMSG_ALIGN(route_request.nlh.nlmsg_len));
+    rta->rta_type = RTA_DST;
+    rta->rta_len  = RTA_LENGTH(size);
+    memcpy(RTA_DATA(rta), &dst->ip, size);
+    route_request.nlh.nlmsg_len = NLMSG_ALIGN(route_request.nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+    if (!tx_ring_netlink_query(tx_ring, &route_request.nlh, tx_ring_parse_route, &route)) {
+        return false;
+    }
+
+    memcpy(&nexthop->dst, dst, sizeof(address_t));
+    nexthop->ifindex = route.ifindex;
+
+    switch (route.type) {
+        case RTN_LOCAL:
+            // A packet injected on the loopback interface has no route
+            // attached and is dropped as martian (IPv4). Such destinations
+            // are cached with no interface and left to the raw sockets.
+            nexthop->ifindex     = 0;
+            nexthop->lladdr_size = 0;
+            return true;
+        case RTN_UNICAST:
+            break;
+        default:
+            return false;
+    }
+
+    // Fetch the link-layer address of the next hop
+    memset(&neighbour_request, 0, sizeof(neighbour_request));
+    neighbour_request.nlh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct ndmsg));
+    neighbour_request.nlh.nlmsg_type  = RTM_GETNEIGH;
+    neighbour_request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    neighbour_request.ndm.ndm_family  = dst->family;
+    neighbour_request.ndm.ndm_ifindex = route.ifindex;
+
+    neighbour.family  = dst->family;
+    neighbour.ifindex = route.ifindex;
+    neighbour.ip      = route.has_gateway ? &route.gateway : &dst->ip;
+    neighbour.nexthop = nexthop;
+
+    return tx_ring_netlink_query(tx_ring, &neighbour_request.nlh, tx_ring_parse_neighbour, &neighbour);
+}
+
+/**
+ * \brief Retrieve the next hop related to an IP destination.
+ * \param tx_ring A tx_ring_t instance.
+ * \param dst The IP destination.
+ * \return The corresponding next hop, NULL if it cannot be resolved or
+ *    if the destination is local.
+ *    This pointer is valid until the next call to this function.
+ */
+
+static const tx_nexthop_t * tx_ring_get_nexthop(tx_ring_t * tx_ring, const address_t * dst)
+{
+    const uint8_t * bytes = (const uint8_t *) &dst->ip;
+    size_t          i, size = address_get_size(dst);
+    uint32_t        hash = 2166136261u; // FNV-1a
+    tx_nexthop_t  * entry;
+    double          now = NS_TO_SECONDS(get_time_ns());
+
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    entry = &tx_ring->cache[hash & (TX_RING_CACHE_SIZE - 1)];
+    if (entry->expiry > now && address_equals(&entry->dst, dst)) {
+        return entry->ifindex ? entry : NULL;
+    }
+
+    // Negative results are not cached, since the neighbour discovery
+    // triggered by the raw socket may succeed in the meantime.
+    if (!tx_ring_resolve(tx_ring, dst, entry)) {
+        entry->expiry = 0;
+        return NULL;
+    }
+
+    entry->expiry = now + TX_RING_CACHE_TIMEOUT;
+    return entry->ifindex ? entry : NULL;
+}
+
+/**
+ * \brief Test whether two next hops are reached the same way.
+ * \param x A next hop.
+ * \param y A next hop.
+ * \return true iif they have the same family, interface and link-layer address.
+ */
+
+static bool tx_nexthop_match(const tx_nexthop_t * x, const tx_nexthop_t * y) {
+    return x->dst.family  == y->dst.family
+        && x->ifindex     == y->ifindex
+        && x->lladdr_size == y->lladdr_size
+        && memcmp(x->lladdr, y->lladdr, x->lladdr_size) == 0;
+}
+
+//---------------------------------------------------------------------------
+// Ring
+//---------------------------------------------------------------------------
+
+tx_ring_t * tx_ring_create()
+{
+    tx_ring_t         * tx_ring;
+    struct tpacket_req  req;
+    int                 version = TPACKET_V2,
+                        loss = 1;
+
+    if (!(tx_ring = calloc(1, sizeof(tx_ring_t)))) goto ERR_CALLOC;
+
+    // Protocol 0: this socket never receives packets
+    if ((tx_ring->sockfd = socket(AF_PACKET, SOCK_DGRAM, 0)) == -1) {
+        perror("tx_ring_create: error while creating socket");
+        goto ERR_SOCKET;
+    }
+
+    // PACKET_LOSS: malformed frames are skipped instead of blocking the ring
+    if (setsockopt(tx_ring->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1
+    ||  setsockopt(tx_ring->sockfd, SOL_PACKET, PACKET_LOSS,    &loss,    sizeof(loss))    == -1) {
+        perror("tx_ring_create: error in setsockopt");
+        goto ERR_SETSOCKOPT;
+    }
+
+    memset(&req, 0, sizeof(struct tpacket_req));
+    req.tp_block_size = TX_RING_BLOCK_SIZE;
+    req.tp_block_nr   = TX_RING_NUM_BLOCKS;
+    req.tp_frame_size = TX_RING_FRAME_SIZE;
+    req.tp_frame_nr   = (TX_RING_BLOCK_SIZE / TX_RING_FRAME_SIZE) * TX_RING_NUM_BLOCKS;
+
+    if (setsockopt(tx_ring->sockfd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(struct tpacket_req)) == -1) {
+        perror("tx_ring_create: error while creating the ring");
+        goto ERR_SETSOCKOPT;
+    }
+
+    tx_ring->map_size   = TX_RING_BLOCK_SIZE * TX_RING_NUM_BLOCKS;
+    tx_ring->num_frames = req.tp_frame_nr;
+    tx_ring->cur_frame  = 0;
+    if ((tx_ring->map = mmap(NULL, tx_ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, tx_ring->sockfd, 0)) == MAP_FAILED) {
+        perror("tx_ring_create: error while mapping the ring");
+        goto ERR_MMAP;
+    }
+
+    if ((tx_ring->netlink_sockfd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) == -1) {
+        perror("tx_ring_create: error while creating netlink socket");
+        goto ERR_NETLINK_SOCKET;
+    }
+    tx_ring->netlink_seq = 0;
+
+    return tx_ring;
+
+ERR_NETLINK_SOCKET:
+    munmap(tx_ring->map, tx_ring->map_size);
+ERR_MMAP:
+ERR_SETSOCKOPT:
+    close(tx_ring->sockfd);
+ERR_SOCKET:
+    free(tx_ring);
+ERR_CALLOC:
+    return NULL;
+}
+
+void tx_ring_free(tx_ring_t * tx_ring)
+{
+    if (tx_ring) {
+        close(tx_ring->netlink_sockfd);
+        munmap(tx_ring->map, tx_ring->map_size);
+        close(tx_ring->sockfd);
+        free(tx_ring);
+    }
+}
+
+/**
+ * \brief Copy a packet in the next frame of a ring.
+ * \param tx_ring A tx_ring_t instance.
+ * \param packet The packet to send.
+ * \return true iif successful, false if the packet is too large or if
+ *    the ring is full.
+ */
+
+static bool tx_ring_push_packet(tx_ring_t * tx_ring, const packet_t * packet)
+{
+    struct tpacket2_hdr * frame  = (struct tpacket2_hdr *) (tx_ring->map + tx_ring->cur_frame * TX_RING_FRAME_SIZE);
+    size_t                size   = packet_get_size(packet);
+    uint32_t              status = __atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE);
+
+    if (size > TX_RING_FRAME_SIZE - TX_RING_DATA_OFFSET) return false;
+
+    // This frame has not yet been sent by the kernel
+    if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) return false;
+
+    memcpy((uint8_t *) frame + TX_RING_DATA_OFFSET, packet_get_bytes(packet), size);
+    frame->tp_len = size;
+    __atomic_store_n(&frame->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    tx_ring->cur_frame = (tx_ring->cur_frame + 1) % tx_ring->num_frames;
+    return true;
+}
+
+/**
+ * \brief Ask the kernel to send the pending frames of a ring.
+ * \param tx_ring A tx_ring_t instance.
+ * \param nexthop The next hop of every pending frame.
+ * \return true iif successful
+ */
+
+static bool tx_ring_flush(tx_ring_t * tx_ring, const tx_nexthop_t * nexthop)
+{
+    struct sockaddr_ll saddr;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_ll));
+    saddr.sll_family   = AF_PACKET;
+    saddr.sll_protocol = htons(nexthop->dst.family == AF_INET ? ETH_P_IP : ETH_P_IPV6);
+    saddr.sll_ifindex  = nexthop->ifindex;
+    saddr.sll_halen    = nexthop->lladdr_size;
+    memcpy(saddr.sll_addr, nexthop->lladdr, nexthop->lladdr_size);
+
+    if (sendto(tx_ring->sockfd, NULL, 0, MSG_DONTWAIT, (struct sockaddr *) &saddr, sizeof(struct sockaddr_ll)) == -1
+    &&  errno != EAGAIN && errno != ENOBUFS) {
+        perror("tx_ring_flush: error while sending frames");
+        return false;
+    }
+
+    return true;
+}
+
+size_t tx_ring_send_packets(tx_ring_t * tx_ring, packet_t ** packets, size_t num_packets)
+{
+    const tx_nexthop_t * nexthop;
+    tx_nexthop_t         batch_nexthop;
+    size_t               i, num_queued = 0;
+
+    for (i = 0; i < num_packets; i++) {
+        if (!(nexthop = tx_ring_get_nexthop(tx_ring, packets[i]->dst_ip))) break;
+
+        // The kernel sends every pending frame through the same interface
+        // to the same next hop.
+        if (num_queued > 0 && !tx_nexthop_match(nexthop, &batch_nexthop)) {
+            tx_ring_flush(tx_ring, &batch_nexthop);
+            num_queued = 0;
+        }
+
+        if (num_queued == 0) batch_nexthop = *nexthop;
+        if (!tx_ring_push_packet(tx_ring, packets[i])) break;
+        num_queued++;
+    }
+
+    if (num_queued > 0) tx_ring_flush(tx_ring, &batch_nexthop);
+    return i;
+}
+
+#endif // USE_PACKET_TX_RING
@@ -0,0 +1,103 @@
+#include "use.h"
+
+#ifndef TX_RING_H
+#define TX_RING_H
+
+/**
+ * \file tx_ring.h
+ * \brief Transmission of packets through a memory-mapped PACKET_TX_RING
+ *    (Linux specific).
+ *
+ * Packets are copied straight into the frames of a ring shared with the
+ * kernel, and consecutive packets leaving through the same interface
+ * towards the same next hop are flushed with a single system call.
+ *
+ * Since such packets bypass the IP routing of the kernel, the egress
+ * interface and the link-layer address of the next hop are retrieved
+ * thanks to rtnetlink (route and neighbour tables) and cached for each
+ * destination. A packet whose next hop is not yet known (e.g. no ARP/NDP
+ * entry) or to a local address cannot be sent through the ring.
+ */
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint8_t
+
+#include "address.h" // address_t
+#include "packet.h"  // packet_t
+
+// Geometry of the ring. TX_RING_BLOCK_SIZE must be a multiple of the page
+// size and of TX_RING_FRAME_SIZE.
+#define TX_RING_BLOCK_SIZE (1 << 16)
+#define TX_RING_NUM_BLOCKS 16
+#define TX_RING_FRAME_SIZE 2048
+
+// Number of cached next hops. Must be a power of 2.
+#define TX_RING_CACHE_SIZE 64
+
+// Lifetime of a cached next hop (in seconds).
+#define TX_RING_CACHE_TIMEOUT 10
+
+// Maximum size of a link-layer address.
+#define TX_RING_MAX_LLADDR_SIZE 8
+
+/**
+ * \struct tx_nexthop_t
+ * \brief The link-layer destination of the packets sent to a given
+ *    IP destination.
+ */
+
+typedef struct {
+    address_t dst;                              /**< The IP destination */
+    int       ifindex;                          /**< The egress interface, 0 if the destination is local */
+    uint8_t   lladdr[TX_RING_MAX_LLADDR_SIZE];  /**< Link-layer address of the next hop */
+    uint8_t   lladdr_size;                      /**< Size of lladdr (in bytes) */
+    double    expiry;                           /**< When this entry must be refreshed, 0 if unused */
+} tx_nexthop_t;
+
+/**
+ * \struct tx_ring_t
+ * \brief A PACKET_TX_RING mapped in the memory.
+ */
+
+typedef struct {
+    int          sockfd;                        /**< AF_PACKET socket related to the ring */
+    int          netlink_sockfd;                /**< rtnetlink socket used to resolve the next hops */
+    uint32_t     netlink_seq;                   /**< Sequence number of the last rtnetlink request */
+    uint8_t    * map;                           /**< The mapped ring */
+    size_t       map_size;                      /**< Size of the mapped ring (in bytes) */
+    size_t       num_frames;                    /**< Number of frames of the ring */
+    size_t       cur_frame;                     /**< Index of the next frame to fill */
+    tx_nexthop_t cache[TX_RING_CACHE_SIZE];     /**< Next hops, indexed by destination */
+} tx_ring_t;
+
+/**
+ * \brief Create a tx_ring_t instance.
+ * \return The newly allocated tx_ring_t instance, NULL in case of failure
+ *    (e.g. PACKET_TX_RING is not supported).
+ */
+
+tx_ring_t * tx_ring_create();
+
+/**
+ * \brief Release a tx_ring_t instance from the memory.
+ * \param tx_ring A tx_ring_t instance.
+ */
+
+void tx_ring_free(tx_ring_t * tx_ring);
+
+/**
+ * \brief Send packets through a ring. The packets must be complete IP
+ *    packets (checksums included), since the kernel does not alter them.
+ * \param tx_ring A tx_ring_t instance.
+ * \param packets An array of packets to send.
+ * \param num_packets The number of packets stored in packets.
+ * \return The number of packets sent. If this value is lower than
+ *    num_packets, packets[return value] cannot be sent through the ring
+ *    (unknown next hop, packet too large, ring full...) and should be sent
+ *    by other means.
+ */
+
+size_t tx_ring_send_packets(tx_ring_t * tx_ring, packet_t ** packets, size_t num_packets);
+
+#endif
@@ -0,0 +1,178 @@
+#include "use.h"
+#include "config.h"
+
+#ifdef USE_IO_URING
+
+#include <errno.h>              // errno, EINTR
+#include <poll.h>               // POLLIN
+#include <stdio.h>              // perror
+#include <stdlib.h>             // calloc, free
+#include <string.h>             // memset
+#include <unistd.h>             // close, syscall
+#include <sys/mman.h>           // mmap, munmap
+#include <sys/syscall.h>        // __NR_io_uring_*
+#include <linux/io_uring.h>     // io_uring_params, io_uring_sqe, io_uring_cqe
+
+#include "uring.h"
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params * params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void * arg, size_t arg_size) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+uring_t * uring_create(size_t entries)
+{
+    uring_t                * uring;
+    struct io_uring_params   params;
+
+    if (!(uring = calloc(1, sizeof(uring_t)))) goto ERR_CALLOC;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+    if ((uring->fd = io_uring_setup(entries, &params)) == -1) {
+        perror("uring_create: io_uring not available");
+        goto ERR_SETUP;
+    }
+
+    uring->features    = params.features;
+    uring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->cq_map_size = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Both rings may be stored in the same mapping
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_map_size > uring->sq_map_size) uring->sq_map_size = uring->cq_map_size;
+        uring->cq_map_size = 0;
+    }
+
+    if ((uring->sq_map = mmap(NULL, uring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+        perror("uring_create: error while mapping the submission ring");
+        goto ERR_MMAP_SQ;
+    }
+
+    if (!uring->cq_map_size) {
+        uring->cq_map = uring->sq_map;
+    } else if ((uring->cq_map = mmap(NULL, uring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        perror("uring_create: error while mapping the completion ring");
+        goto ERR_MMAP_CQ;
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if ((uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+        perror("uring_create: error while mapping the submission entries");
+        goto ERR_MMAP_SQES;
+    }
+
+    uring->sq_head    = (uint32_t *) ((uint8_t *) uring->sq_map + params.sq_off.head);
+    uring->sq_tail    = (uint32_t *) ((uint8_t *) uring->sq_map + params.sq_off.tail);
+    uring->sq_array   = (uint32_t *) ((uint8_t *) uring->sq_map + params.sq_off.array);
+    uring->sq_mask    = *(uint32_t *) ((uint8_t *) uring->sq_map + params.sq_off.ring_mask);
+    uring->sq_entries = params.sq_entries;
+    uring->sq_pending = 0;
+    uring->cq_head    = (uint32_t *) ((uint8_t *) uring->cq_map + params.cq_off.head);
+    uring->cq_tail    = (uint32_t *) ((uint8_t *) uring->cq_map + params.cq_off.tail);
+    uring->cq_mask    = *(uint32_t *) ((uint8_t *) uring->cq_map + params.cq_off.ring_mask);
+    uring->cqes       = (uint8_t *) uring->cq_map + params.cq_off.cqes;
+    return uring;
+
+ERR_MMAP_SQES:
+    if (uring->cq_map != uring->sq_map) munmap(uring->cq_map, uring->cq_map_size);
+ERR_MMAP_CQ:
+    munmap(uring->sq_map, uring->sq_map_size);
+ERR_MMAP_SQ:
+    close(uring->fd);
+ERR_SETUP:
+    free(uring);
+ERR_CALLOC:
+    return NULL;
+}
+
+void uring_free(uring_t * uring)
+{
+    if (uring) {
+        munmap(uring->sqes, uring->sqes_size);
+        if (uring->cq_map != uring->sq_map) munmap(uring->cq_map, uring->cq_map_size);
+        munmap(uring->sq_map, uring->sq_map_size);
+        close(uring->fd);
+        free(uring);
+    }
+}
+
+bool uring_poll_add(uring_t * uring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe;
+    uint32_t              tail = *uring->sq_tail,
+                          head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE),
+                          index;
+
+    if (tail - head >= uring->sq_entries) return false;
+
+    index = tail & uring->sq_mask;
+    sqe = (struct io_uring_sqe *) uring->sqes + index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data     = user_data;
+    uring->sq_array[index] = index;
+
+    // Publish the entry to the kernel
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->sq_pending++;
+    return true;
+}
+
+int uring_wait(uring_t * uring, uring_completion_t * completions, size_t max_completions, int timeout_ms)
+{
+    const struct io_uring_cqe    * cqe;
+    uint32_t                       head, tail;
+    size_t                         num_completions = 0;
+    int                            ret;
+    unsigned                       flags = IORING_ENTER_GETEVENTS;
+    const void                   * parg = NULL;
+    size_t                         arg_size = 0;
+#ifdef IORING_ENTER_EXT_ARG
+    struct io_uring_getevents_arg  arg;
+    struct __kernel_timespec       ts;
+
+    if (timeout_ms > 0 && (uring->features & IORING_FEAT_EXT_ARG)) {
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts    = (uint64_t) (uintptr_t) &ts;
+        flags    |= IORING_ENTER_EXT_ARG;
+        parg      = &arg;
+        arg_size  = sizeof(arg);
+    }
+#endif
+
+    // Submit the pending requests, then sleep until a request completes
+    do {
+        ret = io_uring_enter(uring->fd, uring->sq_pending, timeout_ms == 0 ? 0 : 1, flags, parg, arg_size);
+    } while (ret == -1 && errno == EINTR);
+
+    // The timeout has expired before any request has been submitted
+    if (ret == -1 && errno == ETIME) ret = 0;
+
+    if (ret == -1) {
+        perror("uring_wait: io_uring_enter");
+        return -1;
+    }
+    uring->sq_pending -= ret;
+
+    head = *uring->cq_head;
+    tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail && num_completions < max_completions; head++, num_completions++) {
+        cqe = (const struct io_uring_cqe *) uring->cqes + (head & uring->cq_mask);
+        completions[num_completions].user_data = cqe->user_data;
+        completions[num_completions].res       = cqe->res;
+    }
+
+    // Release the reaped entries to the kernel
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    return num_completions;
+}
+
+#endif // USE_IO_URING
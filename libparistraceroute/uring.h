@@ -0,0 +1,112 @@
+#include "use.h"
+
+#ifndef URING_H
+#define URING_H
+
+/**
+ * \file uring.h
+ * \brief Minimal io_uring wrapper (Linux specific) used by pt_loop to
+ *    wait for its file descriptors.
+ *
+ * Each watched file descriptor is polled by a one-shot IORING_OP_POLL_ADD
+ * request. A request is re-armed once its completion has been reaped, and
+ * the re-armed requests are submitted by the io_uring_enter() call which
+ * waits for the next completions. Since a poll request completes at once
+ * if its file descriptor is already readable, the semantics are those of
+ * a level-triggered epoll instance, for a single system call per
+ * iteration of the loop.
+ *
+ * Multishot poll requests are not used, since they only complete when a
+ * file descriptor becomes readable again: a handler leaving its file
+ * descriptor readable would not be woken up anymore. This is the case
+ * of the algorithm eventfd of pt_loop (an EFD_SEMAPHORE, read one unit
+ * at a time), and of any handler which does not drain its file descriptor
+ * unless USE_EPOLLET is set.
+ *
+ * The rings are set up thanks to the raw system calls, so that
+ * libparistraceroute does not depend on liburing.
+ */
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t, uint64_t
+
+/**
+ * \struct uring_completion_t
+ * \brief A completed request.
+ */
+
+typedef struct {
+    uint64_t user_data; /**< The value passed when the request has been queued */
+    int32_t  res;       /**< Result of the request (poll: the revents mask, < 0: -errno) */
+} uring_completion_t;
+
+/**
+ * \struct uring_t
+ * \brief An io_uring instance and its mapped rings.
+ */
+
+typedef struct {
+    int        fd;           /**< File descriptor returned by io_uring_setup */
+    void     * sq_map;       /**< Mapped submission ring */
+    size_t     sq_map_size;  /**< Size of sq_map (in bytes) */
+    void     * cq_map;       /**< Mapped completion ring (may be equal to sq_map) */
+    size_t     cq_map_size;  /**< Size of cq_map (in bytes) */
+    void     * sqes;         /**< Mapped submission queue entries */
+    size_t     sqes_size;    /**< Size of sqes (in bytes) */
+    uint32_t * sq_head;      /**< Head of the submission ring (updated by the kernel) */
+    uint32_t * sq_tail;      /**< Tail of the submission ring */
+    uint32_t * sq_array;     /**< Indexes of the submitted entries */
+    uint32_t   sq_mask;      /**< sq_entries - 1 */
+    uint32_t   sq_entries;   /**< Number of submission entries */
+    uint32_t   sq_pending;   /**< Number of queued but not yet submitted entries */
+    uint32_t * cq_head;      /**< Head of the completion ring */
+    uint32_t * cq_tail;      /**< Tail of the completion ring (updated by the kernel) */
+    uint32_t   cq_mask;      /**< Number of completion entries - 1 */
+    void     * cqes;         /**< Completion queue entries */
+    uint32_t   features;     /**< Features supported by the kernel (IORING_FEAT_*) */
+} uring_t;
+
+/**
+ * \brief Create a uring_t instance.
+ * \param entries Minimal number of requests which may be queued at once.
+ * \return The newly allocated uring_t instance, NULL in case of failure
+ *    (e.g. io_uring is not supported by the kernel).
+ */
+
+uring_t * uring_create(size_t entries);
+
+/**
+ * \brief Release a uring_t instance from the memory.
+ * \param uring A uring_t instance.
+ */
+
+void uring_free(uring_t * uring);
+
+/**
+ * \brief Queue a one-shot request which completes as soon as a file
+ *    descriptor is readable. The request is submitted by the next call
+ *    to uring_wait().
+ * \param uring A uring_t instance.
+ * \param fd The polled file descriptor.
+ * \param user_data This value is passed back in the corresponding
+ *    uring_completion_t instance.
+ * \return true iif successful, false if the submission ring is full.
+ */
+
+bool uring_poll_add(uring_t * uring, int fd, uint64_t user_data);
+
+/**
+ * \brief Submit the queued requests and wait for at least one completion.
+ * \param uring A uring_t instance.
+ * \param completions An array in which the completed requests are written.
+ * \param max_completions The number of cells of completions.
+ * \param timeout_ms The maximum waiting time (in milliseconds), -1 to wait
+ *    until a request completes, 0 to return immediately. A finite timeout
+ *    requires IORING_FEAT_EXT_ARG (Linux 5.11), otherwise it is ignored.
+ * \return The number of completed requests, -1 in case of failure.
+ */
+
+int uring_wait(uring_t * uring, uring_completion_t * completions, size_t max_completions, int timeout_ms);
+
+#endif
@@ -16,4 +16,98 @@
 // Enable scheduling of probes
 #define USE_SCHEDULING
 
+// Timestamp probes and replies in the kernel (SO_TIMESTAMPING, Linux only)
+// instead of in userspace, so that the RTTs do not include the time spent
+// in the event loop.
+#ifdef __linux__
+#  define USE_TIMESTAMPING
+#endif
+
+// Filter the sniffed packets in the kernel, so that only the ICMP replies
+// that may be related to a probe are passed to the sniffer.
+#define USE_SOCKET_FILTER
+
+// Capture replies thanks to a memory-mapped AF_PACKET ring (Linux only).
+// The sniffer then sees every IP packet received by the host.
+//#define USE_PACKET_RING
+
+// Send probes thanks to a memory-mapped AF_PACKET ring (Linux only).
+// Packets whose next hop is not resolved yet are sent through the raw sockets.
+//#define USE_PACKET_TX_RING
+
+// Watch the file descriptors of pt_loop in edge-triggered mode (epoll only).
+// Each handler then drains its file descriptor until EAGAIN, so that a busy
+// socket wakes up the loop once per burst of packets instead of once per batch.
+#define USE_EPOLLET
+
+// Wait for the events of pt_loop thanks to io_uring instead of epoll
+// (Linux >= 5.1). pt_loop falls back on epoll if io_uring is not available.
+//#define USE_IO_URING
+
+// Wait for the events of pt_loop thanks to kqueue instead of epoll, on the
+// BSD systems which do not provide epoll (e.g. FreeBSD probe hosts). The
+// eventfds and timerfds are kept (FreeBSD >= 14, NetBSD >= 10), and SIGINT
+// and SIGQUIT are caught by EVFILT_SIGNAL instead of a signalfd. The control
+// socket, the metrics endpoint, the coordinator, the demultiplexer and the
+// broker watch their sockets and signals the same way.
+#if defined(__FreeBSD__) || defined(__NetBSD__)
+#  define USE_KQUEUE
+#  undef USE_IO_URING
+#endif
+
+// Hand the departure time of the scheduled probes to the kernel (SO_TXTIME,
+// Linux >= 4.19) instead of waking up the event loop for each of them.
+// The egress interface must use the fq (or etf) qdisc, otherwise the probes
+// are sent as soon as they are handed over to the kernel.
+//#define USE_TXTIME
+
+// Recycle the probes, layers, packets and buffers released by the library
+// instead of handing them back to malloc at once. Disable it to track memory
+// errors thanks to valgrind or AddressSanitizer.
+#define USE_POOLS
+
+// Back the large tables (indexes of the recent probes, of the mda lookups,
+// hashmaps...) with huge pages: reserved ones (MAP_HUGETLB) if any, and
+// transparent huge pages otherwise (see hugemem.h).
+#define USE_HUGEPAGES
+
+// Allocate the memory of each shard (see pt_shards.h) on the NUMA node of
+// the core running it (Linux only).
+#ifdef __linux__
+#  define USE_NUMA
+#endif
+
+// Pin the thread of each shard (see pt_shards.h) to its core (Linux only).
+// Elsewhere, the scheduler is free to move the shards.
+#ifdef __linux__
+#  define USE_CPU_AFFINITY
+#endif
+
+// Compute the Internet checksums thanks to vector instructions (SSE2/AVX2
+// or NEON), selected at runtime according to the CPU.
+#define USE_SIMD_CSUM
+
+// Match the replies quoting an IPv4/UDP, IPv4/ICMP, IPv4/TCP, IPv6/UDP or
+// IPv6/ICMPv6 probe by reading their fields at fixed offsets (see
+// protocol_stack.h) instead of dissecting them layer by layer.
+#define USE_PROTOCOL_STACKS
+
+// Release the packet of the probes in transit, keeping only the bytes
+// which differ from their skeleton (see probe_compact).
+#define USE_COMPACT_PROBES
+
+// Place USDT tracepoints along the lifecycle of the probes (see tracepoint.h),
+// so that bpftrace or perf may be attached to a running process. They are
+// only compiled if <sys/sdt.h> (systemtap-sdt) is available.
+#define USE_TRACEPOINTS
+
+// The features above which rely on Linux-only interfaces (AF_PACKET, io_uring,
+// SO_TXTIME) cannot be enabled on the other systems.
+#ifndef __linux__
+#  undef USE_PACKET_RING
+#  undef USE_PACKET_TX_RING
+#  undef USE_IO_URING
+#  undef USE_TXTIME
+#endif
+
 #endif
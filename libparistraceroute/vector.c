@@ -7,8 +7,6 @@
 #include "vector.h"
 
 #define VECTOR_SIZE_INIT  5
-#define VECTOR_SIZE_INC   5
-
 
 static void * vector_get_ith_element_impl(const vector_t * vector, size_t i) {
     return (uint8_t *)(vector->cells) + i * (vector->cell_size);
@@ -21,10 +19,13 @@ static void vector_initialize(vector_t * vector) {
 }
 
 vector_t * vector_create_impl(size_t size, void (* callback_free)(void *), void (* callback_dump)(const void *)) {
-    vector_t * vector = malloc(size);
+    vector_t * vector = malloc(sizeof(vector_t));
     if (vector) {
         vector->cell_size = size;
-        vector->cells = calloc(VECTOR_SIZE_INIT, vector->cell_size);
+        if (!(vector->cells = calloc(VECTOR_SIZE_INIT, vector->cell_size))) {
+            free(vector);
+            return NULL;
+        }
         vector->cells_free = callback_free;
         vector->cells_dump = callback_dump;
         vector_initialize(vector);
@@ -53,22 +54,20 @@ void vector_free(vector_t * vector, void (* element_free)(void * element)) {
 
 bool vector_push_element(vector_t * vector, void * element)
 {
-    bool ret = false;
+    bool   ret = false;
+    void * cells;
+    size_t max_cells;
 
     if (vector && element) {
-        // If the vector is full, allocate VECTOR_SIZE_INC
-        // cells in the vector
+        // If the vector is full, double its capacity, so that n pushes
+        // cost O(n) copies overall
         if (vector->num_cells == vector->max_cells) {
-            vector->cells = realloc(
-                    vector->cells,
-                    (vector->num_cells + VECTOR_SIZE_INC) * vector->cell_size
-                    );
-            memset(
-                    vector_get_ith_element_impl(vector, vector->num_cells),
-                    0,
-                    VECTOR_SIZE_INC * vector->cell_size
-                  );
-            vector->max_cells += VECTOR_SIZE_INC;
+            max_cells = vector->max_cells ? 2 * vector->max_cells : VECTOR_SIZE_INIT;
+            if (!(cells = realloc(vector->cells, max_cells * vector->cell_size))) {
+                return false;
+            }
+            vector->cells     = cells;
+            vector->max_cells = max_cells;
         }
 
         // Add the new element and update exposed size
@@ -106,8 +105,8 @@ void vector_clear(vector_t * vector, void (*element_free)(void * element))
                 }
             }
         }
-        vector->cells = realloc(vector->cells, VECTOR_SIZE_INIT * vector->cell_size);
-        vector_initialize(vector);
+        // The cells are kept for the next elements
+        vector->num_cells = 0;
     }
 }
 
@@ -9,9 +9,9 @@
  * \file vector.h
  * \brief Header file: vector structure
  *
- * vector_t manages a dynamic vector of dynamic size, by
- * allocating memory in a chunk-by-chunk fashion. An initial memory_size is
- * allocated, and this size is increased by a given amount when needed.
+ * vector_t manages a dynamic vector of dynamic size. An initial buffer
+ * is allocated, and its capacity is doubled whenever it is full, so that
+ * pushing n elements costs O(n) copies overall.
  */
 
 /**
@@ -77,7 +77,7 @@ bool vector_push_element(vector_t * vector, void * element);
 bool vector_del_ith_element(vector_t * vector, size_t i);
 
 /**
- * \brief Clear a vector.
+ * \brief Clear a vector. Its cells are kept for the next elements.
  * \param vector A vector instance 
  * \param element_free Pointer to a function used to free up element resources
  *     (may be NULL)
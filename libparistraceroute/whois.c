@@ -2,6 +2,7 @@
 
 #include "config.h"
 #include "whois.h"
+#include "cachefile.h"  // cachefile_append_asn, CACHEFILE_DEFAULT_TTL
 
 #include <errno.h>      // errno
 #include <stdio.h>      // fprintf
@@ -10,32 +11,41 @@
 #include <sys/types.h>  // socket, recv
 #include <sys/socket.h> // socket, recv
 #include <unistd.h>     // close
+#include <pthread.h>    // pthread_mutex_*
 
 #ifdef USE_CACHE
-#    include "containers/map.h"
+#    include "containers/hashmap.h"
+#    include "memstats.h"    // memstats_track_alloc
 
-static map_t * cache_ip_asn = NULL;
+// Maps each address_t to its uint32_t origin AS
+static hashmap_t * cache_ip_asn = NULL;
 
 static void __cache_ip_asn_create() __attribute__((constructor));
 static void __cache_ip_asn_free()   __attribute__((destructor));
 
-static void str_dump(const char * s) {
-    printf("%s (%p)", s, s);
+static void asn_dump(const uint32_t * asn) {
+    printf("AS%u", *asn);
 }
 
 static void __cache_ip_asn_create() {
-    cache_ip_asn = map_create(
-        address_dup, address_free, address_dump, address_compare,
-        strdup,      free,         str_dump
+    cache_ip_asn = hashmap_create(
+        sizeof(address_t), address_hash, address_compare, address_dump,
+        sizeof(uint32_t),  NULL,         asn_dump
     );
 }
 
 static void __cache_ip_asn_free() {
-    if (cache_ip_asn) map_free(cache_ip_asn);
+    if (cache_ip_asn) hashmap_free(cache_ip_asn);
 }
 
 #endif
 
+// The cache may be fed by several threads (see pt_shards.h)
+static pthread_mutex_t whois_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// When set, the origin AS are looked up offline (see whois_set_asmap)
+static const asmap_t * whois_asmap = NULL;
+
 bool whois_callback_print(void * pdata, const char * line) {
     FILE * out = (FILE *) pdata;
     fprintf(out, "%s\n", line);
@@ -236,55 +246,80 @@ ERR_WHOIS_FIND_SERVER:
     return false;
 }
 
-bool whois_get_asn(
-    const address_t * queried_address,
-    uint32_t        * asn,
-    int               mask_cache
-) {
-    bool ret = true;
-
-	// FIXME
-/*
-
-	// valgrind error in map
-
-	address_get_size: Invalid family==6139== Invalid read of size 1
-	==6139==    at 0x4E42696: address_compare (address.c:183)
-	==6139==    by 0x514414F: tfind (in /lib/x86_64-linux-gnu/libc-2.22.so)
-	==6139==    by 0x4E47D39: set_find (set.c:70)
-	==6139==    by 0x4E477A8: map_find_impl (map.c:145)
-	==6139==    by 0x4E521BB: whois_get_asn (whois.c:249)
-	==6139==    by 0x400917: main (traceroute.c:99)
-	==6139==  Address 0xffffffffffffffff is not stack'd, malloc'd or (recently) free'd
-*/
-
-/*
+/**
+ * \brief Look up the origin AS of an address in the cache.
+ * \param queried_address The queried IP address.
+ * \param asn The address of an uint32_t, where the cached ASN is written
+ *    (0 if the previous lookup has failed).
+ * \return true iff the address is cached.
+ */
+
+static bool whois_find_asn(const address_t * queried_address, uint32_t * asn)
+{
+    bool found = false;
 #ifdef USE_CACHE
-    if (cache_ip_asn && (mask_cache & CACHE_READ)) {
+    uint32_t * cached_asn;
 
-        address_dump(queried_address);
-		printf("\n");
+    pthread_mutex_lock(&whois_mutex);
+    if (cache_ip_asn && (found = hashmap_find(cache_ip_asn, queried_address, &cached_asn))) {
+        *asn = *cached_asn;
+    }
+    pthread_mutex_unlock(&whois_mutex);
+#endif
+    return found;
+}
 
-        ret = map_find(cache_ip_asn, queried_address, asn);
+void whois_set_asmap(const asmap_t * asmap) {
+    whois_asmap = asmap;
+}
 
-		if (ret) printf("hit cache!");
-        address_dump(queried_address);
-		printf("\n");
-    }
+bool whois_is_asn_cached(const address_t * queried_address)
+{
+    uint32_t asn;
+    return whois_asmap || whois_find_asn(queried_address, &asn);
+}
 
-    if (!ret) {
-#endif
-*/
-        whois(queried_address, whois_callback_get_asn, asn);
-		ret = (*asn != 0);
-/*
+void whois_cache_asn(const address_t * queried_address, uint32_t asn, uint32_t ttl)
+{
 #ifdef USE_CACHE
-        if (mask_cache & CACHE_WRITE) {
-            map_update(cache_ip_asn, queried_address, asn_dup);
+    size_t num_entries;
+
+    pthread_mutex_lock(&whois_mutex);
+    if (cache_ip_asn) {
+        num_entries = hashmap_get_size(cache_ip_asn);
+        if (hashmap_update(cache_ip_asn, queried_address, &asn)
+        &&  hashmap_get_size(cache_ip_asn) > num_entries) {
+            // The cached entries are released on exit
+            memstats_track_alloc(MEMSTATS_CACHE, sizeof(address_t) + sizeof(uint32_t));
         }
     }
+    pthread_mutex_unlock(&whois_mutex);
 #endif
-*/
-    return ret;
+    cachefile_append_asn(queried_address, asn, ttl);
 }
 
+bool whois_get_asn(
+    const address_t * queried_address,
+    uint32_t        * asn,
+    int               mask_cache
+) {
+    // The AS map is read-only and shared, and a lookup is cheaper than
+    // taking whois_mutex: bypass the cache.
+    if (whois_asmap) {
+        return asmap_lookup(whois_asmap, queried_address, asn);
+    }
+
+    // A failed lookup is cached as AS0, which is reserved (RFC 7607)
+    if ((mask_cache & CACHE_READ) && whois_find_asn(queried_address, asn)) {
+        return *asn != 0;
+    }
+
+    *asn = 0;
+    whois(queried_address, whois_callback_get_asn, asn);
+
+    if (mask_cache & CACHE_WRITE) {
+        // A failed whois query may be transient: do not save it
+        whois_cache_asn(queried_address, *asn, *asn ? CACHEFILE_DEFAULT_TTL : 0);
+    }
+    return *asn != 0;
+}
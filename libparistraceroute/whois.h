@@ -5,6 +5,7 @@
 #include <stdbool.h>	// bool
 
 #include "address.h"	// address_t
+#include "asmap.h"      // asmap_t
 
 /**
  * \brief Default callback for whois_* function.
@@ -76,7 +77,8 @@ bool whois(
 );
 
 /**
- * \brief Perform a whois query (whois_find_server + whois_query).
+ * \brief Retrieve the origin AS of an IP address. Unless cached, it
+ *    performs a whois query (whois_find_server + whois_query).
  * \example
     uint32_t asn;
     address_t address;
@@ -96,4 +98,36 @@ bool whois_get_asn(
 	int               mask
 );
 
+/**
+ * \brief Look up the origin AS in an AS map instead of querying whois
+ *    servers (and the DNS, see pt_raise_event_resolved).
+ * \param asmap The AS map (see asmap_open), which must remain open while
+ *    whois_get_asn is used. Pass NULL to query whois servers again.
+ */
+
+void whois_set_asmap(const asmap_t * asmap);
+
+/**
+ * \brief Check whether the origin AS of an address is cached, i.e.
+ *    whether whois_get_asn(address, ..., CACHE_ENABLED) returns without
+ *    performing a whois query.
+ * \param queried_address The queried IP address.
+ * \return true iff the address is cached (see USE_CACHE) or an AS map
+ *    is used (see whois_set_asmap).
+ */
+
+bool whois_is_asn_cached(const address_t * queried_address);
+
+/**
+ * \brief Store in the cache the origin AS of an address, retrieved
+ *    elsewhere (e.g. by resolver.h).
+ * \param queried_address The queried IP address.
+ * \param asn The ASN, 0 if the lookup has failed: whois_get_asn will
+ *    then fail without looking this address up again.
+ * \param ttl The number of seconds during which the result may be saved
+ *    in the cache file (see cachefile.h), 0 if it must not be saved.
+ */
+
+void whois_cache_asn(const address_t * queried_address, uint32_t asn, uint32_t ttl);
+
 #endif
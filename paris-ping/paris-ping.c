@@ -35,9 +35,11 @@
 #define PING_HELP_T        "Use TCP. The destination port is set by default to 80."
 #define PING_HELP_U        "Use UDP. The destination port is set by default to 53."
 #define PING_HELP_k        "Send a TCP ACK packet. (Works only with TCP)"
+#define PING_HELP_TI       "Wait INTERVAL seconds between two packets sent to different hosts when several hosts are pinged (default: 'interval' divided by the number of hosts). The interval toward each host is raised if needed to respect this rate."
 #define PING_HELP_PR       "Use raw packet of protocol PROTOCOL for tracerouting (default: 'icmp'). Valid values are 'udp', 'icmp' and 'tcp'."
+#define PING_HELP_METRICS  "Export the statistics of each host and of the network layer in the OpenMetrics (Prometheus) format over HTTP, on ADDRESS ('PORT', 'HOST:PORT' or '[IPV6]:PORT'; without HOST, only the loopback is listened to)."
 
-#define TEXT               "ping - verify the connection between two hosts."
+#define TEXT               "ping - verify the connection between this host and one or several hosts."
 #define TEXT_OPTIONS       "Options:"
 
 // Default values (based on modern traceroute for linux)
@@ -66,6 +68,9 @@ static bool is_tcp_ack = false;
 // points to the source address (if indicated; option -I)
 struct opt_str src_ip = {NULL, 0};
 
+// address of the metrics HTTP server (if indicated; option --metrics)
+struct opt_str metrics_address = {NULL, 0};
+
 const char * protocol_names[] = {
     "icmp", // default value
     "tcp",
@@ -74,13 +79,14 @@ const char * protocol_names[] = {
 };
 
 // Bounded integer parameters
-//                                  def     min  max                     option_enabled
-static int      dst_port[4]      = {33457,  0,   UINT16_MAX,             0};
-static int      src_port[4]      = {33456,  0,   UINT16_MAX,             0};
-static int      flow_label[4]    = {0,      0,   PING_FLOW_LABEL_MAX,    0};
-static double   send_time[3]     = {1,      1,   DBL_MAX};
-static int      packet_size[3]   = OPTIONS_PING_PACKET_SIZE;
-static unsigned max_ttl[3]       = OPTIONS_PING_MAX_TTL;
+//                                    def     min  max                     option_enabled
+static int      dst_port[4]        = {33457,  0,   UINT16_MAX,             0};
+static int      src_port[4]        = {33456,  0,   UINT16_MAX,             0};
+static int      flow_label[4]      = {0,      0,   PING_FLOW_LABEL_MAX,    0};
+static double   send_time[4]       = {1,      1,   DBL_MAX,                0};
+static double   target_interval[3] = {0,      0,   DBL_MAX};
+static int      packet_size[3]     = OPTIONS_PING_PACKET_SIZE;
+static unsigned max_ttl[3]         = OPTIONS_PING_MAX_TTL;
 
 struct opt_spec runnable_options[] = {
     // action                 sf          lf                   metavar               help               data
@@ -99,6 +105,8 @@ struct opt_spec runnable_options[] = {
     {opt_store_1,             "k",        OPT_NO_LF,           OPT_NO_METAVAR,       PING_HELP_k,       &is_tcp_ack},
     {opt_store_int,           "t",        OPT_NO_LF,           " TIME TO LIVE",      PING_HELP_t,       max_ttl},
     {opt_store_choice,        OPT_NO_SF,  "--protocol",        "PROTOCOL",           PING_HELP_PR,      protocol_names},
+    {opt_store_double_lim,    OPT_NO_SF,  "--target-interval", "INTERVAL",           PING_HELP_TI,      target_interval},
+    {opt_store_str,           OPT_NO_SF,  "--metrics",         "ADDRESS",            PING_HELP_METRICS, &metrics_address},
 
     END_OPT_SPECS
 };
@@ -229,16 +237,42 @@ static bool check_packet_size(bool is_icmp, size_t headers_size, size_t desired_
 // libparistraceroute translation
 //---------------------------------------------------------------------------
 
+/**
+ * \struct target_t
+ * \brief A host pinged by paris-ping.
+ */
+
+typedef struct {
+    ping_options_t         options;  /**< Options of the corresponding ping instance (first member, see loop_handler) */
+    const char           * dst_ip;   /**< The host passed in the command-line */
+    address_t              dst_addr; /**< The corresponding address */
+    probe_t              * probe;    /**< The probe skeleton of the corresponding ping instance */
+    algorithm_instance_t * instance; /**< The corresponding ping instance, NULL once it has terminated */
+} target_t;
+
+/**
+ * \struct targets_t
+ * \brief The hosts pinged by paris-ping (user data of the loop).
+ */
+
+typedef struct {
+    target_t * targets;     /**< The pinged hosts */
+    size_t     num_targets; /**< Number of pinged hosts */
+    size_t     num_running; /**< Number of ping instances not terminated yet */
+} targets_t;
+
 /**
  * \brief Handle events raised by libparistraceroute.
  * \param loop The main loop.
  * \param event The event raised by libparistraceroute.
- * \param user_data Points to user data, shared by
+ * \param user_data Points to the targets_t instance shared by
  *   all the algorithms instances running in this loop.
  */
 
 void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
 {
+    targets_t            * targets = user_data;
+    target_t             * target;
     ping_event_t         * ping_event;
     const ping_options_t * ping_options;
     ping_data_t          * ping_data;
@@ -246,13 +280,24 @@ void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
     switch (event->type) {
         case ALGORITHM_HAS_TERMINATED:
             ping_data = event->issuer->data;
+            target    = event->issuer->options;
 
             if (ping_data != NULL) { // to prevent to print statistics twice and to print an error-message
-            ping_dump_statistics(ping_data);
+                if (targets->num_targets > 1) {
+                    printf("%s (", target->dst_ip);
+                    address_dump(&target->dst_addr);
+                    printf("):\n");
+                }
+                ping_dump_statistics(ping_data);
             }
 
             pt_stop_instance(loop, event->issuer);
-            pt_loop_terminate(loop);
+            target->instance = NULL;
+
+            // Kill the loop once every host has been pinged
+            if (--targets->num_running == 0) {
+                pt_loop_terminate(loop);
+            }
             break;
 
         case ALGORITHM_EVENT:
@@ -303,54 +348,16 @@ const char * get_protocol_name(int family, bool use_icmp, bool use_tcp, bool use
     return NULL;
 }
 
-//---------------------------------------------------------------------------
-// Main program
-//---------------------------------------------------------------------------
+/**
+ * \brief Translate a host passed in the command-line into an address.
+ * \param dst_ip The host (IP address or FQDN).
+ * \param dst_addr The address_t instance to update.
+ * \return true iif successful
+ */
 
-int main(int argc, char ** argv)
+static bool resolve_destination(const char * dst_ip, address_t * dst_addr)
 {
-    int                       exit_code = EXIT_FAILURE;
-    char                    * version = strdup("version 1.0");
-    const char              * usage = "usage: %s [options] host\n";
-    void                    * algorithm_options = NULL;
-    ping_options_t            ping_options;
-    probe_t                 * probe;
-    pt_loop_t               * loop;
-    int                       family;
-    address_t                 dst_addr;
-    address_t                 src_addr;
-    options_t               * options;
-    char                    * dst_ip;
-    const char              * algorithm_name;
-    const char              * protocol_name;
-    bool                      use_icmp, use_udp, use_tcp;
-
-    // Prepare the commande line options
-    if (!(options = init_options(version))) {
-        fprintf(stderr, "E: Can't initialize options\n");
-        goto ERR_INIT_OPTIONS;
-    }
-
-    // Retrieve values passed in the command-line
-    if (options_parse(options, usage, argv) != 1) {
-        fprintf(stderr, "%s: destination required\n", basename(argv[0]));
-        goto ERR_OPT_PARSE;
-    }
-
-    // We assume that the target IP address is always the last argument
-    dst_ip         = argv[argc - 1];
-    algorithm_name = algorithm_names[0];
-    protocol_name  = protocol_names[0];
-
-    // Checking if there are any conflicts between options passed in the commandline
-    if (!check_options(is_icmp, is_tcp, is_udp, is_tcp_ack, is_ipv4, is_ipv6, flow_label[3],
-                       dst_port[3], src_port[3], protocol_name, algorithm_name)) {
-        goto ERR_CHECK_OPTIONS;
-    }
-
-    use_icmp = is_icmp || strcmp(protocol_name, "icmp") == 0;
-    use_tcp  = is_tcp  || strcmp(protocol_name, "tcp")  == 0;
-    use_udp  = is_udp  || strcmp(protocol_name, "udp")  == 0;
+    int family;
 
     // If not any ip version is set, call address_guess_family.
     // If only one is set to true, set family to AF_INET or AF_INET6
@@ -360,14 +367,40 @@ int main(int argc, char ** argv)
         family = AF_INET6;
     } else {
         // Get address family if not defined by the user
-        if (!address_guess_family(dst_ip, &family)) goto ERR_ADDRESS_GUESS_FAMILY;
+        if (!address_guess_family(dst_ip, &family)) return false;
     }
 
     // Translate the string IP / FQDN into an address_t * instance
-    if (address_from_string(family, dst_ip, &dst_addr) != 0) {
+    if (address_from_string(family, dst_ip, dst_addr) != 0) {
         fprintf(stderr, "E: Invalid destination address %s\n", dst_ip);
-        goto ERR_ADDRESS_IP_FROM_STRING;
+        return false;
     }
+    return true;
+}
+
+/**
+ * \brief Create the probe skeleton toward a given host according to the
+ *    command-line options.
+ * \param dst_ip The host passed in the command-line.
+ * \param dst_addr The corresponding address.
+ * \param use_icmp Pass true to probe using ICMP.
+ * \param use_tcp Pass true to probe using TCP.
+ * \param use_udp Pass true to probe using UDP.
+ * \param interval The time to wait between two probes (in seconds).
+ * \return The newly created probe skeleton, NULL in case of failure.
+ */
+
+static probe_t * make_probe_skel(
+    const char      * dst_ip,
+    const address_t * dst_addr,
+    bool              use_icmp,
+    bool              use_tcp,
+    bool              use_udp,
+    double            interval
+) {
+    probe_t   * probe;
+    address_t   src_addr;
+    int         family = dst_addr->family;
 
     // Probe skeleton definition: IPv4/UDP probe targetting 'dst_ip'
     if (!(probe = probe_create())) {
@@ -383,7 +416,7 @@ int main(int argc, char ** argv)
         NULL
     );
 
-    probe_set_field(probe, ADDRESS("dst_ip", &dst_addr));
+    probe_set_field(probe, ADDRESS("dst_ip", dst_addr));
 
     if (src_ip.s) {  // true if user has specified an interface address (-I)
         if (is_ipv4) {
@@ -402,7 +435,7 @@ int main(int argc, char ** argv)
         }
     }
 
-    probe_set_delay(probe, DOUBLE("delay", send_time[0]));
+    probe_set_delay(probe, DOUBLE("delay", interval));
 
     probe_set_field(probe, I8("ttl", max_ttl[0]));
 
@@ -438,8 +471,6 @@ int main(int argc, char ** argv)
         );
     }
 
-    is_icmp = (!is_tcp) && (!is_udp);
-
     // Resize the packet
     {
         size_t headers_size = probe_get_layer_payload(probe)->segment - probe_get_layer(probe, 0)->segment,
@@ -462,15 +493,123 @@ int main(int argc, char ** argv)
             probe_set_field(probe, BITS("syn", 1, &bit_value));
         }
     }
+    return probe;
 
-    ping_options = ping_get_default_options();
-    algorithm_options = &ping_options;
+ERR_INVALID_PACKET_SIZE:
+ERR_ADDRESS_IP_FROM_STRING:
+ERR_ADDRESS_GUESS_FAMILY:
+    probe_free(probe);
+ERR_PROBE_CREATE:
+    return NULL;
+}
+
+/**
+ * \brief Write the statistics of the running ping instances in the
+ *    OpenMetrics format (see metrics_callback_t).
+ * \param file The output stream.
+ * \param user_data Points to the targets_t instance.
+ */
+
+static void write_metrics(FILE * file, void * user_data)
+{
+    const targets_t  * targets = user_data;
+    const char      ** dst_ips;
+    ping_data_t     ** ping_datas;
+    size_t             i;
+
+    if (!(dst_ips = malloc(targets->num_targets * sizeof(char *))))         goto ERR_MALLOC_DST_IPS;
+    if (!(ping_datas = malloc(targets->num_targets * sizeof(ping_data_t *)))) goto ERR_MALLOC_PING_DATAS;
+
+    for (i = 0; i < targets->num_targets; i++) {
+        dst_ips[i]    = targets->targets[i].dst_ip;
+        ping_datas[i] = targets->targets[i].instance ? targets->targets[i].instance->data : NULL;
+    }
+    ping_write_metrics(file, dst_ips, ping_datas, targets->num_targets);
+
+    free(ping_datas);
+ERR_MALLOC_PING_DATAS:
+    free(dst_ips);
+ERR_MALLOC_DST_IPS:
+    return;
+}
+
+//---------------------------------------------------------------------------
+// Main program
+//---------------------------------------------------------------------------
+
+int main(int argc, char ** argv)
+{
+    int                       exit_code = EXIT_FAILURE;
+    char                    * version = strdup("version 1.0");
+    const char              * usage = "usage: %s [options] host...\n";
+    pt_loop_t               * loop;
+    options_t               * options;
+    char                   ** dst_ips;
+    const char              * algorithm_name;
+    const char              * protocol_name;
+    bool                      use_icmp, use_udp, use_tcp;
+    int                       num_targets;
+    double                    interval, spread;
+    targets_t                 targets;
+    target_t                * target;
+    size_t                    i;
+
+    // Prepare the commande line options
+    if (!(options = init_options(version))) {
+        fprintf(stderr, "E: Can't initialize options\n");
+        goto ERR_INIT_OPTIONS;
+    }
 
-    // Algorithm options (common options)
-    options_ping_init(&ping_options, &dst_addr, send_time[0], max_ttl[0]);
+    // Retrieve values passed in the command-line
+    if ((num_targets = options_parse(options, usage, argv)) < 1) {
+        fprintf(stderr, "%s: destination required\n", basename(argv[0]));
+        goto ERR_OPT_PARSE;
+    }
+
+    // We assume that the target IP addresses are always the last arguments
+    dst_ips        = &argv[argc - num_targets];
+    algorithm_name = algorithm_names[0];
+    protocol_name  = protocol_names[0];
+
+    // Checking if there are any conflicts between options passed in the commandline
+    if (!check_options(is_icmp, is_tcp, is_udp, is_tcp_ack, is_ipv4, is_ipv6, flow_label[3],
+                       dst_port[3], src_port[3], protocol_name, algorithm_name)) {
+        goto ERR_CHECK_OPTIONS;
+    }
+
+    use_icmp = is_icmp || strcmp(protocol_name, "icmp") == 0;
+    use_tcp  = is_tcp  || strcmp(protocol_name, "tcp")  == 0;
+    use_udp  = is_udp  || strcmp(protocol_name, "udp")  == 0;
+    is_icmp  = (!is_tcp) && (!is_udp);
+
+    // The probes sent to the different hosts are interleaved: the i-th
+    // host is pinged i * spread seconds after the first one. The interval
+    // toward each host is raised if needed so that any two consecutive
+    // probes are spaced by spread seconds.
+    spread   = target_interval[0] ? target_interval[0] : send_time[0] / num_targets;
+    interval = spread * num_targets > send_time[0] ? spread * num_targets : send_time[0];
+
+    // Prepare a ping instance per host
+    targets.num_targets = num_targets;
+    targets.num_running = 0;
+    if (!(targets.targets = calloc(num_targets, sizeof(target_t)))) {
+        goto ERR_TARGETS_CALLOC;
+    }
+
+    for (i = 0; i < targets.num_targets; i++) {
+        target = &targets.targets[i];
+        target->dst_ip = dst_ips[i];
+        if (!resolve_destination(target->dst_ip, &target->dst_addr)) goto ERR_TARGET;
+        if (!(target->probe = make_probe_skel(target->dst_ip, &target->dst_addr, use_icmp, use_tcp, use_udp, interval))) goto ERR_TARGET;
+
+        // Algorithm options (common options)
+        target->options = ping_get_default_options();
+        options_ping_init(&target->options, &target->dst_addr, interval, max_ttl[0]);
+        target->options.offset = i * spread;
+    }
 
     // Create libparistraceroute loop
-    if (!(loop = pt_loop_create(loop_handler, NULL))) {
+    if (!(loop = pt_loop_create(loop_handler, &targets))) {
         fprintf(stderr, "E: Cannot create libparistraceroute loop");
         goto ERR_LOOP_CREATE;
     }
@@ -478,14 +617,26 @@ int main(int argc, char ** argv)
     // Set network options (network and verbose)
     options_network_init(loop->network, false);
 
-    printf("paris-ping to %s (", dst_ip);
-    address_dump(&dst_addr);
-    printf(")\n");
+    // Export the statistics of the network layer and of each host
+    if (metrics_address.s
+    && (!pt_loop_set_metrics(loop, metrics_address.s)
+    ||  !metrics_add_source(loop->metrics, write_metrics, &targets))) {
+        fprintf(stderr, "E: Cannot export metrics on %s\n", metrics_address.s);
+        goto ERR_SET_METRICS;
+    }
+
+    for (i = 0; i < targets.num_targets; i++) {
+        target = &targets.targets[i];
+        printf("paris-ping to %s (", target->dst_ip);
+        address_dump(&target->dst_addr);
+        printf(")\n");
 
-    // Add an algorithm instance in the main loop
-    if (!pt_add_instance(loop, algorithm_name, algorithm_options, probe)) {
-        fprintf(stderr, "E: Cannot add the chosen algorithm");
-        goto ERR_INSTANCE;
+        // Add an algorithm instance in the main loop
+        if (!(target->instance = pt_add_instance(loop, algorithm_name, &target->options, target->probe))) {
+            fprintf(stderr, "E: Cannot add the chosen algorithm");
+            goto ERR_INSTANCE;
+        }
+        targets.num_running++;
     }
 
     // Wait for events. They will be catched by handler_user()
@@ -499,21 +650,22 @@ int main(int argc, char ** argv)
     // Leave the program
 ERR_PT_LOOP:
 ERR_INSTANCE:
+ERR_SET_METRICS:
     // pt_loop_free() automatically removes algorithms instances,
     // probe_replies and events from the memory.
     // Options and probe must be manually removed.
     pt_loop_free(loop);
 ERR_LOOP_CREATE:
-    probe_free(probe);
-ERR_INVALID_PACKET_SIZE:
-ERR_PROBE_CREATE:
-ERR_ADDRESS_IP_FROM_STRING:
-ERR_ADDRESS_GUESS_FAMILY:
-    if (errno) perror(gai_strerror(errno));
+ERR_TARGET:
+    for (i = 0; i < targets.num_targets; i++) {
+        probe_free(targets.targets[i].probe);
+    }
+    free(targets.targets);
+ERR_TARGETS_CALLOC:
+    if (exit_code != EXIT_SUCCESS && errno) perror(gai_strerror(errno));
 ERR_CHECK_OPTIONS:
 ERR_OPT_PARSE:
 ERR_INIT_OPTIONS:
     free(version);
     exit(exit_code);
 }
-
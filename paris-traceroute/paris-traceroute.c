@@ -1,3 +1,4 @@
+#include "use.h"
 #include "config.h"
 
 #include <stdlib.h>                  // malloc...
@@ -7,21 +8,51 @@
 #include <libgen.h>                  // basename
 #include <string.h>                  // strcmp
 #include <stdint.h>                  // UINT16_MAX
+#include <inttypes.h>                // PRIu64
 #include <float.h>                   // DBL_MAX
+#include <limits.h>                  // INT_MAX
 #include <sys/types.h>               // gai_strerror
 #include <sys/socket.h>              // gai_strerror, AF_INET, AF_INET6
 #include <netdb.h>                   // gai_strerror
+#include <time.h>                    // clock_gettime, time
+#include <unistd.h>                  // STDOUT_FILENO, unlink
+#include <fcntl.h>                   // open
+#include <sys/mman.h>                // mmap, munmap, madvise
+#include <sys/stat.h>                // fstat
+#include <sys/un.h>                  // sockaddr_un
+#ifdef USE_KQUEUE
+#    include <sys/event.h>           // kqueue, kevent
+#else
+#    include <sys/epoll.h>           // epoll_*
+#endif
+#include <arpa/inet.h>               // inet_pton, inet_ntop
+#include <pthread.h>                 // pthread_mutex_*
 
 #include "common.h"                  // ELEMENT_DUMP
 #include "optparse.h"                // opt_*()
 #include "pt_loop.h"                 // pt_loop_t
+#include "pt_shards.h"               // pt_shards_t
 #include "probe.h"                   // probe_t
 #include "lattice.h"                 // lattice_t
 #include "algorithm.h"               // algorithm_instance_t
+#include "algorithms/alias.h"        // alias_*_t
 #include "algorithms/mda.h"          // mda_*_t
+#include "algorithms/mda/topology.h" // mda_topology_*
+#include "algorithms/monitor.h"      // monitor_*_t
+#include "algorithms/pmtud.h"        // pmtud_*_t
 #include "algorithms/traceroute.h"   // traceroute_options_t
+#include "algorithms/stateless.h"    // stateless_options_t
 #include "address.h"                 // address_to_string
 #include "options.h"                 // options_*
+#include "asmap.h"                   // asmap_*
+#include "whois.h"                   // whois_set_asmap
+#include "cachefile.h"               // cachefile_*
+#include "output.h"                  // output_*
+#include "demux.h"                   // demux_server_*
+#include "broker.h"                  // broker_server_*
+#include "archive.h"                 // archive_*
+#include "deque.h"                   // deque_t
+#include "dynarray.h"                // dynarray_t
 
 //---------------------------------------------------------------------------
 // Command line stuff
@@ -29,7 +60,7 @@
 
 #define TRACEROUTE_HELP_4  "Use IPv4."
 #define TRACEROUTE_HELP_6  "Use IPv6."
-#define TRACEROUTE_HELP_a  "Set the traceroute algorithm (default: 'paris-traceroute'). Valid values are 'paris-traceroute' and 'mda'."
+#define TRACEROUTE_HELP_a  "Set the traceroute algorithm (default: 'paris-traceroute'). Valid values are 'paris-traceroute', 'mda', 'mda-lite', 'pmtud' (path MTU toward each hop, see --max-mtu), 'monitor' (latency toward each hop, see --trains) and 'stateless' (IPv4 only, requires -F)."
 #define TRACEROUTE_HELP_d  "Print libparistraceroute debug information."
 #define TRACEROUTE_HELP_p  "Set PORT as destination port (default: 33457)."
 #define TRACEROUTE_HELP_s  "Set PORT as source port (default: 33456)."
@@ -38,6 +69,27 @@
 #define TRACEROUTE_HELP_T  "Use TCP for tracerouting."
 #define TRACEROUTE_HELP_U  "Use UDP for tracerouting. The destination port is set by default to 53."
 #define TRACEROUTE_HELP_z  "Minimal time interval between probes (default 0).  If the value is more than 10, then it specifies a number in milliseconds, else it is a number of seconds (float point values allowed  too)"
+#define TRACEROUTE_HELP_F  "Trace the destinations listed in FILE (one per line, '-' for the standard input) instead of a single host. Each trace is printed once complete. With -a mda or -a mda-lite, the traces running at once share the next hops enumerated by each other, which are only verified. With -a stateless, every (destination, TTL) pair is probed once, in a random order, and each reply is printed as soon as it is received. FILE may also list pre-resolved destinations: 'PTADDR4\\n' (resp. 'PTADDR6\\n') followed by IPv4 (resp. IPv6) addresses in network byte order."
+#define TRACEROUTE_HELP_K  "Set the number of destinations traced simultaneously when using -F (default: 16)."
+#define TRACEROUTE_HELP_resolvers "Set the maximum number of hostnames listed in the file passed with -F resolved simultaneously (default: 8). The IP addresses are not resolved."
+#define TRACEROUTE_HELP_threads "Split the destinations listed in the file passed with -F among NUM threads, each of them pinned to a core and owning its sockets (default: 1). Each thread traces up to -K destinations at once, and steals the destinations queued by the busiest threads once it has none left. The destinations are all read (and their hostnames resolved) before tracing. Only supported by -a paris-traceroute."
+#define TRACEROUTE_HELP_seed   "Set the seed selecting the order of the probes when using -a stateless (default: random). The seed is printed when the sweep starts."
+#define TRACEROUTE_HELP_offset "Skip the OFFSET first probes when using -a stateless, e.g. to resume an interrupted sweep. Requires --seed."
+#define TRACEROUTE_HELP_asmap        "Look up the origin AS (see -A) in the AS map FILE instead of querying DNS and whois servers."
+#define TRACEROUTE_HELP_pfx2as       "Build the AS map passed to --asmap out of the prefix to AS dump PFX2AS (e.g. a CAIDA RouteViews pfx2as file) before tracing."
+#define TRACEROUTE_HELP_cache_file   "Save the hostnames and origin AS looked up in FILE, and reuse the ones saved by the previous runs until they expire."
+#define TRACEROUTE_HELP_format       "Set the output format (default: 'text'). Valid values are 'text', 'json' (JSON Lines, one record per reply) and 'binary'."
+#define TRACEROUTE_HELP_checkpoint   "Save the progress of -F in FILE every few seconds, so that an interrupted run can be resumed with --resume."
+#define TRACEROUTE_HELP_resume       "Resume the run saved in the file passed with --checkpoint: the destinations already traced (or, with -a stateless, the probes already sent) are skipped. The output should be appended to the output of the interrupted run."
+#define TRACEROUTE_HELP_daemon       "Run as a daemon accepting measurement requests on the UNIX socket PATH instead of tracing a single host. Each request is a JSON object on its own line, e.g. {\"dst\":\"8.8.8.8\",\"algorithm\":\"mda\",\"protocol\":\"icmp\",\"max_ttl\":20} (only 'dst' is required; 'min_ttl' and 'num_queries' may also be set), and its results are streamed back in the format set by --format (default: 'json'). The other options set the defaults of the requests."
+#define TRACEROUTE_HELP_coordinate   "Trace the destinations passed with -F from the daemons (see --daemon) listening on the comma-separated UNIX sockets PATHS, e.g. forwarded from remote vantage points with 'ssh -L'. Each daemon traces up to -K destinations at once, and is handed the next ones as it completes them, so that the fastest vantage points trace the most destinations. Their results are merged in the output (requires --format json), each record being tagged with the socket of its daemon ('vp')."
+#define TRACEROUTE_HELP_demux_server "Run as a demultiplexer on the UNIX socket PATH instead of tracing a single host: the ICMP replies received by this host are sniffed once, and routed to the paris-traceroute and paris-ping processes started with --demux-client PATH according to their probe IDs."
+#define TRACEROUTE_HELP_broker_server "Run as a broker on the UNIX socket PATH instead of tracing a single host: the raw sockets are opened and tuned by this (privileged) process, and handed over to the unprivileged paris-traceroute and paris-ping processes started with --broker-client PATH."
+#define TRACEROUTE_HELP_broker_buffer "Set the size of the send and receive buffers of the sockets opened by --broker-server (default: 4194304, 0 keeps the default of the system)."
+#define TRACEROUTE_HELP_aliases      "Once the traces are complete (with -a mda or -a mda-lite), resolve the aliases among the IPv4 interfaces they have discovered, by probing each of them several times (see --alias-rounds). The routers made of several interfaces are then printed (with --format, each of their interfaces is mapped to the first one)."
+#define TRACEROUTE_HELP_archive      "Also append the records of the structured output (see --format) to the indexed archive DIR, which can be queried with --query. Not supported by --daemon and --coordinate."
+#define TRACEROUTE_HELP_query        "Print the records of the archive passed with --archive matching QUERY instead of tracing a host, e.g. 'via=192.0.2.1,since=-7d'. QUERY is a comma-separated list of criteria: 'dst=ADDRESS', 'via=ADDRESS' (an interface which has replied, or the target of a link), 'asn=ASN', 'since=TIME' and 'until=TIME', where TIME is a number of seconds since the Epoch, or a number of seconds ago prefixed with '-' (or of minutes, hours, days, with the suffix 'm', 'h', 'd'). The records are printed in the format set by --format (default: 'json'), along with the time they have been archived."
+#define TRACEROUTE_HELP_compress     "Compress the output set by --format on a dedicated thread. Valid values are 'none' (default), 'gzip' and 'zstd' (if supported by this build)."
 #define TEXT               "paris-traceroute - print the IP-level path toward a given IP host."
 #define TEXT_OPTIONS       "Options:"
 
@@ -54,9 +106,23 @@
 const char * algorithm_names[] = {
     "paris-traceroute", // default value
     "mda",
+    "mda-lite",
+    "pmtud",
+    "monitor",
+    "stateless",
     NULL
 };
 
+const char * format_names[] = {
+    "text", // default value
+    "json",
+    "binary",
+    NULL
+};
+
+// The structured output (see --format), NULL if the text output is used
+static output_t * output = NULL;
+
 static bool is_ipv4  = false;
 static bool is_ipv6  = false;
 static bool is_tcp   = false;
@@ -76,6 +142,27 @@ const char * protocol_names[] = {
 static int    dst_port[4]    = {33457,  0,   UINT16_MAX, 0};
 static int    src_port[4]    = {33456,  0,   UINT16_MAX, 0};
 static double send_time[4]   = {1,      1,   DBL_MAX,    0};
+static int    concurrency[4] = {16,     1,   UINT16_MAX, 0};
+static int    seed[4]        = {0,      0,   INT_MAX,    0};
+static int    offset[4]      = {0,      0,   INT_MAX,    0};
+static int    resolvers[4]   = {8,      1,   LOOKUP_POOL_MAX_THREADS, 0};
+static int    threads[4]     = {1,      1,   UINT16_MAX, 0};
+static int    broker_buffer[4] = {BROKER_DEFAULT_BUFFER_SIZE, 0, INT_MAX, 0};
+
+static struct opt_str targets_filename = {NULL, 0};
+static struct opt_str asmap_filename   = {NULL, 0};
+static struct opt_str pfx2as_filename  = {NULL, 0};
+static struct opt_str cache_filename   = {NULL, 0};
+static struct opt_str compression_name = {NULL, 0};
+static struct opt_str checkpoint_filename = {NULL, 0};
+static struct opt_str daemon_path         = {NULL, 0};
+static struct opt_str coordinate_paths    = {NULL, 0};
+static struct opt_str demux_server_path   = {NULL, 0};
+static struct opt_str broker_server_path  = {NULL, 0};
+static struct opt_str archive_directory   = {NULL, 0};
+static struct opt_str query_string        = {NULL, 0};
+static bool           is_resume           = false;
+static bool           is_aliases          = false;
 
 struct opt_spec runnable_options[] = {
     // action                 sf          lf                   metavar             help          data
@@ -88,6 +175,27 @@ struct opt_spec runnable_options[] = {
     {opt_store_int_lim_en,    "p",        "--dst-port",        "PORT",             TRACEROUTE_HELP_p,       dst_port},
     {opt_store_int_lim_en,    "s",        "--src-port",        "PORT",             TRACEROUTE_HELP_s,       src_port},
     {opt_store_double_lim_en, "z",        OPT_NO_LF,           "WAIT",             TRACEROUTE_HELP_z,       send_time},
+    {opt_store_str,           "F",        "--file",            "FILE",             TRACEROUTE_HELP_F,       &targets_filename},
+    {opt_store_int_lim_en,    "K",        "--concurrency",     "NUM",              TRACEROUTE_HELP_K,       concurrency},
+    {opt_store_int_lim_en,    OPT_NO_SF,  "--resolvers",       "NUM",              TRACEROUTE_HELP_resolvers, resolvers},
+    {opt_store_int_lim_en,    OPT_NO_SF,  "--threads",         "NUM",              TRACEROUTE_HELP_threads, threads},
+    {opt_store_int_lim_en,    OPT_NO_SF,  "--seed",            "SEED",             TRACEROUTE_HELP_seed,    seed},
+    {opt_store_int_lim_en,    OPT_NO_SF,  "--offset",          "OFFSET",           TRACEROUTE_HELP_offset,  offset},
+    {opt_store_str,           OPT_NO_SF,  "--asmap",           "FILE",             TRACEROUTE_HELP_asmap,        &asmap_filename},
+    {opt_store_str,           OPT_NO_SF,  "--pfx2as",          "PFX2AS",           TRACEROUTE_HELP_pfx2as,       &pfx2as_filename},
+    {opt_store_str,           OPT_NO_SF,  "--cache-file",      "FILE",             TRACEROUTE_HELP_cache_file,   &cache_filename},
+    {opt_store_choice,        OPT_NO_SF,  "--format",          "FORMAT",           TRACEROUTE_HELP_format,       format_names},
+    {opt_store_str,           OPT_NO_SF,  "--checkpoint",      "FILE",             TRACEROUTE_HELP_checkpoint,   &checkpoint_filename},
+    {opt_store_1,             OPT_NO_SF,  "--resume",          OPT_NO_METAVAR,     TRACEROUTE_HELP_resume,       &is_resume},
+    {opt_store_str,           OPT_NO_SF,  "--compress",        "COMPRESSION",      TRACEROUTE_HELP_compress,     &compression_name},
+    {opt_store_str,           OPT_NO_SF,  "--daemon",          "PATH",             TRACEROUTE_HELP_daemon,       &daemon_path},
+    {opt_store_str,           OPT_NO_SF,  "--coordinate",      "PATHS",            TRACEROUTE_HELP_coordinate,   &coordinate_paths},
+    {opt_store_str,           OPT_NO_SF,  "--demux-server",    "PATH",             TRACEROUTE_HELP_demux_server, &demux_server_path},
+    {opt_store_str,           OPT_NO_SF,  "--broker-server",   "PATH",             TRACEROUTE_HELP_broker_server, &broker_server_path},
+    {opt_store_int_lim_en,    OPT_NO_SF,  "--broker-buffer",   "BYTES",            TRACEROUTE_HELP_broker_buffer, broker_buffer},
+    {opt_store_str,           OPT_NO_SF,  "--archive",         "DIR",              TRACEROUTE_HELP_archive,      &archive_directory},
+    {opt_store_str,           OPT_NO_SF,  "--query",           "QUERY",            TRACEROUTE_HELP_query,        &query_string},
+    {opt_store_1,             OPT_NO_SF,  "--aliases",         OPT_NO_METAVAR,     TRACEROUTE_HELP_aliases,      &is_aliases},
     {opt_store_1,             "I",        "--icmp",            OPT_NO_METAVAR,     TRACEROUTE_HELP_I,       &is_icmp},
     {opt_store_choice,        "P",        "--protocol",        "PROTOCOL",         TRACEROUTE_HELP_P,       protocol_names},
     {opt_store_1,             "T",        "--tcp",             OPT_NO_METAVAR,     TRACEROUTE_HELP_T,       &is_tcp},
@@ -111,6 +219,9 @@ static options_t * init_options(char * version) {
     options_add_optspecs(options, runnable_options);
     options_add_optspecs(options, traceroute_get_options());
     options_add_optspecs(options, mda_get_options());
+    options_add_optspecs(options, pmtud_get_options());
+    options_add_optspecs(options, monitor_get_options());
+    options_add_optspecs(options, alias_get_options());
     options_add_optspecs(options, network_get_options());
     options_add_common  (options, version);
     return options;
@@ -161,14 +272,42 @@ static bool check_ports(bool is_icmp, int dst_port_enabled, int src_port_enabled
     return true;
 }
 
+/**
+ * \brief Check whether an algorithm is a variant of mda.
+ * \param algorithm_name The name of the algorithm.
+ * \return true iif it runs mda or mda-lite.
+ */
+
+static bool is_mda(const char * algorithm_name)
+{
+    return strcmp(algorithm_name, "mda") == 0
+        || strcmp(algorithm_name, "mda-lite") == 0;
+}
+
 static bool check_algorithm(const char * algorithm_name)
 {
     if (options_mda_get_is_set()) {
-        if (strcmp(algorithm_name, "mda") != 0) {
+        if (!is_mda(algorithm_name)) {
             fprintf(stderr, "You cannot pass options related to mda when using another algorithm\n");
             return false;
         }
     }
+    if (options_pmtud_get_is_set() && strcmp(algorithm_name, "pmtud") != 0) {
+        fprintf(stderr, "--max-mtu requires -a pmtud\n");
+        return false;
+    }
+    if (options_monitor_get_is_set() && strcmp(algorithm_name, "monitor") != 0) {
+        fprintf(stderr, "--trains and --train-interval require -a monitor\n");
+        return false;
+    }
+    if (is_aliases && !is_mda(algorithm_name)) {
+        fprintf(stderr, "--aliases requires -a mda or -a mda-lite\n");
+        return false;
+    }
+    if (options_alias_get_is_set() && !is_aliases) {
+        fprintf(stderr, "--alias-rounds requires --aliases\n");
+        return false;
+    }
     return true;
 }
 
@@ -193,6 +332,148 @@ static bool check_options(
 // Command-line / libparistraceroute translation
 //---------------------------------------------------------------------------
 
+/**
+ * \brief Write the record ending a trace in the structured output.
+ * \param output The output_t instance.
+ * \param dst_addr The destination.
+ */
+
+static void end_output(output_t * output, const address_t * dst_addr)
+{
+    output_record_t record;
+
+    memset(&record, 0, sizeof(output_record_t));
+    record.type = OUTPUT_RECORD_END;
+    record.dst  = dst_addr;
+    output_write_record(output, &record);
+}
+
+//---------------------------------------------------------------------------
+// Alias resolution (see --aliases)
+//---------------------------------------------------------------------------
+
+/**
+ * \struct aliases_t
+ * \brief The interfaces discovered by the traces, whose aliases are
+ *    resolved by a single alias instance once every trace is complete.
+ */
+
+typedef struct {
+    alias_options_t   options;        /**< Options of the alias instance */
+    address_t       * interfaces;     /**< The interfaces discovered so far (duplicates included) */
+    size_t            num_interfaces; /**< Number of interfaces */
+    size_t            max_interfaces; /**< Number of interfaces allocated */
+    probe_t         * probe_skel;     /**< Skeleton of the probes of the alias instance, NULL if not started */
+    const address_t * dst_addr;       /**< The destination of the records (see --format), NULL in batch mode */
+} aliases_t;
+
+static aliases_t aliases;
+
+/**
+ * \brief Collect the interfaces discovered by an mda instance.
+ * \param mda_data The data of the mda instance.
+ * \return true iif successful
+ */
+
+static bool aliases_add(const mda_data_t * mda_data)
+{
+    address_t * interfaces;
+    size_t      i, max_interfaces;
+
+    for (i = 0; i < mda_data->index->max_addresses; i++) {
+        if (!mda_data->index->addresses[i].elt) continue;
+        if (aliases.num_interfaces == aliases.max_interfaces) {
+            max_interfaces = aliases.max_interfaces ? 2 * aliases.max_interfaces : MDA_INDEX_INITIAL_SIZE;
+            if (!(interfaces = realloc(aliases.interfaces, max_interfaces * sizeof(address_t)))) return false;
+            aliases.interfaces     = interfaces;
+            aliases.max_interfaces = max_interfaces;
+        }
+        aliases.interfaces[aliases.num_interfaces++] = mda_data->index->addresses[i].address;
+    }
+    return true;
+}
+
+/**
+ * \brief Start resolving the aliases among the collected interfaces.
+ * \param loop The main loop.
+ * \param probe_skel A probe skeleton of the traces. It is duplicated.
+ * \param dst_addr The destination of the records, NULL if none.
+ * \return true iif successful
+ */
+
+static bool aliases_start(pt_loop_t * loop, const probe_t * probe_skel, const address_t * dst_addr)
+{
+    if (!(aliases.probe_skel = probe_dup(probe_skel))) goto ERR_PROBE_DUP;
+    aliases.options                = alias_get_default_options();
+    options_alias_init(&aliases.options);
+    aliases.options.interfaces     = aliases.interfaces;
+    aliases.options.num_interfaces = aliases.num_interfaces;
+    aliases.dst_addr               = dst_addr;
+
+    if (!output) printf("\nRouters:\n");
+    if (!pt_add_instance(loop, "alias", &aliases.options, aliases.probe_skel)) {
+        fprintf(stderr, "E: Cannot resolve the aliases\n");
+        goto ERR_ADD_INSTANCE;
+    }
+    return true;
+
+ERR_ADD_INSTANCE:
+    probe_free(aliases.probe_skel);
+    aliases.probe_skel = NULL;
+ERR_PROBE_DUP:
+    return false;
+}
+
+/**
+ * \brief Handle the events raised by the alias instance (in text mode or
+ *    with --format).
+ * \param loop The main loop.
+ * \param event The event raised by libparistraceroute.
+ * \return true iif the alias instance has terminated.
+ */
+
+static bool aliases_handle_event(pt_loop_t * loop, event_t * event)
+{
+    alias_data_t  * alias_data;
+    alias_event_t * alias_event;
+
+    switch (event->type) {
+        case ALGORITHM_HAS_TERMINATED:
+            alias_data = event->issuer->data;
+            if (!output) {
+                printf("%zu probes sent\n", alias_data ? alias_data->num_probes : 0);
+            }
+            alias_data_free(alias_data);
+            event->issuer->data = NULL;
+            pt_stop_instance(loop, event->issuer);
+            return true;
+        case ALGORITHM_EVENT:
+            alias_event = event->data;
+            if (!output) {
+                alias_event_fdump(stdout, alias_event);
+            } else if (alias_event->type == ALIAS_ROUTER) {
+                alias_router_output(output, aliases.dst_addr, alias_event->data);
+                output_flush(output);
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+/**
+ * \brief Release the collected interfaces and the probe skeleton of the
+ *    alias instance. It must have been released (see pt_loop_free).
+ */
+
+static void aliases_free()
+{
+    free(aliases.interfaces);
+    if (aliases.probe_skel) probe_free(aliases.probe_skel);
+    memset(&aliases, 0, sizeof(aliases_t));
+}
+
 /**
  * \brief Handle events raised by libparistraceroute.
  * \param loop The main loop.
@@ -208,33 +489,73 @@ void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
     const traceroute_data_t    * traceroute_data;
     mda_event_t                * mda_event;
     mda_data_t                 * mda_data;
+    pmtud_data_t               * pmtud_data;
+    monitor_data_t             * monitor_data;
     const char                 * algorithm_name;
+    bool                         has_aliases = false;
+
+    // The alias instance is started once the trace is complete
+    if (event->issuer && strcmp(event->issuer->algorithm->name, "alias") == 0) {
+        if (aliases_handle_event(loop, event)) {
+            pt_loop_terminate(loop);
+        }
+        event_free(event);
+        return;
+    }
 
     switch (event->type) {
         case ALGORITHM_HAS_TERMINATED:
             algorithm_name = event->issuer->algorithm->name;
-            if (strcmp(algorithm_name, "mda") == 0) {
+            if (output) {
+                end_output(output, ((const traceroute_options_t *) event->issuer->options)->dst_addr);
+            }
+            if (is_mda(algorithm_name)) {
                 mda_data = event->issuer->data;
-                printf("Lattice:\n");
-                lattice_dump(mda_data->lattice, (ELEMENT_DUMP) mda_lattice_elt_dump);
-                printf("\n");
+                if (!output) {
+                    printf("Lattice:\n");
+                    lattice_dump(mda_data->lattice, (ELEMENT_DUMP) mda_lattice_elt_dump);
+                    printf("\n");
+                    printf("%zu probes sent\n", mda_data->num_probes);
+                }
+                has_aliases = is_aliases
+                    && aliases_add(mda_data)
+                    && aliases_start(loop, event->issuer->probe_skel, ((const traceroute_options_t *) event->issuer->options)->dst_addr);
                 mda_data_free(mda_data);
+            } else if (strcmp(algorithm_name, "pmtud") == 0) {
+                pmtud_data = event->issuer->data;
+                printf("%zu probes sent\n", pmtud_data->num_probes);
+                pmtud_data_free(pmtud_data);
+                event->issuer->data = NULL;
+            } else if (strcmp(algorithm_name, "monitor") == 0) {
+                monitor_data = event->issuer->data;
+                if (!output) {
+                    monitor_statistics_fdump(stdout, monitor_data, event->issuer->options);
+                }
+                monitor_data_free(monitor_data);
+                event->issuer->data = NULL;
             }
 
             // Tell to the algorithm it can free its data
             pt_stop_instance(loop, event->issuer);
 
-            // Kill the loop
-            pt_loop_terminate(loop);
+            // Kill the loop, unless the aliases are being resolved
+            if (!has_aliases) {
+                pt_loop_terminate(loop);
+            }
             break;
         case ALGORITHM_EVENT:
             algorithm_name = event->issuer->algorithm->name;
-            if (strcmp(algorithm_name, "mda") == 0) {
+            if (is_mda(algorithm_name)) {
                 mda_event = event->data;
                 traceroute_options = event->issuer->options; // mda_options inherits traceroute_options
                 switch (mda_event->type) {
                     case MDA_NEW_LINK:
-                        mda_link_dump(mda_event->data, traceroute_options->do_resolv);
+                        if (output) {
+                            mda_link_output(output, traceroute_options->dst_addr, mda_event->data, traceroute_options->do_resolv);
+                            output_flush(output);
+                        } else {
+                            mda_link_dump(mda_event->data, traceroute_options->do_resolv);
+                        }
                         break;
                     default:
                         break;
@@ -244,9 +565,23 @@ void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
                 traceroute_options = event->issuer->options;
                 traceroute_data    = event->issuer->data;
 
-                // Forward this event to the default traceroute handler
-                // See libparistraceroute/algorithms/traceroute.c
-                traceroute_handler(loop, traceroute_event, traceroute_options, traceroute_data);
+                if (output) {
+                    traceroute_event_output(output, traceroute_event, traceroute_options);
+                    output_flush(output);
+                } else {
+                    // Forward this event to the default traceroute handler
+                    // See libparistraceroute/algorithms/traceroute.c
+                    traceroute_handler(loop, traceroute_event, traceroute_options, traceroute_data);
+                }
+            } else if (strcmp(algorithm_name, "pmtud") == 0) {
+                pmtud_event_fdump(stdout, event->data, event->issuer->options);
+            } else if (strcmp(algorithm_name, "monitor") == 0) {
+                if (output) {
+                    monitor_event_output(output, event->data, event->issuer->options);
+                    output_flush(output);
+                } else {
+                    monitor_event_fdump(stdout, event->data, event->issuer->options);
+                }
             }
             break;
         default:
@@ -289,87 +624,87 @@ const char * get_protocol_name(int family, bool use_icmp, bool use_tcp, bool use
     return NULL;
 }
 
-//---------------------------------------------------------------------------
-// Main program
-//---------------------------------------------------------------------------
+/**
+ * \brief Retrieve the family of the destinations set by the user.
+ * \return AF_INET (-4), AF_INET6 (-6), or AF_UNSPEC if it must be guessed.
+ */
 
-int main(int argc, char ** argv)
+static int get_destination_family()
 {
-    int                       exit_code = EXIT_FAILURE;
-    char                    * version = strdup("version 1.0");
-    const char              * usage = "usage: %s [options] host\n";
-    void                    * algorithm_options;
-    traceroute_options_t      traceroute_options;
-    traceroute_options_t    * ptraceroute_options;
-    mda_options_t             mda_options;
-    probe_t                 * probe;
-    pt_loop_t               * loop;
-    int                       family;
-    address_t                 dst_addr;
-    options_t               * options;
-    char                    * dst_ip;
-    const char              * algorithm_name;
-    const char              * protocol_name;
-    bool                      use_icmp, use_udp, use_tcp;
+    return is_ipv4 ? AF_INET : is_ipv6 ? AF_INET6 : AF_UNSPEC;
+}
 
-    // Prepare the commande line options
-    if (!(options = init_options(version))) {
-        fprintf(stderr, "E: Can't initialize options\n");
-        goto ERR_INIT_OPTIONS;
-    }
+/**
+ * \brief Translate a destination passed by the user into an address_t if
+ *    it is an IP address, without any DNS lookup.
+ * \param dst_ip The IP address or the FQDN of the destination.
+ * \param dst_addr The address_t instance to update.
+ * \return true iif dst_ip is an IP address of the family set by the user
+ *    (if any). Otherwise, it must be resolved (see resolve_destination).
+ */
 
-    // Retrieve values passed in the command-line
-    if (options_parse(options, usage, argv) != 1) {
-        fprintf(stderr, "%s: destination required\n", basename(argv[0]));
-        goto ERR_OPT_PARSE;
+static bool parse_destination(const char * dst_ip, address_t * dst_addr)
+{
+    memset(dst_addr, 0, sizeof(address_t));
+    if (!is_ipv6 && inet_pton(AF_INET, dst_ip, &dst_addr->ip.ipv4) == 1) {
+        dst_addr->family = AF_INET;
+    } else if (!is_ipv4 && inet_pton(AF_INET6, dst_ip, &dst_addr->ip.ipv6) == 1) {
+        dst_addr->family = AF_INET6;
     }
+    return dst_addr->family != 0;
+}
 
-    // We assume that the target IP address is always the last argument
-    dst_ip         = argv[argc - 1];
-    algorithm_name = algorithm_names[0];
-    protocol_name  = protocol_names[0];
-
-    // Checking if there is any conflicts between options passed in the commandline
-    if (!check_options(is_icmp, is_tcp, is_udp, is_ipv4, is_ipv6, dst_port[3], src_port[3], protocol_name, algorithm_name)) {
-        goto ERR_CHECK_OPTIONS;
-    }
+/**
+ * \brief Translate a destination passed by the user into an address_t.
+ * \param dst_ip The IP address or the FQDN of the destination.
+ * \param dst_addr The address_t instance to update.
+ * \return true iif successful
+ */
 
-    use_icmp = is_icmp || strcmp(protocol_name, "icmp") == 0;
-    use_tcp  = is_tcp  || strcmp(protocol_name, "tcp")  == 0;
-    use_udp  = is_udp  || strcmp(protocol_name, "udp")  == 0;
+static bool resolve_destination(const char * dst_ip, address_t * dst_addr)
+{
+    int family = get_destination_family();
 
-    // If not any ip version is set, call address_guess_family.
-    // If only one is set to true, set family to AF_INET or AF_INET6
-    if (is_ipv4) {
-        family = AF_INET;
-    } else if (is_ipv6) {
-        family = AF_INET6;
-    } else {
-        // Get address family if not defined by the user
-        if (!address_guess_family(dst_ip, &family)) goto ERR_ADDRESS_GUESS_FAMILY;
-    }
+    // Get address family if not defined by the user
+    if (family == AF_UNSPEC && !address_guess_family(dst_ip, &family)) return false;
 
     // Translate the string IP / FQDN into an address_t * instance
-    if (address_from_string(family, dst_ip, &dst_addr) != 0) {
+    if (address_from_string(family, dst_ip, dst_addr) != 0) {
         fprintf(stderr, "E: Invalid destination address %s\n", dst_ip);
-        goto ERR_ADDRESS_IP_FROM_STRING;
+        return false;
     }
+    return true;
+}
+
+/**
+ * \brief Create the probe skeleton toward a given destination according
+ *    to the command-line options.
+ * \param dst_addr The destination.
+ * \param use_icmp Pass true to probe using ICMP.
+ * \param use_tcp Pass true to probe using TCP.
+ * \param use_udp Pass true to probe using UDP.
+ * \return The newly created probe skeleton, NULL in case of failure.
+ */
+
+static probe_t * make_probe_skel(const address_t * dst_addr, bool use_icmp, bool use_tcp, bool use_udp)
+{
+    probe_t * probe;
 
     // Probe skeleton definition: IPv4/UDP probe targetting 'dst_ip'
     if (!(probe = probe_create())) {
         fprintf(stderr,"E: Cannot create probe skeleton");
-        goto ERR_PROBE_CREATE;
+        return NULL;
     }
 
     // Prepare the probe skeleton
     probe_set_protocols(
         probe,
-        get_ip_protocol_name(family),                          // "ipv4"   | "ipv6"
-        get_protocol_name(family, use_icmp, use_tcp, use_udp), // "icmpv4" | "icmpv6" | "tcp" | "udp"
+        get_ip_protocol_name(dst_addr->family),                          // "ipv4"   | "ipv6"
+        get_protocol_name(dst_addr->family, use_icmp, use_tcp, use_udp), // "icmpv4" | "icmpv6" | "tcp" | "udp"
         NULL
     );
 
-    probe_set_field(probe, ADDRESS("dst_ip", &dst_addr));
+    probe_set_field(probe, ADDRESS("dst_ip", dst_addr));
 
     if (send_time[3]) {
         if(send_time[0] <= 10) { // seconds
@@ -402,76 +737,2606 @@ int main(int argc, char ** argv)
             NULL
         );
 
-        // Resize payload (it will be use to set our customized checksum in the {TCP, UDP} layer)
-        probe_payload_resize(probe, 2);
+        if (use_tcp && options_network_get_seq_tags()) {
+            // The tag is carried in the sequence number (see --seq-tags):
+            // send a SYN, so that the destination answers a SYN/ACK or a RST.
+            int bit_value = 1;
+            probe_set_field(probe, BITS("syn", 1, &bit_value));
+        } else {
+            // Resize payload (it will be use to set our customized checksum in the {TCP, UDP} layer)
+            probe_payload_resize(probe, 2);
+        }
     }
 
-    // Algorithm options (dedicated options)
-    if (strcmp(algorithm_name, "paris-traceroute") == 0) {
-        traceroute_options  = traceroute_get_default_options();
-        ptraceroute_options = &traceroute_options;
-        algorithm_options   = &traceroute_options;
-        algorithm_name      = "traceroute";
-    } else if ((strcmp(algorithm_name, "mda") == 0) || options_mda_get_is_set()) {
-        mda_options         = mda_get_default_options();
-        ptraceroute_options = &mda_options.traceroute_options;
-        algorithm_options   = &mda_options;
-        options_mda_init(&mda_options);
-    } else {
-        fprintf(stderr, "E: Unknown algorithm");
-        goto ERR_UNKNOWN_ALGORITHM;
+    return probe;
+}
+
+/**
+ * \brief Print the header of a trace.
+ * \param out The output stream.
+ * \param algorithm_name The name of the algorithm.
+ * \param dst_ip The destination passed by the user.
+ * \param dst_addr The corresponding address.
+ * \param max_ttl The maximum TTL.
+ * \param probe The probe skeleton.
+ */
+
+static void header_fdump(
+    FILE            * out,
+    const char      * algorithm_name,
+    const char      * dst_ip,
+    const address_t * dst_addr,
+    unsigned          max_ttl,
+    const probe_t   * probe
+) {
+    fprintf(out, "%s to %s (", algorithm_name, dst_ip);
+    address_fdump(out, dst_addr);
+    fprintf(out, "), %u hops max, %u bytes packets\n",
+        max_ttl,
+        (unsigned int) packet_get_size(probe->packet)
+    );
+}
+
+/**
+ * \brief Write the record starting a trace in the structured output.
+ * \param output The output_t instance.
+ * \param algorithm_name The name of the algorithm.
+ * \param dst_addr The destination.
+ * \param max_ttl The maximum TTL.
+ * \param probe The probe skeleton.
+ */
+
+static void header_output(
+    output_t        * output,
+    const char      * algorithm_name,
+    const address_t * dst_addr,
+    unsigned          max_ttl,
+    const probe_t   * probe
+) {
+    output_record_t record;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(&record, 0, sizeof(output_record_t));
+    record.type      = OUTPUT_RECORD_TRACE;
+    record.time      = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    record.dst       = dst_addr;
+    record.max_ttl   = max_ttl;
+    record.size      = packet_get_size(probe->packet);
+    record.algorithm = algorithm_name;
+    output_write_record(output, &record);
+}
+
+//---------------------------------------------------------------------------
+// Checkpoints (see --checkpoint)
+//---------------------------------------------------------------------------
+
+#define CHECKPOINT_MAGIC    "paris-traceroute-checkpoint 1"
+
+// Minimal delay between two checkpoints (in seconds)
+#define CHECKPOINT_INTERVAL 10
+
+/**
+ * \struct checkpoint_t
+ * \brief The progress of a run using -F. The destinations are identified
+ *    by their index in the input.
+ *
+ * The checkpoint file starts with CHECKPOINT_MAGIC, followed by one
+ * "key value" pair per line: "done N" (every destination whose index is
+ * lower than N has been traced) and "extra I" (destination I has been
+ * traced as well, I increasing), or, for a stateless sweep, "seed S"
+ * and "offset O".
+ */
+
+typedef struct {
+    size_t     num_done;  /**< Every destination whose index is lower has been traced */
+    size_t   * extra;     /**< Indices (increasing) of the other destinations traced */
+    size_t     num_extra; /**< Number of indices stored in extra */
+    bool       is_sweep;  /**< True iif the run is a stateless sweep */
+    uint64_t   seed;      /**< (Sweep) The seed of the sweep */
+    uint64_t   offset;    /**< (Sweep) The number of probes sent so far */
+} checkpoint_t;
+
+/**
+ * \brief Load a checkpoint file.
+ * \param filename The checkpoint file.
+ * \param checkpoint The checkpoint_t instance to fill. Its member extra
+ *    must be released by the caller.
+ * \return true iif successful.
+ */
+
+static bool checkpoint_load(const char * filename, checkpoint_t * checkpoint)
+{
+    FILE     * file;
+    char       magic[sizeof(CHECKPOINT_MAGIC)],
+               key[16];
+    uint64_t   value;
+    size_t   * resized;
+    int        num_scanned;
+
+    memset(checkpoint, 0, sizeof(checkpoint_t));
+
+    if (!(file = fopen(filename, "r"))) {
+        perror(filename);
+        goto ERR_FOPEN;
     }
 
-    // Algorithm options (common options)
-    options_traceroute_init(ptraceroute_options, &dst_addr);
+    if (!fgets(magic, sizeof(magic), file) || strcmp(magic, CHECKPOINT_MAGIC) != 0) {
+        goto ERR_INVALID;
+    }
 
-    // Create libparistraceroute loop
-    if (!(loop = pt_loop_create(loop_handler, NULL))) {
-        fprintf(stderr, "E: Cannot create libparistraceroute loop");
-        goto ERR_LOOP_CREATE;
+    while ((num_scanned = fscanf(file, "%15s %" SCNu64, key, &value)) == 2) {
+        if (strcmp(key, "done") == 0) {
+            checkpoint->num_done = value;
+        } else if (strcmp(key, "extra") == 0) {
+            if (value <= checkpoint->num_done
+            || (checkpoint->num_extra && value <= checkpoint->extra[checkpoint->num_extra - 1])) {
+                goto ERR_INVALID;
+            }
+            if (!(resized = realloc(checkpoint->extra, (checkpoint->num_extra + 1) * sizeof(size_t)))) {
+                goto ERR_REALLOC;
+            }
+            checkpoint->extra = resized;
+            checkpoint->extra[checkpoint->num_extra++] = value;
+        } else if (strcmp(key, "seed") == 0) {
+            checkpoint->is_sweep = true;
+            checkpoint->seed     = value;
+        } else if (strcmp(key, "offset") == 0) {
+            checkpoint->is_sweep = true;
+            checkpoint->offset   = value;
+        } else {
+            goto ERR_INVALID;
+        }
     }
+    if (num_scanned != EOF) goto ERR_INVALID;
 
-    // Set network options (network and verbose)
-    options_network_init(loop->network, is_debug);
+    fclose(file);
+    return true;
 
-    printf("%s to %s (", algorithm_name, dst_ip);
-    address_dump(&dst_addr);
-    printf("), %u hops max, %u bytes packets\n",
-        ptraceroute_options->max_ttl,
-        (unsigned int)packet_get_size(probe->packet)
-    );
+ERR_INVALID:
+    fprintf(stderr, "%s: invalid checkpoint file\n", filename);
+ERR_REALLOC:
+    free(checkpoint->extra);
+    checkpoint->extra = NULL;
+    fclose(file);
+ERR_FOPEN:
+    return false;
+}
 
-    // Add an algorithm instance in the main loop
-    if (!pt_add_instance(loop, algorithm_name, algorithm_options, probe)) {
-        fprintf(stderr, "E: Cannot add the chosen algorithm");
-        goto ERR_INSTANCE;
+/**
+ * \brief Start writing a checkpoint file. The checkpoint is written in a
+ *    temporary file, which replaces the previous checkpoint once complete
+ *    (see checkpoint_commit), so that a crash never leaves a partial
+ *    checkpoint.
+ * \param filename The checkpoint file.
+ * \param ptmp_filename Address of a char * in which the name of the
+ *    temporary file is written.
+ * \return The temporary file, NULL in case of failure.
+ */
+
+static FILE * checkpoint_begin(const char * filename, char ** ptmp_filename)
+{
+    FILE * file;
+
+    if (!(*ptmp_filename = malloc(strlen(filename) + 5))) goto ERR_MALLOC;
+    sprintf(*ptmp_filename, "%s.tmp", filename);
+
+    if (!(file = fopen(*ptmp_filename, "w"))) {
+        perror(*ptmp_filename);
+        goto ERR_FOPEN;
     }
+    fprintf(file, "%s\n", CHECKPOINT_MAGIC);
+    return file;
 
-    // Wait for events. They will be catched by handler_user()
-    if (pt_loop(loop, 0) < 0) {
-        fprintf(stderr, "E: Main loop interrupted");
-        goto ERR_PT_LOOP;
+ERR_FOPEN:
+    free(*ptmp_filename);
+ERR_MALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Replace the checkpoint file by the temporary file.
+ * \param file The temporary file (see checkpoint_begin). It is closed.
+ * \param filename The checkpoint file.
+ * \param tmp_filename The name of the temporary file. It is released.
+ * \return true iif successful.
+ */
+
+static bool checkpoint_commit(FILE * file, const char * filename, char * tmp_filename)
+{
+    bool ret = true;
+
+    if (fclose(file) != 0 || rename(tmp_filename, filename) != 0) {
+        perror(tmp_filename);
+        unlink(tmp_filename);
+        ret = false;
     }
-    exit_code = EXIT_SUCCESS;
+    free(tmp_filename);
+    return ret;
+}
 
-    // Leave the program
-ERR_PT_LOOP:
-ERR_INSTANCE:
-    // pt_loop_free() automatically removes algorithms instances,
-    // probe_replies and events from the memory.
-    // Options and probe must be manually removed.
-    pt_loop_free(loop);
-ERR_LOOP_CREATE:
-ERR_UNKNOWN_ALGORITHM:
-    probe_free(probe);
-ERR_PROBE_CREATE:
-ERR_ADDRESS_IP_FROM_STRING:
-ERR_ADDRESS_GUESS_FAMILY:
-    if (errno) perror(gai_strerror(errno));
-ERR_CHECK_OPTIONS:
-ERR_OPT_PARSE:
-ERR_INIT_OPTIONS:
-    free(version);
-    exit(exit_code);
+//---------------------------------------------------------------------------
+// Batch mode (see option -F)
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Read the next destination listed in the input. Blank lines and
+ *    comments are skipped.
+ * \param input The list of destinations.
+ * \param pline Points to the buffer storing the line (see getline).
+ * \param pline_size Points to the size of *pline (see getline).
+ * \return The destination (stored in *pline), NULL once the input is over.
+ */
+
+static char * read_destination(FILE * input, char ** pline, size_t * pline_size)
+{
+    char * dst_ip,
+         * end;
+
+    while (getline(pline, pline_size, input) != -1) {
+        for (dst_ip = *pline; *dst_ip == ' ' || *dst_ip == '\t'; dst_ip++);
+        for (end = dst_ip; *end && *end != '\n' && *end != ' ' && *end != '\t' && *end != '#'; end++);
+        *end = '\0';
+        if (*dst_ip) return dst_ip;
+    }
+    return NULL;
 }
 
+// A list of pre-resolved destinations (see -F) starts with one of these
+// magics, followed by IPv4 (resp. IPv6) addresses in network byte order.
+#define TARGETS_MAGIC_IPV4 "PTADDR4\n"
+#define TARGETS_MAGIC_IPV6 "PTADDR6\n"
+#define TARGETS_MAGIC_SIZE 8
+
+/**
+ * \struct targets_t
+ * \brief The list of destinations passed with -F: either a text list (see
+ *    read_destination), or a list of pre-resolved destinations, which is
+ *    mapped in memory and never resolved.
+ */
+
+typedef struct {
+    FILE          * input;     /**< The text list, NULL if the list is mapped */
+    const uint8_t * map;       /**< The mapped list, NULL if the list is a text */
+    size_t          map_size;  /**< Size of the mapped list */
+    size_t          offset;    /**< Offset of the next address in map */
+    int             family;    /**< Family of the mapped addresses */
+    char          * line;      /**< The last destination read (see getline) */
+    size_t          line_size; /**< Size of line */
+} targets_t;
+
+/**
+ * \brief Open a list of destinations.
+ * \param targets The targets_t instance to initialize.
+ * \param filename The list, "-" for the standard input.
+ * \return true iif successful.
+ */
+
+static bool targets_open(targets_t * targets, const char * filename)
+{
+    char          magic[TARGETS_MAGIC_SIZE];
+    struct stat   st;
+    size_t        address_size;
+    void        * map;
+    int           fd;
+
+    memset(targets, 0, sizeof(targets_t));
+    if (strcmp(filename, "-") == 0) {
+        targets->input = stdin;
+        return true;
+    }
+
+    if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(filename);
+        goto ERR_OPEN;
+    }
+    if (fstat(fd, &st) == -1) goto ERR_FSTAT;
+
+    if (S_ISREG(st.st_mode) && st.st_size >= TARGETS_MAGIC_SIZE
+    &&  pread(fd, magic, TARGETS_MAGIC_SIZE, 0) == TARGETS_MAGIC_SIZE) {
+        if (memcmp(magic, TARGETS_MAGIC_IPV4, TARGETS_MAGIC_SIZE) == 0) {
+            targets->family = AF_INET;
+        } else if (memcmp(magic, TARGETS_MAGIC_IPV6, TARGETS_MAGIC_SIZE) == 0) {
+            targets->family = AF_INET6;
+        }
+    }
+
+    if (!targets->family) {
+        if (!(targets->input = fdopen(fd, "r"))) goto ERR_FDOPEN;
+        return true;
+    }
+
+    address_size = targets->family == AF_INET ? sizeof(ipv4_t) : sizeof(ipv6_t);
+    if ((st.st_size - TARGETS_MAGIC_SIZE) % address_size != 0) {
+        fprintf(stderr, "E: %s: truncated list of destinations\n", filename);
+        goto ERR_INVALID;
+    }
+    if ((is_ipv4 && targets->family != AF_INET) || (is_ipv6 && targets->family != AF_INET6)) {
+        fprintf(stderr, "E: %s: the destinations do not match the IP version set\n", filename);
+        goto ERR_INVALID;
+    }
+
+    // The mapping outlives the file descriptor
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) goto ERR_MMAP;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    close(fd);
+
+    targets->map      = map;
+    targets->map_size = st.st_size;
+    targets->offset   = TARGETS_MAGIC_SIZE;
+    return true;
+
+ERR_MMAP:
+ERR_FDOPEN:
+ERR_FSTAT:
+    perror(filename);
+ERR_INVALID:
+    close(fd);
+ERR_OPEN:
+    return false;
+}
+
+/**
+ * \brief Close a list of destinations.
+ * \param targets The list (see targets_open).
+ */
+
+static void targets_close(targets_t * targets)
+{
+    if (targets->map) munmap((void *) targets->map, targets->map_size);
+    if (targets->input && targets->input != stdin) fclose(targets->input);
+    free(targets->line);
+}
+
+/**
+ * \brief Read the next destination of a list. Blank lines and comments
+ *    of a text list are skipped.
+ * \param targets The list (see targets_open).
+ * \param dst_addr The address_t instance in which the destination is
+ *    written if it is an IP address (see parse_destination).
+ * \param pis_resolved Points to a bool set to true iif *dst_addr has been
+ *    set. Otherwise, the destination must be resolved.
+ * \return The destination (stored in targets->line), NULL once the list
+ *    is over or in case of failure.
+ */
+
+static char * targets_next(targets_t * targets, address_t * dst_addr, bool * pis_resolved)
+{
+    char   * dst_ip;
+    size_t   address_size;
+
+    if (!targets->map) {
+        if ((dst_ip = read_destination(targets->input, &targets->line, &targets->line_size))) {
+            *pis_resolved = parse_destination(dst_ip, dst_addr);
+        }
+        return dst_ip;
+    }
+
+    address_size = targets->family == AF_INET ? sizeof(ipv4_t) : sizeof(ipv6_t);
+    if (targets->offset + address_size > targets->map_size) return NULL;
+    if (!targets->line) {
+        if (!(targets->line = malloc(INET6_ADDRSTRLEN))) return NULL;
+        targets->line_size = INET6_ADDRSTRLEN;
+    }
+
+    memset(dst_addr, 0, sizeof(address_t));
+    dst_addr->family = targets->family;
+    memcpy(&dst_addr->ip, targets->map + targets->offset, address_size);
+    targets->offset += address_size;
+    *pis_resolved = true;
+    return (char *) inet_ntop(dst_addr->family, &dst_addr->ip, targets->line, targets->line_size);
+}
+
+/**
+ * \struct target_t
+ * \brief A destination traced in batch mode. Its text output is buffered
+ *    until the trace is complete, so that concurrent traces are not
+ *    interleaved. The records of a structured output are written as soon
+ *    as they are known, since each of them carries its destination.
+ */
+
+typedef struct {
+    mda_options_t        options;            /**< Options of the instance. Must be the first member (see batch_loop_handler). The traceroute algorithm only reads options.traceroute_options */
+    address_t            dst_addr;           /**< The destination */
+    probe_t            * probe;              /**< The probe skeleton of the instance */
+    FILE               * out;                /**< Stream buffering the output of the trace (NULL if --format is set) */
+    char               * output;             /**< The buffered output (see open_memstream) */
+    size_t               output_size;        /**< Size of the buffered output */
+    size_t               num_probes_printed; /**< See traceroute_event_fdump */
+    size_t               index;              /**< Index of the destination in the input (see checkpoint_t) */
+} target_t;
+
+/**
+ * \struct batch_t
+ * \brief State of the batch mode, shared by every target.
+ */
+
+typedef struct {
+    targets_t    targets;         /**< The list of destinations */
+    const char * algorithm_name;  /**< The algorithm run toward each destination ("traceroute", "mda" or "mda-lite") */
+    size_t       num_running;     /**< Number of destinations being resolved or traced */
+    size_t       max_running;     /**< Maximum number of destinations traced simultaneously */
+    bool         use_icmp;        /**< Probe using ICMP */
+    bool         use_tcp;         /**< Probe using TCP */
+    bool         use_udp;         /**< Probe using UDP */
+    size_t       num_read;        /**< Number of destinations read so far */
+    size_t       num_done;        /**< Every destination whose index is lower has been traced */
+    bool       * is_done;         /**< Whether each destination from num_done to num_read has been traced */
+    size_t       max_is_done;     /**< Number of flags allocated in is_done */
+    size_t     * skipped;         /**< (--resume) Indices (increasing) of the next destinations already traced */
+    size_t       num_skipped;     /**< Number of indices remaining in skipped */
+    time_t       last_checkpoint; /**< When the progress has been saved for the last time */
+    pt_shards_t * shards;         /**< (--threads) The loops tracing the destinations, NULL if a single loop traces them */
+    pthread_mutex_t mutex;        /**< (--threads) Serializes the events raised by the shards, which share the output and this batch_t */
+} batch_t;
+
+/**
+ * \brief Release a target_t instance from the memory.
+ * \param target A target_t instance.
+ */
+
+static void target_free(target_t * target)
+{
+    if (target) {
+        if (target->out) fclose(target->out);
+        free(target->output);
+        probe_free(target->probe);
+        free(target);
+    }
+}
+
+/**
+ * \brief Create a target_t instance.
+ * \param batch The batch_t instance.
+ * \param dst_ip The destination passed by the user.
+ * \param dst_addr The address of the destination.
+ * \return The newly created target_t instance, NULL in case of failure.
+ */
+
+static target_t * target_create(const batch_t * batch, const char * dst_ip, const address_t * dst_addr)
+{
+    target_t * target;
+
+    if (!(target = calloc(1, sizeof(target_t))))                    goto ERR_CALLOC;
+    target->dst_addr = *dst_addr;
+    if (!output && !(target->out = open_memstream(&target->output, &target->output_size))) goto ERR_OPEN_MEMSTREAM;
+    if (!(target->probe = make_probe_skel(&target->dst_addr, batch->use_icmp, batch->use_tcp, batch->use_udp))) {
+        goto ERR_MAKE_PROBE_SKEL;
+    }
+
+    target->options = mda_get_default_options();
+    options_mda_init(&target->options);
+    options_traceroute_init(&target->options.traceroute_options, &target->dst_addr);
+    if (output) {
+        header_output(output, batch->algorithm_name, &target->dst_addr, target->options.traceroute_options.max_ttl, target->probe);
+    } else {
+        header_fdump(target->out, batch->algorithm_name, dst_ip, &target->dst_addr, target->options.traceroute_options.max_ttl, target->probe);
+    }
+    return target;
+
+ERR_MAKE_PROBE_SKEL:
+ERR_OPEN_MEMSTREAM:
+    target_free(target);
+ERR_CALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Record that a destination has been traced (see checkpoint_t).
+ * \param batch The batch_t instance.
+ * \param index The index of the destination.
+ */
+
+static void batch_set_done(batch_t * batch, size_t index)
+{
+    size_t num_flags = batch->num_read - batch->num_done,
+           i;
+
+    batch->is_done[index - batch->num_done] = true;
+
+    // Move the watermark past the destinations traced in a row
+    for (i = 0; i < num_flags && batch->is_done[i]; i++);
+    memmove(batch->is_done, batch->is_done + i, (num_flags - i) * sizeof(bool));
+    batch->num_done += i;
+}
+
+/**
+ * \brief Read the next destination to trace. The destinations already
+ *    traced by a resumed run are skipped.
+ * \param batch The batch_t instance.
+ * \param dst_addr The address_t instance in which the destination is
+ *    written if it is an IP address (see targets_next).
+ * \param pis_resolved Points to a bool set to true iif *dst_addr has been
+ *    set.
+ * \param pindex Points to a size_t in which the index of the destination
+ *    is written.
+ * \return The destination (stored in batch->targets), NULL once the input
+ *    is over or in case of failure.
+ */
+
+static char * batch_next_destination(batch_t * batch, address_t * dst_addr, bool * pis_resolved, size_t * pindex)
+{
+    char   * dst_ip;
+    size_t   index,
+             num_flags;
+    bool   * resized;
+
+    while ((dst_ip = targets_next(&batch->targets, dst_addr, pis_resolved))) {
+        index = batch->num_read++;
+        if (index < batch->num_done) continue;
+
+        num_flags = batch->num_read - batch->num_done;
+        if (num_flags > batch->max_is_done) {
+            if (!(resized = realloc(batch->is_done, 2 * num_flags * sizeof(bool)))) {
+                batch->num_read--;
+                return NULL;
+            }
+            batch->is_done     = resized;
+            batch->max_is_done = 2 * num_flags;
+        }
+        batch->is_done[num_flags - 1] = false;
+
+        if (batch->num_skipped && *batch->skipped == index) {
+            batch->skipped++;
+            batch->num_skipped--;
+            batch_set_done(batch, index);
+            continue;
+        }
+
+        *pindex = index;
+        return dst_ip;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Save the progress of the batch in the file passed with
+ *    --checkpoint (if any).
+ * \param batch The batch_t instance.
+ * \param force Pass false to save it at most every CHECKPOINT_INTERVAL
+ *    seconds.
+ */
+
+static void batch_checkpoint(batch_t * batch, bool force)
+{
+    FILE   * file;
+    char   * tmp_filename;
+    time_t   now = time(NULL);
+    size_t   i;
+
+    if (!checkpoint_filename.s) return;
+    if (!force && now < batch->last_checkpoint + CHECKPOINT_INTERVAL) return;
+    batch->last_checkpoint = now;
+
+    // A destination is recorded as traced once its trace is output
+    if (output) output_flush(output);
+    fflush(stdout);
+
+    if (!(file = checkpoint_begin(checkpoint_filename.s, &tmp_filename))) return;
+    fprintf(file, "done %zu\n", batch->num_done);
+    for (i = 0; i < batch->num_read - batch->num_done; i++) {
+        if (batch->is_done[i]) fprintf(file, "extra %zu\n", batch->num_done + i);
+    }
+    for (i = 0; i < batch->num_skipped; i++) {
+        fprintf(file, "extra %zu\n", batch->skipped[i]);
+    }
+    checkpoint_commit(file, checkpoint_filename.s, tmp_filename);
+}
+
+/**
+ * \struct batch_lookup_t
+ * \brief A destination whose hostname is being resolved (see
+ *    pt_loop_lookup).
+ */
+
+typedef struct {
+    pt_loop_t * loop;     /**< The main loop */
+    batch_t   * batch;    /**< The batch_t instance */
+    size_t      index;    /**< Index of the destination in the input */
+    char        dst_ip[]; /**< The destination passed by the user */
+} batch_lookup_t;
+
+/**
+ * \brief Start tracing a destination.
+ * \param loop The main loop.
+ * \param batch The batch_t instance.
+ * \param dst_ip The destination passed by the user.
+ * \param dst_addr The address of the destination.
+ * \param index The index of the destination in the input.
+ */
+
+static void batch_start_target(pt_loop_t * loop, batch_t * batch, const char * dst_ip, const address_t * dst_addr, size_t index)
+{
+    target_t * target;
+
+    // A destination which cannot be traced is not traced again if the
+    // run is resumed.
+    if (!(target = target_create(batch, dst_ip, dst_addr))) {
+        fprintf(stderr, "E: Cannot trace %s\n", dst_ip);
+        batch_set_done(batch, index);
+        return;
+    }
+    target->index = index;
+    if (!pt_add_instance(loop, batch->algorithm_name, &target->options, target->probe)) {
+        fprintf(stderr, "E: Cannot add the chosen algorithm");
+        target_free(target);
+        batch_set_done(batch, index);
+        return;
+    }
+    batch->num_running++;
+}
+
+static void batch_start_targets(pt_loop_t * loop, batch_t * batch);
+
+/**
+ * \brief Trace a destination once its hostname is resolved (see
+ *    lookup_callback_t).
+ * \param address The address of the destination, NULL if the lookup has
+ *    failed.
+ * \param data Points to the batch_lookup_t instance.
+ */
+
+static void batch_handle_lookup(const address_t * address, void * data)
+{
+    batch_lookup_t * lookup = data;
+    pt_loop_t      * loop   = lookup->loop;
+    batch_t        * batch  = lookup->batch;
+
+    batch->num_running--;
+
+    // The destination is traced again if an interrupted run is resumed
+    if (loop->status != PT_LOOP_INTERRUPTED) {
+        if (address) {
+            batch_start_target(loop, batch, lookup->dst_ip, address, lookup->index);
+        } else {
+            fprintf(stderr, "E: Cannot trace %s\n", lookup->dst_ip);
+            batch_set_done(batch, lookup->index);
+        }
+        batch_start_targets(loop, batch);
+        batch_checkpoint(batch, false);
+    }
+    free(lookup);
+    if (!batch->num_running) {
+        pt_loop_terminate(loop);
+    }
+}
+
+/**
+ * \brief Start tracing the next destinations listed in the input, until
+ *    batch->max_running destinations are resolved or traced
+ *    simultaneously. The hostnames are resolved without blocking the
+ *    traces in progress, and their destinations are traced as soon as
+ *    they are resolved.
+ * \param loop The main loop.
+ * \param batch The batch_t instance.
+ */
+
+static void batch_start_targets(pt_loop_t * loop, batch_t * batch)
+{
+    char           * dst_ip;
+    size_t           index;
+    address_t        dst_addr;
+    bool             is_resolved;
+    batch_lookup_t * lookup;
+
+    while (batch->num_running < batch->max_running
+        && (dst_ip = batch_next_destination(batch, &dst_addr, &is_resolved, &index))
+    ) {
+        if (!is_resolved) {
+            if ((lookup = malloc(sizeof(batch_lookup_t) + strlen(dst_ip) + 1))) {
+                lookup->loop  = loop;
+                lookup->batch = batch;
+                lookup->index = index;
+                strcpy(lookup->dst_ip, dst_ip);
+                if (pt_loop_lookup(loop, get_destination_family(), dst_ip, batch_handle_lookup, lookup)) {
+                    batch->num_running++;
+                    continue;
+                }
+                free(lookup);
+            }
+
+            // Fall back on a blocking lookup
+            if (!resolve_destination(dst_ip, &dst_addr)) {
+                fprintf(stderr, "E: Cannot trace %s\n", dst_ip);
+                batch_set_done(batch, index);
+                continue;
+            }
+        }
+        batch_start_target(loop, batch, dst_ip, &dst_addr, index);
+    }
+}
+
+/**
+ * \brief Handle events raised by libparistraceroute in batch mode.
+ * \param loop The main loop.
+ * \param event The event raised by libparistraceroute.
+ * \param user_data Points to the batch_t instance.
+ */
+
+static void batch_loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
+{
+    batch_t     * batch = user_data;
+    target_t    * target;
+    mda_event_t * mda_event;
+    mda_data_t  * mda_data;
+
+    // The alias instance is started once every destination has been traced
+    if (event->issuer && strcmp(event->issuer->algorithm->name, "alias") == 0) {
+        if (aliases_handle_event(loop, event)) {
+            pt_loop_terminate(loop);
+        }
+        event_free(event);
+        return;
+    }
+
+    // The shards share the output and the progress of the batch
+    if (batch->shards) pthread_mutex_lock(&batch->mutex);
+
+    // The options of an instance are the first member of its target
+    target = event->issuer ? (target_t *) event->issuer->options : NULL;
+
+    switch (event->type) {
+        case ALGORITHM_HAS_TERMINATED:
+            if (is_mda(event->issuer->algorithm->name)) {
+                mda_data = event->issuer->data;
+                if (!output) {
+                    fprintf(target->out, "%zu probes sent\n", mda_data->num_probes);
+                }
+                if (is_aliases && !aliases_add(mda_data)) {
+                    fprintf(stderr, "E: Cannot collect the discovered interfaces\n");
+                }
+                mda_data_free(mda_data);
+            }
+
+            // Tell to the algorithm it can free its data
+            pt_stop_instance(loop, event->issuer);
+
+            // Print the complete trace
+            if (output) {
+                end_output(output, &target->dst_addr);
+            } else {
+                fclose(target->out);
+                target->out = NULL;
+                fwrite(target->output, 1, target->output_size, stdout);
+                fflush(stdout);
+            }
+            batch->num_running--;
+
+            // Trace the next destinations. Kill the loop once every
+            // destination has been traced. An interrupted trace is
+            // incomplete: it is traced again if the run is resumed.
+            if (loop->status != PT_LOOP_INTERRUPTED) {
+                batch_set_done(batch, target->index);
+                if (!batch->shards) batch_start_targets(loop, batch);
+                batch_checkpoint(batch, false);
+            }
+
+            // The shards start their queued destinations and terminate
+            // on their own (see pt_shards.h). Their targets are released
+            // once they have all terminated (see batch_run_shards).
+            if (batch->shards) {
+                free(target->output);
+                target->output = NULL;
+                break;
+            }
+
+            // Resolve the aliases among the interfaces discovered by the traces
+            if (!batch->num_running && !(is_aliases
+                && loop->status != PT_LOOP_INTERRUPTED
+                && aliases_start(loop, target->probe, NULL)
+            )) {
+                pt_loop_terminate(loop);
+            }
+            target_free(target);
+            break;
+        case ALGORITHM_EVENT:
+            if (is_mda(event->issuer->algorithm->name)) {
+                mda_event = event->data;
+                if (mda_event->type == MDA_NEW_LINK) {
+                    if (output) {
+                        mda_link_output(output, &target->dst_addr, mda_event->data, target->options.traceroute_options.do_resolv);
+                    } else {
+                        mda_link_fdump(target->out, mda_event->data, target->options.traceroute_options.do_resolv);
+                    }
+                }
+            } else if (output) {
+                traceroute_event_output(output, event->data, &target->options.traceroute_options);
+            } else {
+                traceroute_event_fdump(target->out, event->data, &target->options.traceroute_options, &target->num_probes_printed);
+            }
+            break;
+        default:
+            break;
+    }
+    event_free(event);
+    if (batch->shards) pthread_mutex_unlock(&batch->mutex);
+}
+
+/**
+ * \brief (--threads) Trace the destinations listed in the input with
+ *    several loops, each of them run by its own thread (see pt_shards.h).
+ *    Unlike batch_start_targets, every destination is read (and resolved)
+ *    before tracing, so that an idle shard may steal the destinations
+ *    queued by the others.
+ * \param batch The batch_t instance.
+ * \param num_threads The number of threads.
+ * \return The exit code of the program.
+ */
+
+static int batch_run_shards(batch_t * batch, size_t num_threads)
+{
+    int          exit_code = EXIT_FAILURE;
+    dynarray_t * targets;
+    target_t   * target;
+    char       * dst_ip;
+    address_t    dst_addr;
+    bool         is_resolved;
+    size_t       i, index;
+
+    if (!(targets = dynarray_create())) goto ERR_DYNARRAY_CREATE;
+
+    // Create a libparistraceroute loop per thread
+    if (!(batch->shards = pt_shards_create(num_threads, batch_loop_handler, batch))) {
+        fprintf(stderr, "E: Cannot create libparistraceroute loops\n");
+        goto ERR_PT_SHARDS_CREATE;
+    }
+    pthread_mutex_init(&batch->mutex, NULL);
+    pt_shards_set_max_running(batch->shards, batch->max_running);
+    for (i = 0; i < num_threads; i++) {
+        options_network_init(pt_shards_get_shard_loop(batch->shards, i)->network, is_debug);
+    }
+
+    // Queue each destination in its shard. A destination which cannot
+    // be traced is not traced again if the run is resumed.
+    while ((dst_ip = batch_next_destination(batch, &dst_addr, &is_resolved, &index))) {
+        if ((!is_resolved && !resolve_destination(dst_ip, &dst_addr))
+        ||  !(target = target_create(batch, dst_ip, &dst_addr))
+        ) {
+            fprintf(stderr, "E: Cannot trace %s\n", dst_ip);
+            batch_set_done(batch, index);
+            continue;
+        }
+        target->index = index;
+        if (!dynarray_push_element(targets, target)) {
+            target_free(target);
+            goto ERR_DYNARRAY_PUSH_ELEMENT;
+        }
+        if (!pt_shards_add_instance(batch->shards, batch->algorithm_name, &target->options, target->probe, &target->dst_addr)) {
+            fprintf(stderr, "E: Cannot add the chosen algorithm\n");
+            batch_set_done(batch, index);
+            continue;
+        }
+        batch->num_running++;
+    }
+
+    // Wait for events. They will be catched by batch_loop_handler()
+    if (batch->num_running && pt_shards_run(batch->shards) < 0) {
+        fprintf(stderr, "E: Main loop interrupted\n");
+        goto ERR_PT_SHARDS_RUN;
+    }
+    exit_code = EXIT_SUCCESS;
+    for (i = 0; i < num_threads; i++) {
+        if (pt_shards_get_shard_loop(batch->shards, i)->status == PT_LOOP_INTERRUPTED) {
+            exit_code = EXIT_FAILURE;
+        }
+    }
+
+ERR_PT_SHARDS_RUN:
+ERR_DYNARRAY_PUSH_ELEMENT:
+    pt_shards_free(batch->shards);
+    pthread_mutex_destroy(&batch->mutex);
+ERR_PT_SHARDS_CREATE:
+    dynarray_free(targets, (ELEMENT_FREE) target_free);
+ERR_DYNARRAY_CREATE:
+    return exit_code;
+}
+
+//---------------------------------------------------------------------------
+// Stateless mode (see -a stateless)
+//---------------------------------------------------------------------------
+
+/**
+ * \struct sweep_t
+ * \brief State of a stateless sweep.
+ */
+
+typedef struct {
+    bool   is_done;         /**< true once every probe has been sent (or if the sweep has failed) */
+    bool   has_failed;      /**< true if the stateless instance has failed */
+    size_t num_replies;     /**< Number of replies printed so far */
+    time_t last_checkpoint; /**< When the progress has been saved for the last time */
+} sweep_t;
+
+/**
+ * \brief Save the progress of a sweep in the file passed with
+ *    --checkpoint (if any).
+ * \param sweep The sweep_t instance.
+ * \param seed The seed of the sweep.
+ * \param offset The number of probes sent so far (see stateless_get_offset).
+ * \param force Pass false to save it at most every CHECKPOINT_INTERVAL
+ *    seconds.
+ */
+
+static void sweep_checkpoint(sweep_t * sweep, uint64_t seed, uint64_t offset, bool force)
+{
+    FILE   * file;
+    char   * tmp_filename;
+    time_t   now = time(NULL);
+
+    if (!checkpoint_filename.s) return;
+    if (!force && now < sweep->last_checkpoint + CHECKPOINT_INTERVAL) return;
+    sweep->last_checkpoint = now;
+
+    if (output) output_flush(output);
+    fflush(stdout);
+
+    if (!(file = checkpoint_begin(checkpoint_filename.s, &tmp_filename))) return;
+    fprintf(file, "seed %" PRIu64 "\noffset %" PRIu64 "\n", seed, offset);
+    checkpoint_commit(file, checkpoint_filename.s, tmp_filename);
+}
+
+/**
+ * \brief Handle events raised by libparistraceroute in stateless mode.
+ * \param loop The main loop.
+ * \param event The event raised by libparistraceroute.
+ * \param user_data Points to the sweep_t instance.
+ */
+
+static void sweep_loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
+{
+    sweep_t           * sweep = user_data;
+    stateless_event_t * stateless_event;
+
+    switch (event->type) {
+        case ALGORITHM_EVENT:
+            stateless_event = event->data;
+            switch (stateless_event->type) {
+                case STATELESS_REPLY:
+                    if (output) {
+                        stateless_reply_output(output, stateless_event->data);
+                    } else {
+                        stateless_reply_fdump(stdout, stateless_event->data);
+                    }
+                    sweep->num_replies++;
+                    break;
+                case STATELESS_ALL_PROBES_SENT:
+                    sweep->is_done = true;
+                    break;
+            }
+            break;
+        case ALGORITHM_ERROR:
+            sweep->is_done    = true;
+            sweep->has_failed = true;
+            break;
+        case ALGORITHM_HAS_TERMINATED:
+            // The sweep has been interrupted (e.g. ctrl c)
+            pt_loop_terminate(loop);
+            break;
+        default:
+            break;
+    }
+    event_free(event);
+}
+
+/**
+ * \struct sweep_targets_t
+ * \brief The destinations of a sweep. They are stored in the order of the
+ *    input, whatever the order in which their hostnames are resolved, so
+ *    that a resumed sweep sends the same probes.
+ */
+
+typedef struct {
+    address_t * targets;     /**< The destinations. A destination which cannot be probed (yet) has the family AF_UNSPEC */
+    size_t      num_targets; /**< Number of destinations stored in targets */
+    size_t      max_targets; /**< Number of destinations allocated in targets */
+    size_t      num_lookups; /**< Number of hostnames being resolved */
+} sweep_targets_t;
+
+/**
+ * \struct sweep_lookup_t
+ * \brief A destination of a sweep whose hostname is being resolved (see
+ *    pt_loop_lookup).
+ */
+
+typedef struct {
+    sweep_targets_t * targets;  /**< The destinations of the sweep */
+    size_t            index;    /**< Index of the destination in targets */
+    char              dst_ip[]; /**< The destination passed by the user */
+} sweep_lookup_t;
+
+/**
+ * \brief Store a destination of a sweep.
+ * \param dst_ip The destination passed by the user.
+ * \param dst_addr The address of the destination.
+ * \param target The slot of the destination.
+ */
+
+static void sweep_set_target(const char * dst_ip, const address_t * dst_addr, address_t * target)
+{
+    if (dst_addr->family != AF_INET) {
+        fprintf(stderr, "E: Cannot probe %s (stateless probing only supports IPv4)\n", dst_ip);
+        return;
+    }
+    *target = *dst_addr;
+}
+
+/**
+ * \brief Store a destination of a sweep once its hostname is resolved
+ *    (see lookup_callback_t).
+ * \param address The address of the destination, NULL if the lookup has
+ *    failed.
+ * \param data Points to the sweep_lookup_t instance.
+ */
+
+static void sweep_handle_lookup(const address_t * address, void * data)
+{
+    sweep_lookup_t * lookup = data;
+
+    lookup->targets->num_lookups--;
+    if (address) {
+        sweep_set_target(lookup->dst_ip, address, &lookup->targets->targets[lookup->index]);
+    } else {
+        fprintf(stderr, "E: Cannot probe %s\n", lookup->dst_ip);
+    }
+    free(lookup);
+}
+
+/**
+ * \brief Load the destinations of a sweep. The hostnames are resolved
+ *    concurrently (see pt_loop_lookup).
+ * \param loop The main loop.
+ * \param input The list of destinations.
+ * \param targets The sweep_targets_t instance to fill. Its member targets
+ *    must be released by the caller.
+ * \return true iif successful.
+ */
+
+static bool sweep_load_targets(pt_loop_t * loop, targets_t * input, sweep_targets_t * targets)
+{
+    char           * dst_ip;
+    address_t        dst_addr,
+                   * target,
+                   * resized;
+    bool             is_resolved,
+                     ret = true;
+    sweep_lookup_t * lookup;
+    size_t           i, j;
+
+    memset(targets, 0, sizeof(sweep_targets_t));
+    while (loop->status != PT_LOOP_INTERRUPTED
+        && (dst_ip = targets_next(input, &dst_addr, &is_resolved))
+    ) {
+        if (targets->num_targets == targets->max_targets) {
+            targets->max_targets = targets->max_targets ? 2 * targets->max_targets : 1024;
+            if (!(resized = realloc(targets->targets, targets->max_targets * sizeof(address_t)))) {
+                ret = false;
+                break;
+            }
+            targets->targets = resized;
+        }
+        target = &targets->targets[targets->num_targets];
+        memset(target, 0, sizeof(address_t));
+
+        if (!is_resolved) {
+            if ((lookup = malloc(sizeof(sweep_lookup_t) + strlen(dst_ip) + 1))) {
+                lookup->targets = targets;
+                lookup->index   = targets->num_targets++;
+                strcpy(lookup->dst_ip, dst_ip);
+                if (pt_loop_lookup(loop, get_destination_family(), dst_ip, sweep_handle_lookup, lookup)) {
+                    // Bound the number of hostnames waiting for a thread
+                    targets->num_lookups++;
+                    while (targets->num_lookups >= 2 * (size_t) resolvers[0]
+                        && loop->status != PT_LOOP_INTERRUPTED
+                        && pt_loop_step(loop, 0, -1) > 0
+                    );
+                    continue;
+                }
+                targets->num_targets--;
+                free(lookup);
+            }
+
+            // Fall back on a blocking lookup
+            if (!resolve_destination(dst_ip, &dst_addr)) {
+                fprintf(stderr, "E: Cannot probe %s\n", dst_ip);
+                continue;
+            }
+        }
+        sweep_set_target(dst_ip, &dst_addr, target);
+        targets->num_targets++;
+    }
+
+    // Wait for the last lookups, which update targets->targets
+    while (targets->num_lookups && pt_loop_step(loop, 0, -1) > 0);
+    if (targets->num_lookups || loop->status == PT_LOOP_INTERRUPTED) ret = false;
+
+    // Drop the destinations which cannot be probed
+    for (i = j = 0; i < targets->num_targets; i++) {
+        if (targets->targets[i].family == AF_INET) targets->targets[j++] = targets->targets[i];
+    }
+    targets->num_targets = j;
+    return ret;
+}
+
+/**
+ * \brief Probe once, in a random order, every (destination, TTL) pair
+ *    related to the destinations listed in the file passed with -F, using
+ *    the stateless algorithm (see libparistraceroute/algorithms/stateless.h).
+ * \param input The list of destinations.
+ * \param use_icmp Pass true to probe using ICMP.
+ * \param use_tcp Pass true to probe using TCP.
+ * \param use_udp Pass true to probe using UDP.
+ * \param checkpoint The checkpoint of the sweep to resume, NULL if none.
+ * \return The exit code of the program.
+ */
+
+static int sweep_run(targets_t * input, bool use_icmp, bool use_tcp, bool use_udp, const checkpoint_t * checkpoint)
+{
+    int                    exit_code = EXIT_FAILURE;
+    sweep_t                sweep = {false, false, 0, 0};
+    stateless_options_t    options = stateless_get_default_options();
+    stateless_data_t     * data;
+    sweep_targets_t        targets;
+    probe_t              * probe;
+    pt_loop_t            * loop;
+    algorithm_instance_t * instance;
+
+    // Create libparistraceroute loop
+    if (!(loop = pt_loop_create(sweep_loop_handler, &sweep))) {
+        fprintf(stderr, "E: Cannot create libparistraceroute loop");
+        goto ERR_LOOP_CREATE;
+    }
+
+    // Set network options (network and verbose)
+    options_network_init(loop->network, is_debug);
+
+    // Without lookup pool, the hostnames are resolved one at a time
+    pt_loop_set_lookups(loop, resolvers[0]);
+
+    // The targets are loaded at once, since they are probed in a random order
+    if (!sweep_load_targets(loop, input, &targets)) {
+        fprintf(stderr, "E: Cannot load the destinations\n");
+        goto ERR_LOAD_TARGETS;
+    }
+    if (!targets.num_targets) {
+        fprintf(stderr, "E: No destination to probe\n");
+        goto ERR_NO_TARGET;
+    }
+
+    // The destination of each probe is overwritten by the algorithm
+    if (!(probe = make_probe_skel(&targets.targets[0], use_icmp, use_tcp, use_udp))) {
+        goto ERR_PROBE_CREATE;
+    }
+
+    options.targets     = targets.targets;
+    options.num_targets = targets.num_targets;
+    options.min_ttl     = options_traceroute_get_min_ttl();
+    options.max_ttl     = options_traceroute_get_max_ttl();
+    options.seed        = seed[3] ? (uint64_t) seed[0] : get_time_ns() % INT_MAX;
+    options.offset      = offset[0];
+    if (offset[3] && !seed[3]) {
+        fprintf(stderr, "E: --offset requires --seed\n");
+        goto ERR_OFFSET;
+    }
+    if (checkpoint) {
+        if (seed[3] || offset[3]) {
+            fprintf(stderr, "E: --resume is incompatible with --seed and --offset\n");
+            goto ERR_OFFSET;
+        }
+        options.seed   = checkpoint->seed;
+        options.offset = checkpoint->offset;
+    }
+
+    if (!(instance = pt_add_instance(loop, "stateless", &options, probe))) {
+        fprintf(stderr, "E: Cannot add the chosen algorithm");
+        goto ERR_INSTANCE;
+    }
+
+    fprintf(stderr, "stateless sweep of %zu targets (TTL %u to %u), seed %" PRIu64 "\n",
+        targets.num_targets, options.min_ttl, options.max_ttl, options.seed
+    );
+
+    // Send every probe, then wait for the last replies during the timeout
+    sweep.last_checkpoint = time(NULL);
+    while (!sweep.is_done && pt_loop_step(loop, 0, -1) > 0) {
+        sweep_checkpoint(&sweep, options.seed, stateless_get_offset(instance->data), false);
+    }
+    sweep_checkpoint(&sweep, options.seed, stateless_get_offset(instance->data), true);
+    if (!sweep.is_done) {
+        fprintf(stderr, "E: Sweep interrupted, resume it with --seed %" PRIu64 " --offset %" PRIu64 "\n",
+            options.seed, stateless_get_offset(instance->data)
+        );
+        goto ERR_PT_LOOP;
+    }
+    if (sweep.has_failed
+    ||  pt_loop(loop, (unsigned int) network_get_timeout(loop->network) + 1) < 0) {
+        fprintf(stderr, "E: Main loop interrupted");
+        goto ERR_PT_LOOP;
+    }
+
+    data = instance->data;
+    fprintf(stderr, "%zu probes sent, %zu replies\n", data->num_probes_sent, sweep.num_replies);
+    exit_code = EXIT_SUCCESS;
+
+ERR_PT_LOOP:
+    stateless_data_free(loop, instance->data);
+    pt_stop_instance(loop, instance);
+ERR_INSTANCE:
+ERR_OFFSET:
+    probe_free(probe);
+ERR_PROBE_CREATE:
+ERR_NO_TARGET:
+ERR_LOAD_TARGETS:
+    free(targets.targets);
+    pt_loop_free(loop);
+ERR_LOOP_CREATE:
+    return exit_code;
+}
+
+/**
+ * \brief Trace every destination listed in the file passed with -F. The
+ *    destinations are traced in the same loop, so that they share the
+ *    sockets and the probe rate.
+ * \param algorithm_name The algorithm passed with -a.
+ * \param use_icmp Pass true to probe using ICMP.
+ * \param use_tcp Pass true to probe using TCP.
+ * \param use_udp Pass true to probe using UDP.
+ * \return The exit code of the program.
+ */
+
+static int batch_run(const char * algorithm_name, bool use_icmp, bool use_tcp, bool use_udp)
+{
+    int           exit_code = EXIT_FAILURE;
+    batch_t       batch;
+    pt_loop_t   * loop;
+    checkpoint_t  checkpoint;
+    bool          is_sweep = strcmp(algorithm_name, "stateless") == 0;
+
+    memset(&checkpoint, 0, sizeof(checkpoint_t));
+
+    if (strcmp(algorithm_name, "paris-traceroute") != 0 && !is_mda(algorithm_name) && !is_sweep) {
+        fprintf(stderr, "E: -F is only supported by the paris-traceroute, mda, mda-lite and stateless algorithms\n");
+        goto ERR_ALGORITHM;
+    }
+
+    // The mda instances share their lattices, which are not thread-safe
+    if (threads[0] > 1 && strcmp(algorithm_name, "paris-traceroute") != 0) {
+        fprintf(stderr, "E: --threads is only supported by the paris-traceroute algorithm\n");
+        goto ERR_ALGORITHM;
+    }
+
+    // The mda instances running at once share their lattices (see topology.h)
+    if (is_mda(algorithm_name) && !mda_topology_share()) {
+        fprintf(stderr, "E: Cannot share the topology\n");
+        goto ERR_ALGORITHM;
+    }
+
+    if (is_resume) {
+        if (!checkpoint_load(checkpoint_filename.s, &checkpoint)) goto ERR_CHECKPOINT_LOAD;
+        if (checkpoint.is_sweep != is_sweep) {
+            fprintf(stderr, "E: %s has not been saved by a %s run\n",
+                checkpoint_filename.s, is_sweep ? "stateless" : "paris-traceroute"
+            );
+            goto ERR_CHECKPOINT_TYPE;
+        }
+    }
+
+    if (!targets_open(&batch.targets, targets_filename.s)) goto ERR_TARGETS_OPEN;
+
+    if (is_sweep) {
+        exit_code = sweep_run(&batch.targets, use_icmp, use_tcp, use_udp, is_resume ? &checkpoint : NULL);
+        goto SWEEP_DONE;
+    }
+    batch.algorithm_name  = is_mda(algorithm_name) ? algorithm_name : "traceroute";
+    batch.num_running     = 0;
+    batch.max_running     = concurrency[0];
+    batch.use_icmp        = use_icmp;
+    batch.use_tcp         = use_tcp;
+    batch.use_udp         = use_udp;
+    batch.num_read        = 0;
+    batch.num_done        = checkpoint.num_done;
+    batch.is_done         = NULL;
+    batch.max_is_done     = 0;
+    batch.skipped         = checkpoint.extra;
+    batch.num_skipped     = checkpoint.num_extra;
+    batch.last_checkpoint = time(NULL);
+    batch.shards          = NULL;
+    if (is_resume) {
+        fprintf(stderr, "resuming: %zu destinations already traced\n", checkpoint.num_done + checkpoint.num_extra);
+    }
+
+    if (threads[0] > 1) {
+        exit_code = batch_run_shards(&batch, threads[0]);
+        goto SHARDS_DONE;
+    }
+
+    // Create libparistraceroute loop
+    if (!(loop = pt_loop_create(batch_loop_handler, &batch))) {
+        fprintf(stderr, "E: Cannot create libparistraceroute loop");
+        goto ERR_LOOP_CREATE;
+    }
+
+    // Set network options (network and verbose)
+    options_network_init(loop->network, is_debug);
+
+    // Without lookup pool, the hostnames are resolved one at a time
+    pt_loop_set_lookups(loop, resolvers[0]);
+
+    // Wait for events. They will be catched by batch_loop_handler()
+    batch_start_targets(loop, &batch);
+    if (batch.num_running && pt_loop(loop, 0) < 0) {
+        fprintf(stderr, "E: Main loop interrupted");
+        goto ERR_PT_LOOP;
+    }
+    exit_code = loop->status == PT_LOOP_INTERRUPTED ? EXIT_FAILURE : EXIT_SUCCESS;
+
+ERR_PT_LOOP:
+    pt_loop_free(loop);
+SHARDS_DONE:
+    batch_checkpoint(&batch, true);
+    free(batch.is_done);
+ERR_LOOP_CREATE:
+SWEEP_DONE:
+    targets_close(&batch.targets);
+ERR_TARGETS_OPEN:
+ERR_CHECKPOINT_TYPE:
+    free(checkpoint.extra);
+ERR_CHECKPOINT_LOAD:
+ERR_ALGORITHM:
+    return exit_code;
+}
+
+//---------------------------------------------------------------------------
+// Daemon mode (see --daemon)
+//---------------------------------------------------------------------------
+
+/**
+ * \struct request_t
+ * \brief A measurement requested to the daemon.
+ */
+
+typedef struct {
+    mda_options_t      options;  /**< Options of the instance. Must be the first member (see daemon_loop_handler). The traceroute algorithm only reads options.traceroute_options */
+    address_t          dst_addr; /**< The destination */
+    probe_t          * probe;    /**< The probe skeleton of the instance */
+    control_client_t * client;   /**< The client which has sent the request */
+} request_t;
+
+/**
+ * \struct daemon_t
+ * \brief State of the daemon mode.
+ */
+
+typedef struct {
+    pt_loop_t  * loop;           /**< The main loop */
+    size_t       num_running;    /**< Number of measurements in progress */
+    const char * algorithm_name; /**< The algorithm used by default (see -a) */
+    bool         use_icmp;       /**< Probe using ICMP by default */
+    bool         use_tcp;        /**< Probe using TCP by default */
+    bool         use_udp;        /**< Probe using UDP by default */
+} daemon_t;
+
+/**
+ * \brief Release a request_t instance from the memory.
+ * \param request A request_t instance.
+ */
+
+static void request_free(request_t * request)
+{
+    if (request) {
+        control_client_release(request->client);
+        probe_free(request->probe);
+        free(request);
+    }
+}
+
+/**
+ * \brief Read an integer field of a measurement request.
+ * \param request The request.
+ * \param key The name of the field.
+ * \param min The minimal value of the field.
+ * \param max The maximal value of the field.
+ * \param pvalue Address of an unsigned in which the value is written,
+ *    left unchanged if the field is unset.
+ * \return true iif the field is unset or valid.
+ */
+
+static bool request_get_uint(const control_request_t * request, const char * key, unsigned min, unsigned max, unsigned * pvalue)
+{
+    const char    * value = control_request_get(request, key);
+    char          * end;
+    unsigned long   x;
+
+    if (!value) return true;
+    errno = 0;
+    x = strtoul(value, &end, 10);
+    if (errno || end == value || *end || x < min || x > max) return false;
+    *pvalue = x;
+    return true;
+}
+
+/**
+ * \brief Tell a client that its request has been rejected.
+ * \param client The client.
+ * \param dst_addr The destination of the request, NULL if unknown.
+ * \param reason Why the request has been rejected.
+ */
+
+static void daemon_reject(control_client_t * client, const address_t * dst_addr, const char * reason)
+{
+    output_record_t   record;
+    output_t        * output;
+
+    if (!(output = control_client_get_output(client))) return;
+    memset(&record, 0, sizeof(output_record_t));
+    record.type   = OUTPUT_RECORD_REJECT;
+    record.dst    = dst_addr;
+    record.reason = reason;
+    output_write_record(output, &record);
+    control_client_flush(client);
+}
+
+/**
+ * \brief Start the measurement requested by a client of the daemon. The
+ *    fields of the request which are not set are set by the command-line
+ *    options.
+ * \param client The client.
+ * \param control_request The request.
+ * \param data Points to the daemon_t instance.
+ */
+
+static void daemon_request_handler(control_client_t * client, const control_request_t * control_request, void * data)
+{
+    daemon_t   * daemon = data;
+    request_t  * request;
+    const char * dst_ip         = control_request_get(control_request, "dst"),
+               * algorithm_name = control_request_get(control_request, "algorithm"),
+               * protocol_name  = control_request_get(control_request, "protocol"),
+               * reason;
+    address_t  * dst_addr = NULL;
+    bool         use_icmp = daemon->use_icmp,
+                 use_tcp  = daemon->use_tcp,
+                 use_udp  = daemon->use_udp;
+    unsigned     min_ttl, max_ttl, num_queries;
+
+    if (!dst_ip) {
+        daemon_reject(client, NULL, "missing dst");
+        return;
+    }
+
+    if (!algorithm_name) {
+        algorithm_name = daemon->algorithm_name;
+    } else if (strcmp(algorithm_name, "paris-traceroute") != 0 && !is_mda(algorithm_name)) {
+        daemon_reject(client, NULL, "unsupported algorithm");
+        return;
+    }
+
+    if (protocol_name) {
+        use_icmp = strcmp(protocol_name, "icmp") == 0;
+        use_tcp  = strcmp(protocol_name, "tcp")  == 0;
+        use_udp  = strcmp(protocol_name, "udp")  == 0;
+        if (!use_icmp && !use_tcp && !use_udp) {
+            daemon_reject(client, NULL, "unsupported protocol");
+            return;
+        }
+    }
+
+    if (!(request = calloc(1, sizeof(request_t)))) {
+        daemon_reject(client, NULL, "out of memory");
+        return;
+    }
+    if (!resolve_destination(dst_ip, &request->dst_addr)) {
+        reason = "invalid dst";
+        goto ERR_RESOLVE_DESTINATION;
+    }
+    dst_addr = &request->dst_addr;
+
+    request->options = mda_get_default_options();
+    options_mda_init(&request->options);
+    options_traceroute_init(&request->options.traceroute_options, &request->dst_addr);
+
+    min_ttl     = request->options.traceroute_options.min_ttl;
+    max_ttl     = request->options.traceroute_options.max_ttl;
+    num_queries = request->options.traceroute_options.num_probes;
+    if (!request_get_uint(control_request, "min_ttl", 1, 255, &min_ttl)
+    ||  !request_get_uint(control_request, "max_ttl", 1, 255, &max_ttl)
+    ||  !request_get_uint(control_request, "num_queries", 1, 255, &num_queries)
+    ||  min_ttl > max_ttl) {
+        reason = "invalid options";
+        goto ERR_OPTIONS;
+    }
+    request->options.traceroute_options.min_ttl    = min_ttl;
+    request->options.traceroute_options.max_ttl    = max_ttl;
+    request->options.traceroute_options.num_probes = num_queries;
+
+    if (!(request->probe = make_probe_skel(&request->dst_addr, use_icmp, use_tcp, use_udp))) {
+        reason = "cannot create the probes";
+        goto ERR_MAKE_PROBE_SKEL;
+    }
+
+    if (strcmp(algorithm_name, "paris-traceroute") == 0) algorithm_name = "traceroute";
+    header_output(control_client_get_output(client), algorithm_name, &request->dst_addr, max_ttl, request->probe);
+    if (!pt_add_instance(daemon->loop, algorithm_name, &request->options, request->probe)) {
+        reason = "cannot add the chosen algorithm";
+        goto ERR_ADD_INSTANCE;
+    }
+    request->client = control_client_ref(client);
+    daemon->num_running++;
+    control_client_flush(client);
+    return;
+
+ERR_ADD_INSTANCE:
+ERR_MAKE_PROBE_SKEL:
+ERR_OPTIONS:
+ERR_RESOLVE_DESTINATION:
+    daemon_reject(client, dst_addr, reason);
+    request_free(request);
+}
+
+/**
+ * \brief Handle events raised by libparistraceroute in daemon mode.
+ * \param loop The main loop.
+ * \param event The event raised by libparistraceroute.
+ * \param user_data Points to the daemon_t instance.
+ */
+
+static void daemon_loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
+{
+    daemon_t    * daemon = user_data;
+    request_t   * request;
+    output_t    * output;
+    mda_event_t * mda_event;
+
+    // The options of an instance are the first member of its request
+    request = event->issuer ? (request_t *) event->issuer->options : NULL;
+
+    switch (event->type) {
+        case ALGORITHM_HAS_TERMINATED:
+            if ((output = control_client_get_output(request->client))) {
+                end_output(output, &request->dst_addr);
+                control_client_flush(request->client);
+            }
+            if (is_mda(event->issuer->algorithm->name)) {
+                mda_data_free(event->issuer->data);
+            }
+
+            // Tell to the algorithm it can free its data
+            pt_stop_instance(loop, event->issuer);
+            request_free(request);
+            daemon->num_running--;
+
+            // Once interrupted, the daemon waits for the measurements in progress
+            if (loop->status == PT_LOOP_INTERRUPTED && !daemon->num_running) {
+                pt_loop_terminate(loop);
+            }
+            break;
+        case ALGORITHM_EVENT:
+            // The results of a client which has left are dropped
+            if (!(output = control_client_get_output(request->client))) break;
+            if (is_mda(event->issuer->algorithm->name)) {
+                mda_event = event->data;
+                if (mda_event->type == MDA_NEW_LINK) {
+                    mda_link_output(output, &request->dst_addr, mda_event->data, request->options.traceroute_options.do_resolv);
+                }
+            } else {
+                traceroute_event_output(output, event->data, &request->options.traceroute_options);
+            }
+            control_client_flush(request->client);
+            break;
+        default:
+            break;
+    }
+    event_free(event);
+}
+
+/**
+ * \brief Run the daemon mode (see --daemon): every measurement requested
+ *    through the UNIX socket is run in the same loop, so that they share
+ *    the sockets, the caches and the probe rate. The daemon stops once
+ *    interrupted and the measurements in progress are over.
+ * \param algorithm_name The algorithm passed with -a.
+ * \param format_name The format passed with --format.
+ * \param use_icmp Pass true to probe using ICMP.
+ * \param use_tcp Pass true to probe using TCP.
+ * \param use_udp Pass true to probe using UDP.
+ * \return The exit code of the program.
+ */
+
+static int daemon_run(const char * algorithm_name, const char * format_name, bool use_icmp, bool use_tcp, bool use_udp)
+{
+    int         exit_code = EXIT_FAILURE;
+    daemon_t    daemon;
+    pt_loop_t * loop;
+
+    if (strcmp(algorithm_name, "stateless") == 0
+    ||  strcmp(algorithm_name, "pmtud") == 0
+    ||  strcmp(algorithm_name, "monitor") == 0
+    ) {
+        fprintf(stderr, "E: --daemon does not support the %s algorithm\n", algorithm_name);
+        goto ERR_ALGORITHM;
+    }
+
+    // The mda measurements running at once share their lattices (see topology.h)
+    if (!mda_topology_share()) {
+        fprintf(stderr, "E: Cannot share the topology\n");
+        goto ERR_ALGORITHM;
+    }
+
+    daemon.num_running    = 0;
+    daemon.algorithm_name = algorithm_name;
+    daemon.use_icmp       = use_icmp;
+    daemon.use_tcp        = use_tcp;
+    daemon.use_udp        = use_udp;
+
+    // Create libparistraceroute loop
+    if (!(loop = pt_loop_create(daemon_loop_handler, &daemon))) {
+        fprintf(stderr, "E: Cannot create libparistraceroute loop");
+        goto ERR_LOOP_CREATE;
+    }
+    daemon.loop = loop;
+
+    // Set network options (network and verbose)
+    options_network_init(loop->network, is_debug);
+
+    // The results are streamed in a structured format
+    if (!pt_loop_set_control(loop, daemon_path.s, strcmp(format_name, "text") == 0 ? "json" : format_name, daemon_request_handler, &daemon)) {
+        fprintf(stderr, "E: Cannot listen to %s\n", daemon_path.s);
+        goto ERR_SET_CONTROL;
+    }
+
+    // Wait for requests and events until the daemon is interrupted
+    if (pt_loop(loop, 0) < 0) {
+        fprintf(stderr, "E: Main loop interrupted");
+        goto ERR_PT_LOOP;
+    }
+    exit_code = EXIT_SUCCESS;
+
+ERR_PT_LOOP:
+ERR_SET_CONTROL:
+    pt_loop_free(loop);
+ERR_LOOP_CREATE:
+ERR_ALGORITHM:
+    return exit_code;
+}
+
+//---------------------------------------------------------------------------
+// Coordinator mode (see --coordinate)
+//---------------------------------------------------------------------------
+
+// Maximum number of daemons driven by the coordinator
+#define COORDINATOR_MAX_NODES   64
+
+// Size of the buffer storing the results received from a daemon and not
+// processed yet. It must exceed the size of a record.
+#define COORDINATOR_BUFFER_SIZE 65536
+
+/**
+ * \struct node_t
+ * \brief A daemon (see --daemon) driven by the coordinator, typically
+ *    running on a remote vantage point whose UNIX socket is forwarded.
+ */
+
+typedef struct {
+    const char * path;                            /**< The UNIX socket of the daemon */
+    int          sockfd;                          /**< The connection to the daemon, -1 once it is closed */
+    char         buffer[COORDINATOR_BUFFER_SIZE]; /**< The results received and not processed yet */
+    size_t       buffer_size;                     /**< Number of bytes stored in buffer */
+    dynarray_t * pending;                         /**< The destinations (char *) requested and not traced yet */
+    size_t       num_done;                        /**< Number of destinations traced by this daemon */
+} node_t;
+
+/**
+ * \struct coordinator_t
+ * \brief State of the coordinator mode. Each daemon traces at most
+ *    max_running destinations at once, and is handed the next ones as it
+ *    completes them: the destinations are balanced according to the
+ *    throughput of each vantage point, without any static partition.
+ */
+
+typedef struct {
+    targets_t    targets;                     /**< The list of destinations */
+    deque_t    * retries;                     /**< The destinations (char *) whose daemon has left before tracing them */
+    bool         is_over;                     /**< True once the list of destinations is over */
+    node_t     * nodes[COORDINATOR_MAX_NODES]; /**< The daemons */
+    size_t       num_nodes;                   /**< Number of daemons */
+    size_t       num_connected;               /**< Number of daemons still connected */
+    size_t       max_running;                 /**< Maximum number of destinations traced at once by a daemon */
+    const char * algorithm_name;              /**< The algorithm run toward each destination */
+    const char * protocol_name;               /**< The protocol of the probes */
+    int          efd;                         /**< epoll (kqueue if USE_KQUEUE) instance watching the daemons */
+} coordinator_t;
+
+/**
+ * \brief Release a node_t instance from the memory, and close its
+ *    connection.
+ * \param node A node_t instance.
+ */
+
+static void node_free(node_t * node)
+{
+    if (node) {
+        if (node->sockfd != -1) close(node->sockfd);
+        dynarray_free(node->pending, free);
+        free(node);
+    }
+}
+
+/**
+ * \brief Connect to a daemon.
+ * \param path The UNIX socket of the daemon.
+ * \return The newly created node_t instance, NULL in case of failure.
+ */
+
+static node_t * node_create(const char * path)
+{
+    node_t             * node;
+    struct sockaddr_un   addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path) || strpbrk(path, "\"\\")) {
+        fprintf(stderr, "E: %s: invalid socket path\n", path);
+        goto ERR_PATH;
+    }
+    if (!(node = calloc(1, sizeof(node_t))))                      goto ERR_CALLOC;
+    node->path = path;
+    if (!(node->pending = dynarray_create()))                      goto ERR_PENDING;
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((node->sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) goto ERR_SOCKET;
+    if (connect(node->sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1) {
+        goto ERR_CONNECT;
+    }
+    return node;
+
+ERR_CONNECT:
+    close(node->sockfd);
+ERR_SOCKET:
+    perror(path);
+    dynarray_free(node->pending, NULL);
+ERR_PENDING:
+    free(node);
+ERR_CALLOC:
+ERR_PATH:
+    return NULL;
+}
+
+/**
+ * \brief Close the connection to a daemon. The destinations it has not
+ *    traced are handed to the other daemons.
+ * \param coordinator The coordinator_t instance.
+ * \param node The daemon.
+ */
+
+static void node_close(coordinator_t * coordinator, node_t * node)
+{
+    size_t i, num_pending = dynarray_get_size(node->pending);
+
+    for (i = 0; i < num_pending; i++) {
+        if (!deque_push_back(coordinator->retries, dynarray_get_ith_element(node->pending, i))) {
+            free(dynarray_get_ith_element(node->pending, i));
+        }
+    }
+    dynarray_clear(node->pending, NULL);
+    fprintf(stderr, "W: %s: connection closed, %zu destination(s) handed to the other vantage points\n", node->path, num_pending);
+
+    close(node->sockfd);
+    node->sockfd = -1;
+    coordinator->num_connected--;
+}
+
+/**
+ * \brief Retrieve the next destination to trace: the destinations whose
+ *    daemon has left, then the next ones of the list.
+ * \param coordinator The coordinator_t instance.
+ * \return The IP address of the destination (to be released by free),
+ *    NULL once there is no destination left.
+ */
+
+static char * coordinator_next_destination(coordinator_t * coordinator)
+{
+    address_t   dst_addr;
+    char        buffer[INET6_ADDRSTRLEN];
+    char      * dst_ip;
+    bool        is_resolved;
+
+    if (deque_get_size(coordinator->retries)) {
+        return deque_pop_front(coordinator->retries);
+    }
+
+    // The destinations are resolved once, so that the records of the
+    // daemons (see output.h) carry the same address.
+    while (!coordinator->is_over) {
+        if (!(dst_ip = targets_next(&coordinator->targets, &dst_addr, &is_resolved))) {
+            coordinator->is_over = true;
+            break;
+        }
+        if ((is_resolved || resolve_destination(dst_ip, &dst_addr))
+        &&  inet_ntop(dst_addr.family, &dst_addr.ip, buffer, sizeof(buffer))) {
+            return strdup(buffer);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Request a daemon to trace a destination.
+ * \param coordinator The coordinator_t instance.
+ * \param node The daemon.
+ * \param dst_ip The IP address of the destination. The node takes its
+ *    ownership.
+ * \return true iif successful.
+ */
+
+static bool node_request(const coordinator_t * coordinator, node_t * node, char * dst_ip)
+{
+    char   request[CONTROL_REQUEST_SIZE];
+    int    size;
+
+    size = snprintf(request, sizeof(request),
+        "{\"dst\":\"%s\",\"algorithm\":\"%s\",\"protocol\":\"%s\",\"min_ttl\":%u,\"max_ttl\":%u,\"num_queries\":%u}\n",
+        dst_ip,
+        coordinator->algorithm_name,
+        coordinator->protocol_name,
+        options_traceroute_get_min_ttl(),
+        options_traceroute_get_max_ttl(),
+        options_traceroute_get_num_queries()
+    );
+
+    // The destination is traced again by another daemon if this one leaves
+    if (!dynarray_push_element(node->pending, dst_ip)) {
+        free(dst_ip);
+        return false;
+    }
+    return send(node->sockfd, request, size, MSG_NOSIGNAL) == size;
+}
+
+/**
+ * \brief Hand to each daemon as many destinations as it may trace.
+ * \param coordinator The coordinator_t instance.
+ */
+
+static void coordinator_dispatch(coordinator_t * coordinator)
+{
+    node_t * node;
+    char   * dst_ip;
+    size_t   i;
+
+    for (i = 0; i < coordinator->num_nodes; i++) {
+        node = coordinator->nodes[i];
+        while (node->sockfd != -1 && dynarray_get_size(node->pending) < coordinator->max_running) {
+            if (!(dst_ip = coordinator_next_destination(coordinator))) return;
+            if (!node_request(coordinator, node, dst_ip)) node_close(coordinator, node);
+        }
+    }
+}
+
+/**
+ * \brief Process a record received from a daemon: copy it to the output,
+ *    tagged with the daemon, and release its destination once traced.
+ * \param node The daemon.
+ * \param record The record (a JSON object), ending with '\n'.
+ * \param size The size of the record.
+ * \return true iif successful.
+ */
+
+static bool node_process_record(node_t * node, const char * record, size_t size)
+{
+    static const char   dst_key[] = "\"dst\":\"";
+    const char        * dst_ip, * end;
+    size_t              i, num_pending;
+
+    if (record[0] != '{') return false;
+    if (!output_printf(output, "{\"vp\":\"%s\",", node->path)
+    ||  !output_append(output, record + 1, size - 1)) {
+        return false;
+    }
+
+    // A measurement ends with an "end" record, or a "reject" record.
+    if (strncmp(record, "{\"type\":\"end\"", 13) != 0 && strncmp(record, "{\"type\":\"reject\"", 16) != 0) {
+        return true;
+    }
+    node->num_done++;
+    num_pending = dynarray_get_size(node->pending);
+    if (!num_pending) return true;
+
+    // The requests rejected before their dst was parsed are released in order
+    if (!(dst_ip = strstr(record, dst_key)) || !(end = strchr(dst_ip += sizeof(dst_key) - 1, '"'))) {
+        return dynarray_del_ith_element(node->pending, 0, free);
+    }
+    for (i = 0; i < num_pending; i++) {
+        if (strncmp(dynarray_get_ith_element(node->pending, i), dst_ip, end - dst_ip) == 0
+        &&  ((char *) dynarray_get_ith_element(node->pending, i))[end - dst_ip] == '\0') {
+            return dynarray_del_ith_element(node->pending, i, free);
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Read the records received from a daemon.
+ * \param coordinator The coordinator_t instance.
+ * \param node The daemon.
+ */
+
+static void node_receive(coordinator_t * coordinator, node_t * node)
+{
+    ssize_t   num_bytes;
+    char    * record, * end;
+
+    for (;;) {
+        num_bytes = recv(node->sockfd, node->buffer + node->buffer_size, COORDINATOR_BUFFER_SIZE - node->buffer_size, MSG_DONTWAIT);
+        if (num_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (num_bytes <= 0) goto CLOSE;
+        node->buffer_size += num_bytes;
+
+        // Process the complete records
+        for (record = node->buffer; (end = memchr(record, '\n', node->buffer + node->buffer_size - record)); record = end + 1) {
+            if (!node_process_record(node, record, end + 1 - record)) {
+                fprintf(stderr, "E: %s: invalid record\n", node->path);
+                goto CLOSE;
+            }
+        }
+        node->buffer_size -= record - node->buffer;
+        memmove(node->buffer, record, node->buffer_size);
+        if (node->buffer_size == COORDINATOR_BUFFER_SIZE) {
+            fprintf(stderr, "E: %s: record too long\n", node->path);
+            goto CLOSE;
+        }
+    }
+    return;
+
+CLOSE:
+    node_close(coordinator, node);
+}
+
+/**
+ * \brief Run the coordinator mode (see --coordinate): the destinations
+ *    listed in the file passed with -F are traced by the daemons (see
+ *    --daemon) listening on the UNIX sockets passed with --coordinate, and
+ *    their results are merged in the structured output.
+ * \param paths The comma-separated UNIX sockets of the daemons.
+ * \param algorithm_name The algorithm passed with -a.
+ * \param use_icmp Pass true to probe using ICMP.
+ * \param use_tcp Pass true to probe using TCP.
+ * \return The exit code of the program.
+ */
+
+static int coordinator_run(char * paths, const char * algorithm_name, bool use_icmp, bool use_tcp)
+{
+    int                  exit_code = EXIT_FAILURE;
+    coordinator_t        coordinator;
+#ifdef USE_KQUEUE
+    struct kevent        event, events[COORDINATOR_MAX_NODES];
+#else
+    struct epoll_event   event, events[COORDINATOR_MAX_NODES];
+#endif
+    char               * path, * saveptr;
+    node_t             * node;
+    size_t               i, num_done = 0;
+    int                  n;
+
+    if (strcmp(algorithm_name, "paris-traceroute") != 0 && !is_mda(algorithm_name)) {
+        fprintf(stderr, "E: --coordinate does not support the %s algorithm\n", algorithm_name);
+        goto ERR_ALGORITHM;
+    }
+
+    memset(&coordinator, 0, sizeof(coordinator_t));
+    coordinator.max_running    = concurrency[0];
+    coordinator.algorithm_name = algorithm_name;
+    coordinator.protocol_name  = use_icmp ? "icmp" : use_tcp ? "tcp" : "udp";
+
+#ifdef USE_KQUEUE
+    if ((coordinator.efd = kqueue()) == -1) {
+        perror("Error kqueue");
+        goto ERR_EPOLL_CREATE;
+    }
+#else
+    if ((coordinator.efd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("Error epoll_create1");
+        goto ERR_EPOLL_CREATE;
+    }
+#endif
+    if (!(coordinator.retries = deque_create()))                     goto ERR_RETRIES;
+    if (!targets_open(&coordinator.targets, targets_filename.s))   goto ERR_TARGETS_OPEN;
+
+    // Connect to the daemons
+    for (path = strtok_r(paths, ",", &saveptr); path; path = strtok_r(NULL, ",", &saveptr)) {
+        if (coordinator.num_nodes == COORDINATOR_MAX_NODES) {
+            fprintf(stderr, "E: --coordinate supports at most %d daemons\n", COORDINATOR_MAX_NODES);
+            goto ERR_NODE_CREATE;
+        }
+        if (!(node = node_create(path)))                            goto ERR_NODE_CREATE;
+        coordinator.nodes[coordinator.num_nodes++] = node;
+
+#ifdef USE_KQUEUE
+        EV_SET(&event, node->sockfd, EVFILT_READ, EV_ADD, 0, 0, node);
+        if (kevent(coordinator.efd, &event, 1, NULL, 0, NULL) == -1) {
+            perror("Error kevent");
+            goto ERR_EPOLL_CTL;
+        }
+#else
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events   = EPOLLIN;
+        event.data.ptr = node;
+        if (epoll_ctl(coordinator.efd, EPOLL_CTL_ADD, node->sockfd, &event) == -1) {
+            perror("Error epoll_ctl");
+            goto ERR_EPOLL_CTL;
+        }
+#endif
+    }
+    coordinator.num_connected = coordinator.num_nodes;
+
+    // Each daemon is handed a new destination whenever it completes one
+    for (coordinator_dispatch(&coordinator); coordinator.num_connected; coordinator_dispatch(&coordinator)) {
+        for (i = 0; i < coordinator.num_nodes; i++) {
+            if (dynarray_get_size(coordinator.nodes[i]->pending)) break;
+        }
+        if (i == coordinator.num_nodes) break;
+
+#ifdef USE_KQUEUE
+        if ((n = kevent(coordinator.efd, NULL, 0, events, COORDINATOR_MAX_NODES, NULL)) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error kevent");
+            goto ERR_EPOLL_WAIT;
+        }
+#else
+        if ((n = epoll_wait(coordinator.efd, events, COORDINATOR_MAX_NODES, -1)) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error epoll_wait");
+            goto ERR_EPOLL_WAIT;
+        }
+#endif
+        while (n--) {
+#ifdef USE_KQUEUE
+            node = (node_t *) events[n].udata;
+#else
+            node = events[n].data.ptr;
+#endif
+            if (node->sockfd != -1) node_receive(&coordinator, node);
+        }
+        output_flush(output);
+    }
+
+    for (i = 0; i < coordinator.num_nodes; i++) {
+        num_done += coordinator.nodes[i]->num_done;
+        fprintf(stderr, "%s: %zu destination(s) traced\n", coordinator.nodes[i]->path, coordinator.nodes[i]->num_done);
+    }
+    if (!coordinator.is_over || deque_get_size(coordinator.retries)) {
+        fprintf(stderr, "E: every vantage point has left, %zu destination(s) traced\n", num_done);
+    } else {
+        exit_code = EXIT_SUCCESS;
+    }
+
+ERR_EPOLL_WAIT:
+ERR_EPOLL_CTL:
+ERR_NODE_CREATE:
+    for (i = 0; i < coordinator.num_nodes; i++) {
+        node_free(coordinator.nodes[i]);
+    }
+    targets_close(&coordinator.targets);
+ERR_TARGETS_OPEN:
+    deque_free(coordinator.retries, free);
+ERR_RETRIES:
+    close(coordinator.efd);
+ERR_EPOLL_CREATE:
+ERR_ALGORITHM:
+    return exit_code;
+}
+
+//---------------------------------------------------------------------------
+// Demultiplexer mode (see --demux-server)
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Route the replies received by this host to the processes
+ *    connected to the demultiplexer, until SIGINT or SIGTERM is received.
+ * \return EXIT_SUCCESS iif successful.
+ */
+
+static int demux_run()
+{
+    int              exit_code = EXIT_FAILURE;
+    demux_server_t * server;
+
+    if (!(server = demux_server_create(demux_server_path.s))) {
+        fprintf(stderr, "E: Cannot listen to %s\n", demux_server_path.s);
+        goto ERR_DEMUX_SERVER_CREATE;
+    }
+
+    if (demux_server_run(server)) exit_code = EXIT_SUCCESS;
+    demux_server_dump(server, stderr);
+    demux_server_free(server);
+
+ERR_DEMUX_SERVER_CREATE:
+    return exit_code;
+}
+
+//---------------------------------------------------------------------------
+// Broker mode (see --broker-server)
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Hand the raw sockets over to the processes connected to the
+ *    broker, until SIGINT or SIGTERM is received.
+ * \return EXIT_SUCCESS iif successful.
+ */
+
+static int broker_run()
+{
+    int               exit_code = EXIT_FAILURE;
+    broker_server_t * server;
+
+    if (!(server = broker_server_create(broker_server_path.s, broker_buffer[0]))) {
+        fprintf(stderr, "E: Cannot listen to %s\n", broker_server_path.s);
+        goto ERR_BROKER_SERVER_CREATE;
+    }
+
+    if (broker_server_run(server)) exit_code = EXIT_SUCCESS;
+    broker_server_dump(server, stderr);
+    broker_server_free(server);
+
+ERR_BROKER_SERVER_CREATE:
+    return exit_code;
+}
+
+/**
+ * \brief Build (if requested) and open the AS map passed to --asmap.
+ * \param pasmap Address of an asmap_t *, where the AS map is written
+ *    (NULL if --asmap is not set).
+ * \return true iif successful.
+ */
+
+static bool load_asmap(asmap_t ** pasmap)
+{
+    *pasmap = NULL;
+
+    if (pfx2as_filename.s && !asmap_filename.s) {
+        fprintf(stderr, "--pfx2as requires --asmap\n");
+        return false;
+    }
+
+    if (!asmap_filename.s) return true;
+
+    if (pfx2as_filename.s && !asmap_build(pfx2as_filename.s, asmap_filename.s)) {
+        return false;
+    }
+
+    if (!(*pasmap = asmap_open(asmap_filename.s))) {
+        return false;
+    }
+
+    whois_set_asmap(*pasmap);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Main program
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Archive queries (see --query)
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Parse a time passed in a query.
+ * \param value The time: a number of seconds since the Epoch, or a number
+ *    of seconds (minutes, hours, days with the suffix 'm', 'h', 'd') ago
+ *    prefixed with '-'.
+ * \param ptime Address of an uint64_t, where the time is written (in
+ *    nanoseconds since the Epoch).
+ * \return true iif successful.
+ */
+
+static bool parse_query_time(const char * value, uint64_t * ptime)
+{
+    char     * end;
+    double     x = strtod(value, &end);
+    time_t     now = time(NULL);
+
+    switch (*end) {
+        case 'm': x *= 60;    end++; break;
+        case 'h': x *= 3600;  end++; break;
+        case 'd': x *= 86400; end++; break;
+        default: break;
+    }
+    if (end == value || *end) return false;
+
+    if (x < 0) x += now;
+    if (x < 0) x = 0;
+    *ptime = x * 1e9;
+    return true;
+}
+
+/**
+ * \brief Parse a query (see --query).
+ * \param s The query.
+ * \param query The archive_query_t to fill.
+ * \param dst_addr Where the destination of the query is stored.
+ * \param interface Where the interface of the query is stored.
+ * \return true iif successful.
+ */
+
+static bool parse_query(char * s, archive_query_t * query, address_t * dst_addr, address_t * interface)
+{
+    char          * criterion,
+                  * value,
+                  * end,
+                  * saveptr;
+    address_t     * address;
+    unsigned long   asn;
+
+    memset(query, 0, sizeof(archive_query_t));
+    for (criterion = strtok_r(s, ",", &saveptr); criterion; criterion = strtok_r(NULL, ",", &saveptr)) {
+        if (!(value = strchr(criterion, '='))) goto ERR_INVALID_CRITERION;
+        *value++ = '\0';
+
+        if (strcmp(criterion, "dst") == 0 || strcmp(criterion, "via") == 0) {
+            address = criterion[0] == 'd' ? dst_addr : interface;
+            memset(address, 0, sizeof(address_t));
+            if (inet_pton(AF_INET, value, &address->ip.ipv4) == 1) {
+                address->family = AF_INET;
+            } else if (inet_pton(AF_INET6, value, &address->ip.ipv6) == 1) {
+                address->family = AF_INET6;
+            } else {
+                goto ERR_INVALID_CRITERION;
+            }
+            if (address == dst_addr) query->dst       = dst_addr;
+            else                     query->interface = interface;
+        } else if (strcmp(criterion, "asn") == 0) {
+            asn = strtoul(value, &end, 10);
+            if (!*value || *end || asn == 0 || asn > UINT32_MAX) goto ERR_INVALID_CRITERION;
+            query->asn = asn;
+        } else if (strcmp(criterion, "since") == 0) {
+            if (!parse_query_time(value, &query->time_min)) goto ERR_INVALID_CRITERION;
+        } else if (strcmp(criterion, "until") == 0) {
+            if (!parse_query_time(value, &query->time_max)) goto ERR_INVALID_CRITERION;
+        } else {
+            goto ERR_INVALID_CRITERION;
+        }
+    }
+    return true;
+
+ERR_INVALID_CRITERION:
+    fprintf(stderr, "--query: invalid criterion '%s'\n", criterion);
+    return false;
+}
+
+/**
+ * \brief Write an archived record in the structured output.
+ * \param archive_record The record.
+ * \param data The output_t instance.
+ * \return true iif successful.
+ */
+
+static bool query_output(const archive_record_t * archive_record, void * data)
+{
+    output_record_t record;
+    address_t       dst_addr, from, to;
+
+    memset(&record, 0, sizeof(output_record_t));
+    record.type = archive_record->type;
+    record.time = archive_record->time;
+    record.rtt  = archive_record->rtt;
+    record.asn  = archive_record->asn;
+    record.ttl  = archive_record->ttl;
+    if (archive_address_get(&archive_record->dst,  &dst_addr)) record.dst  = &dst_addr;
+    if (archive_address_get(&archive_record->from, &from))     record.from = &from;
+    if (archive_address_get(&archive_record->to,   &to))       record.to   = &to;
+    if (record.type == OUTPUT_RECORD_TRACE) {
+        record.max_ttl   = archive_record->ttl;
+        record.size      = archive_record->size;
+        record.algorithm = "";
+    }
+    return output_write_record(data, &record);
+}
+
+/**
+ * \brief Print the records of the archive matching the query passed
+ *    with --query.
+ * \param format_name The output format.
+ * \return EXIT_SUCCESS iif successful.
+ */
+
+static int query_run(const char * format_name)
+{
+    int                exit_code = EXIT_FAILURE;
+    archive_reader_t * reader;
+    archive_query_t    query;
+    address_t          dst_addr, interface;
+    output_t         * out;
+
+    if (!parse_query(query_string.s, &query, &dst_addr, &interface)) goto ERR_PARSE_QUERY;
+    if (!(reader = archive_reader_open(archive_directory.s)))       goto ERR_ARCHIVE_READER_OPEN;
+    if (!(out = output_create(STDOUT_FILENO, strcmp(format_name, "text") == 0 ? "json" : format_name, compression_name.s))) {
+        goto ERR_OUTPUT_CREATE;
+    }
+
+    archive_reader_find(reader, &query, query_output, out);
+    output_free(out);
+    exit_code = EXIT_SUCCESS;
+
+ERR_OUTPUT_CREATE:
+    archive_reader_close(reader);
+ERR_ARCHIVE_READER_OPEN:
+ERR_PARSE_QUERY:
+    return exit_code;
+}
+
+int main(int argc, char ** argv)
+{
+    int                       exit_code = EXIT_FAILURE;
+    char                    * version = strdup("version 1.0");
+    const char              * usage = "usage: %s [options] {host | -F FILE | --daemon PATH | --demux-server PATH | --broker-server PATH | --query QUERY}\n";
+    void                    * algorithm_options;
+    traceroute_options_t      traceroute_options;
+    traceroute_options_t    * ptraceroute_options;
+    mda_options_t             mda_options;
+    pmtud_options_t           pmtud_options;
+    monitor_options_t         monitor_options;
+    probe_t                 * probe;
+    pt_loop_t               * loop;
+    address_t                 dst_addr;
+    options_t               * options;
+    char                    * dst_ip;
+    const char              * algorithm_name;
+    const char              * protocol_name;
+    const char              * format_name;
+    bool                      use_icmp, use_udp, use_tcp;
+    asmap_t                 * asmap;
+    archive_writer_t        * archive = NULL;
+
+    // Prepare the commande line options
+    if (!(options = init_options(version))) {
+        fprintf(stderr, "E: Can't initialize options\n");
+        goto ERR_INIT_OPTIONS;
+    }
+
+    // Retrieve values passed in the command-line
+    if (options_parse(options, usage, argv) != (targets_filename.s || daemon_path.s || demux_server_path.s || broker_server_path.s || query_string.s ? 0 : 1)) {
+        fprintf(stderr, targets_filename.s || daemon_path.s || demux_server_path.s || broker_server_path.s || query_string.s ?
+            "%s: no destination expected when using -F, --daemon, --demux-server, --broker-server or --query\n" :
+            "%s: destination required\n",
+            basename(argv[0])
+        );
+        goto ERR_OPT_PARSE;
+    }
+
+    // We assume that the target IP address is always the last argument
+    dst_ip         = argv[argc - 1];
+    algorithm_name = algorithm_names[0];
+    protocol_name  = protocol_names[0];
+    format_name    = format_names[0];
+
+    // Checking if there is any conflicts between options passed in the commandline
+    if (!check_options(is_icmp, is_tcp, is_udp, is_ipv4, is_ipv6, dst_port[3], src_port[3], protocol_name, algorithm_name)) {
+        goto ERR_CHECK_OPTIONS;
+    }
+
+    if ((checkpoint_filename.s || is_resume) && !targets_filename.s) {
+        fprintf(stderr, "--checkpoint and --resume require -F\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (is_resume && !checkpoint_filename.s) {
+        fprintf(stderr, "--resume requires --checkpoint\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (daemon_path.s && targets_filename.s) {
+        fprintf(stderr, "Cannot use simultaneously -F and --daemon\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (coordinate_paths.s && (!targets_filename.s || checkpoint_filename.s)) {
+        fprintf(stderr, "--coordinate requires -F and does not support --checkpoint\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (coordinate_paths.s && strcmp(format_name, "json") != 0) {
+        fprintf(stderr, "--coordinate requires --format json\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (is_aliases && (daemon_path.s || coordinate_paths.s)) {
+        fprintf(stderr, "--aliases is not supported by --daemon and --coordinate\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (daemon_path.s && compression_name.s && strcmp(compression_name.s, "none") != 0) {
+        fprintf(stderr, "--compress is not supported by --daemon\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (archive_directory.s && (daemon_path.s || coordinate_paths.s)) {
+        fprintf(stderr, "--archive is not supported by --daemon and --coordinate\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (query_string.s && !archive_directory.s) {
+        fprintf(stderr, "--query requires --archive\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+    if (archive_directory.s && !query_string.s && strcmp(format_name, "text") == 0) {
+        fprintf(stderr, "--archive requires --format\n");
+        goto ERR_CHECK_OPTIONS;
+    }
+
+    // The archive is only read
+    if (query_string.s) {
+        if (targets_filename.s || daemon_path.s) {
+            fprintf(stderr, "Cannot use -F or --daemon with --query\n");
+            goto ERR_CHECK_OPTIONS;
+        }
+        exit_code = query_run(format_name);
+        goto SERVER_DONE;
+    }
+
+    // The demultiplexer does not send any probe
+    if (demux_server_path.s) {
+        if (targets_filename.s || daemon_path.s) {
+            fprintf(stderr, "Cannot use -F or --daemon with --demux-server\n");
+            goto ERR_CHECK_OPTIONS;
+        }
+        exit_code = demux_run();
+        goto SERVER_DONE;
+    }
+
+    // Nor does the broker
+    if (broker_server_path.s) {
+        if (targets_filename.s || daemon_path.s) {
+            fprintf(stderr, "Cannot use -F or --daemon with --broker-server\n");
+            goto ERR_CHECK_OPTIONS;
+        }
+        exit_code = broker_run();
+        goto SERVER_DONE;
+    }
+
+    use_icmp = is_icmp || strcmp(protocol_name, "icmp") == 0;
+    use_tcp  = is_tcp  || strcmp(protocol_name, "tcp")  == 0;
+    use_udp  = is_udp  || strcmp(protocol_name, "udp")  == 0;
+
+    if (cache_filename.s && !cachefile_open(cache_filename.s)) {
+        goto ERR_CACHEFILE_OPEN;
+    }
+
+    if (options_mda_get_cache_filename() && !mda_topology_open(options_mda_get_cache_filename())) {
+        goto ERR_MDA_TOPOLOGY_OPEN;
+    }
+
+    if (!load_asmap(&asmap)) {
+        goto ERR_LOAD_ASMAP;
+    }
+
+    // Each client of the daemon has its own output
+    if (daemon_path.s) {
+        exit_code = daemon_run(algorithm_name, format_name, use_icmp, use_tcp, use_udp);
+        goto DAEMON_DONE;
+    }
+
+    // The text output is printed through stdout, a structured output is
+    // buffered (and compressed) by the output_t instance.
+    if (strcmp(format_name, "text") == 0) {
+        if (compression_name.s && strcmp(compression_name.s, "none") != 0) {
+            fprintf(stderr, "--compress requires --format\n");
+            goto ERR_OUTPUT_CREATE;
+        }
+    } else if (strcmp(algorithm_name, "pmtud") == 0) {
+        fprintf(stderr, "E: -a pmtud only supports the text output\n");
+        goto ERR_OUTPUT_CREATE;
+    } else if (!(output = output_create(STDOUT_FILENO, format_name, compression_name.s))) {
+        goto ERR_OUTPUT_CREATE;
+    }
+
+    // The records of the structured output are also archived
+    if (archive_directory.s) {
+        if (!(archive = archive_writer_create(archive_directory.s))) goto ERR_ARCHIVE_WRITER_CREATE;
+        output_set_archive(output, archive);
+    }
+
+    // The daemons trace the destinations
+    if (coordinate_paths.s) {
+        exit_code = coordinator_run(coordinate_paths.s, algorithm_name, use_icmp, use_tcp);
+        goto BATCH_DONE;
+    }
+
+    if (targets_filename.s) {
+        exit_code = batch_run(algorithm_name, use_icmp, use_tcp, use_udp);
+        goto BATCH_DONE;
+    }
+
+    if (!resolve_destination(dst_ip, &dst_addr)) {
+        goto ERR_RESOLVE_DESTINATION;
+    }
+
+    if (!(probe = make_probe_skel(&dst_addr, use_icmp, use_tcp, use_udp))) {
+        goto ERR_PROBE_CREATE;
+    }
+
+    // Algorithm options (dedicated options)
+    if (strcmp(algorithm_name, "paris-traceroute") == 0) {
+        traceroute_options  = traceroute_get_default_options();
+        ptraceroute_options = &traceroute_options;
+        algorithm_options   = &traceroute_options;
+        algorithm_name      = "traceroute";
+    } else if (is_mda(algorithm_name) || options_mda_get_is_set()) {
+        mda_options         = mda_get_default_options();
+        ptraceroute_options = &mda_options.traceroute_options;
+        algorithm_options   = &mda_options;
+        options_mda_init(&mda_options);
+    } else if (strcmp(algorithm_name, "pmtud") == 0) {
+        pmtud_options       = pmtud_get_default_options();
+        ptraceroute_options = &pmtud_options.traceroute_options;
+        algorithm_options   = &pmtud_options;
+        options_pmtud_init(&pmtud_options);
+        if (dst_addr.family == AF_INET6 && pmtud_options.max_mtu < PMTUD_IPV6_MIN_MTU) {
+            fprintf(stderr, "E: --max-mtu must be at least %d in IPv6\n", PMTUD_IPV6_MIN_MTU);
+            errno = EINVAL;
+            goto ERR_UNKNOWN_ALGORITHM;
+        }
+    } else if (strcmp(algorithm_name, "monitor") == 0) {
+        monitor_options     = monitor_get_default_options();
+        ptraceroute_options = &monitor_options.traceroute_options;
+        algorithm_options   = &monitor_options;
+        options_monitor_init(&monitor_options);
+    } else {
+        fprintf(stderr, "E: Unknown algorithm");
+        goto ERR_UNKNOWN_ALGORITHM;
+    }
+
+    // Algorithm options (common options)
+    options_traceroute_init(ptraceroute_options, &dst_addr);
+
+    // Create libparistraceroute loop
+    if (!(loop = pt_loop_create(loop_handler, NULL))) {
+        fprintf(stderr, "E: Cannot create libparistraceroute loop");
+        goto ERR_LOOP_CREATE;
+    }
+
+    // Set network options (network and verbose)
+    options_network_init(loop->network, is_debug);
+
+    if (output) {
+        header_output(output, algorithm_name, &dst_addr, ptraceroute_options->max_ttl, probe);
+    } else {
+        header_fdump(stdout, algorithm_name, dst_ip, &dst_addr, ptraceroute_options->max_ttl, probe);
+    }
+
+    // Add an algorithm instance in the main loop
+    if (!pt_add_instance(loop, algorithm_name, algorithm_options, probe)) {
+        fprintf(stderr, "E: Cannot add the chosen algorithm");
+        goto ERR_INSTANCE;
+    }
+
+    // Wait for events. They will be catched by handler_user()
+    if (pt_loop(loop, 0) < 0) {
+        fprintf(stderr, "E: Main loop interrupted");
+        goto ERR_PT_LOOP;
+    }
+    exit_code = EXIT_SUCCESS;
+
+    // Leave the program
+ERR_PT_LOOP:
+ERR_INSTANCE:
+    // pt_loop_free() automatically removes algorithms instances,
+    // probe_replies and events from the memory.
+    // Options and probe must be manually removed.
+    pt_loop_free(loop);
+ERR_LOOP_CREATE:
+ERR_UNKNOWN_ALGORITHM:
+    probe_free(probe);
+ERR_PROBE_CREATE:
+ERR_RESOLVE_DESTINATION:
+    if (exit_code != EXIT_SUCCESS && errno) perror(gai_strerror(errno));
+BATCH_DONE:
+    aliases_free();
+ERR_ARCHIVE_WRITER_CREATE:
+    output_free(output);
+    archive_writer_free(archive);
+ERR_OUTPUT_CREATE:
+DAEMON_DONE:
+    whois_set_asmap(NULL);
+    asmap_close(asmap);
+ERR_LOAD_ASMAP:
+    mda_topology_close();
+ERR_MDA_TOPOLOGY_OPEN:
+    cachefile_close();
+ERR_CACHEFILE_OPEN:
+SERVER_DONE:
+ERR_CHECK_OPTIONS:
+ERR_OPT_PARSE:
+ERR_INIT_OPTIONS:
+    free(version);
+    exit(exit_code);
+}